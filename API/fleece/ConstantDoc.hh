@@ -0,0 +1,459 @@
+//
+// ConstantDoc.hh
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+
+#pragma once
+#ifndef _FLEECE_CONSTANTDOC_HH
+#define _FLEECE_CONSTANTDOC_HH
+#include "Fleece.hh"
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace fleece {
+
+    /*  Builds Fleece documents at compile time, so constant data such as default configurations
+        or canned responses costs nothing at runtime and lives in read-only memory. For example:
+
+            using namespace fleece::constdoc;
+            static constexpr auto kDefaults = FLEECE_CONSTANT_DOC(
+                dictOf(entry("hosts",   arrayOf("a.example.com", "b.example.com")),
+                       entry("retries", 3),
+                       entry("timeout", 2.5),
+                       entry("verbose", false)));
+
+            Dict defaults = kDefaults.root().asDict();
+
+        The output is byte-for-byte what an Encoder with default settings would produce from the
+        same values: Dict keys are sorted at compile time, and short strings are written once.
+        Values can be bools, integers, floating-point numbers, string literals or string_views,
+        `nullptr` (or `null()`), and nested `arrayOf`s and `dictOf`s. A document too large for
+        narrow (2-byte) pointers, a duplicate Dict key, or a NaN fails to compile. A negative zero
+        is encoded as zero, since its sign bit can't be read in a constant expression before C++20.
+        (The names aren't `array` and `dict` because those would clash with `std::array`.) */
+
+
+    /** Fleece data encoded at compile time: a `std::array` of bytes, aligned as Fleece requires. */
+    template <size_t N>
+    struct alignas(2) ConstantDoc : std::array<uint8_t,N> {
+        slice bytes() const noexcept    {return slice(this->data(), N);}
+        operator slice() const noexcept {return bytes();}
+
+        /** The root Value. It points into this object, so it's valid as long as this is. */
+        Value root() const noexcept     {return Value::fromData(bytes(), kFLTrusted);}
+    };
+
+
+    namespace constdoc {
+
+        namespace detail {
+
+            // How a Value is referred to from its container (or from the trailer): either its
+            // 2-byte inline form, or a pointer to its position in the output.
+            struct Slot {
+                uint8_t byte0 = 0, byte1 = 0;
+                size_t  target = 0;
+                bool    isPointer = false;
+            };
+
+            struct StringRef {
+                const char *chars = nullptr;
+                size_t      size = 0;
+            };
+
+            // These match the rules the Encoder uses, so the output is identical:
+            constexpr size_t kMaxNarrowOffset = 0x7FFE;
+            constexpr size_t kMaxSharedStringSize = 15;
+            constexpr size_t kLongArrayCount = 0x07FF;
+
+            // Orders strings like FLSlice_Compare, i.e. the order of a Dict's keys.
+            constexpr int compare(StringRef a, StringRef b) {
+                size_t n = (a.size < b.size) ? a.size : b.size;
+                for (size_t i = 0; i < n; ++i) {
+                    auto ca = uint8_t(a.chars[i]), cb = uint8_t(b.chars[i]);
+                    if (ca != cb)
+                        return (ca < cb) ? -1 : 1;
+                }
+                return (a.size == b.size) ? 0 : ((a.size < b.size) ? -1 : 1);
+            }
+
+            // Writes encoded data. With a Capacity of 0 it only counts the bytes, which is how
+            // the size of the output is determined before it's written.
+            template <size_t Capacity, size_t MaxStrings>
+            struct Writer {
+                std::array<uint8_t,Capacity>    out {};
+                size_t                          pos = 0;
+                std::array<StringRef,MaxStrings> strings {};
+                std::array<size_t,MaxStrings>   stringPos {};
+                size_t                          nStrings = 0;
+
+                constexpr void put(uint8_t b) {
+                    if constexpr (Capacity > 0)
+                        out[pos] = b;
+                    ++pos;
+                }
+
+                constexpr void putVarInt(uint64_t n) {
+                    while (n >= 0x80) {
+                        put(uint8_t((n & 0xFF) | 0x80));
+                        n >>= 7;
+                    }
+                    put(uint8_t(n));
+                }
+
+                constexpr void pad() {
+                    if (pos & 1)
+                        put(0);
+                }
+
+                constexpr void putSlot(const Slot &slot) {
+                    if (slot.isPointer) {
+                        size_t offset = pos - slot.target;
+                        if (offset > kMaxNarrowOffset)
+                            throw "constant doc is too large for narrow pointers";
+                        auto p = uint16_t(0x8000 | (offset >> 1));
+                        put(uint8_t(p >> 8));
+                        put(uint8_t(p & 0xFF));
+                    } else {
+                        put(slot.byte0);
+                        put(slot.byte1);
+                    }
+                }
+
+                // Writes a collection's header and its slots, returning a pointer to it.
+                constexpr Slot putCollection(uint8_t tag, const Slot slots[], size_t nSlots,
+                                             size_t count) {
+                    size_t start = pos;
+                    size_t inlineCount = (count < kLongArrayCount) ? count : kLongArrayCount;
+                    put(uint8_t((tag << 4) | (inlineCount >> 8)));
+                    put(uint8_t(inlineCount & 0xFF));
+                    if (count >= kLongArrayCount)
+                        putVarInt(count - kLongArrayCount);
+                    pad();
+                    for (size_t i = 0; i < nSlots; ++i)
+                        putSlot(slots[i]);
+                    return {0, 0, start, true};
+                }
+
+                // Looks up a string written earlier, returning its position or SIZE_MAX.
+                constexpr size_t findString(StringRef s) const {
+                    for (size_t i = 0; i < nStrings; ++i)
+                        if (compare(strings[i], s) == 0)
+                            return stringPos[i];
+                    return SIZE_MAX;
+                }
+
+                constexpr void addString(StringRef s, size_t at) {
+                    for (size_t i = 0; i < nStrings; ++i) {
+                        if (compare(strings[i], s) == 0) {
+                            stringPos[i] = at;
+                            return;
+                        }
+                    }
+                    strings[nStrings] = s;
+                    stringPos[nStrings++] = at;
+                }
+            };
+
+
+            // Returns the IEEE 754 bits of a finite number exactly representable in a format with
+            // `MantBits` mantissa bits and `ExpBits` exponent bits.
+            template <int MantBits, int ExpBits>
+            constexpr uint64_t ieeeBits(double n) {
+                constexpr int bias = (1 << (ExpBits - 1)) - 1;
+                if (n == 0)
+                    return 0;
+                uint64_t sign = 0;
+                if (n < 0) {
+                    sign = uint64_t(1) << (MantBits + ExpBits);
+                    n = -n;
+                }
+                int exp = 0;
+                while (n >= 2) { n /= 2; ++exp; }
+                while (n < 1)  { n *= 2; --exp; }
+                uint64_t biased = 0;
+                if (exp + bias > 0) {
+                    biased = uint64_t(exp + bias);
+                    n -= 1;
+                    for (int i = 0; i < MantBits; ++i)
+                        n *= 2;
+                } else {
+                    // Subnormal: no implicit leading 1.
+                    for (int i = 0; i < MantBits - 1 + exp + bias; ++i)
+                        n *= 2;
+                }
+                return sign | (biased << MantBits) | uint64_t(n);
+            }
+
+
+            struct Null {
+                static constexpr size_t kStringCount = 0;
+                template <class W> constexpr Slot place(W&) const   {return {0x30, 0};}
+            };
+
+            struct Bool {
+                bool value;
+                static constexpr size_t kStringCount = 0;
+                template <class W> constexpr Slot place(W&) const {
+                    return {uint8_t(value ? 0x38 : 0x34), 0};
+                }
+            };
+
+            struct Int {
+                uint64_t value;
+                bool     isUnsigned;
+                static constexpr size_t kStringCount = 0;
+
+                template <class W> constexpr Slot place(W &w) const {
+                    bool small = isUnsigned ? (value < 2048)
+                                            : (int64_t(value) < 2048 && int64_t(value) >= -2048);
+                    if (small)
+                        return {uint8_t((value >> 8) & 0x0F), uint8_t(value & 0xFF)};
+                    // Same length as PutIntOfLength: skip the trailing (high) sign-extension
+                    // bytes, but keep one if the sign wouldn't be discoverable:
+                    uint8_t trim = (!isUnsigned && int64_t(value) < 0) ? 0xFF : 0x00;
+                    size_t size = 8;
+                    for (; size > 1; --size) {
+                        auto b = uint8_t(value >> (8 * (size - 1)));
+                        if (b != trim) {
+                            if (!isUnsigned && ((b ^ trim) & 0x80))
+                                ++size;
+                            break;
+                        }
+                    }
+                    size_t start = w.pos;
+                    w.put(uint8_t(0x10 | (isUnsigned ? 0x08 : 0) | (size - 1)));
+                    for (size_t i = 0; i < size; ++i)
+                        w.put(uint8_t(value >> (8 * i)));
+                    w.pad();
+                    return {0, 0, start, true};
+                }
+            };
+
+            struct Float {
+                double value;
+                static constexpr size_t kStringCount = 0;
+
+                template <class W> constexpr Slot place(W &w) const {
+                    if (value != value)
+                        throw "Can't write NaN";
+                    double magnitude = (value < 0) ? -value : value;
+                    bool isFloat = (magnitude <= 3.40282346638528859811704183484516925e+38
+                                    && value == double(float(value)));
+                    size_t start = w.pos;
+                    uint64_t bits = 0;
+                    int nBytes = 0;
+                    if (isFloat) {
+                        bits = ieeeBits<23,8>(value);
+                        nBytes = 4;
+                        w.put(0x20);
+                    } else {
+                        bits = ieeeBits<52,11>(value);
+                        nBytes = 8;
+                        w.put(0x28);
+                    }
+                    w.put(0);
+                    for (int i = 0; i < nBytes; ++i)
+                        w.put(uint8_t(bits >> (8 * i)));
+                    return {0, 0, start, true};
+                }
+            };
+
+            struct String {
+                StringRef str;
+                static constexpr size_t kStringCount = 1;
+
+                template <class W> constexpr Slot place(W &w) const {
+                    if (str.size < 2)
+                        return {uint8_t(0x40 | str.size), uint8_t(str.size ? str.chars[0] : 0)};
+                    bool unique = (str.size <= kMaxSharedStringSize);
+                    if (unique) {
+                        size_t earlier = w.findString(str);
+                        if (earlier != SIZE_MAX && w.pos - earlier <= kMaxNarrowOffset - 32)
+                            return {0, 0, earlier, true};
+                    }
+                    size_t start = w.pos;
+                    if (str.size < 0x0F) {
+                        w.put(uint8_t(0x40 | str.size));
+                    } else {
+                        w.put(0x4F);
+                        w.putVarInt(str.size);
+                    }
+                    for (size_t i = 0; i < str.size; ++i)
+                        w.put(uint8_t(str.chars[i]));
+                    w.pad();
+                    if (unique)
+                        w.addString(str, start);
+                    return {0, 0, start, true};
+                }
+            };
+
+            template <class... Items>
+            struct Array {
+                std::tuple<Items...> items;
+                static constexpr size_t kStringCount = (size_t(0) + ... + Items::kStringCount);
+
+                template <class W> constexpr Slot place(W &w) const {
+                    constexpr size_t n = sizeof...(Items);
+                    if constexpr (n == 0) {
+                        return {0x60, 0};
+                    } else {
+                        std::array<Slot,n> slots {};
+                        size_t i = 0;
+                        std::apply([&](const auto&... item) {((slots[i++] = item.place(w)), ...);},
+                                   items);
+                        return w.putCollection(6, slots.data(), n, n);
+                    }
+                }
+            };
+
+            template <class... Values>
+            struct Dict {
+                static constexpr size_t n = sizeof...(Values);
+                std::array<StringRef,n> keys;
+                std::tuple<Values...>   values;
+                static constexpr size_t kStringCount = n + (size_t(0) + ... + Values::kStringCount);
+
+                template <class W> constexpr Slot place(W &w) const {
+                    if constexpr (n == 0) {
+                        return {0x70, 0};
+                    } else {
+                        // Keys and values are written in the order given, as by an Encoder...
+                        std::array<Slot,n> keySlots {}, valueSlots {};
+                        placeEntries(w, keySlots, valueSlots, std::index_sequence_for<Values...>{});
+
+                        // ...but the Dict's slots are in key order:
+                        std::array<size_t,n> order {};
+                        for (size_t i = 0; i < n; ++i)
+                            order[i] = i;
+                        for (size_t i = 1; i < n; ++i) {
+                            for (size_t j = i; j > 0 && compare(keys[order[j]],
+                                                                keys[order[j-1]]) < 0; --j) {
+                                size_t t = order[j]; order[j] = order[j-1]; order[j-1] = t;
+                            }
+                        }
+                        std::array<Slot,2*n> slots {};
+                        for (size_t i = 0; i < n; ++i) {
+                            if (i > 0 && compare(keys[order[i]], keys[order[i-1]]) == 0)
+                                throw "duplicate key in constant Dict";
+                            slots[2*i]   = keySlots[order[i]];
+                            slots[2*i+1] = valueSlots[order[i]];
+                        }
+                        return w.putCollection(7, slots.data(), 2*n, n);
+                    }
+                }
+
+            private:
+                template <class W, size_t... I>
+                constexpr void placeEntries(W &w, std::array<Slot,n> &keySlots,
+                                            std::array<Slot,n> &valueSlots,
+                                            std::index_sequence<I...>) const {
+                    ((keySlots[I] = String{keys[I]}.place(w),
+                      valueSlots[I] = std::get<I>(values).place(w)), ...);
+                }
+            };
+
+            template <class V>
+            struct Entry {
+                StringRef key;
+                V         value;
+            };
+
+            template <class T> struct isNode : std::false_type { };
+            template <> struct isNode<Null>   : std::true_type { };
+            template <> struct isNode<Bool>   : std::true_type { };
+            template <> struct isNode<Int>    : std::true_type { };
+            template <> struct isNode<Float>  : std::true_type { };
+            template <> struct isNode<String> : std::true_type { };
+            template <class... I> struct isNode<Array<I...>> : std::true_type { };
+            template <class... V> struct isNode<Dict<V...>>  : std::true_type { };
+
+            // Converts a C++ value to the node that encodes it.
+            template <class T>
+            constexpr auto node(const T &v) {
+                if constexpr (isNode<T>::value)
+                    return v;
+                else if constexpr (std::is_same_v<T, std::nullptr_t>)
+                    return Null{};
+                else if constexpr (std::is_same_v<T, bool>)
+                    return Bool{v};
+                else if constexpr (std::is_integral_v<T>)
+                    return Int{uint64_t(v), std::is_unsigned_v<T>};
+                else if constexpr (std::is_floating_point_v<T>)
+                    return Float{double(v)};
+                else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                    std::string_view s = v;
+                    return String{{s.data(), s.size()}};
+                } else
+                    static_assert(!sizeof(T), "unsupported type in a constant Fleece doc");
+            }
+
+            template <size_t N>
+            constexpr auto node(const char (&s)[N]) {
+                return String{{s, N - 1}};
+            }
+
+            template <class Root>
+            constexpr size_t encodedSize(const Root &root) {
+                Writer<0, Root::kStringCount> w;
+                w.putSlot(root.place(w));
+                return w.pos;
+            }
+
+            template <size_t N, class Root>
+            constexpr ConstantDoc<N> encodeDoc(const Root &root) {
+                Writer<N, Root::kStringCount> w;
+                w.putSlot(root.place(w));
+                ConstantDoc<N> doc {};
+                for (size_t i = 0; i < N; ++i)
+                    doc[i] = w.out[i];
+                return doc;
+            }
+        }
+
+
+        /** A null value (`nullptr` works too.) */
+        constexpr detail::Null null()   {return {};}
+
+        /** An Array of the given values. */
+        template <class... Items>
+        constexpr auto arrayOf(const Items&... items) {
+            return detail::Array<decltype(detail::node(items))...>{{detail::node(items)...}};
+        }
+
+        /** A Dict entry, for `dictOf`. */
+        template <class V>
+        constexpr auto entry(std::string_view key, const V &value) {
+            return detail::Entry<decltype(detail::node(value))>{{key.data(), key.size()},
+                                                                  detail::node(value)};
+        }
+
+        /** A Dict of the given `entry`s, in any order. */
+        template <class... Values>
+        constexpr auto dictOf(const detail::Entry<Values>&... entries) {
+            return detail::Dict<Values...>{{entries.key...}, {entries.value...}};
+        }
+
+        /** Encodes the value returned by `makeRoot`, a captureless lambda; use the
+            FLEECE_CONSTANT_DOC macro rather than calling this directly. The value has to be
+            produced by a function because its contents determine the size of the result. */
+        template <class MakeRoot>
+        constexpr auto encode(MakeRoot makeRoot) {
+            constexpr auto root = detail::node(makeRoot());
+            constexpr size_t size = detail::encodedSize(root);
+            return detail::encodeDoc<size>(root);
+        }
+    }
+
+}
+
+/** Expands to a `fleece::ConstantDoc` holding `VALUE` encoded at compile time; see above. */
+#define FLEECE_CONSTANT_DOC(VALUE) \
+    (::fleece::constdoc::encode([]{ using namespace ::fleece::constdoc; return (VALUE); }))
+
+#endif // _FLEECE_CONSTANTDOC_HH
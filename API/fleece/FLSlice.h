@@ -123,6 +123,21 @@ int FLSlice_Compare(FLSlice, FLSlice) FLAPI FLPURE;
 /** Computes a 32-bit hash of a slice's data, suitable for use in hash tables. */
 uint32_t FLSlice_Hash(FLSlice s) FLAPI FLPURE;
 
+/** Lexicographic comparison of two slices, ignoring the case of ASCII letters. */
+int FLSlice_CaseEquivalentCompare(FLSlice, FLSlice) FLAPI FLPURE;
+
+/** Returns a pointer to the first occurrence of `target` in `s`, or NULL if there is none.
+    An empty target is found at the start of any non-empty slice. */
+const void* FLSlice_Find(FLSlice s, FLSlice target) FLAPI FLPURE;
+
+/** Returns a pointer to the first byte of `s` that is any of the bytes in `targetBytes`,
+    or NULL if there is none. */
+const void* FLSlice_FindAnyByteOf(FLSlice s, FLSlice targetBytes) FLAPI FLPURE;
+
+/** Returns a pointer to the first byte of `s` that is none of the bytes in `targetBytes`,
+    or NULL if there is none. */
+const void* FLSlice_FindByteNotIn(FLSlice s, FLSlice targetBytes) FLAPI FLPURE;
+
 /** Copies a slice to a buffer, adding a trailing zero byte to make it a valid C string.
     If there is not enough capacity the slice will be truncated, but the trailing zero byte is
     always written.
@@ -166,6 +181,59 @@ static inline FLSlice FLSliceResult_AsSlice(FLSliceResult sr) {
 }
 
 
+/** A memory allocator for Fleece to use instead of the default heap. */
+typedef struct FLAllocator {
+    /** Allocates a block, aligned to `alignment` (a power of two), or returns NULL.
+        An `alignment` of 0 means the default alignment of `malloc`. */
+    void* (*allocate)(void *context, size_t size, size_t alignment);
+    /** Resizes a block allocated with the default alignment, like `realloc`. */
+    void* (*reallocate)(void *context, void *block, size_t newSize);
+    /** Frees a block; `alignment` is the value it was allocated with. */
+    void (*free)(void *context, void *block, size_t alignment);
+    void *context;                      ///< Passed to the functions, e.g. for accounting
+} FLAllocator;
+
+/** Changes the allocator used for all of Fleece's own heap memory: FLSliceResult /
+    `alloc_slice` buffers (see also \ref FLSlice_SetPooling), Writer/Encoder output chunks,
+    mutable Arrays and Dicts and their arenas, Docs, deep-iterator state, and hash tables.
+    NULL restores the default (`malloc` & co.)
+    This must be called at startup, before Fleece allocates anything, since memory is freed by
+    whatever allocator is current at the time.
+    \note Memory that's returned to you to free yourself (like C strings) still comes from
+          `malloc`. */
+void FLSetAllocator(const FLAllocator*) FLAPI;
+
+/** Enables huge pages for big buffers: FLSliceResult / `alloc_slice` buffers and Writer/Encoder
+    output chunks of at least `minSize` bytes, and memory-mapped files (see
+    \ref FLDoc_FromMappedFile) that big, are advised to use transparent huge pages. With 2MB
+    pages instead of 4KB, reading a large document at random takes far fewer TLB misses.
+    While it's enabled, an Encoder's output chunks grow up to 8MB instead of 1MB.
+    0 (the default) disables it. It only has an effect on Linux, with transparent huge pages
+    enabled in `madvise` or `always` mode; whether they're actually used is up to the kernel. */
+void FLSetHugePageThreshold(size_t minSize) FLAPI;
+
+
+/** Enables or disables pooling of FLSliceResult (and C++ `alloc_slice`) buffers, whose memory
+    comes from the allocator given to \ref FLSetAllocator either way.
+    When pooling is enabled (as it is by default, except when building with Address Sanitizer),
+    blocks of up to 1KB come in power-of-two size classes, and freed ones are kept for reuse in
+    a per-thread cache. A thread whose cache fills up passes half of it to a shared list that
+    other threads refill from, so blocks allocated on one thread and freed on another are
+    recycled too. */
+void FLSlice_SetPooling(bool enabled) FLAPI;
+
+/** Allocation statistics of FLSliceResults, for tuning. */
+typedef struct FLSliceAllocStats {
+    uint64_t poolHits;                  ///< Allocations satisfied from the pool
+    uint64_t poolMisses;                ///< Allocations of poolable size that found it empty
+    uint64_t unpooled;                  ///< Allocations too big to pool, or with pooling off
+} FLSliceAllocStats;
+
+/** Returns the allocation statistics since launch. The current thread's are exact; other
+    threads' are added in batches, so the most recent ones may be missing. */
+FLSliceAllocStats FLSlice_GetAllocStats(void) FLAPI;
+
+
 /** Writes zeroes to `size` bytes of memory starting at `dst`.
     Unlike a call to `memset`, these writes cannot be optimized away by the compiler.
     This is useful for securely removing traces of passwords or encryption keys. */
@@ -0,0 +1,235 @@
+//
+// Fleece+Inline.h
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#ifndef _FLEECE_INLINE_H
+#define _FLEECE_INLINE_H
+
+#include "Fleece.h"
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    /** \defgroup FLInline   Inline Value Accessors
+        @{
+        Header-only versions of the most frequently called Value and Array accessors. They decode
+        the encoded data directly, so the compiler can inline them into tight loops, instead of
+        calling into the library. Each returns exactly what the regular function of the same
+        name (minus the `_Inline` suffix) would; for the uncommon cases -- mutable collections,
+        wide, long or packed arrays, converting floats to integers -- they call that function.
+
+        These depend on details of the encoding and of the library's memory layout, so a
+        program using them must run with the version of the library whose headers it was
+        compiled with. Check \ref FLInline_IsCompatible at startup. (If you include Fleece.hh
+        with `FLEECE_INLINE_ACCESSORS` defined, which makes the C++ API use these, that's
+        checked for you: if it fails, the C++ API calls the regular functions instead.) */
+
+    /** The version of the assumptions these inline functions make. */
+    #define FL_INLINE_ACCESSORS_VERSION 2
+
+    /** Returns the FL_INLINE_ACCESSORS_VERSION the library was built with. */
+    uint32_t FLInlineAccessorsVersion(void) FLAPI FLCONST;
+
+    /** Returns true if it's safe to use the inline accessors with this library. */
+    static inline bool FLInline_IsCompatible(void) {
+        return FLInlineAccessorsVersion() == FL_INLINE_ACCESSORS_VERSION;
+    }
+
+
+    // Internal constants of the encoding:
+    #define _FLINLINE_FAR_POINTER   0x31    // Destination of a pointer over 2GB back
+    #define _FLINLINE_LONG_COUNT    0x07FF  // Array count meaning "the real count follows"
+                                            // (which a packed array's header always has)
+
+    static inline const uint8_t* _FLInline_Bytes(const void *v) {return (const uint8_t*)v;}
+
+    // A mutable Value has an odd address, and some mutable Values are collections the inline
+    // functions can't read.
+    static inline bool _FLInline_IsMutable(const void *v) {return ((size_t)v & 1) != 0;}
+
+
+    static inline FLValueType FLValue_GetType_Inline(FLValue v) {
+        if (v == NULL)
+            return kFLUndefined;
+        uint8_t byte0 = _FLInline_Bytes(v)[0];
+        switch (byte0 >> 4) {
+            case 0: case 1: case 2: return kFLNumber;
+            case 3:
+                switch (byte0 & 0x0F) {
+                    case 0x04: case 0x08:   return kFLBoolean;
+                    case 0x0C:              return kFLUndefined;
+                    default:                return kFLNull;
+                }
+            case 4:                 return kFLString;
+            case 5:                 return kFLData;
+            case 6:                 return kFLArray;
+            case 7:                 return kFLDict;
+            default:                return kFLNull;
+        }
+    }
+
+    static inline bool FLValue_IsInteger_Inline(FLValue v) {
+        return v && (_FLInline_Bytes(v)[0] >> 4) <= 1;
+    }
+
+    static inline bool FLValue_IsUnsigned_Inline(FLValue v) {
+        return v && (_FLInline_Bytes(v)[0] & 0xF8) == 0x18;
+    }
+
+    static inline bool FLValue_IsDouble_Inline(FLValue v) {
+        return v && (_FLInline_Bytes(v)[0] & 0xF8) == 0x28;
+    }
+
+    static inline int64_t FLValue_AsInt_Inline(FLValue v) {
+        if (v == NULL)
+            return 0;
+        const uint8_t *bytes = _FLInline_Bytes(v);
+        switch (bytes[0] >> 4) {
+            case 0: {
+                // Short int: 12-bit two's complement
+                int32_t i = ((bytes[0] & 0x0F) << 8) | bytes[1];
+                return (i & 0x0800) ? i - 0x1000 : i;
+            }
+            case 1: {
+                // Int: 1 to 8 little-endian bytes, signed unless the 0x08 bit is set
+                unsigned n = (bytes[0] & 0x07) + 1;
+                uint64_t i = 0;
+                for (unsigned b = n; b > 0; --b)
+                    i = (i << 8) | bytes[b];
+                if (!(bytes[0] & 0x08) && n < 8 && (bytes[n] & 0x80))
+                    i |= ~(uint64_t)0 << (8 * n);   // sign-extend
+                return (int64_t)i;
+            }
+            case 3:
+                return (bytes[0] & 0x0F) == 0x08;
+            case 2:
+                return FLValue_AsInt(v);            // (float)
+            default:
+                return 0;
+        }
+    }
+
+    static inline uint64_t FLValue_AsUnsigned_Inline(FLValue v) {
+        return (uint64_t)FLValue_AsInt_Inline(v);
+    }
+
+    static inline bool FLValue_AsBool_Inline(FLValue v) {
+        if (v == NULL)
+            return false;
+        switch (_FLInline_Bytes(v)[0] >> 4) {
+            case 0: case 1: return FLValue_AsInt_Inline(v) != 0;
+            case 2:         return FLValue_AsBool(v);
+            case 3:         return (_FLInline_Bytes(v)[0] & 0x0F) == 0x08;
+            default:        return true;
+        }
+    }
+
+    // Reads the little-endian IEEE double (if `n` is 8) or float (if 4) of a float Value.
+    static inline double _FLInline_ReadFloat(const uint8_t *bytes, unsigned n) {
+        uint64_t bits = 0;
+        for (unsigned b = n; b > 0; --b)
+            bits = (bits << 8) | bytes[1 + b];      // (after the 2 header bytes)
+        if (n == 8) {
+            double d;
+            memcpy(&d, &bits, sizeof(d));
+            return d;
+        } else {
+            uint32_t bits32 = (uint32_t)bits;
+            float f;
+            memcpy(&f, &bits32, sizeof(f));
+            return f;
+        }
+    }
+
+    static inline double FLValue_AsDouble_Inline(FLValue v) {
+        if (v == NULL)
+            return 0.0;
+        const uint8_t *bytes = _FLInline_Bytes(v);
+        if ((bytes[0] >> 4) == 2)
+            return _FLInline_ReadFloat(bytes, (bytes[0] & 0x08) ? 8 : 4);
+        if (FLValue_IsUnsigned_Inline(v))
+            return (double)FLValue_AsUnsigned_Inline(v);
+        return (double)FLValue_AsInt_Inline(v);
+    }
+
+    static inline float FLValue_AsFloat_Inline(FLValue v) {
+        if (v == NULL)
+            return 0.0f;
+        const uint8_t *bytes = _FLInline_Bytes(v);
+        if ((bytes[0] >> 4) == 2)
+            return (float)_FLInline_ReadFloat(bytes, (bytes[0] & 0x08) ? 8 : 4);
+        if (FLValue_IsUnsigned_Inline(v))
+            return (float)FLValue_AsUnsigned_Inline(v);
+        return (float)FLValue_AsInt_Inline(v);
+    }
+
+
+    static inline uint32_t FLArray_Count_Inline(FLArray a) {
+        if (a == NULL)
+            return 0;
+        if (_FLInline_IsMutable(a))
+            return FLArray_Count(a);
+        const uint8_t *bytes = _FLInline_Bytes(a);
+        uint32_t count = ((bytes[0] & 0x07) << 8) | bytes[1];
+        if (count == _FLINLINE_LONG_COUNT)
+            return FLArray_Count(a);
+        return count;
+    }
+
+    static inline bool FLArray_IsEmpty_Inline(FLArray a) {
+        if (a == NULL)
+            return true;
+        if (_FLInline_IsMutable(a))
+            return FLArray_IsEmpty(a);
+        const uint8_t *bytes = _FLInline_Bytes(a);
+        return bytes[1] == 0 && (bytes[0] & 0x07) == 0;
+    }
+
+    /** Gets an item of a narrow array (one whose items are 2 bytes wide, which is any array
+        whose items are all small or near) inline; other arrays go through FLArray_Get. */
+    static inline FLValue FLArray_Get_Inline(FLArray a, uint32_t index) {
+        if (a == NULL)
+            return NULL;
+        if (_FLInline_IsMutable(a))
+            return FLArray_Get(a, index);
+        const uint8_t *bytes = _FLInline_Bytes(a);
+        uint32_t count = ((bytes[0] & 0x07) << 8) | bytes[1];
+        if ((bytes[0] & 0x08) || count == _FLINLINE_LONG_COUNT)
+            return FLArray_Get(a, index);
+        if (index >= count)
+            return NULL;
+        const uint8_t *item = bytes + 2 + 2 * index;
+        if (!(item[0] & 0x80))
+            return (FLValue)item;                   // Inline value
+        if (item[0] & 0x40)
+            return FLArray_Get(a, index);           // External pointer
+        const uint8_t *dst = item - ((((item[0] & 0x3F) << 8) | item[1]) << 1);
+        if (dst[0] == _FLINLINE_FAR_POINTER)
+            return FLArray_Get(a, index);
+        return (FLValue)dst;
+    }
+
+    /** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _FLEECE_INLINE_H
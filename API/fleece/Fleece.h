@@ -91,7 +91,13 @@ extern "C" {
             storage.
             If invalid data is read by this call, subsequent calls to Value accessor functions can
             crash or return bogus results (including data from arbitrary memory locations.) */
-        kFLTrusted
+        kFLTrusted,
+        /** Input data is trusted if it has a checksum (see \ref FLEncoder_SetChecksum) and the
+            checksum matches; otherwise it's validated, as with kFLUntrusted. Verifying the
+            checksum is much faster than validating. Since a checksum only detects corruption,
+            this is for data from a trusted encoder that may have been damaged in transit or
+            storage, not for data from a possibly-malicious source. */
+        kFLTrustedIfChecksummed
     } FLTrust;
 
 
@@ -105,6 +111,48 @@ extern "C" {
         function returns. */
     FLDoc FLDoc_FromJSON(FLSlice json, FLError *outError) FLAPI;
 
+    /** Creates an FLDoc by memory-mapping a file of Fleece data, instead of reading it into
+        memory. Opening is fast regardless of the file's size, since pages are only loaded as
+        they're accessed. The file is unmapped when the doc is freed; it must not be modified
+        while the doc exists.
+        @note  Untrusted data is validated, which reads the entire file. Use kFLTrusted to avoid
+               that, if the file is known to be valid.
+        @return  The new FLDoc, or NULL if the file couldn't be opened or mapped. */
+    FLDoc FLDoc_FromMappedFile(const char *path,
+                               FLTrust,
+                               FLSharedKeys,
+                               FLError *outError) FLAPI;
+
+    /** Copies Fleece data into a named shared-memory segment, replacing any existing one of that
+        name, so that processes on the same host can create FLDocs on it with
+        \ref FLDoc_FromSharedMemory and share one copy of the data. The name should begin with
+        "/" and contain no other slashes. Only processes running as the same user can open it.
+        The segment remains until it's removed by \ref FLSharedMemory_Remove. (On Windows a segment only lasts while it's mapped, so this
+        returns false there; create it with the C++ `MappedFile::createSharedMemory`.) */
+    bool FLSharedMemory_Create(const char *name, FLSlice data, FLError *outError) FLAPI;
+
+    /** Removes a shared-memory segment's name; processes that have it mapped can keep using it.
+        Returns false if there's no such segment. */
+    bool FLSharedMemory_Remove(const char *name) FLAPI;
+
+    /** Creates an FLDoc on a named shared-memory segment created by \ref FLSharedMemory_Create,
+        by this or another process. As with \ref FLDoc_FromMappedFile, untrusted data is
+        validated, which reads all of it.
+        @return  The new FLDoc, or NULL if the segment couldn't be opened. */
+    FLDoc FLDoc_FromSharedMemory(const char *name,
+                                 FLTrust,
+                                 FLSharedKeys,
+                                 FLError *outError) FLAPI;
+
+    /** Makes an FLDoc use different data, as though it had been freed and recreated by
+        \ref FLDoc_FromResultData, but faster. This is useful when many short-lived docs are
+        created in turn, e.g. one per request: keep one FLDoc and reinitialize it each time.
+        As with FLDoc_FromResultData, the doc retains the data. All values of its old data
+        become invalid.
+        @warning  There must be no other references to the doc (no FLDoc_Retain calls.) */
+    void FLDoc_Reinit(FLDoc NONNULL, FLSliceResult data, FLTrust,
+                      FLSharedKeys, FLSlice externData) FLAPI;
+
     /** Releases a reference to an FLDoc. This must be called once to free an FLDoc you created. */
     void FLDoc_Release(FLDoc) FLAPI;
 
@@ -124,10 +172,32 @@ extern "C" {
     /** Returns the FLSharedKeys used by this FLDoc, as specified when it was created. */
     FLSharedKeys FLDoc_GetSharedKeys(FLDoc) FLAPI FLPURE;
 
+    /** Returns the number of extern-pointer hops from the FLDoc's data down to its oldest
+        segment: 0 if it was created without `externData`, 1 if that data has none, etc. */
+    unsigned FLDoc_GetExternDepth(FLDoc) FLAPI FLPURE;
+
+    /** Returns the heap memory used by the FLDoc: the object, its data if it owns it (not if it
+        was created on a parent doc's data or a memory-mapped file), and any caches it keeps.
+        Mutable copies of its values aren't included; see \ref FLMutableDict_GetMemoryUsage. */
+    size_t FLDoc_GetMemoryUsage(FLDoc) FLAPI;
+
+    /** If the FLDoc's extern depth (see \ref FLDoc_GetExternDepth) is greater than
+        `maxExternDepth`, re-encodes its contents into a single new FLDoc with no extern pointers,
+        which is faster to read. Otherwise returns the same FLDoc. Either way, the caller must
+        release the result. This can be called on a background thread.
+        @return  The flattened FLDoc, or NULL on error (or if `doc` is NULL.) */
+    FLDoc FLDoc_Flatten(FLDoc doc, unsigned maxExternDepth, FLError *outError) FLAPI;
+
     /** Looks up the Doc containing the Value, or NULL if the Value was created without a Doc.
         Caller must release the FLDoc reference!! */
     FLDoc FLValue_FindDoc(FLValue) FLAPI FLPURE;
 
+    /** Advises the OS that a value is about to be read, if it belongs to a doc created by
+        \ref FLDoc_FromMappedFile, so its pages can be loaded in the background instead of
+        faulting in one at a time. If `deep` is false this covers the value itself (for a
+        collection, its item slots); if true, its entire subtree. Does nothing otherwise. */
+    void FLValue_Prefetch(FLValue, bool deep) FLAPI;
+
 
     /** @} */
     /** \name Parsing And Converting Values Directly
@@ -146,6 +216,44 @@ extern "C" {
         This is only useful if you already know, or want to learn, the encoding format. */
     FLStringResult FLData_Dump(FLSlice data) FLAPI;
 
+    /** Re-encodes Fleece data keeping only the values reachable from its root, with duplicate
+        strings merged. After many amendments (see \ref FLEncoder_Amend) the data accumulates
+        values that are no longer reachable; this reclaims their space.
+        @param data  The Fleece data. It's validated first.
+        @param sharedKeys  The shared keys used by the data's dictionaries, if any.
+        @param outLiveBytes  If non-NULL, the number of bytes of `data` that are reachable from
+                    its root is stored here; the rest is garbage.
+        @param outError  On failure, the error code will be stored here.
+        @return  The compacted data, or a null slice on error. */
+    FLSliceResult FLData_Compact(FLSlice data, FLSharedKeys sharedKeys,
+                                 size_t *outLiveBytes, FLError *outError) FLAPI;
+
+#ifndef FL_IMPL
+    typedef struct _FLDataStats* FLDataStats;   ///< Accumulates statistics about Fleece data.
+#endif
+
+    /** Creates an object that accumulates statistics about where the bytes of Fleece data go:
+        bytes by value type, narrow vs. wide collections, pointers, shared strings, shared keys,
+        and the largest collections. Add documents with \ref FLDataStats_Add.
+        @param nLargest  The number of largest collections to list in the report.
+        @return  A new FLDataStats, which must be freed with \ref FLDataStats_Free. */
+    FLDataStats FLDataStats_New(size_t nLargest) FLAPI;
+
+    /** Frees an FLDataStats. (It's ok to pass NULL.) */
+    void FLDataStats_Free(FLDataStats) FLAPI;
+
+    /** Adds the statistics of a Fleece document.
+        @param stats  The statistics to add to.
+        @param data  The Fleece data. It's validated first.
+        @param sharedKeys  The shared keys used by the data's dictionaries, if any.
+        @param label  A name for the document (such as its file name), or a null slice.
+        @return  True on success, false if the data isn't valid Fleece. */
+    bool FLDataStats_Add(FLDataStats NONNULL stats, FLSlice data, FLSharedKeys sharedKeys,
+                         FLString label) FLAPI;
+
+    /** Returns a human-readable report of the statistics. */
+    FLStringResult FLDataStats_Report(FLDataStats NONNULL) FLAPI;
+
 
     /** @} */
     /** @} */
@@ -167,6 +275,13 @@ extern "C" {
                                   bool json5,
                                   bool canonicalForm) FLAPI;
 
+    /** Like FLValue_ToJSONX, but decodes Dicts' integer keys with the given SharedKeys, instead of
+        looking up the ones the value's data belongs to. */
+    FLStringResult FLValue_ToJSONWithSharedKeys(FLValue v,
+                                                bool json5,
+                                                bool canonicalForm,
+                                                FLSharedKeys) FLAPI;
+
     /** Converts valid JSON5 <https://json5.org> to JSON. Among other things, it converts single
         quotes to double, adds missing quotes around dictionary keys, removes trailing commas,
         and removes comments.
@@ -307,6 +422,12 @@ extern "C" {
     /** Compares two values for equality. This is a deep recursive comparison. */
     bool FLValue_IsEqual(FLValue v1, FLValue v2) FLAPI FLPURE;
 
+    /** Returns a 64-bit hash of a value's content: equal values (by FLValue_IsEqual) have equal
+        hashes, however they're encoded. Large collections encoded with
+        \ref FLEncoder_SetEmbedHashes store their hashes, so hashing them is O(1).
+        Returns 0 for NULL. */
+    uint64_t FLValue_Hash(FLValue) FLAPI FLPURE;
+
     /** Returns true if the value is mutable. */
     bool FLValue_IsMutable(FLValue) FLAPI FLPURE;
 
@@ -329,6 +450,44 @@ extern "C" {
 
     /** @} */
 
+    /** \name Value references
+        FLValue_Retain on an immutable value has to look up the Doc containing it. An FLValueRef
+        carries the Doc along with the value, so retaining or releasing it is just a ref-count
+        change on the Doc. Get one from FLDoc_GetRootRef (or FLValue_MakeRef), and get the
+        values in it with FLValueRef_Get and FLValueRef_GetAt, which stay in the same Doc.
+        None of these functions retain anything except FLValueRef_Retain.
+         @{ */
+
+    /** A Value and the Doc containing it. `doc` is NULL if the value isn't in a Doc, for
+        example if it's mutable. */
+    typedef struct {
+        FLValue value;
+        FLDoc doc;
+    } FLValueRef;
+
+    /** Returns a reference to a Doc's root value. */
+    FLValueRef FLDoc_GetRootRef(FLDoc) FLAPI FLPURE;
+
+    /** Returns a reference to any value. This has to look up its Doc, as FLValue_FindDoc does,
+        so it's better to get references from other references when possible. */
+    FLValueRef FLValue_MakeRef(FLValue) FLAPI FLPURE;
+
+    /** Looks up a key in a referenced Dict, returning a reference to its value, or a reference
+        to NULL if it's not found or the value isn't a Dict. */
+    FLValueRef FLValueRef_Get(FLValueRef dict, FLSlice keyString) FLAPI FLPURE;
+
+    /** Returns a reference to an item of a referenced Array, or a reference to NULL if the index
+        is out of range or the value isn't an Array. */
+    FLValueRef FLValueRef_GetAt(FLValueRef array, uint32_t index) FLAPI FLPURE;
+
+    /** Retains the referenced value: its Doc, or the value itself if it's mutable. */
+    FLValueRef FLValueRef_Retain(FLValueRef) FLAPI;
+
+    /** Releases a reference retained by FLValueRef_Retain. */
+    void FLValueRef_Release(FLValueRef) FLAPI;
+
+    /** @} */
+
     /** Allocates a string value on the heap. This is rarely needed -- usually you'd just add a string
         to a mutable Array or Dict directly using one of their "...SetString" or "...AppendString"
         methods. */
@@ -342,6 +501,20 @@ extern "C" {
     /** A constant null value (not a NULL pointer!) */
     extern const FLValue kFLNullValue;
 
+    /** A value and its scalar contents, as read or written in bulk by
+        \ref FLArrayIterator_ReadItems, \ref FLDictIterator_ReadItems and
+        \ref FLEncoder_WriteItems. These save a binding the cost of a foreign-function call for
+        each accessor. */
+    typedef struct {
+        FLString    key;        ///< Dict key; a null slice for an array item
+        FLValue     value;      ///< The value (may be NULL when writing a scalar)
+        FLValueType type;       ///< The value's type
+        bool        isInteger;  ///< True if it's an integer, false if a floating-point number
+        int64_t     asInt;      ///< Integer value of a number or boolean, else 0
+        double      asDouble;   ///< Numeric value of a number or boolean, else 0
+        FLSlice     asString;   ///< Contents of a string or data value, else null
+    } FLItem;
+
 
     //////// ARRAY
 
@@ -364,12 +537,77 @@ extern "C" {
         this can be faster than `FLArray_Count(a) == 0` */
     bool FLArray_IsEmpty(FLArray) FLAPI FLPURE;
 
-    /** If the array is mutable, returns it cast to FLMutableArray, else NULL. */
+    /** If the array is mutable, returns it cast to FLMutableArray, else NULL.
+        Also returns NULL if it's a nested array shared by a lazy deep copy (kFLCopyLazily) and
+        its original; get it with FLMutableArray_GetMutableArray or
+        FLMutableDict_GetMutableArray instead, which copy it first. */
     FLMutableArray FLArray_AsMutable(FLArray) FLAPI FLPURE;
 
     /** Returns an value at an array index, or NULL if the index is out of range. */
     FLValue FLArray_Get(FLArray, uint32_t index) FLAPI FLPURE;
 
+    /** The type of values in an FLColumn. */
+    typedef enum {
+        kFLIntColumn,           ///< int64_t values
+        kFLDoubleColumn,        ///< double values
+        kFLStringColumn,        ///< FLSlice values, pointing into the source data
+    } FLColumnType;
+
+    /** Describes a property to extract from an array of dicts with FLArray_ExtractColumns. */
+    typedef struct {
+        FLSlice key;            ///< The dict property to extract
+        FLColumnType type;      ///< The type of the values to store
+        void *values;           ///< Buffer with room for one value per array item
+        uint8_t *nulls;         ///< Optional bitmap with one bit per item (LSB first), or NULL
+    } FLColumn;
+
+    /** Extracts properties from each dict in an array into typed column buffers, in one pass.
+        Item `i` of each column's `values` gets the value of its property in the i'th dict. If
+        the item isn't a dict, or lacks the property, or the value's type doesn't match (ints
+        and doubles are interchangeable), it gets 0 or a null slice, and its bit in `nulls` is
+        set. This is much faster than looking up each property separately when the dicts have
+        the same keys, as in an array of records. */
+    void FLArray_ExtractColumns(FLArray, FLColumn columns[], size_t columnCount) FLAPI;
+
+    /** Aggregate values of the numbers in an array, as returned by FLArray_GetStats. */
+    typedef struct {
+        uint32_t count;         ///< Number of items that are numbers
+        uint32_t nonNull;       ///< Number of items that aren't null
+        double sum;             ///< Sum of the numbers
+        double min;             ///< Least number, or NaN if there are none
+        double max;             ///< Greatest number, or NaN if there are none
+    } FLArrayStats;
+
+    /** Computes the count, sum, minimum and maximum of the numbers in an array, in one pass,
+        ignoring items that aren't numbers. The numbers are added as doubles. This is much
+        faster than iterating the array, especially if it was encoded with packed numbers. */
+    FLArrayStats FLArray_GetStats(FLArray) FLAPI;
+
+    /** Sets the bit in `bitmap` (LSB first) of each item of an array that's a number in the
+        range [minValue, maxValue], clears the others, and returns the number of bits set.
+        The bitmap must have room for `(FLArray_Count(a) + 7) / 8` bytes. */
+    uint32_t FLArray_FilterNumbers(FLArray, double minValue, double maxValue,
+                                   uint8_t *bitmap) FLAPI;
+
+    /** Returns the index of the first item of a sorted array that isn't less than `value`, or
+        the array's count if there's none, using a binary search. Values are ordered by type
+        (null, false, true, numbers, strings, data, arrays, dicts), then by value. */
+    uint32_t FLArray_LowerBound(FLArray, FLValue value) FLAPI;
+
+    /** Set operations on sorted arrays, for \ref FLArray_WriteSetOperation. */
+    typedef enum {
+        kFLIntersection,        ///< Items in both arrays
+        kFLUnion,               ///< Items in either array
+        kFLDifference,          ///< Items in the first array but not the second
+    } FLSetOperation;
+
+    /** Writes to a Fleece encoder an array of the result of a set operation on two arrays that
+        are sorted in the order used by \ref FLArray_LowerBound, and have no duplicates. When
+        one array is much smaller, only its items are searched for in the other.
+        Returns false if the encoder has an error, or isn't a Fleece encoder. */
+    bool FLArray_WriteSetOperation(FLArray a, FLArray b, FLSetOperation,
+                                   FLEncoder NONNULL) FLAPI;
+
     extern const FLArray kFLEmptyArray;
 
     /** \name Array iteration
@@ -414,6 +652,12 @@ while (NULL != (value = FLArrayIterator_GetValue(&iter))) {
     /** Advances the iterator to the next value, or returns false if at the end. */
     bool FLArrayIterator_Next(FLArrayIterator* NONNULL) FLAPI;
 
+    /** Reads up to `capacity` items, starting with the current one, into `items` (see \ref FLItem)
+        and advances the iterator past them. Returns the number read; 0 means the end.
+        Call it repeatedly to read an array of any size into a fixed-size buffer. */
+    size_t FLArrayIterator_ReadItems(FLArrayIterator* NONNULL,
+                                     FLItem items[], size_t capacity) FLAPI;
+
     /** @} */
 
 
@@ -428,6 +672,16 @@ while (NULL != (value = FLArrayIterator_GetValue(&iter))) {
         kFLDeepCopy           = 1,
         kFLCopyImmutables     = 2,
         kFLDeepCopyImmutables = (kFLDeepCopy | kFLCopyImmutables),
+        kFLCopyToArena        = 4,  ///< Allocate the copies together in bulk; best for big deep copies
+        kFLCopySingleThreaded = 8,  ///< Like kFLCopyToArena, but the copied values (not including
+                                    ///< ones added later) may only be used on the current thread
+        kFLCopyLazily         = 16, ///< With kFLDeepCopy, nested mutable collections are shared, and
+                                    ///< copied only when first accessed with a `GetMutable` function
+                                    ///< on either side. (Ignored with kFLCopyImmutables.)
+        kFLCopyStringArena    = 32, ///< Strings and data stored into the copy or its nested mutable
+                                    ///< collections later are allocated from an arena they share,
+                                    ///< instead of each from the heap. (The space of values that are
+                                    ///< replaced isn't reused until the whole arena is freed.)
     } FLCopyFlags;
 
 
@@ -466,6 +720,36 @@ while (NULL != (value = FLArrayIterator_GetValue(&iter))) {
     /** Sets or clears the mutable Array's "changed" flag. */
     void FLMutableArray_SetChanged(FLMutableArray, bool) FLAPI;
 
+    /** Makes the Array, and all the mutable collections in it, permanently read-only. Reading
+        a mutable collection can otherwise build internal state lazily, so it's not safe to read
+        from multiple threads at once; a frozen one is. Modifying it afterwards fails without
+        effect: the functions that return a slot or a nested collection return NULL, and the
+        others do nothing. (Copying it with FLArray_MutableCopy makes a mutable copy.)
+        Returns false, and sets `outError` if it's non-NULL, if it can't be frozen because
+        it's, or contains, a copy made with kFLCopySingleThreaded. */
+    bool FLMutableArray_Freeze(FLMutableArray, FLError *outError) FLAPI;
+
+    /** Returns true if the Array has been frozen by FLMutableArray_Freeze (or by freezing a
+        collection containing it.) */
+    bool FLMutableArray_IsFrozen(FLMutableArray) FLAPI;
+
+    /** Returns a frozen snapshot of the Array's current state, which can be read from any thread
+        while the Array goes on changing. It shares all the collections nested in the Array,
+        which become frozen; the Array copies each before changing it, so a change costs a copy
+        of just the collections along its path. Only the Array itself is copied, not its
+        contents.
+        \note  References to nested collections obtained before the snapshot now refer to
+               frozen ones, so modifying them fails (see FLMutableArray_Freeze). Keep modifying
+               nested collections by getting them from the Array again with the
+               `GetMutable...` functions, which return private copies.
+        You are responsible for releasing the result. */
+    FLMutableArray FLMutableArray_Snapshot(FLMutableArray) FLAPI;
+
+    /** Returns the heap memory used by the mutable Array and the mutable values in it, counting
+        each shared value or arena once. The immutable values it refers to belong to their
+        FLDoc, so they aren't counted. */
+    size_t FLMutableArray_GetMemoryUsage(FLMutableArray) FLAPI;
+
     /** Inserts a contiguous range of JSON `null` values into the array.
         @param array  The array to operate on.
         @param firstIndex  The zero-based index of the first value to be inserted.
@@ -566,13 +850,44 @@ while (NULL != (value = FLArrayIterator_GetValue(&iter))) {
         representation, this can be faster than `FLDict_Count(a) == 0` */
     bool FLDict_IsEmpty(FLDict) FLAPI FLPURE;
 
-    /** If the dictionary is mutable, returns it cast to FLMutableDict, else NULL. */
+    /** If the dictionary is mutable, returns it cast to FLMutableDict, else NULL.
+        Also returns NULL if it's a nested dictionary shared by a lazy deep copy (kFLCopyLazily)
+        and its original; get it with FLMutableArray_GetMutableDict or
+        FLMutableDict_GetMutableDict instead, which copy it first. */
     FLMutableDict FLDict_AsMutable(FLDict) FLAPI FLPURE;
 
     /** Looks up a key in a dictionary, returning its value.
         Returns NULL if the value is not found or if the dictionary is NULL. */
     FLValue FLDict_Get(FLDict, FLSlice keyString) FLAPI FLPURE;
 
+    /** Looks up a key in a dictionary whose keys are encoded with the given SharedKeys. This is
+        like FLDict_Get, except that it doesn't have to look up the SharedKeys the dictionary's
+        data belongs to. */
+    FLValue FLDict_GetWithSharedKeys(FLDict, FLSlice keyString, FLSharedKeys) FLAPI FLPURE;
+
+    /** Looks up several keys in a dictionary at once, storing each key's value (or NULL if it's
+        not found) in the corresponding element of `values`. This is faster than calling
+        FLDict_Get for each key, especially if the keys are sorted (as by FLSlice_Compare.)
+        If the dictionary is NULL, all the values are set to NULL. */
+    void FLDict_GetMany(FLDict, const FLSlice keys[], size_t count, FLValue values[]) FLAPI;
+
+    /** Destination arrays for FLDict_GetFields. Each one that isn't NULL must have room for one
+        element per key. */
+    typedef struct {
+        FLValue     *values;    ///< The values, or NULL where missing
+        FLValueType *types;     ///< Their types (as by FLValue_GetType)
+        int64_t     *ints;      ///< FLValue_AsInt of each value
+        double      *doubles;   ///< FLValue_AsDouble of each value
+        FLSlice     *strings;   ///< FLValue_AsString, or FLValue_AsData, of each value
+    } FLFieldArrays;
+
+    /** Looks up several keys at once like FLDict_GetMany, and stores each value's type and
+        scalar contents into the corresponding elements of the non-NULL arrays in `fields`.
+        This saves a binding one foreign-function call per accessor per field.
+        Returns the number of keys found. */
+    size_t FLDict_GetFields(FLDict, const FLSlice keys[], size_t count,
+                            const FLFieldArrays* NONNULL fields) FLAPI;
+
     extern const FLDict kFLEmptyDict;
 
     /** \name Dict iteration
@@ -608,6 +923,10 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
         then FLDictIterator_Next. */
     void FLDictIterator_Begin(FLDict, FLDictIterator* NONNULL) FLAPI;
 
+    /** Like FLDictIterator_Begin, but decodes integer keys with the given SharedKeys, instead of
+        looking up the ones the dictionary's data belongs to. */
+    void FLDictIterator_BeginWithSharedKeys(FLDict, FLSharedKeys, FLDictIterator* NONNULL) FLAPI;
+
     /** Returns the current key being iterated over. This Value will be a string or an integer. */
     FLValue FLDictIterator_GetKey(const FLDictIterator* NONNULL) FLAPI FLPURE;
 
@@ -627,6 +946,12 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
         (b) you stop iterating before the end (i.e. before FLDictIterator_Next returns false.) */
     void FLDictIterator_End(FLDictIterator* NONNULL) FLAPI;
 
+    /** Reads up to `capacity` key/value pairs, starting with the current one, into `items`
+        (see \ref FLItem) and advances the iterator past them. Returns the number read; 0 means
+        the end, at which point the iterator has been cleaned up as by FLDictIterator_End. */
+    size_t FLDictIterator_ReadItems(FLDictIterator* NONNULL,
+                                    FLItem items[], size_t capacity) FLAPI;
+
     /** @} */
     /** \name Optimized Keys
         @{ */
@@ -659,6 +984,29 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     FLValue FLDict_GetWithKey(FLDict, FLDictKey* NONNULL) FLAPI;
 
 
+#ifndef FL_IMPL
+    typedef struct _FLResolvedKey* FLResolvedKey;   ///< A reference to a resolved dictionary key.
+#endif
+
+    /** Creates an immutable key for dictionary lookups, mapped to its integer form in `sharedKeys`
+        (if it's known there) just once, up front. Unlike an FLDictKey it's never modified by
+        lookups, so a single FLResolvedKey can be used on multiple threads at once.
+        It should only be used with dictionaries that use the same FLSharedKeys (or none.)
+        @param string  The key string (UTF-8). It's copied, so it needn't remain valid.
+        @param sharedKeys  The shared keys used by the dictionaries to be searched, or NULL.
+        @return  A new FLResolvedKey, which must be freed with \ref FLResolvedKey_Free. */
+    FLResolvedKey FLResolvedKey_New(FLSlice string, FLSharedKeys sharedKeys) FLAPI;
+
+    /** Frees an FLResolvedKey. (It's ok to pass NULL.) */
+    void FLResolvedKey_Free(FLResolvedKey) FLAPI;
+
+    /** Returns the string value of the key (which it was created with.) */
+    FLString FLResolvedKey_GetString(FLResolvedKey NONNULL) FLAPI;
+
+    /** Looks up a key in a dictionary using an FLResolvedKey. This is thread-safe. */
+    FLValue FLDict_GetWithResolvedKey(FLDict, FLResolvedKey NONNULL) FLAPI;
+
+
     //////// MUTABLE DICT
 
 
@@ -682,6 +1030,13 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
         Its initial ref-count is 1, so a call to FLMutableDict_Free will free it.  */
     FLMutableDict FLMutableDict_New(void) FLAPI;
 
+    /** Enables or disables sharing of mutable Dicts' keys: if enabled, each short key string
+        (up to 32 bytes) is stored once per process, instead of once per Dict that uses it.
+        That saves memory when many Dicts have the same keys, but the stored keys (up to 64K of
+        them) are never freed, so it shouldn't be enabled if keys are arbitrary user data.
+        It's disabled by default. */
+    void FLMutableDict_SetKeySharing(bool enabled) FLAPI;
+
     /** Increments the ref-count of a mutable Dict. */
     static inline FLMutableDict FLMutableDict_Retain(FLMutableDict d) {
         return (FLMutableDict)FLValue_Retain((FLValue)d);
@@ -701,6 +1056,24 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Sets or clears the mutable Dict's "changed" flag. */
     void FLMutableDict_SetChanged(FLMutableDict, bool) FLAPI;
 
+    /** Makes the Dict, and all the mutable collections in it, permanently read-only, so it's
+        safe to read from multiple threads at once. Modifying it afterwards fails.
+        (See FLMutableArray_Freeze.) */
+    bool FLMutableDict_Freeze(FLMutableDict, FLError *outError) FLAPI;
+
+    /** Returns true if the Dict has been frozen by FLMutableDict_Freeze (or by freezing a
+        collection containing it.) */
+    bool FLMutableDict_IsFrozen(FLMutableDict) FLAPI;
+
+    /** Returns a frozen snapshot of the Dict's current state, sharing its nested collections.
+        (See FLMutableArray_Snapshot.) You are responsible for releasing the result. */
+    FLMutableDict FLMutableDict_Snapshot(FLMutableDict) FLAPI;
+
+    /** Returns the heap memory used by the mutable Dict and the mutable values in it, counting
+        each shared value or arena once. The immutable values it refers to belong to their
+        FLDoc, so they aren't counted. */
+    size_t FLMutableDict_GetMemoryUsage(FLMutableDict) FLAPI;
+
     /** Removes the value for a key. */
     void FLMutableDict_Remove(FLMutableDict, FLString key) FLAPI;
 
@@ -721,6 +1094,16 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
           copy as the property value, and returns the copy. */
     FLMutableDict FLMutableDict_GetMutableDict(FLMutableDict, FLString key) FLAPI;
 
+    /** Encodes a mutable Dict as a delta to the document containing its source Dict (see
+        \ref FLEncoder_Amend): the result has to be appended to that document's data to be read,
+        unless `externPointers` is true. Unchanged values, including nested collections, are
+        written as pointers back into the original, so the size of the result, and the time
+        taken, are proportional to the changes, not to the whole document.
+        Fails if the Dict's source isn't part of an FLDoc. */
+    FLSliceResult FLMutableDict_Amend(FLMutableDict NONNULL,
+                                      bool reuseStrings, bool externPointers,
+                                      FLError *outError) FLAPI;
+
 
     /// Stores a JSON null value into a mutable dictionary.
     static inline void FLMutableDict_SetNull(FLMutableDict NONNULL, FLString key);
@@ -809,6 +1192,39 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Returns the current path in JSONPointer format (RFC 6901). */
     FLSliceResult FLDeepIterator_GetJSONPointer(FLDeepIterator NONNULL) FLAPI;
 
+    /** Like FLDeepIterator_GetPathString, but without allocating: the string is in a buffer owned
+        by the iterator, and is only valid until it advances. */
+    FLString FLDeepIterator_GetPathSlice(FLDeepIterator NONNULL) FLAPI;
+
+    /** Like FLDeepIterator_GetJSONPointer, but without allocating: the string is in a buffer
+        owned by the iterator, and is only valid until it advances. */
+    FLString FLDeepIterator_GetJSONPointerSlice(FLDeepIterator NONNULL) FLAPI;
+
+
+    /** Callbacks for \ref FLValue_VisitParallel. */
+    typedef struct {
+        /** Creates the private state of a worker thread. Called on the calling thread. */
+        void* (*begin)(void *context);
+        /** Called on a worker thread with each value and the path to it. Returning false skips
+            the value's children. */
+        bool (*visit)(void *state, FLValue value, const FLPathComponent *path, size_t depth);
+        /** Called on the calling thread, after all the threads finish, with each worker's state
+            in turn; it should combine the state's results and free it. */
+        void (*end)(void *context, void *state);
+    } FLParallelVisitor;
+
+    /** Visits every value in `root`, like an FLDeepIterator, but concurrently on `nThreads`
+        threads (0 means the Executor's concurrency; see \ref FLSetExecutor.) Large arrays and
+        dicts at the top levels are split into ranges of items, which the threads take in turn. Values are visited in no particular
+        order, except that a collection is visited before its items.
+        The values must not be mutated during the call.
+        @return  True on success, false if an exception occurred. */
+    bool FLValue_VisitParallel(FLValue root,
+                               const FLParallelVisitor* NONNULL visitor,
+                               void *context,
+                               unsigned nThreads,
+                               FLError *outError) FLAPI;
+
 
     //////// PATH
 
@@ -828,6 +1244,11 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
 
      A '\' can be used to escape a special character ('.', '[' or '$') at the start of a
      property name (but not yet in the middle of a name.)
+
+     A path can also match multiple values: `[*]` matches every array item or dict value,
+     `[2:5]` matches a range of array items (either bound may be omitted or negative), and `..`
+     matches a value and all its descendants, as in `$..name`. Such a path only matches anything
+     when evaluated with \ref FLKeyPath_EvalAll.
      */
 
 #ifndef FL_IMPL
@@ -843,11 +1264,37 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Evaluates a compiled key-path for a given Fleece root object. */
     FLValue FLKeyPath_Eval(FLKeyPath NONNULL, FLValue root) FLAPI;
 
+    /** Evaluates a compiled key-path, looking up dictionary keys with the given SharedKeys instead
+        of the ones the root's data belongs to. */
+    FLValue FLKeyPath_EvalWithSharedKeys(FLKeyPath NONNULL, FLValue root, FLSharedKeys) FLAPI;
+
+    /** Evaluates a compiled key-path that may match multiple values (using wildcards, slices
+        or `..`), writing an array of all the matching values to the encoder. The tree is
+        traversed only once. Returns false if the encoder has an error. */
+    bool FLKeyPath_EvalAll(FLKeyPath NONNULL, FLValue root, FLEncoder NONNULL) FLAPI;
+
     /** Evaluates a key-path from a specifier string, for a given Fleece root object.
         If you only need to evaluate the path once, this is a bit faster than creating an
         FLKeyPath object, evaluating, then freeing it. */
     FLValue FLKeyPath_EvalOnce(FLSlice specifier, FLValue root NONNULL, FLError *error) FLAPI;
 
+    /** Overwrites the scalar value at a path in encoded Fleece data, in place, if the new value
+        fits in the same bytes: a small int, boolean or null can replace any of those; an int can
+        replace a larger int of the same width; and a floating-point number can replace a double,
+        or a float if it's exactly representable as one. This makes it an O(1) update for
+        counters and flags, instead of re-encoding the document.
+        The data must be writable (such as that of a Doc made from data you own), and nothing
+        else may be reading it meanwhile.
+        @param root  The root of the data.
+        @param specifier  The path to the value to change, which must be single-valued.
+        @param newValue  The new value.
+        @param outError  On a path syntax error, the error code will be stored here.
+        @return  True if the value was changed; false if the path wasn't found, the new value
+                 doesn't fit, the value is in a mutable or packed collection or one with an
+                 embedded hash, or the data has a checksum. */
+    bool FLValue_TryPatchInPlace(FLValue root NONNULL, FLSlice specifier, FLValue newValue NONNULL,
+                                 FLError *outError) FLAPI;
+
     /** Returns a path in string form. */
     FLStringResult FLKeyPath_ToString(FLKeyPath path) FLAPI;
 
@@ -860,6 +1307,31 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
                               FLSlice *outDictKey NONNULL,
                               int32_t *outArrayIndex NONNULL) FLAPI;
 
+    /** How strings are compared by \ref FLArray_SortedBy. */
+    typedef enum {
+        kFLBinaryCollation,             ///< By UTF-8 bytes, i.e. by Unicode code point
+        kFLASCIICaseInsensitive,        ///< Like binary, but ignoring the case of ASCII letters
+    } FLCollation;
+
+    /** A sort criterion for \ref FLArray_SortedBy. */
+    typedef struct {
+        FLKeyPath path;                 ///< Path of the value in each item; must be single-valued
+        bool descending;                ///< True to sort in descending order
+    } FLSortKey;
+
+    /** Writes the items of an array to the encoder as a new array, sorted by the values at the
+        paths in each item, comparing by the first key, then the second, etc. Values are ordered
+        by type (missing, null, false, true, numbers, strings, data, arrays, dicts), then by
+        value; equal items keep their original order. At most `limit` items are written.
+
+        Each item's values are evaluated once, into a key that's compared as bytes, so this is
+        much faster than sorting with a comparator that evaluates the paths. If the encoder was
+        set up by \ref FLEncoder_Amend with the array's data as its base, the items are written
+        as pointers to the originals.
+        Returns false if a path isn't single-valued or the encoder has an error. */
+    bool FLArray_SortedBy(FLArray, const FLSortKey keys[], size_t keyCount,
+                          FLCollation, size_t limit, FLEncoder NONNULL) FLAPI;
+
     //////// SHARED KEYS
 
 
@@ -897,6 +1369,21 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Updates an FLSharedKeys with saved state data created by \ref FLSharedKeys_GetStateData. */
     bool FLSharedKeys_LoadStateData(FLSharedKeys, FLSlice) FLAPI;
 
+    /** Returns the current state as an image, which unlike the state data can be used in place
+        by \ref FLSharedKeys_UseImage, without copying the strings or building a hash table. */
+    FLSliceResult FLSharedKeys_GetImageData(FLSharedKeys NONNULL) FLAPI;
+
+    /** Loads an empty FLSharedKeys from an image created by \ref FLSharedKeys_GetImageData,
+        using the image in place. The image data (which may be memory-mapped) must remain valid
+        and unchanged as long as the FLSharedKeys exists.
+        @return  True on success, false if the image is invalid. */
+    bool FLSharedKeys_UseImage(FLSharedKeys NONNULL, FLSlice image) FLAPI;
+
+    /** Like \ref FLSharedKeys_UseImage, but with an image stored in a shared-memory segment by
+        \ref FLSharedMemory_Create, which stays mapped as long as the FLSharedKeys exists.
+        @return  True on success, false if the segment can't be opened or the image is invalid. */
+    bool FLSharedKeys_UseSharedMemoryImage(FLSharedKeys NONNULL, const char *name) FLAPI;
+
     /** Writes the current state to a Fleece encoder as a single value,
         which can later be decoded and passed to \ref FLSharedKeys_LoadState. */
     void FLSharedKeys_WriteState(FLSharedKeys, FLEncoder) FLAPI;
@@ -976,12 +1463,42 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Creates a new Fleece encoder that writes to a file, not to memory. */
     FLEncoder FLEncoder_NewWritingToFile(FILE* NONNULL, bool uniqueStrings) FLAPI;
 
-    /** Frees the space used by an encoder. */
+    /** A callback that receives the output of a streaming encoder, in order. It should return
+        false if it fails, which puts the encoder in an error state. */
+    typedef bool (*FLEncoderSink)(void *context, FLSlice data);
+
+    /** Creates a new Fleece encoder that passes its output to a callback, such as one that writes
+        to a file descriptor or socket, as soon as a buffer's worth is ready, instead of keeping
+        it in memory. FLEncoder_Finish flushes the remaining output and returns a null slice. */
+    FLEncoder FLEncoder_NewWritingToSink(FLEncoderSink NONNULL sink, void *context,
+                                         bool uniqueStrings) FLAPI;
+
+    /** Encodes a Fleece value as JSON (or JSON5), passing the output to a sink in chunks of a
+        fixed size as the value is walked, instead of returning it all at once. This takes
+        constant memory however big the value is, so it's suited to streaming a response.
+        Returns false, setting `outError`, if the sink fails. */
+    bool FLValue_WriteJSON(FLValue v,
+                           FLEncoderSink NONNULL sink, void *context,
+                           bool json5,
+                           bool canonicalForm,
+                           FLError *outError) FLAPI;
+
+    /** Returns a Fleece encoder from a per-thread pool, or creates one. Pooled encoders keep their
+        internal buffers at their high-water mark, so in steady state encoding a document does no
+        heap allocation apart from the finished output. FLEncoder_Free returns the encoder to the
+        pool of the calling thread, after resetting it and restoring its default options. */
+    FLEncoder FLEncoder_NewPooled(void) FLAPI;
+
+    /** Frees the space used by an encoder. (Or, if it came from FLEncoder_NewPooled, returns it
+        to the pool.) */
     void FLEncoder_Free(FLEncoder) FLAPI;
 
     /** Tells the encoder to use a shared-keys mapping when encoding dictionary keys. */
     void FLEncoder_SetSharedKeys(FLEncoder NONNULL, FLSharedKeys) FLAPI;
 
+    /** Returns the encoder's shared-keys mapping, or NULL if it has none. */
+    FLSharedKeys FLEncoder_GetSharedKeys(FLEncoder NONNULL) FLAPI;
+
     /** Associates an arbitrary user-defined value with the encoder. */
     void FLEncoder_SetExtraInfo(FLEncoder NONNULL, void *info) FLAPI;
 
@@ -1006,9 +1523,50 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     void FLEncoder_Amend(FLEncoder e NONNULL, FLSlice base,
                          bool reuseStrings, bool externPointers) FLAPI;
 
+    /** Resets the encoder and amends `base` reusing its strings, like FLEncoder_Reset followed
+        by FLEncoder_Amend(e, base, true, false). But if `base` is the previous base with the
+        encoder's last output appended to it, as when a document is amended repeatedly, the
+        encoder keeps its table of the strings in it instead of scanning the whole base again. */
+    void FLEncoder_ResetForAmend(FLEncoder e NONNULL, FLSlice base) FLAPI;
+
     /** Returns the `base` value passed to FLEncoder_Amend. */
     FLSlice FLEncoder_GetBase(FLEncoder NONNULL) FLAPI;
 
+    /** Tells the encoder whether to end the data with a CRC-32C checksum of it, so that it can
+        be read with \ref kFLTrustedIfChecksummed. (The default is false.) Readers that don't
+        know about checksums ignore it. Has no effect on a JSON encoder; it's an error when
+        encoding to a file. */
+    void FLEncoder_SetChecksum(FLEncoder NONNULL, bool checksum) FLAPI;
+
+    /** Tells the encoder whether to pad out-of-line doubles and floats so their bytes are
+        naturally aligned (8 or 4 bytes) relative to the start of the data, for readers that load
+        them directly. (The default is false.) Integers and packed arrays aren't aligned.
+        Readers that don't know about it ignore it. Has no effect on a JSON encoder. */
+    void FLEncoder_SetAlignNumbers(FLEncoder NONNULL, bool align) FLAPI;
+
+    /** Tells the encoder whether to keep an array or dictionary narrow (2-byte items) when only
+        a few of its items point too far back, by redirecting those through far pointers written
+        just before it, if that takes less space than widening it. (The default is false.)
+        Readers that don't support far pointers can't read the result. Has no effect on a JSON
+        encoder. */
+    void FLEncoder_SetAvoidWideCollections(FLEncoder NONNULL, bool avoidWide) FLAPI;
+
+    /** Tells the encoder whether to follow every large array and dictionary with its hash (see
+        \ref FLValue_Hash), making hashing it O(1), as well as comparing it with an unequal one.
+        (The default is false.) Readers that don't know about it ignore it. Has no effect on a
+        JSON encoder. */
+    void FLEncoder_SetEmbedHashes(FLEncoder NONNULL, bool embedHashes) FLAPI;
+
+    /** Tells the encoder whether to produce canonical output, whose bytes depend only on the
+        content written (and the other options), so that equal values encode identically and can
+        be compared or hashed as raw data. Dict keys are written as strings, even with shared keys;
+        numbers in their smallest form, with integral floating-point numbers as integers; and
+        values copied with \ref FLEncoder_WriteValue with their keys in sorted order.
+        (The default is false.) Dict keys written with \ref FLEncoder_WriteKey must be in sorted
+        order, or ending the dict fails. It can't be combined with \ref FLEncoder_Amend. Has no
+        effect on a JSON encoder. */
+    void FLEncoder_SetCanonical(FLEncoder NONNULL, bool canonical) FLAPI;
+
     /** Tells the encoder not to write the two-byte Fleece trailer at the end of the data.
         This is only useful for certain special purposes. */
     void FLEncoder_SuppressTrailer(FLEncoder NONNULL) FLAPI;
@@ -1083,6 +1641,16 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
         @return  True on success, false on error. */
     bool FLEncoder_WriteDateString(FLEncoder NONNULL encoder, FLTimestamp ts, bool asUTC) FLAPI;
 
+    /** Writes a timestamp to an encoder. In Fleece this is an ISO-8601 date string, as written
+        by FLEncoder_WriteDateString, that also stores the timestamp in binary, so
+        FLValue_AsTimestamp reads it back without parsing. Older readers see only the string.
+        In JSON it's the same as FLEncoder_WriteDateString.
+        @param encoder  The encoder to write to.
+        @param ts  The timestamp (milliseconds since Unix epoch 1-1-1970).
+        @param asUTC  If true, date is written in UTC (GMT); if false, with the local timezone.
+        @return  True on success, false on error. */
+    bool FLEncoder_WriteTimestamp(FLEncoder NONNULL encoder, FLTimestamp ts, bool asUTC) FLAPI;
+
     /** Writes a binary data value (a blob) to an encoder. This can contain absolutely anything
         including null bytes.
         If the encoder is generating JSON, the blob will be written as a base64-encoded string. */
@@ -1123,6 +1691,36 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
         The key is given as a Value, which must be a string or integer. */
     bool FLEncoder_WriteKeyValue(FLEncoder NONNULL, FLValue NONNULL) FLAPI;
 
+    /** Specifies the key for the next value to be written to the current dictionary, as an
+        FLResolvedKey. If the key was resolved with the same SharedKeys the encoder uses, and has
+        an integer encoding, that's written without looking the string up again. */
+    bool FLEncoder_WriteResolvedKey(FLEncoder NONNULL, FLResolvedKey NONNULL) FLAPI;
+
+#ifndef FL_IMPL
+    typedef struct _FLEncoderKey* FLEncoderKey;   ///< A reference to a prepared key for encoding.
+#endif
+
+    /** Creates a key for writing with \ref FLEncoder_WritePreparedKey, for a fixed vocabulary of
+        keys written over and over. The string's hash is computed just once, and its integer
+        encoding in SharedKeys is remembered after the first time it's written, so writing it
+        again doesn't hash it or look it up. It can be used by any number of encoders at once.
+        @param string  The key string (UTF-8). It's copied, so it needn't remain valid.
+        @return  A new FLEncoderKey, which must be freed with \ref FLEncoderKey_Free. */
+    FLEncoderKey FLEncoderKey_New(FLString string) FLAPI;
+
+    /** Frees an FLEncoderKey. (It's ok to pass NULL.) */
+    void FLEncoderKey_Free(FLEncoderKey) FLAPI;
+
+    /** Specifies the key for the next value to be written to the current dictionary, as an
+        FLEncoderKey. Equivalent to FLEncoder_WriteKey with its string, but faster. */
+    bool FLEncoder_WritePreparedKey(FLEncoder NONNULL, FLEncoderKey NONNULL) FLAPI;
+
+    /** Writes a batch of items (see \ref FLItem) in one call. For each item, writes its `key`
+        first if it's not null (as FLEncoder_WriteKey), then its `value` if it's not NULL, else
+        the scalar of the given `type` from `asInt`, `asDouble` or `asString`.
+        An item with no value can't be an array or dict. */
+    bool FLEncoder_WriteItems(FLEncoder NONNULL, const FLItem items[], size_t count) FLAPI;
+
     /** Ends writing a dictionary value; pops back the previous encoding state. */
     bool FLEncoder_EndDict(FLEncoder NONNULL) FLAPI;
 
@@ -1171,6 +1769,59 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     MUST_USE_RESULT
     FLSliceResult FLEncoder_Finish(FLEncoder e, FLError *outError) FLAPI;
 
+    /** @} */
+    /** \name Templates
+         @{
+        A template is a document encoded once with placeholders in place of some scalar values.
+        Instantiating it copies the data and stores values into the placeholders, which is much
+        cheaper than encoding a document of the same shape again. */
+
+#ifndef FL_IMPL
+    typedef struct _FLDocTemplate* FLDocTemplate;   ///< A reference to a document template.
+#endif
+
+    /** Types of template placeholders. */
+    typedef enum {
+        kFLPlaceholderInt,          ///< A 64-bit signed integer
+        kFLPlaceholderDouble,       ///< A 64-bit floating-point number
+        kFLPlaceholderString,       ///< A string of any length
+    } FLPlaceholderType;
+
+    /** A value to store in a placeholder; only the field matching its type is used. */
+    typedef struct {
+        int64_t  intValue;
+        double   doubleValue;
+        FLString stringValue;
+    } FLTemplateValue;
+
+    /** Writes a placeholder, whose value will be given when the template is instantiated.
+        Placeholders are numbered in the order they're written. A placeholder can't be a Dict key,
+        and can't be used by an encoder with a base or checksums, or one writing to a file. */
+    bool FLEncoder_WritePlaceholder(FLEncoder NONNULL, FLPlaceholderType) FLAPI;
+
+    /** Ends encoding; if there has been no error, it returns the encoded data and its
+        placeholders as a template, which must be freed with \ref FLDocTemplate_Free.
+        This does not free the FLEncoder; call FLEncoder_Free (or FLEncoder_Reset) next. */
+    FLDocTemplate FLEncoder_FinishTemplate(FLEncoder NONNULL, FLError*) FLAPI;
+
+    /** Frees a template. (It's ok to pass NULL.) */
+    void FLDocTemplate_Free(FLDocTemplate) FLAPI;
+
+    /** Returns the number of placeholders in a template. */
+    size_t FLDocTemplate_PlaceholderCount(FLDocTemplate NONNULL) FLAPI;
+
+    /** Returns a new document made from the template, with its placeholders filled in.
+        @param tmpl  The template.
+        @param values  The values of the placeholders, in order.
+        @param count  The number of values; must equal the number of placeholders.
+        @param outError  On failure, the error code will be stored here.
+        @return  The encoded document, or a null slice on error. */
+    MUST_USE_RESULT
+    FLSliceResult FLDocTemplate_Instantiate(FLDocTemplate NONNULL tmpl,
+                                            const FLTemplateValue values[],
+                                            size_t count,
+                                            FLError *outError) FLAPI;
+
     /** @} */
     /** \name Error handling
          @{ */
@@ -1208,13 +1859,22 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
 
     /** Writes JSON that describes the changes to turn the value `old` into `nuu`.
         (The format is documented in Fleece.md, but you should treat it as a black box.)
+        If the encoder is a Fleece encoder, a Fleece-encoded delta is written instead; it has the
+        same structure, but can be applied with \ref FLApplyFleeceDelta without parsing JSON.
         @param old  A value that's typically the old/original state of some data.
         @param nuu  A value that's typically the new/changed state of the `old` data.
         @param jsonEncoder  An encoder to write the JSON to. Must have been created using
-                `FLEncoder_NewWithOptions`, with JSON or JSON5 format.
+                `FLEncoder_NewWithOptions`, with JSON or JSON5 format, or else it's a Fleece encoder.
         @return  True on success, false on (extremely unlikely) failure. */
     bool FLEncodeJSONDelta(FLValue old, FLValue nuu, FLEncoder NONNULL jsonEncoder) FLAPI;
 
+    /** Returns Fleece data that encodes the changes to turn the value `old` into `nuu`.
+        This is the same delta as \ref FLCreateJSONDelta's, but Fleece-encoded, so it's
+        smaller and faster to apply. Apply it with \ref FLApplyFleeceDelta.
+        @return  Fleece data representing the changes from `old` to `nuu`, or NULL on
+                    (extremely unlikely) failure. */
+    FLSliceResult FLCreateFleeceDelta(FLValue old, FLValue nuu) FLAPI;
+
 
     /** Applies the JSON data created by `CreateJSONDelta` to the value `old`, which must be equal
         to the `old` value originally passed to `FLCreateJSONDelta`, and returns a Fleece document
@@ -1241,6 +1901,44 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
                                    FLSlice jsonDelta,
                                    FLEncoder encoder) FLAPI;
 
+    /** Applies many JSON deltas, each to its own `old` value, concurrently on a pool of worker
+        threads. This is much faster than calling \ref FLApplyJSONDelta on each one when there
+        are many to apply and several CPU cores.
+        @param count  The number of items in each of the arrays.
+        @param olds  The values to apply the deltas to. They must not be mutated during the call.
+        @param jsonDeltas  The JSON deltas created by `FLCreateJSONDelta`.
+        @param results  The resulting Fleece documents are stored here, in the same order. An item
+                    whose delta can't be applied gets a null result. The caller must release the
+                    results with `FLSliceResult_Release`.
+        @param errors  If non-null, each item's error (or kFLNoError) is stored here.
+        @param nThreads  The number of threads to use, or 0 for the Executor's concurrency.
+        @return  True if all the deltas were applied, false if any failed. */
+    bool FLApplyJSONDeltas(size_t count,
+                           const FLValue olds[],
+                           const FLSlice jsonDeltas[],
+                           FLSliceResult results[],
+                           FLError errors[],
+                           unsigned nThreads) FLAPI;
+
+    /** Applies a Fleece-encoded delta, created by `FLCreateFleeceDelta` or by
+        `FLEncodeJSONDelta` with a Fleece encoder, to the value `old` and returns a Fleece document
+        equal to the original `nuu` value.
+        @param old  A value that's typically the old/original state of some data. This must be
+                    equal to the `old` value used when creating the delta.
+        @param fleeceDelta  The root value of the Fleece-encoded delta.
+        @param error  On failure, error information will be stored where this points, if non-null.
+        @return  The corresponding `nuu` value, encoded as Fleece, or null if an error occurred. */
+    FLSliceResult FLApplyFleeceDelta(FLValue old,
+                                     FLValue fleeceDelta,
+                                     FLError *error) FLAPI;
+
+    /** Applies a Fleece-encoded delta to the value `old`, and writes the corresponding `nuu` value
+        to the encoder. (See \ref FLApplyFleeceDelta.)
+        @return  True on success, false on error; call `FLEncoder_GetError` for details. */
+    bool FLEncodeApplyingFleeceDelta(FLValue old,
+                                     FLValue fleeceDelta,
+                                     FLEncoder encoder) FLAPI;
+
 
     //////// VALUE SLOTS
 
@@ -1263,40 +1961,44 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     /** Returns an FLSlot that refers to the given index of the given array.
         You store a value to it by calling one of the nine `FLSlot_Set...` functions.
         \warning You should immediately store a value into the `FLSlot`. Do not keep it around;
-                 any changes to the array invalidate it.*/
+                 any changes to the array invalidate it.
+        Returns NULL if the index is out of range or the array is frozen.*/
     MUST_USE_RESULT
     FLSlot FLMutableArray_Set(FLMutableArray NONNULL, uint32_t index) FLAPI;
 
     /** Appends a null value to the array and returns an `FLSLot` that refers to that position.
         You store a value to it by calling one of the nine `FLSlot_Set...` functions.
         \warning You should immediately store a value into the `FLSlot`. Do not keep it around;
-                 any changes to the array invalidate it.*/
+                 any changes to the array invalidate it.
+        Returns NULL if the array is frozen.*/
     MUST_USE_RESULT
     FLSlot FLMutableArray_Append(FLMutableArray NONNULL) FLAPI;
 
     /** Returns an FLSlot that refers to the given key/value pair of the given dictionary.
         You store a value to it by calling one of the nine `FLSlot_Set...` functions.
         \warning You should immediately store a value into the `FLSlot`. Do not keep it around;
-                 any changes to the dictionary invalidate it.*/
+                 any changes to the dictionary invalidate it.
+        Returns NULL if the dictionary is frozen.*/
     MUST_USE_RESULT
     FLSlot FLMutableDict_Set(FLMutableDict FL_NONNULL, FLString key) FLAPI;
 
 
-    void FLSlot_SetNull(FLSlot NONNULL) FLAPI;             ///< Stores a JSON null into a slot.
-    void FLSlot_SetBool(FLSlot NONNULL, bool) FLAPI;       ///< Stores a boolean into a slot.
-    void FLSlot_SetInt(FLSlot NONNULL, int64_t) FLAPI;     ///< Stores an integer into a slot.
-    void FLSlot_SetUInt(FLSlot NONNULL, uint64_t) FLAPI;   ///< Stores an unsigned int into a slot.
-    void FLSlot_SetFloat(FLSlot NONNULL, float) FLAPI;     ///< Stores a `float` into a slot.
-    void FLSlot_SetDouble(FLSlot NONNULL, double) FLAPI;   ///< Stores a `double` into a slot.
-    void FLSlot_SetString(FLSlot NONNULL, FLString) FLAPI; ///< Stores a UTF-8 string into a slot.
-    void FLSlot_SetData(FLSlot NONNULL, FLSlice) FLAPI;    ///< Stores a data blob into a slot.
-    void FLSlot_SetValue(FLSlot NONNULL, FLValue) FLAPI;   ///< Stores an FLValue into a slot.
+    // The `FLSlot_Set...` functions do nothing if the slot is NULL.
+    void FLSlot_SetNull(FLSlot) FLAPI;             ///< Stores a JSON null into a slot.
+    void FLSlot_SetBool(FLSlot, bool) FLAPI;       ///< Stores a boolean into a slot.
+    void FLSlot_SetInt(FLSlot, int64_t) FLAPI;     ///< Stores an integer into a slot.
+    void FLSlot_SetUInt(FLSlot, uint64_t) FLAPI;   ///< Stores an unsigned int into a slot.
+    void FLSlot_SetFloat(FLSlot, float) FLAPI;     ///< Stores a `float` into a slot.
+    void FLSlot_SetDouble(FLSlot, double) FLAPI;   ///< Stores a `double` into a slot.
+    void FLSlot_SetString(FLSlot, FLString) FLAPI; ///< Stores a UTF-8 string into a slot.
+    void FLSlot_SetData(FLSlot, FLSlice) FLAPI;    ///< Stores a data blob into a slot.
+    void FLSlot_SetValue(FLSlot, FLValue) FLAPI;   ///< Stores an FLValue into a slot.
     
-    static inline void FLSlot_SetArray(FLSlot NONNULL slot, FLArray array) {
+    static inline void FLSlot_SetArray(FLSlot slot, FLArray array) {
         FLSlot_SetValue(slot, (FLValue)array);
     }
 
-    static inline void FLSlot_SetDict(FLSlot NONNULL slot, FLDict dict) {
+    static inline void FLSlot_SetDict(FLSlot slot, FLDict dict) {
         FLSlot_SetValue(slot, (FLValue)dict);
     }
 
@@ -1406,6 +2108,94 @@ while (NULL != (value = FLDictIterator_GetValue(&iter))) {
     }
 
 
+
+
+    //////// EXECUTOR
+
+
+    /** @} */
+    /** \defgroup executor   Executor
+        @{
+         Fleece's parallel operations (\ref FLValue_VisitParallel, \ref FLApplyJSONDeltas, and
+         parallel JSON conversion and indexing) run their work as tasks on an executor. By default
+         that's an internal work-stealing thread pool, with a thread per CPU core but one; an app
+         that has its own thread pool can have Fleece use that instead. */
+
+    /** An executor provided by the app. `submit` must arrange for `task(taskContext)` to be
+        called soon, on some thread other than the caller's. */
+    typedef struct FLExecutor {
+        void (*submit)(void *context, void (*task)(void *taskContext), void *taskContext);
+        unsigned concurrency;           ///< The number of tasks it can run at once
+        void *context;
+    } FLExecutor;
+
+    /** Sets the executor to use, or restores the default thread pool if given NULL. The struct
+        is copied. Set it at startup, before running any parallel operations. */
+    void FLSetExecutor(const FLExecutor*) FLAPI;
+
+    /** Runs `task(context)` asynchronously on the current executor. */
+    void FLExecutor_Submit(void (*task)(void *context), void *context) FLAPI;
+
+    /** Calls `fn(context, i)` for each `i` in [0, count), with up to `maxTasks` calls at once
+        (0 means the executor's concurrency), and returns when all are done. The calling thread
+        runs items too, so it's safe to call from a task. */
+    void FLExecutor_ParallelFor(size_t count, unsigned maxTasks,
+                                void (*fn)(void *context, size_t i), void *context) FLAPI;
+
+
+    //////// INSTRUMENTATION
+
+
+    /** @} */
+    /** \defgroup stats   Instrumentation
+        @{
+         Fleece always counts some of the things it does, cheaply (with per-thread counters that
+         are added to the totals in batches), so an app can feed them into its metrics. */
+
+    /** Counts of Fleece operations, since launch or the last call to \ref FLResetStats.
+        \note  Some counted functions, like FLDict_Get, are declared pure, so the compiler may
+               skip a call whose result is unused, or that repeats an earlier call with the same
+               arguments; the counts are of the calls actually made. Trusted data is validated
+               too in debug builds. */
+    typedef struct FLStats {
+        uint64_t dictLookups;           ///< Dict lookups by key
+        uint64_t dictKeyComparisons;    ///< Key comparisons made by Dict lookups
+        uint64_t scopeLookups;          ///< Lookups of the Doc containing a Value
+        uint64_t validations;           ///< Fleece data validated
+        uint64_t validatedBytes;        ///< Bytes of Fleece data validated
+        uint64_t encodedBytes;          ///< Bytes of Fleece data written by encoders
+        uint64_t dedupedStrings;        ///< Strings encoders wrote as pointers to earlier copies
+        uint64_t mutablePromotions;     ///< Immutable collections given mutable copies
+        uint64_t heapValues;            ///< Mutable values allocated
+    } FLStats;
+
+    /** Returns the current counts. The calling thread's are exact; other threads' are added in
+        batches of 256 events, so their most recent ones may be missing. */
+    FLStats FLGetStats(void) FLAPI;
+
+    /** Resets the counts to zero. Other threads' counts that haven't been added yet will still
+        be added later. */
+    void FLResetStats(void) FLAPI;
+
+
+    /** Callbacks invoked around potentially long operations, for distributed tracing: Doc
+        creation, validation (`Value::fromData`), `JSONConverter::encodeJSON`, `Encoder::finish`,
+        `JSONDelta::create` and `JSONDelta::apply`. Both are called on the thread doing the
+        operation, and spans nest (Doc creation includes validation.) Sizes are in bytes; the
+        output size is 0 for operations that don't produce data. */
+    typedef struct FLTracer {
+        void (*begin)(void *context, const char *operation, size_t inputSize);
+        void (*end)(void *context, const char *operation, size_t inputSize,
+                    size_t outputSize, double seconds);
+        void *context;
+        size_t minInputSize;            ///< Operations on less input than this aren't traced
+    } FLTracer;
+
+    /** Sets the tracer, or clears it if given NULL. The struct is copied. While no tracer is set,
+        the cost to each operation is a single load. */
+    void FLSetTracer(const FLTracer*) FLAPI;
+
+
     /** @} */
 
 #ifdef __cplusplus
@@ -23,8 +23,13 @@
 #include "Fleece.h"
 #endif
 #include "slice.hh"
+#ifdef FLEECE_INLINE_ACCESSORS
+#include "Fleece+Inline.h"
+#endif
+#include <algorithm>
 #include <string>
 #include <utility>
+#include <vector>
 
 namespace fleece {
     class Array;
@@ -87,6 +92,7 @@ namespace fleece {
         inline Value operator[] (const KeyPath &kp) const;
 
         inline Doc findDoc() const;
+        void prefetch(bool deep =false) const           {FLValue_Prefetch(_val, deep);}
 
         static Value fromData(slice data, FLTrust t =kFLUntrusted)
                                                         {return FLValue_FromData(data,t);}
@@ -130,6 +136,18 @@ namespace fleece {
         inline bool empty() const;
         inline Value get(uint32_t index) const;
 
+        void extractColumns(FLColumn columns[], size_t count) const {
+            FLArray_ExtractColumns(*this, columns, count);
+        }
+
+        FLArrayStats stats() const                      {return FLArray_GetStats(*this);}
+
+        uint32_t filterNumbers(double minValue, double maxValue, uint8_t *bitmap) const {
+            return FLArray_FilterNumbers(*this, minValue, maxValue, bitmap);
+        }
+
+        uint32_t lowerBound(Value value) const          {return FLArray_LowerBound(*this, value);}
+
         inline Value operator[] (int index) const       {return get(index);}
         inline Value operator[] (const KeyPath &kp) const {return Value::operator[](kp);}
 
@@ -280,6 +298,8 @@ namespace fleece {
             return FLKeyPath_EvalOnce(specifier, root, error);
         }
 
+        inline bool evalAll(Value root, Encoder&) const;
+
         explicit operator std::string() const {
             return std::string(alloc_slice(FLKeyPath_ToString(_path)));
         }
@@ -307,6 +327,8 @@ namespace fleece {
         size_t depth() const                            {return FLDeepIterator_GetDepth(_i);}
         alloc_slice pathString() const                  {return FLDeepIterator_GetPathString(_i);}
         alloc_slice JSONPointer() const                 {return FLDeepIterator_GetJSONPointer(_i);}
+        slice pathSlice() const                         {return FLDeepIterator_GetPathSlice(_i);}
+        slice JSONPointerSlice() const                  {return FLDeepIterator_GetJSONPointerSlice(_i);}
 
         void skipChildren()                             {FLDeepIterator_SkipChildren(_i);}
         bool next()                                     {return FLDeepIterator_Next(_i);}
@@ -336,6 +358,9 @@ namespace fleece {
         bool loadState(slice data)                          {return FLSharedKeys_LoadStateData(_sk, data);}
         bool loadState(Value state)                         {return FLSharedKeys_LoadState(_sk, state);}
         alloc_slice stateData() const                       {return FLSharedKeys_GetStateData(_sk);}
+        alloc_slice imageData() const                       {return FLSharedKeys_GetImageData(_sk);}
+        bool useImage(slice image)                          {return FLSharedKeys_UseImage(_sk, image);}
+        bool useSharedMemoryImage(const char *name)         {return FLSharedKeys_UseSharedMemoryImage(_sk, name);}
         inline void writeState(const Encoder &enc);
         unsigned count() const                              {return FLSharedKeys_Count(_sk);}
         void revertToCount(unsigned count)                  {FLSharedKeys_RevertToCount(_sk, count);}
@@ -368,6 +393,16 @@ namespace fleece {
 
         static inline Doc fromJSON(slice_NONNULL json, FLError *outError = nullptr);
 
+        static inline Doc fromMappedFile(const char *path,
+                                         FLTrust trust =kFLUntrusted,
+                                         SharedKeys sk =nullptr,
+                                         FLError *outError = nullptr);
+
+        static inline Doc fromSharedMemory(const char *name,
+                                           FLTrust trust =kFLUntrusted,
+                                           SharedKeys sk =nullptr,
+                                           FLError *outError = nullptr);
+
         static alloc_slice dump(slice_NONNULL fleeceData)   {return FLData_Dump(fleeceData);}
 
         Doc()                                       :_doc(nullptr) { }
@@ -383,6 +418,9 @@ namespace fleece {
         SharedKeys sharedKeys() const               {return FLDoc_GetSharedKeys(_doc);}
 
         Value root() const                          {return FLDoc_GetRoot(_doc);}
+        unsigned externDepth() const                {return FLDoc_GetExternDepth(_doc);}
+        size_t memoryUsage() const                  {return FLDoc_GetMemoryUsage(_doc);}
+        inline Doc flattened(unsigned maxExternDepth =0, FLError *outError =nullptr) const;
         explicit operator bool () const             {return root() != nullptr;}
         Array asArray() const                       {return root().asArray();}
         Dict asDict() const                         {return root().asDict();}
@@ -440,8 +478,10 @@ namespace fleece {
         ~Encoder()                                      {FLEncoder_Free(_enc);}
 
         void setSharedKeys(SharedKeys sk)               {FLEncoder_SetSharedKeys(_enc, sk);}
+        SharedKeys sharedKeys() const                   {return FLEncoder_GetSharedKeys(_enc);}
 
         inline void amend(slice base, bool reuseStrings =false, bool externPointers =false);
+        void resetForAmend(slice base)                  {FLEncoder_ResetForAmend(_enc, base);}
         slice base() const                              {return FLEncoder_GetBase(_enc);}
 
         void suppressTrailer()                          {FLEncoder_SuppressTrailer(_enc);}
@@ -459,6 +499,7 @@ namespace fleece {
         inline bool writeString(const char *s)          {return writeString(slice(s));}
         inline bool writeString(std::string s)          {return writeString(slice(s));}
         inline bool writeDateString(FLTimestamp, bool asUTC =true);
+        inline bool writeTimestamp(FLTimestamp, bool asUTC =true);
         inline bool writeData(slice);
         inline bool writeValue(Value);
         inline bool convertJSON(slice_NONNULL);
@@ -568,6 +609,22 @@ namespace fleece {
         static inline bool apply(Value old,
                                  slice jsonDelta,
                                  Encoder &encoder);
+
+        /** Applies many deltas concurrently; see \ref FLApplyJSONDeltas. The results are in the
+            same order as the inputs; any that failed are null. */
+        static inline std::vector<alloc_slice> applyMany(const std::vector<Value> &olds,
+                                                         const std::vector<slice> &jsonDeltas,
+                                                         unsigned nThreads =0);
+
+        /** Fleece-encoded deltas: same structure as JSON deltas, but no JSON parsing to apply.
+            (To write one to an Encoder, call `create` with a Fleece Encoder.) */
+        static inline alloc_slice createFleece(Value old, Value nuu);
+        static inline alloc_slice apply(Value old,
+                                        Value fleeceDelta,
+                                        FLError *error);
+        static inline bool apply(Value old,
+                                 Value fleeceDelta,
+                                 Encoder &encoder);
     };
 
 
@@ -599,17 +656,35 @@ namespace fleece {
 
     //////// IMPLEMENTATION GUNK:
 
+#ifdef FLEECE_INLINE_ACCESSORS
+    // False if the library doesn't match Fleece+Inline.h, in which case the accessors call it
+    // instead. (It's also false until it's initialized, so static initializers are safe too.)
+    inline const bool _kInlineAccessorsCompatible = FLInline_IsCompatible();
+
+    #define _FLINLINE(NAME, ...) \
+        (_kInlineAccessorsCompatible ? NAME##_Inline(__VA_ARGS__) : NAME(__VA_ARGS__))
+
+    inline FLValueType Value::type() const      {return _FLINLINE(FLValue_GetType, _val);}
+    inline bool Value::isInteger() const        {return _FLINLINE(FLValue_IsInteger, _val);}
+    inline bool Value::isUnsigned() const       {return _FLINLINE(FLValue_IsUnsigned, _val);}
+    inline bool Value::isDouble() const         {return _FLINLINE(FLValue_IsDouble, _val);}
+    inline bool Value::asBool() const           {return _FLINLINE(FLValue_AsBool, _val);}
+    inline int64_t Value::asInt() const         {return _FLINLINE(FLValue_AsInt, _val);}
+    inline uint64_t Value::asUnsigned() const   {return _FLINLINE(FLValue_AsUnsigned, _val);}
+    inline float Value::asFloat() const         {return _FLINLINE(FLValue_AsFloat, _val);}
+    inline double Value::asDouble() const       {return _FLINLINE(FLValue_AsDouble, _val);}
+#else
     inline FLValueType Value::type() const      {return FLValue_GetType(_val);}
     inline bool Value::isInteger() const        {return FLValue_IsInteger(_val);}
     inline bool Value::isUnsigned() const       {return FLValue_IsUnsigned(_val);}
     inline bool Value::isDouble() const         {return FLValue_IsDouble(_val);}
-    inline bool Value::isMutable() const        {return FLValue_IsMutable(_val);}
-
     inline bool Value::asBool() const           {return FLValue_AsBool(_val);}
     inline int64_t Value::asInt() const         {return FLValue_AsInt(_val);}
     inline uint64_t Value::asUnsigned() const   {return FLValue_AsUnsigned(_val);}
     inline float Value::asFloat() const         {return FLValue_AsFloat(_val);}
     inline double Value::asDouble() const       {return FLValue_AsDouble(_val);}
+#endif
+    inline bool Value::isMutable() const        {return FLValue_IsMutable(_val);}
     inline FLTimestamp Value::asTimestamp() const {return FLValue_AsTimestamp(_val);}
     inline slice Value::asString() const        {return FLValue_AsString(_val);}
     inline slice Value::asData() const          {return FLValue_AsData(_val);}
@@ -628,9 +703,16 @@ namespace fleece {
 
 
 
+#ifdef FLEECE_INLINE_ACCESSORS
+    inline uint32_t Array::count() const        {return _FLINLINE(FLArray_Count, *this);}
+    inline bool Array::empty() const            {return _FLINLINE(FLArray_IsEmpty, *this);}
+    inline Value Array::get(uint32_t i) const   {return _FLINLINE(FLArray_Get, *this, i);}
+    #undef _FLINLINE
+#else
     inline uint32_t Array::count() const        {return FLArray_Count(*this);}
     inline bool Array::empty() const            {return FLArray_IsEmpty(*this);}
     inline Value Array::get(uint32_t i) const   {return FLArray_Get(*this, i);}
+#endif
 
     inline Array::iterator::iterator(Array a)   {FLArrayIterator_Begin(a, this);}
     inline Value Array::iterator::value() const {return FLArrayIterator_GetValue(this);}
@@ -652,6 +734,10 @@ namespace fleece {
 
     inline void SharedKeys::writeState(const Encoder &enc) {FLSharedKeys_WriteState(_sk, enc);}
 
+    inline bool KeyPath::evalAll(Value root, Encoder &enc) const {
+        return FLKeyPath_EvalAll(_path, root, enc);
+    }
+
     inline void Encoder::amend(slice base, bool reuseStrings, bool externPointers)
                                                 {FLEncoder_Amend(_enc, base,
                                                                      reuseStrings, externPointers);}
@@ -665,6 +751,8 @@ namespace fleece {
     inline bool Encoder::writeString(slice s)   {return FLEncoder_WriteString(_enc, s);}
     inline bool Encoder::writeDateString(FLTimestamp ts, bool asUTC)
                                                 {return FLEncoder_WriteDateString(_enc, ts, asUTC);}
+    inline bool Encoder::writeTimestamp(FLTimestamp ts, bool asUTC)
+                                                {return FLEncoder_WriteTimestamp(_enc, ts, asUTC);}
     inline bool Encoder::writeData(slice data){return FLEncoder_WriteData(_enc, data);}
     inline bool Encoder::writeValue(Value v)    {return FLEncoder_WriteValue(_enc, v);}
     inline bool Encoder::convertJSON(slice_NONNULL j) {return FLEncoder_ConvertJSON(_enc, j);}
@@ -699,6 +787,30 @@ namespace fleece {
                                  Encoder &encoder) {
         return FLEncodeApplyingJSONDelta(old, jsonDelta, encoder);
     }
+    inline std::vector<alloc_slice> JSONDelta::applyMany(const std::vector<Value> &olds,
+                                                         const std::vector<slice> &jsonDeltas,
+                                                         unsigned nThreads) {
+        size_t count = std::min(olds.size(), jsonDeltas.size());
+        std::vector<FLValue> oldValues(olds.begin(), olds.begin() + count);
+        std::vector<FLSlice> deltas(jsonDeltas.begin(), jsonDeltas.begin() + count);
+        std::vector<FLSliceResult> results(count);
+        FLApplyJSONDeltas(count, oldValues.data(), deltas.data(), results.data(),
+                          nullptr, nThreads);
+        std::vector<alloc_slice> out;
+        out.reserve(count);
+        for (auto &result : results)
+            out.emplace_back(std::move(result));
+        return out;
+    }
+    inline alloc_slice JSONDelta::createFleece(Value old, Value nuu) {
+        return FLCreateFleeceDelta(old, nuu);
+    }
+    inline alloc_slice JSONDelta::apply(Value old, Value fleeceDelta, FLError *error) {
+        return FLApplyFleeceDelta(old, fleeceDelta, error);
+    }
+    inline bool JSONDelta::apply(Value old, Value fleeceDelta, Encoder &encoder) {
+        return FLEncodeApplyingFleeceDelta(old, fleeceDelta, encoder);
+    }
 
     inline SharedKeys SharedKeys::create(slice state) {
         auto sk = create();
@@ -724,6 +836,22 @@ namespace fleece {
         return Doc(FLDoc_FromJSON(json, outError), false);
     }
 
+    inline Doc Doc::fromMappedFile(const char *path, FLTrust trust, SharedKeys sk,
+                                   FLError *outError)
+    {
+        return Doc(FLDoc_FromMappedFile(path, trust, sk, outError), false);
+    }
+
+    inline Doc Doc::fromSharedMemory(const char *name, FLTrust trust, SharedKeys sk,
+                                     FLError *outError)
+    {
+        return Doc(FLDoc_FromSharedMemory(name, trust, sk, outError), false);
+    }
+
+    inline Doc Doc::flattened(unsigned maxExternDepth, FLError *outError) const {
+        return Doc(FLDoc_Flatten(_doc, maxExternDepth, outError), false);
+    }
+
     inline Doc& Doc::operator=(const Doc &other) {
         if (other._doc != _doc) {
             FLDoc_Release(_doc);
@@ -103,6 +103,17 @@ namespace fleece {
         /** True if this array has been modified since it was created. */
         bool isChanged() const                  {return FLMutableArray_IsChanged(*this);}
 
+        /** Makes this array, and everything in it, read-only and safe to read from any number
+            of threads at once. Modifying it afterwards fails. Returns false if it can't be
+            frozen (see FLMutableArray_Freeze.) */
+        bool freeze()                           {return FLMutableArray_Freeze(*this, nullptr);}
+        bool isFrozen() const                   {return FLMutableArray_IsFrozen(*this);}
+
+        /** Returns a frozen snapshot of the array's current state, sharing the collections
+            nested in it (see FLMutableArray_Snapshot.) */
+        MutableArray snapshot() const           {return MutableArray(FLMutableArray_Snapshot(*this), false);}
+        size_t memoryUsage() const              {return FLMutableArray_GetMemoryUsage(*this);}
+
         /** Removes a range of values from the array. */
         void remove(uint32_t first, uint32_t n =1) {FLMutableArray_Remove(*this, first, n);}
 
@@ -174,6 +185,10 @@ namespace fleece {
 
         Dict source() const                     {return FLMutableDict_GetSource(*this);}
         bool isChanged() const                  {return FLMutableDict_IsChanged(*this);}
+        bool freeze()                           {return FLMutableDict_Freeze(*this, nullptr);}
+        bool isFrozen() const                   {return FLMutableDict_IsFrozen(*this);}
+        MutableDict snapshot() const            {return MutableDict(FLMutableDict_Snapshot(*this), false);}
+        size_t memoryUsage() const              {return FLMutableDict_GetMemoryUsage(*this);}
 
         void remove(slice key)                  {FLMutableDict_Remove(*this, key);}
 
@@ -198,6 +213,14 @@ namespace fleece {
         inline MutableArray getMutableArray(slice key);
         inline MutableDict getMutableDict(slice key);
 
+        /** Encodes this Dict as a delta to its source's document; see \ref FLMutableDict_Amend. */
+        alloc_slice amend(bool reuseStrings =false, bool externPointers =false,
+                          FLError *outError =nullptr) const
+        {
+            return alloc_slice(FLMutableDict_Amend(*this, reuseStrings, externPointers,
+                                                   outError));
+        }
+
     private:
         MutableDict(FLMutableDict d, bool)      :Dict((FLDict)d) {}
         friend class RetainedValue;
@@ -0,0 +1,273 @@
+//
+// StructCoder.hh
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+
+#pragma once
+#ifndef _FLEECE_STRUCTCODER_HH
+#define _FLEECE_STRUCTCODER_HH
+#include "Fleece.hh"
+#include <algorithm>
+#include <array>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace fleece {
+
+    /*  Encodes C++ structs as Fleece Dicts, and decodes them, from a compile-time description
+        of their fields. For example:
+
+            struct Point { int x, y; std::string label; };
+
+            template<> struct fleece::StructFields<Point> {
+                static constexpr auto fields = std::make_tuple(fleece::field("x", &Point::x),
+                                                               fleece::field("y", &Point::y),
+                                                               fleece::field("label", &Point::label));
+            };
+
+            encodeStruct(enc, point);               // writes {"label":..., "x":..., "y":...}
+            bool complete = decodeStruct(dict, point);
+
+        The keys are sorted at compile time, so encoding writes them in the order the Dict stores
+        them, and decoding looks them all up in a single pass through the Dict. Field types can be
+        bool, numbers, std::string, std::vector of a field type, or another described struct.
+        To encode with SharedKeys, use a StructCoder, which resolves the keys up front. */
+
+
+    /** Describes one field of a struct: its Dict key and a pointer to the member. */
+    template <class S, class T>
+    struct StructField {
+        const char *key;
+        T S::*member;
+    };
+
+    template <class S, class T>
+    constexpr StructField<S,T> field(const char *key, T S::*member) {return {key, member};}
+
+    /** Specialize this for a struct, with a `static constexpr` tuple of `field`s named `fields`. */
+    template <class S> struct StructFields;
+
+
+    namespace structcoder {
+
+        template <class S, class = void>
+        struct isDescribed : std::false_type { };
+        template <class S>
+        struct isDescribed<S, std::void_t<decltype(StructFields<S>::fields)>> : std::true_type { };
+
+        template <class T> struct isVector : std::false_type { };
+        template <class T, class A> struct isVector<std::vector<T,A>> : std::true_type { };
+
+        // Compile-time facts about a described struct:
+        template <class S>
+        struct Info {
+            static constexpr const auto& fields = StructFields<S>::fields;
+            static constexpr size_t count = std::tuple_size_v<std::decay_t<decltype(fields)>>;
+
+            static constexpr std::array<std::string_view,count> keys =
+                std::apply([](const auto&... f) {
+                    return std::array<std::string_view,count>{std::string_view(f.key)...};
+                }, fields);
+
+            // Field indexes in the order a Dict stores string keys (bytewise, then by length):
+            static constexpr std::array<size_t,count> order = [] {
+                std::array<size_t,count> o {};
+                for (size_t i = 0; i < count; ++i)
+                    o[i] = i;
+                for (size_t i = 1; i < count; ++i)
+                    for (size_t j = i; j > 0 && keys[o[j]] < keys[o[j-1]]; --j) {
+                        size_t t = o[j]; o[j] = o[j-1]; o[j-1] = t;
+                    }
+                for (size_t i = 1; i < count; ++i) {
+                    if (keys[o[i]] == keys[o[i-1]])
+                        throw "duplicate key in StructFields";  // (fails the constant evaluation)
+                }
+                return o;
+            }();
+
+            static constexpr std::array<FLSlice,count> sortedKeys = [] {
+                std::array<FLSlice,count> k {};
+                for (size_t i = 0; i < count; ++i)
+                    k[i] = FLSlice{keys[order[i]].data(), keys[order[i]].size()};
+                return k;
+            }();
+        };
+
+
+        template <class T> void encodeValue(Encoder&, const T&);
+        template <class T> void decodeValue(Value, T&);
+
+        template <class S, size_t I>
+        void encodeFieldValue(Encoder &enc, const S &s) {
+            encodeValue(enc, s.*(std::get<I>(Info<S>::fields).member));
+        }
+
+        template <class S, size_t I>
+        bool decodeField(Value v, S &s) {
+            if (!v)
+                return false;
+            decodeValue(v, s.*(std::get<I>(Info<S>::fields).member));
+            return true;
+        }
+
+        template <class S, size_t... I>
+        void encodeFields(Encoder &enc, const S &s, std::index_sequence<I...>) {
+            ((enc.writeKey(slice(Info<S>::sortedKeys[I])),
+              encodeFieldValue<S, Info<S>::order[I]>(enc, s)), ...);
+        }
+
+        template <class S, size_t... I>
+        bool decodeFields(const FLValue values[], S &s, std::index_sequence<I...>) {
+            return (decodeField<S, Info<S>::order[I]>(Value(values[I]), s) & ... & true);
+        }
+
+        template <class S, size_t... I>
+        constexpr auto fieldWriters(std::index_sequence<I...>) {
+            using Writer = void(*)(Encoder&, const S&);
+            return std::array<Writer,sizeof...(I)>{&encodeFieldValue<S,I>...};
+        }
+    }
+
+
+    /** Writes a described struct to an Encoder as a Dict, with its keys in sorted order. */
+    template <class S>
+    void encodeStruct(Encoder &enc, const S &s) {
+        using Info = structcoder::Info<S>;
+        enc.beginDict(Info::count);
+        structcoder::encodeFields(enc, s, std::make_index_sequence<Info::count>());
+        enc.endDict();
+    }
+
+    /** Reads a Dict into a described struct. Fields whose keys are missing are left alone.
+        Returns true if all the keys were found. */
+    template <class S>
+    bool decodeStruct(Dict dict, S &s) {
+        using Info = structcoder::Info<S>;
+        FLValue values[Info::count];
+        FLDict_GetMany(dict, Info::sortedKeys.data(), Info::count, values);
+        return structcoder::decodeFields(values, s, std::make_index_sequence<Info::count>());
+    }
+
+
+    /** Encodes a described struct with keys resolved against a SharedKeys in advance, so
+        encoding doesn't look up the keys' integer forms, and writes them in the Dict's order
+        (integer keys first) without the Encoder having to sort them.
+        Keys the SharedKeys doesn't know when the coder is created are written by string, so the
+        Encoder looks them up as usual (and may sort them, if it adds them to the SharedKeys.)
+        A StructCoder is immutable, so it can be shared between threads. */
+    template <class S>
+    class StructCoder {
+    public:
+        using Info = structcoder::Info<S>;
+
+        explicit StructCoder(SharedKeys sk =nullptr) {
+            // Resolve the keys, and find the order of the ones that became integers:
+            std::array<int,Info::count> intKeys;
+            size_t nInts = 0;
+            for (size_t i = 0; i < Info::count; ++i) {
+                size_t f = Info::order[i];
+                slice key(Info::keys[f]);
+                _keys[f] = FLResolvedKey_New(key, sk);
+                intKeys[f] = sk ? FLSharedKeys_Encode(sk, key, false) : -1;
+                if (intKeys[f] >= 0)
+                    _order[nInts++] = f;
+            }
+            std::sort(&_order[0], &_order[nInts], [&](size_t a, size_t b) {
+                return intKeys[a] < intKeys[b];
+            });
+            for (size_t i = 0; i < Info::count; ++i) {
+                if (intKeys[Info::order[i]] < 0)
+                    _order[nInts++] = Info::order[i];
+            }
+        }
+
+        ~StructCoder() {
+            for (auto key : _keys)
+                FLResolvedKey_Free(key);
+        }
+
+        StructCoder(const StructCoder&) =delete;
+        StructCoder& operator= (const StructCoder&) =delete;
+
+        /** Writes a struct to an Encoder (which should use this coder's SharedKeys) as a Dict. */
+        void encode(Encoder &enc, const S &s) const {
+            static constexpr auto kWriters =
+                structcoder::fieldWriters<S>(std::make_index_sequence<Info::count>());
+            enc.beginDict(Info::count);
+            for (size_t f : _order) {
+                FLEncoder_WriteResolvedKey(enc, _keys[f]);
+                kWriters[f](enc, s);
+            }
+            enc.endDict();
+        }
+
+        /** Reads a Dict into a struct; same as `decodeStruct`. */
+        bool decode(Dict dict, S &s) const          {return decodeStruct(dict, s);}
+
+    private:
+        std::array<FLResolvedKey,Info::count> _keys;    // Resolved keys, by field index
+        std::array<size_t,Info::count> _order;          // Field indexes in Dict key order
+    };
+
+
+    namespace structcoder {
+
+        template <class T>
+        void encodeValue(Encoder &enc, const T &value) {
+            if constexpr (std::is_same_v<T, bool>)
+                enc.writeBool(value);
+            else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+                enc.writeInt(value);
+            else if constexpr (std::is_integral_v<T>)
+                enc.writeUInt(value);
+            else if constexpr (std::is_same_v<T, float>)
+                enc.writeFloat(value);
+            else if constexpr (std::is_floating_point_v<T>)
+                enc.writeDouble(value);
+            else if constexpr (std::is_convertible_v<const T&, slice>)
+                enc.writeString(slice(value));
+            else if constexpr (isVector<T>::value) {
+                enc.beginArray(value.size());
+                for (auto &item : value)
+                    encodeValue(enc, item);
+                enc.endArray();
+            } else {
+                static_assert(isDescribed<T>::value, "Unsupported field type for StructCoder");
+                encodeStruct(enc, value);
+            }
+        }
+
+        template <class T>
+        void decodeValue(Value v, T &value) {
+            if constexpr (std::is_same_v<T, bool>)
+                value = v.asBool();
+            else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+                value = T(v.asInt());
+            else if constexpr (std::is_integral_v<T>)
+                value = T(v.asUnsigned());
+            else if constexpr (std::is_floating_point_v<T>)
+                value = T(v.asDouble());
+            else if constexpr (std::is_same_v<T, std::string>)
+                value = std::string(v.asString());
+            else if constexpr (isVector<T>::value) {
+                Array array = v.asArray();
+                value.clear();
+                value.resize(array.count());
+                size_t i = 0;
+                for (Array::iterator iter(array); iter; ++iter)
+                    decodeValue(iter.value(), value[i++]);
+            } else {
+                static_assert(isDescribed<T>::value, "Unsupported field type for StructCoder");
+                decodeStruct(v.asDict(), value);
+            }
+        }
+    }
+
+}
+
+#endif // _FLEECE_STRUCTCODER_HH
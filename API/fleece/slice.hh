@@ -619,40 +619,20 @@ namespace fleece {
 #pragma mark  COMPARISON & FIND:
 
 
-    __hot
     inline int pure_slice::caseEquivalentCompare(pure_slice b) const noexcept {
-        size_t minSize = std::min(size, b.size);
-        for (size_t i = 0; i < minSize; i++) {
-            if ((*this)[i] != b[i]) {
-                int cmp = ::tolower((*this)[i]) - ::tolower(b[i]);
-                if (cmp != 0)
-                    return cmp;
-            }
-        }
-        return (int)size - (int)b.size;
+        return FLSlice_CaseEquivalentCompare(*this, b);
     }
 
 
-    __hot
     inline bool pure_slice::caseEquivalent(pure_slice b) const noexcept {
-        if (size != b.size)
-            return false;
-        for (size_t i = 0; i < size; i++)
-            if (::tolower((*this)[i]) != ::tolower(b[i]))
-                return false;
-        return true;
+        return size == b.size && FLSlice_CaseEquivalentCompare(*this, b) == 0;
     }
 
 
-    __hot
     inline slice pure_slice::find(pure_slice target) const noexcept {
-        char* src = (char *)buf;
-        char* search = (char *)target.buf;
-        char* found = std::search(src, src + size, search, search + target.size);
-        if(found == src + size) {
+        auto found = FLSlice_Find(*this, target);
+        if (!found)
             return nullslice;
-        }
-
         return {found, target.size};
     }
 
@@ -677,26 +657,13 @@ namespace fleece {
     }
 
 
-    __hot
     inline const uint8_t* pure_slice::findAnyByteOf(pure_slice targetBytes) const noexcept {
-        // this could totally be optimized, if it turns out to matter...
-        const void* result = nullptr;
-        for (size_t i = 0; i < targetBytes.size; ++i) {
-            auto r = findByte(targetBytes[i]);
-            if (r && (!result || r < result))
-                result = r;
-        }
-        return (const uint8_t*)result;
+        return (const uint8_t*)FLSlice_FindAnyByteOf(*this, targetBytes);
     }
 
 
-    __hot
     inline const uint8_t* pure_slice::findByteNotIn(pure_slice targetBytes) const noexcept {
-        for (auto c = (const uint8_t*)buf; c != end(); ++c) {
-            if (!targetBytes.findByte(*c))
-                return c;
-        }
-        return nullptr;
+        return (const uint8_t*)FLSlice_FindByteNotIn(*this, targetBytes);
     }
 
 
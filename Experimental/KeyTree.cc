@@ -18,21 +18,17 @@
 
 #include "KeyTree.hh"
 #include "varint.hh"
-#include <math.h>
 #include <iostream>
 #include <algorithm>
 #include "slice_stream.hh"
 #include "PlatformCompat.hh"
 #include "betterassert.hh"
 
-#if (defined __ANDROID__) && (__ANDROID_API__ < 18)
-#define log2(x) (log(x) / log(2))
-#endif
 namespace fleece {
 
 
     // Data format of a tree is:
-    // depth                    1 byte
+    // count                    varint
     // [root node]
     //
     // Data format of a tree node is:
@@ -44,6 +40,8 @@ namespace fleece {
     //
     // Offset to right subtree is 0 if there is no right subtree,
     // and the field is entirely missing in the bottom nodes (which have no subtrees.)
+    // The tree over the sorted strings [begin, end) has string (begin+end)/2 at its root, so a
+    // reader that starts from the count knows the range, and thus the shape, of every subtree.
 
 
 #pragma mark - WRITING:
@@ -57,12 +55,13 @@ namespace fleece {
 
         alloc_slice writeTree() {
             auto n = _strings.size();
-            size_t totalSize = 1 + sizeKeyTree(0, n);
+            size_t totalSize = SizeOfVarInt(n) + (n ? sizeKeyTree(0, n) : 0);
             alloc_slice output(totalSize);
             _out = (uint8_t*)output.buf;
 
-            writeByte((uint8_t)ceil(log2(n)));   // Write the depth first
-            writeKeyTree(0, n);
+            writeVarInt(n);                         // Write the count first
+            if (n > 0)
+                writeKeyTree(0, n);
             assert_postcondition(_out == output.end());
             return output;
         }
@@ -144,81 +143,88 @@ namespace fleece {
 
 #pragma mark - READING:
 
-    KeyTree::KeyTree(const void *encodedDataStart)
-    :_data(encodedDataStart)
+    KeyTree::KeyTree(slice encoded)
+    :_data(encoded)
     { }
 
     KeyTree::KeyTree(alloc_slice encoded)
     :_ownedData(encoded),
-    _data(encoded.buf)
+    _data(encoded)
     { }
-    
-    static int32_t readVarInt(const uint8_t* &tree) {
-        slice_istream buf(tree, kMaxVarintLen32);
-        std::optional<uint32_t> n = buf.readUVarInt();
-        if (!n)
+
+    // Reads a varint, or returns -1 on a parse error.
+    static int32_t readVarInt(slice_istream &tree) {
+        std::optional<uint32_t> n = tree.readUVarInt32();
+        if (!n || *n > INT32_MAX)
             return -1;
-        tree = (const uint8_t*)buf.buf;
-        return *n;
+        return int32_t(*n);
     }
 
-    static slice readKey(const uint8_t* &tree) {
-        slice key;
+    // Reads a length-prefixed key, or returns nullslice on a parse error.
+    static slice readKey(slice_istream &tree) {
         int32_t len = readVarInt(tree);
-        if (len >= 0) {
-            key = slice(tree, len);
-            tree += len;
-        }
-        return key;
+        if (len < 0 || size_t(len) > tree.size)
+            return nullslice;
+        return tree.readAll(len);
     }
 
 
+    unsigned KeyTree::count() const {
+        slice_istream tree(_data);
+        return std::max(readVarInt(tree), 0);
+    }
+
     unsigned KeyTree::operator[] (slice str) const {
-        const uint8_t* tree = (const uint8_t*)_data;
-        unsigned id = 0;
-        unsigned mask = 1;
-        for (unsigned depth = *tree++; depth > 0; --depth) {
+        slice_istream tree(_data);
+        int32_t n = readVarInt(tree);
+        size_t begin = 0, end = std::max(n, 0);
+        while (begin < end) {
+            size_t mid = (begin + end) / 2;
             slice key = readKey(tree);
             if (!key.buf)
                 return 0; // parse error
             int cmp = str.compare(key);
             if (cmp == 0)
-                return id | mask;
-            if (depth == 1)
+                return unsigned(mid + 1);
+            if (end - begin == 1)
                 return 0;
             int32_t leftTreeSize = readVarInt(tree);
             if (leftTreeSize < 0)
                 return 0; // parse error
             if (cmp > 0) {
-                tree += leftTreeSize;
-                id |= mask;
+                if (leftTreeSize == 0 || size_t(leftTreeSize) > tree.size)
+                    return 0; // no right subtree, or parse error
+                tree.skip(leftTreeSize);
+                begin = mid + 1;
+            } else {
+                end = mid;
             }
-            mask <<= 1;
         }
         return 0;
     }
 
     slice KeyTree::operator[] (unsigned id) const {
-        if (id == 0)
+        slice_istream tree(_data);
+        int32_t n = readVarInt(tree);
+        if (id == 0 || n < 0 || id > unsigned(n))
             return nullslice;
-        const uint8_t* tree = (const uint8_t*)_data;
-        for (unsigned depth = *tree++; depth > 0; --depth) {
+        size_t index = id - 1, begin = 0, end = n;
+        while (begin < end) {
+            size_t mid = (begin + end) / 2;
             slice key = readKey(tree);
-            if (!key.buf)
-                return key; // parse error
-            if (id == 1)
+            if (!key.buf || index == mid)
                 return key;
-            if (depth == 1)
-                break;
             int32_t leftTreeSize = readVarInt(tree);
             if (leftTreeSize < 0)
                 return nullslice; // parse error
-            if (id & 1) {
-                if (leftTreeSize == 0)
-                    return nullslice; // no right subtree
-                tree += leftTreeSize;
+            if (index > mid) {
+                if (leftTreeSize == 0 || size_t(leftTreeSize) > tree.size)
+                    return nullslice; // parse error
+                tree.skip(leftTreeSize);
+                begin = mid + 1;
+            } else {
+                end = mid;
             }
-            id >>= 1;
         }
         return nullslice;
     }
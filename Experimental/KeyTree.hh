@@ -24,26 +24,35 @@
 namespace fleece {
 
     /** A very compact dictionary of strings (or arbitrary blobs) that bidirectionally maps each
-        one to a small positive integer. Internally it's stored as a tree, so lookup time is
-        O(log n). The total storage overhead (beyond the sizes of the strings themselves) is
-        about 1.5n bytes, although this increases somewhat as the length of the strings or the
-        total size of the dictionary increase. */
+        one to a small positive integer: its 1-based index in sorted order. Internally it's stored
+        as a tree, so lookup time is O(log n). The total storage overhead (beyond the sizes of the
+        strings themselves) is about 1.5n bytes, although this increases somewhat as the length
+        of the strings or the total size of the dictionary increase. */
     class KeyTree {
     public:
-        KeyTree(const void *encodedDataStart);
+        /** Uses encoded data in place; it must remain valid as long as the KeyTree is used.
+            Lookups never read outside of it, even if it's corrupt. */
+        explicit KeyTree(slice encodedData);
         KeyTree(alloc_slice encodedData);
         
         static KeyTree fromSortedStrings(const std::vector<slice>&);
         static KeyTree fromStrings(std::vector<slice>);
 
+        /** The number of strings. */
+        unsigned count() const;
+
+        /** Returns the ID of a string, or 0 if it's not in the tree. */
         unsigned operator[] (slice str) const;
+
+        /** Returns the string with an ID, or nullslice if the ID is out of range. The result
+            points into the encoded data. */
         slice operator[] (unsigned id) const;
 
-        slice encodedData() const       {return _ownedData;}
+        slice encodedData() const       {return _data;}
 
     private:
         alloc_slice _ownedData;
-        const void * _data;
+        slice _data;
     };
 
 }
@@ -22,6 +22,12 @@
 #include <algorithm>
 #include <atomic>
 #include <cstddef>
+#include <mutex>
+#include <new>
+#include "Allocator.hh"
+#include "Bitmap.hh"
+#include "CPUFeatures.hh"
+#include "PlatformCompat.hh"
 #include "betterassert.hh"
 
 // Both headers declare a `wyrand()` function, so use namespaces to prevent collision.
@@ -36,6 +42,19 @@ namespace fleece::wyhash32 {
 #include <Windows.h>                // for SecureZeroMemory()
 #endif
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    // AVX2 isn't in the x86-64 baseline, so the byte-set search is compiled for it separately
+    // and only called if the CPU supports it:
+    #include <immintrin.h>
+    #define FL_SLICE_AVX2 1
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+    #include <arm_neon.h>
+    #define FL_SLICE_NEON 1
+#endif
+#if defined(FL_HAVE_SSE2) && !FL_SLICE_AVX2
+    #include <emmintrin.h>
+#endif
+
 
 // Note: These functions avoid passing NULL to memcmp, which is undefined behavior even when
 // the byte count is zero.
@@ -89,6 +108,280 @@ __hot uint32_t FLSlice_Hash(FLSlice s) noexcept {
 }
 
 
+#pragma mark - SEARCH:
+
+
+namespace fleece {
+
+    // ASCII-only, unlike `tolower`, so results don't depend on the locale.
+    static inline uint8_t lowercase(uint8_t c) {
+        return (uint8_t(c - 'A') < 26) ? (c | 0x20) : c;
+    }
+
+    namespace {
+        // A set of bytes, as a 256-bit bitmap.
+        struct ByteSet {
+            explicit ByteSet(FLSlice bytes) {
+                for (size_t i = 0; i < bytes.size; ++i) {
+                    uint8_t c = ((const uint8_t*)bytes.buf)[i];
+                    _bits[c >> 3] |= uint8_t(1 << (c & 7));
+                }
+            }
+            bool contains(uint8_t c) const      {return (_bits[c >> 3] >> (c & 7)) & 1;}
+        private:
+            uint8_t _bits[32] {};
+        };
+
+#if FL_SLICE_AVX2 || FL_SLICE_NEON
+        // The same set as two 16-byte tables indexed by a byte's low nybble, for vector table
+        // lookups (the method of Muła, "SIMD-ized searching for any of a set of bytes".)
+        // Bit `h` of `low[n]` is set if the byte 0x`hn` is in the set, for `h` < 8; `high` is the
+        // same for bytes 0x80 and up.
+        struct NybbleTables {
+            explicit NybbleTables(FLSlice bytes) {
+                for (size_t i = 0; i < bytes.size; ++i) {
+                    uint8_t c = ((const uint8_t*)bytes.buf)[i];
+                    (c < 0x80 ? low : high)[c & 0x0F] |= uint8_t(1 << ((c >> 4) & 7));
+                }
+            }
+            uint8_t low[16] {}, high[16] {};
+        };
+
+        // Indexed by a byte's high nybble, the bit for it in the nybble tables' rows:
+        const uint8_t kNybbleBits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                         1, 2, 4, 8, 16, 32, 64, 128};
+#endif
+    }
+
+
+#if FL_SLICE_AVX2
+    #define FL_AVX2 __attribute__((target("avx2")))
+
+    // Scans 32 bytes at a time from `p` for a byte in (or, if `inSet` is false, not in) the
+    // set, and returns it; or else advances `p` to less than 32 bytes before `end`, and
+    // returns nullptr.
+    FL_AVX2 static const uint8_t* scanSIMD(const uint8_t* &p, const uint8_t *end,
+                                           const NybbleTables &set, bool inSet) noexcept
+    {
+        const __m256i low  = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set.low));
+        const __m256i high = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set.high));
+        const __m256i bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)kNybbleBits));
+        const __m256i nybble = _mm256_set1_epi8(0x0F), zero = _mm256_setzero_si256();
+        for (; end - p >= 32; p += 32) {
+            __m256i input = _mm256_loadu_si256((const __m256i*)p);
+            __m256i lo = _mm256_and_si256(input, nybble);
+            __m256i hi = _mm256_and_si256(_mm256_srli_epi16(input, 4), nybble);
+            // `blendv` picks the `high` row for bytes whose top bit is set:
+            __m256i rows = _mm256_blendv_epi8(_mm256_shuffle_epi8(low, lo),
+                                              _mm256_shuffle_epi8(high, lo), input);
+            __m256i hits = _mm256_and_si256(rows, _mm256_shuffle_epi8(bits, hi));
+            uint32_t misses = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hits, zero)));
+            if (uint32_t found = inSet ? ~misses : misses; found)
+                return p + countTrailingZeros(found);
+        }
+        return nullptr;
+    }
+
+    // Looks for `target` (at least 2 bytes long) at each position from `p` through `last`, 32
+    // positions at a time, and returns the first match; or else advances `p` to less than 32
+    // positions before `last`, and returns nullptr. Only positions where both the first and last
+    // bytes of `target` match are compared in full (the method of Muła, "SIMD-friendly algorithms
+    // for substring searching".)
+    FL_AVX2 static const uint8_t* findSIMD(const uint8_t* &p, const uint8_t *last,
+                                           const uint8_t *target, size_t size) noexcept
+    {
+        const __m256i first = _mm256_set1_epi8(char(target[0]));
+        const __m256i final = _mm256_set1_epi8(char(target[size - 1]));
+        for (; last - p >= 31; p += 32) {
+            __m256i atFirst = _mm256_cmpeq_epi8(first, _mm256_loadu_si256((const __m256i*)p));
+            __m256i atFinal = _mm256_cmpeq_epi8(final,
+                                            _mm256_loadu_si256((const __m256i*)(p + size - 1)));
+            auto candidates = uint32_t(_mm256_movemask_epi8(_mm256_and_si256(atFirst, atFinal)));
+            for (; candidates; candidates &= candidates - 1) {
+                auto found = p + countTrailingZeros(candidates);
+                if (memcmp(found + 1, target + 1, size - 2) == 0)
+                    return found;
+            }
+        }
+        return nullptr;
+    }
+
+    #undef FL_AVX2
+
+    static bool haveSIMD() noexcept {return cpu::has(cpu::kAVX2);}
+
+    static constexpr ptrdiff_t kSIMDBlockSize = 32;
+
+#elif FL_SLICE_NEON
+    // Returns a mask with 4 bits for each byte of `v`, which must be all 0s or 1s.
+    static inline uint64_t neonMask(uint8x16_t v) noexcept {
+        return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(v), 4)), 0);
+    }
+
+    // Scans 16 bytes at a time from `p` for a byte in (or, if `inSet` is false, not in) the
+    // set, and returns it; or else advances `p` to less than 16 bytes before `end`, and
+    // returns nullptr.
+    static const uint8_t* scanSIMD(const uint8_t* &p, const uint8_t *end,
+                                   const NybbleTables &set, bool inSet) noexcept
+    {
+        const uint8x16_t low = vld1q_u8(set.low), high = vld1q_u8(set.high);
+        const uint8x16_t bits = vld1q_u8(kNybbleBits), nybble = vdupq_n_u8(0x0F);
+        for (; end - p >= 16; p += 16) {
+            uint8x16_t input = vld1q_u8(p);
+            uint8x16_t lo = vandq_u8(input, nybble);
+            uint8x16_t rows = vbslq_u8(vtstq_u8(input, vdupq_n_u8(0x80)),
+                                       vqtbl1q_u8(high, lo), vqtbl1q_u8(low, lo));
+            uint8x16_t hits = vtstq_u8(rows, vqtbl1q_u8(bits, vshrq_n_u8(input, 4)));
+            if (uint64_t found = neonMask(inSet ? hits : vmvnq_u8(hits)); found)
+                return p + countTrailingZeros(found) / 4;
+        }
+        return nullptr;
+    }
+
+    // Looks for `target` (at least 2 bytes long) at each position from `p` through `last`, 16
+    // positions at a time, and returns the first match; or else advances `p` to less than 16
+    // positions before `last`, and returns nullptr.
+    static const uint8_t* findSIMD(const uint8_t* &p, const uint8_t *last,
+                                   const uint8_t *target, size_t size) noexcept
+    {
+        const uint8x16_t first = vdupq_n_u8(target[0]), final = vdupq_n_u8(target[size - 1]);
+        for (; last - p >= 15; p += 16) {
+            uint8x16_t matches = vandq_u8(vceqq_u8(first, vld1q_u8(p)),
+                                          vceqq_u8(final, vld1q_u8(p + size - 1)));
+            for (uint64_t candidates = neonMask(matches); candidates; ) {
+                int bit = countTrailingZeros(candidates);
+                auto found = p + bit / 4;
+                if (memcmp(found + 1, target + 1, size - 2) == 0)
+                    return found;
+                candidates &= ~(uint64_t(0xF) << bit);
+            }
+        }
+        return nullptr;
+    }
+
+    static bool haveSIMD() noexcept {return cpu::has(cpu::kNEON);}
+
+    static constexpr ptrdiff_t kSIMDBlockSize = 16;
+#endif
+
+
+    // Returns the first byte of `s` that's in (or, if `inSet` is false, not in) `targetBytes`.
+    static const void* findInSet(FLSlice s, FLSlice targetBytes, bool inSet) noexcept {
+        auto p = (const uint8_t*)s.buf, end = p + s.size;
+#if FL_SLICE_AVX2 || FL_SLICE_NEON
+        // (Short slices aren't worth setting up the vector tables for.)
+        if (end - p >= kSIMDBlockSize && haveSIMD()) {
+            if (auto found = scanSIMD(p, end, NybbleTables(targetBytes), inSet))
+                return found;
+        }
+#endif
+        ByteSet set(targetBytes);
+        for (; p < end; ++p) {
+            if (set.contains(*p) == inSet)
+                return p;
+        }
+        return nullptr;
+    }
+
+}
+
+using namespace fleece;
+
+
+__hot
+const void* FLSlice_FindAnyByteOf(FLSlice s, FLSlice targetBytes) noexcept {
+    if (s.size == 0 || targetBytes.size == 0)
+        return nullptr;
+    else if (targetBytes.size == 1)
+        return memchr(s.buf, *(const uint8_t*)targetBytes.buf, s.size);
+    else
+        return findInSet(s, targetBytes, true);
+}
+
+
+__hot
+const void* FLSlice_FindByteNotIn(FLSlice s, FLSlice targetBytes) noexcept {
+    if (s.size == 0)
+        return nullptr;
+    else if (targetBytes.size == 0)
+        return s.buf;
+    else
+        return findInSet(s, targetBytes, false);
+}
+
+
+__hot
+const void* FLSlice_Find(FLSlice s, FLSlice target) noexcept {
+    if (target.size == 0)
+        return s.size > 0 ? s.buf : nullptr;
+    else if (target.size > s.size)
+        return nullptr;
+    else if (target.size == 1)
+        return memchr(s.buf, *(const uint8_t*)target.buf, s.size);
+    auto p = (const uint8_t*)s.buf, last = p + (s.size - target.size);
+#if FL_SLICE_AVX2 || FL_SLICE_NEON
+    // Check a vector's worth of positions at once, for the first and last bytes together:
+    if (last - p >= kSIMDBlockSize - 1 && haveSIMD()) {
+        if (auto found = findSIMD(p, last, (const uint8_t*)target.buf, target.size))
+            return found;
+    }
+#endif
+    // Let `memchr` (which is vectorized in any decent libc) find candidates for the first byte:
+    auto first = *(const uint8_t*)target.buf;
+    auto rest = (const uint8_t*)target.buf + 1;
+    while (p <= last) {
+        p = (const uint8_t*)memchr(p, first, last - p + 1);
+        if (!p)
+            break;
+        if (memcmp(p + 1, rest, target.size - 1) == 0)
+            return p;
+        ++p;
+    }
+    return nullptr;
+}
+
+
+__hot
+int FLSlice_CaseEquivalentCompare(FLSlice a, FLSlice b) noexcept {
+    auto pa = (const uint8_t*)a.buf, pb = (const uint8_t*)b.buf;
+    size_t n = std::min(a.size, b.size), i = 0;
+    // First skip 16 bytes at a time while the lowercased bytes are equal:
+#ifdef FL_HAVE_SSE2
+    // SSE2 only has signed compares, so offset by 0x80 to test for `c - 'A' < 26` unsigned:
+    const __m128i upperA = _mm_set1_epi8(char('A' + 0x80)), below = _mm_set1_epi8(char(26 - 0x80));
+    const __m128i caseBit = _mm_set1_epi8(0x20);
+    auto lower = [&](__m128i v) {
+        __m128i isUpper = _mm_cmplt_epi8(_mm_sub_epi8(v, upperA), below);
+        return _mm_or_si128(v, _mm_and_si128(isUpper, caseBit));
+    };
+    for (; n - i >= 16; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(pa + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(pb + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(lower(va), lower(vb))) != 0xFFFF)
+            break;
+    }
+#elif FL_SLICE_NEON
+    const uint8x16_t upperA = vdupq_n_u8('A'), letters = vdupq_n_u8(26), caseBit = vdupq_n_u8(0x20);
+    auto lower = [&](uint8x16_t v) {
+        return vorrq_u8(v, vandq_u8(vcltq_u8(vsubq_u8(v, upperA), letters), caseBit));
+    };
+    for (; n - i >= 16; i += 16) {
+        uint8x16_t same = vceqq_u8(lower(vld1q_u8(pa + i)), lower(vld1q_u8(pb + i)));
+        if (vminvq_u8(same) == 0)
+            break;
+    }
+#endif
+    for (; i < n; ++i) {
+        if (pa[i] != pb[i]) {
+            int cmp = lowercase(pa[i]) - lowercase(pb[i]);
+            if (cmp != 0)
+                return cmp;
+        }
+    }
+    return (int)a.size - (int)b.size;
+}
+
+
 namespace fleece {
 
 #if FL_EMBEDDED
@@ -113,23 +406,247 @@ namespace fleece {
 #endif
 
 
+#ifndef FL_POOL_SLICES
+#  if FL_EMBEDDED
+#    define FL_POOL_SLICES 0
+#  else
+#    define FL_POOL_SLICES 1
+#  endif
+#endif
+
+    // Pooling would hide use-after-free bugs of alloc_slices from Address Sanitizer:
+#if defined(__SANITIZE_ADDRESS__)
+    static constexpr bool kPoolByDefault = false;
+#elif defined(__has_feature)
+#  if __has_feature(address_sanitizer)
+    static constexpr bool kPoolByDefault = false;
+#  else
+    static constexpr bool kPoolByDefault = true;
+#  endif
+#else
+    static constexpr bool kPoolByDefault = true;
+#endif
+
+    static bool sPooling = kPoolByDefault && FL_POOL_SLICES;
+
+
+#pragma mark - POOL:
+
+
+    // Pooled blocks come in power-of-two size classes from 32 to 1024 bytes. A block's class
+    // is stored in its sharedBuffer; class 0 means it's not pooled.
+    static constexpr unsigned kMinPooledShift = 5, kNumSizeClasses = 6;
+    static constexpr size_t kMaxPooledSize = size_t(1) << (kMinPooledShift + kNumSizeClasses - 1);
+
+    // Each thread caches up to this many bytes of each class, and the shared lists hold up to
+    // four times that:
+    static constexpr size_t kCachedBytesPerClass = 16 * 1024;
+
+    static constexpr size_t classBlockSize(unsigned sizeClass) {
+        return size_t(1) << (kMinPooledShift + sizeClass - 1);
+    }
+
+    static constexpr size_t classCacheLimit(unsigned sizeClass) {
+        return kCachedBytesPerClass / classBlockSize(sizeClass);
+    }
+
+    static inline unsigned sizeClassFor(size_t blockSize) {
+        if (!FL_POOL_SLICES || blockSize > kMaxPooledSize || !sPooling)
+            return 0;
+        else if (blockSize <= classBlockSize(1))
+            return 1;
+        else
+            return 64 - countLeadingZeros(blockSize - 1) - kMinPooledShift + 1;
+    }
+
+#if FL_POOL_SLICES
+    namespace {
+        // A free block in a pool is linked to the next through its first bytes.
+        struct FreeBlock {
+            FreeBlock* next;
+        };
+
+        // A list of free blocks shared between threads. Threads move blocks to and from these in
+        // batches, so the lock is rarely taken.
+        struct SharedList {
+            std::mutex mutex;
+            FreeBlock* head {nullptr};
+            size_t count {0};
+        };
+
+        // Allocated once and never freed, since threads may still be exiting while static
+        // destructors run.
+        SharedList* sharedLists() {
+            static SharedList* const sLists = new SharedList[kNumSizeClasses + 1];
+            return sLists;
+        }
+
+        std::atomic<uint64_t> sPoolHits {0}, sPoolMisses {0}, sUnpooled {0};
+
+        // The per-thread cache. Like the Writer's chunk pool, it's plain data so it's still
+        // usable while other thread-local objects are destructed; `tSlicePoolReleaser` hands its
+        // blocks to the shared lists when the thread exits, and closes it.
+        thread_local FreeBlock* tCached[kNumSizeClasses + 1];
+        thread_local size_t tCachedCount[kNumSizeClasses + 1];
+        thread_local bool tSlicePoolClosed = false;
+        thread_local uint32_t tPoolHits = 0, tPoolMisses = 0, tUnpooled = 0;
+
+        struct SlicePoolReleaser {
+            ~SlicePoolReleaser();
+        };
+        thread_local SlicePoolReleaser tSlicePoolReleaser;
+
+        // Adds the thread's statistics to the global ones.
+        void flushStats() {
+            sPoolHits.fetch_add(tPoolHits, std::memory_order_relaxed);
+            sPoolMisses.fetch_add(tPoolMisses, std::memory_order_relaxed);
+            sUnpooled.fetch_add(tUnpooled, std::memory_order_relaxed);
+            tPoolHits = tPoolMisses = tUnpooled = 0;
+        }
+
+        inline void countEvent(uint32_t &counter) {
+            if (++counter >= 256)
+                flushStats();
+        }
+
+        // Moves up to `n` blocks from the front of `list` to the shared list of the class `c`,
+        // freeing any that don't fit. Returns the number moved.
+        size_t giveToShared(unsigned c, FreeBlock* &list, size_t n) {
+            FreeBlock *first = list, *last = nullptr;
+            size_t count = 0;
+            for (FreeBlock *b = list; b && count < n; b = b->next, ++count)
+                last = b;
+            if (count == 0)
+                return 0;
+            list = last->next;
+            {
+                SharedList &shared = sharedLists()[c];
+                std::lock_guard<std::mutex> lock(shared.mutex);
+                if (shared.count < 4 * classCacheLimit(c)) {
+                    last->next = shared.head;
+                    shared.head = first;
+                    shared.count += count;
+                    return count;
+                }
+            }
+            last->next = nullptr;
+            while (first) {
+                FreeBlock *next = first->next;
+                heap::free(first);
+                first = next;
+            }
+            return count;
+        }
+
+        // Moves up to half a cache's worth of blocks from the shared list to the thread's cache.
+        bool takeFromShared(unsigned c) {
+            SharedList &shared = sharedLists()[c];
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            if (!shared.head)
+                return false;
+            FreeBlock *first = shared.head, *last = first;
+            size_t count = 1;
+            for (size_t n = classCacheLimit(c) / 2; count < n && last->next; ++count)
+                last = last->next;
+            shared.head = last->next;
+            shared.count -= count;
+            last->next = tCached[c];
+            tCached[c] = first;
+            tCachedCount[c] += count;
+            (void)&tSlicePoolReleaser;
+            return true;
+        }
+
+        SlicePoolReleaser::~SlicePoolReleaser() {
+            tSlicePoolClosed = true;
+            for (unsigned c = 1; c <= kNumSizeClasses; ++c) {
+                giveToShared(c, tCached[c], tCachedCount[c]);
+                tCachedCount[c] = 0;
+            }
+            flushStats();
+        }
+    }
+
+
+    static void* allocateBlock(unsigned sizeClass, size_t blockSize) noexcept {
+        if (sizeClass == 0) {
+            countEvent(tUnpooled);
+            return heap::tryAllocate(blockSize);
+        }
+        if (_usuallyFalse(tSlicePoolClosed)) {
+            ++sPoolMisses;
+        } else if (tCached[sizeClass] || takeFromShared(sizeClass)) {
+            FreeBlock *block = tCached[sizeClass];
+            tCached[sizeClass] = block->next;
+            --tCachedCount[sizeClass];
+            countEvent(tPoolHits);
+            return block;
+        } else {
+            countEvent(tPoolMisses);
+        }
+        return heap::tryAllocate(classBlockSize(sizeClass));
+    }
+
+
+    static void freeBlock(void *block, unsigned sizeClass) noexcept {
+        if (sizeClass == 0 || !sPooling) {
+            heap::free(block);
+            return;
+        }
+        auto fb = (FreeBlock*)block;
+        if (_usuallyFalse(tSlicePoolClosed)) {
+            fb->next = nullptr;
+            giveToShared(sizeClass, fb, 1);
+            return;
+        }
+        fb->next = tCached[sizeClass];
+        tCached[sizeClass] = fb;
+        if (++tCachedCount[sizeClass] == 1)
+            (void)&tSlicePoolReleaser;      // makes sure the cache gets cleaned up at thread exit
+        else if (tCachedCount[sizeClass] > classCacheLimit(sizeClass))
+            tCachedCount[sizeClass] -= giveToShared(sizeClass, tCached[sizeClass],
+                                                    classCacheLimit(sizeClass) / 2);
+    }
+
+#else // FL_POOL_SLICES
+
+    static inline void* allocateBlock(unsigned, size_t blockSize) noexcept {
+        return heap::tryAllocate(blockSize);
+    }
+
+    static inline void freeBlock(void *block, unsigned) noexcept {
+        heap::free(block);
+    }
+
+#endif // FL_POOL_SLICES
+
+
+#pragma mark - SHARED BUFFER:
+
+
     // The heap-allocated buffer that an alloc_slice points to.
     // It's ref-counted; every alloc_slice manages retaining/releasing its sharedBuffer.
     struct sharedBuffer {
         std::atomic<uint32_t> _refCount {1};
+        uint32_t _sizeClass;                    // pool size class, or 0 if not pooled
 #if FL_DETECT_COPIES
         static constexpr uint32_t kMagic = 0xdecade55;
         uint32_t const _magic {kMagic};
 #endif
         uint8_t _buf[4];
 
-        static inline void* operator new(size_t basicSize, size_t bufferSize) noexcept {
-            return malloc(basicSize - sizeof(sharedBuffer::_buf) + bufferSize);
-        }
-
-        static inline void operator delete(void *self) {
-            assert_precondition(isHeapAligned(self));
-            free(self);
+        static inline sharedBuffer* create(size_t bufferSize) noexcept {
+            size_t blockSize = offsetof(sharedBuffer, _buf) + bufferSize;
+            unsigned sizeClass = sizeClassFor(blockSize);
+            void *block = allocateBlock(sizeClass, blockSize);
+            if (!block)
+                return nullptr;
+            if (sizeClass == 0)
+                heap::adviseHugePages(block, blockSize);
+            assert_postcondition(isHeapAligned(block));
+            auto sb = new (block) sharedBuffer;
+            sb->_sizeClass = sizeClass;
+            return sb;
         }
 
         __hot
@@ -142,7 +659,7 @@ namespace fleece {
         inline void release() noexcept {
             assert_precondition(isHeapAligned(this));
             if (--_refCount == 0)
-                delete this;
+                freeBlock(this, _sizeClass);
         }
     };
 
@@ -158,7 +675,7 @@ using namespace fleece;
 
 __hot
 FLSliceResult FLSliceResult_New(size_t size) noexcept {
-    auto sb = new (size) sharedBuffer;
+    auto sb = sharedBuffer::create(size);
     if (!sb)
         return {};
     return {&sb->_buf, size};
@@ -177,7 +694,7 @@ FLSliceResult FLSlice_Copy(FLSlice s) noexcept {
         fprintf(stderr, "$$$$$ Copying existing alloc_slice at {%p, %zu}\n", s.buf, s.size);
     }
 #endif
-    auto sb = new (s.size) sharedBuffer;
+    auto sb = sharedBuffer::create(s.size);
     if (!sb)
         return {};
     memcpy(&sb->_buf, s.buf, s.size);
@@ -199,6 +716,20 @@ void _FLBuf_Release(const void *buf) noexcept {
 }
 
 
+void FLSlice_SetPooling(bool enabled) noexcept {
+    sPooling = enabled && FL_POOL_SLICES;
+}
+
+
+FLSliceAllocStats FLSlice_GetAllocStats() noexcept {
+#if FL_POOL_SLICES
+    return {sPoolHits + tPoolHits, sPoolMisses + tPoolMisses, sUnpooled + tUnpooled};
+#else
+    return {};
+#endif
+}
+
+
 void FL_WipeMemory(void *buf, size_t size) noexcept {
     if (size > 0) {
 #if defined(_MSC_VER)
@@ -21,6 +21,7 @@
 #include "ValueSlot.hh"
 #include "JSONEncoder.hh"
 #include "Path.hh"
+#include "DataStats.hh"
 #include "DeepIterator.hh"
 #include "Doc.hh"
 #include "FleeceException.hh"
@@ -45,7 +46,11 @@ typedef FLEncoderImpl*  FLEncoder;
 typedef SharedKeys*     FLSharedKeys;
 typedef Path*           FLKeyPath;
 typedef DeepIterator*   FLDeepIterator;
+typedef const Dict::resolvedKey* FLResolvedKey;
+typedef const Encoder::PreparedKey* FLEncoderKey;
 typedef const Doc*      FLDoc;
+typedef DataStats*      FLDataStats;
+typedef DocTemplate*    FLDocTemplate;
 
 #define FL_IMPL         // Prevents redefinition of the above types
 
@@ -64,6 +69,7 @@ namespace fleece { namespace impl {
     struct FLEncoderImpl {
         FLError errorCode {::kFLNoError};
         const bool ownsFleeceEncoder {true};
+        bool pooled {false};                    // Created by FLEncoder_NewPooled
         std::string errorMessage;
         std::unique_ptr<Encoder> fleeceEncoder;
         std::unique_ptr<JSONEncoder> jsonEncoder;
@@ -89,6 +95,11 @@ namespace fleece { namespace impl {
             fleeceEncoder->uniqueStrings(uniqueStrings);
         }
 
+        FLEncoderImpl(Writer::OutputSink sink, bool uniqueStrings =true) {
+            fleeceEncoder.reset(new Encoder(std::move(sink)));
+            fleeceEncoder->uniqueStrings(uniqueStrings);
+        }
+
         FLEncoderImpl(Encoder *encoder)
         :ownsFleeceEncoder(false)
         ,fleeceEncoder(encoder)
@@ -17,12 +17,23 @@
 //
 
 #include "Fleece+ImplGlue.hh"
+#include "Aggregates.hh"
+#include "ArraySort.hh"
+#include "Columns.hh"
 #include "MutableArray.hh"
 #include "MutableDict.hh"
+#include "Counters.hh"
+#include "Tracing.hh"
+#include "Executor.hh"
+#include "InternedStrings.hh"
 #include "JSONDelta.hh"
 #include "fleece/Fleece.h"
+#include "fleece/Fleece+Inline.h"
 #include "JSON5.hh"
+#include "Pointer.hh"
+#include "sliceIO.hh"
 #include "betterassert.hh"
+#include <cmath>
 
 
 namespace fleece { namespace impl {
@@ -47,7 +58,11 @@ static FLSliceResult toSliceResult(alloc_slice &&s) {
 
 
 FLValue FLValue_FromData(FLSlice data, FLTrust trust) FLAPI {
-    return trust ? Value::fromTrustedData(data) : Value::fromData(data);
+    switch (trust) {
+        case kFLTrusted:                return Value::fromTrustedData(data);
+        case kFLTrustedIfChecksummed:   return Value::fromChecksummedData(data);
+        default:                        return Value::fromData(data);
+    }
 }
 
 
@@ -64,6 +79,15 @@ const char* FLDumpData(FLSlice data) FLAPI {
 }
 
 
+// Fleece+Inline.h hard-codes these, so they must not change without bumping its version:
+// (Version 2 relies on a packed array's header having the long count.)
+static_assert(FL_INLINE_ACCESSORS_VERSION == 2);
+static_assert(_FLINLINE_FAR_POINTER == internal::Pointer::kFarPointerByte);
+static_assert(_FLINLINE_LONG_COUNT == internal::kLongArrayCount);
+
+uint32_t FLInlineAccessorsVersion(void) FLAPI {return FL_INLINE_ACCESSORS_VERSION;}
+
+
 FLValueType FLValue_GetType(FLValue v) FLAPI {
     if (_usuallyFalse(v == NULL))
         return kFLUndefined;
@@ -96,6 +120,54 @@ FLDoc FLValue_FindDoc(FLValue v) FLAPI {
     return v ? retain(Doc::containing(v).get()) : nullptr;
 }
 
+
+FLValueRef FLDoc_GetRootRef(FLDoc doc) FLAPI {
+    return {doc ? doc->root() : nullptr, doc};
+}
+
+FLValueRef FLValue_MakeRef(FLValue v) FLAPI {
+    if (!v || v->isMutable())
+        return {v, nullptr};
+    return {v, Doc::containing(v).get()};   // (the Doc outlives the Value, so no need to retain)
+}
+
+// A value in a Doc is in the same Doc as its container; only a mutable container's values
+// have to be looked up.
+static FLValueRef childRef(FLValueRef parent, FLValue child) {
+    if (parent.doc || !child || child->isMutable())
+        return {child, parent.doc};
+    return FLValue_MakeRef(child);
+}
+
+FLValueRef FLValueRef_Get(FLValueRef ref, FLSlice keyString) FLAPI {
+    const Dict *d = ref.value ? ref.value->asDict() : nullptr;
+    if (!d)
+        return {};
+    return childRef(ref, d->get(keyString, ref.doc ? ref.doc->sharedKeys() : nullptr));
+}
+
+FLValueRef FLValueRef_GetAt(FLValueRef ref, uint32_t index) FLAPI {
+    const Array *a = ref.value ? ref.value->asArray() : nullptr;
+    if (!a)
+        return {};
+    return childRef(ref, a->get(index));
+}
+
+FLValueRef FLValueRef_Retain(FLValueRef ref) FLAPI {
+    if (ref.doc)
+        retain(ref.doc);
+    else
+        retain(ref.value);
+    return ref;
+}
+
+void FLValueRef_Release(FLValueRef ref) FLAPI {
+    if (ref.doc)
+        release(ref.doc);
+    else
+        release(ref.value);
+}
+
 bool FLValue_IsEqual(FLValue v1, FLValue v2) FLAPI {
     if (_usuallyTrue(v1 != nullptr))
         return v1->isEqual(v2);
@@ -103,6 +175,10 @@ bool FLValue_IsEqual(FLValue v1, FLValue v2) FLAPI {
         return v2 == nullptr;
 }
 
+uint64_t FLValue_Hash(FLValue v) FLAPI {
+    return v ? v->hash() : 0;
+}
+
 FLSliceResult FLValue_ToString(FLValue v) FLAPI {
     if (v) {
         try {
@@ -129,15 +205,17 @@ FLValue FLValue_NewData(FLSlice data) FLAPI {
 }
 
 
-FLSliceResult FLValue_ToJSONX(FLValue v,
-                              bool json5,
-                              bool canonical) FLAPI
+FLSliceResult FLValue_ToJSONWithSharedKeys(FLValue v,
+                                           bool json5,
+                                           bool canonical,
+                                           FLSharedKeys sk) FLAPI
 {
     if (v) {
         try {
             JSONEncoder encoder;
             encoder.setJSON5(json5);
             encoder.setCanonical(canonical);
+            encoder.setSharedKeys(sk);
             encoder.writeValue(v);
             return toSliceResult(encoder.finish());
         } catchError(nullptr)
@@ -145,6 +223,31 @@ FLSliceResult FLValue_ToJSONX(FLValue v,
     return {nullptr, 0};
 }
 
+FLSliceResult FLValue_ToJSONX(FLValue v,
+                              bool json5,
+                              bool canonical) FLAPI
+{
+    return FLValue_ToJSONWithSharedKeys(v, json5, canonical, nullptr);
+}
+
+bool FLValue_WriteJSON(FLValue v, FLEncoderSink sink, void *context,
+                       bool json5, bool canonical, FLError *outError) FLAPI
+{
+    try {
+        JSONEncoder encoder([=](slice data) {
+            if (!sink(context, data))
+                FleeceException::_throw(EncodeError, "JSON output sink failed");
+        });
+        encoder.setJSON5(json5);
+        encoder.setCanonical(canonical);
+        if (v)
+            encoder.writeValue(v);
+        encoder.finish();
+        return true;
+    } catchError(outError)
+    return false;
+}
+
 FLSliceResult FLValue_ToJSON(FLValue v)      FLAPI {return FLValue_ToJSONX(v, false, false);}
 FLSliceResult FLValue_ToJSON5(FLValue v)     FLAPI {return FLValue_ToJSONX(v, true,  false);}
 
@@ -188,6 +291,45 @@ FLSliceResult FLData_Dump(FLSlice data) FLAPI {
     return {nullptr, 0};
 }
 
+FLSliceResult FLData_Compact(FLSlice data, FLSharedKeys sk,
+                             size_t *outLiveBytes, FLError *outError) FLAPI
+{
+    try {
+        Retained<Doc> doc = new Doc(alloc_slice(data), Doc::kUntrusted, sk);
+        throwIf(!doc->root(), InvalidData, "Invalid Fleece data");
+        if (outLiveBytes)
+            *outLiveBytes = doc->liveDataSize();
+        return toSliceResult(doc->compact()->allocedData());
+    } catchError(outError)
+    return {nullptr, 0};
+}
+
+
+FLDataStats FLDataStats_New(size_t nLargest) FLAPI {
+    try {
+        return new DataStats(nLargest);
+    } catchError(nullptr)
+    return nullptr;
+}
+
+void FLDataStats_Free(FLDataStats stats) FLAPI {
+    delete stats;
+}
+
+bool FLDataStats_Add(FLDataStats stats, FLSlice data, FLSharedKeys sk, FLString label) FLAPI {
+    try {
+        return stats->add(data, sk, label);
+    } catchError(nullptr)
+    return false;
+}
+
+FLStringResult FLDataStats_Report(FLDataStats stats) FLAPI {
+    try {
+        return toSliceResult(alloc_slice(stats->report()));
+    } catchError(nullptr)
+    return {nullptr, 0};
+}
+
 
 #pragma mark - ARRAYS:
 
@@ -196,6 +338,52 @@ uint32_t FLArray_Count(FLArray a)                    FLAPI {return a ? a->count(
 bool FLArray_IsEmpty(FLArray a)                      FLAPI {return a ? a->empty() : true;}
 FLValue FLArray_Get(FLArray a, uint32_t index)       FLAPI {return a ? a->get(index) : nullptr;}
 
+void FLArray_ExtractColumns(FLArray a, FLColumn columns[], size_t columnCount) FLAPI {
+    if (!a)
+        return;
+    smallVector<Column, 8> cols(columnCount);
+    for (size_t i = 0; i < columnCount; ++i)
+        cols[i] = {columns[i].key, ColumnType(columns[i].type), columns[i].values, columns[i].nulls};
+    extractColumns(a, cols.begin(), columnCount);
+}
+
+FLArrayStats FLArray_GetStats(FLArray a) FLAPI {
+    if (!a)
+        return {0, 0, 0.0, NAN, NAN};
+    auto stats = getArrayStats(a);
+    return {stats.count, stats.nonNull, stats.sum, stats.min, stats.max};
+}
+
+uint32_t FLArray_FilterNumbers(FLArray a, double minValue, double maxValue,
+                               uint8_t *bitmap) FLAPI
+{
+    return a ? filterNumbers(a, minValue, maxValue, bitmap) : 0;
+}
+
+uint32_t FLArray_LowerBound(FLArray a, FLValue value) FLAPI {
+    return a ? a->lowerBound(value) : 0;
+}
+
+bool FLArray_WriteSetOperation(FLArray a, FLArray b, FLSetOperation op, FLEncoder e) FLAPI {
+    try {
+        if (!e->hasError()) {
+            if (!e->isFleece())
+                FleeceException::_throw(EncodeError, "Set operations need a Fleece encoder");
+            if (!a) a = Array::kEmpty;
+            if (!b) b = Array::kEmpty;
+            switch (op) {
+                case kFLIntersection: writeIntersection(a, b, *e->fleeceEncoder); break;
+                case kFLUnion:        writeUnion(a, b, *e->fleeceEncoder); break;
+                case kFLDifference:   writeDifference(a, b, *e->fleeceEncoder); break;
+            }
+            return true;
+        }
+    } catch (const std::exception &x) {
+        e->recordException(x);
+    }
+    return false;
+}
+
 void FLArrayIterator_Begin(FLArray a, FLArrayIterator* i) FLAPI {
     static_assert(sizeof(FLArrayIterator) >= sizeof(Array::iterator),"FLArrayIterator is too small");
     new (i) Array::iterator(a);
@@ -223,6 +411,41 @@ bool FLArrayIterator_Next(FLArrayIterator* i) FLAPI {
     return false;
 }
 
+// Fills in an FLItem from a Value, for the batch readers.
+static void readItem(FLItem &item, slice key, const Value *v) noexcept {
+    item.key = key;
+    item.value = v;
+    item.type = FLValue_GetType(v);
+    item.isInteger = false;
+    item.asInt = 0;
+    item.asDouble = 0.0;
+    item.asString = nullslice;
+    switch (item.type) {
+        case kFLBoolean:
+        case kFLNumber:
+            item.isInteger = v->isInteger();
+            item.asInt = v->asInt();
+            item.asDouble = v->asDouble();
+            break;
+        case kFLString:
+            item.asString = v->asString();
+            break;
+        case kFLData:
+            item.asString = v->asData();
+            break;
+        default:
+            break;
+    }
+}
+
+size_t FLArrayIterator_ReadItems(FLArrayIterator* i, FLItem items[], size_t capacity) FLAPI {
+    auto& iter = *(Array::iterator*)i;
+    size_t n = 0;
+    for (; n < capacity && iter; ++n, ++iter)
+        readItem(items[n], nullslice, iter.value());
+    return n;
+}
+
 
 static FLMutableArray _newMutableArray(FLArray a, FLCopyFlags flags) noexcept {
     try {
@@ -243,25 +466,73 @@ FLMutableArray FLArray_AsMutable(FLArray a)         FLAPI {return a ? a->asMutab
 FLArray FLMutableArray_GetSource(FLMutableArray a)  FLAPI {return a ? a->source() : nullptr;}
 bool FLMutableArray_IsChanged(FLMutableArray a)     FLAPI {return a && a->isChanged();}
 void FLMutableArray_SetChanged(FLMutableArray a, bool c)       FLAPI {if (a) a->setChanged(c);}
-void FLMutableArray_Resize(FLMutableArray a, uint32_t size)    FLAPI {a->resize(size);}
+bool FLMutableArray_Freeze(FLMutableArray a, FLError *outError) FLAPI {
+    try {
+        if (a) a->freeze();
+        return true;
+    } catchError(outError)
+    return false;
+}
+
+bool FLMutableArray_IsFrozen(FLMutableArray a)      FLAPI {return a && a->isFrozen();}
+
+FLMutableArray FLMutableArray_Snapshot(FLMutableArray a) FLAPI {
+    try {
+        if (a)
+            return (MutableArray*)retain(a->snapshot());
+    } catchError(nullptr)
+    return nullptr;
+}
+
+size_t FLMutableArray_GetMemoryUsage(FLMutableArray a)         FLAPI {return a ? a->memoryUsage() : 0;}
+
+// The functions that modify a collection fail without throwing if it's frozen: those that
+// return something return NULL, and the FLSlot_Set functions ignore a NULL slot.
+
+void FLMutableArray_Resize(FLMutableArray a, uint32_t size)    FLAPI {
+    try {
+        a->resize(size);
+    } catchError(nullptr)
+}
 
-FLSlot FLMutableArray_Set(FLMutableArray a, uint32_t index)    FLAPI {return &a->setting(index);}
-FLSlot FLMutableArray_Append(FLMutableArray a)                 FLAPI {return &a->appending();}
+FLSlot FLMutableArray_Set(FLMutableArray a, uint32_t index)    FLAPI {
+    try {
+        return &a->setting(index);
+    } catchError(nullptr)
+    return nullptr;
+}
+
+FLSlot FLMutableArray_Append(FLMutableArray a)                 FLAPI {
+    try {
+        return &a->appending();
+    } catchError(nullptr)
+    return nullptr;
+}
 
 void FLMutableArray_Insert(FLMutableArray a, uint32_t firstIndex, uint32_t count) FLAPI {
-    if (a) a->insert(firstIndex, count);
+    try {
+        if (a) a->insert(firstIndex, count);
+    } catchError(nullptr)
 }
 
 void FLMutableArray_Remove(FLMutableArray a, uint32_t firstIndex, uint32_t count) FLAPI {
-    if(a) a->remove(firstIndex, count);
+    try {
+        if(a) a->remove(firstIndex, count);
+    } catchError(nullptr)
 }
 
 FLMutableArray FLMutableArray_GetMutableArray(FLMutableArray a, uint32_t index) FLAPI {
-    return a ? a->getMutableArray(index) : nullptr;
+    try {
+        return a ? a->getMutableArray(index) : nullptr;
+    } catchError(nullptr)
+    return nullptr;
 }
 
 FLMutableDict FLMutableArray_GetMutableDict(FLMutableArray a, uint32_t index) FLAPI {
-    return a ? a->getMutableDict(index) : nullptr;
+    try {
+        return a ? a->getMutableDict(index) : nullptr;
+    } catchError(nullptr)
+    return nullptr;
 }
 
 
@@ -272,6 +543,42 @@ uint32_t FLDict_Count(FLDict d)                 FLAPI {return d ? d->count() : 0
 bool FLDict_IsEmpty(FLDict d)                   FLAPI {return d ? d->empty() : true;}
 FLValue FLDict_Get(FLDict d, FLSlice keyString) FLAPI {return d ? d->get(keyString) : nullptr;}
 
+FLValue FLDict_GetWithSharedKeys(FLDict d, FLSlice keyString, FLSharedKeys sk) FLAPI {
+    return d ? d->get(keyString, sk) : nullptr;
+}
+
+void FLDict_GetMany(FLDict d, const FLSlice keys[], size_t count, FLValue values[]) FLAPI {
+    if (d)
+        d->getMany((const slice*)keys, count, values);
+    else
+        std::fill(&values[0], &values[count], nullptr);
+}
+
+size_t FLDict_GetFields(FLDict d, const FLSlice keys[], size_t count,
+                        const FLFieldArrays *fields) FLAPI
+{
+    // Look up the values in batches, into the caller's array if there is one:
+    constexpr size_t kBatchSize = 64;
+    FLValue batch[kBatchSize];
+    size_t found = 0;
+    for (size_t start = 0; start < count; start += kBatchSize) {
+        size_t n = std::min(count - start, kBatchSize);
+        FLValue *values = fields->values ? &fields->values[start] : batch;
+        FLDict_GetMany(d, &keys[start], n, values);
+        for (size_t i = 0; i < n; ++i) {
+            FLItem item;
+            readItem(item, nullslice, values[i]);
+            found += (item.value != nullptr);
+            size_t k = start + i;
+            if (fields->types)      fields->types[k] = item.type;
+            if (fields->ints)       fields->ints[k] = item.asInt;
+            if (fields->doubles)    fields->doubles[k] = item.asDouble;
+            if (fields->strings)    fields->strings[k] = item.asString;
+        }
+    }
+    return found;
+}
+
 #if 0
 FLSlice FLSharedKey_GetKeyString(FLSharedKeys sk, int keyCode, FLError* outError)
 {
@@ -293,6 +600,10 @@ void FLDictIterator_Begin(FLDict d, FLDictIterator* i) FLAPI {
     // Note: this is safe even if d is null.
 }
 
+void FLDictIterator_BeginWithSharedKeys(FLDict d, FLSharedKeys sk, FLDictIterator* i) FLAPI {
+    new (i) Dict::iterator(d, sk);
+}
+
 FLValue FLDictIterator_GetKey(const FLDictIterator* i) FLAPI {
     return ((Dict::iterator*)i)->key();
 }
@@ -324,6 +635,18 @@ void FLDictIterator_End(FLDictIterator* i) FLAPI {
     ((Dict::iterator*)i)->~DictIterator();
 }
 
+size_t FLDictIterator_ReadItems(FLDictIterator* i, FLItem items[], size_t capacity) FLAPI {
+    auto& iter = *(Dict::iterator*)i;
+    size_t n = 0;
+    try {
+        for (; n < capacity && iter; ++n, ++iter)
+            readItem(items[n], iter.keyString(), iter.value());
+        if (n == 0)
+            iter.~DictIterator();
+    } catchError(nullptr)
+    return n;
+}
+
 
 FLDictKey FLDictKey_Init(FLSlice string) FLAPI {
     FLDictKey key;
@@ -344,6 +667,25 @@ FLValue FLDict_GetWithKey(FLDict d, FLDictKey *k) FLAPI {
     return d->get(key);
 }
 
+FLResolvedKey FLResolvedKey_New(FLSlice string, FLSharedKeys sk) FLAPI {
+    try {
+        return new Dict::resolvedKey(string, sk);
+    } catchError(nullptr)
+    return nullptr;
+}
+
+void FLResolvedKey_Free(FLResolvedKey key) FLAPI {
+    delete key;
+}
+
+FLSlice FLResolvedKey_GetString(FLResolvedKey key) FLAPI {
+    return key->string();
+}
+
+FLValue FLDict_GetWithResolvedKey(FLDict d, FLResolvedKey key) FLAPI {
+    return d ? d->get(*key) : nullptr;
+}
+
 
 static FLMutableDict _newMutableDict(FLDict d, FLCopyFlags flags) noexcept {
     try {
@@ -356,6 +698,10 @@ FLMutableDict FLMutableDict_New(void) FLAPI {
     return _newMutableDict(nullptr, kFLDefaultCopy);
 }
 
+void FLMutableDict_SetKeySharing(bool enabled) FLAPI {
+    InternedStrings::setSharedEnabled(enabled);
+}
+
 FLMutableDict FLDict_MutableCopy(FLDict d, FLCopyFlags flags) FLAPI {
     return d ? _newMutableDict(d, flags) : nullptr;
 }
@@ -364,18 +710,66 @@ FLMutableDict FLDict_AsMutable(FLDict d)           FLAPI {return d ? d->asMutabl
 FLDict FLMutableDict_GetSource(FLMutableDict d)    FLAPI {return d ? d->source() : nullptr;}
 bool FLMutableDict_IsChanged(FLMutableDict d)      FLAPI {return d && d->isChanged();}
 void FLMutableDict_SetChanged(FLMutableDict d, bool c)   FLAPI {if (d) d->setChanged(c);}
+bool FLMutableDict_Freeze(FLMutableDict d, FLError *outError) FLAPI {
+    try {
+        if (d) d->freeze();
+        return true;
+    } catchError(outError)
+    return false;
+}
+
+bool FLMutableDict_IsFrozen(FLMutableDict d)       FLAPI {return d && d->isFrozen();}
+
+FLMutableDict FLMutableDict_Snapshot(FLMutableDict d) FLAPI {
+    try {
+        if (d)
+            return (MutableDict*)retain(d->snapshot());
+    } catchError(nullptr)
+    return nullptr;
+}
+
+size_t FLMutableDict_GetMemoryUsage(FLMutableDict d)     FLAPI {return d ? d->memoryUsage() : 0;}
+
+FLSlot FLMutableDict_Set(FLMutableDict d, FLString k)    FLAPI {
+    try {
+        return &d->setting(k);
+    } catchError(nullptr)
+    return nullptr;
+}
 
-FLSlot FLMutableDict_Set(FLMutableDict d, FLString k)    FLAPI {return &d->setting(k);}
+void FLMutableDict_Remove(FLMutableDict d, FLString key) FLAPI {
+    try {
+        if(d) d->remove(key);
+    } catchError(nullptr)
+}
 
-void FLMutableDict_Remove(FLMutableDict d, FLString key) FLAPI {if(d) d->remove(key);}
-void FLMutableDict_RemoveAll(FLMutableDict d)            FLAPI {if(d) d->removeAll();}
+void FLMutableDict_RemoveAll(FLMutableDict d)            FLAPI {
+    try {
+        if(d) d->removeAll();
+    } catchError(nullptr)
+}
 
 FLMutableArray FLMutableDict_GetMutableArray(FLMutableDict d, FLString key) FLAPI {
-    return d ? d->getMutableArray(key) : nullptr;
+    try {
+        return d ? d->getMutableArray(key) : nullptr;
+    } catchError(nullptr)
+    return nullptr;
 }
 
 FLMutableDict FLMutableDict_GetMutableDict(FLMutableDict d, FLString key) FLAPI {
-    return d ? d->getMutableDict(key) : nullptr;
+    try {
+        return d ? d->getMutableDict(key) : nullptr;
+    } catchError(nullptr)
+    return nullptr;
+}
+
+FLSliceResult FLMutableDict_Amend(FLMutableDict d, bool reuseStrings, bool externPointers,
+                                  FLError *outError) FLAPI
+{
+    try {
+        return toSliceResult(d->amend(reuseStrings, externPointers));
+    } catchError(outError)
+    return {nullptr, 0};
 }
 
 
@@ -389,6 +783,15 @@ unsigned FLSharedKeys_Count(FLSharedKeys sk)               FLAPI {return (unsign
 bool FLSharedKeys_LoadStateData(FLSharedKeys sk, FLSlice d)FLAPI {return sk->loadFrom(d);}
 bool FLSharedKeys_LoadState(FLSharedKeys sk, FLValue s)    FLAPI {return sk->loadFrom(s);}
 FLSliceResult FLSharedKeys_GetStateData(FLSharedKeys sk)   FLAPI {return toSliceResult(sk->stateData());}
+FLSliceResult FLSharedKeys_GetImageData(FLSharedKeys sk)   FLAPI {return toSliceResult(sk->imageData());}
+bool FLSharedKeys_UseImage(FLSharedKeys sk, FLSlice image) FLAPI {return sk->useImage(image);}
+
+bool FLSharedKeys_UseSharedMemoryImage(FLSharedKeys sk, const char *name) FLAPI {
+    try {
+        return sk->useSharedMemoryImage(name);
+    } catchError(nullptr);
+    return false;
+}
 FLString FLSharedKeys_Decode(FLSharedKeys sk, int key)     FLAPI {return sk->decode(key);}
 void FLSharedKeys_RevertToCount(FLSharedKeys sk, unsigned c) FLAPI {sk->revertToCount(c);}
 
@@ -439,15 +842,15 @@ FLSharedKeys FLSharedKeys_CreateFromStateData(FLSlice data) FLAPI {
 #pragma mark - SLOTS:
 
 
-void FLSlot_SetNull(FLSlot slot)                        FLAPI {slot->set(Null());}
-void FLSlot_SetBool(FLSlot slot, bool v)                FLAPI {slot->set(v);}
-void FLSlot_SetInt(FLSlot slot, int64_t v)              FLAPI {slot->set(v);}
-void FLSlot_SetUInt(FLSlot slot, uint64_t v)            FLAPI {slot->set(v);}
-void FLSlot_SetFloat(FLSlot slot, float v)              FLAPI {slot->set(v);}
-void FLSlot_SetDouble(FLSlot slot, double v)            FLAPI {slot->set(v);}
-void FLSlot_SetString(FLSlot slot, FLString v)          FLAPI {slot->set(v);}
-void FLSlot_SetData(FLSlot slot, FLSlice v)             FLAPI {slot->setData(v);}
-void FLSlot_SetValue(FLSlot slot, FLValue v)            FLAPI {slot->set(v);}
+void FLSlot_SetNull(FLSlot slot)                        FLAPI {if (slot) slot->set(Null());}
+void FLSlot_SetBool(FLSlot slot, bool v)                FLAPI {if (slot) slot->set(v);}
+void FLSlot_SetInt(FLSlot slot, int64_t v)              FLAPI {if (slot) slot->set(v);}
+void FLSlot_SetUInt(FLSlot slot, uint64_t v)            FLAPI {if (slot) slot->set(v);}
+void FLSlot_SetFloat(FLSlot slot, float v)              FLAPI {if (slot) slot->set(v);}
+void FLSlot_SetDouble(FLSlot slot, double v)            FLAPI {if (slot) slot->set(v);}
+void FLSlot_SetString(FLSlot slot, FLString v)          FLAPI {if (slot) slot->set(v);}
+void FLSlot_SetData(FLSlot slot, FLSlice v)             FLAPI {if (slot) slot->setData(v);}
+void FLSlot_SetValue(FLSlot slot, FLValue v)            FLAPI {if (slot) slot->set(v);}
 
 
 #pragma mark - DEEP ITERATOR:
@@ -471,16 +874,68 @@ void FLDeepIterator_GetPath(FLDeepIterator i, FLPathComponent* *outPath, size_t
     static_assert(sizeof(FLPathComponent) == sizeof(DeepIterator::PathComponent),
                   "FLPathComponent does not match PathComponent");
     auto &path = i->path();
-    *outPath = (FLPathComponent*) path.data();
+    *outPath = (FLPathComponent*) path.begin();
     *outDepth = path.size();
 }
 
 FLSliceResult FLDeepIterator_GetPathString(FLDeepIterator i) FLAPI {
-    return toSliceResult(alloc_slice(i->pathString()));
+    return toSliceResult(alloc_slice(i->pathSlice()));
 }
 
 FLSliceResult FLDeepIterator_GetJSONPointer(FLDeepIterator i) FLAPI {
-    return toSliceResult(alloc_slice(i->jsonPointer()));
+    return toSliceResult(alloc_slice(i->jsonPointerSlice()));
+}
+
+FLString FLDeepIterator_GetPathSlice(FLDeepIterator i) FLAPI {
+    return i->pathSlice();
+}
+
+FLString FLDeepIterator_GetJSONPointerSlice(FLDeepIterator i) FLAPI {
+    return i->jsonPointerSlice();
+}
+
+
+namespace {
+    // Adapts the C callbacks of an FLParallelVisitor to a ParallelVisitor.
+    class CParallelVisitor : public ParallelVisitor {
+    public:
+        CParallelVisitor(const FLParallelVisitor *callbacks, void *context)
+        :_callbacks(callbacks)
+        ,_state(callbacks->begin ? callbacks->begin(context) : context)
+        { }
+
+        bool visit(const Value *value, const DeepIterator::Path &path) override {
+            return _callbacks->visit(_state, value, (const FLPathComponent*)path.begin(),
+                                     path.size());
+        }
+
+        void* state() const     {return _state;}
+
+    private:
+        const FLParallelVisitor* _callbacks;
+        void* _state;
+    };
+}
+
+bool FLValue_VisitParallel(FLValue root, const FLParallelVisitor *callbacks, void *context,
+                           unsigned nThreads, FLError *outError) FLAPI
+{
+    // Remember the states as they're created, so they can be ended even after an exception:
+    bool ok = false;
+    std::vector<void*> states;
+    try {
+        visitParallel(root, [&] {
+            auto visitor = std::make_unique<CParallelVisitor>(callbacks, context);
+            states.push_back(visitor->state());
+            return visitor;
+        }, nThreads);
+        ok = true;
+    } catchError(outError);
+    if (callbacks->end) {
+        for (void *state : states)
+            callbacks->end(context, state);
+    }
+    return ok;
 }
 
 
@@ -502,13 +957,43 @@ FLValue FLKeyPath_Eval(FLKeyPath path, FLValue root) FLAPI {
     return path->eval(root);
 }
 
+FLValue FLKeyPath_EvalWithSharedKeys(FLKeyPath path, FLValue root, FLSharedKeys sk) FLAPI {
+    return path->eval(root, sk);
+}
+
+bool FLKeyPath_EvalAll(FLKeyPath path, FLValue root, FLEncoder e) FLAPI {
+    try {
+        if (!e->hasError()) {
+            ENCODER_DO(e, beginArray());
+            path->evalAll(root, [&](const Value *value) {
+                ENCODER_DO(e, writeValue(value));
+                return true;
+            });
+            ENCODER_DO(e, endArray());
+            return true;
+        }
+    } catch (const std::exception &x) {
+        e->recordException(x);
+    }
+    return false;
+}
+
 FLValue FLKeyPath_EvalOnce(FLSlice specifier, FLValue root, FLError *outError) FLAPI {
     try {
-        return Path::eval((std::string)(slice)specifier, root);
+        return CompiledPath::evalCached(specifier, root);
     } catchError(outError)
     return nullptr;
 }
 
+bool FLValue_TryPatchInPlace(FLValue root, FLSlice specifier, FLValue newValue,
+                             FLError *outError) FLAPI
+{
+    try {
+        return root->patchInPlace(Path(specifier), newValue);
+    } catchError(outError)
+    return false;
+}
+
 FLStringResult FLKeyPath_ToString(FLKeyPath path) FLAPI {
     return toSliceResult(alloc_slice(std::string(*path)));
 }
@@ -526,6 +1011,30 @@ bool FLKeyPath_GetElement(FLKeyPath path, size_t i, FLSlice *outKey, int32_t *ou
     return true;
 }
 
+bool FLArray_SortedBy(FLArray a, const FLSortKey keys[], size_t keyCount,
+                      FLCollation collation, size_t limit, FLEncoder e) FLAPI
+{
+    try {
+        if (!e->hasError()) {
+            std::vector<uint32_t> order;
+            if (a) {
+                smallVector<SortKey, 4> sortKeys(keyCount);
+                for (size_t k = 0; k < keyCount; ++k)
+                    sortKeys[k] = {keys[k].path, keys[k].descending};
+                order = sortArray(a, sortKeys.begin(), keyCount, Collation(collation), limit);
+            }
+            ENCODER_DO(e, beginArray(order.size()));
+            for (uint32_t index : order)
+                ENCODER_DO(e, writeValue(a->get(index)));
+            ENCODER_DO(e, endArray());
+            return true;
+        }
+    } catch (const std::exception &x) {
+        e->recordException(x);
+    }
+    return false;
+}
+
 
 #pragma mark - ENCODER:
 
@@ -544,12 +1053,41 @@ FLEncoder FLEncoder_NewWritingToFile(FILE *outputFile, bool uniqueStrings) FLAPI
     return new FLEncoderImpl(outputFile, uniqueStrings);
 }
 
+FLEncoder FLEncoder_NewWritingToSink(FLEncoderSink sink, void *context, bool uniqueStrings) FLAPI {
+    return new FLEncoderImpl([=](slice data) {
+        if (!sink(context, data))
+            FleeceException::_throw(EncodeError, "Encoder's output sink failed");
+    }, uniqueStrings);
+}
+
 void FLEncoder_Reset(FLEncoder e) FLAPI {
     e->reset();
 }
 
+// Per-thread pool of encoders that were created by FLEncoder_NewPooled and then freed:
+static constexpr size_t kMaxPooledEncoders = 4;
+static thread_local std::vector<std::unique_ptr<FLEncoderImpl>> tEncoderPool;
+
+FLEncoder FLEncoder_NewPooled(void) FLAPI {
+    if (!tEncoderPool.empty()) {
+        FLEncoder e = tEncoderPool.back().release();
+        tEncoderPool.pop_back();
+        return e;
+    }
+    auto e = new FLEncoderImpl(kFLEncodeFleece);
+    e->fleeceEncoder->retainBuffers(true);
+    e->pooled = true;
+    return e;
+}
+
 void FLEncoder_Free(FLEncoder e) FLAPI {
-    delete e;
+    if (e && e->pooled && tEncoderPool.size() < kMaxPooledEncoders) {
+        e->reset();
+        e->fleeceEncoder->resetOptions();
+        tEncoderPool.emplace_back(e);
+    } else {
+        delete e;
+    }
 }
 
 void FLEncoder_SetSharedKeys(FLEncoder e, FLSharedKeys sk) FLAPI {
@@ -557,6 +1095,40 @@ void FLEncoder_SetSharedKeys(FLEncoder e, FLSharedKeys sk) FLAPI {
         e->fleeceEncoder->setSharedKeys(sk);
 }
 
+FLSharedKeys FLEncoder_GetSharedKeys(FLEncoder e) FLAPI {
+    return e->isFleece() ? e->fleeceEncoder->sharedKeys() : nullptr;
+}
+
+void FLEncoder_SetChecksum(FLEncoder e, bool checksum) FLAPI {
+    if (e->isFleece())
+        e->fleeceEncoder->checksum(checksum);
+}
+
+void FLEncoder_SetAlignNumbers(FLEncoder e, bool align) FLAPI {
+    if (e->isFleece())
+        e->fleeceEncoder->alignNumbers(align);
+}
+
+void FLEncoder_SetAvoidWideCollections(FLEncoder e, bool avoidWide) FLAPI {
+    if (e->isFleece())
+        e->fleeceEncoder->avoidWideCollections(avoidWide);
+}
+
+void FLEncoder_SetEmbedHashes(FLEncoder e, bool embedHashes) FLAPI {
+    if (e->isFleece())
+        e->fleeceEncoder->embedHashes(embedHashes);
+}
+
+void FLEncoder_SetCanonical(FLEncoder e, bool canonical) FLAPI {
+    if (e->isFleece()) {
+        try {
+            e->fleeceEncoder->canonical(canonical);
+        } catch (const std::exception &x) {
+            e->recordException(x);
+        }
+    }
+}
+
 void FLEncoder_SuppressTrailer(FLEncoder e) FLAPI {
     if (e->isFleece())
         e->fleeceEncoder->suppressTrailer();
@@ -570,6 +1142,19 @@ void FLEncoder_Amend(FLEncoder e, FLSlice base, bool reuseStrings, bool externPo
     }
 }
 
+void FLEncoder_ResetForAmend(FLEncoder e, FLSlice base) FLAPI {
+    if (!e->isFleece()) {
+        e->reset();
+        return;
+    }
+    // (Not e->reset(), which would clear the string table that this may keep)
+    e->fleeceEncoder->resetForAmend(base);
+    if (e->jsonConverter)
+        e->jsonConverter->reset();
+    e->errorCode = ::kFLNoError;
+    e->extraInfo = nullptr;
+}
+
 FLSlice FLEncoder_GetBase(FLEncoder e) FLAPI {
     if (e->isFleece())
         return e->fleeceEncoder->base();
@@ -602,11 +1187,31 @@ bool FLEncoder_WriteUndefined(FLEncoder e)         FLAPI {ENCODER_TRY(e, writeUn
 bool FLEncoder_WriteBool(FLEncoder e, bool b)      FLAPI {ENCODER_TRY(e, writeBool(b));}
 bool FLEncoder_WriteInt(FLEncoder e, int64_t i)    FLAPI {ENCODER_TRY(e, writeInt(i));}
 bool FLEncoder_WriteUInt(FLEncoder e, uint64_t u)  FLAPI {ENCODER_TRY(e, writeUInt(u));}
-bool FLEncoder_WriteFloat(FLEncoder e, float f)    FLAPI {ENCODER_TRY(e, writeFloat(f));}
-bool FLEncoder_WriteDouble(FLEncoder e, double d)  FLAPI {ENCODER_TRY(e, writeDouble(d));}
+// NaN is rejected up front, since a record containing one is bad input, not a programming error,
+// and recording the error is much cheaper than having the Encoder throw it.
+static bool rejectNaN(FLEncoder e) {
+    if (!e->hasError()) {
+        e->errorCode = kFLInvalidData;
+        e->errorMessage = "invalid input data: Can't write NaN";
+    }
+    return false;
+}
+
+bool FLEncoder_WriteFloat(FLEncoder e, float f)    FLAPI {
+    if (_usuallyFalse(std::isnan(f)) && e->isFleece())
+        return rejectNaN(e);
+    ENCODER_TRY(e, writeFloat(f));
+}
+bool FLEncoder_WriteDouble(FLEncoder e, double d)  FLAPI {
+    if (_usuallyFalse(std::isnan(d)) && e->isFleece())
+        return rejectNaN(e);
+    ENCODER_TRY(e, writeDouble(d));
+}
 bool FLEncoder_WriteString(FLEncoder e, FLSlice s) FLAPI {ENCODER_TRY(e, writeString(s));}
 bool FLEncoder_WriteDateString(FLEncoder e, FLTimestamp ts, bool asUTC)
                                                    FLAPI {ENCODER_TRY(e, writeDateString(ts,asUTC));}
+bool FLEncoder_WriteTimestamp(FLEncoder e, FLTimestamp ts, bool asUTC)
+                                                   FLAPI {ENCODER_TRY(e, writeTimestamp(ts,asUTC));}
 bool FLEncoder_WriteData(FLEncoder e, FLSlice d)   FLAPI {ENCODER_TRY(e, writeData(d));}
 bool FLEncoder_WriteRaw(FLEncoder e, FLSlice r)    FLAPI {ENCODER_TRY(e, writeRaw(r));}
 bool FLEncoder_WriteValue(FLEncoder e, FLValue v)  FLAPI {ENCODER_TRY(e, writeValue(v));}
@@ -616,9 +1221,90 @@ bool FLEncoder_EndArray(FLEncoder e)                    FLAPI {ENCODER_TRY(e, en
 bool FLEncoder_BeginDict(FLEncoder e, size_t reserve)   FLAPI {ENCODER_TRY(e, beginDictionary(reserve));}
 bool FLEncoder_WriteKey(FLEncoder e, FLSlice s)         FLAPI {ENCODER_TRY(e, writeKey(s));}
 bool FLEncoder_WriteKeyValue(FLEncoder e, FLValue key)  FLAPI {ENCODER_TRY(e, writeKey(key));}
+
+bool FLEncoder_WriteResolvedKey(FLEncoder e, FLResolvedKey key) FLAPI {
+    if (key->isShared() && e->isFleece() && key->sharedKeys() == e->fleeceEncoder->sharedKeys()) {
+        try {
+            if (!e->hasError()) {
+                e->fleeceEncoder->writeKey(impl::key_t(key->numericKey()));
+                return true;
+            }
+        } catch (const std::exception &x) {
+            e->recordException(x);
+        }
+        return false;
+    }
+    ENCODER_TRY(e, writeKey(key->string()));
+}
+
+FLEncoderKey FLEncoderKey_New(FLString string) FLAPI {
+    try {
+        return new Encoder::PreparedKey(string);
+    } catchError(nullptr)
+    return nullptr;
+}
+
+void FLEncoderKey_Free(FLEncoderKey key) FLAPI {
+    delete key;
+}
+
+bool FLEncoder_WritePreparedKey(FLEncoder e, FLEncoderKey key) FLAPI {
+    try {
+        if (!e->hasError()) {
+            if (e->isFleece())
+                e->fleeceEncoder->writeKey(*key);
+            else
+                e->jsonEncoder->writeKey(key->string());
+            return true;
+        }
+    } catch (const std::exception &x) {
+        e->recordException(x);
+    }
+    return false;
+}
 bool FLEncoder_EndDict(FLEncoder e)                     FLAPI {ENCODER_TRY(e, endDictionary());}
 
 
+template <class ENCODER>
+static void writeItems(ENCODER &enc, const FLItem items[], size_t count) {
+    for (size_t n = 0; n < count; ++n) {
+        const FLItem &item = items[n];
+        if (item.key.buf)
+            enc.writeKey(item.key);
+        if (item.value) {
+            enc.writeValue(item.value);
+            continue;
+        }
+        switch (item.type) {
+            case kFLUndefined:  enc.writeUndefined(); break;
+            case kFLNull:       enc.writeNull(); break;
+            case kFLBoolean:    enc.writeBool(item.asInt != 0); break;
+            case kFLNumber:     item.isInteger ? enc.writeInt(item.asInt)
+                                               : enc.writeDouble(item.asDouble); break;
+            case kFLString:     enc.writeString(item.asString); break;
+            case kFLData:       enc.writeData(item.asString); break;
+            default:            FleeceException::_throw(InvalidData,
+                                                        "FLItem of this type needs a value");
+        }
+    }
+}
+
+bool FLEncoder_WriteItems(FLEncoder e, const FLItem items[], size_t count) FLAPI {
+    try {
+        if (!e->hasError()) {
+            if (e->isFleece())
+                writeItems(*e->fleeceEncoder, items, count);
+            else
+                writeItems(*e->jsonEncoder, items, count);
+            return true;
+        }
+    } catch (const std::exception &x) {
+        e->recordException(x);
+    }
+    return false;
+}
+
+
 bool FLEncoder_ConvertJSON(FLEncoder e, FLSlice json) FLAPI {
     if (!e->hasError()) {
         try {
@@ -711,6 +1397,63 @@ FLSliceResult FLEncoder_Finish(FLEncoder e, FLError *outError) FLAPI {
 }
 
 
+bool FLEncoder_WritePlaceholder(FLEncoder e, FLPlaceholderType type) FLAPI {
+    if (!e->isFleece()) {
+        e->errorCode = kFLUnsupported;
+        return false;
+    }
+    try {
+        if (!e->hasError()) {
+            e->fleeceEncoder->writePlaceholder(DocTemplate::PlaceholderType(type));
+            return true;
+        }
+    } catch (const std::exception &x) {
+        e->recordException(x);
+    }
+    return false;
+}
+
+FLDocTemplate FLEncoder_FinishTemplate(FLEncoder e, FLError *outError) FLAPI {
+    if (e->fleeceEncoder) {
+        if (!e->hasError()) {
+            try {
+                return new DocTemplate(e->fleeceEncoder->finishTemplate());
+            } catch (const std::exception &x) {
+                e->recordException(x);
+            }
+        }
+    } else {
+        e->errorCode = kFLUnsupported;  // templates are Fleece data
+    }
+    // Failure:
+    if (outError)
+        *outError = e->errorCode;
+    e->reset();
+    return nullptr;
+}
+
+void FLDocTemplate_Free(FLDocTemplate tmpl) FLAPI {
+    delete tmpl;
+}
+
+size_t FLDocTemplate_PlaceholderCount(FLDocTemplate tmpl) FLAPI {
+    return tmpl->count();
+}
+
+static_assert(sizeof(FLTemplateValue) == sizeof(DocTemplate::Arg)
+              && offsetof(FLTemplateValue, stringValue) == offsetof(DocTemplate::Arg, stringValue),
+              "FLTemplateValue doesn't match DocTemplate::Arg");
+
+FLSliceResult FLDocTemplate_Instantiate(FLDocTemplate tmpl, const FLTemplateValue values[],
+                                        size_t count, FLError *outError) FLAPI
+{
+    try {
+        return toSliceResult(tmpl->instantiate((const DocTemplate::Arg*)values, count));
+    } catchError(outError)
+    return {nullptr, 0};
+}
+
+
 #pragma mark - DOCUMENTS
 
 
@@ -718,9 +1461,57 @@ FLDoc FLDoc_FromResultData(FLSliceResult data, FLTrust trust, FLSharedKeys sk, F
     return retain(new Doc(alloc_slice(data), (Doc::Trust)trust, sk, externData));
 }
 
+void FLDoc_Reinit(FLDoc doc, FLSliceResult data, FLTrust trust, FLSharedKeys sk, FLSlice externData) FLAPI {
+    const_cast<Doc*>(doc)->reinit(alloc_slice(data), (Doc::Trust)trust, sk, externData);
+}
+
 FLDoc FLDoc_FromJSON(FLSlice json, FLError *outError) FLAPI {
     try {
-        return retain(Doc::fromJSON(json));
+        ErrorCode error;
+        if (auto doc = Doc::fromJSON(json, nullptr, error))     // doesn't throw on invalid JSON
+            return retain(std::move(doc));
+        if (outError)
+            *outError = (FLError)error;
+    } catchError(outError);
+    return nullptr;
+}
+
+void FLValue_Prefetch(FLValue v, bool deep) FLAPI {
+    if (v)
+        Doc::prefetch(v, deep);
+}
+
+FLDoc FLDoc_FromMappedFile(const char *path, FLTrust trust, FLSharedKeys sk,
+                           FLError *outError) FLAPI
+{
+    try {
+        return retain(Doc::fromMappedFile(path, (Doc::Trust)trust, sk));
+    } catchError(outError);
+    return nullptr;
+}
+
+bool FLSharedMemory_Create(const char *name, FLSlice data, FLError *outError) FLAPI {
+#ifndef _MSC_VER
+    try {
+        MappedFile::createSharedMemory(name, data);
+        return true;
+    } catchError(outError);
+#else
+    if (outError)
+        *outError = kFLUnsupported;
+#endif
+    return false;
+}
+
+bool FLSharedMemory_Remove(const char *name) FLAPI {
+    return MappedFile::removeSharedMemory(name);
+}
+
+FLDoc FLDoc_FromSharedMemory(const char *name, FLTrust trust, FLSharedKeys sk,
+                             FLError *outError) FLAPI
+{
+    try {
+        return retain(Doc::fromSharedMemory(name, (Doc::Trust)trust, sk));
     } catchError(outError);
     return nullptr;
 }
@@ -736,6 +1527,18 @@ FLSliceResult FLDoc_GetAllocedData(FLDoc doc) FLAPI {
     return doc ? toSliceResult(doc->allocedData()) : FLSliceResult{};
 }
 
+unsigned FLDoc_GetExternDepth(FLDoc doc)       FLAPI {return doc ? doc->externDepth() : 0;}
+size_t FLDoc_GetMemoryUsage(FLDoc doc)          FLAPI {return doc ? doc->memoryUsage() : 0;}
+
+FLDoc FLDoc_Flatten(FLDoc doc, unsigned maxExternDepth, FLError *outError) FLAPI {
+    if (!doc)
+        return nullptr;
+    try {
+        return retain(doc->flattened(maxExternDepth).get());
+    } catchError(outError);
+    return nullptr;
+}
+
 
 #pragma mark - DELTA COMPRESSION
 
@@ -750,9 +1553,13 @@ FLSliceResult FLCreateJSONDelta(FLValue old, FLValue nuu) FLAPI {
 
 bool FLEncodeJSONDelta(FLValue old, FLValue nuu, FLEncoder jsonEncoder) FLAPI {
     try {
-        JSONEncoder *enc = jsonEncoder->jsonEncoder.get();
-        precondition(enc);  //TODO: Support encoding to Fleece
-        JSONDelta::create(old, nuu, *enc);
+        if (JSONEncoder *enc = jsonEncoder->jsonEncoder.get()) {
+            JSONDelta::create(old, nuu, *enc);
+        } else {
+            Encoder *fleeceEnc = jsonEncoder->fleeceEncoder.get();
+            precondition(fleeceEnc);
+            JSONDelta::create(old, nuu, *fleeceEnc);
+        }
         return true;
     } catch (const std::exception &x) {
         jsonEncoder->recordException(x);
@@ -761,6 +1568,17 @@ bool FLEncodeJSONDelta(FLValue old, FLValue nuu, FLEncoder jsonEncoder) FLAPI {
 }
 
 
+FLSliceResult FLCreateFleeceDelta(FLValue old, FLValue nuu) FLAPI {
+    try {
+        Encoder enc;
+        JSONDelta::create(old, nuu, enc);
+        return toSliceResult(enc.finish());
+    } catch (const std::exception&) {
+        return {};
+    }
+}
+
+
 FLSliceResult FLApplyJSONDelta(FLValue old, FLSlice jsonDelta, FLError *outError) FLAPI {
     try {
         return toSliceResult(JSONDelta::apply(old, jsonDelta));
@@ -780,3 +1598,113 @@ bool FLEncodeApplyingJSONDelta(FLValue old, FLSlice jsonDelta, FLEncoder encoder
         return false;
     }
 }
+
+
+bool FLApplyJSONDeltas(size_t count, const FLValue olds[], const FLSlice jsonDeltas[],
+                       FLSliceResult results[], FLError errors[], unsigned nThreads) FLAPI
+{
+    try {
+        std::vector<alloc_slice> items(count);
+        std::vector<std::exception_ptr> exceptions(errors ? count : 0);
+        size_t nFailed = JSONDelta::applyMany(count, olds, (const slice*)jsonDeltas, false,
+                                              items.data(),
+                                              (errors ? exceptions.data() : nullptr),
+                                              nThreads);
+        for (size_t i = 0; i < count; ++i) {
+            results[i] = toSliceResult(std::move(items[i]));
+            if (errors) {
+                errors[i] = kFLNoError;
+                if (exceptions[i]) {
+                    try {
+                        std::rethrow_exception(exceptions[i]);
+                    } catchError(&errors[i]);
+                }
+            }
+        }
+        return nFailed == 0;
+    } catchError(nullptr);
+    return false;
+}
+
+FLSliceResult FLApplyFleeceDelta(FLValue old, FLValue fleeceDelta, FLError *outError) FLAPI {
+    try {
+        return toSliceResult(JSONDelta::apply(old, fleeceDelta));
+    } catchError(outError);
+    return {};
+}
+
+bool FLEncodeApplyingFleeceDelta(FLValue old, FLValue fleeceDelta, FLEncoder encoder) FLAPI {
+    try {
+        Encoder *enc = encoder->fleeceEncoder.get();
+        if (!enc)
+            FleeceException::_throw(EncodeError, "FLEncodeApplyingFleeceDelta cannot encode JSON");
+        JSONDelta::apply(old, fleeceDelta, *enc);
+        return true;
+    } catch (const std::exception &x) {
+        encoder->recordException(x);
+        return false;
+    }
+}
+
+
+#pragma mark - EXECUTOR:
+
+
+namespace {
+    // Adapts an app's FLExecutor to Executor.
+    class AppExecutor final : public Executor {
+    public:
+        explicit AppExecutor(const FLExecutor &e)   :_executor(e) { }
+
+        void submit(Task task) override {
+            auto heapTask = new Task(std::move(task));
+            _executor.submit(_executor.context, [](void *t) {
+                std::unique_ptr<Task> task((Task*)t);
+                (*task)();
+            }, heapTask);
+        }
+
+        unsigned concurrency() const noexcept override {
+            return _executor.concurrency;
+        }
+
+    private:
+        FLExecutor const _executor;
+    };
+}
+
+void FLSetExecutor(const FLExecutor *executor) FLAPI {
+    // Tasks may still be running on the previous executor, so it's never freed.
+    Executor::setCurrent(executor ? new AppExecutor(*executor) : nullptr);
+}
+
+void FLExecutor_Submit(void (*task)(void *context), void *context) FLAPI {
+    Executor::current().submit([=] {task(context);});
+}
+
+void FLExecutor_ParallelFor(size_t count, unsigned maxTasks,
+                            void (*fn)(void *context, size_t i), void *context) FLAPI
+{
+    Executor::parallelFor(count, maxTasks, [=](size_t i) {fn(context, i);});
+}
+
+
+#pragma mark - INSTRUMENTATION:
+
+
+FLStats FLGetStats(void) FLAPI {
+    static_assert(sizeof(FLStats) == sizeof(counters::Totals), "FLStats doesn't match Counters");
+    auto totals = counters::totals();
+    FLStats stats;
+    memcpy(&stats, totals.data(), sizeof(stats));
+    return stats;
+}
+
+void FLResetStats(void) FLAPI {
+    counters::reset();
+}
+
+void FLSetTracer(const FLTracer *tracer) FLAPI {
+    static_assert(sizeof(FLTracer) == sizeof(tracing::Tracer), "FLTracer doesn't match Tracer");
+    tracing::setTracer((const tracing::Tracer*)tracer);
+}
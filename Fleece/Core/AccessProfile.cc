@@ -0,0 +1,257 @@
+//
+// AccessProfile.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "AccessProfile.hh"
+#include "Dict.hh"
+#include "Path.hh"
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <sstream>
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+    std::atomic<AccessProfile*> AccessProfile::sActive {nullptr};
+
+    // Guards sActive's changes, every profile's counts, and sBuffers.
+    static mutex sMutex;
+
+    // The active profile's sample interval:
+    static atomic<unsigned> sSampleInterval {1};
+
+    // Incremented whenever a profile starts or stops, so samples buffered for one profile
+    // aren't added to the next:
+    static atomic<uint64_t> sGeneration {0};
+
+    // Accesses of each kind the current thread has left to skip before it takes the next
+    // sample. (Separate per kind, since every path evaluation also makes a fixed number of
+    // lookups; with one countdown the two could stay in phase and one kind never be sampled.)
+    static thread_local unsigned tUntilSample[AccessProfile::kNumKinds] = {};
+
+
+    // A thread's samples that haven't been added to the profile yet. Its strings are reused,
+    // so once they've grown, recording a sample doesn't allocate.
+    class AccessSampleBuffer {
+    public:
+        static constexpr size_t kCapacity = 64;
+
+        struct Sample {
+            string              str;
+            AccessProfile::Kind kind;
+            uint64_t            generation;
+        };
+
+        AccessSampleBuffer();
+        ~AccessSampleBuffer();
+
+        mutex                       sampleMutex;    // Only contended while flushing
+        array<Sample, kCapacity>    samples;
+        size_t                      size {0};
+    };
+
+    static vector<AccessSampleBuffer*> sBuffers;    // Every thread's buffer
+
+    AccessSampleBuffer::AccessSampleBuffer() {
+        lock_guard<mutex> lock(sMutex);
+        sBuffers.push_back(this);
+    }
+
+    AccessSampleBuffer::~AccessSampleBuffer() {
+        lock_guard<mutex> lock(sMutex);
+        AccessProfile::flush(*this);
+        sBuffers.erase(std::find(sBuffers.begin(), sBuffers.end(), this));
+    }
+
+    static thread_local AccessSampleBuffer tBuffer;
+
+
+    AccessProfile::AccessProfile(unsigned sampleInterval)
+    :_sampleInterval(max(sampleInterval, 1u))
+    { }
+
+    AccessProfile::~AccessProfile() {
+        stop();
+    }
+
+    void AccessProfile::start() {
+        lock_guard<mutex> lock(sMutex);
+        if (sActive.load(memory_order_relaxed) != nullptr)
+            flushAll();             // (into the profile being stopped)
+        sSampleInterval.store(_sampleInterval, memory_order_relaxed);
+        ++sGeneration;
+        sActive.store(this, memory_order_relaxed);
+    }
+
+    void AccessProfile::stop() {
+        lock_guard<mutex> lock(sMutex);
+        if (sActive.load(memory_order_relaxed) == this) {
+            flushAll();
+            sActive.store(nullptr, memory_order_relaxed);
+            ++sGeneration;
+        }
+    }
+
+
+    // Returns true if the current thread should record this access.
+    static inline bool takeSample(AccessProfile::Kind kind) noexcept {
+        unsigned &untilSample = tUntilSample[kind];
+        if (untilSample > 0) {
+            --untilSample;
+            return false;
+        }
+        untilSample = sSampleInterval.load(memory_order_relaxed) - 1;
+        return true;
+    }
+
+    /*static*/ void AccessProfile::_sample(slice key) noexcept {
+        if (takeSample(kLookup))
+            record(key, kLookup);
+    }
+
+    /*static*/ void AccessProfile::_sampleIteration(const DictIterator &i) noexcept {
+        if (takeSample(kIteration))
+            record(i.keyString(), kIteration);
+    }
+
+    /*static*/ void AccessProfile::_samplePath(const Path &path) noexcept {
+        if (takeSample(kPath)) {
+            try {
+                stringstream out;
+                path.writeTo(out);
+                record(slice(out.str()), kPath);
+            } catch (...) { }   // (out of memory; the sample is just dropped)
+        }
+    }
+
+    /*static*/ void AccessProfile::_samplePath(slice specifier) noexcept {
+        if (takeSample(kPath))
+            record(specifier, kPath);
+    }
+
+    /*static*/ void AccessProfile::record(slice str, Kind kind) noexcept {
+        if (!str)
+            return;
+        AccessSampleBuffer &buffer = tBuffer;
+        bool full;
+        {
+            lock_guard<mutex> lock(buffer.sampleMutex);
+            auto &sample = buffer.samples[buffer.size];
+            try {
+                sample.str.assign((const char*)str.buf, str.size);
+            } catch (...) {
+                return;         // (out of memory; the sample is just dropped)
+            }
+            sample.kind = kind;
+            sample.generation = sGeneration.load(memory_order_relaxed);
+            full = (++buffer.size == AccessSampleBuffer::kCapacity);
+        }
+        if (full) {
+            lock_guard<mutex> lock(sMutex);
+            flush(buffer);
+        }
+    }
+
+    // Adds a buffer's samples to the active profile. Must be called with sMutex locked.
+    /*static*/ void AccessProfile::flush(AccessSampleBuffer &buffer) noexcept {
+        lock_guard<mutex> lock(buffer.sampleMutex);
+        AccessProfile *profile = sActive.load(memory_order_relaxed);
+        uint64_t generation = sGeneration.load(memory_order_relaxed);
+        for (size_t i = 0; i < buffer.size; ++i) {
+            auto &sample = buffer.samples[i];
+            if (profile && sample.generation == generation) {
+                try {
+                    ++profile->_counts[sample.kind][sample.str];
+                    ++profile->_total[sample.kind];
+                } catch (...) { }
+            }
+        }
+        buffer.size = 0;
+    }
+
+    // Adds every thread's buffered samples to the active profile. Must be called with sMutex
+    // locked.
+    /*static*/ void AccessProfile::flushAll() noexcept {
+        for (AccessSampleBuffer *buffer : sBuffers)
+            flush(*buffer);
+    }
+
+
+    uint64_t AccessProfile::count(slice key, Kind kind) const {
+        lock_guard<mutex> lock(sMutex);
+        if (started())
+            flushAll();
+        auto i = _counts[kind].find(string(key));
+        return (i != _counts[kind].end()) ? i->second : 0;
+    }
+
+    uint64_t AccessProfile::total(Kind kind) const {
+        lock_guard<mutex> lock(sMutex);
+        if (started())
+            flushAll();
+        return _total[kind];
+    }
+
+    vector<pair<string, uint64_t>> AccessProfile::hottest(size_t n, Kind kind) const {
+        vector<pair<string, uint64_t>> result;
+        {
+            lock_guard<mutex> lock(sMutex);
+            if (started())
+                flushAll();
+            result.assign(_counts[kind].begin(), _counts[kind].end());
+        }
+        n = min(n, result.size());
+        partial_sort(result.begin(), result.begin() + n, result.end(),
+                     [](const pair<string, uint64_t> &a, const pair<string, uint64_t> &b) {
+            return a.second > b.second || (a.second == b.second && a.first < b.first);
+        });
+        result.resize(n);
+        return result;
+    }
+
+    unordered_map<string, uint64_t> AccessProfile::counts(Kind kind) const {
+        lock_guard<mutex> lock(sMutex);
+        if (started())
+            flushAll();
+        return _counts[kind];
+    }
+
+    void AccessProfile::dump(std::ostream &out, size_t n) const {
+        static const char* const kKindNames[kNumKinds] = {"Lookups", "Iterations", "Paths"};
+        out << "Access profile, sampling 1 in " << _sampleInterval << ":\n";
+        for (unsigned kind = 0; kind < kNumKinds; ++kind) {
+            auto hot = hottest(n, Kind(kind));
+            out << kKindNames[kind] << ": " << total(Kind(kind)) << " sampled, "
+                << counts(Kind(kind)).size() << " distinct\n";
+            for (auto &item : hot)
+                out << "    " << item.second << "\t" << item.first << "\n";
+        }
+    }
+
+    void AccessProfile::clear() {
+        lock_guard<mutex> lock(sMutex);
+        if (started())
+            flushAll();
+        for (unsigned kind = 0; kind < kNumKinds; ++kind) {
+            _counts[kind].clear();
+            _total[kind] = 0;
+        }
+    }
+
+} }
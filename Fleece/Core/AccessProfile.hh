@@ -0,0 +1,135 @@
+//
+// AccessProfile.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include "PlatformCompat.hh"
+#include <atomic>
+#include <iosfwd>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace fleece { namespace impl {
+    class AccessSampleBuffer;
+    class DictIterator;
+    class Path;
+
+    /** Records which Dict keys and paths are accessed, by sampling calls to Dict::get,
+        DictIterator and Path::eval, so that documents can be re-encoded with their hot keys'
+        values next to the root (see Encoder::setAccessProfile), and so that SharedKeys can be
+        trained with the keys that are really used (see SharedKeys::train.)
+
+        While a profile is started, every `sampleInterval`th access of each kind on each thread
+        is recorded. (Lookups by SharedKeys integer aren't, since the key's string isn't known;
+        nor are evaluations of a CompiledPath, except through CompiledPath::evalCached.)
+        Keys are counted regardless of the Dict they're in, so the profile describes a kind of
+        document rather than a path in one. When no profile is started, the cost to an access is
+        one relaxed atomic load.
+
+        Each thread buffers its samples, and adds them to the profile when its buffer fills,
+        when it exits, or when the profile is read or stopped; so sampling threads rarely
+        contend with each other. */
+    class AccessProfile {
+    public:
+        /** The kinds of access that are counted separately. */
+        enum Kind : uint8_t {
+            kLookup,        ///< A key looked up by Dict::get (including by a path)
+            kIteration,     ///< A key visited by a DictIterator
+            kPath,          ///< A path specifier evaluated by Path::eval
+        };
+        static constexpr unsigned kNumKinds = 3;
+
+        explicit AccessProfile(unsigned sampleInterval =16);
+        ~AccessProfile();
+
+        unsigned sampleInterval() const     {return _sampleInterval;}
+
+        /** Starts recording accesses, on all threads. Only one profile can be started at a time;
+            starting one stops any other. */
+        void start();
+
+        /** Stops recording. After it returns, no thread is adding to the profile. */
+        void stop();
+
+        bool started() const                {return sActive.load(std::memory_order_relaxed) == this;}
+
+        /** The number of sampled accesses of a key (or path.) */
+        uint64_t count(slice key, Kind =kLookup) const;
+
+        /** The total number of sampled accesses of a kind. */
+        uint64_t total(Kind =kLookup) const;
+
+        /** The `n` most accessed keys (or paths) with their counts, most frequent first. */
+        std::vector<std::pair<std::string, uint64_t>> hottest(size_t n, Kind =kLookup) const;
+
+        /** A copy of all the counts of a kind. */
+        std::unordered_map<std::string, uint64_t> counts(Kind =kLookup) const;
+
+        /** Writes the totals, and the `n` hottest keys and paths of each kind with their counts,
+            in a human-readable form. */
+        void dump(std::ostream&, size_t n =20) const;
+
+        /** Clears the counts. */
+        void clear();
+
+        /** Called by Dict::get. */
+        static inline void sample(slice key) noexcept {
+            if (_usuallyFalse(sActive.load(std::memory_order_relaxed) != nullptr))
+                _sample(key);
+        }
+
+        /** Called by DictIterator when it moves to a key. */
+        static inline void sampleIteration(const DictIterator &i) noexcept {
+            if (_usuallyFalse(sActive.load(std::memory_order_relaxed) != nullptr))
+                _sampleIteration(i);
+        }
+
+        /** Called by Path::eval. */
+        static inline void samplePath(const Path &path) noexcept {
+            if (_usuallyFalse(sActive.load(std::memory_order_relaxed) != nullptr))
+                _samplePath(path);
+        }
+
+        /** Called by the functions that evaluate a path specifier. */
+        static inline void samplePath(slice specifier) noexcept {
+            if (_usuallyFalse(sActive.load(std::memory_order_relaxed) != nullptr))
+                _samplePath(specifier);
+        }
+
+    private:
+        static void _sample(slice key) noexcept;
+        static void _sampleIteration(const DictIterator&) noexcept;
+        static void _samplePath(const Path&) noexcept;
+        static void _samplePath(slice specifier) noexcept;
+        static void record(slice str, Kind) noexcept;
+        static void flush(AccessSampleBuffer&) noexcept;
+        static void flushAll() noexcept;
+
+        friend class AccessSampleBuffer;
+
+        static std::atomic<AccessProfile*> sActive;
+
+        const unsigned _sampleInterval;
+        std::unordered_map<std::string, uint64_t> _counts[kNumKinds];
+        uint64_t _total[kNumKinds] {};
+    };
+
+} }
@@ -0,0 +1,161 @@
+//
+// Aggregates.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Aggregates.hh"
+#include "Array.hh"
+#include "Bitmap.hh"
+#include "PlatformCompat.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef FL_HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
+namespace fleece { namespace impl {
+
+    // Numbers are copied out of the Array into a buffer of this many doubles at a time, and the
+    // kernels below operate on that. (It must be a multiple of 8, to keep bitmaps byte-aligned.)
+    static constexpr uint32_t kBlockSize = 256;
+
+
+    // Adds the numbers in `block` to `sum`, `min` and `max`; two at a time with SSE2 if available.
+    static void accumulate(const double *block, uint32_t n,
+                           double &sum, double &min, double &max) noexcept
+    {
+        uint32_t i = 0;
+#ifdef FL_HAVE_SSE2
+        if (n >= 2) {
+            __m128d vsum = _mm_setzero_pd(), vmin = _mm_set1_pd(min), vmax = _mm_set1_pd(max);
+            for (; i + 2 <= n; i += 2) {
+                __m128d v = _mm_loadu_pd(&block[i]);
+                vsum = _mm_add_pd(vsum, v);
+                vmin = _mm_min_pd(vmin, v);
+                vmax = _mm_max_pd(vmax, v);
+            }
+            double lanes[2];
+            _mm_storeu_pd(lanes, vsum);
+            sum += lanes[0] + lanes[1];
+            _mm_storeu_pd(lanes, vmin);
+            min = std::min(lanes[0], lanes[1]);
+            _mm_storeu_pd(lanes, vmax);
+            max = std::max(lanes[0], lanes[1]);
+        }
+#endif
+        for (; i < n; ++i) {
+            sum += block[i];
+            min = std::min(min, block[i]);
+            max = std::max(max, block[i]);
+        }
+    }
+
+
+    // Writes a bitmap byte for each 8 numbers in `block` (padded with NaN to a multiple of 8),
+    // with a bit set for each one in [lo, hi]. Returns the number of bits set.
+    static uint32_t filterBlock(const double *block, uint32_t n, double lo, double hi,
+                                uint8_t *bitmap) noexcept
+    {
+        uint32_t found = 0;
+#ifdef FL_HAVE_SSE2
+        const __m128d vlo = _mm_set1_pd(lo), vhi = _mm_set1_pd(hi);
+#endif
+        for (uint32_t i = 0; i < n; i += 8) {
+            unsigned bits = 0;
+#ifdef FL_HAVE_SSE2
+            for (unsigned j = 0; j < 8; j += 2) {
+                __m128d v = _mm_loadu_pd(&block[i + j]);
+                __m128d in = _mm_and_pd(_mm_cmpge_pd(v, vlo), _mm_cmple_pd(v, vhi));
+                bits |= unsigned(_mm_movemask_pd(in)) << j;
+            }
+#else
+            for (unsigned j = 0; j < 8; ++j)
+                bits |= unsigned(block[i + j] >= lo && block[i + j] <= hi) << j;
+#endif
+            *bitmap++ = uint8_t(bits);
+            found += popcount(bits);
+        }
+        return found;
+    }
+
+
+    // Calls `fn(block, n)` with successive blocks of an Array's items as doubles. Items that
+    // aren't numbers are left out, or stored as NaN if `keepPositions` is true. Returns the
+    // number of non-null items.
+    template <class FN>
+    static uint32_t forEachBlock(const Array *array, bool keepPositions, FN fn) {
+        double block[kBlockSize];
+        uint32_t count = array->count();
+        if (array->packedType() != Array::PackedType::kNone) {
+            // A packed Array's items are all numbers, so they can be copied in bulk:
+            for (uint32_t start = 0; start < count; start += kBlockSize) {
+                uint32_t n = array->getDoubles(start, kBlockSize, block);
+                fn(block, n);
+            }
+            return count;
+        }
+
+        const Value* values[kBlockSize];
+        uint32_t nonNull = 0;
+        Array::iterator iter(array);
+        while (size_t nValues = iter.read(values, kBlockSize)) {
+            uint32_t n = 0;
+            for (size_t i = 0; i < nValues; ++i) {
+                auto type = values[i]->type();
+                if (type != kNull)
+                    ++nonNull;
+                if (type == kNumber)
+                    block[n++] = values[i]->asDouble();
+                else if (keepPositions)
+                    block[n++] = NAN;
+            }
+            if (n > 0)
+                fn(block, n);
+        }
+        return nonNull;
+    }
+
+
+    ArrayStats getArrayStats(const Array *array) noexcept {
+        ArrayStats stats = {};
+        stats.min = INFINITY;
+        stats.max = -INFINITY;
+        stats.nonNull = forEachBlock(array, false, [&](const double *block, uint32_t n) {
+            accumulate(block, n, stats.sum, stats.min, stats.max);
+            stats.count += n;
+        });
+        if (stats.count == 0)
+            stats.min = stats.max = NAN;
+        return stats;
+    }
+
+
+    uint32_t filterNumbers(const Array *array, double minValue, double maxValue,
+                           uint8_t bitmap[]) noexcept
+    {
+        uint32_t found = 0;
+        forEachBlock(array, true, [&](double *block, uint32_t n) {
+            uint32_t padded = (n + 7) & ~7u;
+            std::fill(&block[n], &block[padded], NAN);
+            found += filterBlock(block, padded, minValue, maxValue, bitmap);
+            bitmap += padded / 8;
+        });
+        return found;
+    }
+
+} }
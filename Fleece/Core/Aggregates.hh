@@ -0,0 +1,51 @@
+//
+// Aggregates.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+
+namespace fleece { namespace impl {
+    class Array;
+
+    /** Aggregate values of the numbers in an Array, as computed by `getArrayStats`. */
+    struct ArrayStats {
+        uint32_t    count;      // Number of items that are numbers
+        uint32_t    nonNull;    // Number of items that aren't null
+        double      sum;        // Sum of the numbers
+        double      min;        // Least number, or NaN if there are none
+        double      max;        // Greatest number, or NaN if there are none
+    };
+
+
+    /** Computes the count, sum, minimum and maximum of the numbers in an Array, in one pass.
+        Items that aren't numbers are ignored, except that non-null ones are counted in
+        `nonNull`. Numbers are added as doubles, so huge integers may lose precision.
+
+        The numbers are processed in blocks, with SIMD instructions if available; this is
+        fastest on a packed Array (see Encoder::packNumericArrays), whose items are gotten
+        without looking at each one's type. */
+    ArrayStats getArrayStats(const Array* NONNULL) noexcept;
+
+
+    /** Sets the bit in `bitmap` (LSB first) of each item of an Array that's a number in the
+        range [minValue, maxValue], and clears the others. Returns the number of bits set.
+        The bitmap must have room for `(array->count() + 7) / 8` bytes. */
+    uint32_t filterNumbers(const Array* NONNULL, double minValue, double maxValue,
+                           uint8_t bitmap[]) noexcept;
+
+} }
@@ -17,11 +17,14 @@
 //
 
 #include "Array.hh"
+#include "ArraySort.hh"
 #include "MutableArray.hh"
 #include "HeapDict.hh"
 #include "Internal.hh"
 #include "PlatformCompat.hh"
 #include "varint.hh"
+#include "Endian.hh"
+#include <algorithm>
 
 
 namespace fleece { namespace impl {
@@ -31,6 +34,22 @@ namespace fleece { namespace impl {
 #pragma mark - ARRAY::IMPL:
 
 
+    // The first item of a packed array, after its header (see Internal.hh):
+    static constexpr uint8_t kPackedMarker = (kSpecialTag << 4) | kSpecialValuePacked;
+
+    // The size of each item of a packed array, which is a complete Value, padded to even length.
+    // (None of these may equal kNarrow, kWide or kMutableWidth.)
+    static inline uint8_t packedStride(Array::PackedType type) noexcept {
+        switch (type) {
+            case Array::PackedType::kInt32:     return 6;   // tag byte, 4 bytes, padding
+            case Array::PackedType::kInt64:     return 10;  // tag byte, 8 bytes, padding
+            case Array::PackedType::kFloat:     return 6;   // 2 header bytes, 4 bytes
+            case Array::PackedType::kDouble:    return 10;  // 2 header bytes, 8 bytes
+            default:                            return 0;
+        }
+    }
+
+
     __hot
     Array::impl::impl(const Value* v) noexcept {
         if (_usuallyFalse(v == nullptr)) {
@@ -51,6 +70,16 @@ namespace fleece { namespace impl {
                 else
                     _count = 0;     // invalid data, but I'm not allowed to throw an exception
                 _first = offsetby(_first, countSize + (countSize & 1));
+                if (_usuallyFalse(_count == kLongArrayCount && _first->_byte[0] == kPackedMarker)
+                                  && v->tag() == kArrayTag) {
+                    // Packed array: after the marker come the count, then inline items with a
+                    // fixed stride:
+                    _width = packedStride(Array::PackedType(_first->_byte[1]));
+                    countSize = GetUVarInt32(slice(offsetby(_first, kNarrow), 10), &_count);
+                    _first = offsetby(_first, kNarrow + countSize + (countSize & 1));
+                    if (_usuallyFalse(_width == 0 || countSize == 0))
+                        _count = 0;     // invalid data
+                }
             }
         } else {
             // Mutable Array or Dict:
@@ -65,6 +94,7 @@ namespace fleece { namespace impl {
             }
             _first = _count ? (const Value*)mutArray->first() : nullptr;
             _width = sizeof(ValueSlot);
+            static_assert(sizeof(ValueSlot) == kMutableWidth);
         }
     }
 
@@ -83,8 +113,10 @@ namespace fleece { namespace impl {
             return offsetby(_first, kNarrow * index)->deref<false>();
         else if (_usuallyTrue(_width == kWide))
             return offsetby(_first, kWide   * index)->deref<true>();
-        else
+        else if (isMutableArray())
             return ((ValueSlot*)_first + index)->asValue();
+        else
+            return offsetby(_first, _width * index);        // packed items are inline
     }
 
     const Value* Array::impl::firstValue() const noexcept {
@@ -127,12 +159,93 @@ namespace fleece { namespace impl {
         return impl(this)[index];
     }
 
+    Array::PackedType Array::packedType() const noexcept {
+        if (_usuallyFalse(isMutable()) || countIsZero())
+            return PackedType::kNone;
+        impl a(this);
+        if (a._width == kNarrow || a._width == kWide || a._count == 0)
+            return PackedType::kNone;
+        return PackedType(offsetby(this, kPackedMarkerOffset)->_byte[1]);
+    }
+
+    // Copies numbers from a packed array, whose items all have the same layout.
+    template <class T, class N, class ENDIAN>
+    static void copyPacked(const void *first, unsigned offset, unsigned stride,
+                           uint32_t count, T out[]) noexcept
+    {
+        auto src = (const uint8_t*)first + offset;
+        for (uint32_t i = 0; i < count; ++i, src += stride) {
+            ENDIAN n;
+            memcpy(&n, src, sizeof(n));
+            out[i] = T(N(n));
+        }
+    }
+
+    template <class T>
+    static uint32_t getNumbers(const Array *array, uint32_t start, uint32_t count, T out[]) {
+        uint32_t n = array->count();
+        if (start >= n)
+            return 0;
+        count = std::min(count, n - start);
+        auto type = array->packedType();
+        if (type != Array::PackedType::kNone) {
+            auto first = array->get(start);
+            auto stride = packedStride(type);
+            switch (type) {
+                case Array::PackedType::kInt32:
+                    copyPacked<T, int32_t, endian::uint32_le>(first, 1, stride, count, out);
+                    break;
+                case Array::PackedType::kInt64:
+                    copyPacked<T, int64_t, endian::uint64_le>(first, 1, stride, count, out);
+                    break;
+                case Array::PackedType::kFloat:
+                    copyPacked<T, float, endian::littleEndianFloat>(first, 2, stride, count, out);
+                    break;
+                default:
+                    copyPacked<T, double, endian::littleEndianDouble>(first, 2, stride, count, out);
+                    break;
+            }
+        } else {
+            Array::iterator i(array);
+            i += start;
+            for (uint32_t k = 0; k < count; ++k, ++i) {
+                if constexpr (std::is_floating_point_v<T>)
+                    out[k] = i.value()->asDouble();
+                else
+                    out[k] = i.value()->asInt();
+            }
+        }
+        return count;
+    }
+
+    uint32_t Array::getDoubles(uint32_t start, uint32_t count, double out[]) const noexcept {
+        return getNumbers(this, start, count, out);
+    }
+
+    uint32_t Array::getInts(uint32_t start, uint32_t count, int64_t out[]) const noexcept {
+        return getNumbers(this, start, count, out);
+    }
+
+    uint32_t Array::lowerBound(const Value *value) const noexcept {
+        uint32_t lo = 0, hi = count();
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (compareValues(get(mid), value) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
     HeapArray* Array::heapArray() const {
         return (HeapArray*)internal::HeapCollection::asHeapValue(this);
     }
 
     MutableArray* Array::asMutable() const {
-        return isMutable() ? (MutableArray*)this : nullptr;
+        if (!isMutable() || heapArray()->isSharedCopyOnWrite())
+            return nullptr;
+        return (MutableArray*)this;
     }
 
     EVEN_ALIGNED static constexpr Array kEmptyArrayInstance;
@@ -159,4 +272,33 @@ namespace fleece { namespace impl {
         return *this;
     }
 
+    // Resolves the first `n` items, given that the Array's width is WIDE.
+    template <bool WIDE>
+    inline void Array::impl::derefItems(size_t n, const Value* out[]) const noexcept {
+        auto item = _first;
+        for (size_t i = 0; i < n; ++i, item = offsetby(item, WIDE ? kWide : kNarrow))
+            out[i] = item->isPointer() ? item->deref<WIDE>() : item;
+    }
+
+    __hot
+    size_t ArrayIterator::read(const Value* out[], size_t n) noexcept {
+        n = std::min(n, size_t(_count));
+        if (_usuallyFalse(n == 0))
+            return 0;
+        if (_width == kNarrow) {
+            derefItems<false>(n, out);
+        } else if (_width == kWide) {
+            derefItems<true>(n, out);
+        } else if (isMutableArray()) {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = ((ValueSlot*)_first + i)->asValue();
+        } else {
+            for (size_t i = 0; i < n; ++i)
+                out[i] = offsetby(_first, _width * i);      // packed items are inline
+        }
+        offset(uint32_t(n));
+        _value = firstValue();
+        return n;
+    }
+
 } }
@@ -40,7 +40,10 @@ namespace fleece { namespace impl {
             const Value* operator[] (unsigned index) const noexcept FLPURE;
             size_t indexOf(const Value *v) const noexcept FLPURE;
             void offset(uint32_t n);
-            bool isMutableArray() const noexcept FLPURE      {return _width > 4;}
+            template <bool WIDE> void derefItems(size_t n, const Value* out[]) const noexcept;
+            bool isMutableArray() const noexcept FLPURE      {return _width == kMutableWidth;}
+
+            static constexpr uint8_t kMutableWidth = FL_VALUE_SLOT_SIZE;  // sizeof(ValueSlot)
         };
 
     public:
@@ -55,6 +58,34 @@ namespace fleece { namespace impl {
             iterator and use its sequential or random-access accessors. */
         const Value* get(uint32_t index) const noexcept FLPURE;
 
+        /** How a packed Array's items are stored. (See Encoder::packNumericArrays.) */
+        enum class PackedType : uint8_t {
+            kNone,              // Not packed
+            kInt32,
+            kInt64,
+            kFloat,
+            kDouble,
+        };
+
+        /** If this Array is packed, returns the type its items are stored as, else kNone.
+            A packed Array is accessed like any other, but its items are inline Values with a
+            fixed stride, instead of slots that point to them. */
+        PackedType packedType() const noexcept FLPURE;
+
+        /** Copies up to `count` items starting at index `start` into `out`, converted as by
+            Value::asDouble, and returns the number copied. On a packed Array this is a simple
+            strided copy, which makes it the fastest way to get at a lot of numbers. */
+        uint32_t getDoubles(uint32_t start, uint32_t count, double out[]) const noexcept;
+
+        /** Copies up to `count` items starting at index `start` into `out`, converted as by
+            Value::asInt, and returns the number copied. */
+        uint32_t getInts(uint32_t start, uint32_t count, int64_t out[]) const noexcept;
+
+        /** Returns the index of the first item that isn't less than `value`, as ordered by
+            \ref compareValues, or count() if there's none. This is a binary search, so the items
+            must be sorted in that order. */
+        uint32_t lowerBound(const Value *value) const noexcept;
+
         /** If this array is mutable, returns the equivalent MutableArray*, else returns nullptr. */
         MutableArray* asMutable() const FLPURE;
 
@@ -72,10 +103,13 @@ namespace fleece { namespace impl {
 
     private:
         friend class Value;
+        friend class CompressedDoc;
+        friend class Doc;
         friend class ArrayIterator;
         friend class Dict;
         friend class DictIterator;
         template <bool WIDE> friend struct dictImpl;
+        friend class Encoder;
         friend class internal::HeapArray;
     };
 
@@ -96,6 +130,12 @@ namespace fleece { namespace impl {
         /** Returns the current item and advances to the next. */
         const Value* read() noexcept                     {auto v = _value; ++(*this); return v;}
 
+        /** Copies up to `n` items, starting with the current one, into `out`, and advances past
+            them. Returns the number of items read, which is less than `n` only at the end.
+            This is much faster than reading the items one at a time, since the Array's width
+            is checked only once per call, and it's the best way to scan a large Array. */
+        size_t read(const Value* out[], size_t n) noexcept;
+
         /** Random access to items. Index is relative to the current item.
             This is very fast, faster than array::get(). */
         const Value* operator[] (unsigned i) const noexcept FLPURE    {return ((impl&)*this)[i];}
@@ -111,11 +151,11 @@ namespace fleece { namespace impl {
 
     private:
         const Value* rawValue() noexcept                 {return _first;}
-
         const Value *_value;
 
         friend class Value;
         friend class ValueDumper;
+        friend class DataStats;
     };
 
 
@@ -0,0 +1,333 @@
+//
+// ArraySort.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ArraySort.hh"
+#include "Array.hh"
+#include "Encoder.hh"
+#include "Path.hh"
+#include "SharedKeys.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+    // The first byte of a value's sort key. 0 is reserved to end an array's items.
+    enum : uint8_t {
+        kKeyEndOfArray = 0, kKeyMissing, kKeyNull, kKeyFalse, kKeyTrue, kKeyNumber, kKeyString,
+        kKeyData, kKeyArray, kKeyDict
+    };
+
+
+    // Writes a string so that it compares bytewise, and isn't a prefix of any longer one:
+    // 00 bytes are escaped as 00 FF, and it ends with 00 00.
+    static void appendString(slice str, Collation collation, string &out) {
+        auto begin = (const char*)str.buf, end = begin + str.size;
+        for (auto c = begin; c != end; ++c) {
+            char ch = *c;
+            if (ch == 0) {
+                out.append("\0\xFF", 2);
+            } else {
+                if (collation == Collation::kASCIICaseInsensitive && ch >= 'A' && ch <= 'Z')
+                    ch += 'a' - 'A';
+                out += ch;
+            }
+        }
+        out.append("\0\0", 2);
+    }
+
+
+    // Writes a double as 8 big-endian bytes that compare like the numbers: positive numbers
+    // get their sign bit set, and negative ones have all their bits flipped.
+    static void appendNumber(double d, string &out) {
+        if (d == 0)
+            d = 0;                  // -0.0 sorts as 0
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        bits = (bits & (1ull << 63)) ? ~bits : (bits | (1ull << 63));
+        for (int shift = 56; shift >= 0; shift -= 8)
+            out += char(uint8_t(bits >> shift));
+    }
+
+
+    static void appendValue(const Value *value, Collation collation, string &out) {
+        if (!value) {
+            out += char(kKeyMissing);
+            return;
+        }
+        switch (value->type()) {
+            case kNull:
+                out += char(kKeyNull);
+                break;
+            case kBoolean:
+                out += char(value->asBool() ? kKeyTrue : kKeyFalse);
+                break;
+            case kNumber:
+                out += char(kKeyNumber);
+                appendNumber(value->asDouble(), out);
+                break;
+            case kString:
+                out += char(kKeyString);
+                appendString(value->asString(), collation, out);
+                break;
+            case kData:
+                out += char(kKeyData);
+                appendString(value->asData(), Collation::kBinary, out);
+                break;
+            case kArray:
+                out += char(kKeyArray);
+                for (Array::iterator i(value->asArray()); i; ++i)
+                    appendValue(i.value(), collation, out);
+                out += char(kKeyEndOfArray);
+                break;
+            case kDict:
+                out += char(kKeyDict);
+                break;
+        }
+    }
+
+
+    void appendSortKey(const Value *value, Collation collation, bool descending, string &out) {
+        size_t start = out.size();
+        appendValue(value, collation, out);
+        if (descending) {
+            for (auto c = out.begin() + start; c != out.end(); ++c)
+                *c = char(~*c);
+        }
+    }
+
+
+    vector<uint32_t> sortArray(const Array *array, const SortKey keys[], size_t keyCount,
+                               Collation collation, size_t limit)
+    {
+        vector<CompiledPath> paths;
+        paths.reserve(keyCount);
+        for (size_t k = 0; k < keyCount; ++k)
+            paths.emplace_back(*keys[k].path, array->sharedKeys());
+
+        // Write each item's key into one buffer:
+        struct entry {
+            uint32_t offset, size, index;
+        };
+        uint32_t count = array->count();
+        vector<entry> entries;
+        entries.reserve(count);
+        string buffer;
+        buffer.reserve(size_t(count) * 16 * keyCount);
+        uint32_t index = 0;
+        for (Array::iterator i(array); i; ++i, ++index) {
+            auto offset = uint32_t(buffer.size());
+            for (size_t k = 0; k < keyCount; ++k)
+                appendSortKey(paths[k].eval(i.value()), collation, keys[k].descending, buffer);
+            entries.push_back({offset, uint32_t(buffer.size()) - offset, index});
+        }
+
+        // Compare keys bytewise, then by index so that the order is stable:
+        auto base = (const uint8_t*)buffer.data();
+        auto less = [base](const entry &a, const entry &b) {
+            if (int cmp = memcmp(base + a.offset, base + b.offset, min(a.size, b.size)); cmp != 0)
+                return cmp < 0;
+            if (a.size != b.size)
+                return a.size < b.size;
+            return a.index < b.index;
+        };
+        if (limit < entries.size()) {
+            partial_sort(entries.begin(), entries.begin() + limit, entries.end(), less);
+            entries.resize(limit);
+        } else {
+            sort(entries.begin(), entries.end(), less);
+        }
+
+        vector<uint32_t> result;
+        result.reserve(entries.size());
+        for (auto &e : entries)
+            result.push_back(e.index);
+        return result;
+    }
+
+
+    void writeSortedArray(const Array *array, const SortKey keys[], size_t keyCount,
+                          Collation collation, size_t limit, Encoder &enc)
+    {
+        auto order = sortArray(array, keys, keyCount, collation, limit);
+        enc.beginArray(order.size());
+        for (uint32_t index : order)
+            enc.writeValue(array->get(index));
+        enc.endArray();
+    }
+
+
+
+#pragma mark - SORTED ARRAYS:
+
+
+    static uint8_t typeRank(const Value *value) noexcept {
+        if (!value)
+            return kKeyMissing;
+        switch (value->type()) {
+            case kNull:     return kKeyNull;
+            case kBoolean:  return value->asBool() ? kKeyTrue : kKeyFalse;
+            case kNumber:   return kKeyNumber;
+            case kString:   return kKeyString;
+            case kData:     return kKeyData;
+            case kArray:    return kKeyArray;
+            default:        return kKeyDict;
+        }
+    }
+
+
+    template <class T>
+    static int compare3(T a, T b) noexcept {
+        return (a < b) ? -1 : (a > b);
+    }
+
+
+    static int compareNumbers(const Value *a, const Value *b) noexcept {
+        if (a->isInteger() && b->isInteger()) {
+            bool negA = !a->isUnsigned() && a->asInt() < 0;
+            bool negB = !b->isUnsigned() && b->asInt() < 0;
+            if (negA != negB)
+                return negA ? -1 : 1;
+            return negA ? compare3(a->asInt(), b->asInt())
+                        : compare3(a->asUnsigned(), b->asUnsigned());
+        }
+        return compare3(a->asDouble(), b->asDouble());
+    }
+
+
+    int compareValues(const Value *a, const Value *b) noexcept {
+        uint8_t rank = typeRank(a);
+        if (int cmp = compare3(rank, typeRank(b)); cmp != 0)
+            return cmp;
+        switch (rank) {
+            case kKeyNumber:
+                return compareNumbers(a, b);
+            case kKeyString:
+                return a->asString().compare(b->asString());
+            case kKeyData:
+                return a->asData().compare(b->asData());
+            case kKeyArray: {
+                Array::iterator ia(a->asArray()), ib(b->asArray());
+                for (; ia && ib; ++ia, ++ib) {
+                    if (int cmp = compareValues(ia.value(), ib.value()); cmp != 0)
+                        return cmp;
+                }
+                return compare3(bool(ia), bool(ib));
+            }
+            default:
+                return 0;
+        }
+    }
+
+
+    // Returns the index of the first item of `array` at or after `start` that isn't less than
+    // `value`. It probes at start, start+1, start+3, start+7... then binary-searches the last
+    // interval, so finding a nearby item is cheap.
+    static uint32_t gallop(const Array *array, uint32_t start, uint32_t count,
+                           const Value *value) noexcept
+    {
+        uint32_t lo = start, step = 1;
+        uint32_t hi = start;
+        while (hi < count && compareValues(array->get(hi), value) < 0) {
+            lo = hi + 1;
+            hi = (count - hi > step) ? hi + step : count;
+            step *= 2;
+        }
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (compareValues(array->get(mid), value) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return lo;
+    }
+
+
+    static void writeItems(const Array *array, uint32_t start, uint32_t end, Encoder &enc) {
+        for (uint32_t i = start; i < end; ++i)
+            enc.writeValue(array->get(i));
+    }
+
+
+    void writeIntersection(const Array *a, const Array *b, Encoder &enc) {
+        enc.beginArray();
+        // Look up each item of the shorter array in the longer one:
+        bool aIsShorter = a->count() <= b->count();
+        const Array *shorter = aIsShorter ? a : b, *longer = aIsShorter ? b : a;
+        uint32_t longCount = longer->count(), pos = 0;
+        for (Array::iterator i(shorter); i && pos < longCount; ++i) {
+            pos = gallop(longer, pos, longCount, i.value());
+            if (pos < longCount && compareValues(longer->get(pos), i.value()) == 0) {
+                enc.writeValue(aIsShorter ? i.value() : longer->get(pos));
+                ++pos;
+            }
+        }
+        enc.endArray();
+    }
+
+
+    void writeUnion(const Array *a, const Array *b, Encoder &enc) {
+        enc.beginArray();
+        // Write the runs of the longer array between the items of the shorter one:
+        bool aIsShorter = a->count() <= b->count();
+        const Array *shorter = aIsShorter ? a : b, *longer = aIsShorter ? b : a;
+        uint32_t longCount = longer->count(), pos = 0;
+        for (Array::iterator i(shorter); i; ++i) {
+            uint32_t next = gallop(longer, pos, longCount, i.value());
+            writeItems(longer, pos, next, enc);
+            pos = next;
+            if (pos < longCount && compareValues(longer->get(pos), i.value()) == 0) {
+                enc.writeValue(aIsShorter ? i.value() : longer->get(pos));
+                ++pos;
+            } else {
+                enc.writeValue(i.value());
+            }
+        }
+        writeItems(longer, pos, longCount, enc);
+        enc.endArray();
+    }
+
+
+    void writeDifference(const Array *a, const Array *b, Encoder &enc) {
+        enc.beginArray();
+        uint32_t aCount = a->count(), bCount = b->count(), pos = 0;
+        if (aCount <= bCount) {
+            // Look up each item of `a` in `b`:
+            for (Array::iterator i(a); i; ++i) {
+                pos = gallop(b, pos, bCount, i.value());
+                if (pos < bCount && compareValues(b->get(pos), i.value()) == 0)
+                    ++pos;
+                else
+                    enc.writeValue(i.value());
+            }
+        } else {
+            // Write the runs of `a` between the items of `b`:
+            for (Array::iterator i(b); i && pos < aCount; ++i) {
+                uint32_t next = gallop(a, pos, aCount, i.value());
+                writeItems(a, pos, next, enc);
+                pos = next;
+                if (pos < aCount && compareValues(a->get(pos), i.value()) == 0)
+                    ++pos;
+            }
+            writeItems(a, pos, aCount, enc);
+        }
+        enc.endArray();
+    }
+
+} }
@@ -0,0 +1,89 @@
+//
+// ArraySort.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include <string>
+#include <vector>
+
+namespace fleece { namespace impl {
+    class Array;
+    class Encoder;
+    class Path;
+    class Value;
+
+    /** How strings are compared when sorting. */
+    enum class Collation : uint8_t {
+        kBinary,                // By UTF-8 bytes, i.e. by Unicode code point
+        kASCIICaseInsensitive,  // Like kBinary, but ASCII letters are compared as lowercase
+    };
+
+
+    /** A sort criterion: the value at a path in each item, in ascending or descending order. */
+    struct SortKey {
+        const Path* path;       // Must be single-valued
+        bool        descending;
+    };
+
+
+    /** Returns the indexes of an Array's items in sorted order, by the values at the paths of
+        `keys` in each item. If `limit` is given, only the first `limit` are returned.
+
+        Values are ordered first by type: missing, null, false, true, numbers, strings, data,
+        arrays, dicts. Numbers are compared as doubles; arrays by their items; dicts are all
+        equal. Items that compare equal stay in their original order.
+
+        Rather than evaluating the paths in each comparison, each item's values are evaluated
+        once and written to a byte string that sorts the same way with memcmp. With a limit,
+        only a heap of the least `limit` keys is kept sorted.
+        Throws FleeceException if a path isn't single-valued. */
+    std::vector<uint32_t> sortArray(const Array* NONNULL, const SortKey keys[], size_t keyCount,
+                                    Collation =Collation::kBinary, size_t limit =SIZE_MAX);
+
+    /** Writes an Array of the items of `array`, sorted as by \ref sortArray. If the encoder's
+        base is the array's data (see Encoder::setBase), the items are written as pointers to
+        the originals, so they aren't copied. */
+    void writeSortedArray(const Array* NONNULL, const SortKey keys[], size_t keyCount,
+                          Collation, size_t limit, Encoder&);
+
+    /** Appends the sort key of a Value, as used by \ref sortArray, to `out`. The keys of
+        values compare with memcmp the way the values sort, and no key is a prefix of another,
+        so the keys of several values can be concatenated. */
+    void appendSortKey(const Value*, Collation, bool descending, std::string &out);
+
+
+    /** Compares two Values, returning a negative number, 0, or a positive number. They're
+        ordered as by \ref sortArray with binary collation, except that integers are compared
+        exactly instead of as doubles. A null pointer is less than any Value. */
+    int compareValues(const Value*, const Value*) noexcept;
+
+
+    /** These write an Array of the items of two Arrays that are sorted as by \ref compareValues,
+        and without duplicates: the items in both, the items in either, or the items in `a` but
+        not `b`. Items in both are written from `a`.
+
+        The arrays are merged, but the shorter array's next item is searched for in the longer
+        one by galloping (an exponential then a binary search), so when one is much smaller the
+        time is O(m log n), and the longer one's items in between aren't even read. Runs of
+        items are written with Encoder::writeValue, so if the encoder's base is the arrays'
+        data they're written as pointers. */
+    void writeIntersection(const Array* NONNULL a, const Array* NONNULL b, Encoder&);
+    void writeUnion(const Array* NONNULL a, const Array* NONNULL b, Encoder&);
+    void writeDifference(const Array* NONNULL a, const Array* NONNULL b, Encoder&);
+
+} }
@@ -0,0 +1,416 @@
+//
+// CBORConverter.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CBORConverter.hh"
+#include "FleeceImpl.hh"
+#include "Writer.hh"
+#include "UTF8.hh"
+#include "slice_stream.hh"
+#include <cmath>
+#include <cstring>
+
+namespace fleece { namespace impl {
+
+    // Major types (the high 3 bits of an item's initial byte):
+    enum : uint8_t {
+        kUnsignedInt, kNegativeInt, kByteString, kTextString, kArrayType, kMapType, kTag, kSimple
+    };
+
+    // Additional-info values (the low 5 bits):
+    enum : uint8_t {
+        kSimpleFalse = 20, kSimpleTrue, kSimpleNull, kSimpleUndefined, kOneByteArg,
+        kHalfFloat = 25, kFloat32, kFloat64, kIndefinite = 31
+    };
+
+    static constexpr uint8_t kBreak = 0xFF;
+
+
+#pragma mark - WRITING:
+
+
+    // Writes an item's head: its major type and its argument, in as few bytes as possible.
+    static void writeHead(Writer &out, uint8_t major, uint64_t arg) {
+        uint8_t buf[9];
+        size_t n;
+        major <<= 5;
+        if (arg < kOneByteArg) {
+            buf[0] = uint8_t(major | arg);
+            n = 1;
+        } else {
+            uint8_t info;
+            if (arg <= UINT8_MAX)        {info = kOneByteArg;     n = 1;}
+            else if (arg <= UINT16_MAX)  {info = kOneByteArg + 1; n = 2;}
+            else if (arg <= UINT32_MAX)  {info = kOneByteArg + 2; n = 4;}
+            else                         {info = kOneByteArg + 3; n = 8;}
+            buf[0] = uint8_t(major | info);
+            for (size_t i = n; i > 0; --i, arg >>= 8)
+                buf[i] = uint8_t(arg);
+            ++n;
+        }
+        out.write(buf, n);
+    }
+
+
+    static void writeItem(const Value *v, Writer &out, const SharedKeys *sk) {
+        switch (v->type()) {
+            case kNull:
+                out << uint8_t((kSimple << 5) | (v->isUndefined() ? kSimpleUndefined : kSimpleNull));
+                break;
+            case kBoolean:
+                out << uint8_t((kSimple << 5) | (v->asBool() ? kSimpleTrue : kSimpleFalse));
+                break;
+            case kNumber:
+                if (v->isInteger()) {
+                    int64_t i = v->asInt();
+                    if (i >= 0 || v->isUnsigned())
+                        writeHead(out, kUnsignedInt, uint64_t(i));
+                    else
+                        writeHead(out, kNegativeInt, uint64_t(-1 - i));
+                } else if (v->isDouble()) {
+                    double d = v->asDouble();
+                    uint64_t bits;
+                    memcpy(&bits, &d, sizeof(bits));
+                    out << uint8_t((kSimple << 5) | kFloat64);
+                    uint8_t buf[8];
+                    for (int i = 7; i >= 0; --i, bits >>= 8)
+                        buf[i] = uint8_t(bits);
+                    out.write(buf, sizeof(buf));
+                } else {
+                    float f = v->asFloat();
+                    uint32_t bits;
+                    memcpy(&bits, &f, sizeof(bits));
+                    out << uint8_t((kSimple << 5) | kFloat32);
+                    uint8_t buf[4];
+                    for (int i = 3; i >= 0; --i, bits >>= 8)
+                        buf[i] = uint8_t(bits);
+                    out.write(buf, sizeof(buf));
+                }
+                break;
+            case kString: {
+                slice str = v->asString();
+                writeHead(out, kTextString, str.size);
+                out.write(str);
+                break;
+            }
+            case kData: {
+                slice data = v->asData();
+                writeHead(out, kByteString, data.size);
+                out.write(data);
+                break;
+            }
+            case kArray: {
+                auto array = v->asArray();
+                writeHead(out, kArrayType, array->count());
+                for (Array::iterator i(array); i; ++i)
+                    writeItem(i.value(), out, sk);
+                break;
+            }
+            case kDict: {
+                auto dict = v->asDict();
+                writeHead(out, kMapType, dict->count());
+                for (Dict::iterator i(dict, sk); i; ++i) {
+                    slice key = i.keyString();
+                    throwIf(!key, InvalidData, "Unrecognized integer key");
+                    writeHead(out, kTextString, key.size);
+                    out.write(key);
+                    writeItem(i.value(), out, sk);
+                }
+                break;
+            }
+            default:
+                FleeceException::_throw(UnknownValue, "illegal typecode in Value; corrupt data?");
+        }
+    }
+
+
+    /*static*/ void CBORConverter::writeCBOR(const Value *v, Writer &out, const SharedKeys *sk) {
+        writeItem(v, out, sk);
+    }
+
+
+    /*static*/ alloc_slice CBORConverter::toCBOR(const Value *v, const SharedKeys *sk) {
+        Writer out;
+        writeItem(v, out, sk);
+        return out.finish();
+    }
+
+
+#pragma mark - READING:
+
+
+    namespace {
+        // Parses CBOR, writing it to an Encoder. Reports errors by returning false.
+        class CBORReader {
+        public:
+            CBORReader(slice cbor, Encoder &enc)    :_in(cbor), _enc(enc) { }
+
+            bool read() {
+                if (!readItem(0))
+                    return false;
+                if (!_in.eof())
+                    return fail("Unexpected data after the CBOR item");
+                return true;
+            }
+
+            ErrorCode       error {NoError};
+            std::string     message;
+
+        private:
+            bool fail(const char *msg, ErrorCode code =InvalidData) {
+                error = code;
+                message = msg;
+                return false;
+            }
+
+            // Reads an item's head. `info` is the additional info; `arg` its value, unless the
+            // item is indefinite-length (or a simple value or float, which have no argument.)
+            bool readHead(uint8_t &major, uint8_t &info, uint64_t &arg) {
+                if (_in.eof())
+                    return fail("Truncated CBOR");
+                uint8_t byte = _in.readByte();
+                major = byte >> 5;
+                info = byte & 0x1F;
+                arg = info;
+                if (info >= kOneByteArg && info < kIndefinite) {
+                    if (info > kFloat64)
+                        return fail("Invalid CBOR additional info");
+                    size_t size = size_t(1) << (info - kOneByteArg);
+                    slice bytes = _in.readAll(size);
+                    if (!bytes)
+                        return fail("Truncated CBOR");
+                    arg = 0;
+                    for (size_t i = 0; i < size; ++i)
+                        arg = (arg << 8) | bytes[i];
+                } else if (info == kIndefinite) {
+                    if (major == kUnsignedInt || major == kNegativeInt || major == kTag)
+                        return fail("Invalid indefinite-length CBOR item");
+                }
+                return true;
+            }
+
+            // Reads the contents of a text or byte string whose head has been read. An
+            // indefinite-length string's chunks are concatenated into `buffer`.
+            bool readString(uint8_t major, uint8_t info, uint64_t arg,
+                            slice &str, std::string &buffer)
+            {
+                if (info != kIndefinite) {
+                    if (arg > _in.size)
+                        return fail("Truncated CBOR");
+                    str = _in.readAll(size_t(arg));
+                } else {
+                    buffer.clear();
+                    while (true) {
+                        if (_in.eof())
+                            return fail("Truncated CBOR");
+                        if (_in.peekByte() == kBreak) {
+                            _in.skip(1);
+                            break;
+                        }
+                        uint8_t chunkMajor, chunkInfo;
+                        uint64_t chunkSize;
+                        if (!readHead(chunkMajor, chunkInfo, chunkSize))
+                            return false;
+                        if (chunkMajor != major || chunkInfo == kIndefinite)
+                            return fail("Invalid chunk in indefinite-length CBOR string");
+                        if (chunkSize > _in.size)
+                            return fail("Truncated CBOR");
+                        buffer.append((const char*)_in.next(), size_t(chunkSize));
+                        _in.skip(size_t(chunkSize));
+                    }
+                    str = slice(buffer);
+                }
+                if (major == kTextString && !isValidUTF8(str))
+                    return fail("Invalid UTF-8 in CBOR text string");
+                return true;
+            }
+
+            // True at the end of an array or map: when no items remain, or, if it's indefinite-
+            // length, at the break byte (which is skipped.)
+            bool atBreak(bool indefinite, uint64_t &remaining) {
+                if (!indefinite)
+                    return remaining-- == 0;
+                if (_in.peekByte() != kBreak)
+                    return false;
+                _in.skip(1);
+                return true;
+            }
+
+            bool readItem(int depth) {
+                uint8_t major, info;
+                uint64_t arg;
+                if (!readHead(major, info, arg))
+                    return false;
+                while (major == kTag) {
+                    // Tags (dates, bignums...) only add meaning to the item; convert it as is.
+                    if (!readHead(major, info, arg))
+                        return false;
+                }
+                bool indefinite = (info == kIndefinite);
+                switch (major) {
+                    case kUnsignedInt:
+                        _enc.writeUInt(arg);
+                        return true;
+                    case kNegativeInt:
+                        if (arg > uint64_t(INT64_MAX))
+                            return fail("CBOR integer is too negative for Fleece");
+                        _enc.writeInt(-1 - int64_t(arg));
+                        return true;
+                    case kByteString:
+                    case kTextString: {
+                        slice str;
+                        if (!readString(major, info, arg, str, _buffer))
+                            return false;
+                        if (major == kTextString)
+                            _enc.writeString(str);
+                        else
+                            _enc.writeData(str);
+                        return true;
+                    }
+                    case kArrayType:
+                        if (depth >= CBORConverter::kMaxNestingLevels)
+                            return fail("CBOR is nested too deeply");
+                        if (!indefinite && arg > _in.size)
+                            return fail("Truncated CBOR");      // (each item is at least 1 byte)
+                        _enc.beginArray(indefinite ? 0 : size_t(arg));
+                        while (true) {
+                            if (indefinite && _in.eof())
+                                return fail("Truncated CBOR");
+                            if (atBreak(indefinite, arg))
+                                break;
+                            if (!readItem(depth + 1))
+                                return false;
+                        }
+                        _enc.endArray();
+                        return true;
+                    case kMapType:
+                        if (depth >= CBORConverter::kMaxNestingLevels)
+                            return fail("CBOR is nested too deeply");
+                        if (!indefinite && arg > _in.size / 2)
+                            return fail("Truncated CBOR");
+                        _enc.beginDictionary(indefinite ? 0 : size_t(arg));
+                        while (true) {
+                            if (indefinite && _in.eof())
+                                return fail("Truncated CBOR");
+                            if (atBreak(indefinite, arg))
+                                break;
+                            uint8_t keyMajor, keyInfo;
+                            uint64_t keyArg;
+                            if (!readHead(keyMajor, keyInfo, keyArg))
+                                return false;
+                            if (keyMajor != kTextString)
+                                return fail("CBOR map key is not a string", EncodeError);
+                            slice key;
+                            if (!readString(keyMajor, keyInfo, keyArg, key, _keyBuffer))
+                                return false;
+                            _enc.writeKey(key);
+                            if (!readItem(depth + 1))
+                                return false;
+                        }
+                        _enc.endDictionary();
+                        return true;
+                    default:
+                        return readSimple(info, arg);
+                }
+            }
+
+            bool readSimple(uint8_t info, uint64_t arg) {
+                switch (info) {
+                    case kSimpleFalse:      _enc.writeBool(false); return true;
+                    case kSimpleTrue:       _enc.writeBool(true); return true;
+                    case kSimpleNull:       _enc.writeNull(); return true;
+                    case kSimpleUndefined:  _enc.writeUndefined(); return true;
+                    case kHalfFloat:
+                        return writeFloat(halfToFloat(uint16_t(arg)));
+                    case kFloat32: {
+                        uint32_t bits = uint32_t(arg);
+                        float f;
+                        memcpy(&f, &bits, sizeof(f));
+                        return writeFloat(f);
+                    }
+                    case kFloat64: {
+                        double d;
+                        memcpy(&d, &arg, sizeof(d));
+                        if (std::isnan(d))
+                            return fail("Can't write NaN");
+                        _enc.writeDouble(d);
+                        return true;
+                    }
+                    case kIndefinite:
+                        return fail("Unexpected CBOR break");
+                    default:
+                        return fail("Unsupported CBOR simple value", EncodeError);
+                }
+            }
+
+            bool writeFloat(float f) {
+                if (std::isnan(f))
+                    return fail("Can't write NaN");
+                _enc.writeFloat(f);
+                return true;
+            }
+
+            static float halfToFloat(uint16_t half) {
+                int exponent = (half >> 10) & 0x1F;
+                int mantissa = half & 0x3FF;
+                float f;
+                if (exponent == 0)
+                    f = std::ldexp(float(mantissa), -24);
+                else if (exponent != 31)
+                    f = std::ldexp(float(mantissa + 1024), exponent - 25);
+                else
+                    f = mantissa ? NAN : INFINITY;
+                return (half & 0x8000) ? -f : f;
+            }
+
+            slice_istream   _in;
+            Encoder&        _enc;
+            std::string     _buffer, _keyBuffer;   // Holds indefinite-length strings
+        };
+    }
+
+
+    /*static*/ bool CBORConverter::encodeCBOR(slice cbor, Encoder &enc, ErrorCode &outError,
+                                              std::string *outErrorMessage)
+    {
+        CBORReader reader(cbor, enc);
+        bool ok;
+        try {
+            ok = reader.read();
+        } catch (const FleeceException &x) {
+            reader.error = x.code;
+            reader.message = x.what();
+            ok = false;
+        }
+        outError = reader.error;
+        if (!ok && outErrorMessage)
+            *outErrorMessage = reader.message;
+        return ok;
+    }
+
+
+    /*static*/ alloc_slice CBORConverter::convertCBOR(slice cbor, SharedKeys *sk) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        ErrorCode error;
+        std::string message;
+        if (!encodeCBOR(cbor, enc, error, &message))
+            FleeceException::_throw(error, "%s", message.c_str());
+        return enc.finish();
+    }
+
+} }
@@ -0,0 +1,66 @@
+//
+// CBORConverter.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "FleeceException.hh"
+#include "fleece/slice.hh"
+#include <string>
+
+namespace fleece {
+    class Writer;
+}
+
+namespace fleece { namespace impl {
+    class Encoder;
+    class SharedKeys;
+    class Value;
+
+
+    /** Converts between Fleece and CBOR <https://cbor.io> (RFC 8949) directly, without going
+        through JSON.
+
+        Fleece values map to CBOR's definite-length items: integers, floats and doubles, text
+        and byte strings, arrays, maps with string keys, and false/true/null/undefined.
+        Going the other way, CBOR tags are ignored (the tagged item is converted on its own),
+        half-precision floats are widened, and indefinite-length items are accepted; but CBOR
+        that Fleece can't represent, like maps with non-string keys, is rejected. */
+    class CBORConverter {
+    public:
+        /** Writes a Value to a Writer as a CBOR data item. Integer Dict keys are decoded with
+            `sk`, if given, or else with the SharedKeys of the Doc they belong to.
+            Throws InvalidData if a key can't be decoded. */
+        static void writeCBOR(const Value* NONNULL, Writer&, const SharedKeys *sk =nullptr);
+
+        /** Returns a Value encoded as CBOR. */
+        static alloc_slice toCBOR(const Value* NONNULL, const SharedKeys *sk =nullptr);
+
+        /** Parses a single CBOR data item and writes it to an Encoder.
+            Invalid or unsupported CBOR doesn't throw; it returns false and sets `outError` (and
+            `outErrorMessage`, if given), leaving the Encoder with a partial value.
+            @return  True on success, false if the CBOR can't be converted. */
+        static bool encodeCBOR(slice cbor, Encoder&, ErrorCode &outError,
+                               std::string *outErrorMessage =nullptr);
+
+        /** Convenience method to convert CBOR to Fleece data. Throws FleeceException on error. */
+        static alloc_slice convertCBOR(slice cbor, SharedKeys *sk =nullptr);
+
+        /** Maximum nesting depth of arrays/maps in the input. */
+        static constexpr int kMaxNestingLevels = 50;
+    };
+
+} }
@@ -0,0 +1,202 @@
+//
+// CollectionFile.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CollectionFile.hh"
+#include "JSONConverter.hh"
+#include "SharedKeys.hh"
+#include "SharedStrings.hh"
+#include "FileUtils.hh"
+#include "FleeceException.hh"
+#include "sliceIO.hh"
+#include <cstring>
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+#pragma mark - READER:
+
+
+    /*static*/ Retained<CollectionFile> CollectionFile::open(const char *path, Doc::Trust trust) {
+        return new CollectionFile(unique_ptr<MappedFile>(new MappedFile(path)), trust);
+    }
+
+
+    CollectionFile::CollectionFile(unique_ptr<MappedFile> file, Doc::Trust trust)
+    :_mappedFile(move(file))
+    ,_trust(trust)
+    {
+        init(_mappedFile->contents());
+    }
+
+
+    CollectionFile::CollectionFile(const alloc_slice &data, Doc::Trust trust)
+    :_alloced(data)
+    ,_trust(trust)
+    {
+        init(data);
+    }
+
+
+    void CollectionFile::init(slice data) {
+        throwIf(data.size < sizeof(Header) || memcmp(data.buf, kMagic, sizeof(kMagic)) != 0,
+                InvalidData, "Not a Fleece collection file");
+        Header header;
+        memcpy(&header, data.buf, sizeof(header));
+        auto inBounds = [&](uint64_t offset, uint64_t size) {
+            return offset <= data.size && size <= data.size - offset;
+        };
+        uint64_t count = header.count;
+        throwIf(!inBounds(header.poolOffset, header.poolSize)
+                    || !inBounds(header.keysOffset, header.keysSize)
+                    || header.indexOffset % sizeof(endian::uint64_le) != 0
+                    || count >= data.size / sizeof(endian::uint64_le)
+                    || !inBounds(header.indexOffset, (count + 1) * sizeof(endian::uint64_le)),
+                InvalidData, "Corrupt Fleece collection file");
+
+        _data = data;
+        _count = size_t(count);
+        _index = (const endian::uint64_le*)offsetby(data.buf, header.indexOffset);
+        if (header.poolSize > 0)
+            _pool = slice(offsetby(data.buf, header.poolOffset), size_t(header.poolSize));
+        _sharedKeys = new SharedKeys();
+        if (header.keysSize > 0) {
+            slice image(offsetby(data.buf, header.keysOffset), size_t(header.keysSize));
+            throwIf(!_sharedKeys->useImage(image),
+                    InvalidData, "Corrupt SharedKeys in Fleece collection file");
+        }
+    }
+
+
+    slice CollectionFile::documentData(size_t i) const {
+        throwIf(i >= _count, OutOfRange, "Document index out of range");
+        uint64_t start = _index[i], end = _index[i + 1];
+        throwIf(start < sizeof(Header) || start > end || end > _data.size,
+                InvalidData, "Corrupt Fleece collection file");
+        return slice(offsetby(_data.buf, start), size_t(end - start));
+    }
+
+
+    Retained<Doc> CollectionFile::document(size_t i) const {
+        Retained<Doc> doc = new Doc(this, documentData(i), _trust, _sharedKeys, _pool);
+        if (!doc->root())
+            return nullptr;
+        return doc;
+    }
+
+
+#pragma mark - WRITER:
+
+
+    CollectionFileWriter::CollectionFileWriter(const char *path,
+                                               SharedKeys *sk,
+                                               SharedStrings *pool)
+    :_file(fopen(path, "wb"))
+    ,_sharedKeys(sk ? sk : new SharedKeys())
+    {
+        if (!_file)
+            FleeceException::_throwErrno("Can't open file %s", path);
+        _encoder.setSharedKeys(_sharedKeys);
+        _encoder.setSharedStrings(pool);
+
+        // Leave room for the header, which is written last, once the offsets are known:
+        write({&_header, sizeof(_header)});
+        if (pool) {
+            _header.poolOffset = _pos;
+            _header.poolSize = pool->data().size;
+            write(pool->data());
+            padTo8();
+        }
+    }
+
+
+    CollectionFileWriter::~CollectionFileWriter() {
+        if (_file)
+            fclose(_file);
+    }
+
+
+    void CollectionFileWriter::write(slice s) {
+        check_fwrite(_file, s.buf, s.size);
+        _pos += s.size;
+    }
+
+
+    void CollectionFileWriter::padTo8() {
+        static constexpr uint8_t kZeros[8] = { };
+        if (_pos % 8)
+            write({kZeros, size_t(8 - _pos % 8)});
+    }
+
+
+    size_t CollectionFileWriter::add(const Value *value) {
+        throwIf(!_file, EncodeError, "CollectionFileWriter has already finished");
+        _encoder.writeValue(value);
+        return addEncoded();
+    }
+
+
+    size_t CollectionFileWriter::addJSON(slice json) {
+        throwIf(!_file, EncodeError, "CollectionFileWriter has already finished");
+        JSONConverter cvt(_encoder);
+        if (!cvt.encodeJSON(json)) {
+            _encoder.reset();
+            FleeceException::_throw(JSONError, "%s", cvt.errorMessage());
+        }
+        return addEncoded();
+    }
+
+
+    // Appends the document in the Encoder to the file. (A Fleece document's size is always
+    // even, so the bodies stay 2-byte aligned without padding.)
+    size_t CollectionFileWriter::addEncoded() {
+        alloc_slice body = _encoder.finish();
+        assert_postcondition(body.size % 2 == 0);
+        _index.push_back(_pos);
+        write(body);
+        return _index.size() - 1;
+    }
+
+
+    void CollectionFileWriter::finish() {
+        throwIf(!_file, EncodeError, "CollectionFileWriter has already finished");
+        _header.count = _index.size();
+        _index.push_back(_pos);                     // end of the last body
+
+        padTo8();
+        if (_sharedKeys->count() > 0) {
+            alloc_slice image = _sharedKeys->imageData();
+            _header.keysOffset = _pos;
+            _header.keysSize = image.size;
+            write(image);
+            padTo8();
+        }
+
+        _header.indexOffset = _pos;
+        write({_index.data(), _index.size() * sizeof(endian::uint64_le)});
+
+        memcpy(_header.magic, CollectionFile::kMagic, sizeof(_header.magic));
+        checkErrno(fseek(_file, 0, SEEK_SET), "Can't write to file");
+        check_fwrite(_file, &_header, sizeof(_header));
+        FILE *file = _file;
+        _file = nullptr;
+        checkErrno(fclose(file), "Can't close file");
+    }
+
+} }
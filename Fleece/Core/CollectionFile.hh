@@ -0,0 +1,152 @@
+//
+// CollectionFile.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Doc.hh"
+#include "Encoder.hh"
+#include "Endian.hh"
+#include "RefCounted.hh"
+#include "fleece/slice.hh"
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+namespace fleece {
+    class MappedFile;
+}
+
+namespace fleece { namespace impl {
+    class SharedKeys;
+    class SharedStrings;
+    class Value;
+
+
+    /** A file containing many Fleece documents, which share one SharedKeys and one pool of
+        common strings (see SharedStrings.) Each document stores its keys as integers and its
+        common strings as pointers into the pool, instead of repeating them, which makes a
+        collection of small documents much smaller than the documents stored separately.
+
+        The file consists of (offsets and sizes are little-endian, sections 8-byte aligned):
+        - A header: a magic number, the document count, and the offset and size of each section;
+        - The string pool, i.e. a SharedStrings's data(), or nothing;
+        - The documents' bodies, each a Fleece document whose extern pointers point to the pool;
+        - The SharedKeys, as an image (see SharedKeys::imageData), so they're used in place;
+        - The index: the offset of each document's body, followed by the end of the last one.
+
+        Opening a file reads only its header, and getting a document is one index lookup.
+        A CollectionFile is immutable, so it's thread-safe. Create one with CollectionFileWriter. */
+    class CollectionFile : public RefCounted {
+    public:
+        /** Opens a file by memory-mapping it. Throws InvalidData if it isn't a collection. */
+        static Retained<CollectionFile> open(const char *path, Doc::Trust =Doc::kUntrusted);
+
+        /** Uses the contents of a collection file that's already in memory.
+            Throws InvalidData if it isn't a collection. */
+        explicit CollectionFile(const alloc_slice &data, Doc::Trust =Doc::kUntrusted);
+
+        /** The number of documents. */
+        size_t count() const FLPURE                     {return _count;}
+
+        /** The SharedKeys used by the documents. Since they're read from the file in place,
+            they must not be used after the CollectionFile (and all its Docs) are freed. */
+        SharedKeys* sharedKeys() const FLPURE           {return _sharedKeys;}
+
+        /** The pool of strings that the documents point to. (May be empty.) */
+        slice stringPool() const FLPURE                 {return _pool;}
+
+        /** The raw Fleece data of the i'th document. Its extern pointers point to the pool, so
+            it can't be read except through a Doc; see \ref document.
+            Throws OutOfRange if there's no such document. */
+        slice documentData(size_t i) const;
+
+        /** Returns a Doc for the i'th document, or nullptr if it's not valid Fleece.
+            The Doc retains this CollectionFile. Throws OutOfRange if there's no such document.
+            (Each call creates a new Doc, so keep the Doc if it'll be used again.) */
+        Retained<Doc> document(size_t i) const;
+
+        /** The layout of the header at the start of the file. */
+        struct Header {
+            uint8_t             magic[8];
+            endian::uint64_le   count;
+            endian::uint64_le   poolOffset, poolSize;
+            endian::uint64_le   keysOffset, keysSize;
+            endian::uint64_le   indexOffset;
+        };
+
+        static constexpr uint8_t kMagic[8] = {'F', 'l', 'e', 'e', 'c', 'e', 'C', '1'};
+
+    private:
+        CollectionFile(std::unique_ptr<MappedFile>, Doc::Trust);
+        void init(slice data);
+
+        std::unique_ptr<MappedFile> _mappedFile;        // Mapped file, if any
+        alloc_slice const         _alloced;             // Retains the data if it's in memory
+        slice                     _data;                // The entire file
+        slice                     _pool;                // The string pool
+        const endian::uint64_le*  _index {nullptr};     // Offsets of the bodies (count+1)
+        size_t                    _count {0};
+        Retained<SharedKeys>      _sharedKeys;
+        Doc::Trust const          _trust;
+    };
+
+
+    /** Writes a CollectionFile. Documents are encoded, with the SharedKeys and string pool, and
+        appended to the file as they're added; the SharedKeys and the index are written when the
+        writer finishes. */
+    class CollectionFileWriter {
+    public:
+        /** Creates (or overwrites) a file at `path`.
+            @param path  The file to write.
+            @param sharedKeys  The SharedKeys to encode the documents' keys with; if null, a new
+                        instance is used. Keys found in the documents are added to it.
+            @param pool  A pool of common strings, or null. It's copied into the file. */
+        CollectionFileWriter(const char *path,
+                             SharedKeys *sharedKeys =nullptr,
+                             SharedStrings *pool =nullptr);
+
+        /** If the writer hasn't finished, this closes the file, which won't be readable. */
+        ~CollectionFileWriter();
+
+        /** The number of documents added so far. */
+        size_t count() const FLPURE                     {return _index.size();}
+
+        /** Adds a document, returning its index in the collection. */
+        size_t add(const Value* NONNULL);
+
+        /** Converts JSON to a document and adds it, returning its index in the collection.
+            Throws JSONError if the JSON is invalid. */
+        size_t addJSON(slice json);
+
+        /** Writes the SharedKeys and the index, then the header, and closes the file. */
+        void finish();
+
+    private:
+        CollectionFileWriter(const CollectionFileWriter&) =delete;
+        void write(slice);
+        void padTo8();
+        size_t addEncoded();
+
+        FILE*                       _file;
+        Retained<SharedKeys>        _sharedKeys;
+        Encoder                     _encoder;
+        CollectionFile::Header      _header {};
+        std::vector<endian::uint64_le> _index;
+        uint64_t                    _pos {0};           // Current write position in the file
+    };
+
+} }
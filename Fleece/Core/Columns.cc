@@ -0,0 +1,73 @@
+//
+// Columns.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Columns.hh"
+#include "Array.hh"
+#include "Dict.hh"
+#include "SharedKeys.hh"
+#include "SmallVector.hh"
+#include <cstring>
+
+namespace fleece { namespace impl {
+
+    void extractColumns(const Array *array, Column columns[], size_t columnCount) {
+        uint32_t count = array->count();
+
+        // Map the keys to the array's SharedKeys once, up front:
+        SharedKeys *sk = array->sharedKeys();
+        smallVector<key_t, 8> keys(columnCount);
+        smallVector<uint32_t, 8> hints(columnCount);
+        for (size_t c = 0; c < columnCount; ++c) {
+            int encoded;
+            if (sk && sk->encode(columns[c].key, encoded))
+                keys[c] = key_t(encoded);
+            else
+                keys[c] = key_t(columns[c].key);
+            hints[c] = 0;
+            if (columns[c].nulls)
+                memset(columns[c].nulls, 0, (count + 7) / 8);
+        }
+
+        uint32_t row = 0;
+        for (Array::iterator iter(array); iter; ++iter, ++row) {
+            const Dict *dict = iter.value()->asDict();
+            for (size_t c = 0; c < columnCount; ++c) {
+                Column &column = columns[c];
+                const Value *value = dict ? dict->get(keys[c], hints[c]) : nullptr;
+                bool present = false;
+                switch (column.type) {
+                    case ColumnType::kInt:
+                        present = value && value->type() == kNumber;
+                        ((int64_t*)column.values)[row] = present ? value->asInt() : 0;
+                        break;
+                    case ColumnType::kDouble:
+                        present = value && value->type() == kNumber;
+                        ((double*)column.values)[row] = present ? value->asDouble() : 0.0;
+                        break;
+                    case ColumnType::kString:
+                        present = value && value->type() == kString;
+                        ((slice*)column.values)[row] = present ? value->asString() : slice();
+                        break;
+                }
+                if (!present && column.nulls)
+                    column.nulls[row >> 3] |= uint8_t(1 << (row & 7));
+            }
+        }
+    }
+
+} }
@@ -0,0 +1,55 @@
+//
+// Columns.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+
+namespace fleece { namespace impl {
+    class Array;
+
+    /** The type of values stored in a Column. */
+    enum class ColumnType : uint8_t {
+        kInt,                   // int64_t
+        kDouble,                // double
+        kString,                // slice
+    };
+
+
+    /** Describes one property to extract from an Array of Dicts, and where to put it. */
+    struct Column {
+        slice       key;        // The Dict property to extract
+        ColumnType  type;       // The type of the values to store
+        void*       values;     // Array of int64_t, double or slice, with an item for each row
+        uint8_t*    nulls;      // Optional bitmap with a bit for each row (LSB first), or null
+    };
+
+
+    /** Extracts properties from each Dict in an Array into typed columns, in a single pass.
+        For each row, the property's value (if any) is stored in the corresponding item of each
+        column's `values`, which must have room for `array->count()` items. Strings point into
+        the source data, so they're only valid as long as it is.
+
+        A row whose item isn't a Dict, or doesn't have the property, or whose property's type
+        doesn't match the column, stores 0 (or a null slice) and sets its bit in `nulls`.
+        Ints and doubles are converted to each other's type as necessary.
+
+        The Dicts in an array of records usually have the same keys, so each key is first
+        looked for at the item index where it was found in the previous row. */
+    void extractColumns(const Array* NONNULL, Column columns[], size_t columnCount);
+
+} }
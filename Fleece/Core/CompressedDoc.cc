@@ -0,0 +1,269 @@
+//
+// CompressedDoc.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CompressedDoc.hh"
+#include "Array.hh"
+#include "Dict.hh"
+#include "DictIndex.hh"
+#include "Pointer.hh"
+#include "FleeceException.hh"
+#include "LZ4.hh"
+#include "sliceIO.hh"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+    using namespace internal;
+
+    // The most bytes a Value's header can take, including its varint count or length:
+    static constexpr size_t kMaxHeaderSize = 2 + 10;
+
+
+    // A zero-filled heap block, for the decompressed data. The Doc on it retains it.
+    class ZeroedBuffer : public RefCounted {
+    public:
+        explicit ZeroedBuffer(size_t size)
+        :_buf(calloc(size, 1))
+        ,_size(size)
+        {
+            if (!_buf)
+                throw std::bad_alloc();
+        }
+
+        slice data() const      {return {_buf, _size};}
+
+    protected:
+        ~ZeroedBuffer()         {free(_buf);}
+
+    private:
+        void* const _buf;
+        size_t const _size;
+    };
+
+
+    /*static*/ alloc_slice CompressedDoc::compress(slice data, size_t blockSize) {
+        throwIf(blockSize < 1024 || blockSize > 1024 * 1024, InvalidData, "Invalid block size");
+        throwIf(data.size < kNarrow, InvalidData, "No Fleece data to compress");
+        size_t blockCount = (data.size + blockSize - 1) / blockSize;
+        throwIf(blockCount > UINT32_MAX, InvalidData, "Too much data to compress");
+
+        // Each block is at most its original size, so this is big enough for any data:
+        size_t tableEnd = sizeof(Header) + (blockCount + 1) * sizeof(endian::uint64_le);
+        alloc_slice out(tableEnd + data.size);
+        auto outBytes = (uint8_t*)out.buf;
+        vector<endian::uint64_le> offsets(blockCount + 1);
+        size_t pos = tableEnd;
+        for (size_t i = 0; i < blockCount; ++i) {
+            slice block(offsetby(data.buf, i * blockSize),
+                        min(blockSize, data.size - i * blockSize));
+            offsets[i] = pos;
+            // A block is only stored compressed if it gets smaller:
+            size_t size = compressLZ4(block, outBytes + pos, block.size - 1);
+            if (size == 0) {
+                block.copyTo(outBytes + pos);
+                size = block.size;
+            }
+            pos += size;
+        }
+        offsets[blockCount] = pos;
+
+        Header header;
+        memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.blockSize = uint32_t(blockSize);
+        header.blockCount = uint32_t(blockCount);
+        header.dataSize = data.size;
+        memcpy(outBytes, &header, sizeof(header));
+        memcpy(outBytes + sizeof(header), offsets.data(), offsets.size() * sizeof(offsets[0]));
+        out.shorten(pos);
+        return out;
+    }
+
+
+    CompressedDoc::CompressedDoc(const alloc_slice &compressed, SharedKeys *sk)
+    :_alloced(compressed)
+    {
+        init(compressed, sk);
+    }
+
+
+    CompressedDoc::CompressedDoc(unique_ptr<MappedFile> file, SharedKeys *sk)
+    :_mappedFile(move(file))
+    {
+        init(_mappedFile->contents(), sk);
+    }
+
+
+    /*static*/ Retained<CompressedDoc> CompressedDoc::fromMappedFile(const char *path,
+                                                                     SharedKeys *sk)
+    {
+        return new CompressedDoc(unique_ptr<MappedFile>(new MappedFile(path)), sk);
+    }
+
+
+    void CompressedDoc::init(slice compressed, SharedKeys *sk) {
+        throwIf(compressed.size < sizeof(Header) || memcmp(compressed.buf, kMagic, sizeof(kMagic)),
+                InvalidData, "Not compressed Fleece data");
+        Header header;
+        memcpy(&header, compressed.buf, sizeof(header));
+        _blockSize = header.blockSize;
+        _blockCount = header.blockCount;
+        uint64_t dataSize = header.dataSize;
+        throwIf(_blockSize == 0 || dataSize < kNarrow || dataSize > SIZE_MAX
+                    || _blockCount != (dataSize + _blockSize - 1) / _blockSize
+                    || (compressed.size - sizeof(Header)) / sizeof(endian::uint64_le) <= _blockCount,
+                InvalidData, "Corrupt compressed Fleece data");
+        _compressed = compressed;
+        _offsets = (const endian::uint64_le*)offsetby(compressed.buf, sizeof(Header));
+
+        // A large calloc is normally mapped lazily by the OS to zero pages, so the pages of
+        // blocks that are never loaded don't take up any memory:
+        Retained<ZeroedBuffer> buffer = new ZeroedBuffer(size_t(dataSize));
+        _buffer = buffer->data();
+        _loaded.reset(new atomic<bool>[_blockCount]);
+        for (size_t i = 0; i < _blockCount; ++i)
+            _loaded[i] = false;
+        _doc = new Doc(buffer, _buffer, Doc::kDontParse, sk);
+        _doc->allowDataToChange();
+
+        // The data ends with a pointer to the root:
+        auto top = (const Value*)offsetby(_buffer.end(), -kNarrow);
+        loadRange(top, kNarrow);
+        _root = top->isPointer() ? loadPointer(top, false) : top;
+        throwIf(!_root, InvalidData, "Corrupt compressed Fleece data");
+        load(_root);
+    }
+
+
+    void CompressedDoc::loadBlock(size_t i) const {
+        if (_loaded[i].load(memory_order_acquire))
+            return;
+        lock_guard<mutex> lock(_mutex);
+        if (_loaded[i].load(memory_order_relaxed))
+            return;
+        uint64_t start = _offsets[i], end = _offsets[i + 1];
+        throwIf(start < sizeof(Header) || start > end || end > _compressed.size,
+                InvalidData, "Corrupt compressed Fleece data");
+        slice input(offsetby(_compressed.buf, size_t(start)), size_t(end - start));
+        size_t offset = i * _blockSize, size = min(_blockSize, _buffer.size - offset);
+        auto output = (uint8_t*)_buffer.buf + offset;
+        if (input.size == size)
+            input.copyTo(output);               // stored uncompressed
+        else
+            throwIf(!decompressLZ4(input, output, size),
+                    InvalidData, "Corrupt compressed Fleece data");
+        _loaded[i].store(true, memory_order_release);
+        ++_loadedCount;
+    }
+
+
+    void CompressedDoc::loadRange(const void *start, size_t size) const {
+        size_t offset = (const uint8_t*)start - (const uint8_t*)_buffer.buf;
+        size_t end = min(offset + size, _buffer.size);
+        for (size_t i = offset / _blockSize; i * _blockSize < end; ++i)
+            loadBlock(i);
+    }
+
+
+    // Loads a pointer's destination, and any pointers it goes through, returning the final
+    // Value; or nullptr if it's not in this document.
+    const Value* CompressedDoc::loadPointer(const Value *item, bool wide) const {
+        while (true) {
+            auto ptr = item->_asPointer();
+            if (ptr->isExternal())
+                return nullptr;
+            const Value *dst = wide ? ptr->deref<true>() : ptr->deref<false>();
+            if (!_buffer.containsAddress(dst))
+                return nullptr;
+            loadRange(dst, kMaxHeaderSize);
+            if (!dst->isPointer())
+                return dst;
+            item = dst;
+            wide = true;                        // pointers to pointers are always wide
+        }
+    }
+
+
+    const Value* CompressedDoc::load(const Value *value, bool deep) const {
+        if (!value || !_buffer.containsAddress(value))
+            return value;
+        vector<pair<const Value*,bool>> stack {{value, deep}};
+        while (!stack.empty()) {
+            auto [v, vDeep] = stack.back();
+            stack.pop_back();
+            loadItems(v, vDeep, stack);
+        }
+        return value;
+    }
+
+
+    // Loads a Value's bytes. For a collection that's its header and items; then the Values the
+    // items point to are loaded, or pushed on `stack` if they have to be loaded in turn.
+    void CompressedDoc::loadItems(const Value *value, bool deep,
+                                  vector<pair<const Value*,bool>> &stack) const
+    {
+        loadRange(value, kMaxHeaderSize);
+        auto tag = value->tag();
+        if (tag < kArrayTag) {
+            loadRange(value, value->dataSize());
+            return;
+        }
+
+        Array::impl coll(value);
+        bool isDict = (tag == kDictTag);
+        size_t slots = coll._count;
+        if (isDict)
+            slots *= 2;
+        loadRange(value, value->dataSize() + slots * coll._width);
+
+        if (coll._count >= min(DictKeyPrefixes::kMinCount, CollectionHash::kMinCount)) {
+            // A hash index, key prefixes and/or a content hash may follow the items:
+            auto trailer = (const Value*)offsetby(coll._first, slots * coll._width);
+            for (int i = 0; i < 3 && _buffer.containsAddress(trailer); ++i) {
+                loadRange(trailer, kMaxHeaderSize);
+                if (trailer->_byte[0] != DictIndex::kHeaderByte)
+                    break;
+                size_t size = trailer->dataSize();
+                loadRange(trailer, size);
+                trailer = offsetby(trailer, size + (size & 1));
+            }
+        }
+
+        if (coll._width != kNarrow && coll._width != kWide)
+            return;                             // packed Array: all items are inline
+        bool wide = (coll._width == kWide);
+        bool hasParent = isDict && coll._count > 0
+                            && Dict::isMagicParentKey(coll._first);
+        auto item = coll._first;
+        for (size_t i = 0; i < slots; ++i, item = offsetby(item, coll._width)) {
+            if (!item->isPointer())
+                continue;
+            // Dicts' keys and parents are needed to look up their keys, so they're loaded even
+            // if `deep` is false:
+            bool needed = (isDict && i % 2 == 0)                // key
+                       || (hasParent && i == 1);                // parent
+            if (deep || needed) {
+                if (const Value *target = loadPointer(item, wide); target)
+                    stack.push_back({target, deep});
+            }
+        }
+    }
+
+} }
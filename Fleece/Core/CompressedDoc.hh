@@ -0,0 +1,120 @@
+//
+// CompressedDoc.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Doc.hh"
+#include "Endian.hh"
+#include "RefCounted.hh"
+#include "fleece/slice.hh"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fleece {
+    class MappedFile;
+}
+
+namespace fleece { namespace impl {
+    class SharedKeys;
+    class Value;
+
+
+    /** Fleece data stored as independently-compressed (LZ4) blocks, which are decompressed only
+        as the Values in them are needed. This keeps a large document small at rest, while reading
+        part of it costs only the decompression of the blocks that part lies in.
+
+        The compressed form (see \ref compress) is a header giving the block size and the data's
+        size, a table of the blocks' offsets, then the blocks. A block that doesn't shrink is
+        stored uncompressed.
+
+        Values are read in place, through ordinary pointers, so a Value's bytes must be loaded
+        before it's read: \ref root loads the root, and \ref load loads any other Value, either
+        just the Value itself or its entire subtree. Loading a collection also loads its Dict
+        keys, so it can be searched and iterated, but its items have to be loaded before they're
+        read. (The data that hasn't been loaded is all zeroes, so such a Value reads as 0.)
+
+        The decompressed blocks are written into a zeroed buffer the size of the whole data,
+        which is allocated up front but (on most platforms) only takes up memory as blocks are
+        loaded.
+        The data is trusted: it's not validated, since that would mean decompressing all of it.
+        A CompressedDoc is thread-safe. */
+    class CompressedDoc : public RefCounted {
+    public:
+        static constexpr size_t kDefaultBlockSize = 32 * 1024;
+
+        /** Compresses Fleece data into blocks of the given (uncompressed) size, which must be
+            from 1KB to 1MB. Smaller blocks make loading parts of the data faster, but don't
+            compress as well. */
+        static alloc_slice compress(slice fleeceData, size_t blockSize =kDefaultBlockSize);
+
+        /** Opens compressed data in memory. Throws InvalidData if it isn't valid. */
+        explicit CompressedDoc(const alloc_slice &compressedData, SharedKeys* =nullptr);
+
+        /** Opens compressed data in a file, by memory-mapping it. */
+        static Retained<CompressedDoc> fromMappedFile(const char *path, SharedKeys* =nullptr);
+
+        /** The root Value, loaded as by \ref load. */
+        const Value* root() const FLPURE                {return _root;}
+
+        /** Loads the blocks containing a Value: its own bytes, or (if `deep` is true) those of
+            every Value it contains as well. Returns the Value, for convenience. Values that
+            aren't in this document are returned as-is. Throws InvalidData if a block is corrupt. */
+        const Value* load(const Value*, bool deep =false) const;
+
+        /** The Doc that owns the decompressed data. Values in the data belong to it, so it's the
+            Doc found by Doc::containing(). (Its own `root()` is null; use this object's.) */
+        Doc* doc() const FLPURE                         {return _doc;}
+
+        size_t blockCount() const FLPURE                {return _blockCount;}
+        size_t loadedBlockCount() const noexcept        {return _loadedCount;}
+
+        /** The layout of the header at the start of the compressed data. */
+        struct Header {
+            uint8_t             magic[8];
+            endian::uint32_le   blockSize;
+            endian::uint32_le   blockCount;
+            endian::uint64_le   dataSize;
+        };
+
+        static constexpr uint8_t kMagic[8] = {'F', 'l', 'e', 'e', 'c', 'e', 'Z', '1'};
+
+    private:
+        CompressedDoc(std::unique_ptr<MappedFile>, SharedKeys*);
+        void init(slice compressed, SharedKeys*);
+        void loadRange(const void *start, size_t size) const;
+        void loadBlock(size_t) const;
+        const Value* loadPointer(const Value *item, bool wide) const;
+        void loadItems(const Value*, bool deep,
+                       std::vector<std::pair<const Value*,bool>> &stack) const;
+
+        std::unique_ptr<MappedFile> _mappedFile;        // Mapped file, if any
+        alloc_slice const           _alloced;           // Retains the data if it's in memory
+        slice                       _compressed;        // The compressed data
+        const endian::uint64_le*    _offsets;           // Offsets of the blocks (count+1)
+        size_t                      _blockSize, _blockCount;
+        slice                       _buffer;            // The decompressed data (owned by _doc)
+        Retained<Doc>               _doc;               // Scope covering _buffer
+        std::unique_ptr<std::atomic<bool>[]> _loaded;   // Which blocks are in _buffer
+        mutable std::atomic<size_t> _loadedCount {0};
+        mutable std::mutex          _mutex;             // Serializes decompression
+        const Value*                _root {nullptr};
+    };
+
+} }
@@ -0,0 +1,287 @@
+//
+// DataStats.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "DataStats.hh"
+#include "FleeceImpl.hh"
+#include "Pointer.hh"
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include <stdio.h>
+#include <unordered_set>
+
+namespace fleece { namespace impl {
+    using namespace std;
+    using namespace internal;
+
+
+    // State of the walk through one document.
+    struct DataStats::Walk {
+        SharedKeys*                     sharedKeys;
+        string                          label;
+        string                          path {"$"};
+        unordered_set<const Value*>     seen;           // Values already counted
+        unordered_set<const Value*>     sharedSeen;     // Strings found to have several pointers
+        size_t                          chainBytes {0}; // Size of intermediate pointers
+    };
+
+
+    static DataStats::Category categoryOf(const Value *v) {
+        switch (v->type()) {
+            case kNull:
+            case kBoolean:  return DataStats::kNullOrBoolean;
+            case kNumber:   return v->isInteger() ? DataStats::kInteger : DataStats::kFloat;
+            case kString:   return DataStats::kString;
+            case kData:     return DataStats::kBinary;
+            case kArray:    return DataStats::kArray;
+            default:        return DataStats::kDict;
+        }
+    }
+
+
+    // The size of an out-of-line scalar value, including the padding after it.
+    size_t DataStats::sizeOf(const Value *v) {
+        size_t size = v->dataSize();
+        return size + (size & 1);
+    }
+
+
+    DataStats::DataStats(size_t nLargest)
+    :_nLargest(nLargest)
+    ,_keyChecker(new SharedKeys)
+    { }
+
+
+    bool DataStats::add(slice data, SharedKeys *sharedKeys, slice label) {
+        const Value *root = Value::fromData(data);
+        if (!root)
+            return false;
+        Walk walk {sharedKeys, string(label)};
+        size_t live;
+        auto trailer = (const Value*)offsetby(data.buf, data.size - kNarrow);
+        if (trailer->isPointer()) {
+            root = follow(trailer, false, walk);
+            live = kNarrow + visit(root, walk, true);
+        } else {
+            live = visit(root, walk, true);
+        }
+        ++documents;
+        totalBytes += data.size;
+        liveBytes += live + walk.chainBytes;
+        return true;
+    }
+
+
+    // Counts a pointer and follows it (and any pointers it leads to) to a real value.
+    const Value* DataStats::follow(const Value *pointer, bool wide, Walk &walk) {
+        ++(wide ? widePointers : narrowPointers);
+        size_t length = 1;
+        const Value *dst = pointer->_asPointer()->deref(wide);
+        while (dst->isPointer()) {
+            ++length;
+            if (walk.seen.insert(dst).second)
+                walk.chainBytes += kWide;
+            dst = dst->_asPointer()->deref(true);
+        }
+        if (pointerChains.size() <= length)
+            pointerChains.resize(length + 1);
+        ++pointerChains[length];
+        return dst;
+    }
+
+
+    // Counts a value reached through a pointer (or the root), and everything in it.
+    // Returns the number of bytes this added to the document's live size.
+    size_t DataStats::visit(const Value *value, Walk &walk, bool isRoot) {
+        auto tag = value->tag();
+        if (!walk.seen.insert(value).second) {
+            if (tag == kStringTag || tag == kBinaryTag) {
+                if (walk.sharedSeen.insert(value).second)
+                    ++sharedStrings;
+                dedupSavedBytes += sizeOf(value);
+            }
+            return 0;
+        }
+        if (tag == kArrayTag || tag == kDictTag)
+            return visitCollection(value, walk, isRoot);
+        size_t size = sizeOf(value);
+        auto &tally = byCategory[categoryOf(value)];
+        ++tally.count;
+        tally.bytes += size;
+        return size;
+    }
+
+
+    size_t DataStats::visitCollection(const Value *value, Walk &walk, bool isRoot) {
+        bool wide = value->isWideArray();
+        size_t width = wide ? kWide : kNarrow;
+        ++(wide ? wideCollections : narrowCollections);
+
+        // The collection's size runs to the end of its last slot:
+        auto start = (const uint8_t*)value;
+        auto end = start + value->dataSize();
+        size_t childBytes = 0;
+        auto visitSlot = [&](const Value *slot) {
+            if (slot->isPointer()) {
+                end = max(end, (const uint8_t*)slot + width);
+                childBytes += visit(follow(slot, wide, walk), walk, false);
+            } else {
+                end = max(end, (const uint8_t*)slot + max(width, sizeOf(slot)));
+                ++inlineValues[categoryOf(slot)].count;
+            }
+        };
+        auto pathLength = walk.path.size();
+
+        if (value->tag() == kArrayTag) {
+            auto array = value->asArray();
+            if (array->packedType() != Array::PackedType::kNone)
+                ++packedArrays;
+            size_t index = 0;
+            for (Array::iterator i(array); i; ++i, ++index) {
+                walk.path += "[" + to_string(index) + "]";
+                visitSlot(i.rawValue());
+                walk.path.resize(pathLength);
+            }
+        } else {
+            auto dict = value->asDict();
+            for (Dict::iterator i(dict, true); i; ++i) {
+                const Value *key = i.key();
+                if (key->isInteger() && key->asInt() == Dict::kMagicParentKey) {
+                    ++inheritingDicts;
+                    visitSlot(i.rawKey());
+                    visitSlot(i.rawValue());
+                    continue;
+                }
+                visitSlot(i.rawKey());
+                if (key->isInteger()) {
+                    ++intKeys;
+                } else {
+                    ++stringKeys;
+                    auto sk = walk.sharedKeys ? walk.sharedKeys : _keyChecker.get();
+                    if (sk->couldAdd(key->asString()))
+                        ++shareableStringKeys;
+                }
+                walk.path += '.';
+                if (key->isInteger()) {
+                    slice name;
+                    if (walk.sharedKeys)
+                        name = walk.sharedKeys->decode(int(key->asInt()));
+                    walk.path += name ? string(name) : ("#" + to_string(key->asInt()));
+                } else {
+                    walk.path += string(key->asString());
+                }
+                visitSlot(i.rawValue());
+                walk.path.resize(pathLength);
+            }
+        }
+
+        size_t size = end - start;
+        auto &tally = byCategory[categoryOf(value)];
+        ++tally.count;
+        tally.bytes += size;
+        if (!isRoot)
+            addLargest(walk.label.empty() ? walk.path : walk.label + " " + walk.path,
+                       size + childBytes);
+        return size + childBytes;
+    }
+
+
+    void DataStats::addLargest(const string &path, size_t bytes) {
+        if (largest.size() >= _nLargest && (largest.empty() || bytes <= largest.back().bytes))
+            return;
+        auto pos = upper_bound(largest.begin(), largest.end(), bytes,
+                               [](size_t b, const Subtree &s) {return b > s.bytes;});
+        largest.insert(pos, {path, bytes});
+        if (largest.size() > _nLargest)
+            largest.pop_back();
+    }
+
+
+#pragma mark - REPORT:
+
+
+    static const char* const kCategoryNames[DataStats::kNumCategories] = {
+        "null/boolean", "integer", "float", "string", "binary", "array", "dict"
+    };
+
+
+    static string percent(size_t n, size_t total) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%5.1f%%", total ? 100.0 * n / total : 0.0);
+        return buf;
+    }
+
+
+    void DataStats::writeReport(ostream &out) const {
+        char buf[256];
+        snprintf(buf, sizeof(buf), "Documents:     %zu\n"
+                                   "Total size:    %zu bytes (%zu live, %zu unreachable)\n\n",
+                 documents, totalBytes, liveBytes, totalBytes - liveBytes);
+        out << buf;
+
+        out << "Values          stored   bytes    % live    inline\n";
+        for (int c = 0; c < kNumCategories; ++c) {
+            snprintf(buf, sizeof(buf), "  %-12s %9zu %9zu  %s %9zu\n", kCategoryNames[c],
+                     byCategory[c].count, byCategory[c].bytes,
+                     percent(byCategory[c].bytes, liveBytes).c_str(), inlineValues[c].count);
+            out << buf;
+        }
+
+        size_t collections = narrowCollections + wideCollections;
+        snprintf(buf, sizeof(buf), "\nCollections:   %zu narrow, %zu wide (%s); "
+                                   "%zu packed arrays, %zu inheriting dicts\n",
+                 narrowCollections, wideCollections, percent(wideCollections, collections).c_str(),
+                 packedArrays, inheritingDicts);
+        out << buf;
+
+        snprintf(buf, sizeof(buf), "Pointers:      %zu narrow, %zu wide; chain lengths:",
+                 narrowPointers, widePointers);
+        out << buf;
+        for (size_t len = 1; len < pointerChains.size(); ++len) {
+            if (pointerChains[len])
+                out << ' ' << len << ':' << pointerChains[len];
+        }
+        out << '\n';
+
+        snprintf(buf, sizeof(buf), "Strings:       %zu with several pointers, saving %zu bytes\n",
+                 sharedStrings, dedupSavedBytes);
+        out << buf;
+
+        size_t keys = intKeys + stringKeys;
+        snprintf(buf, sizeof(buf), "Dict keys:     %zu shared (%s), %zu strings, of which %zu "
+                                   "could be shared\n",
+                 intKeys, percent(intKeys, keys).c_str(), stringKeys, shareableStringKeys);
+        out << buf;
+
+        if (!largest.empty()) {
+            out << "\nLargest collections:\n";
+            for (auto &sub : largest) {
+                snprintf(buf, sizeof(buf), "  %9zu  ", sub.bytes);
+                out << buf << sub.path << '\n';
+            }
+        }
+    }
+
+
+    string DataStats::report() const {
+        stringstream out;
+        writeReport(out);
+        return out.str();
+    }
+
+} }
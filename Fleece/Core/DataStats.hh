@@ -0,0 +1,90 @@
+//
+// DataStats.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "SharedKeys.hh"
+#include "RefCounted.hh"
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+namespace fleece { namespace impl {
+    class Value;
+
+
+    /** Accumulates statistics about where the bytes of Fleece data go, over one document or a
+        whole corpus, to help tune encoding options like shared keys, string dedup and dict parents.
+        Only values reachable from a document's root are counted, and a value reached through
+        several pointers is counted once. */
+    class DataStats {
+    public:
+        /** @param nLargest  The number of largest collections to remember. */
+        explicit DataStats(size_t nLargest =10);
+
+        /** Adds the statistics of a document. The SharedKeys, if given, is used to name integer
+            keys in the paths of the largest collections, and to decide which string keys could
+            have been shared; the label (such as a file name) is prefixed to those paths.
+            Returns false, adding nothing, if the data isn't valid Fleece. */
+        bool add(slice data, SharedKeys *sharedKeys =nullptr, slice label =nullslice);
+
+        /** Writes a human-readable report. */
+        void writeReport(std::ostream&) const;
+        std::string report() const;
+
+        enum Category {kNullOrBoolean, kInteger, kFloat, kString, kBinary, kArray, kDict,
+                       kNumCategories};
+
+        struct Tally {
+            size_t count {0};
+            size_t bytes {0};
+        };
+
+        struct Subtree {
+            std::string path;
+            size_t bytes;
+        };
+
+        size_t documents {0};
+        size_t totalBytes {0};                  ///< Size of all the data added
+        size_t liveBytes {0};                   ///< Size of the values reachable from the roots
+        Tally byCategory[kNumCategories];       ///< Values stored on their own, by type
+        Tally inlineValues[kNumCategories];     ///< Values stored in collection slots (no bytes)
+        size_t narrowCollections {0}, wideCollections {0};
+        size_t packedArrays {0}, inheritingDicts {0};
+        size_t narrowPointers {0}, widePointers {0};
+        std::vector<size_t> pointerChains;      ///< Pointers by the length of their chain
+        size_t sharedStrings {0};               ///< Strings & data with more than one pointer
+        size_t dedupSavedBytes {0};             ///< Bytes their sharing saved
+        size_t intKeys {0}, stringKeys {0};
+        size_t shareableStringKeys {0};         ///< String keys that a SharedKeys could encode
+        std::vector<Subtree> largest;           ///< The largest collections, largest first
+
+    private:
+        struct Walk;
+
+        size_t visit(const Value* NONNULL, Walk&, bool isRoot);
+        size_t visitCollection(const Value* NONNULL, Walk&, bool isRoot);
+        const Value* follow(const Value *pointer NONNULL, bool wide, Walk&);
+        void addLargest(const std::string &path, size_t bytes);
+        static size_t sizeOf(const Value* NONNULL);
+
+        size_t const _nLargest;
+        Retained<SharedKeys> _keyChecker;       // Empty SharedKeys, to check keys' eligibility
+    };
+
+} }
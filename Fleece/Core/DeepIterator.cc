@@ -8,7 +8,12 @@
 
 #include "DeepIterator.hh"
 #include "SharedKeys.hh"
-#include <sstream>
+#include "Doc.hh"
+#include "Executor.hh"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
 
 namespace fleece { namespace impl {
 
@@ -29,46 +34,46 @@ namespace fleece { namespace impl {
             queueChildren();
 
         if (!_path.empty())
-            _path.pop_back();
+            popPath();
 
         do {
-            if (_arrayIt) {
+            if (_iterating == kIteratingArray) {
                 // Next array item:
-                _value = (*_arrayIt).value();
+                _value = _arrayIt.value();
                 if (_value) {
                     _path.push_back({nullslice, _arrayIndex++});
-                    ++(*_arrayIt);
+                    ++_arrayIt;
                 } else {
-                    _arrayIt.reset();
+                    endContainer();
                 }
-            } else if (_dictIt) {
+            } else if (_iterating == kIteratingDict) {
                 // Next dict item:
-                _value = (*_dictIt).value();
+                _value = _dictIt.value();
                 if (_value) {
-                    _path.push_back({(*_dictIt).keyString(), 0});
-                    ++(*_dictIt);
+                    _path.push_back({_dictIt.keyString(), 0});
+                    ++_dictIt;
                 } else {
                     if (!_sk)
-                        _sk = _dictIt->sharedKeys();
-                    _dictIt.reset();
+                        _sk = _dictIt.sharedKeys();
+                    endContainer();
                 }
             } else {
                 // End of array/dict, so start another one:
                 _value = nullptr;
                 if (_stack.empty())
                     return; // end of iteration
-                while (_stack.front().second == nullptr) {
+                while (_stack.back().second == nullptr) {
                     // end of a level of hierarchy; pop the path, or stop if it's empty:
                     if (_path.empty())
                         return; // end of iteration
-                    _path.pop_back();
-                    _stack.pop_front();
+                    popPath();
+                    _stack.pop_back();
                 }
 
                 // Pop the next container and its key from the stack:
-                auto container = _stack.front().second;
-                _path.push_back(_stack.front().first);
-                _stack.pop_front();
+                auto container = _stack.back().second;
+                _path.push_back(_stack.back().first);
+                _stack.pop_back();
                 iterateContainer(container);
             }
         } while (!_value);
@@ -76,76 +81,423 @@ namespace fleece { namespace impl {
 
     bool DeepIterator::iterateContainer(const Value *container) {
         _container = container;
-        _stack.push_front({{nullslice, 0}, nullptr});   // Push en end-of-level marker first
+        _stack.push_back({{nullslice, 0}, nullptr});   // Push an end-of-level marker first
         auto type = container->type();
         if (type == kArray) {
-            _arrayIt.reset( new Array::iterator(container->asArray()) );
+            new (&_arrayIt) Array::iterator(container->asArray());
+            _iterating = kIteratingArray;
             _arrayIndex = 0;
             return true;
         } else if (type == kDict) {
-            _dictIt.reset( new Dict::iterator(container->asDict(), _sk) );
+            new (&_dictIt) Dict::iterator(container->asDict(), _sk);
+            _iterating = kIteratingDict;
             return true;
         } else {
             return false;
         }
     }
 
+    void DeepIterator::endContainer() {
+        if (_iterating == kIteratingArray)
+            _arrayIt.~ArrayIterator();
+        else if (_iterating == kIteratingDict)
+            _dictIt.~DictIterator();
+        _iterating = kNotIterating;
+    }
+
+    void DeepIterator::popPath() {
+        _path.pop_back();
+        _pathStr.truncated(_path.size());
+        _pointerStr.truncated(_path.size());
+    }
+
     void DeepIterator::queueChildren() {
         auto type = _value->type();
         if (type == kDict || type == kArray)
-            _stack.push_front({_path.back(), _value});
+            _stack.push_back({_path.back(), _value});
     }
 
 
-    std::string DeepIterator::pathString() const {
-        std::stringstream s;
-        for (auto &component : _path) {
-            if (component.key) {
-                bool quote = false;
-                for (auto c : component.key) {
-                    if (!isalnum(c) && c != '_') {
-                        quote = true;
+    static void visit(const Value *value, slice key, uint32_t index,
+                      const SharedKeys* &sk, Value::Visitor &visitor)
+    {
+        if (!visitor(value, key, index))
+            return;
+        switch (value->type()) {
+            case kArray: {
+                uint32_t i = 0;
+                for (Array::iterator iter(value->asArray()); iter; ++iter)
+                    visit(iter.value(), nullslice, i++, sk, visitor);
+                break;
+            }
+            case kDict: {
+                Dict::iterator iter(value->asDict(), sk);
+                if (!sk)
+                    sk = iter.sharedKeys();
+                for (; iter; ++iter)
+                    visit(iter.value(), iter.keyString(), 0, sk, visitor);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    void Value::visit(Visitor visitor) const {
+        const SharedKeys *sk = nullptr;
+        fleece::impl::visit(this, nullslice, 0, sk, visitor);
+    }
+
+
+    // Returns true if `value` itself is a string or data value (as selected by `flags`)
+    // containing `needle`.
+    static bool valueContains(const Value *value, slice needle, unsigned flags) {
+        switch (value->type()) {
+            case kString:
+                return (flags & Value::kSearchStrings) && value->asString().find(needle);
+            case kData:
+                return (flags & Value::kSearchData) && value->asData().find(needle);
+            default:
+                return false;
+        }
+    }
+
+    // Recursive search for the first match, stopping as soon as one is found.
+    static bool containsString(const Value *value, slice needle, unsigned flags,
+                               const SharedKeys* &sk)
+    {
+        switch (value->type()) {
+            case kArray:
+                for (Array::iterator iter(value->asArray()); iter; ++iter) {
+                    if (containsString(iter.value(), needle, flags, sk))
+                        return true;
+                }
+                return false;
+            case kDict: {
+                Dict::iterator iter(value->asDict(), sk);
+                if (!sk)
+                    sk = iter.sharedKeys();
+                for (; iter; ++iter) {
+                    if ((flags & Value::kSearchKeys) && iter.keyString().find(needle))
+                        return true;
+                    if (containsString(iter.value(), needle, flags, sk))
+                        return true;
+                }
+                return false;
+            }
+            default:
+                return valueContains(value, needle, flags);
+        }
+    }
+
+    bool Value::containsString(slice needle, unsigned flags,
+                               std::vector<std::string> *outPaths) const
+    {
+        // If all the data is in one Scope, a string containing `needle` must leave it in the
+        // raw bytes, so if they don't contain it there's no need to look any further. (Unless
+        // searching keys that may be in the SharedKeys, or strings in an earlier segment.)
+        if (!isMutable()) {
+            if (auto scope = Scope::containing(this); scope && !scope->externDestination()
+                                && !((flags & kSearchKeys) && scope->sharedKeys())) {
+                if (!scope->data().find(needle))
+                    return false;
+            }
+        }
+
+        if (!outPaths) {
+            const SharedKeys *sk = nullptr;
+            return fleece::impl::containsString(this, needle, flags, sk);
+        }
+
+        bool found = false;
+        for (DeepIterator i(this); i; ++i) {
+            bool match = valueContains(i.value(), needle, flags);
+            if (!match && (flags & kSearchKeys) && !i.path().empty())
+                match = bool(i.path().back().key.find(needle));
+            if (match) {
+                outPaths->push_back(i.pathString());
+                found = true;
+            }
+        }
+        return found;
+    }
+
+
+    namespace {
+
+        // Implementation of visitParallel. First the caller's thread walks the top levels,
+        // splitting large collections into units of work, each a range of items with the path
+        // of their container; then the worker threads take units in turn and visit them deeply.
+        class ParallelVisit {
+        public:
+            using Path = DeepIterator::Path;
+
+            ParallelVisit(unsigned nThreads)
+            :_nThreads(nThreads)
+            { }
+
+            // Plans the units of work for a collection's items, visiting and splitting any of
+            // them that are large collections.
+            void plan(const Value *container, Path &path, unsigned depth, ParallelVisitor &visitor) {
+                uint32_t count;
+                if (auto array = container->asArray(); array)
+                    count = array->count();
+                else
+                    count = container->asDict()->count();
+
+                // Aim for a few units per thread, so threads that finish early can take more:
+                uint32_t chunkSize = std::max(count / (8 * _nThreads), 64u);
+                size_t prefix = _prefixes.size();
+                _prefixes.push_back(path);
+                // A large child collection is visited here and split in turn:
+                auto canSplit = [&](const Value *item) {
+                    return depth + 1 < kMaxParallelSplitDepth && isLargeCollection(item);
+                };
+                auto split = [&](const Value *item) {
+                    if (visitor.visit(item, path))
+                        plan(item, path, depth + 1, visitor);
+                };
+
+                if (auto array = container->asArray(); array) {
+                    uint32_t start = 0, i = 0;
+                    for (Array::iterator iter(array); iter; ++iter, ++i) {
+                        path.push_back({nullslice, i});
+                        if (canSplit(iter.value())) {
+                            addUnit(array, prefix, start, i, Unit::kArrayItems);
+                            split(iter.value());
+                            start = i + 1;
+                        } else if (i + 1 - start >= chunkSize) {
+                            addUnit(array, prefix, start, i + 1, Unit::kArrayItems);
+                            start = i + 1;
+                        }
+                        path.pop_back();
+                    }
+                    addUnit(array, prefix, start, count, Unit::kArrayItems);
+                } else {
+                    // Dict iterators can't skip ahead, so the items are copied into _dictItems:
+                    size_t start = _dictItems.size();
+                    Dict::iterator iter(container->asDict(), _sk);
+                    if (!_sk)
+                        _sk = iter.sharedKeys();
+                    for (; iter; ++iter) {
+                        slice key = iter.keyString();
+                        path.push_back({key, 0});
+                        if (canSplit(iter.value())) {
+                            addUnit(nullptr, prefix, start, _dictItems.size(), Unit::kDictItems);
+                            split(iter.value());
+                            start = _dictItems.size();
+                        } else {
+                            _dictItems.push_back({key, iter.value()});
+                            if (_dictItems.size() - start >= chunkSize) {
+                                addUnit(nullptr, prefix, start, _dictItems.size(), Unit::kDictItems);
+                                start = _dictItems.size();
+                            }
+                        }
+                        path.pop_back();
+                    }
+                    addUnit(nullptr, prefix, start, _dictItems.size(), Unit::kDictItems);
+                }
+            }
+
+            size_t unitCount() const        {return _units.size();}
+
+            // Runs the units as Executor tasks, one per visitor.
+            void run(std::vector<std::unique_ptr<ParallelVisitor>> &visitors) {
+                if (visitors.size() == 1) {
+                    work(*visitors[0]);
+                    return;
+                }
+                Executor::parallelFor(visitors.size(), unsigned(visitors.size()), [&](size_t t) {
+                    try {
+                        work(*visitors[t]);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(_errorMutex);
+                        if (!_error)
+                            _error = std::current_exception();
+                        _nextUnit = _units.size();      // stop the other tasks
+                    }
+                });
+                if (_error)
+                    std::rethrow_exception(_error);
+            }
+
+        private:
+            struct Unit {
+                enum Kind : uint8_t {kArrayItems, kDictItems};
+                const Value* container;     // The Array, if kArrayItems
+                size_t prefix;              // Index in _prefixes of the container's path
+                size_t begin, end;          // Range of array indexes, or of _dictItems
+                Kind kind;
+            };
+
+            static bool isLargeCollection(const Value *value) {
+                if (auto array = value->asArray(); array)
+                    return array->count() >= kMinParallelVisitCount;
+                else if (auto dict = value->asDict(); dict)
+                    return dict->count() >= kMinParallelVisitCount;
+                return false;
+            }
+
+            void addUnit(const Value *container, size_t prefix, size_t begin, size_t end,
+                         Unit::Kind kind)
+            {
+                if (begin < end)
+                    _units.push_back({container, prefix, begin, end, kind});
+            }
+
+            void work(ParallelVisitor &visitor) {
+                Path path;
+                const SharedKeys *sk = _sk;
+                for (size_t n; (n = _nextUnit++) < _units.size(); ) {
+                    const Unit &unit = _units[n];
+                    path = _prefixes[unit.prefix];
+                    switch (unit.kind) {
+                        case Unit::kArrayItems: {
+                            Array::iterator iter(unit.container->asArray());
+                            iter += uint32_t(unit.begin);
+                            for (size_t i = unit.begin; i < unit.end; ++i, ++iter) {
+                                path.push_back({nullslice, uint32_t(i)});
+                                visitDeep(iter.value(), path, visitor, sk);
+                                path.pop_back();
+                            }
+                            break;
+                        }
+                        case Unit::kDictItems:
+                            for (size_t i = unit.begin; i < unit.end; ++i) {
+                                path.push_back({_dictItems[i].first, 0});
+                                visitDeep(_dictItems[i].second, path, visitor, sk);
+                                path.pop_back();
+                            }
+                            break;
+                    }
+                }
+            }
+
+            static void visitDeep(const Value *value, Path &path, ParallelVisitor &visitor,
+                                  const SharedKeys* &sk)
+            {
+                if (visitor.visit(value, path))
+                    visitChildren(value, path, visitor, sk);
+            }
+
+        public:
+            // Visits the descendants of a value, depth-first.
+            static void visitChildren(const Value *value, Path &path, ParallelVisitor &visitor,
+                                      const SharedKeys* &sk)
+            {
+                switch (value->type()) {
+                    case kArray: {
+                        uint32_t i = 0;
+                        for (Array::iterator iter(value->asArray()); iter; ++iter) {
+                            path.push_back({nullslice, i++});
+                            visitDeep(iter.value(), path, visitor, sk);
+                            path.pop_back();
+                        }
+                        break;
+                    }
+                    case kDict: {
+                        Dict::iterator iter(value->asDict(), sk);
+                        if (!sk)
+                            sk = iter.sharedKeys();
+                        for (; iter; ++iter) {
+                            path.push_back({iter.keyString(), 0});
+                            visitDeep(iter.value(), path, visitor, sk);
+                            path.pop_back();
+                        }
                         break;
                     }
+                    default:
+                        break;
                 }
-                s << (quote ? "[\"" : ".");
-                s.write((char*)component.key.buf, component.key.size);
-                if (quote)
-                    s << "\"]";
-            } else {
-                s << '[' << component.index << ']';
             }
+
+        private:
+            unsigned const _nThreads;
+            const SharedKeys* _sk {nullptr};
+            std::vector<Unit> _units;
+            std::vector<Path> _prefixes;
+            std::vector<std::pair<slice,const Value*>> _dictItems;
+            std::atomic<size_t> _nextUnit {0};
+            std::mutex _errorMutex;
+            std::exception_ptr _error;
+        };
+
+    }
+
+
+    std::vector<std::unique_ptr<ParallelVisitor>> visitParallel(
+                                        const Value *root,
+                                        function_ref<std::unique_ptr<ParallelVisitor>()> newVisitor,
+                                        unsigned nThreads)
+    {
+        nThreads = Executor::resolveThreads(nThreads);
+        std::vector<std::unique_ptr<ParallelVisitor>> visitors;
+        visitors.push_back(newVisitor());
+        if (!root)
+            return visitors;
+
+        ParallelVisit visit(nThreads);
+        DeepIterator::Path path;
+        if (!visitors[0]->visit(root, path))
+            return visitors;
+        auto type = root->type();
+        if (nThreads < 2 || (type != kArray && type != kDict)) {
+            const SharedKeys *sk = nullptr;
+            ParallelVisit::visitChildren(root, path, *visitors[0], sk);
+            return visitors;
         }
-        return s.str();
+        visit.plan(root, path, 0, *visitors[0]);
+        while (visitors.size() < std::min(size_t(nThreads), visit.unitCount()))
+            visitors.push_back(newVisitor());
+        visit.run(visitors);
+        return visitors;
     }
 
 
-    std::string DeepIterator::jsonPointer() const {
-        if (_path.empty())
-            return "/";
-        std::stringstream s;
-        for (auto &component : _path) {
-            s << '/';
+    slice DeepIterator::PathBuffer::get(const Path &path, bool jsonPointer) {
+        if (path.empty())
+            return jsonPointer ? "/"_sl : ""_sl;
+        _valid = std::min(_valid, path.size());
+        _str.resize(_valid ? _ends[_valid - 1] : 0);
+        _ends.resize(path.size());
+        for (size_t i = _valid; i < path.size(); ++i) {
+            auto &component = path[i];
+            if (jsonPointer)
+                _str += '/';
             if (component.key) {
-                // Keys need to be escaped per https://tools.ietf.org/html/rfc6901#section-3 :
-                if (component.key.findAnyByteOf("/~"_sl)) {
-                    auto end = (const char*)component.key.end();
-                    for (auto c = (const char*)component.key.buf; c != end; ++c) {
+                auto begin = (const char*)component.key.buf, end = (const char*)component.key.end();
+                if (jsonPointer) {
+                    // Keys need to be escaped per https://tools.ietf.org/html/rfc6901#section-3 :
+                    for (auto c = begin; c != end; ++c) {
                         if (*c == '/')
-                            s << "~1";
+                            _str += "~1";
                         else if (*c == '~')
-                            s << "~0";
+                            _str += "~0";
                         else
-                            s << *c;
+                            _str += *c;
                     }
                 } else {
-                    s.write((char*)component.key.buf, component.key.size);
+                    bool quote = std::any_of(begin, end, [](char c) {
+                        return !isalnum((unsigned char)c) && c != '_';
+                    });
+                    _str += (quote ? "[\"" : ".");
+                    _str.append(begin, end);
+                    if (quote)
+                        _str += "\"]";
                 }
             } else {
-                s << component.index;
+                char digits[12];
+                int n = snprintf(digits, sizeof(digits), "%u", component.index);
+                if (!jsonPointer)
+                    _str += '[';
+                _str.append(digits, n);
+                if (!jsonPointer)
+                    _str += ']';
             }
+            _ends[i] = uint32_t(_str.size());
         }
-        return s.str();
+        _valid = path.size();
+        return slice(_str);
     }
 
 } }
@@ -7,12 +7,15 @@
 //
 
 #pragma once
+#include "Allocator.hh"
 #include "Array.hh"
 #include "Dict.hh"
+#include "SmallVector.hh"
+#include "function_ref.hh"
 #include <memory>
-#include <vector>
-#include <deque>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace fleece { namespace impl {
     class SharedKeys;
@@ -29,11 +32,18 @@ namespace fleece { namespace impl {
         If you want to ignore the root container, either call next() immediately after creating
         the iterator, or during the iteration ignore the current value if path() is empty.
 
-        The iteration is (obviously) not recursive, so it uses minimal stack space. It uses a
-        small amount of heap space, roughly proportional to the number of sub-containers. */
-    class DeepIterator {
+        The iteration is (obviously) not recursive, so it uses minimal stack space. Its path and
+        its queue of pending sub-containers are stored inline, so it doesn't allocate any heap
+        space unless the data is unusually deep or has unusually many sub-containers.
+
+        (If you don't need to pause the iteration, Value::visit is faster.) */
+    class DeepIterator : public heap::Allocated {
     public:
         DeepIterator(const Value *root);
+        ~DeepIterator()                                 {endContainer();}
+
+        DeepIterator(const DeepIterator&) =delete;
+        DeepIterator& operator=(const DeepIterator&) =delete;
 
         inline explicit operator bool() const           {return _value != nullptr;}
         inline DeepIterator& operator++ ()              {next(); return *this;}
@@ -55,14 +65,25 @@ namespace fleece { namespace impl {
             uint32_t index;     ///< Array index, only if there's no key
         };
 
+        using Path = smallVector<PathComponent, 16>;
+
         /** The path to the current value. */
-        const std::vector<PathComponent>& path() const  {return _path;}
+        const Path& path() const                        {return _path;}
 
         /** The path expressed as a string in JavaScript syntax using "." and "[]". */
-        std::string pathString() const;
+        std::string pathString() const                 {return std::string(pathSlice());}
 
         /** The path to the current value, in JSONPointer (RFC 6901) syntax. */
-        std::string jsonPointer() const;
+        std::string jsonPointer() const                {return std::string(jsonPointerSlice());}
+
+        /** Like \ref pathString, but returns a slice of a buffer the iterator keeps, which is
+            valid until the next call to `next`. The buffer is brought up to date on demand, by
+            truncating it to the part of the path that hasn't changed and appending the rest, so
+            reading it at every step costs no allocation and only the work of the new components. */
+        slice pathSlice() const                         {return _pathStr.get(_path, false);}
+
+        /** Like \ref jsonPointer, but returns a slice like \ref pathSlice does. */
+        slice jsonPointerSlice() const                  {return _pointerStr.get(_path, true);}
 
         /** The Dict key of the current value, or nullkey if the parent is an Array. */
         slice keyString() const                         {return _path.empty() ? nullslice : _path.back().key;}
@@ -71,18 +92,71 @@ namespace fleece { namespace impl {
         uint32_t index() const                          {return _path.empty() ? 0 : _path.back().index;}
 
     private:
+        using Pending = std::pair<PathComponent,const Value*>;
+
+        // A string form of _path, updated incrementally when it's asked for.
+        class PathBuffer {
+        public:
+            slice get(const Path&, bool jsonPointer);
+            void truncated(size_t depth)        {if (depth < _valid) _valid = depth;}
+        private:
+            std::string _str;
+            smallVector<uint32_t, 16> _ends;    // Length of _str through each path component
+            size_t _valid {0};                  // Number of components of _str still valid
+        };
+
         bool iterateContainer(const Value *);
+        void endContainer();
         void queueChildren();
+        void popPath();
 
         const SharedKeys* _sk {nullptr};
         const Value* _value;
-        std::vector<PathComponent> _path;
-        std::deque<std::pair<PathComponent,const Value*>> _stack;
+        Path _path;
+        smallVector<Pending, 16> _stack;        // Containers to visit; null marks end of a level
         const Value* _container {nullptr};
         bool _skipChildren;
-        std::unique_ptr<Dict::iterator> _dictIt;
-        std::unique_ptr<Array::iterator> _arrayIt;
+        enum : uint8_t {kNotIterating, kIteratingArray, kIteratingDict} _iterating {kNotIterating};
+        union {                                  // Iterator of _container, if _iterating
+            Array::iterator _arrayIt;
+            Dict::iterator _dictIt;
+        };
         uint32_t _arrayIndex;
+        mutable PathBuffer _pathStr, _pointerStr;
+    };
+
+
+
+    /** Receives the values visited by \ref visitParallel. Each worker thread gets its own
+        instance, so it can accumulate results without any locking. */
+    class ParallelVisitor {
+    public:
+        virtual ~ParallelVisitor() =default;
+
+        /** Called with each value and its path. Returning false skips the value's children. */
+        virtual bool visit(const Value* NONNULL, const DeepIterator::Path&) =0;
     };
 
+    /** Visits every value in `root`, like Value::visit, but concurrently on `nThreads` threads
+        (0 means the Executor's concurrency.) The items of the root, and of any large collections
+        in the top \ref kMaxParallelSplitDepth levels, are split into ranges, which the threads
+        take in turn; everything below a range is visited by that range's thread. Visits happen in no particular order, except
+        that a collection is visited before its items.
+
+        `newVisitor` is called on the calling thread to create each thread's visitor, and the
+        visitors are returned when all threads have finished, to be combined by the caller. The
+        first visitor is also used on the calling thread to visit the root and any other
+        collections that are split. Values must not be mutated during the traversal.
+        If a visitor throws, the traversal stops and the exception is rethrown. */
+    std::vector<std::unique_ptr<ParallelVisitor>> visitParallel(
+                                        const Value *root,
+                                        function_ref<std::unique_ptr<ParallelVisitor>()> newVisitor,
+                                        unsigned nThreads =0);
+
+    /** Collections below the root with fewer items than this aren't split by \ref visitParallel. */
+    static constexpr uint32_t kMinParallelVisitCount = 1024;
+
+    /** \ref visitParallel only splits collections up to this deep (the root is depth 0.) */
+    static constexpr unsigned kMaxParallelSplitDepth = 2;
+
 } }
@@ -17,13 +17,19 @@
 //
 
 #include "Dict.hh"
+#include "AccessProfile.hh"
+#include "Counters.hh"
 #include "MutableDict.hh"
 #include "SharedKeys.hh"
 #include "Doc.hh"
+#include "DictIndex.hh"
 #include "Internal.hh"
 #include "PlatformCompat.hh"
+#include "SmallVector.hh"
+#include <algorithm>
 #include <atomic>
 #include <string>
+#include <tuple>
 #include "betterassert.hh"
 
 
@@ -33,14 +39,13 @@ namespace fleece { namespace impl {
 
 #ifndef NDEBUG
     namespace internal {
-        std::atomic<unsigned> gTotalComparisons;
         bool gDisableNecessarySharedKeysCheck = false;
     }
-    static inline void countComparison() {++gTotalComparisons;}
-#else
-    static inline void countComparison() { }
 #endif
 
+    static inline void countComparison() {counters::count(counters::kDictKeyComparisons);}
+    static inline void countLookups(size_t n =1) {counters::count(counters::kDictLookups, n);}
+
     bool Dict::isMagicParentKey(const Value *v) {
         return v->_byte[0] == uint8_t((kShortIntTag<<4) | 0x08)
             && v->_byte[1] == 0;
@@ -64,9 +69,9 @@ namespace fleece { namespace impl {
 
         bool usesSharedKeys() const {
             // Check if the first key is an int (the second, if the 1st is a parent ptr)
-            return _count > 0 && _first->tag() == kShortIntTag
+            return _count > 0 && _first->tag() <= kIntTag
                 && !(Dict::isMagicParentKey(_first)
-                     && (_count == 1 || offsetby(_first, 2*_width)->tag() != kShortIntTag));
+                     && (_count == 1 || offsetby(_first, 2*_width)->tag() > kIntTag));
         }
 
         template <class KEY>
@@ -84,11 +89,18 @@ namespace fleece { namespace impl {
         }
 
         __hot
-        inline const Value* getUnshared(slice keyToFind) const noexcept {
-            auto key = search(keyToFind, [](slice target, const Value *val) {
-                countComparison();
-                return compareKeys(target, val);
-            });
+        inline const Value* getUnshared(slice keyToFind,
+                                        SharedKeys *sharedKeys =nullptr) const noexcept {
+            const Value *key;
+            if (_usuallyFalse(_count >= DictIndex::kMinCount))
+                key = findKeyByString(keyToFind);
+            else
+                key = searchString(keyToFind);
+            if (_usuallyFalse(!key && sharedKeys)) {
+                // Pass the SharedKeys on to the parent, so it doesn't have to look them up:
+                const Dict *parent = getParent();
+                return parent ? parent->get(keyToFind, sharedKeys) : nullptr;
+            }
             return finishGet(key, keyToFind);
         }
 
@@ -111,7 +123,7 @@ namespace fleece { namespace impl {
             int encoded;
             if (sharedKeys && lookupSharedKey(keyToFind, sharedKeys, encoded))
                 return get(encoded);
-            return getUnshared(keyToFind);
+            return getUnshared(keyToFind, sharedKeys);
         }
 
         __hot
@@ -142,6 +154,127 @@ namespace fleece { namespace impl {
             return finishGet(key, keyToFind);
         }
 
+        __hot
+        const Value* get(const Dict::resolvedKey &keyToFind) const noexcept {
+            if (!usesSharedKeys())
+                return getUnshared(keyToFind._string);
+            if (_usuallyTrue(keyToFind._hasNumericKey))
+                return get(keyToFind._numericKey);
+            // Key wasn't known when resolved; it may have been added to the SharedKeys since:
+            return get(keyToFind._string, keyToFind._sharedKeys);
+        }
+
+        __hot
+        const Value* get(const key_t &keyToFind, uint32_t &hint) const noexcept {
+            auto compare = [&](const Value *key) {
+                countComparison();
+                return keyToFind.shared() ? compareKeys(keyToFind.asInt(), key)
+                                          : compareKeys(keyToFind.asString(), key);
+            };
+            const Value *key = nullptr;
+            if (_usuallyTrue(hint < _count)) {
+                key = offsetby(_first, hint * 2*kWidth);
+                if (_usuallyFalse(compare(key) != 0))
+                    key = nullptr;
+            }
+            if (!key) {
+                if (keyToFind.shared())
+                    key = search(keyToFind.asInt(), [&](int, const Value *k) {return compare(k);});
+                else if (_usuallyFalse(_count >= DictIndex::kMinCount))
+                    key = findKeyByString(keyToFind.asString());
+                else
+                    key = searchString(keyToFind.asString());
+                if (key)
+                    hint = (uint32_t)indexOf(key) / 2;
+            }
+            return finishGet(key, keyToFind);
+        }
+
+        // Looks up sorted keys in one pass. Each search gallops forward from where the previous
+        // key was found (or would have been), then binary-searches the range it lands in.
+        __hot
+        void getMany(const key_t keys[], size_t n, const Value* values[]) const noexcept {
+            const Value *begin = _first;
+            size_t remaining = _count;
+            for (size_t k = 0; k < n; ++k) {
+                const key_t &key = keys[k];
+                auto compare = [&](size_t i) {
+                    countComparison();
+                    auto item = offsetby(begin, i * 2*kWidth);
+                    return key.shared() ? compareKeys(key.asInt(), item)
+                                        : compareKeys(key.asString(), item);
+                };
+                size_t lo = 0, hi = remaining;  // keys before `lo` are < key, from `hi` on are >=
+                bool found = false;
+                for (size_t step = 1; lo + step - 1 < hi; step *= 2) {
+                    size_t i = lo + step - 1;
+                    int cmp = compare(i);
+                    if (cmp > 0) {
+                        lo = i + 1;
+                    } else {
+                        hi = i;
+                        found = (cmp == 0);
+                        break;
+                    }
+                }
+                while (!found && lo < hi) {
+                    size_t mid = (lo + hi) >> 1;
+                    int cmp = compare(mid);
+                    if (cmp > 0) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                        found = (cmp == 0);
+                    }
+                }
+
+                values[k] = nullptr;
+                if (found) {
+                    lo = hi;
+                    auto value = deref(next(offsetby(begin, lo * 2*kWidth)));
+                    if (_usuallyTrue(!value->isUndefined()))
+                        values[k] = value;
+                }
+                // The next key is >= this one, so it can't come before `lo`:
+                begin = offsetby(begin, lo * 2*kWidth);
+                remaining -= lo;
+            }
+        }
+
+        void getMany(const slice keys[], size_t n, const Value* values[]) const noexcept {
+            SharedKeys *sharedKeys = nullptr;
+            if (usesSharedKeys()) {
+                sharedKeys = findSharedKeys();
+                assert_precondition(sharedKeys || gDisableNecessarySharedKeysCheck);
+            }
+            smallVector<key_t, 32> encodedKeys(n);
+            for (size_t i = 0; i < n; ++i) {
+                int encoded;
+                if (sharedKeys && lookupSharedKey(keys[i], sharedKeys, encoded))
+                    encodedKeys[i] = key_t(encoded);
+                else
+                    encodedKeys[i] = key_t(keys[i]);
+            }
+            if (std::is_sorted(encodedKeys.begin(), encodedKeys.end())) {
+                getMany(encodedKeys.begin(), n, values);
+                return;
+            }
+            // Sort the keys, look them up, then put the values back in the caller's order:
+            smallVector<uint32_t, 32> order(n);
+            for (size_t i = 0; i < n; ++i)
+                order[i] = uint32_t(i);
+            std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+                return encodedKeys[a] < encodedKeys[b];
+            });
+            smallVector<key_t, 32> sortedKeys(n);
+            for (size_t i = 0; i < n; ++i)
+                sortedKeys[i] = encodedKeys[order[i]];
+            smallVector<const Value*, 32> sortedValues(n);
+            getMany(sortedKeys.begin(), n, sortedValues.begin());
+            for (size_t i = 0; i < n; ++i)
+                values[order[i]] = sortedValues[i];
+        }
+
         bool hasParent() const {
             return _usuallyTrue(_count > 0) && _usuallyFalse(Dict::isMagicParentKey(_first));
         }
@@ -161,14 +294,16 @@ namespace fleece { namespace impl {
 
         __hot
         static int compareKeys(int keyToFind, const Value *key) {
-            assert_precondition(key->tag() == kShortIntTag || key->tag() == kStringTag
-                                                           || key->tag() >= kPointerTagFirst);
+            assert_precondition(key->tag() <= kIntTag || key->tag() == kStringTag
+                                                      || key->tag() >= kPointerTagFirst);
             // This is optimized using the knowledge that short ints have a tag of 0.
             uint8_t hiByte = key->_byte[0];
             if (_usuallyTrue(hiByte <= 0x07))
                 return keyToFind - ((hiByte << 8) | key->_byte[1]);     // positive int key
             else if (_usuallyFalse(hiByte <= 0x0F))
                 return keyToFind - (int16_t)(0xF0 | (hiByte << 8) | key->_byte[1]); // negative
+            else if (_usuallyFalse(hiByte <= 0x1F))
+                return keyToFind - (int)key->asInt();   // long int key, from a large SharedKeys
             else
                 return -1;                                              // string, or ptr to string
         }
@@ -216,12 +351,82 @@ namespace fleece { namespace impl {
             return nullptr;
         }
 
-        // Finds a key in a dictionary via binary search of the UTF-8 key strings.
+        // Binary search like `search`, that also prefetches the two keys that could be probed
+        // next, and the strings they point to, so that the cache misses of consecutive probes
+        // overlap instead of following each other. (For large Dicts that may not be in the
+        // cache, like ones in a memory-mapped file.)
+        template <class CMP>
         __hot
-        const Value* findKeyBySearch(Dict::key &keyToFind) const {
-            auto key = search(keyToFind._rawString, [](slice target, const Value *val) {
+        inline const Value* prefetchingSearch(slice target, CMP comparator) const {
+            const Value *begin = _first;
+            size_t n = _count;
+            while (n > 0) {
+                size_t mid = n >> 1;
+                const Value *midVal = offsetby(begin, mid * 2*kWidth);
+                if (mid > 0)
+                    prefetchKey(offsetby(begin, (mid >> 1) * 2*kWidth));
+                if (size_t right = n - mid - 1; right > 0)
+                    prefetchKey(offsetby(midVal, (1 + (right >> 1)) * 2*kWidth));
+                int cmp = comparator(target, midVal);
+                if (_usuallyFalse(cmp == 0))
+                    return midVal;
+                else if (cmp < 0)
+                    n = mid;
+                else {
+                    begin = offsetby(midVal, 2*kWidth);
+                    n -= mid + 1;
+                }
+            }
+            return nullptr;
+        }
+
+        static inline void prefetchKey(const Value *key) {
+            PREFETCH(deref(key));
+        }
+
+        // Binary search for a string key, using the Dict's key prefixes if it has them.
+        // Dicts with at least kMinPrefetchCount keys use prefetchingSearch.
+        __hot
+        inline const Value* searchString(slice keyToFind) const {
+            auto compare = [](slice target, const Value *val) {
+                countComparison();
                 return compareKeys(target, val);
+            };
+            if (_usuallyFalse(_count >= DictKeyPrefixes::kMinCount)) {
+                DictKeyPrefixes prefixes(offsetby(_first, _count * 2 * kWidth), _count);
+                if (prefixes) {
+                    int64_t i = prefixes.find(keyToFind, [&](uint32_t i) {
+                        return compare(keyToFind, offsetby(_first, i * 2 * kWidth));
+                    });
+                    return (i >= 0) ? offsetby(_first, size_t(i) * 2 * kWidth) : nullptr;
+                }
+            }
+            if (_count >= kMinPrefetchCount)
+                return prefetchingSearch(keyToFind, compare);
+            else
+                return search(keyToFind, compare);
+        }
+
+        // Finds a key in a large dictionary, using its hash index if it has one.
+        const Value* findKeyByString(slice keyToFind) const {
+            DictIndex index(offsetby(_first, _count * 2 * kWidth), _count);
+            if (!index)
+                return searchString(keyToFind);
+            int64_t i = index.find(keyToFind, [&](uint32_t i) {
+                countComparison();
+                return compareKeys(keyToFind, offsetby(_first, i * 2 * kWidth)) == 0;
             });
+            return (i >= 0) ? offsetby(_first, size_t(i) * 2 * kWidth) : nullptr;
+        }
+
+        // Finds a key in a dictionary via binary search of the UTF-8 key strings.
+        __hot
+        const Value* findKeyBySearch(Dict::key &keyToFind) const {
+            const Value *key;
+            if (_usuallyFalse(_count >= DictIndex::kMinCount))
+                key = findKeyByString(keyToFind._rawString);
+            else
+                key = searchString(keyToFind._rawString);
             if (!key)
                 return nullptr;
 
@@ -267,6 +472,7 @@ namespace fleece { namespace impl {
         }
 
         static constexpr size_t kWidth = (WIDE ? 4 : 2);
+        static constexpr uint32_t kMinPrefetchCount = 65536; // Min Dict size for prefetchingSearch
         static constexpr uint32_t kPtrMask = (WIDE ? 0x80000000 : 0x8000);
     };
 
@@ -290,6 +496,22 @@ namespace fleece { namespace impl {
     }
 
 
+    Dict::resolvedKey::resolvedKey(slice string, SharedKeys *sk)
+    :_string(string)
+    ,_sharedKeys(retain(sk))
+    {
+        int encoded;
+        if (sk && sk->encode(_string, encoded)) {
+            _numericKey = encoded;
+            _hasNumericKey = true;
+        }
+    }
+
+    Dict::resolvedKey::~resolvedKey() {
+        release(_sharedKeys);
+    }
+
+
 #pragma mark - DICT IMPLEMENTATION:
 
 
@@ -322,6 +544,8 @@ namespace fleece { namespace impl {
 
     __hot
     const Value* Dict::get(slice keyToFind) const noexcept {
+        countLookups();
+        AccessProfile::sample(keyToFind);
         if (_usuallyFalse(isMutable()))
             return heapDict()->get(keyToFind);
         if (isWideArray())
@@ -330,8 +554,21 @@ namespace fleece { namespace impl {
             return dictImpl<false>(this).get(keyToFind);
     }
 
+    __hot
+    const Value* Dict::get(slice keyToFind, SharedKeys *sharedKeys) const noexcept {
+        countLookups();
+        AccessProfile::sample(keyToFind);
+        if (_usuallyFalse(isMutable()))
+            return heapDict()->get(keyToFind);
+        if (isWideArray())
+            return dictImpl<true>(this).get(keyToFind, sharedKeys);
+        else
+            return dictImpl<false>(this).get(keyToFind, sharedKeys);
+    }
+
     __hot
     const Value* Dict::get(int keyToFind) const noexcept {
+        countLookups();
         if (_usuallyFalse(isMutable()))
             return heapDict()->get(keyToFind);
         else if (isWideArray())
@@ -341,6 +578,8 @@ namespace fleece { namespace impl {
     }
 
     const Value* Dict::get(key &keyToFind) const noexcept {
+        countLookups();
+        AccessProfile::sample(keyToFind.string());
         if (_usuallyFalse(isMutable()))
             return heapDict()->get(keyToFind);
         else if (isWideArray())
@@ -350,17 +589,72 @@ namespace fleece { namespace impl {
     }
 
     __hot
-    const Value* Dict::get(const key_t &keyToFind) const noexcept {
+    const Value* Dict::get(const resolvedKey &keyToFind) const noexcept {
+        countLookups();
+        AccessProfile::sample(keyToFind.string());
         if (_usuallyFalse(isMutable()))
+            return heapDict()->get(keyToFind.string());
+        else if (isWideArray())
+            return dictImpl<true>(this).get(keyToFind);
+        else
+            return dictImpl<false>(this).get(keyToFind);
+    }
+
+    __hot
+    const Value* Dict::get(const key_t &keyToFind) const noexcept {
+        if (_usuallyFalse(isMutable())) {
+            countLookups();
             return heapDict()->get(keyToFind);
-        else if (keyToFind.shared())
+        } else if (keyToFind.shared())
             return get(keyToFind.asInt());
         else
             return get(keyToFind.asString());
     }
 
+    __hot
+    const Value* Dict::get(const key_t &keyToFind, uint32_t &hint) const noexcept {
+        countLookups();
+        if (!keyToFind.shared())
+            AccessProfile::sample(keyToFind.asString());
+        if (_usuallyFalse(isMutable()))
+            return heapDict()->get(keyToFind);
+        else if (isWideArray())
+            return dictImpl<true>(this).get(keyToFind, hint);
+        else
+            return dictImpl<false>(this).get(keyToFind, hint);
+    }
+
+    __hot
+    void Dict::getMany(const key_t keys[], size_t n, const Value* values[]) const noexcept {
+        if (_usuallyFalse(isMutable() || getParent() != nullptr)) {
+            for (size_t i = 0; i < n; ++i)
+                values[i] = get(keys[i]);
+        } else if (isWideArray()) {
+            countLookups(n);
+            dictImpl<true>(this).getMany(keys, n, values);
+        } else {
+            countLookups(n);
+            dictImpl<false>(this).getMany(keys, n, values);
+        }
+    }
+
+    void Dict::getMany(const slice keys[], size_t n, const Value* values[]) const noexcept {
+        if (_usuallyFalse(isMutable() || getParent() != nullptr)) {
+            for (size_t i = 0; i < n; ++i)
+                values[i] = get(keys[i]);
+        } else if (isWideArray()) {
+            countLookups(n);
+            dictImpl<true>(this).getMany(keys, n, values);
+        } else {
+            countLookups(n);
+            dictImpl<false>(this).getMany(keys, n, values);
+        }
+    }
+
     MutableDict* Dict::asMutable() const noexcept {
-        return isMutable() ? (MutableDict*)this : nullptr;
+        if (!isMutable() || heapDict()->isSharedCopyOnWrite())
+            return nullptr;
+        return (MutableDict*)this;
     }
 
     HeapDict* Dict::heapDict() const noexcept {
@@ -381,19 +675,10 @@ namespace fleece { namespace impl {
         Dict::iterator j(dv);
         if (!this->getParent() && !dv->getParent() && i.count() != j.count())
             return false;
-        if (sharedKeys() == dv->sharedKeys()) {
-            // If both dicts use same sharedKeys, their keys must be in the same order.
-            for (; i; ++i, ++j)
-                if (i.keyString() != j.keyString() || !i.value()->isEqual(j.value()))
-                    return false;
-        } else {
-            unsigned n = 0;
-            for (; i; ++i, ++n) {
-                auto dvalue = dv->get(i.keyString());
-                if (!dvalue || !i.value()->isEqual(dvalue))
-                    return false;
-            }
-            if (dv->count() != n)
+        if (uint64_t h1, h2; embeddedHash(h1) && dv->embeddedHash(h2) && h1 != h2)
+            return false;
+        for (DictMergeIterator m(this, dv); m; ++m) {
+            if (!m.value1() || !m.value2() || !m.value1()->isEqual(m.value2()))
                 return false;
         }
         return true;
@@ -415,8 +700,10 @@ namespace fleece { namespace impl {
     {
         readKV();
         if (_usuallyFalse(_key && Dict::isMagicParentKey(_key))) {
-            _parent.reset( new DictIterator(_value->asDict()) );
+            _parent.reset( new DictIterator(_value->asDict(), _sharedKeys) );
             ++(*this);
+        } else if (_key) {
+            AccessProfile::sampleIteration(*this);
         }
     }
 
@@ -463,6 +750,8 @@ namespace fleece { namespace impl {
             }
             readKV();
         } while (_usuallyFalse(_parent && _value && _value->isUndefined()));      // skip deletion tombstones
+        if (_key)
+            AccessProfile::sampleIteration(*this);
         return *this;
     }
 
@@ -497,4 +786,113 @@ namespace fleece { namespace impl {
         }
     }
 
+
+#pragma mark - DICT MERGE ITERATOR:
+
+
+    const SharedKeys* DictMergeIterator::sharedKeysOf(const Dict *d) noexcept {
+        if (!d)
+            return nullptr;
+        else if (d->isMutable())
+            return d->heapDict()->sharedKeys();
+        else
+            return d->sharedKeys();
+    }
+
+    // A mutable Dict iterates its keys as strings, but in the order of their encoded forms, so
+    // if any of them are shared they're not in string order.
+    static bool keysOutOfOrder(const Dict *d, const SharedKeys *sk) noexcept {
+        return d && d->isMutable() && sk != nullptr;
+    }
+
+    DictMergeIterator::DictMergeIterator(const Dict *d1, const SharedKeys *sk1,
+                                         const Dict *d2, const SharedKeys *sk2)
+    :_byString(d1 && d2 && (sk1 != sk2 || keysOutOfOrder(d1, sk1) || keysOutOfOrder(d2, sk2)))
+    ,_side1(d1, sk1, _byString)
+    ,_side2(d2, sk2, _byString)
+    {
+        load();
+    }
+
+    bool DictMergeIterator::less(const side &a, const side &b) const noexcept {
+        if (!b)
+            return true;
+        else if (_byString)
+            return a._keyString < b._keyString;
+        else
+            return key_t(a._key) < key_t(b._key);
+    }
+
+    void DictMergeIterator::load() {
+        bool has1 = bool(_side1), has2 = bool(_side2);
+        if (has1 && has2) {
+            if (less(_side1, _side2))
+                has2 = false;
+            else if (less(_side2, _side1))
+                has1 = false;
+        }
+        _value1 = has1 ? _side1._value : nullptr;
+        _value2 = has2 ? _side2._value : nullptr;
+        _current = has1 ? &_side1 : (has2 ? &_side2 : nullptr);
+    }
+
+    slice DictMergeIterator::keyString() const noexcept {
+        return _current ? _current->keyString() : slice();
+    }
+
+    DictMergeIterator& DictMergeIterator::operator++() {
+        throwIf(!_value1 && !_value2, OutOfRange, "iterating past end of dict");
+        if (_value1)
+            _side1.next();
+        if (_value2)
+            _side2.next();
+        load();
+        return *this;
+    }
+
+
+    DictMergeIterator::side::side(const Dict *d, const SharedKeys *sk, bool byString)
+    :_iter(d, sk)
+    ,_byString(byString)
+    {
+        if (byString) {
+            // Integer keys sort before strings, so they're all at the start:
+            bool sortAll = keysOutOfOrder(d, sk);
+            for (; _iter && (sortAll || _iter.key()->isInteger()); ++_iter)
+                _intItems.emplace_back(_iter.keyString(), _iter.value());
+            std::sort(_intItems.begin(), _intItems.end(), [](auto &a, auto &b) {
+                return a.first < b.first;
+            });
+        }
+        load();
+    }
+
+    void DictMergeIterator::side::load() {
+        if (_byString) {
+            // Take the lesser of the next decoded integer key and the next string key:
+            bool haveInt = _intPos < _intItems.size();
+            _fromIntItems = haveInt && (!_iter || _intItems[_intPos].first < _iter.keyString());
+            if (_fromIntItems) {
+                std::tie(_keyString, _value) = _intItems[_intPos];
+                return;
+            }
+        }
+        if (_iter) {
+            _key = _iter.key();
+            _value = _iter.value();
+            if (_byString)
+                _keyString = _iter.keyString();
+        } else {
+            _key = _value = nullptr;
+        }
+    }
+
+    void DictMergeIterator::side::next() {
+        if (_fromIntItems)
+            ++_intPos;
+        else
+            ++_iter;
+        load();
+    }
+
 } }
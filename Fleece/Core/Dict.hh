@@ -19,6 +19,7 @@
 #pragma once
 #include "Array.hh"
 #include <memory>
+#include <vector>
 
 namespace fleece { namespace impl {
 
@@ -38,6 +39,11 @@ namespace fleece { namespace impl {
         /** Looks up the Value for a string key. */
         const Value* get(slice keyToFind) const noexcept FLPURE;
 
+        /** Looks up the Value for a string key, using the given SharedKeys to map it to an
+            integer (if this Dict's keys are shared) instead of looking up the ones its data
+            belongs to. If `sharedKeys` is null, this is the same as `get(slice)`. */
+        const Value* get(slice keyToFind, SharedKeys *sharedKeys) const noexcept;
+
         /** Looks up the Value for an integer (shared) key. */
         const Value* get(int numericKeyToFind) const noexcept FLPURE;
 
@@ -88,12 +94,58 @@ namespace fleece { namespace impl {
             template <bool WIDE> friend struct dictImpl;
         };
 
+        /** A key that's mapped to its SharedKeys integer once, when it's constructed, and is
+            immutable after that. Unlike \ref key it doesn't cache a hint, so a single instance
+            can be used for lookups on any number of threads at once, with no synchronization.
+            It should only be used with Dicts that use the same SharedKeys (or none.) */
+        class resolvedKey {
+        public:
+            /** Constructs a key from a string, which is copied. If `sharedKeys` is non-null and
+                knows the string, the key stores its integer encoding. (It never adds the string
+                to the SharedKeys.) */
+            explicit resolvedKey(slice string, SharedKeys *sharedKeys =nullptr);
+            ~resolvedKey();
+            slice string() const noexcept                {return _string;}
+            SharedKeys* sharedKeys() const noexcept      {return _sharedKeys;}
+            bool isShared() const noexcept               {return _hasNumericKey;}
+            int numericKey() const noexcept              {return _numericKey;}
+            resolvedKey(const resolvedKey&) =delete;
+            resolvedKey& operator= (const resolvedKey&) =delete;
+        private:
+            alloc_slice const _string;
+            SharedKeys* const _sharedKeys;
+            int32_t _numericKey     {0};
+            bool _hasNumericKey     {false};
+
+            template <bool WIDE> friend struct dictImpl;
+        };
+
         /** Looks up the Value for a key, in a form that can cache the key's Fleece object.
             Using the Fleece object is significantly faster than a normal get. */
         const Value* get(key&) const noexcept;
 
+        /** Looks up the Value for a resolvedKey. This is thread-safe; it never modifies the key. */
+        const Value* get(const resolvedKey&) const noexcept;
+
         const Value* get(const key_t&) const noexcept;
 
+        /** Looks up a key, first checking the item at index `hint`; then updates `hint` to the
+            index where the key was found. This is much faster when looking up the same key in a
+            series of Dicts with the same layout, as is typical of an array of records. */
+        const Value* get(const key_t&, uint32_t &hint) const noexcept;
+
+        /** Looks up several keys at once, storing each key's Value (or nullptr) in the
+            corresponding element of `values`. The keys must be in the same order as a Dict's
+            keys (i.e. sorted by key_t's `<`), and any shared keys must already be in their integer
+            form. This makes a single forward pass through the Dict, instead of a separate binary
+            search for each key. */
+        void getMany(const key_t keys[], size_t count, const Value* values[]) const noexcept;
+
+        /** Looks up several string keys at once, storing each key's Value (or nullptr) in the
+            corresponding element of `values`. The keys can be in any order, but this is
+            fastest if they're sorted. Shared keys are looked up as necessary. */
+        void getMany(const slice keys[], size_t count, const Value* values[]) const noexcept;
+
         constexpr Dict()  :Value(internal::kDictTag, 0, 0) { }
 
     protected:
@@ -105,10 +157,13 @@ namespace fleece { namespace impl {
         static constexpr int kMagicParentKey = -2048;
 
         template <bool WIDE> friend struct dictImpl;
+        friend class CompressedDoc;
         friend class DictIterator;
+        friend class DictMergeIterator;
         friend class Value;
         friend class Encoder;
         friend class internal::HeapDict;
+        friend class DataStats;
     };
 
 
@@ -118,7 +173,9 @@ namespace fleece { namespace impl {
         /** Constructs an iterator. It's OK for the Dict to be null. */
         DictIterator(const Dict*) noexcept;
 
-        /** Constructs an iterator on a Dict using shared keys. It's OK for the Dict to be null. */
+        /** Constructs an iterator on a Dict using shared keys, which are used to decode integer
+            keys instead of looking up the ones its data belongs to. It's OK for the Dict to be
+            null. */
         DictIterator(const Dict*, const SharedKeys*) noexcept;
 
         /** Returns the number of _remaining_ items. */
@@ -159,10 +216,70 @@ namespace fleece { namespace impl {
 
         friend class Value;
         friend class ValueDumper;
+        friend class DataStats;
         friend class Encoder;
     };
 
 
+    /** Iterates two Dicts in step, visiting each key that's in either one once, in order, with
+        its value in each Dict (or nullptr if it's not in that one.) Since Dicts are sorted this
+        takes linear time, instead of looking up each key of one Dict in the other.
+        If the Dicts use different SharedKeys, their integer keys aren't in the same order, so
+        the iterator decodes and sorts those first, and visits all the keys in string order.
+        (That's also the case for a mutable Dict with SharedKeys, whose keys are all sorted.) */
+    class DictMergeIterator {
+    public:
+        /** Constructs an iterator. It's OK for either Dict to be null. */
+        DictMergeIterator(const Dict* d1, const Dict* d2)
+        :DictMergeIterator(d1, sharedKeysOf(d1), d2, sharedKeysOf(d2)) { }
+
+        slice keyString() const noexcept;
+
+        /** The current key's value in the first Dict, or nullptr if it has none. */
+        const Value* value1() const noexcept FLPURE             {return _value1;}
+
+        /** The current key's value in the second Dict, or nullptr if it has none. */
+        const Value* value2() const noexcept FLPURE             {return _value2;}
+
+        /** Returns false when the iterator reaches the end. */
+        explicit operator bool() const noexcept FLPURE          {return _value1 || _value2;}
+
+        /** Steps to the next key. */
+        DictMergeIterator& operator ++();
+
+    private:
+        // One of the Dicts, read in key order.
+        class side {
+        public:
+            side(const Dict*, const SharedKeys*, bool byString);
+            explicit operator bool() const noexcept         {return _value != nullptr;}
+            slice keyString() const noexcept    {return _byString ? _keyString : _iter.keyString();}
+            void next();
+
+            const Value* _key {nullptr};        // Current key, unless `byString`
+            slice _keyString;                   // Current key, if `byString`
+            const Value* _value {nullptr};      // Current value, or nullptr at the end
+        private:
+            void load();
+
+            DictIterator _iter;
+            std::vector<std::pair<slice, const Value*>> _intItems; // if byString: sorted by key
+            size_t _intPos {0};
+            bool _byString, _fromIntItems {false};
+        };
+
+        DictMergeIterator(const Dict*, const SharedKeys*, const Dict*, const SharedKeys*);
+        static const SharedKeys* sharedKeysOf(const Dict*) noexcept;
+        bool less(const side&, const side&) const noexcept;
+        void load();
+
+        bool _byString;
+        side _side1, _side2;
+        const side* _current {nullptr};             // Side whose key is current
+        const Value *_value1 {nullptr}, *_value2 {nullptr};
+    };
+
+
     inline Dict::iterator Dict::begin() const noexcept    {return iterator(this);}
 
 } }
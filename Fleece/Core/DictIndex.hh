@@ -0,0 +1,346 @@
+//
+// DictIndex.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Internal.hh"
+#include "Endian.hh"
+#include "varint.hh"
+#include "Writer.hh"
+#include "fleece/slice.hh"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace fleece { namespace impl { namespace internal {
+    namespace wy32 {
+        #include "wyhash32.h"
+    }
+
+    /*
+     A hash index of a large Dict's string keys, optionally written by the Encoder.
+
+     It's stored as a binary Value immediately following the Dict's last item. Nothing points to
+     it, so readers that don't know about it never see it, and the Dict is still an ordinary
+     sorted dictionary. The binary data is:
+
+         "FLdx"                 magic number
+         count                  uint32, the Dict's item count
+         size                   uint32, number of table slots (a power of 2)
+         slots[size]            uint16 (or uint32 if count >= 0xFFFF), LE: 1 + item index, or 0
+
+     The table uses open addressing with linear probing, keyed by the wyhash32 of the key string.
+     A slot's item is always compared with the key being looked up, so a damaged or bogus index
+     can only cause a lookup to fail, never to return the wrong value.
+    */
+    class DictIndex {
+    public:
+        /** Dicts with fewer items than this are never indexed. */
+        static constexpr uint32_t kMinCount = 256;
+
+        /** Looks for an index following the items of a Dict. */
+        DictIndex(const void *itemsEnd, uint32_t count) noexcept {
+            auto header = (const uint8_t*)itemsEnd;
+            if (count < kMinCount || header[0] != kHeaderByte)
+                return;
+            uint32_t dataSize;
+            size_t n = GetUVarInt32(slice(header + 1, kMaxVarintLen32), &dataSize);
+            if (n == 0 || dataSize < 12)
+                return;
+            auto data = header + 1 + n;
+            if (memcmp(data, kMagic, 4) != 0 || readLittle32(data + 4) != count)
+                return;
+            uint32_t size = readLittle32(data + 8);
+            unsigned slotWidth = (count < 0xFFFF) ? 2 : 4;
+            if (size == 0 || (size & (size - 1)) != 0 || dataSize != 12 + size * slotWidth)
+                return;
+            _slots = data + 12;
+            _size = size;
+            _count = count;
+            _wide = (slotWidth == 4);
+        }
+
+        explicit operator bool() const          {return _slots != nullptr;}
+
+        /** Returns the index of the item whose key matches, or -1. `isKeyAt(i)` must return
+            true if the i'th key equals `key`. */
+        template <class CALLBACK>
+        int64_t find(slice key, CALLBACK isKeyAt) const {
+            uint32_t mask = _size - 1;
+            uint32_t i = hash(key) & mask;
+            for (uint32_t probes = 0; probes < _size; ++probes, i = (i + 1) & mask) {
+                uint32_t slot = _wide ? readLittle32(_slots + 4*i) : readLittle16(_slots + 2*i);
+                if (slot == 0)
+                    break;
+                if (_usuallyTrue(slot <= _count) && isKeyAt(slot - 1))
+                    return slot - 1;
+            }
+            return -1;
+        }
+
+        /** Writes an index for a Dict with `count` items whose sorted keys are `keys`.
+            A key with a null `buf` is an integer key, and isn't indexed. */
+        static void write(Writer &out, const FLSlice keys[], uint32_t count) {
+            uint32_t size = 1;
+            while (size < count + count / 2)
+                size <<= 1;
+            std::vector<uint32_t> table(size, 0);
+            for (uint32_t item = 0; item < count; ++item) {
+                if (!keys[item].buf)
+                    continue;
+                uint32_t i = hash(keys[item]) & (size - 1);
+                while (table[i] != 0)
+                    i = (i + 1) & (size - 1);
+                table[i] = item + 1;
+            }
+
+            unsigned slotWidth = (count < 0xFFFF) ? 2 : 4;
+            uint32_t dataSize = 12 + size * slotWidth;
+            uint8_t header[1 + kMaxVarintLen32];
+            header[0] = kHeaderByte;
+            size_t headerSize = 1 + PutUVarInt(&header[1], dataSize);
+            out.write(header, headerSize);
+            out.write(kMagic, 4);
+            writeLittle32(out, count);
+            writeLittle32(out, size);
+            for (uint32_t slot : table) {
+                if (slotWidth == 2) {
+                    uint16_t le = endian::encLittle16(uint16_t(slot));
+                    out.write(&le, 2);
+                } else {
+                    writeLittle32(out, slot);
+                }
+            }
+            out.padToEvenLength();
+        }
+
+        static uint32_t hash(slice key) FLPURE {
+            return wy32::wyhash32(key.buf, key.size, kSeed);
+        }
+
+        /** The first byte of an index, i.e. of a binary Value whose size follows as a varint. */
+        static constexpr uint8_t kHeaderByte = (kBinaryTag << 4) | 0x0F;
+
+    private:
+        static constexpr const char* kMagic = "FLdx";
+        static constexpr unsigned kSeed = 0x91BAC172;
+
+        static uint32_t readLittle32(const uint8_t *p) {
+            uint32_t v;
+            memcpy(&v, p, 4);
+            return endian::decLittle32(v);
+        }
+
+        static uint16_t readLittle16(const uint8_t *p) {
+            uint16_t v;
+            memcpy(&v, p, 2);
+            return endian::decLittle16(v);
+        }
+
+        static void writeLittle32(Writer &out, uint32_t v) {
+            v = endian::encLittle32(v);
+            out.write(&v, 4);
+        }
+
+        const uint8_t* _slots {nullptr};
+        uint32_t _size {0};
+        uint32_t _count {0};
+        bool _wide {false};
+
+        friend class DictKeyPrefixes;
+        friend class CollectionHash;
+    };
+
+
+    /*
+     A column of the first 8 bytes of each of a Dict's string keys, optionally written by the
+     Encoder, which lets a binary search compare integers and only compare the key strings when
+     their prefixes are equal.
+
+     Like a DictIndex it's a binary Value that nothing points to, following the Dict's last item
+     (or its DictIndex, if it has one.) It's only written if all the keys are strings:
+
+         "FLkp"                 magic number
+         count                  uint32, the Dict's item count
+         prefixes[count]        8 bytes each: the key's first 8 bytes, padded with 00s
+
+     Read as big-endian integers, prefixes sort in the same order as their keys, except that
+     different keys can have equal prefixes.
+    */
+    class DictKeyPrefixes {
+    public:
+        /** Dicts with fewer items than this never have prefixes. */
+        static constexpr uint32_t kMinCount = 64;
+
+        /** Looks for key prefixes following the items of a Dict (and its index, if any.) */
+        DictKeyPrefixes(const void *itemsEnd, uint32_t count) noexcept {
+            if (count < kMinCount)
+                return;
+            auto header = (const uint8_t*)itemsEnd;
+            for (int i = 0; i < 2; ++i) {
+                if (header[0] != DictIndex::kHeaderByte)
+                    return;
+                uint32_t dataSize;
+                size_t n = GetUVarInt32(slice(header + 1, kMaxVarintLen32), &dataSize);
+                if (n == 0 || dataSize < 8)
+                    return;
+                auto data = header + 1 + n;
+                if (memcmp(data, kMagic, 4) == 0) {
+                    if (DictIndex::readLittle32(data + 4) != count || dataSize != 8 + 8 * count)
+                        return;
+                    _prefixes = data + 8;
+                    _count = count;
+                    return;
+                } else if (memcmp(data, DictIndex::kMagic, 4) == 0) {
+                    header = data + dataSize + ((1 + n + dataSize) & 1);      // skip DictIndex
+                } else {
+                    return;
+                }
+            }
+        }
+
+        explicit operator bool() const          {return _prefixes != nullptr;}
+
+        /** Returns the index of the item whose key matches, or -1. `compareKeyAt(i)` must
+            compare `key` with the i'th key, like slice::compare. */
+        template <class CALLBACK>
+        int64_t find(slice key, CALLBACK compareKeyAt) const {
+            uint64_t prefix = prefixOf(key);
+            uint32_t lo = 0, hi = _count;      // prefixes before `lo` are < prefix
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) >> 1;
+                if (prefixAt(mid) < prefix)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            for (; lo < _count && prefixAt(lo) == prefix; ++lo) {
+                int cmp = compareKeyAt(lo);
+                if (cmp == 0)
+                    return lo;
+                else if (cmp < 0)
+                    break;
+            }
+            return -1;
+        }
+
+        /** Writes the prefixes of a Dict with `count` items whose sorted keys are `keys`,
+            unless some key is an integer (with a null `buf`.) */
+        static void write(Writer &out, const FLSlice keys[], uint32_t count) {
+            for (uint32_t item = 0; item < count; ++item) {
+                if (!keys[item].buf && keys[item].size > 0)
+                    return;
+            }
+            uint32_t dataSize = 8 + 8 * count;
+            uint8_t header[1 + kMaxVarintLen32];
+            header[0] = DictIndex::kHeaderByte;
+            size_t headerSize = 1 + PutUVarInt(&header[1], dataSize);
+            out.write(header, headerSize);
+            out.write(kMagic, 4);
+            DictIndex::writeLittle32(out, count);
+            for (uint32_t item = 0; item < count; ++item) {
+                uint64_t prefix = endian::enc64(prefixOf(keys[item]));
+                out.write(&prefix, 8);
+            }
+            out.padToEvenLength();
+        }
+
+        /** A key's prefix, as a native integer. */
+        static uint64_t prefixOf(slice key) FLPURE {
+            uint8_t bytes[8] = {};
+            if (key.size > 0)
+                memcpy(bytes, key.buf, std::min(key.size, sizeof(bytes)));
+            uint64_t prefix;
+            memcpy(&prefix, bytes, 8);
+            return endian::dec64(prefix);
+        }
+
+    private:
+        static constexpr const char* kMagic = "FLkp";
+
+        uint64_t prefixAt(uint32_t i) const {
+            uint64_t prefix;
+            memcpy(&prefix, _prefixes + 8 * i, 8);
+            return endian::dec64(prefix);
+        }
+
+        const uint8_t* _prefixes {nullptr};
+        uint32_t _count {0};
+
+        friend class CollectionHash;
+    };
+
+
+    /*
+     The hash of a large Array's or Dict's content (see Value::hash), optionally written by the
+     Encoder, which makes hashing it O(1) and lets unequal collections be compared in O(1).
+
+     Like a DictIndex it's a binary Value that nothing points to, following the collection's last
+     item -- or, in a Dict, its DictIndex and DictKeyPrefixes, if it has them:
+
+         "FLhs"                 magic number
+         count                  uint32, the collection's item count
+         hash                   uint64, the hash
+    */
+    class CollectionHash {
+    public:
+        /** Collections with fewer items than this never have hashes. */
+        static constexpr uint32_t kMinCount = 64;
+
+        /** Looks for a hash following the items of a collection (and a Dict's other trailers.) */
+        static bool find(const void *itemsEnd, uint32_t count, uint64_t &outHash) noexcept {
+            if (count < kMinCount)
+                return false;
+            auto header = (const uint8_t*)itemsEnd;
+            for (int i = 0; i < 3; ++i) {
+                if (header[0] != DictIndex::kHeaderByte)
+                    return false;
+                uint32_t dataSize;
+                size_t n = GetUVarInt32(slice(header + 1, kMaxVarintLen32), &dataSize);
+                if (n == 0 || dataSize < 8 || DictIndex::readLittle32(header + 1 + n + 4) != count)
+                    return false;
+                auto data = header + 1 + n;
+                if (memcmp(data, kMagic, 4) == 0) {
+                    if (dataSize != 16)
+                        return false;
+                    memcpy(&outHash, data + 8, 8);
+                    outHash = endian::decLittle64(outHash);
+                    return true;
+                } else if (memcmp(data, DictIndex::kMagic, 4) != 0
+                                && memcmp(data, DictKeyPrefixes::kMagic, 4) != 0) {
+                    return false;
+                }
+                header = data + dataSize + ((1 + n + dataSize) & 1);    // skip to the next one
+            }
+            return false;
+        }
+
+        /** Writes the hash of a collection with `count` items. */
+        static void write(Writer &out, uint32_t count, uint64_t hash) {
+            uint8_t header[2] = {DictIndex::kHeaderByte, 16};
+            out.write(header, 2);
+            out.write(kMagic, 4);
+            DictIndex::writeLittle32(out, count);
+            hash = endian::encLittle64(hash);
+            out.write(&hash, 8);
+        }
+
+    private:
+        static constexpr const char* kMagic = "FLhs";
+    };
+
+} } }
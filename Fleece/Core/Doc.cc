@@ -17,15 +17,24 @@
 //
 
 #include "Doc.hh"
+#include "Counters.hh"
+#include "DictIndex.hh"
+#include "Encoder.hh"
 #include "SharedKeys.hh"
+#include "Tracing.hh"
 #include "Pointer.hh"
 #include "JSONConverter.hh"
 #include "FleeceException.hh"
 #include "MutableDict.hh"
 #include "MutableArray.hh"
+#include "sliceIO.hh"
+#include "AsyncFileIO.hh"
+#include "Executor.hh"
+#include "ValueHash.hh"
 #include <algorithm>
 #include <functional>
 #include <mutex>
+#include <thread>
 #include <vector>
 #include "betterassert.hh"
 
@@ -43,24 +52,192 @@ namespace fleece { namespace impl {
     using namespace internal;
 
 
+    // Each registration of a Scope has a ticket: a version number that changes when the
+    // registration ends, so a thread's cached entry for it can tell that it's stale. Tickets
+    // are recycled, but never freed, so a cache can check one after its Scope is gone.
+    using ticket = atomic<uint64_t>;
+
+
     // `sMemoryMap` is a global mapping from pointers to Scopes.
     struct memEntry {
         const void *endOfRange; // The _end_ of the memory range covered by the Scope
         Scope *scope;           // The Scope
+        ticket *tkt;            // The registration's ticket
+        uint64_t version;       // The ticket's version while the registration lasts
         bool operator< (const memEntry &other) const        {return endOfRange < other.endOfRange;}
     };
 
     using memoryMap = smallVector<memEntry, 10>;
 
-    static memoryMap *sMemoryMap;
+    // The map is copy-on-write, so lookups never block: a reader just loads the current map.
+    // Writers (registr/unregister) serialize on `sMutex` and publish a modified copy. The old
+    // copy is retired, and freed by a later writer once no reader can still be using it; no
+    // writer waits for readers while holding `sMutex`.
+    static atomic<const memoryMap*> sMemoryMap;
 
-    // Mutex for access to `sMemoryMap`
+    // Mutex serializing changes to `sMemoryMap`. Readers never take it.
     static mutex sMutex;
 
 
+    // Reader accounting for reclamation. Readers bump a counter belonging to the parity of the
+    // current epoch. The epoch advances only when the readers of the previous one are gone, so
+    // once it's two past the epoch in which something was retired, no reader can be using it.
+    // The counters are striped across cache lines, so concurrent readers don't contend on one.
+    static constexpr size_t kReaderStripes = 16;
+
+    struct alignas(64) readerCount {
+        atomic<int32_t> n {0};
+    };
+
+    static atomic<uint64_t> sEpoch {0};
+    static readerCount sReaders[2][kReaderStripes];
+
+    // Maps replaced during an epoch, waiting to be freed. Guarded by `sMutex`.
+    struct retiredMap {
+        const memoryMap *map;
+        uint64_t epoch;
+    };
+    static vector<retiredMap> sRetiredMaps;
+
+    static size_t readerStripe() noexcept {
+        static atomic<size_t> sNextStripe {0};
+        static thread_local size_t tStripe = sNextStripe++ % kReaderStripes;
+        return tStripe;
+    }
+
+
+    // RAII read-side critical section: while it exists, the memoryMap returned by `map()`, and
+    // every Scope in it, stays valid.
+    class memoryMapReader {
+    public:
+        __hot memoryMapReader() noexcept
+        :_stripe(readerStripe())
+        {
+            while (true) {
+                _epoch = unsigned(sEpoch.load() & 1);
+                ++sReaders[_epoch][_stripe].n;
+                if (_usuallyTrue((sEpoch.load() & 1) == _epoch))
+                    break;
+                // A writer flipped the epoch in between; register with the new one instead:
+                --sReaders[_epoch][_stripe].n;
+            }
+            _map = sMemoryMap.load();
+        }
+
+        __hot ~memoryMapReader() noexcept {
+            --sReaders[_epoch][_stripe].n;
+        }
+
+        const memoryMap* map() const noexcept   {return _map;}
+
+    private:
+        memoryMapReader(const memoryMapReader&) =delete;
+
+        size_t _stripe;
+        unsigned _epoch;
+        const memoryMap* _map;
+    };
+
+
+    // Each thread caches the last few Scopes it looked up, since most threads work with only
+    // one or two Docs at a time. An entry is used only while its registration's ticket is
+    // unchanged, so unregistering a Scope invalidates just the entries for it.
+    struct cachedScope {
+        const void *start, *end;
+        const Scope *scope;
+        const ticket *tkt;
+        uint64_t version;
+    };
+
+    static constexpr size_t kScopeCacheSize = 4;
+
+    struct scopeCache {
+        cachedScope entries[kScopeCacheSize];
+        unsigned    next;
+    };
+
+    static thread_local scopeCache tScopeCache;
+
+
+    // Tickets not in use. Guarded by `sMutex`.
+    static vector<ticket*> sFreeTickets;
+
+    // Returns an unused ticket. Must be called with `sMutex` locked.
+    static ticket* newTicket() {
+        if (sFreeTickets.empty()) {
+            static constexpr size_t kTicketsPerChunk = 256;
+            auto chunk = new ticket[kTicketsPerChunk];      // never freed
+            for (size_t i = kTicketsPerChunk; i-- > 0;) {
+                chunk[i].store(0, memory_order_relaxed);
+                sFreeTickets.push_back(&chunk[i]);
+            }
+        }
+        ticket *t = sFreeTickets.back();
+        sFreeTickets.pop_back();
+        return t;
+    }
+
+    // Ends the registration of a map entry, invalidating cached copies of it, and recycles its
+    // ticket. Must be called with `sMutex` locked, before the epoch of its removal is read.
+    static void retireTicket(const memEntry &entry) {
+        ++*entry.tkt;
+        sFreeTickets.push_back(entry.tkt);
+    }
+
+
+    // If no reader of the epoch before the current one is left, advances the epoch and frees
+    // the retired maps that no reader can still be using. Never waits for readers.
+    // Must be called with `sMutex` locked.
+    static void tryAdvanceEpoch() noexcept {
+        uint64_t epoch = sEpoch.load();
+        for (auto &stripe : sReaders[(epoch - 1) & 1]) {
+            if (stripe.n.load() != 0)
+                return;
+        }
+        // Readers of earlier epochs left before the last advance, so nothing retired before
+        // this epoch is in use:
+        auto end = remove_if(sRetiredMaps.begin(), sRetiredMaps.end(), [&](retiredMap &r) {
+            if (r.epoch >= epoch)
+                return false;
+            delete r.map;
+            return true;
+        });
+        sRetiredMaps.erase(end, sRetiredMaps.end());
+        sEpoch.store(epoch + 1);
+    }
+
+
+    // Installs a new memoryMap and retires the old one. Returns the epoch it was retired in,
+    // for waitForReaders(). Must be called with `sMutex` locked.
+    static uint64_t publishMemoryMap(const memoryMap *newMap) noexcept {
+        const memoryMap *oldMap = sMemoryMap.exchange(newMap);
+        uint64_t epoch = sEpoch.load();
+        if (oldMap)
+            sRetiredMaps.push_back({oldMap, epoch});
+        tryAdvanceEpoch();
+        return epoch;
+    }
+
+
+    // Waits until no reader can be using anything retired in `epoch`: in particular a Scope
+    // removed from the map then, which may then be destroyed. Must be called with `sMutex`
+    // unlocked; it only locks it briefly, to advance the epoch.
+    static void waitForReaders(uint64_t epoch) noexcept {
+        while (sEpoch.load() < epoch + 2) {
+            {
+                lock_guard<mutex> lock(sMutex);
+                tryAdvanceEpoch();
+            }
+            if (sEpoch.load() < epoch + 2)
+                this_thread::yield();
+        }
+    }
+
+
     Scope::Scope(slice data, SharedKeys *sk, slice destination) noexcept
     :_sk(sk)
     ,_externDestination(destination)
+    ,_olderSegments(segmentsBefore(destination))
     ,_data(data)
     {
         registr();
@@ -70,6 +247,7 @@ namespace fleece { namespace impl {
     Scope::Scope(const alloc_slice &data, SharedKeys *sk, slice destination) noexcept
     :_sk(sk)
     ,_externDestination(destination)
+    ,_olderSegments(segmentsBefore(destination))
     ,_data(data)
     ,_alloced(data)
     {
@@ -80,6 +258,7 @@ namespace fleece { namespace impl {
     Scope::Scope(const Scope &parentScope, slice subData) noexcept
     :_sk(parentScope.sharedKeys())
     ,_externDestination(parentScope.externDestination())
+    ,_olderSegments(parentScope._olderSegments)
     ,_data(subData)
     ,_alloced(parentScope._alloced)
     {
@@ -95,73 +274,151 @@ namespace fleece { namespace impl {
     }
 
 
-    __hot void Scope::registr() noexcept {
-        _unregistered.test_and_set();
-        if (!_data)
-            return;
-
-#if DEBUG
-        if (_data.size < 1e6)
-            _dataHash = _data.hash();
-#endif
-        lock_guard<mutex> lock(sMutex);
-        if (_usuallyFalse(!sMemoryMap))
-            sMemoryMap = new memoryMap;
+    // Adds a Scope to a (new, unpublished) memoryMap. Must be called with `sMutex` locked.
+    static void addToMemoryMap(memoryMap *newMap, Scope *scope) {
+        slice data = scope->data();
         Log("Register   (%p ... %p) --> Scope %p, sk=%p [Now %zu]",
-            _data.buf, _data.end(), this, _sk.get(), sMemoryMap->size()+1);
+            data.buf, data.end(), scope, scope->sharedKeys(), newMap->size()+1);
 
-        memEntry entry = {_data.end(), this};
-        memoryMap::iterator iter = upper_bound(sMemoryMap->begin(), sMemoryMap->end(), entry);
+        memEntry entry = {data.end(), scope, nullptr, 0};
+        memoryMap::iterator iter = upper_bound(newMap->begin(), newMap->end(), entry);
 
         // Assert that there isn't another conflicting Scope registered for this data:
-        if (iter != sMemoryMap->begin() && prev(iter)->endOfRange == entry.endOfRange) {
+        if (iter != newMap->begin() && prev(iter)->endOfRange == entry.endOfRange) {
             Scope *existing = prev(iter)->scope;
-            if (existing->_data == _data && existing->_externDestination == _externDestination
-                && existing->_sk == _sk) {
+            if (existing->data() == data
+                    && existing->externDestination() == scope->externDestination()
+                    && existing->sharedKeys() == scope->sharedKeys()) {
                 Log("Duplicate  (%p ... %p) --> Scope %p, sk=%p",
-                    _data.buf, _data.end(), this, _sk.get());
+                    data.buf, data.end(), scope, scope->sharedKeys());
             } else {
+                delete newMap;
                 FleeceException::_throw(InternalError,
                     "Incompatible duplicate Scope %p for (%p .. %p) with sk=%p: "
                     "conflicts with %p for (%p .. %p) with sk=%p",
-                    this, _data.buf, _data.end(), _sk.get(),
-                    existing, existing->_data.buf, existing->_data.end(),
-                    existing->_sk.get());
+                    scope, data.buf, data.end(), scope->sharedKeys(),
+                    existing, existing->data().buf, existing->data().end(),
+                    existing->sharedKeys());
             }
         }
+        entry.tkt = newTicket();
+        entry.version = entry.tkt->load();
+        newMap->insert(iter, entry);
+    }
+
+
+    // Returns a copy of a memoryMap without a Scope's entry, or nullptr if it has no entry.
+    // The entry's ticket is retired. Must be called with `sMutex` locked.
+    static memoryMap* copyMemoryMapWithout(const memoryMap *curMap, const Scope *scope,
+                                           slice data) noexcept
+    {
+        if (!curMap)
+            return nullptr;
+        memEntry entry = {data.end(), const_cast<Scope*>(scope), nullptr, 0};
+        auto iter = lower_bound(curMap->begin(), curMap->end(), entry);
+        for (; iter != curMap->end() && iter->endOfRange == entry.endOfRange; ++iter) {
+            if (iter->scope == scope) {
+                retireTicket(*iter);
+                auto newMap = new memoryMap;
+                newMap->reserve(curMap->size() - 1);
+                for (auto i = curMap->begin(); i != curMap->end(); ++i) {
+                    if (i != iter)
+                        newMap->push_back(*i);
+                }
+                return newMap;
+            }
+        }
+        return nullptr;
+    }
+
+
+    __hot void Scope::registr() noexcept {
+        _unregistered.test_and_set();
+        if (!_data)
+            return;
 
-        sMemoryMap->insert(iter, entry);
+#if DEBUG
+        if (_data.size < 1e6)
+            _dataHash = _data.hash();
+#endif
+        lock_guard<mutex> lock(sMutex);
+        auto newMap = sMemoryMap.load() ? new memoryMap(*sMemoryMap.load()) : new memoryMap;
+        addToMemoryMap(newMap, this);
+        publishMemoryMap(newMap);
         _unregistered.clear();
     }
 
 
+#if DEBUG
+    // Asserts that the data hasn't been changed since I was registered.
+    void Scope::checkDataHash() const {
+        if (_data.size < 1e6 && !_dataMayChange && _data.hash() != _dataHash)
+            FleeceException::_throw(InternalError,
+                "Memory range (%p .. %p) was altered while Scope %p (sk=%p) was active. "
+                "This usually means the Scope's data was freed/invalidated before the Scope "
+                "was unregistered/deleted. Unregister it earlier!",
+                _data.buf, _data.end(), this, _sk.get());
+    }
+#endif
+
+
     __hot void Scope::unregister() noexcept {
         if (!_unregistered.test_and_set()) {            // this is atomic
 #if DEBUG
-            // Assert that the data hasn't been changed since I was created:
-            if (_data.size < 1e6 && _data.hash() != _dataHash)
-                FleeceException::_throw(InternalError,
-                    "Memory range (%p .. %p) was altered while Scope %p (sk=%p) was active. "
-                    "This usually means the Scope's data was freed/invalidated before the Scope "
-                    "was unregistered/deleted. Unregister it earlier!",
-                    _data.buf, _data.end(), this, _sk.get());
+            checkDataHash();
 #endif
-
-            lock_guard<mutex> lock(sMutex);
-            Log("Unregister (%p ... %p) --> Scope %p, sk=%p   [now %zu]",
-                _data.buf, _data.end(), this, _sk.get(), sMemoryMap->size()-1);
-            memEntry entry = {_data.end(), this};
-            auto iter = lower_bound(sMemoryMap->begin(), sMemoryMap->end(), entry);
-            while (iter != sMemoryMap->end() && iter->endOfRange == entry.endOfRange) {
-                if (iter->scope == this) {
-                    sMemoryMap->erase(iter);
+            uint64_t epoch;
+            {
+                lock_guard<mutex> lock(sMutex);
+                Log("Unregister (%p ... %p) --> Scope %p, sk=%p",
+                    _data.buf, _data.end(), this, _sk.get());
+                auto newMap = copyMemoryMapWithout(sMemoryMap.load(), this, _data);
+                if (!newMap) {
+                    Warn("unregister(%p) couldn't find an entry for (%p ... %p)", this, _data.buf, _data.end());
                     return;
-                } else {
-                    ++iter;
                 }
+                epoch = publishMemoryMap(newMap);
             }
-            Warn("unregister(%p) couldn't find an entry for (%p ... %p)", this, _data.buf, _data.end());
+            // Readers that found me in the old map may still be using me:
+            waitForReaders(epoch);
+        }
+    }
+
+
+    // Swaps the registered range from the old data to the new in a single update of the map,
+    // instead of the two that unregistering and registering would take.
+    void Scope::retarget(const alloc_slice &data, SharedKeys *sk, slice destination) noexcept {
+        vector<slice> olderSegments = segmentsBefore(destination);
+        bool wasRegistered = !_unregistered.test_and_set();
+#if DEBUG
+        if (wasRegistered)
+            checkDataHash();
+        if (data.size < 1e6)
+            _dataHash = data.hash();
+#endif
+        alloc_slice oldAlloced;
+        uint64_t epoch;
+        {
+            lock_guard<mutex> lock(sMutex);
+            const memoryMap *curMap = sMemoryMap.load();
+            memoryMap *newMap = wasRegistered ? copyMemoryMapWithout(curMap, this, _data) : nullptr;
+            if (!newMap)
+                newMap = curMap ? new memoryMap(*curMap) : new memoryMap;
+            _sk = sk;
+            _externDestination = destination;
+            _olderSegments = move(olderSegments);
+            _data = data;
+            oldAlloced = move(_alloced);
+            _alloced = data;
+            if (data)
+                addToMemoryMap(newMap, this);
+            epoch = publishMemoryMap(newMap);
+            if (data)
+                _unregistered.clear();
         }
+        // Readers that found the old data in the old map may still be using it:
+        if (wasRegistered)
+            waitForReaders(epoch);
     }
 
 
@@ -170,25 +427,52 @@ namespace fleece { namespace impl {
             // Scope doesn't know about mutable Values (they're in the heap), but the mutable
             // Value may be a mutable copy of a Value with scope...
             if (value->asDict())
-                value = value->asDict()->asMutable()->source();
+                value = ((const MutableDict*)value)->source();
             else
-                value = value->asArray()->asMutable()->source();
+                value = ((const MutableArray*)value)->source();
         }
         return value;
     }
 
 
-    /*static*/ __hot const Scope* Scope::_containing(const Value *src) noexcept {
-        // must have sMutex to call this
-        if (_usuallyFalse(!sMemoryMap))
+    static const memEntry* entryContaining(const memoryMap *map, const Value *src) noexcept {
+        // must be inside a memoryMapReader to call this
+        if (_usuallyFalse(!map))
             return nullptr;
-        auto iter = upper_bound(sMemoryMap->begin(), sMemoryMap->end(), memEntry{src, nullptr});
-        if (_usuallyFalse(iter == sMemoryMap->end()))
+        auto iter = upper_bound(map->begin(), map->end(), memEntry{src, nullptr, nullptr, 0});
+        if (_usuallyFalse(iter == map->end()))
             return nullptr;
-        Scope *scope = iter->scope;
-        if (_usuallyFalse(src < scope->_data.buf))
+        if (_usuallyFalse(src < iter->scope->data().buf))
             return nullptr;
-        return scope;
+        return &*iter;
+    }
+
+
+    // Returns the Scope containing `src` if it's in the current thread's cache, else null.
+    __hot static const Scope* cachedScope(const void *src) noexcept {
+        for (auto &entry : tScopeCache.entries) {
+            if (src >= entry.start && src < entry.end && entry.tkt->load() == entry.version)
+                return entry.scope;
+        }
+        return nullptr;
+    }
+
+
+    // Like entryContaining, but returns the Scope, and checks the current thread's cache first.
+    __hot static const Scope* lookupScope(const memoryMapReader &reader, const Value *src) noexcept {
+        counters::count(counters::kScopeLookups);
+        if (auto scope = cachedScope(src); scope)
+            return scope;
+        const memEntry *entry = entryContaining(reader.map(), src);
+        if (!entry)
+            return nullptr;
+        // (If the entry's registration has already ended, its version is out of date, so the
+        // cached copy will never be used.)
+        scopeCache &cache = tScopeCache;
+        cache.entries[cache.next] = {entry->scope->data().buf, entry->endOfRange, entry->scope,
+                                     entry->tkt, entry->version};
+        cache.next = (cache.next + 1) % kScopeCacheSize;
+        return entry->scope;
     }
 
 
@@ -196,31 +480,70 @@ namespace fleece { namespace impl {
         v = resolveMutable(v);
         if (!v)
             return nullptr;
-        lock_guard<mutex> lock(sMutex);
-        return _containing(v);
+        memoryMapReader reader;
+        return lookupScope(reader, v);
     }
 
 
     /*static*/ __hot SharedKeys* Scope::sharedKeys(const Value *v) noexcept {
-        lock_guard<mutex> lock(sMutex);
-        auto scope = _containing(v);
+        memoryMapReader reader;
+        auto scope = lookupScope(reader, v);
         return scope ? scope->sharedKeys() : nullptr;
     }
 
 
-    const Value* Scope::resolveExternPointerTo(const void* dst) const noexcept {
-        dst = offsetby(dst, (char*)_externDestination.end() - (char*)_data.buf);
-        if (_usuallyFalse(!_externDestination.containsAddress(dst)))
+    /*static*/ vector<slice> Scope::segmentsBefore(slice destination) noexcept {
+        vector<slice> segments;
+        if (!destination)
+            return segments;
+        memoryMapReader reader;
+        auto scope = lookupScope(reader, (const Value*)destination.buf);
+        if (scope && scope->_data.buf == destination.buf && scope->_externDestination) {
+            segments.reserve(1 + scope->_olderSegments.size());
+            segments.push_back(scope->_externDestination);
+            segments.insert(segments.end(),
+                            scope->_olderSegments.begin(), scope->_olderSegments.end());
+        }
+        return segments;
+    }
+
+
+    // `dst` is where an extern pointer points if the extern segments were contiguous with, and
+    // just before, my data. So measure how far before my data it is, and find that segment's
+    // corresponding address; usually it's in the extern destination, so this is just an add.
+    __hot const Value* Scope::resolveExternPointerTo(const void* dst,
+                                                     slice *outSegment) const noexcept
+    {
+        if (_usuallyFalse(dst >= _data.buf))
             return nullptr;
-        return (const Value*)dst;
+        size_t back = (const uint8_t*)_data.buf - (const uint8_t*)dst;
+        slice segment = _externDestination;
+        if (_usuallyFalse(back > segment.size)) {
+            back -= segment.size;
+            auto i = _olderSegments.begin();
+            for (; i != _olderSegments.end() && back > i->size; ++i)
+                back -= i->size;
+            if (i == _olderSegments.end())
+                return nullptr;
+            segment = *i;
+        }
+        if (outSegment)
+            *outSegment = segment;
+        return (const Value*)offsetby(segment.end(), -(ptrdiff_t)back);
     }
 
 
-    /*static*/ const Value* Scope::resolvePointerFrom(const internal::Pointer* src,
-                                                      const void *dst) noexcept
+    /*static*/ __hot const Value* Scope::resolvePointerFrom(const internal::Pointer* src,
+                                                            const void *dst) noexcept
     {
-        lock_guard<mutex> lock(sMutex);
-        auto scope = _containing((const Value*)src);
+        // Check the thread's cache first, without a memoryMapReader. That's safe because `src`
+        // is in a live Scope (the caller is reading it), so a cached entry containing it must be
+        // that Scope: had the entry's Scope been unregistered since, its ticket would have
+        // changed and the entry would be ignored.
+        if (auto scope = cachedScope(src); _usuallyTrue(scope != nullptr))
+            return scope->resolveExternPointerTo(dst);
+        memoryMapReader reader;
+        auto scope = lookupScope(reader, (const Value*)src);
         return scope ? scope->resolveExternPointerTo(dst) : nullptr;
     }
 
@@ -228,21 +551,23 @@ namespace fleece { namespace impl {
     /*static*/ pair<const Value*,slice> Scope::resolvePointerFromWithRange(const Pointer* src,
                                                                          const void* dst) noexcept
     {
-        lock_guard<mutex> lock(sMutex);
-        auto scope = _containing((const Value*)src);
+        memoryMapReader reader;
+        auto scope = lookupScope(reader, (const Value*)src);
         if (!scope)
             return { };
-        return {scope->resolveExternPointerTo(dst), scope->externDestination()};
+        slice segment;
+        auto target = scope->resolveExternPointerTo(dst, &segment);
+        return {target, segment};
     }
 
 
     void Scope::dumpAll() {
-        lock_guard<mutex> lock(sMutex);
-        if (_usuallyFalse(!sMemoryMap)) {
+        memoryMapReader reader;
+        if (_usuallyFalse(!reader.map())) {
             fprintf(stderr, "No Scopes have ever been registered.\n");
             return;
         }
-        for (auto &entry : *sMemoryMap) {
+        for (auto &entry : *reader.map()) {
             auto scope = entry.scope;
             fprintf(stderr, "%p -- %p (%4zu bytes) --> SharedKeys[%p]%s\n",
                     scope->_data.buf, scope->_data.end(), scope->_data.size, scope->sharedKeys(),
@@ -261,6 +586,14 @@ namespace fleece { namespace impl {
     }
 
 
+    Doc::Doc(std::unique_ptr<MappedFile> file, Trust trust, SharedKeys *sk) noexcept
+    :Scope(file->contents(), sk)
+    ,_mappedFile(move(file))
+    {
+        init(trust);
+    }
+
+
     Doc::Doc(const Doc *parentDoc, slice subData, Trust trust) noexcept
     :Scope(*parentDoc, subData)
     ,_parent(parentDoc)                         // Ensure parent is retained
@@ -275,9 +608,31 @@ namespace fleece { namespace impl {
         init(trust);
     }
 
+    Doc::Doc(const RefCounted *owner, slice data, Trust trust, SharedKeys *sk,
+             slice destination) noexcept
+    :Scope(data, sk, destination)
+    ,_owner(owner)
+    {
+        init(trust);
+    }
+
+    Doc::~Doc() {
+        // The Scope has to be unregistered before the data goes away with `_mappedFile` or
+        // `_owner`:
+        if (_mappedFile || _owner)
+            unregister();
+        delete _hashCache.load();
+    }
+
+
     void Doc::init(Trust trust) noexcept {
+        tracing::Span span("Doc", data().size);
         if (data() && trust != kDontParse) {
-            _root = trust ? Value::fromTrustedData(data()) : Value::fromData(data());
+            switch (trust) {
+                case kTrusted:              _root = Value::fromTrustedData(data()); break;
+                case kTrustedIfChecksummed: _root = Value::fromChecksummedData(data()); break;
+                default:                    _root = Value::fromData(data()); break;
+            }
             if (!_root)
                 unregister();
         }
@@ -285,6 +640,29 @@ namespace fleece { namespace impl {
     }
 
 
+    void Doc::reinit(const alloc_slice &data, Trust trust, SharedKeys *sk,
+                     slice destination) noexcept
+    {
+        assert_precondition(refCount() == 1);
+        assert_precondition(!_parent && !_mappedFile && !_owner);
+        _root = nullptr;
+        delete _hashCache.exchange(nullptr);
+        retarget(data, sk, destination);
+        init(trust);
+    }
+
+
+    TransientDoc::TransientDoc(const alloc_slice &data, Doc::Trust trust) noexcept
+    :_data(data)
+    {
+        switch (trust) {
+            case Doc::kTrusted:              _root = Value::fromTrustedData(data); break;
+            case Doc::kTrustedIfChecksummed: _root = Value::fromChecksummedData(data); break;
+            default:                         _root = Value::fromData(data); break;
+        }
+    }
+
+
     Retained<Doc> Doc::fromFleece(const alloc_slice &fleece, Trust trust) {
         return new Doc(fleece, trust);
     }
@@ -293,13 +671,216 @@ namespace fleece { namespace impl {
         return new Doc(JSONConverter::convertJSON(json, sk), kTrusted, sk);
     }
 
+    Retained<Doc> Doc::fromJSON(slice json, SharedKeys *sk, ErrorCode &outError) {
+        alloc_slice data = JSONConverter::convertJSON(json, sk, outError);
+        if (!data)
+            return nullptr;
+        return new Doc(data, kTrusted, sk);
+    }
+
+    Retained<Doc> Doc::fromMappedFile(const char *path, Trust trust, SharedKeys *sk) {
+        return new Doc(std::unique_ptr<MappedFile>(new MappedFile(path)), trust, sk);
+    }
+
+    Retained<Doc> Doc::fromSharedMemory(const char *name, Trust trust, SharedKeys *sk) {
+        return new Doc(MappedFile::openSharedMemory(name), trust, sk);
+    }
+
+
+    void Doc::loadFileAsync(const char *path, Trust trust, SharedKeys *sk, LoadCallback callback) {
+        Retained<SharedKeys> retainedSK = sk;
+        AsyncFileIO::shared().readFile(path, [=](alloc_slice data, std::exception_ptr error) {
+            if (error) {
+                callback(nullptr, error);
+                return;
+            }
+            // Get off the I/O completion thread before validating:
+            Executor::current().submit([=] {
+                callback(new Doc(data, trust, retainedSK), nullptr);
+            });
+        });
+    }
+
+    std::future<Retained<Doc>> Doc::loadFileAsync(const char *path, Trust trust, SharedKeys *sk) {
+        auto result = std::make_shared<std::promise<Retained<Doc>>>();
+        loadFileAsync(path, trust, sk, [result](Retained<Doc> doc, std::exception_ptr error) {
+            if (error)
+                result->set_exception(error);
+            else
+                result->set_value(std::move(doc));
+        });
+        return result->get_future();
+    }
+
+
+    // Returns the address range to prefetch for a Value. A subtree isn't necessarily contiguous
+    // (strings may be shared with other subtrees) but since the Encoder writes a collection's
+    // contents before the collection itself, the bulk of it lies between the contents of its
+    // first item and its own end. So `deep` follows the chain of first items that are
+    // collections to find the start, then backs up a page to cover the strings written before
+    // the innermost one. The result is limited to `bounds`, the Doc's data.
+    /*static*/ slice Doc::prefetchRange(const Value *v, bool deep, slice bounds) noexcept {
+        auto start = (const uint8_t*)v, end = start + v->dataSize();
+        for (auto cur = v; cur && bounds.containsAddress(cur); ) {
+            auto type = cur->type();
+            if (type != kArray && type != kDict)
+                break;
+            Array::impl items(cur);
+            if (cur == v) {
+                unsigned slots = items._count * (type == kDict ? 2 : 1);
+                end = (const uint8_t*)offsetby(items._first, slots * items._width);
+            }
+            start = std::min(start, (const uint8_t*)cur);
+            if (!deep || items._count == 0)
+                break;
+            cur = items.deref(type == kDict ? items.second() : items._first);
+        }
+        if (deep)
+            start -= std::min(size_t(4096), size_t(start - (const uint8_t*)bounds.buf));
+        return slice(start, end);
+    }
+
+
+    unsigned Doc::externDepth() const noexcept {
+        return externDestination() ? 1 + unsigned(olderExternSegments().size()) : 0;
+    }
+
+
+    RetainedConst<Doc> Doc::flattened(unsigned maxExternDepth) const {
+        if (!_root || externDepth() <= maxExternDepth)
+            return this;
+        // With no base, the Encoder copies every Value, so nothing points outside the new data:
+        Encoder enc;
+        enc.setSharedKeys(sharedKeys());
+        enc.writeValue(_root);
+        return enc.finishDoc();
+    }
+
+
+    size_t Doc::liveDataSize() const {
+        slice data = this->data();
+        if (!_root || data.size < kNarrow)
+            return 0;
+
+        // One flag per 2-byte unit of the data, since Values are 2-byte aligned. `mark` flags a
+        // Value's range as live, returning false if the Value was already found.
+        vector<bool> live((data.size + 1) / 2);
+        size_t liveBytes = 0;
+        auto mark = [&](const void *start, size_t size) {
+            size_t first = ((const uint8_t*)start - (const uint8_t*)data.buf) / 2;
+            if (live[first])
+                return false;
+            size_t end = std::min(live.size(), first + (size + 1) / 2);
+            for (size_t i = first; i < end; ++i) {
+                if (!live[i]) {
+                    live[i] = true;
+                    liveBytes += 2;
+                }
+            }
+            return true;
+        };
+
+        // The data ends with a pointer to the root, possibly via a wide pointer:
+        auto top = (const Value*)offsetby(data.end(), -kNarrow);
+        mark(top, kNarrow);
+        if (top->isPointer()) {
+            auto dst = top->_asPointer()->deref<false>();
+            if (data.containsAddress(dst) && dst->isPointer())
+                mark(dst, kWide);
+        }
+
+        vector<const Value*> stack {_root};
+        while (!stack.empty()) {
+            const Value *value = stack.back();
+            stack.pop_back();
+            if (!data.containsAddress(value))
+                continue;       // in an extern segment
+            auto tag = value->tag();
+            if (tag < kArrayTag) {
+                mark(value, value->dataSize());
+                continue;
+            }
+            Array::impl coll(value);
+            size_t itemCount = coll._count;
+            if (tag == kDictTag)
+                itemCount *= 2;
+            if (!mark(value, value->dataSize() + itemCount * coll._width))
+                continue;
+            if (tag == kDictTag && coll._count >= DictKeyPrefixes::kMinCount) {
+                // A hash index and/or key prefixes may follow the items:
+                auto trailer = (const Value*)offsetby(coll._first, itemCount * coll._width);
+                for (int i = 0; i < 2; ++i) {
+                    if (!data.containsAddress(trailer)
+                            || trailer->_byte[0] != DictIndex::kHeaderByte)
+                        break;
+                    size_t size = trailer->dataSize();
+                    mark(trailer, size);
+                    trailer = offsetby(trailer, size + (size & 1));
+                }
+            }
+            if (coll._width != kNarrow && coll._width != kWide)
+                continue;       // packed Array: all items are inline
+            // Inline items are covered by the collection's range; follow the pointers:
+            bool wide = (coll._width == kWide);
+            auto item = coll._first;
+            for (size_t i = 0; i < itemCount; ++i, item = offsetby(item, coll._width)) {
+                if (item->isPointer())
+                    stack.push_back(item->deref(wide));
+            }
+        }
+        return liveBytes;
+    }
+
+
+    Retained<Doc> Doc::compact() const {
+        Encoder enc;
+        enc.setSharedKeys(sharedKeys());
+        if (_root)
+            enc.writeValue(_root);
+        return enc.finishDoc();
+    }
+
+
+    /*static*/ void Doc::prefetch(const Value *v, bool deep) noexcept {
+        v = resolveMutable(v);
+        if (!v)
+            return;
+        RetainedConst<Doc> doc = containing(v);
+        if (!doc || !doc->_mappedFile)
+            return;
+        doc->_mappedFile->prefetch(prefetchRange(v, deep, doc->data()));
+    }
+
+
+    uint64_t Doc::hashOf(const Value *v) const {
+        HashCache *cache = _hashCache.load(memory_order_acquire);
+        if (!cache) {
+            auto newCache = new HashCache;
+            if (_hashCache.compare_exchange_strong(cache, newCache, memory_order_acq_rel))
+                cache = newCache;
+            else
+                delete newCache;                // another thread created one first
+        }
+        return v->hash(sharedKeys(), cache);
+    }
+
+
+    size_t Doc::memoryUsage() const noexcept {
+        size_t size = sizeof(Doc) + _olderSegments.capacity() * sizeof(slice);
+        if (_alloced && !_parent && _data == slice(_alloced))
+            size += _alloced.size;
+        if (auto cache = _hashCache.load(memory_order_acquire))
+            size += cache->memoryUsage();
+        return size;
+    }
+
 
     /*static*/ RetainedConst<Doc> Doc::containing(const Value *src) noexcept {
         src = resolveMutable(src);
         if (!src)
             return nullptr;
-        lock_guard<mutex> lock(sMutex);
-        const Scope *scope = _containing(src);
+        memoryMapReader reader;
+        const Scope *scope = lookupScope(reader, src);
         if (!scope)
             return nullptr;
         assert_postcondition(scope->_isDoc);
@@ -6,10 +6,20 @@
 
 #pragma once
 #include "RefCounted.hh"
+#include "Allocator.hh"
 #include "Value.hh"
 #include "fleece/slice.hh"
 #include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
 #include <utility>
+#include <vector>
+
+namespace fleece {
+    class MappedFile;
+}
 
 namespace fleece { namespace impl {
     class SharedKeys;
@@ -43,10 +53,21 @@ namespace fleece { namespace impl {
         SharedKeys* sharedKeys() const FLPURE          {return _sk;}
         slice externDestination() const FLPURE         {return _externDestination;}
 
+        /** The extern segments preceding the extern destination, newest first. Extern pointers
+            can point into these as though they, the destination and this data were contiguous.
+            These are found when the Scope is created: if the destination is the start of another
+            Scope's data, its own destination and older segments are added, and so on. */
+        const std::vector<slice>& olderExternSegments() const FLPURE {return _olderSegments;}
+
+        /** Returns the extern segments that precede the data `destination` in turn, newest
+            first, if it's the start of a registered Scope's data. */
+        static std::vector<slice> segmentsBefore(slice destination) noexcept;
+
         // For internal use:
 
         static SharedKeys* sharedKeys(const Value* NONNULL v) noexcept;
-        const Value* resolveExternPointerTo(const void* NONNULL) const noexcept;
+        const Value* resolveExternPointerTo(const void* NONNULL,
+                                            slice *outSegment =nullptr) const noexcept;
         static const Value* resolvePointerFrom(const internal::Pointer* NONNULL src,
                                                const void* NONNULL dst) noexcept;
         static std::pair<const Value*,slice> resolvePointerFromWithRange(
@@ -54,21 +75,39 @@ namespace fleece { namespace impl {
                                                                          const void* NONNULL dst) noexcept;
         static void dumpAll();
 
+        /** Call this if the data will be filled in gradually after the Scope is created, to
+            disable the debug-build check that it isn't modified while the Scope exists. */
+        void allowDataToChange() noexcept {
+#if DEBUG
+            _dataMayChange = true;
+#endif
+        }
+
     protected:
-        static const Scope* _containing(const Value* NONNULL) noexcept;
         void unregister() noexcept;
 
+        /** Changes the data this Scope represents, unregistering the old data and registering
+            the new in one update of the registry. */
+        void retarget(const alloc_slice &fleeceData,
+                      SharedKeys*,
+                      slice externDestination) noexcept;
+
     private:
         Scope(const Scope&) =delete;
         void registr() noexcept;
+#if DEBUG
+        void checkDataHash() const;
+#endif
 
         Retained<SharedKeys> _sk;                       // SharedKeys used for this Fleece data
-        slice const         _externDestination;         // Extern ptr destination for this data
-        slice const         _data;                      // The memory range I represent
-        alloc_slice const   _alloced;                   // Retains data if it's an alloc_slice
+        slice               _externDestination;         // Extern ptr destination for this data
+        std::vector<slice>  _olderSegments;             // Segments before _externDestination
+        slice               _data;                      // The memory range I represent
+        alloc_slice         _alloced;                   // Retains data if it's an alloc_slice
         std::atomic_flag    _unregistered ATOMIC_FLAG_INIT; // False if registered in sMemoryMap
 #if DEBUG
         uint32_t            _dataHash;                  // hash of _data, for troubleshooting
+        bool                _dataMayChange {false};     // Disables _dataHash check
 #endif
     protected:
         bool                _isDoc {false};             // True if I am a field of a Doc
@@ -79,10 +118,11 @@ namespace fleece { namespace impl {
     /** A container for Fleece data in memory. Every Value belongs to the Doc whose memory range
         contains it. The Doc keeps track of the SharedKeys used by its Dicts, and where to resolve
         external pointers to. */
-    class Doc : public RefCounted, public Scope {
+    class Doc : public RefCounted, public Scope, public heap::Allocated {
     public:
         enum Trust {
             kUntrusted, kTrusted,
+            kTrustedIfChecksummed,      // Trusted if its checksum matches (see Encoder::checksum)
             kDontParse = -1
         };
 
@@ -100,23 +140,153 @@ namespace fleece { namespace impl {
             slice subData,
             Trust =kUntrusted) noexcept;
 
+        /** Creates a Doc on data that's kept alive by another object, `owner`, which the Doc
+            retains. Unlike a sub-Doc, the data gets its own Scope, so it can have its own
+            SharedKeys and extern destination. */
+        Doc(const RefCounted *owner NONNULL,
+            slice fleeceData,
+            Trust,
+            SharedKeys*,
+            slice externDest =nullslice) noexcept;
+
+        /** Makes this Doc use different data, as though it had been created anew with it. This
+            saves allocating a new Doc, and updates the Scope registry once instead of twice, so
+            it's faster when many short-lived Docs are created one after another, for instance
+            by keeping one Doc per thread and reinitializing it for each request.
+            The Doc must not be in use elsewhere, since all Values in its old data become
+            invalid: there must be no other references to it. It can't be a sub-Doc, nor a Doc
+            on a file or on data owned by another object. */
+        void reinit(const alloc_slice &fleeceData,
+                    Trust =kUntrusted,
+                    SharedKeys* =nullptr,
+                    slice externDest =nullslice) noexcept;
+
         static Retained<Doc> fromFleece(const alloc_slice &fleece, Trust =kUntrusted);
         static Retained<Doc> fromJSON(slice json, SharedKeys* =nullptr);
 
+        /** Like the other `fromJSON`, but if the JSON is invalid it returns null and sets
+            `outError` instead of throwing. */
+        static Retained<Doc> fromJSON(slice json, SharedKeys*, ErrorCode &outError);
+
+        /** Creates a Doc by memory-mapping a file of Fleece data, instead of reading it into
+            memory. Opening is O(1) and pages are loaded on demand; the file is unmapped when
+            the Doc is freed, so it mustn't be modified while the Doc exists.
+            Untrusted data is validated, which reads the whole file; pass kTrusted to avoid it. */
+        static Retained<Doc> fromMappedFile(const char *path,
+                                            Trust =kUntrusted,
+                                            SharedKeys* =nullptr);
+
+        /** Creates a Doc on a named shared-memory segment of Fleece data, created by this or
+            another process with \ref MappedFile::createSharedMemory, so that every process on
+            the host shares one copy of the data. Fleece data is position-independent, so it can
+            be mapped at any address. (It mustn't have extern pointers.) As with fromMappedFile,
+            untrusted data is validated, which reads all of it.
+            If the data uses shared keys, each process can share their image the same way; see
+            \ref SharedKeys::useSharedMemoryImage. */
+        static Retained<Doc> fromSharedMemory(const char *name,
+                                              Trust =kUntrusted,
+                                              SharedKeys* =nullptr);
+
+        using LoadCallback = std::function<void(Retained<Doc>, std::exception_ptr)>;
+
+        /** Reads a file of Fleece data asynchronously with \ref AsyncFileIO, so that many files
+            can be loading at once without a thread for each, then creates a Doc on it and
+            passes that to the callback. The Doc is created (and untrusted data validated) as a
+            task on the current Executor. As with \ref fromFleece, the Doc's root is null if
+            the data isn't valid; the callback only gets an exception if reading failed. */
+        static void loadFileAsync(const char *path, Trust, SharedKeys*, LoadCallback);
+
+        /** Like the callback version of loadFileAsync, but returns a future. */
+        static std::future<Retained<Doc>> loadFileAsync(const char *path,
+                                                        Trust =kUntrusted,
+                                                        SharedKeys* =nullptr);
+
         static RetainedConst<Doc> containing(const Value* NONNULL) noexcept;
 
+        /** Advises the OS that a Value is about to be read, if it's in a memory-mapped Doc, so
+            its pages can be loaded in the background instead of faulting in one at a time.
+            If `deep` is false this covers just the Value itself (a collection's header and item
+            slots); if true, its entire subtree. Does nothing for Docs that aren't mapped. */
+        static void prefetch(const Value* NONNULL, bool deep =false) noexcept;
+
+        /** The number of extern segments below this Doc's data: 0 if it has no extern
+            destination, else 1 plus the number of `olderExternSegments()`. */
+        unsigned externDepth() const noexcept;
+
+        /** If `externDepth()` is greater than `maxExternDepth`, re-encodes the contents into a
+            single contiguous segment with no extern pointers, and returns that as a new Doc;
+            otherwise returns this Doc itself. Docs are immutable, so this can be called on a
+            background thread, and the result swapped in for this Doc when it's done. */
+        RetainedConst<Doc> flattened(unsigned maxExternDepth =0) const;
+
+        /** Returns the number of bytes of this Doc's data that are reachable from its root,
+            including collections' trailers. After many amendments much of the rest is usually
+            unreachable garbage; \ref compact will reclaim it. */
+        size_t liveDataSize() const;
+
+        /** Returns the heap memory used by this Doc: the object, its data if it retains an
+            alloc_slice of its own (not a parent's; nor a mapped file, which is paged by the OS),
+            the validation bitmap and the hash cache. Mutable copies of its Values aren't
+            included; see MutableDict::memoryUsage. */
+        size_t memoryUsage() const noexcept;
+
+        /** Returns a new Doc containing only the Values reachable from the root, re-encoded
+            with duplicate strings merged and no extern pointers. (Encoder options such as Dict
+            indexes and packed Arrays aren't preserved.) Like \ref flattened, this can
+            be called on a background thread. */
+        Retained<Doc> compact() const;
+
+        /** Returns the same hash as `Value::hash`, using this Doc's SharedKeys, but caches the
+            hashes of the immutable collections it computes, at every level, so hashing the same
+            Values again is O(1). (Use it on Values in this Doc, or the cache will just fill up
+            with other Docs' Values.) It's thread-safe. */
+        uint64_t hashOf(const Value* NONNULL) const;
+
         const Value* root() const FLPURE               {return _root;}
         const Dict* asDict() const FLPURE              {return _root ? _root->asDict() : nullptr;}
         const Array* asArray() const FLPURE            {return _root ? _root->asArray() : nullptr;}
 
     protected:
-        virtual ~Doc() =default;
+        virtual ~Doc();
 
     private:
+        Doc(std::unique_ptr<MappedFile>, Trust, SharedKeys*) noexcept;
         void init(Trust) noexcept;
+        static slice prefetchRange(const Value*, bool deep, slice bounds) noexcept;
 
         const Value*        _root {nullptr};            // The root object of the Fleece
         RetainedConst<Doc>  _parent;
+        std::unique_ptr<MappedFile> _mappedFile;        // Mapped file containing the data, if any
+        RetainedConst<RefCounted> _owner;               // Object that owns the data, if any
+        mutable std::atomic<internal::HashCache*> _hashCache {nullptr}; // Created by hashOf
+    };
+
+
+    /** A lightweight alternative to Doc, for short-lived reads of data that has no extern
+        pointers and doesn't use SharedKeys. Like a Doc it retains and (unless trusted) validates
+        the data, but it can live on the stack and it isn't registered as a Scope, which saves a
+        heap allocation and two updates of the Scope registry.
+        The catch is that its Values have no Scope: Doc::containing returns null for them, they
+        can't be retained, and Dicts with integer keys can't be looked up. Data with extern
+        pointers is invalid, unless trusted (in which case reading them is undefined.) */
+    class TransientDoc {
+    public:
+        /** Uses the data, which is validated unless `trust` is kTrusted (or kTrustedIfChecksummed
+            and the checksum matches.) */
+        explicit TransientDoc(const alloc_slice &fleeceData,
+                              Doc::Trust trust =Doc::kUntrusted) noexcept;
+
+        slice data() const FLPURE                      {return _data;}
+        const Value* root() const FLPURE               {return _root;}
+        const Dict* asDict() const FLPURE              {return _root ? _root->asDict() : nullptr;}
+        const Array* asArray() const FLPURE            {return _root ? _root->asArray() : nullptr;}
+
+    private:
+        TransientDoc(const TransientDoc&) =delete;
+        TransientDoc& operator=(const TransientDoc&) =delete;
+
+        alloc_slice const   _data;
+        const Value*        _root;
     };
 
 } }
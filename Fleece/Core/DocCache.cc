@@ -0,0 +1,215 @@
+//
+// DocCache.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "DocCache.hh"
+#include "betterassert.hh"
+#include <string.h>
+
+// Both wyhash headers declare a `wyrand()` function, so use a namespace to prevent collision.
+namespace fleece::impl::wy {
+    #include "wyhash.h"
+}
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+    // An ID key and a content key can never be equal, since they start with different bytes.
+    static constexpr char kIDKeyPrefix = 'i', kContentKeyPrefix = 'c';
+
+    // Approximate heap overhead of an entry: the list node, the index node and bucket.
+    static constexpr size_t kItemOverhead = 96;
+
+
+    DocCache::DocCache(size_t byteBudget, unsigned shardCount)
+    :_shards(new Shard[max(shardCount, 1u)])
+    ,_shardCount(max(shardCount, 1u))
+    ,_shardBudget(byteBudget / _shardCount)
+    { }
+
+
+    /*static*/ string DocCache::idKey(slice id) {
+        string key;
+        key.reserve(1 + id.size);
+        key += kIDKeyPrefix;
+        key.append((const char*)id.buf, id.size);
+        return key;
+    }
+
+
+    DocCache::Shard& DocCache::shardFor(const string &key) {
+        uint64_t h = wy::wyhash(key.data(), key.size(), 0, wy::_wyp);
+        return _shards[h % _shardCount];
+    }
+
+
+    // Looks up a key, and if `data` is given, checks that the Doc found has the same data.
+    DocCache::Entry DocCache::lookup(const string &key, const alloc_slice *data) {
+        Shard &shard = shardFor(key);
+        {
+            lock_guard<mutex> lock(shard.mutex);
+            auto i = shard.index.find(slice(key));
+            if (i != shard.index.end() && (!data || i->second->entry.doc->data() == *data)) {
+                shard.items.splice(shard.items.begin(), shard.items, i->second);
+                ++_hits;
+                return i->second->entry;
+            }
+        }
+        ++_misses;
+        return {};
+    }
+
+
+    // Adds an entry, unless `replace` is false and the key is already present, in which case
+    // it returns the existing entry's Doc.
+    Retained<Doc> DocCache::insert(string key, Entry entry, size_t nativeSize, bool replace) {
+        size_t size = kItemOverhead + key.size() + entry.doc->memoryUsage() + nativeSize;
+        Shard &shard = shardFor(key);
+        LRUList evicted;            // Freed after unlocking, since freeing Docs takes time
+        lock_guard<mutex> lock(shard.mutex);
+        if (auto i = shard.index.find(slice(key)); i != shard.index.end()) {
+            if (!replace) {
+                shard.items.splice(shard.items.begin(), shard.items, i->second);
+                return i->second->entry.doc;
+            }
+            shard.bytes -= i->second->size;
+            evicted.splice(evicted.end(), shard.items, i->second);
+            shard.index.erase(i);
+        }
+        shard.items.push_front({move(key), move(entry), size});
+        Item &item = shard.items.front();
+        shard.index.emplace(slice(item.key), shard.items.begin());
+        shard.bytes += size;
+        while (shard.bytes > _shardBudget && shard.items.size() > 1) {
+            // Evict the least recently used entries, but never the one just added:
+            auto last = prev(shard.items.end());
+            shard.index.erase(slice(last->key));
+            shard.bytes -= last->size;
+            evicted.splice(evicted.end(), shard.items, last);
+        }
+        return item.entry.doc;
+    }
+
+
+    DocCache::Entry DocCache::getEntry(slice id) {
+        return lookup(idKey(id), nullptr);
+    }
+
+
+    Retained<Doc> DocCache::put(slice id, Retained<Doc> doc,
+                                shared_ptr<void> native, size_t nativeSize)
+    {
+        assert_precondition(doc);
+        return insert(idKey(id), {move(doc), move(native)}, nativeSize, true);
+    }
+
+
+    Retained<Doc> DocCache::getOrCreate(slice id, function_ref<Retained<Doc>()> create) {
+        string key = idKey(id);
+        if (Entry entry = lookup(key, nullptr))
+            return entry.doc;
+        Retained<Doc> doc = create();
+        if (!doc)
+            return nullptr;
+        return insert(move(key), {move(doc), nullptr}, 0, false);
+    }
+
+
+    Retained<Doc> DocCache::getOrCreateFromData(const alloc_slice &fleeceData,
+                                                Doc::Trust trust, SharedKeys *sk)
+    {
+        uint64_t hash = wy::wyhash(fleeceData.buf, fleeceData.size, 0, wy::_wyp);
+        string key(1, kContentKeyPrefix);
+        key.append((const char*)&hash, sizeof(hash));
+        if (Entry entry = lookup(key, &fleeceData))
+            return entry.doc;
+        Retained<Doc> doc = new Doc(fleeceData, trust, sk);
+        if (!doc->root())
+            return nullptr;
+        Retained<Doc> result = insert(key, {doc, nullptr}, 0, false);
+        if (result->data() != fleeceData) {
+            // Another thread added a Doc for different data with the same hash; replace it:
+            result = insert(move(key), {move(doc), nullptr}, 0, true);
+        }
+        return result;
+    }
+
+
+    bool DocCache::setNative(slice id, const Doc *doc, shared_ptr<void> native, size_t nativeSize) {
+        string key = idKey(id);
+        Shard &shard = shardFor(key);
+        lock_guard<mutex> lock(shard.mutex);
+        auto i = shard.index.find(slice(key));
+        if (i == shard.index.end() || i->second->entry.doc != doc)
+            return false;
+        Item &item = *i->second;
+        size_t size = kItemOverhead + item.key.size() + doc->memoryUsage() + nativeSize;
+        shard.bytes = shard.bytes - item.size + size;
+        item.size = size;
+        swap(item.entry.native, native);    // (the old native object is freed after unlocking)
+        return true;
+    }
+
+
+    bool DocCache::remove(slice id) {
+        string key = idKey(id);
+        Shard &shard = shardFor(key);
+        LRUList removed;
+        lock_guard<mutex> lock(shard.mutex);
+        auto i = shard.index.find(slice(key));
+        if (i == shard.index.end())
+            return false;
+        shard.bytes -= i->second->size;
+        removed.splice(removed.end(), shard.items, i->second);
+        shard.index.erase(i);
+        return true;
+    }
+
+
+    void DocCache::clear() {
+        for (unsigned s = 0; s < _shardCount; ++s) {
+            Shard &shard = _shards[s];
+            LRUList removed;
+            lock_guard<mutex> lock(shard.mutex);
+            shard.index.clear();
+            removed.swap(shard.items);
+            shard.bytes = 0;
+        }
+    }
+
+
+    size_t DocCache::count() const {
+        size_t n = 0;
+        for (unsigned s = 0; s < _shardCount; ++s) {
+            lock_guard<mutex> lock(_shards[s].mutex);
+            n += _shards[s].items.size();
+        }
+        return n;
+    }
+
+
+    size_t DocCache::bytesUsed() const {
+        size_t n = 0;
+        for (unsigned s = 0; s < _shardCount; ++s) {
+            lock_guard<mutex> lock(_shards[s].mutex);
+            n += _shards[s].bytes;
+        }
+        return n;
+    }
+
+} }
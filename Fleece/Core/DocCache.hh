@@ -0,0 +1,136 @@
+//
+// DocCache.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Doc.hh"
+#include "function_ref.hh"
+#include "fleece/slice.hh"
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fleece { namespace impl {
+    class SharedKeys;
+
+
+    /** A thread-safe cache of Docs, so that documents that are opened again and again are
+        only allocated, validated and registered once. Entries are keyed either by an ID the
+        caller chooses, or by the content of the Fleece data (see \ref getOrCreateFromData).
+
+        The cache is limited to a byte budget, counted with Doc::memoryUsage (as of when a Doc
+        was added) plus the size of each entry's native object, if any. It's divided into
+        shards, each with its own lock, its own share of the budget, and its own least-recently-
+        used list; when a shard goes over budget, it evicts its least recently used entries.
+        Evicted Docs stay alive as long as callers still retain them.
+
+        An entry can also hold a "native" object the caller built from the Doc, such as the
+        tree of platform objects an MRoot produces, so that it's built only once too. The cache
+        just keeps it alive; since it's shared between threads, it should be immutable. */
+    class DocCache {
+    public:
+        /** A cached Doc, and its native object if any. */
+        struct Entry {
+            Retained<Doc>           doc;
+            std::shared_ptr<void>   native;
+            explicit operator bool() const          {return doc != nullptr;}
+        };
+
+        static constexpr unsigned kDefaultShardCount = 16;
+
+        explicit DocCache(size_t byteBudget, unsigned shardCount =kDefaultShardCount);
+
+        DocCache(const DocCache&) =delete;
+
+        /** The Doc cached under an ID, or null. A hit makes it the most recently used. */
+        Retained<Doc> get(slice id)                 {return getEntry(id).doc;}
+
+        /** The Doc and native object cached under an ID, or an empty Entry. */
+        Entry getEntry(slice id);
+
+        /** Adds a Doc (and optionally a native object, whose heap size is `nativeSize`) under
+            an ID, replacing any entry with that ID. Returns the Doc. */
+        Retained<Doc> put(slice id, Retained<Doc>,
+                          std::shared_ptr<void> native =nullptr, size_t nativeSize =0);
+
+        /** Returns the Doc cached under an ID; or if there is none, calls `create` and adds the
+            Doc it returns (unless it's null.) The cache isn't locked while `create` runs, so two
+            threads missing the same ID may both create a Doc; then the one added first wins, and
+            both get it. If `create` throws, nothing is added. */
+        Retained<Doc> getOrCreate(slice id, function_ref<Retained<Doc>()> create);
+
+        /** Returns the Doc cached for Fleece data with the same content as `fleeceData`, or else
+            creates a Doc on it with the given trust and SharedKeys and adds it. The key is a
+            hash of the data; a hit is checked by comparing the data, so a hash collision is
+            just a miss. Returns null if the data isn't valid Fleece (which isn't cached.) */
+        Retained<Doc> getOrCreateFromData(const alloc_slice &fleeceData,
+                                          Doc::Trust =Doc::kUntrusted,
+                                          SharedKeys* =nullptr);
+
+        /** Adds a native object to the entry for an ID, which must have the given Doc.
+            Returns false if there's no such entry (as when it's been evicted.) */
+        bool setNative(slice id, const Doc* NONNULL,
+                       std::shared_ptr<void> native, size_t nativeSize);
+
+        /** Removes the entry for an ID. Returns false if there was none. */
+        bool remove(slice id);
+
+        /** Removes all entries. */
+        void clear();
+
+        size_t byteBudget() const                   {return _shardBudget * _shardCount;}
+
+        /** The number of entries. */
+        size_t count() const;
+
+        /** The bytes counted against the budget by all the entries. */
+        size_t bytesUsed() const;
+
+        uint64_t hits() const                       {return _hits.load(std::memory_order_relaxed);}
+        uint64_t misses() const                     {return _misses.load(std::memory_order_relaxed);}
+
+    private:
+        struct Item {
+            std::string             key;
+            Entry                   entry;
+            size_t                  size;
+        };
+        using LRUList = std::list<Item>;        // Most recently used first
+
+        struct alignas(64) Shard {
+            mutable std::mutex      mutex;
+            LRUList                 items;
+            std::unordered_map<slice, LRUList::iterator> index;    // Keys point into `items`
+            size_t                  bytes {0};
+        };
+
+        static std::string idKey(slice id);
+        Shard& shardFor(const std::string &key);
+        Entry lookup(const std::string &key, const alloc_slice *data);
+        Retained<Doc> insert(std::string key, Entry, size_t nativeSize, bool replace);
+        void evict(Shard&, const Item *keep);
+
+        std::unique_ptr<Shard[]>    _shards;
+        unsigned                    _shardCount;
+        size_t                      _shardBudget;
+        std::atomic<uint64_t>       _hits {0}, _misses {0};
+    };
+
+} }
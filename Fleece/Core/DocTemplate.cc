@@ -0,0 +1,95 @@
+//
+// DocTemplate.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "DocTemplate.hh"
+#include "FleeceException.hh"
+#include "Internal.hh"
+#include "Pointer.hh"
+#include "Endian.hh"
+#include "varint.hh"
+#include <string.h>
+
+namespace fleece { namespace impl {
+    using namespace internal;
+
+
+    DocTemplate::DocTemplate(alloc_slice data, std::vector<Placeholder> placeholders)
+    :_data(std::move(data))
+    ,_placeholders(std::move(placeholders))
+    { }
+
+
+    // Size of a string Value, including its padding byte if any.
+    static size_t encodedStringSize(slice s) {
+        size_t size = 1 + s.size;
+        if (s.size >= 0x0F)
+            size += SizeOfVarInt(s.size);
+        return size + (size & 1);
+    }
+
+
+    alloc_slice DocTemplate::instantiate(const Arg args[], size_t nArgs) const {
+        throwIf(nArgs != _placeholders.size(), InvalidData,
+                "wrong number of values for the template's placeholders");
+        size_t prefixSize = 0;
+        for (size_t i = 0; i < nArgs; ++i) {
+            if (_placeholders[i].type == kStringPlaceholder)
+                prefixSize += encodedStringSize(args[i].stringValue);
+        }
+
+        alloc_slice result(prefixSize + _data.size);
+        auto out = (uint8_t*)result.buf;
+        memcpy(out + prefixSize, _data.buf, _data.size);
+
+        size_t stringPos = 0;
+        for (size_t i = 0; i < nArgs; ++i) {
+            const Placeholder &ph = _placeholders[i];
+            uint8_t *dst = out + prefixSize + ph.offset;
+            switch (ph.type) {
+                case kIntPlaceholder: {
+                    uint64_t n = endian::encLittle64(uint64_t(args[i].intValue));
+                    memcpy(dst + 1, &n, sizeof(n));
+                    break;
+                }
+                case kDoublePlaceholder: {
+                    endian::littleEndianDouble d = args[i].doubleValue;
+                    memcpy(dst + 2, &d, sizeof(d));
+                    break;
+                }
+                case kStringPlaceholder: {
+                    slice s = args[i].stringValue;
+                    uint8_t *str = out + stringPos;
+                    size_t size = encodedStringSize(s);
+                    str[size - 1] = 0;                  // padding, unless the string overwrites it
+                    if (s.size < 0x0F) {
+                        *str++ = uint8_t((kStringTag << 4) | s.size);
+                    } else {
+                        *str++ = uint8_t((kStringTag << 4) | 0x0F);
+                        str += PutUVarInt(str, s.size);
+                    }
+                    memcpy(str, s.buf, s.size);
+                    Pointer::writeFarPointer(dst, (prefixSize + ph.offset) - stringPos);
+                    stringPos += size;
+                    break;
+                }
+            }
+        }
+        return result;
+    }
+
+} }
@@ -0,0 +1,72 @@
+//
+// DocTemplate.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include <stdint.h>
+#include <vector>
+
+namespace fleece { namespace impl {
+
+
+    /** Encoded Fleece data with placeholders for scalar values, from Encoder::finishTemplate.
+        Instantiating it copies the data and stores values into the placeholders, which is much
+        cheaper than encoding a document of the same shape again.
+        A number placeholder is a full-width out-of-line number, so any value fits in it. A string
+        placeholder is a far pointer, and the strings are written ahead of the copy, since Fleece
+        pointers only point backwards. */
+    class DocTemplate {
+    public:
+        enum PlaceholderType : uint8_t {
+            kIntPlaceholder,
+            kDoublePlaceholder,
+            kStringPlaceholder,
+        };
+
+        struct Placeholder {
+            PlaceholderType type;
+            uint32_t        offset;         // Position of its Value in the data
+        };
+
+        /** A value to store in a placeholder; only the field matching its type is used.
+            (Same layout as FLTemplateValue.) */
+        struct Arg {
+            int64_t intValue;
+            double  doubleValue;
+            slice   stringValue;
+        };
+
+        DocTemplate() = default;
+        DocTemplate(alloc_slice data, std::vector<Placeholder> placeholders);
+
+        /** The encoded data, with unfilled placeholders. */
+        slice data() const                              {return _data;}
+
+        size_t count() const                            {return _placeholders.size();}
+        const Placeholder& placeholder(size_t i) const  {return _placeholders.at(i);}
+
+        /** Returns a new document: a copy of the data with the placeholders filled in from
+            `args`, which must have one item per placeholder, in the order they were written. */
+        alloc_slice instantiate(const Arg args[], size_t nArgs) const;
+
+    private:
+        alloc_slice              _data;
+        std::vector<Placeholder> _placeholders;
+    };
+
+} }
@@ -21,14 +21,25 @@
 #include "Pointer.hh"
 #include "SharedKeys.hh"
 #include "MutableDict.hh"
+#include "HeapArray.hh"
 #include "Endian.hh"
+#include "Counters.hh"
+#include "CRC32C.hh"
 #include "varint.hh"
 #include "FleeceException.hh"
 #include "ParseDate.hh"
 #include "PlatformCompat.hh"
 #include "TempArray.hh"
+#include "Tracing.hh"
+#include "DictIndex.hh"
+#include "ValueHash.hh"
+#include "PostingList.hh"
+#include "AccessProfile.hh"
+#include "AsyncFileIO.hh"
+#include "Executor.hh"
 #include <algorithm>
 #include <cmath>
+#include <unordered_set>
 #include <float.h>
 #include <stdlib.h>
 #include "betterassert.hh"
@@ -42,6 +53,12 @@ namespace fleece { namespace impl {
     const slice Encoder::kPreEncodedNull  = {Value::kNullValue,  kNarrow};
     const slice Encoder::kPreEncodedEmptyDict = {Dict::kEmpty,   kNarrow};
 
+    // Kinds of numbers in `_pendingNumbers` (see "PACKED ARRAYS" below)
+    enum : uint8_t {kPendingInt, kPendingUInt, kPendingFloat, kPendingDouble};
+
+    static inline uint64_t bitsOf(double d)    {uint64_t bits; memcpy(&bits, &d, 8); return bits;}
+    static inline double doubleOf(uint64_t b)  {double d; memcpy(&d, &b, 8); return d;}
+
     Encoder::Encoder(size_t reserveSize)
     :_out(reserveSize),
      _stack(kInitialStackSize),
@@ -58,13 +75,29 @@ namespace fleece { namespace impl {
         init();
     }
 
+    Encoder::Encoder(Writer::OutputSink sink, size_t bufferSize)
+    :_out(std::move(sink), bufferSize),
+     _stack(kInitialStackSize),
+     _strings(20)
+    {
+        init();
+    }
+
+    Encoder::Encoder(slice buffer, Writer::GrowBufferCallback grow)
+    :_out(buffer, std::move(grow)),
+     _stack(kInitialStackSize),
+     _strings(20)
+    {
+        init();
+    }
+
     Encoder::~Encoder() =default;
 
     void Encoder::init() {
         // Initial state has a placeholder collection on the stack, which will contain the real
         // root value.
         resetStack();
-        _items->reset(kSpecialTag);
+        _items->reset(kSpecialTag, false);
         _items->reserve(1);
     }
 
@@ -73,23 +106,89 @@ namespace fleece { namespace impl {
         _stackDepth = 1;
     }
 
+    void Encoder::retainBuffers(bool b) {
+        _retainBuffers = b;
+        _out.retainCapacity(b);
+        _stringStorage.retainCapacity(b);
+        if (!b) {
+            _sortIndices = {};
+            _sortItems = {};
+            _sortKeys = {};
+        }
+    }
+
+    void Encoder::resetOptions() {
+        _uniqueStrings = true;
+        _uniqueCollections = false;
+        _indexLargeDicts = false;
+        _prefixDictKeys = false;
+        _packNumericArrays = false;
+        _maxDictParentDepth = 0;
+        _checksum = false;
+        _alignNumbers = false;
+        _avoidWideCollections = false;
+        _keyHeat.clear();
+        _snipChunkSize = 0;
+        _snipCallback = nullptr;
+        _embedHashes = false;
+        _canonical = false;
+        _trailer = true;
+        _sharedKeys = nullptr;
+        setSharedStrings(nullptr);
+    }
+
     void Encoder::reset() {
-        if (_items)
-            _items->clear();
-        _out.reset();
         _strings.clear();
         _stringStorage.reset();
+        resetExceptStrings();
+    }
+
+    void Encoder::resetExceptStrings() {
+        _out.reset();
+        _uniqueValues.clear();
+        _pendingNumbers.clear();
+        _stringsEnd = 0;
         _writingKey = _blockedOnKey = false;
+        // Clear every level, since reset() may be called with collections still open, or after
+        // finishing without a trailer (which leaves the root item in place):
+        for (auto &items : _stack)
+            clearItems(&items);
         resetStack();
+        _checksumPos = -1;
+        _farPositions.clear();
+        _placeholders.clear();
+        _collectionStats = {};
+        _snippedItems = 0;
         setBase(nullslice);
+        _snippedParts.clear();
+        if (_sharedStrings)
+            setBase(_sharedStrings->data(), true);
+    }
+
+    void Encoder::canonical(bool b) {
+        throwIf(b && _base, EncodeError, "Canonical encoding can't be used with a base");
+        _canonical = b;
     }
 
     void Encoder::setSharedKeys(SharedKeys *s) {
         _sharedKeys = s;
     }
 
+    void Encoder::setSharedStrings(SharedStrings *s) {
+        if (s == _sharedStrings)
+            return;
+        if (_sharedStrings)
+            setBase(nullslice);
+        _sharedStrings = nullptr;
+        if (s) {
+            setBase(s->data(), true);
+            _sharedStrings = s;
+        }
+    }
+
     void Encoder::setBase(slice base, bool markExternPointers, size_t cutoff) {
         throwIf(_base && base, EncodeError, "There's already a base");
+        throwIf(_canonical && base, EncodeError, "Canonical encoding can't be used with a base");
         _base = base;
         _ownedBase = nullslice;
         _baseCutoff = nullptr;
@@ -98,7 +197,21 @@ namespace fleece { namespace impl {
             _baseCutoff = (char*)base.end() - cutoff;
         }
         _baseMinUsed = _base.end();
+        _stringsCoverBase = !base;
         _markExternPtrs = markExternPointers;
+        _olderSegments.clear();
+        _olderSegmentsSize = 0;
+    }
+
+    void Encoder::useOlderExternSegments() {
+        throwIf(!_base || !_markExternPtrs || _baseCutoff, EncodeError,
+                "Older extern segments need a base with extern pointers and no cutoff");
+        throwIf(_out.length() > 0 || _strings.count() > 0, EncodeError,
+                "Older extern segments must be used before anything is written");
+        _olderSegments = Scope::segmentsBefore(_base);
+        _olderSegmentsSize = 0;
+        for (slice segment : _olderSegments)
+            _olderSegmentsSize += segment.size;
     }
 
     void Encoder::end() {
@@ -108,6 +221,11 @@ namespace fleece { namespace impl {
         throwIf(_items->size() > 1, EncodeError, "top level must have only one value");
 
         if (_trailer && !_items->empty()) {
+            if (_alignNumbers)
+                writeAlignedMarker();
+            if (_checksum)
+                writeChecksumBlock();
+            writeFarPointers(_items);
             checkPointerWidths(_items, nextWritePos());
             fixPointers(_items);
             Value &root = (*_items)[0];
@@ -119,9 +237,16 @@ namespace fleece { namespace impl {
             } else {
                 _out.write(&root, kNarrow);
             }
-            _items->clear();
+            clearItems(_items);
         }
         _out.flush();
+        counters::count(counters::kEncodedBytes, _out.length());
+        // If the output is appended to the base, the string table will cover the result:
+        if (_stringsCoverBase && _uniqueStrings && !_markExternPtrs && !_baseCutoff
+                && !_sharedStrings)
+            _stringsEnd = _base.size + _out.length();
+        _farPositions.clear();
+        _placeholders.clear();
         // Go to "finished" state, where stack is empty:
         _items = nullptr;
         _stackDepth = 0;
@@ -134,24 +259,141 @@ namespace fleece { namespace impl {
         size_t itemPos;
         const Value *item = &(*_items)[0];
         if (item->isPointer()) {
-            itemPos = item->_asPointer()->offset<true>() - _base.size;
+            itemPos = itemPointerPos(*item);
         } else {
             itemPos = nextWritePos();
             _out.write(item, (_items->wide ? kWide : kNarrow));
         }
-        _items->clear();
+        clearItems(_items);
         resetStack();
+        _farPositions.clear();
         return itemPos;
     }
 
     alloc_slice Encoder::finish() {
+        tracing::Span span("Encoder::finish", _out.length());
         end();
         alloc_slice out = _out.finish();
         if (out.size == 0)
             out.reset();
+        fillInChecksum(out);
+        span.setOutputSize(out.size);
         return out;
     }
 
+    slice Encoder::finishInPlace() {
+        throwIf(!_out.hasExternalBuffer(), EncodeError, "Encoder has no external buffer");
+        end();
+        slice out = _out.finishInPlace();
+        fillInChecksum(out);
+        return out;
+    }
+
+    void Encoder::finishTo(const Writer::OutputSink &sink) {
+        throwIf(_out.isStreaming(), EncodeError, "Encoder is already writing to a file or sink");
+        end();
+        auto chunks = _out.output();
+        fillInChecksum(chunks);
+        for (slice chunk : chunks)
+            sink(chunk);
+        _out.reset();
+    }
+
+    void Encoder::finishToFileAsync(const char *path,
+                                    std::function<void(std::exception_ptr)> callback)
+    {
+        throwIf(_out.isStreaming(), EncodeError, "Encoder is already writing to a file or sink");
+        AsyncFileIO::shared().writeFile(finish(), path, std::move(callback));
+    }
+
+    std::future<void> Encoder::finishToFileAsync(const char *path) {
+        throwIf(_out.isStreaming(), EncodeError, "Encoder is already writing to a file or sink");
+        return AsyncFileIO::shared().writeFile(finish(), path);
+    }
+
+    bool Encoder::finishToFD(int fd) {
+        throwIf(_out.isStreaming(), EncodeError, "Encoder is already writing to a file or sink");
+        end();
+        fillInChecksum(_out.output());
+        bool ok = _out.writeOutputToFD(fd);
+        _out.reset();
+        return ok;
+    }
+
+    // A checksummed document has a block just before its trailer: a 7-byte binary Value whose
+    // first 3 bytes are "CRC" and the rest the CRC-32C of all the other bytes of the data. Since
+    // that includes the trailer, the block is written with a zero CRC, which is filled in once
+    // the data is finished. The root has to be a pointer, to skip over the block.
+    void Encoder::writeChecksumBlock() {
+        throwIf(_out.isStreaming(), EncodeError, "Can't write a checksum when writing to a file");
+        writeRootOutOfLine();
+        _checksumPos = nextWritePos();
+        uint8_t block[kChecksumSize] = { };
+        memcpy(block, kChecksumHeader, sizeof(kChecksumHeader));
+        _out.write(block, sizeof(block));
+    }
+
+    // Writes an inline root Value before the blocks that precede the trailer, so that the
+    // trailer can point to it.
+    void Encoder::writeRootOutOfLine() {
+        Value &root = (*_items)[0];
+        if (!root.isPointer()) {
+            size_t pos = nextWritePos();
+            _out.write(&root, _items->wide ? kWide : kNarrow);
+            setItemPointer(root, pos);
+        }
+    }
+
+    // Data written with alignNumbers is marked by a block before the trailer (and checksum.)
+    void Encoder::writeAlignedMarker() {
+        writeRootOutOfLine();
+        nextWritePos();
+        _out.write(kAlignedMarker, sizeof(kAlignedMarker));
+    }
+
+    void Encoder::fillInChecksum(slice out) {
+        if (_checksumPos < 0)
+            return;
+        auto crcPos = (uint8_t*)out.buf + _checksumPos + sizeof(kChecksumHeader);
+        assert(out.containsAddressRange(slice(crcPos, 4)));
+        uint32_t crc = crc32c(slice(out.buf, crcPos));
+        endian::uint32_le stored = crc32c(slice(crcPos + 4, out.end()), crc);
+        memcpy(crcPos, &stored, sizeof(stored));
+        _checksumPos = -1;
+    }
+
+    // The same, when the output is still in the Writer's chunks. The checksum block is written
+    // in one piece, so it's in a single chunk.
+    void Encoder::fillInChecksum(const std::vector<slice> &chunks) {
+        if (_checksumPos < 0)
+            return;
+        size_t crcOffset = _checksumPos + sizeof(kChecksumHeader), pos = 0;
+        uint8_t *crcPos = nullptr;
+        uint32_t crc = 0;
+        for (slice chunk : chunks) {
+            if (!crcPos && crcOffset >= pos && crcOffset < pos + chunk.size) {
+                crcPos = (uint8_t*)chunk.buf + (crcOffset - pos);
+                assert(chunk.containsAddressRange(slice(crcPos, 4)));
+                crc = crc32c(slice(chunk.buf, crcPos), crc);
+                crc = crc32c(slice(crcPos + 4, chunk.end()), crc);
+            } else {
+                crc = crc32c(chunk, crc);
+            }
+            pos += chunk.size;
+        }
+        assert(crcPos);
+        endian::uint32_le stored = crc;
+        memcpy(crcPos, &stored, sizeof(stored));
+        _checksumPos = -1;
+    }
+
+    DocTemplate Encoder::finishTemplate() {
+        // (end() clears _placeholders, so take them first)
+        auto placeholders = std::move(_placeholders);
+        _placeholders.clear();
+        return DocTemplate(finish(), std::move(placeholders));
+    }
+
     Retained<Doc> Encoder::finishDoc() {
         Retained<Doc> doc = new Doc(finish(),
                                     Doc::kTrusted,
@@ -169,36 +411,109 @@ namespace fleece { namespace impl {
     // Returns an opaque reference to the last value written, but not if it's inline.
     Encoder::PreWrittenValue Encoder::lastValueWritten() const {
         if (!_items->empty())
-            if (auto ptr = _items->back()._asPointer(); ptr->isPointer())
-                return PreWrittenValue(ptr->offset<true>());
+            if (auto &item = _items->back(); item.isPointer())
+                return PreWrittenValue(baseOrigin() + itemPointerPos(item));
         return PreWrittenValue::none;
     }
 
     // Writes a pointer to an already-written value, allowing it to appear twice without overhead.
     void Encoder::writeValueAgain(PreWrittenValue pos) {
         throwIf(pos == PreWrittenValue::none, EncodeError, "Can't rewrite an inline Value");
-        writePointer(ssize_t(pos) - _base.size);
+        throwIf(_canonical, EncodeError, "Can't rewrite a Value in canonical encoding");
+        writePointer(ssize_t(pos) - baseOrigin());
+        _items->hashable = false;               // (its hash isn't known)
     }
 
 
     alloc_slice Encoder::snip() {
-        throwIf(_base, EncodeError, "Can't snip when there's already a base");
+        throwIf(_base && _base.buf != _ownedBase.buf, EncodeError,
+                "Can't snip when there's already a base");
         // Find the last value that was written:
         auto pos = lastValueWritten();
         if (pos == PreWrittenValue::none)
             return nullslice;
+        return snipAt(pos);
+    }
 
-        // Write a pointer to it, to form the top of the snipped document:
-        auto offset = _out.length() - ssize_t(pos);
-        new (_out.reserveSpace(kNarrow)) Pointer(offset, kNarrow);
-
-        // Collect what's been written so far and return a copy:
+    // Writes a pointer to `root`, to form the top of a snipped document, then returns what's
+    // been written so far and makes it the base of what follows.
+    alloc_slice Encoder::snipAt(PreWrittenValue root) {
+        size_t here = baseOrigin() + nextWritePos();
+        size_t rootPos = size_t(root);
+        bool external = (rootPos < baseOrigin());
+        size_t offset = here - rootPos;
+        if (offset <= Pointer::kMaxNarrowOffset) {
+            new (_out.reserveSpace(kNarrow)) Pointer(offset, kNarrow, external);
+        } else {
+            // As in end(), a wide pointer followed by a narrow one to it:
+            new (_out.reserveSpace(kWide)) Pointer(offset, kWide, external);
+            new (_out.reserveSpace(kNarrow)) Pointer(kWide, kNarrow);
+        }
         alloc_slice result = _out.finish();
+
+        // The previous base becomes the newest of the older segments:
+        std::vector<slice> older;
+        if (_base) {
+            older.push_back(_base);
+            older.insert(older.end(), _olderSegments.begin(), _olderSegments.end());
+            _snippedParts.push_back(_ownedBase);
+        }
+        setBase(nullslice);
         setBase(result, true);
         _ownedBase = result;
+        for (slice segment : older)
+            _olderSegmentsSize += segment.size;
+        _olderSegments = std::move(older);
         return result;
     }
 
+    void Encoder::snipEvery(size_t chunkSize, ChunkCallback callback) {
+        assert_precondition(chunkSize == 0 || callback);
+        _snipChunkSize = chunkSize;
+        _snipCallback = chunkSize ? std::move(callback) : nullptr;
+    }
+
+    // Called between items of the top-level collection when the output has reached the chunk
+    // size. Writes a collection of the items completed since the last chunk, and snips there.
+    void Encoder::snipProgressively() {
+        valueArray *top = &_stack[1];
+        if (_usuallyFalse(top->packing))
+            stopPacking();
+        size_t begin = _snippedItems, end = top->size();
+        if (end <= begin)
+            return;
+        tags tag = top->tag;
+        bool writingKey = _writingKey, blockedOnKey = _blockedOnKey;
+        bool wide = top->wide, hashable = top->hashable;
+        uint64_t hash = top->hash, keyHash = top->keyHash;
+
+        push(tag, 0);
+        top = &_stack[1];                   // (push may have reallocated the stack)
+        for (size_t i = begin; i < end; ++i)
+            memcpy(_items->push_back_new(), &(*top)[i], sizeof(Value));
+        if (tag == kDictTag) {
+            for (size_t i = begin / 2; i < end / 2; ++i)
+                _items->keys.push_back(top->keys[i]);
+            _items->keysSorted = top->keysSorted;
+        }
+        _items->wide = wide;
+        _items->hashable = false;
+        endCollection(tag);
+
+        // endCollection added the new collection to the top-level one; take it back out:
+        PreWrittenValue root = lastValueWritten();
+        _items->pop_back();
+        _items->wide = wide;
+        _items->hashable = hashable;
+        _items->hash = hash;
+        _items->keyHash = keyHash;
+        _writingKey = writingKey;
+        _blockedOnKey = blockedOnKey;
+
+        _snippedItems = end;
+        _snipCallback(snipAt(root));
+    }
+
 
 #pragma mark - WRITING:
 
@@ -206,6 +521,8 @@ namespace fleece { namespace impl {
     // Caller is responsible for initializing the Value.
     uint8_t* Encoder::placeItem() {
         throwIf(_blockedOnKey, EncodeError, "need a key before this value");
+        if (_usuallyFalse(_items->packing))
+            stopPacking();
         if (_writingKey) {
             _writingKey = false;
         } else {
@@ -228,6 +545,8 @@ namespace fleece { namespace impl {
                 _items->wide = true;
             return buf;
         } else {
+            if (_usuallyFalse(_items->packing))
+                stopPacking();                  // (before getting the position it writes after)
             writePointer(nextWritePos());
             bool pad = (size & 1);
             buf = _out.reserveSpace<byte>(size + pad);
@@ -248,76 +567,128 @@ namespace fleece { namespace impl {
 
 #pragma mark - SCALARS:
 
-    void Encoder::addSpecial(int specVal)  {new (placeItem()) Value(kSpecialTag, specVal);}
+    void Encoder::addSpecial(int specVal) {
+        new (placeItem()) Value(kSpecialTag, specVal);
+        if (_usuallyFalse(_embedHashes))
+            addHash(ValueHash::ofSpecial(specVal));
+    }
+
     void Encoder::writeNull()              {addSpecial(kSpecialValueNull);}
     void Encoder::writeUndefined()         {addSpecial(kSpecialValueUndefined);}
     void Encoder::writeBool(bool b)        {addSpecial(b ? kSpecialValueTrue : kSpecialValueFalse);}
 
     void Encoder::writeInt(uint64_t i, bool isSmall, bool isUnsigned) {
+        if (_usuallyFalse(_items->packing))
+            return addPendingNumber(isUnsigned ? kPendingUInt : kPendingInt, i);
         if (isSmall) {
             new (placeItem()) Value(kShortIntTag, (i >> 8) & 0x0F, i & 0xFF);
         } else {
-            byte intbuf[10];
-            auto size = PutIntOfLength(intbuf, i, isUnsigned);
-            byte *buf = placeValue<false>(kIntTag, byte(size - 1), 1 + size);
+            byte buf[1 + 10];
+            auto size = PutIntOfLength(buf + 1, i, isUnsigned);
+            buf[0] = byte((kIntTag << 4) | (size - 1));
             if (isUnsigned)
                 buf[0] |= 0x08;
-            memcpy(buf + 1, intbuf, size);
+            writeScalar({buf, 1 + size});
         }
     }
 
-    void Encoder::writeInt(int64_t i)   {writeInt(i, (i < 2048 && i >= -2048), false);}
-    void Encoder::writeUInt(uint64_t i) {writeInt(i, (i < 2048),               true);}
+    void Encoder::writeInt(int64_t i) {
+        writeInt(i, (i < 2048 && i >= -2048), false);
+        if (_usuallyFalse(_embedHashes))
+            addHash(ValueHash::ofInt(i, false));
+    }
+
+    void Encoder::writeUInt(uint64_t i) {
+        if (_usuallyFalse(_canonical) && i <= INT64_MAX)
+            return writeInt(int64_t(i));
+        writeInt(i, (i < 2048), true);
+        if (_usuallyFalse(_embedHashes))
+            addHash(ValueHash::ofInt(int64_t(i), true));
+    }
 
     void Encoder::writeDouble(double n) {
         throwIf(std::isnan(n), InvalidData, "Can't write NaN");
-#if 0 // Perhaps an option in the future?
-        if (isIntRepresentable(n)) {
-            return writeInt((int64_t)n);
-        } else
-#endif
+        if (_usuallyFalse(_canonical) && isIntRepresentable(n))
+            return writeInt(int64_t(n));
         if (isFloatRepresentable(n)) {
-            return _writeFloat((float)n);
+            _writeFloat((float)n);
+        } else if (_usuallyFalse(_items->packing)) {
+            addPendingNumber(kPendingDouble, bitsOf(n));
         } else {
             endian::littleEndianDouble swapped = n;
-            auto buf = placeValue<false>(kFloatTag, 0x08, 2 + sizeof(swapped));
-            buf[1] = 0;
+            byte buf[2 + sizeof(swapped)] = {byte((kFloatTag << 4) | 0x08), 0};
             memcpy(&buf[2], &swapped, sizeof(swapped));
+            if (_usuallyFalse(_alignNumbers))
+                alignNextValue(2, sizeof(swapped));
+            writeScalar({buf, sizeof(buf)});
         }
+        if (_usuallyFalse(_embedHashes))
+            addHash(ValueHash::ofDouble(n));
     }
 
     void Encoder::writeFloat(float n) {
         throwIf(std::isnan(n), InvalidData, "Can't write NaN");
-#if 0 // Perhaps an option in the future?
-        if (isIntRepresentable(n))
-            writeInt((int32_t)n);
-        else
-#endif
-            _writeFloat(n);
+        if (_usuallyFalse(_canonical))
+            return writeDouble(n);
+        _writeFloat(n);
+        if (_usuallyFalse(_embedHashes))
+            addHash(ValueHash::ofDouble(n));
     }
 
     void Encoder::_writeFloat(float n) {
+        if (_usuallyFalse(_items->packing))
+            return addPendingNumber(kPendingFloat, bitsOf(double(n)));
         endian::littleEndianFloat swapped = n;
-        auto buf = placeValue<false>(kFloatTag, 0, 2 + sizeof(swapped));
-        buf[1] = 0;
+        byte buf[2 + sizeof(swapped)] = {byte(kFloatTag << 4), 0};
         memcpy(&buf[2], &swapped, sizeof(swapped));
+        if (_usuallyFalse(_alignNumbers))
+            alignNextValue(2, sizeof(swapped));
+        writeScalar({buf, sizeof(buf)});
     }
 
-#if 0
-    bool Encoder::isIntRepresentable(float n) noexcept {
-        return (n <= INT32_MAX && n >= INT32_MIN && n == floorf(n));
+    // Pads the output so that the byte `payloadOffset` into the next Value written out of line
+    // is at a multiple of `alignment` from the start of the data (including the base.)
+    void Encoder::alignNextValue(size_t payloadOffset, size_t alignment) {
+        size_t misalignment = (_base.size + nextWritePos() + payloadOffset) % alignment;
+        if (misalignment) {
+            size_t padding = alignment - misalignment;
+            memset(_out.reserveSpace<byte>(padding), 0, padding);
+        }
     }
 
     bool Encoder::isIntRepresentable(double n) noexcept {
-        return (n <= INT64_MAX && n >= INT64_MIN && n == floor(n));
+        // (INT64_MAX isn't exactly representable as a double, but -INT64_MIN is:)
+        return (n < -double(INT64_MIN) && n >= double(INT64_MIN) && n == floor(n));
     }
-#endif
 
     bool Encoder::isFloatRepresentable(double n) noexcept {
         return (fabs(n) <= FLT_MAX && n == (float)n);
     }
 
 
+    // A placeholder is as big as the largest value that can go in it: a 64-bit int (padded), a
+    // double, or a far pointer to a string.
+    static constexpr size_t kPlaceholderSize = Pointer::kFarPointerSize;
+
+    unsigned Encoder::writePlaceholder(DocTemplate::PlaceholderType type) {
+        throwIf(_writingKey, EncodeError, "a placeholder can't be a Dict key");
+        throwIf(_base || _checksum || _embedHashes || _canonical || _snipChunkSize
+                      || _out.isStreaming(),
+                EncodeError, "placeholders aren't supported with this encoder's options");
+        byte *buf = placeValue<false>(kPlaceholderSize);
+        memset(buf, 0, kPlaceholderSize);
+        switch (type) {
+            case DocTemplate::kIntPlaceholder:    buf[0] = byte((kIntTag << 4) | 7); break;
+            case DocTemplate::kDoublePlaceholder: buf[0] = byte((kFloatTag << 4) | 0x08); break;
+            case DocTemplate::kStringPlaceholder: buf[0] = Pointer::kFarPointerByte; break;
+        }
+        size_t pos = _out.length() - kPlaceholderSize;
+        throwIf(pos > UINT32_MAX, EncodeError, "placeholder is too far into the data");
+        _placeholders.push_back({type, uint32_t(pos)});
+        return unsigned(_placeholders.size() - 1);
+    }
+
+
 #pragma mark - STRINGS / DATA:
 
     // Subroutine for writing strings or binary data. Returns the address of the string in the
@@ -331,7 +702,17 @@ namespace fleece { namespace impl {
             buf[1] = s.size > 0 ? s[0] : 0;
             buf = nullptr; // this string is ephemeral
         } else {
-            // Large data doesn't:
+            // Large data doesn't. With uniqueCollections it's only written once (except for
+            // strings the string table uniques anyway):
+            std::string key;
+            if (_usuallyFalse(_uniqueCollections) && s.size < kMaxUniqueValueSize
+                    && (tag != kStringTag || !_uniqueStrings || s.size > kMaxSharedStringSize)) {
+                key.reserve(1 + s.size);
+                key += char(tag << 4);
+                key.append((const char*)s.buf, s.size);
+                if (writeEarlierCopy(key))
+                    return nullptr;
+            }
             size_t bufLen = 1 + s.size;
             if (s.size >= 0x0F)
                 bufLen += SizeOfVarInt(s.size);
@@ -343,8 +724,10 @@ namespace fleece { namespace impl {
                 buf += PutUVarInt(buf, s.size);
             }
             memcpy(buf, s.buf, s.size);
-            if (_out.outputFile())
-                buf = nullptr;          // ephemeral if writing to file
+            if (_out.isStreaming() || _out.hasExternalBuffer())
+                buf = nullptr;          // ephemeral if writing to file/sink, or to a buffer that can move
+            if (!key.empty())
+                rememberCopy(std::move(key));
         }
         return buf;
     }
@@ -352,22 +735,47 @@ namespace fleece { namespace impl {
     // Writes a string, or a pointer to an already-written copy of the same string.
     // This is the main body of writeString() and writeKey().
     // Returns the address where s got written to, if possible, just like writeData above.
-    const void* Encoder::_writeString(slice s) {
-        if (!_usuallyTrue(_uniqueStrings && s.size >= kNarrow && s.size <= kMaxSharedStringSize)) {
-            // Not uniquing this string, so just write it:
+    // `hash`, if not Empty, is the string's precomputed StringTable hash code.
+    const void* Encoder::_writeString(slice s, StringTable::hash_t hash) {
+        if (!_usuallyTrue((_uniqueStrings || _canonical)
+                            && s.size >= kNarrow && s.size <= kMaxSharedStringSize)) {
+            // Not uniquing this string, so just write it (unless it's in the shared strings):
+            if (_sharedStrings && s.size >= kNarrow) {
+                if (hash == StringTable::hash_t::Empty)
+                    hash = StringTable::hashCode(s);
+                if (auto shared = writeSharedString(s, hash); shared)
+                    return shared->asString().buf;
+            }
             return writeData(kStringTag, s);
         }
 
         // Check whether this string's already been written:
+        if (hash == StringTable::hash_t::Empty)
+            hash = StringTable::hashCode(s);
         StringTable::entry_t *entry;
         bool isNew;
-        std::tie(entry, isNew) = _strings.insert(s, 0);
-        if (!isNew) {
+        if (_usuallyTrue(baseOrigin() + _out.length() < UINT32_MAX - 1)) {
+            std::tie(entry, isNew) = _strings.insert(s, 0, hash);
+        } else {
+            // The table's offsets are 32-bit, so strings written past 4GB can't be added:
+            entry = const_cast<StringTable::entry_t*>(_strings.find(s, hash));
+            if (!entry)
+                return writeData(kStringTag, s);
+            isNew = false;
+        }
+        if (isNew && _sharedStrings) {
+            // If it's a shared string, point to that, and remember it for next time:
+            if (auto shared = writeSharedString(s, hash); shared) {
+                *entry = {shared->asString(),
+                          uint32_t(_olderSegmentsSize + (size_t)shared - (size_t)_base.buf)};
+                return entry->first.buf;
+            }
+        } else if (!isNew) {
             // String exists: Write pointer to it, as long as the offset's not too large:
-            ssize_t offset = entry->second - _base.size;
+            ssize_t offset = ssize_t(entry->second) - ssize_t(baseOrigin());
             if (_items->wide || nextWritePos() - offset <= Pointer::kMaxNarrowOffset - 32) {
                 writePointer(offset);
-                if (offset < 0) {
+                if (offset < 0 && size_t(-offset) <= _base.size) {
                     const void *stringVal = &_base[_base.size + offset];
                     if (stringVal < _baseMinUsed)
                         _baseMinUsed = stringVal;
@@ -375,13 +783,18 @@ namespace fleece { namespace impl {
 #ifndef NDEBUG
                 _numSavedStrings++;
 #endif
+                counters::count(counters::kDedupedStrings);
                 return entry->first.buf; // done!
             }
         }
 
-        // Write the string to the output:
-        auto offset = _base.size + nextWritePos();
-        throwIf(offset > 1u<<31, MemoryError, "encoded data too large");
+        // Write the string to the output. (The table's offsets are from the start of the oldest
+        // base segment, so they stay valid when snip() adds a segment.)
+        auto offset = baseOrigin() + nextWritePos();
+        if (_usuallyFalse(offset > UINT32_MAX)) {
+            assert(!isNew);
+            return writeData(kStringTag, s);    // (the table keeps pointing to the older copy)
+        }
         writeData(kStringTag, s);
 
         // Store a copy of the string, since _out won't necessarily keep it around (if it's
@@ -391,19 +804,73 @@ namespace fleece { namespace impl {
         return writtenStr;
     }
 
+    // If `s` is in the SharedStrings, and the pointer to it isn't too long, writes the pointer
+    // and returns the shared string Value; otherwise returns null.
+    const Value* Encoder::writeSharedString(slice s, StringTable::hash_t hash) {
+        const Value *shared = _sharedStrings->find(s, hash);
+        if (!shared)
+            return nullptr;
+        ssize_t offset = (const uint8_t*)shared - (const uint8_t*)_base.end();
+        if (!_items->wide && nextWritePos() - offset > Pointer::kMaxNarrowOffset - 32)
+            return nullptr;
+        writePointer(offset);
+        if (shared < _baseMinUsed)
+            _baseMinUsed = shared;
+        return shared;
+    }
+
     // Adds a preexisting string to the cache
     void Encoder::cacheString(slice s, size_t offsetInBase) {
         if (_usuallyTrue(_uniqueStrings && s.size >= kNarrow && s.size <= kMaxSharedStringSize))
-            _strings.insert(s, uint32_t(offsetInBase));
+            _strings.insert(s, uint32_t(_olderSegmentsSize + offsetInBase));
     }
 
     void Encoder::writeData(slice s) {
         writeData(kBinaryTag, s);
+        if (_usuallyFalse(_embedHashes))
+            addHash(ValueHash::ofData(s));
+    }
+
+    void Encoder::writePostingList(const uint64_t values[], size_t count) {
+        writeData(PostingList::encode(values, count));
+    }
+
+    void Encoder::addStringHash(slice s) {
+        addHash(ValueHash::ofString(s));
     }
 
 
     void Encoder::reuseBaseStrings() {
         reuseBaseStrings(Value::fromTrustedData(_base));
+        _stringsCoverBase = true;
+    }
+
+    void Encoder::resetForAmend(slice newBase) {
+        bool keep = _stringsEnd > 0 && newBase.size == _stringsEnd;
+        if (keep) {
+            // Point the keys into the new base, since the old base and _stringStorage may go
+            // away. Checking that each entry still finds its string there is cheap insurance:
+            _strings.forEach([&](StringTable::entry_t &entry) {
+                if (!keep || entry.second + kNarrow > newBase.size)
+                    return void(keep = false);
+                slice str = ((const Value*)&newBase[entry.second])->asString();
+                if (str.size != entry.first.size)
+                    keep = false;
+                entry.first = str;
+            });
+        }
+        if (!keep) {
+            reset();
+            if (newBase) {
+                setBase(newBase);
+                reuseBaseStrings();
+            }
+            return;
+        }
+        _stringStorage.reset();
+        resetExceptStrings();
+        setBase(newBase);
+        _stringsCoverBase = true;
     }
 
     void Encoder::reuseBaseStrings(const Value *value) {
@@ -434,6 +901,39 @@ namespace fleece { namespace impl {
         writeString(FormatISO8601Date(str, timestamp, asUTC));
     }
 
+    void Encoder::writeTimestamp(int64_t timestamp, bool asUTC) {
+        char buf[kFormattedISO8601DateMaxSize];
+        slice str = FormatISO8601Date(buf, timestamp, asUTC);
+        throwIf(!str, InvalidData, "Invalid timestamp");
+        // The string ends with either 'Z' or the timezone offset as "+hhmm":
+        int tzOffset = 0;
+        if (str[str.size - 1] != 'Z') {
+            auto digits = (const char*)str.end() - 4;
+            tzOffset = ((digits[0] - '0') * 10 + (digits[1] - '0')) * 60
+                     + (digits[2] - '0') * 10 + (digits[3] - '0');
+            if (digits[-1] == '-')
+                tzOffset = -tzOffset;
+        }
+        writeTimestamp(str, timestamp, tzOffset);
+    }
+
+    // Writes a timestamp's string, with its count as a (non-minimal) 2-byte varint, followed by
+    // the binary trailer. It's never shared or uniqued, since a pointer to it would be a string.
+    void Encoder::writeTimestamp(slice str, int64_t timestamp, int tzOffset) {
+        assert_precondition(str.size < 0x80);
+        byte *buf = placeValue<false>(kStringTag, 0x0F, 3 + str.size + kTimestampTrailerSize);
+        buf[1] = byte(0x80 | str.size);
+        buf[2] = 0;
+        memcpy(&buf[3], str.buf, str.size);
+        buf += 3 + str.size;
+        auto ts = endian::encLittle64(timestamp);
+        memcpy(buf, &ts, sizeof(ts));
+        buf[8] = byte(tzOffset & 0xFF);
+        buf[9] = byte((tzOffset >> 8) & 0xFF);
+        if (_usuallyFalse(_embedHashes))
+            addStringHash(str);
+    }
+
 
 #pragma mark - WRITING VALUES:
 
@@ -485,8 +985,10 @@ namespace fleece { namespace impl {
             auto minVal = minUsed(value);
             if (minVal >= _baseCutoff) {
                 // Value is in the base data, and close enough; I can just emit a pointer to it:
-                writePointer( (ssize_t)value - (ssize_t)_base.end() );
-                if (minVal && minVal < _baseMinUsed)
+                writePointer(basePosition(value));
+                if (_usuallyFalse(_embedHashes))
+                    addHash(value->hash(sk ? const_cast<SharedKeys*>(sk) : _sharedKeys.get()));
+                if (minVal && minVal < _baseMinUsed && _base.containsAddress(minVal))
                     _baseMinUsed = minVal;
                 return;
             }
@@ -495,18 +997,56 @@ namespace fleece { namespace impl {
             case kShortIntTag:
             case kIntTag:
             case kFloatTag:
+                if (_usuallyFalse(_items->packing || _canonical || _alignNumbers)) {
+                    if (value->tag() == kFloatTag)
+                        value->isDouble() ? writeDouble(value->asDouble())
+                                          : writeFloat(value->asFloat());
+                    else
+                        value->isUnsigned() ? writeUInt(value->asUnsigned())
+                                            : writeInt(value->asInt());
+                    break;
+                }
+                // fall through
             case kSpecialTag: {
                 size_t size = value->dataSize();
                 memcpy(placeValue<true>(size), value, size);
+                if (_usuallyFalse(_embedHashes))
+                    addHash(value->hash());
                 break;
             }
             case kStringTag:
-                writeString(value->asString());
+                if (value->isTimestamp())
+                    writeTimestamp(value->asString(), value->asTimestamp(),
+                                   value->timestampOffset());
+                else
+                    writeString(value->asString());
                 break;
             case kBinaryTag:
                 writeData(value->asData());
                 break;
             case kArrayTag: {
+                if (!value->isMutable() && !writeNestedValue && relocateValue(value, sk))
+                    break;
+                if (value->isMutable()) {
+                    // A mutable Array that's unchanged from its source in the base can be written
+                    // as a pointer to the source:
+                    auto ha = ((const Array*)value)->heapArray();
+                    auto source = ha->unchangedSource();
+                    if (source && valueIsInBase(source)) {
+                        writeValue(source, sk, writeNestedValue);
+                        break;
+                    }
+                    // Iterate the HeapArray directly, so a sparse one doesn't get materialized:
+                    ++_copyingCollection;
+                    beginArray(ha->count());
+                    for (HeapArray::iterator iter(ha); iter; ++iter) {
+                        if (!writeNestedValue || !(*writeNestedValue)(nullptr, iter.value()))
+                            writeValue(iter.value(), sk, writeNestedValue);
+                    }
+                    endArray();
+                    --_copyingCollection;
+                    break;
+                }
                 ++_copyingCollection;
                 auto iter = value->asArray()->begin();
                 beginArray(iter.count());
@@ -519,10 +1059,16 @@ namespace fleece { namespace impl {
                 break;
             }
             case kDictTag: {
+                if (!value->isMutable() && !writeNestedValue && relocateValue(value, sk))
+                    break;
                 ++_copyingCollection;
                 auto dict = (const Dict*)value;
-                if (dict->isMutable()) {
+                if (_usuallyFalse(_canonical)) {
+                    writeCanonicalDict(dict, sk, writeNestedValue);
+                } else if (dict->isMutable()) {
                     dict->heapDict()->writeTo(*this/*, writeNestedValue*/);
+                } else if (_usuallyFalse(!_keyHeat.empty())) {
+                    writeProfiledDict(dict, sk, writeNestedValue);
                 } else {
                     auto iter = dict->begin();
                     beginDictionary(iter.count());
@@ -545,12 +1091,488 @@ namespace fleece { namespace impl {
     }
 
 
+    // Writes a Dict for canonical encoding, with its keys as strings in sorted order. (Iterating
+    // it doesn't always produce that order, since integer keys sort before strings.)
+    void Encoder::writeCanonicalDict(const Dict *dict,
+                                     const SharedKeys* &sk,
+                                     const WriteValueFunc *writeNestedValue)
+    {
+        struct Entry {slice key; const Value *keyValue, *value;};
+        std::vector<Entry> entries;
+        if (dict->isMutable()) {
+            for (HeapDict::iterator i(dict->heapDict()); i; ++i)
+                entries.push_back({i.keyString(), nullptr, i.value()});
+        } else {
+            for (Dict::iterator i(dict, sk); i; ++i) {
+                if (!sk && i.key()->isInteger())
+                    sk = i.sharedKeys();
+                slice key = i.keyString();
+                throwIf(!key, InvalidData, "Unrecognized integer key");
+                entries.push_back({key, i.key(), i.value()});
+            }
+        }
+        std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.key.compare(b.key) < 0;
+        });
+        beginDictionary(entries.size());
+        for (auto &entry : entries) {
+            if (!writeNestedValue || !entry.keyValue
+                    || !(*writeNestedValue)(entry.keyValue, entry.value)) {
+                writeKey(entry.key);
+                writeValue(entry.value, sk, writeNestedValue);
+            }
+        }
+        endDictionary();
+    }
+
+
+    // Writes a Dict with the values of its keys in order of increasing lookup count in the
+    // access profile, so the hottest ones end up closest to it. (The Dict's items are sorted by
+    // endDictionary as usual.)
+    void Encoder::writeProfiledDict(const Dict *dict,
+                                    const SharedKeys* &sk,
+                                    const WriteValueFunc *writeNestedValue)
+    {
+        struct Entry {uint64_t heat; const Value *key, *value;};
+        std::vector<Entry> entries;
+        entries.reserve(dict->count());
+        for (Dict::iterator i(dict, sk); i; ++i) {
+            if (!sk && i.key()->isInteger())
+                sk = i.sharedKeys();
+            uint64_t heat = 0;
+            if (slice key = i.keyString(); key) {
+                if (auto found = _keyHeat.find(std::string(key)); found != _keyHeat.end())
+                    heat = found->second;
+            }
+            entries.push_back({heat, i.key(), i.value()});
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+            return a.heat < b.heat;
+        });
+        beginDictionary(entries.size());
+        for (auto &entry : entries) {
+            if (!writeNestedValue || !(*writeNestedValue)(entry.key, entry.value)) {
+                writeKey(entry.key, sk);
+                writeValue(entry.value, sk, writeNestedValue);
+            }
+        }
+        endDictionary();
+    }
+
+
+    void Encoder::setAccessProfile(const AccessProfile *profile) {
+        if (profile)
+            _keyHeat = profile->counts();
+        else
+            _keyHeat.clear();
+    }
+
+
     void Encoder::writeValue(const Value* NONNULL value, const WriteValueFunc *fn) {
         const SharedKeys *sk = nullptr;
         writeValue(value, sk, fn);
     }
 
 
+#pragma mark - PARALLEL ENCODING:
+
+
+    // Returns the number of Values in a mutable collection's tree, counting an immutable Value
+    // (even a collection, which is copied as a block) as one. If it has more than `maxSize`,
+    // appends to `tasks` groups of the mutable collections in it to encode separately: runs of
+    // consecutive items that are collections of up to `maxSize` Values, adding up to at least
+    // kMinParallelSubtree. (The larger items are split up the same way, recursively.)
+    static size_t findParallelSubtrees(const Value *value, size_t maxSize,
+                                       std::vector<std::vector<const Value*>> &tasks)
+    {
+        auto type = value->type();
+        if ((type != kArray && type != kDict) || !value->isMutable())
+            return 1;
+        size_t size = 1, firstTask = tasks.size();
+        std::vector<std::pair<const Value*, size_t>> smallItems;
+        auto addItem = [&](const Value *item) {
+            size_t itemSize = findParallelSubtrees(item, maxSize, tasks);
+            size += itemSize;
+            if (itemSize > 1 && itemSize <= maxSize)
+                smallItems.emplace_back(item, itemSize);
+        };
+        if (type == kArray) {
+            for (HeapArray::iterator i((const MutableArray*)value->asArray()); i; ++i)
+                addItem(i.value());
+        } else {
+            for (HeapDict::iterator i((const MutableDict*)value->asDict()); i; ++i) {
+                ++size;                                 // the key
+                addItem(i.value());
+            }
+        }
+        if (size <= maxSize) {
+            // Small enough to be encoded as part of a task, so drop any tasks inside it:
+            tasks.resize(firstTask);
+        } else {
+            size_t runSize = 0;
+            for (auto &[item, itemSize] : smallItems) {
+                if (runSize == 0)
+                    tasks.emplace_back();
+                tasks.back().push_back(item);
+                runSize += itemSize;
+                if (runSize >= maxSize)
+                    runSize = 0;
+            }
+            if (runSize > 0 && runSize < Encoder::kMinParallelSubtree)
+                tasks.pop_back();                       // too small to be worth a task
+        }
+        return size;
+    }
+
+
+    void Encoder::writeValueParallel(const Value *value, unsigned nThreads) {
+        nThreads = Executor::resolveThreads(nThreads);
+        auto type = value->type();
+        // Options whose output depends on what else is in the document (or where it is) rule
+        // out encoding subtrees separately:
+        bool canSplit = value->isMutable() && (type == kArray || type == kDict)
+                     && !_base && !_canonical && !_embedHashes && !_alignNumbers
+                     && !_uniqueCollections && !_sharedStrings && _keyHeat.empty()
+                     && !_snipChunkSize && !_items->packing;
+        std::vector<std::vector<const Value*>> tasks;
+        if (canSplit) {
+            // (This is done even on one thread, so the output doesn't depend on the number.)
+            size_t total = findParallelSubtrees(value, SIZE_MAX, tasks);
+            if (total >= 4 * kMinParallelSubtree)
+                findParallelSubtrees(value, std::max(total / 64, kMinParallelSubtree), tasks);
+        }
+        if (tasks.size() < 2) {
+            writeValue(value);
+            return;
+        }
+        tracing::Span span("Encoder::writeValueParallel", tasks.size());
+
+        // Encode each task's subtrees into its own Encoder, as top-level values with no trailer:
+        struct Chunk {
+            std::unique_ptr<Encoder> enc;
+            std::vector<size_t> valuePos;
+            alloc_slice data;
+        };
+        std::vector<Chunk> chunks(tasks.size());
+        Executor::parallelFor(tasks.size(), nThreads, [&](size_t t) {
+            auto sub = std::make_unique<Encoder>();
+            sub->setSharedKeys(_sharedKeys);
+            sub->uniqueStrings(_uniqueStrings);
+            sub->indexLargeDicts(_indexLargeDicts);
+            sub->prefixDictKeys(_prefixDictKeys);
+            sub->packNumericArrays(_packNumericArrays);
+            sub->maxDictParentDepth(_maxDictParentDepth);
+            sub->avoidWideCollections(_avoidWideCollections);
+            sub->suppressTrailer();
+            for (const Value *subtree : tasks[t]) {
+                sub->writeValue(subtree);
+                chunks[t].valuePos.push_back(sub->finishItem());
+            }
+            chunks[t].data = sub->finish();
+            chunks[t].enc = std::move(sub);
+        });
+
+        // Since Fleece pointers are relative, the chunks remain valid when appended to the
+        // output. Their strings are added to my string table, so later ones can point to them:
+        std::unordered_map<const Value*, size_t> written;
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            Chunk &chunk = chunks[t];
+            size_t chunkPos = nextWritePos();
+            _out.write(chunk.data);
+            for (size_t i = 0; i < tasks[t].size(); ++i)
+                written.emplace(tasks[t][i], chunkPos + chunk.valuePos[i]);
+            if (_uniqueStrings && baseOrigin() + _out.length() < UINT32_MAX) {
+                chunk.enc->_strings.forEach([&](StringTable::entry_t &entry) {
+                    auto [mine, isNew] = _strings.insert(entry.first, 0);
+                    if (isNew)
+                        *mine = {{_stringStorage.write(entry.first), entry.first.size},
+                                 uint32_t(baseOrigin() + chunkPos + entry.second)};
+                });
+            }
+            auto &stats = chunk.enc->_collectionStats;
+            _collectionStats.narrow += stats.narrow;
+            _collectionStats.wide += stats.wide;
+            _collectionStats.narrowItems += stats.narrowItems;
+            _collectionStats.wideItems += stats.wideItems;
+            _collectionStats.farPointers += stats.farPointers;
+            chunk = {};
+        }
+
+        // Then write the rest of the tree, with pointers to the subtrees:
+        writeSplicedValue(value, written);
+    }
+
+
+    // Writes a mutable tree like writeValue, except that the Values in `written` have already
+    // been written at the given positions, and are written as pointers to those.
+    void Encoder::writeSplicedValue(const Value *value,
+                                    const std::unordered_map<const Value*, size_t> &written)
+    {
+        if (auto i = written.find(value); i != written.end()) {
+            writeValueAgain(PreWrittenValue(baseOrigin() + i->second));
+        } else if (auto type = value->type(); (type != kArray && type != kDict)
+                                                  || !value->isMutable()) {
+            writeValue(value);
+        } else if (type == kArray) {
+            ++_copyingCollection;
+            auto ha = ((const Array*)value)->heapArray();
+            beginArray(ha->count());
+            for (HeapArray::iterator i(ha); i; ++i)
+                writeSplicedValue(i.value(), written);
+            endArray();
+            --_copyingCollection;
+        } else {
+            ++_copyingCollection;
+            HeapDict::iterator i(((const Dict*)value)->heapDict());
+            beginDictionary(i.count());
+            for (; i; ++i) {
+                writeKey(i.keyString());
+                writeSplicedValue(i.value(), written);
+            }
+            endDictionary();
+            --_copyingCollection;
+        }
+    }
+
+
+#pragma mark - RELOCATING:
+
+
+    // An immutable collection being copied by writeValue usually occupies a contiguous region of
+    // its data, and since pointers are relative, that region is still valid Fleece wherever it's
+    // put. So instead of being re-encoded item by item, it's "relocated": the region is copied
+    // as-is, and only pointers to values outside it (typically strings written earlier, like
+    // the keys of the first Dict that used them) are rewritten, to copies of those values
+    // written just before it. Integer Dict keys are rewritten too, if they're from different
+    // SharedKeys and their order is unchanged, and they're all short ints (less than 2048) in
+    // both SharedKeys. It's not done when the result would differ
+    // from re-encoding in a way that matters, e.g. if a string key should become an integer.
+
+    static constexpr uint32_t kMinRelocatedCount = 4;  // Smaller collections are re-encoded
+    static constexpr size_t kMaxRelocationGap = 64;    // Max unused bytes between region's values
+
+    // What scanForRelocation finds out about a collection to be relocated.
+    struct Encoder::Relocation {
+        struct Node {const Value *value; size_t size;};
+        struct Ptr {const Value *slot, *target; bool wide;};
+        struct IntKey {const Value *slot; size_t prev;};   // `prev`: index of previous in Dict
+
+        std::vector<Node> nodes;                    // Out-of-line values, each once
+        std::unordered_set<const Value*> seen;      // Values already added to `nodes`
+        std::vector<Ptr> pointers;                  // Pointer slots of collections in `nodes`
+        std::vector<IntKey> intKeys;                // Integer Dict keys, in order
+    };
+
+
+    // Adds a Value and its descendants to the Relocation; returns false if it can't be relocated.
+    bool Encoder::scanForRelocation(const Value *value, Relocation &r) {
+        if (!r.seen.insert(value).second)
+            return true;
+        auto tag = value->tag();
+        if (tag < kArrayTag) {
+            r.nodes.push_back({value, value->dataSize()});
+            return true;
+        }
+        Array::impl items(value);
+        size_t nSlots = items._count;
+        bool wide = (items._width == kWide), keyed = false;
+        if (tag == kDictTag) {
+            nSlots *= 2;
+            keyed = true;
+        } else if (items._width != kNarrow && !wide) {
+            // Packed array, whose items are all inline:
+            if (!_packNumericArrays)
+                return false;
+            r.nodes.push_back({value, size_t((const byte*)offsetby(items._first, nSlots * items._width)
+                                             - (const byte*)value)});
+            return true;
+        }
+        r.nodes.push_back({value, size_t((const byte*)offsetby(items._first, nSlots * items._width)
+                                         - (const byte*)value)});
+
+        auto slot = items._first;
+        size_t prevIntKey = SIZE_MAX;
+        for (size_t i = 0; i < nSlots; ++i, slot = offsetby(slot, items._width)) {
+            const Value *target = slot;
+            if (slot->isPointer()) {
+                auto ptr = slot->_asPointer();
+                if (ptr->isExternal())
+                    return false;
+                target = offsetby(slot, -ptrdiff_t(wide ? ptr->offset<true>()
+                                                        : ptr->offset<false>()));
+                if (Pointer::isFarPointer(target))
+                    return false;
+                r.pointers.push_back({slot, target, wide});
+                if (!scanForRelocation(target, r))
+                    return false;
+            }
+            if (keyed && (i & 1) == 0) {
+                if (target->tag() == kShortIntTag) {
+                    if (target->asInt() >= 0) {
+                        r.intKeys.push_back({slot, prevIntKey});
+                        prevIntKey = r.intKeys.size() - 1;
+                    }
+                } else if (target->tag() == kIntTag) {
+                    return false;   // (a key beyond the short int range can't be rewritten inline)
+                } else if (_sharedKeys) {
+                    // A string key that the SharedKeys can encode has to be written as an int:
+                    int encoded;
+                    if (_sharedKeys->encodeAndAdd(target->asString(), encoded))
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+
+
+    // Tries to copy an immutable collection by relocating it (see above.)
+    bool Encoder::relocateValue(const Value *value, const SharedKeys* &sk) {
+        if (Array::impl(value)._count < kMinRelocatedCount || _canonical || _uniqueCollections
+                || _alignNumbers || !_keyHeat.empty())
+            return false;
+        Relocation r;
+        if (!scanForRelocation(value, r))
+            return false;
+
+        // Integer keys: map them to my SharedKeys, if they're different, keeping their order:
+        std::vector<int> newKeys;
+        if (!r.intKeys.empty()) {
+            if (!sk)
+                sk = value->sharedKeys();
+            if (!sk || !_sharedKeys)
+                return false;
+            if (sk != _sharedKeys) {
+                newKeys.reserve(r.intKeys.size());
+                for (auto &intKey : r.intKeys) {
+                    slice key = sk->decode(int(intKey.slot->asInt()));
+                    int encoded;
+                    if (!key || !_sharedKeys->encodeAndAdd(key, encoded) || encoded > 2047)
+                        return false;       // (a new key has to fit in the key's short int)
+                    if (intKey.prev != SIZE_MAX && encoded <= newKeys[intKey.prev])
+                        return false;
+                    newKeys.push_back(encoded);
+                }
+            }
+        }
+
+        // The region ends with the collection, and extends back over the values below it that
+        // are close together. Any values before that are "outliers" that get copied separately.
+        // (A gap as big as the collection before it is allowed, since it may be followed by a
+        // DictIndex or other trailer.)
+        std::sort(r.nodes.begin(), r.nodes.end(), [](auto &a, auto &b) {return a.value < b.value;});
+        assert(r.nodes.back().value == value);
+        auto regionStart = (const byte*)value;
+        auto regionEnd = regionStart + r.nodes.back().size;
+        size_t firstInRegion = r.nodes.size() - 1, regionUsed = r.nodes.back().size;
+        for (; firstInRegion > 0; --firstInRegion) {
+            auto &node = r.nodes[firstInRegion - 1];
+            auto maxGap = kMaxRelocationGap + (node.value->tag() >= kArrayTag ? node.size : 0);
+            if ((const byte*)node.value + node.size + maxGap < regionStart)
+                break;
+            regionStart = (const byte*)node.value;
+            regionUsed += node.size;
+        }
+        size_t regionSize = regionEnd - regionStart;
+        if (regionSize > 2 * regionUsed)
+            return false;
+        size_t outlierSize = 0;
+        for (size_t i = 0; i < firstInRegion; ++i) {
+            if (r.nodes[i].value->tag() >= kArrayTag)
+                return false;       // (not worth the complexity of copying it separately)
+            outlierSize += r.nodes[i].size + 1;
+        }
+        if (regionSize + outlierSize > gMaxWideOffset)
+            return false;
+
+        // Make sure the pointers to outliers will reach them:
+        auto isOutlier = [&](const Value *v) {return (const byte*)v < regionStart;};
+        for (auto &ptr : r.pointers) {
+            if (isOutlier(ptr.target) && !ptr.wide
+                    && ((const byte*)ptr.slot - regionStart) + outlierSize > Pointer::kMaxNarrowOffset)
+                return false;
+        }
+
+        // Write the outliers, or find existing copies of strings:
+        if (_usuallyFalse(_items->packing))
+            stopPacking();                  // (before writing anything; see placeValue)
+        std::unordered_map<const Value*, ssize_t> outlierPos;
+        for (size_t i = 0; i < firstInRegion; ++i) {
+            const Value *outlier = r.nodes[i].value;
+            StringTable::entry_t *entry = nullptr;
+            if (outlier->tag() == kStringTag && _uniqueStrings && !outlier->isTimestamp()) {
+                slice str = outlier->asString();
+                if (str.size >= kNarrow && str.size <= kMaxSharedStringSize
+                        && baseOrigin() + _out.length() < UINT32_MAX - 1) {
+                    bool isNew;
+                    std::tie(entry, isNew) = _strings.insert(str, 0);
+                    if (!isNew) {
+                        ssize_t pos = ssize_t(entry->second) - ssize_t(baseOrigin());
+                        if (pos >= 0 && nextWritePos() + outlierSize + regionSize - pos
+                                            <= Pointer::kMaxNarrowOffset) {
+                            outlierPos[outlier] = pos;
+                            continue;
+                        }
+                    }
+                }
+            }
+            ssize_t pos = nextWritePos();
+            _out.write(outlier, r.nodes[i].size);
+            outlierPos[outlier] = pos;
+            if (entry) {
+                slice str = outlier->asString();
+                *entry = {{_stringStorage.write(str), str.size}, uint32_t(baseOrigin() + pos)};
+            }
+        }
+
+        // Copy the region's values and their trailers, zeroing the gaps between them so no
+        // unrelated bytes of the source get copied. Then fix the pointers to outliers and the
+        // integer keys. (A Value is constructed separately, since it's wide, and a slot may be
+        // narrow.)
+        ssize_t regionPos = nextWritePos();
+        byte *dst = _out.reserveSpace<byte>(regionSize);
+        memset(dst, 0, regionSize);
+        for (size_t i = firstInRegion; i < r.nodes.size(); ++i) {
+            auto start = (const byte*)r.nodes[i].value, end = start + r.nodes[i].size;
+            auto limit = (i + 1 < r.nodes.size()) ? (const byte*)r.nodes[i+1].value : regionEnd;
+            if (r.nodes[i].value->tag() >= kArrayTag && i + 1 < r.nodes.size()
+                    && Array::impl(r.nodes[i].value)._count
+                            >= std::min(DictKeyPrefixes::kMinCount, CollectionHash::kMinCount)) {
+                // Include the DictIndex and other trailers following the collection:
+                for (int t = 0; t < 3 && end + 2 <= limit; ++t) {
+                    auto trailer = (const Value*)end;
+                    if (trailer->_byte[0] != DictIndex::kHeaderByte)
+                        break;
+                    size_t size = trailer->dataSize();
+                    size += size & 1;
+                    if (end + size > limit)
+                        break;
+                    end += size;
+                }
+            }
+            memcpy(dst + (start - regionStart), start, end - start);
+        }
+        for (auto &ptr : r.pointers) {
+            if (isOutlier(ptr.target)) {
+                auto slotOffset = (const byte*)ptr.slot - regionStart;
+                auto offset = size_t(regionPos + slotOffset - outlierPos[ptr.target]);
+                Pointer newPtr(offset, ptr.wide ? kWide : kNarrow);
+                memcpy(dst + slotOffset, &newPtr, ptr.wide ? kWide : kNarrow);
+            }
+        }
+        for (size_t i = 0; i < newKeys.size(); ++i) {
+            auto slotOffset = (const byte*)r.intKeys[i].slot - regionStart;
+            Value newKey(kShortIntTag, (newKeys[i] >> 8) & 0x0F, newKeys[i] & 0xFF);
+            memcpy(dst + slotOffset, &newKey, kNarrow);
+        }
+
+        writePointer(regionPos + ((const byte*)value - regionStart));
+        if (_usuallyFalse(_embedHashes))
+            addHash(value->hash(const_cast<SharedKeys*>(sk ? sk : _sharedKeys.get())));
+        return true;
+    }
+
+
 
 #pragma mark - POINTERS:
 
@@ -563,12 +1585,131 @@ namespace fleece { namespace impl {
     // without having to write negative numbers as positions.
 
     bool Encoder::valueIsInBase(const Value *value) const {
-        return _base && value >= _base.buf && value < (const void*)_base.end();
+        if (!_base)
+            return false;
+        if (_usuallyTrue(_base.containsAddress(value)))
+            return true;
+        return _usuallyFalse(!_olderSegments.empty()) && basePosition(value) != 0;
+    }
+
+    // Returns the offset of a Value in the base from the end of the base, which is negative.
+    // The older extern segments are treated as though they preceded the base contiguously.
+    // Returns 0 if the Value isn't in any of them.
+    ssize_t Encoder::basePosition(const Value *value) const {
+        if (_usuallyTrue(_base.containsAddress(value)))
+            return (ssize_t)value - (ssize_t)_base.end();
+        ssize_t segmentEnd = -(ssize_t)_base.size;
+        for (slice segment : _olderSegments) {
+            if (segment.containsAddress(value))
+                return segmentEnd - ((ssize_t)segment.end() - (ssize_t)value);
+            segmentEnd -= segment.size;
+        }
+        return 0;
     }
 
     // Parameter p is an offset into the current stream, not taking into account the base.
     void Encoder::writePointer(ssize_t p)   {
-        new (placeItem()) Pointer(_base.size + p, kWide);
+        setItemPointer(*(Value*)placeItem(), p);
+    }
+
+    // An item that's a pointer holds the absolute position of its target (as a wide Pointer)
+    // until fixPointers makes it relative. If that's too big for a Pointer, it goes in
+    // _farPositions instead, and the item holds its index, flagged as external.
+    void Encoder::setItemPointer(Value &item, ssize_t pos) {
+        size_t absPos = baseOrigin() + pos;
+        if (_usuallyTrue(absPos <= gMaxWideOffset)) {
+            new (&item) Pointer(absPos, kWide);
+        } else {
+            new (&item) Pointer(2 * _farPositions.size(), kWide, true);
+            _farPositions.push_back(absPos);
+        }
+    }
+
+    // Returns the position (relative to the stream) that a pointer item points to.
+    ssize_t Encoder::itemPointerPos(const Value &item) const {
+        auto ptr = item._asPointer();
+        size_t absPos = ptr->offset<true>();
+        if (_usuallyFalse(ptr->isExternal()))
+            absPos = _farPositions[absPos / 2];
+        return ssize_t(absPos) - baseOrigin();
+    }
+
+    // Called just before a collection's items are written. Any pointer item whose target will
+    // be out of reach of a wide Pointer gets a far pointer written for it, and points to that.
+    void Encoder::writeFarPointers(valueArray *items) {
+        // Conservatively, where the items will end up after all the far pointers:
+        size_t itemsPos = nextWritePos() + items->size() * (Pointer::kFarPointerSize + kWide) + 16;
+        if (_usuallyTrue(baseOrigin() + itemsPos <= gMaxWideOffset))
+            return;
+        for (Value &v : *items) {
+            if (v.isPointer()) {
+                ssize_t pos = itemPointerPos(v);
+                if (itemsPos - pos > gMaxWideOffset) {
+                    throwIf(pos < 0 && _markExternPtrs, OutOfRange,
+                            "Encoded data is too far from the external data it points to");
+                    size_t farPos = nextWritePos();
+                    Pointer::writeFarPointer(_out.reserveSpace<byte>(Pointer::kFarPointerSize),
+                                             farPos - pos);
+                    setItemPointer(v, farPos);
+                }
+            }
+        }
+    }
+
+    // Called just before a collection's header, when avoidWideCollections is set. If some
+    // pointer items are too far back for a narrow Pointer, but redirecting them takes fewer bytes
+    // than widening every slot, it writes a far pointer for each of them, and points them to it.
+    void Encoder::writeNarrowingPointers(valueArray *items, size_t headerLen) {
+        if (items->wide)
+            return;
+        const size_t nValues = items->size();
+        const size_t farPos = nextWritePos();
+        const size_t itemsPos = farPos + headerLen + (headerLen & 1);
+        // Find the items out of reach once `nFar` far pointers are written; since that moves the
+        // items further away, repeat until the number stops growing:
+        size_t nFar = 0;
+        for (;;) {
+            size_t n = 0;
+            size_t pointerOrigin = itemsPos + nFar * Pointer::kFarPointerSize;
+            for (Value &v : *items) {
+                if (v.isPointer()) {
+                    ssize_t pos = itemPointerPos(v);
+                    if (pointerOrigin - pos > Pointer::kMaxNarrowOffset) {
+                        if (pos < 0 && _markExternPtrs)
+                            return;         // can't redirect an extern pointer
+                        ++n;
+                    }
+                }
+                pointerOrigin += kNarrow;
+            }
+            if (n == nFar)
+                break;
+            nFar = n;
+            if (nFar * Pointer::kFarPointerSize >= nValues * (kWide - kNarrow))
+                return;                     // cheaper to go wide
+        }
+        if (nFar == 0)
+            return;
+        // The last slot has to reach the first far pointer:
+        size_t lastSlot = itemsPos + nFar * Pointer::kFarPointerSize + (nValues - 1) * kNarrow;
+        if (lastSlot - farPos > Pointer::kMaxNarrowOffset)
+            return;
+
+        size_t pointerOrigin = itemsPos + nFar * Pointer::kFarPointerSize;
+        for (Value &v : *items) {
+            if (v.isPointer()) {
+                ssize_t pos = itemPointerPos(v);
+                if (pointerOrigin - pos > Pointer::kMaxNarrowOffset) {
+                    size_t pos2 = nextWritePos();
+                    Pointer::writeFarPointer(_out.reserveSpace<byte>(Pointer::kFarPointerSize),
+                                             pos2 - pos);
+                    setItemPointer(v, pos2);
+                    _collectionStats.farPointers++;
+                }
+            }
+            pointerOrigin += kNarrow;
+        }
+        assert(nextWritePos() == farPos + nFar * Pointer::kFarPointerSize);
     }
 
     // Check whether any pointers in _items can't fit in a narrow Value:
@@ -576,7 +1717,7 @@ namespace fleece { namespace impl {
         if (!items->wide) {
             for (Value &v : *items) {
                 if (v.isPointer()) {
-                    ssize_t pos = v._asPointer()->offset<true>() - _base.size;
+                    ssize_t pos = itemPointerPos(v);
                     if (pointerOrigin - pos > Pointer::kMaxNarrowOffset) {
                         items->wide = true;
                         break;
@@ -593,7 +1734,7 @@ namespace fleece { namespace impl {
         int width = items->wide ? kWide : kNarrow;
         for (Value &v : *items) {
             if (v.isPointer()) {
-                ssize_t pos = v._asPointer()->offset<true>() - _base.size;
+                ssize_t pos = itemPointerPos(v);
                 assert(pos < (ssize_t)pointerOrigin);
                 bool isExternal = (pos < 0);
                 v = Pointer(pointerOrigin - pos, width, isExternal && _markExternPtrs);
@@ -611,26 +1752,73 @@ namespace fleece { namespace impl {
             else
                 FleeceException::_throw(EncodeError, "not writing a dictionary");
         }
+        maybeSnipProgressively();
         _blockedOnKey = false;
     }
 
     void Encoder::writeKey(slice s) {
         int encoded;
-        if (_sharedKeys && _sharedKeys->encodeAndAdd(s, encoded)) {
+        if (_sharedKeys && !_canonical && _sharedKeys->encodeAndAdd(s, encoded)) {
+            writeKey(encoded);
+            return;
+        }
+        writeStringKey(s);
+    }
+
+    void Encoder::writeKey(const PreparedKey &key) {
+        if (_sharedKeys && !_canonical) {
+            int encoded = key._intKey.load(std::memory_order_relaxed);
+            if (encoded < 0 || _sharedKeys->isUnknownKey(encoded)
+                            || _sharedKeys->decode(encoded) != key._string) {
+                if (!_sharedKeys->encodeAndAdd(key._string, encoded)) {
+                    writeStringKey(key._string, key._hash);
+                    return;
+                }
+                key._intKey.store(encoded, std::memory_order_relaxed);
+            }
             writeKey(encoded);
             return;
         }
+        writeStringKey(key._string, key._hash);
+    }
+
+    // Writes a key as a string. `hash`, if not Empty, is its precomputed StringTable hash code.
+    void Encoder::writeStringKey(slice s, StringTable::hash_t hash) {
+        if (_usuallyFalse(_embedHashes))
+            addKeyHash(s);
         addingKey();
-        const void* writtenKey = _writeString(s);
-        if (!writtenKey && _copyingCollection)
-            writtenKey = s.buf;         // Workaround for written strings not being kept in memory by the Writer if it's writing to a file
+        const void* writtenKey = _writeString(s, hash);
+        if (!writtenKey && s.size >= kNarrow) {
+            // The written string isn't kept in memory by the Writer (if it's writing to a file,
+            // sink or external buffer), so point to a stable copy:
+            if (_copyingCollection)
+                writtenKey = s.buf;
+            else
+                writtenKey = _stringStorage.write(s);
+        }
         addedKey({writtenKey, s.size});
     }
 
     void Encoder::writeKey(int n) {
         assert_precondition(_sharedKeys || n == Dict::kMagicParentKey || gDisableNecessarySharedKeysCheck);
+        if (_usuallyFalse(_canonical) && n != Dict::kMagicParentKey) {
+            // Canonical keys are strings, since integer ones depend on the SharedKeys' history:
+            slice key = _sharedKeys ? _sharedKeys->decode(n) : slice();
+            throwIf(!key, InvalidData, "Unrecognized integer key");
+            return writeKey(key);
+        }
+        if (_usuallyFalse(_embedHashes))
+            addKeyHash(_sharedKeys && n >= 0 ? _sharedKeys->decode(n) : slice());
         addingKey();
-        writeInt(n);
+        if (_usuallyTrue(n < 2048)) {
+            writeInt(n);
+        } else {
+            // Keys from a SharedKeys with increased capacity are written as inline 2-byte ints,
+            // which makes the Dict wide:
+            byte *buf = placeValue<true>(kIntTag, 1, 3);
+            buf[1] = byte(n & 0xFF);
+            buf[2] = byte(n >> 8);
+        }
         addedKey(nullslice);
     }
 
@@ -655,9 +1843,11 @@ namespace fleece { namespace impl {
             slice str = key->asString();
             throwIf(!str, InvalidData, "Key must be a string or integer");
             int encoded;
-            if (_sharedKeys && _sharedKeys->encodeAndAdd(str, encoded)) {
+            if (_sharedKeys && !_canonical && _sharedKeys->encodeAndAdd(str, encoded)) {
                 writeKey(encoded);
             } else {
+                if (_usuallyFalse(_embedHashes))
+                    addKeyHash(str);
                 addingKey();
                 writeValue(key, nullptr);
                 addedKey(str);
@@ -677,13 +1867,46 @@ namespace fleece { namespace impl {
         _items->keys.push_back(str);
     }
 
+    // Adds a collection's hash, once it's been written, to that of the one containing it.
+    void Encoder::addCollectionHash(const valueArray *items) {
+        if (_usuallyTrue(!_embedHashes))
+            return;
+        if (items->hashable)
+            addHash(items->hash);
+        else
+            _items->hashable = false;
+    }
+
+    // Sets the hash of the current Dict key. A null key's string isn't known (it's the magic
+    // parent key, or an unknown integer), so the Dict's hash isn't either.
+    void Encoder::addKeyHash(slice key) {
+        if (key)
+            _items->keyHash = ValueHash::ofKey(key);
+        else
+            _items->hashable = false;
+    }
+
+    // Adds the hash of the Value just added to the current collection, if it's a Dict value or
+    // an Array item, to the collection's hash (if embedHashes is on.)
+    void Encoder::addHash(uint64_t h) {
+        if (_items->tag == kArrayTag)
+            _items->hash = ValueHash::addItem(_items->hash, h);
+        else if (_items->tag == kDictTag && _writingKey)    // (else it was a key)
+            _items->hash = ValueHash::addEntry(_items->hash, _items->keyHash, h);
+    }
+
     void Encoder::push(tags tag, size_t reserve) {
         if (_usuallyFalse(_stackDepth == 0))
             reset();                        // I'm being reused after finish(), so initialize
+        if (_usuallyFalse(_items->packing))
+            stopPacking();                  // An array containing a collection can't be packed
         if (_usuallyFalse(_stackDepth >= _stack.size()))
             _stack.resize(2*_stackDepth);
         _items = &_stack[_stackDepth++];
-        _items->reset(tag);
+        _items->reset(tag, _retainBuffers);
+        _items->packing = (tag == kArrayTag && _packNumericArrays);
+        if (_usuallyFalse(_embedHashes))
+            _items->hash = (tag == kDictTag) ? ValueHash::beginDict() : ValueHash::beginArray();
         if (reserve > 0) {
             if (_usuallyTrue(tag == kDictTag)) {
                 _items->reserve(2 * reserve);
@@ -709,8 +1932,24 @@ namespace fleece { namespace impl {
         _writingKey = _blockedOnKey = true;
     }
 
+    void Encoder::beginDictionary(size_t reserve, KeyOrder order) {
+        beginDictionary(reserve);
+        _items->keysSorted = (order == kKeysSorted);
+    }
+
     void Encoder::beginDictionary(const Dict *parent, size_t reserve) {
         throwIf(!valueIsInBase(parent), EncodeError, "parent is not in base");
+        if (_maxDictParentDepth > 0) {
+            unsigned depth = 0;
+            for (auto ancestor = parent; ancestor; ancestor = ancestor->getParent())
+                ++depth;
+            if (depth > _maxDictParentDepth) {
+                // Too many ancestors; write a flat Dict, adding the parent's items at the end:
+                beginDictionary(reserve);
+                _items->flatParent = parent;
+                return;
+            }
+        }
         beginDictionary(1 + reserve);
         writeKey(Dict::kMagicParentKey);
         writeValue(parent);
@@ -718,11 +1957,67 @@ namespace fleece { namespace impl {
 
     void Encoder::endArray() {
         endCollection(internal::kArrayTag);
+        maybeSnipProgressively();
     }
 
     void Encoder::endDictionary() {
         throwIf(!_writingKey, EncodeError, "need a value");
+        if (_usuallyFalse(_items->flatParent != nullptr))
+            addParentItems();
         endCollection(internal::kDictTag);
+        maybeSnipProgressively();
+    }
+
+    // Adds the items of a flattened Dict's parent (and its ancestors) whose keys weren't
+    // written, and removes the deletions (undefined values) that were.
+    void Encoder::addParentItems() {
+        valueArray &items = *_items;
+        const Dict *parent = items.flatParent;
+        items.flatParent = nullptr;
+
+        // Get the keys that were written. (An inline string key points into `items`, so this
+        // has to be done before anything else is written.)
+        size_t n = items.keys.size();
+        std::vector<slice> written(n);
+        for (size_t i = 0; i < n; ++i) {
+            const Value &key = items[2*i];
+            if (items.keys[i].buf)
+                written[i] = items.keys[i];
+            else if (key.tag() == kStringTag)
+                written[i] = key.asString();                // inline string
+            else
+                written[i] = _sharedKeys->decode(int(key.asInt()));
+        }
+        std::sort(written.begin(), written.end());
+
+        std::vector<std::pair<slice, const Value*>> inherited;
+        for (DictIterator i(parent, _sharedKeys); i; ++i) {
+            slice key = i.keyString();
+            if (!std::binary_search(written.begin(), written.end(), key))
+                inherited.emplace_back(key, i.value());
+        }
+        for (auto &[key, value] : inherited) {
+            writeKey(key);
+            writeValue(value);
+        }
+
+        // Remove the deleted keys:
+        size_t dst = 0;
+        for (size_t src = 0; src < items.keys.size(); ++src) {
+            if (items[2*src + 1].isUndefined())
+                continue;
+            if (dst != src) {
+                items[2*dst] = items[2*src];
+                items[2*dst + 1] = items[2*src + 1];
+                items.keys[dst] = items.keys[src];
+            }
+            ++dst;
+        }
+        if (dst < items.keys.size()) {
+            items.erase(items.begin() + 2*dst, items.end());
+            items.keys.erase(items.keys.begin() + dst, items.keys.end());
+            items.hashable = false;                 // (the hash includes the deleted keys)
+        }
     }
 
     void Encoder::endCollection(tags tag) {
@@ -733,23 +2028,52 @@ namespace fleece { namespace impl {
                 FleeceException::_throw(EncodeError, "ending wrong type of collection");
         }
 
+        auto packedType = Array::PackedType::kNone;
+        if (_usuallyFalse(_items->packing)) {
+            packedType = packedTypeOfPendingNumbers();
+            if (packedType == Array::PackedType::kNone)
+                stopPacking();
+        }
+
         // Pop _items off the stack:
         valueArray *items = _items;
         pop();
         _writingKey = _blockedOnKey = false;
 
-        auto nValues = items->size();    // includes keys if this is a dict!
-        auto count = (uint32_t)nValues;
+        if (_usuallyFalse(packedType != Array::PackedType::kNone)) {
+            writePackedArray(packedType);
+            addCollectionHash(items);
+            clearItems(items);
+            return;
+        }
+
+        auto count = (uint32_t)items->size();
         if (_usuallyTrue(count > 0)) {
-            if (_usuallyTrue(tag == kDictTag)) {
-                count /= 2;
+            if (_usuallyTrue(tag == kDictTag))
                 sortDict(*items);
+
+            // If uniqueCollections is on and an identical collection has been written, just
+            // write a pointer to it:
+            std::string signature;
+            if (_usuallyFalse(_uniqueCollections)) {
+                signature = collectionSignature(items);
+                if (!signature.empty() && writeEarlierCopy(signature)) {
+                    addCollectionHash(items);
+                    clearItems(items);
+                    return;
+                }
             }
 
+            if (_usuallyTrue(tag == kDictTag))
+                count /= 2;
+
             // Write the array/dict header to the outer Value:
             size_t bufLen = 2;
             if (count >= kLongArrayCount)
                 bufLen += SizeOfVarInt(count - kLongArrayCount);
+            writeFarPointers(items);
+            if (_usuallyFalse(_avoidWideCollections))
+                writeNarrowingPointers(items, bufLen);
             uint32_t inlineCount = std::min(count, (uint32_t)kLongArrayCount);
             byte *buf = placeValue<false>(tag, byte(inlineCount >> 8), bufLen);
             buf[1]  = (byte)(inlineCount & 0xFF);
@@ -763,6 +2087,7 @@ namespace fleece { namespace impl {
             fixPointers(items);
 
             // Write the values:
+            auto nValues = items->size();    // includes keys if this is a dict!
             if (items->wide) {
                 _out.write(&(*items)[0], kWide*nValues);
             } else {
@@ -770,22 +2095,228 @@ namespace fleece { namespace impl {
                 for (auto &v : *items)
                     ::memcpy(narrow++, &v, kNarrow);
             }
+
+            if (tag == kDictTag && _indexLargeDicts && count >= DictIndex::kMinCount)
+                DictIndex::write(_out, &items->keys[0], count);
+
+            // (This has to follow the DictIndex, if one was written.)
+            if (tag == kDictTag && _prefixDictKeys
+                                && count >= DictKeyPrefixes::kMinCount)
+                DictKeyPrefixes::write(_out, &items->keys[0], count);
+
+            // (And this has to follow both of them.)
+            if (_embedHashes && items->hashable && count >= CollectionHash::kMinCount)
+                CollectionHash::write(_out, count, items->hash);
+
+            if (!signature.empty())
+                rememberCopy(std::move(signature));
         } else {
             byte *buf = placeValue<true>(tag, 0, 2);
             buf[1] = 0;
         }
+        addCollectionHash(items);
 
-#ifndef NDEBUG
         if (items->wide) {
-            _numWide++;
-            _wideCount += count;
+            _collectionStats.wide++;
+            _collectionStats.wideItems += count;
         } else {
-            _numNarrow++;
-            _narrowCount += count;
+            _collectionStats.narrow++;
+            _collectionStats.narrowItems += count;
         }
-#endif
 
-        items->clear();
+        clearItems(items);
+    }
+
+#pragma mark - UNIQUE VALUES:
+
+    // While uniqueCollections is on, each out-of-line Value is identified by a key: a scalar's
+    // is its encoded form, and a collection's is its tag (which isn't a valid first byte of a
+    // scalar) followed by its items. _uniqueValues maps the keys to the Values written.
+
+    // Returns the key identifying a collection, or an empty string if it isn't eligible.
+    // The items identify the contents: strings and other scalars are pointers
+    // to their unique copies (or inline), nested collections are pointers to their own unique
+    // copies, and pointers are still absolute positions.
+    std::string Encoder::collectionSignature(const valueArray *items) const {
+        auto n = items->size();
+        if (1 + n * kWide > kMaxUniqueValueSize || !_farPositions.empty())
+            return {};      // (a far pointer item holds an index, not a position)
+        std::string signature(1 + n * kWide, '\0');
+        signature[0] = char(items->tag);
+        memcpy(&signature[1], &(*items)[0], n * kWide);
+        return signature;
+    }
+
+    // If a Value with this key has been written, writes a pointer to it and returns true.
+    bool Encoder::writeEarlierCopy(slice key) {
+        auto found = _uniqueValues.find(std::string(key));
+        if (found == _uniqueValues.end())
+            return false;
+        auto pos = ssize_t(found->second) - ssize_t(baseOrigin());
+        if (!_items->wide && nextWritePos() - pos > Pointer::kMaxNarrowOffset - 32) {
+            // Too far back for a narrow pointer, so a new copy will be written in its place:
+            _uniqueValues.erase(found);
+            return false;
+        }
+        writePointer(pos);
+        return true;
+    }
+
+    // Remembers the Value just written, under its key.
+    void Encoder::rememberCopy(std::string &&key) {
+        if (_uniqueValues.size() < kMaxUniqueValues)
+            _uniqueValues.emplace(std::move(key), lastValueWritten());
+    }
+
+    // Writes an out-of-line scalar, given its encoded form, or a pointer to an earlier copy.
+    void Encoder::writeScalar(slice encoded) {
+        if (_usuallyFalse(_uniqueCollections)) {
+            if (writeEarlierCopy(encoded))
+                return;
+            memcpy(placeValue<false>(encoded.size), encoded.buf, encoded.size);
+            rememberCopy(std::string(encoded));
+        } else {
+            memcpy(placeValue<false>(encoded.size), encoded.buf, encoded.size);
+        }
+    }
+
+#pragma mark - PACKED ARRAYS:
+
+    // While packNumericArrays is on, numbers written to the innermost Array are kept in
+    // _pendingNumbers (with placeholder items) until it ends; then, if they're all of a kind,
+    // they're written as a packed Array. If anything else is added to the Array first, or it
+    // isn't worth packing, stopPacking() writes the numbers normally. Only the innermost Array
+    // can be packing, since an Array containing a collection can't be packed.
+
+    // Adds a number to the packing Array.
+    void Encoder::addPendingNumber(uint8_t kind, uint64_t bits) {
+        throwIf(_blockedOnKey, EncodeError, "need a key before this value");
+        _pendingNumbers.push_back({bits, kind});
+        new (_items->push_back_new()) Value(kSpecialTag, kSpecialValueNull);   // placeholder
+    }
+
+    // Writes the pending numbers as regular items of the Array, and stops packing it.
+    void Encoder::stopPacking() {
+        _items->packing = false;
+        _items->clearKeepingCapacity();
+        uint64_t hash = _items->hash;           // (the numbers were hashed when first written)
+        for (auto &n : _pendingNumbers) {
+            switch (n.kind) {
+                case kPendingInt:   writeInt(int64_t(n.bits)); break;
+                case kPendingUInt:  writeUInt(n.bits); break;
+                case kPendingFloat: _writeFloat(float(doubleOf(n.bits))); break;
+                default:            writeDouble(doubleOf(n.bits)); break;
+            }
+        }
+        _items->hash = hash;
+        _pendingNumbers.clear();
+    }
+
+    // Decides whether the pending numbers can be packed, and whether it's worth it.
+    Array::PackedType Encoder::packedTypeOfPendingNumbers() const {
+        static constexpr size_t kMinPackedCount = 4;
+        if (_pendingNumbers.size() < kMinPackedCount)
+            return Array::PackedType::kNone;
+        bool ints = true, floats = true, fitsInt32 = true, doubles = false;
+        size_t unpackedSize = 0;
+        for (auto &n : _pendingNumbers) {
+            unpackedSize += kNarrow;            // (assuming it'd be a narrow array)
+            switch (n.kind) {
+                case kPendingInt:
+                case kPendingUInt: {
+                    floats = false;
+                    bool isUnsigned = (n.kind == kPendingUInt);
+                    if (isUnsigned && n.bits > uint64_t(INT64_MAX))
+                        ints = false;
+                    int64_t i = int64_t(n.bits);
+                    fitsInt32 = fitsInt32 && i >= INT32_MIN && i <= INT32_MAX;
+                    if (i < -2048 || i >= 2048) {
+                        byte buf[10];
+                        size_t size = 1 + PutIntOfLength(buf, i, isUnsigned);
+                        unpackedSize += size + (size & 1);
+                    }
+                    break;
+                }
+                case kPendingFloat:
+                    ints = false;
+                    unpackedSize += 6;
+                    break;
+                default:
+                    ints = false;
+                    doubles = true;
+                    unpackedSize += 10;
+                    break;
+            }
+            if (!ints && !floats)
+                return Array::PackedType::kNone;
+        }
+        Array::PackedType type;
+        size_t stride;
+        if (ints) {
+            type = fitsInt32 ? Array::PackedType::kInt32 : Array::PackedType::kInt64;
+            stride = fitsInt32 ? 6 : 10;
+        } else {
+            type = doubles ? Array::PackedType::kDouble : Array::PackedType::kFloat;
+            stride = doubles ? 10 : 6;
+        }
+        // (Both sizes leave out the 2-byte header. A packed Array adds the zero count, the marker
+        // and the real count; a regular Array's long count is ignored, which favors it slightly.)
+        size_t countSize = SizeOfVarInt(_pendingNumbers.size());
+        size_t packedSize = 2*kNarrow + countSize + (countSize & 1)
+                            + _pendingNumbers.size() * stride;
+        return (packedSize <= unpackedSize) ? type : Array::PackedType::kNone;
+    }
+
+    // Writes the header of a packed Array to the outer Value, then the pending numbers.
+    void Encoder::writePackedArray(Array::PackedType type) {
+        // The header's count is kLongArrayCount + 0; then come the marker, the real count and
+        // the items themselves (see Internal.hh):
+        auto count = (uint32_t)_pendingNumbers.size();
+        byte *buf = placeValue<false>(kPackedMarkerOffset + kNarrow + SizeOfVarInt(count));
+        buf[0] = byte((kArrayTag << 4) | (kLongArrayCount >> 8));
+        buf[1] = byte(kLongArrayCount & 0xFF);
+        buf[2] = buf[3] = 0;
+        buf[kPackedMarkerOffset] = byte((kSpecialTag << 4) | kSpecialValuePacked);
+        buf[kPackedMarkerOffset + 1] = byte(type);
+        PutUVarInt(&buf[kPackedMarkerOffset + kNarrow], count);
+        bool isInt = (type == Array::PackedType::kInt32 || type == Array::PackedType::kInt64);
+        bool is64 = (type == Array::PackedType::kInt64 || type == Array::PackedType::kDouble);
+        size_t stride = is64 ? 10 : 6;
+        buf = _out.reserveSpace<byte>(count * stride);
+        for (auto &n : _pendingNumbers) {
+            memset(buf, 0, stride);
+            if (isInt) {
+                buf[0] = byte((kIntTag << 4) | (is64 ? 7 : 3));
+                if (is64) {
+                    endian::uint64_le le = n.bits;
+                    memcpy(&buf[1], &le, 8);
+                } else {
+                    endian::uint32_le le = uint32_t(int32_t(int64_t(n.bits)));
+                    memcpy(&buf[1], &le, 4);
+                }
+            } else {
+                buf[0] = byte((kFloatTag << 4) | (is64 ? 0x08 : 0));
+                if (is64) {
+                    endian::littleEndianDouble le = doubleOf(n.bits);
+                    memcpy(&buf[2], &le, 8);
+                } else {
+                    endian::littleEndianFloat le = float(doubleOf(n.bits));
+                    memcpy(&buf[2], &le, 4);
+                }
+            }
+            buf += stride;
+        }
+        _pendingNumbers.clear();
+        _collectionStats.narrow++;
+        _collectionStats.narrowItems += count;
+    }
+
+
+    void Encoder::clearItems(valueArray *items) {
+        if (_retainBuffers)
+            items->clearKeepingCapacity();
+        else
+            items->clear();
     }
 
     // compares dictionary keys as slices. If a slice has a null `buf`, it represents an integer
@@ -804,6 +2335,58 @@ namespace fleece { namespace impl {
         }
     }
 
+    // Dicts with at least this many integer keys have them radix-sorted:
+    static constexpr size_t kMinRadixSortCount = 64;
+
+    // Radix-sorts `n` pointers to integer keys by the keys' values, using `scratch` (which has
+    // room for `n` more) as the other buffer of each pass. The keys are in the `size` fields,
+    // as signed ints; flipping the sign bit makes their unsigned order the same.
+    static void radixSortIntKeys(const FLSlice* *indices, const FLSlice* *scratch, size_t n) {
+        auto digits = [](const FLSlice *key) {return uint32_t(int(key->size)) ^ 0x80000000u;};
+        // Only the bytes where some keys differ need sorting on:
+        uint32_t differing = 0, first = digits(indices[0]);
+        for (size_t i = 1; i < n; i++)
+            differing |= digits(indices[i]) ^ first;
+        const FLSlice* *src = indices, **dst = scratch;
+        for (unsigned shift = 0; shift < 32; shift += 8) {
+            if (((differing >> shift) & 0xFF) == 0)
+                continue;
+            size_t offsets[256] = { };
+            for (size_t i = 0; i < n; i++)
+                ++offsets[(digits(src[i]) >> shift) & 0xFF];
+            size_t total = 0;
+            for (auto &offset : offsets) {
+                size_t count = offset;
+                offset = total;
+                total += count;
+            }
+            for (size_t i = 0; i < n; i++)
+                dst[offsets[(digits(src[i]) >> shift) & 0xFF]++] = src[i];
+            std::swap(src, dst);
+        }
+        if (src != indices)
+            std::copy(src, src + n, indices);
+    }
+
+    // Sorts `indices`, pointers to `n` Dict keys, by compareKeysByIndex. Large sets of integer
+    // (shared) keys are radix-sorted, since comparison sorting is relatively slow for them.
+    void Encoder::sortKeyIndices(const FLSlice* *indices, size_t n) {
+        // Integer keys go before strings; gather them at the start:
+        auto stringsStart = std::partition(&indices[0], &indices[n],
+                                           [](const FLSlice *key) {return key->buf == nullptr;});
+        size_t nInts = stringsStart - &indices[0];
+        if (nInts >= kMinRadixSortCount) {
+            TempArray(tempScratch, const FLSlice*, _retainBuffers ? 0 : nInts);
+            const FLSlice* *scratch = tempScratch;
+            if (_retainBuffers)
+                scratch = &indices[n];                  // sortDict made room in _sortIndices
+            radixSortIntKeys(indices, scratch, nInts);
+        } else {
+            std::sort(&indices[0], stringsStart, &compareKeysByIndex);
+        }
+        std::sort(stringsStart, &indices[n], &compareKeysByIndex);
+    }
+
     void Encoder::sortDict(valueArray &items) {
         auto &keys = items.keys;
         size_t n = keys.size();
@@ -817,23 +2400,58 @@ namespace fleece { namespace impl {
                 if (item->tag() == kStringTag) {
                     keys[i].buf = offsetby(item, 1);                    // inline string
                 } else {
-                    assert(item->tag() == kShortIntTag);
+                    assert(item->tag() == kShortIntTag || item->tag() == kIntTag);
                     keys[i] = {nullptr, (size_t)item->asUnsigned()};    // integer
                 }
             }
         }
 
+        if (_usuallyFalse(_canonical)) {
+            // The keys must already be in order, since the order their values were written in
+            // determines the layout:
+            for (unsigned i = 1; i < n; i++)
+                throwIf(!compareKeysByIndex(&keys[i-1], &keys[i]), EncodeError,
+                        "Dict keys must be written in sorted order in canonical encoding");
+            return;
+        }
+
+        if (items.keysSorted) {
+            // The caller promised the keys are in order:
+            for (unsigned i = 1; i < n; i++)
+                assert_precondition(compareKeysByIndex(&keys[i-1], &keys[i]));
+            return;
+        }
+
+        // Keys copied from a Dict, or from any other sorted source, are already in order, in
+        // which case there's nothing to do. Otherwise this stops at the first one out of order:
+        unsigned nSorted = 1;
+        while (nSorted < n && compareKeysByIndex(&keys[nSorted-1], &keys[nSorted]))
+            ++nSorted;
+        if (nSorted == n)
+            return;
+
         // Construct an array that describes the permutation of item indices:
-        TempArray(indices, const FLSlice*, n);
+        TempArray(tempIndices, const FLSlice*, _retainBuffers ? 0 : n);
+        const FLSlice* *indices = tempIndices;
+        if (_retainBuffers) {
+            if (_sortIndices.size() < 2*n)
+                _sortIndices.resize(2*n);               // (the second half is for sortKeyIndices)
+            indices = _sortIndices.data();
+        }
         const FLSlice* base = &keys[0];
         for (unsigned i = 0; i < n; i++)
             indices[i] = base + i;
-        std::sort(&indices[0], &indices[n], &compareKeysByIndex);
+        sortKeyIndices(indices, n);
         // indices[i] is now a pointer to the Value that should go at index i
 
         // Now rewrite items according to the permutation in indices:
-        TempArray(oldBuf, char, 2*n * sizeof(Value));
-        auto old = (Value*)oldBuf;
+        TempArray(oldBuf, char, _retainBuffers ? 0 : 2*n * sizeof(Value));
+        auto old = (Value*)(char*)oldBuf;
+        if (_retainBuffers) {
+            if (_sortItems.size() < 2*n * sizeof(Value))
+                _sortItems.resize(2*n * sizeof(Value));
+            old = (Value*)_sortItems.data();
+        }
         memcpy(old, &items[0], 2*n * sizeof(Value));
         for (size_t i = 0; i < n; i++) {
             auto j = indices[i] - base;
@@ -842,6 +2460,24 @@ namespace fleece { namespace impl {
                 items[2*i+1] = old[2*j+1];
             }
         }
+
+        if ((_indexLargeDicts && n >= DictIndex::kMinCount)
+                || (_prefixDictKeys && n >= DictKeyPrefixes::kMinCount)) {
+            // Put the keys in sorted order too, for DictIndex::write and DictKeyPrefixes::write:
+            TempArray(tempKeys, FLSlice, _retainBuffers ? 0 : n);
+            FLSlice *oldKeys = tempKeys;
+            if (_retainBuffers) {
+                if (_sortKeys.size() < n)
+                    _sortKeys.resize(n);
+                oldKeys = _sortKeys.data();
+            }
+            memcpy(oldKeys, &keys[0], n * sizeof(FLSlice));
+            for (size_t i = 0; i < n; i++) {
+                keys[i] = oldKeys[indices[i] - base];
+                if (items[2*i].tag() == kStringTag)
+                    keys[i].buf = offsetby(&items[2*i], 1);     // inline string has moved
+            }
+        }
     }
 
 } }
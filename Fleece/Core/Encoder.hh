@@ -19,14 +19,24 @@
 #pragma once
 
 #include "Value.hh"
+#include "Array.hh"
 #include "Writer.hh"
 #include "Doc.hh"
+#include "DocTemplate.hh"
+#include "SharedStrings.hh"
 #include "StringTable.hh"
 #include "SmallVector.hh"
 #include "function_ref.hh"
+#include <atomic>
+#include <functional>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace fleece { namespace impl {
+    class AccessProfile;
     class SharedKeys;
     class key_t;
 
@@ -37,12 +47,136 @@ namespace fleece { namespace impl {
         /** Constructs an encoder. */
         Encoder(size_t reserveOutputSize =256);
         Encoder(FILE* NONNULL);
+
+        /** Constructs an encoder that streams its output to a sink, such as a socket; see the
+            corresponding Writer constructor. Output is passed to the sink as soon as
+            `bufferSize` bytes are ready, since the encoder never needs to look at it again.
+            (Memory use is still proportional to the number of items in the open collections,
+            whose headers can't be written until the collections end, and to the size of the
+            unique-strings table; turn off uniqueStrings to bound the latter.) */
+        Encoder(Writer::OutputSink sink, size_t bufferSize =Writer::kDefaultSinkBufferSize);
+
+        /** Constructs an encoder that writes into caller-provided memory, growing it via the
+            optional callback; see the corresponding Writer constructor. Call finishInPlace()
+            to get the output without copying it. */
+        Encoder(slice buffer, Writer::GrowBufferCallback grow =nullptr);
         ~Encoder();
 
         /** Sets the uniqueStrings property. If true (the default), the encoder tries to write
             each unique string only once. This saves space but makes the encoder slightly slower. */
         void uniqueStrings(bool b)      {_uniqueStrings = b;}
 
+        /** Sets the uniqueCollections property. If true (the default is false), an Array or Dict
+            identical to one already written in this document -- like a repeated address, tag
+            list or block of default settings -- is written as a pointer to the earlier one,
+            instead of again. So are numbers, data and strings that aren't stored inline (and
+            aren't already uniqued by uniqueStrings.) Only smallish collections and values are
+            remembered, up to a limit, to bound the memory used.
+            The output is readable by any version of Fleece. */
+        void uniqueCollections(bool b)  {_uniqueCollections = b;}
+
+        /** Sets the indexLargeDicts property. If true (the default is false), every Dict with at
+            least DictIndex::kMinCount string keys is followed by a hash index of its keys, which
+            makes lookups in it faster. The index is invisible to code that doesn't use it, so
+            the output is still readable by older versions of Fleece. */
+        void indexLargeDicts(bool b)    {_indexLargeDicts = b;}
+
+        /** Sets the prefixDictKeys property. If true (the default is false), every Dict with at
+            least DictKeyPrefixes::kMinCount keys, all strings, is followed by a column of its
+            keys' first 8 bytes, which speeds up string-key lookups. Readers that don't know
+            about it ignore it. */
+        void prefixDictKeys(bool b)     {_prefixDictKeys = b;}
+
+        /** Sets the packNumericArrays property. If true (the default is false), an Array whose
+            items are all integers, or all floating-point numbers, is written as a "packed" array
+            of inline numbers with a fixed stride, if that's no larger. Items of a packed array are
+            accessed without any pointer indirection, and in bulk by Array::getDoubles/getInts.
+            **Packed arrays can't be read by older versions of Fleece.** */
+        void packNumericArrays(bool b)  {_packNumericArrays = b;}
+
+        /** Sets the maxDictParentDepth property. If nonzero (the default is zero, i.e. no
+            limit), a Dict begun with `beginDictionary(parent)` whose chain of ancestors would be
+            longer than this is instead written as an ordinary Dict, containing the parent's
+            items as well as the ones written to it. Lookups in, counting and iterating an
+            inherited Dict have to go through all its ancestors, so this keeps a long series of
+            revisions from getting slower to read with each one, at the cost of the flattened
+            Dicts being bigger. */
+        void maxDictParentDepth(unsigned d) {_maxDictParentDepth = d;}
+
+        /** Sets the checksum property. If true (the default is false), the data ends with a
+            CRC-32C checksum of it, just before the trailer, so that a reader can verify the
+            checksum and then trust the data, instead of validating it; see
+            Value::fromChecksummedData. Readers that don't know about it ignore it.
+            It can't be used when writing to a file, or with suppressTrailer(). */
+        void checksum(bool b)           {_checksum = b;}
+
+        /** Sets the alignNumbers property. If true (the default is false), the 8-byte value of
+            every double written out of line is aligned to an 8-byte boundary of the data, and
+            that of every float to a 4-byte boundary, by padding before it, and the data is marked
+            as aligned (see Value::hasAlignedNumbers), so that readers can load them directly as
+            typed values, e.g. with SIMD instructions. This assumes that the data, including any
+            base it's appended to, starts at an 8-byte-aligned address. Readers that don't know
+            about it ignore it.
+            Integers aren't aligned, since they're stored in as few bytes as they need; nor are
+            the items of packed arrays, whose stride is fixed by the format. Collections aren't
+            relocated while copying, since that would move numbers off their alignment. */
+        void alignNumbers(bool b)       {_alignNumbers = b;}
+
+        /** Sets the avoidWideCollections property. If true (the default is false), a collection
+            that would need 4-byte slots only because a few of its items point too far back for a
+            2-byte Pointer (typically reused strings written long before) keeps 2-byte slots:
+            each of those items points instead to a far pointer written just before the
+            collection, which points the rest of the way. That's done only when the far pointers
+            take less space than the wider slots would, so in a large document more collections
+            stay narrow and their items take half the space and cache lines.
+            Reading such an item costs an extra hop. Readers that don't know about far pointers
+            can't read the data. Pointers into the base aren't redirected if markExternPointers
+            was set. */
+        void avoidWideCollections(bool b) {_avoidWideCollections = b;}
+
+        /** Sets an access profile to lay out copied Dicts by, or clears it if `nullptr`. When a
+            Dict is copied by writeValue(), the values of its keys are written in order of
+            increasing lookup count in the profile, so the most-used ones and their strings end
+            up last, next to the Dict itself; and, in a document being re-encoded, next to the
+            root, where they share cache lines and pages. The output's content is unchanged.
+            The profile's counts are copied, so it can be changed or destroyed afterwards.
+            Dicts written key by key, mutable Dicts, and canonical encoding aren't affected; and
+            copied collections aren't relocated as a block while a profile is set. */
+        void setAccessProfile(const AccessProfile*);
+
+        /** Sets the embedHashes property. If true (the default is false), every Array or Dict
+            with at least CollectionHash::kMinCount items is followed by its hash (see
+            Value::hash), so hashing it is O(1), and so is comparing it with an unequal one that
+            has a hash. Readers that don't know about it ignore it.
+            Dicts with a parent, and collections containing them or Values written by
+            writeValueAgain(), don't get hashes, since the encoder doesn't know their contents. */
+        void embedHashes(bool b)        {_embedHashes = b;}
+
+        /** Sets the canonical property. If true (the default is false), the output depends only
+            on the content written, and on the other options, so equal Values encode to the same
+            bytes: Dict keys are always strings, not SharedKeys integers; numbers are written in
+            their smallest form, with integral floating-point numbers as integers; unique strings
+            are always written once; and Values copied by writeValue() are re-encoded, with Dict
+            keys in sorted order.
+            Dict keys written by the caller must already be in sorted order (by byte), since their
+            values have been written by the time the keys are sorted; endDictionary() throws
+            EncodeError if they aren't. setBase(), setSharedStrings() and writeValueAgain() can't
+            be used. */
+        void canonical(bool b);
+
+        /** Sets the retainBuffers property. If true (the default is false), internal buffers are
+            kept at their high-water mark instead of being freed when they shrink, so that after
+            a few documents an encoder that's reused via reset() or finish() stops allocating
+            memory, apart from the finished output itself. */
+        void retainBuffers(bool b);
+
+        /** Restores the uniqueStrings, uniqueCollections, indexLargeDicts, prefixDictKeys,
+            packNumericArrays, maxDictParentDepth, checksum, alignNumbers, avoidWideCollections,
+            embedHashes, canonical and trailer settings to their defaults, clears the access
+            profile, and clears the SharedKeys and SharedStrings. (The retainBuffers setting is
+            unchanged.) */
+        void resetOptions();
+
         /** Sets the base Fleece data that the encoded data will be (logically) appended to.
             Any writeValue() calls whose Value points into the base data will be written as
             pointers.
@@ -51,21 +185,64 @@ namespace fleece { namespace impl {
                         encoded data) will be marked with the `extern` flag. The resulting Fleece
                         document must then be opened as a Doc using the `externData` property
                         pointing to wherever a copy of the base document is.
+                        (See also useOlderExternSegments().)
             @param cutoff  If nonzero, this specifies the maximum number of bytes of the base
                         (starting from the end) that should be used. Any base data before
                         the cutoff will not be referenced in the encoder output. */
         void setBase(slice base, bool markExternPointers =false, size_t cutoff =0);
 
+        /** If the base, set by setBase() with markExternPointers, is itself the data of a Doc
+            with extern pointers, Values in that Doc's older extern segments are written as
+            pointers too, instead of copies. The Docs of all those segments must stay alive while
+            the result is used. Must be called before reuseBaseStrings() or writing anything. */
+        void useOlderExternSegments();
+
         /** Scans the base document for strings and adds them to the encoder's string table.
             If equivalent strings are written to the encoder they will then be encoded as pointers
             to the existing strings. */
         void reuseBaseStrings();
 
+        /** Prepares to amend a document again, as `reset(); setBase(newBase); reuseBaseStrings()`
+            would. But if `newBase` is the previous base with the last finished output appended
+            to it, and the string table covered that whole base, the table is kept: its entries
+            already locate every string in `newBase`, so the base isn't scanned again, and the
+            cost of an amend doesn't grow with the size of the document.
+            (That's not possible after using extern pointers, a cutoff or SharedStrings.) */
+        void resetForAmend(slice newBase);
+
         bool valueIsInBase(const Value *value) const;
 
+        /** Sets a pool of common strings, or clears it if `nullptr`. Strings in the pool are
+            written as `extern` pointers to it instead of being copied, whether or not
+            uniqueStrings is enabled, so the output must be opened as a Doc whose
+            externDestination is the pool's data() (as finishDoc() does.)
+            The pool becomes the encoder's base, so it can't be combined with setBase(). It stays
+            set after reset(). */
+        void setSharedStrings(SharedStrings*);
+
+        SharedStrings* sharedStrings() const    {return _sharedStrings;}
+
         bool isEmpty() const            {return _out.length() == 0 && _stackDepth == 1 && _items->empty();}
         size_t bytesWritten() const     {return _out.length();} // may be an underestimate
 
+        /** Counts of the collections written since the encoder was created or reset, by the
+            width of their slots. Packed arrays count as narrow. */
+        struct CollectionStats {
+            unsigned narrow {0}, wide {0};              ///< Number of collections
+            unsigned narrowItems {0}, wideItems {0};    ///< Total number of items in them
+            unsigned farPointers {0};   ///< Written by avoidWideCollections to keep them narrow
+
+            /// The fraction of collections that are narrow (1.0 if there are none.)
+            double narrowRatio() const {
+                return (narrow + wide) ? double(narrow) / (narrow + wide) : 1.0;
+            }
+        };
+
+        const CollectionStats& collectionStats() const  {return _collectionStats;}
+
+        /** True after end() or finish(). Only beginArray, beginDictionary or reset can follow. */
+        bool isFinished() const         {return _stackDepth == 0;}
+
         /** Ends encoding, writing the last of the data to the Writer. */
         void end();
 
@@ -75,6 +252,34 @@ namespace fleece { namespace impl {
         /** Returns the encoded data as a Doc. This implicitly calls end(). */
         Retained<Doc> finishDoc();
 
+        /** Returns the encoded data as a DocTemplate, with the placeholders written by
+            writePlaceholder. This implicitly calls end(). */
+        DocTemplate finishTemplate();
+
+        /** Returns the encoded data in place, in the buffer given to the constructor. (The buffer
+            may have been replaced by the grow callback.) This implicitly calls end().
+            The data stays valid until the encoder writes again. */
+        slice finishInPlace();
+
+        /** Ends encoding and passes the encoded data to the sink, one chunk at a time, without
+            copying it into a single block as finish() does; then resets the output.
+            Not available when already writing to a file or sink. */
+        void finishTo(const Writer::OutputSink&);
+
+        /** Like finish(), but then writes the data to a file asynchronously with
+            \ref AsyncFileIO, replacing any existing file. The callback gets null when the file
+            is written, or the exception if that failed. The encoder is free to use meanwhile.
+            Not available when already writing to a file or sink. */
+        void finishToFileAsync(const char *path, std::function<void(std::exception_ptr)>);
+
+        /** Like the callback version of finishToFileAsync, but returns a future. */
+        std::future<void> finishToFileAsync(const char *path);
+
+        /** Ends encoding and writes the encoded data to a file descriptor, such as a socket,
+            passing all the chunks to the OS at once (see Writer::writeOutputToFD); then resets
+            the output. Returns false, with `errno` set, if the write fails. */
+        bool finishToFD(int fd);
+
         /** Resets the encoder so it can be used again. */
         void reset();
 
@@ -84,17 +289,35 @@ namespace fleece { namespace impl {
         void writeUndefined();
         void writeBool(bool);
 
+        /** Writes a placeholder for a value to be filled in by DocTemplate::instantiate, and
+            returns its index. Not available with a base, checksums, embedded hashes, canonical
+            or progressive encoding, or when writing to a file or sink. */
+        unsigned writePlaceholder(DocTemplate::PlaceholderType);
+
         void writeInt(int64_t i);
         void writeUInt(uint64_t i);
         void writeFloat(float);
         void writeDouble(double);
 
-        void writeString(slice s)                           {(void)_writeString(s);}
+        void writeString(slice s) {
+            (void)_writeString(s);
+            if (_usuallyFalse(_embedHashes))
+                addStringHash(s);
+        }
 
         void writeDateString(int64_t timestamp, bool asUTC =true);
 
+        /** Writes a timestamp as an ISO-8601 date string, like writeDateString, but also stores
+            it in binary, so that reading it back with Value::asTimestamp is O(1). Readers that
+            don't know about timestamps see just the string. */
+        void writeTimestamp(int64_t timestamp, bool asUTC =true);
+
         void writeData(slice s);
 
+        /** Writes a sorted array of unsigned integers as a compressed PostingList, which is
+            stored as a Data value. Read it back with the PostingList class. */
+        void writePostingList(const uint64_t values[], size_t count);
+
         void writeValue(const Value* NONNULL v)             {writeValue(v, nullptr);}
 
         using WriteValueFunc = function_ref<bool(const Value *key, const Value *value)>;
@@ -104,6 +327,22 @@ namespace fleece { namespace impl {
             the callback can invoke the Encoder to write a different Value instead if it likes. */
         void writeValue(const Value* NONNULL v, WriteValueFunc fn)  {writeValue(v, &fn);}
 
+        /** Writes a large mutable Array or Dict like writeValue, but encodes its big subtrees
+            concurrently on `nThreads` threads (0 means the Executor's concurrency), each into
+            its own Encoder. Their outputs are appended to this one's, and the rest of the tree
+            is written with pointers to them; their strings are added to this Encoder's, so later
+            strings can be shared. Which subtrees are split off depends only on the tree, so the
+            output is the same for any number of threads (even one), but it may differ from
+            writeValue's, as strings in different subtrees aren't shared.
+            Falls back to writeValue if the Value is immutable or small, or if this Encoder has
+            a base or uses an option that depends on the rest of the document (canonical,
+            embedHashes, alignNumbers, uniqueCollections, shared strings, an access
+            profile, or progressive output.) */
+        void writeValueParallel(const Value* NONNULL, unsigned nThreads =0);
+
+        /** The minimum number of Values in a subtree that writeValueParallel encodes separately. */
+        static constexpr size_t kMinParallelSubtree = 1024;
+
 #ifdef __OBJC__
         /** Writes an Objective-C object. Supported classes are the ones allowed by
             NSJSONSerialization, as well as NSData. */
@@ -131,6 +370,19 @@ namespace fleece { namespace impl {
                             effect on the output but can speed up encoding slightly. */
         void beginDictionary(size_t reserve =0);
 
+        enum KeyOrder {
+            kKeysUnsorted,      ///< Keys may be written in any order
+            kKeysSorted,        ///< Keys will be written in sorted order (see below)
+        };
+
+        /** Begins creating a dictionary, like the above, but with a hint about the order its
+            keys will be written in. With kKeysSorted the caller promises to write them in the
+            order a Dict stores them: integer keys first, in numeric order, then string keys in
+            byte order. The Encoder then doesn't sort them, or even check the order (except in
+            debug builds.) Keys written in order without the hint are detected anyway, but that
+            costs a comparison per key. */
+        void beginDictionary(size_t reserve, KeyOrder);
+
         /** Begins creating a dictionary which inherits from an existing dictionary. */
         void beginDictionary(const Dict *parent NONNULL, size_t reserve =0);
 
@@ -146,10 +398,38 @@ namespace fleece { namespace impl {
 
         void writeKey(key_t);
 
+        /** A Dict key prepared for writing many times, by any number of Encoders. Its string's
+            hash is computed once, and its integer encoding in a SharedKeys is remembered once
+            it's been found, so writing it doesn't hash the string or look it up again. */
+        class PreparedKey {
+        public:
+            explicit PreparedKey(slice string)
+            :_string(string)
+            ,_hash(StringTable::hashCode(_string))
+            { }
+
+            slice string() const                    {return _string;}
+
+        private:
+            alloc_slice const           _string;
+            StringTable::hash_t const   _hash;
+            mutable std::atomic<int>    _intKey {-1};   // Last known encoding in a SharedKeys
+
+            friend class Encoder;
+        };
+
+        /** Writes a PreparedKey to the current dictionary; equivalent to `writeKey(key.string())`.
+            The integer encoding is validated against this Encoder's SharedKeys by decoding it,
+            which is just an array lookup, so a key can be shared by Encoders with different
+            SharedKeys (but that of course makes it look up the key each time.) */
+        void writeKey(const PreparedKey&);
+
         /** Associates a SharedKeys object with this Encoder. The writeKey() methods that take
             strings will consult this object to possibly map the key to an integer. */
         void setSharedKeys(SharedKeys *s);
 
+        SharedKeys* sharedKeys() const              {return _sharedKeys;}
+
         //////// "<<" convenience operators;
 
         // Note: overriding <<(bool) would be dangerous due to implicit conversion
@@ -185,13 +465,28 @@ namespace fleece { namespace impl {
         /** Returns the data written so far as a standalone Fleece document, whose root is the last
             value written. You can continue writing, and the final output returned by \ref finish will
             consist of everything after this point. It can be used in the future by loading it with the
-            first part as its `extern` reference. */
+            first part as its `extern` reference.
+            It can be called again later: each snipped part uses the ones before it as its
+            extern segments, as does the final output. */
         alloc_slice snip();
 
-#if 0
-        static bool isIntRepresentable(float n) noexcept;
+        using ChunkCallback = std::function<void(alloc_slice chunk)>;
+
+        /** Turns on progressive output, for sending a large document while it's being encoded.
+            Whenever at least `chunkSize` bytes have been written, the output so far is snipped
+            off and passed to the callback as a chunk, and later output refers to it with extern
+            pointers. The output of \ref finish is the final chunk. A receiver can open the
+            chunks in order with a \ref ProgressiveDoc, and read parts of the document before it
+            has all arrived.
+
+            The root of each chunk is a collection of the same type as the document's, holding
+            the items of the top-level Array or Dict that were completed since the last chunk.
+            Chunks are only cut between top-level items, after one that's an Array or Dict or
+            before a Dict key, so an Array of scalars isn't split.
+            A chunkSize of 0 turns progressive output off. */
+        void snipEvery(size_t chunkSize, ChunkCallback);
+
         static bool isIntRepresentable(double n) noexcept;
-#endif
         static bool isFloatRepresentable(double n) noexcept;
 
     private:
@@ -199,15 +494,34 @@ namespace fleece { namespace impl {
 
         static constexpr size_t kInitialStackSize = 4;
         static constexpr size_t kInitialCollectionCapacity = 16;
+        // Limits on the Values remembered by uniqueCollections: their number and (encoded) size.
+        static constexpr size_t kMaxUniqueValues = 4096, kMaxUniqueValueSize = 256;
 
         // Stores the pending values to be written to an in-progress array/dict
         class valueArray : public smallVector<Value, kInitialCollectionCapacity> {
         public:
             valueArray()                    =default;
-            void reset(internal::tags t)    {tag = t; wide = false; keys.clear();}
+            void reset(internal::tags t, bool keepCapacity) {
+                tag = t;
+                wide = false;
+                packing = false;
+                hashable = true;
+                keysSorted = false;
+                flatParent = nullptr;
+                if (keepCapacity)
+                    keys.clearKeepingCapacity();
+                else
+                    keys.clear();
+            }
             
             internal::tags tag;
             bool wide;
+            bool packing;       // Items are placeholders for _pendingNumbers (see Encoder.cc)
+            bool hashable;      // False if the hash of an item is unknown (see embedHashes)
+            bool keysSorted;    // True if the Dict's keys are known to be in order
+            uint64_t hash;      // Hash of the items so far, if embedHashes is on
+            uint64_t keyHash;   // Hash of the current Dict key, if embedHashes is on
+            const Dict* flatParent; // Parent whose items get added at the end (maxDictParentDepth)
             smallVector<FLSlice, kInitialCollectionCapacity> keys;
         };
 
@@ -218,25 +532,70 @@ namespace fleece { namespace impl {
         template <bool canInline> byte* placeValue(size_t size);
         template <bool canInline> byte* placeValue(internal::tags tag, byte param, size_t size);
         void reuseBaseStrings(const Value* NONNULL);
+        void resetExceptStrings();
         void cacheString(slice s, size_t offsetInBase);
         static bool isNarrowValue(const Value *value NONNULL);
         void writePointer(ssize_t pos);
+        void setItemPointer(Value &item, ssize_t pos);
+        ssize_t itemPointerPos(const Value &item) const;
+        void writeFarPointers(valueArray *items NONNULL);
+        void writeNarrowingPointers(valueArray *items NONNULL, size_t headerLen);
+        void writeProfiledDict(const Dict* NONNULL, const SharedKeys*&, const WriteValueFunc*);
+        ssize_t basePosition(const Value*) const;
+        size_t baseOrigin() const               {return _base.size + _olderSegmentsSize;}
         void writeSpecial(uint8_t special);
         void writeInt(uint64_t i, bool isShort, bool isUnsigned);
         void _writeFloat(float);
         const void* writeData(internal::tags, slice s);
-        const void* _writeString(slice);
+        void writeTimestamp(slice str, int64_t timestamp, int tzOffset);
+        const void* _writeString(slice, StringTable::hash_t =StringTable::hash_t::Empty);
+        void writeStringKey(slice, StringTable::hash_t =StringTable::hash_t::Empty);
+        const Value* writeSharedString(slice, StringTable::hash_t);
         void addingKey();
         void addedKey(FLSlice str);
+        void addHash(uint64_t);
+        void addStringHash(slice);
+        void addKeyHash(slice);
+        void addCollectionHash(const valueArray* NONNULL);
+        alloc_slice snipAt(PreWrittenValue root);
+        void maybeSnipProgressively() {
+            if (_usuallyFalse(_snipChunkSize > 0) && _stackDepth == 2
+                    && _out.length() >= _snipChunkSize)
+                snipProgressively();
+        }
+        void snipProgressively();
         void sortDict(valueArray &items);
+        void addParentItems();
+        void sortKeyIndices(const FLSlice* *indices, size_t n);
+        void clearItems(valueArray *items NONNULL);
         void checkPointerWidths(valueArray *items NONNULL, size_t writePos);
         void fixPointers(valueArray *items NONNULL);
+        void writeChecksumBlock();
+        void fillInChecksum(slice output);
+        void fillInChecksum(const std::vector<slice> &chunks);
         void endCollection(internal::tags tag);
+        void addPendingNumber(uint8_t kind, uint64_t bits);
+        void stopPacking();
+        Array::PackedType packedTypeOfPendingNumbers() const;
+        void writePackedArray(Array::PackedType);
+        std::string collectionSignature(const valueArray *items NONNULL) const;
+        bool writeEarlierCopy(slice key);
+        void rememberCopy(std::string &&key);
+        void writeScalar(slice encoded);
+        void alignNextValue(size_t payloadOffset, size_t alignment);
+        void writeRootOutOfLine();
+        void writeAlignedMarker();
         void push(internal::tags tag, size_t reserve);
         inline void pop();
         void writeKey(int);
         void writeValue(const Value* NONNULL, const WriteValueFunc*);
         void writeValue(const Value* NONNULL, const SharedKeys* &, const WriteValueFunc*);
+        void writeCanonicalDict(const Dict* NONNULL, const SharedKeys* &, const WriteValueFunc*);
+        void writeSplicedValue(const Value* NONNULL,
+                               const std::unordered_map<const Value*, size_t> &written);
+        struct Relocation;
+        bool relocateValue(const Value* NONNULL, const SharedKeys* &);
+        bool scanForRelocation(const Value* NONNULL, Relocation&);
         const Value* minUsed(const Value *value);
 
         Encoder(const Encoder&) = delete;
@@ -252,23 +611,53 @@ namespace fleece { namespace impl {
         unsigned _stackDepth;        // Current depth of _stack
         PreallocatedStringTable<kInitialStringTableSize> _strings; // Maps strings to the offsets where they appear as values
         Writer _stringStorage;       // Backing store for strings in _strings
+        bool _stringsCoverBase {true}; // Does _strings have all the strings in _base?
+        size_t _stringsEnd {0};      // Size of base + output _strings covers, after finishing
         bool _uniqueStrings {true};  // Should strings be uniqued before writing?
+        bool _indexLargeDicts {false}; // Should large dicts be followed by a hash index?
+        bool _prefixDictKeys {false};  // Should large dicts be followed by key prefixes?
+        bool _retainBuffers {false}; // Keep buffers at their high-water mark?
+        bool _packNumericArrays {false}; // Should Arrays of numbers be packed?
+        unsigned _maxDictParentDepth {0}; // Max ancestors of a Dict with a parent (0 = no limit)
+        struct PendingNumber {uint64_t bits; uint8_t kind;};
+        std::vector<PendingNumber> _pendingNumbers; // Items of the packing Array, if any
+        bool _uniqueCollections {false}; // Should identical collections be written only once?
+        std::unordered_map<std::string, PreWrittenValue> _uniqueValues; // Key -> Value written
+        std::vector<const FLSlice*> _sortIndices;   // Scratch space for sortDict, if _retainBuffers
+        std::vector<uint8_t> _sortItems;            // Scratch space for sortDict, if _retainBuffers
+        std::vector<FLSlice> _sortKeys;             // Scratch space for sortDict, if _retainBuffers
         Retained<SharedKeys> _sharedKeys;  // Client-provided key-to-int mapping
+        Retained<SharedStrings> _sharedStrings; // Client-provided pool of common strings
         slice _base;                 // Base Fleece data being appended to (if any)
         alloc_slice _ownedBase;      // If I allocated _base, it's stored here too to retain it
         const void* _baseCutoff {0}; // Lowest addr in _base that I can write a ptr to
         const void* _baseMinUsed {0};// Lowest addr in _base I've written a ptr to
+        std::vector<slice> _olderSegments;  // Extern segments before _base, newest first
+        size_t _olderSegmentsSize {0};      // Total size of _olderSegments
+        std::vector<size_t> _farPositions;  // Item pointer targets too far to store inline
+        std::vector<DocTemplate::Placeholder> _placeholders; // Written by writePlaceholder
         int _copyingCollection {0};  // Nonzero inside writeValue when writing array/dict
         bool _writingKey    {false}; // True if Value being written is a key
         bool _blockedOnKey  {false}; // True if writes should be refused
         bool _trailer       {true};  // Write standard trailer at end?
+        bool _checksum      {false}; // Write a checksum before the trailer?
+        bool _alignNumbers  {false}; // Align out-of-line floating-point numbers?
+        bool _avoidWideCollections {false}; // Redirect far items to keep collections narrow?
+        bool _embedHashes   {false}; // Follow large collections with their hashes?
+        bool _canonical     {false}; // Make the output depend only on the content?
+        ssize_t _checksumPos {-1};   // Position of the checksum block in _out, if written
         bool _markExternPtrs{false}; // Mark pointers outside encoded data as 'extern'
+        std::vector<alloc_slice> _snippedParts; // Earlier snipped parts, retained for _olderSegments
+        size_t _snipChunkSize {0};   // Progressive chunk size, or 0 if not in progressive mode
+        ChunkCallback _snipCallback; // Receives progressive chunks
+        size_t _snippedItems {0};    // Number of top-level items already in a progressive chunk
+        CollectionStats _collectionStats;   // Numbers of narrow and wide collections
+        std::unordered_map<std::string, uint64_t> _keyHeat; // Lookup counts from AccessProfile
 
         friend class EncoderTests;
 #ifndef NDEBUG
     public: // Statistics for use in tests
-        unsigned _numNarrow {0}, _numWide {0}, _narrowCount {0}, _wideCount {0},
-                 _numSavedStrings {0};
+        unsigned _numSavedStrings {0};
 #endif
     };
 
@@ -39,8 +39,22 @@
  1xoooooo oooooooo       pointer (x = external?, denotes ptr outside data to prev written data;
                                 o = BE unsigned offset in units of 2 bytes back, up to -32KB)
                                 NOTE: In a wide collection, offset field is 30 bits wide
+ 00110001 00000000 o...  far pointer (o = LE 64-bit byte offset back to the destination.) This is
+                                only ever the target of a pointer whose destination is too far
+                                back for it to reach, i.e. in data over 2GB; see Pointer.hh.
 
  Bits marked "-" are reserved and should be set to zero.
+
+ A timestamp is a string (its ISO-8601 form) whose count is written as the non-minimal varint
+ `1ccccccc 00000000`, which the minimal encoding never produces; the string is followed by a
+ trailer: the LE int64 milliseconds since the Unix epoch, then the LE int16 timezone offset in
+ minutes. Readers that don't know about timestamps just see the string.
+
+ A packed array (see Encoder::packNumericArrays) has the count 2047 + 0, i.e. the header
+ `01100111 11111111 00000000 00000000`, followed by the marker `00110010 tttttttt` (t is the
+ Array::PackedType of its items), then the real count as a varint padded to even length, then
+ the items: inline numbers of that type, each padded to the type's fixed stride. An ordinary
+ array of 2047 items can't start with that marker, and readers only look for it in that case.
 */
 
 namespace fleece { namespace impl { namespace internal {
@@ -71,8 +85,13 @@ namespace fleece { namespace impl { namespace internal {
         kSpecialValueUndefined  = 0x0C,       // 1100
         kSpecialValueFalse      = 0x04,       // 0100
         kSpecialValueTrue       = 0x08,       // 1000
+        kSpecialValuePacked     = 0x02,       // 0010 (only as the first item of a packed array)
+        kSpecialValueFar        = 0x01,       // 0001 (only as a far pointer; see Pointer.hh)
     };
 
+    // Size of the binary trailer that follows a timestamp's string
+    static const size_t kTimestampTrailerSize = 10;
+
     // Min/max length of string that will be considered for sharing
     // (not part of the format, just a heuristic used by the encoder & Obj-C decoder)
     static const size_t kMinSharedStringSize =  2;
@@ -81,11 +100,26 @@ namespace fleece { namespace impl { namespace internal {
     // Minimum array count that has to be stored outside the header
     static const uint32_t kLongArrayCount = 0x07FF;
 
+    // Offset of a packed array's marker, after its header and the zero varint count
+    static const size_t kPackedMarkerOffset = 4;
+
+    // The block before the trailer of checksummed data: a 7-byte binary Value, the 3 bytes
+    // "CRC" then the little-endian CRC-32C of the rest of the data (see Encoder::checksum.)
+    static constexpr size_t kChecksumSize = 8;
+    static constexpr uint8_t kChecksumHeader[4] = {(kBinaryTag << 4) | 7, 'C', 'R', 'C'};
+
+    // The block that marks data written with Encoder::alignNumbers: a 7-byte binary Value,
+    // "ALIGNED", before the trailer (and before the checksum block, if any.)
+    static constexpr size_t kAlignedMarkerSize = 8;
+    static constexpr uint8_t kAlignedMarker[kAlignedMarkerSize] =
+        {(kBinaryTag << 4) | 7, 'A', 'L', 'I', 'G', 'N', 'E', 'D'};
+
     class Pointer;
     class HeapValue;
     class HeapCollection;
     class HeapArray;
     class HeapDict;
+    class HashCache;
 
     // There is a sanity-check that prevents the use of numeric dict keys when there is no
     // SharedKeys in scope. The Encoder test case "DictionaryNumericKeys" needs to disable this
@@ -95,7 +129,6 @@ namespace fleece { namespace impl { namespace internal {
     constexpr bool gDisableNecessarySharedKeysCheck = false;
 #else
     extern bool gDisableNecessarySharedKeysCheck;
-    extern std::atomic<unsigned> gTotalComparisons;
 #endif
 
 // Value instances are only declared directly in a few special cases such as the constants
@@ -18,8 +18,20 @@
 
 #include "JSONConverter.hh"
 #include "NumConversion.hh"
+#include "PlatformCompat.hh"
+#include "Bitmap.hh"
+#include "Executor.hh"
+#include "Tracing.hh"
+#include "UTF8.hh"
 #include "jsonsl.h"
+#include <cctype>
+#include <cstring>
 #include <map>
+#include <vector>
+
+#ifdef FL_HAVE_SSE2
+    #include <emmintrin.h>
+#endif
 
 namespace fleece { namespace impl {
 
@@ -36,9 +48,10 @@ namespace fleece { namespace impl {
                                  struct jsonsl_state_st *state,
                                  const char *buf) noexcept;
 
-    JSONConverter::JSONConverter(Encoder &e) noexcept
+    JSONConverter::JSONConverter(Encoder &e, Parser parser) noexcept
     :_encoder(e),
-     _jsn(jsonsl_new(50)),      // never returns nullptr, according to source code
+     _jsn(jsonsl_new(kMaxNestingLevels)),      // never returns nullptr, according to source code
+     _parser(parser),
      _jsonError(JSONSL_ERROR_SUCCESS),
      _errorPos(0)
     {
@@ -53,44 +66,134 @@ namespace fleece { namespace impl {
         jsonsl_reset(_jsn);
         _jsonError = JSONSL_ERROR_SUCCESS;
         _errorPos = 0;
+        _pending.clear();
+        _feeding = false;
     }
 
-    const char* JSONConverter::errorMessage() noexcept {
-        if (!_errorMessage.empty())
-            return _errorMessage.c_str();
-        else if (_jsonError == kErrExceptionThrown)
+    // Returns the message for a parse error code, using `storage` if it has to be composed.
+    static const char* jsonErrorMessage(int jsonError, std::string &storage) {
+        if (jsonError == JSONConverter::kErrExceptionThrown)
             return "Unexpected C++ exception";
-        else if (_jsonError == kErrTruncatedJSON)
+        else if (jsonError == JSONConverter::kErrTruncatedJSON)
             return "Truncated JSON";
+        else if (jsonError == JSONConverter::kErrInvalidUTF8)
+            return "Invalid UTF-8 in JSON string";
         else {
-            _errorMessage = std::string("JSON parse error: ") +
-                                    jsonsl_strerror((jsonsl_error_t)_jsonError);
-            return _errorMessage.c_str();
+            storage = std::string("JSON parse error: ") +
+                                    jsonsl_strerror((jsonsl_error_t)jsonError);
+            return storage.c_str();
         }
     }
 
+    const char* JSONConverter::errorMessage() noexcept {
+        if (!_errorMessage.empty())
+            return _errorMessage.c_str();
+        return jsonErrorMessage(_jsonError, _errorMessage);
+    }
+
 
     bool JSONConverter::encodeJSON(slice json) {
-        _input = json;
+        tracing::Span span("JSONConverter::encodeJSON", json.size);
+        size_t startPos = _encoder.bytesWritten();
+        bool ok;
+        if (_parser != kJsonslParser) {
+            begin();
+            _feeding = false;
+            ok = parseFast(json);
+        } else {
+            feed(json);
+            ok = finish();
+        }
+        span.setOutputSize(_encoder.bytesWritten() - startPos);
+        return ok;
+    }
+
+
+    void JSONConverter::begin() {
         _errorMessage.clear();
         _errorCode = NoError;
         _jsonError = JSONSL_ERROR_SUCCESS;
         _errorPos = 0;
+        _pending.clear();
+        _feeding = true;
 
         _jsn->data = this;
         _jsn->action_callback_PUSH = writePushCallback;
         _jsn->action_callback_POP  = writePopCallback;
         _jsn->error_callback = errorCallback;
         jsonsl_enable_all_callbacks(_jsn);
+    }
+
+
+    bool JSONConverter::feed(slice chunk) {
+        if (!_feeding)
+            begin();
+        if (_jsonError)
+            return false;
+
+        if (_parser != kJsonslParser) {
+            // The fast parser needs the whole input, so just collect it until finish():
+            _pending.append((const char*)chunk.buf, chunk.size);
+            return true;
+        }
 
-        jsonsl_feed(_jsn, (char*)json.buf, json.size);
+        _chunk = chunk;
+        _chunkPos = _jsn->pos;
+        if (_pending.empty()) {
+            _input = chunk;
+            _inputPos = _chunkPos;
+        } else {
+            // A token is continued from the previous chunk, so it needs to be contiguous:
+            _pending.append((const char*)chunk.buf, chunk.size);
+            _input = slice(_pending);
+            _inputPos = _pendingPos;
+        }
+
+        jsonsl_feed(_jsn, (char*)chunk.buf, chunk.size);
+
+        if (_jsonError) {
+            _pending.clear();
+        } else {
+            // If the chunk ended in the middle of a string or number, save what's been seen of
+            // it, since the next chunk won't include it:
+            auto state = &_jsn->stack[_jsn->level];
+            if (_jsn->level > 0 && (state->type == JSONSL_T_STRING
+                                        || state->type == JSONSL_T_HKEY
+                                        || state->type == JSONSL_T_SPECIAL)) {
+                if (_pending.empty()) {
+                    _pending.assign(inputAt(state->pos_begin),
+                                    _jsn->pos - state->pos_begin);
+                } else {
+                    _pending.erase(0, state->pos_begin - _pendingPos);
+                }
+                _pendingPos = state->pos_begin;
+            } else {
+                _pending.clear();
+            }
+        }
+        _input = _chunk = nullslice;
+        return !_jsonError;
+    }
+
+
+    bool JSONConverter::finish() {
+        if (!_feeding)
+            begin();
+        if (_parser != kJsonslParser) {
+            std::string input = std::move(_pending);
+            _pending.clear();
+            _feeding = false;
+            return !_jsonError && parseFast(slice(input));
+        }
         if (_jsn->level > 0 && !_jsonError) {
             // Input is valid JSON so far, but truncated:
             _jsonError = kErrTruncatedJSON;
             _errorCode = JSONError;
-            _errorPos = json.size;
+            _errorPos = _jsn->pos;
         }
         jsonsl_reset(_jsn);
+        _pending.clear();
+        _feeding = false;
         return (_jsonError == JSONSL_ERROR_SUCCESS);
     }
 
@@ -102,6 +205,170 @@ namespace fleece { namespace impl {
         return enc.finish();
     }
 
+    /*static*/ alloc_slice JSONConverter::convertJSON(slice json, SharedKeys *sk,
+                                                      ErrorCode &outError,
+                                                      std::string *outErrorMessage)
+    {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        JSONConverter cvt(enc);
+        if (_usuallyFalse(!cvt.encodeJSON(json))) {
+            outError = cvt.errorCode();
+            if (outErrorMessage)
+                *outErrorMessage = cvt.errorMessage();
+            return nullslice;
+        }
+        outError = NoError;
+        return enc.finish();
+    }
+
+    /*static*/ alloc_slice JSONConverter::convertJSON5(slice json5, SharedKeys *sk) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        JSONConverter cvt(enc, kJSON5Parser);
+        throwIf(!cvt.encodeJSON(json5), JSONError, cvt.errorMessage());
+        return enc.finish();
+    }
+
+
+#pragma mark - PARALLEL CONVERSION:
+
+
+    static inline const char* skipWhitespace(const char *pos, const char *end) {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\n' || *pos == '\r'))
+            ++pos;
+        return pos;
+    }
+
+    // Finds the items of a top-level JSON array, without parsing them. Only tracks nesting and
+    // string delimiters; the items themselves are validated later, when they're converted.
+    // Returns false if `json` isn't a single array, or is obviously malformed.
+    static bool splitJSONArray(slice json, std::vector<slice> &items) {
+        auto end = (const char*)json.end();
+        auto pos = skipWhitespace((const char*)json.buf, end);
+        if (pos == end || *pos != '[')
+            return false;
+        pos = skipWhitespace(pos + 1, end);
+        if (pos < end && *pos == ']')
+            return skipWhitespace(pos + 1, end) == end;     // empty array
+        auto itemStart = pos;
+        int depth = 0;
+        for (; pos < end; ++pos) {
+            switch (*pos) {
+                case '"':
+                    for (++pos; pos < end && *pos != '"'; ++pos) {
+                        if (*pos == '\\')
+                            ++pos;
+                    }
+                    break;
+                case '[':
+                case '{':
+                    ++depth;
+                    break;
+                case ']':
+                case '}':
+                    if (depth-- > 0)
+                        break;
+                    // else it's the end of the top-level array:
+                    if (itemStart == pos)
+                        return false;
+                    items.emplace_back(itemStart, pos);
+                    return skipWhitespace(pos + 1, end) == end;
+                case ',':
+                    if (depth == 0) {
+                        if (itemStart == pos)
+                            return false;
+                        items.emplace_back(itemStart, pos);
+                        itemStart = skipWhitespace(pos + 1, end);
+                        pos = itemStart - 1;
+                    }
+                    break;
+            }
+        }
+        return false;
+    }
+
+
+    /*static*/ alloc_slice JSONConverter::convertJSONArray(slice json, SharedKeys *sk,
+                                                           unsigned nThreads)
+    {
+        nThreads = Executor::resolveThreads(nThreads);
+        std::vector<slice> items;
+        if (nThreads < 2 || json.size < kMinParallelJSONSize
+                         || !splitJSONArray(json, items) || items.size() < nThreads)
+            return convertJSON(json, sk);
+
+        // Each thread converts a contiguous run of items, writing them as separate top-level
+        // values (with no trailer) and remembering where each one starts:
+        struct Segment {
+            size_t firstItem, endItem;
+            alloc_slice data;
+            std::vector<size_t> itemPos;
+            bool ok {false};
+        };
+        std::vector<Segment> segments(nThreads);
+        Executor::parallelFor(nThreads, nThreads, [&](size_t t) {
+            Segment &seg = segments[t];
+            seg.firstItem = items.size() * t / nThreads;
+            seg.endItem   = items.size() * (t + 1) / nThreads;
+            try {
+                Encoder enc;
+                enc.setSharedKeys(sk);
+                enc.suppressTrailer();
+                JSONConverter cvt(enc, kFastParser);
+                seg.itemPos.reserve(seg.endItem - seg.firstItem);
+                for (size_t i = seg.firstItem; i < seg.endItem; ++i) {
+                    if (!cvt.encodeJSON(items[i]))
+                        return;
+                    seg.itemPos.push_back(enc.finishItem());
+                }
+                seg.data = enc.finish();
+                seg.ok = true;
+            } catch (...) { }
+        });
+
+        // On any error, redo the conversion serially; that way the exception thrown is the same
+        // one (with the same message and position) that convertJSON would have thrown.
+        size_t baseSize = 0;
+        for (auto &seg : segments) {
+            if (!seg.ok)
+                return convertJSON(json, sk);
+            baseSize += seg.data.size;
+        }
+
+        // Since Fleece pointers are relative, the segments remain valid when concatenated.
+        // Then the top-level array is encoded as a delta pointing back into them:
+        alloc_slice base(baseSize);
+        size_t offset = 0;
+        for (auto &seg : segments) {
+            memcpy((char*)base.buf + offset, seg.data.buf, seg.data.size);
+            for (auto &pos : seg.itemPos)
+                pos += offset;
+            offset += seg.data.size;
+        }
+
+        Encoder enc(baseSize / 8 + 256);
+        enc.setSharedKeys(sk);
+        enc.setBase(base);
+        enc.beginArray(items.size());
+        for (auto &seg : segments) {
+            for (auto pos : seg.itemPos) {
+                auto item = (const Value*)offsetby(base.buf, pos);
+                if (item->type() == kArray || item->type() == kDict)
+                    enc.writeValueAgain(Encoder::PreWrittenValue(pos));  // skips a tree walk
+                else
+                    enc.writeValue(item);
+            }
+        }
+        enc.endArray();
+        alloc_slice top = enc.finish();
+
+        alloc_slice result(baseSize + top.size);
+        memcpy((void*)result.buf, base.buf, baseSize);
+        memcpy((char*)result.buf + baseSize, top.buf, top.size);
+        return result;
+    }
+
     inline void JSONConverter::push(struct jsonsl_state_st *state) {
         switch (state->type) {
             case JSONSL_T_LIST:
@@ -114,8 +381,9 @@ namespace fleece { namespace impl {
     }
 
     void JSONConverter::writeDouble(struct jsonsl_state_st *state) {
-        char *start = (char*)&_input[state->pos_begin];
-        _encoder.writeDouble(ParseDouble(start));
+        double d;
+        ParseDouble(slice(inputAt(state->pos_begin), state->pos_cur - state->pos_begin), d);
+        _encoder.writeDouble(d);
     }
 
     inline void JSONConverter::pop(struct jsonsl_state_st *state) {
@@ -123,14 +391,13 @@ namespace fleece { namespace impl {
             case JSONSL_T_SPECIAL: {
                 unsigned f = state->special_flags;
                 if (f & JSONSL_SPECIALf_FLOAT || f & JSONSL_SPECIALf_EXPONENT) {
-                    char *start = (char*)&_input[state->pos_begin];
-                    _encoder.writeDouble(ParseDouble(start));
+                    writeDouble(state);
                 } else if (f & JSONSL_SPECIALf_UNSIGNED) {
                     if (_usuallyTrue(state->pos_cur - state->pos_begin < 19)) {
                         _encoder.writeUInt(state->nelem);
                     } else {
                         // Parse super long numbers carefully; go to double on overflow:
-                        char *start = (char*)&_input[state->pos_begin];
+                        char *start = (char*)inputAt(state->pos_begin);
                         uint64_t n;
                         if (ParseUnsignedInteger(start, n, true))
                             _encoder.writeUInt(n);
@@ -142,7 +409,7 @@ namespace fleece { namespace impl {
                         _encoder.writeInt(-(int64_t)state->nelem);
                     } else {
                         // Parse super long numbers carefully; go to double on overflow:
-                        char *start = (char*)&_input[state->pos_begin];
+                        char *start = (char*)inputAt(state->pos_begin);
                         int64_t n;
                         if (ParseInteger(start, n, true))
                             _encoder.writeInt(n);
@@ -160,8 +427,12 @@ namespace fleece { namespace impl {
             }
             case JSONSL_T_STRING:
             case JSONSL_T_HKEY: {
-                slice str(&_input[state->pos_begin + 1],
+                slice str(inputAt(state->pos_begin + 1),
                           state->pos_cur - state->pos_begin - 1);
+                if (!isValidUTF8(str)) {
+                    gotError(kErrInvalidUTF8, state->pos_begin);
+                    return;
+                }
                 char *buf = nullptr;
                 bool mallocedBuf = false;
                 if (state->nescapes > 0) {
@@ -206,7 +477,16 @@ namespace fleece { namespace impl {
     }
 
     int JSONConverter::gotError(int err, const char *errat) noexcept {
-        return gotError(err, errat ? (errat - (char*)_input.buf) : 0);
+        // `errat` may point into the chunk being parsed, or into the (possibly separate) buffer
+        // holding the current token:
+        size_t pos = 0;
+        if (errat) {
+            if (_chunk.containsAddress(errat) || errat == (const char*)_chunk.end())
+                pos = _chunkPos + (errat - (const char*)_chunk.buf);
+            else
+                pos = _inputPos + (errat - (const char*)_input.buf);
+        }
+        return gotError(err, pos);
     }
 
     void JSONConverter::gotException(ErrorCode code, const char *what, size_t pos) noexcept {
@@ -257,4 +537,667 @@ namespace fleece { namespace impl {
         return converter(jsn)->gotError(err, errat);
     }
 
+
+
+#pragma mark - FAST PARSER:
+
+
+    // An alternative to jsonsl that parses a complete JSON document in memory. It doesn't need
+    // per-token callbacks or a per-byte state machine: it walks the input directly, and scans
+    // string contents 8 bytes at a time. Errors are reported with jsonsl's error codes.
+    // In JSON5 mode it also accepts comments, single-quoted strings, unquoted keys, trailing
+    // commas, and JSON5's extra number syntax and string escapes.
+    // It reports what it parses to a HANDLER, which has the methods of JSONHandler. It's a
+    // template so that JSONConverter's EncoderHandler is called directly, not virtually.
+    template <class HANDLER>
+    class FastParser {
+    public:
+        FastParser(HANDLER &handler, slice json, bool json5)
+        :_handler(handler)
+        ,_start((const char*)json.buf)
+        ,_pos(_start)
+        ,_end((const char*)json.end())
+        ,_json5(json5)
+        { }
+
+        int error() const                   {return _error;}
+        size_t errorPos() const             {return _errorAt - _start;}
+        size_t pos() const                  {return _pos - _start;}
+        bool stopped() const                {return _stopped;}
+
+        bool parse() {
+            skipWhitespace();
+            if (_pos == _end)
+                return !_error;             // Empty input (jsonsl doesn't complain either)
+            while (true) {
+                // Parse a value:
+                if (_pos == _end)
+                    return truncated();
+                switch (*_pos) {
+                    case '[':
+                        if (!push('['))
+                            return false;
+                        if (!_handler.beginArray())
+                            return stop();
+                        skipWhitespace();
+                        if (_pos < _end && *_pos == ']') {
+                            ++_pos;
+                            pop();
+                            if (!_handler.endArray())
+                                return stop();
+                            break;
+                        }
+                        continue;           // go on to parse the first item
+                    case '{':
+                        if (!push('{'))
+                            return false;
+                        if (!_handler.beginDict())
+                            return stop();
+                        skipWhitespace();
+                        if (_pos < _end && *_pos == '}') {
+                            ++_pos;
+                            pop();
+                            if (!_handler.endDict())
+                                return stop();
+                            break;
+                        }
+                        if (!parseKey())
+                            return false;
+                        continue;           // go on to parse the first value
+                    case '"':
+                        if (!parseString(false))
+                            return false;
+                        break;
+                    case '\'':
+                        if (!_json5)
+                            return fail(JSONSL_ERROR_STRAY_TOKEN, _pos);
+                        if (!parseString(false))
+                            return false;
+                        break;
+                    case 't':
+                        if (!parseLiteral("true"))
+                            return false;
+                        if (!_handler.boolValue(true))
+                            return stop();
+                        break;
+                    case 'f':
+                        if (!parseLiteral("false"))
+                            return false;
+                        if (!_handler.boolValue(false))
+                            return stop();
+                        break;
+                    case 'n':
+                        if (!parseLiteral("null"))
+                            return false;
+                        if (!_handler.nullValue())
+                            return stop();
+                        break;
+                    case '+': case '.':
+                        if (!_json5)
+                            return fail(JSONSL_ERROR_STRAY_TOKEN, _pos);
+                        [[fallthrough]];
+                    case '-': case '0': case '1': case '2': case '3': case '4':
+                    case '5': case '6': case '7': case '8': case '9':
+                        if (!parseNumber())
+                            return false;
+                        break;
+                    default:
+                        return fail(JSONSL_ERROR_STRAY_TOKEN, _pos);
+                }
+
+                // After a value: consume commas and closing brackets, until another value is due:
+                while (true) {
+                    skipWhitespace();
+                    if (_depth == 0) {
+                        if (_pos != _end && !_sequence)
+                            return fail(JSONSL_ERROR_GARBAGE_TRAILING, _pos);
+                        return !_error;
+                    }
+                    if (_pos == _end)
+                        return truncated();
+                    char c = *_pos++;
+                    char container = _stack[_depth - 1];
+                    if (c == ',') {
+                        skipWhitespace();
+                        if (_json5 && _pos < _end && (*_pos == ']' || *_pos == '}'))
+                            continue;       // JSON5 allows a trailing comma
+                        if (container == '{' && !parseKey())
+                            return false;
+                        break;
+                    } else if (c == ']' && container == '[') {
+                        pop();
+                        if (!_handler.endArray())
+                            return stop();
+                    } else if (c == '}' && container == '{') {
+                        pop();
+                        if (!_handler.endDict())
+                            return stop();
+                    } else {
+                        return fail(JSONSL_ERROR_MISSING_TOKEN, _pos - 1);
+                    }
+                }
+            }
+        }
+
+        // Parses a series of values separated by optional whitespace, such as newline-delimited
+        // JSON, calling `eachValue` after each one.
+        template <class FN>
+        bool parseSequence(FN eachValue) {
+            _sequence = true;
+            while (true) {
+                skipWhitespace();
+                if (_pos == _end)
+                    return !_error;
+                if (!parse())
+                    return false;
+                eachValue();
+            }
+        }
+
+    private:
+        bool fail(int err, const char *at) {
+            _error = err;
+            _errorAt = at;
+            return false;
+        }
+
+        bool truncated() {
+            _error = JSONConverter::kErrTruncatedJSON;
+            _errorAt = _end;
+            return false;
+        }
+
+        // Called when the handler returns false.
+        bool stop() {
+            _stopped = true;
+            return false;
+        }
+
+        bool push(char container) {
+            if (_usuallyFalse(_depth >= JSONConverter::kMaxNestingLevels - 1))
+                return fail(JSONSL_ERROR_LEVELS_EXCEEDED, _pos);
+            _stack[_depth++] = container;
+            ++_pos;
+            return true;
+        }
+
+        void pop()                          {--_depth;}
+
+        void skipWhitespace() {
+            while (_pos < _end && (*_pos == ' ' || *_pos == '\n' || *_pos == '\r' || *_pos == '\t'))
+                ++_pos;
+            if (_json5 && _pos < _end && (*_pos == '/' || *_pos == '\v' || *_pos == '\f'))
+                skipJSON5Whitespace();
+        }
+
+        // Skips whitespace and comments. An unterminated comment is an error, but it has to be
+        // reported later, by the caller checking _error.
+        void skipJSON5Whitespace() {
+            while (_pos < _end) {
+                char c = *_pos;
+                if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f') {
+                    ++_pos;
+                } else if (c == '/' && _end - _pos >= 2 && _pos[1] == '/') {
+                    auto eol = (const char*)memchr(_pos, '\n', _end - _pos);
+                    _pos = eol ? eol + 1 : _end;
+                } else if (c == '/' && _end - _pos >= 2 && _pos[1] == '*') {
+                    auto close = (const char*)slice(_pos + 2, _end).find("*/"_sl).buf;
+                    if (!close) {
+                        truncated();
+                        _pos = _end;
+                    } else {
+                        _pos = close + 2;
+                    }
+                } else {
+                    break;
+                }
+            }
+        }
+
+        // Parses a dict key and the following ':'.
+        bool parseKey() {
+            skipWhitespace();
+            if (_pos == _end)
+                return truncated();
+            if (*_pos == '"' || (_json5 && *_pos == '\'')) {
+                if (!parseString(true))
+                    return false;
+            } else if (_json5 && isIdentifierStart(*_pos)) {
+                const char *begin = _pos;
+                while (_pos < _end && (isIdentifierStart(*_pos) || isDigit(*_pos)))
+                    ++_pos;
+                if (!_handler.key(slice(begin, _pos)))
+                    return stop();
+            } else {
+                return fail(JSONSL_ERROR_HKEY_EXPECTED, _pos);
+            }
+            skipWhitespace();
+            if (_pos == _end)
+                return truncated();
+            if (*_pos != ':')
+                return fail(JSONSL_ERROR_MISSING_TOKEN, _pos);
+            ++_pos;
+            skipWhitespace();
+            return true;
+        }
+
+        // Returns a pointer to the first `quote` or backslash in [p, end), or else to a point
+        // less than 8 bytes before `end`. It checks 16 bytes at a time with SSE2 if available,
+        // then 8 at a time in a uint64_t. If any byte it skips is non-ASCII, sets `nonASCII`.
+        static inline const char* skipStringChars(const char *p, const char *end, char quote,
+                                                  bool &nonASCII)
+        {
+#ifdef FL_HAVE_SSE2
+            const __m128i quotes = _mm_set1_epi8(quote), backslashes = _mm_set1_epi8('\\');
+            for (; end - p >= 16; p += 16) {
+                __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+                unsigned highBits = unsigned(_mm_movemask_epi8(chunk));
+                unsigned hits = unsigned(_mm_movemask_epi8(_mm_or_si128(
+                                                            _mm_cmpeq_epi8(chunk, quotes),
+                                                            _mm_cmpeq_epi8(chunk, backslashes))));
+                if (hits) {
+                    unsigned n = countTrailingZeros(hits);
+                    nonASCII |= (highBits & ((1u << n) - 1)) != 0;
+                    return p + n;
+                }
+                nonASCII |= (highBits != 0);
+            }
+#endif
+            constexpr uint64_t kOnes = 0x0101010101010101, kHighs = 0x8080808080808080;
+            auto hasZeroByte = [](uint64_t w) {return (w - kOnes) & ~w & kHighs;};
+            uint64_t highBits = 0;
+            for (; end - p >= 8; p += 8) {
+                uint64_t word;
+                memcpy(&word, p, 8);
+                if ((hasZeroByte(word ^ (quote * kOnes)) | hasZeroByte(word ^ ('\\' * kOnes))) != 0)
+                    break;
+                highBits |= word;
+            }
+            nonASCII |= (highBits & kHighs) != 0;
+            return p;
+        }
+
+        bool parseString(bool isKey) {
+            const char quote = *_pos;
+            const char *begin = ++_pos;     // skip the opening quote
+            bool escapes = false, nonASCII = false;
+            while (true) {
+                // Skip quickly past bytes that don't contain anything interesting:
+                _pos = skipStringChars(_pos, _end, quote, nonASCII);
+                if (_pos == _end)
+                    return truncated();
+                char c = *_pos++;
+                if (c == quote) {
+                    break;
+                } else if (c == '\\') {
+                    escapes = true;
+                    if (_pos == _end)
+                        return truncated();
+                    c = *_pos++;
+                }
+                nonASCII |= (uint8_t(c) >= 0x80);
+            }
+
+            slice str(begin, _pos - 1);
+            if (nonASCII && !isValidUTF8(str))
+                return fail(JSONConverter::kErrInvalidUTF8, begin);
+            std::string unescaped;
+            if (escapes && _json5) {
+                if (!unescapeJSON5(str, unescaped))
+                    return false;
+                str = slice(unescaped);
+            } else if (escapes) {
+                unescaped.resize(str.size);
+                jsonsl_error_t err = JSONSL_ERROR_SUCCESS;
+                const char *errat = nullptr;
+                auto size = jsonsl_util_unescape_ex((const char*)str.buf, &unescaped[0], str.size,
+                                                    nullptr, nullptr, &err, &errat);
+                if (err)
+                    return fail(err, errat ? errat : begin);
+                str = slice(unescaped.data(), size);
+            }
+            if (!(isKey ? _handler.key(str) : _handler.stringValue(str)))
+                return stop();
+            return true;
+        }
+
+        // Decodes a JSON5 string's escapes, which are JSON's plus \\', \\v, \\0, \\xHH, and
+        // backslash-newline (which is removed.) Any other escaped character stands for itself.
+        bool unescapeJSON5(slice str, std::string &out) {
+            out.reserve(str.size);
+            auto p = (const char*)str.buf, end = (const char*)str.end();
+            while (p < end) {
+                auto backslash = (const char*)memchr(p, '\\', end - p);
+                if (!backslash) {
+                    out.append(p, end);
+                    break;
+                }
+                out.append(p, backslash);
+                p = backslash + 1;          // (the scanner ensured there's a character after it)
+                char c = *p++;
+                switch (c) {
+                    case 'b':   out += '\b'; break;
+                    case 'f':   out += '\f'; break;
+                    case 'n':   out += '\n'; break;
+                    case 'r':   out += '\r'; break;
+                    case 't':   out += '\t'; break;
+                    case 'v':   out += '\v'; break;
+                    case '0':
+                        if (p < end && isDigit(*p))
+                            return fail(JSONSL_ERROR_ESCAPE_INVALID, backslash);
+                        out += '\0';
+                        break;
+                    case '\r':
+                        if (p < end && *p == '\n')
+                            ++p;
+                        break;
+                    case '\n':
+                        break;
+                    case 'x':
+                    case 'u': {
+                        int ch = parseHex(p, end, (c == 'x') ? 2 : 4);
+                        if (ch < 0)
+                            return fail(JSONSL_ERROR_UESCAPE_TOOSHORT, backslash);
+                        if (ch >= 0xD800 && ch < 0xDC00) {
+                            // UTF-16 surrogate pair:
+                            int lo = -1;
+                            if (end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                                auto q = p + 2;
+                                lo = parseHex(q, end, 4);
+                                if (lo >= 0xDC00 && lo < 0xE000)
+                                    p = q;
+                            }
+                            if (lo < 0xDC00 || lo >= 0xE000)
+                                return fail(JSONSL_ERROR_INVALID_CODEPOINT, backslash);
+                            ch = 0x10000 + ((ch - 0xD800) << 10) + (lo - 0xDC00);
+                        } else if (ch >= 0xDC00 && ch < 0xE000) {
+                            return fail(JSONSL_ERROR_INVALID_CODEPOINT, backslash);
+                        }
+                        appendUTF8(out, ch);
+                        break;
+                    }
+                    default:
+                        if (isDigit(c))
+                            return fail(JSONSL_ERROR_ESCAPE_INVALID, backslash);
+                        out += c;   // includes quotes, backslash and '/'
+                        break;
+                }
+            }
+            return true;
+        }
+
+        // Parses `n` hex digits at `p`, advancing it; returns -1 if they aren't all hex digits.
+        static int parseHex(const char* &p, const char *end, int n) {
+            if (end - p < n)
+                return -1;
+            int result = 0;
+            for (int i = 0; i < n; ++i) {
+                int digit = hexDigit(p[i]);
+                if (digit < 0)
+                    return -1;
+                result = (result << 4) | digit;
+            }
+            p += n;
+            return result;
+        }
+
+        static int hexDigit(char c) {
+            if (c >= '0' && c <= '9')       return c - '0';
+            else if (c >= 'a' && c <= 'f')  return c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F')  return c - 'A' + 10;
+            else                            return -1;
+        }
+
+        static void appendUTF8(std::string &out, int ch) {
+            if (ch < 0x80) {
+                out += char(ch);
+            } else if (ch < 0x800) {
+                out += char(0xC0 | (ch >> 6));
+                out += char(0x80 | (ch & 0x3F));
+            } else if (ch < 0x10000) {
+                out += char(0xE0 | (ch >> 12));
+                out += char(0x80 | ((ch >> 6) & 0x3F));
+                out += char(0x80 | (ch & 0x3F));
+            } else {
+                out += char(0xF0 | (ch >> 18));
+                out += char(0x80 | ((ch >> 12) & 0x3F));
+                out += char(0x80 | ((ch >> 6) & 0x3F));
+                out += char(0x80 | (ch & 0x3F));
+            }
+        }
+
+        static bool isIdentifierStart(char c) {
+            return isalpha((unsigned char)c) || c == '_' || c == '$';
+        }
+
+        bool parseLiteral(const char *literal) {
+            size_t len = strlen(literal);
+            if (size_t(_end - _pos) < len) {
+                if (memcmp(_pos, literal, _end - _pos) == 0)
+                    return truncated();
+            } else if (memcmp(_pos, literal, len) == 0
+                       && (_pos + len == _end || !isalnum((unsigned char)_pos[len]))) {
+                _pos += len;
+                return true;
+            }
+            return fail(JSONSL_ERROR_SPECIAL_EXPECTED, _pos);
+        }
+
+        static bool isDigit(char c)         {return c >= '0' && c <= '9';}
+
+        bool parseNumber() {
+            const char *begin = _pos;
+            bool negative = (*_pos == '-');
+            if (negative || *_pos == '+')
+                ++_pos;
+            if (_json5 && _end - _pos >= 2 && _pos[0] == '0' && (_pos[1] == 'x' || _pos[1] == 'X'))
+                return parseHexNumber(negative);
+            uint64_t n = 0;
+            const char *digits = _pos;
+            while (_end - _pos >= 8 && IsEightDigits(_pos)) {
+                n = n * 100000000 + ParseEightDigits(_pos);     // (overflow is checked below)
+                _pos += 8;
+            }
+            while (_pos < _end && isDigit(*_pos))
+                n = 10 * n + (*_pos++ - '0');
+            size_t nDigits = _pos - digits;
+            if (nDigits == 0 && !(_json5 && _pos < _end && *_pos == '.'))
+                return (_pos == _end) ? truncated() : fail(JSONSL_ERROR_INVALID_NUMBER, _pos);
+
+            bool isInteger = true;
+            if (_pos < _end && *_pos == '.') {
+                isInteger = false;
+                const char *frac = ++_pos;
+                while (_pos < _end && isDigit(*_pos))
+                    ++_pos;
+                if (_pos == frac && (!_json5 || nDigits == 0))  // JSON5 allows "1." and ".1"
+                    return fail(JSONSL_ERROR_INVALID_NUMBER, _pos);
+            }
+            if (_pos < _end && (*_pos == 'e' || *_pos == 'E')) {
+                isInteger = false;
+                ++_pos;
+                if (_pos < _end && (*_pos == '+' || *_pos == '-'))
+                    ++_pos;
+                const char *exp = _pos;
+                while (_pos < _end && isDigit(*_pos))
+                    ++_pos;
+                if (_pos == exp)
+                    return fail(JSONSL_ERROR_INVALID_NUMBER, _pos);
+            }
+            if (_pos < _end && isalpha((unsigned char)*_pos))
+                return fail(JSONSL_ERROR_INVALID_NUMBER, _pos);
+
+            if (isInteger && _usuallyTrue(nDigits < 19))
+                return (negative ? _handler.intValue(-(int64_t)n) : _handler.uintValue(n))
+                    || stop();
+
+            if (isInteger) {
+                // Parse super long numbers carefully; go to double on overflow.
+                // The input isn't necessarily NUL-terminated, so copy the number before parsing:
+                std::string numStr(begin, _pos);
+                if (negative) {
+                    int64_t i;
+                    if (ParseInteger(numStr.c_str(), i))
+                        return _handler.intValue(i) || stop();
+                } else {
+                    uint64_t u;
+                    if (ParseInteger(numStr.c_str(), u))
+                        return _handler.uintValue(u) || stop();
+                }
+            }
+            double d;
+            ParseDouble(slice(begin, _pos), d);
+            return _handler.doubleValue(d) || stop();
+        }
+
+        // Parses a JSON5 hexadecimal integer, after any sign.
+        bool parseHexNumber(bool negative) {
+            _pos += 2;
+            uint64_t n = 0;
+            const char *digits = _pos;
+            for (int digit; _pos < _end && (digit = hexDigit(*_pos)) >= 0; ++_pos) {
+                if (n >> 60)
+                    return fail(JSONSL_ERROR_INVALID_NUMBER, _pos);
+                n = (n << 4) | unsigned(digit);
+            }
+            if (_pos == digits || (_pos < _end && isalnum((unsigned char)*_pos)))
+                return fail(JSONSL_ERROR_INVALID_NUMBER, _pos);
+            bool ok;
+            if (!negative)
+                ok = _handler.uintValue(n);
+            else if (n <= uint64_t(INT64_MAX) + 1)
+                ok = _handler.intValue(int64_t(0 - n));
+            else
+                ok = _handler.doubleValue(-double(n));
+            return ok || stop();
+        }
+
+        HANDLER &_handler;
+        const char* const _start;
+        const char* _pos;
+        const char* const _end;
+        char _stack[JSONConverter::kMaxNestingLevels];  // '[' or '{' for each open collection
+        int _depth {0};
+        int _error {JSONSL_ERROR_SUCCESS};
+        const char* _errorAt {nullptr};
+        bool const _json5;                  // Parse JSON5 instead of JSON?
+        bool _stopped {false};              // True if the handler stopped parsing
+        bool _sequence {false};             // Parsing a series of values, not just one?
+    };
+
+
+    // The handler JSONConverter gives the fast parser; it just writes to the Encoder.
+    struct EncoderHandler {
+        Encoder &enc;
+
+        bool beginArray()               {enc.beginArray(); return true;}
+        bool endArray()                 {enc.endArray(); return true;}
+        bool beginDict()                {enc.beginDictionary(); return true;}
+        bool endDict()                  {enc.endDictionary(); return true;}
+        bool key(slice k)               {enc.writeKey(k); return true;}
+        bool stringValue(slice s)       {enc.writeString(s); return true;}
+        bool intValue(int64_t i)        {enc.writeInt(i); return true;}
+        bool uintValue(uint64_t u)      {enc.writeUInt(u); return true;}
+        bool doubleValue(double d)      {enc.writeDouble(d); return true;}
+        bool boolValue(bool b)          {enc.writeBool(b); return true;}
+        bool nullValue()                {enc.writeNull(); return true;}
+    };
+
+
+    bool JSONConverter::parseFast(slice json) {
+        EncoderHandler handler {_encoder};
+        FastParser<EncoderHandler> parser(handler, json, _parser == kJSON5Parser);
+        try {
+            if (!parser.parse()) {
+                gotError(parser.error(), parser.errorPos());
+                return false;
+            }
+        } catch (const FleeceException &x) {
+            gotException(x.code, x.what(), parser.pos());
+            return false;
+        } catch (...) {
+            gotException(InternalError, "Unexpected C++ exception", parser.pos());
+            return false;
+        }
+        return true;
+    }
+
+
+    bool JSONConverter::encodeJSONSequence(slice json, function_ref<void()> eachValue) {
+        tracing::Span span("JSONConverter::encodeJSONSequence", json.size);
+        begin();
+        _feeding = false;
+        EncoderHandler handler {_encoder};
+        FastParser<EncoderHandler> parser(handler, json, _parser == kJSON5Parser);
+        try {
+            bool ok = parser.parseSequence([&] {
+                eachValue();
+                if (_encoder.isFinished())
+                    _encoder.reset();       // (else the next value might be a scalar)
+            });
+            if (!ok) {
+                gotError(parser.error(), parser.errorPos());
+                return false;
+            }
+        } catch (const FleeceException &x) {
+            gotException(x.code, x.what(), parser.pos());
+            return false;
+        } catch (...) {
+            gotException(InternalError, "Unexpected C++ exception", parser.pos());
+            return false;
+        }
+        return true;
+    }
+
+
+    /*static*/ std::vector<alloc_slice> JSONConverter::convertJSONSequence(slice json,
+                                                                           SharedKeys *sk)
+    {
+        std::vector<alloc_slice> results;
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        JSONConverter cvt(enc, kFastParser);
+        bool ok = cvt.encodeJSONSequence(json, [&] {
+            results.push_back(enc.finish());
+        });
+        throwIf(!ok, JSONError, cvt.errorMessage());
+        return results;
+    }
+
+
+    /*static*/ alloc_slice JSONConverter::convertJSONSequenceToArray(slice json, SharedKeys *sk) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        enc.beginArray();
+        JSONConverter cvt(enc, kFastParser);
+        throwIf(!cvt.encodeJSONSequence(json, [] { }), JSONError, cvt.errorMessage());
+        enc.endArray();
+        return enc.finish();
+    }
+
+
+#pragma mark - SCANNER:
+
+
+    JSONScanner::JSONScanner(JSONHandler &handler, bool json5) noexcept
+    :_handler(handler)
+    ,_json5(json5)
+    { }
+
+
+    bool JSONScanner::scan(slice json) {
+        tracing::Span span("JSONScanner::scan", json.size);
+        FastParser<JSONHandler> parser(_handler, json, _json5);
+        bool ok = parser.parse();
+        _stopped = parser.stopped();
+        _jsonError = parser.error();
+        _errorPos = _jsonError ? parser.errorPos() : 0;
+        return ok;
+    }
+
+
+    const char* JSONScanner::errorMessage() noexcept {
+        return _jsonError ? jsonErrorMessage(_jsonError, _errorMessage) : nullptr;
+    }
+
 } }
@@ -22,6 +22,7 @@
 #include "Doc.hh"
 #include "FleeceException.hh"
 #include "fleece/slice.hh"
+#include <vector>
 
 extern "C" {
     struct jsonsl_state_st;
@@ -30,16 +31,101 @@ extern "C" {
 
 namespace fleece { namespace impl {
 
+    /** Receives the contents of a JSON document from a JSONScanner, as a series of events in
+        document order. The default implementations do nothing, so a subclass only overrides
+        the events it cares about. Any method can return false to stop the scan.
+        String and key slices point into the input when the JSON string has no escapes, else
+        into a temporary buffer; either way they're only valid until the method returns. */
+    class JSONHandler {
+    public:
+        virtual ~JSONHandler() =default;
+
+        virtual bool beginArray()               {return true;}
+        virtual bool endArray()                 {return true;}
+        virtual bool beginDict()                {return true;}
+        virtual bool endDict()                  {return true;}
+        virtual bool key(slice)                 {return true;}
+        virtual bool stringValue(slice)         {return true;}
+        virtual bool intValue(int64_t)          {return true;}   ///< Negative integers
+        virtual bool uintValue(uint64_t)        {return true;}   ///< Non-negative integers
+        virtual bool doubleValue(double)        {return true;}
+        virtual bool boolValue(bool)            {return true;}
+        virtual bool nullValue()                {return true;}
+    };
+
+
+    /** Parses JSON (or JSON5) with the same tokenizer as JSONConverter's fast parser, but
+        instead of producing Fleece it calls a JSONHandler, so it can scan a document for a few
+        values, or count or validate it, without encoding anything.
+        Exceptions thrown by the handler propagate out of \ref scan. */
+    class JSONScanner {
+    public:
+        explicit JSONScanner(JSONHandler&, bool json5 =false) noexcept;
+
+        /** Parses a complete JSON document, calling the handler for each token.
+            @return  True if the entire document was parsed; false if it's invalid, or if the
+                     handler stopped the scan (see \ref stopped.) */
+        bool scan(slice json);
+
+        /** True if the last scan ended early because the handler returned false. */
+        bool stopped() const noexcept           {return _stopped;}
+
+        /** The error of the last scan, as in JSONConverter::jsonError, or 0. */
+        int jsonError() const noexcept          {return _jsonError;}
+        const char* errorMessage() noexcept;
+        size_t errorPos() const noexcept        {return _errorPos;}
+
+    private:
+        JSONHandler &_handler;
+        std::string _errorMessage;
+        size_t _errorPos {0};
+        int _jsonError {0};
+        bool const _json5;
+        bool _stopped {false};
+    };
+
+
     /** Parses JSON data and writes the values in it to a Fleece encoder. */
     class JSONConverter {
     public:
-        JSONConverter(Encoder&) noexcept;
+        /** The available parser implementations. */
+        enum Parser {
+            kJsonslParser,      ///< Streaming parser based on jsonsl (the default)
+            kFastParser,        ///< Faster; but given chunks via feed(), it buffers the entire input
+            kJSON5Parser,       ///< Like kFastParser, but parses JSON5 <https://json5.org>
+        };
+
+        JSONConverter(Encoder&, Parser =kJsonslParser) noexcept;
         ~JSONConverter();
 
         /** Parses JSON data and writes the values to the encoder.
+            Invalid JSON doesn't throw (see \ref errorCode), so rejecting it costs no more than
+            accepting it; only unexpected failures, like running out of memory, are thrown.
             @return  True if parsing succeeded, false if the JSON is invalid. */
         bool encodeJSON(slice json);
 
+        /** Parses a sequence of JSON values -- newline-delimited JSON, or values simply
+            concatenated with optional whitespace between them -- writing each to the encoder and
+            then calling `eachValue`, which typically calls Encoder::finish to collect it as a
+            separate document. The parser, Encoder and their buffers are reused for every value,
+            so this is much cheaper than converting each one separately.
+            This always uses the fast parser (or the JSON5 parser, if that was chosen.)
+            @return  True if parsing succeeded, false if the JSON is invalid. */
+        bool encodeJSONSequence(slice json, function_ref<void()> eachValue);
+
+        /** Parses the next chunk of a JSON document, writing the values in it to the encoder.
+            The document can be split into chunks at any byte offset. Only a token that spans
+            a chunk boundary is copied; everything else is parsed in place, so the caller can
+            reuse or free the chunk as soon as this returns.
+            Call \ref finish after the last chunk.
+            @return  True if the JSON is valid so far, false if it's invalid. */
+        bool feed(slice chunk);
+
+        /** Completes parsing a document given to \ref feed, and prepares the converter to parse
+            another document.
+            @return  True if parsing succeeded, false if the JSON is invalid or truncated. */
+        bool finish();
+
         /** See jsonsl_error_t for error codes, plus a few more defined below. */
         int jsonError() noexcept                {return _jsonError;}
         ErrorCode errorCode() noexcept          {return _errorCode;}
@@ -48,10 +134,14 @@ namespace fleece { namespace impl {
         /** Byte offset in input where error occurred */
         size_t errorPos() noexcept              {return _errorPos;}
 
+        /** Maximum nesting depth of arrays/dicts in the input, with either parser. */
+        static constexpr int kMaxNestingLevels = 50;
+
         /** Extra error codes beyond those in jsonsl_error_t. */
         enum {
             kErrTruncatedJSON = 1000,
-            kErrExceptionThrown
+            kErrExceptionThrown,
+            kErrInvalidUTF8             ///< A string isn't valid UTF-8
         };
 
         /** Resets the converter, as though you'd deleted it and constructed a new one. */
@@ -60,6 +150,36 @@ namespace fleece { namespace impl {
         /** Convenience method to convert JSON to Fleece data. Throws FleeceException on error. */
         static alloc_slice convertJSON(slice json, SharedKeys *sk =nullptr);
 
+        /** Like \ref convertJSON, but if the JSON is invalid it returns a null slice and sets
+            `outError` (and `outErrorMessage`, if given) instead of throwing, which is much
+            cheaper when bad input is common. */
+        static alloc_slice convertJSON(slice json, SharedKeys *sk, ErrorCode &outError,
+                                       std::string *outErrorMessage =nullptr);
+
+        /** Converts JSON5 to Fleece data in a single pass, without converting it to JSON first.
+            Throws FleeceException on error. */
+        static alloc_slice convertJSON5(slice json5, SharedKeys *sk =nullptr);
+
+        /** Converts a sequence of JSON values, such as newline-delimited JSON, to a separate
+            Fleece document for each. Throws FleeceException on error. */
+        static std::vector<alloc_slice> convertJSONSequence(slice json, SharedKeys *sk =nullptr);
+
+        /** Converts a sequence of JSON values, such as newline-delimited JSON, to a single
+            Fleece document whose root is an array of them. Strings repeated in different values
+            are stored only once. Throws FleeceException on error. */
+        static alloc_slice convertJSONSequenceToArray(slice json, SharedKeys *sk =nullptr);
+
+        /** Like \ref convertJSON, but if the JSON is a large top-level array, its items are
+            converted concurrently on `nThreads` threads (0 means the Executor's concurrency.)
+            The result is a single Fleece document equivalent to what convertJSON returns, except
+            that strings repeated in items converted by different threads aren't de-duplicated.
+            If `sk` is given, it's shared by all the threads. Throws FleeceException on error. */
+        static alloc_slice convertJSONArray(slice json, SharedKeys *sk =nullptr,
+                                            unsigned nThreads =0);
+
+        /** Inputs smaller than this are converted by \ref convertJSONArray on a single thread. */
+        static constexpr size_t kMinParallelJSONSize = 64 * 1024;
+
     //private:
         void push(struct jsonsl_state_st *state NONNULL);
         void pop(struct jsonsl_state_st *state NONNULL);
@@ -68,15 +188,25 @@ namespace fleece { namespace impl {
         void gotException(ErrorCode code, const char *what NONNULL, size_t pos) noexcept;
 
     private:
+        void begin();
+        bool parseFast(slice json);
+        const char* inputAt(size_t pos) const   {return (const char*)_input.buf + (pos - _inputPos);}
         void writeDouble(struct jsonsl_state_st *);
 
         Encoder &_encoder;                  // encoder to write to
         struct jsonsl_st * _jsn {nullptr};  // JSON parser
+        Parser _parser;                     // Which parser implementation to use
         int _jsonError {0};                 // Parse error from jsonsl
         ErrorCode _errorCode {NoError};
         std::string _errorMessage;
         size_t _errorPos {0};               // Byte index where parse error occurred
         slice _input;                       // Current JSON being parsed
+        size_t _inputPos {0};               // Stream position of the start of _input
+        slice _chunk;                       // Chunk currently being fed to jsonsl
+        size_t _chunkPos {0};               // Stream position of the start of _chunk
+        std::string _pending;               // Copy of a token that's split between chunks
+        size_t _pendingPos {0};             // Stream position of the start of _pending
+        bool _feeding {false};              // True between the first feed() and finish()
     };
 
 } }
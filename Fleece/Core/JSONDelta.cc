@@ -17,18 +17,33 @@
 //
 
 #include "JSONDelta.hh"
+#include "ByteDiff.hh"
+#include "Executor.hh"
 #include "FleeceImpl.hh"
+#include "MutableArray.hh"
+#include "MutableDict.hh"
 #include "JSONEncoder.hh"
 #include "JSONConverter.hh"
-#include "JSON5.hh"
 #include "FleeceException.hh"
 #include "TempArray.hh"
+#include "Tracing.hh"
+#include "Base64.hh"
+#include "varint.hh"
 #include "diff_match_patch.hh"
-#include "NumConversion.hh"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
 #include <sstream>
 #include <unordered_set>
+#include <vector>
 #include "betterassert.hh"
 
+// Both wyhash headers declare a `wyrand()` function, so use a namespace to prevent collision.
+namespace fleece::impl::wy {
+    #include "wyhash.h"
+}
+
 
 namespace fleece { namespace impl {
     using namespace std;
@@ -40,13 +55,24 @@ namespace fleece { namespace impl {
 
     size_t JSONDelta::gMinStringDiffLength = 60;
 
+    size_t JSONDelta::gMinDataDiffLength = 1024;
+
+    bool JSONDelta::gArraySplices = false;
+
     float JSONDelta::gTextDiffTimeout = 0.25;
 
+    // Maximum number of inserted/removed items an array diff will look for
+    static constexpr size_t kMaxArrayDiffEdits = 1000;
+
+    // String changes separated by fewer equal bytes than this are written as one change
+    static constexpr size_t kMinStringDiffEqualRun = 4;
+
     // Codes that appear as the 3rd item of an array item in a diff
     enum {
         kDeletionCode = 0,
         kTextDiffCode = 2,
         kArraymoveCode = 3,
+        kDataDiffCode = 4,
     };
 
 
@@ -57,9 +83,6 @@ namespace fleece { namespace impl {
     }
 
 
-    static void snapToUTF8Character(long &pos, size_t &length, slice str);
-
-
 #pragma mark - CREATING DELTAS:
 
 
@@ -71,19 +94,56 @@ namespace fleece { namespace impl {
     }
 
 
+    /*static*/ alloc_slice JSONDelta::createIfSmaller(const Value *old, const Value *nuu,
+                                                      size_t maxSize, bool json5)
+    {
+        JSONEncoder enc;
+        enc.setJSON5(json5);
+        JSONDelta delta;
+        delta._maxSize = maxSize;
+        try {
+            delta._create(enc, old, nuu);
+        } catch (const overBudget&) {
+            return nullslice;
+        }
+        alloc_slice result = enc.finish();
+        if (result.size > maxSize)
+            return nullslice;
+        return result;
+    }
+
+
     /*static*/ bool JSONDelta::create(const Value *old, const Value *nuu, JSONEncoder &enc) {
-        if (JSONDelta(enc)._write(old, nuu, nullptr))
-            return true;
-        // If there is no difference, write a no-op delta:
-        enc.beginDictionary();
-        enc.endDictionary();
-        return false;
+        return JSONDelta()._create(enc, old, nuu);
     }
 
 
-    JSONDelta::JSONDelta(JSONEncoder &enc)
-    :_encoder(&enc)
-    { }
+    /*static*/ bool JSONDelta::create(const Value *old, const Value *nuu, Encoder &enc) {
+        return JSONDelta()._create(enc, old, nuu);
+    }
+
+
+    // The size of the data a Value is in, for tracing; 0 if it's mutable or not in a Scope.
+    static size_t traceSizeOf(const Value *v) {
+        auto scope = v ? Scope::containing(v) : nullptr;
+        return scope ? scope->data().size : 0;
+    }
+
+
+    template <class ENC>
+    bool JSONDelta::_create(ENC &enc, const Value *old, const Value *nuu) {
+        size_t inputSize = tracing::enabled() ? traceSizeOf(old) + traceSizeOf(nuu) : 0;
+        tracing::Span span("JSONDelta::create", inputSize);
+        _startPos = enc.bytesWritten();
+        bool changed = _write(enc, old, nuu, nullptr);
+        if (!changed) {
+            // If there is no difference, write a no-op delta:
+            enc.beginDictionary();
+            enc.endDictionary();
+        }
+        span.setOutputSize(enc.bytesWritten() - _startPos);
+        return changed;
+    }
 
 
     struct JSONDelta::pathItem {
@@ -93,100 +153,89 @@ namespace fleece { namespace impl {
     };
 
 
-    void JSONDelta::writePath(pathItem *path) {
+    // Throws overBudget if the delta written so far is larger than _maxSize. This is called
+    // before each change is written, so an oversized delta is abandoned without finishing
+    // the diff of the rest of the values.
+    template <class ENC>
+    inline void JSONDelta::checkSize(ENC &enc) {
+        if (_usuallyFalse(enc.bytesWritten() - _startPos > _maxSize))
+            throw overBudget();
+    }
+
+
+    template <class ENC>
+    void JSONDelta::writePath(ENC &enc, pathItem *path) {
+        checkSize(enc);
         if (!path)
             return;
-        writePath(path->parent);
+        writePath(enc, path->parent);
         path->parent = nullptr;
         if (!path->isOpen) {
-            _encoder->beginDictionary();
+            enc.beginDictionary();
             path->isOpen = true;
         }
-        _encoder->writeKey(path->key);
+        enc.writeKey(path->key);
     }
 
 
     // Main encoder function. Called recursively, traversing the hierarchy.
-    bool JSONDelta::_write(const Value *old, const Value *nuu, pathItem *path) {
+    // `ENC` is either a JSONEncoder or a (Fleece) Encoder; the delta has the same structure.
+    template <class ENC>
+    bool JSONDelta::_write(ENC &enc, const Value *old, const Value *nuu, pathItem *path) {
         if (_usuallyFalse(old == nuu))
             return false;
         if (old) {
             if (!nuu) {
                 // `old` was deleted: write []
-                writePath(path);
-                _encoder->beginArray();
+                writePath(enc, path);
+                enc.beginArray();
                 if (gCompatibleDeltas) {
-                    _encoder->writeValue(old);
-                    _encoder->writeInt(0);
-                    _encoder->writeInt(kDeletionCode);
+                    enc.writeValue(old);
+                    enc.writeInt(0);
+                    enc.writeInt(kDeletionCode);
                 }
-                _encoder->endArray();
+                enc.endArray();
                 return true;
             }
 
             auto oldType = old->type(), nuuType = nuu->type();
             if (oldType == nuuType) {
-                if (oldType == kDict) {
+                if ((oldType == kDict || oldType == kArray) && hashOf(old) == hashOf(nuu)
+                        && old->isEqual(nuu)) {
+                    // Identical collections: skip without descending into them
+                    return false;
+                } else if (oldType == kDict) {
                     // Possibly-modified dict: write a dict with the modified keys
                     auto oldDict = (const Dict*)old, nuuDict = (const Dict*)nuu;
                     pathItem curLevel = {path, false, nullslice};
-                    unsigned oldKeysSeen = 0;
-                    // Iterate all the new & maybe-changed keys:
-                    for (Dict::iterator i_nuu(nuuDict); i_nuu; ++i_nuu) {
-                        slice key = i_nuu.keyString();
-                        auto oldValue = oldDict->get(key);
-                        if (oldValue)
-                            ++oldKeysSeen;
-                        curLevel.key = key;
-                        _write(oldValue, i_nuu.value(), &curLevel);
-                    }
-                    // Iterate all the deleted keys:
-                    if (oldKeysSeen < oldDict->count()) {
-                        for (Dict::iterator i_old(oldDict); i_old; ++i_old) {
-                            slice key = i_old.keyString();
-                            if (nuuDict->get(key) == nullptr) {
-                                curLevel.key = key;
-                                _write(i_old.value(), nullptr, &curLevel);
-                            }
+                    // Iterate the old & new keys together, so the new, deleted and
+                    // maybe-changed keys are all found in one pass. The deletions are
+                    // written last:
+                    std::vector<std::pair<slice, const Value*>> deleted;
+                    for (DictMergeIterator i(oldDict, nuuDict); i; ++i) {
+                        if (i.value2()) {
+                            curLevel.key = i.keyString();
+                            _write(enc, i.value1(), i.value2(), &curLevel);
+                        } else {
+                            deleted.emplace_back(i.keyString(), i.value1());
                         }
                     }
+                    for (auto &[key, oldValue] : deleted) {
+                        curLevel.key = key;
+                        _write(enc, oldValue, nullptr, &curLevel);
+                    }
                     if (!curLevel.isOpen)
                         return false;
-                    _encoder->endDictionary();
+                    enc.endDictionary();
                     return true;
 
                 } else if (oldType == kArray) {
-                    // Scan forwards through unchanged items:
                     auto oldArray = (const Array*)old, nuuArray = (const Array*)nuu;
                     auto oldCount = oldArray->count(), nuuCount = nuuArray->count();
-                    auto minCount = min(oldCount, nuuCount);
-                    if (minCount > 0) {
-                        pathItem curLevel = {path, false, nullslice};
-                        uint32_t index = 0;
-                        char key[10];
-                        for (Array::iterator iOld(oldArray), iNew(nuuArray); index < minCount;
-                             ++iOld, ++iNew, ++index) {
-                            sprintf(key, "%d", index);
-                            curLevel.key = slice(key);
-                            _write(iOld.value(), iNew.value(), &curLevel);
-                        }
-                        if (oldCount != nuuCount) {
-                            sprintf(key, "%d-", index);
-                            curLevel.key = slice(key);
-                            writePath(&curLevel);
-                            _encoder->beginArray();
-                            for (; index < nuuCount; ++index) {
-                                _encoder->writeValue(nuuArray->get(index));
-                            }
-                            _encoder->endArray();
-                        }
-                        if (!curLevel.isOpen)
-                            return false;
-                        _encoder->endDictionary();
-                        return true;
-                    } else if (oldCount == 0 && nuuCount == 0) {
+                    if (oldCount > 0 && nuuCount > 0)
+                        return _writeArrayDiff(enc, oldArray, nuuArray, path);
+                    else if (oldCount == 0 && nuuCount == 0)
                         return false;
-                    }
 
                 } else if (old->isEqual(nuu)) {
                     // Equal objects: do nothing
@@ -196,34 +245,326 @@ namespace fleece { namespace impl {
                     // Strings: Try to use smart text diff
                     string strPatch = createStringDelta(old->asString(), nuu->asString());
                     if (!strPatch.empty()) {
-                        writePath(path);
-                        _encoder->beginArray();
-                        _encoder->writeString(strPatch);
-                        _encoder->writeInt(0);
-                        _encoder->writeInt(kTextDiffCode);
-                        _encoder->endArray();
+                        writePath(enc, path);
+                        enc.beginArray();
+                        enc.writeString(strPatch);
+                        enc.writeInt(0);
+                        enc.writeInt(kTextDiffCode);
+                        enc.endArray();
                         return true;
                     }
                     // if there's no smart diff, fall through to the generic case...
+
+                } else if (oldType == kData) {
+                    // Data: Try to use a chunked binary diff
+                    alloc_slice dataPatch = createDataDelta(old->asData(), nuu->asData());
+                    if (dataPatch) {
+                        writePath(enc, path);
+                        enc.beginArray();
+                        enc.writeData(dataPatch);
+                        enc.writeInt(0);
+                        enc.writeInt(kDataDiffCode);
+                        enc.endArray();
+                        return true;
+                    }
+                    // if there's no diff, fall through to the generic case...
                 }
             }
         }
 
         // Generic modification/insertion:
-        writePath(path);
+        writePath(enc, path);
         if (nuu->type() < kArray && path && !gCompatibleDeltas) {
-            _encoder->writeValue(nuu);
+            enc.writeValue(nuu);
         } else {
-            _encoder->beginArray();
+            enc.beginArray();
             if (gCompatibleDeltas && old)
-                _encoder->writeValue(old);
-            _encoder->writeValue(nuu);
-            _encoder->endArray();
+                enc.writeValue(old);
+            enc.writeValue(nuu);
+            enc.endArray();
         }
         return true;
     }
 
 
+    /*static*/ alloc_slice JSONDelta::createParallel(const Value *old, const Value *nuu,
+                                                     bool json5, unsigned nThreads)
+    {
+        nThreads = Executor::resolveThreads(nThreads);
+        auto oldDict = old ? old->asDict() : nullptr, nuuDict = nuu ? nuu->asDict() : nullptr;
+        if (nThreads < 2 || !oldDict || !nuuDict || oldDict == nuuDict
+                || max(oldDict->count(), nuuDict->count()) < kMinParallelCreateCount)
+            return create(old, nuu, json5);
+
+        size_t inputSize = tracing::enabled() ? traceSizeOf(old) + traceSizeOf(nuu) : 0;
+        tracing::Span span("JSONDelta::createParallel", inputSize);
+
+        // Collect the items the dicts have in common, and the deleted ones, which are written
+        // last as in `_write`:
+        struct item {slice key; const Value *oldValue, *nuuValue;};
+        vector<item> items, deleted;
+        for (DictMergeIterator i(oldDict, nuuDict); i; ++i)
+            (i.value2() ? items : deleted).push_back({i.keyString(), i.value1(), i.value2()});
+
+        // Diff ranges of the items into separate encoders. There are several ranges per thread,
+        // taken in turn by the threads, so a range of expensive items doesn't hold up the rest.
+        // Each range's path level is already "open", so its encoder writes just the keys and
+        // values, with no braces, and the pieces can be joined with commas:
+        size_t nRanges = min(items.size(), size_t(4) * nThreads) + 1;
+        vector<alloc_slice> pieces(nRanges);
+        Executor::parallelFor(nRanges, nThreads, [&](size_t r) {
+            JSONEncoder enc;
+            enc.setJSON5(json5);
+            JSONDelta delta;
+            pathItem level = {nullptr, true, nullslice};
+            if (r < nRanges - 1) {
+                size_t begin = items.size() * r / (nRanges - 1);
+                size_t end   = items.size() * (r + 1) / (nRanges - 1);
+                for (size_t i = begin; i < end; ++i) {
+                    level.key = items[i].key;
+                    delta._write(enc, items[i].oldValue, items[i].nuuValue, &level);
+                }
+            } else {
+                for (auto &d : deleted) {
+                    level.key = d.key;
+                    delta._write(enc, d.oldValue, nullptr, &level);
+                }
+            }
+            pieces[r] = enc.finish();
+        });
+
+        size_t size = 2;
+        for (auto &piece : pieces)
+            size += piece.size + 1;
+        alloc_slice result(size);
+        auto out = (char*)result.buf;
+        *out++ = '{';
+        for (auto &piece : pieces) {
+            if (piece.size > 0) {
+                if (out > (char*)result.buf + 1)
+                    *out++ = ',';
+                memcpy(out, piece.buf, piece.size);
+                out += piece.size;
+            }
+        }
+        *out++ = '}';
+        result.shorten(out - (char*)result.buf);
+        span.setOutputSize(result.size);
+        return result;
+    }
+
+
+    // Finds the longest common subsequence of the hash arrays `a` and `b`, using Myers' O(ND)
+    // algorithm <http://www.xmailserver.org/diff2.pdf>, and appends the index pairs of the
+    // matching items (plus `base`) to `matches`. Gives up, leaving `matches` empty, if there
+    // are more than kMaxArrayDiffEdits differences.
+    static void matchItems(const uint64_t a[], uint32_t n, const uint64_t b[], uint32_t m,
+                           uint32_t base, vector<pair<uint32_t,uint32_t>> &matches)
+    {
+        const int maxD = int(min(size_t(n) + m, kMaxArrayDiffEdits));
+        // v[k] is the furthest x reached on diagonal k = x - y; trace[d] saves the part of v
+        // (diagonals -d-1 ... d+1) that round d started from, for backtracking.
+        vector<int> v(2 * maxD + 3, 0);
+        auto V = [&](int k) -> int& {return v[k + maxD + 1];};
+        vector<vector<int>> trace;
+        int d;
+        for (d = 0; d <= maxD; ++d) {
+            trace.emplace_back(&V(-d-1), &V(d+1) + 1);
+            bool done = false;
+            for (int k = -d; k <= d; k += 2) {
+                int x = (k == -d || (k != d && V(k-1) < V(k+1))) ? V(k+1) : V(k-1) + 1;
+                int y = x - k;
+                while (x < int(n) && y < int(m) && a[x] == b[y]) {
+                    ++x;
+                    ++y;
+                }
+                V(k) = x;
+                if (x >= int(n) && y >= int(m)) {
+                    done = true;
+                    break;
+                }
+            }
+            if (done)
+                break;
+        }
+        if (d > maxD)
+            return;
+
+        // Backtrack from the end, collecting the diagonal runs ("snakes") of matches:
+        size_t firstNew = matches.size();
+        int x = n, y = m;
+        for (; d >= 0; --d) {
+            auto &prev = trace[d];
+            auto P = [&](int k) {return prev[k + d + 1];};
+            int k = x - y, prevX, prevY;
+            if (d == 0) {
+                prevX = prevY = 0;
+            } else {
+                int prevK = (k == -d || (k != d && P(k-1) < P(k+1))) ? k+1 : k-1;
+                prevX = P(prevK);
+                prevY = prevX - prevK;
+            }
+            while (x > prevX && y > prevY && x > 0 && y > 0 && a[x-1] == b[y-1]) {
+                --x;
+                --y;
+                matches.emplace_back(base + x, base + y);
+            }
+            x = prevX;
+            y = prevY;
+        }
+        reverse(matches.begin() + firstNew, matches.end());
+    }
+
+
+    // Writes the delta between two non-empty arrays. Common items at the start and end are
+    // skipped, and the items in between are matched up by an LCS of their hashes, so inserted
+    // or removed items don't make every following item look different. Each unmatched run is
+    // written as positional patches of the items it has on both sides, plus a splice
+    // ("i-n": [items]) of the remainder. A run that reaches the end of both arrays uses the
+    // remainder form ("i-": [items]) instead, which is all that older deltas contain.
+    // Unless gArraySplices is set, no items are matched up, so the whole array is one run,
+    // written in the older form.
+    template <class ENC>
+    bool JSONDelta::_writeArrayDiff(ENC &enc, const Array *oldArray, const Array *nuuArray,
+                                    pathItem *path)
+    {
+        uint32_t oldCount = oldArray->count(), nuuCount = nuuArray->count();
+
+        // Matched (old, new) index pairs, ending with the start of the common suffix:
+        vector<pair<uint32_t,uint32_t>> anchors;
+        uint32_t prefix = 0, suffix = 0;
+        if (gArraySplices) {
+            vector<uint64_t> oldHashes(oldCount), nuuHashes(nuuCount);
+            for (uint32_t i = 0; i < oldCount; ++i)
+                oldHashes[i] = hashOf(oldArray->get(i));
+            for (uint32_t j = 0; j < nuuCount; ++j)
+                nuuHashes[j] = hashOf(nuuArray->get(j));
+
+            uint32_t minCount = min(oldCount, nuuCount);
+            while (prefix < minCount && oldHashes[prefix] == nuuHashes[prefix])
+                ++prefix;
+            while (suffix < minCount - prefix
+                        && oldHashes[oldCount-1-suffix] == nuuHashes[nuuCount-1-suffix])
+                ++suffix;
+
+            uint32_t oldMid = oldCount - suffix - prefix, nuuMid = nuuCount - suffix - prefix;
+            if (oldMid > 0 && nuuMid > 0)
+                matchItems(&oldHashes[prefix], oldMid, &nuuHashes[prefix], nuuMid, prefix,
+                           anchors);
+            if (suffix > 0)
+                anchors.emplace_back(oldCount - suffix, nuuCount - suffix);
+        }
+
+        pathItem curLevel = {path, false, nullslice};
+        char key[24];
+        auto writePatch = [&](uint32_t i, uint32_t j) {
+            sprintf(key, "%u", i);
+            curLevel.key = slice(key);
+            _write(enc, oldArray->get(i), nuuArray->get(j), &curLevel);
+        };
+        auto writeSplice = [&](uint32_t i, const char *deleteCount, uint32_t j, uint32_t jEnd) {
+            sprintf(key, "%u-%s", i, deleteCount);
+            curLevel.key = slice(key);
+            writePath(enc, &curLevel);
+            enc.beginArray();
+            for (; j < jEnd; ++j)
+                enc.writeValue(nuuArray->get(j));
+            enc.endArray();
+        };
+
+        // Items before `prefix` and matched hashes are almost certainly equal, but they're
+        // patched anyway (which costs little when they are), in case of a hash collision:
+        for (uint32_t i = 0; i < prefix; ++i)
+            writePatch(i, i);
+        uint32_t i = prefix, j = prefix;
+        for (auto &anchor : anchors) {
+            uint32_t pairs = min(anchor.first - i, anchor.second - j);
+            for (uint32_t n = 0; n < pairs; ++n)
+                writePatch(i + n, j + n);
+            i += pairs;
+            j += pairs;
+            if (i < anchor.first || j < anchor.second) {
+                char deleteCount[12];
+                sprintf(deleteCount, "%u", anchor.first - i);
+                writeSplice(i, deleteCount, j, anchor.second);
+            }
+            i = anchor.first;
+            j = anchor.second;
+            if (&anchor == &anchors.back() && suffix > 0) {
+                for (; i < oldCount; ++i, ++j)
+                    writePatch(i, j);
+            } else {
+                writePatch(i++, j++);
+            }
+        }
+        if (i < oldCount || j < nuuCount) {
+            // The last run reaches the end of both arrays:
+            uint32_t pairs = min(oldCount - i, nuuCount - j);
+            for (uint32_t n = 0; n < pairs; ++n)
+                writePatch(i + n, j + n);
+            i += pairs;
+            j += pairs;
+            if (i < oldCount || j < nuuCount)
+                writeSplice(i, "", j, nuuCount);
+        }
+
+        if (!curLevel.isOpen)
+            return false;
+        enc.endDictionary();
+        return true;
+    }
+
+
+    // Returns a hash of a value, such that equal values have equal hashes. The hashes of
+    // collections are cached, since the diff asks for them at every level of the tree.
+    uint64_t JSONDelta::hashOf(const Value *v) {
+        auto type = v->type();
+        switch (type) {
+            case kNull:
+                return wy::wyhash64(type, v->isUndefined());
+            case kBoolean:
+                return wy::wyhash64(type, v->asBool());
+            case kNumber:
+                if (v->isInteger()) {
+                    return wy::wyhash64(type, uint64_t(v->asInt()));
+                } else {
+                    double d = v->asDouble();
+                    uint64_t bits;
+                    memcpy(&bits, &d, sizeof(bits));
+                    return wy::wyhash64(type + 0x10, bits);
+                }
+            case kString:
+            case kData: {
+                slice bytes = (type == kString) ? v->asString() : v->asData();
+                return wy::wyhash(bytes.buf, bytes.size, type, wy::_wyp);
+            }
+            case kArray:
+            case kDict: {
+                if (auto i = _hashes.find(v); i != _hashes.end())
+                    return i->second;
+                uint64_t h;
+                if (type == kArray) {
+                    h = wy::wyhash64(type, 0);
+                    for (Array::iterator i((const Array*)v); i; ++i)
+                        h = wy::wyhash64(h, hashOf(i.value()));
+                } else {
+                    // Dicts with different SharedKeys can have different key orders, so the
+                    // entry hashes are combined in an order-independent way:
+                    h = wy::wyhash64(type, 0);
+                    for (Dict::iterator i((const Dict*)v); i; ++i) {
+                        slice k = i.keyString();
+                        h += wy::wyhash64(wy::wyhash(k.buf, k.size, 0, wy::_wyp), hashOf(i.value()));
+                    }
+                }
+                _hashes.emplace(v, h);
+                return h;
+            }
+            default:
+                return 0;
+        }
+    }
+
+
 #pragma mark - APPLYING DELTAS:
 
 
@@ -236,19 +577,75 @@ namespace fleece { namespace impl {
 
     /*static*/ void JSONDelta::apply(const Value *old, slice jsonDelta, bool isJSON5, Encoder &enc) {
         assert_precondition(jsonDelta);
-        string json5;
-        if (isJSON5) {
-            json5 = ConvertJSON5(string(jsonDelta));
-            jsonDelta = slice(json5);
-        }
+        tracing::Span span("JSONDelta::apply", jsonDelta.size);
+        size_t startPos = enc.bytesWritten();
 
         // Parse JSON delta to Fleece using same SharedKeys as `old`:
         auto sk = old->sharedKeys();
-        alloc_slice fleeceData = JSONConverter::convertJSON(jsonDelta, sk);
+        alloc_slice fleeceData = isJSON5 ? JSONConverter::convertJSON5(jsonDelta, sk)
+                                         : JSONConverter::convertJSON(jsonDelta, sk);
         Scope scope(fleeceData, sk);
         const Value *fleeceDelta = Value::fromTrustedData(fleeceData);
 
         JSONDelta(enc)._apply(old, fleeceDelta);
+        span.setOutputSize(enc.bytesWritten() - startPos);
+    }
+
+
+    /*static*/ alloc_slice JSONDelta::apply(const Value *old, const Value *fleeceDelta) {
+        Encoder enc;
+        apply(old, fleeceDelta, enc);
+        return enc.finish();
+    }
+
+
+    /*static*/ void JSONDelta::apply(const Value *old, const Value *fleeceDelta, Encoder &enc) {
+        assert_precondition(fleeceDelta);
+        JSONDelta delta(enc);
+        // If the delta's keys aren't shared with `old`'s, they have to be matched by string:
+        delta._keysByString = old && fleeceDelta->sharedKeys() != old->sharedKeys();
+        delta._apply(old, fleeceDelta);
+    }
+
+
+    /*static*/ size_t JSONDelta::applyMany(size_t count,
+                                           const Value* const olds[],
+                                           const slice jsonDeltas[],
+                                           bool isJSON5,
+                                           alloc_slice results[],
+                                           std::exception_ptr errors[],
+                                           unsigned nThreads)
+    {
+        nThreads = Executor::resolveThreads(nThreads);
+        if (count < kMinParallelDeltas)
+            nThreads = 1;
+        nThreads = unsigned(min(size_t(nThreads), count));
+
+        // Deltas vary a lot in cost, so instead of giving each task a fixed range, the tasks
+        // take the next item from a shared counter. Each reuses one Encoder for all its items;
+        // with retainBuffers it stops allocating after the first few.
+        atomic<size_t> nextItem {0}, nFailed {0};
+        auto work = [&](size_t) {
+            Encoder enc;
+            enc.retainBuffers(true);
+            for (size_t i; (i = nextItem++) < count; ) {
+                try {
+                    apply(olds[i], jsonDeltas[i], isJSON5, enc);
+                    results[i] = enc.finish();
+                    if (errors)
+                        errors[i] = nullptr;
+                } catch (...) {
+                    results[i] = nullslice;
+                    if (errors)
+                        errors[i] = current_exception();
+                    ++nFailed;
+                    enc.reset();
+                }
+            }
+        };
+
+        Executor::parallelFor(nThreads, nThreads, work);
+        return nFailed;
     }
 
 
@@ -287,6 +684,21 @@ namespace fleece { namespace impl {
     }
 
 
+    // Returns the patch of a data diff: a data value, or in a JSON delta a base64 string,
+    // which is decoded into `decoded`.
+    static slice dataDiffPatch(const Value *patch, alloc_slice &decoded) {
+        slice diff;
+        if (patch->type() == kData) {
+            diff = patch->asData();
+        } else {
+            decoded = base64::decode(patch->asString());
+            diff = decoded;
+        }
+        throwIf(diff.size == 0, InvalidData, "Invalid data diff in delta");
+        return diff;
+    }
+
+
     inline void JSONDelta::_applyArray(const Value *old, const Array* NONNULL delta) {
         switch (delta->count()) {
             case 0:
@@ -324,6 +736,15 @@ namespace fleece { namespace impl {
                         _decoder->writeString(nuuStr);
                         break;
                     }
+                    case kDataDiffCode: {
+                        // Data diff:
+                        throwIf(!old || old->type() != kData, InvalidData,
+                                "Invalid data replace in delta");
+                        alloc_slice decoded;
+                        slice diff = dataDiffPatch(delta->get(0), decoded);
+                        _decoder->writeData(applyDataDelta(old->asData(), diff));
+                        break;
+                    }
                     default:
                         FleeceException::_throw(InvalidData, "Unknown mode in delta");
                 }
@@ -335,6 +756,12 @@ namespace fleece { namespace impl {
     }
 
 
+    // Looks up the key of a Dict iterator in a different Dict.
+    inline const Value* JSONDelta::getSameKey(const Dict *dict, const Dict::iterator &i) const {
+        return _keysByString ? dict->get(i.keyString()) : dict->get(i.key());
+    }
+
+
     inline void JSONDelta::_patchDict(const Dict* NONNULL old, const Dict* NONNULL delta) {
         // Dict: Incremental update
         if (_decoder->valueIsInBase(old)) {
@@ -342,34 +769,21 @@ namespace fleece { namespace impl {
             _decoder->beginDictionary(old);
             for (Dict::iterator i(delta); i; ++i) {
                 _decoder->writeKey(i.keyString());
-                _apply(old->get(i.key()), i.value());  // recurse into dict item!
+                _apply(getSameKey(old, i), i.value());  // recurse into dict item!
             }
             _decoder->endDictionary();
         } else {
             // In the general case, have to write a new dict from scratch:
             _decoder->beginDictionary();
-            // Process the unaffected, deleted, and modified keys:
-            unsigned deltaKeysUsed = 0;
-            for (Dict::iterator i(old); i; ++i) {
-                const Value *valueDelta = delta->get(i.key());
-                if (valueDelta)
-                    ++deltaKeysUsed;
-                if (!isDeltaDeletion(valueDelta)) {                 // skip deletions
+            // Process the unaffected, deleted, modified and inserted keys in one pass:
+            for (DictMergeIterator i(old, delta); i; ++i) {
+                auto oldValue = i.value1(), valueDelta = i.value2();
+                if (!oldValue || !isDeltaDeletion(valueDelta)) {    // skip deletions
                     _decoder->writeKey(i.keyString());
-                    auto oldValue = i.value();
                     if (valueDelta == nullptr)
                         _decoder->writeValue(oldValue);               // unaffected
                     else
-                        _apply(oldValue, valueDelta);  // replaced/modified
-                }
-            }
-            // Now add the inserted keys:
-            if (deltaKeysUsed < delta->count()) {
-                for (Dict::iterator i(delta); i; ++i) {
-                    if (old->get(i.key()) == nullptr) {
-                        _decoder->writeKey(i.keyString());
-                        _apply(nullptr, i.value());  // recurse into insertion
-                    }
+                        _apply(oldValue, valueDelta);  // replaced/modified/inserted
                 }
             }
             _decoder->endDictionary();
@@ -377,43 +791,97 @@ namespace fleece { namespace impl {
     }
 
 
+    // Parses a key of an array delta: "i" (patch item i), "i-n" (replace n items starting at i
+    // with the items of an array) or "i-" (replace all items starting at i.)
+    static bool parseArrayDeltaKey(slice key, uint32_t &index, bool &splice, uint32_t &count) {
+        auto parseInt = [&](uint32_t &n) {
+            if (key.size == 0 || !isdigit(key[0]))
+                return false;
+            uint64_t result = 0;
+            while (key.size > 0 && isdigit(key[0])) {
+                result = 10 * result + (key[0] - '0');
+                if (result > UINT32_MAX)
+                    return false;
+                key.moveStart(1);
+            }
+            n = uint32_t(result);
+            return true;
+        };
+        if (!parseInt(index))
+            return false;
+        splice = (key.size > 0);
+        count = UINT32_MAX;
+        if (splice) {
+            if (key[0] != '-')
+                return false;
+            key.moveStart(1);
+            if (key.size > 0 && !parseInt(count))
+                return false;
+        }
+        return key.size == 0;
+    }
+
+
+    // One operation of an array delta: a patch of item `index`, or a splice.
+    struct arrayOp {
+        uint32_t index;
+        bool     splice;
+        uint32_t count;             // splice: number of items to remove (UINT32_MAX = all)
+        const Value *value;
+        bool operator< (const arrayOp &op) const {
+            return index < op.index || (index == op.index && splice && !op.splice);
+        }
+    };
+
+
+    // Collects the operations of an array delta, in the order they apply.
+    // Returns false if a key isn't a valid array delta key.
+    static bool parseArrayDelta(const Dict *delta, vector<arrayOp> &ops) {
+        ops.reserve(delta->count());
+        for (Dict::iterator i(delta); i; ++i) {
+            arrayOp op;
+            if (!parseArrayDeltaKey(i.keyString(), op.index, op.splice, op.count))
+                return false;
+            op.value = i.value();
+            ops.push_back(op);
+        }
+        sort(ops.begin(), ops.end());
+        return true;
+    }
+
+
     inline void JSONDelta::_patchArray(const Array* NONNULL old, const Dict* NONNULL delta) {
-        // Array: Incremental update
+        // Array: Incremental update. First collect the delta's operations, in order:
+        vector<arrayOp> ops;
+        throwIf(!parseArrayDelta(delta, ops), InvalidData, "Invalid array index in delta");
+
         _decoder->beginArray();
-        uint32_t index = 0;
-        const Value *remainder = nullptr;
-        for (Array::iterator iOld(old); iOld; ++iOld, ++index) {
-            auto oldItem = iOld.value();
-            char key[10];
-            sprintf(key, "%d", index);
-            auto replacement = delta->get(slice(key));
-            if (replacement) {
+        uint32_t oldCount = old->count(), index = 0;
+        for (auto &op : ops) {
+            throwIf(op.index < index || op.index > oldCount, InvalidData,
+                    "Invalid array index in delta");
+            for (; index < op.index; ++index)
+                _decoder->writeValue(old->get(index));       // unaffected items
+            if (!op.splice) {
                 // Patch this array item:
-                _apply(oldItem, replacement);
+                throwIf(index >= oldCount, InvalidData, "Invalid array index in delta");
+                _apply(old->get(index++), op.value);
             } else {
-                strcat(key, "-");
-                remainder = delta->get(slice(key));
-                if (remainder) {
-                    break;
-                } else {
-                    // Array item is unaffected:
-                    _decoder->writeValue(oldItem);
+                // Replace a range of items with the array from the delta:
+                auto items = op.value->asArray();
+                throwIf(!items, InvalidData, "Invalid array remainder in delta");
+                for (Array::iterator iItem(items); iItem; ++iItem)
+                    _decoder->writeValue(iItem.value());
+                if (op.count == UINT32_MAX)
+                    index = oldCount;
+                else {
+                    throwIf(op.count > oldCount - index, InvalidData, "Invalid array splice in delta");
+                    index += op.count;
                 }
             }
         }
-
-        if (!remainder) {
-            char key[10];
-            sprintf(key, "%d-", old->count());
-            remainder = delta->get(slice(key));
-        }
-        if (remainder) {
-            // Remainder of array is replaced by the array from the delta:
-            auto remainderArray = remainder->asArray();
-            throwIf(!remainderArray, InvalidData, "Invalid array remainder in delta");
-            for (Array::iterator iRem(remainderArray); iRem; ++iRem)
-                _decoder->writeValue(iRem.value());
-        }
+        for (; index < oldCount; ++index)
+            _decoder->writeValue(old->get(index));           // unaffected items
         _decoder->endArray();
     }
 
@@ -430,6 +898,481 @@ namespace fleece { namespace impl {
     }
 
 
+#pragma mark - APPLYING IN PLACE:
+
+
+    /*static*/ void JSONDelta::applyTo(MutableDict *dict, slice jsonDelta, bool isJSON5) {
+        assert_precondition(jsonDelta);
+        tracing::Span span("JSONDelta::applyTo", jsonDelta.size);
+        alloc_slice fleeceData = isJSON5 ? JSONConverter::convertJSON5(jsonDelta)
+                                         : JSONConverter::convertJSON(jsonDelta);
+        // Values inserted from the delta are copied from a Doc, which has to own its data:
+        Retained<Doc> deltaDoc = new Doc(fleeceData, Doc::kTrusted);
+        applyTo(dict, deltaDoc->root());
+    }
+
+
+    /*static*/ void JSONDelta::applyTo(MutableDict *dict, const Value *fleeceDelta) {
+        assert_precondition(dict && fleeceDelta);
+        auto deltaDict = fleeceDelta->asDict();
+        throwIf(!deltaDict, InvalidData, "Delta doesn't patch a dict");
+        _patchInPlace(dict, deltaDict);
+    }
+
+
+    // Stores a copy of `value` in a slot of a mutable collection, so that it doesn't point into
+    // the delta's data.
+    static void setCopy(ValueSlot &slot, const Value *value) {
+        constexpr auto kFlags = CopyFlags(kDeepCopy | kCopyImmutables);
+        switch (value->type()) {
+            case kNull:
+            case kBoolean:
+                slot.setValue(value);                   // always stored inline
+                break;
+            case kNumber:
+                if (!value->isInteger())
+                    slot.set(value->asDouble());
+                else if (value->isUnsigned())
+                    slot.set(value->asUnsigned());
+                else
+                    slot.set(value->asInt());
+                break;
+            case kString:
+                slot.set(value->asString());
+                break;
+            case kData:
+                slot.setData(value->asData());
+                break;
+            case kArray:
+                slot.set(MutableArray::newArray((const Array*)value, kFlags));
+                break;
+            case kDict:
+                slot.set(MutableDict::newDict((const Dict*)value, kFlags));
+                break;
+        }
+    }
+
+
+    // Applies `delta` to the item of `coll` (a MutableDict or MutableArray) at `key`.
+    // Like _apply, but updates the item in place instead of writing it to an Encoder.
+    template <class COLL, class KEY>
+    void JSONDelta::_applyInPlace(COLL *coll, KEY key, const Value *delta) {
+        const Value *old = coll->get(key);
+        switch (delta->type()) {
+            case kArray: {
+                auto deltaArray = (const Array*)delta;
+                auto count = deltaArray->count();
+                if (count == 0 || (count == 3 && deltaArray->get(2)->asInt() == kDeletionCode)) {
+                    // Deletion:
+                    throwIf(!old, InvalidData, "Invalid deletion in delta");
+                    if constexpr (std::is_same_v<COLL, MutableDict>)
+                        coll->remove(key);
+                    else
+                        coll->setting(key).setValue(Value::kUndefinedValue);  // as _apply does
+                } else if (count == 1 || count == 2) {
+                    // Insertion / replacement:
+                    throwIf(count == 2 && !old, InvalidData, "Invalid replace in delta");
+                    setCopy(coll->setting(key), deltaArray->get(count - 1));
+                } else if (count == 3 && deltaArray->get(2)->asInt() == kTextDiffCode) {
+                    // Text diff:
+                    slice oldStr;
+                    if (old)
+                        oldStr = old->asString();
+                    throwIf(!oldStr, InvalidData, "Invalid text replace in delta");
+                    slice diff = deltaArray->get(0)->asString();
+                    throwIf(diff.size == 0, InvalidData, "Invalid text diff in delta");
+                    coll->setting(key).set(slice(applyStringDelta(oldStr, diff)));
+                } else if (count == 3 && deltaArray->get(2)->asInt() == kDataDiffCode) {
+                    // Data diff:
+                    throwIf(!old || old->type() != kData, InvalidData,
+                            "Invalid data replace in delta");
+                    alloc_slice decoded;
+                    slice diff = dataDiffPatch(deltaArray->get(0), decoded);
+                    coll->setting(key).setData(applyDataDelta(old->asData(), diff));
+                } else {
+                    FleeceException::_throw(InvalidData, (count == 3 ? "Unknown mode in delta"
+                                                                     : "Bad array count in delta"));
+                }
+                break;
+            }
+            case kDict: {
+                auto deltaDict = (const Dict*)delta;
+                switch (old ? old->type() : kNull) {
+                    case kArray:
+                        _patchInPlace(coll->getMutableArray(key), deltaDict);
+                        break;
+                    case kDict:
+                        _patchInPlace(coll->getMutableDict(key), deltaDict);
+                        break;
+                    default:
+                        throwIf(!deltaDict->empty() || !old, InvalidData, "Invalid {...} in delta");
+                }
+                break;
+            }
+            default:
+                setCopy(coll->setting(key), delta);
+                break;
+        }
+    }
+
+
+    void JSONDelta::_patchInPlace(MutableDict *dict, const Dict *delta) {
+        for (Dict::iterator i(delta); i; ++i) {
+            slice key = i.keyString();
+            if (isDeltaDeletion(i.value()) && !dict->get(key))
+                continue;                               // _patchDict skips these too
+            _applyInPlace(dict, key, i.value());
+        }
+    }
+
+
+    void JSONDelta::_patchInPlace(MutableArray *array, const Dict *delta) {
+        vector<arrayOp> ops;
+        throwIf(!parseArrayDelta(delta, ops), InvalidData, "Invalid array index in delta");
+
+        // Check the operations first, the same way _patchArray does:
+        uint32_t oldCount = array->count(), index = 0;
+        for (auto &op : ops) {
+            throwIf(op.index < index || op.index > oldCount, InvalidData,
+                    "Invalid array index in delta");
+            if (!op.splice) {
+                throwIf(op.index >= oldCount, InvalidData, "Invalid array index in delta");
+                index = op.index + 1;
+            } else {
+                throwIf(!op.value->asArray(), InvalidData, "Invalid array remainder in delta");
+                if (op.count == UINT32_MAX)
+                    op.count = oldCount - op.index;
+                else
+                    throwIf(op.count > oldCount - op.index, InvalidData,
+                            "Invalid array splice in delta");
+                index = op.index + op.count;
+            }
+        }
+
+        // Then apply them last-to-first, so each one's index isn't shifted by the others:
+        for (auto op = ops.rbegin(); op != ops.rend(); ++op) {
+            if (!op->splice) {
+                _applyInPlace(array, op->index, op->value);
+            } else {
+                auto items = (const Array*)op->value;
+                uint32_t nItems = items->count();
+                if (op->count > nItems)
+                    array->remove(op->index + nItems, op->count - nItems);
+                else if (op->count < nItems)
+                    array->insert(op->index + op->count, nItems - op->count);
+                uint32_t i = op->index;
+                for (Array::iterator iItem(items); iItem; ++iItem)
+                    setCopy(array->setting(i++), iItem.value());
+            }
+        }
+    }
+
+
+#pragma mark - COMPOSING DELTAS:
+
+
+    /*static*/ alloc_slice JSONDelta::compose(slice jsonDelta1, slice jsonDelta2, bool isJSON5) {
+        assert_precondition(jsonDelta1 && jsonDelta2);
+        tracing::Span span("JSONDelta::compose", jsonDelta1.size + jsonDelta2.size);
+        auto parse = [&](slice json) {
+            return isJSON5 ? JSONConverter::convertJSON5(json) : JSONConverter::convertJSON(json);
+        };
+        alloc_slice fleeceDelta1 = parse(jsonDelta1), fleeceDelta2 = parse(jsonDelta2);
+
+        Encoder enc;
+        compose(Value::fromTrustedData(fleeceDelta1), Value::fromTrustedData(fleeceDelta2), enc);
+        alloc_slice fleeceResult = enc.finish();
+        auto root = Value::fromTrustedData(fleeceResult);
+        alloc_slice result = isJSON5 ? root->toJSON<5>() : root->toJSON();
+        span.setOutputSize(result.size);
+        return result;
+    }
+
+
+    /*static*/ void JSONDelta::compose(const Value *delta1, const Value *delta2, Encoder &enc) {
+        assert_precondition(delta1 && delta2);
+        JSONDelta composer(enc);
+        // Values from `delta1` may get patched by `delta2`, whose keys needn't be shared:
+        composer._keysByString = true;
+        composer._compose(delta1, delta2, false);
+    }
+
+
+    // If the delta replaces or inserts a value, returns that value; else nullptr.
+    static const Value* deltaReplacement(const Value *delta) {
+        switch (delta->type()) {
+            case kDict:
+                return nullptr;
+            case kArray: {
+                auto array = (const Array*)delta;
+                switch (array->count()) {
+                    case 1:     return array->get(0);
+                    case 2:     return array->get(1);      // JsonDiffPatch format
+                    default:    return nullptr;
+                }
+            }
+            default:
+                return delta;
+        }
+    }
+
+
+    // If the delta is a text diff, returns the diff; else nullslice.
+    static slice deltaTextDiff(const Value *delta) {
+        auto array = delta->asArray();
+        if (array && array->count() == 3 && array->get(2)->asInt() == kTextDiffCode)
+            return array->get(0)->asString();
+        return nullslice;
+    }
+
+
+    // If the delta is a data diff, returns the patch value; else nullptr.
+    static const Value* deltaDataDiff(const Value *delta) {
+        auto array = delta->asArray();
+        if (array && array->count() == 3 && array->get(2)->asInt() == kDataDiffCode)
+            return array->get(0);
+        return nullptr;
+    }
+
+
+    // Does this dict delta contain "i-n" or "i-" keys? Those only appear in array deltas, and
+    // make the indexes of later items shift. (Other array deltas compose just like dicts.)
+    static bool hasArraySplices(const Dict *delta) {
+        for (Dict::iterator i(delta); i; ++i) {
+            uint32_t index, count;
+            bool splice;
+            if (parseArrayDeltaKey(i.keyString(), index, splice, count) && splice)
+                return true;
+        }
+        return false;
+    }
+
+
+    // Writes a delta equivalent to applying `delta1` and then `delta2`. Called recursively;
+    // `nested` is true if the delta is the value of a key in a dict or array delta.
+    void JSONDelta::_compose(const Value *delta1, const Value *delta2, bool nested) {
+        auto dict1 = delta1->asDict(), dict2 = delta2->asDict();
+        if (dict2 && dict2->empty()) {
+            _decoder->writeValue(delta1);                   // `delta2` is a no-op
+        } else if (dict1 && dict1->empty()) {
+            _decoder->writeValue(delta2);                   // `delta1` is a no-op
+        } else if (dict2) {
+            // `delta2` patches a collection:
+            if (dict1) {
+                if (hasArraySplices(dict1) || hasArraySplices(dict2))
+                    _composeArray(dict1, dict2);
+                else
+                    _composeDict(dict1, dict2);
+            } else if (auto value = deltaReplacement(delta1); value) {
+                // Patch the value `delta1` inserted:
+                _decoder->beginArray();
+                _apply(value, dict2);
+                _decoder->endArray();
+            } else {
+                FleeceException::_throw(InvalidData, "Can't compose deltas: patch of deleted value");
+            }
+        } else if (slice diff2 = deltaTextDiff(delta2); diff2) {
+            // `delta2` is a text diff:
+            if (slice diff1 = deltaTextDiff(delta1); diff1) {
+                _decoder->beginArray();
+                _decoder->writeString(composeStringDeltas(diff1, diff2));
+                _decoder->writeInt(0);
+                _decoder->writeInt(kTextDiffCode);
+                _decoder->endArray();
+            } else {
+                auto value = deltaReplacement(delta1);
+                throwIf(!value || value->type() != kString, InvalidData,
+                        "Can't compose deltas: text diff of non-string");
+                string nuuStr = applyStringDelta(value->asString(), diff2);
+                if (!nested)
+                    _decoder->beginArray();
+                _decoder->writeString(nuuStr);
+                if (!nested)
+                    _decoder->endArray();
+            }
+        } else if (auto patch2 = deltaDataDiff(delta2); patch2) {
+            // `delta2` is a data diff:
+            alloc_slice decoded1, decoded2;
+            slice diff2 = dataDiffPatch(patch2, decoded2);
+            if (auto patch1 = deltaDataDiff(delta1); patch1) {
+                _decoder->beginArray();
+                _decoder->writeData(composeDataDeltas(dataDiffPatch(patch1, decoded1), diff2));
+                _decoder->writeInt(0);
+                _decoder->writeInt(kDataDiffCode);
+                _decoder->endArray();
+            } else {
+                auto value = deltaReplacement(delta1);
+                throwIf(!value || value->type() != kData, InvalidData,
+                        "Can't compose deltas: data diff of non-data");
+                alloc_slice nuuData = applyDataDelta(value->asData(), diff2);
+                if (!nested)
+                    _decoder->beginArray();
+                _decoder->writeData(nuuData);
+                if (!nested)
+                    _decoder->endArray();
+            }
+        } else {
+            // `delta2` replaces or deletes the value, so it doesn't matter what `delta1` did:
+            _decoder->writeValue(delta2);
+        }
+    }
+
+
+    void JSONDelta::_composeDict(const Dict *delta1, const Dict *delta2) {
+        _decoder->beginDictionary();
+        for (DictMergeIterator i(delta1, delta2); i; ++i) {
+            _decoder->writeKey(i.keyString());
+            if (!i.value2())
+                _decoder->writeValue(i.value1());
+            else if (!i.value1())
+                _decoder->writeValue(i.value2());
+            else
+                _compose(i.value1(), i.value2(), true);     // recurse into key changed by both
+        }
+        _decoder->endDictionary();
+    }
+
+
+    // Composes array deltas. `delta1`'s operations map each item of the intermediate array to
+    // an original item (maybe patched) or to an item `delta1` inserted. `delta2`'s operations
+    // are applied to that mapping, and the result is written as operations on the original
+    // array: original items it skips were removed, and runs of other items are inserted.
+    void JSONDelta::_composeArray(const Dict *delta1, const Dict *delta2) {
+        vector<arrayOp> ops1, ops2;
+        throwIf(!parseArrayDelta(delta1, ops1) || !parseArrayDelta(delta2, ops2),
+                InvalidData, "Invalid array index in delta");
+
+        // An item in terms of the original array: either original item `index`, or a value
+        // inserted by a splice; with the patches the deltas apply to it.
+        struct item {
+            const Value *inserted;
+            uint32_t index;
+            const Value *patch1, *patch2;
+        };
+        auto original = [](uint32_t index, const Value *patch1 =nullptr) {
+            return item{nullptr, index, patch1, nullptr};
+        };
+        auto inserted = [](const Value *value) {
+            return item{value, 0, nullptr, nullptr};
+        };
+        auto throwInvalid = [] {
+            FleeceException::_throw(InvalidData, "Invalid array index in delta");
+        };
+
+        // Map the intermediate array. Its items past the end of `mid` are the original ones
+        // from `midTail` on, unless `delta1` ends with an "i-" splice:
+        vector<item> mid;
+        uint32_t index = 0;
+        bool hasTail = true;
+        for (auto &op : ops1) {
+            if (!hasTail || op.index < index)
+                throwInvalid();
+            for (; index < op.index; ++index)
+                mid.push_back(original(index));
+            if (!op.splice) {
+                mid.push_back(original(index++, op.value));
+            } else {
+                auto items = op.value->asArray();
+                throwIf(!items, InvalidData, "Invalid array remainder in delta");
+                for (Array::iterator i(items); i; ++i)
+                    mid.push_back(inserted(i.value()));
+                if (op.count == UINT32_MAX)
+                    hasTail = false;
+                else
+                    index += op.count;
+            }
+        }
+        uint32_t midTail = index;
+        auto midItem = [&](uint32_t i) {
+            if (i < mid.size())
+                return mid[i];
+            if (!hasTail)
+                throwInvalid();
+            return original(midTail + (i - uint32_t(mid.size())));
+        };
+
+        // Apply `delta2` to it:
+        vector<item> result;
+        uint32_t i = 0;
+        bool ended = false;
+        for (auto &op : ops2) {
+            if (ended || op.index < i)
+                throwInvalid();
+            for (; i < op.index; ++i)
+                result.push_back(midItem(i));
+            if (!op.splice) {
+                item patched = midItem(i++);
+                patched.patch2 = op.value;
+                result.push_back(patched);
+            } else {
+                auto items = op.value->asArray();
+                throwIf(!items, InvalidData, "Invalid array remainder in delta");
+                for (Array::iterator iItem(items); iItem; ++iItem)
+                    result.push_back(inserted(iItem.value()));
+                if (op.count == UINT32_MAX)
+                    ended = true;
+                else
+                    i += op.count;
+            }
+        }
+        // ...after which come the rest of the intermediate items, if any:
+        bool resultHasTail = false;
+        uint32_t resultTail = 0;
+        if (!ended) {
+            for (; i < mid.size(); ++i)
+                result.push_back(mid[i]);
+            if (hasTail) {
+                resultHasTail = true;
+                resultTail = midTail + (i - uint32_t(mid.size()));
+            } else if (i > mid.size()) {
+                throwInvalid();
+            }
+        }
+
+        // Write the result as operations on the original array:
+        _decoder->beginDictionary();
+        char key[24];
+        uint32_t oldPos = 0;
+        vector<item> pending;           // Inserted items not written yet
+        auto writeSplice = [&](uint32_t endIndex, bool toEnd) {
+            if (toEnd)
+                sprintf(key, "%u-", oldPos);
+            else if (endIndex > oldPos || !pending.empty())
+                sprintf(key, "%u-%u", oldPos, endIndex - oldPos);
+            else
+                return;
+            _decoder->writeKey(slice(key));
+            _decoder->beginArray();
+            for (auto &ins : pending) {
+                if (ins.patch2)
+                    _apply(ins.inserted, ins.patch2);
+                else
+                    _decoder->writeValue(ins.inserted);
+            }
+            _decoder->endArray();
+            pending.clear();
+        };
+        for (auto &r : result) {
+            if (r.inserted) {
+                pending.push_back(r);
+                continue;
+            }
+            writeSplice(r.index, false);
+            if (r.patch1 || r.patch2) {
+                sprintf(key, "%u", r.index);
+                _decoder->writeKey(slice(key));
+                if (r.patch1 && r.patch2)
+                    _compose(r.patch1, r.patch2, true);
+                else
+                    _decoder->writeValue(r.patch1 ? r.patch1 : r.patch2);
+            }
+            oldPos = r.index + 1;
+        }
+        writeSplice(resultTail, !resultHasTail);
+        _decoder->endDictionary();
+    }
+
+
 #pragma mark - STRING DELTAS:
 
 
@@ -437,58 +1380,88 @@ namespace fleece { namespace impl {
         if (nuuStr.size < gMinStringDiffLength
                 || (gCompatibleDeltas && oldStr.size > gMinStringDiffLength))
             return "";
-        diff_match_patch<string> dmp;
-        dmp.Diff_Timeout = gTextDiffTimeout;
-        auto patches = dmp.patch_make(string(oldStr), string(nuuStr));
 
-        if (gCompatibleDeltas)
-            return dmp.patch_toText(patches);
+        if (gCompatibleDeltas) {
+            diff_match_patch<string> dmp;
+            dmp.Diff_Timeout = gTextDiffTimeout;
+            return dmp.patch_toText(dmp.patch_make(string(oldStr), string(nuuStr)));
+        }
 
-        // Iterate over the diffs, writing the encoded form to the output stream:
-        stringstream diff;
-        long lastOldPos = 0, correction = 0;
-        for (auto patch = patches.begin(); patch != patches.end(); ++patch) {
-            long oldPos = patch->start1 + correction;   // position in oldStr
-            long nuuPos = patch->start2;                // position in nuuStr
-            auto &diffs = patch->diffs;
-            for (auto cur_diff = diffs.begin(); cur_diff != diffs.end(); ++cur_diff) {
-                auto length = cur_diff->text.length();
-                if (cur_diff->operation == diff_match_patch<string>::EQUAL) {
-                    oldPos += narrow_cast<long>(length);
-                    nuuPos += narrow_cast<long>(length);
-                } else {
-                    // Don't break up a UTF-8 multibyte character:
-                    if (cur_diff->operation == diff_match_patch<string>::DELETE)
-                        snapToUTF8Character(oldPos, length, oldStr);
-                    else
-                        snapToUTF8Character(nuuPos, length, nuuStr);
+        auto ops = diffBytes(oldStr, nuuStr, gTextDiffTimeout);
+
+        // Collect the changed ranges, as (oldStart, oldEnd, nuuStart, nuuEnd):
+        struct change {size_t oldStart, oldEnd, nuuStart, nuuEnd;};
+        vector<change> ranges;
+        size_t oldPos = 0, nuuPos = 0;
+        for (auto &op : ops) {
+            if (op.kind == ByteDiffOp::kEqual) {
+                oldPos += op.length;
+                nuuPos += op.length;
+                continue;
+            }
+            if (ranges.empty() || ranges.back().oldEnd != oldPos || ranges.back().nuuEnd != nuuPos)
+                ranges.push_back({oldPos, oldPos, nuuPos, nuuPos});
+            if (op.kind == ByteDiffOp::kDelete)
+                oldPos = ranges.back().oldEnd += op.length;
+            else
+                nuuPos = ranges.back().nuuEnd += op.length;
+        }
 
-                    assert(oldPos >= lastOldPos);
-                    if (oldPos > lastOldPos) {
-                        // Write the number of matching bytes since the last insert/delete:
-                        diff << (oldPos-lastOldPos) << '=';
-                    }
-                    if (cur_diff->operation == diff_match_patch<string>::DELETE) {
-                        // Write the number of deleted bytes:
-                        diff << length << '-';
-                        oldPos += narrow_cast<long>(length);
-                    } else /* INSERT */ {
-                        // Write an insertion, both the count and the bytes:
-                        diff << length << '+';
-                        diff.write((const char*)&nuuStr[nuuPos], length);
-                        diff << '|';
-                        nuuPos += narrow_cast<long>(length);
-                    }
-                    lastOldPos = oldPos;
-                }
-                if ((size_t)diff.tellp() + 6 >= nuuStr.size)
-                    return "";          // Patch is too long; give up on using a diff
+        // Widen any range that starts or ends in the middle of a UTF-8 multibyte character to
+        // include all of it. The bytes it takes in are equal in both strings, so the ranges stay
+        // consistent. A range that grows into its neighbor, or is separated from it by only a
+        // few equal bytes (which would cost more to encode than to re-insert), is merged with it.
+        auto splitsChar = [&](size_t oldPos, size_t nuuPos) {
+            return (oldPos < oldStr.size && isUTF8Continuation(oldStr[oldPos]))
+                || (nuuPos < nuuStr.size && isUTF8Continuation(nuuStr[nuuPos]));
+        };
+        vector<change> changes;
+        for (size_t i = 0; i < ranges.size(); ++i) {
+            change c = ranges[i];
+            size_t prevEnd = changes.empty() ? 0 : changes.back().oldEnd;
+            while (c.oldStart > prevEnd && c.nuuStart > 0 && splitsChar(c.oldStart, c.nuuStart)) {
+                --c.oldStart;
+                --c.nuuStart;
+            }
+            if (!changes.empty() && c.oldStart < prevEnd + kMinStringDiffEqualRun) {
+                changes.back().oldEnd = c.oldEnd;
+                changes.back().nuuEnd = c.nuuEnd;
+            } else {
+                changes.push_back(c);
+            }
+            change &last = changes.back();
+            size_t nextStart = (i + 1 < ranges.size()) ? ranges[i+1].oldStart : oldStr.size;
+            while (last.oldEnd < nextStart && splitsChar(last.oldEnd, last.nuuEnd)) {
+                ++last.oldEnd;
+                ++last.nuuEnd;
             }
-            correction += patch->length1 - patch->length2;
         }
-        if (oldStr.size > size_t(lastOldPos)) {
+
+        // Write the encoded form of the changes:
+        stringstream diff;
+        size_t lastOldPos = 0;
+        for (auto &c : changes) {
+            if (c.oldStart > lastOldPos) {
+                // Write the number of matching bytes since the last insert/delete:
+                diff << (c.oldStart - lastOldPos) << '=';
+            }
+            if (c.oldEnd > c.oldStart) {
+                // Write the number of deleted bytes:
+                diff << (c.oldEnd - c.oldStart) << '-';
+            }
+            if (c.nuuEnd > c.nuuStart) {
+                // Write an insertion, both the count and the bytes:
+                diff << (c.nuuEnd - c.nuuStart) << '+';
+                diff.write((const char*)&nuuStr[c.nuuStart], c.nuuEnd - c.nuuStart);
+                diff << '|';
+            }
+            lastOldPos = c.oldEnd;
+            if ((size_t)diff.tellp() + 6 >= nuuStr.size)
+                return "";          // Patch is too long; give up on using a diff
+        }
+        if (oldStr.size > lastOldPos) {
             // Write a final matching-bytes count:
-            diff << (oldStr.size-lastOldPos) << '=';
+            diff << (oldStr.size - lastOldPos) << '=';
         }
         return diff.str();
     }
@@ -538,17 +1511,359 @@ namespace fleece { namespace impl {
     }
 
 
-    // Given a byte range (`pos`, `length`) in the slice `str`, if either end of the range falls
-    // in the middle of a UTF-8 multibyte character, push it _outwards_ to include the entire char.
-    static void snapToUTF8Character(long &pos, size_t &length, slice str) {
-        while (isUTF8Continuation(str[pos])) {
-            --pos;
-            throwIf(pos < 0, InvalidData, "Invalid UTF-8 at start of a string");
-            ++length;
+    // Combines two text diffs, where `diff2` applies to the string `diff1` produces.
+    /*static*/ string JSONDelta::composeStringDeltas(slice diff1, slice diff2) {
+        struct op {
+            char  kind;                 // '=', '-' or '+'
+            size_t len;
+            slice insertion;            // The inserted bytes, if kind is '+'
+        };
+        auto parse = [](slice diff) {
+            vector<op> ops;
+            while (diff.size > 0) {
+                op o {0, 0, nullslice};
+                throwIf(!isdigit(diff[0]), InvalidData, "Invalid length in text delta");
+                while (diff.size > 0 && isdigit(diff[0])) {
+                    o.len = 10 * o.len + (diff[0] - '0');
+                    throwIf(o.len > UINT32_MAX, InvalidData, "Invalid length in text delta");
+                    diff.moveStart(1);
+                }
+                throwIf(diff.size == 0, InvalidData, "Unknown op in text delta");
+                o.kind = diff[0];
+                diff.moveStart(1);
+                if (o.kind == '+') {
+                    throwIf(diff.size <= o.len || diff[o.len] != '|', InvalidData,
+                            "Missing insertion delimiter in text delta");
+                    o.insertion = slice(diff.buf, o.len);
+                    diff.moveStart(o.len + 1);
+                } else {
+                    throwIf(o.kind != '=' && o.kind != '-', InvalidData, "Unknown op in text delta");
+                }
+                ops.push_back(o);
+            }
+            return ops;
+        };
+        vector<op> ops1 = parse(diff1), ops2 = parse(diff2);
+
+        // Consecutive ops of the same kind are merged as they're written:
+        stringstream out;
+        op last {0, 0, nullslice};
+        string lastInsertion;
+        auto flush = [&] {
+            if (last.len > 0) {
+                out << last.len << last.kind;
+                if (last.kind == '+')
+                    out << lastInsertion << '|';
+            }
+            last.len = 0;
+            lastInsertion.clear();
+        };
+        auto write = [&](char kind, size_t len, slice insertion) {
+            if (len == 0)
+                return;
+            if (kind != last.kind) {
+                flush();
+                last.kind = kind;
+            }
+            last.len += len;
+            if (kind == '+')
+                lastInsertion.append((const char*)insertion.buf, insertion.size);
+        };
+
+        // Walk through `diff2`, consuming the bytes of the intermediate string that `diff1`
+        // produces: original bytes it kept, and bytes it inserted.
+        size_t i1 = 0, used1 = 0;
+        for (auto &o2 : ops2) {
+            if (o2.kind == '+') {
+                write('+', o2.len, o2.insertion);
+                continue;
+            }
+            size_t len = o2.len;
+            while (len > 0) {
+                throwIf(i1 >= ops1.size(), InvalidData, "Length mismatch in text delta");
+                auto &o1 = ops1[i1];
+                if (o1.kind == '-') {
+                    write('-', o1.len, nullslice);
+                    ++i1;
+                    continue;
+                }
+                size_t n = min(len, o1.len - used1);
+                if (o1.kind == '=')
+                    write(o2.kind, n, nullslice);           // original bytes kept or deleted
+                else if (o2.kind == '=')
+                    write('+', n, slice((const char*)o1.insertion.buf + used1, n));
+                // (bytes inserted by `diff1` and deleted by `diff2` just disappear)
+                len -= n;
+                used1 += n;
+                if (used1 == o1.len) {
+                    ++i1;
+                    used1 = 0;
+                }
+            }
+        }
+        for (; i1 < ops1.size(); ++i1) {
+            // Only deletions (or empty ops) of `diff1` can be left over:
+            auto &o1 = ops1[i1];
+            throwIf(o1.kind != '-' && o1.len > used1, InvalidData, "Length mismatch in text delta");
+            if (o1.kind == '-')
+                write('-', o1.len, nullslice);
+            used1 = 0;
+        }
+        flush();
+        return out.str();
+    }
+
+
+#pragma mark - DATA DELTAS:
+
+
+    // A data diff is a sequence of varint-encoded ops, preceded by the length of the new data.
+    // Each op starts with `(length << 1) | isInsertion`; a copy is followed by the offset in the
+    // old data to copy `length` bytes from, and an insertion by the `length` bytes to insert.
+
+    // Content-defined chunking parameters: chunk boundaries are placed where the rolling "gear"
+    // hash of the preceding bytes has its top bits all zero, so the boundaries depend only on
+    // nearby content and resynchronize right after an insertion or deletion.
+    static constexpr size_t   kMinDataChunk = 128, kMaxDataChunk = 4096;
+    static constexpr uint64_t kDataChunkMask = 0x1FFull << 55;     // ~512 bytes past the min
+
+    struct GearTable {
+        uint64_t entries[256];
+        constexpr GearTable() :entries() {
+            uint64_t x = 0;
+            for (auto &e : entries) {                   // splitmix64
+                uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                e = z ^ (z >> 31);
+            }
+        }
+    };
+    static constexpr GearTable kGear;
+
+    // Returns the length of the content-defined chunk at the start of `data`.
+    static size_t nextDataChunk(slice data) {
+        if (data.size <= kMinDataChunk)
+            return data.size;
+        size_t end = min(data.size, kMaxDataChunk);
+        auto bytes = (const uint8_t*)data.buf;
+        uint64_t h = 0;
+        for (size_t i = 0; i < kMinDataChunk; ++i)
+            h = (h << 1) + kGear.entries[bytes[i]];
+        for (size_t i = kMinDataChunk; i < end; ++i) {
+            h = (h << 1) + kGear.entries[bytes[i]];
+            if ((h & kDataChunkMask) == 0)
+                return i + 1;
+        }
+        return end;
+    }
+
+    static void appendVarint(string &out, uint64_t n) {
+        uint8_t buf[kMaxVarintLen64];
+        out.append((const char*)buf, PutUVarInt(buf, n));
+    }
+
+    static uint64_t readVarint(slice &in, const char *what) {
+        uint64_t n;
+        size_t size = GetUVarInt(in, &n);
+        throwIf(size == 0, InvalidData, what);
+        in.moveStart(size);
+        return n;
+    }
+
+    // Writes data-diff ops, merging consecutive insertions and copies of consecutive ranges.
+    class DataDiffWriter {
+    public:
+        explicit DataDiffWriter(size_t nuuSize)     {appendVarint(_out, nuuSize);}
+
+        void copy(size_t oldPos, size_t len) {
+            if (len == 0)
+                return;
+            if (_copyLen > 0 && _copyPos + _copyLen == oldPos) {
+                _copyLen += len;
+            } else {
+                flush();
+                _copyPos = oldPos;
+                _copyLen = len;
+            }
+        }
+
+        void insert(slice bytes) {
+            if (_copyLen > 0)
+                flush();
+            _insertion.append((const char*)bytes.buf, bytes.size);
         }
-        while (pos+length < str.size && isUTF8Continuation(str[pos+length])) {
-            ++length;
+
+        size_t size() const                 {return _out.size() + _insertion.size();}
+
+        alloc_slice finish()                {flush(); return alloc_slice(_out);}
+
+    private:
+        void flush() {
+            if (_copyLen > 0) {
+                appendVarint(_out, _copyLen << 1);
+                appendVarint(_out, _copyPos);
+                _copyLen = 0;
+            } else if (!_insertion.empty()) {
+                appendVarint(_out, (_insertion.size() << 1) | 1);
+                _out += _insertion;
+                _insertion.clear();
+            }
         }
+
+        string _out, _insertion;
+        size_t _copyPos {0}, _copyLen {0};
+    };
+
+
+    /*static*/ alloc_slice JSONDelta::createDataDelta(slice oldData, slice nuuData) {
+        if (nuuData.size < gMinDataDiffLength || oldData.size == 0 || gCompatibleDeltas)
+            return nullslice;
+
+        // Index the chunks of the old data by hash:
+        unordered_map<uint64_t, pair<size_t,size_t>> oldChunks;     // hash -> (offset, length)
+        for (size_t pos = 0; pos < oldData.size; ) {
+            size_t len = nextDataChunk(oldData.from(pos));
+            oldChunks.emplace(wy::wyhash(&oldData[pos], len, 0, wy::_wyp), make_pair(pos, len));
+            pos += len;
+        }
+
+        // Find the chunks of the new data that also occur in the old data:
+        struct match {size_t nuuPos, oldPos, len;};
+        vector<match> matches;
+        for (size_t pos = 0; pos < nuuData.size; ) {
+            size_t len = nextDataChunk(nuuData.from(pos));
+            auto i = oldChunks.find(wy::wyhash(&nuuData[pos], len, 0, wy::_wyp));
+            if (i != oldChunks.end() && i->second.second == len
+                    && memcmp(&oldData[i->second.first], &nuuData[pos], len) == 0)
+                matches.push_back({pos, i->second.first, len});
+            pos += len;
+        }
+        if (matches.empty())
+            return nullslice;
+
+        // Extend each match backward and forward over equal bytes, into the chunks that
+        // contain the changes, then write copies of the matches and insertions of the gaps:
+        DataDiffWriter writer(nuuData.size);
+        size_t nuuPos = 0;
+        for (size_t m = 0; m < matches.size(); ++m) {
+            match cur = matches[m];
+            if (cur.nuuPos < nuuPos) {
+                // The previous match's forward extension overlaps this one:
+                size_t skip = nuuPos - cur.nuuPos;
+                if (skip >= cur.len)
+                    continue;
+                cur.nuuPos += skip;
+                cur.oldPos += skip;
+                cur.len -= skip;
+            }
+            while (cur.nuuPos > nuuPos && cur.oldPos > 0
+                        && nuuData[cur.nuuPos - 1] == oldData[cur.oldPos - 1]) {
+                --cur.nuuPos;
+                --cur.oldPos;
+                ++cur.len;
+            }
+            size_t limit = (m + 1 < matches.size()) ? matches[m + 1].nuuPos : nuuData.size;
+            while (cur.nuuPos + cur.len < limit && cur.oldPos + cur.len < oldData.size
+                        && nuuData[cur.nuuPos + cur.len] == oldData[cur.oldPos + cur.len])
+                ++cur.len;
+            writer.insert(nuuData(nuuPos, cur.nuuPos - nuuPos));
+            writer.copy(cur.oldPos, cur.len);
+            nuuPos = cur.nuuPos + cur.len;
+            if (writer.size() >= nuuData.size)
+                return nullslice;   // Patch is too long; give up on using a diff
+        }
+        writer.insert(nuuData.from(nuuPos));
+        alloc_slice diff = writer.finish();
+        if (diff.size + 8 >= nuuData.size)
+            return nullslice;
+        return diff;
+    }
+
+
+    // Calls `copy(oldPos, len)` or `insert(bytes)` for each op of a data diff, after checking
+    // the ops against the new and old data lengths. Returns the length of the new data.
+    template <class COPY, class INSERT>
+    static size_t readDataDelta(slice diff, size_t oldSize, COPY copy, INSERT insert) {
+        size_t nuuSize = readVarint(diff, "Invalid length in data delta");
+        size_t pos = 0;
+        while (diff.size > 0) {
+            uint64_t op = readVarint(diff, "Invalid op in data delta");
+            size_t len = size_t(op >> 1);
+            throwIf(len == 0 || len > nuuSize - pos, InvalidData, "Invalid length in data delta");
+            if (op & 1) {
+                throwIf(len > diff.size, InvalidData, "Invalid insertion in data delta");
+                insert(slice(diff.buf, len));
+                diff.moveStart(len);
+            } else {
+                uint64_t oldPos = readVarint(diff, "Invalid offset in data delta");
+                throwIf(oldPos > oldSize || len > oldSize - oldPos, InvalidData,
+                        "Invalid offset in data delta");
+                copy(size_t(oldPos), len);
+            }
+            pos += len;
+        }
+        throwIf(pos != nuuSize, InvalidData, "Length mismatch in data delta");
+        return nuuSize;
+    }
+
+
+    /*static*/ alloc_slice JSONDelta::applyDataDelta(slice oldData, slice diff) {
+        // Validate the diff before trusting the length it starts with:
+        alloc_slice nuu(readDataDelta(diff, oldData.size, [](size_t, size_t) { }, [](slice) { }));
+        size_t pos = 0;
+        readDataDelta(diff, oldData.size,
+                      [&](size_t oldPos, size_t len) {
+                          memcpy((uint8_t*)nuu.buf + pos, &oldData[oldPos], len);
+                          pos += len;
+                      },
+                      [&](slice bytes) {
+                          memcpy((uint8_t*)nuu.buf + pos, bytes.buf, bytes.size);
+                          pos += bytes.size;
+                      });
+        return nuu;
+    }
+
+
+    // Combines two data diffs, where `diff2` applies to the data `diff1` produces.
+    /*static*/ alloc_slice JSONDelta::composeDataDeltas(slice diff1, slice diff2) {
+        // The intermediate data, as the pieces `diff1` assembles it from: `len` bytes copied
+        // from the original data at `oldPos`, or inserted `bytes`. `start` is its offset.
+        struct piece {size_t start, len, oldPos; const void *bytes;};
+        vector<piece> pieces;
+        size_t midSize = 0;
+        readDataDelta(diff1, SIZE_MAX,
+            [&](size_t oldPos, size_t len) {
+                pieces.push_back({midSize, len, oldPos, nullptr});
+                midSize += len;
+            },
+            [&](slice bytes) {
+                pieces.push_back({midSize, bytes.size, 0, bytes.buf});
+                midSize += bytes.size;
+            });
+
+        slice in = diff2;
+        DataDiffWriter writer(readVarint(in, "Invalid length in data delta"));
+        readDataDelta(diff2, midSize,
+            [&](size_t midPos, size_t len) {
+                // Translate the copied range of the intermediate data into its pieces:
+                auto p = upper_bound(pieces.begin(), pieces.end(), midPos,
+                                     [](size_t pos, const piece &pc) {return pos < pc.start;});
+                for (--p; len > 0; ++p) {
+                    size_t offset = midPos - p->start;
+                    size_t n = min(len, p->len - offset);
+                    if (p->bytes)
+                        writer.insert(slice(offsetby(p->bytes, offset), n));
+                    else
+                        writer.copy(p->oldPos + offset, n);
+                    midPos += n;
+                    len -= n;
+                }
+            },
+            [&](slice bytes) {
+                writer.insert(bytes);
+            });
+        return writer.finish();
     }
 
 } }
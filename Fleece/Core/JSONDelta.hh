@@ -6,10 +6,14 @@
 
 #pragma once
 #include "FleeceImpl.hh"
+#include <exception>
 #include <string>
+#include <unordered_map>
 
 namespace fleece { namespace impl {
     class JSONEncoder;
+    class MutableArray;
+    class MutableDict;
 
 
     class JSONDelta {
@@ -19,10 +23,32 @@ namespace fleece { namespace impl {
             If the values are equal, returns nullslice. */
             static alloc_slice create(const Value *old, const Value *nuu, bool json5 =false);
 
+        /** Like `create`, but gives up and returns nullslice as soon as the delta grows larger
+            than `maxSize` bytes, in which case it's probably not worth using instead of `nuu`.
+            This saves most of the work of diffing values that have been mostly rewritten. */
+        static alloc_slice createIfSmaller(const Value *old, const Value *nuu, size_t maxSize,
+                                           bool json5 =false);
+
+        /** Like `create`, but if `old` and `nuu` are large Dicts, diffs ranges of their keys
+            concurrently on `nThreads` threads (0 means the Executor's concurrency), each into
+            its own JSONEncoder, and joins the pieces in key order. The result is identical to
+            what `create` returns. */
+        static alloc_slice createParallel(const Value *old, const Value *nuu, bool json5 =false,
+                                          unsigned nThreads =0);
+
+        /** Dicts with fewer keys than this are diffed by \ref createParallel on one thread. */
+        static constexpr uint32_t kMinParallelCreateCount = 256;
+
         /** Writes JSON that describes the changes to turn the value `old` into `nuu`.
             If the values are equal, writes nothing and returns false. */
         static bool create(const Value *old, const Value *nuu, JSONEncoder&);
 
+        /** Writes a Fleece-encoded delta that describes the changes to turn `old` into `nuu`.
+            It has the same structure as the JSON delta (converting it to JSON produces the
+            JSON delta), but it can be applied without parsing any JSON.
+            If the values are equal, writes an empty dict and returns false. */
+        static bool create(const Value *old, const Value *nuu, Encoder&);
+
 
         /** Applies the JSON delta created by `create` to the value `old` (which must be equal
             to the `old` value originally passed to `create`) and returns a Fleece document
@@ -36,9 +62,72 @@ namespace fleece { namespace impl {
             If the delta is malformed or can't be applied to `old`, throws a FleeceException. */
         static void apply(const Value *old, slice jsonDelta, bool isJSON5, Encoder&);
 
+        /** Applies a Fleece-encoded delta, written by `create` to an Encoder, to the value `old`
+            and returns a Fleece document equal to the original `nuu` value.
+            If the delta is malformed or can't be applied to `old`, throws a FleeceException. */
+        static alloc_slice apply(const Value *old, const Value* NONNULL fleeceDelta);
+
+        /** Applies a Fleece-encoded delta, written by `create` to an Encoder, to the value `old`
+            and writes the corresponding `nuu` value to the Fleece encoder.
+            If the delta is malformed or can't be applied to `old`, throws a FleeceException. */
+        static void apply(const Value *old, const Value* NONNULL fleeceDelta, Encoder&);
+
+        /** Applies a JSON delta to a mutable Dict in place, instead of encoding a new document.
+            Only the values the delta changes are modified (nested collections it patches are
+            made mutable as needed), so this takes time proportional to the size of the delta.
+            Inserted values are copied, so they don't point into the delta.
+            The delta must be one created from a Dict equal to `dict`'s current contents.
+            If it's malformed or can't be applied, throws a FleeceException; in that case `dict`
+            may have been partly updated. */
+        static void applyTo(MutableDict* NONNULL dict, slice jsonDelta, bool isJSON5 =false);
+
+        /** Applies a Fleece-encoded delta to a mutable Dict in place, as above. */
+        static void applyTo(MutableDict* NONNULL dict, const Value* NONNULL fleeceDelta);
+
+        /** Applies `count` JSON deltas, each to the corresponding value in `olds`, concurrently
+            on `nThreads` threads (0 means the Executor's concurrency), and stores the resulting
+            Fleece documents in `results` in the same order. An item whose delta can't be applied gets
+            a null result, and its exception is stored in `errors` if that's non-null.
+            The `olds` values must not be mutated while this runs.
+            Returns the number of items that failed. */
+        static size_t applyMany(size_t count,
+                                const Value* const olds[],
+                                const slice jsonDeltas[],
+                                bool isJSON5,
+                                alloc_slice results[],
+                                std::exception_ptr errors[] =nullptr,
+                                unsigned nThreads =0);
+
+        /** Batches smaller than this are applied by \ref applyMany on a single thread. */
+        static constexpr size_t kMinParallelDeltas = 16;
+
+        /** Combines two JSON deltas into one that has the same effect as applying `jsonDelta1`
+            and then `jsonDelta2` (which must have been created from `jsonDelta1`'s result.)
+            This works on the deltas alone, without the document they apply to: nested patches
+            are merged, array splices are remapped, and consecutive string or data diffs are
+            combined.
+            If the deltas can't be combined, as when `jsonDelta2` patches a value `jsonDelta1`
+            deleted, throws a FleeceException. */
+        static alloc_slice compose(slice jsonDelta1, slice jsonDelta2, bool isJSON5 =false);
+
+        /** Combines two Fleece-encoded deltas into one, as above, and writes it to the encoder. */
+        static void compose(const Value* NONNULL delta1, const Value* NONNULL delta2, Encoder&);
+
         /** Minimum byte length of strings that will be considered for diffing (default 60) */
         static size_t gMinStringDiffLength;
 
+        /** Minimum byte length of data values that will be considered for diffing (default 1024).
+            Data diffs split the values into content-defined chunks and copy the chunks they
+            have in common, so a small edit to a large data value makes a small delta. */
+        static size_t gMinDataDiffLength;
+
+        /** If true, array deltas match up inserted and removed items anywhere in an array and
+            describe them with splice keys (`"i-n"`), instead of comparing items at the same
+            index (default false.) Deltas with splice keys can't be applied by versions of
+            Fleece older than this one, which ignore those keys, so only enable this if every
+            reader of the deltas understands them. */
+        static bool gArraySplices;
+
         /** Maximum time (in seconds) that the string-diff algorithm is allowed to run
             (default 0.25) */
         static float gTextDiffTimeout;
@@ -46,8 +135,14 @@ namespace fleece { namespace impl {
     private:
         struct pathItem;
 
-        JSONDelta(JSONEncoder&);
-        bool _write(const Value *old, const Value *nuu, pathItem *path);
+        JSONDelta() =default;
+        template <class ENC> bool _create(ENC&, const Value *old, const Value *nuu);
+        template <class ENC> bool _write(ENC&, const Value *old, const Value *nuu, pathItem*);
+        template <class ENC> void writePath(ENC&, pathItem*);
+        template <class ENC> void checkSize(ENC&);
+        template <class ENC> bool _writeArrayDiff(ENC&, const Array* NONNULL old,
+                                                 const Array* NONNULL nuu, pathItem*);
+        uint64_t hashOf(const Value* NONNULL);
 
         JSONDelta(Encoder&);
         void _apply(const Value *old, const Value* NONNULL delta);
@@ -55,12 +150,30 @@ namespace fleece { namespace impl {
         void _patchArray(const Array* NONNULL old, const Dict* NONNULL delta);
         void _patchDict(const Dict* NONNULL old, const Dict* NONNULL delta);
 
-        void writePath(pathItem*);
+        template <class COLL, class KEY>
+        static void _applyInPlace(COLL* NONNULL, KEY, const Value* NONNULL delta);
+        static void _patchInPlace(MutableDict* NONNULL, const Dict* NONNULL delta);
+        static void _patchInPlace(MutableArray* NONNULL, const Dict* NONNULL delta);
+
+        void _compose(const Value* NONNULL delta1, const Value* NONNULL delta2, bool nested);
+        void _composeDict(const Dict* NONNULL delta1, const Dict* NONNULL delta2);
+        void _composeArray(const Dict* NONNULL delta1, const Dict* NONNULL delta2);
+
+        const Value* getSameKey(const Dict* NONNULL, const Dict::iterator&) const;
         static bool isDeltaDeletion(const Value *delta);
         static std::string createStringDelta(slice oldStr, slice nuuStr);
         static std::string applyStringDelta(slice oldStr, slice diff);
-
-        JSONEncoder* _encoder;
-        Encoder* _decoder;
+        static std::string composeStringDeltas(slice diff1, slice diff2);
+        static alloc_slice createDataDelta(slice oldData, slice nuuData);
+        static alloc_slice applyDataDelta(slice oldData, slice diff);
+        static alloc_slice composeDataDeltas(slice diff1, slice diff2);
+
+        struct overBudget { };                  // Thrown when the delta exceeds _maxSize
+
+        std::unordered_map<const Value*, uint64_t> _hashes; // Cached hashes of collections
+        size_t _startPos {0};                   // Encoder position where the delta starts
+        size_t _maxSize {SIZE_MAX};             // Size limit of the delta being created
+        Encoder* _decoder {nullptr};
+        bool _keysByString {false};             // Match delta keys to `old` keys by string
     };
 } }
@@ -0,0 +1,131 @@
+//
+// KeyTranscoder.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "KeyTranscoder.hh"
+#include "FleeceImpl.hh"
+#include "FleeceException.hh"
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+
+    KeyTranscoder::KeyTranscoder(SharedKeys *source, SharedKeys *target)
+    :_source(source)
+    ,_target(target)
+    { }
+
+
+    int KeyTranscoder::mapKey(int sourceKey) {
+        if (_usuallyFalse(sourceKey < 0))
+            return sourceKey;                       // (the magic parent key)
+        if (_usuallyFalse(size_t(sourceKey) >= _map.size()))
+            _map.resize(sourceKey + 1, kUnmapped);
+        int &mapped = _map[sourceKey];
+        if (_usuallyFalse(mapped == kUnmapped)) {
+            slice str = _source->decode(sourceKey);
+            throwIf(!str, InvalidData, "Unrecognized integer key");
+            if (!_target->encodeAndAdd(str, mapped))
+                mapped = -1;
+        }
+        return mapped;
+    }
+
+
+    // True if the data would come out the same after transcoding, so it can just be copied.
+    bool KeyTranscoder::keysAreUnchanged(const Value *value) {
+        switch (value->type()) {
+            case kArray:
+                for (Array::iterator i(value->asArray()); i; ++i) {
+                    if (!keysAreUnchanged(i.value()))
+                        return false;
+                }
+                return true;
+            case kDict:
+                for (Dict::iterator i(value->asDict(), _source); i; ++i) {
+                    const Value *key = i.key();
+                    if (key->isInteger()) {
+                        if (mapKey(int(key->asInt())) != key->asInt())
+                            return false;
+                    } else {
+                        int encoded;
+                        if (_target->encode(key->asString(), encoded)
+                                || _target->couldAdd(key->asString()))
+                            return false;
+                    }
+                    if (!keysAreUnchanged(i.value()))
+                        return false;
+                }
+                return true;
+            default:
+                return true;
+        }
+    }
+
+
+    alloc_slice KeyTranscoder::transcode(slice data) {
+        const Value *root = Value::fromData(data);
+        throwIf(!root, InvalidData, "Invalid Fleece data");
+        if (keysAreUnchanged(root))
+            return alloc_slice(data);
+        Encoder enc(data.size);
+        enc.setSharedKeys(_target);
+        writeTo(root, enc);
+        return enc.finish();
+    }
+
+
+    void KeyTranscoder::writeTo(const Value *value, Encoder &enc) {
+        switch (value->type()) {
+            case kArray: {
+                auto array = value->asArray();
+                enc.beginArray(array->count());
+                for (Array::iterator i(array); i; ++i)
+                    writeTo(i.value(), enc);
+                enc.endArray();
+                break;
+            }
+            case kDict: {
+                // The mapped keys are written as they're found. If that puts them out of order,
+                // the Encoder sorts them; otherwise it notices they're already sorted.
+                auto dict = value->asDict();
+                enc.beginDictionary(dict->count());
+                for (Dict::iterator i(dict, _source); i; ++i) {
+                    const Value *v = i.value();
+                    if (_usuallyFalse(v->isUndefined()))
+                        continue;                   // (deletion of an inherited key)
+                    const Value *key = i.key();
+                    if (key->isInteger()) {
+                        int mapped = mapKey(int(key->asInt()));
+                        if (mapped >= 0)
+                            enc.writeKey(key_t(mapped));
+                        else
+                            enc.writeKey(_source->decode(int(key->asInt())));
+                    } else {
+                        enc.writeKey(key->asString());
+                    }
+                    writeTo(v, enc);
+                }
+                enc.endDictionary();
+                break;
+            }
+            default:
+                enc.writeValue(value);
+                break;
+        }
+    }
+
+} }
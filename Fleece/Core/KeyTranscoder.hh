@@ -0,0 +1,64 @@
+//
+// KeyTranscoder.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "SharedKeys.hh"
+#include "RefCounted.hh"
+#include <vector>
+
+namespace fleece { namespace impl {
+    class Encoder;
+    class Value;
+
+
+    /** Converts Fleece data encoded with one SharedKeys into data using another, as when
+        moving documents between databases.
+
+        The mapping from source to target integer keys is built up as keys are seen, so each
+        one is decoded and looked up in the target only once per KeyTranscoder. Data whose keys
+        all map to themselves (as when both SharedKeys started from the same state) is copied
+        verbatim; other data is re-encoded with the mapped keys written directly as integers.
+
+        Keys are added to the target SharedKeys as an Encoder would, so if it's persistent it
+        must be in a transaction. The mapping assumes that neither SharedKeys is reverted while
+        the KeyTranscoder is in use. Not thread-safe. */
+    class KeyTranscoder {
+    public:
+        KeyTranscoder(SharedKeys *source NONNULL, SharedKeys *target NONNULL);
+
+        /** Returns a copy of the Fleece data, using the target SharedKeys.
+            Throws InvalidData if the data isn't valid Fleece. */
+        alloc_slice transcode(slice fleeceData);
+
+        /** Writes a Value from data that uses the source SharedKeys to an Encoder, which must be
+            using the target SharedKeys. */
+        void writeTo(const Value* NONNULL, Encoder&);
+
+        /** The target key for a source key, or -1 if it has to be written as a string. */
+        int mapKey(int sourceKey);
+
+    private:
+        static constexpr int kUnmapped = -2;
+
+        bool keysAreUnchanged(const Value* NONNULL);
+
+        Retained<SharedKeys>    _source, _target;
+        std::vector<int>        _map;               // Source key -> target key, -1, or kUnmapped
+    };
+
+} }
@@ -0,0 +1,384 @@
+//
+// MsgPackConverter.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "MsgPackConverter.hh"
+#include "FleeceImpl.hh"
+#include "Writer.hh"
+#include "UTF8.hh"
+#include "slice_stream.hh"
+#include <cmath>
+#include <cstring>
+
+namespace fleece { namespace impl {
+
+    // Format bytes:
+    enum : uint8_t {
+        kFixMap = 0x80, kFixArray = 0x90, kFixStr = 0xA0,
+        kNil = 0xC0, kNeverUsed, kFalse, kTrue,
+        kBin8, kBin16, kBin32,
+        kExt8, kExt16, kExt32,
+        kFloat32, kFloat64,
+        kUInt8, kUInt16, kUInt32, kUInt64,
+        kInt8, kInt16, kInt32, kInt64,
+        kFixExt1, kFixExt2, kFixExt4, kFixExt8, kFixExt16,
+        kStr8, kStr16, kStr32,
+        kArray16, kArray32,
+        kMap16, kMap32,
+        kNegativeFixInt = 0xE0
+    };
+
+
+#pragma mark - WRITING:
+
+
+    // Writes a format byte followed by a big-endian number of `size` bytes.
+    static void writeFormat(Writer &out, uint8_t format, uint64_t n, size_t size) {
+        uint8_t buf[9];
+        buf[0] = format;
+        for (size_t i = size; i > 0; --i, n >>= 8)
+            buf[i] = uint8_t(n);
+        out.write(buf, 1 + size);
+    }
+
+
+    // Writes the header of a string, binary, array or map, using the first of the formats (for
+    // 8-, 16- and 32-bit lengths) that fits. A zero format means there's no format of that size.
+    static void writeLength(Writer &out, uint64_t length,
+                            uint8_t format8, uint8_t format16, uint8_t format32)
+    {
+        if (length <= UINT8_MAX && format8)
+            writeFormat(out, format8, length, 1);
+        else if (length <= UINT16_MAX)
+            writeFormat(out, format16, length, 2);
+        else
+            writeFormat(out, format32, length, 4);
+    }
+
+
+    static void writeString(Writer &out, slice str) {
+        if (str.size < 32)
+            out << uint8_t(kFixStr | str.size);
+        else
+            writeLength(out, str.size, kStr8, kStr16, kStr32);
+        out.write(str);
+    }
+
+
+    static void writeObject(const Value *v, Writer &out, const SharedKeys *sk) {
+        switch (v->type()) {
+            case kNull:
+                out << kNil;                            // (including `undefined`)
+                break;
+            case kBoolean:
+                out << (v->asBool() ? kTrue : kFalse);
+                break;
+            case kNumber:
+                if (v->isInteger()) {
+                    int64_t i = v->asInt();
+                    if (i >= 0 || v->isUnsigned()) {
+                        uint64_t u = uint64_t(i);
+                        if (u <= 0x7F)              out << uint8_t(u);
+                        else if (u <= UINT8_MAX)    writeFormat(out, kUInt8, u, 1);
+                        else if (u <= UINT16_MAX)   writeFormat(out, kUInt16, u, 2);
+                        else if (u <= UINT32_MAX)   writeFormat(out, kUInt32, u, 4);
+                        else                        writeFormat(out, kUInt64, u, 8);
+                    } else {
+                        if (i >= -32)               out << uint8_t(i);
+                        else if (i >= INT8_MIN)     writeFormat(out, kInt8, uint64_t(i), 1);
+                        else if (i >= INT16_MIN)    writeFormat(out, kInt16, uint64_t(i), 2);
+                        else if (i >= INT32_MIN)    writeFormat(out, kInt32, uint64_t(i), 4);
+                        else                        writeFormat(out, kInt64, uint64_t(i), 8);
+                    }
+                } else if (v->isDouble()) {
+                    double d = v->asDouble();
+                    uint64_t bits;
+                    memcpy(&bits, &d, sizeof(bits));
+                    writeFormat(out, kFloat64, bits, 8);
+                } else {
+                    float f = v->asFloat();
+                    uint32_t bits;
+                    memcpy(&bits, &f, sizeof(bits));
+                    writeFormat(out, kFloat32, bits, 4);
+                }
+                break;
+            case kString:
+                writeString(out, v->asString());
+                break;
+            case kData: {
+                slice data = v->asData();
+                writeLength(out, data.size, kBin8, kBin16, kBin32);
+                out.write(data);
+                break;
+            }
+            case kArray: {
+                auto array = v->asArray();
+                uint32_t count = array->count();
+                if (count < 16)
+                    out << uint8_t(kFixArray | count);
+                else
+                    writeLength(out, count, 0, kArray16, kArray32);
+                for (Array::iterator i(array); i; ++i)
+                    writeObject(i.value(), out, sk);
+                break;
+            }
+            case kDict: {
+                auto dict = v->asDict();
+                uint32_t count = dict->count();
+                if (count < 16)
+                    out << uint8_t(kFixMap | count);
+                else
+                    writeLength(out, count, 0, kMap16, kMap32);
+                for (Dict::iterator i(dict, sk); i; ++i) {
+                    slice key = i.keyString();
+                    throwIf(!key, InvalidData, "Unrecognized integer key");
+                    writeString(out, key);
+                    writeObject(i.value(), out, sk);
+                }
+                break;
+            }
+            default:
+                FleeceException::_throw(UnknownValue, "illegal typecode in Value; corrupt data?");
+        }
+    }
+
+
+    /*static*/ void MsgPackConverter::writeMsgPack(const Value *v, Writer &out,
+                                                   const SharedKeys *sk)
+    {
+        writeObject(v, out, sk);
+    }
+
+
+    /*static*/ alloc_slice MsgPackConverter::toMsgPack(const Value *v, const SharedKeys *sk) {
+        Writer out;
+        writeObject(v, out, sk);
+        return out.finish();
+    }
+
+
+#pragma mark - READING:
+
+
+    namespace {
+        // Parses MessagePack, writing it to an Encoder. Reports errors by returning false.
+        class MsgPackReader {
+        public:
+            MsgPackReader(slice msgpack, Encoder &enc)  :_in(msgpack), _enc(enc) { }
+
+            bool read() {
+                if (!readObject(0))
+                    return false;
+                if (!_in.eof())
+                    return fail("Unexpected data after the MessagePack object");
+                return true;
+            }
+
+            ErrorCode       error {NoError};
+            std::string     message;
+
+        private:
+            bool fail(const char *msg, ErrorCode code =InvalidData) {
+                error = code;
+                message = msg;
+                return false;
+            }
+
+            // Reads a big-endian number of `size` bytes.
+            bool readNumber(size_t size, uint64_t &n) {
+                slice bytes = _in.readAll(size);
+                if (!bytes)
+                    return fail("Truncated MessagePack");
+                n = 0;
+                for (size_t i = 0; i < size; ++i)
+                    n = (n << 8) | bytes[i];
+                return true;
+            }
+
+            bool readBytes(uint64_t length, slice &bytes) {
+                if (length > _in.size)
+                    return fail("Truncated MessagePack");
+                bytes = _in.readAll(size_t(length));
+                return true;
+            }
+
+            // Reads a string whose format byte has been read; returns false if it's not a string.
+            bool readString(uint8_t format, slice &str) {
+                uint64_t length;
+                if ((format & 0xE0) == kFixStr)
+                    length = format & 0x1F;
+                else if (format >= kStr8 && format <= kStr32) {
+                    if (!readNumber(size_t(1) << (format - kStr8), length))
+                        return false;
+                } else
+                    return fail("MessagePack map key is not a string", EncodeError);
+                if (!readBytes(length, str))
+                    return false;
+                if (!isValidUTF8(str))
+                    return fail("Invalid UTF-8 in MessagePack string");
+                return true;
+            }
+
+            bool readArray(uint64_t count, int depth) {
+                if (depth >= MsgPackConverter::kMaxNestingLevels)
+                    return fail("MessagePack is nested too deeply");
+                if (count > _in.size)
+                    return fail("Truncated MessagePack");      // (each item is at least 1 byte)
+                _enc.beginArray(size_t(count));
+                for (; count > 0; --count) {
+                    if (!readObject(depth + 1))
+                        return false;
+                }
+                _enc.endArray();
+                return true;
+            }
+
+            bool readMap(uint64_t count, int depth) {
+                if (depth >= MsgPackConverter::kMaxNestingLevels)
+                    return fail("MessagePack is nested too deeply");
+                if (count > _in.size / 2)
+                    return fail("Truncated MessagePack");
+                _enc.beginDictionary(size_t(count));
+                for (; count > 0; --count) {
+                    if (_in.eof())
+                        return fail("Truncated MessagePack");
+                    slice key;
+                    if (!readString(_in.readByte(), key))
+                        return false;
+                    _enc.writeKey(key);
+                    if (!readObject(depth + 1))
+                        return false;
+                }
+                _enc.endDictionary();
+                return true;
+            }
+
+            bool readObject(int depth) {
+                if (_in.eof())
+                    return fail("Truncated MessagePack");
+                uint8_t format = _in.readByte();
+                uint64_t n;
+                if (format < kFixMap) {
+                    _enc.writeUInt(format);
+                    return true;
+                } else if (format >= kNegativeFixInt) {
+                    _enc.writeInt(int8_t(format));
+                    return true;
+                } else if (format < kFixArray) {
+                    return readMap(format & 0x0F, depth);
+                } else if (format < kFixStr) {
+                    return readArray(format & 0x0F, depth);
+                } else if (format < kNil || (format >= kStr8 && format <= kStr32)) {
+                    slice str;
+                    if (!readString(format, str))
+                        return false;
+                    _enc.writeString(str);
+                    return true;
+                }
+                switch (format) {
+                    case kNil:      _enc.writeNull(); return true;
+                    case kFalse:    _enc.writeBool(false); return true;
+                    case kTrue:     _enc.writeBool(true); return true;
+                    case kBin8: case kBin16: case kBin32: {
+                        slice data;
+                        if (!readNumber(size_t(1) << (format - kBin8), n) || !readBytes(n, data))
+                            return false;
+                        _enc.writeData(data);
+                        return true;
+                    }
+                    case kFloat32: {
+                        if (!readNumber(4, n))
+                            return false;
+                        uint32_t bits = uint32_t(n);
+                        float f;
+                        memcpy(&f, &bits, sizeof(f));
+                        if (std::isnan(f))
+                            return fail("Can't write NaN");
+                        _enc.writeFloat(f);
+                        return true;
+                    }
+                    case kFloat64: {
+                        if (!readNumber(8, n))
+                            return false;
+                        double d;
+                        memcpy(&d, &n, sizeof(d));
+                        if (std::isnan(d))
+                            return fail("Can't write NaN");
+                        _enc.writeDouble(d);
+                        return true;
+                    }
+                    case kUInt8: case kUInt16: case kUInt32: case kUInt64:
+                        if (!readNumber(size_t(1) << (format - kUInt8), n))
+                            return false;
+                        _enc.writeUInt(n);
+                        return true;
+                    case kInt8: case kInt16: case kInt32: case kInt64: {
+                        size_t size = size_t(1) << (format - kInt8);
+                        if (!readNumber(size, n))
+                            return false;
+                        int shift = int(64 - 8 * size);             // to sign-extend it
+                        _enc.writeInt(int64_t(n << shift) >> shift);
+                        return true;
+                    }
+                    case kArray16: case kArray32:
+                        return readNumber(format == kArray16 ? 2 : 4, n) && readArray(n, depth);
+                    case kMap16: case kMap32:
+                        return readNumber(format == kMap16 ? 2 : 4, n) && readMap(n, depth);
+                    case kNeverUsed:
+                        return fail("Invalid MessagePack format byte");
+                    default:
+                        return fail("MessagePack extension types aren't supported", EncodeError);
+                }
+            }
+
+            slice_istream   _in;
+            Encoder&        _enc;
+        };
+    }
+
+
+    /*static*/ bool MsgPackConverter::encodeMsgPack(slice msgpack, Encoder &enc,
+                                                    ErrorCode &outError,
+                                                    std::string *outErrorMessage)
+    {
+        MsgPackReader reader(msgpack, enc);
+        bool ok;
+        try {
+            ok = reader.read();
+        } catch (const FleeceException &x) {
+            reader.error = x.code;
+            reader.message = x.what();
+            ok = false;
+        }
+        outError = reader.error;
+        if (!ok && outErrorMessage)
+            *outErrorMessage = reader.message;
+        return ok;
+    }
+
+
+    /*static*/ alloc_slice MsgPackConverter::convertMsgPack(slice msgpack, SharedKeys *sk) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        ErrorCode error;
+        std::string message;
+        if (!encodeMsgPack(msgpack, enc, error, &message))
+            FleeceException::_throw(error, "%s", message.c_str());
+        return enc.finish();
+    }
+
+} }
@@ -0,0 +1,65 @@
+//
+// MsgPackConverter.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "FleeceException.hh"
+#include "fleece/slice.hh"
+#include <string>
+
+namespace fleece {
+    class Writer;
+}
+
+namespace fleece { namespace impl {
+    class Encoder;
+    class SharedKeys;
+    class Value;
+
+
+    /** Converts between Fleece and MessagePack <https://msgpack.org> directly, without going
+        through JSON.
+
+        Fleece values map to the smallest MessagePack formats that hold them. MessagePack has no
+        `undefined`, so it's written as nil. Going the other way, maps must have string keys,
+        and extension types (including timestamps) aren't supported. */
+    class MsgPackConverter {
+    public:
+        /** Writes a Value to a Writer as MessagePack. Integer Dict keys are decoded with `sk`,
+            if given, or else with the SharedKeys of the Doc they belong to.
+            Throws InvalidData if a key can't be decoded. */
+        static void writeMsgPack(const Value* NONNULL, Writer&, const SharedKeys *sk =nullptr);
+
+        /** Returns a Value encoded as MessagePack. */
+        static alloc_slice toMsgPack(const Value* NONNULL, const SharedKeys *sk =nullptr);
+
+        /** Parses a single MessagePack object and writes it to an Encoder.
+            Invalid or unsupported input doesn't throw; it returns false and sets `outError` (and
+            `outErrorMessage`, if given), leaving the Encoder with a partial value.
+            @return  True on success, false if the MessagePack can't be converted. */
+        static bool encodeMsgPack(slice msgpack, Encoder&, ErrorCode &outError,
+                                  std::string *outErrorMessage =nullptr);
+
+        /** Convenience method to convert MessagePack to Fleece data.
+            Throws FleeceException on error. */
+        static alloc_slice convertMsgPack(slice msgpack, SharedKeys *sk =nullptr);
+
+        /** Maximum nesting depth of arrays/maps in the input. */
+        static constexpr int kMaxNestingLevels = 50;
+    };
+
+} }
@@ -17,23 +17,33 @@
 //
 
 #include "Path.hh"
+#include "AccessProfile.hh"
+#include "Doc.hh"
+#include "Encoder.hh"
 #include "SharedKeys.hh"
 #include "FleeceException.hh"
 #include "PlatformCompat.hh"
 #include "slice_stream.hh"
+#include <algorithm>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 
 using namespace std;
 
 namespace fleece { namespace impl {
 
     void Path::addComponents(slice components) {
-        forEachComponent(components, _path.empty(), [&](char token, slice component, int32_t index) {
-            if (token == '.')
-                _path.emplace_back(component);
-            else
-                _path.emplace_back(index);
+        forEachComponent(components, _path.empty(), [&](char token, slice component,
+                                                        int32_t index, int32_t end) {
+            switch (token) {
+                case '.':   _path.emplace_back(component); break;
+                case '[':   _path.emplace_back(index); break;
+                case '*':   _path.emplace_back(Element::kWildcard); break;
+                case ':':   _path.emplace_back(Element::kSlice, index, end); break;
+                default:    _path.emplace_back(Element::kDescendants); break;
+            }
             return true;
         });
     }
@@ -49,6 +59,21 @@ namespace fleece { namespace impl {
         _path.emplace_back(index);
     }
 
+
+    void Path::addWildcard() {
+        _path.emplace_back(Element::kWildcard);
+    }
+
+
+    void Path::addSlice(int32_t start, int32_t end) {
+        _path.emplace_back(Element::kSlice, start, end);
+    }
+
+
+    void Path::addDescendants() {
+        _path.emplace_back(Element::kDescendants);
+    }
+
     
     Path& Path::operator += (const Path &other) {
         _path.reserve(_path.size() + other.size());
@@ -68,6 +93,12 @@ namespace fleece { namespace impl {
     }
 
 
+    bool Path::isSingleValued() const {
+        return std::all_of(_path.begin(), _path.end(),
+                           [](const Element &e) {return e.isSingleValued();});
+    }
+
+
 #pragma mark - ENCODING:
 
 
@@ -81,10 +112,30 @@ namespace fleece { namespace impl {
     void Path::writeTo(std::ostream &out) const {
         bool first = true;
         for (auto &element : _path) {
-            if (element.isKey())
-                writeProperty(out, element.key().string(), first);
-            else
-                writeIndex(out, element.index());
+            switch (element.type()) {
+                case Element::kProperty:
+                    writeProperty(out, element.key().string(), first);
+                    break;
+                case Element::kIndex:
+                    writeIndex(out, element.index());
+                    break;
+                case Element::kWildcard:
+                    out << "[*]";
+                    break;
+                case Element::kSlice:
+                    out << '[';
+                    if (element.index() != 0)
+                        out << element.index();
+                    out << ':';
+                    if (element.sliceEnd() != kEndOfArray)
+                        out << element.sliceEnd();
+                    out << ']';
+                    break;
+                case Element::kDescendants:
+                    out << "..";
+                    first = true;       // so the next property doesn't get another '.'
+                    continue;
+            }
             first = false;
         }
     }
@@ -115,12 +166,13 @@ namespace fleece { namespace impl {
 #pragma mark - EVALUATION:
 
 
-    const Value* Path::eval(const Value *root) const noexcept {
+    const Value* Path::eval(const Value *root, SharedKeys *sharedKeys) const noexcept {
+        AccessProfile::samplePath(*this);
         const Value *item = root;
         if (_usuallyFalse(!item))
             return nullptr;
         for (auto &e : _path) {
-            item = e.eval(item);
+            item = e.eval(item, sharedKeys);
             if (!item)
                 break;
         }
@@ -128,18 +180,203 @@ namespace fleece { namespace impl {
     }
 
 
-    /*static*/ const Value* Path::eval(slice specifier, const Value *root) {
+    // Value::patchInPlace is here since it's mostly about evaluating the path.
+    bool Value::patchInPlace(const Path &path, const Value *newValue) const {
+        using namespace internal;
+        if (!path.isSingleValued())
+            return false;
+        const Value *item = this;
+        uint64_t hash;
+        for (auto &e : path.path()) {
+            if (item->isMutable() || item->embeddedHash(hash))
+                return false;
+            if (item->tag() == kArrayTag
+                    && ((const Array*)item)->packedType() != Array::PackedType::kNone)
+                return false;       // (its items are decoded into temporary Values)
+            item = e.eval(item);
+            if (!item)
+                return false;
+        }
+        if (item->isMutable())
+            return false;
+        if (auto scope = Scope::containing(this); scope) {
+            // Don't write outside this data (i.e. into an extern segment), or invalidate its
+            // checksum:
+            slice data = scope->data();
+            if (!data.containsAddress(item))
+                return false;
+            size_t trailer = trailerSize(data);
+            if (trailer > 0 && data.size >= kChecksumSize + trailer
+                    && memcmp((const uint8_t*)data.end() - trailer - kChecksumSize,
+                              kChecksumHeader, sizeof(kChecksumHeader)) == 0)
+                return false;
+        }
+
+        auto dst = const_cast<uint8_t*>(item->_byte);
+        switch (item->tag()) {
+            case kShortIntTag:
+            case kSpecialTag:
+                // A 2-byte Value, possibly inline in a collection:
+                switch (newValue->type()) {
+                    case kNull:
+                    case kBoolean:
+                        memcpy(dst, newValue->_byte, kNarrow);
+                        return true;
+                    case kNumber: {
+                        if (!newValue->isInteger())
+                            return false;
+                        int64_t i = newValue->asInt();
+                        if ((newValue->isUnsigned() && newValue->asUnsigned() > INT64_MAX)
+                                || i < -2048 || i > 2047)
+                            return false;
+                        dst[0] = uint8_t((kShortIntTag << 4) | ((i >> 8) & 0x0F));
+                        dst[1] = uint8_t(i & 0xFF);
+                        return true;
+                    }
+                    default:
+                        return false;
+                }
+            case kIntTag: {
+                if (newValue->type() != kNumber || !newValue->isInteger())
+                    return false;
+                unsigned size = (item->tinyValue() & 0x07) + 1;
+                uint64_t bits;
+                bool isUnsigned = newValue->isUnsigned() && newValue->asUnsigned() > INT64_MAX;
+                if (isUnsigned) {
+                    bits = newValue->asUnsigned();
+                    if (size < 8)
+                        return false;
+                } else {
+                    int64_t i = newValue->asInt();
+                    if (size < 8) {
+                        int64_t limit = int64_t(1) << (8 * size - 1);
+                        if (i < -limit || i >= limit)
+                            return false;
+                    }
+                    bits = uint64_t(i);
+                }
+                dst[0] = uint8_t((kIntTag << 4) | (isUnsigned ? 0x08 : 0) | (size - 1));
+                bits = endian::encLittle64(bits);
+                memcpy(dst + 1, &bits, size);       // (the low-order bytes, little-endian)
+                return true;
+            }
+            case kFloatTag: {
+                if (newValue->type() != kNumber || newValue->isInteger())
+                    return false;
+                double n = newValue->asDouble();
+                if (item->tinyValue() & 0x08) {
+                    endian::littleEndianDouble swapped = n;
+                    memcpy(dst + 2, &swapped, sizeof(swapped));
+                } else {
+                    if (!Encoder::isFloatRepresentable(n))
+                        return false;
+                    endian::littleEndianFloat swapped = float(n);
+                    memcpy(dst + 2, &swapped, sizeof(swapped));
+                }
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+
+    /*static*/ const Value* Path::eval(slice specifier, const Value *root,
+                                       SharedKeys *sharedKeys)
+    {
+        AccessProfile::samplePath(specifier);
         const Value *item = root;
         if (_usuallyFalse(!item))
             return nullptr;
-        forEachComponent(specifier, true, [&](char token, slice component, int32_t index) {
-            item = Element::eval(token, component, index, item);
+        forEachComponent(specifier, true, [&](char token, slice component,
+                                              int32_t index, int32_t) {
+            item = Element::eval(token, component, index, item, sharedKeys);
             return (item != nullptr);
         });
         return item;
     }
 
 
+    void Path::evalAll(const Value *root, EvalCallback callback) const {
+        if (_usuallyTrue(root != nullptr))
+            evalAllFrom(0, root, callback);
+    }
+
+
+    void Path::evalAll(const Value *root, Encoder &enc) const {
+        enc.beginArray();
+        evalAll(root, [&](const Value *value) {
+            enc.writeValue(value);
+            return true;
+        });
+        enc.endArray();
+    }
+
+
+    // Evaluates the path starting at element `i`, on `item`. Returns false if stopped.
+    bool Path::evalAllFrom(size_t i, const Value *item, EvalCallback callback) const {
+        for (; i < _path.size(); ++i) {
+            auto &element = _path[i];
+            switch (element.type()) {
+                case Element::kProperty:
+                case Element::kIndex:
+                    item = element.eval(item);
+                    if (!item)
+                        return true;
+                    break;
+                case Element::kWildcard:
+                    if (auto array = item->asArray(); array) {
+                        for (Array::iterator iter(array); iter; ++iter)
+                            if (!evalAllFrom(i + 1, iter.value(), callback))
+                                return false;
+                    } else if (auto dict = item->asDict(); dict) {
+                        for (Dict::iterator iter(dict); iter; ++iter)
+                            if (!evalAllFrom(i + 1, iter.value(), callback))
+                                return false;
+                    }
+                    return true;
+                case Element::kSlice: {
+                    auto array = item->asArray();
+                    if (!array)
+                        return true;
+                    // Resolve the bounds the way Python does:
+                    int64_t count = array->count();
+                    auto resolve = [&](int64_t bound) {
+                        if (bound < 0)
+                            bound += count;
+                        return std::min(std::max(bound, int64_t(0)), count);
+                    };
+                    int64_t start = resolve(element.index()), end = resolve(element.sliceEnd());
+                    for (int64_t index = start; index < end; ++index)
+                        if (!evalAllFrom(i + 1, array->get(uint32_t(index)), callback))
+                            return false;
+                    return true;
+                }
+                case Element::kDescendants:
+                    return evalDescendants(i + 1, item, callback);
+            }
+        }
+        return callback(item);
+    }
+
+
+    // Evaluates the path starting at element `i` on `item` and on each of its descendants.
+    bool Path::evalDescendants(size_t i, const Value *item, EvalCallback callback) const {
+        if (!evalAllFrom(i, item, callback))
+            return false;
+        if (auto array = item->asArray(); array) {
+            for (Array::iterator iter(array); iter; ++iter)
+                if (!evalDescendants(i, iter.value(), callback))
+                    return false;
+        } else if (auto dict = item->asDict(); dict) {
+            for (Dict::iterator iter(dict); iter; ++iter)
+                if (!evalDescendants(i, iter.value(), callback))
+                    return false;
+        }
+        return true;
+    }
+
+
     /*static*/ const Value* Path::evalJSONPointer(slice specifier, const Value *root)
     {
         slice_istream in(specifier);
@@ -181,6 +418,17 @@ namespace fleece { namespace impl {
 #pragma mark - PARSING:
 
 
+    static int32_t parseSliceBound(slice param, int32_t defaultValue) {
+        if (param.size == 0)
+            return defaultValue;
+        slice_istream n = param;
+        int64_t i = n.readSignedDecimal();
+        throwIf(n.size > 0 || i > INT32_MAX || i < INT32_MIN,
+                PathSyntaxError, "Invalid array slice");
+        return (int32_t)i;
+    }
+
+
     // Parses a path expression, calling the callback for each property or array index.
     void Path::forEachComponent(slice specifier, bool atStart, eachComponentCallback callback) {
         slice_istream in(specifier);
@@ -213,11 +461,24 @@ namespace fleece { namespace impl {
             return;                     // "." or "" mean the root
 
         while (true) {
-            // Read parameter (property name or array index):
+            // A ".." is recursive descent, followed by a property name or by brackets:
+            if (token == '.' && in.size > 0 && in[0] == '.') {
+                if (_usuallyFalse(!callback('~', nullslice, 0, 0)))
+                    return;
+                in.skip(1);
+                throwIf(in.size == 0 || in[0] == '.', PathSyntaxError,
+                        "Missing property after '..'");
+                if (in[0] == '[') {
+                    token = '[';
+                    in.skip(1);
+                }
+            }
+
+            // Read parameter (property name, array index, wildcard or slice):
             const uint8_t* next;
             slice param;
             alloc_slice unescaped;
-            int32_t index = 0;
+            int32_t index = 0, end = 0;
 
             if (token == '.') {
                 // Find end of property name:
@@ -250,19 +511,28 @@ namespace fleece { namespace impl {
                 if (!next)
                     FleeceException::_throw(PathSyntaxError, "Missing ']'");
                 param = slice(in.buf, next++);
-                // Parse array index:
-                slice_istream n = param;
-                int64_t i = n.readSignedDecimal();
-                throwIf(param.size == 0 || n.size > 0 || i > INT32_MAX || i < INT32_MIN,
-                        PathSyntaxError, "Invalid array index");
-                index = (int32_t)i;
+                if (param == "*"_sl) {
+                    token = '*';
+                } else if (auto colon = param.findByte(':'); colon) {
+                    // Parse slice bounds, either of which may be omitted:
+                    token = ':';
+                    index = parseSliceBound(slice(param.buf, colon), 0);
+                    end = parseSliceBound(slice(colon + 1, param.end()), kEndOfArray);
+                } else {
+                    // Parse array index:
+                    slice_istream n = param;
+                    int64_t i = n.readSignedDecimal();
+                    throwIf(param.size == 0 || n.size > 0 || i > INT32_MAX || i < INT32_MIN,
+                            PathSyntaxError, "Invalid array index");
+                    index = (int32_t)i;
+                }
             } else {
                 FleeceException::_throw(PathSyntaxError, "Invalid path component");
             }
 
             if (param.size > 0) {
                 // Invoke the callback:
-                if (_usuallyFalse(!callback(token, param, index)))
+                if (_usuallyFalse(!callback(token, param, index, end)))
                     return;
             }
 
@@ -286,9 +556,20 @@ namespace fleece { namespace impl {
     { }
 
 
+    Path::Element::Element(Type type, int32_t start, int32_t end)
+    :_index(start)
+    ,_end(end)
+    ,_type(type)
+    {
+        assert(type != kProperty);
+    }
+
+
     Path::Element::Element(const Element &other)
     :_keyBuf(other._keyBuf)
     ,_index(other._index)
+    ,_end(other._end)
+    ,_type(other._type)
     {
         if (other._key)
             _key.reset(new Dict::key(_keyBuf));
@@ -296,30 +577,43 @@ namespace fleece { namespace impl {
 
 
     bool Path::Element::operator== (const Element &e) const {
-        return _key ? (_key == e._key) : (_index == e._index);
+        if (_type != e._type)
+            return false;
+        switch (_type) {
+            case kProperty: return keyStr() == e.keyStr();
+            case kIndex:    return _index == e._index;
+            case kSlice:    return _index == e._index && _end == e._end;
+            default:        return true;
+        }
     }
 
 
-    const Value* Path::Element::eval(const Value *item) const noexcept {
+    const Value* Path::Element::eval(const Value *item, SharedKeys *sharedKeys) const noexcept {
         if (_key) {
             auto d = item->asDict();
             if (_usuallyFalse(!d))
                 return nullptr;
-            return d->get(*_key);
-        } else {
+            // A Dict::key caches the SharedKeys it was first used with, so it can't take others:
+            return sharedKeys ? d->get(_key->string(), sharedKeys) : d->get(*_key);
+        } else if (_type == kIndex) {
             return getFromArray(item, _index);
+        } else {
+            return nullptr;
         }
     }
 
     /*static*/ const Value* Path::Element::eval(char token, slice comp, int32_t index,
-                                                const Value *item) noexcept {
+                                                const Value *item,
+                                                SharedKeys *sharedKeys) noexcept {
         if (token == '.') {
             auto d = item->asDict();
             if (_usuallyFalse(!d))
                 return nullptr;
-            return d->get(comp);
-        } else {
+            return d->get(comp, sharedKeys);
+        } else if (token == '[') {
             return getFromArray(item, index);
+        } else {
+            return nullptr;
         }
     }
 
@@ -337,4 +631,385 @@ namespace fleece { namespace impl {
         return a->get((uint32_t)index);
     }
 
+
+
+#pragma mark - COMPILED PATH:
+
+
+    CompiledPath::CompiledPath(const Path &path, SharedKeys *sk)
+    :_sharedKeys(sk)
+    {
+        throwIf(!path.isSingleValued(), PathSyntaxError,
+                "CompiledPath can't contain wildcards, slices or descendants");
+        _steps.reserve(path.size());
+        for (auto &element : path.path()) {
+            if (element.isKey()) {
+                int encoded;
+                if (sk && sk->encode(element.keyStr(), encoded))
+                    _steps.push_back({&getSharedKey, encoded, alloc_slice(element.keyStr())});
+                else
+                    _steps.push_back({&getKey, -1, alloc_slice(element.keyStr())});
+            } else if (element.index() >= 0) {
+                _steps.push_back({&getIndex, element.index(), nullslice});
+            } else {
+                _steps.push_back({&getIndexFromEnd, element.index(), nullslice});
+            }
+        }
+    }
+
+
+    CompiledPath::CompiledPath(slice specifier, SharedKeys *sk)
+    :CompiledPath(Path(specifier), sk)
+    { }
+
+
+    const Value* CompiledPath::getSharedKey(const Step &step, const Value *item) noexcept {
+        auto d = item->asDict();
+        return _usuallyTrue(d != nullptr) ? d->get(step.index) : nullptr;
+    }
+
+    const Value* CompiledPath::getKey(const Step &step, const Value *item) noexcept {
+        auto d = item->asDict();
+        return _usuallyTrue(d != nullptr) ? d->get(step.name) : nullptr;
+    }
+
+    const Value* CompiledPath::getIndex(const Step &step, const Value *item) noexcept {
+        auto a = item->asArray();
+        return _usuallyTrue(a != nullptr) ? a->get(uint32_t(step.index)) : nullptr;
+    }
+
+    const Value* CompiledPath::getIndexFromEnd(const Step &step, const Value *item) noexcept {
+        auto a = item->asArray();
+        if (_usuallyFalse(!a))
+            return nullptr;
+        uint32_t count = a->count();
+        if (_usuallyFalse(uint32_t(-step.index) > count))
+            return nullptr;
+        return a->get(count + step.index);
+    }
+
+
+    namespace {
+        // Cache of CompiledPaths used by CompiledPath::evalCached, keyed by specifier. Each is
+        // compiled for the SharedKeys of the last root it was evaluated on, which is identified
+        // by its instanceID (0 for none) so that the cache doesn't keep it alive. Each entry's
+        // key points into its own `specifier`.
+        struct PathCacheEntry {
+            alloc_slice specifier;
+            std::shared_ptr<const CompiledPath> path;
+            uint64_t sharedKeysID;
+        };
+        std::mutex sPathCacheMutex;
+        std::unordered_map<slice, PathCacheEntry> sPathCache;
+    }
+
+
+    /*static*/ const Value* CompiledPath::evalCached(slice specifier, const Value *root) {
+        AccessProfile::samplePath(specifier);
+        SharedKeys *sk = root ? root->sharedKeys() : nullptr;
+        uint64_t skID = sk ? sk->instanceID() : 0;
+        std::shared_ptr<const CompiledPath> path;
+        {
+            std::lock_guard<std::mutex> lock(sPathCacheMutex);
+            if (auto i = sPathCache.find(specifier); i != sPathCache.end()) {
+                if (i->second.sharedKeysID == skID)
+                    path = i->second.path;
+            }
+        }
+        if (!path) {
+            auto compiled = std::make_shared<CompiledPath>(specifier, sk);     // may throw
+            compiled->_sharedKeys = nullptr;    // (its steps don't use it; see PathCacheEntry)
+            path = compiled;
+            PathCacheEntry entry {alloc_slice(specifier), path, skID};
+            std::lock_guard<std::mutex> lock(sPathCacheMutex);
+            sPathCache.erase(specifier);
+            if (sPathCache.size() >= kMaxCachedPaths)
+                sPathCache.clear();
+            slice key = entry.specifier;
+            sPathCache.emplace(key, std::move(entry));
+        }
+        return path->eval(root);
+    }
+
+
+#pragma mark - PROJECTION:
+
+
+    // A node of the trie of paths. The path from the root to a node corresponds to a path prefix.
+    struct Projection::Node {
+        smallVector<uint32_t, 1> results;       // Indices of the paths that end at this node
+        std::vector<std::pair<alloc_slice, std::unique_ptr<Node>>> properties;
+        std::vector<std::pair<int32_t, std::unique_ptr<Node>>> indexes;
+
+        // The property names as mapped by the current SharedKeys, sorted for Dict::getMany,
+        // and the index in `properties` of each. Without SharedKeys, just the sorted names.
+        std::vector<key_t> sortedKeys;
+        std::vector<slice> sortedNames;
+        std::vector<uint32_t> sortedOrder;
+
+        Node* child(const Path::Element &element) {
+            if (element.isKey()) {
+                for (auto &prop : properties)
+                    if (prop.first == element.keyStr())
+                        return prop.second.get();
+                properties.emplace_back(alloc_slice(element.keyStr()), new Node);
+                return properties.back().second.get();
+            } else {
+                for (auto &index : indexes)
+                    if (index.first == element.index())
+                        return index.second.get();
+                indexes.emplace_back(element.index(), new Node);
+                return indexes.back().second.get();
+            }
+        }
+
+        void mapKeys(SharedKeys *sk) {
+            auto n = properties.size();
+            std::vector<key_t> keys(n);
+            for (size_t i = 0; i < n; ++i) {
+                int encoded;
+                if (sk && sk->encode(properties[i].first, encoded))
+                    keys[i] = key_t(encoded);
+                else
+                    keys[i] = key_t(slice(properties[i].first));
+            }
+            sortedOrder.resize(n);
+            for (size_t i = 0; i < n; ++i)
+                sortedOrder[i] = uint32_t(i);
+            std::sort(sortedOrder.begin(), sortedOrder.end(), [&](uint32_t a, uint32_t b) {
+                return keys[a] < keys[b];
+            });
+            sortedKeys.resize(n);
+            sortedNames.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+                sortedKeys[i] = keys[sortedOrder[i]];
+                sortedNames[i] = properties[sortedOrder[i]].first;
+            }
+
+            for (auto &prop : properties)
+                prop.second->mapKeys(sk);
+            for (auto &index : indexes)
+                index.second->mapKeys(sk);
+        }
+
+        // If `mapped` is false there's no known SharedKeys, so each Dict has to look up any
+        // shared keys itself.
+        void eval(const Value *value, const Value* results[], bool mapped) const {
+            for (auto i : this->results)
+                results[i] = value;
+            if (!properties.empty()) {
+                if (auto dict = value->asDict(); dict) {
+                    auto n = sortedKeys.size();
+                    smallVector<const Value*, 16> values(n);
+                    if (mapped)
+                        dict->getMany(sortedKeys.data(), n, values.begin());
+                    else
+                        dict->getMany(sortedNames.data(), n, values.begin());
+                    for (size_t i = 0; i < n; ++i) {
+                        if (values[i])
+                            properties[sortedOrder[i]].second->eval(values[i], results, mapped);
+                    }
+                }
+            }
+            for (auto &index : indexes) {
+                if (auto item = Path::Element::eval('[', nullslice, index.first, value); item)
+                    index.second->eval(item, results, mapped);
+            }
+        }
+    };
+
+
+    Projection::Projection()
+    :_root(new Node)
+    { }
+
+    Projection::Projection(const std::vector<Path> &paths)
+    :Projection()
+    {
+        for (auto &path : paths)
+            addPath(path);
+    }
+
+    Projection::~Projection() =default;
+
+
+    size_t Projection::addPath(const Path &path) {
+        throwIf(!path.isSingleValued(), PathSyntaxError,
+                "Projection can't contain wildcards, slices or descendants");
+        Node *node = _root.get();
+        for (auto &element : path.path())
+            node = node->child(element);
+        node->results.push_back(uint32_t(_count));
+        _sharedKeys = nullptr;
+        _sharedKeysCount = 0;
+        _root->mapKeys(nullptr);
+        return _count++;
+    }
+
+
+    void Projection::eval(const Value *root, const Value* results[]) const {
+        std::fill(&results[0], &results[_count], nullptr);
+        if (_usuallyFalse(!root))
+            return;
+        // Re-map the keys if the SharedKeys differs, or has gained keys, since the last time:
+        SharedKeys *sk = root->sharedKeys();
+        if (_usuallyFalse(sk != _sharedKeys || (sk && sk->count() != _sharedKeysCount))) {
+            _root->mapKeys(sk);
+            _sharedKeys = sk;
+            _sharedKeysCount = sk ? sk->count() : 0;
+        }
+        _root->eval(root, results, sk != nullptr);
+    }
+
+
+    void Projection::eval(const Value *root, Encoder &enc) const {
+        smallVector<const Value*, 16> results(_count);
+        eval(root, results.begin());
+        enc.beginArray(_count);
+        for (auto result : results) {
+            if (result)
+                enc.writeValue(result);
+            else
+                enc.writeNull();
+        }
+        enc.endArray();
+    }
+
+
+#pragma mark - PATH FILTER:
+
+
+    // A node of the trie of filter paths; the path from the root to a node is a path prefix.
+    struct PathFilter::Node {
+        std::vector<std::pair<alloc_slice, std::unique_ptr<Node>>> properties; // sorted by name
+        bool included {false};          // An include path ends here
+        bool excluded {false};          // An exclude path ends here
+        bool includesBelow {false};     // An include path passes through here
+        bool excludesBelow {false};     // An exclude path passes through here
+
+        const Node* find(slice name) const {
+            auto i = std::lower_bound(properties.begin(), properties.end(), name,
+                                      [](auto &prop, slice n) {return prop.first < n;});
+            return (i != properties.end() && i->first == name) ? i->second.get() : nullptr;
+        }
+
+        Node* child(slice name) {
+            auto i = std::lower_bound(properties.begin(), properties.end(), name,
+                                      [](auto &prop, slice n) {return prop.first < n;});
+            if (i == properties.end() || i->first != name)
+                i = properties.emplace(i, alloc_slice(name), new Node);
+            return i->second.get();
+        }
+
+        // True if a value at this node (whose parent is `included` or not) gets written.
+        bool selects(const Value *value, bool included) const {
+            if (excluded)
+                return false;
+            if (included || this->included)
+                return true;
+            auto type = value->type();
+            return includesBelow && (type == kDict || type == kArray);
+        }
+
+        // Writes a value that `selects` approved of.
+        void write(const Value *value, bool included, Encoder &enc) const {
+            included = included || this->included;
+            if (included && !excludesBelow) {
+                enc.writeValue(value);
+                return;
+            }
+            switch (value->type()) {
+                case kDict: {
+                    auto dict = (const Dict*)value;
+                    enc.beginDictionary(dict->count());
+                    for (Dict::iterator i(dict); i; ++i) {
+                        auto node = find(i.keyString());
+                        if (node ? node->selects(i.value(), included) : included) {
+                            enc.writeKey(i.key(), i.sharedKeys());
+                            if (node)
+                                node->write(i.value(), included, enc);
+                            else
+                                enc.writeValue(i.value());
+                        }
+                    }
+                    enc.endDictionary();
+                    break;
+                }
+                case kArray: {
+                    // The same node applies to each item:
+                    auto array = (const Array*)value;
+                    enc.beginArray(array->count());
+                    for (Array::iterator i(array); i; ++i) {
+                        if (selects(i.value(), included))
+                            write(i.value(), included, enc);
+                    }
+                    enc.endArray();
+                    break;
+                }
+                default:
+                    enc.writeValue(value);
+                    break;
+            }
+        }
+    };
+
+
+    PathFilter::PathFilter()
+    :_root(new Node)
+    { }
+
+    PathFilter::PathFilter(const std::vector<Path> &include, const std::vector<Path> &exclude)
+    :PathFilter()
+    {
+        for (auto &path : include)
+            this->include(path);
+        for (auto &path : exclude)
+            this->exclude(path);
+    }
+
+    PathFilter::~PathFilter() =default;
+
+
+    PathFilter::Node* PathFilter::nodeFor(const Path &path) {
+        for (auto &element : path.path())
+            throwIf(element.type() != Path::Element::kProperty, PathSyntaxError,
+                    "PathFilter paths can only contain property names");
+        Node *node = _root.get();
+        for (auto &element : path.path())
+            node = node->child(element.keyStr());
+        return node;
+    }
+
+
+    void PathFilter::include(const Path &path) {
+        auto node = nodeFor(path);
+        node->included = true;
+        node = _root.get();
+        for (auto &element : path.path()) {
+            node->includesBelow = true;
+            node = node->child(element.keyStr());
+        }
+    }
+
+
+    void PathFilter::exclude(const Path &path) {
+        throwIf(path.empty(), PathSyntaxError, "PathFilter can't exclude the root");
+        auto node = nodeFor(path);
+        node->excluded = true;
+        node = _root.get();
+        for (auto &element : path.path()) {
+            node->excludesBelow = true;
+            node = node->child(element.keyStr());
+        }
+    }
+
+
+    void PathFilter::encode(const Value *root, Encoder &enc) const {
+        bool all = !_root->includesBelow && !_root->included;
+        if (_root->selects(root, all))
+            _root->write(root, all, enc);
+        else
+            enc.writeNull();
+    }
+
 } }
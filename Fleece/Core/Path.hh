@@ -18,13 +18,16 @@
 
 #pragma once
 #include "Dict.hh"
+#include "RefCounted.hh"
 #include "SmallVector.hh"
 #include "function_ref.hh"
 #include <iosfwd>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace fleece { namespace impl {
+    class Encoder;
     class SharedKeys;
 
     /** Describes a location in a Fleece object tree, as a path from the root that follows
@@ -34,11 +37,20 @@ namespace fleece { namespace impl {
         indexes in brackets. (Negative indexes count from the end of the array.)
         A leading JSONPath-like "$." is allowed but ignored.
         A '\' can be used to escape a special character ('.', '[' or '$') at the start of a
-        property name (but not yet in the middle of a name.) */
+        property name (but not yet in the middle of a name.)
+
+        A path can also match multiple values, like a JSONPath: "[*]" matches every item of an
+        array or every value of a dict; "[2:5]" matches the array items with indexes 2 through 4
+        (either bound can be omitted or negative); and ".." matches the value it's applied to and
+        all its descendants, so "$..name" finds every "name" property in the tree. Such paths
+        have to be evaluated with `evalAll`. */
     class Path {
     public:
         class Element;
 
+        /** Omitted end bound of an array slice, i.e. the end of the array. */
+        static constexpr int32_t kEndOfArray = INT32_MAX;
+
         //// Construction from a string: (throws FleeceException with code PathSyntaxError)
 
         Path(slice specifier)                       {addComponents(specifier);}
@@ -48,6 +60,9 @@ namespace fleece { namespace impl {
         Path()                                      =default;
         void addProperty(slice key);
         void addIndex(int index);
+        void addWildcard();
+        void addSlice(int32_t start, int32_t end =kEndOfArray);
+        void addDescendants();
         void addComponents(slice components);
 
         bool operator== (const Path&) const;
@@ -63,16 +78,34 @@ namespace fleece { namespace impl {
         bool empty() const                              {return _path.empty();}
         size_t size() const                             {return _path.size();}
 
+        /** True if the path has no wildcards, slices or descendants, so it matches at most one
+            value and can be evaluated by `eval`. */
+        bool isSingleValued() const;
+
         const Element& operator[] (size_t i) const      {return _path[i];}
         Element& operator[] (size_t i)                  {return _path[i];}
 
         //// Evaluation:
 
-        const Value* eval(const Value *root) const noexcept;
+        /** Evaluates a single-valued path. (If the path isSingleValued, returns nullptr.)
+            If `sharedKeys` is given, it's used to look up Dict properties, instead of looking up
+            the SharedKeys the data belongs to. */
+        const Value* eval(const Value *root, SharedKeys *sharedKeys =nullptr) const noexcept;
+
+        /** Callback for `evalAll`; return false to stop the evaluation. */
+        using EvalCallback = function_ref<bool(const Value*)>;
+
+        /** Evaluates a path, calling the callback with each value it matches, in order, in a
+            single traversal of the tree. */
+        void evalAll(const Value *root, EvalCallback) const;
+
+        /** Evaluates a path, writing an array of all the values it matches to the Encoder. */
+        void evalAll(const Value *root, Encoder&) const;
 
         /** One-shot evaluation; faster if you're only doing it once */
         static const Value* eval(slice specifier,
-                                 const Value *root NONNULL);
+                                 const Value *root NONNULL,
+                                 SharedKeys *sharedKeys =nullptr);
 
         /** Evaluates a JSONPointer string (RFC 6901), which has a different syntax.
             This can only be done one-shot since JSONPointer path components are ambiguous unless
@@ -96,21 +129,34 @@ namespace fleece { namespace impl {
         static void writeIndex(std::ostream&, int arrayIndex);
 
 
-        /** An element of a Path, representing either a named property or an array index. */
+        /** An element of a Path, representing a named property, an array index, or one of the
+            multi-valued elements. */
         class Element {
         public:
+            enum Type : uint8_t {
+                kProperty,          // A Dict property
+                kIndex,             // An Array index
+                kWildcard,          // Every item of an Array or Dict ("[*]")
+                kSlice,             // A range of Array items ("[start:end]")
+                kDescendants,       // The value and all its descendants ("..")
+            };
+
             Element(slice property);
-            Element(int32_t arrayIndex)             :_index(arrayIndex) { }
+            Element(int32_t arrayIndex)             :_index(arrayIndex), _type(kIndex) { }
+            Element(Type, int32_t start =0, int32_t end =kEndOfArray);
             Element(const Element &e);
             bool operator== (const Element &e) const;
+            Type type() const                       {return _type;}
             bool isKey() const                      {return _key != nullptr;}
+            bool isSingleValued() const             {return _type <= kIndex;}
             Dict::key& key() const                  {return *_key;}
             slice keyStr() const                    {return _key ? _key->string() : slice();}
-            int32_t index() const                   {return _index;}
+            int32_t index() const                   {return _index;}    // (start of a slice)
+            int32_t sliceEnd() const                {return _end;}
 
-            const Value* eval(const Value* NONNULL) const noexcept;
+            const Value* eval(const Value* NONNULL, SharedKeys* =nullptr) const noexcept;
             static const Value* eval(char token, slice property, int32_t index,
-                                     const Value *item NONNULL) noexcept;
+                                     const Value *item NONNULL, SharedKeys* =nullptr) noexcept;
 
         private:
             static const Value* getFromArray(const Value* NONNULL, int32_t index) noexcept;
@@ -118,13 +164,151 @@ namespace fleece { namespace impl {
             alloc_slice _keyBuf;
             std::unique_ptr<Dict::key> _key {nullptr};
             int32_t _index {0};
+            int32_t _end {kEndOfArray};
+            Type _type {kProperty};
         };
 
     private:
-        using eachComponentCallback = function_ref<bool(char,slice,int32_t)>;
+        // Callback's token is '.' for a property, '[' for an index, '*' for a wildcard,
+        // ':' for a slice from the index to `end`, or '~' for descendants.
+        using eachComponentCallback = function_ref<bool(char token, slice property,
+                                                        int32_t index, int32_t end)>;
         static void forEachComponent(slice in, bool atStart, eachComponentCallback);
 
+        bool evalAllFrom(size_t elementIndex, const Value* NONNULL, EvalCallback) const;
+        bool evalDescendants(size_t elementIndex, const Value* NONNULL, EvalCallback) const;
+
         smallVector<Element, 4> _path;
     };
 
+
+    /** A Path prepared for fast, repeated evaluation. Each property name is mapped to its
+        integer form in a given SharedKeys when it's constructed, so evaluating it on a Dict
+        using those SharedKeys doesn't need to look them up. Each step calls a lookup function
+        chosen in advance, so evaluation doesn't branch on the kind of each path element.
+        A CompiledPath is immutable, so it can be evaluated on multiple threads at once. */
+    class CompiledPath {
+    public:
+        /** Compiles a path, which must be single-valued; otherwise throws FleeceException.
+            If `sk` is given, the path may only be evaluated on values that use
+            those SharedKeys, or none. (Keys added to `sk` later are still found, just more
+            slowly.) Without `sk`, it can evaluate any values. */
+        explicit CompiledPath(const Path&, SharedKeys *sk =nullptr);
+
+        /** Parses and compiles a path specifier; throws FleeceException on a syntax error. */
+        explicit CompiledPath(slice specifier, SharedKeys *sk =nullptr);
+
+        SharedKeys* sharedKeys() const                  {return _sharedKeys;}
+
+        const Value* eval(const Value *root) const noexcept {
+            const Value *item = root;
+            for (auto &step : _steps) {
+                if (_usuallyFalse(!item))
+                    break;
+                item = step.lookup(step, item);
+            }
+            return item;
+        }
+
+        /** Evaluates a path specifier, like Path::eval(slice, const Value*), except that the
+            compiled form of recently used specifiers is cached (in a thread-safe way), so
+            repeated calls with the same specifier, on values with the same SharedKeys, don't
+            re-parse it or look up its keys.
+            Throws FleeceException if the specifier has a syntax error. */
+        static const Value* evalCached(slice specifier, const Value *root);
+
+        /** The maximum number of paths kept by \ref evalCached. */
+        static constexpr size_t kMaxCachedPaths = 256;
+
+    private:
+        struct Step {
+            using Lookup = const Value* (*)(const Step&, const Value* NONNULL) noexcept;
+            Lookup lookup;
+            int32_t index;          // Array index, or the property's integer key
+            alloc_slice name;       // The property name, if any
+        };
+
+        static const Value* getSharedKey(const Step&, const Value*) noexcept;
+        static const Value* getKey(const Step&, const Value*) noexcept;
+        static const Value* getIndex(const Step&, const Value*) noexcept;
+        static const Value* getIndexFromEnd(const Step&, const Value*) noexcept;
+
+        smallVector<Step, 4> _steps;
+        Retained<SharedKeys> _sharedKeys;
+    };
+
+
+    /** A set of Paths compiled for evaluating together against the same root, over and over.
+        Paths with common prefixes share the work of evaluating the prefix, and all the
+        properties wanted from a Dict are looked up in a single pass (see Dict::getMany.)
+        Property names are mapped to shared keys once per SharedKeys instance, not per lookup.
+        Warning: Evaluation updates internal caches, so an instance must not be evaluated on
+        multiple threads at once. */
+    class Projection {
+    public:
+        Projection();
+        explicit Projection(const std::vector<Path>&);
+        ~Projection();
+
+        /** Adds a path, returning its index in the results. The path must be single-valued;
+            otherwise throws FleeceException. */
+        size_t addPath(const Path&);
+
+        /** The number of paths, i.e. the number of results an evaluation produces. */
+        size_t count() const                            {return _count;}
+
+        /** Evaluates all the paths, storing each one's result (or nullptr) in `results`, which
+            must have room for `count()` items. */
+        void eval(const Value *root, const Value* results[]) const;
+
+        /** Evaluates all the paths and writes the results to an Encoder as an array, with a
+            null in place of any result that's missing. */
+        void eval(const Value *root, Encoder&) const;
+
+    private:
+        struct Node;
+
+        std::unique_ptr<Node> _root;
+        size_t _count {0};
+        mutable Retained<SharedKeys> _sharedKeys;   // SharedKeys the nodes' keys are mapped for
+        mutable size_t _sharedKeysCount {0};        // Its count when they were mapped
+    };
+
+
+    /** Copies a Value to an Encoder, keeping only the parts selected by two sets of paths: the
+        "include" paths pick what's copied (everything, if there are none), and the "exclude"
+        paths remove parts of that. The paths are compiled into a tree once; then a Value is
+        filtered by streaming it into the Encoder in a single pass, without building a mutable
+        copy. Branches that are copied whole go through Encoder::writeValue, so they're
+        relocated as a block where possible.
+        Paths may contain only property names. A property step that reaches an Array applies to
+        each of its items, so "friends.id" selects the `id` of every Dict in `friends`. Included
+        properties missing from a Dict are just omitted.
+        A filter has no caches, so it can be used on any number of threads at once. */
+    class PathFilter {
+    public:
+        PathFilter();
+        PathFilter(const std::vector<Path> &include, const std::vector<Path> &exclude);
+        ~PathFilter();
+
+        /** Adds a path to copy, with everything under it. An empty path includes everything.
+            Throws FleeceException if the path contains anything but property names. */
+        void include(const Path&);
+
+        /** Adds a path to omit, with everything under it. Excluding takes precedence over
+            including. Throws FleeceException if the path is empty or contains anything but
+            property names. */
+        void exclude(const Path&);
+
+        /** Writes the filtered form of `root` to the Encoder. */
+        void encode(const Value *root NONNULL, Encoder&) const;
+
+    private:
+        struct Node;
+
+        Node* nodeFor(const Path&);
+
+        std::unique_ptr<Node> _root;
+    };
+
 } }
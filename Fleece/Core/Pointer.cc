@@ -26,6 +26,11 @@ using namespace std;
 
 namespace fleece { namespace impl { namespace internal {
 
+#ifndef NDEBUG
+    size_t gMaxWideOffset = Pointer::kMaxWideOffset;
+#endif
+
+
     Pointer::Pointer(size_t offset, int width, bool external)
     :Value(kPointerTagFirst, 0)
     {
@@ -98,6 +103,18 @@ namespace fleece { namespace impl { namespace internal {
             if (_usuallyFalse(target < dataStart) || _usuallyFalse(target >= dataEnd))
                 return nullptr;
             dataEnd = this;
+            if (_usuallyFalse(isFarPointer(target))) {
+                // Far pointer: the offset must be in bounds, and so must its destination:
+                if (_usuallyFalse(offsetby(target, kFarPointerSize) > dataEnd))
+                    return nullptr;
+                uint64_t farOff = farOffset(target);
+                if (_usuallyFalse(farOff == 0 || (farOff & 1) != 0
+                                  || farOff > size_t((const uint8_t*)target
+                                                     - (const uint8_t*)dataStart)))
+                    return nullptr;
+                dataEnd = target;
+                target = offsetby(target, -(ptrdiff_t)farOff);
+            }
         }
 
         if (_usuallyFalse(target->isPointer()))
@@ -6,6 +6,7 @@
 
 #pragma once
 #include "Value.hh"
+#include <string.h>
 #include "betterassert.hh"
 
 namespace fleece { namespace impl { namespace internal {
@@ -15,6 +16,34 @@ namespace fleece { namespace impl { namespace internal {
     class Pointer : public Value {
     public:
         static constexpr size_t kMaxNarrowOffset = 0x7FFE;
+        static constexpr size_t kMaxWideOffset = 0x7FFFFFFE;
+
+        // A "far pointer" extends a Pointer whose destination is more than kMaxWideOffset bytes
+        // back. The Pointer points to it instead, and it holds the 64-bit offset the rest of the
+        // way. It's a special Value (kSpecialValueFar) whose 2 bytes are followed by the offset,
+        // little-endian, counted back from its own start. The Encoder writes one just before the
+        // collection that needs it, so these only appear in data over 2GB.
+        static constexpr size_t kFarPointerSize = 10;
+        static constexpr uint8_t kFarPointerByte = (kSpecialTag << 4) | kSpecialValueFar;
+
+        static bool isFarPointer(const Value *v) noexcept FLPURE {
+            return v->_byte[0] == kFarPointerByte;
+        }
+
+        static uint64_t farOffset(const Value *far) noexcept FLPURE {
+            uint64_t off;
+            memcpy(&off, offsetby(far, 2), sizeof(off));
+            return endian::decLittle64(off);
+        }
+
+        // Writes a far pointer to a destination `offset` bytes before `dst`.
+        static void writeFarPointer(void *dst, uint64_t offset) noexcept {
+            auto bytes = (uint8_t*)dst;
+            bytes[0] = kFarPointerByte;
+            bytes[1] = 0;
+            offset = endian::encLittle64(offset);
+            memcpy(bytes + 2, &offset, sizeof(offset));
+        }
 
         Pointer(size_t offset, int width, bool external =false);
 
@@ -36,6 +65,8 @@ namespace fleece { namespace impl { namespace internal {
             const Value *dst = offsetby(this, -(ptrdiff_t)off);
             if (_usuallyFalse(isExternal()))
                 dst = derefExtern(WIDE, dst);
+            else if (_usuallyFalse(isFarPointer(dst)))
+                dst = offsetby(dst, -(ptrdiff_t)farOffset(dst));
             return dst;
         }
 
@@ -72,4 +103,13 @@ namespace fleece { namespace impl { namespace internal {
     };
 
 
+    // The Encoder writes a far pointer for any offset bigger than this. It can be lowered in
+    // debug builds, so tests can use far pointers without writing 2GB of data.
+#ifdef NDEBUG
+    constexpr size_t gMaxWideOffset = Pointer::kMaxWideOffset;
+#else
+    extern size_t gMaxWideOffset;
+#endif
+
+
 } } }
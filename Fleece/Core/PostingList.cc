@@ -0,0 +1,327 @@
+//
+// PostingList.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "PostingList.hh"
+#include "Encoder.hh"
+#include "Array.hh"
+#include "Endian.hh"
+#include "FleeceException.hh"
+#include "varint.hh"
+#include <algorithm>
+#include <cstring>
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+    // Encoded format:
+    //   magic:     kMagic
+    //   count:     varint
+    //   blocks:    up to kBlockSize integers each:
+    //              bit width of the deltas:    1 byte
+    //              first integer:              varint, minus the previous block's last one
+    //              last integer:               varint, minus the first one
+    //              deltas between the rest:    bit-packed LSB-first, padded to a byte
+    //   padding:   kPadding zero bytes, so the decoder can read 9 bytes at any packed position
+
+    static constexpr uint8_t kMagic[2] = {0xF7, 'P'};
+    static constexpr size_t kPadding = 8;
+
+
+    static inline uint64_t bitMask(unsigned width) {
+        return (width >= 64) ? ~uint64_t(0) : ((uint64_t(1) << width) - 1);
+    }
+
+    static inline size_t packedSize(unsigned n, unsigned width) {
+        return (size_t(n > 0 ? n - 1 : 0) * width + 7) / 8;
+    }
+
+    static inline unsigned bitWidth(uint64_t n) {
+        unsigned width = 0;
+        while (n) {
+            ++width;
+            n >>= 1;
+        }
+        return width;
+    }
+
+
+#pragma mark - ENCODING:
+
+
+    /*static*/ alloc_slice PostingList::encode(const uint64_t values[], size_t count) {
+        // Worst case per block: 3 bytes of header, 2 varints and 8 bytes per integer.
+        size_t nBlocks = (count + kBlockSize - 1) / kBlockSize;
+        alloc_slice result(sizeof(kMagic) + kMaxVarintLen64
+                           + nBlocks * (1 + 2 * kMaxVarintLen64) + 8 * count + kPadding);
+        auto out = (uint8_t*)result.buf;
+        memset(out, 0, result.size);
+        memcpy(out, kMagic, sizeof(kMagic));
+        out += sizeof(kMagic);
+        out += PutUVarInt(out, count);
+
+        uint64_t prevLast = 0;
+        for (size_t start = 0; start < count; start += kBlockSize) {
+            auto n = unsigned(min(count - start, size_t(kBlockSize)));
+            const uint64_t *block = &values[start];
+            throwIf(block[0] < prevLast, InvalidData, "Posting list isn't sorted");
+            uint64_t maxDelta = 0;
+            for (unsigned i = 1; i < n; ++i) {
+                throwIf(block[i] < block[i-1], InvalidData, "Posting list isn't sorted");
+                maxDelta = max(maxDelta, block[i] - block[i-1]);
+            }
+            unsigned width = bitWidth(maxDelta);
+            *out++ = uint8_t(width);
+            out += PutUVarInt(out, block[0] - prevLast);
+            out += PutUVarInt(out, block[n-1] - block[0]);
+
+            size_t bit = 0;
+            for (unsigned i = 1; i < n; ++i) {
+                uint64_t delta = block[i] - block[i-1];
+                for (unsigned left = width; left > 0; ) {
+                    unsigned shift = bit & 7, take = min(8 - shift, left);
+                    out[bit >> 3] |= uint8_t((delta & bitMask(take)) << shift);
+                    delta >>= take;
+                    bit += take;
+                    left -= take;
+                }
+            }
+            out += packedSize(n, width);
+            prevLast = block[n-1];
+        }
+        out += kPadding;
+        result.shorten((uint8_t*)out - (uint8_t*)result.buf);
+        return result;
+    }
+
+
+#pragma mark - READING:
+
+
+    /*static*/ bool PostingList::isPostingList(slice data) noexcept {
+        return data.size >= sizeof(kMagic) + 1 + kPadding
+            && memcmp(data.buf, kMagic, sizeof(kMagic)) == 0;
+    }
+
+
+    PostingList::PostingList(slice encoded) {
+        throwIf(!isPostingList(encoded), InvalidData, "Not a posting list");
+        _blocks = encoded;
+        _blocks.moveStart(sizeof(kMagic));
+        uint64_t count;
+        size_t n = GetUVarInt(_blocks, &count);
+        throwIf(n == 0, InvalidData, "Invalid posting list");
+        _blocks.moveStart(n);
+        _count = size_t(count);
+        validate();
+    }
+
+
+    PostingList::PostingList(const Value *value) {
+        if (value->type() == kData) {
+            *this = PostingList(value->asData());
+        } else {
+            auto array = value->asArray();
+            throwIf(!array, InvalidData, "Posting list is neither data nor an array");
+            vector<uint64_t> values;
+            values.reserve(array->count());
+            for (Array::iterator i(array); i; ++i) {
+                throwIf(!i->isInteger() || (!i->isUnsigned() && i->asInt() < 0), InvalidData,
+                        "Posting list array contains a non-integer");
+                values.push_back(i->asUnsigned());
+            }
+            alloc_slice encoded = encode(values);
+            *this = PostingList(slice(encoded));
+            _ownData = move(encoded);
+        }
+    }
+
+
+    // Checks that the block headers are consistent with the count and the data size, so that
+    // decoding never reads out of bounds.
+    void PostingList::validate() {
+        slice data = _blocks;
+        for (size_t remaining = _count; remaining > 0; ) {
+            auto n = unsigned(min(remaining, size_t(kBlockSize)));
+            throwIf(data.size == 0 || data[0] > 64, InvalidData, "Invalid posting list");
+            unsigned width = data[0];
+            data.moveStart(1);
+            for (int i = 0; i < 2; ++i) {
+                uint64_t v;
+                size_t len = GetUVarInt(data, &v);
+                throwIf(len == 0, InvalidData, "Invalid posting list");
+                data.moveStart(len);
+            }
+            size_t packed = packedSize(n, width);
+            throwIf(data.size < packed + kPadding, InvalidData, "Truncated posting list");
+            data.moveStart(packed);
+            remaining -= n;
+        }
+        _blocks.setSize(_blocks.size - data.size + kPadding);
+    }
+
+
+    vector<uint64_t> PostingList::decode() const {
+        vector<uint64_t> result;
+        result.reserve(_count);
+        for (iterator i(*this); i; ++i)
+            result.push_back(*i);
+        return result;
+    }
+
+
+    void PostingList::writeAsArray(Encoder &enc) const {
+        enc.beginArray(_count);
+        for (iterator i(*this); i; ++i)
+            enc.writeUInt(*i);
+        enc.endArray();
+    }
+
+
+#pragma mark - ITERATOR:
+
+
+    PostingList::iterator::iterator(const PostingList &list)
+    :_remaining(list._blocks)
+    ,_unread(list._count)
+    {
+        readBlock(true);
+    }
+
+
+    // Reads the next block's header, and decodes the block if `decode` is true; else skips it.
+    // Returns false at the end of the list.
+    bool PostingList::iterator::readBlock(bool decode) {
+        _pos = 0;
+        if (_unread == 0) {
+            _blockCount = 0;
+            return false;
+        }
+        auto n = unsigned(min(_unread, size_t(kBlockSize)));
+        _unread -= n;
+        unsigned width = _remaining[0];
+        _remaining.moveStart(1);
+        uint64_t first, span;
+        _remaining.moveStart(GetUVarInt(_remaining, &first));
+        _remaining.moveStart(GetUVarInt(_remaining, &span));
+        first += _prevLast;
+        _prevLast = first + span;
+        auto packed = (const uint8_t*)_remaining.buf;
+        _remaining.moveStart(packedSize(n, width));
+
+        if (!decode) {
+            _blockCount = 0;
+            return true;
+        }
+        // Unpack the deltas and add them up. Every position is at most 7 bits into a byte, so
+        // a delta is contained in the 9 bytes starting there:
+        const uint64_t mask = bitMask(width);
+        uint64_t value = first;
+        _block[0] = value;
+        size_t bit = 0;
+        for (unsigned i = 1; i < n; ++i, bit += width) {
+            const uint8_t *p = packed + (bit >> 3);
+            unsigned shift = bit & 7;
+            uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            word = endian::decLittle64(word) >> shift;
+            if (shift + width > 64)
+                word |= uint64_t(p[8]) << (64 - shift);
+            value += word & mask;
+            _block[i] = value;
+        }
+        throwIf(value != _prevLast, InvalidData, "Corrupt posting list");
+        _blockCount = n;
+        return true;
+    }
+
+
+    PostingList::iterator& PostingList::iterator::operator++ () {
+        if (++_pos >= _blockCount)
+            readBlock(true);
+        return *this;
+    }
+
+
+    bool PostingList::iterator::seek(uint64_t target) {
+        if (_pos >= _blockCount)
+            return false;
+        if (_block[_blockCount - 1] < target) {
+            // Skip whole blocks whose last integer is less than the target:
+            while (true) {
+                slice saved = _remaining;
+                size_t savedUnread = _unread;
+                uint64_t savedPrevLast = _prevLast;
+                if (!readBlock(false))
+                    return false;
+                if (_prevLast >= target) {
+                    // The target is in this block; go back and decode it:
+                    _remaining = saved;
+                    _unread = savedUnread;
+                    _prevLast = savedPrevLast;
+                    readBlock(true);
+                    break;
+                }
+            }
+        }
+        _pos = unsigned(lower_bound(&_block[_pos], &_block[_blockCount], target) - &_block[0]);
+        return true;
+    }
+
+
+#pragma mark - SET OPERATIONS:
+
+
+    /*static*/ vector<uint64_t> PostingList::intersect(const PostingList &a, const PostingList &b) {
+        const PostingList &shorter = (a.count() <= b.count()) ? a : b;
+        const PostingList &longer  = (a.count() <= b.count()) ? b : a;
+        vector<uint64_t> result;
+        iterator iLong(longer);
+        for (iterator i(shorter); i; ++i) {
+            uint64_t value = *i;
+            if (!iLong.seek(value))
+                break;
+            if (*iLong == value) {
+                if (result.empty() || result.back() != value)
+                    result.push_back(value);
+            }
+        }
+        return result;
+    }
+
+
+    /*static*/ vector<uint64_t> PostingList::unite(const PostingList &a, const PostingList &b) {
+        vector<uint64_t> result;
+        result.reserve(a.count() + b.count());
+        iterator ia(a), ib(b);
+        while (ia || ib) {
+            uint64_t value;
+            if (!ib || (ia && *ia <= *ib)) {
+                value = *ia;
+                ++ia;
+            } else {
+                value = *ib;
+                ++ib;
+            }
+            if (result.empty() || result.back() != value)
+                result.push_back(value);
+        }
+        return result;
+    }
+
+} }
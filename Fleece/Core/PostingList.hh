@@ -0,0 +1,108 @@
+//
+// PostingList.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include <vector>
+
+namespace fleece { namespace impl {
+    class Encoder;
+    class Value;
+
+
+    /** A compact encoding of a sorted array of unsigned integers, such as an index posting list
+        or a list of record IDs, stored in Fleece as a Data value.
+
+        The integers are split into blocks of up to 128. Each block stores its first integer,
+        and the span to its last, as varints; then the differences between consecutive
+        integers, bit-packed at the width of the largest one. So a dense list takes a few bits
+        per integer instead of the 2-9 bytes each in a Fleece array, and a search can skip a
+        block by reading only its header. Blocks decode in a tight loop without branches.
+
+        Readers that don't know the encoding see just a Data value. The constructor also
+        accepts a regular Array of integers, so data can use either form.
+        \ref Encoder::writePostingList writes one. */
+    class PostingList {
+    public:
+        static constexpr unsigned kBlockSize = 128;
+
+        /** Encodes integers, which must be sorted in ascending order (duplicates are allowed.) */
+        static alloc_slice encode(const uint64_t values[], size_t count);
+        static alloc_slice encode(const std::vector<uint64_t> &values) {
+            return encode(values.data(), values.size());
+        }
+
+        /** True if the data looks like an encoded posting list. (Only the header is checked.) */
+        static bool isPostingList(slice data) noexcept;
+
+        /** Reads an encoded posting list. The data is not copied, so it must remain valid.
+            Throws InvalidData if it's not a valid encoding. */
+        explicit PostingList(slice encoded);
+
+        /** Reads a posting list stored as a Data value, or as an Array of non-negative
+            integers (which is copied.) Throws InvalidData if the Value is neither. */
+        explicit PostingList(const Value* NONNULL);
+
+        /** The number of integers. */
+        size_t count() const                                {return _count;}
+        bool empty() const                                  {return _count == 0;}
+
+        /** Decodes all the integers. */
+        std::vector<uint64_t> decode() const;
+
+        /** Writes the integers as a regular Fleece Array. */
+        void writeAsArray(Encoder&) const;
+
+        /** Returns the integers that are in both lists. It steps through the shorter list and
+            skips over the blocks of the longer one that can't contain its next integer. */
+        static std::vector<uint64_t> intersect(const PostingList&, const PostingList&);
+
+        /** Returns the integers that are in either list, without duplicates. */
+        static std::vector<uint64_t> unite(const PostingList&, const PostingList&);
+
+        /** Steps through the integers of a PostingList in order, one block at a time. */
+        class iterator {
+        public:
+            explicit iterator(const PostingList&);
+            explicit operator bool() const                  {return _pos < _blockCount;}
+            uint64_t operator* () const                     {return _block[_pos];}
+            iterator& operator++ ();
+
+            /** Advances to the first integer greater than or equal to `target`, skipping blocks
+                that end before it without decoding them. Returns false at the end. */
+            bool seek(uint64_t target);
+
+        private:
+            bool readBlock(bool decode);
+
+            slice _remaining;                               // Encoded blocks not read yet
+            size_t _unread;                                 // Number of integers in them
+            uint64_t _prevLast {0};                         // Last integer of the previous block
+            uint64_t _block[kBlockSize];                    // Current decoded block
+            unsigned _pos {0}, _blockCount {0};
+        };
+
+    private:
+        void validate();
+
+        slice _blocks;                                      // The encoded blocks
+        size_t _count {0};
+        alloc_slice _ownData;                               // Backing store, if converted
+    };
+
+} }
@@ -0,0 +1,253 @@
+//
+// Predicate.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Predicate.hh"
+#include "Array.hh"
+#include "ArraySort.hh"
+#include "Encoder.hh"
+#include "FleeceException.hh"
+#include "SmallVector.hh"
+#include <algorithm>
+#include <cstring>
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+    struct Predicate::PathValues {
+        PathValues(size_t n)            :values(n), done(n) {reset();}
+        void reset()                    {std::fill(done.begin(), done.end(), false);}
+
+        smallVector<const Value*, 8>    values;
+        smallVector<bool, 8>            done;
+    };
+
+
+    Predicate::Predicate(const Value *expression, SharedKeys *sk)
+    :_sharedKeys(sk)
+    {
+        Encoder enc;
+        enc.writeValue(expression);
+        _expression = enc.finishDoc();
+        _root = compile(_expression->root());
+    }
+
+
+    /*static*/ Predicate Predicate::fromJSON(slice json, SharedKeys *sk) {
+        Retained<Doc> doc = Doc::fromJSON(json);
+        return Predicate(doc->root(), sk);
+    }
+
+
+#pragma mark - COMPILING:
+
+
+    // If `value` is a property reference like `[".path"]`, returns the path, else a null slice.
+    static slice propertyPath(const Value *value) {
+        const Array *array = value->asArray();
+        if (!array || array->count() != 1)
+            return nullslice;
+        slice path = array->get(0)->asString();
+        if (path.size < 2 || path[0] != '.')
+            return nullslice;
+        path.moveStart(1);
+        return path;
+    }
+
+
+    // Returns the index of the compiled property path, sharing it with identical ones.
+    uint32_t Predicate::compilePath(const Value *operand) {
+        slice spec = propertyPath(operand);
+        throwIf(!spec, InvalidData, "Predicate operand must be a property like [\".path\"]");
+        for (uint32_t i = 0; i < _pathSpecs.size(); ++i) {
+            if (_pathSpecs[i] == spec)
+                return i;
+        }
+        Path path(spec);
+        _paths.emplace_back(path, _sharedKeys);
+        _pathCosts.push_back(uint32_t(path.size()));
+        _pathSpecs.emplace_back(spec);
+        return uint32_t(_paths.size() - 1);
+    }
+
+
+    uint32_t Predicate::compile(const Value *expr) {
+        const Array *array = expr->asArray();
+        throwIf(!array || array->empty(), InvalidData, "Predicate must be a non-empty array");
+        static constexpr struct {const char *name; Op op;} kOperators[] = {
+            {"=", Op::kEq}, {"==", Op::kEq}, {"!=", Op::kNe}, {"<", Op::kLt}, {"<=", Op::kLe},
+            {">", Op::kGt}, {">=", Op::kGe}, {"IN", Op::kIn}, {"EXISTS", Op::kExists},
+            {"AND", Op::kAnd}, {"OR", Op::kOr}, {"NOT", Op::kNot},
+        };
+        slice name = array->get(0)->asString();
+        auto opInfo = find_if(begin(kOperators), end(kOperators),
+                              [&](auto &o) {return name == slice(o.name);});
+        throwIf(opInfo == end(kOperators), InvalidData, "Unknown predicate operator");
+        Node node {opInfo->op, 0, nullptr, 0, 0, 0};
+        uint32_t nOperands = array->count() - 1;
+
+        switch (node.op) {
+            case Op::kAnd:
+            case Op::kOr:
+            case Op::kNot: {
+                throwIf(nOperands == 0 || (node.op == Op::kNot && nOperands != 1), InvalidData,
+                        "Wrong number of operands in predicate");
+                // Compile the operands, then order them cheapest first. (Each operand's own
+                // operands get added to _children first, so these are appended afterwards.)
+                vector<uint32_t> children;
+                for (uint32_t i = 1; i <= nOperands; ++i)
+                    children.push_back(compile(array->get(i)));
+                stable_sort(children.begin(), children.end(), [&](uint32_t a, uint32_t b) {
+                    return _nodes[a].cost < _nodes[b].cost;
+                });
+                node.firstChild = uint32_t(_children.size());
+                node.childCount = nOperands;
+                for (uint32_t child : children)
+                    node.cost += _nodes[child].cost;
+                _children.insert(_children.end(), children.begin(), children.end());
+                break;
+            }
+            case Op::kExists:
+                throwIf(nOperands != 1, InvalidData, "Wrong number of operands in predicate");
+                node.path = compilePath(array->get(1));
+                node.cost = _pathCosts[node.path];
+                break;
+            default: {
+                throwIf(nOperands != 2, InvalidData, "Wrong number of operands in predicate");
+                node.path = compilePath(array->get(1));
+                node.constant = array->get(2);
+                throwIf(propertyPath(node.constant), InvalidData,
+                        "Predicate can't compare two properties");
+                node.cost = _pathCosts[node.path] + 1;
+                if (node.op == Op::kIn) {
+                    const Array *values = node.constant->asArray();
+                    throwIf(!values, InvalidData, "IN needs an array of values");
+                    node.cost += values->count() / 4;
+                }
+                break;
+            }
+        }
+        _nodes.push_back(node);
+        return uint32_t(_nodes.size() - 1);
+    }
+
+
+#pragma mark - EVALUATING:
+
+
+    bool Predicate::eval(uint32_t index, const Value *doc, PathValues &pathValues) const noexcept {
+        const Node &node = _nodes[index];
+        switch (node.op) {
+            case Op::kAnd:
+                for (uint32_t i = 0; i < node.childCount; ++i) {
+                    if (!eval(_children[node.firstChild + i], doc, pathValues))
+                        return false;
+                }
+                return true;
+            case Op::kOr:
+                for (uint32_t i = 0; i < node.childCount; ++i) {
+                    if (eval(_children[node.firstChild + i], doc, pathValues))
+                        return true;
+                }
+                return false;
+            case Op::kNot:
+                return !eval(_children[node.firstChild], doc, pathValues);
+            default:
+                break;
+        }
+
+        const Value *value;
+        if (pathValues.done[node.path]) {
+            value = pathValues.values[node.path];
+        } else {
+            value = doc ? _paths[node.path].eval(doc) : nullptr;
+            pathValues.values[node.path] = value;
+            pathValues.done[node.path] = true;
+        }
+        if (!value)
+            return false;
+
+        switch (node.op) {
+            case Op::kExists:
+                return true;
+            case Op::kEq:
+                return compareValues(value, node.constant) == 0;
+            case Op::kNe:
+                return compareValues(value, node.constant) != 0;
+            case Op::kIn:
+                for (Array::iterator i(node.constant->asArray()); i; ++i) {
+                    if (compareValues(value, i.value()) == 0)
+                        return true;
+                }
+                return false;
+            default:
+                break;
+        }
+        if (value->type() != node.constant->type())
+            return false;
+        int cmp = compareValues(value, node.constant);
+        switch (node.op) {
+            case Op::kLt:   return cmp < 0;
+            case Op::kLe:   return cmp <= 0;
+            case Op::kGt:   return cmp > 0;
+            case Op::kGe:   return cmp >= 0;
+            default:        return false;
+        }
+    }
+
+
+    bool Predicate::matches(const Value *doc) const noexcept {
+        PathValues pathValues(_paths.size());
+        return eval(_root, doc, pathValues);
+    }
+
+
+    uint32_t Predicate::filter(const Array *docs, uint8_t bitmap[]) const noexcept {
+        PathValues pathValues(_paths.size());
+        uint32_t count = docs->count(), nMatches = 0;
+        memset(bitmap, 0, (count + 7) / 8);
+        uint32_t i = 0;
+        for (Array::iterator iter(docs); iter; ++iter, ++i) {
+            pathValues.reset();
+            if (eval(_root, iter.value(), pathValues)) {
+                bitmap[i >> 3] |= uint8_t(1 << (i & 7));
+                ++nMatches;
+            }
+        }
+        return nMatches;
+    }
+
+
+    uint32_t Predicate::filter(const Value* const docs[], size_t count,
+                               uint8_t bitmap[]) const noexcept
+    {
+        PathValues pathValues(_paths.size());
+        uint32_t nMatches = 0;
+        memset(bitmap, 0, (count + 7) / 8);
+        for (size_t i = 0; i < count; ++i) {
+            pathValues.reset();
+            if (eval(_root, docs[i], pathValues)) {
+                bitmap[i >> 3] |= uint8_t(1 << (i & 7));
+                ++nMatches;
+            }
+        }
+        return nMatches;
+    }
+
+} }
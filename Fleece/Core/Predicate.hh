@@ -0,0 +1,101 @@
+//
+// Predicate.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Doc.hh"
+#include "Path.hh"
+#include "SharedKeys.hh"
+#include <vector>
+
+namespace fleece { namespace impl {
+    class Array;
+
+
+    /** A boolean expression over the properties of a document, compiled for fast repeated
+        evaluation, as when filtering many documents.
+
+        The expression is a Fleece Array in the JSON form used by Couchbase queries, e.g.
+        `["AND", [">", [".age"], 30], ["=", [".address.city"], "X"]]`. The operations are:
+        - Comparisons `=` (or `==`), `!=`, `<`, `<=`, `>`, `>=`, whose first operand is a
+          property, as `[".path"]`, and second a constant. `=` and `!=` compare any Values;
+          the others are false unless both are of the same type. All are false if the
+          property is missing.
+        - `["IN", [".path"], [constants...]]`, true if the property equals any constant.
+        - `["EXISTS", [".path"]]`, true if the property isn't missing.
+        - `AND`, `OR` (with any number of operands) and `NOT`.
+        Values are compared as by \ref compareValues.
+
+        Each distinct path is compiled once, with its keys resolved in the given SharedKeys, and
+        is evaluated at most once per document. The operands of AND and OR are reordered to
+        test the cheapest ones (those with the shortest paths) first, and evaluation stops as
+        soon as the result is known.
+
+        A Predicate is immutable, so it can be evaluated on multiple threads at once. */
+    class Predicate {
+    public:
+        /** Compiles an expression. The expression is copied. If `sk` is given, documents must
+            use those SharedKeys, or none.
+            Throws FleeceException (InvalidData or PathSyntaxError) if it's invalid. */
+        explicit Predicate(const Value* NONNULL expression, SharedKeys *sk =nullptr);
+
+        /** Parses an expression from JSON and compiles it. */
+        static Predicate fromJSON(slice json, SharedKeys *sk =nullptr);
+
+        /** Evaluates the predicate on a document (or any Value.) */
+        bool matches(const Value *doc) const noexcept;
+
+        /** Evaluates the predicate on each item of an Array, setting the item's bit in `bitmap`
+            (LSB first) if it matches and clearing it if not. Returns the number of matches.
+            The bitmap must have room for `(docs->count() + 7) / 8` bytes. */
+        uint32_t filter(const Array* NONNULL docs, uint8_t bitmap[]) const noexcept;
+
+        /** Like the other `filter`, but with the documents as a C array. */
+        uint32_t filter(const Value* const docs[], size_t count, uint8_t bitmap[]) const noexcept;
+
+    private:
+        enum class Op : uint8_t {
+            kEq, kNe, kLt, kLe, kGt, kGe, kIn, kExists, kAnd, kOr, kNot
+        };
+
+        struct Node {
+            Op              op;
+            uint32_t        path;           // Comparisons: index in _paths
+            const Value*    constant;       // Comparisons: the value compared with
+            uint32_t        firstChild;     // AND, OR, NOT: first index in _children
+            uint32_t        childCount;
+            uint32_t        cost;           // Rough cost of evaluating it
+        };
+
+        // Values of the paths, evaluated on demand for one document:
+        struct PathValues;
+
+        uint32_t compile(const Value*);
+        uint32_t compilePath(const Value*);
+        bool eval(uint32_t node, const Value *doc, PathValues&) const noexcept;
+
+        Retained<Doc>               _expression;    // Copy of the expression, for the constants
+        Retained<SharedKeys>        _sharedKeys;
+        std::vector<CompiledPath>   _paths;
+        std::vector<uint32_t>       _pathCosts;
+        std::vector<alloc_slice>    _pathSpecs;
+        std::vector<Node>           _nodes;
+        std::vector<uint32_t>       _children;      // Indexes in _nodes
+        uint32_t                    _root;
+    };
+
+} }
@@ -0,0 +1,103 @@
+//
+// ProgressiveDoc.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ProgressiveDoc.hh"
+#include "Array.hh"
+#include "Dict.hh"
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+    ProgressiveDoc::ProgressiveDoc(SharedKeys *sk, Doc::Trust trust)
+    :_sharedKeys(sk)
+    ,_trust(trust)
+    { }
+
+
+    bool ProgressiveDoc::addChunk(const alloc_slice &chunk) {
+        return add(chunk, false);
+    }
+
+
+    bool ProgressiveDoc::addFinalChunk(const alloc_slice &chunk) {
+        return add(chunk, true);
+    }
+
+
+    bool ProgressiveDoc::add(const alloc_slice &chunk, bool final) {
+        precondition(!_complete);
+        if (!_valid)
+            return false;
+        slice previous = _chunks.empty() ? slice() : _chunks.back()->data();
+        Retained<Doc> doc = new Doc(chunk, _trust, _sharedKeys, previous);
+        const Value *chunkRoot = doc->root();
+        if (!chunkRoot || (chunkRoot->type() != kArray && chunkRoot->type() != kDict)) {
+            _valid = false;
+            return false;
+        }
+        _chunks.push_back(doc);
+        size_t count = (chunkRoot->type() == kArray) ? chunkRoot->asArray()->count()
+                                                     : chunkRoot->asDict()->count();
+        // The final chunk's root is the whole collection, not just the items since the last:
+        _receivedCount = final ? count : _receivedCount + count;
+        _complete = final;
+        return true;
+    }
+
+
+    const Value* ProgressiveDoc::root() const noexcept {
+        return _complete ? _chunks.back()->root() : nullptr;
+    }
+
+
+    const Value* ProgressiveDoc::receivedItem(size_t index) const noexcept {
+        if (_complete) {
+            const Array *array = root()->asArray();
+            return array ? array->get(uint32_t(index)) : nullptr;
+        }
+        for (auto &chunk : _chunks) {
+            const Array *array = chunk->root()->asArray();
+            if (!array)
+                return nullptr;
+            size_t count = array->count();
+            if (index < count)
+                return array->get(uint32_t(index));
+            index -= count;
+        }
+        return nullptr;
+    }
+
+
+    const Value* ProgressiveDoc::get(slice key) const noexcept {
+        if (_complete) {
+            const Dict *dict = root()->asDict();
+            return dict ? dict->get(key) : nullptr;
+        }
+        for (auto &chunk : _chunks) {
+            const Dict *dict = chunk->root()->asDict();
+            if (!dict)
+                return nullptr;
+            if (const Value *value = dict->get(key))
+                return value;
+        }
+        return nullptr;
+    }
+
+} }
@@ -0,0 +1,74 @@
+//
+// ProgressiveDoc.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Doc.hh"
+#include <vector>
+
+namespace fleece { namespace impl {
+    class Array;
+    class Dict;
+
+    /** Receives a document sent in chunks by an Encoder using `snipEvery`, making its top-level
+        items readable as they arrive instead of only once the whole document has.
+
+        Each chunk becomes a Doc whose extern pointers resolve into the chunks before it, so
+        the chunks are used in place, without copying. Until the final chunk arrives, `root`
+        is null, but the top-level items received so far can be read with `receivedItem` (if
+        the root is an Array) or `get` (if it's a Dict). */
+    class ProgressiveDoc : public RefCounted {
+    public:
+        explicit ProgressiveDoc(SharedKeys* =nullptr, Doc::Trust =Doc::kUntrusted);
+
+        /** Adds the next chunk. Returns false if it's invalid, after which no more can be added. */
+        bool addChunk(const alloc_slice &chunk);
+
+        /** Adds the last chunk, the output of the Encoder's `finish`, whose root is the entire
+            document. Returns false if it's invalid. */
+        bool addFinalChunk(const alloc_slice &chunk);
+
+        bool isComplete() const noexcept                {return _complete;}
+        bool isValid() const noexcept                   {return _valid;}
+
+        /** The root of the whole document, or null if it hasn't all arrived yet. */
+        const Value* root() const noexcept;
+
+        /** The number of top-level items (array items, or dict entries) received so far. */
+        size_t receivedCount() const noexcept           {return _receivedCount;}
+
+        /** A top-level item of an Array root that's been received, or null if it hasn't. */
+        const Value* receivedItem(size_t index) const noexcept;
+
+        /** The value for a key of a Dict root, or null if it hasn't been received (yet). */
+        const Value* get(slice key) const noexcept;
+
+        /** The Docs of the chunks received so far. */
+        const std::vector<Retained<Doc>>& chunks() const noexcept   {return _chunks;}
+
+    private:
+        bool add(const alloc_slice &chunk, bool final);
+
+        SharedKeys*                 _sharedKeys;
+        Doc::Trust                  _trust;
+        std::vector<Retained<Doc>>  _chunks;
+        size_t                      _receivedCount {0};
+        bool                        _complete {false};
+        bool                        _valid {true};
+    };
+
+} }
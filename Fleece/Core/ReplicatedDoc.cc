@@ -0,0 +1,166 @@
+//
+// ReplicatedDoc.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ReplicatedDoc.hh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "betterassert.hh"
+
+#if defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+#endif
+
+namespace fleece { namespace impl {
+    using namespace std;
+
+
+#pragma mark - TOPOLOGY:
+
+
+    namespace {
+        struct Topology {
+            vector<vector<unsigned>> nodeCPUs;      // The CPUs of each node
+            vector<unsigned> cpuNode;               // The node of each CPU
+        };
+    }
+
+#if defined(__linux__)
+    // Parses a Linux CPU list like "0-3,8,10-11".
+    static vector<unsigned> parseCPUList(const char *list) {
+        vector<unsigned> cpus;
+        while (*list) {
+            char *end;
+            unsigned long first = strtoul(list, &end, 10), last = first;
+            if (end == list)
+                break;
+            if (*end == '-')
+                last = strtoul(end + 1, &end, 10);
+            for (unsigned long cpu = first; cpu <= last && cpu < 65536; ++cpu)
+                cpus.push_back(unsigned(cpu));
+            list = (*end == ',') ? end + 1 : end;
+            if (*list == '\n')
+                break;
+        }
+        return cpus;
+    }
+#endif
+
+    static Topology readTopology() {
+        Topology t;
+#if defined(__linux__)
+        for (unsigned node = 0; ; ++node) {
+            char path[64], list[4096];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+            FILE *f = fopen(path, "r");
+            if (!f)
+                break;
+            bool ok = fgets(list, sizeof(list), f) != nullptr;
+            fclose(f);
+            vector<unsigned> cpus;
+            if (ok)
+                cpus = parseCPUList(list);
+            for (unsigned cpu : cpus) {
+                if (cpu >= t.cpuNode.size())
+                    t.cpuNode.resize(cpu + 1, 0);
+                t.cpuNode[cpu] = node;
+            }
+            t.nodeCPUs.push_back(move(cpus));
+        }
+#endif
+        if (t.nodeCPUs.empty())
+            t.nodeCPUs.resize(1);
+        return t;
+    }
+
+    static const Topology& topology() {
+        static const Topology sTopology = readTopology();
+        return sTopology;
+    }
+
+
+    /*static*/ unsigned ReplicatedDoc::numaNodeCount() noexcept {
+        return unsigned(topology().nodeCPUs.size());
+    }
+
+
+    /*static*/ unsigned ReplicatedDoc::currentNumaNode() noexcept {
+#if defined(__linux__)
+        auto &t = topology();
+        if (t.nodeCPUs.size() > 1) {
+            int cpu = sched_getcpu();
+            if (cpu >= 0 && size_t(cpu) < t.cpuNode.size())
+                return t.cpuNode[cpu];
+        }
+#endif
+        return 0;
+    }
+
+
+    // Restricts the calling thread to the CPUs of a node, so the memory it touches first is
+    // allocated there. Failure isn't fatal: the replica just might not be local.
+    static void bindToNode(unsigned node) {
+#if defined(__linux__)
+        auto &t = topology();
+        if (node >= t.nodeCPUs.size() || t.nodeCPUs[node].empty())
+            return;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (unsigned cpu : t.nodeCPUs[node]) {
+            if (cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &cpus);
+        }
+        (void)pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif
+    }
+
+
+#pragma mark - REPLICATEDDOC:
+
+
+    ReplicatedDoc::ReplicatedDoc(const Doc *original, unsigned nodeCount) {
+        if (nodeCount == 0)
+            nodeCount = numaNodeCount();
+        // Copy the data on a thread per node, bound to that node:
+        vector<alloc_slice> copies(nodeCount);
+        vector<thread> threads;
+        for (unsigned node = 1; node < nodeCount; ++node) {
+            threads.emplace_back([&, node] {
+                bindToNode(node);
+                copies[node] = alloc_slice(original->data());
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+
+        _replicas.reserve(nodeCount);
+        _replicas.emplace_back(original);
+        for (unsigned node = 1; node < nodeCount; ++node)
+            _replicas.emplace_back(new Doc(copies[node], Doc::kTrusted, original->sharedKeys(),
+                                           original->externDestination()));
+    }
+
+
+    const Doc* ReplicatedDoc::local() const noexcept {
+        if (_replicas.size() == 1)
+            return _replicas[0];
+        return _replicas[currentNumaNode() % _replicas.size()];
+    }
+
+} }
@@ -0,0 +1,63 @@
+//
+// ReplicatedDoc.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Doc.hh"
+#include "SharedKeys.hh"
+#include <vector>
+
+namespace fleece { namespace impl {
+
+    /** A read-only Doc with a copy of its data in the memory of each NUMA node, so that threads
+        on every socket of a large machine read local memory.
+
+        Each copy is written by a thread bound to the CPUs of its node, so that with the OS's
+        usual first-touch policy its pages are allocated on that node. (That only works for
+        data big enough to be allocated fresh from the OS, which is the case that matters.)
+        Every replica is a Doc with the original's SharedKeys and extern destination, registered
+        as its own Scope, so Values in any replica resolve to it as usual.
+
+        Call `root()` or `local()` for each operation, rather than keeping a Value, since the
+        thread may have moved to another node. On platforms without NUMA information, or on a
+        machine with one node, there's one replica: the original Doc. */
+    class ReplicatedDoc : public RefCounted {
+    public:
+        /** Replicates a Doc onto `nodeCount` nodes; if zero, onto all the machine's nodes.
+            Replica 0 is the original. */
+        explicit ReplicatedDoc(const Doc* NONNULL, unsigned nodeCount =0);
+
+        /** The replica on the calling thread's node. */
+        const Doc* local() const noexcept;
+
+        /** The root of the calling thread's replica. */
+        const Value* root() const noexcept              {return local()->root();}
+
+        unsigned replicaCount() const noexcept          {return unsigned(_replicas.size());}
+        const Doc* replica(unsigned node) const         {return _replicas.at(node);}
+
+        /** The number of NUMA nodes in this machine (1 if unknown.) */
+        static unsigned numaNodeCount() noexcept;
+
+        /** The NUMA node the calling thread is running on (0 if unknown.) */
+        static unsigned currentNumaNode() noexcept;
+
+    private:
+        std::vector<RetainedConst<Doc>> _replicas;
+    };
+
+} }
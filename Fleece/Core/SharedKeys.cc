@@ -17,8 +17,15 @@
 //
 
 #include "SharedKeys.hh"
+#include "AccessProfile.hh"
 #include "FleeceImpl.hh"
 #include "FleeceException.hh"
+#include "KeyTree.hh"
+#include "Endian.hh"
+#include "slice_stream.hh"
+#include "varint.hh"
+#include "sliceIO.hh"
+#include <algorithm>
 
 
 #define LOCK(MUTEX)     lock_guard<mutex> _lock(MUTEX)
@@ -28,18 +35,71 @@ namespace fleece { namespace impl {
     using namespace std;
 
 
+    static std::atomic<uint64_t> sNextInstanceID {1};
+
+
     SharedKeys::SharedKeys()
-    :_table(2047)
+    :_instanceID(sNextInstanceID++)
+    ,_table(kInitialTableCapacity)
+    ,_byKey((kMaxCount + kByKeyBlockSize - 1) / kByKeyBlockSize)
     { }
 
 
+    void SharedKeys::setCapacity(size_t capacity) {
+        LOCK(_mutex);
+        throwIf(_count > 0, SharedKeysStateError, "can't change capacity after adding keys");
+        throwIf(capacity > kMaxCapacity, InvalidData, "SharedKeys capacity too large");
+        freePlatformStrings();
+        // Size the block list for the capacity, so it never moves while other threads are
+        // decoding. (The blocks themselves, and _table, grow as keys are added.)
+        _byKey.clear();
+        _byKey.resize((capacity + kByKeyBlockSize - 1) / kByKeyBlockSize);
+        _capacity = capacity;
+    }
+
+
+    slice SharedKeys::_byKeyAt(size_t key) const {
+        if (_usuallyFalse(key < _imageCount.load(std::memory_order_relaxed)))
+            return _imageStringAt(key);
+        else if (_usuallyFalse(key >= _capacity))
+            return nullslice;
+        auto &block = _byKey[key / kByKeyBlockSize];
+        return block ? block[key % kByKeyBlockSize] : slice();
+    }
+
+
+    void SharedKeys::_setByKey(size_t key, slice str) {
+        auto &block = _byKey[key / kByKeyBlockSize];
+        if (!block) {
+            if (!str)
+                return;
+            block.reset(new slice[kByKeyBlockSize]);
+        }
+        block[key % kByKeyBlockSize] = str;
+    }
+
+
     SharedKeys::~SharedKeys() {
+        freePlatformStrings();
+    }
+
+
+    void SharedKeys::freePlatformStrings() const {
     #ifdef __APPLE__
-        for (auto &str : _platformStringsByKey) {
-            if (str)
+        for (auto str : _retiredPlatformStrings)
+            CFRelease(str);
+    #endif
+        _retiredPlatformStrings.clear();
+        auto strings = _platformStrings.exchange(nullptr);
+        if (!strings)
+            return;
+    #ifdef __APPLE__
+        for (size_t i = 0; i < _capacity; ++i) {
+            if (auto str = strings[i].load())
                 CFRelease(str);
         }
     #endif
+        delete[] strings;
     }
 
     key_t::key_t(const Value *v) noexcept {
@@ -62,8 +122,7 @@ namespace fleece { namespace impl {
 
 
     size_t SharedKeys::count() const {
-        LOCK(_mutex);
-        return _count;
+        return _count.load(std::memory_order_acquire);
     }
 
 
@@ -76,11 +135,19 @@ namespace fleece { namespace impl {
         if (!state)
             return false;
         Array::iterator i(state->asArray());
+        // Data appended by PersistentSharedKeys::save starts with the key of its first string:
+        size_t first = 0;
+        if (i && i.value()->isInteger()) {
+            first = (size_t)i.value()->asUnsigned();
+            ++i;
+        }
         LOCK(_mutex);
-        if (i.count() <= _count)
+        if (first > _count)
+            return false;       // Missing the keys before this
+        if (first + i.count() <= _count)
             return false;
 
-        i += _count;           // Start at the first _new_ string
+        i += unsigned(_count.load() - first);    // Start at the first _new_ string
         for (; i; ++i) {
             slice str = i.value()->asString();
             if (!str)
@@ -94,10 +161,10 @@ namespace fleece { namespace impl {
 
 
     void SharedKeys::writeState(Encoder &enc) const {
-        auto count = _count;
+        size_t count = _count.load(std::memory_order_acquire);
         enc.beginArray(count);
         for (size_t key = 0; key < count; ++key)
-            enc.writeString(_byKey[key]);
+            enc.writeString(_byKeyAt(key));
         enc.endArray();
     }
 
@@ -116,18 +183,31 @@ namespace fleece { namespace impl {
             key = entry.value;
             return true;
         }
-        return false;
+        return _usuallyFalse(_imageCount.load(std::memory_order_relaxed) > 0)
+            && _encodeFromImage(str, key);
     }
 
 
     bool SharedKeys::encodeAndAdd(slice str, int &key) {
+        bool result = _encodeAndAdd(str, key);
+        (result ? _hits : _misses).fetch_add(1, std::memory_order_relaxed);
+        return result;
+    }
+
+
+    bool SharedKeys::_encodeAndAdd(slice str, int &key) {
         if (encode(str, key))
             return true;
         // Should this string be encoded?
         if (str.size > _maxKeyLength || !isEligibleToEncode(str))
             return false;
         LOCK(_mutex);
-        if (_count >= kMaxCount)
+        if (_samples) {
+            // In training mode, just count it:
+            _sample(str);
+            return false;
+        }
+        if (_count >= _capacity)
             return false;
         throwIf(!_inTransaction, SharedKeysStateError, "not in transaction");
         // OK, add to table:
@@ -136,21 +216,271 @@ namespace fleece { namespace impl {
 
 
     bool SharedKeys::_add(slice str, int &key) {
+        if (_count >= _capacity)
+            return false;
         auto value = uint16_t(_count);
         auto entry = _table.insert(str, value);
         if (!entry.key)
             return false; // failed
 
         if (entry.value == value) {
-            // new key:
-            _byKey[value] = entry.key;
-            ++_count;
+            // new key. Set _byKey before bumping _count, so lock-free readers never see the
+            // slot before it's written:
+            _setByKey(value, entry.key);
+            _count.store(value + 1, std::memory_order_release);
         }
         key = entry.value;
         return true;
     }
 
 
+#pragma mark - IMAGES:
+
+
+    // Data format of an image; all integers are little-endian:
+    //     "FLsk"                   magic number
+    //     count                    uint32
+    //     keyOfID[count]           uint16: the key of each KeyTree ID (minus 1)
+    //     stringOf[count]          uint32: offset in the image of each key's string in the tree
+    //     [KeyTree]
+    // Since a KeyTree's IDs are the strings' indexes in sorted order, keyOfID also serves to
+    // write the KeyTree: its strings are the keys' strings sorted by keyOfID.
+
+    static constexpr const char* kImageMagic = "FLsk";
+
+    static uint32_t readLittle32(const void *p) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return endian::decLittle32(v);
+    }
+
+    static uint16_t readLittle16(const void *p) {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        return endian::decLittle16(v);
+    }
+
+    static size_t imageHeaderSize(size_t count) {
+        return 8 + count * (sizeof(uint16_t) + sizeof(uint32_t));
+    }
+
+
+    alloc_slice SharedKeys::imageData() const {
+        vector<slice> strings = byKey();
+        size_t count = strings.size();
+        vector<uint16_t> keyOfID(count);
+        for (size_t key = 0; key < count; ++key)
+            keyOfID[key] = uint16_t(key);
+        sort(keyOfID.begin(), keyOfID.end(), [&](uint16_t a, uint16_t b) {
+            return strings[a] < strings[b];
+        });
+        vector<slice> sorted(count);
+        for (size_t i = 0; i < count; ++i)
+            sorted[i] = strings[keyOfID[i]];
+        KeyTree tree = KeyTree::fromSortedStrings(sorted);
+
+        size_t headerSize = imageHeaderSize(count);
+        alloc_slice image(headerSize + tree.encodedData().size);
+        auto out = (uint8_t*)image.buf;
+        memcpy(out, kImageMagic, 4);
+        uint32_t count32 = endian::encLittle32(uint32_t(count));
+        memcpy(out + 4, &count32, 4);
+        auto keyOfIDOut = out + 8, stringOfOut = keyOfIDOut + count * sizeof(uint16_t);
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t key = endian::encLittle16(keyOfID[i]);
+            memcpy(keyOfIDOut + i * sizeof(uint16_t), &key, sizeof(key));
+            slice str = tree[unsigned(i + 1)];
+            auto offset = uint32_t(headerSize + ((uint8_t*)str.buf - (uint8_t*)tree.encodedData().buf)
+                                   - SizeOfVarInt(str.size));
+            offset = endian::encLittle32(offset);
+            memcpy(stringOfOut + keyOfID[i] * sizeof(uint32_t), &offset, sizeof(offset));
+        }
+        tree.encodedData().copyTo(out + headerSize);
+        return image;
+    }
+
+
+    bool SharedKeys::useImage(slice image) {
+        LOCK(_mutex);
+        throwIf(_count > 0, SharedKeysStateError, "can't use an image after adding keys");
+        if (image.size < 8 || memcmp(image.buf, kImageMagic, 4) != 0)
+            return false;
+        size_t count = readLittle32(offsetby(image.buf, 4));
+        if (count > _capacity || image.size < imageHeaderSize(count))
+            return false;
+        size_t headerSize = imageHeaderSize(count);
+        slice tree(offsetby(image.buf, headerSize), image.end());
+        if (KeyTree(tree).count() != count)
+            return false;
+
+        // Check that the tables are consistent and every string lies within the image, so the
+        // lookups never need to:
+        auto keyOfID = (const uint8_t*)image.buf + 8;
+        auto stringOf = keyOfID + count * sizeof(uint16_t);
+        vector<bool> seen(count);
+        for (size_t i = 0; i < count; ++i) {
+            size_t key = readLittle16(keyOfID + i * sizeof(uint16_t));
+            if (key >= count || seen[key])
+                return false;
+            seen[key] = true;
+            size_t offset = readLittle32(stringOf + i * sizeof(uint32_t));
+            if (offset < headerSize || offset >= image.size)
+                return false;
+            slice_istream in(offsetby(image.buf, offset), image.end());
+            auto size = in.readUVarInt32();
+            if (!size || *size > in.size)
+                return false;
+        }
+
+        _image = image;
+        _imageKeyOfID = keyOfID;
+        _imageStringOf = stringOf;
+        _imageTree = tree;
+        _imageCount.store(unsigned(count), std::memory_order_relaxed);
+        _count.store(unsigned(count), std::memory_order_release);
+        return true;
+    }
+
+
+    bool SharedKeys::useImage(const alloc_slice &image) {
+        if (!useImage(slice(image)))
+            return false;
+        _imageOwner = image;
+        return true;
+    }
+
+
+    bool SharedKeys::useSharedMemoryImage(const char *name) {
+        auto mapping = MappedFile::openSharedMemory(name);
+        if (!useImage(mapping->contents()))
+            return false;
+        _imageMapping = std::move(mapping);
+        return true;
+    }
+
+
+    slice SharedKeys::_imageStringAt(size_t key) const {
+        auto offset = readLittle32(_imageStringOf + key * sizeof(uint32_t));
+        slice_istream in(offsetby(_image.buf, offset), _image.end());
+        auto size = in.readUVarInt32();
+        return slice(in.buf, *size);
+    }
+
+
+    // Looks up a string in the image's KeyTree. If found, adds it to _table, so the next lookup
+    // will be faster.
+    bool SharedKeys::_encodeFromImage(slice str, int &key) const {
+        unsigned id = KeyTree(_imageTree)[str];
+        if (id == 0)
+            return false;
+        key = readLittle16(_imageKeyOfID + (id - 1) * sizeof(uint16_t));
+        if (unsigned(key) >= _imageCount.load(std::memory_order_relaxed))
+            return false;
+        _table.insert(_imageStringAt(key), uint16_t(key));
+        return true;
+    }
+
+
+    void SharedKeys::beginTraining() {
+        LOCK(_mutex);
+        if (!_samples)
+            _samples.reset(new unordered_map<string, uint64_t>);
+    }
+
+
+    bool SharedKeys::isTraining() const {
+        LOCK(_mutex);
+        return _samples != nullptr;
+    }
+
+
+    void SharedKeys::_sample(slice str, uint64_t count) {
+        (*_samples)[string(str)] += count;
+    }
+
+
+    void SharedKeys::train(const Value *value) {
+        if (!value)
+            return;
+        if (auto dict = value->asDict(); dict) {
+            for (Dict::iterator i(dict); i; ++i) {
+                // Integer keys are already mapped, so only string keys matter:
+                slice str = i.key()->asString();
+                int key;
+                if (str && !encode(str, key) && str.size <= _maxKeyLength
+                        && isEligibleToEncode(str)) {
+                    LOCK(_mutex);
+                    throwIf(!_samples, SharedKeysStateError, "not in training mode");
+                    _sample(str);
+                }
+                train(i.value());
+            }
+        } else if (auto array = value->asArray(); array) {
+            for (Array::iterator i(array); i; ++i)
+                train(i.value());
+        }
+    }
+
+
+    void SharedKeys::train(const AccessProfile &profile) {
+        for (auto kind : {AccessProfile::kLookup, AccessProfile::kIteration}) {
+            for (auto &[str, count] : profile.counts(kind)) {
+                int key;
+                if (!encode(str, key) && str.size() <= _maxKeyLength && isEligibleToEncode(str)) {
+                    LOCK(_mutex);
+                    throwIf(!_samples, SharedKeysStateError, "not in training mode");
+                    _sample(str, count * profile.sampleInterval());
+                }
+            }
+        }
+    }
+
+
+    size_t SharedKeys::finishTraining() {
+        LOCK(_mutex);
+        throwIf(!_samples, SharedKeysStateError, "not in training mode");
+        auto samples = move(_samples);
+        throwIf(!_inTransaction, SharedKeysStateError, "not in transaction");
+
+        // Score each key by the number of bytes it would have saved: the key string (with its
+        // tag byte, padded to even length) is replaced by an inline int. Add one to favor hot
+        // short keys too, since integer keys are faster to look up.
+        vector<pair<uint64_t, slice>> scored;
+        scored.reserve(samples->size());
+        for (auto &sample : *samples) {
+            uint64_t bytesSaved = ((1 + sample.first.size() + 1) & ~1) + 1;
+            scored.emplace_back(sample.second * bytesSaved, slice(sample.first));
+        }
+        sort(scored.begin(), scored.end(), [](const pair<uint64_t, slice> &a,
+                                               const pair<uint64_t, slice> &b) {
+            return a.first != b.first ? a.first > b.first : a.second < b.second;
+        });
+
+        size_t added = 0;
+        for (auto &item : scored) {
+            if (_count >= _capacity)
+                break;
+            int key;
+            unsigned oldCount = _count;
+            if (!_add(item.second, key))
+                break;
+            added += (_count > oldCount);
+        }
+        return added;
+    }
+
+
+    SharedKeys::Stats SharedKeys::stats() const {
+        return {_hits.load(std::memory_order_relaxed), _misses.load(std::memory_order_relaxed)};
+    }
+
+
+    void SharedKeys::resetStats() {
+        _hits = 0;
+        _misses = 0;
+    }
+
+
     __hot bool SharedKeys::isEligibleToEncode(slice str) const {
         for (size_t i = 0; i < str.size; ++i)
             if (_usuallyFalse(!isalnum(str[i]) && str[i] != '_' && str[i] != '-'))
@@ -160,58 +490,93 @@ namespace fleece { namespace impl {
 
 
     bool SharedKeys::isUnknownKey(int key) const {
-        LOCK(_mutex);
         return _isUnknownKey(key);
     }
 
 
     /** Decodes an integer back to a string. */
-    slice SharedKeys::decode(int key) const {
+    __hot slice SharedKeys::decode(int key) const {
         throwIf(key < 0, InvalidData, "key must be non-negative");
-        if (_usuallyFalse(key >= kMaxCount))
-            return nullslice;
-        slice str = _byKey[key];
-        if (_usuallyFalse(!str))
+        if (_usuallyFalse(_isUnknownKey(key)))
             return decodeUnknown(key);
-        return str;
+        return _byKeyAt(key);
     }
 
 
     slice SharedKeys::decodeUnknown(int key) const {
+        if ((size_t)key >= _capacity)
+            return nullslice;
         // Unrecognized key -- if not in a transaction, try reloading
         const_cast<SharedKeys*>(this)->refresh();
 
-        // Retry after refreshing:
+        // Retry after refreshing. Locking waits for any _add call in progress, which may have
+        // put the key in _table but not yet bumped _count:
         LOCK(_mutex);
-        return _byKey[key];
+        if (_isUnknownKey(key))
+            return nullslice;
+        return _byKeyAt(key);
     }
 
 
     vector<slice> SharedKeys::byKey() const {
+        size_t count = _count.load(std::memory_order_acquire);
+        vector<slice> keys(count);
+        for (size_t key = 0; key < count; ++key)
+            keys[key] = _byKeyAt(key);
+        return keys;
+    }
+
+
+    shared_ptr<const vector<uint16_t>> SharedKeys::keyRanks() const {
         LOCK(_mutex);
-        return vector<slice>(&_byKey[0], &_byKey[_count]);
+        size_t count = _count.load(std::memory_order_acquire);
+        if (!_keyRanks || _keyRanks->size() != count) {
+            vector<uint16_t> order(count);
+            for (size_t key = 0; key < count; ++key)
+                order[key] = uint16_t(key);
+            std::sort(order.begin(), order.end(), [&](uint16_t a, uint16_t b) {
+                return _byKeyAt(a) < _byKeyAt(b);
+            });
+            auto ranks = make_shared<vector<uint16_t>>(count);
+            for (size_t rank = 0; rank < count; ++rank)
+                (*ranks)[order[rank]] = uint16_t(rank);
+            _keyRanks = std::move(ranks);
+        }
+        return _keyRanks;
     }
 
 
     SharedKeys::PlatformString SharedKeys::platformStringForKey(int key) const {
         throwIf(key < 0, InvalidData, "key must be non-negative");
-        LOCK(_mutex);
-        if ((unsigned)key >= _platformStringsByKey.size())
+        auto strings = _platformStrings.load(std::memory_order_acquire);
+        if (!strings || (size_t)key >= _capacity)
             return nullptr;
-        return _platformStringsByKey[key];
+        return strings[key].load(std::memory_order_acquire);
     }
 
 
     void SharedKeys::setPlatformStringForKey(int key, SharedKeys::PlatformString platformKey) const {
         LOCK(_mutex);
         throwIf(key < 0, InvalidData, "key must be non-negative");
-        throwIf((unsigned)key >= _count, InvalidData, "key is not yet known");
-        if ((unsigned)key >= _platformStringsByKey.size())
-            _platformStringsByKey.resize(key + 1);
+        throwIf(_isUnknownKey(key), InvalidData, "key is not yet known");
+        auto strings = _platformStrings.load();
+        if (!strings) {
+            strings = new atomic<PlatformString>[_capacity];
+            for (size_t i = 0; i < _capacity; ++i)
+                strings[i] = nullptr;
+            _platformStrings.store(strings, std::memory_order_release);
+        }
 #ifdef __APPLE__
-        _platformStringsByKey[key] = CFStringCreateCopy(kCFAllocatorDefault, platformKey);
+        platformKey = CFStringCreateCopy(kCFAllocatorDefault, platformKey);
+#endif
+        auto oldKey = strings[key].exchange(platformKey, std::memory_order_acq_rel);
+#ifdef __APPLE__
+        // Another thread may have just gotten `oldKey` from platformStringForKey, so it can't be
+        // released until I'm destructed:
+        if (oldKey)
+            _retiredPlatformStrings.push_back(oldKey);
 #else
-        _platformStringsByKey[key] = platformKey;
+        (void)oldKey;
 #endif
     }
 
@@ -224,11 +589,26 @@ namespace fleece { namespace impl {
         }
 
         // (Iterating backwards helps the ConcurrentArena free up key space.)
-        for (int key = _count - 1; key >= int(toCount); --key) {
-            _table.remove(_byKey[key]);
-            _byKey[key] = nullslice;
+        auto oldCount = _count.load();
+        _count.store(unsigned(toCount), std::memory_order_release);
+        _keyRanks.reset();
+        auto strings = _platformStrings.load();
+        for (int key = oldCount - 1; key >= int(toCount); --key) {
+            _table.remove(_byKeyAt(key));   // (image keys may not be in the table yet; that's OK)
+            if (key >= int(_imageCount))
+                _setByKey(key, nullslice);
+            if (strings) {
+                auto str = strings[key].exchange(nullptr);
+#ifdef __APPLE__
+                if (str)
+                    _retiredPlatformStrings.push_back(str);     // (see setPlatformStringForKey)
+#else
+                (void)str;
+#endif
+            }
         }
-        _count = unsigned(toCount);
+        if (toCount < _imageCount)
+            _imageCount.store(unsigned(toCount), std::memory_order_relaxed);
     }
 
 
@@ -265,6 +645,7 @@ namespace fleece { namespace impl {
     void PersistentSharedKeys::transactionEnded() {
         if (_inTransaction) {
             _committedPersistedCount = _persistedCount;
+            _committedDeltaCount = _deltaCount;
             _inTransaction = false;
         }
     }
@@ -273,6 +654,13 @@ namespace fleece { namespace impl {
     // Subclass's read() method calls this
     bool PersistentSharedKeys::loadFrom(const Value *state) {
         throwIf(changed(), SharedKeysStateError, "can't load when already changed");
+        // Keep track of how many appended deltas the storage holds:
+        if (const Array *array = state ? state->asArray() : nullptr; array) {
+            if (array->count() > 0 && array->get(0)->isInteger())
+                _committedDeltaCount = _deltaCount = _deltaCount + 1;
+            else
+                _committedDeltaCount = _deltaCount = 0;
+        }
         if (!SharedKeys::loadFrom(state))
             return false;
         _committedPersistedCount = _persistedCount = count();
@@ -280,17 +668,46 @@ namespace fleece { namespace impl {
     }
 
 
+    bool PersistentSharedKeys::useImage(slice image) {
+        if (!SharedKeys::useImage(image))
+            return false;
+        _committedPersistedCount = _persistedCount = count();
+        return true;
+    }
+
+
     void PersistentSharedKeys::save() {
         if (changed()) {
-            write(stateData());     // subclass hook
+            if (_persistedCount > 0 && _deltaCount < _snapshotInterval
+                                    && append(deltaData(_persistedCount))) {    // subclass hook
+                ++_deltaCount;
+            } else {
+                write(stateData());     // subclass hook
+                _deltaCount = 0;
+            }
             _persistedCount = count();
         }
     }
 
 
+    // Encodes the strings from `fromCount` on, preceded by `fromCount` itself, which is how
+    // SharedKeys::loadFrom tells them from a full state.
+    alloc_slice PersistentSharedKeys::deltaData(size_t fromCount) const {
+        size_t count = this->count();
+        Encoder enc;
+        enc.beginArray(count - fromCount + 1);
+        enc.writeUInt(fromCount);
+        for (size_t key = fromCount; key < count; ++key)
+            enc.writeString(_byKeyAt(key));
+        enc.endArray();
+        return enc.finish();
+    }
+
+
     void PersistentSharedKeys::revert() {
         revertToCount(_committedPersistedCount);
         _persistedCount = _committedPersistedCount;
+        _deltaCount = _committedDeltaCount;
     }
 
 } }
@@ -19,8 +19,11 @@
 #pragma once
 #include "RefCounted.hh"
 #include "ConcurrentMap.hh"
-#include <array>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include "betterassert.hh"
 
@@ -29,7 +32,12 @@
 #endif
 
 
+namespace fleece {
+    class MappedFile;
+}
+
 namespace fleece { namespace impl {
+    class AccessProfile;
     class Encoder;
     class Value;
 
@@ -66,7 +74,8 @@ namespace fleece { namespace impl {
         integer key, the Dict will look up a Scope responsible for its address, and get the
         SharedKeys instance from that Scope.
 
-        NOTE: This class is now thread-safe. */
+        NOTE: This class is now thread-safe. Reading (encode, decode, byKey, platformStringForKey)
+        doesn't take any locks; only adding keys does. */
     class SharedKeys : public RefCounted {
     public:
         SharedKeys();
@@ -81,12 +90,49 @@ namespace fleece { namespace impl {
         alloc_slice stateData() const;
         void writeState(Encoder &enc) const;
 
+        /** Returns the keys encoded as an image: a KeyTree of the strings, plus tables mapping
+            between its IDs and the keys. Unlike the state data, this can be used in place. */
+        alloc_slice imageData() const;
+
+        /** Loads the keys from an image created by \ref imageData, using it in place: no strings
+            are copied, and the hash table is filled in lazily as keys are looked up. The image
+            (which may be memory-mapped) must remain valid and unchanged for the lifetime of this
+            object. Keys added afterwards are stored as usual. Can only be called before any keys
+            have been added.
+            @return  True on success, false if the image is invalid. */
+        virtual bool useImage(slice image);
+
+        /** Same as \ref useImage(slice), but retains the image so it stays valid. Any number of
+            instances with the same keys can share one image this way, instead of each having its
+            own copy of the strings and tables; keys added to one afterwards are its own. */
+        bool useImage(const alloc_slice &image);
+
+        /** Same as \ref useImage(slice), but with an image in a named shared-memory segment
+            (see \ref MappedFile::createSharedMemory), which stays mapped as long as this object
+            exists. Every process on the host can use the same keys this way, with the strings
+            and tables in memory only once. Throws if the segment can't be opened. */
+        bool useSharedMemoryImage(const char *name);
+
         /** Sets the maximum length of string that can be mapped. (Defaults to 16 bytes.) */
         void setMaxKeyLength(size_t m)          {_maxKeyLength = m;}
 
+        /** Sets the maximum number of keys that can be mapped. (Defaults to kMaxCount.)
+            Can only be called before any keys have been added.
+            Keys numbered kMaxCount and up are encoded as 3-byte integers, which make the Dicts
+            containing them wide. Versions of Fleece that predate this can't look them up. */
+        void setCapacity(size_t capacity);
+
+        /** The maximum number of keys that can be mapped. */
+        size_t capacity() const FLPURE          {return _capacity;}
+
         /** The number of stored keys. */
         size_t count() const FLPURE;
 
+        /** A number identifying this instance, which no other instance in this process will
+            ever have, unlike its address. Caches can use it to refer to a SharedKeys without
+            keeping it alive. */
+        uint64_t instanceID() const FLPURE              {return _instanceID;}
+
         /** Maps a string to an integer, or returns false if there is no mapping. */
         bool encode(slice string, int &key) const;
 
@@ -97,7 +143,7 @@ namespace fleece { namespace impl {
         /** Returns true if the string could be added, i.e. there's room, it's not too long,
             and it has only valid characters. */
         inline bool couldAdd(slice str) const FLPURE {
-            return count() < kMaxCount && str.size <= _maxKeyLength && isEligibleToEncode(str);
+            return count() < _capacity && str.size <= _maxKeyLength && isEligibleToEncode(str);
         }
 
         /** Decodes an integer back to a string. */
@@ -112,9 +158,51 @@ namespace fleece { namespace impl {
 
         bool isUnknownKey(int key) const FLPURE;
 
+        /** A table of each key's position in the sorted order of all the keys' strings, so that
+            integer keys can be put in string order without decoding and comparing them. (Its
+            size is the count when it was made.) It's cached until keys are added or reverted. */
+        std::shared_ptr<const std::vector<uint16_t>> keyRanks() const;
+
         virtual bool refresh()                          {return false;}
 
-        static const size_t kMaxCount = 2048;               // Max number of keys to store
+        //////// Training:
+
+        /** Enters training mode. Instead of adding new keys on a first-come-first-served basis,
+            encodeAndAdd() just counts how often each eligible unmapped key is seen, and returns
+            false. (Keys that are already mapped are still encoded.) Keys can also be sampled
+            directly by calling train(). Call finishTraining() to add the most valuable keys. */
+        void beginTraining();
+
+        /** True if in training mode. */
+        bool isTraining() const FLPURE;
+
+        /** Samples the keys of every Dict in a value, recursively. Must be in training mode. */
+        void train(const Value*);
+
+        /** Samples the keys of an AccessProfile's lookups and iterations, weighted by their
+            counts times its sample interval. Must be in training mode. */
+        void train(const AccessProfile&);
+
+        /** Ends training mode, adding the sampled keys in descending order of how many bytes they
+            would have saved, until the capacity is reached.
+            @return  The number of keys added. */
+        size_t finishTraining();
+
+        //////// Statistics:
+
+        struct Stats {
+            uint64_t hits;      ///< encodeAndAdd calls that returned an integer key
+            uint64_t misses;    ///< encodeAndAdd calls that returned false
+        };
+
+        /** Returns the number of hits and misses of encodeAndAdd since creation or the last call
+            to resetStats(). */
+        Stats stats() const FLPURE;
+
+        void resetStats();
+
+        static const size_t kMaxCount = 2048;               // Default max number of keys to store
+        static const size_t kMaxCapacity = 0x7FFF;          // Max for setCapacity (2-byte ints)
         static const size_t kDefaultMaxKeyLength = 16;      // Max length of string to store
 
 #ifdef __APPLE__
@@ -124,7 +212,10 @@ namespace fleece { namespace impl {
 #endif
 
         /** Allows an uninterpreted value (like a pointer to a platform String object) to be
-            associated with an encoded key. */
+            associated with an encoded key. The value returned by platformStringForKey isn't
+            retained, since it's read without locking; so on Apple platforms, where the strings
+            are retained, one that's replaced or reverted isn't released until the SharedKeys
+            is destructed. */
         void setPlatformStringForKey(int key, PlatformString) const;
         PlatformString platformStringForKey(int key) const;
 
@@ -139,17 +230,41 @@ namespace fleece { namespace impl {
         friend class PersistentSharedKeys;
 
         bool _encodeAndAdd(slice string, int &key);
+        void _sample(slice string, uint64_t count =1);
         bool _add(slice string, int &key);
-        bool _isUnknownKey(int key) const FLPURE        {return (size_t)key >= _count;}
+        bool _isUnknownKey(int key) const FLPURE        {return (size_t)key >= _count.load(std::memory_order_acquire);}
         slice decodeUnknown(int key) const;
-
+        void freePlatformStrings() const;
+        slice _byKeyAt(size_t key) const FLPURE;
+        void _setByKey(size_t key, slice);
+        bool _encodeFromImage(slice string, int &key) const;
+        slice _imageStringAt(size_t key) const FLPURE;
+
+        // The reverse mapping is allocated in blocks as keys are added, since most instances
+        // hold far fewer than their capacity:
+        static constexpr size_t kByKeyBlockSize = 64;
+        static constexpr int kInitialTableCapacity = 32;
+
+        uint64_t const _instanceID;                     // Unique ID (see instanceID())
         size_t _maxKeyLength {kDefaultMaxKeyLength};    // Max length of string I will add
+        size_t _capacity {kMaxCount};                   // Max number of keys
         mutable std::mutex _mutex;
-        unsigned _count {0};
+        std::atomic<unsigned> _count {0};               // Incremented only after _byKey is set
         bool _inTransaction {true};                     // (for PersistentSharedKeys)
-        mutable std::vector<PlatformString> _platformStringsByKey; // Reverse mapping, int->platform key
-        ConcurrentMap _table;                             // Hash table mapping slice->int
-        std::array<slice, kMaxCount> _byKey;      // Reverse mapping, int->slice
+        mutable std::atomic<std::atomic<PlatformString>*> _platformStrings {nullptr}; // int->platform key
+        mutable std::vector<PlatformString> _retiredPlatformStrings; // Replaced; maybe still in use
+        mutable ConcurrentMap _table;                     // Hash table mapping slice->int
+        std::vector<std::unique_ptr<slice[]>> _byKey; // Reverse mapping, int->slice, in blocks
+        std::unique_ptr<std::unordered_map<std::string, uint64_t>> _samples; // Training key counts
+        std::atomic<uint64_t> _hits {0}, _misses {0};   // encodeAndAdd statistics
+        slice _image;                                   // Image being used in place, if any
+        alloc_slice _imageOwner;                        // Retains _image, if it was an alloc_slice
+        std::unique_ptr<MappedFile> _imageMapping;      // Maps _image, if it's shared memory
+        const uint8_t* _imageKeyOfID {nullptr};          // _image's table of KeyTree ID -> key
+        const uint8_t* _imageStringOf {nullptr};         // _image's table of key -> string offset
+        slice _imageTree;                               // _image's KeyTree
+        mutable std::shared_ptr<const std::vector<uint16_t>> _keyRanks; // Cached by keyRanks()
+        std::atomic<unsigned> _imageCount {0};          // Number of keys (still) from _image
     };
 
 
@@ -165,6 +280,8 @@ namespace fleece { namespace impl {
 
         bool loadFrom(const Value *state) override;
         bool loadFrom(slice stateData)              {return SharedKeys::loadFrom(stateData);}
+        using SharedKeys::useImage;
+        bool useImage(slice image) override;
 
         /** Updates state from persistent storage. Not usually necessary. */
         virtual bool refresh() override;
@@ -172,9 +289,15 @@ namespace fleece { namespace impl {
         /** Call this right after a transaction has started; it enables adding new strings. */
         void transactionBegan();
 
-        /** Writes any changed state. Call before committing a transaction. */
+        /** Writes any changed state. Call before committing a transaction.
+            If the subclass implements append(), this usually appends just the keys added since
+            the last save; every `snapshotInterval` saves it writes the full state instead. */
         void save();
 
+        /** Sets how many times in a row save() may append new keys, before it writes the full
+            state again. (Each append is another piece of data for read() to load.) */
+        void setSnapshotInterval(unsigned n)        {_snapshotInterval = n;}
+
         /** Reverts to persisted state as of the end of the last transaction.
             Call when aborting a transaction, or a transaction failed to commit.
             @warning  Any use of encoded keys created during the transaction will
@@ -191,13 +314,27 @@ namespace fleece { namespace impl {
         /** Abstract: Should read the persisted data and call loadFrom() with it. */
         virtual bool read() =0;
 
-        /** Abstract: Should write the given encoded data to persistent storage. */
+        /** Abstract: Should write the given encoded data to persistent storage, replacing
+            anything written (or appended) before. */
         virtual void write(slice encodedData) =0;
 
+        /** Optional: Should append the given encoded data, holding just the keys added since the
+            last write or append, to persistent storage. read() must then call loadFrom() with
+            the written data followed by each appended piece, in order. Returns false if this
+            isn't supported, and save() calls write() instead, which is the default. */
+        virtual bool append(slice encodedDelta)     {return false;}
+
         std::mutex _refreshMutex;
 
     private:
+        alloc_slice deltaData(size_t fromCount) const;
+
+        static constexpr unsigned kDefaultSnapshotInterval = 32;
+
         size_t _persistedCount {0};             // Number of strings written to storage
         size_t _committedPersistedCount {0};    // Number of strings written to storage & committed
+        unsigned _deltaCount {0};               // Number of appends since the last full write
+        unsigned _committedDeltaCount {0};      // Number of appends since then, committed
+        unsigned _snapshotInterval {kDefaultSnapshotInterval}; // Max appends between full writes
     };
 } }
@@ -0,0 +1,76 @@
+//
+// SharedStrings.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "SharedStrings.hh"
+#include "Encoder.hh"
+#include "Array.hh"
+#include "FleeceException.hh"
+#include "betterassert.hh"
+
+namespace fleece { namespace impl {
+    using namespace std;
+    using namespace internal;
+
+
+    SharedStrings::SharedStrings(const vector<slice> &strings) {
+        Encoder enc;
+        enc.beginArray(strings.size());
+        // Write in reverse, so the first strings end up nearest the end of the data:
+        for (auto s = strings.rbegin(); s != strings.rend(); ++s) {
+            if (s->size >= kNarrow)
+                enc.writeString(*s);
+        }
+        enc.endArray();
+        init(enc.finish());
+    }
+
+
+    SharedStrings::SharedStrings(alloc_slice data) {
+        init(move(data));
+    }
+
+
+    void SharedStrings::init(alloc_slice data) {
+        const Value *root = Value::fromData(data);
+        const Array *array = root ? root->asArray() : nullptr;
+        throwIf(!array, InvalidData, "Invalid shared strings data");
+        _data = move(data);
+        _table = StringTable(array->count());
+        for (Array::iterator i(array); i; ++i) {
+            const Value *v = i.value();
+            throwIf(v->type() != kString, InvalidData, "Shared strings data contains a non-string");
+            slice str = v->asString();
+            if (str.size >= kNarrow)    // shorter strings are inline, so they can't be pointed to
+                _table.insert(str, uint32_t((const uint8_t*)v - (const uint8_t*)_data.buf));
+        }
+    }
+
+
+    const Array* SharedStrings::strings() const {
+        return Value::fromTrustedData(_data)->asArray();
+    }
+
+
+    const Value* SharedStrings::find(slice str, StringTable::hash_t hash) const noexcept {
+        if (str.size < kNarrow)
+            return nullptr;
+        auto entry = _table.find(str, hash);
+        return entry ? (const Value*)&_data[entry->second] : nullptr;
+    }
+
+} }
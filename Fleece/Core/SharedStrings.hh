@@ -0,0 +1,83 @@
+//
+// SharedStrings.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "RefCounted.hh"
+#include "StringTable.hh"
+#include "fleece/slice.hh"
+#include <vector>
+
+
+namespace fleece { namespace impl {
+    class Array;
+    class Value;
+
+
+    /** A pool of common string values, shared by many documents. An Encoder that's given one
+        (see Encoder::setSharedStrings) writes any string that's in the pool as a pointer to it,
+        instead of writing the string itself.
+
+        The pool is itself a Fleece document, whose root is an Array of strings, so it can be
+        persisted by saving its data(). The pointers to it are `extern` pointers, so a document
+        encoded with it must be opened as a Doc whose externDestination is the pool's data().
+        Since every occurrence of a pooled string then has the same address, such strings can be
+        compared by comparing pointers.
+
+        Documents depend on the exact layout of the pool, so once documents have been encoded
+        with it, the pool must never change; to add strings, create a new pool.
+        A SharedStrings is immutable, so it's thread-safe. */
+    class SharedStrings : public RefCounted {
+    public:
+        /** Creates a pool of the given strings. Duplicates, and strings shorter than 2 bytes (which
+            are always stored inline), are skipped.
+            The Encoder's narrow (2-byte) pointers can only reach about 32KB, and the earliest
+            strings given are stored nearest the end of the pool, so list the most common strings
+            first. */
+        explicit SharedStrings(const std::vector<slice> &strings);
+
+        /** Loads a pool from its persisted data, i.e. the data() of an earlier instance.
+            Throws an InvalidData exception if it isn't a Fleece Array of strings. */
+        explicit SharedStrings(alloc_slice data);
+
+        /** The encoded pool, an Array of strings. */
+        const alloc_slice& data() const FLPURE      {return _data;}
+
+        /** The pool's strings, as an Array. */
+        const Array* strings() const FLPURE;
+
+        /** The number of strings in the pool. */
+        size_t count() const FLPURE                 {return _table.count();}
+
+        /** Returns the string Value in the pool that's equal to `str`, or nullptr. */
+        const Value* find(slice str) const noexcept FLPURE {
+            return find(str, StringTable::hashCode(str));
+        }
+
+        const Value* find(slice str, StringTable::hash_t) const noexcept FLPURE;
+
+        /** True if the Value is one of the pool's strings. */
+        bool contains(const Value *v) const FLPURE  {return _data.containsAddress(v);}
+
+    private:
+        void init(alloc_slice data);
+
+        alloc_slice _data;                          // The encoded pool
+        StringTable _table;                         // Maps each string to its offset in _data
+    };
+
+} }
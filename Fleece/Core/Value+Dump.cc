@@ -199,7 +199,16 @@ namespace fleece { namespace impl {
             switch (value->tag()) {
                 case kArrayTag: {
                     _out << " [";
-                    for (auto i = value->asArray()->begin(); i; ++i) {
+                    auto array = value->asArray();
+                    if (array->packedType() != Array::PackedType::kNone) {
+                        // A packed Array's header ends with a marker giving its items' type
+                        // (which is included in the header's size):
+                        _out << '\n';
+                        dumpHex(offsetby(value, kPackedMarkerOffset), false);
+                        _out << "  <packed>";
+                        ++n;
+                    }
+                    for (auto i = array->begin(); i; ++i) {
                         if (n++ > 0) _out << ',';
                         _out << '\n';
                         size += dump(i.rawValue(), value->isWideArray(), 1);
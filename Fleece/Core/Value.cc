@@ -20,15 +20,21 @@
 #include "Pointer.hh"
 #include "Array.hh"
 #include "Dict.hh"
+#include "DictIndex.hh"
 #include "Internal.hh"
 #include "Doc.hh"
 #include "HeapValue.hh"
 #include "Endian.hh"
+#include "Counters.hh"
+#include "CRC32C.hh"
 #include "FleeceException.hh"
 #include "varint.hh"
 #include "PlatformCompat.hh"
 #include "JSONEncoder.hh"
 #include "ParseDate.hh"
+#include "SmallVector.hh"
+#include "Tracing.hh"
+#include "ValueHash.hh"
 #include <math.h>
 #include "betterassert.hh"
 
@@ -175,10 +181,8 @@ namespace fleece { namespace impl {
             case kShortIntTag:
             case kIntTag: {
                 int64_t i = asInt();
-                if (isUnsigned())
-                    sprintf(str, "%llu", (unsigned long long)i);
-                else
-                    sprintf(str, "%lld", (long long)i);
+                size_t len = isUnsigned() ? WriteInteger(uint64_t(i), str) : WriteInteger(i, str);
+                str[len] = '\0';
                 break;
             }
             case kSpecialTag: {
@@ -225,6 +229,11 @@ namespace fleece { namespace impl {
     int64_t Value::asTimestamp() const noexcept {
         switch (tag()) {
             case kStringTag:
+                if (isTimestamp()) {
+                    int64_t ts;
+                    memcpy(&ts, getStringBytes().end(), sizeof(ts));
+                    return endian::decLittle64(ts);
+                }
                 return ParseISO8601Date(asString());
             case kShortIntTag:
             case kIntTag:
@@ -235,6 +244,13 @@ namespace fleece { namespace impl {
         }
     }
 
+    int Value::timestampOffset() const noexcept {
+        if (!isTimestamp())
+            return 0;
+        auto trailer = (const uint8_t*)getStringBytes().end() + sizeof(int64_t);
+        return int16_t(trailer[0] | (trailer[1] << 8));
+    }
+
     const Array* Value::asArray() const noexcept {
         if (_usuallyFalse(tag() != kArrayTag))
             return nullptr;
@@ -254,19 +270,20 @@ namespace fleece { namespace impl {
 
 
     template <int VER>
-    alloc_slice Value::toJSON(bool canonical) const {
+    alloc_slice Value::toJSON(bool canonical, SharedKeys *sharedKeys) const {
         JSONEncoder encoder;
         if (VER >= 5)
             encoder.setJSON5(true);
         encoder.setCanonical(canonical);
+        encoder.setSharedKeys(sharedKeys);
         encoder.writeValue(this);
         return encoder.finish();
     }
 
 
     // Explicitly instantiate both needed versions of the templates:
-    template alloc_slice Value::toJSON<1>(bool canonical) const;
-    template alloc_slice Value::toJSON<5>(bool canonical) const;
+    template alloc_slice Value::toJSON<1>(bool, SharedKeys*) const;
+    template alloc_slice Value::toJSON<5>(bool, SharedKeys*) const;
 
 
     std::string Value::toJSONString() const {
@@ -275,8 +292,20 @@ namespace fleece { namespace impl {
 
 
     bool Value::isEqual(const Value *v) const {
-        if (!v || _byte[0] != v->_byte[0])
+        if (!v)
             return false;
+        if (_byte[0] != v->_byte[0]) {
+            // Equal numbers may differ in size, like an item of a packed Array and a regular
+            // number; and equal collections in width, like a packed Array (whose items are
+            // inline, so it's never wide) and a wide Array of the same numbers:
+            bool isInt = (tag() <= kIntTag), vIsInt = (v->tag() <= kIntTag);
+            if (isInt && vIsInt)
+                return asInt() == v->asInt() && (isUnsigned() == v->isUnsigned() || asInt() >= 0);
+            else if (tag() == kFloatTag && v->tag() == kFloatTag)
+                return asDouble() == v->asDouble();
+            else if (tag() != v->tag() || (tag() != kArrayTag && tag() != kDictTag))
+                return false;
+        }
         if (_usuallyFalse(this == v))
             return true;
         switch (tag()) {
@@ -298,6 +327,8 @@ namespace fleece { namespace impl {
                 Array::iterator j((const Array*)v);
                 if (i.count() != j.count())
                     return false;
+                if (uint64_t h1, h2; embeddedHash(h1) && v->embeddedHash(h2) && h1 != h2)
+                    return false;
                 for (; i; ++i, ++j)
                     if (!i.value()->isEqual(j.value()))
                         return false;
@@ -311,6 +342,72 @@ namespace fleece { namespace impl {
     }
 
 
+    uint64_t Value::hash(SharedKeys *sk) const {
+        return hash(sk, nullptr);
+    }
+
+
+    // Computes a hash (see ValueHash.hh), using and adding to `cache` if it's non-null.
+    uint64_t Value::hash(SharedKeys *sk, HashCache *cache) const {
+        switch (tag()) {
+            case kSpecialTag:
+                return ValueHash::ofSpecial(tinyValue());
+            case kShortIntTag:
+            case kIntTag:
+                return ValueHash::ofInt(asInt(), isUnsigned());
+            case kFloatTag:
+                return ValueHash::ofDouble(asDouble());
+            case kStringTag:
+                return ValueHash::ofString(asString());
+            case kBinaryTag:
+                return ValueHash::ofData(asData());
+            case kArrayTag:
+            case kDictTag: {
+                uint64_t h;
+                if (embeddedHash(h))
+                    return h;
+                bool cacheable = (cache && !isMutable());
+                if (cacheable && cache->get(this, h))
+                    return h;
+                if (tag() == kArrayTag) {
+                    h = ValueHash::beginArray();
+                    for (Array::iterator i((const Array*)this); i; ++i)
+                        h = ValueHash::addItem(h, i.value()->hash(sk, cache));
+                } else {
+                    h = ValueHash::beginDict();
+                    for (Dict::iterator i((const Dict*)this, sk); i; ++i) {
+                        slice key = i.keyString();
+                        uint64_t keyHash = key ? ValueHash::ofKey(key) : i.key()->hash(sk, cache);
+                        h = ValueHash::addEntry(h, keyHash, i.value()->hash(sk, cache));
+                    }
+                }
+                if (cacheable)
+                    cache->set(this, h);
+                return h;
+            }
+            default:
+                return 0;
+        }
+    }
+
+
+    // Looks for a hash stored after a collection's items by Encoder::embedHashes.
+    bool Value::embeddedHash(uint64_t &outHash) const noexcept {
+        auto t = tag();
+        if ((t != kArrayTag && t != kDictTag) || isMutable())
+            return false;
+        Array::impl coll(this);
+        if (coll._count < CollectionHash::kMinCount
+                || (t == kArrayTag && ((const Array*)this)->packedType() != Array::PackedType::kNone))
+            return false;
+        size_t slots = coll._count;
+        if (t == kDictTag)
+            slots *= 2;
+        return CollectionHash::find(offsetby(coll._first, slots * coll._width), coll._count,
+                                    outHash);
+    }
+
+
 #pragma mark - VALIDATION:
 
     
@@ -323,11 +420,66 @@ namespace fleece { namespace impl {
 
     const Value* Value::fromData(slice s) noexcept {
         auto root = findRoot(s);
-        if (root && _usuallyFalse(!root->validate(s.buf, s.end())))
-            root = nullptr;
+        if (root) {
+            tracing::Span span("Value::fromData", s.size);
+            counters::count(counters::kValidations);
+            counters::count(counters::kValidatedBytes, s.size);
+            if (_usuallyFalse(!root->validate(s.buf, s.end())))
+                root = nullptr;
+        }
         return root;
     }
 
+    const Value* Value::fromChecksummedData(slice s) noexcept {
+        return hasValidChecksum(s) ? findRoot(s) : fromData(s);
+    }
+
+    // Returns the size of the trailer of encoded data, if the data may have blocks before it
+    // (i.e. its root is a pointer), else 0. The trailer is a narrow pointer, either to the root
+    // or (if it's wide) to a wide pointer just before it.
+    size_t Value::trailerSize(slice s) noexcept {
+        if (_usuallyFalse((size_t)s.buf & 1) || _usuallyFalse(s.size < kNarrow)
+                                             || _usuallyFalse(s.size % kNarrow))
+            return 0;
+        auto trailer = (const Value*)offsetby(s.buf, s.size - kNarrow);
+        if (!trailer->isPointer())
+            return 0;
+        if (trailer->_asPointer()->offset<false>() == kWide)
+            return kNarrow + kWide;
+        return kNarrow;
+    }
+
+    bool Value::hasValidChecksum(slice s) noexcept {
+        size_t trailerSize = Value::trailerSize(s);
+        if (trailerSize == 0 || s.size < kChecksumSize + trailerSize)
+            return false;
+        auto block = (const uint8_t*)s.end() - trailerSize - kChecksumSize;
+        if (memcmp(block, kChecksumHeader, sizeof(kChecksumHeader)) != 0)
+            return false;
+        auto crcPos = block + sizeof(kChecksumHeader);
+        uint32_t crc = crc32c(slice(s.buf, crcPos));
+        crc = crc32c(slice(crcPos + 4, s.end()), crc);
+        endian::uint32_le stored;
+        memcpy(&stored, crcPos, sizeof(stored));
+        return crc == stored;
+    }
+
+    bool Value::hasAlignedNumbers(slice s) noexcept {
+        size_t trailerSize = Value::trailerSize(s);
+        if (trailerSize == 0)
+            return false;
+        auto end = (const uint8_t*)s.end() - trailerSize;
+        if (size_t(end - (const uint8_t*)s.buf) >= kChecksumSize + kAlignedMarkerSize
+                && memcmp(end - kChecksumSize, kChecksumHeader, sizeof(kChecksumHeader)) == 0)
+            end -= kChecksumSize;
+        if (size_t(end - (const uint8_t*)s.buf) < kAlignedMarkerSize)
+            return false;
+        auto marker = end - kAlignedMarkerSize;
+        // (The root itself could be binary data that looks like the marker.)
+        return memcmp(marker, kAlignedMarker, kAlignedMarkerSize) == 0
+            && (const void*)findRoot(s) < (const void*)marker;
+    }
+
     const Value* Value::findRoot(slice s) noexcept {
         precondition(((size_t)s.buf & 1) == 0);  // Values must be 2-byte aligned
 
@@ -349,38 +501,131 @@ namespace fleece { namespace impl {
         return root;
     }
 
+    namespace {
+        // A Value waiting to be validated, and the data range it has to fit in.
+        struct pendingValue {
+            const Value *value;
+            const void *dataStart, *dataEnd;
+        };
+
+        // Returns true if the 4 narrow items starting at `items` are all small ints or specials.
+        // Those are always exactly 2 bytes, so they're valid no matter what. This is checked 8
+        // bytes at a time: a tag is the high nibble of each item's first byte.
+        static inline bool fourTrivialNarrowItems(const void *items) noexcept {
+            uint64_t word;
+            memcpy(&word, items, sizeof(word));
+            word = endian::decLittle64(word);
+            constexpr uint64_t kLowNibbles = 0x000F000F000F000F, kSignBits = 0x8000800080008000;
+            uint64_t tags = (word >> 4) & kLowNibbles;
+            // Sets the high bit of each 16-bit lane whose (4-bit) value is nonzero:
+            auto nonzero = [](uint64_t lanes) {return (lanes + 0x7FFF7FFF7FFF7FFF) & kSignBits;};
+            uint64_t notShortInt = nonzero(tags ^ kShortIntTag * 0x0001000100010001);
+            uint64_t notSpecial  = nonzero(tags ^ kSpecialTag  * 0x0001000100010001);
+            return (notShortInt & notSpecial) == 0;
+        }
+    }
+
+    // The first byte of each item of a packed array, indexed by its Array::PackedType:
+    static constexpr uint8_t kPackedItemTags[5] = {
+        0,                                  // (kNone, but that doesn't get this far)
+        (kIntTag << 4) | 3,                 // kInt32: 4-byte int
+        (kIntTag << 4) | 7,                 // kInt64: 8-byte int
+        (kFloatTag << 4),                   // kFloat
+        (kFloatTag << 4) | 0x08,            // kDouble
+    };
+
+    // Validation is iterative, using an explicit stack instead of recursing into collections
+    // and pointer targets, so deeply nested data can't overflow the C stack.
     bool Value::validate(const void *dataStart, const void *dataEnd) const noexcept {
-        auto t = tag();
-        if (t == kArrayTag || t == kDictTag) {
-            Array::impl array(this);
-            if (_usuallyTrue(array._count > 0)) {
-                // For validation purposes a Dict is just an array with twice as many items:
-                size_t itemCount = array._count;
-                if (_usuallyTrue(t == kDictTag))
-                    itemCount *= 2;
-                // Check that size fits:
-                auto itemsSize = itemCount * array._width;
-                if (_usuallyFalse(offsetby(array._first, itemsSize) > dataEnd))
+        smallVector<pendingValue, 32> stack;
+        stack.push_back({this, dataStart, dataEnd});
+        do {
+            pendingValue cur = stack.back();
+            stack.pop_back();
+            auto t = cur.value->tag();
+            if (t == kArrayTag || t == kDictTag) {
+                // (Array::impl reads a long count, and after a zero one, checks for a packed
+                // array's marker and reads its count. Any valid long array is bigger than that.)
+                if (cur.value->countValue() == kLongArrayCount
+                        && offsetby(cur.value, kPackedMarkerOffset + kNarrow + kMaxVarintLen64)
+                                > cur.dataEnd)
                     return false;
+                Array::impl array(cur.value);
+                if (_usuallyTrue(array._count > 0)) {
+                    // For validation purposes a Dict is just an array with twice as many items:
+                    size_t itemCount = array._count;
+                    if (_usuallyTrue(t == kDictTag))
+                        itemCount *= 2;
+                    // Check that size fits:
+                    const bool wide = (array._width == kWide);
+                    auto itemsSize = itemCount * array._width;
+                    if (_usuallyFalse(offsetby(array._first, itemsSize) > cur.dataEnd))
+                        return false;
+                    if (t == kDictTag && array._count >= DictKeyPrefixes::kMinCount) {
+                        // Dict::get will read a hash index and/or key prefixes following the
+                        // items, so check that they fit:
+                        auto trailer = (const Value*)offsetby(array._first, itemsSize);
+                        for (int i = 0; i < 2; ++i) {
+                            if (trailer >= cur.dataEnd) {
+                                if (i > 0)
+                                    return false;   // (a reader looks past a DictIndex)
+                                break;
+                            }
+                            if (trailer->_byte[0] != DictIndex::kHeaderByte)
+                                break;
+                            if (offsetby(trailer, 1 + kMaxVarintLen32) > cur.dataEnd)
+                                return false;
+                            size_t size = trailer->dataSize();
+                            if (offsetby(trailer, size) > cur.dataEnd)
+                                return false;
+                            trailer = offsetby(trailer, size + (size & 1));
+                        }
+                    }
 
-                // Check each Array/Dict element:
-                auto item = array._first;
-                while (itemCount-- > 0) {
-                    auto nextItem = offsetby(item, array._width);
-                    if (item->isPointer()) {
-                        if (_usuallyFalse(!item->_asPointer()->validate(array._width == kWide, dataStart)))
-                            return false;
-                    } else {
-                        if (_usuallyFalse(!item->validate(dataStart, nextItem)))
+                    if (array._width != kNarrow && !wide) {
+                        // Packed array: every item must be an inline number of the same type
+                        // (which also rules out pointers):
+                        auto marker = offsetby(cur.value, kPackedMarkerOffset);
+                        uint8_t itemTag = kPackedItemTags[marker->_byte[1]];
+                        for (auto item = array._first; itemCount > 0; --itemCount) {
+                            if (_usuallyFalse(item->_byte[0] != itemTag))
+                                return false;
+                            item = offsetby(item, array._width);
+                        }
+                        continue;
+                    }
+
+                    // Check each Array/Dict element:
+                    auto item = array._first;
+                    while (itemCount > 0) {
+                        if (!wide && itemCount >= 4 && fourTrivialNarrowItems(item)) {
+                            item = offsetby(item, 4 * kNarrow);
+                            itemCount -= 4;
+                            continue;
+                        }
+                        auto nextItem = offsetby(item, array._width);
+                        if (item->isPointer()) {
+                            const void *start = cur.dataStart, *end = item;
+                            auto target = item->_asPointer()->carefulDeref(wide, start, end);
+                            if (_usuallyFalse(!target))
+                                return false;
+                            stack.push_back({target, start, end});
+                        } else if (item->tag() >= kArrayTag) {
+                            stack.push_back({item, cur.dataStart, nextItem});
+                        } else if (_usuallyFalse(offsetby(item, item->dataSize()) > nextItem)) {
                             return false;
+                        }
+                        item = nextItem;
+                        --itemCount;
                     }
-                    item = nextItem;
+                    continue;
                 }
-                return true;
             }
-        }
-        // Default: just check that size fits:
-        return offsetby(this, dataSize()) <= dataEnd;
+            // Default: just check that size fits:
+            if (_usuallyFalse(offsetby(cur.value, cur.value->dataSize()) > cur.dataEnd))
+                return false;
+        } while (!stack.empty());
+        return true;
     }
 
     // This does not include the inline items in arrays/dicts
@@ -391,6 +636,10 @@ namespace fleece { namespace impl {
             case kFloatTag:     return isDouble() ? 10 : 6;
             case kIntTag:       return 2 + (tinyValue() & 0x07);
             case kStringTag:
+                if (isTimestamp())
+                    return (uint8_t*)getStringBytes().end() + kTimestampTrailerSize
+                                - (uint8_t*)this;
+                // fall through
             case kBinaryTag:    return (uint8_t*)getStringBytes().end() - (uint8_t*)this;
             case kArrayTag:
             case kDictTag:      return (uint8_t*)Array::impl(this)._first - (uint8_t*)this;
@@ -21,7 +21,10 @@
 #include "FleeceException.hh"
 #include "fleece/slice.hh"
 #include "Endian.hh"
+#include "function_ref.hh"
 #include <iosfwd>
+#include <string>
+#include <vector>
 #include <stdint.h>
 #ifdef __OBJC__
 #import <Foundation/NSMapTable.h>
@@ -34,6 +37,7 @@ namespace fleece {
 namespace fleece { namespace impl {
     class Array;
     class Dict;
+    class Path;
     class SharedKeys;
 
 
@@ -60,6 +64,10 @@ namespace fleece { namespace impl {
         kDefaultCopy        = 0,
         kDeepCopy           = 1,
         kCopyImmutables     = 2,
+        kCopyToArena        = 4,    ///< Allocate the copied values together in a HeapArena
+        kCopySingleThreaded = 8,    ///< Like kCopyToArena, but the copy is used on one thread only
+        kCopyLazily         = 16,   ///< With kDeepCopy, copies nested collections when modified
+        kCopyStringArena    = 32,   ///< Strings set later are allocated from a shared arena
     };
 
 
@@ -77,12 +85,36 @@ namespace fleece { namespace impl {
             This is a lot faster, but "undefined behavior" occurs if the data is corrupt... */
         static const Value* fromTrustedData(slice s) noexcept;
 
+        /** Returns a pointer to the root value in encoded data that may have a checksum (see
+            Encoder::checksum.) If it has one and it matches, the data is trusted as by
+            fromTrustedData, which is much faster than validating it; otherwise it's validated
+            as by fromData.
+            A checksum only detects corruption: data from a sender that might be malicious must
+            always be validated. */
+        static const Value* fromChecksummedData(slice) noexcept;
+
+        /** Returns true if the data has a checksum (see Encoder::checksum) and it matches. */
+        static bool hasValidChecksum(slice) noexcept;
+
+        /** Returns true if the data was encoded with Encoder::alignNumbers, so that if it starts at
+            an 8-byte-aligned address, the 8 bytes of every out-of-line double are 8-byte aligned,
+            and the 4 bytes of every float 4-byte aligned. */
+        static bool hasAlignedNumbers(slice) noexcept;
+
         /** The overall type of a value (JSON types plus Data) */
         valueType type() const noexcept FLPURE;
 
         /** Compares two Values for equality. */
         bool isEqual(const Value*) const FLPURE;
 
+        /** Returns a 64-bit hash of the Value's content, such that equal Values (by isEqual) have
+            equal hashes however they're encoded -- even if one is in a document whose keys are
+            SharedKeys integers and one isn't. Integer keys are decoded with `sharedKeys`, or if
+            it's null, the SharedKeys the data belongs to.
+            A large collection encoded with Encoder::embedHashes stores its hash, so hashing it is
+            O(1); otherwise it is hashed recursively. See also Doc::hashOf, which caches hashes. */
+        uint64_t hash(SharedKeys *sharedKeys =nullptr) const;
+
         //////// Scalar types:
 
         /** Boolean value/conversion. Any value is considered true except false, null, 0. */
@@ -132,6 +164,17 @@ namespace fleece { namespace impl {
              - A number is interpreted as a timestamp and returned as-is. */
         FLTimestamp asTimestamp() const noexcept FLPURE;
 
+        /** True if this is a string written by Encoder::writeTimestamp, which stores the
+            timestamp in binary as well, so \ref asTimestamp doesn't have to parse it. */
+        bool isTimestamp() const noexcept FLPURE {
+            return _byte[0] == ((internal::kStringTag << 4) | 0x0F)
+                && (_byte[1] & 0x80) != 0 && _byte[2] == 0;
+        }
+
+        /** The timezone offset, in minutes east of UTC, a timestamp was written with;
+            0 if this isn't a timestamp. */
+        int timestampOffset() const noexcept FLPURE;
+
         /** If this value is an array, returns it cast to 'const Array*', else returns nullptr. */
         const Array* asArray() const noexcept FLPURE;
 
@@ -151,6 +194,48 @@ namespace fleece { namespace impl {
         SharedKeys* sharedKeys() const noexcept FLPURE;
 
 
+        //////// Traversal:
+
+        /** Called by \ref visit with each value, and its Dict key (or else nullslice and its
+            Array index.) Returning false skips the value's children. */
+        using Visitor = function_ref<bool(const Value*, slice key, uint32_t index)>;
+
+        /** Calls `visitor` with this value and then, recursively, with every value it contains,
+            depth-first. Faster than a DeepIterator, and doesn't allocate memory, but the
+            traversal can't be paused, and it recurses once per level of nesting. */
+        void visit(Visitor visitor) const;
+
+        /** Which values \ref containsString looks in. */
+        enum SearchFlags : unsigned {
+            kSearchStrings  = 1,    ///< String values
+            kSearchKeys     = 2,    ///< Dict keys
+            kSearchData     = 4,    ///< Binary data values
+        };
+
+        /** Returns true if this value, or any value it contains, is a string (or key or data,
+            depending on `flags`) containing `needle` as a substring. If `outPaths` is given, the
+            path of every such value (in \ref DeepIterator::pathString form) is appended to it;
+            otherwise the search stops at the first match.
+
+            Since strings are stored verbatim, the encoded data is first scanned for `needle`
+            as a whole, with no decoding; if it doesn't occur there, nothing need be traversed. */
+        bool containsString(slice needle,
+                            unsigned flags =kSearchStrings,
+                            std::vector<std::string> *outPaths =nullptr) const;
+
+        /** Overwrites the scalar at a single-valued path from this value with `newValue`, in the
+            encoded data, if the new value's encoding fits where the old one is: a small int,
+            boolean or null can replace any of those; an int can replace an out-of-line int if it
+            fits in as many bytes; and a floating-point number can replace a double, or a float
+            if it's exactly representable as one.
+            Returns false, changing nothing, if the path isn't found, the value doesn't fit, it's
+            in a mutable or packed collection or one with an embedded hash, or the data has a
+            checksum.
+            The data must be writable, and nothing else may be reading it meanwhile. If it was
+            encoded with uniqueCollections, an out-of-line number may be shared by other paths. */
+        bool patchInPlace(const Path&, const Value *newValue NONNULL) const;
+
+
         //////// Conversion:
 
         /** Writes a JSON representation to a Writer.
@@ -159,9 +244,11 @@ namespace fleece { namespace impl {
         void toJSON(Writer&) const;
 
         /** Returns a JSON representation.
-            If you call it as toJSON<5>(...), writes JSON5, which leaves most keys unquoted. */
+            If you call it as toJSON<5>(...), writes JSON5, which leaves most keys unquoted.
+            If `sharedKeys` is given, it's used to decode integer keys, instead of looking up the
+            SharedKeys the data belongs to. */
         template <int VER =1>
-        alloc_slice toJSON(bool canonical =false) const;
+        alloc_slice toJSON(bool canonical =false, SharedKeys *sharedKeys =nullptr) const;
 
         /** Returns a JSON string representation of a Value. */
         std::string toJSONString() const;
@@ -212,6 +299,9 @@ namespace fleece { namespace impl {
         { }
 
         static const Value* findRoot(slice) noexcept FLPURE;
+        static size_t trailerSize(slice) noexcept FLPURE;
+        uint64_t hash(SharedKeys*, internal::HashCache*) const;
+        bool embeddedHash(uint64_t &outHash) const noexcept;
         bool validate(const void* dataStart, const void *dataEnd) const noexcept FLPURE;
 
         internal::tags tag() const noexcept FLPURE   {return (internal::tags)(_byte[0] >> 4);}
@@ -255,11 +345,14 @@ namespace fleece { namespace impl {
         friend class internal::HeapCollection;
         friend class internal::HeapValue;
         friend class Array;
+        friend class CompressedDoc;
+        friend class Doc;
         friend class Dict;
         friend class Encoder;
         friend class ValueTests;
         friend class EncoderTests;
         friend class ValueDumper;
+        friend class DataStats;
         template <bool WIDE> friend struct dictImpl;
     };
 
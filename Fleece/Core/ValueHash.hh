@@ -0,0 +1,120 @@
+//
+// ValueHash.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "Internal.hh"
+#include "fleece/slice.hh"
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace fleece { namespace impl {
+    class Value;
+} }
+
+namespace fleece { namespace impl { namespace internal {
+    // Both wyhash headers declare a `wyrand()` function, so use a namespace to prevent collision.
+    namespace wy {
+        #include "wyhash.h"
+    }
+
+    /*
+     The building blocks of Value::hash, which are shared by the Encoder so that the hashes it
+     embeds in the data (see Encoder::embedHashes) are the same as those computed from the data.
+
+     A hash depends only on a Value's content, as compared by Value::isEqual, never on how it's
+     encoded: a number's size, a collection's width, and whether a Dict's keys are
+     strings or SharedKeys integers make no difference. Since integer keys sort before strings,
+     equal Dicts can have different key orders, so a Dict's entries are combined by adding them.
+    */
+    struct ValueHash {
+        static uint64_t ofSpecial(int specialValue) noexcept {
+            return wy::wyhash64(kSpecialTag, uint64_t(specialValue));
+        }
+
+        static uint64_t ofInt(int64_t i, bool isUnsigned) noexcept {
+            // An unsigned int is only different from a signed one if it's too big to be one:
+            bool bigUnsigned = isUnsigned && i < 0;
+            return wy::wyhash64(kIntTag + (bigUnsigned ? 0x10 : 0), uint64_t(i));
+        }
+
+        static uint64_t ofDouble(double d) noexcept {
+            if (d == 0)
+                d = 0;                                  // -0 is equal to 0
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            return wy::wyhash64(kFloatTag, bits);
+        }
+
+        static uint64_t ofString(slice s) noexcept {
+            return wy::wyhash(s.buf, s.size, kStringTag, wy::_wyp);
+        }
+
+        static uint64_t ofData(slice s) noexcept {
+            return wy::wyhash(s.buf, s.size, kBinaryTag, wy::_wyp);
+        }
+
+        static uint64_t ofKey(slice key) noexcept {
+            return wy::wyhash(key.buf, key.size, 0, wy::_wyp);
+        }
+
+        static uint64_t beginArray() noexcept       {return wy::wyhash64(kArrayTag, 0);}
+
+        static uint64_t addItem(uint64_t h, uint64_t itemHash) noexcept {
+            return wy::wyhash64(h, itemHash);
+        }
+
+        static uint64_t beginDict() noexcept        {return wy::wyhash64(kDictTag, 0);}
+
+        static uint64_t addEntry(uint64_t h, uint64_t keyHash, uint64_t valueHash) noexcept {
+            return h + wy::wyhash64(keyHash, valueHash);
+        }
+    };
+
+
+    /** A thread-safe cache of collections' hashes, as kept by Doc::hashOf. */
+    class HashCache {
+    public:
+        bool get(const Value *v, uint64_t &hash) const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto i = _hashes.find(v);
+            if (i == _hashes.end())
+                return false;
+            hash = i->second;
+            return true;
+        }
+
+        void set(const Value *v, uint64_t hash) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _hashes.emplace(v, hash);
+        }
+
+        /** The approximate memory used, including the object itself. */
+        size_t memoryUsage() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            // Each entry is a node holding the pair and a next-pointer (plus cached hash):
+            return sizeof(*this) + _hashes.bucket_count() * sizeof(void*)
+                 + _hashes.size() * (sizeof(decltype(_hashes)::value_type) + 2*sizeof(void*));
+        }
+
+    private:
+        mutable std::mutex _mutex;
+        std::unordered_map<const Value*, uint64_t> _hashes;
+    };
+
+} } }
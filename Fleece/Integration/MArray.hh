@@ -171,6 +171,8 @@ namespace fleece {
 
         Array               _array;     // Base Fleece Array (if any)
         std::vector<MValue> _vec;       // Current array; empty MValues are unmodified
+
+        friend MRoot<Native>;
     };
 
 }
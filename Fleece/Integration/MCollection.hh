@@ -44,6 +44,9 @@ namespace fleece {
         /** The parent collection, if any. */
         MCollection* parent() const         {return _parent;}
 
+        /** True if this is an MDict, false if an MArray. */
+        bool isDict() const                 {return _isDict;}
+
     protected:
         using MValue = MValue<Native>;
 
@@ -51,6 +54,12 @@ namespace fleece {
         :MCollection(MContext::gNullContext, true)
         { }
 
+        explicit MCollection(bool isDict)
+        :MCollection()
+        {
+            _isDict = isDict;
+        }
+
         MCollection(MContext *context, bool isMutable)
         :_context(context->retain())
         ,_mutable(isMutable)
@@ -115,6 +124,7 @@ namespace fleece {
         bool            _mutable {true};            // Am I mutable?
         bool            _mutated {true};            // Has my value changed from the backing store?
         bool            _mutableChildren {true};    // Should child containers be mutable?
+        bool            _isDict {false};            // Am I an MDict?
 
         friend MValue;
     };
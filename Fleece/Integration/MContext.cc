@@ -19,6 +19,10 @@
 #include "MContext.hh"
 #include "betterassert.hh"
 
+#ifdef __APPLE__
+#include <CoreFoundation/CFBase.h>
+#endif
+
 namespace fleece {
 
     MContext::MContext(const alloc_slice &data)
@@ -37,12 +41,40 @@ namespace fleece {
 
     MContext::~MContext() {
         assert(this != gNullContext);
+#ifdef __APPLE__
+        for (auto &entry : _platformStrings)
+            CFRelease(entry.second);
+#endif
 #ifndef NDEBUG
         --gInstanceCount;
 #endif
     }
 
 
+    MContext::PlatformString MContext::platformStringForValue(FLValue value) const {
+        std::lock_guard<std::mutex> lock(_platformStringsMutex);
+        auto i = _platformStrings.find(value);
+        return (i != _platformStrings.end()) ? i->second : nullptr;
+    }
+
+
+    void MContext::setPlatformStringForValue(FLValue value, PlatformString str) const {
+        if (this == gNullContext || !str)
+            return;
+        std::lock_guard<std::mutex> lock(_platformStringsMutex);
+#ifdef __APPLE__
+        CFRetain(str);
+#endif
+        auto [i, isNew] = _platformStrings.insert({value, str});
+        if (!isNew) {
+#ifdef __APPLE__
+            CFRelease(i->second);
+#endif
+            i->second = str;
+        }
+    }
+
+
     MContext::MContext()
     :_refCount(0x7FFFFFFF)
     { }
@@ -19,6 +19,8 @@
 #pragma once
 #include "MValue.hh"
 #include <atomic>
+#include <mutex>
+#include <unordered_map>
 
 namespace fleece {
 
@@ -37,6 +39,21 @@ namespace fleece {
         /** The data of the Fleece document from which the root was loaded. */
         virtual slice data() const                  {return _data;}
 
+#ifdef __APPLE__
+        typedef CFStringRef PlatformString;
+#else
+        typedef const void* PlatformString;
+#endif
+
+        /** Returns the platform string object (like an NSString) cached for the string Value at
+            this address in the data, or null if there isn't one. */
+        PlatformString platformStringForValue(FLValue) const;
+
+        /** Caches a platform string object made from a string Value in the data, so that the
+            Value is converted only once however many times it's read. The context retains it.
+            (Does nothing in the null context, whose Values come from all sorts of data.) */
+        void setPlatformStringForValue(FLValue, PlatformString) const;
+
         inline MContext* retain() {
             ++_refCount;
             return this;
@@ -53,6 +70,8 @@ namespace fleece {
     private:
         std::atomic_uint _refCount {0};             // Reference count
         alloc_slice      _data;                     // Fleece data; ensures it doesn't go away
+        mutable std::mutex _platformStringsMutex;
+        mutable std::unordered_map<FLValue, PlatformString> _platformStrings; // Value->string
 
     private:
         MContext();
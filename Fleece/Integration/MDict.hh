@@ -18,6 +18,7 @@
 
 #pragma once
 #include "MCollection.hh"
+#include "InternedStrings.hh"
 #include <unordered_map>
 #include <vector>
 
@@ -35,11 +36,13 @@ namespace fleece {
         using MapType = std::unordered_map<slice, MValue, fleece::sliceHash>;
 
         /** Constructs an empty MDict not connected to any existing Fleece Dict. */
-        MDict() :MCollection() { }
+        MDict() :MCollection(true) { }
 
         /** Constructs an MDict that shadows a Dict stored in `mv` and contained in `parent`.
             This is what you'd call from MValue::toNative. */
-        MDict(MValue *mv, MCollection *parent) {
+        MDict(MValue *mv, MCollection *parent)
+        :MCollection(true)
+        {
             initInSlot(mv, parent);
         }
 
@@ -145,18 +148,41 @@ namespace fleece {
 
         using iterator = MDictIterator<Native>;     // defined in MDictIterator.hh
 
-        /** Writes the dictionary to an Encoder as a single Value. */
+        /** Writes the dictionary to an Encoder as a single Value.
+            Keys and values from the original Dict are written as the original Values, not by
+            content, so when the Encoder is amending the original data (see `MRoot::amend`) they
+            become pointers back into it, and the cost is proportional to what's changed. */
         void encodeTo(Encoder &enc) const {
             if (!MCollection::isMutated()) {
                 enc << _dict;
             } else {
                 enc.beginDict(count());
-                for (iterator i(*this); i; ++i) {
+                // First the keys of the original Dict, overwritten or not:
+                size_t mapEntriesSeen = 0;
+                for (Dict::iterator i(_dict); i; ++i) {
+                    const MValue *mv = nullptr;
+                    if (!_map.empty()) {
+                        if (auto m = _map.find(i.keyString()); m != _map.end()) {
+                            ++mapEntriesSeen;
+                            mv = &m->second;
+                            if (mv->isEmpty())
+                                continue;       // removed
+                        }
+                    }
                     enc.writeKey(i.key());
-                    if (i.value())
-                        enc.writeValue(i.value());
+                    if (!mv || mv->value())
+                        enc.writeValue(mv ? mv->value() : i.value());
                     else
-                        i.mvalue().encodeTo(enc);
+                        mv->encodeTo(enc);
+                }
+                // Then the new keys:
+                if (mapEntriesSeen < _map.size()) {
+                    for (auto &[key, mv] : _map) {
+                        if (!mv.isEmpty() && !_dict.get(key)) {
+                            enc.writeKey(key);
+                            mv.encodeTo(enc);
+                        }
+                    }
                 }
                 enc.endDict();
             }
@@ -164,8 +190,16 @@ namespace fleece {
 
     private:
         typename MDict::MapType::iterator _setInMap(slice key, const MValue &val) {
-            _newKeys.emplace_back(key);
-            key = _newKeys.back();
+            // If enabled, short keys are interned, so all the MDicts that use a key share one copy:
+            slice interned;
+            if (auto strings = InternedStrings::shared(); strings)
+                interned = strings->intern(key);
+            if (interned) {
+                key = interned;
+            } else {
+                _newKeys.emplace_back(key);
+                key = _newKeys.back();
+            }
             return _map.emplace(key, val).first;
         }
 
@@ -175,6 +209,7 @@ namespace fleece {
         uint32_t                 _count {0};// Current count
 
         friend MDictIterator<Native>;
+        friend MRoot<Native>;
     };
 
 }
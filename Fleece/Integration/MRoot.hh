@@ -16,7 +16,8 @@
 // limitations under the License.
 //
 
-#include "MCollection.hh"
+#include "MArray.hh"
+#include "MDict.hh"
 
 namespace fleece {
 
@@ -63,6 +64,15 @@ namespace fleece {
         MContext* context() const           {return MCollection::context();}
 
         Native asNative() const             {return _slot.asNative(this);}
+
+        /** Like `asNative`, but also creates the Native objects of every value in the tree, in
+            one pass over each Fleece collection instead of a lookup per item accessed later.
+            Worth it when the caller is going to visit most of the tree anyway. Only the items
+            whose `toNative` sets `cacheIt` are kept; collections always are. */
+        Native materializeAll() const {
+            return materialize(_slot, this);
+        }
+
         bool isMutated() const              {return _slot.isMutated();}
 
         void encodeTo(Encoder &enc) const   {_slot.encodeTo(enc);}
@@ -76,10 +86,51 @@ namespace fleece {
         }
 
     private:
+        using MValue = fleece::MValue<Native>;
+
+        static Native materialize(const MValue &mv, const MCollection *parent) {
+            Native native = mv.asNative(parent);
+            if (native) {
+                if (auto coll = MValue::collectionFromNative(native)) {
+                    if (coll->isDict())
+                        materializeDict(*static_cast<MDict<Native>*>(coll));
+                    else
+                        materializeArray(*static_cast<MArray<Native>*>(coll));
+                }
+            }
+            return native;
+        }
+
+        static void materializeArray(MArray<Native> &array) {
+            // An empty MValue at index i is always the unmodified item _array[i]:
+            Array::iterator iter(array._array);
+            for (auto &item : array._vec) {
+                if (item.isEmpty())
+                    item = iter.value();
+                materialize(item, &array);
+                if (iter)
+                    ++iter;
+            }
+        }
+
+        static void materializeDict(MDict<Native> &dict) {
+            if (dict._map.empty())
+                dict._map.reserve(dict._dict.count());
+            for (Dict::iterator iter(dict._dict); iter; ++iter) {
+                slice key = iter.keyString();
+                if (dict._map.empty() || dict._map.find(key) == dict._map.end())
+                    dict._setInMap(key, MValue(iter.value()));
+            }
+            for (auto &entry : dict._map) {
+                if (!entry.second.isEmpty())
+                    materialize(entry.second, &dict);
+            }
+        }
+
         MRoot(const MRoot&) =delete;
         MRoot& operator= (const MRoot &) =delete;
 
-        MValue<Native>  _slot;              // My contents: a holder for the actual root object
+        MValue          _slot;              // My contents: a holder for the actual root object
     };
 
 }
@@ -20,12 +20,14 @@
 #include "fleece/Fleece.hh"
 #include "fleece/Base.h"
 #include "fleece/slice.hh"
+#include <atomic>
 
 namespace fleece {
     using slice = fleece::slice;
     using alloc_slice = fleece::alloc_slice;
 
     template <class Native> class MCollection;
+    template <class Native> class MRoot;
 
 
     /** Stores a Value together with its native equivalent.
@@ -92,18 +94,45 @@ namespace fleece {
 
         Native asNative(const MCollection<Native> *parent) const {
             if (_native || !_value) {
+                if (_native)
+                    sReuses.fetch_add(1, std::memory_order_relaxed);
                 return _native;
             } else {
                 bool cacheIt = false;
                 Native n = toNative(const_cast<MValue*>(this),
                                     const_cast<MCollection<Native>*>(parent),
                                     cacheIt);
-                if (cacheIt)
+                sConversions.fetch_add(1, std::memory_order_relaxed);
+                if (cacheIt) {
+                    sCachedConversions.fetch_add(1, std::memory_order_relaxed);
                     _native = n;
+                }
                 return n;
             }
         }
 
+        /** Counts of what `asNative` has done (across all threads) since launch or the last
+            `resetStats`. A binding can use these to tune itself: lots of uncached conversions
+            suggest setting `cacheIt`, and a tree that's converted almost entirely is cheaper to
+            build all at once with `MRoot::materializeAll`. */
+        struct Stats {
+            uint64_t conversions;           ///< Calls to `toNative`
+            uint64_t cachedConversions;     ///< Conversions whose result was cached
+            uint64_t reuses;                ///< Calls answered with an existing Native object
+        };
+
+        static Stats stats() {
+            return {sConversions.load(std::memory_order_relaxed),
+                    sCachedConversions.load(std::memory_order_relaxed),
+                    sReuses.load(std::memory_order_relaxed)};
+        }
+
+        static void resetStats() {
+            sConversions = 0;
+            sCachedConversions = 0;
+            sReuses = 0;
+        }
+
         void encodeTo(Encoder &enc) const {
             assert(!isEmpty());
             if (_value)
@@ -156,6 +185,10 @@ namespace fleece {
 
         Value  _value;                      // Fleece value; null if I'm new or modified
         mutable Native _native {nullptr};   // Cached or new/modified native value
+
+        static inline std::atomic<uint64_t> sConversions {0}, sCachedConversions {0}, sReuses {0};
+
+        friend MRoot<Native>;
     };
 
 
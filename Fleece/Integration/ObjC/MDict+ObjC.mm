@@ -21,13 +21,30 @@
 #import "MDict.hh"
 #import "MDictIterator.hh"
 #include "PlatformCompat.hh"
+#include <algorithm>
 
 using namespace fleece;
 
 
+namespace fleece {
+
+    // Keys from the Fleece Dict are converted by its iterator, which caches the NSStrings of
+    // shared keys in the SharedKeys (see SharedKeys::platformStringForKey.)
+    template<>
+    id MDictIterator<id>::nativeKey() const {
+        if (_iteratingMap)
+            return _key.asNSString();
+        return _dictIter.keyAsNSString(nil);
+    }
+
+}
+
+
 @implementation FleeceDict
 {
     MDict<id> _dict;
+    NSArray* _keys;                 // All the keys, made on demand; cleared by any mutation
+    unsigned long _mutations;       // Incremented by every mutation, to detect it in for...in
 }
 
 
@@ -119,30 +136,43 @@ using namespace fleece;
 }
 
 
+- (void) mutated {
+    _keys = nil;
+    ++_mutations;
+}
+
+
 - (void)setObject:(id)value forKey:(id<NSCopying>)key {
     //[self checkNoParent: value];
     if (!_dict.set(nsstring_slice((NSString*)key), value))
         throwMutationException();
+    [self mutated];
 }
 
 
 - (void)removeObjectForKey:(id)key {
     if (!_dict.remove(nsstring_slice(key)))
         throwMutationException();
+    [self mutated];
 }
 
 
 - (void)removeAllObjects {
     if (!_dict.clear())
         throwMutationException();
+    [self mutated];
 }
 
 
+// Collects the keys in a single walk of the dictionary, and keeps them until it's mutated.
 - (NSArray*) allKeys {
-    NSMutableArray* keys = [NSMutableArray arrayWithCapacity: _dict.count()];
-    for (MDict<id>::iterator i(_dict); i; ++i)
-        [keys addObject: i.key().asNSString()];
-    return keys;
+    if (!_keys) {
+        NSMutableArray* keys = [NSMutableArray arrayWithCapacity: _dict.count()];
+        for (MDictIterator<id> i(_dict); i; ++i)
+            [keys addObject: i.nativeKey()];
+        _keys = [keys copy];
+    }
+    return _keys;
 }
 
 
@@ -153,44 +183,34 @@ using namespace fleece;
 
 - (void) enumerateKeysAndObjectsUsingBlock: (void (NS_NOESCAPE ^)(UU id key, UU id obj, BOOL *stop))block {
     __block BOOL stop = NO;
-    for (MDict<id>::iterator i(_dict); i; ++i) {
-        block(i.key().asNSString(), i.nativeValue(), &stop);
+    for (MDictIterator<id> i(_dict); i; ++i) {
+        block(i.nativeKey(), i.nativeValue(), &stop);
         if (stop)
             break;
     }
 }
 
 
-#if 0
-// Fast enumeration -- for(in) loops use this.
+// Fast enumeration -- for(in) loops use this. It fills the buffer from the keys collected by
+// allKeys, a batch at a time, instead of walking the dictionary again for every batch.
 - (NSUInteger) countByEnumeratingWithState: (NSFastEnumerationState *)state
                                    objects: (id __unsafe_unretained [])stackBuf
                                      count: (NSUInteger)stackBufCount
 {
     NSUInteger index = state->state;
     if (index == 0)
-        state->mutationsPtr = &state->extra[0]; // this has to be pointed to something non-nullptr
-    if (index >= _count)
+        state->mutationsPtr = &_mutations;  // so the loop fails if the dictionary is mutated
+    auto keys = (__bridge CFArrayRef)self.allKeys;
+    NSUInteger count = CFArrayGetCount(keys);
+    if (index >= count)
         return 0;
 
-    auto iter = _dict.begin();
-    iter += (uint32_t)index;
-    NSUInteger n = 0;
-    for (; iter; ++iter) {
-        NSString* key = [_document objectForValue: iter.key()];
-        if (key) {
-            CFAutorelease(CFBridgingRetain(key));
-            stackBuf[n++] = key;
-            if (n >= stackBufCount)
-                break;
-        }
-    }
-
+    NSUInteger n = std::min(stackBufCount, count - index);
+    CFArrayGetValues(keys, CFRange{CFIndex(index), CFIndex(n)}, (const void**)stackBuf);
     state->itemsPtr = stackBuf;
     state->state += n;
     return n;
 }
-#endif
 
 
 #if 0
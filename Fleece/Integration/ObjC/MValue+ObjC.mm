@@ -43,6 +43,16 @@ namespace fleece {
                 cacheIt = true;
                 return [[FleeceDict alloc] initWithMValue: mv
                                                  inParent: parent];
+            case kFLString: {
+                // The context caches NSStrings by Value, so a string is converted only once:
+                MContext *context = parent ? parent->context() : MContext::gNullContext;
+                FLValue value = mv->value();
+                if (auto str = context->platformStringForValue(value))
+                    return (__bridge NSString*)str;
+                NSString *str = mv->value().asNSObject();
+                context->setPlatformStringForValue(value, (__bridge CFStringRef)str);
+                return str;
+            }
             default:
                 return mv->value().asNSObject();
         }
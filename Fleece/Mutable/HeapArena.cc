@@ -0,0 +1,148 @@
+//
+// HeapArena.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "HeapArena.hh"
+#include "Allocator.hh"
+#include "betterassert.hh"
+#include <new>
+
+namespace fleece { namespace impl { namespace internal {
+
+    // Chunks are aligned to their size, so the chunk (and hence the arena) that a block belongs
+    // to can be found by masking the block's address.
+    static constexpr size_t kChunkSize = 16384;
+
+    // Bigger blocks than this are allocated from the heap, to avoid wasting the rest of a chunk.
+    static constexpr size_t kMaxBlockSize = kChunkSize / 8;
+
+    static constexpr size_t kBlockAlignment = alignof(std::max_align_t);
+
+    // Each chunk starts with a pointer to its arena.
+    struct ChunkHeader {
+        HeapArena* arena;
+    };
+
+    static constexpr size_t kChunkHeaderSize =
+                    (sizeof(ChunkHeader) + kBlockAlignment - 1) & ~(kBlockAlignment - 1);
+
+
+    static thread_local HeapArena* tCurrentArena = nullptr;
+    static thread_local bool tFreeingArenaBlock = false;
+
+
+    HeapArena::Scope::Scope(CopyFlags flags)
+    :_prevArena(tCurrentArena)
+    {
+        if (flags & (kCopyToArena | kCopySingleThreaded)) {
+            _arena = new HeapArena(flags & kCopySingleThreaded);
+            tCurrentArena = _arena;
+            _active = true;
+        }
+    }
+
+
+    HeapArena::Scope::Scope(HeapArena *arena)
+    :_prevArena(tCurrentArena)
+    {
+        if (arena) {
+            tCurrentArena = arena;
+            _active = true;
+        }
+    }
+
+
+    HeapArena::HeapArena(bool singleThreaded)
+    :_owner(std::this_thread::get_id())
+    ,_singleThreaded(singleThreaded)
+    { }
+
+
+    HeapArena::Scope::~Scope() {
+        if (_active)
+            tCurrentArena = _prevArena;
+    }
+
+
+    HeapArena::~HeapArena() {
+        for (void *chunk : _chunks)
+            heap::free(chunk, kChunkSize);
+    }
+
+
+    size_t HeapArena::memoryUsage() const noexcept {
+        return sizeof(HeapArena) + _chunks.size() * kChunkSize
+                                 + _chunks.capacity() * sizeof(void*);
+    }
+
+
+    void* HeapArena::allocate(size_t size) {
+        if (HeapArena *arena = tCurrentArena; arena && size <= kMaxBlockSize)
+            return arena->_allocate(size);
+        return heap::allocate(size);
+    }
+
+
+    void* HeapArena::_allocate(size_t size) {
+        size = (size + kBlockAlignment - 1) & ~(kBlockAlignment - 1);
+        if (size > size_t(_end - _next)) {
+            auto chunk = (uint8_t*) heap::allocate(kChunkSize, kChunkSize);
+            _chunks.push_back(chunk);
+            ((ChunkHeader*)chunk)->arena = this;
+            _next = chunk + kChunkHeaderSize;
+            _end = chunk + kChunkSize;
+        }
+        void *block = _next;
+        _next += size;
+        retain(this);                               // Each live block keeps me alive
+        return block;
+    }
+
+
+    bool HeapArena::_isInCurrentChunk(const void *block) const noexcept {
+        return !_chunks.empty() && block >= _chunks.back() && block < _end;
+    }
+
+
+    HeapArena* HeapArena::arenaOfNewBlock(const void *block) noexcept {
+        HeapArena *arena = tCurrentArena;
+        return (arena && arena->_isInCurrentChunk(block)) ? arena : nullptr;
+    }
+
+
+    HeapArena* HeapArena::arenaOf(const void *block) noexcept {
+        return ((ChunkHeader*)(size_t(block) & ~(kChunkSize - 1)))->arena;
+    }
+
+
+    void HeapArena::willFreeArenaBlock() noexcept {
+        tFreeingArenaBlock = true;
+    }
+
+
+    void HeapArena::free(void *block) noexcept {
+        // A block whose constructor threw is freed without being destructed, so it won't have
+        // been marked, but then it's the newest block of the current arena.
+        if (tFreeingArenaBlock || arenaOfNewBlock(block)) {
+            tFreeingArenaBlock = false;
+            release(arenaOf(block));
+        } else {
+            heap::free(block);
+        }
+    }
+
+} } }
@@ -0,0 +1,105 @@
+//
+// HeapArena.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "RefCounted.hh"
+#include "Value.hh"
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace fleece { namespace impl { namespace internal {
+
+    /** A bump allocator for the HeapValues of a mutable copy of a document, used when copying
+        with the kCopyToArena flag.
+
+        While a HeapArena::Scope is active on a thread, the HeapValues (including HeapArrays and
+        HeapDicts) created on that thread are carved out of large chunks, instead of each being
+        allocated from the heap. Such values are still ref-counted and destructed individually,
+        but freeing one doesn't free its memory: each value holds a reference to its arena, and
+        the arena frees all its chunks at once when the last value goes away.
+
+        Allocation is not thread-safe, but it only happens on the thread that owns the Scope.
+        Values can be freed on any thread -- unless the arena is single-threaded (kCopySingleThreaded),
+        in which case its values' ref-counts aren't atomic, and they may only be used on the thread
+        that created them. Debug builds check this. */
+    class HeapArena : public RefCounted {
+    public:
+        /** Routes HeapValue allocations on the current thread to a new arena, for its lifetime,
+            if `flags` includes kCopyToArena or kCopySingleThreaded. Scopes can nest. */
+        class Scope {
+        public:
+            explicit Scope(CopyFlags flags);
+
+            /** Routes HeapValue allocations on the current thread to `arena`, if non-null.
+                The caller must keep the arena alive for the Scope's lifetime. */
+            explicit Scope(HeapArena *arena);
+
+            ~Scope();
+        private:
+            Scope(const Scope&) =delete;
+            Scope& operator=(const Scope&) =delete;
+
+            Retained<HeapArena> _arena;             // The arena I created, if any
+            HeapArena* _prevArena;
+            bool _active {false};
+        };
+
+        /** Creates an arena for the strings stored into a tree of mutable collections
+            (see kCopyStringArena), which is used through a Scope when storing them. */
+        static Retained<HeapArena> newStringArena()  {return new HeapArena(false);}
+
+        /** Allocates a block from the current thread's arena, or from the heap if there is none
+            (or the block is too big.) */
+        static void* allocate(size_t size);
+
+        /** If `block` was just allocated by \ref allocate from an arena, returns the arena. */
+        static HeapArena* arenaOfNewBlock(const void *block) noexcept;
+
+        /** Returns the arena of a block that was allocated from one. */
+        static HeapArena* arenaOf(const void *block) noexcept;
+
+        bool singleThreaded() const                 {return _singleThreaded;}
+
+        /** The memory used by the arena, including its unused space. */
+        size_t memoryUsage() const noexcept;
+
+        /** True if this is the thread that created the arena. */
+        bool isOwnerThread() const                  {return std::this_thread::get_id() == _owner;}
+
+        /** Marks the block about to be freed, on this thread, as belonging to an arena. This must
+            be called during its destructor, while it's still known to be an arena block. */
+        static void willFreeArenaBlock() noexcept;
+
+        /** Frees a block allocated by \ref allocate. */
+        static void free(void *block) noexcept;
+
+    private:
+        explicit HeapArena(bool singleThreaded);
+        ~HeapArena();
+        void* _allocate(size_t size);
+        bool _isInCurrentChunk(const void *block) const noexcept;
+
+        std::vector<void*> _chunks;                 // All my chunks, the newest last
+        uint8_t* _next {nullptr};                   // Next free byte in the newest chunk
+        uint8_t* _end {nullptr};                    // End of the newest chunk
+        std::thread::id const _owner;               // Thread that created me
+        bool const _singleThreaded;                 // Are my values' ref-counts non-atomic?
+    };
+
+} } }
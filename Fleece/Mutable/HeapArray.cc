@@ -19,8 +19,11 @@
 #include "HeapArray.hh"
 #include "HeapDict.hh"
 #include "MutableArray.hh"
+#include "Counters.hh"
 #include "varint.hh"
 #include "betterassert.hh"
+#include <algorithm>
+#include <iterator>
 
 namespace fleece { namespace impl { namespace internal {
 
@@ -29,87 +32,194 @@ namespace fleece { namespace impl { namespace internal {
 
     HeapArray::HeapArray(const Array *a)
     :HeapCollection(kArrayTag)
-    ,_items(a ? a->count() : 0)
     {
         if (a) {
             if (a->isMutable()) {
-                auto ha = a->asMutable()->heapArray();
-                _items = ha->_items;
+                auto ha = a->heapArray();
+                if (ha->_changes) {
+                    _changes.reset(new changeMap(*ha->_changes));
+                    _sparseCount = ha->_sparseCount;
+                } else {
+                    _items.assign(ha->_items.begin() + ha->_front, ha->_items.end());
+                }
                 _source = ha->_source;
+                _sourceShift = ha->_sourceShift;
             } else {
                 _source = a;
+                if (a->count() >= kMinCountForSparse) {
+                    _changes.reset(new changeMap);
+                    _sparseCount = a->count();
+                } else {
+                    _items.resize(a->count());
+                }
+                counters::count(counters::kMutablePromotions);
             }
         }
     }
 
 
-    void HeapArray::populate(unsigned fromIndex) {
+    // Returns the slot of an item, which is empty if the item is unchanged. If the array is
+    // sparse, this adds it to _changes, unless there are so many it's time to materialize.
+    ValueSlot& HeapArray::itemSlot(uint32_t index) {
+        if (_changes) {
+            // (A map entry takes several times the memory of a slot in _items.)
+            if (_changes->size() < std::max(_sparseCount / 8, 8u))
+                return (*_changes)[index];
+            materialize();
+        }
+        return slot(index);
+    }
+
+
+    // Converts a sparse array to a regular one.
+    void HeapArray::materialize() {
+        if (!_changes)
+            return;
+        std::unique_ptr<changeMap> changes = std::move(_changes);
+        assert(_items.empty() && _front == 0 && _sourceShift == 0);
+        _items.resize(_sparseCount);
+        for (auto &change : *changes)
+            _items[change.first] = std::move(change.second);
+        _sparseCount = 0;
+    }
+
+
+    const Value* HeapArray::sourceItem(uint32_t index) const {
+        assert(_source);
+        return _source->get(uint32_t(int64_t(index) - _sourceShift));
+    }
+
+
+    // Copies unchanged items in the range from _source, before they're moved.
+    void HeapArray::populate(uint32_t fromIndex, uint32_t toIndex) {
         if (!_source)
             return;
-        auto dst = _items.begin() + fromIndex;
+        // (Items before _sourceShift were inserted, so they're never unchanged.)
+        if (_sourceShift > 0)
+            fromIndex = std::max(fromIndex, uint32_t(_sourceShift));
+        int64_t srcIndex = int64_t(fromIndex) - _sourceShift;
+        if (fromIndex >= toIndex || srcIndex >= _source->count())
+            return;
         Array::iterator src(_source);
-        for (src += fromIndex; src && dst != _items.end(); ++src, ++dst) {
-            if (!*dst)
-                dst->set(src.value());
+        src += uint32_t(srcIndex);
+        for (uint32_t i = fromIndex; i < toIndex && src; ++i, ++src) {
+            auto &dst = slot(i);
+            if (!dst)
+                dst.set(src.value());
         }
+    }
 
+
+    // Moves the items to make room for at least `n` more in front of them.
+    void HeapArray::growFront(uint32_t n) {
+        uint32_t room = std::max(n, count() / 2);
+        itemVector items;
+        items.reserve(room + count() + count() / 4);
+        items.resize(room);
+        std::move(_items.begin() + _front, _items.end(), std::back_inserter(items));
+        _items = std::move(items);
+        _front = room;
     }
 
 
     const Value* HeapArray::get(uint32_t index) {
         if (index >= count())
             return nullptr;
-        auto &item = _items[index];
-        if (item)
+        if (_changes) {
+            if (auto i = _changes->find(index); i != _changes->end() && i->second)
+                return i->second.asValue();
+        } else if (auto &item = slot(index); item) {
             return item.asValue();
-        assert(_source);
-        return _source->get(index);
+        }
+        return sourceItem(index);
     }
 
 
     void HeapArray::resize(uint32_t newSize) {
+        mutating();
         if (newSize == count())
             return;
-        _items.resize(newSize, ValueSlot(Null()));
+        if (_changes && newSize < _sparseCount) {
+            _changes->erase(_changes->lower_bound(newSize), _changes->end());
+            _sparseCount = newSize;
+        } else {
+            materialize();
+            _items.resize(_front + newSize, ValueSlot(Null()));
+        }
         setChanged(true);
     }
 
 
     void HeapArray::insert(uint32_t where, uint32_t n) {
+        mutating();
         throwIf(where > count(), OutOfRange, "insert position is past end of array");
         if (n == 0)
             return;
-        populate(where);
-        _items.insert(_items.begin() + where,  n, ValueSlot(Null()));
+        materialize();
+        if (where < count() / 2 && count() >= kMinCountForFrontRoom) {
+            // Nearer the front: move the items before `where` down, into the room at the front:
+            populate(0, where);
+            if (_front < n)
+                growFront(n);
+            auto front = _items.begin() + _front;
+            std::move(front, front + where, front - n);
+            _front -= n;
+            _sourceShift += n;
+            for (uint32_t i = where; i < where + n; ++i)
+                slot(i) = ValueSlot(Null());
+        } else {
+            populate(where, count());
+            _items.insert(_items.begin() + _front + where,  n, ValueSlot(Null()));
+        }
         setChanged(true);
     }
 
 
     void HeapArray::remove(uint32_t where, uint32_t n) {
+        mutating();
         throwIf(where + n > count(), OutOfRange, "remove range is past end of array");
         if (n == 0)
             return;
-        populate(where + n);
-        auto at = _items.begin() + where;
-        _items.erase(at, at + n);
+        if (_changes && where + n == _sparseCount) {
+            resize(where);
+            return;
+        }
+        materialize();
+        if (where < count() - (where + n) && count() >= kMinCountForFrontRoom) {
+            // Nearer the front: move the items before `where` up, leaving room at the front:
+            populate(0, where);
+            auto front = _items.begin() + _front;
+            std::move_backward(front, front + where, front + where + n);
+            for (auto i = front; i != front + n; ++i)
+                *i = ValueSlot();
+            _front += n;
+            _sourceShift -= n;
+        } else {
+            populate(where + n, count());
+            auto at = _items.begin() + _front + where;
+            _items.erase(at, at + n);
+        }
         setChanged(true);
     }
 
 
     HeapCollection* HeapArray::getMutable(uint32_t index, tags ifType) {
+        mutating();
         if (index >= count())
             return nullptr;
         Retained<HeapCollection> result = nullptr;
-        auto &mval = _items[index];
+        auto &mval = itemSlot(index);
         if (mval) {
             result = mval.makeMutable(ifType);
         } else if (_source) {
-            result = HeapCollection::mutableCopy(_source->get(index), ifType);
+            result = HeapCollection::mutableCopy(sourceItem(index), ifType);
             if (result)
-                _items[index].set(result->asValue());
+                mval.set(result->asValue());
         }
-        if (result)
+        if (result) {
+            shareStringArena(result);
             setChanged(true);
+        }
         return result;
     }
 
@@ -126,44 +236,116 @@ namespace fleece { namespace impl { namespace internal {
 
     ValueSlot& HeapArray::setting(uint32_t index) {
 #if DEBUG
-        assert_precondition(index<_items.size());
+        assert_precondition(index<count());
 #endif
+        mutating();
         setChanged(true);
-        return _items[index];
+        return settingSlot(itemSlot(index));
     }
 
 
     ValueSlot& HeapArray::appending() {
+        mutating();
         setChanged(true);
+        if (_changes) {
+            if (_changes->size() < std::max(_sparseCount / 8, 8u))
+                return settingSlot((*_changes)[_sparseCount++]);
+            materialize();
+        }
         _items.emplace_back();
-        return _items.back();
+        return settingSlot(_items.back());
     }
 
 
     const ValueSlot* HeapArray::first() {
-        populate(0);
-        return &_items.front();
+        if (!isFrozen()) {
+            materialize();
+            populate(0, count());
+        }
+        return _items.data() + _front;
+    }
+
+
+    void HeapArray::freezeContents() {
+        // Do what `first` would do on the first read, since it can't afterwards:
+        materialize();
+        populate(0, count());
+        for (uint32_t i = 0; i < count(); ++i) {
+            if (auto child = slot(i).asMutableCollection())
+                child->freeze();
+        }
     }
 
 
     void HeapArray::disconnectFromSource() {
+        mutating();
         if (!_source)
             return;
-        uint32_t index = 0;
-        for (auto &mval : _items) {
-            if (!mval)
-                mval.set(_source->get(index));
-            ++index;
-        }
+        materialize();
+        populate(0, count());
         _source = nullptr;
+        _sourceShift = 0;
+    }
+
+
+    const Array* HeapArray::unchangedSource() const {
+        if (!_source || _sourceShift != 0 || count() != _source->count())
+            return nullptr;
+        if (_changes) {
+            for (auto &change : *_changes) {
+                if (change.second)
+                    return nullptr;
+            }
+        } else {
+            for (auto i = _items.begin() + _front; i != _items.end(); ++i) {
+                if (*i)
+                    return nullptr;
+            }
+        }
+        return _source;
+    }
+
+
+    void HeapArray::addContentsMemoryUsage(MemoryTally &tally) const {
+        tally.addBytes(_items.capacity() * sizeof(ValueSlot));
+        for (auto i = _items.begin() + _front; i != _items.end(); ++i)
+            HeapValue::addMemoryUsage(i->asPointer(), tally);
+        if (_changes) {
+            tally.addBytes(sizeof(changeMap) + _changes->size() * (sizeof(changeMap::value_type)
+                                                                   + 4 * sizeof(void*)));
+            for (auto &change : *_changes)
+                HeapValue::addMemoryUsage(change.second.asPointer(), tally);
+        }
     }
 
 
     void HeapArray::copyChildren(CopyFlags flags) {
         if (flags & kCopyImmutables)
             disconnectFromSource();
-        for (auto &entry : _items)
+        if ((flags & (kDeepCopy | kCopyLazily | kCopyImmutables)) == (kDeepCopy | kCopyLazily)) {
+            // Lazy deep copy: share nested mutable collections until they're modified.
+            for (auto &entry : _items) {
+                if (auto child = entry.asMutableCollection())
+                    child->setCopyOnWrite(true);
+            }
+            if (_changes) {
+                for (auto &change : *_changes) {
+                    if (auto child = change.second.asMutableCollection())
+                        child->setCopyOnWrite(true);
+                }
+            }
+            return;
+        }
+        for (auto &entry : _items) {
             entry.copyValue(flags);
+            shareStringArena(entry.asMutableCollection());
+        }
+        if (_changes) {
+            for (auto &change : *_changes) {
+                change.second.copyValue(flags);
+                shareStringArena(change.second.asMutableCollection());
+            }
+        }
     }
 
 
@@ -171,10 +353,16 @@ namespace fleece { namespace impl { namespace internal {
 
 
     HeapArray::iterator::iterator(const HeapArray *ma) noexcept
-    :_iter(ma->_items.begin())
-    ,_iterEnd(ma->_items.end())
+    :_iter(ma->_items.begin() + ma->_front)
     ,_sourceIter(ma->_source)
+    ,_count(ma->count())
+    ,_sourceShift(ma->_sourceShift)
+    ,_sparse(ma->_changes != nullptr)
     {
+        if (_sparse) {
+            _change = ma->_changes->begin();
+            _changeEnd = ma->_changes->end();
+        }
         ++(*this);
     }
 
@@ -183,13 +371,18 @@ namespace fleece { namespace impl { namespace internal {
     { }
 
     HeapArray::iterator& HeapArray::iterator::operator ++() {
-        if (_iter == _iterEnd) {
+        if (_index >= _count) {
             _value = nullptr;
         } else {
-            _value = _iter->asValue();
+            if (_sparse) {
+                _value = nullptr;
+                if (_change != _changeEnd && _change->first == _index)
+                    _value = (_change++)->second.asValue();
+            } else {
+                _value = (_iter++)->asValue();
+            }
             if (!_value)
-                _value = _sourceIter[_index];
-            ++_iter;
+                _value = _sourceIter[uint32_t(int64_t(_index) - _sourceShift)];
             ++_index;
         }
         return *this;
@@ -7,6 +7,9 @@
 #pragma once
 #include "Array.hh"
 #include "ValueSlot.hh"
+#include "Allocator.hh"
+#include <map>
+#include <memory>
 #include <vector>
 #include "betterassert.hh"
 
@@ -18,6 +21,10 @@ namespace fleece { namespace impl {
 namespace fleece { namespace impl { namespace internal {
 
     class HeapArray : public HeapCollection {
+        using itemVector = std::vector<ValueSlot, heap::StdAllocator<ValueSlot>>;
+        using changeMap = std::map<uint32_t, ValueSlot, std::less<uint32_t>,
+                                   heap::StdAllocator<std::pair<const uint32_t, ValueSlot>>>;
+
     public:
         HeapArray()
         :HeapCollection(kArrayTag)
@@ -33,8 +40,10 @@ namespace fleece { namespace impl { namespace internal {
         static MutableArray* asMutableArray(HeapArray *a)   {return (MutableArray*)asValue(a);}
         MutableArray* asMutableArray() const        {return (MutableArray*)asValue();}
 
-        uint32_t count() const                      {return (uint32_t)_items.size();}
-        bool empty() const                          {return _items.empty();}
+        uint32_t count() const {
+            return _changes ? _sparseCount : uint32_t(_items.size() - _front);
+        }
+        bool empty() const                          {return count() == 0;}
 
         const Array* source() const                 {return _source;}
 
@@ -71,6 +80,12 @@ namespace fleece { namespace impl { namespace internal {
         void disconnectFromSource();
         void copyChildren(CopyFlags flags);
 
+        /** Returns the source Array if my contents are still identical to it, else nullptr. */
+        const Array* unchangedSource() const;
+
+        /** Adds the memory used by my items to the tally (see HeapValue::addMemoryUsage.) */
+        void addContentsMemoryUsage(MemoryTally&) const;
+
         class iterator {
         public:
             iterator(const HeapArray* NONNULL) noexcept;
@@ -86,9 +101,12 @@ namespace fleece { namespace impl { namespace internal {
 
         private:
             const Value* _value;
-            std::vector<ValueSlot>::const_iterator _iter, _iterEnd;
+            itemVector::const_iterator _iter;
+            changeMap::const_iterator _change, _changeEnd;
             Array::iterator _sourceIter;
-            uint32_t _index {0};
+            uint32_t _index {0}, _count;
+            int32_t _sourceShift;
+            bool _sparse;
         };
 
 
@@ -97,15 +115,41 @@ namespace fleece { namespace impl { namespace internal {
         friend class impl::MutableArray;
 
         ~HeapArray() =default;
-        const ValueSlot* first();          // Called by Array::impl
+        const ValueSlot* first();          // Called by Array::impl; materializes the items
 
     private:
-        void populate(unsigned fromIndex);
+        friend class HeapCollection;
+        void freezeContents();             // Called by HeapCollection::freeze
+
+        // Arrays smaller than this just insert and remove in place.
+        static constexpr uint32_t kMinCountForFrontRoom = 64;
+        // A copy of an Array at least this big starts out sparse (see _changes.)
+        static constexpr uint32_t kMinCountForSparse = 64;
+
+        ValueSlot& itemSlot(uint32_t index);
+        void materialize();
+
+        ValueSlot& slot(uint32_t index)             {return _items[_front + index];}
+        const Value* sourceItem(uint32_t index) const;
+        void populate(uint32_t fromIndex, uint32_t toIndex);
+        void growFront(uint32_t n);
         HeapCollection* getMutable(uint32_t index, tags ifType);
 
-        // _items stores each array item as a ValueSlot. If an item's type is 'undefined',
-        // that means the item is unchanged and its value can be found at the same index in _source.
-        std::vector<ValueSlot> _items;
+        // _items stores each array item as a ValueSlot, starting at _front; the empty slots
+        // before that are room to insert at the front without moving the rest of the items.
+        // If an item's type is 'undefined', that means the item is unchanged and its value can
+        // be found in _source, at its index minus _sourceShift. (Inserting or removing near the
+        // front moves the items before that point, and changes _sourceShift, so the items after
+        // it needn't be populated from _source first.)
+        itemVector _items;
+        uint32_t _front {0};
+        int32_t _sourceShift {0};
+
+        // A big copy of an Array is "sparse" at first: instead of _items it has _changes, which
+        // maps the indexes of changed items to their slots, and every other item is the one in
+        // _source. Inserting or removing items, or changing too many, materializes _items.
+        std::unique_ptr<changeMap> _changes;
+        uint32_t _sparseCount {0};              // count, while sparse
 
         // The original Array that this is a mutable copy of.
         RetainedConst<Array> _source;
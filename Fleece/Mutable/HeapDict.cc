@@ -20,24 +20,37 @@
 #include "HeapArray.hh"
 #include "ValueSlot.hh"
 #include "MutableDict.hh"
+#include "Counters.hh"
 #include "Encoder.hh"
 #include "SharedKeys.hh"
+#include "Doc.hh"
+#include "FleeceException.hh"
+#include "InternedStrings.hh"
 #include "betterassert.hh"
+#include <algorithm>
+#include <iterator>
 
 namespace fleece { namespace impl { namespace internal {
 
+    // Size of the chunks that new key strings are copied into.
+    static constexpr size_t kKeyChunkSize = 256;
+
+
     HeapDict::HeapDict(const Dict *d)
     :HeapCollection(kDictTag)
     {
         if (d) {
             _count = d->count();
             if (d->isMutable()) {
-                auto hd = d->asMutable()->heapDict();
+                auto hd = d->heapDict();
                 _source = hd->_source;
-                _map = hd->_map;
-                _backingSlices = hd->_backingSlices;
+                _map.reserve(hd->_map.size());
+                for (auto &entry : hd->_map)
+                    _map.emplace_back(entry.first, _newSlot(*entry.second));
+                _keyChunks = hd->_keyChunks;    // (but don't share the free space in the last one)
             } else {
                 _source = d;
+                counters::count(counters::kMutablePromotions);
             }
             if (_source)
                 _sharedKeys = _source->sharedKeys();
@@ -74,35 +87,96 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    HeapDict::keyMap::iterator HeapDict::_lowerBound(const key_t &key) const noexcept {
+        auto &map = const_cast<keyMap&>(_map);
+        return std::lower_bound(map.begin(), map.end(), key,
+                                [](const keyMap::value_type &item, const key_t &k) {
+            return item.first < k;
+        });
+    }
+
+
+    HeapDict::keyMap::iterator HeapDict::_find(const key_t &key) const noexcept {
+        auto it = _lowerBound(key);
+        if (it != _map.end() && it->first == key)
+            return it;
+        return const_cast<keyMap&>(_map).end();
+    }
+
+
     ValueSlot* HeapDict::_findValueFor(key_t key) const noexcept {
-        auto it = _map.find(key);
+        auto it = _find(key);
         if (it == _map.end())
             return nullptr;
-        return const_cast<ValueSlot*>(&it->second);
+        return it->second;
     }
 
 
     key_t HeapDict::_allocateKey(key_t key) {
         if (key.shared())
             return key;
-        alloc_slice allocedKey(key.asString());
-        _backingSlices.push_back(allocedKey);
-        return key_t(allocedKey);
+        // If enabled, short keys are interned, so all the Dicts that use a key share one copy:
+        if (auto strings = InternedStrings::shared(); strings) {
+            if (slice interned = strings->intern(key.asString()); interned)
+                return key_t(interned);
+        }
+        return key_t(_copyKeyString(key.asString()));
+    }
+
+
+    // Copies a key string into memory owned by this HeapDict. Keys are packed into chunks, so most
+    // new keys don't need a heap allocation of their own.
+    slice HeapDict::_copyKeyString(slice str) {
+        if (str.size > size_t(_keySpaceEnd - _keySpace)) {
+            if (str.size > kKeyChunkSize / 4) {
+                // Big keys get their own allocation, leaving the current chunk alone:
+                _keyChunks.emplace_back(str);
+                return _keyChunks.back();
+            }
+            _keyChunks.emplace_back(kKeyChunkSize);
+            _keySpace = (char*)_keyChunks.back().buf;
+            _keySpaceEnd = _keySpace + kKeyChunkSize;
+        }
+        slice result(_keySpace, str.size);
+        str.copyTo(_keySpace);
+        _keySpace += str.size;
+        return result;
     }
 
 
     ValueSlot& HeapDict::_makeValueFor(key_t key) {
         // Look in my map first:
-        auto it = _map.find(key);
-        if (it != _map.end())
-            return it->second;
+        auto it = _lowerBound(key);
+        if (it != _map.end() && it->first == key)
+            return *it->second;
         // If not in map, add it as an empty value:
-        return _map[key_t(_allocateKey(key))];                // creates a new value
+        key_t allocatedKey = _allocateKey(key);
+        return *_map.emplace(it, allocatedKey, _newSlot())->second;
+    }
+
+
+    // Returns a slot for a new key's value, initialized to `value`.
+    ValueSlot* HeapDict::_newSlot(const ValueSlot &value) {
+        if (!_freeSlots.empty()) {
+            ValueSlot *slot = _freeSlots.back();
+            _freeSlots.pop_back();
+            *slot = value;
+            return slot;
+        }
+        return &_slots.emplace_back(value);
+    }
+
+
+    // Releases the value of a removed key and saves its slot for reuse.
+    void HeapDict::_freeSlot(ValueSlot *slot) {
+        *slot = ValueSlot();
+        _freeSlots.push_back(slot);
     }
 
 
     // this is the innards of the set() method
     ValueSlot& HeapDict::setting(slice stringKey) {
+        mutating();
         key_t key;
         ValueSlot *slotp = _findValueFor(stringKey);
         if (slotp) {
@@ -114,7 +188,7 @@ namespace fleece { namespace impl { namespace internal {
         if (slotp->empty() && !(_source && _source->get(key)))
             ++_count;
         markChanged();
-        return *slotp;
+        return settingSlot(*slotp);
     }
 
 
@@ -128,9 +202,9 @@ namespace fleece { namespace impl { namespace internal {
 
 
     const Value* HeapDict::get(int key) const noexcept {
-        auto it = _map.find(key);
+        auto it = _find(key);
         if (it != _map.end())
-            return it->second.asValue();
+            return it->second->asValue();
         else
             return _source ? _source->get(key) : nullptr;
     }
@@ -146,15 +220,16 @@ namespace fleece { namespace impl { namespace internal {
 
 
     const Value* HeapDict::get(const key_t &key) const noexcept {
-        auto it = _map.find(key);
+        auto it = _find(key);
         if (it != _map.end())
-            return it->second.asValue();
+            return it->second->asValue();
         else
             return _source ? _source->get(key) : nullptr;
     }
 
 
     HeapCollection* HeapDict::getMutable(slice stringKey, tags ifType) {
+        mutating();
         key_t key = encodeKey(stringKey);
         Retained<HeapCollection> result;
         ValueSlot* mval = _findValueFor(key);
@@ -163,28 +238,34 @@ namespace fleece { namespace impl { namespace internal {
         } else if (_source) {
             result = HeapCollection::mutableCopy(_source->get(key), ifType);
             if (result)
-                _map.emplace(_allocateKey(key), result.get());
+                _makeValueFor(key) = ValueSlot(result.get());
         }
-        if (result)
+        if (result) {
+            shareStringArena(result);
             markChanged();
+        }
         return result;
     }
 
 
     void HeapDict::remove(slice stringKey) {
+        mutating();
         key_t key = encodeKey(stringKey);
         if (_source && _source->get(key)) {
-            auto it = _map.find(key);
+            auto it = _find(key);
             if (it != _map.end()) {
-                if (_usuallyFalse(!it->second))
+                if (_usuallyFalse(!*it->second))
                     return;                             // already removed
-                it->second = ValueSlot();
+                *it->second = ValueSlot();
             } else {
                 _makeValueFor(key);
             }
         } else {
-            if (_usuallyFalse(!_map.erase(key)))        //OPT: key remains in _backingSlices
+            auto it = _find(key);
+            if (_usuallyFalse(it == _map.end()))
                 return;
+            _freeSlot(it->second);
+            _map.erase(it);                             //OPT: key remains in _keyChunks
         }
         --_count;
         markChanged();
@@ -192,10 +273,14 @@ namespace fleece { namespace impl { namespace internal {
 
 
     void HeapDict::removeAll() {
+        mutating();
         if (_count == 0)
             return;
         _map.clear();
-        _backingSlices.clear();
+        _slots.clear();
+        _freeSlots.clear();
+        _keyChunks.clear();
+        _keySpace = _keySpaceEnd = nullptr;
         if (_source) {
             for (Dict::iterator i(_source); i; ++i)
                 _makeValueFor(i.keyt());    // override source with empty values
@@ -219,6 +304,16 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    void HeapDict::freezeContents() {
+        for (auto &entry : _map) {
+            if (auto child = entry.second->asMutableCollection())
+                child->freeze();
+        }
+        // Build the array that Array::impl would otherwise build on the first read:
+        kvArray()->freeze();
+    }
+
+
     bool HeapDict::tooManyAncestors() const {
         auto grampaw = _source->getParent();
         return grampaw && grampaw->getParent();
@@ -226,12 +321,15 @@ namespace fleece { namespace impl { namespace internal {
 
 
     void HeapDict::writeTo(Encoder &enc) {
-        if (enc.valueIsInBase(_source) && _map.size() + 1 < count() && !tooManyAncestors()) {
+        if (auto source = unchangedSource(); source && enc.valueIsInBase(source)) {
+            // I'm unchanged, so just point to the original:
+            enc.writeValue(source);
+        } else if (enc.valueIsInBase(_source) && _map.size() + 1 < count() && !tooManyAncestors()) {
             // Write just the changed keys, with _source as parent:
             enc.beginDictionary(_source, _map.size());
             for (auto &i : _map) {
                 enc.writeKey(i.first);
-                enc.writeValue(i.second.asValueOrUndefined());
+                enc.writeValue(i.second->asValueOrUndefined());
             }
             enc.endDictionary();
         } else {
@@ -246,23 +344,79 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    alloc_slice HeapDict::amend(bool reuseStrings, bool externPointers) const {
+        RetainedConst<Doc> doc = _source ? Doc::containing(_source) : nullptr;
+        throwIf(!doc, EncodeError, "Dict has no source document to amend");
+        Encoder enc;
+        enc.setSharedKeys(doc->sharedKeys());
+        enc.setBase(doc->data(), externPointers);
+        if (reuseStrings)
+            enc.reuseBaseStrings();
+        enc.writeValue(asValue());
+        return enc.finish();
+    }
+
+
     void HeapDict::disconnectFromSource() {
+        mutating();
         if (!_source)
             return;
+        // Merge the source's items into mine. Both are sorted, so this is a single pass, and
+        // where both have a key, mine wins (even if it's a tombstone.)
+        keyMap merged;
+        merged.reserve(_map.size() + _source->count());
+        auto mine = _map.begin();
+        bool changed = false;
         for (Dict::iterator i(_source); i; ++i) {
-            slice key = i.keyString();
-            if (_map.find(key) == _map.end())
-                set(key, i.value());
+            key_t key = i.keyt();
+            while (mine != _map.end() && mine->first < key)
+                merged.push_back(std::move(*mine++));
+            if (mine != _map.end() && mine->first == key) {
+                merged.push_back(std::move(*mine++));
+            } else if (!key.shared() || _find(key_t(i.keyString())) == _map.end()) {
+                // (A shared key may also be present in my map in string form; see _findValueFor)
+                key_t allocatedKey = _allocateKey(key);
+                merged.emplace_back(allocatedKey, _newSlot()).second->set(i.value());
+                changed = true;
+            }
         }
+        std::move(mine, _map.end(), std::back_inserter(merged));
+        _map = std::move(merged);
         _source = nullptr;
+        if (changed)
+            markChanged();
     }
 
 
     void HeapDict::copyChildren(CopyFlags flags) {
         if (flags & kCopyImmutables)
             disconnectFromSource();
+        if ((flags & (kDeepCopy | kCopyLazily | kCopyImmutables)) == (kDeepCopy | kCopyLazily)) {
+            // Lazy deep copy: share nested mutable collections until they're modified.
+            for (auto &entry : _map) {
+                if (auto child = entry.second->asMutableCollection())
+                    child->setCopyOnWrite(true);
+            }
+            return;
+        }
+        for (auto &entry : _map) {
+            entry.second->copyValue(flags);
+            shareStringArena(entry.second->asMutableCollection());
+        }
+    }
+
+
+    void HeapDict::addContentsMemoryUsage(MemoryTally &tally) const {
+        tally.addBytes(_map.capacity() * sizeof(keyMap::value_type)
+                       + _slots.size() * sizeof(ValueSlot)
+                       + _freeSlots.capacity() * sizeof(ValueSlot*)
+                       + _keyChunks.capacity() * sizeof(alloc_slice));
+        for (auto &chunk : _keyChunks)
+            tally.addBytes(chunk.size);
         for (auto &entry : _map)
-            entry.second.copyValue(flags);
+            HeapValue::addMemoryUsage(entry.second->asPointer(), tally);
+        if (_iterable)
+            HeapValue::addMemoryUsage(_iterable->asValue(), tally);
     }
 
 
@@ -316,11 +470,11 @@ namespace fleece { namespace impl { namespace internal {
                 getSource();
                 return *this;
             } else {
-                bool exists = !!(_newIter->second);
+                bool exists = !!(*_newIter->second);
                 if (_usuallyTrue(exists)) {
                     // Key from _map is lower or equal, and its value exists, so add its pair:
                     decodeKey(_newIter->first);
-                    _value = _newIter->second.asValue();
+                    _value = _newIter->second->asValue();
                 }
                 if (_sourceActive && _sourceKey == _newIter->first) {
                     ++_sourceIter;
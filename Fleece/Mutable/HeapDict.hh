@@ -8,8 +8,10 @@
 #include "Dict.hh"
 #include "ValueSlot.hh"
 #include "SharedKeys.hh"
+#include "Allocator.hh"
 #include <deque>
-#include <map>
+#include <utility>
+#include <vector>
 
 namespace fleece { namespace impl {
     class Encoder;
@@ -58,10 +60,31 @@ namespace fleece { namespace impl { namespace internal {
         void disconnectFromSource();
         void copyChildren(CopyFlags flags);
 
+        /** Adds the memory used by my keys and values to the tally (see
+            HeapValue::addMemoryUsage.) */
+        void addContentsMemoryUsage(MemoryTally&) const;
+
         void writeTo(Encoder&);
 
+        /** Returns the source Dict if my contents are still identical to it, else nullptr. */
+        const Dict* unchangedSource() const        {return _map.empty() ? _source.get() : nullptr;}
+
+        /** Encodes me as a delta to the Doc containing my source: Fleece data that has to be
+            appended to the Doc's data (or, with `externPointers`, used with it as extern
+            destination) to be read. Unchanged values, including unchanged nested collections,
+            are written as pointers back into the Doc, so the cost is proportional to the size of
+            the changes, not of the whole document.
+            Throws if my source isn't in a Doc. */
+        alloc_slice amend(bool reuseStrings =false, bool externPointers =false) const;
+
 
-        using keyMap = std::map<key_t, ValueSlot>;
+        /** The changed keys and their value slots, sorted by key. This is a sorted vector rather
+            than a tree, since a mutable Dict typically only changes a few keys, and a binary
+            search of contiguous memory beats walking individually-allocated nodes. The slots
+            themselves are in `_slots`, which never moves them, so Values and ValueSlot references
+            returned for a key stay valid while other keys are added or removed. */
+        using keyMap = std::vector<std::pair<key_t, ValueSlot*>,
+                                   heap::StdAllocator<std::pair<key_t, ValueSlot*>>>;
 
 
         class iterator {
@@ -104,20 +127,30 @@ namespace fleece { namespace impl { namespace internal {
         HeapArray* kvArray();
 
     private:
+        friend class HeapCollection;
+        void freezeContents();                      // Called by HeapCollection::freeze
         key_t encodeKey(slice) const noexcept;
         void markChanged();
         key_t _allocateKey(key_t key);
+        slice _copyKeyString(slice);
+        keyMap::iterator _lowerBound(const key_t&) const noexcept;
+        keyMap::iterator _find(const key_t&) const noexcept;
         ValueSlot* _findValueFor(slice keyToFind) const noexcept;
         ValueSlot* _findValueFor(key_t keyToFind) const noexcept;
         ValueSlot& _makeValueFor(key_t key);
+        ValueSlot* _newSlot(const ValueSlot& =ValueSlot());
+        void _freeSlot(ValueSlot*);
         HeapCollection* getMutable(slice key, tags ifType);
         bool tooManyAncestors() const;
 
         uint32_t _count {0};                        // Dict's actual count
         RetainedConst<Dict> _source;                // Original Dict I shadow, if any
         Retained<SharedKeys> _sharedKeys;           // Namespace of integer keys
-        keyMap _map;                                // Actual storage of key-value pairs
-        std::deque<alloc_slice> _backingSlices;     // Backing storage of key slices
+        std::deque<ValueSlot, heap::StdAllocator<ValueSlot>> _slots; // Storage of values in _map
+        std::vector<ValueSlot*> _freeSlots;         // Slots of removed keys, to reuse
+        keyMap _map;                                // Changed keys, and their slots
+        std::vector<alloc_slice> _keyChunks;        // Backing storage of key slices
+        char *_keySpace {nullptr}, *_keySpaceEnd {nullptr}; // Unused part of last key chunk
         Retained<HeapArray> _iterable;              // All key-value pairs in sequence, for iterator
     };
     
@@ -17,8 +17,10 @@
 //
 
 #include "HeapValue.hh"
+#include "HeapArena.hh"
 #include "HeapArray.hh"
 #include "HeapDict.hh"
+#include "Counters.hh"
 #include "Doc.hh"
 #include "FleeceException.hh"
 #include "varint.hh"
@@ -38,16 +40,63 @@ namespace fleece { namespace impl { namespace internal {
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
-        return ::operator new(size + valueSize);
+        counters::count(counters::kHeapValues);
+        return HeapArena::allocate(size + valueSize);
     }
 
 
-    HeapValue::HeapValue(tags tag, int tiny) {
-        _pad = 0xFF;
+    void* HeapValue::operator new(size_t size) {
+        counters::count(counters::kHeapValues);
+        return HeapArena::allocate(size);
+    }
+
+
+    void HeapValue::operator delete(void* ptr) {
+        HeapArena::free(ptr);
+    }
+
+
+    HeapValue::HeapValue() {
+        if (auto arena = HeapArena::arenaOfNewBlock(this))
+            _pad = arena->singleThreaded() ? kSingleThreadedPad : kArenaPad;
+        else
+            _pad = kPad;
+    }
+
+
+    HeapValue::HeapValue(tags tag, int tiny)
+    :HeapValue()
+    {
         _header = uint8_t((tag << 4) | tiny);
     }
 
 
+    HeapValue::~HeapValue() {
+        if (_pad != kPad)
+            HeapArena::willFreeArenaBlock();    // tells operator delete not to free the memory
+    }
+
+
+    void HeapValue::_retainValue() const {
+        if (_usuallyFalse(_pad == kSingleThreadedPad)) {
+            assert(HeapArena::arenaOf(this)->isOwnerThread());  // single-threaded value
+            _unsharedRetain();
+        } else {
+            fleece::retain(this);
+        }
+    }
+
+
+    void HeapValue::_releaseValue() const {
+        if (_usuallyFalse(_pad == kSingleThreadedPad)) {
+            assert(HeapArena::arenaOf(this)->isOwnerThread());  // single-threaded value
+            _unsharedRelease();
+        } else {
+            fleece::release(this);
+        }
+    }
+
+
     HeapValue* HeapValue::create(tags tag, int tiny, slice extraData) {
         auto hv = new (extraData.size) HeapValue(tag, tiny);
         extraData.copyTo(&hv->_header + 1);
@@ -146,7 +195,8 @@ namespace fleece { namespace impl { namespace internal {
         if (!isHeapValue(v))
             return nullptr;
         auto ov = (offsetValue*)(size_t(v) & ~1);
-        assert_postcondition(ov->_pad == 0xFF);
+        assert_postcondition(ov->_pad == kPad || ov->_pad == kArenaPad
+                             || ov->_pad == kSingleThreadedPad);
         return (HeapValue*)ov;
     }
 
@@ -160,7 +210,7 @@ namespace fleece { namespace impl { namespace internal {
 
     const Value* HeapValue::retain(const Value *v) {
         if (internal::HeapValue::isHeapValue(v)) {
-            fleece::retain(HeapValue::asHeapValue(v));
+            HeapValue::asHeapValue(v)->_retainValue();
         } else if (v) {
             RetainedConst<Doc> doc = Doc::containing(v);
             if (_usuallyTrue(doc != nullptr))
@@ -175,7 +225,7 @@ namespace fleece { namespace impl { namespace internal {
 
     void HeapValue::release(const Value *v) {
         if (internal::HeapValue::isHeapValue(v)) {
-            fleece::release(HeapValue::asHeapValue(v));
+            HeapValue::asHeapValue(v)->_releaseValue();
         } else if (v) {
             RetainedConst<Doc> doc = Doc::containing(v);
             if (_usuallyTrue(doc != nullptr))
@@ -188,6 +238,106 @@ namespace fleece { namespace impl { namespace internal {
     }
 
 
+    void MemoryTally::addArena(const HeapArena *arena) {
+        if (arena && firstVisit(arena))
+            addBytes(arena->memoryUsage());
+    }
+
+
+    void HeapValue::addMemoryUsage(const Value *v, MemoryTally &tally) {
+        if (!isHeapValue(v))
+            return;
+        HeapValue *hv = asHeapValue(v);
+        if (!tally.firstVisit(hv))
+            return;
+        size_t size;
+        switch (hv->tag()) {
+            case kArrayTag: {
+                auto array = (HeapArray*)hv;
+                size = sizeof(HeapArray);
+                tally.addArena(array->stringArena());
+                array->addContentsMemoryUsage(tally);
+                break;
+            }
+            case kDictTag: {
+                auto dict = (HeapDict*)hv;
+                size = sizeof(HeapDict);
+                tally.addArena(dict->stringArena());
+                dict->addContentsMemoryUsage(tally);
+                break;
+            }
+            default:
+                // The Value's data starts at _header, which is part of the object:
+                size = sizeof(HeapValue) + v->dataSize() - 1;
+                break;
+        }
+        // A value allocated in an arena takes up part of the arena's memory instead:
+        if (hv->_pad == kPad)
+            tally.addBytes(size);
+        else
+            tally.addArena(HeapArena::arenaOf(hv));
+    }
+
+
+    ValueSlot& HeapCollection::settingSlot(ValueSlot &slot) {
+        if (_stringArena)
+            slot.useStringArena(_stringArena);
+        return slot;
+    }
+
+
+    HeapCollection* HeapCollection::copyOnWriteIn(ValueSlot &slot) {
+        if (!_copyOnWrite && !_frozen)
+            return this;
+        if (!_frozen && refCount() <= 1) {
+            // Only `slot` refers to me, so I'm not shared any more:
+            _copyOnWrite = false;
+            return this;
+        }
+        Retained<HeapCollection> copy;
+        if (tag() == kArrayTag) {
+            auto ha = new HeapArray((const Array*)asValue());
+            ha->copyChildren(CopyFlags(kDeepCopy | kCopyLazily));
+            copy = ha;
+        } else {
+            auto hd = new HeapDict((const Dict*)asValue());
+            hd->copyChildren(CopyFlags(kDeepCopy | kCopyLazily));
+            copy = hd;
+        }
+        slot.set(copy->asValue());
+        return copy;
+    }
+
+
+    void HeapCollection::freeze() {
+        if (_frozen)
+            return;
+        // Values in a single-threaded arena have non-atomic ref-counts:
+        throwIf(isSingleThreaded(), InternalError, "can't freeze a single-threaded copy");
+        if (tag() == kArrayTag)
+            ((HeapArray*)this)->freezeContents();
+        else
+            ((HeapDict*)this)->freezeContents();
+        _copyOnWrite = false;
+        _frozen = true;
+    }
+
+
+    Retained<HeapCollection> HeapCollection::snapshot() {
+        if (_frozen)
+            return this;
+        // Copying just copies my item slots; then freezing the copy freezes the nested
+        // collections that it shares with me, so I'll copy them before changing them:
+        Retained<HeapCollection> snap;
+        if (tag() == kArrayTag)
+            snap = new HeapArray((const Array*)asValue());
+        else
+            snap = new HeapDict((const Dict*)asValue());
+        snap->freeze();
+        return snap;
+    }
+
+
     Retained<HeapCollection> HeapCollection::mutableCopy(const Value *v, tags ifType) {
         if (!v || v->tag() != ifType)
             return nullptr;
@@ -7,6 +7,8 @@
 #pragma once
 #include "Value.hh"
 #include "RefCounted.hh"
+#include "HeapArena.hh"
+#include <unordered_set>
 
 namespace fleece { namespace impl {
     class ValueSlot;
@@ -15,7 +17,11 @@ namespace fleece { namespace impl {
         using namespace fleece::impl;
 
         struct offsetValue {
-            uint8_t _pad = 0xFF;                // Unused byte, to ensure _header is at an odd address
+            static constexpr uint8_t kPad = 0xFF,               // Normal value
+                                     kArenaPad = 0xFE,          // Allocated in a HeapArena
+                                     kSingleThreadedPad = 0xFC; // ... a single-threaded one
+
+            uint8_t _pad = kPad;                // Unused byte, to ensure _header is at an odd address
             uint8_t _header;                    // Value header byte (tag | tiny)
 //          uint8_t _data[0];                   // Extra Value data (object is dynamically sized)
 
@@ -26,6 +32,20 @@ namespace fleece { namespace impl {
             offsetValue& operator=(const offsetValue&) = delete;
         };
 
+        /** Adds up the heap memory used by mutable values. Each value, and each HeapArena values
+            were allocated from, is counted once, since subtrees may be shared by copies. */
+        class MemoryTally {
+        public:
+            size_t bytes() const                        {return _bytes;}
+            void addBytes(size_t n)                     {_bytes += n;}
+            bool firstVisit(const void *p)              {return _seen.insert(p).second;}
+            void addArena(const HeapArena*);
+
+        private:
+            std::unordered_set<const void*> _seen;
+            size_t _bytes {0};
+        };
+
         /** Stores a Value in a heap block.
             The actual Value data is offset by 1 byte, so that pointers to it are tagged. */
         class HeapValue : public RefCounted, offsetValue {
@@ -51,19 +71,28 @@ namespace fleece { namespace impl {
             static const Value* retain(const Value *v);
             static void release(const Value *v);
 
-            void* operator new(size_t size)                 {return ::operator new(size);}
-            void operator delete(void* ptr)                 {::operator delete(ptr);}
-            void operator delete(void* ptr, size_t size)    {::operator delete(ptr);}
+            /** If the Value is a HeapValue, adds the memory it uses to the tally -- and if it's a
+                mutable collection, that of its contents. Immutable Values belong to their Doc,
+                so they aren't counted. */
+            static void addMemoryUsage(const Value*, MemoryTally&);
+
+            void* operator new(size_t size);
+            void operator delete(void* ptr);
+            void operator delete(void* ptr, size_t size)    {operator delete(ptr);}
         protected:
-            ~HeapValue() =default;
+            ~HeapValue();
             static HeapValue* create(tags tag, int tiny, slice extraData);
             HeapValue(tags tag, int tiny);
             tags tag() const                            {return tags(_header >> 4);}
+            bool isSingleThreaded() const               {return _pad == kSingleThreadedPad;}
         private:
+            void _retainValue() const;
+            void _releaseValue() const;
+
             friend class fleece::impl::ValueSlot;
 
             static void* operator new(size_t size, size_t extraSize);
-            HeapValue() =default;
+            HeapValue();
             static HeapValue* createStr(internal::tags, slice s);
             template <class INT> static HeapValue* createInt(INT, bool isUnsigned);
         };
@@ -77,6 +106,52 @@ namespace fleece { namespace impl {
 
             bool isChanged() const FLPURE                          {return _changed;}
 
+            /** True if this collection may be shared by a lazy deep copy (see kCopyLazily), so
+                it has to be copied before it's modified through a parent. */
+            bool isCopyOnWrite() const FLPURE                      {return _copyOnWrite;}
+            void setCopyOnWrite(bool c)                     {if (!_frozen) _copyOnWrite = c;}
+
+            /** True if this collection is copy-on-write and still shared, so it mustn't be
+                modified directly, only after its parent's getMutable* has copied it. */
+            bool isSharedCopyOnWrite() const FLPURE        {return _copyOnWrite && refCount() > 1;}
+
+            /** If this collection is copy-on-write and is also referenced from elsewhere than
+                `slot`, or is frozen, replaces the slot's value with a copy of it (whose children
+                are in turn copy-on-write), and returns the copy. Otherwise returns itself. */
+            HeapCollection* copyOnWriteIn(ValueSlot &slot);
+
+            /** True if this collection has been frozen (see \ref freeze.) */
+            bool isFrozen() const FLPURE                           {return _frozen;}
+
+            /** Makes this collection, and the mutable collections nested in it, permanently
+                read-only: the lazily-built state that reads would otherwise create is built now,
+                so from here on reading it has no side effects, and it can be read from any
+                number of threads at once without locking. Any attempt to modify it throws.
+                A frozen collection can still be copied, and the copy is mutable; a mutable
+                collection containing a frozen one copies it before modifying it. */
+            void freeze();
+
+            /** Returns a frozen copy of this collection, sharing everything nested in it: the
+                nested mutable collections are frozen, so this one copies each before changing it
+                (and so on down the path to a change.) Only my own items are copied, so a snapshot
+                costs no more than a copy of this one node, however big the tree below it; and
+                after it, each change costs a copy of the nodes on its path, just once. A frozen
+                collection is its own snapshot.
+                Mutable collections nested in this one that are referenced elsewhere become frozen
+                too, so further changes should be made through this collection. */
+            Retained<HeapCollection> snapshot();
+
+            /** The arena that strings stored into this collection are allocated from, if any.
+                It's shared with the mutable collections nested in this one. */
+            HeapArena* stringArena() const FLPURE                  {return _stringArena;}
+            void setStringArena(Retained<HeapArena> a)             {_stringArena = std::move(a);}
+
+            /** Gives a nested collection my string arena, if it doesn't have one. */
+            void shareStringArena(HeapCollection *child) const {
+                if (_stringArena && child && !child->_stringArena)
+                    child->_stringArena = _stringArena;
+            }
+
         protected:
             HeapCollection(internal::tags tag)
             :HeapValue(tag, 0)
@@ -87,8 +162,19 @@ namespace fleece { namespace impl {
 
             void setChanged(bool c)                         {_changed = c;}
 
+            /** Throws if I'm frozen. Called before every modification. */
+            void mutating() const {
+                throwIf(_frozen, InternalError, "can't modify a frozen collection");
+            }
+
+            /** Returns `slot`, after making sure a string stored in it will use my arena. */
+            ValueSlot& settingSlot(ValueSlot &slot);
+
         private:
+            Retained<HeapArena> _stringArena;
             bool _changed {false};
+            bool _copyOnWrite {false};
+            bool _frozen {false};
         };
 
     } // end internal namespace
@@ -9,6 +9,7 @@
 #pragma once
 #include "Array.hh"
 #include "HeapArray.hh"
+#include "HeapArena.hh"
 
 namespace fleece { namespace impl {
     class MutableDict;
@@ -25,8 +26,11 @@ namespace fleece { namespace impl {
         /** Creates a copy of `a`, or an empty array if `a` is null.
             If `deepCopy` is true, nested mutable collections will be recursively copied too. */
         static Retained<MutableArray> newArray(const Array *a, CopyFlags flags =kDefaultCopy) {
+            internal::HeapArena::Scope arena(flags);
             auto ha = retained(new internal::HeapArray(a));
-            if (flags)
+            if (flags & kCopyStringArena)
+                ha->setStringArena(internal::HeapArena::newStringArena());
+            if (flags & (kDeepCopy | kCopyImmutables))
                 ha->copyChildren(flags);
             return ha->asMutableArray();
         }
@@ -37,6 +41,25 @@ namespace fleece { namespace impl {
         bool isChanged() const                      {return heapArray()->isChanged();}
         void setChanged(bool changed)               {heapArray()->setChanged(changed);}
 
+        /** Makes this Array and everything in it read-only, and safe to read from many threads
+            at once; see \ref internal::HeapCollection::freeze. */
+        void freeze()                               {heapArray()->freeze();}
+        bool isFrozen() const                       {return heapArray()->isFrozen();}
+
+        /** Returns a frozen snapshot of this Array's current state, sharing its nested
+            collections; see \ref internal::HeapCollection::snapshot. */
+        Retained<MutableArray> snapshot() {
+            return (MutableArray*)heapArray()->snapshot()->asValue();
+        }
+
+        /** The heap memory used by this Array and the mutable values in it, counting shared
+            ones and string arenas once; not including its source's Doc. */
+        size_t memoryUsage() const {
+            internal::MemoryTally tally;
+            internal::HeapValue::addMemoryUsage(this, tally);
+            return tally.bytes();
+        }
+
         ValueSlot& setting(uint32_t index)          {return heapArray()->setting(index);}
         ValueSlot& inserting(uint32_t index)        {return heapArray()->inserting(index);}
         ValueSlot& appending()                      {return heapArray()->appending();}
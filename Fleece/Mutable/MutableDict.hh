@@ -7,6 +7,7 @@
 #pragma once
 #include "Dict.hh"
 #include "HeapDict.hh"
+#include "HeapArena.hh"
 
 namespace fleece { namespace impl {
     class MutableArray;
@@ -16,8 +17,11 @@ namespace fleece { namespace impl {
     public:
 
         static Retained<MutableDict> newDict(const Dict *d =nullptr, CopyFlags flags =kDefaultCopy) {
+            internal::HeapArena::Scope arena(flags);
             auto hd = retained(new internal::HeapDict(d));
-            if (flags)
+            if (flags & kCopyStringArena)
+                hd->setStringArena(internal::HeapArena::newStringArena());
+            if (flags & (kDeepCopy | kCopyImmutables))
                 hd->copyChildren(flags);
             return hd->asMutableDict();
         }
@@ -28,6 +32,25 @@ namespace fleece { namespace impl {
         bool isChanged() const                              {return heapDict()->isChanged();}
         void setChanged(bool changed)                       {heapDict()->setChanged(changed);}
 
+        /** Makes this Dict and everything in it read-only, and safe to read from many threads
+            at once; see \ref internal::HeapCollection::freeze. */
+        void freeze()                                       {heapDict()->freeze();}
+        bool isFrozen() const                               {return heapDict()->isFrozen();}
+
+        /** Returns a frozen snapshot of this Dict's current state, sharing its nested
+            collections; see \ref internal::HeapCollection::snapshot. */
+        Retained<MutableDict> snapshot() {
+            return (MutableDict*)heapDict()->snapshot()->asValue();
+        }
+
+        /** The heap memory used by this Dict and the mutable values in it, counting shared
+            ones and string arenas once; not including its source's Doc. */
+        size_t memoryUsage() const {
+            internal::MemoryTally tally;
+            internal::HeapValue::addMemoryUsage(this, tally);
+            return tally.bytes();
+        }
+
         const Value* get(slice keyToFind) const noexcept    {return heapDict()->get(keyToFind);}
 
         // Warning: Modifying a MutableDict invalidates all Dict::iterators on it!
@@ -38,6 +61,12 @@ namespace fleece { namespace impl {
         void set(slice key, T value)                        {heapDict()->set(key, value);}
 
         void remove(slice key)                              {heapDict()->remove(key);}
+
+        /** Encodes this Dict as a delta to its source's document; see HeapDict::amend. */
+        alloc_slice amend(bool reuseStrings =false, bool externPointers =false) const {
+            return heapDict()->amend(reuseStrings, externPointers);
+        }
+
         void removeAll()                                    {heapDict()->removeAll();}
 
         /** Promotes an Array value to a MutableArray (in place) and returns it.
@@ -28,29 +28,35 @@ namespace fleece { namespace impl {
     using namespace internal;
 
 
-    static_assert(sizeof(ValueSlot) == 8);
+    static_assert(sizeof(ValueSlot) == FL_VALUE_SLOT_SIZE);
 
 
-    ValueSlot::ValueSlot()
-    :_pointer(0)
-    { }
+    // The slot that `useStringArena` was last called on, on this thread, and the arena.
+    // (The arena is retained, in case the slot goes away without having a string stored in it.)
+    static thread_local const ValueSlot* tArenaSlot = nullptr;
+    static thread_local Retained<HeapArena> tSlotArena;
 
 
-    ValueSlot::ValueSlot(Null)
-    :_pointerTag(0xFF)
-    {
+    ValueSlot::ValueSlot() {
+        clear();
+    }
+
+
+    ValueSlot::ValueSlot(Null) {
+        clear();
+        _pointerTag = 0xFF;
         _inlineVal[0] = ((kSpecialTag << 4) | kSpecialValueNull);
     }
 
 
-    ValueSlot::ValueSlot(HeapCollection *md)
-    :_pointer( uint64_t(retain(md)->asValue()) )
-    { }
+    ValueSlot::ValueSlot(HeapCollection *md) {
+        clear();
+        _pointer = uint64_t(retain(md)->asValue());
+    }
 
 
-    ValueSlot::ValueSlot(const ValueSlot &other) noexcept
-    :_pointer(other._pointer)
-    {
+    ValueSlot::ValueSlot(const ValueSlot &other) noexcept {
+        copyFrom(other);
         if (isPointer())
             retain(pointer());
     }
@@ -58,7 +64,7 @@ namespace fleece { namespace impl {
 
     ValueSlot& ValueSlot::operator= (const ValueSlot &other) noexcept {
         releaseValue();
-        _pointer = other._pointer;
+        copyFrom(other);
         if (isPointer())
             retain(pointer());
         return *this;
@@ -66,15 +72,15 @@ namespace fleece { namespace impl {
 
 
     ValueSlot::ValueSlot(ValueSlot &&other) noexcept {
-        _pointer = other._pointer;
-        other._pointer = 0;
+        copyFrom(other);
+        other.clear();
     }
 
 
     ValueSlot& ValueSlot::operator= (ValueSlot &&other) noexcept {
         release(asPointer());
-        _pointer = other._pointer;
-        other._pointer = 0;
+        copyFrom(other);
+        other.clear();
         return *this;
     }
 
@@ -95,7 +101,7 @@ namespace fleece { namespace impl {
 
 
     const Value* ValueSlot::asValueOrUndefined() const {
-        return _pointer ? asValue() : Value::kUndefinedValue;
+        return empty() ? Value::kUndefinedValue : asValue();
     }
 
 
@@ -104,6 +110,7 @@ namespace fleece { namespace impl {
         if (_usuallyFalse(v == pointer()))
             return;
         releaseValue();
+        clear();
         _pointer = uint64_t(size_t(retain(v)));
         assert(isPointer());
     }
@@ -207,11 +214,23 @@ namespace fleece { namespace impl {
     }
 
 
+    void ValueSlot::useStringArena(HeapArena *arena) {
+        tArenaSlot = this;
+        if (tSlotArena != arena)
+            tSlotArena = arena;
+    }
+
+
     void ValueSlot::setStringOrData(tags valueTag, slice s) {
         if (s.size + 1 <= kInlineCapacity) {
             // Short strings can go inline:
             setInline(valueTag, (int)s.size);
             s.copyTo(&_inlineVal[1]);
+        } else if (_usuallyFalse(tArenaSlot == this)) {
+            // My collection has a string arena:
+            tArenaSlot = nullptr;
+            HeapArena::Scope scope(tSlotArena);         // (tSlotArena keeps the arena alive)
+            setPointer(HeapValue::createStr(valueTag, s)->asValue());
         } else {
             setPointer(HeapValue::createStr(valueTag, s)->asValue());
         }
@@ -220,7 +239,7 @@ namespace fleece { namespace impl {
 
     HeapCollection* ValueSlot::asMutableCollection() const {
         const Value *ptr = asPointer();
-        if (ptr && ptr->isMutable())
+        if (ptr && ptr->isMutable() && (ptr->tag() == kArrayTag || ptr->tag() == kDictTag))
             return (HeapCollection*)HeapValue::asHeapValue(ptr);
         return nullptr;
     }
@@ -229,7 +248,13 @@ namespace fleece { namespace impl {
     HeapCollection* ValueSlot::makeMutable(tags ifType) {
         if (isInline())
             return nullptr;
-        Retained<HeapCollection> mval = HeapCollection::mutableCopy(pointer(), ifType);
+        const Value *value = pointer();
+        if (value->isMutable()) {
+            if (value->tag() != ifType)
+                return nullptr;
+            return ((HeapCollection*)HeapValue::asHeapValue(value))->copyOnWriteIn(*this);
+        }
+        Retained<HeapCollection> mval = HeapCollection::mutableCopy(value, ifType);
         if (mval)
             set(mval->asValue());
         return mval;
@@ -254,8 +279,14 @@ namespace fleece { namespace impl {
                         ((HeapDict*)copy.get())->copyChildren(flags);
                     set(copy->asValue());
                     break;
+                case kIntTag:
+                    setPointer(HeapValue::create(value)->asValue());
+                    break;
                 case kStringTag:
-                    set(value->asString());
+                    if (value->isTimestamp())
+                        setPointer(HeapValue::create(value)->asValue());
+                    else
+                        set(value->asString());
                     break;
                 case kFloatTag:
                     set(value->asDouble());
@@ -8,9 +8,11 @@
 #include "HeapValue.hh"
 #include "Endian.hh"
 #include <limits.h>
+#include <string.h>
 
 namespace fleece { namespace impl {
     namespace internal {
+        class HeapArena;
         class HeapArray;
         class HeapDict;
     }
@@ -30,7 +32,7 @@ namespace fleece { namespace impl {
         ValueSlot(ValueSlot &&other) noexcept;
         ValueSlot& operator= (ValueSlot &&other) noexcept;
 
-        bool empty() const FLPURE                              {return _pointer == 0;}
+        bool empty() const FLPURE               {return _pointer == 0 && _pointerTag == 0;}
         explicit operator bool() const FLPURE                  {return !empty();}
 
         const Value* asValue() const FLPURE     {return isPointer() ? pointer() : inlinePointer();}
@@ -58,6 +60,11 @@ namespace fleece { namespace impl {
         /** Replaces an external value with a copy of itself. */
         void copyValue(CopyFlags);
 
+        /** Makes the next string or data value stored into this slot (on this thread) be
+            allocated from `arena`, if it doesn't fit inline. Used by collections that have a
+            string arena (see kCopyStringArena.) */
+        void useStringArena(internal::HeapArena *arena);
+
     protected:
         friend class internal::HeapArray;
         friend class internal::HeapDict;
@@ -84,9 +91,11 @@ namespace fleece { namespace impl {
 
         // The data layout below looks weirder than it is! It's just a union of a pointer and
         // a byte array.
-        // It can store either a pointer to a Value, or 7 bytes of inline Value data.
-        // The most significant byte of _pointer is used as a tag: if zero the object is storing
-        // a pointer, if nonzero it's storing inline data.
+        // It can store either a pointer to a Value, or 7 bytes of inline Value data (15 if
+        // FL_VALUE_SLOT_SIZE is 16.)
+        // The last byte of the slot (the first, on big-endian CPUs) is used as a tag: if zero the
+        // object is storing a pointer, if nonzero it's storing inline data. In an 8-byte slot
+        // the tag is the most significant byte of _pointer.
         //
         // This works because any real memory address will leave the high byte of _pointer zero:
         // this is obvious on a 32-bit CPU, but even in 64-bit the CPU only uses the upper 48
@@ -95,12 +104,24 @@ namespace fleece { namespace impl {
         // and other dynamic-language runtimes.)
         //
         // The #ifdefs are to ensure that the _pointerTag byte lines up with the most significant
-        // byte of _pointer, and _inline doesn't.
+        // byte of _pointer, or lies outside it, and _inline doesn't.
+
+        static constexpr size_t kSlotSize = FL_VALUE_SLOT_SIZE;
+        static_assert(kSlotSize == 8 || kSlotSize == 16, "FL_VALUE_SLOT_SIZE must be 8 or 16");
+        static const auto kInlineCapacity = kSlotSize - 1;
 
-        static const auto kInlineCapacity = 7;
+        void clear() noexcept                           {memset(_bytes, 0, kSlotSize);}
+        void copyFrom(const ValueSlot &other) noexcept  {memcpy(_bytes, other._bytes, kSlotSize);}
 
         union {
-            uint64_t _pointer;                          // Pointer representation
+            uint8_t _bytes[kSlotSize];
+
+            struct {
+#if defined(__BIG_ENDIAN__) && FL_VALUE_SLOT_SIZE > 8
+                uint64_t _pointerPad;                   // Always 0 when storing a pointer
+#endif
+                uint64_t _pointer;                      // Pointer representation
+            };
 
             struct {
 #ifdef __BIG_ENDIAN__
@@ -0,0 +1,121 @@
+//
+// Allocator.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Allocator.hh"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#if defined(__linux__)
+    #include <sys/mman.h>
+#endif
+#include "betterassert.hh"
+
+namespace fleece { namespace heap {
+
+    static inline bool isOveraligned(size_t alignment) {
+        return alignment > alignof(std::max_align_t);
+    }
+
+
+    static void* defaultAllocate(void*, size_t size, size_t alignment) {
+        if (isOveraligned(alignment))
+            return ::operator new(size, std::align_val_t(alignment), std::nothrow);
+        return ::malloc(size);
+    }
+
+    static void* defaultReallocate(void*, void *block, size_t newSize) {
+        return ::realloc(block, newSize);
+    }
+
+    static void defaultFree(void*, void *block, size_t alignment) {
+        if (isOveraligned(alignment))
+            ::operator delete(block, std::align_val_t(alignment));
+        else
+            ::free(block);
+    }
+
+    static FLAllocator sAllocator {defaultAllocate, defaultReallocate, defaultFree, nullptr};
+
+
+    void* tryAllocate(size_t size, size_t alignment) noexcept {
+        return sAllocator.allocate(sAllocator.context, size, alignment);
+    }
+
+
+    void* allocate(size_t size, size_t alignment) {
+        void *block = sAllocator.allocate(sAllocator.context, size, alignment);
+        if (_usuallyFalse(!block))
+            throw std::bad_alloc();
+        return block;
+    }
+
+
+    void* reallocate(void *block, size_t newSize) {
+        void *newBlock = sAllocator.reallocate(sAllocator.context, block, newSize);
+        if (_usuallyFalse(!newBlock && newSize > 0))
+            throw std::bad_alloc();
+        return newBlock;
+    }
+
+
+    void free(void *block, size_t alignment) noexcept {
+        if (block)
+            sAllocator.free(sAllocator.context, block, alignment);
+    }
+
+
+    static std::atomic<size_t> sHugePageThreshold {0};
+
+    size_t hugePageThreshold() noexcept {
+        return sHugePageThreshold.load(std::memory_order_relaxed);
+    }
+
+    bool adviseHugePages(const void *start, size_t size) noexcept {
+        size_t threshold = hugePageThreshold();
+        if (_usuallyTrue(threshold == 0 || size < threshold))
+            return false;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        // Only whole huge pages can be backed by one; the rest of the range is left alone:
+        constexpr uintptr_t kHugePageSize = 2 * 1024 * 1024;
+        uintptr_t first = ((uintptr_t)start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+        uintptr_t end   = ((uintptr_t)start + size) & ~(kHugePageSize - 1);
+        if (end <= first)
+            return false;
+        return ::madvise((void*)first, end - first, MADV_HUGEPAGE) == 0;
+#else
+        return false;
+#endif
+    }
+
+} }
+
+
+void FLSetAllocator(const FLAllocator *allocator) noexcept {
+    using namespace fleece::heap;
+    if (allocator) {
+        precondition(allocator->allocate && allocator->reallocate && allocator->free);
+        sAllocator = *allocator;
+    } else {
+        sAllocator = {defaultAllocate, defaultReallocate, defaultFree, nullptr};
+    }
+}
+
+
+void FLSetHugePageThreshold(size_t minSize) noexcept {
+    fleece::heap::sHugePageThreshold.store(minSize, std::memory_order_relaxed);
+}
@@ -0,0 +1,83 @@
+//
+// Allocator.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/FLSlice.h"
+#include <cstddef>
+#include <new>
+
+namespace fleece { namespace heap {
+
+    // Fleece's own heap memory goes through these, which call the allocator set with
+    // `FLSetAllocator` (by default `malloc` and co.) An `alignment` of 0 means malloc's.
+
+    /** Allocates a block, or returns nullptr on failure. */
+    void* tryAllocate(size_t size, size_t alignment =0) noexcept;
+
+    /** Allocates a block, throwing `std::bad_alloc` on failure. */
+    void* allocate(size_t size, size_t alignment =0);
+
+    /** Resizes a block allocated with the default alignment (or nullptr, to allocate one.)
+        Throws `std::bad_alloc` on failure, leaving the block alone. */
+    void* reallocate(void *block, size_t newSize);
+
+    /** Frees a block; `alignment` must be the value it was allocated with. */
+    void free(void *block, size_t alignment =0) noexcept;
+
+
+    /** The size at or above which big buffers are backed by huge pages; 0 (the default) if
+        that's disabled. See FLSetHugePageThreshold. */
+    size_t hugePageThreshold() noexcept;
+
+    /** If `size` is at least the huge-page threshold, advises the OS to back the (2MB-aligned)
+        huge pages inside the memory range with huge pages, using transparent huge pages.
+        It should be called before the memory is first written. Returns true if it did. */
+    bool adviseHugePages(const void *start, size_t size) noexcept;
+
+
+    /** A base class that makes `new` and `delete` of a class allocate from the Fleece heap. */
+    struct Allocated {
+        static void* operator new(size_t size)                  {return allocate(size);}
+        static void* operator new(size_t, void *where) noexcept {return where;}
+        static void operator delete(void *block) noexcept       {free(block);}
+        static void operator delete(void*, void*) noexcept      { }
+    };
+
+
+    /** A C++ standard allocator using the Fleece heap, for containers like `std::vector`. */
+    template <class T>
+    struct StdAllocator {
+        using value_type = T;
+
+        StdAllocator() noexcept = default;
+        template <class U> StdAllocator(const StdAllocator<U>&) noexcept { }
+
+        T* allocate(size_t n) {
+            return (T*) heap::allocate(n * sizeof(T), alignof(T) > alignof(std::max_align_t)
+                                                        ? alignof(T) : 0);
+        }
+
+        void deallocate(T *p, size_t) noexcept {
+            heap::free(p, alignof(T) > alignof(std::max_align_t) ? alignof(T) : 0);
+        }
+
+        template <class U> bool operator== (const StdAllocator<U>&) const noexcept {return true;}
+        template <class U> bool operator!= (const StdAllocator<U>&) const noexcept {return false;}
+    };
+
+} }
@@ -0,0 +1,465 @@
+//
+// AsyncFileIO.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "AsyncFileIO.hh"
+#include "Executor.hh"
+#include "FleeceException.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <vector>
+#include "betterassert.hh"
+
+#if FL_HAVE_FILESYSTEM && defined(__linux__)
+    #include <sys/syscall.h>
+    #if defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+        #define FL_HAVE_IO_URING 1
+        #include <linux/io_uring.h>
+        #include <sys/mman.h>
+        #include <sys/stat.h>
+        #include <sys/uio.h>
+        #include <unistd.h>
+    #endif
+#endif
+
+namespace fleece {
+    using namespace std;
+
+
+    // One file operation.
+    struct AsyncFileIO::Op {
+        string          path;
+        bool            write;
+        alloc_slice     data;           // Buffer read into, or data to write
+        ReadCallback    onRead;
+        WriteCallback   onWrite;
+#if FL_HAVE_IO_URING
+        int             fd {-1};
+        size_t          done {0};       // Bytes transferred so far
+        struct iovec    iov;
+#endif
+    };
+
+
+#if FL_HAVE_IO_URING
+
+    static int io_uring_setup(unsigned entries, io_uring_params *params) {
+        return int(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    static int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+
+    // An io_uring instance: its file descriptor and the mapped submission and completion queues.
+    struct AsyncFileIO::Ring {
+        ~Ring() {
+            if (sqes)
+                ::munmap(sqes, sqesSize);
+            if (cqMap && cqMap != sqMap)
+                ::munmap(cqMap, cqMapSize);
+            if (sqMap)
+                ::munmap(sqMap, sqMapSize);
+            if (fd >= 0)
+                ::close(fd);
+        }
+
+        bool open(unsigned entries) {
+            io_uring_params params = {};
+            fd = io_uring_setup(entries, &params);
+            if (fd < 0)
+                return false;
+            sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (singleMap)
+                sqMapSize = cqMapSize = max(sqMapSize, cqMapSize);
+            sqMap = map(sqMapSize, IORING_OFF_SQ_RING);
+            if (!sqMap)
+                return false;
+            cqMap = singleMap ? sqMap : map(cqMapSize, IORING_OFF_CQ_RING);
+            if (!cqMap)
+                return false;
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            sqes = (io_uring_sqe*)map(sqesSize, IORING_OFF_SQES);
+            if (!sqes)
+                return false;
+
+            auto sq = (uint8_t*)sqMap, cq = (uint8_t*)cqMap;
+            sqTail  = (unsigned*)(sq + params.sq_off.tail);
+            sqMask  = *(unsigned*)(sq + params.sq_off.ring_mask);
+            sqArray = (unsigned*)(sq + params.sq_off.array);
+            cqHead  = (unsigned*)(cq + params.cq_off.head);
+            cqTail  = (unsigned*)(cq + params.cq_off.tail);
+            cqMask  = *(unsigned*)(cq + params.cq_off.ring_mask);
+            cqes    = (io_uring_cqe*)(cq + params.cq_off.cqes);
+            capacity = params.sq_entries;
+            return true;
+        }
+
+        void* map(size_t size, off_t offset) {
+            void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd, offset);
+            return (addr == MAP_FAILED) ? nullptr : addr;
+        }
+
+        // Queues an operation and submits it to the kernel. Must be called under the mutex.
+        void push(uint8_t opcode, int fileDesc, const struct iovec *iov, uint64_t offset,
+                  uint64_t userData)
+        {
+            unsigned tail = *sqTail;
+            unsigned index = tail & sqMask;
+            io_uring_sqe &sqe = sqes[index];
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = opcode;
+            sqe.fd = fileDesc;
+            sqe.addr = uint64_t(uintptr_t(iov));
+            sqe.len = iov ? 1 : 0;
+            sqe.off = offset;
+            sqe.user_data = userData;
+            sqArray[index] = index;
+            __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+            // If this fails the entry stays queued, and goes in with the next submission.
+            while (io_uring_enter(fd, 1, 0, 0) < 0 && (errno == EINTR || errno == EAGAIN))
+                ;
+        }
+
+        int             fd {-1};
+        unsigned        capacity {0};
+        void*           sqMap {nullptr};
+        void*           cqMap {nullptr};
+        size_t          sqMapSize {0}, cqMapSize {0}, sqesSize {0};
+        io_uring_sqe*   sqes {nullptr};
+        unsigned*       sqTail;
+        unsigned*       sqArray;
+        unsigned        sqMask;
+        unsigned*       cqHead;
+        unsigned*       cqTail;
+        unsigned        cqMask;
+        io_uring_cqe*   cqes;
+    };
+
+#else
+
+    struct AsyncFileIO::Ring { };
+
+#endif // FL_HAVE_IO_URING
+
+
+#pragma mark - ASYNCFILEIO:
+
+
+    AsyncFileIO& AsyncFileIO::shared() {
+        static AsyncFileIO *sShared = new AsyncFileIO;
+        return *sShared;
+    }
+
+
+    AsyncFileIO::AsyncFileIO(unsigned queueDepth, bool useIOUring)
+    :_queueDepth(max(queueDepth, 1u))
+    {
+#if FL_HAVE_IO_URING
+        if (useIOUring) {
+            auto ring = make_unique<Ring>();
+            if (ring->open(_queueDepth)) {
+                _ring = move(ring);
+                _queueDepth = _ring->capacity;
+                _completionThread = thread([this] {completionLoop();});
+            }
+        }
+#endif
+    }
+
+
+    AsyncFileIO::~AsyncFileIO() {
+        waitIdle();
+#if FL_HAVE_IO_URING
+        if (_ring) {
+            // A no-op with null user data tells the completion thread to stop, unless the
+            // ring failed and it already has:
+            {
+                lock_guard<mutex> lock(_mutex);
+                if (!_ringError)
+                    _ring->push(IORING_OP_NOP, -1, nullptr, 0, 0);
+            }
+            _completionThread.join();
+        }
+#endif
+    }
+
+
+    void AsyncFileIO::waitIdle() {
+        unique_lock<mutex> lock(_mutex);
+        _idle.wait(lock, [this] {return _outstanding == 0;});
+    }
+
+
+    void AsyncFileIO::readFile(const char *path, ReadCallback callback) {
+        auto op = new Op{path, false, nullslice, move(callback), nullptr};
+        start(op);
+    }
+
+
+    void AsyncFileIO::writeFile(alloc_slice data, const char *path, WriteCallback callback) {
+        auto op = new Op{path, true, move(data), nullptr, move(callback)};
+        start(op);
+    }
+
+
+    future<alloc_slice> AsyncFileIO::readFile(const char *path) {
+        auto result = make_shared<promise<alloc_slice>>();
+        readFile(path, [result](alloc_slice data, exception_ptr error) {
+            if (error)
+                result->set_exception(error);
+            else
+                result->set_value(move(data));
+        });
+        return result->get_future();
+    }
+
+
+    future<void> AsyncFileIO::writeFile(alloc_slice data, const char *path) {
+        auto result = make_shared<promise<void>>();
+        writeFile(move(data), path, [result](exception_ptr error) {
+            if (error)
+                result->set_exception(error);
+            else
+                result->set_value();
+        });
+        return result->get_future();
+    }
+
+
+    // Opens the file and starts the operation, or without io_uring hands it to the Executor.
+    void AsyncFileIO::start(Op *op) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            ++_outstanding;
+        }
+        if (!_ring) {
+            Executor::current().submit([this, op] {
+                exception_ptr error;
+                try {
+#if FL_HAVE_FILESYSTEM
+                    if (op->write)
+                        writeToFile(op->data, op->path.c_str());
+                    else
+                        op->data = fleece::readFile(op->path.c_str());
+#else
+                    FleeceException::_throw(POSIXError, "No filesystem access");
+#endif
+                } catch (...) {
+                    error = current_exception();
+                }
+                finish(op, error);
+            });
+            return;
+        }
+
+#if FL_HAVE_IO_URING
+        try {
+            if (op->write) {
+                op->fd = ::open(op->path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0600);
+                if (op->fd < 0)
+                    FleeceException::_throwErrno("Can't open file %s", op->path.c_str());
+            } else {
+                op->fd = ::open(op->path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (op->fd < 0)
+                    FleeceException::_throwErrno("Can't open file %s", op->path.c_str());
+                struct stat stat;
+                if (fstat(op->fd, &stat) < 0)
+                    FleeceException::_throwErrno("Can't stat file %s", op->path.c_str());
+                if (uint64_t(stat.st_size) > SIZE_MAX)
+                    throw std::logic_error("File too big for address space");
+                op->data = alloc_slice(size_t(stat.st_size));
+            }
+        } catch (...) {
+            finish(op, current_exception());
+            return;
+        }
+        if (op->data.size == 0) {
+            finish(op, nullptr);
+            return;
+        }
+        exception_ptr error;
+        {
+            lock_guard<mutex> lock(_mutex);
+            if (_ringError) {
+                error = _ringError;
+            } else if (_inKernel.size() < _queueDepth) {
+                _inKernel.insert(op);
+                submit(op);
+                return;
+            } else {
+                _waiting.push_back(op);
+                return;
+            }
+        }
+        finish(op, error);
+#endif
+    }
+
+
+    // Submits the rest of an operation's transfer to the ring. Must be called under the mutex.
+    void AsyncFileIO::submit(Op *op) {
+#if FL_HAVE_IO_URING
+        op->iov.iov_base = (void*)&op->data[op->done];
+        op->iov.iov_len = op->data.size - op->done;
+        _ring->push(op->write ? IORING_OP_WRITEV : IORING_OP_READV,
+                    op->fd, &op->iov, op->done, uint64_t(uintptr_t(op)));
+#endif
+    }
+
+
+    void AsyncFileIO::completionLoop() {
+#if FL_HAVE_IO_URING
+        vector<pair<Op*,int>> completions;
+        while (true) {
+            int err = 0;
+            if (io_uring_enter(_ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) {
+                err = errno;
+                if (err != EINTR && err != EAGAIN && err != EBUSY) {
+                    failAll(err);
+                    return;
+                }
+            }
+            unsigned head = *_ring->cqHead;
+            unsigned tail = __atomic_load_n(_ring->cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head) {
+                const io_uring_cqe &cqe = _ring->cqes[head & _ring->cqMask];
+                completions.emplace_back((Op*)uintptr_t(cqe.user_data), cqe.res);
+            }
+            __atomic_store_n(_ring->cqHead, head, __ATOMIC_RELEASE);
+
+            bool stop = false;
+            for (auto [op, result] : completions) {
+                if (op)
+                    completed(op, result);
+                else
+                    stop = true;
+            }
+            if (completions.empty() && err != 0 && err != EINTR) {
+                // The kernel is short of resources; give it a moment before trying again:
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+            completions.clear();
+            if (stop)
+                return;
+        }
+#endif
+    }
+
+
+    // Called when the ring fails: fails every operation in or waiting for it, and any started
+    // from now on.
+    void AsyncFileIO::failAll(int err) {
+#if FL_HAVE_IO_URING
+        exception_ptr error;
+        errno = err;
+        try {
+            FleeceException::_throwErrno("io_uring failed");
+        } catch (...) {
+            error = current_exception();
+        }
+        vector<Op*> ops;
+        {
+            lock_guard<mutex> lock(_mutex);
+            _ringError = error;
+            ops.assign(_inKernel.begin(), _inKernel.end());
+            ops.insert(ops.end(), _waiting.begin(), _waiting.end());
+            _inKernel.clear();
+            _waiting.clear();
+        }
+        for (Op *op : ops)
+            finish(op, error);
+#endif
+    }
+
+
+    // Handles the completion of an operation's read or write.
+    void AsyncFileIO::completed(Op *op, int result) {
+#if FL_HAVE_IO_URING
+        exception_ptr error;
+        if (result < 0) {
+            if (result == -EINTR || result == -EAGAIN) {
+                lock_guard<mutex> lock(_mutex);
+                submit(op);
+                return;
+            }
+            errno = -result;
+            try {
+                FleeceException::_throwErrno("Can't %s file %s",
+                                             (op->write ? "write" : "read"), op->path.c_str());
+            } catch (...) {
+                error = current_exception();
+            }
+        } else if (result == 0) {
+            if (op->write) {
+                error = make_exception_ptr(FleeceException(POSIXError, EIO,
+                                                           "Can't write file " + op->path));
+            } else {
+                op->data.shorten(op->done);         // The file got shorter since it was opened
+            }
+        } else {
+            op->done += size_t(result);
+            if (op->done < op->data.size) {
+                // Partial transfer; continue from where it left off:
+                lock_guard<mutex> lock(_mutex);
+                submit(op);
+                return;
+            }
+        }
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _inKernel.erase(op);
+            if (!_waiting.empty()) {
+                Op *next = _waiting.front();
+                _waiting.pop_front();
+                _inKernel.insert(next);
+                submit(next);
+            }
+        }
+        finish(op, error);
+#endif
+    }
+
+
+    // Closes the file and calls the operation's callback.
+    void AsyncFileIO::finish(Op *op, exception_ptr error) {
+#if FL_HAVE_IO_URING
+        if (op->fd >= 0)
+            ::close(op->fd);
+#endif
+        if (op->write)
+            op->onWrite(error);
+        else if (error)
+            op->onRead(nullslice, error);
+        else
+            op->onRead(move(op->data), nullptr);
+        delete op;
+
+        lock_guard<mutex> lock(_mutex);
+        if (--_outstanding == 0)
+            _idle.notify_all();
+    }
+
+}
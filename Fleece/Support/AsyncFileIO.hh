@@ -0,0 +1,106 @@
+//
+// AsyncFileIO.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "sliceIO.hh"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace fleece {
+
+    /** Reads and writes whole files asynchronously, so that many file operations can be
+        outstanding at once without a thread for each.
+
+        On Linux it uses io_uring: reads and writes are queued to the kernel, and a single
+        thread collects their completions. Where io_uring isn't available (other platforms,
+        older kernels, or a sandbox that forbids it) each operation runs as a blocking task on
+        the current \ref Executor instead.
+
+        Files are opened on the calling thread; only the reads and writes are asynchronous.
+        Callbacks are called on the completion thread (or an Executor thread), so they should
+        be quick, and hand off any real work. They must not throw.
+        (Without FL_HAVE_FILESYSTEM, every operation fails with an exception.) */
+    class AsyncFileIO {
+    public:
+        using ReadCallback  = std::function<void(alloc_slice data, std::exception_ptr)>;
+        using WriteCallback = std::function<void(std::exception_ptr)>;
+
+        /** A shared instance, created on first use and never destroyed. */
+        static AsyncFileIO& shared();
+
+        /** Creates an instance allowing up to `queueDepth` operations at once in the kernel;
+            further ones wait their turn. If `useIOUring` is false, or io_uring isn't
+            available, operations run on the Executor instead. */
+        explicit AsyncFileIO(unsigned queueDepth =128, bool useIOUring =true);
+
+        /** Waits for all outstanding operations to complete. */
+        ~AsyncFileIO();
+
+        /** True if operations go through io_uring. */
+        bool usesIOUring() const                    {return _ring != nullptr;}
+
+        /** Reads the entire file, then calls the callback with its contents, or with an
+            exception if it couldn't be read (which may happen before this returns.) */
+        void readFile(const char *path, ReadCallback);
+
+        /** Writes the data to a file, replacing any existing one, then calls the callback with
+            null, or with an exception if it failed (which may happen before this returns.) */
+        void writeFile(alloc_slice data, const char *path, WriteCallback);
+
+        /** Like the callback version, but returns a future of the file's contents. */
+        std::future<alloc_slice> readFile(const char *path);
+
+        /** Like the callback version, but returns a future that's ready when it's written. */
+        std::future<void> writeFile(alloc_slice data, const char *path);
+
+        /** Blocks until no operations are outstanding. */
+        void waitIdle();
+
+    private:
+        struct Op;
+        struct Ring;
+
+        AsyncFileIO(const AsyncFileIO&) =delete;
+        AsyncFileIO& operator=(const AsyncFileIO&) =delete;
+
+        void start(Op*);
+        void submit(Op*);
+        void completionLoop();
+        void completed(Op*, int result);
+        void failAll(int err);
+        void finish(Op*, std::exception_ptr);
+
+        std::unique_ptr<Ring>   _ring;              // null if not using io_uring
+        unsigned                _queueDepth;
+        std::thread             _completionThread;
+        std::mutex              _mutex;
+        std::condition_variable _idle;
+        size_t                  _outstanding {0};   // Operations started and not finished
+        std::unordered_set<Op*> _inKernel;          // Operations submitted to the ring
+        std::deque<Op*>         _waiting;           // Operations waiting for room in the ring
+        std::exception_ptr      _ringError;         // Set if the ring stopped working
+    };
+
+}
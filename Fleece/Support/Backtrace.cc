@@ -24,6 +24,7 @@
 #include <sstream>
 #include <string.h>
 #include <algorithm>
+#include <unordered_map>
 #include "betterassert.hh"
 
 
@@ -46,6 +47,12 @@
 #endif
 
 
+#if !defined(FL_BACKTRACE_FRAME_POINTERS) && defined(__APPLE__)
+    // Apple's ABIs require frame pointers, so they can always be walked:
+    #define FL_BACKTRACE_FRAME_POINTERS 1
+#endif
+
+
 namespace fleece {
     using namespace std;
 
@@ -96,23 +103,6 @@ namespace fleece {
     }
 
 
-    Backtrace::frameInfo Backtrace::getFrame(unsigned i) const {
-        precondition(i < _addrs.size());
-        frameInfo frame = { };
-        Dl_info info;
-        if (dladdr(_addrs[i], &info)) {
-            frame.pc = _addrs[i];
-            frame.offset = (size_t)frame.pc - (size_t)info.dli_saddr;
-            frame.function = info.dli_sname;
-            frame.library = info.dli_fname;
-            const char *slash = strrchr(frame.library, '/');
-            if (slash)
-                frame.library = slash + 1;
-        }
-        return frame;
-    }
-
-
     // If any of these strings occur in a backtrace, suppress further frames.
     static constexpr const char* kTerminalFunctions[] = {
         "_C_A_T_C_H____T_E_S_T_",
@@ -138,27 +128,71 @@ namespace fleece {
     }
 
 
+    namespace {
+        // What's known about a code address: the dladdr lookup, plus the demangled and
+        // abbreviated function name that `writeTo` shows.
+        struct Symbol {
+            Backtrace::frameInfo frame;
+            string name;                    // Empty if the function is unknown
+            bool terminal;                  // Is it one of the kTerminalFunctions?
+        };
+    }
+
+
+    // Returns the Symbol for an address, looking it up the first time. Entries are never
+    // removed, so the reference stays valid. (Code addresses in a process are a small set.)
+    static const Symbol& symbolize(const void *pc) {
+        static mutex &sMutex = *new mutex;
+        static auto &sCache = *new unordered_map<const void*, Symbol>;
+        lock_guard<mutex> lock(sMutex);
+        auto [i, isNew] = sCache.try_emplace(pc);
+        Symbol &sym = i->second;
+        if (isNew) {
+            sym.frame = {};
+            sym.terminal = false;
+            Dl_info info;
+            if (dladdr(pc, &info)) {
+                sym.frame.pc = pc;
+                sym.frame.offset = (size_t)pc - (size_t)info.dli_saddr;
+                sym.frame.function = info.dli_sname;
+                sym.frame.library = info.dli_fname;
+                const char *slash = strrchr(sym.frame.library, '/');
+                if (slash)
+                    sym.frame.library = slash + 1;
+                if (info.dli_sname) {
+                    sym.name = Unmangle(info.dli_sname);
+                    // Stop when we hit a unit test, or other known functions:
+                    for (auto fn : kTerminalFunctions) {
+                        if (sym.name.find(fn) != string::npos)
+                            sym.terminal = true;
+                    }
+                    // Abbreviate some C++ verbosity:
+                    for (auto &abbrev : kAbbreviations)
+                        replace(sym.name, abbrev.old, abbrev.nuu);
+                }
+            }
+        }
+        return sym;
+    }
+
+
+    Backtrace::frameInfo Backtrace::getFrame(unsigned i) const {
+        precondition(i < _addrs.size());
+        return symbolize(_addrs[i]).frame;
+    }
+
+
     bool Backtrace::writeTo(ostream &out) const {
         for (int i = 0; i < _addrs.size(); ++i) {
             if (i > 0)
                 out << '\n';
             out << '\t';
             char *cstr = nullptr;
-            auto frame = getFrame(i);
+            const Symbol &sym = symbolize(_addrs[i]);
             int len;
-            bool stop = false;
-            if (frame.function) {
-                string name = Unmangle(frame.function);
-                // Stop when we hit a unit test, or other known functions:
-                for (auto fn : kTerminalFunctions) {
-                    if (name.find(fn) != string::npos)
-                        stop = true;
-                }
-                // Abbreviate some C++ verbosity:
-                for (auto &abbrev : kAbbreviations)
-                    replace(name, abbrev.old, abbrev.nuu);
+            if (!sym.name.empty()) {
                 len = asprintf(&cstr, "%2d  %-25s %s + %zd",
-                               i, frame.library, name.c_str(), frame.offset);
+                               i, sym.frame.library, sym.name.c_str(), sym.frame.offset);
             } else {
                 len = asprintf(&cstr, "%2d  %p", i, _addrs[i]);
             }
@@ -167,7 +201,7 @@ namespace fleece {
             out.write(cstr, size_t(len));
             free(cstr);
 
-            if (stop) {
+            if (sym.terminal) {
                 out << "\n\t ... (" << (_addrs.size() - i - 1) << " more suppressed) ...";
                 break;
             }
@@ -305,11 +339,46 @@ namespace fleece {
     }
 
 
+    unsigned Backtrace::captureRaw(void* pcs[], unsigned maxFrames, unsigned skipFrames) noexcept {
+#if FL_BACKTRACE_FRAME_POINTERS
+        // Follow the chain of saved frame pointers, starting with my own frame, whose return
+        // address is in my caller. Each frame starts with the caller's frame pointer, followed by
+        // the return address. The chain must run up the stack; anything else means it's ended
+        // (or isn't trustworthy.)
+        auto fp = (void* const*)__builtin_frame_address(0);
+        unsigned n = 0;
+        while (fp && n < maxFrames) {
+            void *pc = fp[1];
+            if (!pc)
+                break;
+            if (skipFrames > 0)
+                --skipFrames;
+            else
+                pcs[n++] = pc;
+            auto next = (void* const*)fp[0];
+            if (next <= fp || ((size_t)next & (sizeof(void*) - 1))
+                           || (size_t)next - (size_t)fp > (1 << 20))
+                break;
+            fp = next;
+        }
+        return n;
+#else
+        ++skipFrames;                                   // skip this frame
+        void* buffer[kMaxRawFrames];
+        int n = backtrace(buffer, min(skipFrames + maxFrames, kMaxRawFrames));
+        if (n <= int(skipFrames))
+            return 0;
+        n -= skipFrames;
+        memcpy(pcs, &buffer[skipFrames], n * sizeof(void*));
+        return unsigned(n);
+#endif
+    }
+
+
     void Backtrace::_capture(unsigned skipFrames, unsigned maxFrames) {
-        _addrs.resize(++skipFrames + maxFrames);        // skip this frame
-        auto n = backtrace(&_addrs[0], skipFrames + maxFrames);
-        _addrs.resize(n);
-        skip(skipFrames);
+        void* pcs[kMaxRawFrames];
+        unsigned n = captureRaw(pcs, min(maxFrames, kMaxRawFrames), skipFrames + 1);
+        _addrs.assign(pcs, pcs + n);
     }
 
 
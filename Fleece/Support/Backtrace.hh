@@ -15,12 +15,29 @@
 
 namespace fleece {
 
-    /** Captures a backtrace of the current thread, and can convert it to human-readable form. */
+    /** Captures a backtrace of the current thread, and can convert it to human-readable form.
+        Capturing only records the stack's return addresses; they're symbolized when the
+        backtrace is written or its frames are read, and the results are cached, so each address
+        is only looked up once per process. */
     class Backtrace {
     public:
+        /// The most frames \ref captureRaw can skip plus capture, except by walking frame pointers.
+        static constexpr unsigned kMaxRawFrames = 128;
+
+        /// Captures the return addresses on the current thread's stack, top first, into `pcs`,
+        /// without allocating memory or symbolizing them; returns the number captured. This is
+        /// cheap enough to record on sampled operations in production. Where the ABI guarantees
+        /// frame pointers (Apple platforms, or if FL_BACKTRACE_FRAME_POINTERS is defined to 1)
+        /// it walks them; otherwise it uses the platform's unwinder.
+        static unsigned captureRaw(void* pcs[], unsigned maxFrames,
+                                   unsigned skipFrames =0) noexcept;
+
         /// Captures a backtrace and returns a shared pointer to the instance.
         static std::shared_ptr<Backtrace> capture(unsigned skipFrames =0, unsigned maxFrames =50);
 
+        /// Creates a Backtrace from addresses captured by \ref captureRaw.
+        Backtrace(void* const pcs[], unsigned nFrames)      :_addrs(pcs, pcs + nFrames) { }
+
         /// Captures a backtrace, unless maxFrames is zero.
         /// @param skipFrames  Number of frames to skip at top of stack
         /// @param maxFrames  Maximum number of frames to capture
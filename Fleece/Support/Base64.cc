@@ -17,23 +17,240 @@
 //
 
 #include "Base64.hh"
-#include "encode.h"
+#include "CPUFeatures.hh"
 #include "decode.h"
 #include "betterassert.hh"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    // AVX2 isn't in the x86-64 baseline, so its functions are compiled for it separately and
+    // only called if the CPU supports it:
+    #include <immintrin.h>
+    #define FL_BASE64_AVX2 1
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+    #include <arm_neon.h>
+    #define FL_BASE64_NEON 1
+#endif
+
 namespace fleece { namespace base64 {
 
+    // The fast paths below encode and decode whole groups of 3 bytes / 4 characters. Decoding
+    // stops at the first group that isn't 4 valid characters (padding, whitespace, garbage),
+    // and libb64 decodes the rest, so it's as lenient as it always was.
+
+    static constexpr char kEncoding[65] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    struct DecodingTable {
+        int8_t table[256];
+
+        constexpr DecodingTable() :table() {
+            for (int i = 0; i < 256; ++i)
+                table[i] = -1;
+            for (int i = 0; i < 64; ++i)
+                table[uint8_t(kEncoding[i])] = int8_t(i);
+        }
+    };
+
+    static constexpr DecodingTable kDecoding;
+
+
+    static void encodeScalar(const uint8_t* &src, const uint8_t *end, char* &dst) noexcept {
+        for (; end - src >= 3; src += 3, dst += 4) {
+            uint32_t n = (uint32_t(src[0]) << 16) | (uint32_t(src[1]) << 8) | src[2];
+            dst[0] = kEncoding[n >> 18];
+            dst[1] = kEncoding[(n >> 12) & 63];
+            dst[2] = kEncoding[(n >> 6) & 63];
+            dst[3] = kEncoding[n & 63];
+        }
+    }
+
+
+    // Decodes groups of 4 valid characters, stopping at the first one that isn't.
+    static void decodeScalar(const uint8_t* &src, const uint8_t *end, uint8_t* &dst) noexcept {
+        auto &t = kDecoding.table;
+        for (; end - src >= 4; src += 4, dst += 3) {
+            int32_t a = t[src[0]], b = t[src[1]], c = t[src[2]], d = t[src[3]];
+            if ((a | b | c | d) < 0)
+                break;
+            uint32_t n = (uint32_t(a) << 18) | (uint32_t(b) << 12) | (uint32_t(c) << 6) | d;
+            dst[0] = uint8_t(n >> 16);
+            dst[1] = uint8_t(n >> 8);
+            dst[2] = uint8_t(n);
+        }
+    }
+
+
+#if FL_BASE64_AVX2
+    // These use the methods of Wojciech Muła's "Base64 encoding and decoding at almost the
+    // speed of a memory copy": 24 bytes become 32 characters per step, and vice versa.
+
+    __attribute__((target("avx2")))
+    static void encodeSIMD(const uint8_t* &src, const uint8_t *end, char* &dst) noexcept {
+        const __m256i shuffle = _mm256_setr_epi8(1, 0, 2, 1,  4, 3, 5, 4,  7, 6, 8, 7,  10, 9, 11, 10,
+                                                 1, 0, 2, 1,  4, 3, 5, 4,  7, 6, 8, 7,  10, 9, 11, 10);
+        const __m256i shiftLUT = _mm256_setr_epi8('a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                                                  '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62,
+                                                  '/'-63, 'A', 0, 0,
+                                                  'a'-26, '0'-52, '0'-52, '0'-52, '0'-52, '0'-52,
+                                                  '0'-52, '0'-52, '0'-52, '0'-52, '0'-52, '+'-62,
+                                                  '/'-63, 'A', 0, 0);
+        // Each step reads 28 bytes: 12 each into the two 128-bit lanes, plus 4 not used.
+        for (; end - src >= 28; src += 24, dst += 32) {
+            __m256i in = _mm256_inserti128_si256(
+                                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)src)),
+                                _mm_loadu_si128((const __m128i*)(src + 12)), 1);
+            // Spread each 3 bytes into 4, then shift each 6-bit index into its own byte:
+            in = _mm256_shuffle_epi8(in, shuffle);
+            __m256i ac = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)),
+                                            _mm256_set1_epi32(0x04000040));
+            __m256i bd = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)),
+                                            _mm256_set1_epi32(0x01000010));
+            __m256i indices = _mm256_or_si256(ac, bd);
+            // Map each index to the offset from it to its character, by range:
+            __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+            __m256i isUpper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+            range = _mm256_or_si256(range, _mm256_and_si256(isUpper, _mm256_set1_epi8(13)));
+            __m256i chars = _mm256_add_epi8(indices, _mm256_shuffle_epi8(shiftLUT, range));
+            _mm256_storeu_si256((__m256i*)dst, chars);
+        }
+    }
+
+
+    // Decodes groups of 32 valid characters, stopping at the first one that isn't. Needs room
+    // in the output for 32 bytes per step, though it only produces 24.
+    __attribute__((target("avx2")))
+    static void decodeSIMD(const uint8_t* &src, const uint8_t *end,
+                           uint8_t* &dst, const uint8_t *dstEnd) noexcept
+    {
+        // Bit `n` of lutLo[lo] is set if a character with low nybble `lo` and a high nybble
+        // whose lutHi entry is bit `n` is invalid:
+        const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                               0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                               0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                               0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+        const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                               0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                               0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                               0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+        // The offset from a character to its value, by high nybble ('/' is given index 1):
+        const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                                 0, 0, 0, 0, 0, 0, 0, 0,
+                                                 0, 16, 19, 4, -65, -65, -71, -71,
+                                                 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m256i nybbleMask = _mm256_set1_epi8(0x0F), slash = _mm256_set1_epi8('/');
+        const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                              2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+        for (; end - src >= 32 && dstEnd - dst >= 32; src += 32, dst += 24) {
+            __m256i in = _mm256_loadu_si256((const __m256i*)src);
+            __m256i hiNybbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), nybbleMask);
+            __m256i loNybbles = _mm256_and_si256(in, nybbleMask);
+            __m256i lo = _mm256_shuffle_epi8(lutLo, loNybbles);
+            __m256i hi = _mm256_shuffle_epi8(lutHi, hiNybbles);
+            if (!_mm256_testz_si256(lo, hi))
+                break;
+            __m256i isSlash = _mm256_cmpeq_epi8(in, slash);
+            __m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(isSlash, hiNybbles));
+            __m256i values = _mm256_add_epi8(in, roll);
+            // Merge each 4 6-bit values into 3 bytes, then squeeze out the gaps:
+            __m256i merged = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+            merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+            merged = _mm256_shuffle_epi8(merged, pack);
+            merged = _mm256_permutevar8x32_epi32(merged, compact);
+            _mm256_storeu_si256((__m256i*)dst, merged);
+        }
+    }
+
+    static bool haveSIMD() noexcept {return cpu::has(cpu::kAVX2);}
+
+#elif FL_BASE64_NEON
+    // NEON's interleaving loads and stores split 3 bytes / 4 characters into separate
+    // registers, so 48 bytes become 64 characters per step, and vice versa.
+
+    static void encodeSIMD(const uint8_t* &src, const uint8_t *end, char* &dst) noexcept {
+        auto enc = (const uint8_t*)kEncoding;
+        const uint8x16x4_t table = {{vld1q_u8(enc), vld1q_u8(enc + 16),
+                                     vld1q_u8(enc + 32), vld1q_u8(enc + 48)}};
+        const uint8x16_t mask = vdupq_n_u8(63);
+        for (; end - src >= 48; src += 48, dst += 64) {
+            uint8x16x3_t in = vld3q_u8(src);
+            uint8x16x4_t out;
+            out.val[0] = vshrq_n_u8(in.val[0], 2);
+            out.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+            out.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+            out.val[3] = vandq_u8(in.val[2], mask);
+            for (int i = 0; i < 4; ++i)
+                out.val[i] = vqtbl4q_u8(table, out.val[i]);
+            vst4q_u8((uint8_t*)dst, out);
+        }
+    }
+
+
+    // Decodes groups of 64 valid characters, stopping at the first one that isn't.
+    static void decodeSIMD(const uint8_t* &src, const uint8_t *end,
+                           uint8_t* &dst, const uint8_t *dstEnd) noexcept
+    {
+        // The decoding table for ASCII, as two halves of 64 entries; invalid characters are 0xFF.
+        auto dec = (const uint8_t*)kDecoding.table;
+        const uint8x16x4_t tableLo = {{vld1q_u8(dec), vld1q_u8(dec + 16),
+                                       vld1q_u8(dec + 32), vld1q_u8(dec + 48)}};
+        const uint8x16x4_t tableHi = {{vld1q_u8(dec + 64), vld1q_u8(dec + 80),
+                                       vld1q_u8(dec + 96), vld1q_u8(dec + 112)}};
+        const uint8x16_t k64 = vdupq_n_u8(64);
+        for (; end - src >= 64 && dstEnd - dst >= 48; src += 64, dst += 48) {
+            uint8x16x4_t in = vld4q_u8(src);
+            uint8x16_t bad = vdupq_n_u8(0);
+            for (int i = 0; i < 4; ++i) {
+                // Out-of-range indexes look up 0, so each character is found in at most one
+                // half; non-ASCII ones are in neither, but are caught by their high bit.
+                uint8x16_t c = in.val[i];
+                in.val[i] = vorrq_u8(vqtbl4q_u8(tableLo, c), vqtbl4q_u8(tableHi, vsubq_u8(c, k64)));
+                bad = vorrq_u8(bad, vorrq_u8(in.val[i], c));
+            }
+            // An invalid character, or its value 0xFF, has its high bit set:
+            if (vmaxvq_u8(bad) >= 0x80)
+                break;
+            uint8x16x3_t out;
+            out.val[0] = vorrq_u8(vshlq_n_u8(in.val[0], 2), vshrq_n_u8(in.val[1], 4));
+            out.val[1] = vorrq_u8(vshlq_n_u8(in.val[1], 4), vshrq_n_u8(in.val[2], 2));
+            out.val[2] = vorrq_u8(vshlq_n_u8(in.val[2], 6), in.val[3]);
+            vst3q_u8(dst, out);
+        }
+    }
+
+    static bool haveSIMD() noexcept {return cpu::has(cpu::kNEON);}
+#endif
+
+
+    size_t encode(slice data, void *output) noexcept {
+        auto src = (const uint8_t*)data.buf, end = src + data.size;
+        auto dst = (char*)output;
+#if FL_BASE64_AVX2 || FL_BASE64_NEON
+        if (haveSIMD())
+            encodeSIMD(src, end, dst);
+#endif
+        encodeScalar(src, end, dst);
+        if (end - src == 1) {
+            *dst++ = kEncoding[src[0] >> 2];
+            *dst++ = kEncoding[(src[0] & 3) << 4];
+            *dst++ = '=';
+            *dst++ = '=';
+        } else if (end - src == 2) {
+            *dst++ = kEncoding[src[0] >> 2];
+            *dst++ = kEncoding[((src[0] & 3) << 4) | (src[1] >> 4)];
+            *dst++ = kEncoding[(src[1] & 15) << 2];
+            *dst++ = '=';
+        }
+        size_t written = dst - (char*)output;
+        assert_postcondition(written == encodedSize(data.size));
+        return written;
+    }
+
+
     std::string encode(slice data) {
         std::string str;
-        size_t strLen = ((data.size + 2) / 3) * 4;
-        str.resize(strLen);
-        char *dst = &str[0];
-        ::base64::encoder enc;
-        enc.set_chars_per_line(0);
-        size_t written = enc.encode(data.buf, data.size, dst);
-        written += enc.encode_end(dst + written);
-        assert(written == strLen);
-        (void)written;  // avoid compiler warning in release build when 'assert' is a no-op
+        str.resize(encodedSize(data.size));
+        encode(data, &str[0]);
         return str;
     }
 
@@ -54,8 +271,19 @@ namespace fleece { namespace base64 {
         size_t expectedLen = (b64.size + 3) / 4 * 3;
         if (expectedLen > bufferSize)
             return nullslice;
-        ::base64::decoder dec;
-        size_t len = dec.decode(b64.buf, b64.size, outputBuffer);
+        auto src = (const uint8_t*)b64.buf, end = src + b64.size;
+        auto dst = (uint8_t*)outputBuffer, dstEnd = dst + bufferSize;
+#if FL_BASE64_AVX2 || FL_BASE64_NEON
+        if (haveSIMD())
+            decodeSIMD(src, end, dst, dstEnd);
+#endif
+        decodeScalar(src, end, dst);
+        if (src < end) {
+            // Whatever's left starts on a group boundary, so libb64 can pick up from here:
+            ::base64::decoder dec;
+            dst += dec.decode(src, end - src, dst);
+        }
+        size_t len = dst - (uint8_t*)outputBuffer;
         assert(len <= bufferSize);
         return slice(outputBuffer, len);
     }
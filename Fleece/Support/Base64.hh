@@ -9,9 +9,16 @@
 
 namespace fleece { namespace base64 {
 
+    /** The length of the base64 encoding of `dataSize` bytes, including padding. */
+    constexpr size_t encodedSize(size_t dataSize)   {return (dataSize + 2) / 3 * 4;}
+
     /** Encodes the data in the slice as base64. */
     std::string encode(slice);
 
+    /** Encodes the data in the slice as base64 into `output`, which must have room for
+        `encodedSize(data.size)` bytes. Returns the number of bytes written. */
+    size_t encode(slice data, void *output) noexcept;
+
     /** Decodes Base64 data from a slice into a new alloc_slice.
         On failure returns a null slice. */
     alloc_slice decode(slice);
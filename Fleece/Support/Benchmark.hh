@@ -19,16 +19,115 @@
 #pragma once
 #include "Stopwatch.hh"
 #include <algorithm>
+#include <string>
 #include <utility>
 #include <vector>
 #include "betterassert.hh"
 
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
+
+/** Times repeated runs of some code, and reports statistics of the times.
+    Call `start` and `stop` around each run. The first `setWarmup(n)` runs aren't recorded,
+    so caches and branch predictors are warm for the rest. On Linux, `enableCounters` also
+    measures hardware events with perf_event; they're reported per item, as are the times. */
 class Benchmark {
 public:
-    void start()        {_st.reset();}
+    /** Hardware events that `enableCounters` measures. */
+    enum Counter {kCycles, kInstructions, kCacheMisses, kBranchMisses, kNumCounters};
+
+    Benchmark() =default;
+    ~Benchmark()        {disableCounters();}
+
+    /** Runs to discard before recording times. */
+    void setWarmup(unsigned runs)   {_warmup = runs;}
+
+    /** Starts measuring hardware counters too. Returns false if they're unavailable, as on
+        non-Linux platforms or where perf_event is disallowed; the times are still recorded. */
+    bool enableCounters() {
+#ifdef __linux__
+        static constexpr uint64_t kConfig[kNumCounters] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+        if (_fds[0] >= 0)
+            return true;
+        for (int i = 0; i < kNumCounters; ++i) {
+            perf_event_attr attr = {};
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = kConfig[i];
+            attr.disabled = (i == 0);       // the group leader starts and stops the rest
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            _fds[i] = int(syscall(SYS_perf_event_open, &attr, 0, -1, _fds[0], 0));
+            if (_fds[i] < 0) {
+                disableCounters();
+                return false;
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool hasCounters() const FLPURE {return _fds[0] >= 0;}
+
+    /** Binds the calling thread to one CPU, so runs aren't disturbed by migrating between
+        CPUs. Returns false if that's not possible on this platform. */
+    static bool pinToCPU(unsigned cpu) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+        (void)cpu;
+        return false;
+#endif
+    }
+
+    void start() {
+#ifdef __linux__
+        if (hasCounters()) {
+            ioctl(_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+        _st.reset();
+    }
+
     double elapsed() const FLPURE    {return _st.elapsed();}
-    double stop()       {double t = elapsed(); _times.push_back(t); return t;}
+
+    double stop() {
+        double t = elapsed();
+        uint64_t counts[kNumCounters] = {};
+#ifdef __linux__
+        if (hasCounters()) {
+            ioctl(_fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            uint64_t values[1 + kNumCounters];          // (count of events, then their values)
+            if (read(_fds[0], values, sizeof(values)) == sizeof(values))
+                std::copy(&values[1], &values[1 + kNumCounters], counts);
+        }
+#endif
+        if (_warmup > 0) {
+            --_warmup;
+            return t;
+        }
+        _times.push_back(t);
+        if (hasCounters()) {
+            for (int i = 0; i < kNumCounters; ++i)
+                _counts[i].push_back(counts[i]);
+        }
+        return t;
+    }
 
     bool empty() const FLPURE  {return _times.empty();}
     void sort()         {assert(!empty()); std::sort(_times.begin(), _times.end());}
@@ -38,6 +137,13 @@ public:
         return _times[_times.size()/2];
     }
 
+    /** The time that `p` percent of the runs took no longer than. */
+    double percentile(double p) {
+        sort();
+        size_t i = size_t(p / 100.0 * double(_times.size()));
+        return _times[std::min(i, _times.size() - 1)];
+    }
+
     double average() {
         sort();
         size_t n = _times.size(), skip = n / 10;
@@ -61,13 +167,27 @@ public:
         return {_times[0], _times[_times.size()-1]};
     }
 
-    void reset()        {_times.clear();}
+    /** The median count of a hardware event per run, or 0 if counters aren't enabled. */
+    double counterMedian(Counter c) {
+        auto &counts = _counts[c];
+        if (counts.empty())
+            return 0;
+        std::sort(counts.begin(), counts.end());
+        return double(counts[counts.size()/2]);
+    }
+
+    void reset() {
+        _times.clear();
+        for (auto &counts : _counts)
+            counts.clear();
+    }
 
     void printReport(double scale =1.0, const char *items =nullptr) {
         auto r = range();
 
         std::string scaleName;
         const char* kTimeScales[] = {"sec", "ms", "us", "ns"};
+        double counterScale = scale;
         double avg = average();
         for (unsigned i = 0; i < sizeof(kTimeScales)/sizeof(char*); ++i) {
             if (i > 0)
@@ -83,9 +203,61 @@ public:
         fprintf(stderr, "Median %7.3f %s; mean %7.3f; std dev %5.3g; range (%7.3f ... %7.3f)\n",
                 median()*scale, scaleName.c_str(), average()*scale, stddev()*scale,
                 r.first*scale, r.second*scale);
+        fprintf(stderr, "       p90 %7.3f; p99 %7.3f\n",
+                percentile(90)*scale, percentile(99)*scale);
+        if (!_counts[0].empty()) {
+            fprintf(stderr, "       %.0f cycles, %.0f instructions, %.1f cache misses, "
+                            "%.1f branch misses /%s\n",
+                    counterMedian(kCycles)*counterScale,
+                    counterMedian(kInstructions)*counterScale,
+                    counterMedian(kCacheMisses)*counterScale,
+                    counterMedian(kBranchMisses)*counterScale,
+                    items ? items : "run");
+        }
+    }
+
+    /** Returns the statistics as a JSON object, for regression-tracking tools. Times are in
+        seconds, and they and the counters are per item, given `scale` items per run as in
+        `printReport`. */
+    std::string json(const char *name, double scale =1.0) {
+        auto r = range();
+        char buf[1024];
+        int len = snprintf(buf, sizeof(buf),
+                 "{\"name\":\"%s\",\"runs\":%zu,\"median\":%.9g,\"mean\":%.9g,"
+                 "\"stddev\":%.9g,\"min\":%.9g,\"p50\":%.9g,\"p90\":%.9g,\"p99\":%.9g,"
+                 "\"max\":%.9g",
+                 name, _times.size(), median()*scale, average()*scale, stddev()*scale,
+                 r.first*scale, percentile(50)*scale, percentile(90)*scale,
+                 percentile(99)*scale, r.second*scale);
+        std::string result(buf, std::min(size_t(len), sizeof(buf) - 1));
+        if (!_counts[0].empty()) {
+            snprintf(buf, sizeof(buf),
+                     ",\"cycles\":%.9g,\"instructions\":%.9g,\"cacheMisses\":%.9g,"
+                     "\"branchMisses\":%.9g",
+                     counterMedian(kCycles)*scale, counterMedian(kInstructions)*scale,
+                     counterMedian(kCacheMisses)*scale, counterMedian(kBranchMisses)*scale);
+            result += buf;
+        }
+        return result + "}";
     }
 
 private:
+    Benchmark(const Benchmark&) =delete;
+    Benchmark& operator=(const Benchmark&) =delete;
+
+    void disableCounters() {
+#ifdef __linux__
+        for (int &fd : _fds) {
+            if (fd >= 0)
+                close(fd);
+            fd = -1;
+        }
+#endif
+    }
+
     fleece::Stopwatch _st;
     std::vector<double> _times;
+    std::vector<uint64_t> _counts[kNumCounters];    // Counter values of each run
+    int _fds[kNumCounters] {-1, -1, -1, -1};        // perf_event file descriptors
+    unsigned _warmup {0};                           // Runs still to be discarded
 };
@@ -0,0 +1,211 @@
+//
+// ByteDiff.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "ByteDiff.hh"
+#include <algorithm>
+#include <chrono>
+
+namespace fleece {
+    using namespace std;
+    using DiffClock = chrono::steady_clock;
+
+
+    namespace {
+
+        class Differ {
+        public:
+            Differ(double timeout) {
+                if (timeout > 0) {
+                    _deadline = DiffClock::now() + chrono::duration_cast<DiffClock::duration>(
+                                                            chrono::duration<double>(timeout));
+                    _hasDeadline = true;
+                }
+            }
+
+            void diff(const uint8_t *a, size_t n, const uint8_t *b, size_t m) {
+                // Strip the common prefix and suffix, which are common in practice:
+                size_t prefix = 0;
+                while (prefix < n && prefix < m && a[prefix] == b[prefix])
+                    ++prefix;
+                append(ByteDiffOp::kEqual, prefix);
+                a += prefix; n -= prefix;
+                b += prefix; m -= prefix;
+                size_t suffix = 0;
+                while (suffix < n && suffix < m && a[n-1-suffix] == b[m-1-suffix])
+                    ++suffix;
+                n -= suffix;
+                m -= suffix;
+
+                if (n == 0 || m == 0) {
+                    append(ByteDiffOp::kDelete, n);
+                    append(ByteDiffOp::kInsert, m);
+                } else {
+                    size_t x, y;
+                    if (bisect(a, n, b, m, x, y)) {
+                        diff(a, x, b, y);
+                        diff(a + x, n - x, b + y, m - y);
+                    } else {
+                        append(ByteDiffOp::kDelete, n);
+                        append(ByteDiffOp::kInsert, m);
+                    }
+                }
+                append(ByteDiffOp::kEqual, suffix);
+            }
+
+            vector<ByteDiffOp> finish() {
+                flush();
+                return move(_ops);
+            }
+
+        private:
+            // Finds the "middle snake" of the shortest edit path through `a` and `b`, by
+            // searching from both ends at once, and returns the point (x, y) to split them at.
+            // Returns false if it runs out of time first.
+            bool bisect(const uint8_t *a, size_t n, const uint8_t *b, size_t m,
+                        size_t &outX, size_t &outY)
+            {
+                const int len1 = int(n), len2 = int(m);
+                const int maxD = (len1 + len2 + 1) / 2;
+                const int vOffset = maxD, vLength = 2 * maxD;
+                vector<int> v1(vLength, -1), v2(vLength, -1);     // forward, reverse
+                v1[vOffset + 1] = 0;
+                v2[vOffset + 1] = 0;
+                const int delta = len1 - len2;
+                // If the total number of bytes is odd, the front path will collide with the
+                // reverse path; otherwise the reverse path collides with the front one.
+                const bool front = (delta % 2 != 0);
+                // Offsets for the start and end of the k loops, which prevent mapping space
+                // beyond the grid:
+                int k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+                for (int d = 0; d < maxD; ++d) {
+                    if (_hasDeadline && DiffClock::now() > _deadline)
+                        return false;
+
+                    // Walk the front path one step:
+                    for (int k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+                        int k1Offset = vOffset + k1;
+                        int x1;
+                        if (k1 == -d || (k1 != d && v1[k1Offset - 1] < v1[k1Offset + 1]))
+                            x1 = v1[k1Offset + 1];
+                        else
+                            x1 = v1[k1Offset - 1] + 1;
+                        int y1 = x1 - k1;
+                        while (x1 < len1 && y1 < len2 && a[x1] == b[y1]) {
+                            ++x1;
+                            ++y1;
+                        }
+                        v1[k1Offset] = x1;
+                        if (x1 > len1) {
+                            k1end += 2;             // ran off the right of the graph
+                        } else if (y1 > len2) {
+                            k1start += 2;           // ran off the bottom of the graph
+                        } else if (front) {
+                            int k2Offset = vOffset + delta - k1;
+                            if (k2Offset >= 0 && k2Offset < vLength && v2[k2Offset] != -1) {
+                                // Mirror x2 onto the top-left coordinate system:
+                                int x2 = len1 - v2[k2Offset];
+                                if (x1 >= x2) {
+                                    outX = x1;
+                                    outY = y1;
+                                    return true;
+                                }
+                            }
+                        }
+                    }
+
+                    // Walk the reverse path one step:
+                    for (int k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+                        int k2Offset = vOffset + k2;
+                        int x2;
+                        if (k2 == -d || (k2 != d && v2[k2Offset - 1] < v2[k2Offset + 1]))
+                            x2 = v2[k2Offset + 1];
+                        else
+                            x2 = v2[k2Offset - 1] + 1;
+                        int y2 = x2 - k2;
+                        while (x2 < len1 && y2 < len2 && a[len1 - x2 - 1] == b[len2 - y2 - 1]) {
+                            ++x2;
+                            ++y2;
+                        }
+                        v2[k2Offset] = x2;
+                        if (x2 > len1) {
+                            k2end += 2;             // ran off the left of the graph
+                        } else if (y2 > len2) {
+                            k2start += 2;           // ran off the top of the graph
+                        } else if (!front) {
+                            int k1Offset = vOffset + delta - k2;
+                            if (k1Offset >= 0 && k1Offset < vLength && v1[k1Offset] != -1) {
+                                int x1 = v1[k1Offset];
+                                int y1 = vOffset + x1 - k1Offset;
+                                // Mirror x2 onto the top-left coordinate system:
+                                x2 = len1 - x2;
+                                if (x1 >= x2) {
+                                    outX = x1;
+                                    outY = y1;
+                                    return true;
+                                }
+                            }
+                        }
+                    }
+                }
+                return false;   // (only reachable if the paths never overlap; shouldn't happen)
+            }
+
+            // Adds an op, coalescing each run of deletions and insertions between equal ranges
+            // into a single deletion followed by a single insertion.
+            void append(ByteDiffOp::Kind kind, size_t length) {
+                if (length == 0)
+                    return;
+                switch (kind) {
+                    case ByteDiffOp::kDelete:   _deleted += length; break;
+                    case ByteDiffOp::kInsert:   _inserted += length; break;
+                    case ByteDiffOp::kEqual:
+                        flush();
+                        if (!_ops.empty() && _ops.back().kind == ByteDiffOp::kEqual)
+                            _ops.back().length += length;
+                        else
+                            _ops.push_back({ByteDiffOp::kEqual, length});
+                        break;
+                }
+            }
+
+            void flush() {
+                if (_deleted)
+                    _ops.push_back({ByteDiffOp::kDelete, _deleted});
+                if (_inserted)
+                    _ops.push_back({ByteDiffOp::kInsert, _inserted});
+                _deleted = _inserted = 0;
+            }
+
+            vector<ByteDiffOp> _ops;
+            size_t _deleted {0}, _inserted {0};
+            DiffClock::time_point _deadline;
+            bool _hasDeadline {false};
+        };
+
+    }
+
+
+    vector<ByteDiffOp> diffBytes(slice oldBytes, slice newBytes, double timeout) {
+        Differ differ(timeout);
+        differ.diff((const uint8_t*)oldBytes.buf, oldBytes.size,
+                    (const uint8_t*)newBytes.buf, newBytes.size);
+        return differ.finish();
+    }
+
+}
@@ -0,0 +1,51 @@
+//
+// ByteDiff.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include <vector>
+
+namespace fleece {
+
+    /** One step of an edit script turning one byte string into another. */
+    struct ByteDiffOp {
+        enum Kind : uint8_t {
+            kEqual,                 // Copy `length` bytes of the old string
+            kDelete,                // Skip `length` bytes of the old string
+            kInsert,                // Insert `length` bytes of the new string
+        };
+
+        Kind   kind;
+        size_t length;
+
+        bool operator== (const ByteDiffOp &op) const {return kind == op.kind && length == op.length;}
+    };
+
+
+    /** Computes a shortest edit script between two byte strings, using Myers' linear-space
+        O(ND) algorithm <http://www.xmailserver.org/diff2.pdf>. The strings are compared in
+        place; nothing is copied.
+
+        Consecutive ops never have the same kind, and a deletion is always followed by an
+        insertion rather than vice versa.
+
+        If `timeout` (in seconds) is positive, the search stops refining once it's used up;
+        the result is still a valid edit script, just not a minimal one. */
+    std::vector<ByteDiffOp> diffBytes(slice oldBytes, slice newBytes, double timeout =0);
+
+}
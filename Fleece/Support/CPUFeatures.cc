@@ -0,0 +1,90 @@
+//
+// CPUFeatures.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "CPUFeatures.hh"
+
+#if defined(__aarch64__) && defined(__linux__)
+    #include <sys/auxv.h>
+    #include <asm/hwcap.h>
+#endif
+
+namespace fleece { namespace cpu {
+
+    std::atomic<Features> internal::gEnabled {internal::kUnknown};
+
+    static std::atomic<Features> sDisabled {0};
+
+
+    static Features detect() noexcept {
+        Features features = 0;
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+        // (`__builtin_cpu_supports` also checks that the OS saves the wider registers.)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.2"))
+            features |= kSSE42;
+        if (__builtin_cpu_supports("avx2"))
+            features |= kAVX2;
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            features |= kAVX512;
+#elif defined(__aarch64__)
+        features |= kNEON;              // it's in the arm64 baseline
+    #if defined(__linux__)
+        if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+            features |= kARMCRC32;
+    #elif defined(__APPLE__) || defined(__ARM_FEATURE_CRC32)
+        features |= kARMCRC32;          // all Apple arm64 CPUs have it
+    #endif
+#endif
+        return features;
+    }
+
+
+    Features detected() noexcept {
+        static const Features sDetected = detect();
+        return sDetected;
+    }
+
+
+    Features enabled() noexcept {
+        Features features = detected() & ~sDisabled.load(std::memory_order_relaxed);
+        internal::gEnabled.store(features, std::memory_order_relaxed);
+        return features;
+    }
+
+
+    void setDisabled(Features features) noexcept {
+        sDisabled.store(features, std::memory_order_relaxed);
+        enabled();
+    }
+
+
+    std::string describe(Features features) {
+        static const char* const kNames[] = {"sse4.2", "avx2", "avx512", "neon", "crc32"};
+        std::string result;
+        for (unsigned i = 0; i < sizeof(kNames) / sizeof(kNames[0]); ++i) {
+            if (features & (1u << i)) {
+                if (!result.empty())
+                    result += ' ';
+                result += kNames[i];
+            }
+        }
+        return result;
+    }
+
+} }
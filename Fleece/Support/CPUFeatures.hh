@@ -0,0 +1,70 @@
+//
+// CPUFeatures.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/Base.h"
+#include <atomic>
+#include <string>
+
+namespace fleece { namespace cpu {
+
+    /** Optional instruction-set extensions that Fleece has specialized code for.
+
+        The functions using them are compiled for the extension (with a `target` attribute) in
+        the same source file as their generic versions, and call sites pick one at runtime with
+        `has`, so one binary uses the best code each host supports. Extensions in the target's
+        baseline (like NEON on arm64) are still represented, so they can be disabled too. */
+    enum Feature : unsigned {
+        kSSE42      = 1 << 0,       ///< x86 SSE4.2 (including the CRC32C instructions)
+        kAVX2       = 1 << 1,       ///< x86 AVX2
+        kAVX512     = 1 << 2,       ///< x86 AVX-512 Foundation and Byte/Word instructions
+        kNEON       = 1 << 3,       ///< ARM Advanced SIMD
+        kARMCRC32   = 1 << 4,       ///< ARMv8 CRC32 instructions
+    };
+
+    using Features = unsigned;
+
+    /** The features the CPU (and OS) support. Detected on the first call; later calls are cheap. */
+    Features detected() noexcept;
+
+    /** The detected features minus the ones disabled with `setDisabled`. */
+    Features enabled() noexcept;
+
+    /** Stops Fleece from using some features, which is useful for testing the generic code,
+        or for working around hardware trouble. Pass 0 to re-enable everything. */
+    void setDisabled(Features) noexcept;
+
+    /** A readable list of features, like "sse4.2 avx2". */
+    std::string describe(Features);
+
+
+    namespace internal {
+        // The enabled features, or kUnknown until they're first detected.
+        static constexpr Features kUnknown = 1u << 31;
+        extern std::atomic<Features> gEnabled;
+    }
+
+    /** True if a feature is supported and not disabled. */
+    static inline bool has(Feature f) noexcept {
+        Features features = internal::gEnabled.load(std::memory_order_relaxed);
+        if (_usuallyFalse(features == internal::kUnknown))
+            features = enabled();
+        return (features & f) != 0;
+    }
+
+} }
@@ -0,0 +1,124 @@
+//
+// CRC32C.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "CRC32C.hh"
+#include "CPUFeatures.hh"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    // SSE4.2 isn't in the x86-64 baseline, so its function is compiled for it separately and
+    // only called if the CPU supports it:
+    #include <nmmintrin.h>
+    #define FL_CRC32C_SSE42 1
+#elif defined(__ARM_FEATURE_CRC32)
+    #include <arm_acle.h>
+    #define FL_CRC32C_ARM 1
+#endif
+
+namespace fleece {
+
+    static constexpr uint32_t kPolynomial = 0x82F63B78;     // Castagnoli, bit-reversed
+
+
+    // Tables for the "slicing-by-8" algorithm, which processes 8 bytes per step:
+    // table[0] is the classic byte-wise table, and table[k][b] is the CRC of byte b followed
+    // by k zero bytes.
+    struct CRCTables {
+        uint32_t table[8][256];
+
+        constexpr CRCTables() :table() {
+            for (uint32_t b = 0; b < 256; ++b) {
+                uint32_t crc = b;
+                for (int bit = 0; bit < 8; ++bit)
+                    crc = (crc >> 1) ^ (kPolynomial & (0 - (crc & 1)));
+                table[0][b] = crc;
+            }
+            for (uint32_t b = 0; b < 256; ++b)
+                for (int k = 1; k < 8; ++k)
+                    table[k][b] = (table[k-1][b] >> 8) ^ table[0][table[k-1][b] & 0xFF];
+        }
+    };
+
+    static constexpr CRCTables kTables;
+
+
+    static uint32_t crc32cSoftware(const uint8_t *p, size_t size, uint32_t crc) noexcept {
+        auto &t = kTables.table;
+        for (; size >= 8; size -= 8, p += 8) {
+            uint32_t lo, hi;
+            memcpy(&lo, p, 4);
+            memcpy(&hi, p + 4, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            lo = __builtin_bswap32(lo);
+            hi = __builtin_bswap32(hi);
+#endif
+            lo ^= crc;
+            crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF]
+                ^ t[4][lo >> 24] ^ t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF]
+                ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (; size > 0; --size)
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        return crc;
+    }
+
+
+#if FL_CRC32C_SSE42
+    __attribute__((target("sse4.2")))
+    static uint32_t crc32cHardware(const uint8_t *p, size_t size, uint32_t crc) noexcept {
+        uint64_t crc64 = crc;
+        for (; size >= 8; size -= 8, p += 8) {
+            uint64_t n;
+            memcpy(&n, p, 8);
+            crc64 = _mm_crc32_u64(crc64, n);
+        }
+        crc = uint32_t(crc64);
+        for (; size > 0; --size)
+            crc = _mm_crc32_u8(crc, *p++);
+        return crc;
+    }
+
+    static bool haveHardware() noexcept {return cpu::has(cpu::kSSE42);}
+
+#elif FL_CRC32C_ARM
+    static uint32_t crc32cHardware(const uint8_t *p, size_t size, uint32_t crc) noexcept {
+        for (; size >= 8; size -= 8, p += 8) {
+            uint64_t n;
+            memcpy(&n, p, 8);
+            crc = __crc32cd(crc, n);
+        }
+        for (; size > 0; --size)
+            crc = __crc32cb(crc, *p++);
+        return crc;
+    }
+
+    static bool haveHardware() noexcept {return cpu::has(cpu::kARMCRC32);}
+#endif
+
+
+    uint32_t crc32c(slice data, uint32_t crc) noexcept {
+        auto p = (const uint8_t*)data.buf;
+        crc = ~crc;
+#if FL_CRC32C_SSE42 || FL_CRC32C_ARM
+        if (haveHardware())
+            return ~crc32cHardware(p, data.size, crc);
+#endif
+        return ~crc32cSoftware(p, data.size, crc);
+    }
+
+}
@@ -0,0 +1,30 @@
+//
+// CRC32C.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+
+namespace fleece {
+
+    /** Computes the CRC-32C (Castagnoli) checksum of data. It uses the CPU's CRC instructions
+        where available (SSE4.2 on x86, the CRC extension on ARM), else a table-driven version.
+        To checksum data in pieces, pass the previous piece's result as `crc`.
+        The CRC of "123456789" is 0xE3069283. */
+    uint32_t crc32c(slice data, uint32_t crc =0) noexcept;
+
+}
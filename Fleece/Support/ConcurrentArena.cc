@@ -17,23 +17,53 @@
 //
 
 #include "ConcurrentArena.hh"
+#include <new>
 #include <string.h>
 
 using namespace std;
 
 namespace fleece {
 
+    // A thread's buffer for allocating from an arena.
+    struct ThreadBuffer {
+        uint64_t arenaID {0};               // The arena's _id, or 0 if unused
+        uint8_t *start {nullptr}, *next {nullptr}, *end {nullptr};
+    };
+
+    // Each thread has buffers for the last few arenas it's allocated from:
+    static constexpr unsigned kThreadBuffers = 4;
+    static thread_local ThreadBuffer tBuffers[kThreadBuffers];
+    static thread_local unsigned tNextBuffer = 0;
+
+    // Arena IDs are never reused, so a buffer can't be mistaken for one from a destructed arena.
+    static atomic<uint64_t> sNextArenaID {1};
+
+    static inline ThreadBuffer* findThreadBuffer(uint64_t arenaID) {
+        for (auto &buf : tBuffers)
+            if (buf.arenaID == arenaID)
+                return &buf;
+        return nullptr;
+    }
+
+
     ConcurrentArena::ConcurrentArena()
-    :_heapEnd(nullptr)
-    ,_nextBlock(nullptr)
+    :_id(sNextArenaID++)
     { }
 
 
-    ConcurrentArena::ConcurrentArena(size_t capacity)
-    :_heap(new uint8_t[capacity])
-    ,_heapEnd(&_heap[capacity])
-    ,_nextBlock(&_heap[0])
-    { }
+    ConcurrentArena::ConcurrentArena(size_t capacity, bool growable, size_t threadBufferSize)
+    :_initialSize(max(min(capacity, kMaxSegmentSize), size_t(1)))
+    ,_growable(growable)
+    ,_threadBufferSize(min(threadBufferSize, _initialSize))
+    ,_id(sNextArenaID++)
+    {
+        _segments[0] = new uint8_t[_initialSize];
+    }
+
+
+    ConcurrentArena::~ConcurrentArena() {
+        freeSegments();
+    }
 
 
     ConcurrentArena::ConcurrentArena(ConcurrentArena &&other) {
@@ -42,23 +72,119 @@ namespace fleece {
 
 
     ConcurrentArena& ConcurrentArena::operator=(ConcurrentArena &&other) {
-        _heap = move(other._heap);
-        _heapEnd = other._heapEnd;
-        _nextBlock = other._nextBlock.load();
+        if (&other != this) {
+            freeSegments();
+            _initialSize = other._initialSize;
+            _growable = other._growable;
+            for (unsigned i = 0; i < kMaxSegments; ++i)
+                _segments[i] = other._segments[i].exchange(nullptr);
+            _next = other._next.exchange(0);
+            _threadBufferSize = other._threadBufferSize;
+            _id = other._id;                // threads' buffers are still good, in my segments
+            other._initialSize = 0;
+            other._growable = false;
+            other._threadBufferSize = 0;
+            other._id = sNextArenaID++;
+        }
         return *this;
     }
 
 
+    void ConcurrentArena::freeSegments() {
+        for (auto &segment : _segments)
+            delete[] segment.exchange(nullptr);
+    }
+
+
+    size_t ConcurrentArena::capacity() const {
+        size_t total = 0;
+        for (unsigned i = 0; i < kMaxSegments && _segments[i]; ++i)
+            total += segmentSize(i);
+        return total;
+    }
+
+
+    size_t ConcurrentArena::allocated() const {
+        size_t next = _next, total = next & kOffsetMask;
+        for (unsigned i = 0; i < (next >> kSegmentShift); ++i)
+            total += segmentSize(i);
+        return total;
+    }
+
+
+    size_t ConcurrentArena::available() const {
+        size_t next = _next;
+        if (!_segments[next >> kSegmentShift])
+            return 0;
+        return segmentSize(unsigned(next >> kSegmentShift)) - (next & kOffsetMask);
+    }
+
+
+    // Makes sure segment `i` exists. Threads may race to add it; only one wins.
+    bool ConcurrentArena::addSegment(unsigned i) {
+        if (i >= kMaxSegments || !_growable)
+            return false;
+        if (_segments[i].load(memory_order_acquire))
+            return true;
+        auto segment = new (nothrow) uint8_t[segmentSize(i)];
+        if (!segment)
+            return false;
+        uint8_t *expected = nullptr;
+        if (!_segments[i].compare_exchange_strong(expected, segment, memory_order_acq_rel))
+            delete[] segment;
+        return true;
+    }
+
+
+    void ConcurrentArena::freeAll() {
+        _next = 0;
+        _id = sNextArenaID++;               // abandons all threads' buffers
+    }
+
+
     __hot
     void* ConcurrentArena::alloc(size_t size) {
-        uint8_t *result, *newNext, *nextBlock = _nextBlock;
-        do {
-            result = nextBlock;
-            newNext = nextBlock + size;
-            if (newNext > _heapEnd)
-                return nullptr;  // overflow
-        } while (!_nextBlock.compare_exchange_weak(nextBlock, newNext, memory_order_acq_rel));
-        return result;
+        if (_threadBufferSize > 0 && size <= _threadBufferSize / 4) {
+            ThreadBuffer *buf = findThreadBuffer(_id);
+            if (_usuallyFalse(!buf)) {
+                buf = &tBuffers[tNextBuffer++ % kThreadBuffers];
+                *buf = {};
+            }
+            if (_usuallyFalse(size_t(buf->end - buf->next) < size)) {
+                // Get a new buffer, abandoning what's left of the old one:
+                auto block = (uint8_t*)sharedAlloc(_threadBufferSize);
+                if (!block)
+                    return sharedAlloc(size);
+                *buf = {_id, block, block, block + _threadBufferSize};
+            }
+            uint8_t *result = buf->next;
+            buf->next += size;
+            return result;
+        }
+        return sharedAlloc(size);
+    }
+
+
+    __hot
+    void* ConcurrentArena::sharedAlloc(size_t size) {
+        if (_usuallyFalse(size > kMaxSegmentSize))
+            return nullptr;
+        size_t next = _next.load(memory_order_acquire);
+        while (true) {
+            auto segment = unsigned(next >> kSegmentShift);
+            size_t offset = next & kOffsetMask;
+            if (_usuallyTrue(offset + size <= segmentSize(segment))) {
+                if (_next.compare_exchange_weak(next, next + size, memory_order_acq_rel))
+                    return _segments[segment].load(memory_order_acquire) + offset;
+            } else {
+                // This segment is full; move on to the next one, adding it if necessary:
+                if (!addSegment(segment + 1))
+                    return nullptr;  // overflow
+                size_t newNext = size_t(segment + 1) << kSegmentShift;
+                if (_next.compare_exchange_strong(next, newNext, memory_order_acq_rel))
+                    next = newNext;
+            }
+        }
     }
 
 
@@ -72,9 +198,29 @@ namespace fleece {
 
 
     bool ConcurrentArena::free(void *block, size_t size) {
-        uint8_t *nextBlock = (uint8_t*)block + size;
-        uint8_t *newNext = (uint8_t*)block;
-        return _nextBlock.compare_exchange_weak(nextBlock, newNext, memory_order_acq_rel);
+        if (_threadBufferSize > 0) {
+            ThreadBuffer *buf = findThreadBuffer(_id);
+            if (buf && block >= buf->start && (uint8_t*)block + size == buf->next) {
+                buf->next = (uint8_t*)block;
+                return true;
+            }
+        }
+        size_t newNext = toOffset(block);
+        size_t next = newNext + size;
+        return _next.compare_exchange_strong(next, newNext, memory_order_acq_rel);
+    }
+
+
+    size_t ConcurrentArena::toOffset(const void *ptr) const {
+        for (unsigned i = 0; i < kMaxSegments; ++i) {
+            auto segment = _segments[i].load(memory_order_acquire);
+            if (!segment)
+                break;
+            if (ptr >= segment && ptr < segment + segmentSize(i))
+                return (size_t(i) << kSegmentShift) | size_t((const uint8_t*)ptr - segment);
+        }
+        assert(false);
+        return 0;
     }
 
 }
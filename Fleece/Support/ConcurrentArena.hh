@@ -7,33 +7,55 @@
 #pragma once
 #include "PlatformCompat.hh"
 #include "betterassert.hh"
+#include <algorithm>
 #include <atomic>
 #include <memory>
 
 namespace fleece {
 
-    /** A simple memory allocator that carves blocks out of a pre-allocated fixed-size heap block.
+    /** A simple memory allocator that carves blocks out of pre-allocated heap segments.
         To allocate a new block it simply bumps a pointer forward by the size requested.
+        A growable arena adds a new segment, twice the size of the previous one, when the current
+        one fills up; existing blocks never move.
+        To keep threads from contending for the pointer, an arena can give each thread its own
+        buffer: a thread allocates small blocks from its buffer without any atomic operations,
+        and only goes to the shared pointer when the buffer runs out.
         It is not generally possible to free blocks, although the _last_ allocated block can be freed
         by bumping the pointer backwards.
         Obviously all blocks are freed/invalidated when the ConcurrentArena itself is destructed. */
     class ConcurrentArena {
     public:
+        /// The maximum number of segments, and the largest a segment (or block) can be.
+        static constexpr unsigned kMaxSegments = 16;
+        static constexpr size_t kMaxSegmentSize = size_t(1) << 26;
+
         /** Constructs an arena with the given byte capacity. This allocates a block of that size
-            from the default heap using ::operator new. */
-        ConcurrentArena(size_t capacity);
+            (at most kMaxSegmentSize) from the default heap using ::operator new.
+            If `growable` is true, more segments are allocated as needed.
+            If `threadBufferSize` is nonzero, each thread allocates blocks up to a quarter of that
+            size from a buffer of its own, of that size. Any space left in a thread's buffer when
+            the thread exits is wasted, so this is best for growable arenas that threads make
+            many allocations from. */
+        explicit ConcurrentArena(size_t capacity, bool growable =false,
+                                 size_t threadBufferSize =0);
 
         /** Constructs an empty arena, without allocating any space.
             This is only provided so that an arena can be initialized for real after its constructor,
             by assigning it a new instance with operator=. */
         ConcurrentArena();
 
+        ~ConcurrentArena();
+
         ConcurrentArena(ConcurrentArena&&);
         ConcurrentArena& operator=(ConcurrentArena &&);
 
-        size_t capacity() const FLPURE      {return _heapEnd - _heap.get();}
-        size_t allocated() const FLPURE     {return _nextBlock - _heap.get();}
-        size_t available() const FLPURE     {return _heapEnd - _nextBlock;}
+        /// The total size of all the segments allocated so far.
+        size_t capacity() const FLPURE;
+        /// The number of bytes used, including any unused space at the ends of full segments
+        /// and in threads' buffers.
+        size_t allocated() const FLPURE;
+        /// The number of bytes left in the current segment.
+        size_t available() const FLPURE;
 
         /** Allocates a new block of the given size.
             @return The new block, or nullptr if there's no space. */
@@ -43,35 +65,50 @@ namespace fleece {
             @return The new block, or nullptr if there's no space. */
         void* calloc(size_t size);
 
-        /** _Attempts_ to free the given block. This only works if it's the latest allocated block.
+        /** _Attempts_ to free the given block. This only works if it's the latest block allocated
+            (by this thread, if it came from the thread's buffer.)
              @param allocatedBlock  A block allocated by `alloc` or `calloc`.
              @param size  The exact size of the block, as given to `alloc` or `calloc`.
              @return  True if freed, false if not. */
         bool free(void *allocatedBlock, size_t size);
 
         /** Frees all allocated blocks, resetting the arena to its empty state.
-            (Does not free the arena heap itself!) */
-        void freeAll()                      {_nextBlock = _heap.get();}
+            (Does not free the arena's segments themselves!)
+            Must not be called concurrently with allocations. */
+        void freeAll();
 
-        /** Converts a block pointer to an integer offset from the start of the heap.
-            The offset will be less than the arena's capacity.
+        /** Converts a block pointer to an integer offset, which encodes its segment number and
+            its position in that segment. The offset is less than `kMaxSegments * kMaxSegmentSize`.
             (This also works for interior pointers within blocks.) */
-        size_t toOffset(const void *ptr) const FLPURE {
-            assert(ptr >= _heap.get() && ptr < _heapEnd);
-            return (uint8_t*)ptr - _heap.get();
-        }
+        size_t toOffset(const void *ptr) const FLPURE;
 
-        /** Converts a heap offset back into a pointer. */
+        /** Converts an offset back into a pointer. */
         void* toPointer(size_t off) const FLPURE {
-            void *ptr = _heap.get() + off;
-            assert(ptr < _heapEnd);
-            return ptr;
+            uint8_t *segment = _segments[off >> kSegmentShift].load(std::memory_order_acquire);
+            assert(segment && (off & kOffsetMask) < segmentSize(unsigned(off >> kSegmentShift)));
+            return segment + (off & kOffsetMask);
         }
 
     private:
-        std::unique_ptr<uint8_t[]>  _heap;      // The heap block used for storage
-        uint8_t*                    _heapEnd;   // Points just past the end of the heap
-        std::atomic<uint8_t*>       _nextBlock; // Points to the next available byte
+        static constexpr unsigned kSegmentShift = 26;
+        static constexpr size_t kOffsetMask = kMaxSegmentSize - 1;
+
+        size_t segmentSize(unsigned i) const FLPURE {
+            // Each segment is twice the size of the one before, up to kMaxSegmentSize:
+            if (i >= kSegmentShift || _initialSize >= (kMaxSegmentSize >> i))
+                return kMaxSegmentSize;
+            return _initialSize << i;
+        }
+        void* sharedAlloc(size_t size);
+        bool addSegment(unsigned i);
+        void freeSegments();
+
+        size_t                      _initialSize {0};   // Size of the first segment
+        bool                        _growable {false};  // May more segments be added?
+        std::atomic<uint8_t*>       _segments[kMaxSegments] {};  // The heap blocks used for storage
+        std::atomic<size_t>         _next {0};          // Offset of the next available byte
+        size_t                      _threadBufferSize {0}; // Size of threads' buffers, or 0
+        uint64_t                    _id;                // Identifies threads' buffers from me
     };
 
 
@@ -19,10 +19,7 @@
 #include "ConcurrentMap.hh"
 #include <algorithm>
 #include <cmath>
-
-#if defined(_WIN32) || defined(_WIN64)
-#include <Windows.h>
-#endif
+#include <thread>
 
 
 using namespace std;
@@ -33,78 +30,128 @@ namespace fleece {
      This is based on the “folklore” table described in “Concurrent Hash Tables: Fast and
      General(?)!” by Maier et al. <https://arxiv.org/pdf/1601.04017.pdf>. It's a pretty basic
      open hash table with linear probing. Atomic compare-and-swap operations are used to update
-     entries, but not to read them.
+     entries, each of which is a single 64-bit word so it can't suffer from torn reads.
 
      It doesn't support modifying the value of an entry, simply because SharedKeys doesn't need it.
 
-     It cannot grow past its initial capacity; this is rather difficult to do in a concurrent map
-     (the paper describes how) and would add a lot of complexity ... and again, SharedKeys has a
-     fixed capacity of 2048 so it doesn't need this.
+     Growing works as the paper describes: when a table fills up, a table twice the size is
+     created and linked to it by its `next` pointer, and every entry is migrated to it. Each
+     entry is first "frozen" by setting the high bit of its keyOffset, with a CAS, so no insert
+     or remove can change it after it's been copied. Inserters and removers that come across a
+     migration help with it, claiming chunks of entries to copy, then wait for any chunks that
+     other threads are still copying; after that they, and all later writers, use the new table.
+     Readers never wait: a frozen entry still holds its key and value, and a reader that doesn't
+     find a key in one table follows `next` to look in the newer one. Old tables aren't freed
+     until the map is, since readers may still be looking at them; in total they take up no more
+     space than the newest table.
+
+     The keys are stored in a growable ConcurrentArena, which adds segments as needed, so their
+     addresses never change. An entry refers to its key by the key's offset in the arena.
 
      Since insertions are not very common, it's worth the expense to materialize the count in an
      atomic integer variable, and update it on insert/delete, instead of the more complex
      techniques used in the paper.
 
-     Maier et al state (without explanation) that, unlike ordinary open hash tables, the "folklore"
-     table cannot reuse 'tombstones' for new entries. I believe the reason is that there could be
-     incorrect results from "torn reads" -- non-atomic reads where the two fields of the Entry
-     are not consistent with each other. However, this implementation does not suffer from torn
-     reads since its Entry is only 32 bits, as opposed to two words (128 bits). So to the best
-     of my knowledge, reusing deleted entries is safe.
-
-     Still, this table does have the common problem that large numbers of tombstones degrade
-     read performance, since tombstones have to be scanned past by the `find` method just as if they
-     were occupied. The solution would be to copy the extant entries to a new table, but (as with
-     growing) this is pretty complex in a lockless concurrent table.
+     Deleted entries are left as tombstones, which inserts can reuse. Tombstones degrade read
+     performance, since `find` has to scan past them as if they were occupied, but since
+     migration doesn't copy them, a table that fills up with them is rebuilt at the same size.
      */
 
 
     // Minimum size [not capacity] of table to create initially
     static constexpr size_t kMinInitialSize = 16;
 
+    // Max size of a table
+    static constexpr int kMaxTableSize = 1 << 30;
+
     // Max fraction of table entries that should be occupied (else lookups slow down)
     static constexpr float kMaxLoad = 0.6f;
 
+    // Number of entries a thread claims at a time when migrating
+    static constexpr int kMigrationChunkSize = 1024;
+
 
     // Special values of Entry::keyOffset
-    static constexpr uint16_t kEmptyKeyOffset = 0,   // an empty Entry
-                              kDeletedKeyOffset = 1, // a deleted Entry
-                              kMinKeyOffset = 2;     // first actual key offset
-
-
-    // Cross-platform atomic test-and-set primitive:
-    // If `*value == oldValue`, stores `newValue` and returns true. Else returns false.
-    // Note: This could work with values up to 128 bits, on current 64-bit CPUs.
-    static inline bool atomicCompareAndSwap(uint32_t *value, uint32_t oldValue, uint32_t newValue) {
-#if defined(_WIN32) || defined(_WIN64)
-        // https://docs.microsoft.com/en-us/windows/win32/api/winnt/nf-winnt-interlockedcompareexchange
-        return InterlockedCompareExchange(value, newValue, oldValue) == oldValue;
-#else
-        // https://gcc.gnu.org/onlinedocs/gcc-4.1.1/gcc/Atomic-Builtins.html  (also in Clang)
-        return __sync_bool_compare_and_swap(value, oldValue, newValue);
-#endif
+    static constexpr uint32_t kEmptyKeyOffset = 0,      // an empty Entry
+                              kDeletedKeyOffset = 1,    // a deleted Entry
+                              kMinKeyOffset = 2,        // first actual key offset
+                              kFrozenFlag = 0x80000000; // set on entries that have been migrated
+
+    static_assert(ConcurrentArena::kMaxSegments * ConcurrentArena::kMaxSegmentSize
+                    + kMinKeyOffset < kFrozenFlag);
+
+
+    static inline int tableCapacity(int size) {
+        return int(floor(size * kMaxLoad));
     }
 
 
+    // One generation of the hash table.
+    struct ConcurrentMap::Table {
+        explicit Table(int size)
+        :sizeMask(size - 1)
+        ,capacity(tableCapacity(size))
+        ,entries(new atomic<uint64_t>[size])
+        {
+            for (int i = 0; i < size; ++i)
+                entries[i].store(0, memory_order_relaxed);
+        }
+
+        int size() const FLPURE                         {return sizeMask + 1;}
+        int wrap(int i) const FLPURE                    {return i & sizeMask;}
+        int indexOfHash(hash_t h) const FLPURE          {return wrap(int(h));}
+
+        Entry get(int i) const {
+            return Entry::fromInt(entries[i].load(memory_order_acquire));
+        }
+
+        // If entry `i` is `expected`, stores `swapWith` and returns true. Else returns false.
+        bool compareAndSwap(int i, Entry expected, Entry swapWith) {
+            uint64_t e = expected.asInt();
+            return entries[i].compare_exchange_strong(e, swapWith.asInt(), memory_order_acq_rel);
+        }
+
+        // Adds a migrated entry, whose key is known not to be in this table yet.
+        void copyIn(Entry entry, hash_t hash) {
+            for (int i = indexOfHash(hash); true; i = wrap(i + 1)) {
+                while (get(i).keyOffset == kEmptyKeyOffset) {
+                    if (compareAndSwap(i, {kEmptyKeyOffset, 0}, entry))
+                        return;
+                }
+            }
+        }
+
+        int const                       sizeMask;   // table size - 1; for quick modulo via AND
+        int const                       capacity;   // Max number of entries
+        unique_ptr<atomic<uint64_t>[]>  entries;    // The table: array of key/value pairs
+        atomic<Table*>                  next {nullptr};     // Newer table being migrated to
+        atomic<int>                     migrateCursor {0};  // Next chunk to be migrated
+        atomic<int>                     migratedChunks {0}; // Number of chunks migrated
+        atomic<bool>                    migrated {false};   // True when all chunks are migrated
+    };
+
+
 
     ConcurrentMap::ConcurrentMap(int capacity, int stringCapacity) {
         precondition(capacity <= kMaxCapacity);
         int size;
         for (size = kMinInitialSize; size * kMaxLoad < capacity; size *= 2)
             ;
-        _capacity = int(floor(size * kMaxLoad));
-        _sizeMask = size - 1;
-
         if (stringCapacity == 0)
-            stringCapacity = 17 * _capacity;    // assume 16-byte strings by default
-        stringCapacity = min(stringCapacity, int(kMaxStringCapacity));
-        size_t tableSize = size * sizeof(Entry);
-        
-        _heap = ConcurrentArena(tableSize + stringCapacity);
-        _entries = ConcurrentArenaAllocator<Entry, true>(_heap).allocate(size);
-        _keysOffset = tableSize - kMinKeyOffset;
-        
-        postcondition(_heap.available() == stringCapacity);
+            stringCapacity = 17 * tableCapacity(size);    // assume 16-byte strings by default
+        _keys = ConcurrentArena(min(size_t(stringCapacity), ConcurrentArena::kMaxSegmentSize),
+                                true);
+        _oldestTable = new Table(size);
+        _table = _oldestTable;
+    }
+
+
+    ConcurrentMap::~ConcurrentMap() {
+        for (Table *table = _oldestTable; table; ) {
+            Table *next = table->next;
+            delete table;
+            table = next;
+        }
     }
 
 
@@ -114,29 +161,31 @@ namespace fleece {
 
 
     ConcurrentMap& ConcurrentMap::operator=(ConcurrentMap &&map) {
-        _sizeMask = map._sizeMask;
-        _capacity = map._capacity;
-        _count = map._count.load();
-        _entries = map._entries;
-        _heap = move(map._heap);
+        swap(_oldestTable, map._oldestTable);
+        _table = map._table.exchange(_table);
+        _count = map._count.exchange(_count);
+        swap(_keys, map._keys);
         return *this;
     }
 
 
-    int ConcurrentMap::stringBytesCapacity() const {
-        return int(_heap.capacity() - (_keysOffset + kMinKeyOffset));
+    int ConcurrentMap::capacity() const {
+        return _table.load(memory_order_acquire)->capacity;
     }
 
 
-    int ConcurrentMap::stringBytesCount() const {
-        return int(_heap.allocated() - (_keysOffset + kMinKeyOffset));
+    int ConcurrentMap::tableSize() const {
+        return _table.load(memory_order_acquire)->size();
     }
 
 
-    __hot
-    bool ConcurrentMap::Entry::compareAndSwap(Entry expected, Entry swapWith) {
-        static_assert(sizeof(Entry) == 4);
-        return atomicCompareAndSwap(&asInt32(), expected.asInt32(), swapWith.asInt32());
+    int ConcurrentMap::stringBytesCapacity() const {
+        return int(_keys.capacity());
+    }
+
+
+    int ConcurrentMap::stringBytesCount() const {
+        return int(_keys.allocated());
     }
 
 
@@ -147,36 +196,43 @@ namespace fleece {
 
 
     __hot
-    inline uint16_t ConcurrentMap::keyToOffset(const char *allocedKey) const {
-        ptrdiff_t result = _heap.toOffset(allocedKey) - _keysOffset;
-        assert(result >= kMinKeyOffset && result <= UINT16_MAX);
-        return uint16_t(result);
+    inline uint32_t ConcurrentMap::keyToOffset(const char *allocedKey) const {
+        return uint32_t(_keys.toOffset(allocedKey) + kMinKeyOffset);
     }
 
 
     __hot
-    inline const char* ConcurrentMap::offsetToKey(uint16_t offset) const {
-        assert(offset >= kMinKeyOffset);
-        return (const char*)_heap.toPointer(_keysOffset + offset);
+    inline const char* ConcurrentMap::offsetToKey(uint32_t offset) const {
+        assert(offset >= kMinKeyOffset && !(offset & kFrozenFlag));
+        return (const char*)_keys.toPointer(offset - kMinKeyOffset);
     }
 
 
     __hot
     ConcurrentMap::result ConcurrentMap::find(slice key, hash_t hash) const noexcept {
         assert_precondition(key);
-        for (int i = indexOfHash(hash); true; i = wrap(i + 1)) {
-            Entry current = _entries[i];
-            switch (current.keyOffset) {
-                case kEmptyKeyOffset:
-                    return {};
-                case kDeletedKeyOffset:
+        for (Table *table = _table.load(memory_order_acquire); table;
+                    table = table->next.load(memory_order_acquire)) {
+            int i = table->indexOfHash(hash);
+            for (int probes = 0; probes <= table->sizeMask; ++probes, i = table->wrap(i + 1)) {
+                Entry current = table->get(i);
+                uint32_t keyOffset = current.keyOffset & ~kFrozenFlag;
+                if (keyOffset == kEmptyKeyOffset)
                     break;
-                default:
-                    if (auto keyPtr = offsetToKey(current.keyOffset); equalKeys(keyPtr, key))
+                if (keyOffset == kDeletedKeyOffset)
+                    continue;
+                if (auto keyPtr = offsetToKey(keyOffset); equalKeys(keyPtr, key)) {
+                    // A frozen entry is still current until the migration is complete, since
+                    // nothing can change in the new table till then:
+                    if (!(current.keyOffset & kFrozenFlag)
+                            || !table->migrated.load(memory_order_acquire))
                         return {slice(keyPtr, key.size), current.value};
                     break;
+                }
             }
+            // Not found here, but may be in a newer table...
         }
+        return {};
     }
 
 
@@ -184,52 +240,86 @@ namespace fleece {
     ConcurrentMap::result ConcurrentMap::insert(slice key, value_t value, hash_t hash) {
         assert_precondition(key);
         const char *allocedKey = nullptr;
-        int i = indexOfHash(hash);
+        Table *table = writableTable();
         while (true) {
         retry:
-            Entry current = _entries[i];
-            switch (current.keyOffset) {
-                case kEmptyKeyOffset:
-                case kDeletedKeyOffset: {
-                    // Found an empty or deleted entry to use. First allocate the string:
-                    if (!allocedKey) {
-                        if (_count >= _capacity)
-                            return {};          // Hash table overflow
-                        allocedKey = allocKey(key);
-                        if (!allocedKey)
-                            return {};          // Key-strings overflow
-                    }
-                    Entry newEntry = {keyToOffset(allocedKey), value};
-                    // Try to store my new entry, if another thread didn't beat me to it:
-                    if (_usuallyFalse(!_entries[i].compareAndSwap(current, newEntry))) {
-                        // I was beaten to it; retry (at the same index,
-                        // in case CAS was a false negative)
-                        goto retry;
-                    }
-                    // Success!
-                    ++_count;
-                    assert(_count <= _capacity);
-                    return {slice(allocedKey, key.size), value};
+            // Look for the key, remembering the first deleted entry on the way:
+            int i = table->indexOfHash(hash), freeIndex = -1;
+            Entry freeEntry {};
+            for (int probes = 0; true; ++probes, i = table->wrap(i + 1)) {
+                if (_usuallyFalse(probes > table->sizeMask)) {
+                    if (freeIndex >= 0)
+                        break;
+                    table = grow(table);            // Table is full of tombstones
+                    if (!table)
+                        goto overflow;
+                    goto retry;
                 }
-                default:
-                    if (auto keyPtr = offsetToKey(current.keyOffset); equalKeys(keyPtr, key)) {
-                        // Key already exists in table. Deallocate any string I allocated:
-                        freeKey(allocedKey);
-                        return {slice(keyPtr, key.size), current.value};
+                Entry current = table->get(i);
+                if (_usuallyFalse(current.keyOffset & kFrozenFlag)) {
+                    // The table is being migrated; help finish that, then use the new table:
+                    table = writableTable();
+                    goto retry;
+                } else if (current.keyOffset == kEmptyKeyOffset) {
+                    if (freeIndex < 0) {
+                        freeIndex = i;
+                        freeEntry = current;
                     }
                     break;
+                } else if (current.keyOffset == kDeletedKeyOffset) {
+                    if (freeIndex < 0) {
+                        freeIndex = i;
+                        freeEntry = current;
+                    }
+                } else if (auto keyPtr = offsetToKey(current.keyOffset); equalKeys(keyPtr, key)) {
+                    // Key already exists in table. Deallocate any string I allocated:
+                    freeKey(allocedKey);
+                    return {slice(keyPtr, key.size), current.value};
+                }
+            }
+
+            // Found an empty or deleted entry to use. First allocate the string:
+            if (!allocedKey) {
+                if (_count >= table->capacity) {
+                    table = grow(table);
+                    if (!table)
+                        goto overflow;              // Hash table can't grow any more
+                    continue;
+                }
+                allocedKey = allocKey(key);
+                if (!allocedKey)
+                    goto overflow;                  // Key-strings overflow
             }
-            i = wrap(i + 1);
+            Entry newEntry = {keyToOffset(allocedKey), value};
+            // Try to store my new entry, if another thread didn't beat me to it:
+            if (_usuallyTrue(table->compareAndSwap(freeIndex, freeEntry, newEntry))) {
+                // Success!
+                ++_count;
+                return {slice(allocedKey, key.size), value};
+            }
+            // I was beaten to it; start over, in case another thread inserted the same key.
         }
+
+    overflow:
+        freeKey(allocedKey);
+        return {};
     }
 
 
     bool ConcurrentMap::remove(slice key, hash_t hash) {
         assert_precondition(key);
-        int i = indexOfHash(hash);
-        while (true) {
+        Table *table = writableTable();
+        int i = table->indexOfHash(hash);
+        for (int probes = 0; probes <= table->sizeMask; ++probes, i = table->wrap(i + 1)) {
         retry:
-            Entry current = _entries[i];
+            Entry current = table->get(i);
+            if (_usuallyFalse(current.keyOffset & kFrozenFlag)) {
+                // The table is being migrated; help finish that, then use the new table:
+                table = writableTable();
+                i = table->indexOfHash(hash);
+                probes = 0;
+                goto retry;
+            }
             switch (current.keyOffset) {
                 case kEmptyKeyOffset:
                     // Not found.
@@ -239,11 +329,10 @@ namespace fleece {
                 default:
                     if (auto keyPtr = offsetToKey(current.keyOffset); equalKeys(keyPtr, key)) {
                         // Found it -- now replace with a tombstone. Leave the value alone in case
-                        // a concurrent torn read sees the prior offset + new value.
+                        // a concurrent reader sees the prior offset + new value.
                         Entry tombstone = {kDeletedKeyOffset, current.value};
-                        if (_usuallyFalse(!_entries[i].compareAndSwap(current, tombstone))) {
-                            // I was beaten to it; retry (at the same index,
-                            // in case CAS was a false negative)
+                        if (_usuallyFalse(!table->compareAndSwap(i, current, tombstone))) {
+                            // I was beaten to it; retry at the same index
                             goto retry;
                         }
                         // Success!
@@ -255,13 +344,74 @@ namespace fleece {
                     }
                     break;
             }
-            i = wrap(i + 1);
         }
+        return false;
+    }
+
+
+    // Returns the table that inserts and removes should use, after helping to finish migrating
+    // any older one.
+    ConcurrentMap::Table* ConcurrentMap::writableTable() {
+        Table *table = _table.load(memory_order_acquire);
+        while (Table *next = table->next.load(memory_order_acquire)) {
+            migrate(table, next);
+            if (_table.compare_exchange_strong(table, next, memory_order_acq_rel))
+                table = next;
+        }
+        return table;
+    }
+
+
+    // Starts migrating a table to a new one, unless another thread already has, and returns the
+    // new table once the migration is complete. Returns nullptr if the table can't grow.
+    __cold
+    ConcurrentMap::Table* ConcurrentMap::grow(Table *table) {
+        if (!table->next.load(memory_order_acquire)) {
+            // If there's plenty of room but the table is clogged with tombstones, the new table
+            // can be the same size:
+            int size = table->size();
+            if (_count >= table->capacity / 2) {
+                if (size >= kMaxTableSize)
+                    return nullptr;
+                size *= 2;
+            }
+            auto newTable = new Table(size);
+            Table *expected = nullptr;
+            if (!table->next.compare_exchange_strong(expected, newTable, memory_order_acq_rel))
+                delete newTable;                    // another thread beat me to it
+        }
+        return writableTable();
+    }
+
+
+    // Copies every entry of `from` to `to`, in cooperation with any other threads doing the same;
+    // returns when all the entries have been copied.
+    void ConcurrentMap::migrate(Table *from, Table *to) {
+        int size = from->size();
+        int nChunks = (size + kMigrationChunkSize - 1) / kMigrationChunkSize;
+        int chunk;
+        while ((chunk = from->migrateCursor++) < nChunks) {
+            int end = min(size, (chunk + 1) * kMigrationChunkSize);
+            for (int i = chunk * kMigrationChunkSize; i < end; ++i) {
+                // Freeze the entry, so it can't be changed any more:
+                Entry current = from->get(i);
+                while (!from->compareAndSwap(i, current,
+                                             {current.keyOffset | kFrozenFlag, current.value}))
+                    current = from->get(i);
+                if (current.keyOffset >= kMinKeyOffset)
+                    to->copyIn(current, hashCode(slice(offsetToKey(current.keyOffset))));
+            }
+            if (++from->migratedChunks == nChunks)
+                from->migrated.store(true, memory_order_release);
+        }
+        // Wait for other threads to finish the chunks they claimed:
+        while (!from->migrated.load(memory_order_acquire))
+            this_thread::yield();
     }
 
 
     const char* ConcurrentMap::allocKey(slice key) {
-        auto result = (char*)_heap.alloc(key.size + 1);
+        auto result = (char*)_keys.alloc(key.size + 1);
         if (result) {
             key.copyTo(result);
             result[key.size] = 0;
@@ -271,16 +421,17 @@ namespace fleece {
 
 
     bool ConcurrentMap::freeKey(const char *allocedKey) {
-        return allocedKey == nullptr || _heap.free((void*)allocedKey, strlen(allocedKey) + 1);
+        return allocedKey == nullptr || _keys.free((void*)allocedKey, strlen(allocedKey) + 1);
     }
 
     __cold
     void ConcurrentMap::dump() const {
-        int size = tableSize();
+        Table *table = _table.load(memory_order_acquire);
+        int size = table->size();
         int realCount = 0, tombstones = 0, totalDistance = 0, maxDistance = 0;
         for (int i = 0; i < size; i++) {
-            auto e = _entries[i];
-            switch (e.keyOffset) {
+            auto e = table->get(i);
+            switch (e.keyOffset & ~kFrozenFlag) {
                 case kEmptyKeyOffset:
                     printf("%6d\n", i);
                     break;
@@ -290,9 +441,9 @@ namespace fleece {
                     break;
                 default: {
                     ++realCount;
-                    auto keyPtr = offsetToKey(e.keyOffset);
+                    auto keyPtr = offsetToKey(e.keyOffset & ~kFrozenFlag);
                     hash_t hash = hashCode(slice(keyPtr));
-                    int bestIndex = indexOfHash(hash);
+                    int bestIndex = table->indexOfHash(hash);
                     printf("%6d: %-10s = %08x [%5d]", i, keyPtr, hash, bestIndex);
                     if (i != bestIndex) {
                         if (bestIndex > i)
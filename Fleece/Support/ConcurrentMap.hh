@@ -6,49 +6,57 @@
 
 #pragma once
 #include "ConcurrentArena.hh"
+#include "TableHash.hh"
 #include "fleece/slice.hh"
 #include <atomic>
 #include <memory>
 
 namespace fleece {
 
-    /** A lockless concurrent hash table that maps strings to 16-bit ints.
-        Intended for use by SharedKeys. */
+    /** A lockless concurrent hash table that maps strings to integers.
+        It starts out at a given capacity, and grows as needed by migrating its entries to a
+        bigger table; lookups never block, even while that happens.
+        Intended for use by SharedKeys, but it can serve as a general string interning table. */
     class ConcurrentMap {
         public:
-        static constexpr int kMaxCapacity = 0x7FFF;
-        static constexpr int kMaxStringCapacity = 0x10000;
-
-        /** Constructs a ConcurrentMap. The capacity is fixed.
-            @param capacity  The number of keys it needs to hold. Cannot exceed kMaxCapacity.
-            @param stringCapacity  Maximum total size in bytes of all keys, including one byte per
-                                   key as a separator. Cannot exceed kMaxStringCapacity.
+        static constexpr int kMaxCapacity = 0x20000000;
+        static constexpr int kMaxStringCapacity = int(ConcurrentArena::kMaxSegments
+                                                      * ConcurrentArena::kMaxSegmentSize);
+
+        /** Constructs a ConcurrentMap. It will grow if more keys are added than it has room for,
+            but growing takes time and memory, so it's best to give the expected size here.
+            @param capacity  The number of keys it should initially hold. Cannot exceed kMaxCapacity.
+            @param stringCapacity  Initial total size in bytes of all keys, including one byte per
+                                   key as a separator. More storage is added as needed.
                                    If 0 or omitted, value is `17 * capacity`. */
         ConcurrentMap(int capacity, int stringCapacity =0);
 
+        ~ConcurrentMap();
+
         // Move cannot be concurrent with find or insert calls!
         ConcurrentMap(ConcurrentMap&&);
         ConcurrentMap& operator=(ConcurrentMap&&);
 
         /// The type of value associated with a key.
-        using value_t = uint16_t;
+        using value_t = uint32_t;
 
         /// The hash code of a key.
         enum class hash_t : uint32_t { };
 
         /** Computes the hash code of a key. This code can be passed to alternate versions of the
             `find` and `insert` methods, to avoid hashing the same key multiple times. */
-        static inline hash_t hashCode(slice key) FLPURE {return hash_t( key.hash() );}
+        static inline hash_t hashCode(slice key) FLPURE {return hash_t( tableHash(key) );}
 
         int count() const FLPURE                     {return _count;}
-        int capacity() const FLPURE                  {return _capacity;}
-        int tableSize() const FLPURE                 {return _sizeMask + 1;}
+        /// The number of keys the current table can hold before it has to grow.
+        int capacity() const FLPURE;
+        int tableSize() const FLPURE;
         int stringBytesCapacity() const FLPURE;
         int stringBytesCount() const FLPURE;
 
         struct result {
             slice key;
-            uint16_t value;
+            value_t value;
         };
 
         /** Looks up the key. Returns the value, as well as the key in memory owned by the map
@@ -61,8 +69,8 @@ namespace fleece {
             memory owned by the map.
             If the key already exists, the existing value is not changed, and the existing value is
             returned as well as the managed copy of the key (as from `find`.)
-            If the hash table or key storage is full and the key can't be inserted, returns an empty
-            slice. */
+            If the map has reached its maximum size and the key can't be inserted, returns an
+            empty slice. */
         result insert(slice key, value_t value)         {return insert(key, value, hashCode(key));}
         result insert(slice key, value_t value, hash_t);
 
@@ -77,29 +85,31 @@ namespace fleece {
         void dump() const;
 
     private:
-        // Hash table entry (32 bits).
+        // Hash table entry (64 bits, stored in a std::atomic<uint64_t>.)
         struct Entry {
-            uint16_t keyOffset;     // offset of key from _keysOffset, or 0 if empty, 1 if deleted
-            uint16_t value;         // value associated with key
+            uint32_t keyOffset;     // offset of key + kMinKeyOffset, or 0 if empty, 1 if deleted;
+                                    // the high bit is set once the entry's been migrated
+            value_t value;          // value associated with key
 
-            uint32_t& asInt32()                 {return *(uint32_t*)this;}
-            bool compareAndSwap(Entry expected, Entry swapWith);
+            static Entry fromInt(uint64_t i)    {return {uint32_t(i), value_t(i >> 32)};}
+            uint64_t asInt() const              {return keyOffset | (uint64_t(value) << 32);}
         };
 
-        inline int wrap(int i) const            {return i & _sizeMask;}
-        inline int indexOfHash(hash_t h) const  {return wrap(int(h));}
+        struct Table;
+
+        Table* writableTable();
+        Table* grow(Table*);
+        void migrate(Table *from, Table *to);
         const char* allocKey(slice key);
         bool freeKey(const char *allocedKey);
 
-        inline uint16_t keyToOffset(const char *allocedKey) const FLPURE;
-        inline const char* offsetToKey(uint16_t offset) const FLPURE;
+        inline uint32_t keyToOffset(const char *allocedKey) const FLPURE;
+        inline const char* offsetToKey(uint32_t offset) const FLPURE;
 
-        int                 _sizeMask;   // table size - 1; used for quick modulo via AND
-        int                 _capacity;   // Max number of entries
-        std::atomic<int>    _count {0};  // Current number of entries
-        ConcurrentArena     _heap;       // Storage for entries + keys
-        Entry*              _entries;    // The table: array of key/value pairs
-        size_t              _keysOffset; // Start of key storage
+        std::atomic<Table*> _table {nullptr};   // The newest table that's ready for writes
+        Table*              _oldestTable {nullptr}; // Start of the list of tables, via `next`
+        std::atomic<int>    _count {0};         // Current number of entries
+        ConcurrentArena     _keys;              // Storage for keys
     };
 
 }
@@ -0,0 +1,70 @@
+//
+// Counters.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Counters.hh"
+#include <atomic>
+
+namespace fleece { namespace counters {
+
+    static std::atomic<uint64_t> sTotals[kNumCounters];
+
+    // Plain data, so it's still usable while other thread-local objects are destructed.
+#if defined(__GNUC__)
+    __thread ThreadCounts tCounts;
+#else
+    thread_local ThreadCounts tCounts;
+#endif
+
+    // Adds the thread's counts to the totals when the thread exits.
+    namespace {
+        struct ThreadCountsFlusher {
+            ~ThreadCountsFlusher()          {flushThreadCounts();}
+        };
+        thread_local ThreadCountsFlusher tFlusher;
+    }
+
+
+    void flushThreadCounts() noexcept {
+        (void)&tFlusher;                    // (makes sure it's constructed, to flush at exit)
+        ThreadCounts &t = tCounts;
+        for (unsigned c = 0; c < kNumCounters; ++c) {
+            if (t.counts[c]) {
+                sTotals[c].fetch_add(t.counts[c], std::memory_order_relaxed);
+                t.counts[c] = 0;
+            }
+        }
+        t.untilFlush = 255;
+    }
+
+
+    Totals totals() noexcept {
+        Totals result;
+        for (unsigned c = 0; c < kNumCounters; ++c)
+            result[c] = sTotals[c].load(std::memory_order_relaxed) + tCounts.counts[c];
+        return result;
+    }
+
+
+    void reset() noexcept {
+        for (auto &count : tCounts.counts)
+            count = 0;
+        for (auto &total : sTotals)
+            total.store(0, std::memory_order_relaxed);
+    }
+
+} }
@@ -0,0 +1,76 @@
+//
+// Counters.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "PlatformCompat.hh"
+#include <array>
+#include <stdint.h>
+
+namespace fleece { namespace counters {
+
+    /** Events counted for instrumentation, in the same order as the fields of FLStats.
+        Counting is always on, and cheap: each thread increments plain per-thread counters, which
+        are added to the shared totals (with relaxed atomics) after its first event, every 256
+        events after that, and when it exits. */
+    enum Counter : unsigned {
+        kDictLookups,               ///< Dict lookups by key
+        kDictKeyComparisons,        ///< Key comparisons made by Dict lookups
+        kScopeLookups,              ///< Lookups of the Scope (Doc) containing a Value
+        kValidations,               ///< Fleece data validated
+        kValidatedBytes,            ///< Bytes of Fleece data validated
+        kEncodedBytes,              ///< Bytes of Fleece data written by Encoders
+        kDedupedStrings,            ///< Strings Encoders wrote as pointers to earlier copies
+        kMutablePromotions,         ///< Immutable collections given mutable copies
+        kHeapValues,                ///< Mutable values allocated
+        kNumCounters
+    };
+
+    using Totals = std::array<uint64_t, kNumCounters>;
+
+    // The current thread's counts that haven't been added to the totals yet. (It's plain data, so
+    // GCC and Clang can use `__thread`, which accesses it without a call to check initialization.)
+    struct ThreadCounts {
+        uint64_t counts[kNumCounters];
+        uint32_t untilFlush;            // Events left before the next flush
+    };
+#if defined(__GNUC__)
+    extern __thread ThreadCounts tCounts;
+#else
+    extern thread_local ThreadCounts tCounts;
+#endif
+
+    void flushThreadCounts() noexcept;
+
+
+    /** Adds to a counter. */
+    static inline void count(Counter c, uint64_t n =1) noexcept {
+        ThreadCounts &t = tCounts;
+        t.counts[c] += n;
+        if (_usuallyFalse(t.untilFlush-- == 0))
+            flushThreadCounts();
+    }
+
+    /** The totals since launch or the last `reset`. The current thread's counts are exact;
+        other threads' are added in batches, so their most recent events may be missing. */
+    Totals totals() noexcept;
+
+    /** Resets the totals, and the current thread's counts, to zero. Other threads' counts that
+        haven't been added to the totals yet will still be added later. */
+    void reset() noexcept;
+
+} }
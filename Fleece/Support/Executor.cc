@@ -0,0 +1,219 @@
+//
+// Executor.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Executor.hh"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "betterassert.hh"
+
+namespace fleece {
+    using namespace std;
+
+
+#pragma mark - THREAD POOL:
+
+
+    namespace {
+
+        // The default Executor. Each worker has its own queue; tasks submitted by a worker go
+        // on its own queue, others are dealt out to the queues in turn. A worker runs its own
+        // newest task first, and when its queue is empty steals the oldest from another's.
+        class ThreadPool final : public Executor {
+        public:
+            ThreadPool()
+            :_nThreads(max(thread::hardware_concurrency(), 2u) - 1)
+            { }
+
+            // One per CPU core, counting the caller of parallelFor, as the threads that Fleece
+            // started for itself used to be.
+            unsigned concurrency() const noexcept override {
+                return max(thread::hardware_concurrency(), 1u);
+            }
+
+            void submit(Task task) override {
+                call_once(_started, [this] {start();});
+                size_t q = (tWorker >= 0) ? size_t(tWorker) : _nextQueue++ % _nThreads;
+                {
+                    lock_guard<mutex> lock(_queues[q]->lock);
+                    _queues[q]->tasks.push_back(move(task));
+                }
+                {
+                    lock_guard<mutex> lock(_sleepMutex);
+                    ++_pending;
+                }
+                _wake.notify_one();
+            }
+
+        private:
+            struct Queue {
+                mutex lock;
+                deque<Task> tasks;
+            };
+
+            void start() {
+                for (unsigned i = 0; i < _nThreads; ++i)
+                    _queues.emplace_back(new Queue);
+                // The pool is never destroyed, so its threads run until the process exits:
+                for (unsigned i = 0; i < _nThreads; ++i)
+                    thread([this, i] {run(i);}).detach();
+            }
+
+            bool take(unsigned me, Task &task) {
+                for (unsigned n = 0; n < _nThreads; ++n) {
+                    Queue &q = *_queues[(me + n) % _nThreads];
+                    lock_guard<mutex> lock(q.lock);
+                    if (!q.tasks.empty()) {
+                        if (n == 0) {
+                            task = move(q.tasks.back());
+                            q.tasks.pop_back();
+                        } else {
+                            task = move(q.tasks.front());
+                            q.tasks.pop_front();
+                        }
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            void run(unsigned me) {
+                tWorker = int(me);
+                Task task;
+                while (true) {
+                    if (take(me, task)) {
+                        {
+                            lock_guard<mutex> lock(_sleepMutex);
+                            --_pending;
+                        }
+                        task();
+                        task = nullptr;
+                    } else {
+                        unique_lock<mutex> lock(_sleepMutex);
+                        _wake.wait(lock, [this] {return _pending > 0;});
+                    }
+                }
+            }
+
+            unsigned const          _nThreads;
+            vector<unique_ptr<Queue>> _queues;
+            once_flag               _started;
+            atomic<size_t>          _nextQueue {0};
+            mutex                   _sleepMutex;
+            condition_variable      _wake;
+            size_t                  _pending {0};        // Tasks in the queues
+            static thread_local int tWorker;            // Index of the current worker, or -1
+        };
+
+        thread_local int ThreadPool::tWorker = -1;
+
+    }
+
+
+#pragma mark - EXECUTOR:
+
+
+    static atomic<Executor*> sCurrent {nullptr};
+
+    static Executor& defaultPool() {
+        static Executor *sPool = new ThreadPool;
+        return *sPool;
+    }
+
+    Executor& Executor::current() noexcept {
+        if (Executor *e = sCurrent.load(memory_order_acquire); e)
+            return *e;
+        return defaultPool();
+    }
+
+    void Executor::setCurrent(Executor *e) noexcept {
+        sCurrent.store(e, memory_order_release);
+    }
+
+    unsigned Executor::resolveThreads(unsigned nThreads) noexcept {
+        return nThreads ? nThreads : max(current().concurrency(), 1u);
+    }
+
+
+    namespace {
+        // The state of a parallelFor, shared with its tasks. A task that starts after all the
+        // items have been taken only touches `next`, so the state has to outlive the call.
+        struct ParallelFor {
+            ParallelFor(size_t count_, function_ref<void(size_t)> fn_)
+            :count(count_), fn(fn_) { }
+
+            void run() {
+                for (size_t i; (i = next++) < count; ) {
+                    if (!failed.load(memory_order_relaxed)) {
+                        try {
+                            fn(i);
+                        } catch (...) {
+                            lock_guard<mutex> lock(mutex_);
+                            if (!error)
+                                error = current_exception();
+                            failed = true;
+                        }
+                    }
+                    lock_guard<mutex> lock(mutex_);
+                    if (++finished == count)
+                        done.notify_all();
+                }
+            }
+
+            void wait() {
+                unique_lock<mutex> lock(mutex_);
+                done.wait(lock, [this] {return finished == count;});
+                if (error)
+                    rethrow_exception(error);
+            }
+
+            size_t const                count;
+            function_ref<void(size_t)>  fn;         // Only called while the caller waits
+            atomic<size_t>              next {0};
+            atomic<bool>                failed {false};
+            mutex                       mutex_;
+            condition_variable          done;
+            size_t                      finished {0};
+            exception_ptr               error;
+        };
+    }
+
+    void Executor::parallelFor(size_t count, unsigned maxTasks, function_ref<void(size_t)> fn) {
+        if (count == 0)
+            return;
+        size_t nTasks = min(size_t(resolveThreads(maxTasks)), count);
+        if (nTasks <= 1) {
+            for (size_t i = 0; i < count; ++i)
+                fn(i);
+            return;
+        }
+        auto state = make_shared<ParallelFor>(count, fn);
+        Executor &executor = current();
+        for (size_t t = 1; t < nTasks; ++t)
+            executor.submit([state] {state->run();});
+        state->run();
+        state->wait();
+    }
+
+}
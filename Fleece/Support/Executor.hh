@@ -0,0 +1,68 @@
+//
+// Executor.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "function_ref.hh"
+#include <functional>
+#include <stddef.h>
+
+namespace fleece {
+
+    /** Runs tasks on other threads. All of Fleece's parallel operations (parallel JSON
+        conversion and rendering, parallel deep visits, batch delta application, HashTree and
+        PathIndex bulk building) run their work through the current Executor, instead of
+        starting threads of their own.
+
+        The default is a small work-stealing thread pool, with a thread per CPU core but one,
+        started when it's first used. An app with its own thread pool can set that instead,
+        as a subclass (or through the C API, FLSetExecutor.) */
+    class Executor {
+    public:
+        using Task = std::function<void()>;
+
+        virtual ~Executor() = default;
+
+        /** Runs a task asynchronously, on some thread. It must not throw. */
+        virtual void submit(Task) =0;
+
+        /** The number of tasks it can run at once, counting a thread that waits for them by
+            running some itself (as parallelFor does.) */
+        virtual unsigned concurrency() const noexcept =0;
+
+        /** The Executor that parallel operations use: the one set with setCurrent, or else the
+            default pool. */
+        static Executor& current() noexcept;
+
+        /** Sets the Executor to use, or with `nullptr` restores the default pool. It isn't
+            adopted, so it has to stay valid until it's replaced and the operations running on
+            it are done. Set it at startup, before any parallel operations. */
+        static void setCurrent(Executor*) noexcept;
+
+        /** Resolves a parallel operation's `nThreads` parameter: 0 means the current Executor's
+            concurrency. */
+        static unsigned resolveThreads(unsigned nThreads) noexcept;
+
+        /** Calls `fn(i)` for each `i` in [0, count), with up to `maxTasks` calls at once (0 means
+            the current Executor's concurrency.) The calling thread runs items too, taking the
+            next one from a shared counter like the tasks, so it returns as soon as all are done
+            even if the Executor is busy; that also makes it safe to call from a task.
+            If a call throws, the remaining items are skipped and the exception is rethrown. */
+        static void parallelFor(size_t count, unsigned maxTasks, function_ref<void(size_t)> fn);
+    };
+
+}
@@ -17,9 +17,13 @@
 //
 
 #include "InstanceCounted.hh"
+#include "Backtrace.hh"
 #include "RefCounted.hh"
+#include "PlatformCompat.hh"
 #include <map>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <stdlib.h>
 #include <stdio.h>
 #include <typeinfo>
@@ -31,26 +35,120 @@
 namespace fleece {
     using namespace std;
 
-    std::atomic<int> InstanceCounted::gInstanceCount;
+    // The instance count is the sum of these; each thread adds to and subtracts from its own
+    // shard (chosen round-robin), each in its own cache line.
+    static constexpr unsigned kNumShards = 16;
+    struct alignas(64) Shard {
+        atomic<int> count {0};
+    };
+    static Shard sShards[kNumShards];
+    static atomic<unsigned> sNextShard {0};
+    static thread_local unsigned tShard = kNumShards;       // (kNumShards means none yet)
+
+    static inline atomic<int>& threadCount() {
+        if (_usuallyFalse(tShard == kNumShards))
+            tShard = sNextShard++ % kNumShards;
+        return sShards[tShard].count;
+    }
+
+    int InstanceCounted::liveInstanceCount() {
+        int total = 0;
+        for (auto &shard : sShards)
+            total += shard.count.load(memory_order_relaxed);
+        return total;
+    }
+
+
+    void InstanceCounted::added(size_t offset) {
+        threadCount().fetch_add(1, memory_order_relaxed);
+        if (unsigned period = sSamplePeriod.load(memory_order_relaxed); _usuallyFalse(period != 0))
+            sample(offset);
+    }
+
+
+#pragma mark - SAMPLING:
+
+
+    atomic<unsigned> InstanceCounted::sSamplePeriod {0};
+    static thread_local unsigned tUntilSample = 0;          // New instances until the next sample
+
+    namespace {
+        struct Sample {
+            size_t offset;                                  // From InstanceCounted to the object
+            shared_ptr<Backtrace> backtrace;
+        };
+        // (Never freed, since static objects may be destructed after them)
+        mutex &sSamplesMutex = *new mutex;
+        auto &sSamples = *new unordered_map<const InstanceCounted*, Sample>;
+    }
+
+
+    void InstanceCounted::setSampling(unsigned period) {
+        sSamplePeriod.store(period, memory_order_relaxed);
+    }
+
+
+    void InstanceCounted::sample(size_t offset) {
+        unsigned period = sSamplePeriod.load(memory_order_relaxed);
+        if (tUntilSample == 0 || tUntilSample > period)
+            tUntilSample = period;
+        if (--tUntilSample > 0)
+            return;
+        auto backtrace = Backtrace::capture(3);     // skip sample, added and the constructor
+        lock_guard<mutex> lock(sSamplesMutex);
+        sSamples[this] = {offset, move(backtrace)};
+        _sampled = true;
+    }
+
+
+    void InstanceCounted::removed() const {
+        threadCount().fetch_sub(1, memory_order_relaxed);
+        if (_usuallyFalse(_sampled)) {
+            lock_guard<mutex> lock(sSamplesMutex);
+            sSamples.erase(this);
+        }
+    }
+
+
+    size_t InstanceCounted::sampledInstanceCount() {
+        lock_guard<mutex> lock(sSamplesMutex);
+        return sSamples.size();
+    }
+
+
+    void InstanceCounted::eachSampledInstance(function_ref<void(const void*,
+                                                                const Backtrace&)> callback) {
+        lock_guard<mutex> lock(sSamplesMutex);
+        for (auto &[instance, sample] : sSamples)
+            callback((const uint8_t*)instance - sample.offset, *sample.backtrace);
+    }
+
+
+    void InstanceCounted::dumpSampledInstances() {
+        eachSampledInstance([](const void *address, const Backtrace &backtrace) {
+            fprintf(stderr, "    * object at %p, created at:\n%s\n",
+                    address, backtrace.toString().c_str());
+        });
+    }
 
 // LCOV_EXCL_START
 #if INSTANCECOUNTED_TRACK
     static mutex sInstancesMutex;
     static map<const InstanceCounted*,size_t> sInstances;
 
-    void InstanceCounted::track(size_t offset) const {
+    void InstanceCounted::track(size_t offset) {
         // `offset` is the offset from `this` (the InstanceCounted instance) to the main object
         // it's part of. This is stored in the map so it can be used to log the address of the main
         // object, which is the one we really care about.
+        added(offset);
         lock_guard<mutex> lock(sInstancesMutex);
         sInstances.insert({this, offset});
-        ++gInstanceCount;
     }
 
     void InstanceCounted::untrack() const {
+        removed();
         lock_guard<mutex> lock(sInstancesMutex);
         sInstances.erase(this);
-        --gInstanceCount;
     }
 
     void InstanceCounted::dumpInstances(function_ref<void(const InstanceCounted*)> *callback) {
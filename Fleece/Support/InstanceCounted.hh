@@ -11,28 +11,46 @@
 #include <stdint.h>
 
 #ifndef INSTANCECOUNTED_TRACK
-    // TODO: Add this guard back in
-    //#if DEBUG
+    #if DEBUG
         #define INSTANCECOUNTED_TRACK 1
-    //#endif
+    #endif
 #endif
 
 namespace fleece {
+    class Backtrace;
 
     /** Base class that keeps track of the total instance count of it and all subclasses.
         This is useful for leak detection.
+        The count is sharded: each thread adjusts one of several counters in separate cache
+        lines, so constructing objects on many cores at once doesn't contend on one atomic.
         In debug builds or if INSTANCECOUNTED_TRACK is defined, the class will also track the
-        individual instance addresses, which can be logged by calling `dumpInstances`. */
+        individual instance addresses, which can be logged by calling `dumpInstances`.
+        In any build, `setSampling` can turn on tracking of 1 in N instances, with a backtrace of
+        where each was created; that's cheap enough to leave on in production to find leaks. */
     class InstanceCounted {
     public:
 
         /** Total number of live objects that implement InstanceCounted. */
-        static int liveInstanceCount()              {return gInstanceCount;}
+        static int liveInstanceCount();
+
+        /** Tracks 1 in every `period` new instances (per thread), capturing a backtrace of each.
+            Zero, the default, turns sampling off; instances already sampled stay tracked. */
+        static void setSampling(unsigned period);
+
+        /** The number of live sampled instances. */
+        static size_t sampledInstanceCount();
+
+        /** Calls the callback with the address and creation backtrace of each live sampled
+            instance. (It's called with a lock held, so it mustn't create or destroy any.) */
+        static void eachSampledInstance(function_ref<void(const void*, const Backtrace&)>);
+
+        /** Logs the live sampled instances, and their backtraces, to stderr. */
+        static void dumpSampledInstances();
 
 #if INSTANCECOUNTED_TRACK
         InstanceCounted()                           {track();}
         InstanceCounted(const InstanceCounted&)     {track();}
-        InstanceCounted(InstanceCounted &&old)      {track(); old.untrack();}
+        InstanceCounted(InstanceCounted &&old)      {track();}
         virtual ~InstanceCounted()                  {untrack();}        // must be virtual for RTTI
 
         /** Logs information to stderr about all live objects. */
@@ -42,19 +60,31 @@ namespace fleece {
     protected:
         InstanceCounted(size_t offset)              {track(offset);}
     private:
-        void track(size_t offset =0) const;
+        void track(size_t offset =0);
         void untrack() const;
         static void dumpInstances(function_ref<void(const InstanceCounted*)>*);
 
 #else
-        InstanceCounted()                           {++gInstanceCount;}
-        InstanceCounted(const InstanceCounted&)     {++gInstanceCount;}
-        InstanceCounted(InstanceCounted &&old)      {} // Do nothing, the old and new should balance
-        ~InstanceCounted()                          {--gInstanceCount;}
+        InstanceCounted()                           {added();}
+        InstanceCounted(const InstanceCounted&)     {added();}
+        InstanceCounted(InstanceCounted &&old)      {added();} // `old` still gets destructed
+        ~InstanceCounted()                          {removed();}
+
+    protected:
+        InstanceCounted(size_t offset)              {added(offset);}
 #endif
 
+    public:
+        // Assignment leaves `_sampled` alone: it's a property of this instance, not its state.
+        InstanceCounted& operator=(const InstanceCounted&)  {return *this;}
+
     private:
-        static std::atomic<int> gInstanceCount;
+        void added(size_t offset =0);
+        void removed() const;
+        void sample(size_t offset);
+
+        static std::atomic<unsigned> sSamplePeriod;
+        bool _sampled {false};
     };
 
 
@@ -70,7 +100,6 @@ namespace fleece {
     template <class BASE>
     class InstanceCountedIn : public InstanceCounted {
     public:
-#if INSTANCECOUNTED_TRACK
         InstanceCountedIn()
         :InstanceCounted((size_t)this - (size_t)(BASE*)this)
         { }
@@ -79,12 +108,11 @@ namespace fleece {
         :InstanceCounted((size_t)this - (size_t)(BASE*)this)
         { }
 
-        InstanceCountedIn(InstanceCountedIn &&old)
+        InstanceCountedIn(InstanceCountedIn &&)
         :InstanceCounted((size_t)this - (size_t)(BASE*)this)
-        {
-            old.untrack();
-        }
-#endif
+        { }
+
+        InstanceCountedIn& operator=(const InstanceCountedIn&) =default;
     };
 
 
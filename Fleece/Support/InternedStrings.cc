@@ -0,0 +1,83 @@
+//
+// InternedStrings.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "InternedStrings.hh"
+#include <algorithm>
+#include <atomic>
+
+namespace fleece {
+
+    // Initial capacity of a table; it grows from there as needed, up to its maxCount.
+    static constexpr int kInitialCapacity = 1024;
+
+
+    // ConcurrentMap stores its keys as C strings, so it can't tell "a" from "a\0".
+    static inline bool internable(slice str, size_t maxLength) {
+        return str && str.size <= maxLength && !str.findByte(0);
+    }
+
+
+    InternedStrings::InternedStrings(int maxCount, size_t maxLength)
+    :_map(std::min(maxCount, kInitialCapacity))
+    ,_maxCount(maxCount)
+    ,_maxLength(maxLength)
+    { }
+
+
+    static std::atomic<InternedStrings*> sShared {nullptr};
+    static std::atomic<bool> sSharedEnabled {false};
+
+
+    /*static*/ InternedStrings* InternedStrings::shared() noexcept {
+        if (_usuallyTrue(!sSharedEnabled.load(std::memory_order_relaxed)))
+            return nullptr;
+        return sShared.load(std::memory_order_acquire);
+    }
+
+
+    /*static*/ void InternedStrings::setSharedEnabled(bool enabled) {
+        if (enabled && !sShared.load(std::memory_order_acquire)) {
+            // Deliberately leaked, so the strings outlive any static objects that refer to them:
+            static InternedStrings* table = new InternedStrings;
+            sShared.store(table, std::memory_order_release);
+        }
+        sSharedEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+
+    __hot
+    slice InternedStrings::intern(slice str) {
+        if (!internable(str, _maxLength))
+            return nullslice;
+        auto hash = ConcurrentMap::hashCode(str);
+        if (auto found = _map.find(str, hash); found.key)
+            return found.key;
+        if (_map.count() >= _maxCount)
+            return nullslice;
+        return _map.insert(str, 0, hash).key;
+    }
+
+
+    __hot
+    slice InternedStrings::find(slice str) const noexcept {
+        if (!internable(str, _maxLength))
+            return nullslice;
+        return _map.find(str).key;
+    }
+
+}
@@ -0,0 +1,70 @@
+//
+// InternedStrings.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "ConcurrentMap.hh"
+#include "fleece/slice.hh"
+
+namespace fleece {
+
+    /** A thread-safe, lock-free table of unique copies of strings. Interning a string returns
+        the table's copy of it, which is the same for every string with the same bytes, so
+        interned strings can be compared by pointer, and a string that's used over and over is
+        only stored once. The copies stay valid as long as the table exists.
+
+        Strings can't be removed, so to keep the table from growing without bound it only takes
+        strings up to a maximum length, and only up to a maximum number of them. Once it's full,
+        `intern` still finds strings that are already in it. */
+    class InternedStrings {
+    public:
+        static constexpr size_t kDefaultMaxLength = 32;
+        static constexpr int kDefaultMaxCount = 0x10000;
+
+        explicit InternedStrings(int maxCount =kDefaultMaxCount,
+                                 size_t maxLength =kDefaultMaxLength);
+
+        /** The process-wide table that HeapDict and MDict intern their keys in, or nullptr if
+            that hasn't been enabled by \ref setSharedEnabled. It's never freed, so its strings
+            remain valid for the life of the process. */
+        static InternedStrings* shared() noexcept;
+
+        /** Enables or disables interning of HeapDict and MDict keys in the process-wide table.
+            It's disabled by default, since the table keeps every key it takes until the process
+            exits. Disabling it again only stops new keys from being added. */
+        static void setSharedEnabled(bool);
+
+        /** Returns the table's copy of a string, adding it if necessary. Returns a null slice if
+            the string is null, too long or contains a 0 byte, or if it isn't in the table and the table is full. */
+        slice intern(slice str);
+
+        /** Returns the table's copy of a string, or a null slice if it hasn't been interned. */
+        slice find(slice str) const noexcept;
+
+        /** The number of strings in the table. */
+        int count() const FLPURE                        {return _map.count();}
+
+        int maxCount() const FLPURE                     {return _maxCount;}
+        size_t maxLength() const FLPURE                 {return _maxLength;}
+
+    private:
+        ConcurrentMap _map;
+        int const     _maxCount;
+        size_t const  _maxLength;
+    };
+
+}
@@ -20,42 +20,91 @@
 #include "FleeceImpl.hh"
 #include "SmallVector.hh"
 #include "ParseDate.hh"
+#include "Bitmap.hh"
+#include "Executor.hh"
 #include <algorithm>
+#include <exception>
 #include "betterassert.hh"
 
+#ifdef FL_HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
 namespace fleece { namespace impl {
 
+    static inline bool needsEscape(uint8_t ch) {
+        return ch == '"' || ch == '\\' || ch < 32 || ch == 127;
+    }
+
+
+    // Returns a pointer to the first byte in [p, end) that has to be escaped in a JSON string
+    // (a quote, a backslash or a control character), or `end` if there is none. It checks
+    // 16 bytes at a time with SSE2 if available, else 8 at a time in a uint64_t.
+    static inline const uint8_t* findCharToEscape(const uint8_t *p, const uint8_t *end) {
+#ifdef FL_HAVE_SSE2
+        const __m128i quote = _mm_set1_epi8('"'), backslash = _mm_set1_epi8('\\'),
+                      del = _mm_set1_epi8(127), maxControl = _mm_set1_epi8(31);
+        for (; end - p >= 16; p += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)p);
+            __m128i isControl = _mm_cmpeq_epi8(_mm_min_epu8(chunk, maxControl), chunk);
+            __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, quote),
+                                                    _mm_cmpeq_epi8(chunk, backslash)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(chunk, del), isControl));
+            if (int mask = _mm_movemask_epi8(hit); mask != 0)
+                return p + countTrailingZeros(unsigned(mask));
+        }
+#else
+        constexpr uint64_t kLSBs = 0x0101010101010101, kMSBs = 0x8080808080808080;
+        auto hasZeroByte = [=](uint64_t x) {return (x - kLSBs) & ~x & kMSBs;};
+        for (; end - p >= 8; p += 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            // (This can have false positives, so then check the bytes individually.)
+            if (hasZeroByte(w ^ (kLSBs * '"')) | hasZeroByte(w ^ (kLSBs * '\\'))
+                    | hasZeroByte(w ^ (kLSBs * 127)) | ((w - kLSBs * 32) & ~w & kMSBs)) {
+                for (int i = 0; i < 8; ++i)
+                    if (needsEscape(p[i]))
+                        return p + i;
+            }
+        }
+#endif
+        for (; p < end; ++p) {
+            if (needsEscape(*p))
+                return p;
+        }
+        return end;
+    }
+
+
     void JSONEncoder::writeString(slice str) {
         comma();
         _out << '"';
         auto start = (const uint8_t*)str.buf;
         auto end = (const uint8_t*)str.end();
-        for (auto p = start; p < end; p++) {
+        for (auto p = findCharToEscape(start, end); p < end; p = findCharToEscape(p + 1, end)) {
             uint8_t ch = *p;
-            if (ch == '"' || ch == '\\' || ch < 32 || ch == 127) {
-                // Write characters from start up to p-1:
-                _out.write({start, p});
-                start = p + 1;
-                switch (ch) {
-                    case '"':
-                    case '\\':
-                        _out << '\\';
-                        --start; // ch will be written in next pass
-                        break;
-                    case '\r':
-                        _out.write("\\r"_sl);
-                        break;
-                    case '\n':
-                        _out.write("\\n"_sl);
-                        break;
-                    case '\t':
-                        _out.write("\\t"_sl);
-                        break;
-                    default: {
-                        char buf[7];
-                        _out.write(buf, sprintf(buf, "\\u%04x", (unsigned)ch));
-                        break;
-                    }
+            // Write characters from start up to p-1:
+            _out.write({start, p});
+            start = p + 1;
+            switch (ch) {
+                case '"':
+                case '\\':
+                    _out << '\\';
+                    --start; // ch will be written in next pass
+                    break;
+                case '\r':
+                    _out.write("\\r"_sl);
+                    break;
+                case '\n':
+                    _out.write("\\n"_sl);
+                    break;
+                case '\t':
+                    _out.write("\\t"_sl);
+                    break;
+                default: {
+                    char buf[7];
+                    _out.write(buf, sprintf(buf, "\\u%04x", (unsigned)ch));
+                    break;
                 }
             }
         }
@@ -97,41 +146,79 @@ namespace fleece { namespace impl {
     void JSONEncoder::writeDict(const Dict *dict) {
         beginDictionary();
         if (_canonical) {
-            // In canonical mode, ensure the keys are written in sorted order:
-            struct kv {
-                slice key;
-                const Value *value;
-                bool operator< (const kv &other) const {return key < other.key;}
-            };
-            smallVector<kv, 4> items;
-            items.reserve(dict->count());
-            for (auto iter = dict->begin(); iter; ++iter)
-                items.push_back({iter.keyString(), iter.value()});
-            std::sort(items.begin(), items.end());
-            for (auto &item : items) {
-                writeKey(item.key);
-                writeValue(item.value);
-            }
+            smallVector<Item, 8> items;
+            canonicalItems(dict, items);
+            for (auto &item : items)
+                writeKeyAndValue(item.keyStr, item.key, item.value);
         } else {
-            for (auto iter = dict->begin(); iter; ++iter) {
-                slice keyStr = iter.keyString();
-                if (keyStr) {
-                    writeKey(keyStr);
-                } else {
-                    // non-string keys are possible...
-                    comma();
-                    _first = true;
-                    writeValue(iter.key());
-                    _out << ':';
-                    _first = true;
-                }
-                writeValue(iter.value());
-            }
+            for (Dict::iterator iter(dict, _sharedKeys); iter; ++iter)
+                writeKeyAndValue(iter.keyString(), iter.key(), iter.value());
         }
         endDictionary();
     }
 
 
+    // Collects a Dict's items sorted by their key strings. A Dict's string keys are already sorted,
+    // after its integer keys; so usually only the integer keys need sorting, by their ranks in
+    // their SharedKeys' string order, and then the two runs are merged.
+    template <class VEC>
+    void JSONEncoder::canonicalItems(const Dict *dict, VEC &items) {
+        smallVector<Item, 8> intItems, strItems;
+        bool intsSorted = true, stringsSorted = true;
+        for (Dict::iterator iter(dict, _sharedKeys); iter; ++iter) {
+            Item item {iter.keyString(), iter.key(), iter.value(), -1};
+            if (item.keyStr && item.key->isInteger())
+                item.rank = keyRank(iter.sharedKeys(), int(item.key->asInt()));
+            if (item.rank >= 0) {
+                if (!intItems.empty() && item.rank < intItems.back().rank)
+                    intsSorted = false;
+                intItems.push_back(item);
+            } else {
+                // (Inherited or mutable Dicts' items might not come in order)
+                if (!strItems.empty() && item < strItems.back())
+                    stringsSorted = false;
+                strItems.push_back(item);
+            }
+        }
+        if (!intsSorted)
+            std::sort(intItems.begin(), intItems.end(), [](const Item &a, const Item &b) {
+                return a.rank < b.rank;
+            });
+        if (!stringsSorted)
+            std::sort(strItems.begin(), strItems.end());
+        items.resize(intItems.size() + strItems.size());
+        std::merge(intItems.begin(), intItems.end(), strItems.begin(), strItems.end(),
+                   items.begin());
+    }
+
+
+    // The position of an integer key in its SharedKeys' string order, or -1 if unknown.
+    int JSONEncoder::keyRank(const SharedKeys *sk, int key) {
+        if (!sk || key < 0)
+            return -1;
+        if (sk != _rankedKeys || size_t(key) >= _keyRanks->size()) {
+            _keyRanks = sk->keyRanks();
+            _rankedKeys = sk;
+        }
+        return size_t(key) < _keyRanks->size() ? (*_keyRanks)[key] : -1;
+    }
+
+
+    void JSONEncoder::writeKeyAndValue(slice keyStr, const Value *key, const Value *value) {
+        if (keyStr) {
+            writeKey(keyStr);
+        } else {
+            // non-string keys are possible...
+            comma();
+            _first = true;
+            writeValue(key);
+            _out << ':';
+            _first = true;
+        }
+        writeValue(value);
+    }
+
+
     void JSONEncoder::writeValue(const Value *v) {
         switch (v->type()) {
             case kNull:
@@ -178,4 +265,102 @@ namespace fleece { namespace impl {
         }
     }
 
+
+
+#pragma mark - PARALLEL CONVERSION:
+
+
+    // Renders `v` as a series of JSONEncoders whose outputs, concatenated, are its JSON.
+    /*static*/ JSONEncoder::Pieces JSONEncoder::renderParallel(const Value *v, bool json5,
+                                                              bool canonical, unsigned nThreads)
+    {
+        auto makeEncoder = [=] {
+            auto enc = std::make_unique<JSONEncoder>(64 * 1024);
+            enc->setJSON5(json5);
+            enc->setCanonical(canonical);
+            return enc;
+        };
+
+        nThreads = Executor::resolveThreads(nThreads);
+        auto type = v->type();
+        uint32_t count = 0;
+        if (type == kArray)
+            count = v->asArray()->count();
+        else if (type == kDict)
+            count = v->asDict()->count();
+        Pieces pieces;
+        if (nThreads < 2 || count < std::max(kMinParallelCount, nThreads)) {
+            pieces.push_back(makeEncoder());
+            pieces[0]->writeValue(v);
+            return pieces;
+        }
+
+        // Collect the items, so the threads can access their ranges directly:
+        std::vector<Item> items;
+        items.reserve(count);
+        if (type == kArray) {
+            for (auto iter = v->asArray()->begin(); iter; ++iter)
+                items.push_back({nullslice, nullptr, iter.value(), -1});
+        } else if (canonical) {
+            JSONEncoder().canonicalItems(v->asDict(), items);
+        } else {
+            for (auto iter = v->asDict()->begin(); iter; ++iter)
+                items.push_back({iter.keyString(), iter.key(), iter.value(), -1});
+        }
+
+        // Each thread renders a contiguous range of items; the first also writes the opening
+        // bracket, the last the closing one, and the others start with a comma:
+        for (unsigned t = 0; t < nThreads; ++t)
+            pieces.push_back(makeEncoder());
+        Executor::parallelFor(nThreads, nThreads, [&](size_t t) {
+            JSONEncoder &enc = *pieces[t];
+            size_t begin = items.size() * t / nThreads;
+            size_t end   = items.size() * (t + 1) / nThreads;
+            if (t == 0)
+                enc._out << (type == kArray ? '[' : '{');
+            else
+                enc._first = false;
+            for (size_t i = begin; i < end; ++i) {
+                if (type == kArray)
+                    enc.writeValue(items[i].value);
+                else
+                    enc.writeKeyAndValue(items[i].keyStr, items[i].key, items[i].value);
+            }
+            if (t == nThreads - 1)
+                enc._out << (type == kArray ? ']' : '}');
+        });
+        return pieces;
+    }
+
+
+    /*static*/ alloc_slice JSONEncoder::toJSONParallel(const Value *v, bool json5,
+                                                       bool canonical, unsigned nThreads)
+    {
+        Pieces pieces = renderParallel(v, json5, canonical, nThreads);
+        if (pieces.size() == 1)
+            return pieces[0]->finish();
+        size_t size = 0;
+        for (auto &piece : pieces)
+            size += piece->bytesWritten();
+        alloc_slice result(size);
+        size_t offset = 0;
+        for (auto &piece : pieces) {
+            piece->_out.copyOutputTo((char*)result.buf + offset);
+            offset += piece->bytesWritten();
+        }
+        return result;
+    }
+
+
+    /*static*/ bool JSONEncoder::writeJSONParallel(const Value *v, FILE *file, bool json5,
+                                                   bool canonical, unsigned nThreads)
+    {
+        Pieces pieces = renderParallel(v, json5, canonical, nThreads);
+        for (auto &piece : pieces) {
+            if (!piece->_out.writeOutputToFile(file))
+                return false;
+        }
+        return true;
+    }
+
 } }
@@ -20,9 +20,12 @@
 
 #include "Writer.hh"
 #include "Value.hh"
+#include "SharedKeys.hh"
 #include "FleeceException.hh"
 #include "NumConversion.hh"
+#include <memory>
 #include <stdio.h>
+#include <vector>
 
 
 namespace fleece { namespace impl {
@@ -34,16 +37,40 @@ namespace fleece { namespace impl {
         :_out(reserveOutputSize)
         { }
 
+        /** Constructs an encoder that writes the JSON to a file as it goes. */
+        explicit JSONEncoder(FILE *outputFile NONNULL)
+        :_out(outputFile)
+        { }
+
+        /** Constructs an encoder that passes the JSON to a sink, such as a socket, whenever
+            `bufferSize` bytes have accumulated, so that even a huge Value can be streamed out as
+            it's walked, in constant memory. \ref finish flushes the rest and returns null. */
+        explicit JSONEncoder(Writer::OutputSink sink,
+                             size_t bufferSize =Writer::kDefaultSinkBufferSize)
+        :_out(std::move(sink), bufferSize)
+        { }
+
         /** In JSON5 mode, dictionary keys that are JavaScript identifiers will be unquoted. */
         void setJSON5(bool j5)                  {_json5 = j5;}
+
+        /** In canonical mode, dictionary keys are written in sorted order. Dicts store their
+            string keys sorted already, so only their integer keys have to be put in order, using
+            a table of their SharedKeys' string order that's cached between Dicts. */
         void setCanonical(bool canonical)       {_canonical = canonical;}
 
+        /** Sets the SharedKeys used to decode Dicts' integer keys, instead of looking up the ones
+            each Dict's data belongs to. */
+        void setSharedKeys(SharedKeys *sk)      {_sharedKeys = sk;}
+
         bool isEmpty() const                    {return _out.length() == 0;}
         size_t bytesWritten() const             {return _out.length();}
 
-        /** Returns the encoded data. */
+        /** Returns the encoded data. (If writing to a file or sink, flushes it and returns null.) */
         alloc_slice finish()                    {return _out.finish();}
 
+        /** If writing to a file or sink, passes it all the JSON written so far. */
+        void flush()                            {_out.flush();}
+
         /** Resets the encoder so it can be used again. */
         void reset()                            {_out.reset(); _first = true;}
 
@@ -52,14 +79,15 @@ namespace fleece { namespace impl {
         void writeNull()                        {comma(); _out << slice("null");}
         void writeBool(bool b)                  {comma(); _out.write(b ? "true"_sl : "false"_sl);}
 
-        void writeInt(int64_t i)                {_writeInt("%lld", i);}
-        void writeUInt(uint64_t i)              {_writeInt("%llu", i);}
+        void writeInt(int64_t i)                {_writeInt(i);}
+        void writeUInt(uint64_t i)              {_writeInt(i);}
         void writeFloat(float f)                {_writeFloat(f);}
         void writeDouble(double d)              {_writeFloat(d);}
 
         void writeString(const std::string &s)  {writeString(slice(s));}
         void writeString(slice s);
         void writeDateString(int64_t timestamp, bool asUTC);
+        void writeTimestamp(int64_t timestamp, bool asUTC)  {writeDateString(timestamp, asUTC);}
         
         void writeData(slice d)                 {comma(); _out << '"'; _out.writeBase64(d);
                                                           _out << '"';}
@@ -102,6 +130,23 @@ namespace fleece { namespace impl {
         JSONEncoder& operator<< (slice s)           {writeString(s); return *this;} // string not data!
         JSONEncoder& operator<< (const Value *v)    {writeValue(v); return *this;}
 
+        //////// Parallel conversion:
+
+        /** Returns the JSON representation of a Value, like Value::toJSON. If the Value is a large
+            Array or Dict, ranges of its items are rendered concurrently on `nThreads` threads
+            (0 means the Executor's concurrency), each into its own Writer, and the pieces are
+            then joined. The output is identical to what a single JSONEncoder would produce. */
+        static alloc_slice toJSONParallel(const Value* NONNULL, bool json5 =false,
+                                          bool canonical =false, unsigned nThreads =0);
+
+        /** Like \ref toJSONParallel, but writes the JSON to a file, directly from the threads'
+            Writers without concatenating them first. Returns false on an I/O error. */
+        static bool writeJSONParallel(const Value* NONNULL, FILE* NONNULL, bool json5 =false,
+                                      bool canonical =false, unsigned nThreads =0);
+
+        /** Arrays and Dicts with fewer items than this are converted on a single thread. */
+        static constexpr uint32_t kMinParallelCount = 256;
+
         // Just for API compatibility with Encoder class:
         void beginArray(size_t)                       {beginArray();}
         void beginDictionary(size_t)                  {beginDictionary();}
@@ -110,7 +155,20 @@ namespace fleece { namespace impl {
         }
 
     private:
+        using Pieces = std::vector<std::unique_ptr<JSONEncoder>>;
+
+        struct Item {
+            slice keyStr;
+            const Value *key, *value;
+            int rank;                   // Integer key's position in string order, else -1
+            bool operator< (const Item &other) const {return keyStr < other.keyStr;}
+        };
+
         void writeDict(const Dict*);
+        template <class VEC> void canonicalItems(const Dict*, VEC &items);
+        int keyRank(const SharedKeys*, int key);
+        void writeKeyAndValue(slice keyStr, const Value *key, const Value *value);
+        static Pieces renderParallel(const Value*, bool json5, bool canonical, unsigned nThreads);
         
         void comma() {
             if (_first)
@@ -120,10 +178,10 @@ namespace fleece { namespace impl {
         }
 
         template <class T>
-        void _writeInt(const char *fmt, T t) {
+        void _writeInt(T t) {
             comma();
-            char str[32];
-            _out.write(str, sprintf(str, fmt, t));
+            char str[kMaxIntegerLength];
+            _out.write(str, WriteInteger(t, str));
         }
 
         template <class T>
@@ -134,6 +192,9 @@ namespace fleece { namespace impl {
         }
 
         Writer _out;
+        SharedKeys* _sharedKeys {nullptr};
+        RetainedConst<SharedKeys> _rankedKeys;                  // SharedKeys _keyRanks is from
+        std::shared_ptr<const std::vector<uint16_t>> _keyRanks; // Its keyRanks(), if any
         bool _json5 {false};
         bool _canonical {false};
         bool _first {true};
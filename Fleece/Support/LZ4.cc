@@ -0,0 +1,179 @@
+//
+// LZ4.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "LZ4.hh"
+#include <algorithm>
+#include <cstring>
+
+namespace fleece {
+
+    // An LZ4 block is a series of sequences, each a run of literal bytes followed by a match:
+    // a copy of earlier output. A sequence starts with a token byte, whose high nybble is the
+    // literal count and low nybble the match length minus 4; a nybble of 15 means more bytes of
+    // length follow, each added in until one is less than 255. The literals come next, then the
+    // match's 2-byte little-endian offset back from the current position, then the rest of the
+    // match length. The last sequence has only literals. By the format's rules the last 5 bytes
+    // are always literals, and a match can't start within 12 bytes of the end.
+
+    static constexpr size_t kMinMatch = 4, kLastLiterals = 5, kMatchStartLimit = 12;
+    static constexpr size_t kMaxOffset = 65535;
+    static constexpr unsigned kHashBits = 12;
+
+
+    static inline uint32_t read32(const uint8_t *p) noexcept {
+        uint32_t n;
+        memcpy(&n, p, sizeof(n));
+        return n;
+    }
+
+    static inline uint32_t hash4(uint32_t n) noexcept {
+        return (n * 2654435761u) >> (32 - kHashBits);
+    }
+
+
+    size_t compressLZ4(slice input, void *output, size_t outCapacity) noexcept {
+        auto src = (const uint8_t*)input.buf, end = src + input.size;
+        auto out = (uint8_t*)output, outEnd = out + outCapacity;
+        const uint8_t *anchor = src;                    // start of the pending literals
+
+        auto writeLength = [&](size_t len) {
+            for (; len >= 255; len -= 255) {
+                if (out >= outEnd)
+                    return false;
+                *out++ = 255;
+            }
+            if (out >= outEnd)
+                return false;
+            *out++ = uint8_t(len);
+            return true;
+        };
+
+        // Writes the literals from `anchor` to `literalsEnd`, then the match (if any):
+        auto writeSequence = [&](const uint8_t *literalsEnd, size_t matchLen, size_t offset) {
+            size_t literalLen = literalsEnd - anchor;
+            if (out >= outEnd)
+                return false;
+            uint8_t *token = out++;
+            *token = uint8_t(std::min(literalLen, size_t(15)) << 4);
+            if (literalLen >= 15 && !writeLength(literalLen - 15))
+                return false;
+            if (size_t(outEnd - out) < literalLen)
+                return false;
+            memcpy(out, anchor, literalLen);
+            out += literalLen;
+            if (matchLen > 0) {
+                if (outEnd - out < 2)
+                    return false;
+                *out++ = uint8_t(offset);
+                *out++ = uint8_t(offset >> 8);
+                size_t len = matchLen - kMinMatch;
+                *token |= uint8_t(std::min(len, size_t(15)));
+                if (len >= 15 && !writeLength(len - 15))
+                    return false;
+            }
+            return true;
+        };
+
+        if (input.size > kMatchStartLimit) {
+            // Positions of recent 4-byte sequences, by hash. Stale or colliding entries are
+            // harmless, since every candidate match is verified.
+            uint32_t table[1 << kHashBits] = { };
+            const uint8_t *matchStartLimit = end - kMatchStartLimit;
+            const uint8_t *matchEndLimit = end - kLastLiterals;
+            const uint8_t *ip = src;
+            unsigned misses = 0;
+            while (ip <= matchStartLimit) {
+                uint32_t seq = read32(ip);
+                uint32_t &entry = table[hash4(seq)];
+                const uint8_t *ref = src + entry;
+                entry = uint32_t(ip - src);
+                if (ref < ip && size_t(ip - ref) <= kMaxOffset && read32(ref) == seq) {
+                    size_t offset = ip - ref;
+                    const uint8_t *matchEnd = ip + kMinMatch;
+                    while (matchEnd < matchEndLimit && *matchEnd == matchEnd[-ptrdiff_t(offset)])
+                        ++matchEnd;
+                    if (!writeSequence(ip, matchEnd - ip, offset))
+                        return 0;
+                    ip = anchor = matchEnd;
+                    misses = 0;
+                } else {
+                    // Skip ahead faster through data that isn't compressing:
+                    ip += 1 + (misses++ >> 6);
+                }
+            }
+        }
+        if (!writeSequence(end, 0, 0))
+            return 0;
+        return out - (uint8_t*)output;
+    }
+
+
+    bool decompressLZ4(slice input, void *output, size_t outputSize) noexcept {
+        auto in = (const uint8_t*)input.buf, inEnd = in + input.size;
+        auto start = (uint8_t*)output, out = start, outEnd = out + outputSize;
+
+        auto readLength = [&](size_t &len) {
+            uint8_t b;
+            do {
+                if (in >= inEnd)
+                    return false;
+                b = *in++;
+                len += b;
+            } while (b == 255);
+            return true;
+        };
+
+        while (in < inEnd) {
+            uint8_t token = *in++;
+            size_t literalLen = token >> 4;
+            if (literalLen == 15 && !readLength(literalLen))
+                return false;
+            if (size_t(inEnd - in) < literalLen || size_t(outEnd - out) < literalLen)
+                return false;
+            memcpy(out, in, literalLen);
+            in += literalLen;
+            out += literalLen;
+            if (in == inEnd)
+                break;                                  // the last sequence has no match
+
+            if (inEnd - in < 2)
+                return false;
+            size_t offset = in[0] | (size_t(in[1]) << 8);
+            in += 2;
+            if (offset == 0 || offset > size_t(out - start))
+                return false;
+            size_t matchLen = token & 0x0F;
+            if (matchLen == 15 && !readLength(matchLen))
+                return false;
+            matchLen += kMinMatch;
+            if (size_t(outEnd - out) < matchLen)
+                return false;
+            const uint8_t *match = out - offset;
+            if (offset >= matchLen) {
+                memcpy(out, match, matchLen);
+                out += matchLen;
+            } else {
+                // Overlapping copy, i.e. a repeating pattern; must go byte by byte:
+                while (matchLen-- > 0)
+                    *out++ = *match++;
+            }
+        }
+        return out == outEnd;
+    }
+
+}
@@ -0,0 +1,36 @@
+//
+// LZ4.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+
+namespace fleece {
+
+    /** Compresses data in the LZ4 block format. This is a simple single-pass compressor: it
+        finds matches through a small hash table of 4-byte sequences, so it's fast, but its
+        output is somewhat larger than that of the reference library's.
+        The input should be at most a few megabytes; it's meant for blocks of a larger whole.
+        @return  The compressed size, or 0 if it wouldn't fit in `outCapacity` bytes. */
+    size_t compressLZ4(slice input, void *output, size_t outCapacity) noexcept;
+
+    /** Decompresses an LZ4 block, which must expand to exactly `outputSize` bytes.
+        The input is fully bounds-checked, so it's safe to use on untrusted data.
+        @return  True on success, false if the input is invalid or has the wrong size. */
+    bool decompressLZ4(slice input, void *output, size_t outputSize) noexcept;
+
+}
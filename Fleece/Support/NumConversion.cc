@@ -17,15 +17,22 @@
 //
 
 #include "NumConversion.hh"
+#include "Bitmap.hh"
+#include "PowersOf5.hh"
 #include "SwiftDtoa.h"
+#include <cfloat>
 #include <ctype.h>
 #include <locale.h>
 #include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <new>
 #if !defined(_MSC_VER) && !defined(__GLIBC__)
 #include <xlocale.h>
 #endif
 
 namespace fleece {
+    using namespace internal;
 
     // subroutine that parses only digits
     static bool _parseUInt(const char *str NONNULL, uint64_t &result, bool allowTrailing) {
@@ -92,7 +99,7 @@ namespace fleece {
     }
 
 
-    double ParseDouble(const char *str) noexcept {
+    static double strtodC(const char *str) noexcept {
         // strtod is locale-aware, so in some locales it will not interpret '.' as a decimal point.
         // To work around that, use the C locale explicitly.
         #ifdef LC_C_LOCALE          // Apple & BSD
@@ -113,6 +120,201 @@ namespace fleece {
     }
 
 
+    // Sets hi:lo to the 128-bit product of a and b.
+    static inline void multiply128(uint64_t a, uint64_t b, uint64_t &hi, uint64_t &lo) noexcept {
+    #ifdef __SIZEOF_INT128__
+        auto product = (unsigned __int128)a * b;
+        hi = uint64_t(product >> 64);
+        lo = uint64_t(product);
+    #elif defined(_MSC_VER) && defined(_M_X64)
+        lo = _umul128(a, b, &hi);
+    #else
+        uint64_t aLo = uint32_t(a), aHi = a >> 32, bLo = uint32_t(b), bHi = b >> 32;
+        uint64_t ll = aLo * bLo, lh = aLo * bHi, hl = aHi * bLo, hh = aHi * bHi;
+        uint64_t mid = (ll >> 32) + uint32_t(lh) + uint32_t(hl);
+        lo = (mid << 32) | uint32_t(ll);
+        hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    #endif
+    }
+
+
+    // Computes w * 10^q, correctly rounded, by the Eisel-Lemire algorithm: the product of w and
+    // the 128-bit approximation of 5^q has enough precision to round it, except (very rarely)
+    // when it's too close to halfway between two doubles, in which case this returns false.
+    // See: Daniel Lemire, "Number Parsing at a Gigabyte per Second" (2021).
+    static bool eiselLemire(uint64_t w, int64_t q, double &result) noexcept {
+        uint64_t bits;
+        if (w == 0 || q < kSmallestPowerOf5) {
+            bits = 0;
+        } else if (q > kLargestPowerOf5) {
+            bits = 0x7FFull << 52;                      // infinity
+        } else {
+            int lz = countLeadingZeros(w);
+            w <<= lz;
+            const uint64_t *pow5 = kPowersOf5[q - kSmallestPowerOf5];
+            uint64_t hi, lo;
+            multiply128(w, pow5[0], hi, lo);
+            if ((hi & 0x1FF) == 0x1FF) {
+                // The low bits might matter, so bring in the rest of the power of 5:
+                uint64_t hi2, lo2;
+                multiply128(w, pow5[1], hi2, lo2);
+                lo += hi2;
+                if (hi2 > lo)
+                    ++hi;
+                if ((hi & 0x1FF) == 0x1FF && lo == UINT64_MAX && (q < -27 || q > 55))
+                    return false;                       // can't tell which way to round
+            }
+            int upperBit = int(hi >> 63);
+            uint64_t mantissa = hi >> (upperBit + 9);   // 54 bits: 53 plus one to round with
+            // ((217706 * q) >> 16) is floor(q * log2(10)):
+            int power2 = int(((152170 + 65536) * q) >> 16) + 63 + upperBit - lz + 1023;
+            if (power2 <= 0) {
+                // Subnormal (or zero):
+                if (-power2 + 1 >= 64) {
+                    bits = 0;
+                } else {
+                    mantissa >>= -power2 + 1;
+                    mantissa += (mantissa & 1);
+                    mantissa >>= 1;
+                    power2 = (mantissa < (1ull << 52)) ? 0 : 1;
+                    bits = mantissa | (uint64_t(power2) << 52);
+                }
+            } else {
+                // Exactly halfway between two doubles rounds to even, rather than up. This can
+                // only happen when 5^q fits in 64 bits:
+                if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+                        && (mantissa << (upperBit + 9)) == hi)
+                    mantissa &= ~1ull;
+                mantissa += (mantissa & 1);
+                mantissa >>= 1;
+                if (mantissa >= (2ull << 52)) {
+                    mantissa = 1ull << 52;
+                    ++power2;
+                }
+                mantissa &= ~(1ull << 52);
+                if (power2 >= 0x7FF)
+                    bits = 0x7FFull << 52;              // infinity
+                else
+                    bits = mantissa | (uint64_t(power2) << 52);
+            }
+        }
+        memcpy(&result, &bits, sizeof(result));
+        return true;
+    }
+
+
+    static inline bool isDigit(char c)     {return c >= '0' && c <= '9';}
+
+    // Accumulates the digits at `p` onto `w`, 8 at a time where possible, advancing `p`.
+    // (If there are more than 19, `w` overflows; the caller has to check for that.)
+    static inline void readDigits(const char* &p, const char *end, uint64_t &w) noexcept {
+        while (end - p >= 8 && IsEightDigits(p)) {
+            w = w * 100000000 + ParseEightDigits(p);
+            p += 8;
+        }
+        while (p < end && isDigit(*p))
+            w = 10 * w + (*p++ - '0');
+    }
+
+
+    size_t ParseDouble(slice str, double &result) noexcept {
+        auto start = (const char*)str.buf, end = (const char*)str.end(), p = start;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        // Read the digits as the integer `w`, and the position of the decimal point as the
+        // (negative) exponent:
+        uint64_t w = 0;
+        const char *digits = p;
+        readDigits(p, end, w);
+        const char *intEnd = p;
+        int64_t exponent = 0;
+        if (p < end && *p == '.') {
+            const char *frac = ++p;
+            readDigits(p, end, w);
+            exponent = -(p - frac);
+        }
+        size_t nDigits = (p - digits) - (p != intEnd);
+        if (nDigits == 0)
+            return 0;
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char *e = p + 1;
+            bool negativeExp = false;
+            if (e < end && (*e == '-' || *e == '+'))
+                negativeExp = (*e++ == '-');
+            if (e < end && isDigit(*e)) {               // else the 'e' isn't part of the number
+                int64_t exp = 0;
+                for (; e < end && isDigit(*e); ++e) {
+                    if (exp < 100000)
+                        exp = 10 * exp + (*e - '0');
+                }
+                exponent += negativeExp ? -exp : exp;
+                p = e;
+            }
+        }
+        size_t length = p - start;
+
+        if (_usuallyFalse(nDigits > 19)) {
+            // `w` may have overflowed, unless the extra digits are leading zeros:
+            nDigits = 0;
+            for (auto d = digits; d < p && (isDigit(*d) || *d == '.'); ++d) {
+                if (*d != '.' && (nDigits > 0 || *d != '0'))
+                    ++nDigits;
+            }
+        }
+
+        double d;
+        bool ok = (nDigits <= 19);
+        if (ok) {
+        #if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+            static constexpr double kExactPowersOf10[23] = {
+                1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+            if (exponent >= -22 && exponent <= 22 && w <= (1ull << 53)) {
+                // Both w and the power of 10 are exact doubles, so one operation rounds
+                // correctly (Clinger's fast path):
+                d = double(w);
+                d = (exponent < 0) ? d / kExactPowersOf10[-exponent]
+                                   : d * kExactPowersOf10[exponent];
+            } else
+        #endif
+            {
+                ok = eiselLemire(w, exponent, d);
+            }
+        }
+        if (_usuallyFalse(!ok)) {
+            // Fall back to strtod, which needs a NUL-terminated string:
+            char buf[64];
+            std::unique_ptr<char[]> heapBuf;
+            char *cstr = buf;
+            if (length >= sizeof(buf)) {
+                heapBuf.reset(new (std::nothrow) char[length + 1]);
+                if (!heapBuf)
+                    return 0;
+                cstr = heapBuf.get();
+            }
+            memcpy(cstr, start, length);
+            cstr[length] = '\0';
+            result = strtodC(cstr);
+            return length;
+        }
+        result = negative ? -d : d;
+        return length;
+    }
+
+
+    double ParseDouble(const char *str) noexcept {
+        double result;
+        size_t length = ParseDouble(slice(str, strlen(str)), result);
+        // Let strtod handle anything besides a plain number, like whitespace, "inf" or hex:
+        if (_usuallyTrue(length > 0 && !isalnum((unsigned char)str[length])
+                                    && str[length] != '.'))
+            return result;
+        return strtodC(str);
+    }
+
+
     size_t WriteFloat(float n, char *dst, size_t capacity) {
         return swift_format_float(n, dst, capacity);
     }
@@ -121,4 +323,41 @@ namespace fleece {
     size_t WriteFloat(double n, char *dst, size_t capacity) {
         return swift_format_double(n, dst, capacity);
     }
+
+
+    // "00" "01" ... "99", for writing two digits at a time:
+    static const char kDigitPairs[201] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+
+    size_t WriteInteger(uint64_t n, char *dst) noexcept {
+        // Write the digits right-to-left into a buffer, two at a time:
+        char buf[kMaxIntegerLength];
+        char *p = buf + kMaxIntegerLength;
+        while (n >= 100) {
+            auto pair = n % 100;
+            n /= 100;
+            p -= 2;
+            memcpy(p, &kDigitPairs[2 * pair], 2);
+        }
+        if (n >= 10) {
+            p -= 2;
+            memcpy(p, &kDigitPairs[2 * n], 2);
+        } else {
+            *--p = char('0' + n);
+        }
+        size_t len = buf + kMaxIntegerLength - p;
+        memcpy(dst, p, len);
+        return len;
+    }
+
+
+    size_t WriteInteger(int64_t n, char *dst) noexcept {
+        if (n >= 0)
+            return WriteInteger(uint64_t(n), dst);
+        *dst = '-';
+        return 1 + WriteInteger(uint64_t(0) - uint64_t(n), dst + 1);
+    }
 }
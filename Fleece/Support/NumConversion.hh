@@ -13,9 +13,12 @@
 #include "FleeceException.hh"
 #endif
 
+#include "Endian.hh"
+#include "fleece/slice.hh"
 #include <cstddef>
 #include <cstdint>
 #include <cinttypes>
+#include <cstring>
 #include <typeinfo>
 #include <limits>
 
@@ -45,6 +48,33 @@ namespace fleece {
     /// (I.e. non-numeric characters after the digits are not treated as an error.)
     double ParseDouble(const char *str NONNULL) noexcept;
 
+    /// Parse a floating-point number in JSON syntax (an optional sign, digits, and an optional
+    /// fraction and exponent; JSON5's "1." and ".1" are allowed too) from the start of `str`,
+    /// which needn't be NUL-terminated. Returns the number of bytes parsed, or 0 if `str`
+    /// doesn't start with a number. The result is correctly rounded, like strtod's.
+    size_t ParseDouble(slice str, double &result) noexcept;
+
+
+    /// True if the 8 bytes at `p` are all ASCII digits.
+    static inline bool IsEightDigits(const char *p NONNULL) noexcept {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        // Every byte must be 0x30-0x39, i.e. have 3 in its high nybble before and after adding 6:
+        return ((v & 0xF0F0F0F0F0F0F0F0) | (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4))
+                == 0x3333333333333333;
+    }
+
+    /// Returns the value of the 8 ASCII digits at `p`, which must pass \ref IsEightDigits.
+    static inline uint32_t ParseEightDigits(const char *p NONNULL) noexcept {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v = endian::decLittle64(v) - 0x3030303030303030;
+        // Combine adjacent digits, then pairs of those, then pairs of those:
+        v = (v * 10 + (v >> 8)) & 0x00FF00FF00FF00FF;
+        v = (v * 100 + (v >> 16)) & 0x0000FFFF0000FFFF;
+        return uint32_t(v * 10000 + (v >> 32));
+    }
+
 
     /// Format a 64-bit-floating point number to a string.
     size_t WriteFloat(double n, char *dst, size_t capacity);
@@ -55,6 +85,17 @@ namespace fleece {
     /// Alternative syntax for formatting a 64-bit-floating point number to a string.
     static inline size_t WriteDouble(double n, char *dst, size_t c)  {return WriteFloat(n, dst, c);}
 
+    /// The maximum number of characters written by \ref WriteInteger.
+    static constexpr size_t kMaxIntegerLength = 20;
+
+    /// Formats a signed integer in decimal, returning the number of characters written.
+    /// `dst` must have room for \ref kMaxIntegerLength characters. No NUL is written.
+    size_t WriteInteger(int64_t n, char *dst NONNULL) noexcept;
+
+    /// Formats an unsigned integer in decimal, returning the number of characters written.
+    /// `dst` must have room for \ref kMaxIntegerLength characters. No NUL is written.
+    size_t WriteInteger(uint64_t n, char *dst NONNULL) noexcept;
+
     #if DEBUG
         template<typename Out, typename In>
         static Out narrow_cast (In val) {
@@ -65,6 +65,7 @@
 
 #include "ParseDate.hh"
 #include "date/date.h"
+#include "Endian.hh"
 #include "FleeceException.hh"
 
 #include <stdint.h>
@@ -391,7 +392,139 @@ static int parseYyyyMmDd(const char *zDate, DateTime *p){
 
 namespace fleece {
 
+    static constexpr int64_t kMillisecondsPerDay = 86400000;
+
+
+    // Days since 1970-01-01 of a date in the proleptic Gregorian calendar, and the reverse.
+    // (From Howard Hinnant's "chrono-Compatible Low-Level Date Algorithms".)
+    static inline int64_t daysFromCivil(int y, unsigned m, unsigned d) {
+        y -= (m <= 2);
+        int era = (y >= 0 ? y : y - 399) / 400;
+        unsigned yoe = unsigned(y - era * 400);
+        unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+        unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        return int64_t(era) * 146097 + int64_t(doe) - 719468;
+    }
+
+    static inline void civilFromDays(int64_t days, int64_t &y, unsigned &m, unsigned &d) {
+        days += 719468;
+        int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        unsigned doe = unsigned(days - era * 146097);
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        d = doy - (153 * mp + 2) / 5 + 1;
+        m = (mp < 10) ? mp + 3 : mp - 9;
+        y = int64_t(yoe) + era * 400 + (m <= 2);
+    }
+
+
+    // The fast path for the usual form of date, "YYYY-MM-DDTHH:MM:SSZ" or
+    // "YYYY-MM-DDTHH:MM:SS.sssZ". It's copied into the longer form, then read as three
+    // 64-bit words whose layout and digits are checked all at once. Returns false if the
+    // string isn't in that form (it may still be valid), or kInvalidDate in `result` if its
+    // fields are out of range.
+    static bool parseCommonISO8601Date(slice str, int64_t &result) {
+        static constexpr char kTemplate[25] = "0000-00-00T00:00:00.000Z";
+        if (str.size != 24 && str.size != 20)
+            return false;
+        char buf[24];
+        memcpy(buf, kTemplate, sizeof(buf));
+        memcpy(buf, str.buf, str.size - 1);
+        buf[23] = ((const char*)str.buf)[str.size - 1];
+
+        // 0xFF marks the bytes of each word that are digits:
+        static constexpr uint64_t kDigitMasks[3] = {0x00FFFF00FFFFFFFF,     // "YYYY-MM-"
+                                                    0xFFFF00FFFF00FFFF,     // "DDTHH:MM"
+                                                    0x00FFFFFF00FFFF00};    // ":SS.sssZ"
+        constexpr uint64_t kOnes = 0x0101010101010101;
+        uint64_t digits[3];
+        for (int i = 0; i < 3; ++i) {
+            uint64_t word, templ;
+            memcpy(&word, &buf[8 * i], 8);
+            memcpy(&templ, &kTemplate[8 * i], 8);
+            word = endian::decLittle64(word);
+            templ = endian::decLittle64(templ);
+            uint64_t mask = kDigitMasks[i];
+            // Subtracting '0' leaves a digit 0-9, so adding 6 can't carry into the high nybble:
+            uint64_t d = (word ^ (kOnes * '0')) & mask;
+            if (((word ^ templ) & ~mask) || ((d | (d + kOnes * 6)) & mask & (kOnes * 0xF0)))
+                return false;
+            digits[i] = d;
+        }
+
+        // Combine each pair of digits at an even byte offset into a byte:
+        auto pairs = [](uint64_t d) {return (d * 10 + (d >> 8)) & 0x00FF00FF00FF00FF;};
+        uint64_t ymd = pairs(digits[0]), ymd1 = pairs(digits[0] >> 8);
+        uint64_t dhm = pairs(digits[1]), dhm1 = pairs(digits[1] >> 8);
+        uint64_t sms = pairs(digits[2]), sms1 = pairs(digits[2] >> 8);
+        int Y = int((ymd & 0xFF) * 100 + ((ymd >> 16) & 0xFF));
+        unsigned M = (ymd1 >> 32) & 0xFF, D = dhm & 0xFF;
+        unsigned h = (dhm1 >> 16) & 0xFF, m = (dhm >> 48) & 0xFF, s = sms1 & 0xFF;
+        unsigned ms = unsigned(((sms >> 32) & 0xFF) * 10 + ((digits[2] >> 48) & 0xFF));
+        if (h > 23)
+            return false;                       // the general parser allows 24:00
+        if (M < 1 || M > 12 || D < 1 || m > 59 || s > 59) {
+            result = kInvalidDate;
+            return true;
+        }
+        if (_usuallyFalse(D >= 29)) {
+            // Check for days past the end of the month:
+            bool leap = (Y % 4 == 0 && (Y % 100 != 0 || Y % 400 == 0));
+            if (D > 31 || (M == 2 && (D > 29 || !leap))
+                       || (D > 30 && !(LONG_MONTHS & (1 << M)))) {
+                result = kInvalidDate;
+                return true;
+            }
+        }
+        result = daysFromCivil(Y, M, D) * kMillisecondsPerDay
+               + ((h * 60 + m) * 60 + s) * 1000 + ms;
+        return true;
+    }
+
+
+    // The fast path for formatting a UTC date from year 0 to 9999. Returns 0 if it's out of range.
+    static size_t formatUTCDate(char buf[], int64_t time) {
+        int64_t days = time / kMillisecondsPerDay, msOfDay = time % kMillisecondsPerDay;
+        if (msOfDay < 0) {
+            --days;
+            msOfDay += kMillisecondsPerDay;
+        }
+        int64_t y;
+        unsigned m, d;
+        civilFromDays(days, y, m, d);
+        if (y < 0 || y > 9999)
+            return 0;
+        auto two = [](char *dst, unsigned n) {dst[0] = char('0' + n / 10); dst[1] = char('0' + n % 10);};
+        two(&buf[0], unsigned(y / 100));
+        two(&buf[2], unsigned(y % 100));
+        buf[4] = '-';
+        two(&buf[5], m);
+        buf[7] = '-';
+        two(&buf[8], d);
+        buf[10] = 'T';
+        unsigned secs = unsigned(msOfDay / 1000), ms = unsigned(msOfDay % 1000);
+        two(&buf[11], secs / 3600);
+        buf[13] = ':';
+        two(&buf[14], secs / 60 % 60);
+        buf[16] = ':';
+        two(&buf[17], secs % 60);
+        size_t len = 19;
+        if (ms != 0) {
+            buf[19] = '.';
+            buf[20] = char('0' + ms / 100);
+            two(&buf[21], ms % 100);
+            len = 23;
+        }
+        buf[len++] = 'Z';
+        buf[len] = 0;
+        return len;
+    }
+
+
     int64_t ParseISO8601Date(const char* zDate) {
+        if (int64_t result; parseCommonISO8601Date(slice(zDate), result))
+            return result;
         DateTime x;
         if (parseYyyyMmDd(zDate,&x))
             return kInvalidDate;
@@ -400,14 +533,29 @@ namespace fleece {
     }
 
     int64_t ParseISO8601Date(fleece::slice date) {
+        if (int64_t result; parseCommonISO8601Date(date, result))
+            return result;
         return ParseISO8601Date(string(date).c_str());
     }
 
+    size_t ParseISO8601Dates(const slice dateStrs[], size_t count, int64_t outTimestamps[]) {
+        size_t nValid = 0;
+        for (size_t i = 0; i < count; ++i) {
+            outTimestamps[i] = ParseISO8601Date(dateStrs[i]);
+            nValid += (outTimestamps[i] != kInvalidDate);
+        }
+        return nValid;
+    }
+
     slice FormatISO8601Date(char buf[], int64_t time, bool asUTC) {
         if (time == kInvalidDate) {
             *buf = 0;
             return nullslice;
         }
+        if (asUTC) {
+            if (size_t len = formatUTCDate(buf, time); len > 0)
+                return {buf, len};
+        }
 
         stringstream timestream;
         auto tp = local_time<milliseconds>(milliseconds(time));
@@ -424,7 +572,7 @@ namespace fleece {
         } else {
             tp += offset;
             auto h = duration_cast<hours>(offset);
-            auto m = offset - h;
+            auto m = duration_cast<minutes>(offset - h);
             timestream.fill('0');
             if(totalSec == totalMs) {
                 timestream << format("%FT%T", floor<seconds>(tp));
@@ -440,6 +588,13 @@ namespace fleece {
         return {buf, timestream.str().length()};
     }
 
+    void FormatISO8601Dates(const int64_t timestamps[], size_t count, bool asUTC,
+                            char buf[], slice outStrs[])
+    {
+        for (size_t i = 0; i < count; ++i, buf += kFormattedISO8601DateMaxSize)
+            outStrs[i] = FormatISO8601Date(buf, timestamps[i], asUTC);
+    }
+
     struct tm FromTimestamp(seconds timestamp) {
         local_seconds tp { timestamp };
         auto dp = floor<days>(tp);
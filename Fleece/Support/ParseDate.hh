@@ -35,6 +35,10 @@ namespace fleece {
         1/1/1970), or kInvalidDate if the string is not valid. */
     int64_t ParseISO8601Date(slice dateStr);
 
+    /** Parses many date strings, as by ParseISO8601Date, storing the timestamps (or
+        kInvalidDate) in `outTimestamps`. Returns the number of strings that were valid. */
+    size_t ParseISO8601Dates(const slice dateStrs[], size_t count, int64_t outTimestamps[]);
+
     /** Maximum length of a formatted ISO-8601 date. (Actually it's a bit bigger.) */
     static constexpr size_t kFormattedISO8601DateMaxSize = 40;
 
@@ -46,6 +50,13 @@ namespace fleece {
         @return  The formatted string (points to `buf`). */
     slice FormatISO8601Date(char buf[], int64_t timestamp, bool asUTC);
 
+    /** Formats many timestamps, as by FormatISO8601Date.
+        @param buf  The location to write the formatted strings. At least
+                    `count * kFormattedISO8601DateMaxSize` bytes must be available.
+        @param outStrs  The formatted strings (pointing into `buf`) are stored here. */
+    void FormatISO8601Dates(const int64_t timestamps[], size_t count, bool asUTC,
+                            char buf[], slice outStrs[]);
+
     /** Creates a tm out of a timestamp, but it will not be fully valid until
         passed through mktime.
         @param timestamp  The timestamp to use
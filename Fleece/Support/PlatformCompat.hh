@@ -27,6 +27,12 @@
     #define NOINLINE                        __declspec(noinline)
     #define ALWAYS_INLINE                   inline
     #define ASSUME(cond)                    __assume(cond)
+    #if defined(_M_X64) || defined(_M_IX86)
+        #include <xmmintrin.h>
+        #define PREFETCH(addr)              _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+    #else
+        #define PREFETCH(addr)              ((void)(addr))
+    #endif
 	#define LITECORE_UNUSED
     #define __typeof                        decltype
 
@@ -73,6 +79,8 @@
         #define ASSUME(cond)                (void(0))
     #endif
 
+    #define PREFETCH(addr)                  __builtin_prefetch(addr)
+
     // Declares this function takes a printf-like format string, and the subsequent args should
     // be type-checked against it.
     #ifndef __printflike
@@ -85,6 +93,17 @@
 
 #endif
 
+// Defined if SSE2 vector instructions are available (as on all x86-64 CPUs)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define FL_HAVE_SSE2 1
+#endif
+
+// The size in bytes of a mutable collection's item (ValueSlot): 8, or 16 to store strings of up
+// to 14 bytes inline instead of in separate heap blocks, at the cost of twice the memory per item.
+#ifndef FL_VALUE_SLOT_SIZE
+    #define FL_VALUE_SLOT_SIZE 8
+#endif
+
 // Platform independent string substitutions
 #if defined(__linux__)
 #define PRIms "ld"
@@ -33,6 +33,13 @@ namespace fleece {
         if (--_refCount <= 0)
             delete this;
     }
+
+    __hot void RefCounted::_unsharedRelease() const noexcept {
+        int32_t newRef = _refCount.load(std::memory_order_relaxed) - 1;
+        _refCount.store(newRef, std::memory_order_relaxed);
+        if (newRef <= 0)
+            delete this;
+    }
 #endif
 
 
@@ -42,6 +42,20 @@ namespace fleece {
             **Never call `delete`**, only `release`! Overrides should be made protected or private. */
         virtual ~RefCounted();
 
+        /** Non-atomic versions of retain and release, for subclasses to use on instances that
+            are known to be used on only one thread. They avoid the cost of a locked instruction.
+            (In debug builds they're the same as the regular ones.) */
+#if DEBUG
+        void _unsharedRetain() const noexcept           {_careful_retain();}
+        void _unsharedRelease() const noexcept          {_careful_release();}
+#else
+        ALWAYS_INLINE void _unsharedRetain() const noexcept {
+            _refCount.store(_refCount.load(std::memory_order_relaxed) + 1,
+                            std::memory_order_relaxed);
+        }
+        void _unsharedRelease() const noexcept;
+#endif
+
     private:
         template <typename T>
         friend T* retain(T*) noexcept;
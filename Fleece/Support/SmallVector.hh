@@ -95,6 +95,8 @@ namespace fleece {
         }
 
         void clear()                                    {shrinkTo(0);}
+        /// Like `clear` but keeps any heap storage, so refilling the vector won't reallocate.
+        void clearKeepingCapacity()                     {shrinkTo(0, true);}
         void reserve(size_t cap)                        {if (cap>_capacity) setCapacity(cap);}
 
         const T& get(size_t i) const FLPURE {
@@ -195,14 +197,14 @@ namespace fleece {
         T* heedlessGrow()                       {assert(_size < _capacity); return &_get(_size++);}
         T& heedlessPushBack(const T& t)         {return * new(heedlessGrow()) T(t);}
 
-        void shrinkTo(size_t sz) {
+        void shrinkTo(size_t sz, bool keepCapacity =false) {
             if (sz < _size) {
                 auto item = end();
                 for (auto i = sz; i < _size; ++i)
                     (--item)->T::~T();                 // destruct removed items
                 _size = (uint32_t)sz;
 
-                if (_isBig && sz <= N)
+                if (_isBig && sz <= N && !keepCapacity)
                     _emsmallen(N, kItemSize);
             }
         }
@@ -12,6 +12,7 @@
 
 #pragma once
 #include "PlatformCompat.hh"
+#include "Allocator.hh"
 #include <algorithm>
 #include <memory>
 #include <stdexcept>
@@ -38,7 +39,7 @@ namespace fleece {
 
         ~smallVectorBase() {
             if (_isBig)
-                ::free(_dataPointer);
+                heap::free(_dataPointer);
         }
 
 
@@ -74,9 +75,7 @@ namespace fleece {
             precondition(cap >= _size);
             uint32_t newCap = rangeCheck(cap);
             void *pointer = _isBig ? _dataPointer : nullptr;
-            pointer = ::realloc(pointer, newCap * itemSize);
-            if (_usuallyFalse(!pointer))
-                throw std::bad_alloc();
+            pointer = heap::reallocate(pointer, newCap * itemSize);
             if (!_isBig) {
                 if (_size > 0)
                     ::memcpy(pointer, _inlineData, _size * itemSize);
@@ -98,7 +97,7 @@ namespace fleece {
             void *pointer = _dataPointer;
             if (_size > 0)
                 ::memcpy(_inlineData, pointer, _size * itemSize);
-            ::free(pointer);
+            heap::free(pointer);
             _isBig = false;
             _capacity = newCap;
         }
@@ -17,20 +17,99 @@
 //
 
 #include "StringTable.hh"
+#include "Allocator.hh"
 #include "PlatformCompat.hh"
+#include "Bitmap.hh"
+#include "Endian.hh"
 #include <algorithm>
 #include <stdlib.h>
 #include <vector>
 #include "betterassert.hh"
 
+#ifdef FL_HAVE_SSE2
+    #include <emmintrin.h>
+#endif
+
 namespace fleece {
 
     // Minimum size [not capacity] of table to create initially
     static constexpr size_t kMinInitialSize = 16;
 
     // How full the table is allowed to get before it grows.
-    // (Robin Hood hashing allows higher loads than regular hashing...)
-    static const float kMaxLoad = 0.9f;
+    static const float kMaxLoad = 0.875f;
+
+
+#pragma mark - CONTROL-BYTE GROUPS:
+
+
+    namespace {
+
+        // A set of matching positions within a Group. Iterate it with `for (; m; ++m)`,
+        // where `*m` is the offset of a match from the start of the group.
+        template <unsigned SHIFT>
+        class BitMask {
+        public:
+            explicit BitMask(uint64_t bits)         :_bits(bits) { }
+            explicit operator bool() const          {return _bits != 0;}
+            size_t operator*() const                {return countTrailingZeros(_bits) >> SHIFT;}
+            BitMask& operator++()                   {_bits &= (_bits - 1); return *this;}
+        private:
+            uint64_t _bits;
+        };
+
+
+#ifdef FL_HAVE_SSE2
+        // A group of 16 control bytes, compared in parallel with SSE2.
+        class Group {
+        public:
+            explicit Group(const uint8_t *control)
+            :_control(_mm_loadu_si128((const __m128i*)control))
+            { }
+
+            BitMask<0> match(uint8_t tag) const {
+                auto eq = _mm_cmpeq_epi8(_mm_set1_epi8(char(tag)), _control);
+                return BitMask<0>(uint32_t(_mm_movemask_epi8(eq)));
+            }
+
+            // kEmpty is the only control byte with its high bit set:
+            BitMask<0> matchEmpty() const {
+                return BitMask<0>(uint32_t(_mm_movemask_epi8(_control)));
+            }
+
+        private:
+            __m128i _control;
+        };
+#else
+        // A group of 8 control bytes, compared in parallel within a uint64_t ("SWAR".)
+        class Group {
+        public:
+            explicit Group(const uint8_t *control) {
+                memcpy(&_control, control, sizeof(_control));
+                _control = endian::decLittle64(_control);
+            }
+
+            // This can have false positives just above a true match, which is harmless since
+            // the keys are compared anyway; but never on an empty slot, since x >= 0x80 there.
+            BitMask<3> match(uint8_t tag) const {
+                uint64_t x = _control ^ (kLSBs * tag);
+                return BitMask<3>((x - kLSBs) & ~x & kMSBs);
+            }
+
+            BitMask<3> matchEmpty() const {
+                return BitMask<3>(_control & kMSBs);
+            }
+
+        private:
+            static constexpr uint64_t kLSBs = 0x0101010101010101;
+            static constexpr uint64_t kMSBs = 0x8080808080808080;
+            uint64_t _control;
+        };
+#endif
+
+    }
+
+
+#pragma mark - STRINGTABLE:
 
 
     StringTable::StringTable(size_t capacity)
@@ -39,13 +118,14 @@ namespace fleece {
 
 
     StringTable::StringTable(size_t capacity,
-                             size_t initialSize, hash_t *initialHashes, entry_t *initialEntries)
+                             size_t initialSize, uint8_t *initialControl, entry_t *initialEntries)
     {
+        assert_precondition(initialSize >= kGroupWidth);
         size_t size;
         for (size = initialSize; size * kMaxLoad < capacity; size *= 2)
             ;
-        if (initialHashes && size <= initialSize)
-            initTable(size, initialHashes, initialEntries);
+        if (initialControl && size <= initialSize)
+            initTable(size, initialControl, initialEntries);
         else
             allocTable(size);
     }
@@ -57,19 +137,20 @@ namespace fleece {
 
 
     StringTable& StringTable::operator=(const StringTable &s) {
+        if (this == &s)
+            return *this;
         if (_allocated) {
-            free(_hashes);
-            _hashes = nullptr;
+            heap::free(_entries);
+            _entries = nullptr;
         }
-        _entries = nullptr;
+        _control = nullptr;
         _allocated = false;
 
         allocTable(s._size);
-        
+
         _count = s._count;
-        _maxDistance = s._maxDistance;
-        memcpy(_hashes, s._hashes, _count * sizeof(hash_t));
-        memcpy(_entries, s._entries, _count * sizeof(entry_t));
+        memcpy(_control, s._control, _size + kGroupWidth);
+        memcpy((void*)_entries, s._entries, _size * sizeof(entry_t));
 
         return *this;
     }
@@ -77,28 +158,46 @@ namespace fleece {
 
     StringTable::~StringTable() {
         if (_allocated)
-            free(_hashes);
+            heap::free(_entries);
     }
 
 
     void StringTable::clear() noexcept {
-        ::memset(_hashes, 0, _size * sizeof(hash_t));
+        ::memset(_control, kEmpty, _size + kGroupWidth);
         _count = 0;
-        _maxDistance = 0;
     }
 
 
+    // Sets a control byte, and its copy past the end if it's one of the first kGroupWidth;
+    // that copy lets a Group be loaded at any index without wrapping around.
+    inline void StringTable::setControl(size_t i, uint8_t tag) noexcept {
+        _control[i] = tag;
+        if (i < kGroupWidth)
+            _control[_size + i] = tag;
+    }
+
+
+    // The probe sequence visits groups at triangular-number offsets, which (since the table
+    // size is a power of 2 and a multiple of kGroupWidth) eventually covers the whole table.
+    // Nothing is ever removed, so a lookup can stop at the first group with an empty slot.
+
+
     __hot const StringTable::entry_t* StringTable::find(key_t key, hash_t hash) const noexcept {
         assert_precondition(key.buf != nullptr);
         assert_precondition(hash != hash_t::Empty);
-        size_t end = wrap(size_t(hash) + _maxDistance + 1);
-        for (size_t i = indexOfHash(hash); i != end; i = wrap(i + 1)) {
-            if (_hashes[i] == hash_t::Empty)
-                break;
-            else if (_hashes[i] == hash && _entries[i].first == key)
-                return &_entries[i];
+        uint8_t tag = tagOfHash(hash);
+        size_t pos = indexOfHash(hash);
+        for (size_t step = kGroupWidth; ; step += kGroupWidth) {
+            Group group(&_control[pos]);
+            for (auto m = group.match(tag); m; ++m) {
+                size_t i = wrap(pos + *m);
+                if (_usuallyTrue(_entries[i].first == key))
+                    return &_entries[i];
+            }
+            if (_usuallyTrue(bool(group.matchEmpty())))
+                return nullptr;
+            pos = wrap(pos + step);
         }
-        return nullptr;
     }
 
 
@@ -109,139 +208,101 @@ namespace fleece {
         if (_usuallyFalse(_count > _capacity))
             grow();
 
-        ssize_t distance = 0;
-        auto maxDistance = _maxDistance;
-        hash_t curHash = hash;
-        entry_t curEntry = {key, value};
-        entry_t *result = nullptr;
-        // Walk along the table looking for an empty space:
-        size_t i;
-        for (i = indexOfHash(hash); _hashes[i] != hash_t::Empty; i = wrap(i + 1)) {
-            assert(distance < _count);
-            if (_hashes[i] == hash && _entries[i].first == key) {
-                // Found the key in the table already:
-                if (!result)
-                    return {&_entries[i], false};   // Return existing entry
-                else
-                    break;
+        uint8_t tag = tagOfHash(hash);
+        size_t pos = indexOfHash(hash);
+        for (size_t step = kGroupWidth; ; step += kGroupWidth) {
+            Group group(&_control[pos]);
+            for (auto m = group.match(tag); m; ++m) {
+                size_t i = wrap(pos + *m);
+                if (_usuallyTrue(_entries[i].first == key))
+                    return {&_entries[i], false};           // Return existing entry
             }
-            ssize_t itsDistance = wrap(i - indexOfHash(_hashes[i]) + _size);
-            if (itsDistance < distance) {
-                // Robin Hood hashing: Put new item where a less-distant existing item was:
-                std::swap(curHash,  _hashes[i]);
-                std::swap(curEntry, _entries[i]);
-                maxDistance = std::max(distance, maxDistance);
-                distance = itsDistance;
-                if (!result)
-                    result = &_entries[i];
-                // Then continue, to find a new spot for the existing item we removed...
+            if (auto empty = group.matchEmpty(); _usuallyTrue(bool(empty))) {
+                size_t i = wrap(pos + *empty);
+                setControl(i, tag);
+                _entries[i] = {key, value};
+                ++_count;
+                return {&_entries[i], true};                // Return new entry
             }
-            ++distance;
+            pos = wrap(pos + step);
         }
-
-        // Now place the final item in the empty space:
-        _hashes[i]  = curHash;
-        _entries[i] = std::move(curEntry);
-        _maxDistance = std::max(distance, maxDistance);
-        ++_count;
-
-        if (!result)
-            result = &_entries[i];
-        return {result, true};                      // Return new entry
     }
 
 
     __hot void StringTable::insertOnly(key_t key, value_t value, hash_t hash) {
         assert_precondition(!find(key, hash));
-        if (_usuallyFalse(++_count > _capacity))
+        if (_usuallyFalse(_count > _capacity))
             grow();
-        _insertOnly(hash, {key, value});
+        size_t i = findEmpty(hash);
+        setControl(i, tagOfHash(hash));
+        _entries[i] = {key, value};
+        ++_count;
     }
 
 
-    // Subroutine of insertOnly() and grow() that doesn't bump count or grow table.
-    // This repeats a lot of the logic of insert(), but I decided performance trumps DRY.
-    __hot void StringTable::_insertOnly(hash_t hash, entry_t entry) noexcept {
-        assert_precondition(entry.first);
-        assert_precondition(hash != hash_t::Empty);
-        ssize_t distance = 0;
-        auto maxDistance = _maxDistance;
-        // Walk along the table looking for an empty space:
-        size_t i;
-        for (i = indexOfHash(hash); _hashes[i] != hash_t::Empty; i = wrap(i + 1)) {
-            assert(distance < _count);
-            ssize_t itsDistance = wrap(i - indexOfHash(_hashes[i]) + _size);
-            if (itsDistance < distance) {
-                // Robin Hood hashing: Put new item where a less-distant existing item was:
-                std::swap(hash,  _hashes[i]);
-                std::swap(entry, _entries[i]);
-                maxDistance = std::max(distance, maxDistance);
-                distance = itsDistance;
-                // Then continue, to find a new spot for the existing item we removed...
-            }
-            ++distance;
+    // Returns the index of the empty slot where an entry with this hash belongs.
+    __hot size_t StringTable::findEmpty(hash_t hash) const noexcept {
+        size_t pos = indexOfHash(hash);
+        for (size_t step = kGroupWidth; ; step += kGroupWidth) {
+            if (auto empty = Group(&_control[pos]).matchEmpty(); _usuallyTrue(bool(empty)))
+                return wrap(pos + *empty);
+            pos = wrap(pos + step);
         }
-
-        // Now place the final item in the empty space:
-        _hashes[i]  = hash;
-        _entries[i] = std::move(entry);
-        _maxDistance = std::max(distance, maxDistance);
     }
 
 
 #pragma mark - TABLE ALLOCATION:
 
 
-    void StringTable::initTable(size_t size, hash_t *hashes, entry_t *entries) {
+    void StringTable::initTable(size_t size, uint8_t *control, entry_t *entries) {
         _size = size;
         _sizeMask = size - 1;
-        _maxDistance = 0;
         _capacity = (size_t)(size * kMaxLoad);
-        _hashes = hashes;
+        _control = control;
         _entries = entries;
-        memset(_hashes, 0, size * sizeof(hash_t));
+        memset(_control, kEmpty, size + kGroupWidth);
     }
 
 
     void StringTable::allocTable(size_t size) {
-        size_t hashesSize  = size * sizeof(hash_t), entriesSize = size * sizeof(entry_t);
-        void *memory = ::malloc(hashesSize + entriesSize);
-        if (!memory)
-            throw std::bad_alloc();
-        initTable(size, (hash_t*)memory, (entry_t*)offsetby(memory, hashesSize));
+        size_t entriesSize = size * sizeof(entry_t), controlSize = size + kGroupWidth;
+        void *memory = heap::allocate(entriesSize + controlSize);
+        initTable(size, (uint8_t*)offsetby(memory, entriesSize), (entry_t*)memory);
         _allocated = true;
     }
 
 
     __hot void StringTable::grow() {
         auto oldSize = _size;
-        auto oldHashes = _hashes;
+        auto oldControl = _control;
         auto oldEntries = _entries;
         auto wasAllocated = _allocated;
 
         allocTable(2 * oldSize);
 
         for (size_t i = 0; i < oldSize; ++i) {
-            if (oldHashes[i] != hash_t::Empty)
-                _insertOnly(oldHashes[i], oldEntries[i]);
+            if (oldControl[i] != kEmpty) {
+                hash_t hash = hashCode(oldEntries[i].first);
+                size_t j = findEmpty(hash);
+                setControl(j, tagOfHash(hash));
+                _entries[j] = oldEntries[i];
+            }
         }
         if (wasAllocated)
-            free(oldHashes);
+            heap::free(oldEntries);
     }
 
 
     void StringTable::dump() const noexcept {
-        ssize_t totalDistance = 0;
-        std::vector<size_t> distanceCounts(_maxDistance+1);
+        size_t totalDistance = 0, maxDistance = 0;
         for (size_t i = 0; i < _size; ++i) {
             printf("%4zd: ", i);
-            if (_hashes[i] != hash_t::Empty) {
+            if (_control[i] != kEmpty) {
                 key_t key = _entries[i].first;
-                size_t index = indexOfHash(hashCode(key));
-                ssize_t distance = (i - (int)index + _size) & _sizeMask;
+                size_t distance = wrap(i - indexOfHash(hashCode(key)) + _size);
                 totalDistance += distance;
-                ++distanceCounts[distance];
-                printf("(%2zd) '%.*s'\n", distance, FMTSLICE(key));
+                maxDistance = std::max(distance, maxDistance);
+                printf("(%2zd) [%02x] '%.*s'\n", distance, _control[i], FMTSLICE(key));
             } else {
                 printf("--\n");
             }
@@ -249,9 +310,7 @@ namespace fleece {
         printf(">> Capacity %zd, using %zu (%.0f%%)\n",
                _size, _count,  _count/(double)_size*100.0);
         printf(">> Average key distance = %.2f, max = %zd\n",
-               totalDistance/(double)count(), _maxDistance);
-        for (size_t i = 0; i <= _maxDistance; ++i)
-            printf("\t%2zd: %zd\n", i, distanceCounts[i]);
+               totalDistance/(double)count(), maxDistance);
     }
 
 }
@@ -19,13 +19,18 @@
 #pragma once
 
 #include "PlatformCompat.hh"
+#include "TableHash.hh"
 #include "fleece/slice.hh"
 #include <algorithm>
 #include <utility>
 
 namespace fleece {
 
-    /** Internal hash table mapping strings (slices) to integers (uint32_t). */
+    /** Internal hash table mapping strings (slices) to integers (uint32_t).
+        It's laid out like a SwissTable: alongside the entries is an array of 1-byte control
+        codes, each either kEmpty or the top 7 bits of the entry's hash. Lookups scan a group of
+        control bytes at once (with SSE2 where available, else 8 at a time in a uint64_t), so
+        only entries whose 7-bit tag matches have their keys compared. */
     class StringTable {
     public:
         StringTable(size_t capacity =0);
@@ -41,7 +46,7 @@ namespace fleece {
         enum class hash_t : uint32_t { Empty = 0 };
 
         static inline hash_t hashCode(key_t key) FLPURE {
-            return hash_t( std::max(key.hash(), 1u) ); // hashCode must never be zero
+            return hash_t( std::max(tableHash(key), 1u) ); // hashCode must never be zero
         }
 
         size_t count() const FLPURE                            {return _count;}
@@ -65,26 +70,44 @@ namespace fleece {
         void insertOnly(key_t key, value_t value)       {insertOnly(key, value, hashCode(key));}
         void insertOnly(key_t key, value_t value, hash_t);
 
+        /// Calls `fn` with a reference to every entry. It may change an entry's value, or point
+        /// its key to an identical copy of the string, but mustn't change the key's contents.
+        template <class FN>
+        void forEach(FN fn) {
+            for (size_t i = 0; i < _size; ++i) {
+                if (_control[i] != kEmpty)
+                    fn(_entries[i]);
+            }
+        }
+
         void dump() const noexcept;
 
+#ifdef FL_HAVE_SSE2
+        static constexpr size_t kGroupWidth = 16;   // Control bytes probed at once
+#else
+        static constexpr size_t kGroupWidth = 8;
+#endif
+
     protected:
+        static constexpr uint8_t kEmpty = 0x80;     // Control byte of an empty slot
+
         StringTable(size_t capacity,
-                    size_t initialSize, hash_t *initialHashes, entry_t *initialEntries);
+                    size_t initialSize, uint8_t *initialControl, entry_t *initialEntries);
         inline size_t wrap(size_t i) const              {return i & _sizeMask;}
         inline size_t indexOfHash(hash_t h) const       {return wrap(size_t(h));}
-        insertResult _insert(hash_t, entry_t) noexcept;
-        void _insertOnly(hash_t, entry_t) noexcept;
+        static inline uint8_t tagOfHash(hash_t h)       {return uint8_t(uint32_t(h) >> 25);}
+        inline void setControl(size_t i, uint8_t tag) noexcept;
+        size_t findEmpty(hash_t) const noexcept;
         void allocTable(size_t size);
         void grow();
-        void initTable(size_t size, hash_t *hashes, entry_t *entries);
+        void initTable(size_t size, uint8_t *control, entry_t *entries);
 
         size_t _size;           // Size of the arrays
         size_t _sizeMask;       // Used for quick modulo: (i & _sizeMask) == (i % _size)
         size_t _count {0};      // Number of entries
         size_t _capacity;       // Grow the table when it exceeds this count
-        ssize_t _maxDistance;   // Maximum distance of any entry from its ideal position
-        hash_t*  _hashes;       // Array of hash codes, zero meaning empty
-        entry_t* _entries;      // Array of keys/values, paralleling _hashes
+        uint8_t* _control;      // Control bytes; the first kGroupWidth are repeated at the end
+        entry_t* _entries;      // Array of keys/values, paralleling _control
         bool _allocated {false};// Was table allocated by allocTable?
     };
 
@@ -95,12 +118,15 @@ namespace fleece {
     template <size_t INITIAL_SIZE =32>
     class PreallocatedStringTable : public StringTable {
     public:
+        static_assert(INITIAL_SIZE >= kGroupWidth && (INITIAL_SIZE & (INITIAL_SIZE - 1)) == 0,
+                      "INITIAL_SIZE must be a power of 2, at least kGroupWidth");
+
         PreallocatedStringTable(size_t capacity =0)
-        :StringTable(capacity, INITIAL_SIZE, _initialHashes, _initialEntries)
+        :StringTable(capacity, INITIAL_SIZE, _initialControl, _initialEntries)
         { }
 
     private:
-        hash_t  _initialHashes[INITIAL_SIZE];
+        uint8_t _initialControl[INITIAL_SIZE + kGroupWidth];
         entry_t _initialEntries[INITIAL_SIZE];
     };
 
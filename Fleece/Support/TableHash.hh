@@ -0,0 +1,74 @@
+//
+// TableHash.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include <string.h>
+#if defined(_MSC_VER) && defined(_M_X64)
+    #include <intrin.h>
+#endif
+
+namespace fleece {
+
+    /** A hash function for in-memory hash tables like StringTable and ConcurrentMap.
+        Keys of up to 16 bytes -- most keys -- are hashed inline, with two loads (which may
+        overlap, like wyhash does) and one 64x64-bit multiplication; that's about a third faster
+        than calling `slice::hash`, which longer keys still do.
+        Its values aren't the same as `slice::hash`'s, and could change, so never store them. */
+    static inline uint32_t tableHash(slice s) noexcept FLPURE;
+
+
+    static inline uint32_t tableHash(slice s) noexcept {
+#if defined(__SIZEOF_INT128__) || (defined(_MSC_VER) && defined(_M_X64))
+        if (_usuallyTrue(s.size <= 16)) {
+            auto p = (const uint8_t*)s.buf;
+            auto read = [](const uint8_t *src, size_t n) {
+                uint64_t word = 0;
+                memcpy(&word, src, n);
+                return word;
+            };
+            uint64_t a, b;
+            if (s.size >= 8) {
+                a = read(p, 8);
+                b = read(p + s.size - 8, 8);
+            } else if (s.size >= 4) {
+                a = read(p, 4);
+                b = read(p + s.size - 4, 4);
+            } else if (s.size > 0) {
+                a = (uint64_t(p[0]) << 16) | (uint64_t(p[s.size >> 1]) << 8) | p[s.size - 1];
+                b = 0;
+            } else {
+                a = b = 0;
+            }
+            // The length in the multiplier keeps keys whose loads overlap from colliding:
+            a ^= 0xa0761d6478bd642f;
+            b ^= 0xe7037ed1a0b428db ^ s.size;
+    #ifdef __SIZEOF_INT128__
+            auto product = (unsigned __int128)a * b;
+            uint64_t lo = uint64_t(product), hi = uint64_t(product >> 64);
+    #else
+            uint64_t hi, lo = _umul128(a, b, &hi);
+    #endif
+            uint64_t h = lo ^ hi;
+            return uint32_t(h) ^ uint32_t(h >> 32);
+        }
+#endif
+        return s.hash();
+    }
+
+}
@@ -0,0 +1,46 @@
+//
+// Tracing.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "Tracing.hh"
+
+namespace fleece { namespace tracing {
+    using namespace std;
+
+    atomic<const Tracer*> sTracer {nullptr};
+
+
+    void setTracer(const Tracer *tracer) noexcept {
+        sTracer.store((tracer && tracer->begin && tracer->end) ? new Tracer(*tracer) : nullptr);
+    }
+
+
+    void Span::begin(const Tracer *tracer, const char *operation, size_t inputSize) noexcept {
+        _tracer = tracer;
+        _operation = operation;
+        _inputSize = inputSize;
+        tracer->begin(tracer->context, operation, inputSize);
+        _start = chrono::steady_clock::now();
+    }
+
+
+    void Span::end() noexcept {
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - _start;
+        _tracer->end(_tracer->context, _operation, _inputSize, _outputSize, elapsed.count());
+    }
+
+} }
@@ -0,0 +1,82 @@
+//
+// Tracing.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "PlatformCompat.hh"
+#include <atomic>
+#include <chrono>
+#include <stddef.h>
+
+namespace fleece { namespace tracing {
+
+    /** Callbacks invoked around long-running operations; the same layout as FLTracer. */
+    struct Tracer {
+        void (*begin)(void *context, const char *operation, size_t inputSize);
+        void (*end)(void *context, const char *operation, size_t inputSize, size_t outputSize,
+                    double seconds);
+        void *context;
+        size_t minInputSize;        // Operations on less input than this aren't traced
+    };
+
+    extern std::atomic<const Tracer*> sTracer;
+
+    /** Sets or (given null) clears the tracer. A copy is made; copies of earlier tracers are
+        never freed, since spans in progress on other threads may still be using them. */
+    void setTracer(const Tracer*) noexcept;
+
+    /** True if a tracer is set. Use this to skip computing an expensive input size. */
+    static inline bool enabled() noexcept {
+        return sTracer.load(std::memory_order_relaxed) != nullptr;
+    }
+
+
+    /** Traces the operation running during its lifetime, if a tracer is set and the input is
+        large enough; otherwise it costs one relaxed load. `operation` must be a string literal. */
+    class Span {
+    public:
+        Span(const char *operation, size_t inputSize) noexcept {
+            if (auto tracer = sTracer.load(std::memory_order_relaxed);
+                    _usuallyFalse(tracer != nullptr) && inputSize >= tracer->minInputSize)
+                begin(tracer, operation, inputSize);
+        }
+
+        ~Span() {
+            if (_usuallyFalse(_tracer != nullptr))
+                end();
+        }
+
+        /** Records the size of the operation's result, to pass to the tracer's `end`. */
+        void setOutputSize(size_t size) noexcept            {_outputSize = size;}
+
+        explicit operator bool() const noexcept             {return _tracer != nullptr;}
+
+    private:
+        Span(const Span&) =delete;
+        Span& operator=(const Span&) =delete;
+
+        void begin(const Tracer*, const char *operation, size_t inputSize) noexcept;
+        void end() noexcept;
+
+        const Tracer*   _tracer {nullptr};
+        const char*     _operation;
+        size_t          _inputSize;
+        size_t          _outputSize {0};
+        std::chrono::steady_clock::time_point _start;
+    };
+
+} }
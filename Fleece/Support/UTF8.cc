@@ -0,0 +1,281 @@
+//
+// UTF8.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "UTF8.hh"
+#include "CPUFeatures.hh"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    // AVX2 isn't in the x86-64 baseline, so its functions are compiled for it separately and
+    // only called if the CPU supports it:
+    #include <immintrin.h>
+    #define FL_UTF8_AVX2 1
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+    #include <arm_neon.h>
+    #define FL_UTF8_NEON 1
+#endif
+
+namespace fleece {
+
+    // Returns a pointer to the first non-ASCII byte, or `end`.
+    static inline const uint8_t* skipASCII(const uint8_t *p, const uint8_t *end) noexcept {
+        for (; end - p >= 8; p += 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            if (word & 0x8080808080808080)
+                break;
+        }
+        while (p < end && *p < 0x80)
+            ++p;
+        return p;
+    }
+
+
+    static bool validateScalar(const uint8_t *p, const uint8_t *end) noexcept {
+        while ((p = skipASCII(p, end)) < end) {
+            // The allowed ranges of the bytes after each lead byte are in the Unicode
+            // Standard's table 3-7, "Well-Formed UTF-8 Byte Sequences":
+            uint8_t c = *p;
+            uint8_t lo = 0x80, hi = 0xBF;
+            ptrdiff_t n;
+            if (c >= 0xC2 && c <= 0xDF) {
+                n = 1;
+            } else if (c >= 0xE0 && c <= 0xEF) {
+                n = 2;
+                if (c == 0xE0)       lo = 0xA0;         // overlong
+                else if (c == 0xED)  hi = 0x9F;         // surrogate
+            } else if (c >= 0xF0 && c <= 0xF4) {
+                n = 3;
+                if (c == 0xF0)       lo = 0x90;         // overlong
+                else if (c == 0xF4)  hi = 0x8F;         // above U+10FFFF
+            } else {
+                return false;
+            }
+            if (end - p <= n || p[1] < lo || p[1] > hi)
+                return false;
+            for (ptrdiff_t i = 2; i <= n; ++i) {
+                if ((p[i] & 0xC0) != 0x80)
+                    return false;
+            }
+            p += n + 1;
+        }
+        return true;
+    }
+
+
+    // The lookup-table method: each error is detectable from the high nybble of one byte and
+    // both nybbles of the byte before it, so three table lookups, ANDed together, find every
+    // error but one: a 3- or 4-byte sequence with too few or too many continuation bytes. That's
+    // found separately, by comparing where continuations must be with where they are.
+    enum : uint8_t {
+        kTooShort     = 1 << 0,     // 11______ 0_______  or  11______ 11______
+        kTooLong      = 1 << 1,     // 0_______ 10______
+        kOverlong3    = 1 << 2,     // 11100000 100_____
+        kTooLarge     = 1 << 3,     // 11110100 1001____ etc.
+        kSurrogate    = 1 << 4,     // 11101101 101_____
+        kOverlong2    = 1 << 5,     // 1100000_ 10______
+        kTooLarge1000 = 1 << 6,     // 11110101 1000____ etc.
+        kOverlong4    = 1 << 6,     // 11110000 1000____
+        kTwoConts     = 1 << 7,     // 10______ 10______
+        kCarry        = kTooShort | kTooLong | kTwoConts,
+    };
+
+    // Indexed by the high nybble of the previous byte:
+    static constexpr uint8_t kByte1High[16] = {
+        kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+        kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+        kTooShort | kOverlong2,
+        kTooShort,
+        kTooShort | kOverlong3 | kSurrogate,
+        kTooShort | kTooLarge | kTooLarge1000 | kOverlong4
+    };
+
+    // Indexed by the low nybble of the previous byte:
+    static constexpr uint8_t kByte1Low[16] = {
+        kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+        kCarry | kOverlong2,
+        kCarry,
+        kCarry,
+        kCarry | kTooLarge,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+        kCarry | kTooLarge | kTooLarge1000,
+        kCarry | kTooLarge | kTooLarge1000
+    };
+
+    // Indexed by the high nybble of the current byte:
+    static constexpr uint8_t kByte2High[16] = {
+        kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+        kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+        kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+        kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+        kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+        kTooShort, kTooShort, kTooShort, kTooShort
+    };
+
+    // The minimum values of the last 3 bytes of a block that start a sequence it doesn't
+    // finish, less one:
+    static constexpr uint8_t kIncomplete[3] = {0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+
+
+#if FL_UTF8_AVX2
+    #define FL_AVX2 __attribute__((target("avx2")))
+
+    FL_AVX2 static inline __m256i table16(const uint8_t table[16]) noexcept {
+        return _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table));
+    }
+
+    FL_AVX2 static inline __m256i highNybbles(__m256i v) noexcept {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    }
+
+    // The input shifted later by N bytes, with the last N bytes of the previous input before it.
+    template <int N>
+    FL_AVX2 static inline __m256i prevBytes(__m256i input, __m256i prev) noexcept {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+    }
+
+    struct AVX2Validator {
+        __m256i byte1High, byte1Low, byte2High, incompleteMax;
+        __m256i error, prev, prevIncomplete;
+
+        FL_AVX2 AVX2Validator() noexcept {
+            byte1High = table16(kByte1High);
+            byte1Low = table16(kByte1Low);
+            byte2High = table16(kByte2High);
+            uint8_t maxValues[32];
+            memset(maxValues, 0xFF, 29);
+            memcpy(&maxValues[29], kIncomplete, 3);
+            incompleteMax = _mm256_loadu_si256((const __m256i*)maxValues);
+            error = prev = prevIncomplete = _mm256_setzero_si256();
+        }
+
+        FL_AVX2 void check(const uint8_t *block) noexcept {
+            __m256i input = _mm256_loadu_si256((const __m256i*)block);
+            if (_mm256_movemask_epi8(input) == 0) {
+                // All ASCII, so it's only an error if the previous block ended mid-sequence:
+                error = _mm256_or_si256(error, prevIncomplete);
+            } else {
+                __m256i prev1 = prevBytes<1>(input, prev);
+                __m256i special = _mm256_and_si256(
+                            _mm256_and_si256(_mm256_shuffle_epi8(byte1High, highNybbles(prev1)),
+                                             _mm256_shuffle_epi8(byte1Low, _mm256_and_si256(
+                                                                prev1, _mm256_set1_epi8(0x0F)))),
+                            _mm256_shuffle_epi8(byte2High, highNybbles(input)));
+                // Bytes 2 or 3 after a 3- or 4-byte lead byte must be continuations (which
+                // `special` has marked with kTwoConts), and no others:
+                __m256i third = _mm256_subs_epu8(prevBytes<2>(input, prev),
+                                                 _mm256_set1_epi8(char(0xE0 - 0x80)));
+                __m256i fourth = _mm256_subs_epu8(prevBytes<3>(input, prev),
+                                                  _mm256_set1_epi8(char(0xF0 - 0x80)));
+                __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                                  _mm256_set1_epi8(char(0x80)));
+                error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+                prevIncomplete = _mm256_subs_epu8(input, incompleteMax);
+            }
+            prev = input;
+        }
+
+        FL_AVX2 bool finish() noexcept {
+            error = _mm256_or_si256(error, prevIncomplete);
+            return _mm256_testz_si256(error, error);
+        }
+    };
+
+    FL_AVX2 static bool validateAVX2(const uint8_t *p, const uint8_t *end) noexcept {
+        AVX2Validator v;
+        for (; end - p >= 32; p += 32)
+            v.check(p);
+        // Pad the remainder with zeroes; a sequence cut off by them is an error too:
+        uint8_t last[32] = { };
+        memcpy(last, p, end - p);
+        v.check(last);
+        return v.finish();
+    }
+
+    static bool haveSIMD() noexcept {return cpu::has(cpu::kAVX2);}
+
+    static inline bool validateSIMD(const uint8_t *p, const uint8_t *end) noexcept {
+        return validateAVX2(p, end);
+    }
+
+    #undef FL_AVX2
+
+#elif FL_UTF8_NEON
+    static bool validateSIMD(const uint8_t *p, const uint8_t *end) noexcept {
+        const uint8x16_t byte1High = vld1q_u8(kByte1High), byte1Low = vld1q_u8(kByte1Low),
+                         byte2High = vld1q_u8(kByte2High);
+        uint8_t maxValues[16];
+        memset(maxValues, 0xFF, 13);
+        memcpy(&maxValues[13], kIncomplete, 3);
+        const uint8x16_t incompleteMax = vld1q_u8(maxValues);
+        uint8x16_t error = vdupq_n_u8(0), prev = error, prevIncomplete = error;
+
+        auto checkBlock = [&](const uint8_t *block) {
+            uint8x16_t input = vld1q_u8(block);
+            if (vmaxvq_u8(input) < 0x80) {
+                error = vorrq_u8(error, prevIncomplete);
+            } else {
+                uint8x16_t prev1 = vextq_u8(prev, input, 15);
+                uint8x16_t special = vandq_u8(
+                            vandq_u8(vqtbl1q_u8(byte1High, vshrq_n_u8(prev1, 4)),
+                                     vqtbl1q_u8(byte1Low, vandq_u8(prev1, vdupq_n_u8(0x0F)))),
+                            vqtbl1q_u8(byte2High, vshrq_n_u8(input, 4)));
+                uint8x16_t third = vqsubq_u8(vextq_u8(prev, input, 14), vdupq_n_u8(0xE0 - 0x80));
+                uint8x16_t fourth = vqsubq_u8(vextq_u8(prev, input, 13), vdupq_n_u8(0xF0 - 0x80));
+                uint8x16_t must23 = vandq_u8(vorrq_u8(third, fourth), vdupq_n_u8(0x80));
+                error = vorrq_u8(error, veorq_u8(must23, special));
+                prevIncomplete = vqsubq_u8(input, incompleteMax);
+            }
+            prev = input;
+        };
+
+        for (; end - p >= 16; p += 16)
+            checkBlock(p);
+        uint8_t last[16] = { };
+        memcpy(last, p, end - p);
+        checkBlock(last);
+        error = vorrq_u8(error, prevIncomplete);
+        return vmaxvq_u8(error) == 0;
+    }
+
+    static bool haveSIMD() noexcept {return cpu::has(cpu::kNEON);}
+#endif
+
+
+    bool isValidUTF8(slice s) noexcept {
+        auto p = (const uint8_t*)s.buf, end = p + s.size;
+        p = skipASCII(p, end);
+        if (p == end)
+            return true;
+#if FL_UTF8_AVX2 || FL_UTF8_NEON
+        // (Short non-ASCII strings aren't worth setting up the vector code for.)
+        if (end - p >= 32 && haveSIMD())
+            return validateSIMD(p, end);
+#endif
+        return validateScalar(p, end);
+    }
+
+}
@@ -0,0 +1,31 @@
+//
+// UTF8.hh
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+
+namespace fleece {
+
+    /** Returns true if the data is valid UTF-8: no invalid or truncated sequences, overlong
+        encodings, surrogates, or code points above U+10FFFF. ASCII is skipped 8 bytes at a time;
+        the rest is checked 32 bytes at a time with AVX2 on x86 (if the CPU has it) or 16 with
+        NEON on ARM, using the lookup-table method of Keiser & Lemire, "Validating UTF-8 in less
+        than one instruction per byte". */
+    bool isValidUTF8(slice) noexcept;
+
+}
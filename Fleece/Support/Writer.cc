@@ -17,16 +17,90 @@
 //
 
 #include "Writer.hh"
+#include "Allocator.hh"
+#include "Base64.hh"
 #include "PlatformCompat.hh"
 #include "FleeceException.hh"
-#include "decode.h"
-#include "encode.h"
 #include <algorithm>
+#include <climits>
+#include <errno.h>
 #include "betterassert.hh"
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
 
 namespace fleece {
 
+    // A heap chunk is prefixed by its capacity, since the slice in `_chunks` is shrunk to the
+    // used size once the chunk is full.
+    static constexpr size_t kChunkHeaderSize = 16;
+
+    // Freed chunks at least this big go into the thread's pool, within these limits:
+    static constexpr size_t kMinPooledChunkSize = 4096;
+    static constexpr size_t kMaxPooledChunks = 8;
+    static constexpr size_t kMaxPooledBytes = 4 * Writer::kMaxChunkSize;
+
+    namespace {
+        struct PooledChunk {
+            void*  block;
+            size_t capacity;
+        };
+
+        // The per-thread pool of freed chunks. It's plain data, so it's still usable while other
+        // thread-local objects (like pooled Encoders) are destructed; `tChunkPoolReleaser` frees
+        // the chunks when the thread exits, and closes the pool.
+        thread_local PooledChunk tPooledChunks[kMaxPooledChunks];
+        thread_local size_t tPooledCount = 0, tPooledBytes = 0;
+        thread_local bool tPoolClosed = false;
+
+        struct ChunkPoolReleaser {
+            ~ChunkPoolReleaser() {
+                tPoolClosed = true;
+                for (size_t i = 0; i < tPooledCount; ++i)
+                    heap::free(tPooledChunks[i].block);
+                tPooledCount = tPooledBytes = 0;
+            }
+        };
+        thread_local ChunkPoolReleaser tChunkPoolReleaser;
+    }
+
+
+    // Returns the smallest pooled chunk that can hold `minCapacity` but isn't more than twice
+    // that, or nullptr.
+    static void* takePooledChunk(size_t minCapacity, size_t &capacity) {
+        size_t best = kMaxPooledChunks;
+        for (size_t i = 0; i < tPooledCount; ++i) {
+            size_t c = tPooledChunks[i].capacity;
+            if (c >= minCapacity && c <= 2 * minCapacity
+                    && (best == kMaxPooledChunks || c < tPooledChunks[best].capacity))
+                best = i;
+        }
+        if (best == kMaxPooledChunks)
+            return nullptr;
+        void *block = tPooledChunks[best].block;
+        capacity = tPooledChunks[best].capacity;
+        tPooledBytes -= capacity;
+        tPooledChunks[best] = tPooledChunks[--tPooledCount];
+        return block;
+    }
+
+
+    static bool poolChunk(void *block, size_t capacity) {
+        if (capacity < kMinPooledChunkSize || tPoolClosed || tPooledCount >= kMaxPooledChunks
+                || tPooledBytes + capacity > kMaxPooledBytes)
+            return false;
+        (void)&tChunkPoolReleaser;      // makes sure the pool gets cleaned up at thread exit
+        tPooledChunks[tPooledCount++] = {block, capacity};
+        tPooledBytes += capacity;
+        return true;
+    }
+
+
     Writer::Writer(size_t initialCapacity)
     :_chunkSize(initialCapacity)
     ,_outputFile(nullptr)
@@ -43,12 +117,35 @@ namespace fleece {
     }
 
 
+    Writer::Writer(OutputSink sink, size_t bufferSize)
+    :Writer(bufferSize)
+    {
+        assert_precondition(sink);
+        _sink = move(sink);
+    }
+
+
+    Writer::Writer(slice buffer, GrowBufferCallback grow)
+    :_chunkSize(buffer.size)
+    ,_outputFile(nullptr)
+    ,_externalBuffer(true)
+    ,_growBuffer(move(grow))
+    {
+        _available = _chunks.emplace_back(buffer);
+        _length = _available.size;
+    }
+
+
     Writer::Writer(Writer&& w) noexcept
     :_available(std::move(w._available))
     ,_chunks(std::move(w._chunks))
     ,_chunkSize(w._chunkSize)
     ,_length(w._length)
     ,_outputFile(w._outputFile)
+    ,_retainCapacity(w._retainCapacity)
+    ,_externalBuffer(w._externalBuffer)
+    ,_growBuffer(move(w._growBuffer))
+    ,_sink(move(w._sink))
     {
         migrateInitialBuf(w);
         memcpy(_initialBuf, w._initialBuf, sizeof(_initialBuf));
@@ -57,8 +154,11 @@ namespace fleece {
 
 
     Writer::~Writer() {
-        if (_outputFile)
-            flush();
+        if (isStreaming()) {
+            try {
+                flush();
+            } catch (...) { }   // destructors mustn't throw; the error was likely reported already
+        }
         for (auto &chunk : _chunks)
             freeChunk(chunk);
     }
@@ -70,6 +170,10 @@ namespace fleece {
         _chunks = std::move(w._chunks);
         migrateInitialBuf(w);
         _outputFile = w._outputFile;
+        _retainCapacity = w._retainCapacity;
+        _externalBuffer = w._externalBuffer;
+        _growBuffer = move(w._growBuffer);
+        _sink = move(w._sink);
         memcpy(_initialBuf, w._initialBuf, sizeof(_initialBuf));
         w._outputFile = nullptr;
         return *this;
@@ -77,11 +181,21 @@ namespace fleece {
 
 
     void Writer::_reset() {
-        if (_outputFile)
+        if (isStreaming())
             return;
 
         size_t nChunks = _chunks.size();
-        if (nChunks > 1) {
+        if (nChunks > 1 && _retainCapacity) {
+            // Replace all the chunks with one that's big enough to hold them:
+            size_t capacity = 0;
+            for (auto &chunk : _chunks) {
+                capacity += chunk.size;
+                freeChunk(chunk);
+            }
+            _chunks.clear();
+            _available = nullslice;
+            addChunk(capacity);
+        } else if (nChunks > 1) {
             for (size_t i = 0; i < nChunks-1; i++)
                 freeChunk(_chunks[i]);
             _chunks.erase(_chunks.begin(), _chunks.end() - 1);
@@ -89,7 +203,8 @@ namespace fleece {
         _available = _chunks[0];
 #if DEBUG
         // We will reuse the buffer, but it's invalid so fill it with garbage for troubleshooting:
-        memset((void*)_available.buf, 0xdd, _available.size);
+        if (!_externalBuffer)   // (finishInPlace's output must stay valid)
+            memset((void*)_available.buf, 0xdd, _available.size);
 #endif
     }
 
@@ -102,7 +217,7 @@ namespace fleece {
 
 #if DEBUG
     void Writer::assertLengthCorrect() const {
-        if (!_outputFile) {
+        if (!isStreaming()) {
             size_t len = 0;
             forEachChunk([&](slice chunk) {
                 len += chunk.size;
@@ -131,7 +246,9 @@ namespace fleece {
 
     void* Writer::writeToNewChunk(const void* dataOrNull, size_t length) {
         // If we got here, a call to `write` or `reserveSpace` would not fit in the current chunk
-        if (_outputFile) {
+        if (_externalBuffer) {
+            growExternalBuffer(length);
+        } else if (isStreaming()) {
             flush();
             if (length > _chunkSize) {
                 freeChunk(_chunks.back());
@@ -142,9 +259,10 @@ namespace fleece {
             _available = _chunks[0];
             _length += _available.size;
         } else {
-            if (_usuallyTrue(_chunkSize <= 64*1024))
-                _chunkSize *= 2;
+            size_t maxChunkSize = heap::hugePageThreshold() ? kMaxHugeChunkSize : kMaxChunkSize;
+            _chunkSize = std::min(2 * _chunkSize, maxChunkSize);
             addChunk(std::max(length, _chunkSize));
+            _chunkSize = std::max(_chunkSize, std::min(_available.size, maxChunkSize));
         }
 
         // Now that we have room, write:
@@ -157,13 +275,15 @@ namespace fleece {
 
 
     void Writer::flush() {
-        if (!_outputFile)
+        if (!isStreaming())
             return;
         auto chunk = _chunks.back();
         size_t writtenLength = chunk.size - _available.size;
         if (writtenLength > 0) {
             _length -= _available.size;
-            if (fwrite(chunk.buf, 1, writtenLength, _outputFile) < writtenLength)
+            if (_sink)
+                _sink(slice(chunk.buf, writtenLength));
+            else if (fwrite(chunk.buf, 1, writtenLength, _outputFile) < writtenLength)
                 FleeceException::_throwErrno("Writer can't write to file");
             _available = chunk;
             _length += _available.size;
@@ -172,6 +292,29 @@ namespace fleece {
     }
 
 
+    void Writer::growExternalBuffer(size_t length) {
+        slice buffer = _chunks[0];
+        size_t used = buffer.size - _available.size;
+        slice newBuffer;
+        if (_growBuffer)
+            newBuffer = _growBuffer(buffer, used, used + length);
+        if (!newBuffer.buf || newBuffer.size < used + length)
+            FleeceException::_throw(MemoryError, "Writer's external buffer is full");
+        _chunks[0] = newBuffer;
+        _available = slice(offsetby(newBuffer.buf, used), newBuffer.size - used);
+        _length = newBuffer.size;
+        _chunkSize = newBuffer.size;
+    }
+
+
+    slice Writer::finishInPlace() {
+        assert_precondition(_externalBuffer);
+        slice output(_chunks[0].buf, length());
+        reset();
+        return output;
+    }
+
+
     void Writer::addChunk(size_t capacity) {
         _length -= _available.size;
         if (!_chunks.empty()) {
@@ -182,14 +325,30 @@ namespace fleece {
         if (_chunks.empty() && capacity <= kDefaultInitialCapacity)
             _available = _chunks.emplace_back(_initialBuf, sizeof(_initialBuf));
         else
-            _available = _chunks.emplace_back(slice::newBytes(capacity), capacity);
+            _available = _chunks.emplace_back(allocChunk(capacity));
         _length += _available.size;
     }
 
 
+    /*static*/ slice Writer::allocChunk(size_t capacity) {
+        void *block = takePooledChunk(capacity, capacity);
+        if (!block) {
+            block = heap::allocate(kChunkHeaderSize + capacity);
+            heap::adviseHugePages(block, kChunkHeaderSize + capacity);
+            memcpy(block, &capacity, sizeof(capacity));
+        }
+        return {offsetby(block, kChunkHeaderSize), capacity};
+    }
+
+
     void Writer::freeChunk(slice chunk) {
-        if (chunk.buf != &_initialBuf)
-            ::free((void*)chunk.buf);
+        if (chunk.buf == &_initialBuf || _externalBuffer)
+            return;
+        void *block = offsetby((void*)chunk.buf, -ptrdiff_t(kChunkHeaderSize));
+        size_t capacity;
+        memcpy(&capacity, block, sizeof(capacity));
+        if (!poolChunk(block, capacity))
+            heap::free(block);
     }
 
     void Writer::migrateInitialBuf(const Writer& other) {
@@ -233,7 +392,7 @@ namespace fleece {
 
 
     alloc_slice Writer::copyOutput() const {
-        assert(!_outputFile);
+        assert(!isStreaming());
         alloc_slice output(length());
         copyOutputTo((void*)output.buf);
         return output;
@@ -242,7 +401,7 @@ namespace fleece {
 
     alloc_slice Writer::finish() {
         alloc_slice output;
-        if (_outputFile) {
+        if (isStreaming()) {
             flush();
         } else {
             output = copyOutput();
@@ -254,10 +413,10 @@ namespace fleece {
 
 
     bool Writer::writeOutputToFile(FILE *f) {
-        assert_precondition(!_outputFile);
+        assert_precondition(!isStreaming());
         bool result = true;
         forEachChunk([&](slice chunk) {
-            if (result && fwrite(chunk.buf, chunk.size, 1, f) < chunk.size)
+            if (result && fwrite(chunk.buf, 1, chunk.size, f) < chunk.size)
                 result = false;
         });
         if (result) {
@@ -269,34 +428,73 @@ namespace fleece {
     }
 
 
+    bool Writer::writeOutputToFD(int fd) {
+        assert_precondition(!isStreaming());
+        std::vector<slice> chunks = output();
+        size_t i = 0, skip = 0;         // Current chunk, and the bytes of it already written
+#ifdef _WIN32
+        for (; i < chunks.size(); ++i) {
+            for (size_t pos = 0; pos < chunks[i].size; ) {
+                auto n = _write(fd, offsetby(chunks[i].buf, pos),
+                                unsigned(std::min(chunks[i].size - pos, size_t(INT_MAX))));
+                if (n < 0)
+                    return false;
+                pos += n;
+            }
+        }
+#else
+        static constexpr size_t kMaxIOVs = 16;      // the smallest IOV_MAX POSIX allows
+        while (i < chunks.size()) {
+            iovec iov[kMaxIOVs];
+            int n = 0;
+            for (size_t j = i; j < chunks.size() && n < int(kMaxIOVs); ++j, ++n) {
+                size_t start = (j == i) ? skip : 0;
+                iov[n].iov_base = (void*)offsetby(chunks[j].buf, start);
+                iov[n].iov_len = chunks[j].size - start;
+            }
+            ssize_t written = ::writev(fd, iov, n);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            // Skip past what was written; it may have been only part of it:
+            for (size_t left = size_t(written); i < chunks.size(); ++i, skip = 0) {
+                if (chunks[i].size - skip > left) {
+                    skip += left;
+                    break;
+                }
+                left -= chunks[i].size - skip;
+            }
+        }
+#endif
+        auto len = length();
+        _reset();       // don't reset _length, so offsets remain consistent after
+        _length = len - _available.size;
+        return true;
+    }
+
+
 #pragma mark - BASE64:
 
 
     void Writer::writeBase64(slice data) {
-        size_t base64size = ((data.size + 2) / 3) * 4;
-        char *dst;
-        if (_outputFile)
-            dst = (char*)slice::newBytes(base64size);
-        else
-            dst = (char*)reserveSpace(base64size);
-        base64::encoder enc;
-        enc.set_chars_per_line(0);
-        size_t written = enc.encode(data.buf, data.size, dst);
-        written += enc.encode_end(dst + written);
-        if (_outputFile) {
-            write(dst, written);
+        size_t base64size = base64::encodedSize(data.size);
+        if (isStreaming()) {
+            char *dst = (char*)slice::newBytes(base64size);
+            base64::encode(data, dst);
+            write(dst, base64size);
             free(dst);
+        } else {
+            base64::encode(data, reserveSpace(base64size));
         }
-        assert_postcondition((size_t)written == base64size);
-        (void)written;      // suppresses 'unused value' warning in release builds
     }
 
 
     void Writer::writeDecodedBase64(slice base64) {
-        base64::decoder dec;
         std::vector<char> buf((base64.size + 3) / 4 * 3);
-        size_t len = dec.decode(base64.buf, base64.size, buf.data());
-        write(buf.data(), len);
+        slice decoded = base64::decode(base64, buf.data(), buf.size());
+        write(decoded.buf, decoded.size);
     }
 
 }
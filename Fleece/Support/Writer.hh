@@ -20,6 +20,7 @@
 
 #include "fleece/slice.hh"
 #include "SmallVector.hh"
+#include <functional>
 #include <stdio.h>
 #include <vector>
 #include "betterassert.hh"
@@ -32,6 +33,12 @@ namespace fleece {
     public:
         static constexpr size_t kDefaultInitialCapacity = 256;
 
+        /// Chunks grow geometrically (each twice the size of the last) up to this size.
+        static constexpr size_t kMaxChunkSize = 1024 * 1024;
+        /// The chunk size limit while huge pages are enabled (see heap::hugePageThreshold),
+        /// so chunks can contain some.
+        static constexpr size_t kMaxHugeChunkSize = 8 * 1024 * 1024;
+
         explicit Writer(size_t initialCapacity =kDefaultInitialCapacity);
         ~Writer();
 
@@ -96,7 +103,7 @@ namespace fleece {
         /// Invokes the callback for each range of bytes in the output.
         template <class T>
         void forEachChunk(T callback) const {
-            assert_precondition(!_outputFile);
+            assert_precondition(!isStreaming());
             auto n = _chunks.size();
             for (auto chunk : _chunks) {
                 if (_usuallyFalse(--n == 0)) {
@@ -111,11 +118,21 @@ namespace fleece {
         /// Writes the output to a file. (Must not already be writing to a file.)
         bool writeOutputToFile(FILE *);
 
+        /// Writes the output to a file descriptor, such as a socket, handing all the chunks to
+        /// the OS at once with `writev` instead of copying them together. Like
+        /// `writeOutputToFile`, it then discards the output but keeps counting the length.
+        /// Returns false, with `errno` set, if a write fails.
+        bool writeOutputToFD(int fd);
+
         //-------- Finishing:
 
         /// Clears the Writer, discarding the data written. It can then be reused.
         void reset();
 
+        /// If true, `reset` replaces multiple chunks with a single one big enough to hold them
+        /// all, so that writing the same amount of data again won't allocate. (Default false.)
+        void retainCapacity(bool retain)        {_retainCapacity = retain;}
+
         /// Returns a copy of the data written, and resets.
         alloc_slice finish();
 
@@ -147,15 +164,55 @@ namespace fleece {
         /// The output file, or NULL.
         FILE* outputFile() const                {return _outputFile;}
 
-        /// If writing to a file, flushes to disk. Otherwise a no-op.
+        /// If writing to a file or sink, flushes to it. Otherwise a no-op.
         void flush();
 
+        //-------- Writing To A Sink:
+
+        /// Receives output from a streaming Writer, in order. It may throw to abort writing.
+        using OutputSink = std::function<void(slice data)>;
+
+        /// Constructs a Writer that passes its output to a sink, such as a socket or a file
+        /// descriptor, whenever `bufferSize` bytes have accumulated, and when flushed.
+        /// It has the same restrictions as a Writer that writes to a file.
+        explicit Writer(OutputSink sink, size_t bufferSize =kDefaultSinkBufferSize);
+
+        static constexpr size_t kDefaultSinkBufferSize = 64 * 1024;
+
+        /// True if the output goes to a file or sink rather than staying in memory.
+        bool isStreaming() const                {return _outputFile || _sink;}
+
+        //-------- Writing Directly To External Memory:
+
+        /// Called when an external buffer is full. It's given the buffer and the number of bytes
+        /// written to it, and must return a buffer of at least `minSize` bytes that starts with
+        /// those same bytes, e.g. by remapping a file or reallocating. (It may return the same
+        /// address.) Returning a null slice makes the write fail with a MemoryError.
+        using GrowBufferCallback = std::function<slice(slice buffer, size_t used, size_t minSize)>;
+
+        /// Constructs a Writer that writes into caller-provided memory, such as a region of a
+        /// page or an mmapped file, so the output ends up in its final location without copying.
+        /// * The output is always contiguous, starting at `buffer.buf`.
+        /// * If `grow` is null, writing past the end of the buffer throws a MemoryError.
+        /// * `finishInPlace` returns the output in place; `finish` still returns a copy.
+        /// * `reset` starts writing at the beginning of the (possibly grown) buffer again.
+        Writer(slice buffer, GrowBufferCallback grow);
+
+        /// True if writing to a caller-provided buffer.
+        bool hasExternalBuffer() const          {return _externalBuffer;}
+
+        /// Returns the data written, in place in the external buffer, and resets. The data stays
+        /// valid until the Writer writes to the buffer again.
+        slice finishInPlace();
+
 
     private:
         void _reset();
         void* _write(const void* dataOrNull, size_t length);
         void* writeToNewChunk(const void* dataOrNull, size_t length);
         void addChunk(size_t capacity);
+        void growExternalBuffer(size_t length);
+        static slice allocChunk(size_t capacity);
         void freeChunk(slice);
         void migrateInitialBuf(const Writer& other);
 
@@ -172,7 +229,9 @@ namespace fleece {
            The output is stored in a vector of "chunks", each a slice.
            The first chunk usually points to `_initialBuf`, if the `initialCapacity` permits;
            This avoids a `malloc` in the common case of writing short output (256 bytes or less.)
-           All subsequent chunks are heap-allocated, each twice as big as the last.
+           All subsequent chunks are heap-allocated, each twice as big as the last, up to
+           kMaxChunkSize. When freed, big chunks go into a small per-thread pool, so the next
+           Writer on the same thread can reuse them instead of allocating.
 
            The last chunk is usually partially empty. `_available` points to its empty space,
            so `_available.buf` is the first free byte, and `_available.size` is the free size.
@@ -190,6 +249,10 @@ namespace fleece {
         size_t _chunkSize;              // Size of next chunk to allocate
         size_t _length {0};             // Output length, offset by _available.size
         FILE* _outputFile;              // File writing to, or NULL
+        bool _retainCapacity {false};   // Should reset merge chunks instead of freeing them?
+        bool _externalBuffer {false};   // Is the (single) chunk caller-provided memory?
+        GrowBufferCallback _growBuffer; // Enlarges the external buffer
+        OutputSink _sink;               // Sink writing to, or null
         uint8_t _initialBuf[kDefaultInitialCapacity];   // Inline buffer to avoid a malloc
     };
 
@@ -20,13 +20,18 @@
 
 #if FL_HAVE_FILESYSTEM
 
+#include "Allocator.hh"
 #include "FleeceException.hh"
 #include "PlatformCompat.hh"
 #include "NumConversion.hh"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fcntl.h>
 #include <errno.h>
 
 #ifndef _MSC_VER
+    #include <sys/mman.h>
     #include <sys/stat.h>
     #include <unistd.h>
     #define _open open
@@ -80,6 +85,245 @@ namespace fleece {
         writeToFile(s, path, O_CREAT | O_APPEND);
     }
 
+
+    MappedFile::MappedFile(const char *path) {
+#ifndef _MSC_VER
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+            FleeceException::_throwErrno("Can't open file %s", path);
+        struct stat stat;
+        if (fstat(fd, &stat) < 0) {
+            ::close(fd);
+            FleeceException::_throwErrno("Can't stat file %s", path);
+        }
+        if (uint64_t(stat.st_size) > SIZE_MAX) {
+            ::close(fd);
+            throw std::logic_error("File too big for address space");
+        }
+        auto size = size_t(stat.st_size);
+        if (size > 0) {
+            void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                FleeceException::_throwErrno("Can't memory-map file %s", path);
+            }
+            _contents = slice(mapping, size);
+            // Fleece data is traversed by following pointers, starting from the root at the end,
+            // so read-ahead mostly loads pages that won't be used. But the root's page is needed:
+    #ifdef MADV_RANDOM
+            ::madvise(mapping, size, MADV_RANDOM);
+    #endif
+    #ifdef MADV_WILLNEED
+            long pageSize = ::sysconf(_SC_PAGESIZE);
+            size_t lastPage = size - 1 - (size - 1) % size_t(pageSize);
+            ::madvise((uint8_t*)mapping + lastPage, size - lastPage, MADV_WILLNEED);
+    #endif
+            // A big file is read at random, so huge pages save many TLB misses, if the kernel
+            // supports them for files:
+            heap::adviseHugePages(mapping, size);
+        }
+        ::close(fd);                        // the mapping stays valid after the fd is closed
+#else
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_FLAG_RANDOM_ACCESS, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            FleeceException::_throw(POSIXError, "Can't open file %s", path);
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) {
+            CloseHandle(file);
+            FleeceException::_throw(POSIXError, "Can't get size of file %s", path);
+        }
+        if (uint64_t(size.QuadPart) > SIZE_MAX) {
+            CloseHandle(file);
+            throw std::logic_error("File too big for address space");
+        }
+        if (size.QuadPart > 0) {
+            _mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            const void *view = _mapping ? MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0)
+                                        : nullptr;
+            if (!view) {
+                if (_mapping)
+                    CloseHandle(_mapping);
+                CloseHandle(file);
+                FleeceException::_throw(POSIXError, "Can't memory-map file %s", path);
+            }
+            _contents = slice(view, size_t(size.QuadPart));
+        }
+        CloseHandle(file);                  // the mapping stays valid after the file is closed
+#endif
+    }
+
+
+    void MappedFile::prefetch(slice range) const noexcept {
+        auto start = std::max((const uint8_t*)range.buf, (const uint8_t*)_contents.buf);
+        auto end   = std::min((const uint8_t*)range.end(), (const uint8_t*)_contents.end());
+        if (start >= end)
+            return;
+#ifndef _MSC_VER
+    #ifdef MADV_WILLNEED
+        // madvise requires a page-aligned address; the mapping itself is page-aligned.
+        size_t pageSize = size_t(::sysconf(_SC_PAGESIZE));
+        auto base = (const uint8_t*)(_region ? _region.buf : _contents.buf);
+        start -= (start - base) % pageSize;
+        ::madvise((void*)start, end - start, MADV_WILLNEED);
+    #endif
+#elif _WIN32_WINNT >= 0x0602 // (Windows 8)
+        WIN32_MEMORY_RANGE_ENTRY entry = {(void*)start, size_t(end - start)};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &entry, 0);
+#endif
+    }
+
+
+    MappedFile::~MappedFile() {
+        slice region = _region ? _region : _contents;
+        if (!region)
+            return;
+#ifndef _MSC_VER
+        ::munmap((void*)region.buf, region.size);
+#else
+        UnmapViewOfFile(region.buf);
+        CloseHandle(_mapping);
+#endif
+    }
+
+
+#pragma mark - SHARED MEMORY:
+
+
+    // A shared-memory segment starts with this header, since the segment's size may be rounded
+    // up to a whole number of pages. The magic number is written last, so a segment that's still
+    // being filled in can't be opened.
+    struct SharedMemoryHeader {
+        char     magic[8];
+        uint64_t size;                      // Size of the contents following the header
+    };
+
+    static constexpr char kSharedMemoryMagic[8] = {'F','l','e','e','c','e','S','M'};
+
+
+    std::unique_ptr<MappedFile> MappedFile::createSharedMemory(const char *name, slice contents,
+                                                               unsigned mode)
+    {
+        size_t size = sizeof(SharedMemoryHeader) + contents.size;
+        std::unique_ptr<MappedFile> mapped(new MappedFile);
+#ifndef _MSC_VER
+        ::shm_unlink(name);                 // Replace any existing segment
+        int fd = ::shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode_t(mode));
+        if (fd < 0)
+            FleeceException::_throwErrno("Can't create shared memory %s", name);
+        void *mapping = MAP_FAILED;
+        if (::ftruncate(fd, off_t(size)) == 0)
+            mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            int err = errno;
+            ::shm_unlink(name);
+            errno = err;
+            FleeceException::_throwErrno("Can't map shared memory %s", name);
+        }
+#else
+        (void)mode;
+        mapped->_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                              DWORD(uint64_t(size) >> 32), DWORD(size), name);
+        void *mapping = mapped->_mapping ? MapViewOfFile(mapped->_mapping, FILE_MAP_WRITE, 0, 0, 0)
+                                         : nullptr;
+        if (!mapping)
+            FleeceException::_throw(POSIXError, "Can't create shared memory %s", name);
+#endif
+        auto header = (SharedMemoryHeader*)mapping;
+        if (contents.size > 0)
+            memcpy(header + 1, contents.buf, contents.size);
+        header->size = contents.size;
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, kSharedMemoryMagic, sizeof(header->magic));
+#ifndef _MSC_VER
+        ::mprotect(mapping, size, PROT_READ);
+#endif
+        mapped->_region = slice(mapping, size);
+        mapped->_contents = slice(header + 1, contents.size);
+        return mapped;
+    }
+
+
+    std::unique_ptr<MappedFile> MappedFile::openSharedMemory(const char *name) {
+        std::unique_ptr<MappedFile> mapped(new MappedFile);
+#ifndef _MSC_VER
+        int fd = ::shm_open(name, O_RDONLY, 0);
+        if (fd < 0)
+            FleeceException::_throwErrno("Can't open shared memory %s", name);
+        struct stat stat;
+        if (fstat(fd, &stat) < 0) {
+            ::close(fd);
+            FleeceException::_throwErrno("Can't stat shared memory %s", name);
+        }
+        auto size = size_t(stat.st_size);
+        void *mapping = MAP_FAILED;
+        if (size >= sizeof(SharedMemoryHeader))
+            mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED)
+            FleeceException::_throwErrno("Can't map shared memory %s", name);
+    #ifdef MADV_RANDOM
+        ::madvise(mapping, size, MADV_RANDOM);
+    #endif
+#else
+        mapped->_mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+        void *mapping = mapped->_mapping ? MapViewOfFile(mapped->_mapping, FILE_MAP_READ, 0, 0, 0)
+                                         : nullptr;
+        if (!mapping)
+            FleeceException::_throw(POSIXError, "Can't open shared memory %s", name);
+        MEMORY_BASIC_INFORMATION info;
+        size_t size = VirtualQuery(mapping, &info, sizeof(info)) ? info.RegionSize : 0;
+#endif
+        mapped->_region = slice(mapping, size);
+        auto header = (const SharedMemoryHeader*)mapping;
+        if (size < sizeof(SharedMemoryHeader)
+                || memcmp(header->magic, kSharedMemoryMagic, sizeof(header->magic)) != 0)
+            FleeceException::_throw(InvalidData, "Shared memory %s isn't a Fleece segment", name);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->size > size - sizeof(SharedMemoryHeader))
+            FleeceException::_throw(InvalidData, "Shared memory %s is truncated", name);
+        mapped->_contents = slice(header + 1, size_t(header->size));
+        return mapped;
+    }
+
+
+    bool MappedFile::removeSharedMemory(const char *name) {
+#ifndef _MSC_VER
+        return ::shm_unlink(name) == 0;
+#else
+        return true;
+#endif
+    }
+
+}
+
+#else // FL_HAVE_FILESYSTEM
+
+#include "FleeceException.hh"
+
+namespace fleece {
+
+    MappedFile::MappedFile(const char *path) {
+        FleeceException::_throw(InternalError, "Can't map files on this platform");
+    }
+
+    void MappedFile::prefetch(slice range) const noexcept { }
+
+    MappedFile::~MappedFile() =default;
+
+    std::unique_ptr<MappedFile> MappedFile::createSharedMemory(const char *name, slice, unsigned) {
+        FleeceException::_throw(InternalError, "Can't map shared memory on this platform");
+    }
+
+    std::unique_ptr<MappedFile> MappedFile::openSharedMemory(const char *name) {
+        FleeceException::_throw(InternalError, "Can't map shared memory on this platform");
+    }
+
+    bool MappedFile::removeSharedMemory(const char *name) {
+        return false;
+    }
+
 }
 
 #endif // FL_HAVE_FILESYSTEM
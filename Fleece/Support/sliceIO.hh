@@ -18,6 +18,7 @@
 
 #pragma once
 #include "fleece/slice.hh"
+#include <memory>
 #include <string>
 #include <stdio.h>
 
@@ -40,3 +41,59 @@ namespace fleece {
 
 #endif // FL_HAVE_FILESYSTEM
 
+
+namespace fleece {
+
+    /** A read-only memory mapping of an entire file. Pages are loaded on demand as they're
+        accessed, so opening even a huge file is cheap. The mapping is removed by the destructor,
+        so the contents must not be accessed after that.
+        (Without FL_HAVE_FILESYSTEM, the constructor just throws an exception.) */
+    class MappedFile {
+    public:
+        explicit MappedFile(const char *path);
+        ~MappedFile();
+
+        /** The contents of the file. (If the file is empty, this is a null slice.) */
+        slice contents() const                  {return _contents;}
+
+        /** Advises the OS that the given range of the contents will be accessed soon, so it can
+            start reading those pages in the background. The range is clipped to the contents. */
+        void prefetch(slice range) const noexcept;
+
+        //////// Named shared memory:
+
+        /** Creates a named shared-memory segment holding a copy of `contents`, replacing any
+            existing one of that name, and returns a read-only mapping of it. Other processes on
+            the same host can then map it by name with \ref openSharedMemory, so the data is only
+            in memory once.
+            The name should begin with "/" and contain no other slashes. The segment remains
+            until \ref removeSharedMemory is called (or, on Windows, until every mapping of it
+            has been freed, including this one.) Existing mappings of a replaced segment remain
+            valid.
+            `mode` is the segment's permissions, as for a file; by default only the same user
+            can open it. (It's ignored on Windows.) */
+        static std::unique_ptr<MappedFile> createSharedMemory(const char *name, slice contents,
+                                                              unsigned mode =0600);
+
+        /** Maps an existing shared-memory segment created by \ref createSharedMemory,
+            read-only. Throws if there's no such segment. */
+        static std::unique_ptr<MappedFile> openSharedMemory(const char *name);
+
+        /** Removes the name of a shared-memory segment, so it can't be opened anymore; its
+            memory is freed once it's unmapped by every process. Returns false if there was no
+            such segment. (On Windows this does nothing.) */
+        static bool removeSharedMemory(const char *name);
+
+    private:
+        MappedFile() =default;
+        MappedFile(const MappedFile&) =delete;
+        MappedFile& operator=(const MappedFile&) =delete;
+
+        slice _contents;
+        slice _region;                          // Entire mapping, if it's shared memory
+#ifdef _MSC_VER
+        void* _mapping {nullptr};               // Windows file-mapping HANDLE
+#endif
+    };
+
+}
@@ -18,8 +18,10 @@
 
 #include "varint.hh"
 #include "fleece/slice.hh"
+#include "Bitmap.hh"
 #include "Endian.hh"
 #include <algorithm>
+#include <cstring>
 #include "betterassert.hh"
 
 
@@ -48,10 +50,42 @@ size_t PutUVarInt(void *buf, uint64_t n) {
 }
 
 
+// Decodes a varint of up to 8 bytes from the little-endian 64-bit word `w` without branching,
+// returning its length, or 0 if it's longer than 8 bytes.
+static inline size_t decodeVarIntWord(uint64_t w, uint64_t *n) {
+    // The terminating byte is the first with its high bit clear:
+    uint64_t stops = ~w & 0x8080808080808080;
+    if (_usuallyFalse(stops == 0))
+        return 0;
+    unsigned nBits = countTrailingZeros(stops) + 1;          // 8, 16, ... 64
+    w &= (nBits == 64) ? ~0ull : ((1ull << nBits) - 1);
+    // Squeeze out the high bits of each byte, in parallel, doubling the group size each time:
+    w &= 0x7F7F7F7F7F7F7F7F;
+    w = ((w & 0x7F007F007F007F00) >> 1) | (w & 0x007F007F007F007F);
+    w = ((w & 0x3FFF00003FFF0000) >> 2) | (w & 0x00003FFF00003FFF);
+    w = ((w & 0x0FFFFFFF00000000) >> 4) | (w & 0x000000000FFFFFFF);
+    *n = w;
+    return nBits / 8;
+}
+
+
 __hot
 size_t _GetUVarInt(slice buf, uint64_t *n) {
-    // NOTE: The public inline function GetUVarInt already decodes 1-byte varints,
-    // so if we get here we can assume the varint is at least 2 bytes.
+    // Two-byte varints are common enough (string lengths from 128 to 16K) to special-case;
+    // longer ones are decoded all at once if there are 8 bytes to read.
+    auto bytes = (const uint8_t*)buf.buf;
+    if (_usuallyTrue(buf.size >= 2 && bytes[1] < 0x80)) {
+        *n = (bytes[0] & 0x7F) | (uint64_t(bytes[1]) << 7);
+        return 2;
+    } else if (_usuallyTrue(buf.size >= 8)) {
+        uint64_t w;
+        memcpy(&w, buf.buf, sizeof(w));
+        if (size_t size = decodeVarIntWord(endian::decLittle64(w), n); _usuallyTrue(size > 0))
+            return size;
+    }
+
+    // Otherwise decode a byte at a time. (The public inline function GetUVarInt already decodes
+    // 1-byte varints, so if we get here we can assume the varint is at least 2 bytes.)
     auto pos = (const uint8_t*)buf.buf;
     auto end = pos + std::min(buf.size, (size_t)kMaxVarintLen64);
     uint64_t result = *pos++ & 0x7F;
@@ -73,6 +107,56 @@ size_t _GetUVarInt(slice buf, uint64_t *n) {
     return 0; // buffer too short
 }
 
+__hot
+size_t GetUVarInts(slice buf, uint64_t *n, size_t count) {
+    auto pos = (const uint8_t*)buf.buf, end = (const uint8_t*)buf.end();
+    // While at least 8 bytes remain, no bounds checks are needed:
+    while (count > 0 && end - pos >= 8) {
+        uint64_t w;
+        memcpy(&w, pos, sizeof(w));
+        if ((w & 0x8080808080808080) == 0 && count >= 8) {
+            // Eight 1-byte varints:
+            for (int i = 0; i < 8; ++i)
+                n[i] = pos[i];
+            pos += 8;
+            n += 8;
+            count -= 8;
+            continue;
+        }
+        // (Not special-casing 1-byte varints avoids mispredicted branches on mixed lengths.)
+        size_t size = decodeVarIntWord(endian::decLittle64(w), n);
+        if (_usuallyFalse(size == 0)) {
+            size = _GetUVarInt(slice(pos, end), n);
+            if (size == 0)
+                return 0;
+        }
+        pos += size;
+        ++n;
+        --count;
+    }
+    for (; count > 0; --count, ++n) {
+        size_t size = GetUVarInt(slice(pos, end), n);
+        if (size == 0)
+            return 0;
+        pos += size;
+    }
+    return pos - (const uint8_t*)buf.buf;
+}
+
+
+__hot
+size_t GetUVarInts32(slice buf, uint32_t *n, size_t count) {
+    auto pos = (const uint8_t*)buf.buf, end = (const uint8_t*)buf.end();
+    for (; count > 0; --count, ++n) {
+        size_t size = GetUVarInt32(slice(pos, end), n);
+        if (size == 0)
+            return 0;
+        pos += size;
+    }
+    return pos - (const uint8_t*)buf.buf;
+}
+
+
 __hot
 size_t _GetUVarInt32(slice buf, uint32_t *n) {
     uint64_t n64;
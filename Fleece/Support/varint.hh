@@ -83,6 +83,16 @@ static inline size_t GetUVarInt32(slice buf, uint32_t *n NONNULL) {
 }
 
 
+/** Decodes `count` consecutive varints from buf into the array `n`.
+    Returns the total number of bytes read, or 0 if the data is invalid (buffer too short or a
+    number too long.) */
+size_t GetUVarInts(slice buf, uint64_t *n NONNULL, size_t count);
+
+/** Decodes `count` consecutive varints from buf into the array `n`, like GetUVarInts, but
+    fails if any number doesn't fit in 32 bits. */
+size_t GetUVarInts32(slice buf, uint32_t *n NONNULL, size_t count);
+
+
 /** Skips a pointer past a varint without decoding it. */
 __hot
 static inline const void* SkipVarInt(const void *buf NONNULL) {
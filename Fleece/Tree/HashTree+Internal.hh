@@ -22,6 +22,8 @@
 #include "Bitmap.hh"
 #include "Endian.hh"
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace fleece { namespace hashtree {
 
@@ -42,6 +44,7 @@ namespace fleece { namespace hashtree {
 
 
     union Node;
+    class Leaf;
     class MutableInterior;
 
     // Types for the hash-array map:
@@ -55,6 +58,10 @@ namespace fleece { namespace hashtree {
     // software version this is, since the structure of the hash table depends on it.
     FLPURE hash_t ComputeHash(slice key) noexcept;
 
+    // Keys of leaf nodes, and their positions in the encoded output, collected while writing a
+    // tree so a sorted index can be written. Positions in the Encoder's base are negative.
+    using LeafPositions = std::vector<std::pair<slice, int32_t>>;
+
     // Internal class representing a leaf node
     class Leaf {
     public:
@@ -106,6 +113,7 @@ namespace fleece { namespace hashtree {
 
         const Leaf* findNearest(hash_t hash) const;
         unsigned leafCount() const;
+        void getLeaves(std::vector<const Leaf*>&) const;
 
         unsigned childCount() const;
         const Node* childAtIndex(int i) const;
@@ -131,7 +139,7 @@ namespace fleece { namespace hashtree {
             return Interior(_bitmap, pos - _childrenOffset);
         }
 
-        Interior writeTo(Encoder&) const;
+        Interior writeTo(Encoder&, LeafPositions* =nullptr) const;
 
     private:
         endian::uint32_le_unaligned _bitmap;
@@ -151,6 +159,40 @@ namespace fleece { namespace hashtree {
             return this;
         }
     };
-    
+
+
+    // A Bloom filter of the hashes of a tree's keys, which may be written between the root's
+    // children (and sorted index, if any) and the root; see MutableHashTree::writeTo. It's
+    // "blocked": all the bits for a key are in one 64-byte block, so checking for a missing
+    // key usually costs one cache line instead of a descent of the tree.
+    // The blocks are followed by a trailer of their count (uint32) and a magic number (uint16.)
+    // That makes the gap before the root 2 mod 4 bytes, so older readers, which take a gap
+    // that's a multiple of 4 to be a sorted index, just see no index.
+    class BloomFilter {
+    public:
+        static constexpr size_t kBlockSize = 64;
+        static constexpr size_t kTrailerSize = 6;
+        static constexpr unsigned kBitsPerKey = 10, kProbes = 7;
+
+        explicit BloomFilter(slice blocks)
+        :_blocks((const uint8_t*)blocks.buf)
+        ,_nBlocks(uint32_t(blocks.size / kBlockSize))
+        { }
+
+        // False if the key with this hash is definitely absent.
+        bool mayContain(hash_t) const noexcept FLPURE;
+
+        // Returns the encoded filter of a set of hashes, including its trailer.
+        static alloc_slice encode(const std::vector<hash_t>&);
+
+        // Returns the blocks of the filter whose trailer ends at `end`, if there is one in
+        // the `maxSize` bytes before it.
+        static slice find(const void *end, size_t maxSize) noexcept FLPURE;
+
+    private:
+        const uint8_t* _blocks;
+        uint32_t _nBlocks;
+    };
+
 } }
 
@@ -123,6 +123,17 @@ namespace fleece {
             return count;
         }
 
+        // Adds all the leaves under this node to `leaves`.
+        void Interior::getLeaves(std::vector<const Leaf*> &leaves) const {
+            auto c = childAtIndex(0);
+            for (unsigned n = childCount(); n > 0; --n, ++c) {
+                if (c->isLeaf())
+                    leaves.push_back(&c->leaf);
+                else
+                    c->interior.getLeaves(leaves);
+            }
+        }
+
         void Interior::dump(std::ostream &out, unsigned indent =1) const {
             unsigned n = childCount();
             out << string(2*indent, ' ') << "[";
@@ -137,9 +148,75 @@ namespace fleece {
             out << " ]";
         }
 
-        Interior Interior::writeTo(Encoder &enc) const {
+        static constexpr uint16_t kBloomFilterMagic = 0xB100;
+
+        // Spreads the bits of a key's hash, since the tree uses them a few at a time.
+        static inline uint32_t mixHash(hash_t h) {
+            h ^= h >> 16;  h *= 0x85ebca6b;
+            h ^= h >> 13;  h *= 0xc2b2ae35;
+            h ^= h >> 16;
+            return h;
+        }
+
+        // Calls `fn` with the byte index and bit mask of each of a hash's bits in the filter.
+        template <class FN>
+        static inline void forEachBit(hash_t hash, uint32_t nBlocks, FN fn) {
+            uint32_t h = mixHash(hash);
+            size_t block = size_t((uint64_t(h) * nBlocks) >> 32) * BloomFilter::kBlockSize;
+            uint32_t pos = h * 0x9E3779B1, step = (pos >> 16) | 1;
+            for (unsigned i = 0; i < BloomFilter::kProbes; ++i, pos += step) {
+                unsigned bit = pos & (8 * BloomFilter::kBlockSize - 1);
+                fn(block + bit / 8, uint8_t(1 << (bit % 8)));
+            }
+        }
+
+        bool BloomFilter::mayContain(hash_t hash) const noexcept {
+            bool result = true;
+            forEachBit(hash, _nBlocks, [&](size_t byte, uint8_t mask) {
+                result = result && (_blocks[byte] & mask);
+            });
+            return result;
+        }
+
+        alloc_slice BloomFilter::encode(const std::vector<hash_t> &hashes) {
+            auto nBlocks = uint32_t(std::max(size_t(1), (hashes.size() * kBitsPerKey
+                                                         + 8 * kBlockSize - 1) / (8 * kBlockSize)));
+            alloc_slice result(nBlocks * kBlockSize + kTrailerSize);
+            auto bits = (uint8_t*)result.buf;
+            memset(bits, 0, result.size);
+            for (hash_t hash : hashes)
+                forEachBit(hash, nBlocks, [&](size_t byte, uint8_t mask) {bits[byte] |= mask;});
+            endian::uint32_le_unaligned count(nBlocks);
+            endian::uint16_le magic(kBloomFilterMagic);
+            memcpy(&bits[nBlocks * kBlockSize], &count, sizeof(count));
+            memcpy(&bits[nBlocks * kBlockSize + sizeof(count)], &magic, sizeof(magic));
+            return result;
+        }
+
+        slice BloomFilter::find(const void *end, size_t maxSize) noexcept {
+            if (maxSize < kTrailerSize || maxSize % 4 != 2)
+                return nullslice;
+            endian::uint32_le_unaligned count;
+            endian::uint16_le magic;
+            memcpy(&count, offsetby(end, -(ssize_t)kTrailerSize), sizeof(count));
+            memcpy(&magic, offsetby(end, -(ssize_t)sizeof(magic)), sizeof(magic));
+            size_t size = size_t(uint32_t(count)) * kBlockSize;
+            if (magic != kBloomFilterMagic || size == 0 || size > maxSize - kTrailerSize)
+                return nullslice;
+            return {offsetby(end, -(ssize_t)(size + kTrailerSize)), size};
+        }
+
+
+        Interior Interior::writeTo(Encoder &enc, LeafPositions *leafPositions) const {
             if (enc.base().containsAddress(this)) {
                 auto pos = int32_t((char*)this - (char*)enc.base().end());
+                if (leafPositions && childCount() > 0) {
+                    std::vector<const Leaf*> leaves;
+                    getLeaves(leaves);
+                    for (auto leaf : leaves)
+                        leafPositions->emplace_back(leaf->keyString(),
+                                                    int32_t((char*)leaf - (char*)enc.base().end()));
+                }
                 return makeAbsolute(pos);
             } else {
                 //FIX: DRY FAIL: This is nearly identical to MInteriorNode::writeTo()
@@ -148,7 +225,7 @@ namespace fleece {
                 for (unsigned i = 0; i < n; ++i) {
                     auto child = childAtIndex(i);
                     if (!child->isLeaf())
-                        nodes[i].interior = child->interior.writeTo(enc);
+                        nodes[i].interior = child->interior.writeTo(enc, leafPositions);
                 }
                 for (unsigned i = 0; i < n; ++i) {
                     auto child = childAtIndex(i);
@@ -165,10 +242,13 @@ namespace fleece {
                 auto curPos = childrenPos;
                 for (unsigned i = 0; i < n; ++i) {
                     auto &node = nodes[i];
-                    if (childAtIndex(i)->isLeaf())
+                    if (childAtIndex(i)->isLeaf()) {
                         node.leaf.makeRelativeTo(curPos);
-                    else
+                        if (leafPositions)
+                            leafPositions->emplace_back(childAtIndex(i)->leaf.keyString(), curPos);
+                    } else {
                         node.interior.makeRelativeTo(curPos);
+                    }
                     curPos += sizeof(nodes[i]);
                 }
                 enc.writeRaw({nodes, n * sizeof(nodes[0])});
@@ -190,14 +270,159 @@ namespace fleece {
         return (const Interior*)this;
     }
 
+    // The gap between the root's children and the root, where the sorted index and the Bloom
+    // filter go.
+    static size_t gapBeforeRoot(const Interior *root) {
+        size_t childrenSize = root->childCount() * sizeof(Node);
+        return (root->childrenOffset() > childrenSize) ? root->childrenOffset() - childrenSize : 0;
+    }
+
+    static slice bloomFilterOf(const Interior *root) {
+        return BloomFilter::find(root, gapBeforeRoot(root));
+    }
+
     Value HashTree::get(slice key) const {
         auto root = rootNode();
-        auto leaf = root->findNearest(ComputeHash(key));
+        hash_t hash = ComputeHash(key);
+        if (slice filter = bloomFilterOf(root); filter && !BloomFilter(filter).mayContain(hash))
+            return nullptr;
+        auto leaf = root->findNearest(hash);
         if (leaf && leaf->keyString() == key)
             return leaf->value();
         return nullptr;
     }
 
+    void HashTree::getMany(const slice keys[], Value values[], size_t count) const {
+        static constexpr size_t kGroupSize = 16;
+        const Node* nodes[kGroupSize];
+        hash_t hashes[kGroupSize];
+        slice filterBlocks = bloomFilterOf(rootNode());
+        BloomFilter filter(filterBlocks);
+        for (size_t start = 0; start < count; start += kGroupSize) {
+            size_t n = min(kGroupSize, count - start);
+            for (size_t i = 0; i < n; ++i) {
+                hashes[i] = ComputeHash(keys[start + i]);
+                if (filterBlocks && !filter.mayContain(hashes[i]))
+                    nodes[i] = nullptr;         // Definitely absent
+                else
+                    nodes[i] = (const Node*)rootNode();
+            }
+
+            // Each pass moves every lookup that's still at an interior node down one level,
+            // prefetching the child so it's (hopefully) in the cache by the next pass:
+            for (bool moved = true; moved; ) {
+                moved = false;
+                for (size_t i = 0; i < n; ++i) {
+                    auto node = nodes[i];
+                    if (!node || node->isLeaf())
+                        continue;
+                    node = node->interior.childForBitNumber(hashes[i] & (kMaxChildren - 1));
+                    hashes[i] >>= kBitShift;
+                    nodes[i] = node;
+                    if (node) {
+                        PREFETCH(node);
+                        moved = true;
+                    }
+                }
+            }
+
+            // Then prefetch the leaves' keys before comparing them:
+            for (size_t i = 0; i < n; ++i) {
+                if (nodes[i])
+                    PREFETCH((FLValue)nodes[i]->leaf.key());
+            }
+            for (size_t i = 0; i < n; ++i) {
+                auto leaf = nodes[i] ? &nodes[i]->leaf : nullptr;
+                values[start + i] = (leaf && leaf->matches(keys[start + i])) ? leaf->value()
+                                                                              : Value();
+            }
+        }
+    }
+
+    // The sorted index, if any, lies between the root's children and the root (or the Bloom
+    // filter): an array of little-endian uint32 offsets back from the root to the leaves, in
+    // order of their keys.
+    static slice sortedIndexOf(const Interior *root) {
+        size_t gap = gapBeforeRoot(root);
+        if (slice filter = BloomFilter::find(root, gap); filter)
+            gap -= filter.size + BloomFilter::kTrailerSize;
+        if (gap == 0 || gap % sizeof(uint32_t) != 0)
+            return nullslice;
+        return {offsetby(root, -(ssize_t)gapBeforeRoot(root)), gap};
+    }
+
+    bool HashTree::hasSortedIndex() const {
+        return sortedIndexOf(rootNode()).buf != nullptr;
+    }
+
+    bool HashTree::hasBloomFilter() const {
+        return bloomFilterOf(rootNode()).buf != nullptr;
+    }
+
+
+    HashTree::sortedIterator::sortedIterator(const HashTree *tree, slice startKey, slice prefix)
+    :_root((const uint8_t*)tree->rootNode())
+    ,_prefix(prefix)
+    {
+        slice index = sortedIndexOf(tree->rootNode());
+        if (index) {
+            _index = (const uint8_t*)index.buf;
+            _count = index.size / sizeof(uint32_t);
+        } else {
+            std::vector<const Leaf*> leaves;
+            if (tree->rootNode()->childCount() > 0)
+                tree->rootNode()->getLeaves(leaves);
+            sort(leaves.begin(), leaves.end(), [](const Leaf *a, const Leaf *b) {
+                return a->keyString() < b->keyString();
+            });
+            _ownIndex.reserve(leaves.size());
+            for (auto leaf : leaves)
+                _ownIndex.push_back(endian::encLittle32(uint32_t(_root - (const uint8_t*)leaf)));
+            _index = (const uint8_t*)_ownIndex.data();
+            _count = _ownIndex.size();
+        }
+
+        // Binary-search for the start key:
+        size_t lo = 0, hi = _count;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (leafAt(mid)->keyString() < startKey)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        _pos = lo;
+        load();
+    }
+
+    const Leaf* HashTree::sortedIterator::leafAt(size_t i) const {
+        uint32_t offset;
+        memcpy(&offset, _index + i * sizeof(uint32_t), sizeof(offset));
+        return (const Leaf*)(_root - endian::decLittle32(offset));
+    }
+
+    void HashTree::sortedIterator::load() {
+        if (_pos < _count) {
+            auto leaf = leafAt(_pos);
+            _key = leaf->keyString();
+            if (_prefix.size == 0 || (_key.size >= _prefix.size
+                                      && memcmp(_key.buf, _prefix.buf, _prefix.size) == 0)) {
+                _value = leaf->value();
+                return;
+            }
+        }
+        _pos = _count;
+        _key = nullslice;
+        _value = nullptr;
+    }
+
+    HashTree::sortedIterator& HashTree::sortedIterator::operator++() {
+        ++_pos;
+        load();
+        return *this;
+    }
+
+
     unsigned HashTree::count() const {
         return rootNode()->leafCount();
     }
@@ -20,6 +20,7 @@
 #include "fleece/slice.hh"
 #include "fleece/Fleece.hh"
 #include <memory>
+#include <vector>
 
 namespace fleece {
 
@@ -27,6 +28,7 @@ namespace fleece {
 
     namespace hashtree {
         class Interior;
+        class Leaf;
         class MutableInterior;
         class NodeRef;
         struct iteratorImpl;
@@ -40,11 +42,59 @@ namespace fleece {
 
         Value get(slice) const;
 
+        /** Looks up `count` keys at once, storing the results in `values`. This is faster than
+            calling \ref get for each key on a tree too large for the CPU cache, since the lookups
+            advance through the tree together, prefetching the nodes each one will visit next. */
+        void getMany(const slice keys[], Value values[], size_t count) const;
+
         unsigned count() const;
 
         void dump(std::ostream &out) const;
 
 
+        /** True if the tree was written with a sorted index of its keys; see
+            \ref MutableHashTree::writeTo. */
+        bool hasSortedIndex() const;
+
+        /** True if the tree was written with a Bloom filter of its keys, which \ref get and
+            \ref getMany check first, so that looking up a missing key is usually fast; see
+            \ref MutableHashTree::writeTo. */
+        bool hasBloomFilter() const;
+
+
+        /** Iterates over the entries in the order of their keys. If the tree has a sorted index
+            this takes O(log n) to start and O(1) per entry; otherwise it starts by reading and
+            sorting all the leaves. */
+        class sortedIterator {
+        public:
+            sortedIterator(sortedIterator&&) =default;
+            slice key() const noexcept                      {return _key;}
+            Value value() const noexcept                    {return _value;}
+            explicit operator bool() const noexcept         {return !!_value;}
+            sortedIterator& operator ++();
+        private:
+            sortedIterator(const HashTree*, slice startKey, slice prefix);
+            const hashtree::Leaf* leafAt(size_t i) const;
+            void load();
+
+            const uint8_t* _root;
+            const uint8_t* _index;                  // Little-endian offsets back from _root
+            std::vector<uint32_t> _ownIndex;        // Backing store of _index, if no sorted index
+            size_t _pos {0}, _count {0};
+            slice _prefix;
+            slice _key;
+            Value _value;
+            friend class HashTree;
+        };
+
+        /** Returns an iterator over the entries in sorted order, starting at the first key that
+            is greater than or equal to `key`. */
+        sortedIterator lowerBound(slice key) const  {return sortedIterator(this, key, nullslice);}
+
+        /** Returns an iterator over the entries whose keys start with `prefix`, in sorted order. */
+        sortedIterator withPrefix(slice prefix) const {return sortedIterator(this, prefix, prefix);}
+
+
         class iterator {
         public:
             iterator(const MutableHashTree&);
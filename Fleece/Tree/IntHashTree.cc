@@ -0,0 +1,852 @@
+//
+// IntHashTree.cc
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "IntHashTree.hh"
+#include "HashTree+Internal.hh"
+#include "NodeArena.hh"
+#include "fleece/Mutable.hh"
+#include "Bitmap.hh"
+#include "Endian.hh"
+#include "TempArray.hh"
+#include <ostream>
+#include <string>
+#include "betterassert.hh"
+
+using namespace std;
+
+namespace fleece { namespace hashtree {
+
+    /*
+        Data format: the same as HashTree's (see HashTree+Internal.hh), except that nodes are
+        12 bytes, and a leaf holds its key itself instead of an offset to a string:
+
+        Interior Node:                      Leaf Node:
+            children [4-byte offset]            value [4-byte offset, OR'ed with 1]
+            bitmap   [4-byte int]               key   [8-byte int]
+            (zero)   [4-byte int]
+
+        The root node is at the end of the data, so it starts 12 bytes before the end.
+     */
+
+
+    using inthash_t = uint64_t;
+
+    // Mixes the bits of a key (this is SplitMix64's finalizer.) Every step is invertible, so
+    // distinct keys have distinct hashes and the trie never has collisions; and since every
+    // key bit affects the low hash bits, which pick the children near the root, the tree is
+    // balanced even when keys are sequential. Like ComputeHash, this must never change.
+    static inline inthash_t ComputeIntHash(uint64_t key) noexcept {
+        key ^= key >> 30;  key *= 0xbf58476d1ce4e5b9;
+        key ^= key >> 27;  key *= 0x94d049bb133111eb;
+        key ^= key >> 31;
+        return key;
+    }
+
+    // The deepest a tree can be: deep enough to use all the bits of a hash.
+    static constexpr unsigned kMaxIntDepth = (8*sizeof(inthash_t) + kBitShift - 1) / kBitShift;
+
+    static inline unsigned childBitNumber(inthash_t hash, unsigned shift) {
+        return unsigned(hash >> shift) & (kMaxChildren - 1);
+    }
+
+
+    // Internal class representing a leaf node
+    class IntLeaf {
+    public:
+        IntLeaf(uint32_t valuePos, uint64_t key)
+        :_valueOffset(valuePos)
+        ,_keyLo(uint32_t(key))
+        ,_keyHi(uint32_t(key >> 32))
+        { }
+
+        uint64_t key() const            {return (uint64_t(_keyHi) << 32) | uint32_t(_keyLo);}
+        uint32_t valueOffset() const    {return uint32_t(_valueOffset) & ~1u;}
+        Value value() const {
+            return Value((FLValue)offsetby(this, -(ssize_t)valueOffset()));
+        }
+
+        void makeRelativeTo(uint32_t pos) {
+            _valueOffset = (pos - _valueOffset) | 1;
+        }
+
+        uint32_t writeValueTo(Encoder &enc) const {
+            if (enc.base().containsAddress(this)) {
+                auto pos = int32_t((char*)this - (char*)enc.base().end());
+                return uint32_t(pos) - valueOffset();
+            } else {
+                enc.writeValue(value());
+                return (uint32_t)enc.finishItem();
+            }
+        }
+
+    private:
+        endian::uint32_le_unaligned _valueOffset;
+        endian::uint32_le_unaligned _keyLo, _keyHi;
+
+        friend union IntNode;
+    };
+
+
+    union IntNode;
+    class IntNodeRef;
+
+    // Writes the children of an interior node, then the array of the nodes themselves.
+    // Returns the interior node, with the absolute position of the array.
+    static IntInterior writeChildren(Encoder&, bitmap_t, unsigned n, const IntNodeRef children[]);
+
+
+    // Internal class representing an interior node
+    class IntInterior {
+    public:
+        IntInterior(bitmap_t bitmap, uint32_t childrenPos)
+        :_childrenOffset(childrenPos)
+        ,_bitmap(bitmap)
+        ,_reserved(0)
+        { }
+
+        bitmap_t bitmap() const                     {return _bitmap;}
+        unsigned childCount() const                 {return asBitmap(bitmap()).bitCount();}
+        bool hasChild(unsigned bitNo) const         {return asBitmap(bitmap()).containsBit(bitNo);}
+
+        inline const IntNode* childAtIndex(unsigned i) const;
+        inline const IntNode* childForBitNumber(unsigned bitNo) const;
+
+        void makeRelativeTo(uint32_t pos) {
+            _childrenOffset = pos - _childrenOffset;
+        }
+
+        IntInterior makeAbsolute(uint32_t pos) const {
+            return IntInterior(bitmap(), pos - _childrenOffset);
+        }
+
+        IntInterior writeTo(Encoder&) const;
+
+    private:
+        endian::uint32_le_unaligned _childrenOffset;
+        endian::uint32_le_unaligned _bitmap;
+        endian::uint32_le_unaligned _reserved;
+    };
+
+
+    union IntNode {
+        IntLeaf leaf;
+        IntInterior interior;
+
+        IntNode() { }
+        bool isLeaf() const                 {return (uint32_t(leaf._valueOffset) & 1) != 0;}
+    };
+
+    static_assert(sizeof(IntNode) == 12, "IntNode has the wrong size");
+
+    const IntNode* IntInterior::childAtIndex(unsigned i) const {
+        assert_precondition(_childrenOffset > 0);
+        return (const IntNode*)offsetby(this, -(ssize_t)uint32_t(_childrenOffset)) + i;
+    }
+
+    const IntNode* IntInterior::childForBitNumber(unsigned bitNo) const {
+        return hasChild(bitNo) ? childAtIndex(asBitmap(bitmap()).indexOfBit(bitNo)) : nullptr;
+    }
+
+
+    // Base class of nodes within a MutableIntHashTree.
+    class MutableIntNode {
+    public:
+        explicit MutableIntNode(unsigned capacity)
+        :_capacity(uint8_t(capacity))
+        {
+            assert_precondition(capacity <= kMaxChildren);
+        }
+
+        bool isLeaf() const FLPURE          {return _capacity == 0;}
+
+    protected:
+        uint8_t _capacity;
+    };
+
+
+    // Holds a pointer to any type of node. Mutable nodes are tagged by setting the LSB.
+    class IntNodeRef {
+    public:
+        IntNodeRef()                            :_addr(0) { }
+        IntNodeRef(MutableIntNode* n)           :_addr(size_t(n) | 1) {assert_precondition(n);}
+        IntNodeRef(const IntNode* n)            :_addr(size_t(n)) { }
+        IntNodeRef(const IntInterior* n)        :_addr(size_t(n)) { }
+
+        explicit operator bool () const FLPURE  {return _addr != 0;}
+
+        bool isMutable() const FLPURE           {return (_addr & 1) != 0;}
+
+        MutableIntNode* asMutable() const FLPURE {
+            return isMutable() ? (MutableIntNode*)(_addr & ~1) : nullptr;
+        }
+
+        const IntNode* asImmutable() const FLPURE {
+            return isMutable() ? nullptr : (const IntNode*)_addr;
+        }
+
+        bool isLeaf() const FLPURE;
+        uint64_t key() const FLPURE;
+        Value value() const FLPURE;
+
+        unsigned childCount() const FLPURE;
+        IntNodeRef childAtIndex(unsigned index) const FLPURE;
+        IntNodeRef childForBitNumber(unsigned bitNo) const FLPURE;
+
+        IntInterior writeInteriorTo(Encoder&) const;
+        uint32_t writeValueTo(Encoder&) const;
+
+    private:
+        size_t _addr;
+    };
+
+
+    // A leaf node that holds a single key and value. Allocated from a NodeArena, with
+    // `new (arena) MutableIntLeaf(...)`, and freed by `destroy`.
+    class MutableIntLeaf : public MutableIntNode {
+    public:
+        MutableIntLeaf(uint64_t k, Value v)
+        :MutableIntNode(0)
+        ,key(k)
+        ,value(v)
+        { }
+
+        static void* operator new(size_t size, NodeArena &arena) {
+            return arena.allocate(0, size);
+        }
+
+        static void operator delete(void *ptr, NodeArena &arena) {
+            arena.free(ptr, 0);
+        }
+
+        static void operator delete(void*) = delete;
+
+        void destroy(NodeArena &arena) {
+            this->~MutableIntLeaf();
+            arena.free(this, 0);
+        }
+
+        uint64_t const key;
+        RetainedValue value;
+    };
+
+
+    // An interior node of a MutableIntHashTree: a compact hash table mapping to nodes. Works
+    // like MutableInterior, except that hashes are 64 bits and never collide.
+    class MutableIntInterior : public MutableIntNode {
+    public:
+        using InsertCallback = MutableIntHashTree::InsertCallback;
+
+        static MutableIntInterior* newRoot(const IntHashTree *imTree, NodeArena &arena) {
+            if (imTree)
+                return mutableCopy(imTree->rootNode(), arena);
+            else
+                return newNode(arena, kMaxChildren);
+        }
+
+        unsigned childCount() const                 {return _bitmap.bitCount();}
+        IntNodeRef childAtIndex(unsigned i) const   {return _children[i];}
+        bool hasChild(unsigned bitNo) const         {return _bitmap.containsBit(bitNo);}
+
+        IntNodeRef childForBitNumber(unsigned bitNo) const {
+            return hasChild(bitNo) ? _children[_bitmap.indexOfBit(bitNo)] : IntNodeRef();
+        }
+
+
+        // Recursive insertion method. On success returns either 'this', or a new node that
+        // replaces 'this'. On failure (i.e. callback returned nullptr) returns nullptr.
+        MutableIntInterior* insert(uint64_t key, inthash_t hash, unsigned shift,
+                                   const InsertCallback &callback, NodeArena &arena) {
+            assert_precondition(shift < 8*sizeof(inthash_t));
+            unsigned bitNo = childBitNumber(hash, shift);
+            if (!hasChild(bitNo)) {
+                // No child -- add a leaf:
+                Value val = callback(nullptr);
+                if (!val)
+                    return nullptr;
+                return addChild(bitNo, new (arena) MutableIntLeaf(key, val), arena);
+            }
+            IntNodeRef &childRef = _children[_bitmap.indexOfBit(bitNo)];
+            if (childRef.isLeaf()) {
+                if (childRef.key() == key) {
+                    // Leaf node matches this key; update or copy it:
+                    Value val = callback(childRef.value());
+                    if (!val)
+                        return nullptr;
+                    if (childRef.isMutable())
+                        ((MutableIntLeaf*)childRef.asMutable())->value = val;
+                    else
+                        childRef = new (arena) MutableIntLeaf(key, val);
+                    return this;
+                } else {
+                    // Replace the leaf with an interior node holding it and the new key:
+                    unsigned leafBitNo = childBitNumber(ComputeIntHash(childRef.key()),
+                                                        shift + kBitShift);
+                    MutableIntInterior *node = newNode(arena, 2)->addChild(leafBitNo, childRef,
+                                                                           arena);
+                    auto insertedNode = node->insert(key, hash, shift + kBitShift, callback, arena);
+                    if (!insertedNode) {
+                        freeNode(node, arena);
+                        return nullptr;
+                    }
+                    childRef = insertedNode;
+                    return this;
+                }
+            } else {
+                // Progress down to interior node...
+                auto child = (MutableIntInterior*)childRef.asMutable();
+                bool copied = !child;
+                if (copied)
+                    child = mutableCopy(&childRef.asImmutable()->interior, arena, 1);
+                auto insertedNode = child->insert(key, hash, shift + kBitShift, callback, arena);
+                if (!insertedNode) {
+                    if (copied)
+                        freeNode(child, arena);
+                    return nullptr;
+                }
+                childRef = insertedNode;
+                return this;
+            }
+        }
+
+
+        bool remove(uint64_t key, inthash_t hash, unsigned shift, NodeArena &arena) {
+            unsigned bitNo = childBitNumber(hash, shift);
+            if (!hasChild(bitNo))
+                return false;
+            unsigned childIndex = _bitmap.indexOfBit(bitNo);
+            IntNodeRef childRef = _children[childIndex];
+            if (childRef.isLeaf()) {
+                if (childRef.key() != key)
+                    return false;
+                removeChild(bitNo, childIndex);
+                if (childRef.isMutable())
+                    ((MutableIntLeaf*)childRef.asMutable())->destroy(arena);
+                return true;
+            } else {
+                // Recurse into child node...
+                auto child = (MutableIntInterior*)childRef.asMutable();
+                if (child) {
+                    if (!child->remove(key, hash, shift + kBitShift, arena))
+                        return false;
+                } else {
+                    child = mutableCopy(&childRef.asImmutable()->interior, arena);
+                    if (!child->remove(key, hash, shift + kBitShift, arena)) {
+                        freeNode(child, arena);
+                        return false;
+                    }
+                    _children[childIndex] = child;
+                }
+                if (child->_bitmap.empty()) {
+                    removeChild(bitNo, childIndex);     // child node is now empty, so remove it
+                    freeNode(child, arena);
+                }
+                return true;
+            }
+        }
+
+
+        void deleteTree(NodeArena &arena) {
+            unsigned n = childCount();
+            for (unsigned i = 0; i < n; ++i) {
+                if (auto child = _children[i].asMutable(); child) {
+                    if (child->isLeaf())
+                        ((MutableIntLeaf*)child)->destroy(arena);
+                    else
+                        ((MutableIntInterior*)child)->deleteTree(arena);
+                }
+            }
+            freeNode(this, arena);
+        }
+
+
+        // Destructs the leaves of the tree, but leaves all the nodes' memory to be freed in
+        // bulk by their NodeArena.
+        void destroyLeaves() {
+            unsigned n = childCount();
+            for (unsigned i = 0; i < n; ++i) {
+                if (auto child = _children[i].asMutable(); child) {
+                    if (child->isLeaf())
+                        ((MutableIntLeaf*)child)->~MutableIntLeaf();
+                    else
+                        ((MutableIntInterior*)child)->destroyLeaves();
+                }
+            }
+        }
+
+
+        IntInterior writeTo(Encoder &enc) const {
+            return writeChildren(enc, bitmap_t(_bitmap), childCount(), _children);
+        }
+
+
+        uint32_t writeRootTo(Encoder &enc) const {
+            auto intNode = writeTo(enc);
+            auto curPos = (uint32_t)enc.nextWritePos();
+            intNode.makeRelativeTo(curPos);
+            enc.writeRaw({&intNode, sizeof(intNode)});
+            return curPos;
+        }
+
+
+        // Deletes a single node that's been replaced; its children belong to its replacement.
+        static void freeNode(MutableIntNode *node, NodeArena &arena) {
+            if (node->isLeaf())
+                ((MutableIntLeaf*)node)->destroy(arena);
+            else
+                arena.free(node, ((MutableIntInterior*)node)->capacity());
+        }
+
+
+        static MutableIntInterior* mutableCopy(const IntInterior *iNode, NodeArena &arena,
+                                               unsigned extraCapacity =0) {
+            auto childCount = iNode->childCount();
+            auto node = newNode(arena, std::min(childCount + extraCapacity,
+                                                unsigned(kMaxChildren)));
+            node->_bitmap = asBitmap(iNode->bitmap());
+            for (unsigned i = 0; i < childCount; ++i)
+                node->_children[i] = IntNodeRef(iNode->childAtIndex(i));
+            return node;
+        }
+
+    private:
+        MutableIntInterior() = delete;
+        MutableIntInterior(const MutableIntInterior&) = delete;
+        MutableIntInterior& operator=(const MutableIntInterior&) = delete;
+
+        unsigned capacity() const FLPURE {
+            assert_precondition(_capacity > 0);
+            return _capacity;
+        }
+
+        // Nodes are allocated from a NodeArena, whose size class for them is their capacity.
+        static MutableIntInterior* newNode(NodeArena &arena, unsigned capacity,
+                                           MutableIntInterior *orig =nullptr) {
+            return new (arena, capacity) MutableIntInterior(capacity, orig);
+        }
+
+        static void* operator new(size_t size, NodeArena &arena, unsigned capacity) {
+            return arena.allocate(capacity, size + capacity*sizeof(IntNodeRef));
+        }
+
+        static void operator delete(void* ptr, NodeArena &arena, unsigned capacity) {
+            arena.free(ptr, capacity);
+        }
+
+        static void operator delete(void*) = delete;
+
+        MutableIntInterior(unsigned cap, MutableIntInterior* orig)
+        :MutableIntNode(cap)
+        ,_bitmap(orig ? orig->_bitmap : Bitmap<bitmap_t>{})
+        {
+            unsigned nCopied = 0;
+            if (orig) {
+                nCopied = orig->capacity();
+                assert_precondition(nCopied <= cap);
+                memcpy((void*)_children, orig->_children, nCopied*sizeof(IntNodeRef));
+            }
+            memset((void*)&_children[nCopied], 0, (cap - nCopied)*sizeof(IntNodeRef));
+        }
+
+        MutableIntInterior* addChild(unsigned bitNo, IntNodeRef child, NodeArena &arena) {
+            assert_precondition(child);
+            MutableIntInterior *node = this;
+            if (childCount() == capacity()) {
+                // Replace me with a copy that has room for one more child:
+                node = newNode(arena, capacity() + 1, this);
+                freeNode(this, arena);
+            }
+            unsigned childIndex = node->_bitmap.indexOfBit(bitNo);
+            memmove((void*)&node->_children[childIndex+1], &node->_children[childIndex],
+                    (node->capacity() - childIndex - 1)*sizeof(IntNodeRef));
+            node->_children[childIndex] = child;
+            node->_bitmap.addBit(bitNo);
+            return node;
+        }
+
+        void removeChild(unsigned bitNo, unsigned childIndex) {
+            assert_precondition(childIndex < capacity());
+            memmove((void*)&_children[childIndex], &_children[childIndex+1],
+                    (capacity() - childIndex - 1)*sizeof(IntNodeRef));
+            _bitmap.removeBit(bitNo);
+        }
+
+
+        Bitmap<bitmap_t> _bitmap {0};
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4200)     // zero-sized array in struct/union
+#endif
+        IntNodeRef _children[0];        // Variable-size array; size is given by _capacity
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+    };
+
+
+    bool IntNodeRef::isLeaf() const {
+        return isMutable() ? asMutable()->isLeaf() : asImmutable()->isLeaf();
+    }
+
+    uint64_t IntNodeRef::key() const {
+        assert_precondition(isLeaf());
+        return isMutable() ? ((MutableIntLeaf*)asMutable())->key : asImmutable()->leaf.key();
+    }
+
+    Value IntNodeRef::value() const {
+        assert_precondition(isLeaf());
+        return isMutable() ? ((MutableIntLeaf*)asMutable())->value : asImmutable()->leaf.value();
+    }
+
+    unsigned IntNodeRef::childCount() const {
+        assert_precondition(!isLeaf());
+        return isMutable() ? ((MutableIntInterior*)asMutable())->childCount()
+                           : asImmutable()->interior.childCount();
+    }
+
+    IntNodeRef IntNodeRef::childAtIndex(unsigned index) const {
+        assert_precondition(!isLeaf());
+        return isMutable() ? ((MutableIntInterior*)asMutable())->childAtIndex(index)
+                           : IntNodeRef(asImmutable()->interior.childAtIndex(index));
+    }
+
+    IntNodeRef IntNodeRef::childForBitNumber(unsigned bitNo) const {
+        assert_precondition(!isLeaf());
+        return isMutable() ? ((MutableIntInterior*)asMutable())->childForBitNumber(bitNo)
+                           : IntNodeRef(asImmutable()->interior.childForBitNumber(bitNo));
+    }
+
+    IntInterior IntNodeRef::writeInteriorTo(Encoder &enc) const {
+        assert_precondition(!isLeaf());
+        return isMutable() ? ((MutableIntInterior*)asMutable())->writeTo(enc)
+                           : asImmutable()->interior.writeTo(enc);
+    }
+
+    uint32_t IntNodeRef::writeValueTo(Encoder &enc) const {
+        assert_precondition(isLeaf());
+        if (isMutable()) {
+            enc.writeValue(((MutableIntLeaf*)asMutable())->value);
+            return (uint32_t)enc.finishItem();
+        } else {
+            return asImmutable()->leaf.writeValueTo(enc);
+        }
+    }
+
+
+    IntInterior IntInterior::writeTo(Encoder &enc) const {
+        if (enc.base().containsAddress(this)) {
+            // Already in the data being amended, so just point to it:
+            auto pos = int32_t((char*)this - (char*)enc.base().end());
+            return makeAbsolute(uint32_t(pos));
+        }
+        unsigned n = childCount();
+        TempArray(children, IntNodeRef, n);
+        for (unsigned i = 0; i < n; ++i)
+            children[i] = IntNodeRef(childAtIndex(i));
+        return writeChildren(enc, bitmap(), n, children);
+    }
+
+
+    static IntInterior writeChildren(Encoder &enc, bitmap_t bitmap, unsigned n,
+                                     const IntNodeRef children[])
+    {
+        // `nodes` is an in-memory staging area for the child nodes I'll write.
+        // The offsets in it are absolute positions in the encoded output.
+        TempArray(nodes, IntNode, n);
+
+        // Write interior nodes, then leaf node Values, keeping the values near their leaves:
+        for (unsigned i = 0; i < n; ++i) {
+            if (!children[i].isLeaf())
+                nodes[i].interior = children[i].writeInteriorTo(enc);
+        }
+        for (unsigned i = 0; i < n; ++i) {
+            if (children[i].isLeaf())
+                nodes[i].leaf = IntLeaf(children[i].writeValueTo(enc), children[i].key());
+        }
+
+        // Convert the Nodes' absolute positions into offsets:
+        const auto childrenPos = (uint32_t)enc.nextWritePos();
+        auto curPos = childrenPos;
+        for (unsigned i = 0; i < n; ++i, curPos += sizeof(IntNode)) {
+            if (children[i].isLeaf())
+                nodes[i].leaf.makeRelativeTo(curPos);
+            else
+                nodes[i].interior.makeRelativeTo(curPos);
+        }
+        enc.writeRaw({nodes, n * sizeof(IntNode)});
+        return IntInterior(bitmap, childrenPos);
+    }
+
+
+    static unsigned leafCount(IntNodeRef node) {
+        unsigned count = 0, n = node.childCount();
+        for (unsigned i = 0; i < n; ++i) {
+            IntNodeRef child = node.childAtIndex(i);
+            count += child.isLeaf() ? 1 : leafCount(child);
+        }
+        return count;
+    }
+
+    static Value getFrom(IntNodeRef node, uint64_t key) {
+        inthash_t hash = ComputeIntHash(key);
+        while (node && !node.isLeaf()) {
+            node = node.childForBitNumber(childBitNumber(hash, 0));
+            hash >>= kBitShift;
+        }
+        return (node && node.key() == key) ? node.value() : Value();
+    }
+
+    static void dump(std::ostream &out, IntNodeRef node, unsigned indent) {
+        // Mutable nodes are shown in {braces}, immutable ones in [brackets]:
+        const char *brackets = node.isMutable() ? "{}" : "[]";
+        out << string(2*indent, ' ') << brackets[0];
+        if (node.isLeaf()) {
+            out << node.key() << "=" << node.value().toJSONString() << brackets[1];
+        } else {
+            unsigned n = node.childCount();
+            for (unsigned i = 0; i < n; ++i) {
+                out << "\n";
+                dump(out, node.childAtIndex(i), indent + 1);
+            }
+            out << " " << brackets[1];
+        }
+    }
+
+
+#pragma mark - ITERATOR
+
+
+    struct intIteratorImpl {
+        struct pos {
+            IntNodeRef parent;      // Always an interior node
+            int index;              // Current child index
+        };
+        pos current;
+        pos stack[kMaxIntDepth];
+        unsigned depth {0};
+
+        explicit intIteratorImpl(IntNodeRef root)
+        :current {root, -1}
+        { }
+
+        // Returns the next leaf, or an empty IntNodeRef at the end.
+        IntNodeRef next() {
+            while (unsigned(++current.index) >= current.parent.childCount()) {
+                if (depth == 0)
+                    return {};
+                current = stack[--depth];       // Pop the stack
+            }
+            while (true) {
+                IntNodeRef node = current.parent.childAtIndex(current.index);
+                if (node.isLeaf())
+                    return node;
+                // If it's an interior node, recurse into its children:
+                assert(depth < kMaxIntDepth);
+                stack[depth++] = current;
+                current = {node, 0};
+            }
+        }
+    };
+
+} }
+
+
+namespace fleece {
+    using namespace hashtree;
+
+
+#pragma mark - INTHASHTREE
+
+
+    const IntHashTree* IntHashTree::fromData(slice data) {
+        return (const IntHashTree*)offsetby(data.end(), -(ssize_t)sizeof(IntInterior));
+    }
+
+    const IntInterior* IntHashTree::rootNode() const {
+        return (const IntInterior*)this;
+    }
+
+    Value IntHashTree::get(uint64_t key) const {
+        inthash_t hash = ComputeIntHash(key);
+        const IntInterior *node = rootNode();
+        while (true) {
+            const IntNode *child = node->childForBitNumber(childBitNumber(hash, 0));
+            if (!child)
+                return nullptr;
+            else if (child->isLeaf())
+                return (child->leaf.key() == key) ? child->leaf.value() : Value();
+            node = &child->interior;
+            hash >>= kBitShift;
+        }
+    }
+
+    unsigned IntHashTree::count() const {
+        return leafCount(rootNode());
+    }
+
+    void IntHashTree::dump(ostream &out) const {
+        out << "IntHashTree [\n";
+        hashtree::dump(out, rootNode(), 1);
+        out << "]\n";
+    }
+
+
+    IntHashTree::iterator::iterator(const MutableIntHashTree &tree)
+    :iterator(tree.rootNode())
+    { }
+
+    IntHashTree::iterator::iterator(const IntHashTree *tree)
+    :iterator(IntNodeRef(tree->rootNode()))
+    { }
+
+    IntHashTree::iterator::iterator(IntNodeRef root) {
+        if (root) {
+            _impl = make_unique<intIteratorImpl>(root);
+            load(_impl->next());
+        }
+    }
+
+    IntHashTree::iterator::iterator(iterator&&) =default;
+    IntHashTree::iterator::~iterator() =default;
+
+    void IntHashTree::iterator::load(IntNodeRef leaf) {
+        if (leaf) {
+            _key = leaf.key();
+            _value = leaf.value();
+        } else {
+            _key = 0;
+            _value = nullptr;
+        }
+    }
+
+    IntHashTree::iterator& IntHashTree::iterator::operator++() {
+        load(_impl->next());
+        return *this;
+    }
+
+
+#pragma mark - MUTABLEINTHASHTREE
+
+
+    MutableIntHashTree::MutableIntHashTree()
+    { }
+
+    MutableIntHashTree::MutableIntHashTree(const IntHashTree *tree)
+    :_imRoot(tree)
+    { }
+
+    // The nodes' memory is freed in bulk when `_arena` is destructed.
+    MutableIntHashTree::~MutableIntHashTree() {
+        if (_root)
+            _root->destroyLeaves();
+    }
+
+    MutableIntHashTree& MutableIntHashTree::operator= (MutableIntHashTree &&other) noexcept {
+        _imRoot = other._imRoot;
+        if (_root)
+            _root->destroyLeaves();
+        _root = other._root;
+        _arena = std::move(other._arena);
+        other._imRoot = nullptr;
+        other._root = nullptr;
+        return *this;
+    }
+
+    MutableIntHashTree& MutableIntHashTree::operator= (const IntHashTree *imTree) {
+        _imRoot = imTree;
+        if (_root)
+            _root->deleteTree(*_arena);
+        _root = nullptr;
+        return *this;
+    }
+
+    IntNodeRef MutableIntHashTree::rootNode() const {
+        if (_root)
+            return _root;
+        else if (_imRoot)
+            return _imRoot->rootNode();
+        else
+            return {};
+    }
+
+    NodeArena& MutableIntHashTree::arena() {
+        if (!_arena)
+            _arena = make_unique<NodeArena>();
+        return *_arena;
+    }
+
+    MutableIntInterior* MutableIntHashTree::writableRoot() {
+        if (!_root)
+            _root = MutableIntInterior::newRoot(_imRoot, arena());
+        return _root;
+    }
+
+    unsigned MutableIntHashTree::count() const {
+        IntNodeRef root = rootNode();
+        return root ? leafCount(root) : 0;
+    }
+
+    Value MutableIntHashTree::get(uint64_t key) const {
+        IntNodeRef root = rootNode();
+        return root ? getFrom(root, key) : Value();
+    }
+
+    bool MutableIntHashTree::insert(uint64_t key, const InsertCallback &callback) {
+        auto result = writableRoot()->insert(key, ComputeIntHash(key), 0, callback, *_arena);
+        if (!result)
+            return false;
+        _root = result;
+        return true;
+    }
+
+    void MutableIntHashTree::set(uint64_t key, Value val) {
+        if (val)
+            insert(key, [=](Value){ return val; });
+        else
+            remove(key);
+    }
+
+    bool MutableIntHashTree::remove(uint64_t key) {
+        if (!_root && !_imRoot)
+            return false;
+        return writableRoot()->remove(key, ComputeIntHash(key), 0, *_arena);
+    }
+
+    uint32_t MutableIntHashTree::writeTo(Encoder &enc) {
+        if (_root)
+            return _root->writeRootTo(enc);
+        // (If writing throws, the arena still frees the temporary root eventually.)
+        MutableIntInterior *tempRoot = MutableIntInterior::newRoot(_imRoot, arena());
+        auto pos = tempRoot->writeRootTo(enc);
+        MutableIntInterior::freeNode(tempRoot, *_arena);
+        return pos;
+    }
+
+    void MutableIntHashTree::dump(std::ostream &out) {
+        if (_imRoot && !_root) {
+            _imRoot->dump(out);
+        } else {
+            out << "MutableIntHashTree {";
+            if (_root) {
+                out << "\n";
+                hashtree::dump(out, _root, 1);
+            }
+            out << "}\n";
+        }
+    }
+
+}
@@ -0,0 +1,123 @@
+//
+// IntHashTree.hh
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#pragma once
+#include "fleece/slice.hh"
+#include "fleece/Fleece.hh"
+#include <functional>
+#include <memory>
+
+namespace fleece {
+
+    class MutableIntHashTree;
+
+    namespace hashtree {
+        class IntInterior;
+        class IntNodeRef;
+        class MutableIntInterior;
+        class NodeArena;
+        struct intIteratorImpl;
+    }
+
+
+    /** The root of an immutable tree encoded alongside Fleece data, like \ref HashTree but
+        with 64-bit integer keys, such as numeric document IDs. Each key is stored in its leaf
+        node, instead of as a string Value, and the tree is indexed by a mix of the key's bits
+        instead of a string hash; so it's smaller, and lookups don't hash or compare strings.
+        The mix is one-to-one, so unlike string keys, no two keys ever have the same hash. */
+    class IntHashTree {
+    public:
+        static const IntHashTree* fromData(slice data);
+
+        Value get(uint64_t key) const;
+
+        unsigned count() const;
+
+        void dump(std::ostream &out) const;
+
+
+        class iterator {
+        public:
+            iterator(const MutableIntHashTree&);
+            iterator(const IntHashTree*);
+            iterator(iterator&&);
+            ~iterator();
+            uint64_t key() const noexcept                   {return _key;}
+            Value value() const noexcept                    {return _value;}
+            explicit operator bool() const noexcept         {return !!_value;}
+            iterator& operator ++();
+        private:
+            iterator(hashtree::IntNodeRef);
+            void load(hashtree::IntNodeRef leaf);
+            std::unique_ptr<hashtree::intIteratorImpl> _impl;
+            uint64_t _key {0};
+            Value _value;
+        };
+
+    private:
+        const hashtree::IntInterior* rootNode() const;
+
+        friend class hashtree::MutableIntInterior;
+        friend class MutableIntHashTree;
+    };
+
+
+    /** A mutable tree with 64-bit integer keys, which can be written as an \ref IntHashTree.
+        It works like \ref MutableHashTree, including writing only the changed paths when the
+        Encoder is amending the data the tree was read from. */
+    class MutableIntHashTree {
+    public:
+        MutableIntHashTree();
+        MutableIntHashTree(const IntHashTree*);
+        ~MutableIntHashTree();
+
+        MutableIntHashTree& operator= (MutableIntHashTree&&) noexcept;
+        MutableIntHashTree& operator= (const IntHashTree*);
+
+        Value get(uint64_t key) const;
+
+        unsigned count() const;
+
+        bool isChanged() const                  {return _root != nullptr;}
+
+        using InsertCallback = std::function<Value(Value)>;
+
+        void set(uint64_t key, Value);
+        bool insert(uint64_t key, const InsertCallback&);
+        bool remove(uint64_t key);
+
+        /** Writes the tree, returning the position of the root node. */
+        uint32_t writeTo(Encoder&);
+
+        void dump(std::ostream &out);
+
+        using iterator = IntHashTree::iterator;
+
+    private:
+        hashtree::IntNodeRef rootNode() const;
+        hashtree::MutableIntInterior* writableRoot();
+        hashtree::NodeArena& arena();
+
+        const IntHashTree* _imRoot {nullptr};
+        hashtree::MutableIntInterior* _root {nullptr};
+        std::unique_ptr<hashtree::NodeArena> _arena;            // Allocates nodes; created lazily
+
+        friend class IntHashTree::iterator;
+    };
+
+}
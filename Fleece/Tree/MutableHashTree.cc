@@ -10,11 +10,14 @@
 #include "HashTree+Internal.hh"
 #include "NodeRef.hh"
 #include "MutableNode.hh"
+#include "NodeArena.hh"
 #include "fleece/Mutable.hh"
 #include "Bitmap.hh"
+#include "Executor.hh"
 #include "HeapArray.hh"
 #include "HeapDict.hh"
 #include <algorithm>
+#include <atomic>
 #include <ostream>
 #include <string>
 #include "betterassert.hh"
@@ -26,6 +29,69 @@ namespace fleece {
     using namespace hashtree;
 
 
+    namespace hashtree {
+
+        // The state shared by a MutableHashTree and its Snapshots, for a simple form of
+        // epoch-based reclamation. A Snapshot registers itself in the counter for the current
+        // epoch (checking that the epoch didn't change meanwhile) before reading the root.
+        // Nodes the writer replaces are freed two epochs later: the epoch advances only when
+        // the previous epoch's readers are gone, so once it's advanced twice, no Snapshot that
+        // could have seen them is left. Neither side ever waits for the other.
+        struct SnapshotState {
+            atomic<MutableInterior*> published {nullptr};
+            atomic<uint64_t> epoch {0};
+            atomic<int32_t> readers[2] {};
+            vector<MutableNode*> replaced[2];       // Nodes replaced during even & odd epochs
+            NodeArena &arena;                       // The tree's; only the writer frees nodes
+
+            explicit SnapshotState(NodeArena &a)
+            :arena(a)
+            { }
+
+            ~SnapshotState() {
+                freeNodes(replaced[0]);
+                freeNodes(replaced[1]);
+            }
+
+            void freeNodes(vector<MutableNode*> &nodes) {
+                for (auto node : nodes)
+                    MutableInterior::freeNode(node, arena);
+                nodes.clear();
+            }
+
+            unsigned enter() noexcept {
+                while (true) {
+                    uint64_t e = epoch.load();
+                    auto slot = unsigned(e & 1);
+                    ++readers[slot];
+                    if (_usuallyTrue(epoch.load() == e))
+                        return slot;
+                    --readers[slot];            // The epoch changed, so try again
+                }
+            }
+
+            void exit(unsigned slot) noexcept {
+                --readers[slot];
+            }
+
+            void publish(MutableInterior *root, const vector<MutableNode*> &nodes) {
+                published.store(root);
+                uint64_t e = epoch.load();
+                auto &current = replaced[e & 1];
+                current.insert(current.end(), nodes.begin(), nodes.end());
+                // The other list has the nodes replaced during the previous epoch. If none of
+                // its readers are left, free them and start the next epoch:
+                auto prev = unsigned((e + 1) & 1);
+                if (readers[prev].load() == 0) {
+                    freeNodes(replaced[prev]);
+                    epoch.store(e + 1);
+                }
+            }
+        };
+
+    }
+
+
     MutableHashTree::MutableHashTree()
     { }
 
@@ -33,16 +99,19 @@ namespace fleece {
     :_imRoot(tree)
     { }
 
+    // The nodes' memory is freed in bulk when `_arena` is destructed, after `_snapshots`.
     MutableHashTree::~MutableHashTree() {
         if (_root)
-            _root->deleteTree();
+            _root->destroyLeaves();
     }
 
     MutableHashTree& MutableHashTree::operator= (MutableHashTree &&other) noexcept {
         _imRoot = other._imRoot;
         if (_root)
-            _root->deleteTree();
+            _root->destroyLeaves();
         _root = other._root;
+        _snapshots = std::move(other._snapshots);   // (Frees its nodes into the old arena)
+        _arena = std::move(other._arena);
         other._imRoot = nullptr;
         other._root = nullptr;
         return *this;
@@ -51,8 +120,10 @@ namespace fleece {
     MutableHashTree& MutableHashTree::operator= (const HashTree *imTree) {
         _imRoot = imTree;
         if (_root)
-            _root->deleteTree();
+            _root->deleteTree(*_arena);
         _root = nullptr;
+        if (_snapshots)
+            _snapshots->published = nullptr;
         return *this;
     }
 
@@ -74,33 +145,63 @@ namespace fleece {
             return {};
     }
 
-    Value MutableHashTree::get(slice key) const {
-        if (_root) {
-            Target target(key);
-            NodeRef leaf = _root->findNearest(target.hash);
-            if (leaf) {
-                if (leaf.isMutable()) {
-                    auto mleaf = (MutableLeaf*)leaf.asMutable();
-                    if (mleaf->matches(target))
-                        return mleaf->_value;
-                } else {
-                    if (leaf.asImmutable()->leaf.matches(key))
-                        return leaf.asImmutable()->leaf.value();
-                }
+    static Value getFrom(const MutableInterior *root, slice key) {
+        Target target(key);
+        NodeRef leaf = root->findNearest(target.hash);
+        if (leaf) {
+            if (leaf.isMutable()) {
+                auto mleaf = (MutableLeaf*)leaf.asMutable();
+                if (mleaf->matches(target))
+                    return mleaf->_value;
+            } else {
+                if (leaf.asImmutable()->leaf.matches(key))
+                    return leaf.asImmutable()->leaf.value();
             }
-        } else if (_imRoot) {
-            return _imRoot->get(key);
         }
         return nullptr;
     }
 
-    bool MutableHashTree::insert(slice key, InsertCallback callback) {
+    Value MutableHashTree::get(slice key) const {
+        if (_root)
+            return getFrom(_root, key);
+        else if (_imRoot)
+            return _imRoot->get(key);
+        return nullptr;
+    }
+
+    // Returns the root to change: a copy of the path to `hash` if readers may be using the
+    // current root, otherwise the root itself.
+    MutableInterior* MutableHashTree::writableRoot(hash_t hash, NodeList &replaced) {
         if (!_root)
-            _root = MutableInterior::newRoot(_imRoot);
-        auto result = _root->insert(Target(key, &callback), 0);
-        if (!result)
+            _root = MutableInterior::newRoot(_imRoot, arena());
+        else if (_snapshots && _snapshots->published.load() == _root)
+            return _root->copyPath(hash, replaced, *_arena);
+        return _root;
+    }
+
+    void MutableHashTree::publish(NodeList &replaced) {
+        if (_snapshots)
+            _snapshots->publish(_root, replaced);
+    }
+
+    NodeArena& MutableHashTree::arena() {
+        if (!_arena)
+            _arena = make_unique<NodeArena>();
+        return *_arena;
+    }
+
+    bool MutableHashTree::insert(slice key, InsertCallback callback) {
+        Target target(key, &callback);
+        NodeList replaced;
+        MutableInterior *root = writableRoot(target.hash, replaced);
+        auto result = root->insert(target, 0, *_arena);
+        if (!result) {
+            if (root != _root)
+                root->deletePath(target.hash, *_arena);
             return false;
+        }
         _root = result;
+        publish(replaced);
         return true;
     }
 
@@ -112,12 +213,121 @@ namespace fleece {
     }
 
     bool MutableHashTree::remove(slice key) {
-        if (!_root) {
-            if (!_imRoot)
-                return false;
-            _root = MutableInterior::newRoot(_imRoot);
+        if (!_root && !_imRoot)
+            return false;
+        Target target(key);
+        NodeList replaced;
+        MutableInterior *root = writableRoot(target.hash, replaced);
+        if (!root->remove(target, 0, *_arena)) {
+            if (root != _root)
+                root->deletePath(target.hash, *_arena);
+            return false;
+        }
+        _root = root;
+        publish(replaced);
+        return true;
+    }
+
+
+    void MutableHashTree::enableSnapshots() {
+        if (!_snapshots) {
+            _snapshots = make_unique<SnapshotState>(arena());
+            _snapshots->published = _root;
+        }
+    }
+
+
+    MutableHashTree::Snapshot::Snapshot(const MutableHashTree &tree)
+    :_state(tree._snapshots.get())
+    ,_imRoot(tree._imRoot)
+    {
+        assert_precondition(_state);
+        _slot = _state->enter();
+        _root = _state->published.load();
+    }
+
+    MutableHashTree::Snapshot::~Snapshot() {
+        _state->exit(_slot);
+    }
+
+    Value MutableHashTree::Snapshot::get(slice key) const {
+        if (_root)
+            return getFrom(_root, key);
+        else if (_imRoot)
+            return _imRoot->get(key);
+        return nullptr;
+    }
+
+    unsigned MutableHashTree::Snapshot::count() const {
+        if (_root)
+            return _root->leafCount();
+        else if (_imRoot)
+            return _imRoot->count();
+        return 0;
+    }
+
+
+    // Batches smaller than this are inserted by \ref setMany on a single thread.
+    static constexpr size_t kMinParallelItems = 1000;
+
+    void MutableHashTree::setMany(const vector<KeyValue> &items, unsigned nThreads) {
+        nThreads = Executor::resolveThreads(nThreads);
+        if (nThreads < 2 || items.size() < kMinParallelItems || _snapshots) {
+            for (auto &item : items) {
+                assert_precondition(item.second);
+                set(item.first, item.second);
+            }
+            return;
+        }
+
+        // Partition the items by which child of the root they belong to:
+        vector<uint32_t> buckets[kMaxChildren];
+        for (uint32_t i = 0; i < items.size(); ++i) {
+            assert_precondition(items[i].second);
+            buckets[ComputeHash(items[i].first) & (kMaxChildren - 1)].push_back(i);
+        }
+
+        // Adding a child can reallocate the root, so insert each bucket's first item serially.
+        // After that, each insertion only changes its own child of the root, so the buckets can
+        // be inserted concurrently. Each task allocates from its own arena, which the tree's
+        // arena then takes over:
+        for (auto &bucket : buckets) {
+            if (!bucket.empty())
+                set(items[bucket[0]].first, items[bucket[0]].second);
         }
-        return _root->remove(Target(key), 0);
+        MutableInterior *root = _root;
+        vector<NodeArena> arenas(nThreads);
+        Executor::parallelFor(nThreads, nThreads, [&](size_t t) {
+            Value value;
+            InsertCallback callback = [&](Value) {return value;};
+            for (size_t b = kMaxChildren * t / nThreads;
+                        b < kMaxChildren * (t + 1) / nThreads; ++b) {
+                for (size_t i = 1; i < buckets[b].size(); ++i) {
+                    auto &item = items[buckets[b][i]];
+                    value = item.second;
+                    root->insert(Target(item.first, &callback), 0, arenas[t]);
+                }
+            }
+        });
+        for (auto &threadArena : arenas)
+            _arena->adopt(threadArena);
+    }
+
+
+    void MutableHashTree::merge(const HashTree *other, const MergeCallback &onConflict) {
+        if (!other || other->count() == 0)
+            return;
+        NodeList replaced;
+        MutableInterior::Merger m {(onConflict ? &onConflict : nullptr),
+                                   (_snapshots ? &replaced : nullptr),
+                                   arena()};
+        MutableInterior *root;
+        if (_root)
+            root = m.writable(_root);
+        else
+            root = MutableInterior::newRoot(_imRoot, m.arena);
+        _root = root->merge(other->rootNode(), 0, m);
+        publish(replaced);
     }
 
 
@@ -145,17 +355,83 @@ namespace fleece {
         return result;
     }
 
-    uint32_t MutableHashTree::writeTo(Encoder &enc) {
+    uint32_t MutableHashTree::writeTo(Encoder &enc, unsigned nThreads, bool sortedIndex,
+                                      bool bloomFilter)
+    {
         if (_root) {
-            return _root->writeRootTo(enc);
+            return _root->writeRootTo(enc, nThreads, sortedIndex, bloomFilter);
         } else if (_imRoot) {
-            unique_ptr<MutableInterior> tempRoot( MutableInterior::newRoot(_imRoot) );
-            return tempRoot->writeRootTo(enc);
+            // (If writing throws, the arena still frees the temporary root eventually.)
+            MutableInterior *tempRoot = MutableInterior::newRoot(_imRoot, arena());
+            auto pos = tempRoot->writeRootTo(enc, nThreads, sortedIndex, bloomFilter);
+            MutableInterior::freeNode(tempRoot, *_arena);
+            return pos;
         } else {
             return 0;
         }
     }
 
+    namespace hashtree {
+
+        bool MutableInterior::writeInteriorChildrenInParallel(Encoder &enc, Node nodes[],
+                                                              unsigned nThreads,
+                                                              LeafPositions *leafPositions)
+        {
+            // Nodes in the base are written as offsets to it, which would be wrong after the
+            // chunks are concatenated, so this only works when writing a tree from scratch:
+            if (enc.base())
+                return false;
+            vector<unsigned> interiors;
+            for (unsigned i = 0; i < childCount(); ++i) {
+                if (!_children[i].isLeaf())
+                    interiors.push_back(i);
+            }
+            nThreads = min(nThreads, unsigned(interiors.size()));
+            if (nThreads < 2)
+                return false;
+
+            // Each task writes a contiguous run of the children into its own chunk:
+            SharedKeys sk = enc.sharedKeys();
+            vector<alloc_slice> chunks(nThreads);
+            vector<LeafPositions> chunkLeaves(nThreads);
+            Executor::parallelFor(nThreads, nThreads, [&](size_t t) {
+                try {
+                    Encoder sub;
+                    sub.setSharedKeys(sk);
+                    sub.suppressTrailer();
+                    for (size_t j = interiors.size() * t / nThreads;
+                                j < interiors.size() * (t + 1) / nThreads; ++j)
+                        nodes[interiors[j]] = _children[interiors[j]].writeTo(sub,
+                                                    (leafPositions ? &chunkLeaves[t] : nullptr));
+                    chunks[t] = sub.finish();
+                } catch (...) { }
+            });
+            for (auto &chunk : chunks) {
+                if (!chunk)
+                    return false;
+            }
+
+            // All offsets within a chunk are relative, so it's still valid when appended to the
+            // output; only the children's absolute positions have to be shifted:
+            for (unsigned t = 0; t < nThreads; ++t) {
+                auto chunkPos = uint32_t(enc.nextWritePos());
+                enc.writeRaw(chunks[t]);
+                for (size_t j = interiors.size() * t / nThreads;
+                            j < interiors.size() * (t + 1) / nThreads; ++j) {
+                    auto &interior = nodes[interiors[j]].interior;
+                    interior = Interior(interior.bitmap(), interior.childrenOffset() + chunkPos);
+                }
+                if (leafPositions) {
+                    for (auto &leaf : chunkLeaves[t])
+                        leafPositions->emplace_back(leaf.first, leaf.second + chunkPos);
+                }
+            }
+            return true;
+        }
+
+    }
+
+
     void MutableHashTree::dump(std::ostream &out) {
         if (_imRoot && !_root) {
             _imRoot->dump(out);
@@ -9,6 +9,8 @@
 #include "fleece/slice.hh"
 #include <functional>
 #include <memory>
+#include <utility>
+#include <vector>
 
 namespace fleece {
     class MutableArray;
@@ -17,7 +19,10 @@ namespace fleece {
 
     namespace hashtree {
         class MutableInterior;
+        class MutableNode;
+        class NodeArena;
         class NodeRef;
+        struct SnapshotState;
     }
 
 
@@ -41,11 +46,83 @@ namespace fleece {
 
         using InsertCallback = std::function<Value(Value)>;
 
+        /** Lets other threads read the tree, through \ref Snapshot, while this one changes it.
+            From then on each change copies the nodes on the path to its leaf, instead of
+            changing them in place, and then publishes the new root atomically; the nodes it
+            replaced are freed once no Snapshot that could see them is left. So readers never
+            wait for the writer, or vice versa.
+            Call this before creating any Snapshot. Values in the tree must not be changed in
+            place while there are readers, so don't use \ref getMutableArray or
+            \ref getMutableDict to change them; \ref setMany inserts on a single thread. */
+        void enableSnapshots();
+
+        /** A consistent, read-only view of a MutableHashTree, as of when it was created, that
+            can be used on any thread while the tree's owner keeps changing it. It's cheap to
+            create: it just registers itself for the current epoch and reads the root pointer.
+            Values it returns are valid until it's destructed. Destruct it promptly, since
+            every node replaced while it exists is kept alive until then.
+            The tree must have had \ref enableSnapshots called, and must outlive the Snapshot. */
+        class Snapshot {
+        public:
+            explicit Snapshot(const MutableHashTree&);
+            ~Snapshot();
+
+            Value get(slice key) const;
+            unsigned count() const;
+
+            Snapshot(const Snapshot&) =delete;
+            Snapshot& operator=(const Snapshot&) =delete;
+        private:
+            hashtree::SnapshotState* _state;
+            unsigned _slot;
+            hashtree::MutableInterior* _root;
+            const HashTree* _imRoot;
+        };
+
         void set(slice key, Value);
         bool insert(slice key, InsertCallback);
         bool remove(slice key);
 
-        uint32_t writeTo(Encoder&);
+        using KeyValue = std::pair<slice, Value>;
+
+        /** Sets many keys at once. The root node's children are independent subtrees, so the
+            pairs are partitioned by the low 5 bits of their keys' hashes and inserted on up to
+            `nThreads` threads (0 means the Executor's concurrency.) Values must be non-null. If a
+            key appears more than once, its last value wins, as with a series of \ref set calls. */
+        void setMany(const std::vector<KeyValue>&, unsigned nThreads =0);
+
+        /** Called by \ref merge for a key that's in both trees, with this tree's value and the
+            other's; it returns the value to keep, which must be non-null. */
+        using MergeCallback = std::function<Value(slice key, Value mine, Value theirs)>;
+
+        /** Adds all the keys of another tree to this one, without visiting each of them: the
+            two trees are walked together, and where only the other tree has a child, that
+            whole subtree is shared rather than copied; only where both have children does the
+            merge descend. So its cost depends on how much the trees overlap, not their size.
+            For keys in both trees, `onConflict` picks the value; by default the other tree's
+            value wins.
+            The other tree's data must remain valid as long as this tree uses it, just as with
+            the HashTree this one was created from. */
+        void merge(const HashTree *other, const MergeCallback &onConflict =nullptr);
+
+        /** Writes the tree, returning the position of the root node. If `nThreads` is more than
+            1, the root's interior children are encoded concurrently into separate buffers; the
+            output is a bit larger since strings aren't shared between those subtrees.
+            If `sortedIndex` is true, an index of the keys in sorted order is written too,
+            adding 4 bytes per key; it enables \ref HashTree::lowerBound and
+            \ref HashTree::withPrefix to be fast.
+            If `bloomFilter` is true, a Bloom filter of the keys is written too, adding about
+            10 bits per key; then \ref HashTree::get usually rejects a missing key after
+            reading a single cache line of it, instead of descending the tree. (About 1% of
+            missing keys get past it.)
+
+            If the Encoder is amending the data this tree was read from (see
+            \ref Encoder::amend), only the nodes on the paths from the root to changed leaves
+            are written; the rest are referenced by offset into the base, so the output is
+            proportional to the number of changes, not the size of the tree. (Except that a
+            sorted index or Bloom filter is always written in full.) */
+        uint32_t writeTo(Encoder&, unsigned nThreads =1, bool sortedIndex =false,
+                         bool bloomFilter =false);
 
         void dump(std::ostream &out);
 
@@ -54,8 +131,15 @@ namespace fleece {
     private:
         hashtree::NodeRef rootNode() const;
 
+        using NodeList = std::vector<hashtree::MutableNode*>;
+        hashtree::MutableInterior* writableRoot(uint32_t hash, NodeList &replaced);
+        void publish(NodeList &replaced);
+        hashtree::NodeArena& arena();
+
         const HashTree* _imRoot {nullptr};
         hashtree::MutableInterior* _root {nullptr};
+        std::unique_ptr<hashtree::NodeArena> _arena;            // Allocates nodes; created lazily
+        std::unique_ptr<hashtree::SnapshotState> _snapshots;    // Set by enableSnapshots()
 
         friend class HashTree::iterator;
     };
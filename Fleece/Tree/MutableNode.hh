@@ -8,12 +8,15 @@
 
 #pragma once
 #include "NodeRef.hh"
+#include "NodeArena.hh"
 #include "PlatformCompat.hh"
 #include "RefCounted.hh"
 #include "fleece/Mutable.hh"
 #include "fleece/slice.hh"
 #include "TempArray.hh"
 #include "betterassert.hh"
+#include <algorithm>
+#include <vector>
 
 namespace fleece { namespace hashtree {
     using namespace std;
@@ -48,7 +51,8 @@ namespace fleece { namespace hashtree {
     };
 
 
-    // A leaf node that holds a single key and value.
+    // A leaf node that holds a single key and value. Allocated from a NodeArena, with
+    // `new (arena) MutableLeaf(...)`, and freed by `destroy`.
     class MutableLeaf : public MutableNode {
     public:
         MutableLeaf(const Target &t, Value v)
@@ -58,6 +62,21 @@ namespace fleece { namespace hashtree {
         ,_value(v)
         { }
 
+        static void* operator new(size_t size, NodeArena &arena) {
+            return arena.allocate(0, size);
+        }
+
+        static void operator delete(void *ptr, NodeArena &arena) {
+            arena.free(ptr, 0);
+        }
+
+        static void operator delete(void*) = delete;
+
+        void destroy(NodeArena &arena) {
+            this->~MutableLeaf();
+            arena.free(this, 0);
+        }
+
         bool matches(Target target) const {
             return _hash == target.hash && _key == target.key;
         }
@@ -88,11 +107,11 @@ namespace fleece { namespace hashtree {
     class MutableInterior : public MutableNode {
     public:
 
-        static MutableInterior* newRoot(const HashTree *imTree) {
+        static MutableInterior* newRoot(const HashTree *imTree, NodeArena &arena) {
             if (imTree)
-                return mutableCopy(imTree->rootNode());
+                return mutableCopy(imTree->rootNode(), arena);
             else
-                return newNode(kMaxChildren);
+                return newNode(arena, kMaxChildren);
         }
 
 
@@ -107,18 +126,34 @@ namespace fleece { namespace hashtree {
         }
 
 
-        void deleteTree() {
+        void deleteTree(NodeArena &arena) {
             unsigned n = childCount();
             for (unsigned i = 0; i < n; ++i) {
                 auto child = _children[i].asMutable();
                 if (child) {
                     if (child->isLeaf())
-                        delete (MutableLeaf*)child;
+                        ((MutableLeaf*)child)->destroy(arena);
                     else
-                        ((MutableInterior*)child)->deleteTree();
+                        ((MutableInterior*)child)->deleteTree(arena);
+                }
+            }
+            freeNode(this, arena);
+        }
+
+
+        // Destructs the leaves of the tree, but leaves all the nodes' memory to be freed in
+        // bulk by their NodeArena.
+        void destroyLeaves() {
+            unsigned n = childCount();
+            for (unsigned i = 0; i < n; ++i) {
+                auto child = _children[i].asMutable();
+                if (child) {
+                    if (child->isLeaf())
+                        ((MutableLeaf*)child)->~MutableLeaf();
+                    else
+                        ((MutableInterior*)child)->destroyLeaves();
                 }
             }
-            delete this;
         }
 
 
@@ -162,7 +197,7 @@ namespace fleece { namespace hashtree {
 
         // Recursive insertion method. On success returns either 'this', or a new node that
         // replaces 'this'. On failure (i.e. callback returned nullptr) returns nullptr.
-        MutableInterior* insert(const Target &target, unsigned shift) {
+        MutableInterior* insert(const Target &target, unsigned shift, NodeArena &arena) {
             assert_precondition(shift + kBitShift < 8*sizeof(hash_t));//FIX: //TODO: Handle hash collisions
             unsigned bitNo = childBitNumber(target.hash, shift);
             if (!hasChild(bitNo)) {
@@ -170,7 +205,7 @@ namespace fleece { namespace hashtree {
                 Value val = (*target.insertCallback)(nullptr);
                 if (!val)
                     return nullptr;
-                return addChild(bitNo, new MutableLeaf(target, val));
+                return addChild(bitNo, new (arena) MutableLeaf(target, val), arena);
             }
             NodeRef &childRef = childForBitNumber(bitNo);
             if (childRef.isLeaf()) {
@@ -182,14 +217,14 @@ namespace fleece { namespace hashtree {
                     if (childRef.isMutable())
                         ((MutableLeaf*)childRef.asMutable())->_value = val;
                     else
-                        childRef = new MutableLeaf(target, val);
+                        childRef = new (arena) MutableLeaf(target, val);
                     return this;
                 } else {
                     // Nope, need to promote the leaf to an interior node & add new key:
-                    MutableInterior *node = promoteLeaf(childRef, shift);
-                    auto insertedNode = node->insert(target, shift+kBitShift);
+                    MutableInterior *node = promoteLeaf(childRef, shift, arena);
+                    auto insertedNode = node->insert(target, shift+kBitShift, arena);
                     if (!insertedNode) {
-                        delete node;
+                        freeNode(node, arena);
                         return nullptr;
                     }
                     childRef = insertedNode;
@@ -199,8 +234,8 @@ namespace fleece { namespace hashtree {
                 // Progress down to interior node...
                 auto child = (MutableInterior*)childRef.asMutable();
                 if (!child)
-                    child = mutableCopy(&childRef.asImmutable()->interior, 1);
-                child = child->insert(target, shift+kBitShift);
+                    child = mutableCopy(&childRef.asImmutable()->interior, arena, 1);
+                child = child->insert(target, shift+kBitShift, arena);
                 if (child)
                     childRef = child;
                 //FIX: This can leak if child is created by mutableCopy, but then
@@ -209,7 +244,7 @@ namespace fleece { namespace hashtree {
         }
 
 
-        bool remove(Target target, unsigned shift) {
+        bool remove(Target target, unsigned shift, NodeArena &arena) {
             assert_precondition(shift + kBitShift < 8*sizeof(hash_t));
             unsigned bitNo = childBitNumber(target.hash, shift);
             if (!hasChild(bitNo))
@@ -220,7 +255,8 @@ namespace fleece { namespace hashtree {
                 // Child is a leaf -- is it the right key?
                 if (childRef.matches(target)) {
                     removeChild(bitNo, childIndex);
-                    delete (MutableLeaf*)childRef.asMutable();
+                    if (childRef.isMutable())
+                        ((MutableLeaf*)childRef.asMutable())->destroy(arena);
                     return true;
                 } else {
                     return false;
@@ -229,25 +265,178 @@ namespace fleece { namespace hashtree {
                 // Recurse into child node...
                 auto child = (MutableInterior*)childRef.asMutable();
                 if (child) {
-                    if (!child->remove(target, shift+kBitShift))
+                    if (!child->remove(target, shift+kBitShift, arena))
                         return false;
                 } else {
-                    child = mutableCopy(&childRef.asImmutable()->interior);
-                    if (!child->remove(target, shift+kBitShift)) {
-                        delete child;
+                    child = mutableCopy(&childRef.asImmutable()->interior, arena);
+                    if (!child->remove(target, shift+kBitShift, arena)) {
+                        freeNode(child, arena);
                         return false;
                     }
                     _children[childIndex] = child;
                 }
                 if (child->_bitmap.empty()) {
                     removeChild(bitNo, childIndex);     // child node is now empty, so remove it
-                    delete child;
+                    freeNode(child, arena);
                 }
                 return true;
             }
         }
 
 
+        // Replaces this node, and the mutable nodes below it on the path to `hash`, with copies,
+        // adding the originals to `replaced`; then the copies can be changed in place without
+        // affecting anyone still reading the originals. Returns the copy of this node.
+        MutableInterior* copyPath(hash_t hash, vector<MutableNode*> &replaced, NodeArena &arena,
+                                  unsigned shift =0) {
+            auto copy = newNode(arena, capacity(), this);
+            replaced.push_back(this);
+            unsigned bitNo = childBitNumber(hash, shift);
+            if (hasChild(bitNo)) {
+                NodeRef &childRef = copy->childForBitNumber(bitNo);
+                if (auto child = childRef.asMutable(); child) {
+                    if (child->isLeaf()) {
+                        replaced.push_back(child);
+                        childRef = new (arena) MutableLeaf(*(MutableLeaf*)child);
+                    } else {
+                        childRef = ((MutableInterior*)child)->copyPath(hash, replaced, arena,
+                                                                      shift + kBitShift);
+                    }
+                }
+            }
+            return copy;
+        }
+
+
+        // Deletes the copies made by `copyPath`, if the change to them is abandoned.
+        void deletePath(hash_t hash, NodeArena &arena, unsigned shift =0) {
+            unsigned bitNo = childBitNumber(hash, shift);
+            if (hasChild(bitNo)) {
+                if (auto child = childForBitNumber(bitNo).asMutable(); child) {
+                    if (child->isLeaf())
+                        ((MutableLeaf*)child)->destroy(arena);
+                    else
+                        ((MutableInterior*)child)->deletePath(hash, arena, shift + kBitShift);
+                }
+            }
+            freeNode(this, arena);
+        }
+
+
+        // State of a `merge`.
+        struct Merger {
+            const MutableHashTree::MergeCallback *onConflict;      // May be null
+            vector<MutableNode*> *replaced;     // If non-null, nodes may be in use by readers
+            NodeArena &arena;
+
+            // Returns a node of the tree being merged into that can be changed in place.
+            MutableInterior* writable(MutableInterior *node) {
+                if (!replaced)
+                    return node;
+                replaced->push_back(node);
+                return newNode(arena, node->capacity(), node);
+            }
+
+            // Disposes of a node of the tree being merged into that's no longer in it.
+            void retire(MutableNode *node) {
+                if (replaced)
+                    replaced->push_back(node);
+                else
+                    freeNode(node, arena);
+            }
+        };
+
+
+        // Merges the children of another tree's node into me, at depth `shift`. I must be
+        // writable. Returns either 'this' or a new node that replaces 'this'.
+        MutableInterior* merge(const Interior *other, unsigned shift, Merger &m) {
+            MutableInterior *node = this;
+            for (unsigned bitNo = 0; bitNo < kMaxChildren; ++bitNo) {
+                if (!other->hasChild(bitNo))
+                    continue;
+                NodeRef theirs(other->childForBitNumber(bitNo));
+                if (!node->hasChild(bitNo)) {
+                    node = node->addChild(bitNo, theirs, m.arena);  // Share their whole subtree
+                } else {
+                    NodeRef &mine = node->childForBitNumber(bitNo);
+                    mine = mergeNodes(mine, theirs, shift + kBitShift, m);
+                }
+            }
+            return node;
+        }
+
+
+        // Returns the merger of two nodes in the same slot, whose children are at depth
+        // `shift`. `mine` is from the tree being merged into; `theirs` is immutable.
+        static NodeRef mergeNodes(NodeRef mine, NodeRef theirs, unsigned shift, Merger &m) {
+            if (mine.isLeaf()) {
+                if (theirs.isLeaf()) {
+                    if (mine.keyString() == theirs.keyString())
+                        return mergeLeaves(mine, theirs, m);
+                    MutableInterior *node = promoteLeaf(mine, shift - kBitShift, m.arena);
+                    return node->placeLeaf(theirs, true, shift, m);
+                } else {
+                    auto node = mutableCopy(&theirs.asImmutable()->interior, m.arena, 1);
+                    return node->placeLeaf(mine, false, shift, m);
+                }
+            } else {
+                MutableInterior *node;
+                if (auto mchild = mine.asMutable(); mchild)
+                    node = m.writable((MutableInterior*)mchild);
+                else
+                    node = mutableCopy(&mine.asImmutable()->interior, m.arena,
+                                       theirs.isLeaf() ? 1 : theirs.childCount());
+                if (theirs.isLeaf())
+                    return node->placeLeaf(theirs, true, shift, m);
+                else
+                    return node->merge(&theirs.asImmutable()->interior, shift, m);
+            }
+        }
+
+
+        // Adds a leaf from one tree to me, a node of (or copied from) the other tree.
+        MutableInterior* placeLeaf(NodeRef leaf, bool leafIsTheirs, unsigned shift, Merger &m) {
+            assert_precondition(shift + kBitShift < 8*sizeof(hash_t));//TODO: Handle hash collisions
+            unsigned bitNo = childBitNumber(leaf.hash(), shift);
+            if (!hasChild(bitNo))
+                return addChild(bitNo, leaf, m.arena);
+            NodeRef &child = childForBitNumber(bitNo);
+            if (leafIsTheirs)
+                child = mergeNodes(child, leaf, shift + kBitShift, m);
+            else
+                child = mergeNodes(leaf, child, shift + kBitShift, m);
+            return this;
+        }
+
+
+        // Resolves a key that's in both trees.
+        static NodeRef mergeLeaves(NodeRef mine, NodeRef theirs, Merger &m) {
+            Value myValue = mine.value(), theirValue = theirs.value();
+            Value value = theirValue;
+            if (m.onConflict) {
+                value = (*m.onConflict)(mine.keyString(), myValue, theirValue);
+                assert_postcondition(value);
+            }
+            if (value == myValue)
+                return mine;
+            NodeRef result = theirs;
+            if (value != theirValue)
+                result = new (m.arena) MutableLeaf(Target(theirs.keyString()), value);
+            if (mine.isMutable())
+                m.retire(mine.asMutable());
+            return result;
+        }
+
+
+        // Deletes a single node that's been replaced; its children belong to its replacement.
+        static void freeNode(MutableNode *node, NodeArena &arena) {
+            if (node->isLeaf())
+                ((MutableLeaf*)node)->destroy(arena);
+            else
+                arena.free(node, ((MutableInterior*)node)->capacity());
+        }
+
+
         static offset_t encodeImmutableOffset(const Node *inode, offset_t off, const Encoder &enc) {
             ssize_t o = (((char*)inode - (char*)enc.base().buf) - off) - enc.base().size;
             assert(o < 0 && o > INT32_MIN);
@@ -255,7 +444,9 @@ namespace fleece { namespace hashtree {
         }
 
 
-        Interior writeTo(Encoder &enc) {
+        Interior writeTo(Encoder &enc, unsigned nThreads =1,
+                         LeafPositions *leafPositions =nullptr)
+        {
             unsigned n = childCount();
 
             // `nodes` is an in-memory staging area for the child nodes I'll write.
@@ -265,9 +456,12 @@ namespace fleece { namespace hashtree {
 
             // Write interior nodes, then leaf node Values, then leaf node keys.
             // This keeps the keys near me, for better locality of reference.
-            for (unsigned i = 0; i < n; ++i) {
-                if (!_children[i].isLeaf())
-                    nodes[i] = _children[i].writeTo(enc);
+            if (nThreads < 2
+                    || !writeInteriorChildrenInParallel(enc, nodes, nThreads, leafPositions)) {
+                for (unsigned i = 0; i < n; ++i) {
+                    if (!_children[i].isLeaf())
+                        nodes[i] = _children[i].writeTo(enc, leafPositions);
+                }
             }
             for (unsigned i = 0; i < n; ++i) {
                 if (_children[i].isLeaf())
@@ -283,10 +477,13 @@ namespace fleece { namespace hashtree {
             auto curPos = childrenPos;
             for (unsigned i = 0; i < n; ++i) {
                 auto &node = nodes[i];
-                if (_children[i].isLeaf())
+                if (_children[i].isLeaf()) {
                     node.leaf.makeRelativeTo(curPos);
-                else
+                    if (leafPositions)
+                        leafPositions->emplace_back(_children[i].keyString(), curPos);
+                } else {
                     node.interior.makeRelativeTo(curPos);
+                }
                 curPos += sizeof(nodes[i]);
             }
 
@@ -296,8 +493,56 @@ namespace fleece { namespace hashtree {
         }
 
 
-        offset_t writeRootTo(Encoder &enc) {
-            auto intNode = writeTo(enc);
+        // Encodes my interior children on up to `nThreads` threads, each into its own Encoder,
+        // then appends those to `enc`. Returns false (having written nothing) if it can't.
+        // Defined in MutableHashTree.cc.
+        bool writeInteriorChildrenInParallel(Encoder &enc, Node nodes[], unsigned nThreads,
+                                             LeafPositions *leafPositions);
+
+
+        // Adds the hashes of all the leaves under me to `hashes`.
+        void getHashes(vector<hash_t> &hashes) const {
+            unsigned n = childCount();
+            for (unsigned i = 0; i < n; ++i) {
+                NodeRef child = _children[i];
+                if (child.isLeaf()) {
+                    hashes.push_back(child.hash());
+                } else if (child.isMutable()) {
+                    ((const MutableInterior*)child.asMutable())->getHashes(hashes);
+                } else if (child.childCount() > 0) {
+                    vector<const Leaf*> leaves;
+                    child.asImmutable()->interior.getLeaves(leaves);
+                    for (auto leaf : leaves)
+                        hashes.push_back(leaf->hash());
+                }
+            }
+        }
+
+
+        offset_t writeRootTo(Encoder &enc, unsigned nThreads =1, bool sortedIndex =false,
+                             bool bloomFilter =false) {
+            LeafPositions leaves;
+            auto intNode = writeTo(enc, nThreads, (sortedIndex ? &leaves : nullptr));
+            alloc_slice filter;
+            if (bloomFilter) {
+                vector<hash_t> hashes;
+                getHashes(hashes);
+                filter = BloomFilter::encode(hashes);
+            }
+            if (sortedIndex && !leaves.empty()) {
+                // Write the offsets of the leaves, sorted by key, between my children and me.
+                // Readers detect this index by the gap it leaves; see HashTree::sortedIterator.
+                sort(leaves.begin(), leaves.end());
+                auto rootPos = offset_t(enc.nextWritePos() + leaves.size() * sizeof(uint32_t)
+                                        + filter.size);
+                std::vector<endian::uint32_le> index;
+                index.reserve(leaves.size());
+                for (auto &leaf : leaves)
+                    index.emplace_back(uint32_t(rootPos - leaf.second));
+                enc.writeRaw({index.data(), index.size() * sizeof(index[0])});
+            }
+            if (filter)
+                enc.writeRaw(filter);       // Goes after the index, right before me
             auto curPos = (offset_t)enc.nextWritePos();
             intNode.makeRelativeTo(curPos);
             enc.writeRaw({&intNode, sizeof(intNode)});
@@ -315,42 +560,43 @@ namespace fleece { namespace hashtree {
             out << " }";
         }
 
-        static void operator delete(void* ptr) {
-            ::operator delete(ptr);
-        }
-
     private:
         MutableInterior() = delete;
         MutableInterior(const MutableInterior& i) = delete;
         MutableInterior(MutableInterior&& i) = delete;
         MutableInterior& operator=(const MutableInterior&) = delete;
 
-        static MutableInterior* newNode(unsigned capacity, MutableInterior *orig =nullptr) {
-            return new (capacity) MutableInterior(capacity, orig);
+        // Nodes are allocated from a NodeArena, whose size class for them is their capacity.
+        static MutableInterior* newNode(NodeArena &arena, unsigned capacity,
+                                        MutableInterior *orig =nullptr) {
+            return new (arena, capacity) MutableInterior(capacity, orig);
         }
 
-        static void* operator new(size_t size, unsigned capacity) {
-            return ::operator new(size + capacity*sizeof(NodeRef));
+        static void* operator new(size_t size, NodeArena &arena, unsigned capacity) {
+            return arena.allocate(capacity, size + capacity*sizeof(NodeRef));
         }
 
-        static void operator delete(void* ptr, unsigned capacity) {
-            ::operator delete(ptr);
+        static void operator delete(void* ptr, NodeArena &arena, unsigned capacity) {
+            arena.free(ptr, capacity);
         }
 
-        static MutableInterior* mutableCopy(const Interior *iNode, unsigned extraCapacity =0) {
+        static void operator delete(void*) = delete;
+
+        static MutableInterior* mutableCopy(const Interior *iNode, NodeArena &arena,
+                                            unsigned extraCapacity =0) {
             auto childCount = iNode->childCount();
-            auto node = newNode(childCount + extraCapacity);
+            auto node = newNode(arena, std::min(childCount + extraCapacity, unsigned(kMaxChildren)));
             node->_bitmap = asBitmap(iNode->bitmap());
             for (unsigned i = 0; i < childCount; ++i)
                 node->_children[i] = NodeRef(iNode->childAtIndex(i));
             return node;
         }
 
-        static MutableInterior* promoteLeaf(NodeRef& childLeaf, unsigned shift) {
+        static MutableInterior* promoteLeaf(NodeRef& childLeaf, unsigned shift, NodeArena &arena) {
             unsigned level = shift / kBitShift;
-            MutableInterior* node = newNode(2 + (level<1) + (level<3));
+            MutableInterior* node = newNode(arena, 2 + (level<1) + (level<3));
             unsigned childBitNo = childBitNumber(childLeaf.hash(), shift+kBitShift);
-            node = node->addChild(childBitNo, childLeaf);
+            node = node->addChild(childBitNo, childLeaf, arena);
             return node;
         }
 
@@ -358,20 +604,21 @@ namespace fleece { namespace hashtree {
         :MutableNode(cap)
         ,_bitmap(orig ? orig->_bitmap : Bitmap<bitmap_t>{})
         {
-            if (orig)
-                memcpy(_children, orig->_children, orig->capacity()*sizeof(NodeRef));
-            else
-                memset(_children, 0, cap*sizeof(NodeRef));
+            unsigned nCopied = 0;
+            if (orig) {
+                nCopied = orig->capacity();
+                assert_precondition(nCopied <= cap);
+                memcpy(_children, orig->_children, nCopied*sizeof(NodeRef));
+            }
+            memset((void*)&_children[nCopied], 0, (cap - nCopied)*sizeof(NodeRef));
         }
 
 
-        MutableInterior* grow() {
+        // Replaces me with a copy that has room for one more child, freeing me.
+        MutableInterior* grow(NodeArena &arena) {
             assert_precondition(capacity() < kMaxChildren);
-            auto replacement = (MutableInterior*)realloc(this,
-                                    sizeof(MutableInterior) + (capacity()+1)*sizeof(NodeRef));
-            if (!replacement)
-                throw std::bad_alloc();
-            replacement->_capacity++;
+            auto replacement = newNode(arena, capacity() + 1, this);
+            freeNode(this, arena);
             return replacement;
         }
 
@@ -403,12 +650,13 @@ namespace fleece { namespace hashtree {
         }
 
 
-        MutableInterior* addChild(unsigned bitNo, NodeRef child) {
-            return addChild(bitNo, childIndexForBitNumber(bitNo), child);
+        MutableInterior* addChild(unsigned bitNo, NodeRef child, NodeArena &arena) {
+            return addChild(bitNo, childIndexForBitNumber(bitNo), child, arena);
         }
 
-        MutableInterior* addChild(unsigned bitNo, unsigned childIndex, NodeRef child) {
-            MutableInterior* node = (childCount() < capacity()) ? this : grow();
+        MutableInterior* addChild(unsigned bitNo, unsigned childIndex, NodeRef child,
+                                  NodeArena &arena) {
+            MutableInterior* node = (childCount() < capacity()) ? this : grow(arena);
             return node->_addChild(bitNo, childIndex, child);
         }
 
@@ -0,0 +1,102 @@
+//
+// NodeArena.hh
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+
+#pragma once
+#include "HashTree+Internal.hh"
+#include "Allocator.hh"
+#include <algorithm>
+#include <vector>
+#include "betterassert.hh"
+
+namespace fleece { namespace hashtree {
+
+    // Allocates the nodes of a MutableHashTree out of large chunks, instead of one at a time
+    // from the heap. Each node size has a size class -- 0 for leaves, else the capacity of an
+    // interior node -- with a freelist of freed blocks, which is checked first. The chunks
+    // themselves are freed all at once, when the arena is; so a node's destructor must have
+    // been run by then, if it has one, but its memory needn't be freed individually.
+    // Not thread-safe: threads inserting concurrently each need their own (see `adopt`.)
+    class NodeArena {
+    public:
+        static constexpr unsigned kNumSizeClasses = kMaxChildren + 1;
+        static constexpr size_t kAlignment = alignof(void*);
+
+        NodeArena() = default;
+
+        ~NodeArena() {
+            for (void *chunk : _chunks)
+                heap::free(chunk);
+        }
+
+        // Returns a block of `size` bytes. All blocks in a size class must be the same size.
+        void* allocate(unsigned sizeClass, size_t size) {
+            assert_precondition(sizeClass < kNumSizeClasses);
+            if (FreeBlock *block = _freeLists[sizeClass]; block) {
+                _freeLists[sizeClass] = block->next;
+                return block;
+            }
+            size = std::max((size + kAlignment - 1) & ~(kAlignment - 1), sizeof(FreeBlock));
+            if (size > size_t(_end - _next))
+                addChunk(size);
+            void *result = _next;
+            _next += size;
+            return result;
+        }
+
+        // Puts a block on its size class's freelist, to be reused.
+        void free(void *block, unsigned sizeClass) noexcept {
+            assert_precondition(sizeClass < kNumSizeClasses);
+            auto fb = (FreeBlock*)block;
+            fb->next = _freeLists[sizeClass];
+            _freeLists[sizeClass] = fb;
+        }
+
+        // Takes over another arena's chunks and free blocks, leaving it empty. Nodes allocated
+        // from it can then be freed into this one.
+        void adopt(NodeArena &other) {
+            _chunks.insert(_chunks.end(), other._chunks.begin(), other._chunks.end());
+            other._chunks.clear();
+            for (unsigned i = 0; i < kNumSizeClasses; ++i) {
+                if (FreeBlock *block = other._freeLists[i]; block) {
+                    while (block->next)
+                        block = block->next;
+                    block->next = _freeLists[i];
+                    _freeLists[i] = other._freeLists[i];
+                    other._freeLists[i] = nullptr;
+                }
+            }
+            other._next = other._end = nullptr;     // The rest of its last chunk goes unused
+            other._chunkSize = kMinChunkSize;
+        }
+
+        NodeArena(const NodeArena&) = delete;
+        NodeArena& operator=(const NodeArena&) = delete;
+
+    private:
+        static constexpr size_t kMinChunkSize = 4096, kMaxChunkSize = 256 * 1024;
+
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        // Starts a new chunk; they double in size, so a small tree doesn't waste much.
+        void addChunk(size_t minSize) {
+            size_t size = std::max(_chunkSize, minSize);
+            _chunks.reserve(_chunks.size() + 1);
+            _next = (char*)heap::allocate(size);
+            _chunks.push_back(_next);
+            _end = _next + size;
+            _chunkSize = std::min(2 * _chunkSize, kMaxChunkSize);
+        }
+
+        std::vector<void*> _chunks;
+        char* _next {nullptr};
+        char* _end {nullptr};
+        size_t _chunkSize {kMinChunkSize};
+        FreeBlock* _freeLists[kNumSizeClasses] {};
+    };
+
+} }
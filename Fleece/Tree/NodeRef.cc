@@ -36,6 +36,12 @@ namespace fleece { namespace hashtree {
         return isMutable() ? ((MutableLeaf*)_asMutable())->_value : _asImmutable()->leaf.value();
     }
 
+    slice NodeRef::keyString() const {
+        assert_precondition(isLeaf());
+        return isMutable() ? slice(((MutableLeaf*)_asMutable())->_key)
+                           : _asImmutable()->leaf.keyString();
+    }
+
     bool NodeRef::matches(Target target) const {
         assert_precondition(isLeaf());
         return isMutable() ? ((MutableLeaf*)_asMutable())->matches(target)
@@ -55,13 +61,13 @@ namespace fleece { namespace hashtree {
     }
 
 
-    Node NodeRef::writeTo(Encoder &enc) {
+    Node NodeRef::writeTo(Encoder &enc, LeafPositions *leafPositions) {
         assert_precondition(!isLeaf());
         Node node;
         if (isMutable())
-            node.interior = ((MutableInterior*)asMutable())->writeTo(enc);
+            node.interior = ((MutableInterior*)asMutable())->writeTo(enc, 1, leafPositions);
         else
-            node.interior = asImmutable()->interior.writeTo(enc);
+            node.interior = asImmutable()->interior.writeTo(enc, leafPositions);
         return node;
     }
 
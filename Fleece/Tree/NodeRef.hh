@@ -58,11 +58,12 @@ namespace fleece { namespace hashtree {
         hash_t hash() const FLPURE;
         bool matches(Target) const FLPURE;
         Value value() const FLPURE;
+        slice keyString() const FLPURE;
 
         unsigned childCount() const FLPURE;
         NodeRef childAtIndex(unsigned index) const FLPURE;
 
-        Node writeTo(Encoder &enc);
+        Node writeTo(Encoder &enc, LeafPositions* =nullptr);
         uint32_t writeTo(Encoder &enc, bool writeKey);
         void dump(std::ostream&, unsigned indent) const;
 
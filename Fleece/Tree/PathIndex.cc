@@ -0,0 +1,212 @@
+//
+// PathIndex.cc
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+
+#include "PathIndex.hh"
+#include "HashTree+Internal.hh"
+#include "Executor.hh"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include "betterassert.hh"
+
+using namespace std;
+
+namespace fleece {
+    using namespace hashtree;
+
+
+    // The new values of a shard's changed keys, and the keys it leaves with no documents.
+    struct PathIndexBuilder::shardResult {
+        vector<MutableHashTree::KeyValue> sets;
+        vector<slice> removes;
+        Doc doc;                                    // Holds the ID arrays in `sets`
+    };
+
+
+    static unsigned resolveThreads(unsigned nThreads, size_t nItems) {
+        nThreads = Executor::resolveThreads(nThreads);
+        return unsigned(min(size_t(nThreads), max(nItems, size_t(1))));
+    }
+
+
+    // Calls `fn(i)` for each `i` in [0, count), in up to `nThreads` Executor tasks. Each task
+    // takes the next item from a shared counter, since items can vary a lot in cost.
+    template <class FN>
+    static void forEachParallel(size_t count, unsigned nThreads, FN fn) {
+        Executor::parallelFor(count, nThreads, fn);
+    }
+
+
+    PathIndexBuilder::PathIndexBuilder(MutableHashTree &index, const KeyPath &path,
+                                       SharedKeys sharedKeys)
+    :_index(index)
+    ,_path(path)
+    ,_sharedKeys(sharedKeys)
+    { }
+
+
+    /*static*/ alloc_slice PathIndexBuilder::keyFor(Value value) {
+        return value.toJSON(false, true);
+    }
+
+
+    // Evaluates the path on a document and adds a posting for each value it finds to `shards`.
+    bool PathIndexBuilder::extract(const KeyPath &path, slice docID, slice data, bool added,
+                                   uint64_t seq, Shards &shards) const
+    {
+        Value root = Value::fromData(data);
+        if (!root)
+            return false;
+        auto addValue = [&](Value value) {
+            auto type = value.type();
+            if (type == kFLUndefined || type == kFLNull || type == kFLDict)
+                return;
+            alloc_slice key = keyFor(value);
+            auto &shard = shards[ComputeHash(key) % kNumShards];
+            shard.push_back({string(key), string(docID), seq, added});
+        };
+        Value value = FLKeyPath_EvalWithSharedKeys(path, root, _sharedKeys);
+        if (Array array = value.asArray(); array) {
+            for (Array::iterator i(array); i; ++i) {
+                if (i->type() != kFLArray)
+                    addValue(*i);
+            }
+        } else if (value) {
+            addValue(value);
+        }
+        return true;
+    }
+
+
+    bool PathIndexBuilder::add(slice docID, slice fleeceData) {
+        return extract(_path, docID, fleeceData, true, _seq++, _shards);
+    }
+
+
+    bool PathIndexBuilder::remove(slice docID, slice oldFleeceData) {
+        return extract(_path, docID, oldFleeceData, false, _seq++, _shards);
+    }
+
+
+    size_t PathIndexBuilder::addMany(const vector<Document> &docs, unsigned nThreads) {
+        nThreads = resolveThreads(nThreads, docs.size() / 64);
+        uint64_t firstSeq = _seq;
+        _seq += docs.size();
+
+        // Each thread extracts a range of documents into its own shards, which are appended to
+        // the builder's afterwards. (A compiled KeyPath caches lookups, so each needs a copy.)
+        atomic<size_t> nFailed {0};
+        mutex shardsMutex;
+        size_t perThread = (docs.size() + nThreads - 1) / nThreads;
+        forEachParallel(nThreads, nThreads, [&](size_t t) {
+            KeyPath path(_path);
+            Shards shards;
+            size_t end = min(docs.size(), (t + 1) * perThread);
+            for (size_t i = t * perThread; i < end; ++i) {
+                if (!extract(path, docs[i].docID, docs[i].data, true, firstSeq + i, shards))
+                    ++nFailed;
+            }
+            lock_guard<mutex> lock(shardsMutex);
+            for (unsigned s = 0; s < kNumShards; ++s) {
+                auto &dst = _shards[s];
+                dst.insert(dst.end(), make_move_iterator(shards[s].begin()),
+                           make_move_iterator(shards[s].end()));
+            }
+        });
+        return nFailed;
+    }
+
+
+    size_t PathIndexBuilder::pendingCount() const {
+        size_t count = 0;
+        for (auto &shard : _shards)
+            count += shard.size();
+        return count;
+    }
+
+
+    // Merges a shard's postings with the ID arrays of their keys in the index. The new arrays
+    // are encoded into a single Doc. This only reads the index, so shards can run concurrently.
+    void PathIndexBuilder::commitShard(vector<posting> &postings, shardResult &result) const {
+        sort(postings.begin(), postings.end(), [](const posting &a, const posting &b) {
+            if (int cmp = a.key.compare(b.key); cmp != 0)
+                return cmp < 0;
+            if (int cmp = a.docID.compare(b.docID); cmp != 0)
+                return cmp < 0;
+            return a.seq < b.seq;
+        });
+
+        Encoder enc;
+        enc.beginArray();
+        vector<pair<slice,uint32_t>> written;       // Keys, and the index of their ID array
+        vector<slice> ids;
+        for (auto p = postings.begin(); p != postings.end(); ) {
+            slice key(p->key);
+            auto keyEnd = p;
+            while (keyEnd != postings.end() && keyEnd->key == p->key)
+                ++keyEnd;
+
+            // Merge the sorted existing IDs with the changes; the last change to an ID wins:
+            ids.clear();
+            Array existing = _index.get(key).asArray();
+            Array::iterator iOld(existing);
+            for (; p != keyEnd; ++p) {
+                if (next(p) != keyEnd && next(p)->docID == p->docID)
+                    continue;
+                slice docID(p->docID);
+                for (; iOld && iOld->asString() < docID; ++iOld)
+                    ids.push_back(iOld->asString());
+                if (iOld && iOld->asString() == docID)
+                    ++iOld;
+                if (p->added)
+                    ids.push_back(docID);
+            }
+            for (; iOld; ++iOld)
+                ids.push_back(iOld->asString());
+
+            if (ids.empty()) {
+                if (existing)
+                    result.removes.push_back(key);
+            } else {
+                enc.beginArray(ids.size());
+                for (slice id : ids)
+                    enc.writeString(id);
+                enc.endArray();
+                written.emplace_back(key, uint32_t(written.size()));
+            }
+        }
+        enc.endArray();
+        result.doc = enc.finishDoc();
+        Array arrays = result.doc.asArray();
+        result.sets.reserve(written.size());
+        for (auto &[key, i] : written)
+            result.sets.emplace_back(key, arrays.get(i));
+    }
+
+
+    void PathIndexBuilder::commit(unsigned nThreads) {
+        nThreads = resolveThreads(nThreads, kNumShards);
+        shardResult results[kNumShards];
+        forEachParallel(kNumShards, nThreads, [&](size_t s) {
+            commitShard(_shards[s], results[s]);
+        });
+
+        vector<MutableHashTree::KeyValue> sets;
+        for (auto &result : results)
+            sets.insert(sets.end(), result.sets.begin(), result.sets.end());
+        if (!sets.empty())
+            _index.setMany(sets, nThreads);
+        for (auto &result : results) {
+            for (slice key : result.removes)
+                _index.remove(key);
+        }
+        for (auto &shard : _shards) {
+            shard.clear();
+            shard.shrink_to_fit();
+        }
+    }
+
+}
@@ -0,0 +1,95 @@
+//
+// PathIndex.hh
+//
+// Copyright © 2026 Couchbase. All rights reserved.
+//
+
+#pragma once
+#include "MutableHashTree.hh"
+#include "fleece/Fleece.hh"
+#include <array>
+#include <string>
+#include <vector>
+
+namespace fleece {
+
+    /** Builds and maintains an index of a collection of documents, mapping each value found at
+        a path in them to the IDs of the documents that contain it. The index is a
+        MutableHashTree, so it can be written with \ref MutableHashTree::writeTo and read back
+        as a HashTree, or used to create a MutableHashTree that's updated incrementally.
+
+        Each key of the tree is the \ref keyFor of a value, and its value is an array of the
+        IDs of the documents containing it, in sorted order. If the value at the path is an
+        array, each of its items is indexed. Dicts, nulls and missing values aren't indexed.
+
+        Documents are added (and removed) in any number of calls, which only extract their
+        values; \ref commit then updates the tree with all of them at once. The index keys are
+        partitioned into shards, which are merged into the tree on several threads. */
+    class PathIndexBuilder {
+    public:
+        /** A document to index: its ID and its Fleece data. */
+        struct Document {
+            slice docID;
+            slice data;
+        };
+
+        /** Creates a builder that updates `index`, which may be empty, or contain an index
+            built earlier over the same path. `sharedKeys` is used to look up keys in
+            documents whose Dicts use them. */
+        PathIndexBuilder(MutableHashTree &index, const KeyPath &path,
+                         SharedKeys sharedKeys = SharedKeys());
+
+        /** Adds a document to the index. If the document was already indexed, \ref remove
+            its old version first (or call \ref update.)
+            Returns false if the data isn't valid Fleece. */
+        bool add(slice docID, slice fleeceData);
+
+        /** Removes a document from the index, given the data it was indexed with.
+            Returns false if the data isn't valid Fleece. */
+        bool remove(slice docID, slice oldFleeceData);
+
+        /** Replaces the old version of an indexed document with a new one. */
+        bool update(slice docID, slice oldFleeceData, slice newFleeceData) {
+            return remove(docID, oldFleeceData) && add(docID, newFleeceData);
+        }
+
+        /** Adds many documents, extracting their values on up to `nThreads` threads (0 means
+            the Executor's concurrency.) Returns the number of documents whose data isn't valid. */
+        size_t addMany(const std::vector<Document>&, unsigned nThreads =0);
+
+        /** The number of document changes waiting for \ref commit. */
+        size_t pendingCount() const;
+
+        /** Applies the pending changes to the index, on up to `nThreads` threads (0 means the
+            Executor's concurrency.) Keys left with no documents are removed. */
+        void commit(unsigned nThreads =0);
+
+        /** The index key of a value: its canonical JSON, so that `1` and `"1"` differ, and
+            the keys of strings with a common prefix share that prefix after the quote. */
+        static alloc_slice keyFor(Value);
+
+        static constexpr unsigned kNumShards = 32;
+
+    private:
+        struct posting {
+            std::string key;
+            std::string docID;
+            uint64_t    seq;            // Order of the change, so the last one wins
+            bool        added;
+        };
+        using Shards = std::array<std::vector<posting>, kNumShards>;
+
+        struct shardResult;
+
+        bool extract(const KeyPath&, slice docID, slice data, bool added, uint64_t seq,
+                     Shards&) const;
+        void commitShard(std::vector<posting>&, shardResult&) const;
+
+        MutableHashTree& _index;
+        KeyPath _path;
+        SharedKeys _sharedKeys;
+        Shards _shards;
+        uint64_t _seq {0};
+    };
+
+}
@@ -3,12 +3,12 @@
 
 COMPONENT_SRCDIRS 			:= ../../../Fleece/API_Impl  ../../../Fleece/Core  ../../../Fleece/Mutable \
 	  						   ../../../Fleece/Support  ../../../Fleece/Tree \
-							   ../../../vendor/jsonsl  ../../../vendor/libb64
+							   ../../../Experimental  ../../../vendor/jsonsl  ../../../vendor/libb64
 COMPONENT_ADD_INCLUDEDIRS 	:= ../../../API \
 							   ../../../Fleece/Core  ../../../Fleece/Mutable  ../../../Fleece/Tree \
 							   ../../../Fleece/Support
 
-COMPONENT_PRIV_INCLUDEDIRS 	:= ../../../vendor/jsonsl  ../../../vendor/libb64
+COMPONENT_PRIV_INCLUDEDIRS 	:= ../../../Experimental  ../../../vendor/jsonsl  ../../../vendor/libb64
 
 CPPFLAGS += -D_GNU_SOURCE  -DFL_EMBEDDED
 CFLAGS   += -Wno-unknown-pragmas  -Wno-char-subscripts
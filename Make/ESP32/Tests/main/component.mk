@@ -7,10 +7,9 @@ COMPONENT_OBJS := Tests/FleeceTestsMain.o Tests/FleeceTests.o \
 	Tests/SupportTests.o \
 	Tests/ValueTests.o \
 	Tests/MutableTests.o \
-	Tests/HashTreeTests.o \
-	Experimental/KeyTree.o
+	Tests/HashTreeTests.o
 
-COMPONENT_SRCDIRS 			:= ../../../../Tests  ../../../../Experimental
+COMPONENT_SRCDIRS 			:= ../../../../Tests
 
 COMPONENT_PRIV_INCLUDEDIRS 	:= ../../../../vendor/catch  ../../../../vendor/jsonsl  ../../../../Experimental
 
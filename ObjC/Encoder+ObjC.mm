@@ -20,6 +20,9 @@
 #import "Encoder.hh"
 #import "Fleece+ImplGlue.hh"
 #import "FleeceException.hh"
+#import "TempArray.hh"
+#import <algorithm>
+#import <vector>
 
 using namespace fleece::impl;
 
@@ -38,6 +41,16 @@ namespace fleece {
 using namespace fleece;
 
 
+// Returns a string's UTF-8 as a slice: a pointer to CF's own bytes if it has them, otherwise a
+// copy, which is added to `copies` to keep it alive.
+static slice utf8Slice(CFStringRef str, std::vector<alloc_slice> &copies) {
+    if (const char *cstr = CFStringGetCStringPtr(str, kCFStringEncodingUTF8))
+        return slice(cstr, strlen(cstr));
+    copies.emplace_back(str);
+    return copies.back();
+}
+
+
 bool FLEncoder_WriteNSObject(FLEncoder encoder, id obj) FLAPI {
     try {
         if (!encoder->hasError()) {
@@ -122,10 +135,15 @@ bool FLEncoder_WriteNSObject(FLEncoder encoder, id obj) FLAPI {
 
 @implementation NSArray (Fleece)
 - (void) fl_encodeToFLEncoder: (FLEncoder)enc {
-    FLEncoder_BeginArray(enc, (uint32_t)self.count);
-    for (id item in self) {
-        [item fl_encodeToFLEncoder: enc];
-    }
+    // Get all the items at once, instead of enumerating them:
+    auto array = (__bridge CFArrayRef)self;
+    CFIndex count = CFArrayGetCount(array);
+    TempArray(items, const void*, count);
+    CFArrayGetValues(array, CFRange{0, count}, items);
+
+    FLEncoder_BeginArray(enc, (uint32_t)count);
+    for (CFIndex i = 0; i < count; ++i)
+        [(__bridge id)items[i] fl_encodeToFLEncoder: enc];
     FLEncoder_EndArray(enc);
 }
 
@@ -133,13 +151,34 @@ bool FLEncoder_WriteNSObject(FLEncoder encoder, id obj) FLAPI {
 
 @implementation NSDictionary (Fleece)
 - (void) fl_encodeToFLEncoder: (FLEncoder)enc {
-    FLEncoder_BeginDict(enc, (uint32_t)self.count);
-    [self enumerateKeysAndObjectsUsingBlock:^(__unsafe_unretained id key,
-                                              __unsafe_unretained id value, BOOL *stop) {
-        nsstring_slice slice(key);
-        FLEncoder_WriteKey(enc, slice);
-        [value fl_encodeToFLEncoder: enc];
-    }];
+    // Get all the keys and values at once, instead of enumerating them:
+    auto dict = (__bridge CFDictionaryRef)self;
+    CFIndex count = CFDictionaryGetCount(dict);
+    TempArray(keys, const void*, count);
+    TempArray(values, const void*, count);
+    CFDictionaryGetKeysAndValues(dict, keys, values);
+
+    // Write the keys in sorted order, so the Encoder won't have to sort them. (Unless some are
+    // SharedKeys, which sort differently; then it's still cheaper to sort from nearly in order.)
+    std::vector<alloc_slice> copies;
+    TempArray(keySlices, slice, count);
+    TempArray(order, CFIndex, count);
+    for (CFIndex i = 0; i < count; ++i) {
+        throwIf(CFGetTypeID(keys[i]) != CFStringGetTypeID(), EncodeError,
+                "Dictionary keys must be strings");
+        keySlices[i] = utf8Slice((CFStringRef)keys[i], copies);
+        order[i] = i;
+    }
+    CFIndex *first = order;
+    std::sort(first, first + count, [&](CFIndex a, CFIndex b) {
+        return keySlices[a] < keySlices[b];
+    });
+
+    FLEncoder_BeginDict(enc, (uint32_t)count);
+    for (CFIndex i = 0; i < count; ++i) {
+        FLEncoder_WriteKey(enc, keySlices[order[i]]);
+        [(__bridge id)values[order[i]] fl_encodeToFLEncoder: enc];
+    }
     FLEncoder_EndDict(enc);
 }
 
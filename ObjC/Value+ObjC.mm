@@ -18,6 +18,7 @@
 
 #import <Foundation/Foundation.h>
 #include "FleeceImpl.hh"
+#include "Doc.hh"
 #include "SharedKeys.hh"
 #include "FleeceException.hh"
 
@@ -85,6 +86,39 @@ namespace fleece {
 
 namespace fleece { namespace impl {
 
+    // Deallocator for the strings made by newUncopiedNSString: releases the Doc that owns the
+    // bytes, which was retained when the string was created.
+    static CFAllocatorRef DocReleasingDeallocator() {
+        static CFAllocatorContext context = {
+            .version = 0,
+            .info = nullptr,
+            .deallocate = [](void *p, void *info) -> void {
+                if (auto doc = Doc::containing((const Value*)p))
+                    release(doc.get());
+            },
+        };
+        static CFAllocatorRef kAllocator = CFAllocatorCreate(nullptr, &context);
+        return kAllocator;
+    }
+
+
+    // Creates an NSString that uses the bytes of a string Value in place instead of copying
+    // them, and keeps the Doc containing them alive. Returns nil if the Value isn't in a Doc.
+    // (CF may still copy, for instance if the string isn't ASCII; then it calls the
+    // deallocator right away, as it also does if the string can't be created.)
+    static NSString* newUncopiedNSString(const Value *value, slice str) {
+        RetainedConst<Doc> doc = Doc::containing(value);
+        if (!doc)
+            return nil;
+        (void)std::move(doc).detach();          // the deallocator releases this reference
+        CFStringRef cfStr = CFStringCreateWithBytesNoCopy(nullptr, (const UInt8*)str.buf,
+                                                          str.size, kCFStringEncodingUTF8,
+                                                          false, DocReleasingDeallocator());
+        throwIf(!cfStr, InvalidData, "Invalid UTF-8 in string");
+        return CFBridgingRelease(cfStr);
+    }
+
+
     // Creates an NSMapTable that maps opaque pointers to Obj-C objects (NSStrings).
     NSMapTable* Value::createSharedStringsTable() noexcept {
         return [[NSMapTable alloc] initWithKeyOptions: NSPointerFunctionsOpaquePersonality |
@@ -117,8 +151,15 @@ namespace fleece { namespace impl {
                     float f = asFloat();
                     return CFBridgingRelease(CFNumberCreate(nullptr, kCFNumberFloatType,  &f));
                 }
-            case kString:
-                return asString().asNSString(sharedStrings);
+            case kString: {
+                // Strings too long to share are made without copying, if they're in a Doc:
+                slice str = asString();
+                if (str.size > kMaxSharedStringSize) {
+                    if (NSString *nsStr = newUncopiedNSString(this, str))
+                        return nsStr;
+                }
+                return str.asNSString(sharedStrings);
+            }
             case kData:
                 return asData().copiedNSData();
             case kArray: {
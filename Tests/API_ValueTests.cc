@@ -18,6 +18,7 @@
 
 #include "fleece/Fleece.hh"
 #include <iostream>
+#include <thread>
 
 namespace fleece {
     static inline std::ostream& operator<<(std::ostream &out, const fleece::Doc &doc) {
@@ -28,7 +29,17 @@ namespace fleece {
 
 #include "FleeceTests.hh"
 #include "fleece/Fleece.hh"
+#include "fleece/Fleece+Inline.h"
 #include "fleece/Mutable.hh"
+#include "fleece/ConstantDoc.hh"
+#include "fleece/StructCoder.hh"
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace fleece;
 using namespace std;
@@ -89,6 +100,32 @@ TEST_CASE("DeepIterator", "[API]") {
 #endif
 
 
+TEST_CASE("API DeepIterator Paths", "[API]") {
+    Doc doc = Doc::fromJSON(R"({"a":[1,{"b/c":2,"x y":[3,4]},5],"d~":{"e":{"f":6}},"g":7})"_sl);
+    std::vector<std::string> paths, pointers;
+    for (DeepIterator i(doc.root()); i; ++i) {
+        // The slices always match the allocated strings:
+        CHECK(i.pathSlice() == i.pathString());
+        CHECK(i.JSONPointerSlice() == i.JSONPointer());
+        paths.push_back(std::string(i.pathSlice()));
+        pointers.push_back(std::string(i.JSONPointerSlice()));
+    }
+    CHECK(paths == (std::vector<std::string>{
+        "", ".a", "[\"d~\"]", ".g", "[\"d~\"].e", "[\"d~\"].e.f", ".a[0]", ".a[1]", ".a[2]",
+        ".a[1][\"b/c\"]", ".a[1][\"x y\"]", ".a[1][\"x y\"][0]", ".a[1][\"x y\"][1]"}));
+    CHECK(pointers == (std::vector<std::string>{
+        "/", "/a", "/d~0", "/g", "/d~0/e", "/d~0/e/f", "/a/0", "/a/1", "/a/2",
+        "/a/1/b~1c", "/a/1/x y", "/a/1/x y/0", "/a/1/x y/1"}));
+
+    // The buffer is only brought up to date when it's read, so reading it occasionally works:
+    size_t n = 0;
+    for (DeepIterator i(doc.root()); i; ++i) {
+        if (n++ % 3 == 2)
+            CHECK(i.JSONPointerSlice() == slice(pointers[n - 1]));
+    }
+}
+
+
 TEST_CASE("API Doc", "[API][SharedKeys]") {
     Dict root;
     {
@@ -107,6 +144,267 @@ TEST_CASE("API Doc", "[API][SharedKeys]") {
 }
 
 
+#if FL_HAVE_FILESYSTEM
+TEST_CASE("API Doc From Mapped File", "[API]") {
+    const char *path = kTempDir "fleece_mapped_doc";
+    alloc_slice fleece = Doc::fromJSON(readTestFile(kBigJSONTestFileName)).allocedData();
+    writeToFile(fleece, path);
+
+    Dict person;
+    {
+        Doc doc = Doc::fromMappedFile(path, kFLTrusted);
+        REQUIRE(doc);
+        CHECK(doc.data() == fleece);
+        CHECK(doc.data().buf != fleece.buf);
+        CHECK(!doc.allocedData());
+        Array root = doc.root().asArray();
+        REQUIRE(root);
+        CHECK(root.count() == 1000);
+        root.prefetch();
+        root[999].prefetch(true);
+        person = root[3].asDict();
+        person.prefetch(true);
+        person["name"].prefetch();
+        CHECK(person.findDoc() == doc);
+        CHECK(person.toJSON() == Doc(fleece).root().asArray()[3].toJSON());
+    }
+    CHECK(!person.findDoc());
+
+    Doc untrusted = Doc::fromMappedFile(path);
+    CHECK(untrusted.root().asArray().count() == 1000);
+
+    FLError error = kFLNoError;
+    CHECK(!Doc::fromMappedFile(kTempDir "fleece_nonexistent_file", kFLTrusted, nullptr, &error));
+    CHECK(error != kFLNoError);
+}
+#endif
+
+
+#if FL_HAVE_FILESYSTEM && !defined(_MSC_VER)
+TEST_CASE("API Doc From Shared Memory", "[API]") {
+    const std::string name = "/fleece_test_" + std::to_string(getpid());
+    const std::string keysName = name + "_keys";
+
+    // Encode the data with shared keys, and publish both it and the keys' image:
+    SharedKeys sk = SharedKeys::create();
+    Encoder enc;
+    enc.setSharedKeys(sk);
+    enc.beginArray();
+    for (int i = 0; i < 1000; ++i) {
+        enc.beginDict();
+        enc.writeKey("name");
+        enc.writeString("Person #" + std::to_string(i));
+        enc.writeKey("index");
+        enc.writeInt(i);
+        enc.endDict();
+    }
+    enc.endArray();
+    alloc_slice fleece = enc.finish();
+    REQUIRE(fleece);
+    REQUIRE(FLSharedMemory_Create(name.c_str(), fleece, nullptr));
+    alloc_slice image(FLSharedKeys_GetImageData(sk));
+    REQUIRE(FLSharedMemory_Create(keysName.c_str(), image, nullptr));
+
+    // Only this user can open them:
+    for (auto &segment : {name, keysName}) {
+        int fd = shm_open(segment.c_str(), O_RDONLY, 0);
+        REQUIRE(fd >= 0);
+        struct stat st;
+        CHECK(fstat(fd, &st) == 0);
+        CHECK((st.st_mode & 0777) == 0600);
+        close(fd);
+    }
+
+    // Another process maps them both, without copying, and reads the data:
+    pid_t child = fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        SharedKeys childKeys = SharedKeys::create();
+        if (!childKeys.useSharedMemoryImage(keysName.c_str()))
+            _exit(1);
+        Doc doc = Doc::fromSharedMemory(name.c_str(), kFLUntrusted, childKeys);
+        Array root = doc.root().asArray();
+        if (!root || root.count() != 1000 || doc.data() != fleece)
+            _exit(2);
+        Dict person = root[3].asDict();
+        if (person["name"].asString() != "Person #3"_sl || !(person.findDoc() == doc))
+            _exit(3);
+        _exit(0);
+    }
+    int status = -1;
+    REQUIRE(waitpid(child, &status, 0) == child);
+    CHECK(WIFEXITED(status));
+    CHECK(WEXITSTATUS(status) == 0);
+
+    // In this process too; the data stays mapped after the segment is removed:
+    {
+        SharedKeys keys2 = SharedKeys::create();
+        REQUIRE(keys2.useSharedMemoryImage(keysName.c_str()));
+        Doc doc = Doc::fromSharedMemory(name.c_str(), kFLTrusted, keys2);
+        REQUIRE(doc);
+        CHECK(doc.data() == fleece);
+        CHECK(doc.data().buf != fleece.buf);
+        CHECK(FLSharedMemory_Remove(name.c_str()));
+        CHECK(FLSharedMemory_Remove(keysName.c_str()));
+        CHECK(doc.root().asArray()[3].asDict()["name"].asString() == "Person #3"_sl);
+    }
+
+    FLError error = kFLNoError;
+    CHECK(!Doc::fromSharedMemory(name.c_str(), kFLTrusted, nullptr, &error));
+    CHECK(error != kFLNoError);
+    CHECK(!FLSharedMemory_Remove(name.c_str()));
+}
+#endif
+
+
+TEST_CASE("API Dict GetMany", "[API]") {
+    Doc doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+    Dict person = doc.root().asArray()[3].asDict();
+    REQUIRE(person);
+
+    std::vector<std::string> names;
+    for (Dict::iterator i(person); i; ++i)
+        names.push_back(std::string(i.keyString()));
+    names.push_back("");
+    names.push_back("aaaa");
+    names.push_back("nonexistent");
+    names.push_back("zzzz");
+
+    // Keys in dict order, in reverse order, and every third key:
+    std::vector<FLSlice> keys;
+    for (auto &name : names)
+        keys.push_back(slice(name));
+    std::sort(keys.begin(), keys.end(), [](FLSlice a, FLSlice b) {return FLSlice_Compare(a, b) < 0;});
+    for (int pass = 0; pass < 3; ++pass) {
+        std::vector<FLSlice> someKeys;
+        if (pass == 0)
+            someKeys = keys;
+        else if (pass == 1)
+            someKeys.assign(keys.rbegin(), keys.rend());
+        else
+            for (size_t i = 0; i < keys.size(); i += 3)
+                someKeys.push_back(keys[i]);
+        std::vector<FLValue> values(someKeys.size());
+        FLDict_GetMany(person, someKeys.data(), someKeys.size(), values.data());
+        for (size_t i = 0; i < someKeys.size(); ++i) {
+            INFO("Key " << slice(someKeys[i]));
+            CHECK(values[i] == FLDict_Get(person, someKeys[i]));
+        }
+    }
+
+    FLValue value = doc.root();
+    FLDict_GetMany(nullptr, keys.data(), 1, &value);
+    CHECK(value == nullptr);
+}
+
+
+TEST_CASE("API Pooled Encoder", "[API][Encoder]") {
+    FLEncoder enc = FLEncoder_NewPooled();
+    FLEncoder_SuppressTrailer(enc);
+    FLEncoder_BeginArray(enc, 1);
+    FLEncoder_WriteInt(enc, 17);
+    FLEncoder_EndArray(enc);
+    FLSliceResult_Release(FLEncoder_Finish(enc, nullptr));
+    FLEncoder_Free(enc);
+
+    // The same encoder comes back, with its default options restored:
+    FLEncoder enc2 = FLEncoder_NewPooled();
+    CHECK(enc2 == enc);
+    FLEncoder enc3 = FLEncoder_NewPooled();
+    CHECK(enc3 != enc);
+    for (int i = 0; i < 3; ++i) {
+        FLEncoder_BeginDict(enc2, 1);
+        FLEncoder_WriteKey(enc2, "foo"_sl);
+        FLEncoder_WriteInt(enc2, i);
+        FLEncoder_EndDict(enc2);
+        Doc doc(FLEncoder_FinishDoc(enc2, nullptr), false);
+        REQUIRE(doc);
+        CHECK(doc.root().asDict()["foo"_sl].asInt() == i);
+        FLEncoder_Reset(enc2);
+    }
+    FLEncoder_Free(enc3);
+    FLEncoder_Free(enc2);
+}
+
+
+TEST_CASE("API Encoder Sink", "[API][Encoder]") {
+    struct Output {
+        std::string data;
+        bool fail = false;
+    } output;
+    auto sink = [](void *context, FLSlice data) {
+        auto out = (Output*)context;
+        out->data.append((const char*)data.buf, data.size);
+        return !out->fail;
+    };
+
+    FLEncoder enc = FLEncoder_NewWritingToSink(sink, &output, true);
+    FLEncoder_BeginArray(enc, 2);
+    FLEncoder_WriteString(enc, "hello"_sl);
+    FLEncoder_WriteInt(enc, 1234);
+    FLEncoder_EndArray(enc);
+    FLError error = kFLNoError;
+    FLSliceResult result = FLEncoder_Finish(enc, &error);
+    CHECK(result.buf == nullptr);
+    CHECK(error == kFLNoError);
+    FLEncoder_Free(enc);
+
+    Doc doc = Doc::fromJSON("[\"hello\", 1234]"_sl);
+    CHECK(slice(output.data) == doc.data());
+    CHECK(FLValue_IsEqual(FLValue_FromData(slice(output.data), kFLTrusted), doc.root()));
+
+    output.fail = true;
+    enc = FLEncoder_NewWritingToSink(sink, &output, true);
+    FLEncoder_WriteString(enc, "hello"_sl);
+    result = FLEncoder_Finish(enc, &error);
+    CHECK(result.buf == nullptr);
+    CHECK(error == kFLEncodeError);
+    FLEncoder_Free(enc);
+}
+
+
+TEST_CASE("API Value WriteJSON", "[API][Encoder]") {
+    Encoder enc;
+    enc.beginArray();
+    for (int i = 0; i < 10000; ++i) {
+        enc.beginDict();
+        enc["id"_sl] = i;
+        enc["name"_sl] = "Someone with a fairly long name";
+        enc.endDict();
+    }
+    enc.endArray();
+    Doc doc = enc.finishDoc();
+
+    struct Output {
+        std::string data;
+        size_t calls = 0, maxChunk = 0;
+        bool fail = false;
+    } output;
+    auto sink = [](void *context, FLSlice data) {
+        auto out = (Output*)context;
+        out->data.append((const char*)data.buf, data.size);
+        out->calls++;
+        out->maxChunk = std::max(out->maxChunk, data.size);
+        return !out->fail;
+    };
+
+    FLError error = kFLNoError;
+    CHECK(FLValue_WriteJSON(doc.root(), sink, &output, true, false, &error));
+    CHECK(error == kFLNoError);
+    alloc_slice json = doc.root().toJSON5();
+    CHECK(slice(output.data) == json);
+    // The output was passed along in chunks, not accumulated:
+    CHECK(output.calls > 1);
+    CHECK(output.maxChunk <= 2 * 64 * 1024);
+
+    output = Output();
+    output.fail = true;
+    CHECK(!FLValue_WriteJSON(doc.root(), sink, &output, false, false, &error));
+    CHECK(error == kFLEncodeError);
+    CHECK(output.data.size() < json.size);    // gave up early
+}
+
+
 TEST_CASE("API Encoder", "[API][Encoder]") {
     Encoder enc;
     enc.beginDict();
@@ -146,9 +444,304 @@ TEST_CASE("API Paths", "[API][Encoder]") {
 #else  // embedded test uses only 50 people, not 1000, so [-1] resolves differently
     REQUIRE(name.asString() == slice("Tara Wall"));
 #endif
+
+    KeyPath p3{"[:3].name"_sl, &error};
+    CHECK(!root[p3]);
+    Encoder enc;
+    REQUIRE(p3.evalAll(root, enc));
+    Doc names = enc.finishDoc();
+    REQUIRE(names.root().asArray().count() == 3);
+    CHECK(names.root().asArray()[0].asString() == root.asArray()[0].asDict()["name"].asString());
 }
 
 
+TEST_CASE("API Extract Columns", "[API]") {
+    Doc doc = Doc::fromJSON(R"([{"n":1,"s":"one"},{"n":2.5},{"s":"three"}])"_sl);
+    int64_t ns[3];
+    FLSlice ss[3];
+    uint8_t nNulls, sNulls;
+    FLColumn columns[] = {
+        {"n"_sl, kFLIntColumn,    ns, &nNulls},
+        {"s"_sl, kFLStringColumn, ss, &sNulls},
+    };
+    doc.root().asArray().extractColumns(columns, 2);
+    CHECK(ns[0] == 1);
+    CHECK(ns[1] == 2);
+    CHECK(ns[2] == 0);
+    CHECK(nNulls == 0x04);
+    CHECK(slice(ss[0]) == "one"_sl);
+    CHECK(!ss[1].buf);
+    CHECK(slice(ss[2]) == "three"_sl);
+    CHECK(sNulls == 0x02);
+}
+
+
+TEST_CASE("API Array Stats", "[API]") {
+    Doc doc = Doc::fromJSON(R"([4, null, 2.5, "x", -1])"_sl);
+    FLArrayStats stats = doc.root().asArray().stats();
+    CHECK(stats.count == 3);
+    CHECK(stats.nonNull == 4);
+    CHECK(stats.sum == 5.5);
+    CHECK(stats.min == -1);
+    CHECK(stats.max == 4);
+    uint8_t bitmap;
+    CHECK(doc.root().asArray().filterNumbers(0, 10, &bitmap) == 2);
+    CHECK(bitmap == 0x05);
+    CHECK(Array().stats().count == 0);
+}
+
+
+TEST_CASE("API Array Sorted By", "[API]") {
+    Doc doc = Doc::fromJSON(R"([{"n":"b","x":2},{"n":"a","x":2},{"n":"c","x":1},{"x":3}])"_sl);
+    FLError error;
+    KeyPath x("x"_sl, &error), name("n"_sl, &error);
+    FLSortKey keys[] = {{x, true}, {name, false}};
+    Encoder enc;
+    REQUIRE(FLArray_SortedBy(doc.root().asArray(), keys, 2, kFLBinaryCollation, 3, enc));
+    Doc sorted = enc.finishDoc();
+    CHECK(sorted.root().toJSONString() == R"([{"x":3},{"n":"a","x":2},{"n":"b","x":2}])");
+}
+
+
+TEST_CASE("API Sorted Array Set Operations", "[API]") {
+    Doc doc1 = Doc::fromJSON("[1, 3, 5, 7, 9]"_sl), doc2 = Doc::fromJSON("[3, 4, 5]"_sl);
+    Array a = doc1.root().asArray(), b = doc2.root().asArray();
+    CHECK(a.lowerBound(b[1]) == 2);
+    CHECK(a.lowerBound(b[2]) == 2);
+    const char* expected[] = {"[3,5]", "[1,3,4,5,7,9]", "[1,7,9]"};
+    for (int op = kFLIntersection; op <= kFLDifference; ++op) {
+        Encoder enc;
+        REQUIRE(FLArray_WriteSetOperation(a, b, FLSetOperation(op), enc));
+        CHECK(enc.finishDoc().root().toJSONString() == expected[op]);
+    }
+    JSONEncoder jsonEnc;
+    CHECK(!FLArray_WriteSetOperation(a, b, kFLUnion, jsonEnc));
+}
+
+
+TEST_CASE("API Batch Items", "[API][Encoder]") {
+    Doc doc = Doc::fromJSON(R"({"b":true,"i":-7,"n":null,"s":"str","x":[1],"z":2.5})"_sl);
+    Dict dict = doc.root().asDict();
+
+    SECTION("GetFields") {
+        FLSlice keys[] = {"z"_sl, "i"_sl, "missing"_sl, "s"_sl};
+        FLValue values[4];
+        FLValueType types[4];
+        int64_t ints[4];
+        FLSlice strings[4];
+        FLFieldArrays fields = {values, types, ints, nullptr, strings};
+        CHECK(FLDict_GetFields(dict, keys, 4, &fields) == 3);
+        CHECK(values[0] == dict["z"]);
+        CHECK(types[0] == kFLNumber);
+        CHECK(ints[0] == 2);
+        CHECK(ints[1] == -7);
+        CHECK(values[2] == nullptr);
+        CHECK(types[2] == kFLUndefined);
+        CHECK(ints[2] == 0);
+        CHECK(types[3] == kFLString);
+        CHECK(slice(strings[3]) == "str"_sl);
+        CHECK(!strings[1].buf);
+    }
+    SECTION("Iterate and re-encode") {
+        std::vector<FLItem> items;
+        FLItem buf[4];
+        FLDictIterator iter;
+        FLDictIterator_Begin(dict, &iter);
+        while (size_t n = FLDictIterator_ReadItems(&iter, buf, 4))
+            items.insert(items.end(), &buf[0], &buf[n]);
+        REQUIRE(items.size() == 6);
+        CHECK(slice(items[0].key) == "b"_sl);
+        CHECK(items[0].type == kFLBoolean);
+        CHECK(items[0].asInt == 1);
+        CHECK(items[1].isInteger);
+        CHECK(items[1].asDouble == -7.0);
+        CHECK(items[4].type == kFLArray);
+        CHECK(!items[5].isInteger);
+        CHECK(items[5].asDouble == 2.5);
+
+        FLArrayIterator aiter;
+        FLArrayIterator_Begin(dict["x"].asArray(), &aiter);
+        CHECK(FLArrayIterator_ReadItems(&aiter, buf, 4) == 1);
+        CHECK(!buf[0].key.buf);
+        CHECK(buf[0].asInt == 1);
+        CHECK(FLArrayIterator_ReadItems(&aiter, buf, 4) == 0);
+
+        // Write them back, with the scalars given by value and the array as a Value:
+        for (auto &item : items) {
+            if (item.type != kFLArray)
+                item.value = nullptr;
+        }
+        Encoder enc;
+        enc.beginDict();
+        CHECK(FLEncoder_WriteItems(enc, items.data(), items.size()));
+        enc.endDict();
+        Doc doc2 = enc.finishDoc();
+        CHECK(doc2.root().isEqual(doc.root()));
+
+        FLItem bad = {"x"_sl, nullptr, kFLDict};
+        enc.beginDict();
+        CHECK(!FLEncoder_WriteItems(enc, &bad, 1));
+        CHECK(enc.error() == kFLInvalidData);
+    }
+}
+
+
+namespace {
+    struct TestPoint {
+        int x = 0;
+        double y = 0;
+        std::string label;
+    };
+
+    struct TestShape {
+        std::string name;
+        std::vector<TestPoint> points;
+        bool closed = false;
+        uint32_t id = 0;
+    };
+}
+
+template<> struct fleece::StructFields<TestPoint> {
+    static constexpr auto fields = std::make_tuple(field("x", &TestPoint::x),
+                                                   field("y", &TestPoint::y),
+                                                   field("label", &TestPoint::label));
+};
+
+template<> struct fleece::StructFields<TestShape> {
+    static constexpr auto fields = std::make_tuple(field("name", &TestShape::name),
+                                                   field("points", &TestShape::points),
+                                                   field("closed", &TestShape::closed),
+                                                   field("id", &TestShape::id));
+};
+
+static_assert(structcoder::Info<TestShape>::order[0] == 2);     // "closed" sorts first
+
+
+TEST_CASE("API Struct Coder", "[API][Encoder]") {
+    TestShape shape {"tri", {{1, 2.5, "a"}, {-3, 0, "b"}, {7, 1e10, ""}}, true, 4000000000};
+    const char *json = R"({"closed":true,"id":4000000000,"name":"tri","points":[)"
+                       R"({"label":"a","x":1,"y":2.5},{"label":"b","x":-3,"y":0.0},)"
+                       R"({"label":"","x":7,"y":1e+10}]})";
+
+    SECTION("Without SharedKeys") {
+        Encoder enc;
+        encodeStruct(enc, shape);
+        Doc doc = enc.finishDoc();
+        CHECK(doc.root().toJSONString() == json);
+
+        TestShape decoded;
+        CHECK(decodeStruct(doc.root().asDict(), decoded));
+        CHECK(decoded.name == "tri");
+        CHECK(decoded.closed);
+        CHECK(decoded.id == 4000000000);
+        REQUIRE(decoded.points.size() == 3);
+        CHECK(decoded.points[1].x == -3);
+        CHECK(decoded.points[2].y == 1e10);
+        CHECK(decoded.points[0].label == "a");
+
+        TestPoint partial {5, 5, "keep"};
+        CHECK(!decodeStruct(Doc::fromJSON(R"({"x":9})"_sl).root().asDict(), partial));
+        CHECK(partial.x == 9);
+        CHECK(partial.label == "keep");
+    }
+    SECTION("With SharedKeys") {
+        SharedKeys sk = SharedKeys::create();
+        CHECK(FLSharedKeys_Encode(sk, "name"_sl, true) == 0);
+        CHECK(FLSharedKeys_Encode(sk, "id"_sl, true) == 1);
+        StructCoder<TestShape> coder(sk);
+        Encoder enc(sk);
+        coder.encode(enc, shape);
+        Doc doc = enc.finishDoc();
+        Dict root = doc.root().asDict();
+        CHECK(root.isEqual(Doc::fromJSON(slice(json)).root()));
+        Dict::iterator iter(root);
+        CHECK(iter.key().isInteger());      // "name" and "id" were written as integers
+        CHECK(iter.keyString() == "name"_sl);
+
+        TestShape decoded;
+        CHECK(coder.decode(root, decoded));
+        CHECK(decoded.id == 4000000000);
+        CHECK(decoded.points.size() == 3);
+    }
+}
+
+
+static constexpr auto kConstantDoc = FLEECE_CONSTANT_DOC(
+    dictOf(entry("name", "Fleece"),
+           entry("tags", arrayOf("fast", "compact", "fast", "x", "")),
+           entry("description", "A binary encoding for semi-structured data"),
+           entry("version", 2),
+           entry("big", -100000),
+           entry("huge", uint64_t(18000000000000000000u)),
+           entry("ratio", 2.5),
+           entry("pi", 3.14159265358979),
+           entry("tiny", 5e-324),
+           entry("empty", arrayOf()),
+           entry("nothing", dictOf()),
+           entry("none", nullptr),
+           entry("ok", true),
+           entry("people", arrayOf(dictOf(entry("name", "Alice"), entry("age", 30)),
+                                   dictOf(entry("age", 40), entry("name", "Bob"))))));
+
+static_assert(FLEECE_CONSTANT_DOC(true).size() == 2);
+static_assert(FLEECE_CONSTANT_DOC(true)[0] == 0x38);
+
+TEST_CASE("API Constant Doc", "[API][Encoder]") {
+    Encoder enc;
+    enc.beginDict();
+    enc.writeKey("name"); enc.writeString("Fleece");
+    enc.writeKey("tags");
+        enc.beginArray();
+        for (const char *tag : {"fast", "compact", "fast", "x", ""})
+            enc.writeString(tag);
+        enc.endArray();
+    enc.writeKey("description"); enc.writeString("A binary encoding for semi-structured data");
+    enc.writeKey("version"); enc.writeInt(2);
+    enc.writeKey("big"); enc.writeInt(-100000);
+    enc.writeKey("huge"); enc.writeUInt(18000000000000000000u);
+    enc.writeKey("ratio"); enc.writeDouble(2.5);
+    enc.writeKey("pi"); enc.writeDouble(3.14159265358979);
+    enc.writeKey("tiny"); enc.writeDouble(5e-324);
+    enc.writeKey("empty"); enc.beginArray(); enc.endArray();
+    enc.writeKey("nothing"); enc.beginDict(); enc.endDict();
+    enc.writeKey("none"); enc.writeNull();
+    enc.writeKey("ok"); enc.writeBool(true);
+    enc.writeKey("people");
+        enc.beginArray();
+        enc.beginDict();
+        enc.writeKey("name"); enc.writeString("Alice");
+        enc.writeKey("age"); enc.writeInt(30);
+        enc.endDict();
+        enc.beginDict();
+        enc.writeKey("age"); enc.writeInt(40);
+        enc.writeKey("name"); enc.writeString("Bob");
+        enc.endDict();
+        enc.endArray();
+    enc.endDict();
+    alloc_slice encoded = enc.finish();
+
+    // Identical to what the Encoder writes, including sorted keys and uniqued strings:
+    CHECK(kConstantDoc.bytes() == encoded);
+    CHECK(((size_t)kConstantDoc.data() & 1) == 0);
+
+    Dict root = kConstantDoc.root().asDict();
+    REQUIRE(root);
+    CHECK(root.count() == 14);
+    CHECK(root["name"].asString() == "Fleece"_sl);
+    CHECK(root["tags"].asArray().count() == 5);
+    CHECK(root["huge"].asUnsigned() == 18000000000000000000u);
+    CHECK(root["pi"].asDouble() == 3.14159265358979);
+    CHECK(root["tiny"].asDouble() == 5e-324);
+    CHECK(root["people"].asArray()[1].asDict()["name"].asString() == "Bob"_sl);
+    CHECK(Value::fromData(kConstantDoc, kFLUntrusted) != nullptr);    // validates
+
+    constexpr auto scalar = FLEECE_CONSTANT_DOC("hi");
+    CHECK(scalar.root().asString() == "hi"_sl);
+    constexpr auto number = FLEECE_CONSTANT_DOC(-7);
+    CHECK(number.size() == 2);
+    CHECK(number.root().asInt() == -7);
+}
+
 TEST_CASE("API Undefined", "[API]") {
     Encoder enc;
     enc.beginArray();
@@ -232,3 +825,616 @@ TEST_CASE("API MutableDict", "[API]") {
     REQUIRE(d.get("x"_sl));
     CHECK(d.get("x"_sl).asInt() == 1234);
 }
+
+TEST_CASE("API Modifying Snapshotted Collections", "[API]") {
+    FLMutableDict root = FLMutableDict_New();
+    FLMutableArray list = FLMutableDict_GetMutableArray(root, "list"_sl);
+    CHECK(list == nullptr);
+    FLMutableArray newList = FLMutableArray_New();
+    FLMutableDict_SetArray(root, "list"_sl, newList);
+    FLMutableArray_Release(newList);
+    list = FLMutableDict_GetMutableArray(root, "list"_sl);
+    REQUIRE(list);
+    FLMutableArray_AppendInt(list, 1);
+
+    // The snapshot freezes the nested array, so changing it through the old reference fails,
+    // without throwing out of the C API:
+    FLMutableDict snap = FLMutableDict_Snapshot(root);
+    CHECK(FLMutableArray_IsFrozen(list));
+    CHECK(FLMutableArray_Set(list, 0) == nullptr);
+    CHECK(FLMutableArray_Append(list) == nullptr);
+    FLMutableArray_SetInt(list, 0, 99);
+    FLMutableArray_AppendInt(list, 2);
+    FLMutableArray_Insert(list, 0, 1);
+    FLMutableArray_Remove(list, 0, 1);
+    FLMutableArray_Resize(list, 10);
+    CHECK(Value((FLValue)snap).toJSONString() == R"({"list":[1]})");
+
+    // Getting it from the root again returns a mutable copy:
+    FLMutableArray list2 = FLMutableDict_GetMutableArray(root, "list"_sl);
+    REQUIRE(list2);
+    CHECK(list2 != list);
+    FLMutableArray_AppendInt(list2, 2);
+    CHECK(Value((FLValue)root).toJSONString() == R"({"list":[1,2]})");
+    CHECK(Value((FLValue)snap).toJSONString() == R"({"list":[1]})");
+
+    FLMutableDict_SetInt(snap, "x"_sl, 1);
+    FLMutableDict_Remove(snap, "list"_sl);
+    CHECK(FLMutableDict_GetMutableArray(snap, "list"_sl) == nullptr);
+    CHECK(Value((FLValue)snap).toJSONString() == R"({"list":[1]})");
+    FLMutableDict_Release(snap);
+    FLMutableDict_Release(root);
+}
+
+TEST_CASE("API Freeze", "[API]") {
+    FLDoc doc = FLDoc_FromJSON(R"({"a":{"b":[1,2]}})"_sl, nullptr);
+    FLMutableDict d = FLDict_MutableCopy(FLValue_AsDict(FLDoc_GetRoot(doc)), kFLDeepCopy);
+    FLError error = kFLNoError;
+    CHECK(FLMutableDict_Freeze(d, &error));
+    CHECK(error == kFLNoError);
+    CHECK(FLMutableDict_IsFrozen(d));
+    CHECK(FLMutableDict_Freeze(d, nullptr));        // (already frozen)
+    FLMutableDict_Release(d);
+
+    // A single-threaded copy can't be frozen; that's reported, not thrown:
+    d = FLDict_MutableCopy(FLValue_AsDict(FLDoc_GetRoot(doc)),
+                           FLCopyFlags(kFLDeepCopy | kFLCopySingleThreaded));
+    CHECK(!FLMutableDict_Freeze(d, &error));
+    CHECK(error != kFLNoError);
+    CHECK(!FLMutableDict_IsFrozen(d));
+    FLMutableDict_SetInt(d, "x"_sl, 1);
+    CHECK(FLValue_AsInt(FLDict_Get(d, "x"_sl)) == 1);
+    FLMutableDict_Release(d);
+    FLDoc_Release(doc);
+}
+
+
+TEST_CASE("API Apply JSON Deltas", "[API][Delta]") {
+    Doc doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+    Array people = doc.root().asArray();
+    REQUIRE(people.count() == 1000);
+
+    // Each delta changes one person's name, except #500's, which is garbage:
+    std::vector<Value> olds;
+    std::vector<alloc_slice> deltaData;
+    std::vector<slice> deltas;
+    std::vector<std::string> expected;
+    for (uint32_t i = 0; i < people.count(); ++i) {
+        Dict person = people[i].asDict();
+        MutableDict changed = person.mutableCopy();
+        changed["name"] = "Person " + std::to_string(i);
+        olds.push_back(person);
+        deltaData.push_back(i == 500 ? alloc_slice("{\"foo\":") : JSONDelta::create(person, changed));
+        expected.push_back(changed.toJSONString());
+    }
+    for (auto &d : deltaData)
+        deltas.push_back(d);
+
+    for (unsigned nThreads : {1u, 4u, 0u}) {
+        INFO("nThreads = " << nThreads);
+        std::vector<FLValue> oldValues(olds.begin(), olds.end());
+        std::vector<FLSlice> deltaSlices(deltas.begin(), deltas.end());
+        std::vector<FLSliceResult> results(olds.size());
+        std::vector<FLError> errors(olds.size());
+        CHECK(!FLApplyJSONDeltas(olds.size(), oldValues.data(), deltaSlices.data(),
+                                 results.data(), errors.data(), nThreads));
+        for (size_t i = 0; i < olds.size(); ++i) {
+            alloc_slice result(std::move(results[i]));
+            if (i == 500) {
+                CHECK(!result);
+                CHECK(errors[i] == kFLJSONError);
+            } else {
+                CHECK(errors[i] == kFLNoError);
+                CHECK(Value::fromData(result).toJSONString() == expected[i]);
+            }
+        }
+
+        auto results2 = JSONDelta::applyMany(olds, deltas, nThreads);
+        REQUIRE(results2.size() == olds.size());
+        CHECK(!results2[500]);
+        CHECK(Value::fromData(results2[999]).toJSONString() == expected[999]);
+    }
+}
+
+
+TEST_CASE("API Visit Parallel", "[API]") {
+    Doc doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+    Value root = doc.root();
+
+    size_t expectedCount = 0, expectedDepth = 0;
+    FLDeepIterator iter = FLDeepIterator_New(root);
+    for (; FLDeepIterator_GetValue(iter); FLDeepIterator_Next(iter)) {
+        ++expectedCount;
+        expectedDepth += FLDeepIterator_GetDepth(iter);
+    }
+    FLDeepIterator_Free(iter);
+
+    struct Totals {size_t count = 0, depth = 0, nStates = 0;};
+    FLParallelVisitor visitor = {
+        [](void *context) -> void* {
+            return new Totals;
+        },
+        [](void *state, FLValue value, const FLPathComponent *path, size_t depth) {
+            ((Totals*)state)->count++;
+            ((Totals*)state)->depth += depth;
+            return true;
+        },
+        [](void *context, void *state) {
+            auto totals = (Totals*)context, stateTotals = (Totals*)state;
+            totals->count += stateTotals->count;
+            totals->depth += stateTotals->depth;
+            totals->nStates++;
+            delete stateTotals;
+        },
+    };
+    for (unsigned nThreads : {1u, 4u}) {
+        Totals totals;
+        FLError error = kFLNoError;
+        CHECK(FLValue_VisitParallel(root, &visitor, &totals, nThreads, &error));
+        CHECK(error == kFLNoError);
+        CHECK(totals.nStates == nThreads);
+        CHECK(totals.count == expectedCount);
+        CHECK(totals.depth == expectedDepth);
+    }
+}
+
+
+TEST_CASE("API Compact", "[API]") {
+    alloc_slice data = Doc::fromJSON("{\"name\":\"A string that will be replaced\",\"n\":1}"_sl).allocedData();
+    FLEncoder enc = FLEncoder_New();
+    FLEncoder_Amend(enc, data, false, false);
+    REQUIRE(FLEncoder_ConvertJSON(enc, "{\"name\":\"Replaced\",\"n\":1}"_sl));
+    alloc_slice delta(FLEncoder_Finish(enc, nullptr));
+    FLEncoder_Free(enc);
+    data.append(delta);
+
+    size_t liveBytes = 0;
+    FLError error = kFLNoError;
+    alloc_slice compacted(FLData_Compact(data, nullptr, &liveBytes, &error));
+    REQUIRE(compacted);
+    CHECK(error == kFLNoError);
+    CHECK(liveBytes < data.size);
+    CHECK(compacted.size <= liveBytes);
+    CHECK(Value::fromData(compacted).toJSONString() == "{\"n\":1,\"name\":\"Replaced\"}");
+
+    CHECK(!alloc_slice(FLData_Compact("not fleece"_sl, nullptr, nullptr, &error)));
+    CHECK(error == kFLInvalidData);
+}
+
+
+TEST_CASE("API Checksum", "[API]") {
+    FLEncoder enc = FLEncoder_New();
+    FLEncoder_SetChecksum(enc, true);
+    REQUIRE(FLEncoder_ConvertJSON(enc, "{\"name\":\"Checksummed\",\"n\":1}"_sl));
+    alloc_slice data(FLEncoder_Finish(enc, nullptr));
+    FLEncoder_Free(enc);
+    REQUIRE(data);
+
+    FLValue root = FLValue_FromData(data, kFLTrustedIfChecksummed);
+    REQUIRE(root);
+    CHECK(Value(root).toJSONString() == "{\"n\":1,\"name\":\"Checksummed\"}");
+    CHECK(FLValue_FromData(data, kFLUntrusted) == root);
+
+    FLDoc doc = FLDoc_FromResultData(FLSlice_Copy(data), kFLTrustedIfChecksummed, nullptr, {});
+    CHECK(FLValue_IsEqual(FLDoc_GetRoot(doc), root));
+    FLDoc_Release(doc);
+}
+
+
+TEST_CASE("API Doc Reinit", "[API]") {
+    FLDoc doc = FLDoc_FromJSON("[1]"_sl, nullptr);
+    alloc_slice data = Doc::fromJSON("{\"n\":2}"_sl).allocedData();
+    FLDoc_Reinit(doc, FLSliceResult(alloc_slice(data)), kFLUntrusted, nullptr, {});
+    CHECK(FLValue_AsInt(FLDict_Get(FLValue_AsDict(FLDoc_GetRoot(doc)), "n"_sl)) == 2);
+    FLDoc found = FLValue_FindDoc(FLDoc_GetRoot(doc));
+    CHECK(found == doc);
+    FLDoc_Release(found);
+    FLDoc_Release(doc);
+}
+
+
+TEST_CASE("API Value Refs", "[API]") {
+    FLDoc doc = FLDoc_FromJSON("{\"a\":[10,{\"b\":\"hi\"}],\"c\":true}"_sl, nullptr);
+    FLResetStats();
+    FLValueRef root = FLDoc_GetRootRef(doc);
+    FLValueRef b = FLValueRef_Get(FLValueRef_GetAt(FLValueRef_Get(root, "a"_sl), 1), "b"_sl);
+    CHECK(FLValue_AsString(b.value) == "hi"_sl);
+    CHECK(b.doc == doc);
+    CHECK(FLValueRef_Get(root, "nope"_sl).value == nullptr);
+    CHECK(FLValueRef_GetAt(root, 0).value == nullptr);
+
+    // Retaining a reference retains its Doc, without looking it up:
+    FLValueRef_Retain(b);
+    CHECK(FLGetStats().scopeLookups == 0);
+    FLDoc_Release(doc);
+    CHECK(FLValue_AsString(b.value) == "hi"_sl);
+    FLValueRef_Release(b);
+
+    // A mutable value is retained itself:
+    FLMutableDict md = FLMutableDict_New();
+    FLMutableDict_SetInt(md, "x"_sl, 5);
+    FLValueRef mref = FLValue_MakeRef((FLValue)md);
+    CHECK(mref.doc == nullptr);
+    FLValueRef_Retain(mref);
+    FLMutableDict_Release(md);
+    CHECK(FLValue_AsInt(FLValueRef_Get(mref, "x"_sl).value) == 5);
+    FLValueRef_Release(mref);
+}
+
+
+TEST_CASE("API Explicit SharedKeys", "[API][SharedKeys]") {
+    FLSharedKeys sk = FLSharedKeys_New();
+    FLEncoder enc = FLEncoder_New();
+    FLEncoder_SetSharedKeys(enc, sk);
+    FLEncoder_BeginDict(enc, 1);
+    FLEncoder_WriteKey(enc, "language"_sl);
+    FLEncoder_BeginDict(enc, 1);
+    FLEncoder_WriteKey(enc, "name"_sl);
+    FLEncoder_WriteString(enc, "Cobol"_sl);
+    FLEncoder_EndDict(enc);
+    FLEncoder_EndDict(enc);
+    FLSliceResult data = FLEncoder_Finish(enc, nullptr);
+    FLEncoder_Free(enc);
+    REQUIRE(data.buf);
+
+    // No Doc, so nothing has registered the SharedKeys:
+    FLDict root = FLValue_AsDict(FLValue_FromData(FLSliceResult_AsSlice(data), kFLTrusted));
+    FLDict lang = FLValue_AsDict(FLDict_GetWithSharedKeys(root, "language"_sl, sk));
+    REQUIRE(lang);
+    CHECK(FLValue_AsString(FLDict_GetWithSharedKeys(lang, "name"_sl, sk)) == "Cobol"_sl);
+
+    FLDictIterator iter;
+    FLDictIterator_BeginWithSharedKeys(root, sk, &iter);
+    CHECK(FLDictIterator_GetKeyString(&iter) == "language"_sl);
+    FLDictIterator_End(&iter);
+
+    FLSliceResult json = FLValue_ToJSONWithSharedKeys(FLValue(root), false, false, sk);
+    CHECK(slice(json) == "{\"language\":{\"name\":\"Cobol\"}}"_sl);
+    FLSliceResult_Release(json);
+
+    FLKeyPath path = FLKeyPath_New("language.name"_sl, nullptr);
+    CHECK(FLValue_AsString(FLKeyPath_EvalWithSharedKeys(path, FLValue(root), sk)) == "Cobol"_sl);
+    FLKeyPath_Free(path);
+
+    FLSliceResult_Release(data);
+    FLSharedKeys_Release(sk);
+}
+
+
+TEST_CASE("API Value Hash", "[API]") {
+    FLSliceResult data[2];
+    for (int embed = 0; embed < 2; ++embed) {
+        FLEncoder enc = FLEncoder_New();
+        FLEncoder_SetEmbedHashes(enc, embed);
+        FLEncoder_BeginArray(enc, 100);
+        for (int i = 0; i < 100; ++i)
+            FLEncoder_WriteInt(enc, i * i);
+        FLEncoder_EndArray(enc);
+        data[embed] = FLEncoder_Finish(enc, nullptr);
+        FLEncoder_Free(enc);
+        REQUIRE(data[embed].buf);
+    }
+    CHECK(data[1].size > data[0].size);
+
+    FLValue a = FLValue_FromData(FLSliceResult_AsSlice(data[0]), kFLTrusted);
+    FLValue b = FLValue_FromData(FLSliceResult_AsSlice(data[1]), kFLTrusted);
+    CHECK(FLValue_Hash(a) == FLValue_Hash(b));
+    CHECK(FLValue_Hash(FLArray_Get(FLValue_AsArray(a), 1)) != FLValue_Hash(a));
+    CHECK(FLValue_Hash(nullptr) == 0);
+
+    FLSliceResult_Release(data[0]);
+    FLSliceResult_Release(data[1]);
+}
+
+
+// Checks that the inline accessors agree with the library on a Value and everything in it.
+static void checkInlineAccessors(FLValue v) {
+    CHECK(FLValue_GetType_Inline(v) == FLValue_GetType(v));
+    CHECK(FLValue_IsInteger_Inline(v) == FLValue_IsInteger(v));
+    CHECK(FLValue_IsUnsigned_Inline(v) == FLValue_IsUnsigned(v));
+    CHECK(FLValue_IsDouble_Inline(v) == FLValue_IsDouble(v));
+    CHECK(FLValue_AsBool_Inline(v) == FLValue_AsBool(v));
+    CHECK(FLValue_AsInt_Inline(v) == FLValue_AsInt(v));
+    CHECK(FLValue_AsUnsigned_Inline(v) == FLValue_AsUnsigned(v));
+    CHECK(FLValue_AsFloat_Inline(v) == FLValue_AsFloat(v));
+    CHECK(FLValue_AsDouble_Inline(v) == FLValue_AsDouble(v));
+    if (FLArray a = FLValue_AsArray(v); a || !v) {
+        uint32_t count = FLArray_Count(a);
+        CHECK(FLArray_Count_Inline(a) == count);
+        CHECK(FLArray_IsEmpty_Inline(a) == FLArray_IsEmpty(a));
+        for (uint32_t i = 0; i <= count; ++i) {
+            FLValue item = FLArray_Get(a, i);
+            CHECK(FLArray_Get_Inline(a, i) == item);
+            if (item)
+                checkInlineAccessors(item);
+        }
+    }
+}
+
+TEST_CASE("API Inline Accessors", "[API]") {
+    CHECK(FLInline_IsCompatible());
+
+    Encoder enc;
+    enc.beginArray();
+    for (int64_t i : std::initializer_list<int64_t>{0, 1, -1, 2047, -2048, 2048, -2049, 255, -129,
+                                                   0x7FFF, -0x8000, int64_t(1) << 40, -(int64_t(1) << 40), INT64_MAX, INT64_MIN})
+        enc.writeInt(i);
+    enc.writeUInt(UINT64_MAX);
+    enc.writeUInt(uint64_t(1) << 63);
+    enc.writeFloat(3.5f);
+    enc.writeFloat(-0.0f);
+    enc.writeDouble(0.25);
+    enc.writeDouble(-1e300);
+    enc.writeBool(true);
+    enc.writeBool(false);
+    enc.writeNull();
+    enc.writeUndefined();
+    enc.writeString("hi");
+    enc.writeString(string(100, 'x'));
+    enc.writeData("\x01\x02"_sl);
+    enc.beginArray();
+    enc.endArray();
+    enc.beginDict();
+    enc.writeKey("k"_sl);
+    enc.writeInt(12345678);
+    enc.endDict();
+    enc.beginArray();                   // A long array
+    for (int i = 0; i < 3000; ++i)
+        enc.writeInt(i);
+    enc.endArray();
+    enc.beginArray();                   // A wide array, since the string's too far back
+    enc.writeString(string(70000, 'y'));
+    enc.writeInt(12345678);
+    enc.endArray();
+    enc.endArray();
+    Doc doc = enc.finishDoc();
+    REQUIRE(doc);
+    checkInlineAccessors(doc.root());
+    checkInlineAccessors(nullptr);
+
+    MutableArray mut = doc.root().asArray().mutableCopy();
+    mut.append(7);
+    mut.append("mutable"_sl);
+    mut.append(-2.5);
+    REQUIRE(mut.isMutable());
+    checkInlineAccessors(mut);
+}
+
+
+TEST_CASE("API Canonical Encoding", "[API][Encoder]") {
+    FLSharedKeys sk = FLSharedKeys_New();
+    FLSliceResult data[2];
+    for (int i = 0; i < 2; ++i) {
+        FLEncoder enc = FLEncoder_New();
+        FLEncoder_SetSharedKeys(enc, sk);
+        FLEncoder_SetCanonical(enc, true);
+        FLEncoder_BeginDict(enc, 2);
+        FLEncoder_WriteKey(enc, "answer"_sl);
+        if (i == 0)
+            FLEncoder_WriteDouble(enc, 42.0);
+        else
+            FLEncoder_WriteUInt(enc, 42);
+        FLEncoder_WriteKey(enc, "question"_sl);
+        FLEncoder_WriteString(enc, "unknown"_sl);
+        FLEncoder_EndDict(enc);
+        data[i] = FLEncoder_Finish(enc, nullptr);
+        FLEncoder_Free(enc);
+        REQUIRE(data[i].buf);
+    }
+    CHECK(FLSlice_Equal(FLSliceResult_AsSlice(data[0]), FLSliceResult_AsSlice(data[1])));
+    CHECK(FLSharedKeys_Count(sk) == 0);
+
+    FLEncoder enc = FLEncoder_New();
+    FLEncoder_SetCanonical(enc, true);
+    FLEncoder_BeginDict(enc, 2);
+    FLEncoder_WriteKey(enc, "question"_sl);
+    FLEncoder_WriteNull(enc);
+    FLEncoder_WriteKey(enc, "answer"_sl);
+    FLEncoder_WriteNull(enc);
+    CHECK(!FLEncoder_EndDict(enc));
+    CHECK(FLEncoder_GetError(enc) == kFLEncodeError);
+    FLEncoder_Free(enc);
+
+    FLSliceResult_Release(data[0]);
+    FLSliceResult_Release(data[1]);
+    FLSharedKeys_Release(sk);
+}
+
+
+TEST_CASE("API Stats", "[API]") {
+    FLResetStats();
+    FLStats stats = FLGetStats();
+    CHECK(stats.dictLookups == 0);
+    CHECK(stats.validations == 0);
+
+    Doc jsonDoc = Doc::fromJSON("{\"name\":\"Nathan\",\"kind\":\"cat\",\"also\":\"cat\"}"_sl);
+    REQUIRE(jsonDoc);
+    stats = FLGetStats();
+    CHECK(stats.encodedBytes == jsonDoc.data().size);
+    CHECK(stats.dedupedStrings == 1);
+
+    // Only untrusted data is validated (except in debug builds, which check trusted data too):
+    FLResetStats();
+    Doc doc(alloc_slice(jsonDoc.data()), kFLUntrusted);
+    REQUIRE(doc);
+    stats = FLGetStats();
+    CHECK(stats.validations == 1);
+    CHECK(stats.validatedBytes == doc.data().size);
+
+    Dict root = doc.root().asDict();
+    CHECK(root["name"_sl].asString() == "Nathan"_sl);
+    CHECK(!root["nope"_sl]);
+    stats = FLGetStats();
+    CHECK(stats.dictLookups == 2);
+    CHECK(stats.dictKeyComparisons > 0);
+
+    CHECK(FLValue_FindDoc(root["kind"_sl]) == (FLDoc)doc);
+    CHECK(FLGetStats().scopeLookups >= 1);
+
+    MutableDict copy = root.mutableCopy();
+    copy["kind"_sl] = "dog"_sl;
+    stats = FLGetStats();
+    CHECK(stats.mutablePromotions == 1);
+    CHECK(stats.heapValues >= 1);
+
+    // A thread's counts are all added to the totals when it exits. (The lookups' results are
+    // used, and their keys vary, since the compiler may skip redundant calls to FLDict_Get.)
+    FLResetStats();
+    size_t totalSize = 0;
+    thread([&] {
+        for (int i = 0; i < 10; ++i)
+            totalSize += root[(i % 2) ? "name"_sl : "kind"_sl].asString().size;
+    }).join();
+    CHECK(totalSize == 5 * 6 + 5 * 3);
+    CHECK(FLGetStats().dictLookups == 10);
+}
+
+
+TEST_CASE("API Tracer", "[API]") {
+    struct Event {string op; size_t inputSize, outputSize; bool ended;};
+    vector<Event> events;
+    FLTracer tracer = {};
+    tracer.context = &events;
+    tracer.begin = [](void *context, const char *op, size_t inputSize) {
+        ((vector<Event>*)context)->push_back({op, inputSize, 0, false});
+    };
+    tracer.end = [](void *context, const char *op, size_t inputSize, size_t outputSize,
+                    double seconds) {
+        auto &events = *(vector<Event>*)context;
+        auto e = find_if(events.rbegin(), events.rend(), [&](auto &e) {return !e.ended;});
+        REQUIRE(e != events.rend());
+        CHECK(e->op == op);
+        CHECK(e->inputSize == inputSize);
+        CHECK(seconds >= 0.0);
+        e->outputSize = outputSize;
+        e->ended = true;
+    };
+    FLSetTracer(&tracer);
+
+    slice json = "{\"name\":\"Nathan\",\"kind\":\"cat\"}";
+    Doc doc = Doc::fromJSON(json);
+    REQUIRE(doc);
+    auto ops = [&] {
+        vector<string> result;
+        for (auto &e : events) {
+            CHECK(e.ended);
+            result.push_back(e.op);
+        }
+        return result;
+    };
+    // (Debug builds also validate trusted data, so JSON conversion may be followed by a
+    // "Value::fromData" event.)
+    auto allOps = ops();
+    REQUIRE(allOps.size() >= 3);
+    allOps.resize(3);
+    CHECK(allOps == (vector<string>{"JSONConverter::encodeJSON", "Encoder::finish", "Doc"}));
+    CHECK(events[0].inputSize == json.size);
+    CHECK(events[1].outputSize == doc.data().size);
+    CHECK(events[2].inputSize == doc.data().size);
+
+    // Validating untrusted data is a span inside the Doc's:
+    events.clear();
+    Doc untrusted(doc.allocedData(), kFLUntrusted);
+    REQUIRE(untrusted);
+    CHECK(ops() == (vector<string>{"Doc", "Value::fromData"}));
+    CHECK(events[1].inputSize == doc.data().size);
+
+    events.clear();
+    Doc doc2 = Doc::fromJSON("{\"name\":\"Nathan\",\"kind\":\"dog\"}"_sl);
+    events.clear();
+    alloc_slice delta = JSONDelta::create(doc.root(), doc2.root());
+    REQUIRE(events.size() == 1);
+    CHECK(events[0].op == "JSONDelta::create");
+    CHECK(events[0].inputSize == doc.data().size + doc2.data().size);
+    CHECK(events[0].outputSize == delta.size);
+
+    // Small operations can be skipped:
+    events.clear();
+    tracer.minInputSize = 100;
+    FLSetTracer(&tracer);
+    Doc::fromJSON(json);
+    CHECK(events.empty());
+
+    FLSetTracer(nullptr);
+    Doc::fromJSON(json);
+    CHECK(events.empty());
+}
+
+
+TEST_CASE("API Memory Usage", "[API]") {
+    string json = "{\"names\":[";
+    for (int i = 0; i < 100; ++i)
+        json += (i ? ",\"" : "\"") + to_string(i) + " is a number that needs a long string\"";
+    json += "]}";
+    Doc doc = Doc::fromJSON(slice(json));
+    REQUIRE(doc);
+    size_t docUsage = doc.memoryUsage();
+    CHECK(docUsage > doc.data().size);
+    CHECK(docUsage < doc.data().size + 1000);
+
+    // Mutable copies are counted separately, and start small:
+    MutableDict copy = doc.root().asDict().mutableCopy();
+    size_t copyUsage = copy.memoryUsage();
+    CHECK(copyUsage > 0);
+    CHECK(copyUsage < 500);
+    CHECK(doc.memoryUsage() == docUsage);
+
+    // Promoting a nested collection adds it (a big Array only remembers its changed items);
+    // new strings add their copies:
+    MutableArray names = copy.getMutableArray("names"_sl);
+    REQUIRE(names);
+    size_t namesUsage = names.memoryUsage();
+    CHECK(namesUsage > 0);
+    CHECK(namesUsage < 100 * sizeof(void*));
+    CHECK(copy.memoryUsage() >= copyUsage + namesUsage);
+    size_t before = copy.memoryUsage();
+    names[0] = slice(string(1000, 'x'));
+    CHECK(copy.memoryUsage() >= before + 1000);
+
+    // A value in the tree twice is only counted once:
+    before = copy.memoryUsage();
+    copy["again"_sl] = names;
+    CHECK(copy.memoryUsage() - before < namesUsage);
+
+    // A deep copy into an arena counts the arena's memory:
+    MutableDict arenaCopy = doc.root().asDict().mutableCopy(FLCopyFlags(kFLDeepCopy | kFLCopyToArena));
+    CHECK(arenaCopy.memoryUsage() >= 16384);
+
+    CHECK(FLDoc_GetMemoryUsage(nullptr) == 0);
+    CHECK(FLMutableDict_GetMemoryUsage(nullptr) == 0);
+}
+
+
+TEST_CASE("API Rejecting Bad Input", "[API]") {
+    // These errors are reported without throwing internally:
+    for (const char *json : {"{\"a\":", "[1, 2,, 3]", "{\"a\" 1}", "\"\\uZZZZ\""}) {
+        INFO("JSON is " << json);
+        FLError error = kFLNoError;
+        FLDoc doc = FLDoc_FromJSON(slice(json), &error);
+        CHECK(doc == nullptr);
+        CHECK(error == kFLJSONError);
+    }
+    FLError error = kFLNoError;
+    FLDoc doc = FLDoc_FromJSON("{\"ok\":true}"_sl, &error);
+    CHECK(doc);
+    CHECK(error == kFLNoError);
+    FLDoc_Release(doc);
+
+    FLEncoder enc = FLEncoder_New();
+    FLEncoder_BeginArray(enc, 2);
+    CHECK(FLEncoder_WriteDouble(enc, 1.5));
+    CHECK(!FLEncoder_WriteDouble(enc, NAN));
+    CHECK(FLEncoder_GetError(enc) == kFLInvalidData);
+    CHECK(string(FLEncoder_GetErrorMessage(enc)) == "invalid input data: Can't write NaN");
+    CHECK(!FLEncoder_WriteFloat(enc, NAN));
+    CHECK(!FLEncoder_EndArray(enc));
+    FLSliceResult result = FLEncoder_Finish(enc, &error);
+    CHECK(!result.buf);
+    CHECK(error == kFLInvalidData);
+    // The encoder is usable again after the error:
+    CHECK(FLEncoder_WriteInt(enc, 17));
+    result = FLEncoder_Finish(enc, &error);
+    CHECK(result.buf);
+    FLSliceResult_Release(result);
+    FLEncoder_Free(enc);
+}
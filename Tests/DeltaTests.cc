@@ -19,7 +19,10 @@
 #include "FleeceTests.hh"
 #include "FleeceImpl.hh"
 #include "JSONDelta.hh"
+#include "MutableDict.hh"
+#include "ByteDiff.hh"
 #include <iostream>
+#include <random>
 
 namespace fleece { namespace impl {
     extern bool gCompatibleDeltas;
@@ -70,6 +73,33 @@ static void checkDelta(const char *json1, const char *json2, const char *deltaEx
         INFO("value2 reconstituted:  " << toJSONString(v2_reconstituted) << " ;  should be:  " << toJSONString(v2) << " ;  delta: " << jsonDelta);
         CHECK(v2_reconstituted->isEqual(v2));
     }
+
+    if (jsonDelta.size > 0 && v1 && v1->asDict() && v2 && v2->asDict()) {
+        // Apply the delta in place to a mutable copy of the old value:
+        Retained<MutableDict> mutableDict = MutableDict::newDict(v1->asDict());
+        JSONDelta::applyTo(mutableDict, jsonDelta, true);
+        INFO("value2 updated in place:  " << mutableDict->toJSONString());
+        CHECK(mutableDict->isEqual(v2));
+    }
+
+    // Now do the same with a Fleece-encoded delta, with and without the same SharedKeys:
+    for (int withSharedKeys = 0; withSharedKeys <= 1; ++withSharedKeys) {
+        Encoder enc;
+        if (withSharedKeys)
+            enc.setSharedKeys(sk);
+        CHECK(JSONDelta::create(v1, v2, enc) == (slice(deltaExpected) != "{}"_sl));
+        Retained<Doc> deltaDoc = new Doc(enc.finish(), Doc::kUntrusted,
+                                         (withSharedKeys ? sk.get() : nullptr));
+        const Value *fleeceDelta = deltaDoc->root();
+        REQUIRE(fleeceDelta);
+        alloc_slice expectedData = JSONConverter::convertJSON5(slice(jsonDelta));
+        CHECK(fleeceDelta->isEqual(Value::fromData(expectedData)));
+
+        alloc_slice f2_reconstituted = JSONDelta::apply(v1, fleeceDelta);
+        auto v2_reconstituted = Value::fromData(f2_reconstituted);
+        INFO("value2 reconstituted from Fleece delta:  " << toJSONString(v2_reconstituted));
+        CHECK(v2_reconstituted->isEqual(v2));
+    }
 }
 
 
@@ -104,11 +134,11 @@ TEST_CASE("Delta strings", "[delta]") {
     // Modify string
     checkDelta("'to wound the autumnal city. So howled out for the world to give him a name.  The in-dark answered with the wind.'",
                "'To wound the eternal city. So he howled out for the world to give him its name. The in-dark answered with wind.'",
-               "[\"1-1+T|12=5-4+eter|13=3+he |37=1-3+its|6=1-27=4-5=\",0,2]");
+               "[\"1-1+T|12=5-4+eter|14=3+e h|36=1-3+its|7=1-25=4-6=\",0,2]");
     // Insert in middle
     checkDelta("'to wound the autumnal city. The in-dark answered with the wind.'",
                "'to wound the autumnal city. So howled out for the world to give him a name. The in-dark answered with the wind.'",
-               "[\"27=48+ So howled out for the world to give him a name.|36=\",0,2]");
+               "[\"28=48+So howled out for the world to give him a name. |35=\",0,2]");
     // Inefficient delta
     checkDelta("'Lorem ipsum dolor sit amet, assueverit sadipscing usu ea, mei efficiantur intellegebat in, iudico ullamcorper ei ius. Ius quaeque eripuit instructior ea, et ipsum doctus quo, pri decore ornatus et. Te wisi omittantur interpretaris quo, in audire prompta nominati vim. Dicat epicuri delectus sit eu.'",
                "'Ex quo prima efficiantur, an pro modus pertinax. Magna tractatos qualisque vim id. Eum at omnis inani, labore possim nec id. Exerci audire eam eu, summo liberavisse mel ei. Homero ponderum ea his, cum id impedit fuisset.'",
@@ -116,7 +146,7 @@ TEST_CASE("Delta strings", "[delta]") {
     // Delta control chars in string
     checkDelta("'ABC+DEF-HIJ=KLM|NOP *******************************'",
                "'AbC-def+HIJKLM|NOP= *******************************'",
-               "[\"1=7-7+bC-def+|3=1-7=1+=|32=\",0,2]");
+               "[\"1=11-10+bC-def+HIJ|7=1+=|32=\",0,2]");
 
     JSONDelta::gMinStringDiffLength = 60;
 }
@@ -129,7 +159,7 @@ TEST_CASE("Delta strings UTF-8", "[delta]") {
     // Multi-byte UTF-8 chars, with patches occurring in midst of UTF-8 sequences:
     checkDelta(u8"'モバイルデータベースは将来のものです。 ある日、私たちのデータが端に集まります。'",
                u8"'モバイルデータベースがここにあります。 あなたのデータはすべて端にあります。'",
-               u8"[\"30=49-37+がここにあります。 あなた|12=3-12+はすべて|6=3-3-3+あ|12=\",0,2]");
+               u8"[\"30=24-24+がここにあります|7=18-6+なた|12=3-12+はすべて|6=6-3+あ|12=\",0,2]");
 
     // Here the C7/C6 bytes can't be included in the preceding XXX/YYY diff:
     checkDelta("'<aaaaaaaaXXX\xC7\x88zzzzzzzz>'",
@@ -138,7 +168,7 @@ TEST_CASE("Delta strings UTF-8", "[delta]") {
 
     checkDelta(u8"'யாமறிந்த மொழிகளிலே தமிழ்மொழி போல் இனிதாவது எங்கும் காணோம், பாமரராய் விலங்குகளாய், உலகனைத்தும் இகழ்ச்சிசொலப் பான்மை கெட்டு, நாமமது தமிழரெனக் கொண்டு இங்கு வாழ்ந்திடுதல் நன்றோ? சொல்லீர்! தேமதுரத் இகழ்ச்சிசொலப் உலகமெலாம் பரவும்வகை செய்தல் வேண்டும்.'",
                u8"'யாமறிந்த மொழிகளிலே தமிழ்மொழி போல் இனிதாவது எங்கும் காணோம், பாமரராய் விலங்குகளாய், உலகனைத்தும் இகழ்ச்சிசொலப் பான்மை கெட்டு, நாமமது தமிழரெனக் கொண்டு இங்கு வாழ்ந்திடுதல் நன்றோ? கொண்டு! தேமதுரத் தமிழோசை உலகமெலாம் பரவும்வகை செய்தல் வேண்டும்.'",
-               "[\"476=3-3+க|3=3-3+ண|3=12-6+டு|27=21-6+தம|3=15-12+ழோசை|104=\",0,2]");
+               "[\"476=24-18+கொண்டு|27=39-21+தமிழோசை|104=\",0,2]");
 
     JSONDelta::gMinStringDiffLength = 60;
 }
@@ -184,6 +214,7 @@ TEST_CASE("Delta simple arrays", "[delta]") {
     checkDelta("[]", "[1, 2, 3]", "[[1,2,3]]");
     checkDelta("[1, 2, 3]", "[]", "[[]]");
     checkDelta("[1, 2, 3, 5, 6, 7]", "[1, 2, 3, 4, 5]", "{\"3\":4,\"4\":5,\"5-\":[]}"); // non-optimal - could be {"3-":[4,5]}
+    checkDelta("[1, 2, 3]", "[0, 1, 2, 3]", "{\"0\":0,\"1\":1,\"2\":2,\"3-\":[3]}");
     checkDelta("[1, 2, 3]", "[1, 2, 3, 4, 5]", "{\"3-\":[4,5]}");
     checkDelta("[1, 2, 3, 4, 5]", "[1, 2, 3]", "{\"3-\":[]}");
     checkDelta("[1, 2, 3]", "[1, 9, 3]", "{\"1\":9}");
@@ -192,6 +223,157 @@ TEST_CASE("Delta simple arrays", "[delta]") {
 }
 
 
+TEST_CASE("Delta array insertions and deletions", "[delta]") {
+    JSONDelta::gArraySplices = true;
+    checkDelta("[1, 2, 3, 5, 6, 7]", "[1, 2, 3, 4, 5]", "{\"3-0\":[4],\"4-\":[]}");
+    checkDelta("[1, 2, 3]", "[0, 1, 2, 3]", "{\"0-0\":[0]}");
+    checkDelta("[1, 2, 3]", "[1, 2, 2.5, 3]", "{\"2-0\":[2.5]}");
+    checkDelta("[1, 2, 3, 4]", "[1, 4]", "{\"1-2\":[]}");
+    checkDelta("[1, 2, 3, 4]", "[2, 3, 4]", "{\"0-1\":[]}");
+    checkDelta("[1, 2, 3, 4]", "[2, 3, 4, 1]", "{\"0-1\":[],\"4-\":[1]}");     // a move
+    checkDelta("[1, 2, 3, 4, 5]", "[0, 1, 9, 3, 5, 6]", "{\"0-0\":[0],\"1\":9,\"3-1\":[],\"5-\":[6]}");
+    checkDelta("[{'a':1}, {'b':2}]", "[{'z':0}, {'a':1}, {'b':3}]", "{\"0-0\":[{z:0}],\"1\":{b:3}}");
+    checkDelta("[[1, 2], [3, 4]]", "[[0], [1, 2], [3, 4, 5]]", "{\"0-0\":[[0]],\"1\":{\"2-\":[5]}}");
+    JSONDelta::gArraySplices = false;
+}
+
+
+TEST_CASE("Delta size limit", "[delta]") {
+    Encoder enc1, enc2;
+    enc1.beginDictionary();
+    enc2.beginDictionary();
+    for (int i = 0; i < 1000; ++i) {
+        char key[20];
+        sprintf(key, "k%04d", i);
+        enc1.writeKey(key); enc1.writeInt(i);
+        enc2.writeKey(key); enc2.writeInt(i == 500 ? -1 : -i);
+    }
+    enc1.endDictionary();
+    enc2.endDictionary();
+    Retained<Doc> doc1 = new Doc(enc1.finish()), doc2 = new Doc(enc2.finish());
+    auto old = doc1->root(), nuu = doc2->root();
+
+    // A small change fits:
+    Retained<MutableDict> small = MutableDict::newDict(old->asDict());
+    small->set("k0500"_sl, -1);
+    alloc_slice delta = JSONDelta::createIfSmaller(old, small, 100);
+    CHECK(delta == "{\"k0500\":-1}"_sl);
+    CHECK(JSONDelta::createIfSmaller(old, old, 100) == "{}"_sl);
+
+    // Rewriting almost every value doesn't:
+    alloc_slice fullDelta = JSONDelta::create(old, nuu);
+    CHECK(fullDelta.size > 1000);
+    CHECK(!JSONDelta::createIfSmaller(old, nuu, 1000));
+    CHECK(!JSONDelta::createIfSmaller(old, nuu, fullDelta.size - 1));
+    CHECK(JSONDelta::createIfSmaller(old, nuu, fullDelta.size) == fullDelta);
+}
+
+
+TEST_CASE("Delta create parallel", "[delta]") {
+    Encoder enc1, enc2;
+    enc1.beginDictionary();
+    enc2.beginDictionary();
+    for (int i = 0; i < 2000; ++i) {
+        char key[20];
+        sprintf(key, "k%04d", i);
+        if (i % 7 != 3) {
+            enc1.writeKey(key);
+            enc1.beginDictionary();
+            enc1.writeKey("n"); enc1.writeInt(i);
+            enc1.writeKey("s"); enc1.writeString("some string");
+            enc1.endDictionary();
+        }
+        if (i % 11 != 5) {
+            enc2.writeKey(key);
+            enc2.beginDictionary();
+            enc2.writeKey("n"); enc2.writeInt(i % 5 == 0 ? -i : i);
+            enc2.writeKey("s"); enc2.writeString("some string");
+            enc2.endDictionary();
+        }
+    }
+    enc1.endDictionary();
+    enc2.endDictionary();
+    Retained<Doc> doc1 = new Doc(enc1.finish()), doc2 = new Doc(enc2.finish());
+    auto old = doc1->root(), nuu = doc2->root();
+
+    for (bool json5 : {false, true}) {
+        alloc_slice serial = JSONDelta::create(old, nuu, json5);
+        CHECK(serial.size > 1000);
+        for (unsigned nThreads : {1u, 2u, 4u, 0u})
+            CHECK(JSONDelta::createParallel(old, nuu, json5, nThreads) == serial);
+        CHECK(JSONDelta::createParallel(nuu, old, json5, 4) == JSONDelta::create(nuu, old, json5));
+    }
+    CHECK(JSONDelta::createParallel(old, old, false, 4) == "{}"_sl);
+    Retained<MutableDict> copy = MutableDict::newDict(old->asDict());
+    CHECK(JSONDelta::createParallel(old, copy, false, 4) == "{}"_sl);
+    copy->set("k0001"_sl, 1);
+    CHECK(JSONDelta::createParallel(old, copy, false, 4) == "{\"k0001\":1}"_sl);
+}
+
+
+TEST_CASE("Delta apply in place", "[delta]") {
+    Retained<Doc> doc1 = Doc::fromJSON(R"({"name": "Alice", "untouched": {"x": [1, 2]},
+        "age": 30, "tags": ["a", "b", "c", "d"], "address": {"city": "Oslo", "zip": "0150"},
+        "scores": [[1, 2], [3, 4]]})"_sl);
+    Retained<Doc> doc2 = Doc::fromJSON(R"({"name": "Alice", "untouched": {"x": [1, 2]},
+        "age": 31, "tags": ["z", "a", "c", "d", "e"], "address": {"city": "Bergen"},
+        "scores": [[1, 2], [3, 4, 5]], "big": {"n": 1234567890123456, "s": "a longer string"}})"_sl);
+    auto old = doc1->asDict(), nuu = doc2->asDict();
+    alloc_slice jsonDelta = JSONDelta::create(old, nuu);
+
+    Retained<MutableDict> dict = MutableDict::newDict(old);
+    JSONDelta::applyTo(dict, jsonDelta);
+    jsonDelta.reset();                           // the dict mustn't point into the delta
+    CHECK(dict->isEqual(nuu));
+    // Only the changed values are touched:
+    CHECK(dict->get("untouched"_sl) == old->get("untouched"_sl));
+    CHECK(dict->get("scores"_sl)->asArray()->get(0) == old->get("scores"_sl)->asArray()->get(0));
+
+    // Invalid deltas throw:
+    for (const char *badDelta : {"[1]", "{\"name\":{\"x\":1}}", "{\"tags\":{\"9\":1}}",
+                                 "{\"nope\":[\"1=\",0,2]}", "{\"tags\":{\"0-9\":[]}}"}) {
+        INFO("delta = " << badDelta);
+        CHECK_THROWS_AS(JSONDelta::applyTo(dict, slice(badDelta)), FleeceException);
+    }
+}
+
+
+TEST_CASE("Delta large array insertion", "[delta]") {
+    Encoder enc1, enc2;
+    enc1.beginArray();
+    enc2.beginArray();
+    enc2.writeString("new");
+    for (int i = 0; i < 10000; ++i) {
+        enc1.beginDictionary();
+        enc1.writeKey("n"); enc1.writeInt(i);
+        enc1.endDictionary();
+        enc2.beginDictionary();
+        enc2.writeKey("n"); enc2.writeInt(i == 5000 ? -1 : i);
+        enc2.endDictionary();
+    }
+    enc1.endArray();
+    enc2.endArray();
+    Retained<Doc> doc1 = new Doc(enc1.finish()), doc2 = new Doc(enc2.finish());
+
+    JSONDelta::gArraySplices = true;
+    alloc_slice jsonDelta = JSONDelta::create(doc1->root(), doc2->root());
+    JSONDelta::gArraySplices = false;
+    CHECK(jsonDelta == "{\"0-0\":[\"new\"],\"5000\":{\"n\":-1}}"_sl);
+    alloc_slice result = JSONDelta::apply(doc1->root(), jsonDelta);
+    CHECK(Value::fromData(result)->toJSON() == doc2->root()->toJSON());
+}
+
+
+TEST_CASE("Delta invalid array keys", "[delta]") {
+    Retained<Doc> doc = Doc::fromJSON("[1, 2, 3]"_sl);
+    for (const char *delta : {"{\"x\":1}", "{\"1x\":1}", "{\"-1\":1}", "{\"3\":1}",
+                              "{\"1-5\":[]}", "{\"1-1\":[],\"1\":5}", "{\"1-\":9}"}) {
+        INFO("delta = " << delta);
+        CHECK_THROWS_AS(JSONDelta::apply(doc->root(), slice(delta)), FleeceException);
+    }
+}
+
+
 TEST_CASE("Delta nested arrays", "[delta]") {
     checkDelta("[[[]]]", "[[[]]]", nullptr);
     checkDelta("[1,[2,[3]]]", "[1,[2,[3]]]", nullptr);
@@ -201,6 +383,167 @@ TEST_CASE("Delta nested arrays", "[delta]") {
 }
 
 
+// Checks that composing the deltas json1->json2 and json2->json3 gives a delta json1->json3.
+static void checkComposedDelta(const char *json1, const char *json2, const char *json3,
+                               const char *composedExpected =nullptr)
+{
+    Retained<Doc> docs[3];
+    const char* jsons[3] = {json1, json2, json3};
+    for (int i = 0; i < 3; ++i) {
+        auto j = std::string("[") + ConvertJSON5(std::string(jsons[i])) + "]";
+        docs[i] = Doc::fromJSON(slice(j));
+    }
+    auto value = [&](int i) {return docs[i]->root()->asArray()->get(0);};
+
+    alloc_slice delta1 = JSONDelta::create(value(0), value(1), true);
+    alloc_slice delta2 = JSONDelta::create(value(1), value(2), true);
+    alloc_slice composed = JSONDelta::compose(delta1, delta2, true);
+    INFO("delta1 = " << delta1 << " ;  delta2 = " << delta2 << " ;  composed = " << composed);
+    CHECK(isValidUTF8(composed));
+    if (composedExpected)
+        CHECK(composed == slice(composedExpected));
+
+    alloc_slice result = JSONDelta::apply(value(0), composed, true);
+    auto resultValue = Value::fromData(result);
+    INFO("result = " << toJSONString(resultValue));
+    CHECK(resultValue->isEqual(value(2)));
+}
+
+
+TEST_CASE("Delta compose", "[delta]") {
+    JSONDelta::gMinStringDiffLength = 20;
+    JSONDelta::gTextDiffTimeout = -1;
+    JSONDelta::gArraySplices = true;
+
+    // Scalars and dicts:
+    checkComposedDelta("1", "2", "3", "[3]");
+    checkComposedDelta("{a: 1, b: 2}", "{a: 1, b: 2}", "{a: 5, b: 2}", "{a:5}");
+    checkComposedDelta("{a: 1, b: 2}", "{a: 3, b: 2}", "{a: 3}", "{a:3,b:[]}");
+    checkComposedDelta("{a: 1, b: 2}", "{a: 1}", "{a: 1, b: 7}", "{b:7}");
+    checkComposedDelta("{a: 1}", "{a: 1, b: {c: 2}}", "{a: 1, b: {c: 3, d: 4}}",
+                       "{b:[{c:3,d:4}]}");
+    checkComposedDelta("{a: {b: {c: 1, d: 2}}}", "{a: {b: {c: 9, d: 2}}}",
+                       "{a: {b: {c: 9}, e: 0}}", "{a:{b:{c:9,d:[]},e:0}}");
+    checkComposedDelta("{a: [1]}", "{a: {x: 1}}", "{a: {x: 2}}", "{a:[{x:2}]}");
+
+    // Arrays:
+    checkComposedDelta("[1, 2, 3]", "[1, 9, 3]", "[1, 9, 8]", "{\"1\":9,\"2\":8}");
+    checkComposedDelta("[1, 2, 3]", "[0, 1, 2, 3]", "[0, 1, 2, 3, 4]", "{\"0-0\":[0],\"3-\":[4]}");
+    checkComposedDelta("[1, 2, 3, 4]", "[1, 4]", "[1, 5, 4]", "{\"1-2\":[5]}");
+    checkComposedDelta("[1, 2, 3, 4, 5]", "[0, 1, 2, 4, 5]", "[0, 1, 22, 4]",
+                       "{\"0-0\":[0],\"1\":22,\"2-1\":[],\"4-\":[]}");
+    checkComposedDelta("[{a: 1}, {b: 2}]", "[{z: 0}, {a: 1}, {b: 2}]", "[{z: 1}, {a: 1}, {b: 3}]",
+                       "{\"0-0\":[{z:1}],\"1\":{b:3}}");
+    checkComposedDelta("[[1, 2], [3, 4]]", "[[0], [1, 2], [3, 4, 5]]", "[[0], [1, 2, 6], [3, 4, 5]]",
+                       "{\"0\":{\"2-\":[6]},\"0-0\":[[0]],\"1\":{\"2-\":[5]}}");
+    checkComposedDelta("[1, 2, 3]", "[2, 3, 4]", "[3, 4, 5]");
+    checkComposedDelta("[1, 2, 3, 4, 5, 6]", "[1, 3, 4, 7, 6]", "[0, 1, 3, 7, 6, 8]");
+
+    // Strings:
+    checkComposedDelta("'The quick brown fox jumps over the lazy dog'",
+                       "'The quick red fox jumps over the lazy dog'",
+                       "'The quick red fox leaps over the lazy dog!'",
+                       "[\"10=5-3+red|5=3-3+lea|20=1+!|\",0,2]");
+    checkComposedDelta("'The quick brown fox jumps over the lazy dog'",
+                       "'The quick brown fox jumps over the sleepy dog'",
+                       "'The quick brown fox jumps over the sleepy cat'",
+                       "[\"35=3-5+sleep|2=3-3+cat|\",0,2]");
+    checkComposedDelta("{s: 'hi'}", "{s: 'Now for a much longer string'}",
+                       "{s: 'Now for a much longer string!!'}", "{s:\"Now for a much longer string!!\"}");
+
+    JSONDelta::gMinStringDiffLength = 60;
+    JSONDelta::gArraySplices = false;
+}
+
+
+TEST_CASE("Delta compose invalid", "[delta]") {
+    for (auto [delta1, delta2] : {std::pair<const char*,const char*>
+                                    {"{\"a\":[]}",      "{\"a\":{\"b\":1}}"},
+                                    {"{\"a\":[]}",      "{\"a\":[\"3=\",0,2]}"},
+                                    {"{\"a\":[7]}",     "{\"a\":[\"1=\",0,2]}"},
+                                    {"[[1,2]]",         "{\"0-\":[],\"3\":1}"},
+                                    {"{\"1-\":[5]}",    "{\"2\":1}"},
+                                    {"[\"2=\",0,2]",    "[\"3=\",0,2]"}}) {
+        INFO("delta1 = " << delta1 << " ;  delta2 = " << delta2);
+        CHECK_THROWS_AS(JSONDelta::compose(slice(delta1), slice(delta2)), FleeceException);
+    }
+}
+
+
+TEST_CASE("Delta data", "[delta]") {
+    std::mt19937 rng(12345);
+    std::string blob1(20000, 0);
+    for (auto &c : blob1)
+        c = char(rng());
+    std::string blob2 = blob1;
+    blob2[100] ^= 1;                                // change a byte
+    blob2.insert(5000, std::string(50, 'x'));       // insert some bytes
+    blob2.erase(15000, 300);                        // delete some bytes
+    std::string blob3 = blob2;
+    blob3.replace(9000, 20, std::string(30, 'y'));  // a later edit, for composing
+    std::string small = blob1.substr(0, 100);
+
+    auto encode = [](slice blob, slice other) {
+        Encoder enc;
+        enc.beginDictionary();
+        enc.writeKey("blob"); enc.writeData(blob);
+        enc.writeKey("other"); enc.writeData(other);
+        enc.endDictionary();
+        return retained(new Doc(enc.finish()));
+    };
+    auto doc1 = encode(slice(blob1), slice(small)), doc2 = encode(slice(blob2), "tiny"_sl),
+         doc3 = encode(slice(blob3), "tiny"_sl);
+    auto createDelta = [](const Value *old, const Value *nuu) {
+        Encoder enc;
+        CHECK(JSONDelta::create(old, nuu, enc));
+        return retained(new Doc(enc.finish(), Doc::kUntrusted));
+    };
+
+    // A large data value gets a data diff; a small one is replaced:
+    auto delta12 = createDelta(doc1->root(), doc2->root());
+    auto blobDelta = delta12->asDict()->get("blob"_sl)->asArray();
+    REQUIRE(blobDelta);
+    REQUIRE(blobDelta->count() == 3);
+    CHECK(blobDelta->get(2)->asInt() == 4);
+    CHECK(blobDelta->get(0)->asData().size < 1000);
+    CHECK(delta12->asDict()->get("other"_sl)->asData() == "tiny"_sl);
+
+    // The JSON delta has the same diff, base64-encoded:
+    alloc_slice jsonDelta = JSONDelta::create(doc1->root(), doc2->root());
+    CHECK(jsonDelta.size < 1500);
+
+    // Apply it, to a new document and in place:
+    alloc_slice result = JSONDelta::apply(doc1->root(), delta12->root());
+    CHECK(Value::fromData(result)->isEqual(doc2->root()));
+    Retained<MutableDict> dict = MutableDict::newDict(doc1->asDict());
+    JSONDelta::applyTo(dict, delta12->root());
+    CHECK(dict->isEqual(doc2->root()));
+
+    // Compose two data diffs:
+    auto delta23 = createDelta(doc2->root(), doc3->root());
+    Encoder enc;
+    JSONDelta::compose(delta12->root(), delta23->root(), enc);
+    auto delta13 = retained(new Doc(enc.finish()));
+    CHECK(delta13->asDict()->get("blob"_sl)->asArray()->get(2)->asInt() == 4);
+    result = JSONDelta::apply(doc1->root(), delta13->root());
+    CHECK(Value::fromData(result)->isEqual(doc3->root()));
+
+    // Unrelated data isn't diffed:
+    std::string blob4(20000, 0);
+    for (auto &c : blob4)
+        c = char(rng());
+    auto doc4 = encode(slice(blob4), slice(small));
+    auto delta14 = createDelta(doc1->root(), doc4->root());
+    CHECK(delta14->asDict()->get("blob"_sl)->asData() == slice(blob4));
+
+    // A diff that doesn't fit the old data is rejected:
+    auto truncated = encode(slice(blob1).upTo(10000), slice(small));
+    CHECK_THROWS_AS(JSONDelta::apply(truncated->root(), delta12->root()), FleeceException);
+    auto notData = encode(nullslice, slice(small));
+    CHECK_THROWS_AS(JSONDelta::apply(notData->root(), delta12->root()), FleeceException);
+}
+
+
 static void checkDelta(const Value *left, const Value *right, const Value *expectedDelta) {
     if (!expectedDelta)
         expectedDelta = Dict::kEmpty;
@@ -257,6 +600,82 @@ TEST_CASE("JSONDiffPatch test suite", "[delta]") {
 
 
 
+TEST_CASE("ByteDiff", "[delta]") {
+    using Op = ByteDiffOp;
+    CHECK(diffBytes("", "").empty());
+    CHECK(diffBytes("same", "same") == (std::vector<Op>{{Op::kEqual, 4}}));
+    CHECK(diffBytes("", "new") == (std::vector<Op>{{Op::kInsert, 3}}));
+    CHECK(diffBytes("old", "") == (std::vector<Op>{{Op::kDelete, 3}}));
+    CHECK(diffBytes("abcxyz", "abXYz") == (std::vector<Op>{{Op::kEqual, 2}, {Op::kDelete, 3},
+                                                      {Op::kInsert, 2}, {Op::kEqual, 1}}));
+    CHECK(diffBytes("kitten", "sitting") == (std::vector<Op>{{Op::kDelete, 1}, {Op::kInsert, 1},
+                                                        {Op::kEqual, 3}, {Op::kDelete, 1},
+                                                        {Op::kInsert, 1}, {Op::kEqual, 1},
+                                                        {Op::kInsert, 1}}));
+
+    // Applying the ops to the old string must always produce the new one:
+    auto check = [](slice a, slice b, double timeout) {
+        std::string result;
+        size_t ia = 0, ib = 0;
+        for (auto &op : diffBytes(a, b, timeout)) {
+            switch (op.kind) {
+                case Op::kEqual:  result.append((const char*)a.buf + ia, op.length);
+                                  ia += op.length; ib += op.length; break;
+                case Op::kDelete: ia += op.length; break;
+                case Op::kInsert: result.append((const char*)b.buf + ib, op.length);
+                                  ib += op.length; break;
+            }
+        }
+        CHECK(ia == a.size);
+        CHECK(slice(result) == b);
+    };
+    std::mt19937 random(1234);
+    for (int i = 0; i < 100; ++i) {
+        std::string a, b;
+        for (int j = random() % 200; j > 0; --j)
+            a += char('a' + random() % 4);
+        b = a;
+        for (int j = random() % 10; j > 0 && !b.empty(); --j)
+            b[random() % b.size()] = char('a' + random() % 5);
+        b.insert(random() % (b.size() + 1), "qq");
+        check(slice(a), slice(b), 0);
+        check(slice(a), slice(b), 1e-9);   // Expires at once, but must still be valid
+    }
+}
+
+
+TEST_CASE("Perf JSONDelta long strings", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const char* kWords[] = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur",
+                                   "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"};
+    std::mt19937 random(5678);
+    JSONDelta::gTextDiffTimeout = -1;
+    for (size_t size = 1000; size <= 1000000; size *= 10) {
+        std::string oldStr;
+        while (oldStr.size() < size) {
+            oldStr += kWords[random() % 12];
+            oldStr += ' ';
+        }
+        std::string nuuStr = oldStr;
+        for (int i = 0; i < 50; ++i)
+            nuuStr.replace(random() % (nuuStr.size() - 10), 5, kWords[random() % 12]);
+
+        Retained<Doc> doc1 = Doc::fromJSON(slice("[\"" + oldStr + "\"]"));
+        Retained<Doc> doc2 = Doc::fromJSON(slice("[\"" + nuuStr + "\"]"));
+        Benchmark bench;
+        alloc_slice delta;
+        for (int i = 0; i < 20; ++i) {
+            bench.start();
+            delta = JSONDelta::create(doc1->root(), doc2->root());
+            bench.stop();
+        }
+        fprintf(stderr, "%7zu bytes: delta is %5zu bytes; ", oldStr.size(), delta.size);
+        bench.printReport();
+    }
+    JSONDelta::gTextDiffTimeout = 0.25;
+}
+
+
 // Based on utf8_check.c by Markus Kuhn, 2005
 // https://www.cl.cam.ac.uk/~mgk25/ucs/utf8_check.c
 static bool isValidUTF8(fleece::slice sl) noexcept
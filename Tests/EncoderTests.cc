@@ -17,15 +17,36 @@
 //
 
 #include "FleeceTests.hh"
+#include "AccessProfile.hh"
+#include "Aggregates.hh"
+#include "ArraySort.hh"
+#include "CBORConverter.hh"
+#include "CollectionFile.hh"
+#include "Columns.hh"
+#include "CompressedDoc.hh"
+#include "DataStats.hh"
 #include "Pointer.hh"
+#include "PostingList.hh"
 #include "JSONConverter.hh"
+#include "JSONEncoder.hh"
 #include "KeyTree.hh"
+#include "MsgPackConverter.hh"
+#include "MutableArray.hh"
+#include "MutableDict.hh"
 #include "Path.hh"
+#include "Predicate.hh"
+#include "ProgressiveDoc.hh"
+#include "SharedKeys.hh"
 #include "Internal.hh"
 #include "jsonsl.h"
 #include "mn_wordlist.h"
 #include "NumConversion.hh"
+#include "ParseDate.hh"
 #include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <thread>
 #include "fleece/Fleece.hh"
 #include <float.h>
 
@@ -48,6 +69,7 @@ public:
 
     Encoder enc;
     alloc_slice result;
+    JSONConverter::Parser jsonParser {JSONConverter::kJsonslParser};
 
     void endEncoding() {
         enc.end();
@@ -177,7 +199,7 @@ public:
                       int expectedErr = JSONSL_ERROR_SUCCESS)
     {
         json = std::string("[\"") + json + std::string("\"]");
-        JSONConverter j(enc);
+        JSONConverter j(enc, jsonParser);
         j.encodeJSON(slice(json));
         REQUIRE(j.jsonError() == expectedErr);
         if (j.jsonError()) {
@@ -352,6 +374,134 @@ public:
         checkReadString(cstr);
     }
 
+    TEST_CASE_METHOD(EncoderTests, "Timestamps", "[Encoder]") {
+        const int64_t ts = 1465600135123;
+        enc.beginArray();
+        enc.writeTimestamp(ts);
+        enc.writeTimestamp(ts, false);
+        enc.writeDateString(ts);
+        enc.endArray();
+        endEncoding();
+
+        auto a = checkArray(3);
+        const Value *utc = a->get(0), *local = a->get(1), *str = a->get(2);
+        CHECK(utc->type() == kString);
+        CHECK(utc->isTimestamp());
+        CHECK(utc->asString() == "2016-06-10T23:08:55.123Z"_sl);
+        CHECK(utc->asTimestamp() == ts);
+        CHECK(utc->timestampOffset() == 0);
+        CHECK(local->isTimestamp());
+        CHECK(local->asTimestamp() == ts);
+        CHECK(ParseISO8601Date(local->asString()) == ts);
+        if (local->asString().hasSuffix("Z"_sl))
+            CHECK(local->timestampOffset() == 0);
+        else
+            CHECK(local->timestampOffset() != 0);
+        // A timestamp is just a string to anything else, including isEqual and JSON:
+        CHECK(!str->isTimestamp());
+        CHECK(str->asTimestamp() == ts);
+        CHECK(utc->isEqual(str));
+        CHECK(a->toJSONString().substr(0, 28) == "[\"2016-06-10T23:08:55.123Z\",");
+
+        // Copying Values keeps them timestamps:
+        Encoder enc2;
+        enc2.writeValue(a);
+        alloc_slice copied = enc2.finish();
+        auto a2 = Value::fromData(copied)->asArray();
+        REQUIRE(a2);
+        CHECK(a2->get(0)->isTimestamp());
+        CHECK(a2->get(1)->timestampOffset() == local->timestampOffset());
+        CHECK(!a2->get(2)->isTimestamp());
+
+        Retained<Doc> doc = new Doc(copied);
+        Retained<MutableArray> ma = MutableArray::newArray(doc->root()->asArray(),
+                                                           CopyFlags(kDeepCopy | kCopyImmutables));
+        CHECK(ma->get(0)->isTimestamp());
+        CHECK(ma->get(0)->asTimestamp() == ts);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "PostingList", "[Encoder]") {
+        std::mt19937_64 rng(1234);
+        auto randomList = [&](size_t count, uint64_t maxGap) {
+            std::vector<uint64_t> values;
+            uint64_t n = rng() % 1000;
+            for (size_t i = 0; i < count; ++i) {
+                n += rng() % (maxGap + 1);
+                values.push_back(n);
+            }
+            return values;
+        };
+
+        // Round trips, including empty lists, duplicates, partial blocks and huge values:
+        std::vector<std::vector<uint64_t>> lists = {
+            {}, {0}, {7, 7, 7}, {1, 2, 3, 1000000},
+            {0, UINT64_MAX}, {UINT64_MAX - 1, UINT64_MAX},
+            randomList(PostingList::kBlockSize, 1),
+            randomList(PostingList::kBlockSize + 1, 100),
+            randomList(1000, 5), randomList(1000, 1ull << 40),
+        };
+        for (auto &values : lists) {
+            INFO("count = " << values.size());
+            alloc_slice encoded = PostingList::encode(values);
+            CHECK(PostingList::isPostingList(encoded));
+            PostingList list(encoded);
+            CHECK(list.count() == values.size());
+            CHECK(list.decode() == values);
+        }
+        // Small gaps take a few bits each:
+        auto dense = randomList(1000, 3);
+        CHECK(PostingList::encode(dense).size < 300);
+
+        CHECK_THROWS_AS(PostingList::encode(std::vector<uint64_t>{3, 2}), FleeceException);
+        CHECK(!PostingList::isPostingList(alloc_slice("not a posting list")));
+        alloc_slice truncated = PostingList::encode(dense);
+        truncated.shorten(truncated.size / 2);
+        CHECK_THROWS_AS(PostingList(slice(truncated)), FleeceException);
+
+        // Encoded by the Encoder, and read as either Data or an Array:
+        enc.beginArray();
+        enc.writePostingList(dense.data(), dense.size());
+        PostingList(PostingList::encode(dense)).writeAsArray(enc);
+        enc.writeString("nope");
+        enc.endArray();
+        endEncoding();
+        auto a = checkArray(3);
+        CHECK(a->get(0)->type() == kData);
+        CHECK(a->get(1)->asArray()->count() == dense.size());
+        CHECK(PostingList(a->get(0)).decode() == dense);
+        CHECK(PostingList(a->get(1)).decode() == dense);
+        CHECK_THROWS_AS(PostingList(a->get(2)), FleeceException);
+
+        // Seeking:
+        auto values = randomList(1000, 20);
+        alloc_slice encoded = PostingList::encode(values);
+        PostingList list(encoded);
+        PostingList::iterator i(list);
+        for (uint64_t target = values[0]; target <= values.back(); target += 97) {
+            REQUIRE(i.seek(target));
+            CHECK(*i == *std::lower_bound(values.begin(), values.end(), target));
+        }
+        CHECK(!i.seek(values.back() + 1));
+
+        // Intersection and union:
+        for (uint64_t gap : {2, 30, 1000}) {
+            auto v1 = randomList(700, gap), v2 = randomList(300, gap * 2);
+            alloc_slice e1 = PostingList::encode(v1), e2 = PostingList::encode(v2);
+            PostingList l1(e1), l2(e2);
+            std::vector<uint64_t> expected;
+            std::set_intersection(v1.begin(), v1.end(), v2.begin(), v2.end(),
+                                  std::back_inserter(expected));
+            expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+            CHECK(PostingList::intersect(l1, l2) == expected);
+            CHECK(PostingList::intersect(l2, l1) == expected);
+            expected.clear();
+            std::set_union(v1.begin(), v1.end(), v2.begin(), v2.end(),
+                           std::back_inserter(expected));
+            expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+            CHECK(PostingList::unite(l1, l2) == expected);
+        }
+    }
+
     TEST_CASE_METHOD(EncoderTests, "Arrays", "[Encoder]") {
         {
             enc.beginArray();
@@ -400,6 +550,50 @@ public:
 
             REQUIRE(a->toJSON() == alloc_slice("[\"a\",\"hello\"]"));
         }
+        {
+            // Bulk reads, of narrow, wide, packed and mutable Arrays:
+            std::string bigString(70000, '*');
+            alloc_slice data[3];
+            for (int i = 0; i < 3; ++i) {
+                enc.reset();
+                enc.packNumericArrays(i == 2);
+                enc.beginArray();
+                for (int j = 0; j < 1000; ++j) {
+                    if (i == 1 && j == 0)
+                        enc.writeString(bigString);     // makes the Array wide
+                    else if (i == 2)
+                        enc.writeDouble(j * 1.1);
+                    else if (j % 3 == 0)
+                        enc.writeString(std::to_string(j));
+                    else
+                        enc.writeInt(j * 1000);
+                }
+                enc.endArray();
+                data[i] = enc.finish();
+            }
+            enc.resetOptions();
+            Retained<Doc> doc = new Doc(data[0], Doc::kUntrusted);
+            Retained<MutableArray> mutableArray = MutableArray::newArray(doc->asArray());
+            const Array* arrays[] = {doc->asArray(), Value::fromData(data[1])->asArray(),
+                                     Value::fromData(data[2])->asArray(), mutableArray};
+            CHECK((*(const uint8_t*)arrays[0] & 0x08) == 0);       // narrow
+            CHECK((*(const uint8_t*)arrays[1] & 0x08) != 0);       // wide
+            CHECK(arrays[2]->packedType() == Array::PackedType::kDouble);
+            for (auto array : arrays) {
+                Array::iterator iter(array);
+                iter += 3;
+                const Value* values[64];
+                uint32_t index = 3;
+                while (size_t n = iter.read(values, 64)) {
+                    CHECK((n == 64 || index + n == 1000));
+                    for (size_t i = 0; i < n; ++i, ++index)
+                        CHECK(values[i] == array->get(index));
+                }
+                CHECK(index == 1000);
+                CHECK(!iter);
+                CHECK(iter.read(values, 64) == 0);
+            }
+        }
 #if 0
         {
             // Strings that can be inlined in a wide array:
@@ -487,8 +681,214 @@ public:
         }
         gDisableNecessarySharedKeysCheck = false;
     }
+
+    TEST_CASE_METHOD(EncoderTests, "Dict key sorting", "[Encoder]") {
+        gDisableNecessarySharedKeysCheck = true;
+        SECTION("Unsorted") {
+            // Enough integer keys to be radix-sorted, in random order, mixed with strings:
+            std::vector<int> keys;
+            for (int i = 0; i < 500; ++i)
+                keys.push_back(i * 4 + (i % 3));
+            std::shuffle(keys.begin(), keys.end(), std::mt19937(7));
+            enc.retainBuffers(GENERATE(false, true));
+            enc.beginDictionary();
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (i % 10 == 0) {
+                    enc.writeKey("key" + std::to_string(keys[i]));
+                    enc.writeInt(-keys[i]);
+                }
+                writeKey(keys[i]);
+                enc.writeInt(keys[i]);
+            }
+            enc.endDictionary();
+            endEncoding();
+            auto d = checkDict(550);
+            for (int key : keys)
+                CHECK(d->get(key)->asInt() == key);
+            int prevInt = -1;
+            std::string prevStr;
+            for (Dict::iterator i(d); i; ++i) {
+                if (i.key()->isInteger()) {
+                    CHECK(prevStr.empty());
+                    CHECK(i.key()->asInt() > prevInt);
+                    prevInt = int(i.key()->asInt());
+                } else {
+                    CHECK(std::string(i.key()->asString()) > prevStr);
+                    prevStr = std::string(i.key()->asString());
+                    CHECK(d->get(slice(prevStr))->asInt() == -std::stoi(prevStr.substr(3)));
+                }
+            }
+        }
+        SECTION("Sorted, with hint") {
+            enc.beginDictionary(4, Encoder::kKeysSorted);
+            writeKey(3);
+            enc.writeInt(1);
+            writeKey(300);
+            enc.writeInt(2);
+            enc.writeKey("a");
+            enc.writeInt(3);
+            enc.writeKey("b");
+            enc.writeInt(4);
+            enc.endDictionary();
+            endEncoding();
+            auto d = checkDict(4);
+            CHECK(d->toJSON() == alloc_slice("{3:1,300:2,\"a\":3,\"b\":4}"));
+            CHECK(d->get(300)->asInt() == 2);
+            CHECK(d->get("b"_sl)->asInt() == 4);
+        }
+        gDisableNecessarySharedKeysCheck = false;
+    }
 #endif
 
+    TEST_CASE_METHOD(EncoderTests, "Indexed Dictionaries", "[Encoder]") {
+        constexpr int kCount = 5000;
+        auto keyFor = [](int i) {
+            char key[20];
+            sprintf(key, (i % 2) ? "k%d" : "key number %d", i);    // only the short ones get shared
+            return std::string(key);
+        };
+        for (bool withSharedKeys : {false, true}) {
+            INFO("withSharedKeys = " << withSharedKeys);
+            Retained<SharedKeys> sk = withSharedKeys ? new SharedKeys() : nullptr;
+            auto encodeDict = [&](bool indexed, bool prefixed = false) {
+                enc.setSharedKeys(sk);
+                enc.indexLargeDicts(indexed);
+                enc.prefixDictKeys(prefixed);
+                enc.beginDictionary();
+                for (int i = 0; i < kCount; i++) {
+                    enc.writeKey(keyFor(i));
+                    enc.writeInt(i);
+                }
+                enc.endDictionary();
+                endEncoding();
+                return result;
+            };
+            alloc_slice plain = encodeDict(false);
+            alloc_slice indexed = encodeDict(true);
+            CHECK(indexed.size > plain.size);
+            Scope plainScope(plain, sk), indexedScope(indexed, sk);
+
+            auto dict = Value::fromData(indexed)->asDict();     // validates
+            REQUIRE(dict);
+            CHECK(dict->count() == kCount);
+            CHECK(dict->toJSON() == Value::fromData(plain)->toJSON());
+            // The index should make a lookup take a couple of key comparisons, instead of ~12:
+            FLResetStats();
+            for (int i = 0; i < kCount; i += 2)
+                CHECK(dict->get(slice(keyFor(i))));
+            FLStats stats = FLGetStats();
+            CHECK(stats.dictLookups == kCount / 2);
+            CHECK(stats.dictKeyComparisons < 4 * (kCount / 2));
+            for (int i = 0; i < kCount; i++) {
+                std::string key = keyFor(i);
+                auto value = dict->get(slice(key));
+                REQUIRE(value);
+                CHECK(value->asInt() == i);
+                Dict::key dictKey{slice(key)};
+                CHECK(dict->get(dictKey) == value);
+                CHECK(dict->get(dictKey) == value);     // 2nd time uses the hint
+            }
+            CHECK(dict->get("k0"_sl) == nullptr);
+            CHECK(dict->get("key number 1"_sl) == nullptr);
+            CHECK(dict->get(""_sl) == nullptr);
+
+            std::vector<std::string> names;
+            for (int i = 0; i < kCount; i += 7)
+                names.push_back(keyFor(i));
+            std::vector<slice> keys(names.begin(), names.end());
+            std::vector<const Value*> values(keys.size());
+            dict->getMany(keys.data(), keys.size(), values.data());
+            for (size_t i = 0; i < keys.size(); i++)
+                CHECK(values[i] == dict->get(keys[i]));
+
+            // Key prefixes, with or without an index; they're not written if any key is shared:
+            for (bool withIndex : {false, true}) {
+                alloc_slice prefixed = encodeDict(withIndex, true);
+                CHECK(prefixed.size == (withIndex ? indexed.size : plain.size)
+                                        + (withSharedKeys ? 0 : 8 + 8 * kCount + 4));
+                Scope prefixedScope(prefixed, sk);
+                auto pdict = Value::fromData(prefixed)->asDict();
+                REQUIRE(pdict);
+                CHECK(pdict->toJSON() == Value::fromData(plain)->toJSON());
+                for (int i = 0; i < kCount; i++) {
+                    std::string key = keyFor(i);
+                    auto value = pdict->get(slice(key));
+                    REQUIRE(value);
+                    CHECK(value->asInt() == i);
+                    key += "x";
+                    CHECK(pdict->get(slice(key)) == nullptr);
+                }
+                CHECK(pdict->get(""_sl) == nullptr);
+                CHECK(pdict->get("key number"_sl) == nullptr);
+            }
+        }
+        enc.setSharedKeys(nullptr);
+        enc.indexLargeDicts(false);
+        enc.prefixDictKeys(false);
+
+        {
+            // Prefix ties, short and inline keys:
+            std::vector<std::string> names = {"", "a", "b", "abcdefgh", "abcdefghi", "ab",
+                                              std::string("abcdefgh\0", 9),
+                                              std::string("ab\0", 3)};
+            for (int i = 0; i < 100; i++)
+                names.push_back("abcdefgh" + std::to_string(i));
+            enc.prefixDictKeys(true);
+            enc.beginDictionary();
+            for (size_t i = 0; i < names.size(); i++) {
+                enc.writeKey(slice(names[i]));
+                enc.writeInt(int(i));
+            }
+            enc.endDictionary();
+            endEncoding();
+            enc.prefixDictKeys(false);
+            auto dict = Value::fromData(result)->asDict();
+            REQUIRE(dict);
+            for (size_t i = 0; i < names.size(); i++) {
+                auto value = dict->get(slice(names[i]));
+                REQUIRE(value);
+                CHECK(value->asInt() == int(i));
+            }
+            CHECK(dict->get("abcdefgh100"_sl) == nullptr);
+            CHECK(dict->get("abc"_sl) == nullptr);
+            CHECK(dict->get("c"_sl) == nullptr);
+        }
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Huge Dictionaries", "[Encoder]") {
+        // Big enough to be searched with prefetching:
+        constexpr int kCount = 70000;
+        auto keyFor = [](int i) {
+            char key[20];
+            sprintf(key, "key %d", i * 2);
+            return std::string(key);
+        };
+        enc.beginDictionary();
+        for (int i = 0; i < kCount; i++) {
+            enc.writeKey(keyFor(i));
+            enc.writeInt(i);
+        }
+        enc.endDictionary();
+        endEncoding();
+        auto dict = Value::fromData(result)->asDict();
+        REQUIRE(dict);
+        CHECK(dict->count() == kCount);
+        for (int i = 0; i < kCount; i++) {
+            std::string key = keyFor(i);
+            auto value = dict->get(slice(key));
+            REQUIRE(value);
+            CHECK(value->asInt() == i);
+            if (i % 100 == 0) {
+                Dict::key dictKey{slice(key)};
+                CHECK(dict->get(dictKey) == value);
+                key = "key " + std::to_string(2 * i + 1);
+                CHECK(dict->get(slice(key)) == nullptr);
+            }
+        }
+        CHECK(dict->get(""_sl) == nullptr);
+        CHECK(dict->get("zzz"_sl) == nullptr);
+    }
+
     TEST_CASE_METHOD(EncoderTests, "Deep Nesting", "[Encoder]") {
         for (int depth = 0; depth < 100; ++depth) {
             enc.beginArray();
@@ -503,6 +903,42 @@ public:
         endEncoding();
     }
 
+    TEST_CASE_METHOD(EncoderTests, "Validate Deep Nesting", "[Encoder]") {
+        // Validation mustn't recurse, so this shouldn't overflow the stack:
+        constexpr int kDepth = 100000;
+        for (int depth = 0; depth < kDepth; ++depth)
+            enc.beginArray();
+        for (int depth = 0; depth < kDepth; ++depth)
+            enc.endArray();
+        endEncoding();
+        CHECK(Value::fromData(result) != nullptr);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Validate Mixed Arrays", "[Encoder]") {
+        // Exercises the fast path for runs of short ints & specials, and its fallback:
+        enc.beginArray();
+        for (int i = 0; i < 23; ++i) {
+            if (i % 7 == 6)
+                enc.writeString("hello there");
+            else if (i % 5 == 0)
+                enc.writeNull();
+            else
+                enc.writeInt(i - 10);
+        }
+        enc.endArray();
+        endEncoding();
+        auto a = checkArray(23);
+        CHECK(a->get(6)->asString() == "hello there"_sl);
+
+        // Corrupt the string that's pointed to; that must be detected:
+        alloc_slice bad(result);
+        ((uint8_t*)bad.buf)[0] = 0x4F;
+        CHECK(Value::fromData(bad) == nullptr);
+
+        // Truncate the data:
+        CHECK(Value::fromData(slice(result.buf, result.size - 2)) == nullptr);
+    }
+
     TEST_CASE_METHOD(EncoderTests, "SharedStrings", "[Encoder]") {
         enc.beginArray(4);
         enc.writeString("a");
@@ -538,36 +974,58 @@ public:
 #pragma mark - JSON:
 
     TEST_CASE_METHOD(EncoderTests, "JSONStrings", "[Encoder]") {
-        checkJSONStr("", "");
-        checkJSONStr("x", "x");
-        checkJSONStr("\\\"", "\"");
-        checkJSONStr("\"", nullptr, JSONConverter::kErrTruncatedJSON); // unterminated string
-        checkJSONStr("\\", nullptr, JSONConverter::kErrTruncatedJSON);
-        checkJSONStr("hi \\\"there\\\"", "hi \"there\"");
-        checkJSONStr("hi\\nthere", "hi\nthere");
-        checkJSONStr("H\\u0061ppy", "Happy");
-        checkJSONStr("H\\u0061", "Ha");
-
-        // Unicode escapes:
-        checkJSONStr("Price 50\\u00A2", "Price 50¢");
-        checkJSONStr("Price \\u20ac250", "Price €250");
-        checkJSONStr("Price \\uffff?", "Price \uffff?");
-        checkJSONStr("Price \\u20ac", "Price €");
-        checkJSONStr("!\\u0000!", "!\0!"_sl);
-        checkJSONStr("Price \\u20a", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
-        checkJSONStr("Price \\u20", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
-        checkJSONStr("Price \\u2", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
-        checkJSONStr("Price \\u", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
-        checkJSONStr("\\uzoop!", nullptr, JSONSL_ERROR_PERCENT_BADHEX);
-
-        // UTF-16 surrogate pair decoding:
-        checkJSONStr("lmao\\uD83D\\uDE1C!", "lmao😜!");
-        checkJSONStr("lmao\\uD83D", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
-        checkJSONStr("lmao\\uD83D\\n", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
-        checkJSONStr("lmao\\uD83D\\u", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
-        checkJSONStr("lmao\\uD83D\\u333", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
-        checkJSONStr("lmao\\uD83D\\u3333", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
-        checkJSONStr("lmao\\uDE1C\\uD83D!", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
+        for (auto parser : {JSONConverter::kJsonslParser, JSONConverter::kFastParser}) {
+            INFO("Parser " << parser);
+            jsonParser = parser;
+            checkJSONStr("", "");
+            checkJSONStr("x", "x");
+            checkJSONStr("\\\"", "\"");
+            // unterminated string (jsonsl doesn't notice the missing comma):
+            checkJSONStr("\"", nullptr, (parser == JSONConverter::kFastParser)
+                                            ? int(JSONSL_ERROR_MISSING_TOKEN)
+                                            : int(JSONConverter::kErrTruncatedJSON));
+            checkJSONStr("\\", nullptr, JSONConverter::kErrTruncatedJSON);
+            checkJSONStr("hi \\\"there\\\"", "hi \"there\"");
+            checkJSONStr("hi\\nthere", "hi\nthere");
+            checkJSONStr("H\\u0061ppy", "Happy");
+            checkJSONStr("H\\u0061", "Ha");
+
+            // Unicode escapes:
+            checkJSONStr("Price 50\\u00A2", "Price 50¢");
+            checkJSONStr("Price \\u20ac250", "Price €250");
+            checkJSONStr("Price \\uffff?", "Price \uffff?");
+            checkJSONStr("Price \\u20ac", "Price €");
+            checkJSONStr("!\\u0000!", "!\0!"_sl);
+            checkJSONStr("Price \\u20a", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
+            checkJSONStr("Price \\u20", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
+            checkJSONStr("Price \\u2", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
+            checkJSONStr("Price \\u", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
+            checkJSONStr("\\uzoop!", nullptr, JSONSL_ERROR_PERCENT_BADHEX);
+
+            // UTF-16 surrogate pair decoding:
+            checkJSONStr("lmao\\uD83D\\uDE1C!", "lmao😜!");
+            checkJSONStr("lmao\\uD83D", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
+            checkJSONStr("lmao\\uD83D\\n", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
+            checkJSONStr("lmao\\uD83D\\u", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
+            checkJSONStr("lmao\\uD83D\\u333", nullptr, JSONSL_ERROR_UESCAPE_TOOSHORT);
+            checkJSONStr("lmao\\uD83D\\u3333", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
+            checkJSONStr("lmao\\uDE1C\\uD83D!", nullptr, JSONSL_ERROR_INVALID_CODEPOINT);
+
+            // Invalid UTF-8:
+            auto kBad = JSONConverter::kErrInvalidUTF8;
+            checkJSONStr("Price 50\xC2\xA2 or \xF0\x9F\x98\x9C", "Price 50\xC2\xA2 or \xF0\x9F\x98\x9C");
+            checkJSONStr("Price 50\xC2", nullptr, kBad);
+            checkJSONStr("Price 50\xA2", nullptr, kBad);
+            checkJSONStr("\xC0\xAF", nullptr, kBad);                 // overlong
+            checkJSONStr("\xED\xA0\x80", nullptr, kBad);             // surrogate
+            checkJSONStr("\xF4\x90\x80\x80", nullptr, kBad);         // > U+10FFFF
+            std::string longStr;
+            for (int i = 0; i < 20; ++i)
+                longStr += "Price \xE2\x82\xAC" + std::to_string(i) + " ";
+            checkJSONStr(longStr, longStr.c_str());
+            checkJSONStr(longStr + "\xE2\x82", nullptr, kBad);
+            checkJSONStr(longStr + "\xE2\x82" + longStr, nullptr, kBad);
+        }
     }
 
     TEST_CASE_METHOD(EncoderTests, "JSON", "[Encoder]") {
@@ -604,6 +1062,267 @@ public:
         CHECK(root->get(5)->asDouble() == -9999999999999999999.0);
     }
 
+    TEST_CASE_METHOD(EncoderTests, "JSON fast parser", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        alloc_slice expected = JSONConverter::convertJSON(input);
+        {
+            JSONConverter jr(enc, JSONConverter::kFastParser);
+            REQUIRE(jr.encodeJSON(input));
+            endEncoding();
+            CHECK(result == expected);
+        }
+        {
+            // Chunks are buffered until finish():
+            JSONConverter jr(enc, JSONConverter::kFastParser);
+            REQUIRE(jr.feed(input.upTo(input.size / 2)));
+            REQUIRE(jr.feed(input.from(input.size / 2)));
+            REQUIRE(jr.finish());
+            endEncoding();
+            CHECK(result == expected);
+        }
+
+        slice json("{\"\":\"hello\\nt\\\\here\","
+                            "\"\\\"ironic\\\"\":[null,false,true,-100,0,100,123.456,6.02e+23,5e-06,"
+                            "18446744073709551615,-9223372036854775808],"
+                            "\"foo\":123}");
+        JSONConverter jr(enc, JSONConverter::kFastParser);
+        REQUIRE(jr.encodeJSON(json));
+        endEncoding();
+        CHECK(checkDict(3)->toJSON() == alloc_slice(json));
+
+        struct {const char *json; int error; size_t pos;} kErrors[] = {
+            {"[1, 2",           JSONConverter::kErrTruncatedJSON, 5},
+            {"{\"a\": 1 \"b\":2}",  JSONSL_ERROR_MISSING_TOKEN, 8},
+            {"{\"a\" 1}",        JSONSL_ERROR_MISSING_TOKEN, 5},
+            {"{1: 2}",          JSONSL_ERROR_HKEY_EXPECTED, 1},
+            {"[tru]",           JSONSL_ERROR_SPECIAL_EXPECTED, 1},
+            {"[1.]",            JSONSL_ERROR_INVALID_NUMBER, 3},
+            {"[-x]",            JSONSL_ERROR_INVALID_NUMBER, 2},
+            {"[1] 2",           JSONSL_ERROR_GARBAGE_TRAILING, 4},
+            {"[1 }",            JSONSL_ERROR_MISSING_TOKEN, 3},
+            {"[@]",             JSONSL_ERROR_STRAY_TOKEN, 1},
+        };
+        for (auto &e : kErrors) {
+            INFO("JSON: " << e.json);
+            CHECK(!jr.encodeJSON(slice(e.json)));
+            CHECK(jr.jsonError() == e.error);
+            CHECK(jr.errorPos() == e.pos);
+            enc.reset();
+        }
+
+        std::string deep(JSONConverter::kMaxNestingLevels, '[');
+        CHECK(!jr.encodeJSON(slice(deep)));
+        CHECK(jr.jsonError() == JSONSL_ERROR_LEVELS_EXCEEDED);
+        enc.reset();
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "JSON Scanner", "[Encoder]") {
+        // Records the events as a string:
+        struct Recorder : public JSONHandler {
+            std::string events;
+            slice stopAtKey;
+            bool beginArray() override          {events += "["; return true;}
+            bool endArray() override            {events += "]"; return true;}
+            bool beginDict() override           {events += "{"; return true;}
+            bool endDict() override             {events += "}"; return true;}
+            bool key(slice k) override          {events += std::string(k) + ":";
+                                                 return k != stopAtKey;}
+            bool stringValue(slice s) override  {events += "'" + std::string(s) + "' "; return true;}
+            bool intValue(int64_t i) override   {events += "i" + std::to_string(i) + " "; return true;}
+            bool uintValue(uint64_t u) override {events += "u" + std::to_string(u) + " "; return true;}
+            bool doubleValue(double d) override {events += "d" + std::to_string(int(d)) + " "; return true;}
+            bool boolValue(bool b) override     {events += b ? "T " : "F "; return true;}
+            bool nullValue() override           {events += "N "; return true;}
+        };
+
+        slice json(R"({"a":[1,-2,3.5,true,false,null],"bé":{"c":"hi"},"d":[]})");
+        Recorder rec;
+        JSONScanner scanner(rec);
+        CHECK(scanner.scan(json));
+        CHECK(!scanner.stopped());
+        CHECK(scanner.jsonError() == 0);
+        CHECK(rec.events == "{a:[u1 i-2 d3 T F N ]bé:{c:'hi' }d:[]}");
+
+        // The handler can stop the scan:
+        rec.events.clear();
+        rec.stopAtKey = "bé"_sl;
+        CHECK(!scanner.scan(json));
+        CHECK(scanner.stopped());
+        CHECK(scanner.jsonError() == 0);
+        CHECK(rec.events == "{a:[u1 i-2 d3 T F N ]bé:");
+
+        // JSON5, and the base class that ignores everything:
+        rec.events.clear();
+        JSONScanner scanner5(rec, true);
+        CHECK(scanner5.scan("{a: 0x10, 'b': [+1,],}"_sl));
+        CHECK(rec.events == "{a:u16 b:[u1 ]}");
+        JSONHandler ignore;
+        CHECK(JSONScanner(ignore, true).scan("[1, 2] // comment"_sl));
+
+        // Errors:
+        JSONScanner bad(ignore);
+        CHECK(!bad.scan("[1, 2"_sl));
+        CHECK(!bad.stopped());
+        CHECK(bad.jsonError() == JSONConverter::kErrTruncatedJSON);
+        CHECK(bad.errorPos() == 5);
+        CHECK(std::string(bad.errorMessage()) == "Truncated JSON");
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "JSON Sequence", "[Encoder]") {
+        slice ndjson("{\"level\":\"info\",\"msg\":\"started up\",\"n\":1}\n"
+                     "{\"level\":\"info\",\"msg\":\"started up\",\"n\":2}\r\n"
+                     "\n"
+                     "[1,2] 17 \"str\"{\"level\":\"warn\"}\n");
+        Retained<SharedKeys> sk = new SharedKeys();
+        auto docs = JSONConverter::convertJSONSequence(ndjson, sk);
+        REQUIRE(docs.size() == 6);
+        CHECK(Value::fromData(docs[0])->toJSON(true, sk)
+              == "{\"level\":\"info\",\"msg\":\"started up\",\"n\":1}"_sl);
+        CHECK(Value::fromData(docs[1])->asDict()->get("n"_sl, sk)->asInt() == 2);
+        CHECK(Value::fromData(docs[2])->toJSON() == "[1,2]"_sl);
+        CHECK(Value::fromData(docs[3])->asInt() == 17);
+        CHECK(Value::fromData(docs[4])->asString() == "str"_sl);
+        CHECK(Value::fromData(docs[5])->asDict()->get("level"_sl, sk)->asString() == "warn"_sl);
+
+        // As a single array, the repeated string is written only once:
+        alloc_slice array = JSONConverter::convertJSONSequenceToArray(ndjson, sk);
+        auto root = Value::fromData(array)->asArray();
+        REQUIRE(root);
+        CHECK(root->count() == 6);
+        CHECK(root->get(0)->asDict()->get("msg"_sl, sk)->asString().buf
+              == root->get(1)->asDict()->get("msg"_sl, sk)->asString().buf);
+        CHECK(root->get(3)->asInt() == 17);
+
+        CHECK(JSONConverter::convertJSONSequence(" \n"_sl).empty());
+        alloc_slice emptyArray = JSONConverter::convertJSONSequenceToArray(""_sl);
+        CHECK(Value::fromData(emptyArray)->asArray()->count() == 0);
+
+        // An error reports its position in the whole input:
+        Encoder enc2;
+        JSONConverter cvt(enc2);
+        size_t n = 0;
+        CHECK(!cvt.encodeJSONSequence("{\"a\":1}\n{\"b\" 2}\n"_sl, [&] {enc2.finish(); ++n;}));
+        CHECK(n == 1);
+        CHECK(cvt.errorCode() == JSONError);
+        CHECK(cvt.errorPos() == 13);
+        CHECK_THROWS_AS(JSONConverter::convertJSONSequence("[1]\n[2"_sl), FleeceException);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "JSON in chunks", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        alloc_slice expected = JSONConverter::convertJSON(input);
+
+        for (size_t chunkSize : {1, 7, 100, 4096, 100000}) {
+            INFO("Chunk size " << chunkSize);
+            JSONConverter jr(enc);
+            for (size_t pos = 0; pos < input.size; pos += chunkSize) {
+                std::string chunk((const char*)&input[pos], std::min(chunkSize, input.size - pos));
+                REQUIRE(jr.feed(slice(chunk)));     // chunk is freed right after feed()
+            }
+            REQUIRE(jr.finish());
+            endEncoding();
+            CHECK(result == expected);
+        }
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "JSON in chunks errors", "[Encoder]") {
+        JSONConverter jr(enc);
+        CHECK(jr.feed("[\"hello"_sl));
+        CHECK(jr.feed(" there\", 12"_sl));
+        CHECK(!jr.finish());
+        CHECK(jr.jsonError() == JSONConverter::kErrTruncatedJSON);
+        CHECK(jr.errorPos() == 18);
+        enc.reset();
+
+        CHECK(jr.feed("[\"hel\\u12"_sl));
+        CHECK(!jr.feed("xy\"]"_sl));
+        CHECK(jr.jsonError() == JSONSL_ERROR_PERCENT_BADHEX);
+        CHECK(jr.errorPos() >= 5);         // somewhere in the bad escape sequence
+        CHECK(jr.errorPos() <= 11);
+        CHECK(!jr.finish());
+        enc.reset();
+
+        // The converter can be reused after an error:
+        CHECK(jr.feed("[1, 2"_sl));
+        CHECK(jr.feed("3]"_sl));
+        CHECK(jr.finish());
+        endEncoding();
+        CHECK(checkArray(2)->get(1)->asInt() == 23);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "JSON array in parallel", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        REQUIRE(input.size >= JSONConverter::kMinParallelJSONSize);
+        alloc_slice expected = JSONConverter::convertJSON(input);
+        auto expectedRoot = Value::fromTrustedData(expected);
+
+        for (unsigned nThreads : {1, 2, 3, 8}) {
+            INFO("Threads: " << nThreads);
+            alloc_slice converted = JSONConverter::convertJSONArray(input, nullptr, nThreads);
+            auto root = Value::fromData(converted);
+            REQUIRE(root);
+            CHECK(root->asArray()->count() == expectedRoot->asArray()->count());
+            // (Not isEqual: item encodings may differ in width, since their strings aren't shared
+            // across threads.)
+            CHECK(root->toJSON() == expectedRoot->toJSON());
+        }
+
+        {
+            Retained<SharedKeys> sk = new SharedKeys();
+            alloc_slice converted = JSONConverter::convertJSONArray(input, sk, 4);
+            CHECK(sk->count() > 0);
+            Scope scope(converted, sk);
+            auto root = Value::fromData(converted);
+            REQUIRE(root);
+            CHECK(root->toJSON(true) == expectedRoot->toJSON(true));
+        }
+
+        // Errors are reported the same way as by convertJSON:
+        std::string bad(input);
+        bad[input.size / 2] = '@';
+        try {
+            JSONConverter::convertJSONArray(slice(bad), nullptr, 4);
+            FAIL("invalid JSON was accepted");
+        } catch (const FleeceException &x) {
+            CHECK(x.code == JSONError);
+        }
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "JSON output in parallel", "[Encoder]") {
+        auto doc = readTestFile("1000people.fleece");
+        auto people = Value::fromTrustedData(doc)->asArray();
+        REQUIRE(people->count() >= JSONEncoder::kMinParallelCount);
+
+        // Also make a big Dict, mapping each person's id to their name:
+        enc.beginDictionary();
+        for (Array::iterator i(people); i; ++i) {
+            auto person = i.value()->asDict();
+            enc.writeKey(person->get("guid")->asString());
+            enc.writeValue(person->get("name"));
+        }
+        enc.endDictionary();
+        endEncoding();
+        auto dict = Value::fromData(result);
+        REQUIRE(dict);
+
+        for (const Value *root : {(const Value*)people, dict}) {
+            for (unsigned nThreads : {1, 2, 3, 8}) {
+                INFO("Threads: " << nThreads);
+                CHECK(JSONEncoder::toJSONParallel(root, false, false, nThreads) == root->toJSON());
+                CHECK(JSONEncoder::toJSONParallel(root, true, true, nThreads)
+                      == root->toJSON<5>(true));
+            }
+        }
+
+#if !FL_EMBEDDED
+        FILE *out = fopen(kTempDir"fleecetemp.json", "wb");
+        REQUIRE(out != nullptr);
+        CHECK(JSONEncoder::writeJSONParallel(people, out, false, false, 4));
+        fclose(out);
+        CHECK(readFile(kTempDir"fleecetemp.json") == people->toJSON());
+#endif
+    }
+
     TEST_CASE_METHOD(EncoderTests, "JSONBinary", "[Encoder]") {
         enc.beginArray();
         enc.writeData(slice("not-really-binary"));
@@ -651,6 +1370,105 @@ public:
             " 0050: 80 07       : &Dict @0042\n"));
     }
 
+    TEST_CASE_METHOD(EncoderTests, "DataStats", "[Encoder]") {
+        std::string json = json5("{'foo':123,"
+                                 "'\"ironic\"':[null,false,true,-100,0,100,123.456,6.02e+23],"
+                                 "'':'hello\\nt\\\\here'}");
+        JSONConverter j(enc);
+        j.encodeJSON(slice(json));
+        endEncoding();
+
+        // (See the "Dump" test for the layout of this data.)
+        DataStats stats;
+        REQUIRE(stats.add(result));
+        CHECK(stats.documents == 1);
+        CHECK(stats.totalBytes == 0x52);
+        CHECK(stats.liveBytes == 0x52);
+        CHECK(stats.byCategory[DataStats::kString].count == 3);
+        CHECK(stats.byCategory[DataStats::kString].bytes == 28);
+        CHECK(stats.byCategory[DataStats::kFloat].count == 2);
+        CHECK(stats.byCategory[DataStats::kFloat].bytes == 20);
+        CHECK(stats.byCategory[DataStats::kArray].bytes == 18);
+        CHECK(stats.byCategory[DataStats::kDict].bytes == 14);
+        CHECK(stats.inlineValues[DataStats::kNullOrBoolean].count == 3);
+        CHECK(stats.inlineValues[DataStats::kInteger].count == 4);
+        CHECK(stats.narrowCollections == 2);
+        CHECK(stats.wideCollections == 0);
+        CHECK(stats.narrowPointers == 7);
+        CHECK(stats.pointerChains == std::vector<size_t>{0, 7});
+        CHECK(stats.stringKeys == 3);
+        CHECK(stats.intKeys == 0);
+        REQUIRE(stats.largest.size() == 1);
+        CHECK(stats.largest[0].path == "$.\"ironic\"");
+        CHECK(stats.largest[0].bytes == 38);
+
+        // Adding it again counts it twice; invalid data is rejected:
+        REQUIRE(stats.add(result, nullptr, "again"_sl));
+        CHECK(stats.documents == 2);
+        CHECK(stats.liveBytes == 2 * 0x52);
+        CHECK(stats.largest[1].path == "again $.\"ironic\"");
+        CHECK(!stats.add(alloc_slice("nope")));
+        CHECK(stats.documents == 2);
+        CHECK(stats.report().find("Documents:     2\n") == 0);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "DataStats SharedKeys", "[Encoder]") {
+        Retained<SharedKeys> sk = new SharedKeys();
+        enc.setSharedKeys(sk);
+        enc.beginArray();
+        for (int i = 0; i < 3; ++i) {
+            enc.beginDictionary();
+            enc.writeKey("name");
+            enc.writeString("Harold");
+            enc.writeKey("this key is too long to be shared");
+            enc.writeInt(i);
+            enc.endDictionary();
+        }
+        enc.endArray();
+        endEncoding();
+
+        DataStats stats;
+        REQUIRE(stats.add(result, sk));
+        CHECK(stats.liveBytes == result.size);
+        CHECK(stats.intKeys == 3);
+        CHECK(stats.stringKeys == 3);
+        CHECK(stats.shareableStringKeys == 0);
+        CHECK(stats.sharedStrings == 1);        // "Harold" (long strings aren't deduplicated)
+        CHECK(stats.dedupSavedBytes == 2 * 8);
+        CHECK(stats.largest[0].path.find("$[") == 0);
+
+        SECTION("Packed arrays") {
+            enc.reset();
+            enc.setSharedKeys(sk);
+            enc.packNumericArrays(true);
+            enc.beginArray();
+            for (int i = 0; i < 4; ++i) {
+                enc.beginDictionary();
+                enc.writeKey("id");
+                enc.writeInt(i);
+                enc.writeKey("name");
+                enc.writeString("Harold");
+                enc.writeKey("scores");
+                enc.beginArray();
+                for (int j = 0; j < 10; ++j)
+                    enc.writeDouble(j + i / 8.0);
+                enc.endArray();
+                enc.writeKey("x");
+                enc.writeBool(true);
+                enc.endDictionary();
+            }
+            enc.endArray();
+            endEncoding();
+
+            DataStats stats2;
+            REQUIRE(stats2.add(result, sk));
+            CHECK(stats2.liveBytes == result.size);
+            CHECK(stats2.packedArrays == 4);
+            CHECK(std::any_of(stats2.largest.begin(), stats2.largest.end(),
+                              [](auto &sub) {return sub.path == "$[3].scores";}));
+        }
+    }
+
     TEST_CASE_METHOD(EncoderTests, "ConvertPeople", "[Encoder]") {
         auto input = readTestFile(kBigJSONTestFileName);
 
@@ -676,9 +1494,10 @@ public:
 
         fprintf(stderr, "\nJSON size: %zu bytes; Fleece size: %zu bytes (%.2f%%)\n",
                 input.size, result.size, (result.size*100.0/input.size));
+        auto &stats = enc.collectionStats();
+        fprintf(stderr, "Narrow: %u, Wide: %u (%.1f%% narrow)\n", stats.narrow, stats.wide, stats.narrowRatio()*100);
+        fprintf(stderr, "Narrow count: %u, Wide count: %u (total %u)\n", stats.narrowItems, stats.wideItems, stats.narrowItems+stats.wideItems);
 #ifndef NDEBUG
-        fprintf(stderr, "Narrow: %u, Wide: %u (total %u)\n", enc._numNarrow, enc._numWide, enc._numNarrow+enc._numWide);
-        fprintf(stderr, "Narrow count: %u, Wide count: %u (total %u)\n", enc._narrowCount, enc._wideCount, enc._narrowCount+enc._wideCount);
         fprintf(stderr, "Used %u pointers to shared strings\n", enc._numSavedStrings);
 #endif
     }
@@ -705,6 +1524,106 @@ public:
     }
 #endif
 
+    TEST_CASE_METHOD(EncoderTests, "Encode To Sink", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        alloc_slice expected = JSONConverter::convertJSON(input);
+
+        std::string output;
+        int nCalls = 0;
+        {
+            Encoder senc([&](slice data) {
+                ++nCalls;
+                output.append((const char*)data.buf, data.size);
+            }, 1024);
+            JSONConverter jc(senc);
+            REQUIRE(jc.encodeJSON(input));
+            CHECK(nCalls > 1);
+            CHECK(output.size() < expected.size);   // output was streamed before the end
+            CHECK(!senc.finish());
+        }
+        CHECK(slice(output) == expected);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Encode Finishing To Sink", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        bool checksum = GENERATE(false, true);
+        Encoder cenc;
+        cenc.checksum(checksum);
+        auto encode = [&] {
+            JSONConverter jc(cenc);
+            REQUIRE(jc.encodeJSON(input));
+        };
+        encode();
+        alloc_slice expected = cenc.finish();
+
+        encode();
+        std::string output;
+        int nCalls = 0;
+        cenc.finishTo([&](slice data) {
+            ++nCalls;
+            output.append((const char*)data.buf, data.size);
+        });
+        CHECK(nCalls > 1);                      // the chunks were passed separately
+        CHECK(slice(output) == expected);
+        CHECK(Value::hasValidChecksum(slice(output)) == checksum);
+
+#ifndef _MSC_VER
+        encode();
+        FILE *f = fopen(kTempDir "fleecetemp.fleece", "wb");
+        REQUIRE(f);
+        CHECK(cenc.finishToFD(fileno(f)));
+        fclose(f);
+        CHECK(readFile(kTempDir "fleecetemp.fleece") == expected);
+#endif
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Encode To External Buffer", "[Encoder]") {
+        auto input = readTestFile(kBigJSONTestFileName);
+        alloc_slice expected = JSONConverter::convertJSON(input);
+
+        SECTION("Fixed buffer") {
+            std::vector<char> memory(expected.size + 100);
+            Encoder fenc(slice(memory.data(), memory.size()));
+            JSONConverter jc(fenc);
+            REQUIRE(jc.encodeJSON(input));
+            slice output = fenc.finishInPlace();
+            CHECK(output.buf == memory.data());
+            CHECK(output == expected);
+        }
+        SECTION("Buffer too small") {
+            char memory[100];
+            Encoder fenc(slice(memory, sizeof(memory)));
+            JSONConverter jc(fenc);
+            CHECK(!jc.encodeJSON(input));
+            CHECK(jc.errorCode() == MemoryError);
+        }
+        SECTION("Growable buffer") {
+            std::vector<std::unique_ptr<char[]>> buffers;
+            int nGrows = 0;
+            auto grow = [&](slice buffer, size_t used, size_t minSize) -> slice {
+                ++nGrows;
+                size_t size = std::max(minSize, 2 * buffer.size);
+                buffers.emplace_back(new char[size]);
+                memcpy(buffers.back().get(), buffer.buf, used);
+                return {buffers.back().get(), size};
+            };
+            for (bool unique : {true, false}) {
+                Encoder fenc(nullslice, grow);
+                fenc.uniqueStrings(unique);
+                Encoder plain;
+                plain.uniqueStrings(unique);
+                for (Encoder *e : {&fenc, &plain}) {
+                    JSONConverter jc(*e);
+                    REQUIRE(jc.encodeJSON(input));
+                }
+                slice output = fenc.finishInPlace();
+                CHECK(output.buf == buffers.back().get());
+                CHECK(output == plain.finish());
+            }
+            CHECK(nGrows > 2);
+        }
+    }
+
 #if FL_HAVE_TEST_FILES
     TEST_CASE_METHOD(EncoderTests, "FindPersonByIndexSorted", "[Encoder]") {
         auto doc = readTestFile("1000people.fleece");
@@ -792,56 +1711,984 @@ public:
 #endif
     }
 
-    TEST_CASE_METHOD(EncoderTests, "Resuse Encoder", "[Encoder]") {
-        enc.beginDictionary();
-        enc.writeKey("foo");
-        enc.writeInt(17);
-        enc.endDictionary();
-        auto data1 = enc.finish();
+    TEST_CASE_METHOD(EncoderTests, "Projection", "[Encoder]") {
+        static const char* kPaths[] = {
+            "name", "friends[0].name", "age", "friends[-1].id", "tags[1]", "friends[0].id",
+            "nope", "name.first", "friends[99].name", "$", "address",
+        };
+        std::vector<Path> paths;
+        for (auto p : kPaths)
+            paths.emplace_back(slice(p));
+        Projection proj(paths);
+        REQUIRE(proj.count() == paths.size());
 
-        enc.beginDictionary();
-        enc.writeKey("bar");
-        enc.writeInt(23);
-        enc.endDictionary();
-        auto data2 = enc.finish();
+        auto input = readTestFile(kBigJSONTestFileName);
+        for (bool withSharedKeys : {false, true}) {
+            INFO("withSharedKeys = " << withSharedKeys);
+            Retained<SharedKeys> sk = withSharedKeys ? new SharedKeys() : nullptr;
+            Retained<Doc> doc = Doc::fromJSON(input, sk);
+            auto people = doc->asArray();
+            REQUIRE(people);
+            std::vector<const Value*> results(proj.count());
+            for (Array::iterator i(people); i; ++i) {
+                proj.eval(i.value(), results.data());
+                for (size_t p = 0; p < paths.size(); ++p) {
+                    INFO("Path " << kPaths[p]);
+                    CHECK(results[p] == paths[p].eval(i.value()));
+                }
+            }
 
-        enc.beginDictionary();
-        enc.writeKey("baz");
-        enc.writeInt(42);
-        enc.endDictionary();
-        auto data3 = enc.finish();
+            Encoder projEnc;
+            proj.eval(people->get(3), projEnc);
+            Retained<Doc> projected = projEnc.finishDoc();
+            auto array = projected->asArray();
+            REQUIRE(array);
+            REQUIRE(array->count() == paths.size());
+            CHECK(array->get(0)->asString() == people->get(3)->asDict()->get("name")->asString());
+            CHECK(array->get(6)->type() == kNull);
+        }
     }
 
-    TEST_CASE_METHOD(EncoderTests, "Multi-Item", "[Encoder]") {
-        enc.suppressTrailer();
-        size_t pos[10];
-        unsigned n = 0;
+    TEST_CASE_METHOD(EncoderTests, "Compiled Paths", "[Encoder]") {
+        static const char* kPaths[] = {
+            "name", "friends[0].name", "age", "friends[-1].id", "tags[1]", "friends[0].id",
+            "nope", "name.first", "friends[99].name", "friends[-99]", "$", "address",
+        };
+        auto input = readTestFile(kBigJSONTestFileName);
+        for (bool withSharedKeys : {false, true}) {
+            INFO("withSharedKeys = " << withSharedKeys);
+            Retained<SharedKeys> sk = withSharedKeys ? new SharedKeys() : nullptr;
+            Retained<Doc> doc = Doc::fromJSON(input, sk);
+            auto people = doc->asArray();
+            REQUIRE(people);
+            for (auto p : kPaths) {
+                INFO("Path " << p);
+                Path path{slice(p)};
+                CompiledPath compiled(path, sk), unmapped(path);
+                CHECK(compiled.sharedKeys() == sk);
+                for (Array::iterator i(people); i; ++i) {
+                    auto expected = path.eval(i.value());
+                    CHECK(compiled.eval(i.value()) == expected);
+                    CHECK(unmapped.eval(i.value()) == expected);
+                    CHECK(CompiledPath::evalCached(slice(p), i.value()) == expected);
+                }
+            }
+        }
+        CHECK(CompiledPath(slice("name")).eval(nullptr) == nullptr);
+        CHECK_THROWS_AS(CompiledPath::evalCached("name["_sl, nullptr), FleeceException);
+
+        // A key added to the SharedKeys after compiling is still found:
+        Retained<SharedKeys> sk = new SharedKeys();
+        CompiledPath path("late.key"_sl, sk);
+        Retained<Doc> doc = Doc::fromJSON("{\"late\":{\"key\":17}}"_sl, sk);
+        REQUIRE(path.eval(doc->root()));
+        CHECK(path.eval(doc->root())->asInt() == 17);
+    }
 
-        enc.beginDictionary();
-        enc.writeKey("foo");
-        enc.writeInt(17);
-        enc.endDictionary();
-        pos[n++] = enc.finishItem();
+    TEST_CASE_METHOD(EncoderTests, "Cached Paths don't retain SharedKeys", "[Encoder]") {
+        Retained<SharedKeys> sk1 = new SharedKeys(), sk2 = new SharedKeys();
+        Retained<Doc> doc1 = Doc::fromJSON("{\"a\":{\"key\":17}}"_sl, sk1);
+        Retained<Doc> doc2 = Doc::fromJSON("{\"key\":0,\"a\":{\"key\":18}}"_sl, sk2);
+        CHECK(CompiledPath::evalCached("a.key"_sl, doc1->root())->asInt() == 17);
+        CHECK(CompiledPath::evalCached("a.key"_sl, doc2->root())->asInt() == 18);
+        CHECK(CompiledPath::evalCached("a.key"_sl, doc1->root())->asInt() == 17);
+        doc1 = nullptr;
+        CHECK(sk1->refCount() == 1);
+        doc2 = nullptr;
+        CHECK(sk2->refCount() == 1);
+    }
 
-        enc.beginDictionary();
-        enc.writeKey("bar");
-        enc.writeInt(123456789);
-        enc.endDictionary();
-        pos[n++] = enc.finishItem();
+    TEST_CASE_METHOD(EncoderTests, "Multi-valued Paths", "[Encoder]") {
+        Retained<Doc> doc = Doc::fromJSON(R"({"store":{"books":[{"title":"A","price":8},
+                                              {"title":"B","price":12,"tags":["x","y"]},
+                                              {"title":"C","price":9}],
+                                              "bike":{"price":20,"color":"red"}}})"_sl);
+        auto root = doc->root();
+        auto evalAll = [&](const char *specifier) {
+            Path path{slice(specifier)};
+            CHECK(!path.isSingleValued());
+            CHECK(path.eval(root) == nullptr);
+            Encoder enc;
+            path.evalAll(root, enc);
+            return enc.finishDoc()->root()->toJSON<5>().asString();
+        };
+        CHECK(evalAll("store.books[*].price") == "[8,12,9]");
+        CHECK(evalAll("store.books[1:].title") == "[\"B\",\"C\"]");
+        CHECK(evalAll("store.books[:-1].title") == "[\"A\",\"B\"]");
+        CHECK(evalAll("store.books[-2:].price") == "[12,9]");
+        CHECK(evalAll("store.books[:].tags[0]") == "[\"x\"]");
+        CHECK(evalAll("store.books[5:9]") == "[]");
+        CHECK(evalAll("store.bike[*]") == "[\"red\",20]");
+        CHECK(evalAll("$..price") == "[20,8,12,9]");
+        CHECK(evalAll("store..tags[-1]") == "[\"y\"]");
+        CHECK(evalAll("..[1]") == "[{price:12,tags:[\"x\",\"y\"],title:\"B\"},\"y\"]");
+        CHECK(evalAll("nope[*]") == "[]");
+        CHECK(Path("store.books[0].price"_sl).isSingleValued());
+
+        // The callback can stop the evaluation:
+        std::vector<int64_t> prices;
+        Path("$..price"_sl).evalAll(root, [&](const Value *value) {
+            prices.push_back(value->asInt());
+            return prices.size() < 2;
+        });
+        CHECK(prices == (std::vector<int64_t>{20, 8}));
+
+        // Converting to strings, and step-by-step construction:
+        for (auto str : {"store.books[*].price", "..price", "a..[1]", "a[1:]", "a[:-1]",
+                         "a[2:5]", "a[:]", "a..\\$b"}) {
+            INFO("Path " << str);
+            CHECK(std::string(Path(slice(str))) == str);
+        }
+        Path built;
+        built.addProperty("store");
+        built.addDescendants();
+        built.addWildcard();
+        built.addSlice(1);
+        CHECK(built == Path("store..[*][1:]"_sl));
+        CHECK(built != Path("store..[*][1:2]"_sl));
+
+        for (auto bad : {"a...b", "a..", "a[1:x]", "a[*x]", "a[1:2:3]", ".."}) {
+            INFO("Path " << bad);
+            CHECK_THROWS_AS(Path(slice(bad)), FleeceException);
+        }
+        CHECK_THROWS_AS(CompiledPath("a[*]"_sl), FleeceException);
+        CHECK_THROWS_AS(Projection().addPath(Path("..a"_sl)), FleeceException);
+    }
 
-        enc.beginArray();
-        enc.writeBool(false);
-        enc.writeBool(true);
-        enc.endArray();
-        pos[n++] = enc.finishItem();
+    TEST_CASE_METHOD(EncoderTests, "Path Filter", "[Encoder]") {
+        for (bool withSharedKeys : {false, true}) {
+            INFO("withSharedKeys = " << withSharedKeys);
+            Retained<SharedKeys> sk = withSharedKeys ? new SharedKeys() : nullptr;
+            Retained<Doc> doc = Doc::fromJSON(R"({"name":"Bob","age":42,"password":"hunter2",
+                                      "address":{"city":"Oakland","zip":"94612","gate":"1234"},
+                                      "friends":[{"id":1,"name":"Al","ssn":"x"},7,
+                                                 {"id":2,"ssn":"y"}]})"_sl, sk);
+            auto filter = [&](std::vector<const char*> include,
+                              std::vector<const char*> exclude) {
+                std::vector<Path> inc, exc;
+                for (auto p : include) inc.emplace_back(slice(p));
+                for (auto p : exclude) exc.emplace_back(slice(p));
+                Encoder enc;
+                enc.setSharedKeys(sk);
+                PathFilter(inc, exc).encode(doc->root(), enc);
+                Retained<Doc> result = new Doc(enc.finish(), Doc::kTrusted, sk);
+                return result->root()->toJSON<5>(true).asString();
+            };
+            CHECK(filter({}, {}) == doc->root()->toJSON<5>(true).asString());
+            CHECK(filter({"name", "age"}, {}) == "{age:42,name:\"Bob\"}");
+            CHECK(filter({}, {"password", "address.gate", "friends.ssn"})
+                  == "{address:{city:\"Oakland\",zip:\"94612\"},age:42,"
+                     "friends:[{id:1,name:\"Al\"},7,{id:2}],name:\"Bob\"}");
+            CHECK(filter({"address", "friends.id", "nope.x"}, {"address.zip"})
+                  == "{address:{city:\"Oakland\",gate:\"1234\"},friends:[{id:1},{id:2}]}");
+            CHECK(filter({"name.first"}, {}) == "{}");
+            CHECK(filter({"address.city"}, {"address"}) == "{}");
+            CHECK(filter({"$"}, {"age"}).find("age") == std::string::npos);
+        }
+        CHECK_THROWS_AS(PathFilter().include(Path("a[1]"_sl)), FleeceException);
+        CHECK_THROWS_AS(PathFilter().exclude(Path("$"_sl)), FleeceException);
+    }
 
-        enc.writeString("LOL BUTTS"_sl);
-        pos[n++] = enc.finishItem();
+    TEST_CASE_METHOD(EncoderTests, "Path Filter doesn't leak excluded values", "[Encoder]") {
+        // "pub" shares its first value with "x", so the excluded "secret" lies between the
+        // values of the included Dict:
+        Encoder sourceEnc;
+        sourceEnc.beginDictionary();
+        sourceEnc.writeKey("x");
+        sourceEnc.writeString("shared-value-1");
+        sourceEnc.writeKey("secret");
+        sourceEnc.writeString("TOPSECRET-PASSWORD");
+        sourceEnc.writeKey("pub");
+        sourceEnc.beginDictionary();
+        sourceEnc.writeKey("a");
+        sourceEnc.writeString("shared-value-1");
+        sourceEnc.writeKey("b");
+        sourceEnc.writeString("public value b");
+        sourceEnc.writeKey("c");
+        sourceEnc.writeString("public value c");
+        sourceEnc.writeKey("d");
+        sourceEnc.writeString("public value d");
+        sourceEnc.endDictionary();
+        sourceEnc.endDictionary();
+        Retained<Doc> source = sourceEnc.finishDoc();
+
+        SECTION("Include") {
+            PathFilter({Path("pub"_sl)}, {}).encode(source->root(), enc);
+        }
+        SECTION("Exclude") {
+            PathFilter({}, {Path("secret"_sl)}).encode(source->root(), enc);
+        }
+        result = enc.finish();
+        Retained<Doc> doc = new Doc(result, Doc::kUntrusted);
+        REQUIRE(doc->root());
+        CHECK(doc->asDict()->get("pub"_sl)->isEqual(source->asDict()->get("pub"_sl)));
+        CHECK(!doc->asDict()->get("secret"_sl));
+        CHECK(!result.find("TOPSECRET"_sl));
+    }
 
-        enc.writeString("X"_sl);
-        pos[n++] = enc.finishItem();
+    TEST_CASE_METHOD(EncoderTests, "Extract Columns", "[Encoder]") {
+        auto isNull = [](const std::vector<uint8_t> &nulls, size_t row) {
+            return (nulls[row >> 3] & (1 << (row & 7))) != 0;
+        };
+        auto input = readTestFile(kBigJSONTestFileName);
+        for (bool withSharedKeys : {false, true}) {
+            INFO("withSharedKeys = " << withSharedKeys);
+            Retained<SharedKeys> sk = withSharedKeys ? new SharedKeys() : nullptr;
+            Retained<Doc> doc = Doc::fromJSON(input, sk);
+            auto people = doc->asArray();
+            uint32_t n = people->count();
+            std::vector<int64_t> ages(n), namesAsInts(n);
+            std::vector<double> latitudes(n);
+            std::vector<slice> names(n), bogus(n);
+            std::vector<uint8_t> ageNulls((n + 7) / 8, 0xFF), nameNulls((n + 7) / 8),
+                                 bogusNulls((n + 7) / 8);
+            Column columns[] = {
+                {"age"_sl,      ColumnType::kInt,    ages.data(),        ageNulls.data()},
+                {"latitude"_sl, ColumnType::kDouble, latitudes.data(),   nullptr},
+                {"name"_sl,     ColumnType::kString, names.data(),       nullptr},
+                {"name"_sl,     ColumnType::kInt,    namesAsInts.data(), nameNulls.data()},
+                {"bogus"_sl,    ColumnType::kString, bogus.data(),       bogusNulls.data()},
+            };
+            extractColumns(people, columns, 5);
+            for (uint32_t i = 0; i < n; ++i) {
+                auto person = people->get(i)->asDict();
+                CHECK(ages[i] == person->get("age"_sl)->asInt());
+                CHECK(!isNull(ageNulls, i));
+                CHECK(latitudes[i] == person->get("latitude"_sl)->asDouble());
+                CHECK(names[i] == person->get("name"_sl)->asString());
+                CHECK(namesAsInts[i] == 0);
+                CHECK(isNull(nameNulls, i));
+                CHECK(!bogus[i]);
+                CHECK(isNull(bogusNulls, i));
+            }
+        }
 
-        enc.writeInt(17);
+        // Rows that aren't Dicts, or don't have the same layout:
+        Retained<Doc> doc = Doc::fromJSON(R"([{"a":1,"b":2},{"b":3},17,{"_":0,"a":"x","b":4.5}])"_sl);
+        int64_t as[4];
+        double bs[4];
+        std::vector<uint8_t> nulls(1);
+        Column columns[] = {
+            {"a"_sl, ColumnType::kInt,    as, nulls.data()},
+            {"b"_sl, ColumnType::kDouble, bs, nullptr},
+        };
+        extractColumns(doc->asArray(), columns, 2);
+        CHECK(as[0] == 1);
+        CHECK(as[1] == 0);
+        CHECK(as[2] == 0);
+        CHECK(as[3] == 0);
+        CHECK(nulls[0] == 0x0E);
+        CHECK(bs[0] == 2.0);
+        CHECK(bs[1] == 3.0);
+        CHECK(bs[2] == 0.0);
+        CHECK(bs[3] == 4.5);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Array Stats", "[Encoder]") {
+        auto bitmapString = [](const std::vector<uint8_t> &bitmap, uint32_t count) {
+            std::string str;
+            for (uint32_t i = 0; i < count; ++i)
+                str += (bitmap[i >> 3] & (1 << (i & 7))) ? '1' : '0';
+            return str;
+        };
+
+        Retained<Doc> doc = Doc::fromJSON(R"([3, null, "x", -1.5, 10, true, 2])"_sl);
+        auto array = doc->asArray();
+        ArrayStats stats = getArrayStats(array);
+        CHECK(stats.count == 4);
+        CHECK(stats.nonNull == 6);
+        CHECK(stats.sum == 13.5);
+        CHECK(stats.min == -1.5);
+        CHECK(stats.max == 10);
+        std::vector<uint8_t> bitmap(1, 0xFF);
+        CHECK(filterNumbers(array, 2, 3, bitmap.data()) == 2);
+        CHECK(bitmapString(bitmap, 7) == "1000001");
+        CHECK(bitmap[0] == 0x41);
+
+        doc = Doc::fromJSON("[null, \"x\"]"_sl);
+        stats = getArrayStats(doc->asArray());
+        CHECK(stats.count == 0);
+        CHECK(stats.nonNull == 1);
+        CHECK(stats.sum == 0);
+        CHECK(std::isnan(stats.min));
+        CHECK(std::isnan(stats.max));
+
+        // Long Arrays, packed or not, span multiple blocks:
+        static constexpr uint32_t kCount = 1001;
+        for (bool packed : {false, true}) {
+            INFO("packed = " << packed);
+            enc.reset();
+            enc.packNumericArrays(packed);
+            enc.beginArray();
+            double sum = 0;
+            std::string expected;
+            for (uint32_t i = 0; i < kCount; ++i) {
+                double n = (i % 2) ? i * 0.3 : -(i * 1.1);
+                enc.writeDouble(n);
+                sum += n;
+                expected += (n >= 100 && n <= 300) ? '1' : '0';
+            }
+            enc.endArray();
+            enc.end();
+            doc = new Doc(enc.finish(), Doc::kUntrusted);
+            enc.resetOptions();
+            array = doc->asArray();
+            CHECK((array->packedType() != Array::PackedType::kNone) == packed);
+            stats = getArrayStats(array);
+            CHECK(stats.count == kCount);
+            CHECK(stats.nonNull == kCount);
+            CHECK(stats.sum == Approx(sum));
+            CHECK(stats.min == -1000 * 1.1);
+            CHECK(stats.max == 999 * 0.3);
+
+            bitmap.assign((kCount + 7) / 8, 0xFF);
+            auto expectedCount = std::count(expected.begin(), expected.end(), '1');
+            CHECK(filterNumbers(array, 100, 300, bitmap.data()) == expectedCount);
+            CHECK(bitmapString(bitmap, kCount) == expected);
+            CHECK((bitmap.back() >> (kCount % 8)) == 0);
+        }
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Sort Array", "[Encoder]") {
+        // Records with a random name, and an age that may be missing:
+        std::mt19937 rng(4321);
+        const uint32_t n = 1000;
+        enc.beginArray();
+        for (uint32_t i = 0; i < n; ++i) {
+            enc.beginDictionary();
+            if (rng() % 5) {
+                enc.writeKey("age");
+                if (rng() % 2)
+                    enc.writeInt(int(rng() % 100) - 20);
+                else
+                    enc.writeDouble((rng() % 1000) / 10.0 - 20);
+            }
+            enc.writeKey("name");
+            std::string name;
+            for (unsigned len = 1 + rng() % 3; len > 0; --len)
+                name += char('a' + rng() % 3);
+            enc.writeString(name);
+            enc.endDictionary();
+        }
+        enc.endArray();
+        endEncoding();
+        const Array *people = checkArray(n);
+
+        // Sort by ascending age, then descending name:
+        Path agePath("age"), namePath("name");
+        SortKey keys[] = {{&agePath, false}, {&namePath, true}};
+        auto order = sortArray(people, keys, 2);
+        REQUIRE(order.size() == n);
+
+        std::vector<uint32_t> expected(n);
+        for (uint32_t i = 0; i < n; ++i)
+            expected[i] = i;
+        std::stable_sort(expected.begin(), expected.end(), [&](uint32_t a, uint32_t b) {
+            auto pa = people->get(a)->asDict(), pb = people->get(b)->asDict();
+            auto ageA = pa->get("age"_sl), ageB = pb->get("age"_sl);
+            if (!ageA || !ageB) {
+                if (ageA || ageB)
+                    return !ageA;
+            } else if (ageA->asDouble() != ageB->asDouble()) {
+                return ageA->asDouble() < ageB->asDouble();
+            }
+            return pa->get("name"_sl)->asString() > pb->get("name"_sl)->asString();
+        });
+        CHECK(order == expected);
+
+        // Top-K returns the same first items:
+        auto top = sortArray(people, keys, 2, Collation::kBinary, 10);
+        CHECK(top == std::vector<uint32_t>(expected.begin(), expected.begin() + 10));
+
+        // Writing the sorted array as an amendment writes pointers to the original items:
+        Encoder enc2;
+        enc2.setBase(result);
+        writeSortedArray(people, keys, 2, Collation::kBinary, SIZE_MAX, enc2);
+        alloc_slice sorted = enc2.finish();
+        CHECK(sorted.size < 6 * n);
+        alloc_slice combined(result);
+        combined.append(sorted);
+        auto sortedPeople = Value::fromData(combined)->asArray();
+        REQUIRE(sortedPeople);
+        REQUIRE(sortedPeople->count() == n);
+        for (uint32_t i = 0; i < n; ++i) {
+            auto item = (const uint8_t*)sortedPeople->get(i);
+            auto original = (const uint8_t*)people->get(expected[i]);
+            CHECK(item - (const uint8_t*)combined.buf == original - (const uint8_t*)result.buf);
+        }
+
+        // Values of different types, and collations:
+        Retained<Doc> doc = Doc::fromJSON(
+            R"([{"v":"b"}, {"v":[1,2]}, {"v":null}, {"v":{}}, {"v":"B"}, {"v":true}, {"v":[1]},)"
+            R"( {}, {"v":-1.5}, {"v":false}, {"v":"a"}, {"v":3}, {"v":"A"}])"_sl);
+        Path vPath("v");
+        SortKey vKey[] = {{&vPath, false}};
+        CHECK(sortArray(doc->asArray(), vKey, 1)
+              == (std::vector<uint32_t>{7, 2, 9, 5, 8, 11, 12, 4, 10, 0, 6, 1, 3}));
+        CHECK(sortArray(doc->asArray(), vKey, 1, Collation::kASCIICaseInsensitive)
+              == (std::vector<uint32_t>{7, 2, 9, 5, 8, 11, 10, 12, 0, 4, 6, 1, 3}));
+        vKey[0].descending = true;
+        CHECK(sortArray(doc->asArray(), vKey, 1, Collation::kBinary, 4)
+              == (std::vector<uint32_t>{3, 1, 6, 0}));
+
+        Path wildPath("[*]");
+        SortKey wildKey[] = {{&wildPath, false}};
+        CHECK_THROWS_AS(sortArray(doc->asArray(), wildKey, 1), FleeceException);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Sorted Array Set Operations", "[Encoder]") {
+        auto encodeInts = [](const std::vector<int64_t> &ints) {
+            Encoder e;
+            e.beginArray();
+            for (auto i : ints)
+                e.writeInt(i);
+            e.endArray();
+            return e.finishDoc();
+        };
+        auto decodeInts = [](const Array *array) {
+            std::vector<int64_t> ints;
+            for (Array::iterator i(array); i; ++i)
+                ints.push_back(i->asInt());
+            return ints;
+        };
+
+        // Binary search, with mixed types:
+        Retained<Doc> doc = Doc::fromJSON(R"([null, false, -5, 2.5, 3, 40000, "A", "a", "ab", [1]])"_sl);
+        const Array *mixed = doc->asArray();
+        CHECK(mixed->lowerBound(nullptr) == 0);
+        CHECK(mixed->lowerBound(Value::kNullValue) == 0);
+        CHECK(mixed->lowerBound(Value::kTrueValue) == 2);
+        CHECK(mixed->lowerBound(mixed->get(3)) == 3);
+        Retained<Doc> probes = Doc::fromJSON(R"([3, 2.9, 3.1, 1e10, "aa", "b", [0], {}])"_sl);
+        const Array *p = probes->asArray();
+        CHECK(mixed->lowerBound(p->get(0)) == 4);
+        CHECK(mixed->lowerBound(p->get(1)) == 4);
+        CHECK(mixed->lowerBound(p->get(2)) == 5);
+        CHECK(mixed->lowerBound(p->get(3)) == 6);
+        CHECK(mixed->lowerBound(p->get(4)) == 8);
+        CHECK(mixed->lowerBound(p->get(5)) == 9);
+        CHECK(mixed->lowerBound(p->get(6)) == 9);
+        CHECK(mixed->lowerBound(p->get(7)) == 10);
+        CHECK(Array::kEmpty->lowerBound(p->get(0)) == 0);
+
+        // Set operations, compared with std's, with all combinations of sizes:
+        std::mt19937 rng(99);
+        auto randomSet = [&](size_t count, int64_t range) {
+            std::set<int64_t> ints;
+            while (ints.size() < count)
+                ints.insert(int64_t(rng() % range) - range / 2);
+            return std::vector<int64_t>(ints.begin(), ints.end());
+        };
+        for (size_t sizeA : {0, 1, 10, 2000}) {
+            for (size_t sizeB : {0, 3, 500}) {
+                INFO("sizes " << sizeA << ", " << sizeB);
+                auto a = randomSet(sizeA, 5000), b = randomSet(sizeB, 5000);
+                Retained<Doc> docA = encodeInts(a), docB = encodeInts(b);
+                const Array *arrayA = docA->asArray(), *arrayB = docB->asArray();
+                for (int op = 0; op < 3; ++op) {
+                    std::vector<int64_t> expected;
+                    auto out = std::back_inserter(expected);
+                    switch (op) {
+                        case 0: std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), out);
+                                writeIntersection(arrayA, arrayB, enc); break;
+                        case 1: std::set_union(a.begin(), a.end(), b.begin(), b.end(), out);
+                                writeUnion(arrayA, arrayB, enc); break;
+                        case 2: std::set_difference(a.begin(), a.end(), b.begin(), b.end(), out);
+                                writeDifference(arrayA, arrayB, enc); break;
+                    }
+                    endEncoding();
+                    INFO("op " << op);
+                    CHECK(decodeInts(Value::fromData(result)->asArray()) == expected);
+                }
+            }
+        }
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Predicate", "[Encoder]") {
+        for (bool withSharedKeys : {false, true}) {
+            INFO("withSharedKeys = " << withSharedKeys);
+            Retained<SharedKeys> sk = withSharedKeys ? new SharedKeys() : nullptr;
+            Retained<Doc> doc = Doc::fromJSON(R"([
+                {"name": "a", "age": 25, "address": {"city": "X"}},
+                {"name": "b", "age": 35, "address": {"city": "X"}, "tags": [1, 2]},
+                {"name": "c", "age": 45, "address": {"city": "Y"}},
+                {"name": "d", "age": "old"},
+                {"name": "e", "age": 31.5, "address": {"city": "X"}},
+                17
+            ])"_sl, sk);
+            const Array *docs = doc->asArray();
+            auto matching = [&](const char *json) {
+                Predicate pred = Predicate::fromJSON(slice(json), sk);
+                std::string names;
+                uint8_t bitmap[1];
+                uint32_t n = pred.filter(docs, bitmap);
+                for (uint32_t i = 0; i < docs->count(); ++i) {
+                    bool match = pred.matches(docs->get(i));
+                    CHECK(match == ((bitmap[0] >> i) & 1));
+                    if (match) {
+                        auto name = docs->get(i)->asDict() ? docs->get(i)->asDict()->get("name"_sl)
+                                                           : nullptr;
+                        names += name ? std::string(name->asString()) : std::string("?");
+                    }
+                }
+                CHECK(n == names.size());
+                return names;
+            };
+
+            CHECK(matching(R"([">", [".age"], 30])") == "bce");
+            CHECK(matching(R"(["<=", [".age"], 35])") == "abe");
+            CHECK(matching(R"(["=", [".age"], "old"])") == "d");
+            CHECK(matching(R"(["!=", [".age"], 25])") == "bcde");
+            CHECK(matching(R"(["AND", [">", [".age"], 30], ["==", [".address.city"], "X"]])") == "be");
+            CHECK(matching(R"(["OR", ["<", [".age"], 30], ["=", [".address.city"], "Y"]])") == "ac");
+            CHECK(matching(R"(["NOT", ["EXISTS", [".address"]]])") == "d?");
+            CHECK(matching(R"(["EXISTS", [".tags[1]"]])") == "b");
+            CHECK(matching(R"(["IN", [".name"], ["e", "a", "z"]])") == "ae");
+            CHECK(matching(R"(["AND", ["=", [".name"], "b"], [">=", [".tags[0]"], 1],
+                                      ["OR", ["NOT", ["=", [".age"], 1]], ["=", [".x"], 2]]])") == "b");
+
+            // Documents in a C array:
+            const Value* items[] = {docs->get(0), nullptr, docs->get(2)};
+            uint8_t bitmap;
+            CHECK(Predicate::fromJSON(R"(["NOT", ["EXISTS", [".name"]]])"_sl, sk)
+                      .filter(items, 3, &bitmap) == 1);
+            CHECK(bitmap == 0x02);
+        }
+
+        for (const char *bad : {R"([])", R"(["FOO", 1])", R"(["=", "age", 30])",
+                                R"(["=", [".age"]])", R"(["NOT"])", R"(["IN", [".a"], 3])",
+                                R"(["=", [".a"], [".b"]])", R"(17)"}) {
+            INFO("predicate: " << bad);
+            CHECK_THROWS_AS(Predicate::fromJSON(slice(bad)), FleeceException);
+        }
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Unique Collections", "[Encoder]") {
+        auto encode = [&](bool unique) {
+            enc.reset();
+            enc.uniqueCollections(unique);
+            enc.embedHashes(true);
+            enc.beginArray();
+            for (int i = 0; i < 20; ++i) {
+                enc.beginDictionary();
+                enc.writeKey("address");
+                enc.beginDictionary();
+                enc.writeKey("city");   enc.writeString("Springfield");
+                enc.writeKey("street"); enc.writeString("742 Evergreen Terrace");
+                enc.writeKey("zip");    enc.writeInt(i < 15 ? 12345 : 54321);
+                enc.endDictionary();
+                enc.writeKey("id");
+                enc.writeInt(i);
+                enc.writeKey("tags");
+                enc.beginArray();
+                enc.writeString("residential");
+                enc.writeString("verified");
+                enc.endArray();
+                enc.endDictionary();
+            }
+            // A collection identical to an earlier one, including nested ones:
+            enc.beginDictionary();
+            enc.writeKey("city");   enc.writeString("Springfield");
+            enc.writeKey("street"); enc.writeString("742 Evergreen Terrace");
+            enc.writeKey("zip");    enc.writeInt(12345);
+            enc.endDictionary();
+            enc.endArray();
+            enc.end();
+            alloc_slice data = enc.finish();
+            enc.resetOptions();
+            return data;
+        };
+        alloc_slice plainData = encode(false), uniqueData = encode(true);
+        CHECK(uniqueData.size < plainData.size * 2 / 3);
+
+        Retained<Doc> plainDoc = new Doc(plainData, Doc::kUntrusted);
+        Retained<Doc> uniqueDoc = new Doc(uniqueData, Doc::kUntrusted);
+        REQUIRE(uniqueDoc->root());     // i.e. it's valid
+        auto plain = plainDoc->asArray(), array = uniqueDoc->asArray();
+        CHECK(array->isEqual(plain));
+        CHECK(array->hash() == plain->hash());
+
+        // Identical collections are written once, and different ones aren't shared:
+        auto address = [&](const Array *a, uint32_t i) {return a->get(i)->asDict()->get("address"_sl);};
+        CHECK(address(array, 1) == address(array, 0));
+        CHECK(address(array, 14) == address(array, 0));
+        CHECK(address(array, 15) != address(array, 0));
+        CHECK(address(array, 19) == address(array, 15));
+        CHECK(address(array, 19)->asDict()->get("zip"_sl)->asInt() == 54321);
+        CHECK(array->get(20) == address(array, 0));
+        CHECK(array->get(1)->asDict()->get("tags"_sl) == array->get(0)->asDict()->get("tags"_sl));
+        CHECK(array->get(1) != array->get(0));
+        CHECK(address(plain, 1) != address(plain, 0));
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Relocating Copies", "[Encoder]") {
+        // People whose keys are written in reverse order, so each Dict's values are laid out in
+        // the opposite order to its keys. Re-encoding a Dict would write the values in key
+        // order, but relocating it preserves their layout:
+        auto writePeople = [](Encoder &e) {
+            e.beginArray();
+            for (int i = 0; i < 10; ++i) {
+                e.beginDictionary();
+                e.writeKey("tags");
+                e.beginArray();
+                e.writeString("a friend of mine");
+                e.writeString("colleague");
+                e.writeInt(1000 * i);
+                e.endArray();
+                e.writeKey("name");
+                e.writeString("Person number " + std::to_string(i));
+                e.writeKey("age");
+                e.writeInt(20 + i);
+                e.writeKey("address");
+                e.writeString(std::to_string(i) + " Evergreen Terrace, Springfield");
+                e.endDictionary();
+            }
+            e.endArray();
+        };
+        auto isRelocated = [](const Dict *person) {
+            return person->get("tags"_sl) < person->get("name"_sl);
+        };
+
+        Retained<SharedKeys> sourceKeys;
+        SECTION("No SharedKeys") { }
+        SECTION("SharedKeys") {
+            // (Adding the keys in sorted order keeps them in that order in the Dicts too:)
+            sourceKeys = new SharedKeys();
+            int key;
+            for (auto str : {"address", "age", "name", "tags"})
+                sourceKeys->encodeAndAdd(slice(str), key);
+        }
+        Encoder sourceEnc;
+        sourceEnc.setSharedKeys(sourceKeys);
+        writePeople(sourceEnc);
+        Retained<Doc> source = sourceEnc.finishDoc();
+        const Array *people = source->asArray();
+
+        // Copy some people, whose key strings (if any) were written by the first person:
+        enc.setSharedKeys(sourceKeys);
+        enc.beginArray();
+        enc.writeValue(people->get(3));
+        enc.writeValue(people->get(7));
+        enc.writeValue(people);
+        enc.endArray();
+        Retained<Doc> doc = new Doc(enc.finish(), Doc::kUntrusted, sourceKeys);
+        REQUIRE(doc->root());       // i.e. it's valid
+        auto copies = doc->asArray();
+        CHECK(copies->get(0)->isEqual(people->get(3)));
+        CHECK(copies->get(1)->isEqual(people->get(7)));
+        CHECK(copies->get(2)->isEqual(people));
+        CHECK(isRelocated(copies->get(0)->asDict()));
+        CHECK(isRelocated(copies->get(1)->asDict()));
+        CHECK(copies->get(1)->asDict()->get("address"_sl)->asString()
+              == "7 Evergreen Terrace, Springfield"_sl);
+        enc.reset();
+
+        if (sourceKeys) {
+            // Different SharedKeys that assign the keys different numbers in the same order:
+            Retained<SharedKeys> keys2 = new SharedKeys();
+            int key;
+            for (auto str : {"aaa", "address", "age", "b", "name", "tags"})
+                keys2->encodeAndAdd(slice(str), key);
+            enc.setSharedKeys(keys2);
+            enc.writeValue(people->get(3));
+            doc = new Doc(enc.finish(), Doc::kUntrusted, keys2);
+            REQUIRE(doc->root());
+            CHECK(doc->root()->isEqual(people->get(3)));
+            CHECK(doc->asDict()->get("age"_sl)->asInt() == 23);
+            CHECK(isRelocated(doc->asDict()));
+            enc.reset();
+
+            // ...or in a different order, so the Dicts have to be re-encoded:
+            Retained<SharedKeys> keys3 = new SharedKeys();
+            for (auto str : {"tags", "name", "age", "address"})
+                keys3->encodeAndAdd(slice(str), key);
+            enc.setSharedKeys(keys3);
+            enc.writeValue(people->get(3));
+            doc = new Doc(enc.finish(), Doc::kUntrusted, keys3);
+            REQUIRE(doc->root());
+            CHECK(doc->root()->isEqual(people->get(3)));
+            CHECK(doc->asDict()->get("age"_sl)->asInt() == 23);
+            CHECK(!isRelocated(doc->asDict()));
+            enc.reset();
+
+            // ...or to numbers too big for short ints, so the Dicts have to be re-encoded:
+            Retained<SharedKeys> bigKeys = new SharedKeys();
+            bigKeys->setCapacity(3000);
+            for (int i = 0; i < 2500; ++i)
+                bigKeys->encodeAndAdd(slice("filler" + std::to_string(i)), key);
+            for (auto str : {"address", "age", "name", "tags"})
+                bigKeys->encodeAndAdd(slice(str), key);
+            CHECK(key > 2048);
+            enc.setSharedKeys(bigKeys);
+            enc.writeValue(people->get(3));
+            doc = new Doc(enc.finish(), Doc::kUntrusted, bigKeys);
+            REQUIRE(doc->root());
+            CHECK(doc->root()->isEqual(people->get(3)));
+            CHECK(doc->asDict()->get("age"_sl)->asInt() == 23);
+            CHECK(doc->asDict()->get("tags"_sl)->asArray()->count() == 3);
+            CHECK(!isRelocated(doc->asDict()));
+            enc.reset();
+
+            // Copying those Dicts, whose keys aren't short ints, back to the original keys:
+            Retained<Doc> bigDoc = doc;
+            enc.setSharedKeys(sourceKeys);
+            enc.writeValue(bigDoc->root());
+            doc = new Doc(enc.finish(), Doc::kUntrusted, sourceKeys);
+            REQUIRE(doc->root());
+            CHECK(doc->root()->isEqual(people->get(3)));
+            CHECK(doc->asDict()->get("age"_sl)->asInt() == 23);
+            CHECK(doc->asDict()->get("name"_sl)->asString() == "Person number 3"_sl);
+            enc.reset();
+        } else {
+            // String keys that the Encoder's SharedKeys would encode have to be re-encoded:
+            Retained<SharedKeys> keys2 = new SharedKeys();
+            enc.setSharedKeys(keys2);
+            enc.writeValue(people->get(3));
+            doc = new Doc(enc.finish(), Doc::kUntrusted, keys2);
+            REQUIRE(doc->root());
+            CHECK(doc->asDict()->get("age"_sl)->asInt() == 23);
+            CHECK(doc->asDict()->get("age"_sl, keys2) == doc->asDict()->get("age"_sl));
+            CHECK(!isRelocated(doc->asDict()));
+            enc.reset();
+        }
+        enc.setSharedKeys(nullptr);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Relocating Copies don't leak other values", "[Encoder]") {
+        // The Dict's first value is the string already written for "x", so the string "secret"
+        // lies in a gap between the Dict's values, which must not be copied with them:
+        Encoder sourceEnc;
+        sourceEnc.beginDictionary();
+        sourceEnc.writeKey("x");
+        sourceEnc.writeString("shared-value-1");
+        sourceEnc.writeKey("secret");
+        sourceEnc.writeString("TOPSECRET-PASSWORD");
+        sourceEnc.writeKey("pub");
+        sourceEnc.beginDictionary();
+        sourceEnc.writeKey("a");
+        sourceEnc.writeString("shared-value-1");
+        sourceEnc.writeKey("b");
+        sourceEnc.writeString("public value b");
+        sourceEnc.writeKey("c");
+        sourceEnc.writeString("public value c");
+        sourceEnc.writeKey("d");
+        sourceEnc.writeString("public value d");
+        sourceEnc.endDictionary();
+        sourceEnc.endDictionary();
+        Retained<Doc> source = sourceEnc.finishDoc();
+        const Value *pub = source->asDict()->get("pub"_sl);
+
+        enc.writeValue(pub);
+        result = enc.finish();
+        Retained<Doc> doc = new Doc(result, Doc::kUntrusted);
+        REQUIRE(doc->root());
+        CHECK(doc->root()->isEqual(pub));
+        CHECK(!result.find("TOPSECRET"_sl));
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Packed Arrays", "[Encoder]") {
+        using PackedType = Array::PackedType;
+        auto encode = [&](bool packed, std::function<void()> fn) {
+            enc.reset();
+            enc.packNumericArrays(packed);
+            fn();
+            enc.end();
+            alloc_slice data = enc.finish();
+            enc.resetOptions();
+            return data;
+        };
+        auto check = [&](const char *json, PackedType expectedType) {
+            INFO("JSON = " << json);
+            alloc_slice data[2];
+            for (bool packed : {false, true})
+                data[packed] = encode(packed, [&]{ JSONConverter(enc).encodeJSON(slice(json)); });
+            Retained<Doc> plainDoc = new Doc(data[0], Doc::kUntrusted);
+            Retained<Doc> doc = new Doc(data[1], Doc::kUntrusted);
+            REQUIRE(doc->root());     // i.e. it's valid
+            auto plain = plainDoc->asArray(), array = doc->asArray();
+            CHECK(array->packedType() == expectedType);
+            CHECK(plain->packedType() == PackedType::kNone);
+            CHECK(data[1].size <= data[0].size);
+            CHECK(array->toJSONString() == std::string(json));
+            CHECK(array->isEqual(plain));
+            REQUIRE(array->count() == plain->count());
+            Array::iterator j(plain);
+            uint32_t index = 0;
+            for (Array::iterator i(array); i; ++i, ++j, ++index) {
+                CHECK(i.value()->isEqual(j.value()));
+                CHECK(array->get(index)->isEqual(j.value()));
+            }
+
+            std::vector<double> doubles(array->count()), plainDoubles(array->count());
+            std::vector<int64_t> ints(array->count()), plainInts(array->count());
+            CHECK(array->getDoubles(0, array->count(), doubles.data()) == array->count());
+            CHECK(plain->getDoubles(0, array->count(), plainDoubles.data()) == array->count());
+            CHECK(doubles == plainDoubles);
+            CHECK(array->getInts(1, 100, ints.data()) == array->count() - 1);
+            CHECK(plain->getInts(1, 100, plainInts.data()) == array->count() - 1);
+            CHECK(ints == plainInts);
+            CHECK(array->getInts(array->count(), 1, ints.data()) == 0);
+
+            Retained<MutableArray> ma = MutableArray::newArray(array);
+            CHECK(ma->isEqual(plain));
+            return data[1];
+        };
+
+        check("[1,2,3]", PackedType::kNone);                       // too short
+        check("[1,2,3,4,5,6]", PackedType::kNone);                 // small ints are smaller
+        check("[100000,-200000,300000,2147483647,-2147483648,2000000000]", PackedType::kInt32);
+        check("[100000,-200000,300000,400000,1,2]", PackedType::kNone);   // would be bigger
+        check("[100000000000000000,-200000000000000000,300000000000000000,400000000000000000]",
+              PackedType::kInt64);
+        check("[10000000000,-20000000000,30000000000,1,2]", PackedType::kNone);
+        check("[1.5,2.5,3.5,-4.25,0.5]", PackedType::kFloat);
+        check("[1.1,2.2,3.3,-4.4,0.5]", PackedType::kDouble);
+        check("[1.5,2.5,3,4,5]", PackedType::kNone);               // mixed ints and floats
+        check("[100000,200000,300000,\"x\",400000]", PackedType::kNone);
+        check("[100000,200000,300000,null,400000]", PackedType::kNone);
+        check("[100000,200000,300000,400000,18446744073709551615]", PackedType::kNone);
+
+        // Nested Arrays, and an Array containing an Array:
+        alloc_slice data = check("[[1.1,2.2,3.3,4.4,5.5],[],[100000,200000,300000,400000,500000,"
+                                 "[1.1,2.2,3.3,4.4,5.5]],{\"a\":[1.1,2.2,3.3,4.4,5.5]}]",
+                                 PackedType::kNone);
+        auto root = Value::fromData(data)->asArray();
+        CHECK(root->get(0)->asArray()->packedType() == PackedType::kDouble);
+        CHECK(root->get(2)->asArray()->packedType() == PackedType::kNone);
+        CHECK(root->get(2)->asArray()->get(5)->asArray()->packedType() == PackedType::kDouble);
+        CHECK(root->get(3)->asDict()->get("a"_sl)->asArray()->packedType() == PackedType::kDouble);
+        CHECK(Value::dump(data).find("<packed>") != std::string::npos);
+
+        // Numbers written as Values, and a long Array:
+        data = encode(true, [&]{
+            enc.beginArray();
+            for (int i = 0; i < 5000; ++i)
+                enc.writeValue(root->get(0)->asArray()->get(i % 5));
+            enc.endArray();
+        });
+        auto array = Value::fromData(data)->asArray();
+        REQUIRE(array);
+        CHECK(array->packedType() == PackedType::kDouble);
+        CHECK(array->count() == 5000);
+        CHECK(array->get(4999)->asDouble() == 5.5);
+        CHECK(data.size < 10 * 5000 + 16);
+
+        // A regular Array of that many doubles is wide, but still equal to a packed one:
+        auto writeDoubles = [&]{
+            enc.beginArray();
+            for (int i = 0; i < 20000; ++i)
+                enc.writeDouble(i + 0.1);
+            enc.endArray();
+        };
+        alloc_slice wideData = encode(false, writeDoubles), packedData = encode(true, writeDoubles);
+        auto wideArray = Value::fromData(wideData)->asArray();
+        auto packedArray = Value::fromData(packedData)->asArray();
+        REQUIRE(wideArray);
+        REQUIRE(packedArray);
+        CHECK((*(const uint8_t*)wideArray & 0x08) != 0);       // wide
+        CHECK(packedArray->packedType() == PackedType::kDouble);
+        CHECK((*(const uint8_t*)packedArray & 0x08) == 0);     // narrow
+        CHECK(wideArray->isEqual(packedArray));
+        CHECK(packedArray->isEqual(wideArray));
+
+        // A regular Array whose count is exactly kLongArrayCount, like a packed Array's header:
+        alloc_slice longData = encode(false, [&]{
+            enc.beginArray();
+            for (uint32_t i = 0; i < kLongArrayCount; ++i)
+                enc.writeDouble(i + 0.1);
+            enc.endArray();
+        });
+        auto longArray = Value::fromData(longData)->asArray();
+        REQUIRE(longArray);
+        CHECK(longArray->packedType() == PackedType::kNone);
+        CHECK(longArray->count() == kLongArrayCount);
+        CHECK(longArray->get(kLongArrayCount - 1)->asDouble() == kLongArrayCount - 1 + 0.1);
+
+        // Corrupt an item's tag; validation should catch it:
+        alloc_slice corrupt(data.buf, data.size);
+        ((uint8_t*)corrupt.buf)[(uint8_t*)array->get(17) - (uint8_t*)data.buf] = 0x13;
+        CHECK(Value::fromData(corrupt) == nullptr);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Resuse Encoder", "[Encoder]") {
+        enc.beginDictionary();
+        enc.writeKey("foo");
+        enc.writeInt(17);
+        enc.endDictionary();
+        auto data1 = enc.finish();
+
+        enc.beginDictionary();
+        enc.writeKey("bar");
+        enc.writeInt(23);
+        enc.endDictionary();
+        auto data2 = enc.finish();
+
+        enc.beginDictionary();
+        enc.writeKey("baz");
+        enc.writeInt(42);
+        enc.endDictionary();
+        auto data3 = enc.finish();
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Reuse Encoder Retaining Buffers", "[Encoder]") {
+        // Big collections and long strings, so the buffers outgrow their inline capacity:
+        auto writeDoc = [](Encoder &e, int n) {
+            e.beginArray();
+            for (int i = 0; i < n; ++i) {
+                e.beginDictionary();
+                for (int k = 0; k < 200; ++k) {
+                    char key[20];
+                    sprintf(key, "key%03d", (k * 37) % 200);
+                    e.writeKey(slice(key));
+                    e.writeString(std::string(50 + k, char('a' + (i + k) % 26)));
+                }
+                e.endDictionary();
+            }
+            e.endArray();
+            return e.finish();
+        };
+
+        Encoder plain;
+        enc.retainBuffers(true);
+        for (int n : {40, 3, 40, 1, 20}) {
+            alloc_slice expected = writeDoc(plain, n);
+            CHECK(writeDoc(enc, n) == expected);
+        }
+
+        enc.retainBuffers(false);
+        CHECK(writeDoc(enc, 5) == writeDoc(plain, 5));
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Multi-Item", "[Encoder]") {
+        enc.suppressTrailer();
+        size_t pos[10];
+        unsigned n = 0;
+
+        enc.beginDictionary();
+        enc.writeKey("foo");
+        enc.writeInt(17);
+        enc.endDictionary();
+        pos[n++] = enc.finishItem();
+
+        enc.beginDictionary();
+        enc.writeKey("bar");
+        enc.writeInt(123456789);
+        enc.endDictionary();
+        pos[n++] = enc.finishItem();
+
+        enc.beginArray();
+        enc.writeBool(false);
+        enc.writeBool(true);
+        enc.endArray();
+        pos[n++] = enc.finishItem();
+
+        enc.writeString("LOL BUTTS"_sl);
+        pos[n++] = enc.finishItem();
+
+        enc.writeString("X"_sl);
+        pos[n++] = enc.finishItem();
+
+        enc.writeInt(17);
         pos[n++] = enc.finishItem();
 
         endEncoding();
@@ -950,6 +2797,1023 @@ public:
     }
 
 
+    TEST_CASE_METHOD(EncoderTests, "Snip Repeatedly", "[Encoder]") {
+        std::vector<alloc_slice> parts;
+        enc.beginArray();
+        for (int i = 0; i < 3; ++i) {
+            enc.beginDictionary();
+            enc.writeKey("part");
+            enc.writeInt(i);
+            enc.writeKey("name");
+            enc.writeString("Snip Test");
+            enc.endDictionary();
+            parts.push_back(enc.snip());
+            REQUIRE(parts.back());
+        }
+        enc.endArray();
+        endEncoding();
+        REQUIRE(result);
+
+        // Each part's extern pointers resolve into the parts before it:
+        std::vector<Retained<Doc>> docs;
+        slice previous;
+        for (auto &part : parts) {
+            docs.push_back(new Doc(part, Doc::kUntrusted, nullptr, previous));
+            REQUIRE(docs.back()->root());
+            previous = part;
+        }
+        CHECK(docs[2]->root()->toJSONString() == R"({"name":"Snip Test","part":2})");
+        Retained<Doc> doc = new Doc(result, Doc::kUntrusted, nullptr, previous);
+        REQUIRE(doc->root());
+        CHECK(doc->root()->toJSONString() == R"([{"name":"Snip Test","part":0},)"
+                                              R"({"name":"Snip Test","part":1},)"
+                                              R"({"name":"Snip Test","part":2}])");
+        auto array = doc->root()->asArray();
+        CHECK(array->get(0)->asDict()->get("name") == array->get(2)->asDict()->get("name"));
+    }
+
+
+    TEST_CASE_METHOD(EncoderTests, "Progressive Snip", "[Encoder]") {
+        static constexpr int kCount = 500;
+        bool isDict = GENERATE(false, true);
+        Retained<ProgressiveDoc> received = new ProgressiveDoc();
+        size_t chunkCount = 0, firstChunkCount = 0;
+        enc.snipEvery(1000, [&](alloc_slice chunk) {
+            ++chunkCount;
+            size_t before = received->receivedCount();
+            REQUIRE(received->addChunk(chunk));
+            if (chunkCount == 1)
+                firstChunkCount = received->receivedCount();
+            CHECK(received->receivedCount() > before);
+            CHECK(!received->root());
+        });
+
+        if (isDict)
+            enc.beginDictionary();
+        else
+            enc.beginArray();
+        for (int i = 0; i < kCount; ++i) {
+            if (isDict)
+                enc.writeKey("key" + std::to_string(i));
+            enc.beginDictionary();
+            enc.writeKey("index");
+            enc.writeInt(i);
+            enc.writeKey("name");
+            enc.writeString("Progressive");
+            enc.writeKey("label");
+            enc.writeString("item " + std::to_string(i));
+            enc.endDictionary();
+        }
+        if (isDict)
+            enc.endDictionary();
+        else
+            enc.endArray();
+        endEncoding();
+        REQUIRE(result);
+        CHECK(chunkCount > 5);
+
+        // Items received before the end can be read:
+        size_t partial = received->receivedCount();
+        REQUIRE(partial > 0);
+        REQUIRE(partial < kCount);
+        const Value *item = isDict ? received->get("key" + std::to_string(partial - 1))
+                                   : received->receivedItem(partial - 1);
+        REQUIRE(item);
+        CHECK(item->asDict()->get("index")->asInt() == int64_t(partial - 1));
+        CHECK(item->asDict()->get("label")->asString() == slice("item " + std::to_string(partial - 1)));
+        CHECK(!received->receivedItem(kCount));
+
+        REQUIRE(received->addFinalChunk(result));
+        REQUIRE(received->isComplete());
+        CHECK(received->receivedCount() == kCount);
+        const Value *root = received->root();
+        REQUIRE(root);
+        for (int i = 0; i < kCount; ++i) {
+            const Value *item = isDict ? root->asDict()->get("key" + std::to_string(i))
+                                       : root->asArray()->get(uint32_t(i));
+            REQUIRE(item);
+            CHECK(item->asDict()->get("index")->asInt() == i);
+        }
+        // A string written in an earlier chunk is reused, not written again:
+        auto first = isDict ? root->asDict()->get("key0") : root->asArray()->get(0);
+        auto next = isDict ? root->asDict()->get("key" + std::to_string(firstChunkCount))
+                           : root->asArray()->get(uint32_t(firstChunkCount));
+        CHECK(first->asDict()->get("name")->asString().buf ==
+              next->asDict()->get("name")->asString().buf);
+    }
+
+
+    TEST_CASE_METHOD(EncoderTests, "Checksum", "[Encoder]") {
+        alloc_slice json = readTestFile(kBigJSONTestFileName);
+        alloc_slice plain = JSONConverter::convertJSON(json);
+        CHECK(!Value::hasValidChecksum(plain));
+        CHECK(Value::fromChecksummedData(plain) == Value::fromData(plain));
+
+        auto encodeWithChecksum = [](auto fn) {
+            Encoder e;
+            e.checksum(true);
+            fn(e);
+            return e.finish();
+        };
+
+        alloc_slice data = encodeWithChecksum([&](Encoder &e) {
+            JSONConverter jc(e);
+            REQUIRE(jc.encodeJSON(json));
+        });
+        CHECK(data.size == plain.size + kChecksumSize);
+        CHECK(Value::hasValidChecksum(data));
+        // Readers that don't know about the checksum still read the data:
+        auto root = Value::fromData(data);
+        REQUIRE(root);
+        CHECK(root->isEqual(Value::fromData(plain)));
+        CHECK(Value::fromChecksummedData(data) == root);
+        Retained<Doc> doc = new Doc(data, Doc::kTrustedIfChecksummed);
+        CHECK(doc->root() == root);
+
+        // Any damage to the data makes the checksum fail:
+        alloc_slice damaged {slice(data)};   // a copy
+        for (size_t pos : {size_t(0), data.size / 2, data.size - kChecksumSize, data.size - 1}) {
+            ((uint8_t*)damaged.buf)[pos] ^= 0x10;
+            CHECK(!Value::hasValidChecksum(damaged));
+            ((uint8_t*)damaged.buf)[pos] ^= 0x10;
+        }
+        CHECK(Value::hasValidChecksum(damaged));
+        // ...in which case the data is validated instead:
+        ((uint8_t*)damaged.buf)[data.size - kNarrow] = 0x30;      // not a pointer
+        CHECK(Value::fromChecksummedData(damaged) == nullptr);
+
+        // A scalar root, and a wide root:
+        data = encodeWithChecksum([](Encoder &e) {e.writeInt(17);});
+        CHECK(Value::hasValidChecksum(data));
+        REQUIRE(Value::fromChecksummedData(data));
+        CHECK(Value::fromData(data)->asInt() == 17);
+
+        std::string bigString(100000, 'x');
+        data = encodeWithChecksum([&](Encoder &e) {
+            e.beginArray();
+            e.writeString(bigString);
+            for (int i = 0; i < 20000; ++i)
+                e.writeInt(i);
+            e.endArray();
+        });
+        CHECK(Value::hasValidChecksum(data));
+        REQUIRE(Value::fromData(data));
+        CHECK(Value::fromData(data)->asArray()->count() == 20001);
+
+        // Can't checksum data written to a sink:
+        Encoder senc([](slice) { }, 1024);
+        senc.checksum(true);
+        senc.writeInt(1);
+        CHECK_THROWS_AS(senc.end(), FleeceException);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Aligned Numbers", "[Encoder]") {
+        auto encode = [](bool align, bool checksum, auto fn) {
+            Encoder e;
+            e.alignNumbers(align);
+            e.checksum(checksum);
+            fn(e);
+            return e.finish();
+        };
+        auto writeNumbers = [](Encoder &e) {
+            e.beginArray();
+            for (int i = 0; i < 20; ++i) {
+                e.writeDouble(i + 0.1);
+                e.writeString(std::string(i % 5, 'x'));
+                e.writeFloat(i + 0.5f);
+                e.writeInt(i * 1000000);
+            }
+            e.endArray();
+        };
+        // Checks the alignment of the floating-point numbers in `array`, relative to `whole`:
+        auto checkAligned = [](slice whole, const Array *array) {
+            unsigned nDoubles = 0;
+            for (Array::iterator i(array); i; ++i) {
+                if (i->type() != kNumber || i->isInteger())
+                    continue;
+                size_t payload = (const uint8_t*)i.value() + 2 - (const uint8_t*)whole.buf;
+                if (i->isDouble()) {
+                    CHECK(payload % 8 == 0);
+                    ++nDoubles;
+                } else {
+                    CHECK(payload % 4 == 0);
+                }
+            }
+            return nDoubles;
+        };
+
+        alloc_slice plain = encode(false, false, writeNumbers);
+        CHECK(!Value::hasAlignedNumbers(plain));
+        for (bool checksum : {false, true}) {
+            alloc_slice data = encode(true, checksum, writeNumbers);
+            CHECK(Value::hasAlignedNumbers(data));
+            CHECK(Value::hasValidChecksum(data) == checksum);
+            auto root = Value::fromData(data);
+            REQUIRE(root);
+            CHECK(root->isEqual(Value::fromData(plain)));
+            CHECK(checkAligned(data, root->asArray()) == 20);
+
+            // Copying unaligned numbers aligns them:
+            alloc_slice copy = encode(true, checksum, [&](Encoder &e) {
+                e.writeValue(Value::fromData(plain));
+            });
+            CHECK(Value::hasAlignedNumbers(copy));
+            CHECK(checkAligned(copy, Value::fromData(copy)->asArray()) == 20);
+        }
+
+        // A scalar root:
+        alloc_slice scalar = encode(true, false, [](Encoder &e) {e.writeDouble(M_PI);});
+        CHECK(Value::hasAlignedNumbers(scalar));
+        CHECK(Value::fromData(scalar)->asDouble() == M_PI);
+        CHECK(((const uint8_t*)Value::fromData(scalar) + 2 - (const uint8_t*)scalar.buf) % 8 == 0);
+
+        // Data that just ends with something like the marker isn't aligned:
+        alloc_slice fake = encode(false, false, [](Encoder &e) {e.writeData("ALIGNED"_sl);});
+        CHECK(!Value::hasAlignedNumbers(fake));
+        CHECK(!Value::hasAlignedNumbers(alloc_slice(size_t(0))));
+
+        // Numbers appended to a base are aligned relative to the start of the base:
+        alloc_slice base = encode(true, false, writeNumbers);
+        Encoder e;
+        e.alignNumbers(true);
+        e.setBase(base);
+        e.beginArray();
+        e.writeValue(Value::fromData(base)->asArray()->get(0));
+        e.writeString("z");
+        e.writeDouble(2.25e100);
+        e.writeDouble(-7.125e-50);
+        e.endArray();
+        alloc_slice delta = e.finish();
+        alloc_slice combined(base);
+        combined.append(delta);
+        CHECK(Value::hasAlignedNumbers(combined));
+        CHECK(checkAligned(combined, Value::fromData(combined)->asArray()) == 3);
+    }
+
+
+    TEST_CASE_METHOD(EncoderTests, "Avoid Wide Collections", "[Encoder]") {
+        // Each Dict has a 40KB Data value, written before its other values, so its pointers to
+        // that and to its key don't fit in narrow slots:
+        auto encode = [](bool avoidWide, Encoder::CollectionStats &stats) {
+            Encoder e;
+            e.avoidWideCollections(avoidWide);
+            e.beginArray();
+            for (int i = 0; i < 3; ++i) {
+                e.beginDictionary();
+                e.writeKey("big");
+                e.writeData(slice(std::string(40000, char('a' + i))));
+                for (int k = 0; k < 10; ++k) {
+                    e.writeKey(std::string("key") + std::to_string(k));
+                    e.writeString(std::string("value #") + std::to_string(i * 100 + k));
+                }
+                e.endDictionary();
+            }
+            e.endArray();
+            alloc_slice data = e.finish();
+            stats = e.collectionStats();
+            return data;
+        };
+
+        Encoder::CollectionStats wideStats, narrowStats;
+        alloc_slice wideData = encode(false, wideStats);
+        alloc_slice narrowData = encode(true, narrowStats);
+        CHECK(wideStats.wide == 4);
+        CHECK(wideStats.narrow == 0);
+        CHECK(wideStats.farPointers == 0);
+        CHECK(wideStats.narrowRatio() == 0.0);
+        // The root Array has only 3 items, so widening it is cheaper than redirecting them:
+        CHECK(narrowStats.wide == 1);
+        CHECK(narrowStats.narrow == 3);
+        CHECK(narrowStats.narrowItems == 33);
+        CHECK(narrowStats.farPointers == 6);
+        CHECK(narrowStats.narrowRatio() == 0.75);
+        CHECK(narrowData.size < wideData.size);
+
+        auto root = Value::fromData(narrowData)->asArray();
+        REQUIRE(root);
+        CHECK(root->isEqual(Value::fromData(wideData)));
+        for (int i = 0; i < 3; ++i) {
+            auto dict = root->get(i)->asDict();
+            REQUIRE(dict);
+            CHECK((((const uint8_t*)dict)[0] & 0x08) == 0);     // not wide
+            CHECK(dict->get("big"_sl)->asData().size == 40000);
+            CHECK(dict->get("key3"_sl)->asString()
+                  == slice(std::string("value #") + std::to_string(i * 100 + 3)));
+        }
+    }
+
+
+    TEST_CASE_METHOD(EncoderTests, "Access Profile Layout", "[Encoder]") {
+        auto keyName = [](int i) {return std::string("field") + std::to_string(100 + i);};
+        Encoder enc;
+        enc.beginDictionary();
+        for (int i = 0; i < 40; ++i) {
+            enc.writeKey(keyName(i));
+            enc.writeString(std::string(200, char('A' + i)));
+        }
+        enc.endDictionary();
+        alloc_slice data = enc.finish();
+        const Dict *root = Value::fromData(data)->asDict();
+        REQUIRE(root);
+
+        AccessProfile profile(1);
+        profile.start();
+        CHECK(profile.started());
+        // (Dict::get is pure, so the results have to be used, or the calls may be skipped.)
+        for (int rep = 0; rep < 10; ++rep) {
+            CHECK(root->get(slice(keyName(7))));
+            if (rep < 5)
+                CHECK(root->get(slice(keyName(31))));
+            if (rep < 2)
+                CHECK(root->get(slice(keyName(12))));
+        }
+        profile.stop();
+        CHECK(!profile.started());
+        CHECK(root->get(slice(keyName(7))));      // not recorded
+        CHECK(profile.count(slice(keyName(7))) == 10);
+        CHECK(profile.count(slice(keyName(31))) == 5);
+        CHECK(profile.count("nope"_sl) == 0);
+        CHECK(profile.total() == 17);
+        auto hottest = profile.hottest(2);
+        REQUIRE(hottest.size() == 2);
+        CHECK(hottest[0].first == keyName(7));
+        CHECK(hottest[1].first == keyName(31));
+
+        // Re-encode it with the hot values last, next to the root:
+        Encoder enc2;
+        enc2.setAccessProfile(&profile);
+        enc2.writeValue(root);
+        alloc_slice data2 = enc2.finish();
+        const Dict *root2 = Value::fromData(data2)->asDict();
+        REQUIRE(root2);
+        CHECK(root2->isEqual(root));
+        auto addr = [&](int i) {return (const uint8_t*)root2->get(slice(keyName(i)));};
+        CHECK(addr(7) > addr(31));
+        CHECK(addr(31) > addr(12));
+        for (int i = 0; i < 40; ++i) {
+            if (i != 7 && i != 31 && i != 12)
+                CHECK(addr(12) > addr(i));
+        }
+
+        // Sampling:
+        AccessProfile sampled(4);
+        sampled.start();
+        for (int i = 0; i < 100; ++i)
+            CHECK(root->get(slice(keyName(1))));
+        sampled.stop();
+        CHECK(sampled.count(slice(keyName(1))) == 25);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Access Profile Sampling", "[Encoder]") {
+        Encoder enc;
+        enc.beginDictionary();
+        enc.writeKey("name");
+        enc.beginDictionary();
+        enc.writeKey("first");
+        enc.writeString("Ada");
+        enc.writeKey("last");
+        enc.writeString("Lovelace");
+        enc.endDictionary();
+        enc.writeKey("born");
+        enc.writeInt(1815);
+        enc.endDictionary();
+        alloc_slice data = enc.finish();
+        const Value *root = Value::fromData(data);
+        REQUIRE(root);
+
+        AccessProfile profile(1);
+        profile.start();
+        Path path("name.last");
+        for (int rep = 0; rep < 3; ++rep) {
+            CHECK(path.eval(root)->asString() == "Lovelace"_sl);
+            CHECK(Path::eval("born"_sl, root)->asInt() == 1815);
+        }
+        unsigned n = 0;
+        for (Dict::iterator i(root->asDict()); i; ++i)
+            ++n;
+        CHECK(n == 2);
+
+        // Other threads' samples are added too:
+        std::thread([&] {
+            for (int rep = 0; rep < 100; ++rep)
+                CHECK(root->asDict()->get("born"_sl));
+        }).join();
+        std::thread t([&] {
+            for (int rep = 0; rep < 10; ++rep)
+                CHECK(root->asDict()->get("born"_sl));
+        });
+        t.join();
+        profile.stop();
+
+        CHECK(profile.count("name.last"_sl, AccessProfile::kPath) == 3);
+        CHECK(profile.count("born"_sl, AccessProfile::kPath) == 3);
+        CHECK(profile.total(AccessProfile::kPath) == 6);
+        CHECK(profile.count("name"_sl) == 3);           // lookups made by the paths
+        CHECK(profile.count("last"_sl) == 3);
+        CHECK(profile.count("born"_sl) == 113);
+        CHECK(profile.count("name"_sl, AccessProfile::kIteration) == 1);
+        CHECK(profile.count("born"_sl, AccessProfile::kIteration) == 1);
+        CHECK(profile.count("first"_sl, AccessProfile::kIteration) == 0);
+        CHECK(profile.total(AccessProfile::kIteration) == 2);
+
+        std::stringstream out;
+        profile.dump(out, 1);
+        CHECK(out.str() == "Access profile, sampling 1 in 1:\n"
+                           "Lookups: 119 sampled, 3 distinct\n"
+                           "    113\tborn\n"
+                           "Iterations: 2 sampled, 2 distinct\n"
+                           "    1\tborn\n"
+                           "Paths: 6 sampled, 2 distinct\n"
+                           "    3\tborn\n");
+
+        // Train SharedKeys with the profile; the hottest keys are added first:
+        Retained<SharedKeys> sk = new SharedKeys();
+        sk->setCapacity(2);
+        sk->beginTraining();
+        sk->train(profile);
+        CHECK(sk->finishTraining() == 2);
+        int key;
+        CHECK(sk->encode("born"_sl, key));
+        CHECK(sk->encode("name"_sl, key));
+        CHECK(!sk->encode("last"_sl, key));
+
+        profile.clear();
+        CHECK(profile.total() == 0);
+        CHECK(profile.total(AccessProfile::kPath) == 0);
+    }
+
+    TEST_CASE_METHOD(EncoderTests, "Embedded Hashes", "[Encoder]") {
+        alloc_slice json = readTestFile(kBigJSONTestFileName);
+        Retained<SharedKeys> sk = new SharedKeys();
+        auto encode = [&](bool sharedKeys, bool options, bool hashes) {
+            Encoder e;
+            if (sharedKeys)
+                e.setSharedKeys(sk);
+            e.embedHashes(hashes);
+            e.indexLargeDicts(options);
+            e.prefixDictKeys(options);
+            e.packNumericArrays(options);
+            e.beginArray();
+            JSONConverter jc(e);
+            REQUIRE(jc.encodeJSON(json));
+            e.beginDictionary();    // a Dict big enough to have a hash
+            for (int i = 0; i < 100; ++i) {
+                e.writeKey("k" + std::to_string(i));
+                e.writeDouble(i * 0.5);
+            }
+            e.endDictionary();
+            e.endArray();
+            return e.finishDoc();
+        };
+        // The hashes of equal Values are equal, however they're encoded:
+        Retained<Doc> plain = encode(false, false, false), fancy = encode(true, true, true);
+        CHECK(fancy->data().size > encode(true, true, false)->data().size);
+        const Value *root = plain->root(), *fancyRoot = fancy->root();
+        CHECK(fancyRoot->hash() == root->hash());
+        CHECK(fancy->hashOf(fancyRoot) == root->hash());
+        CHECK(plain->hashOf(root) == root->hash());
+        CHECK(plain->hashOf(root) == root->hash());     // (cached)
+        auto array = root->asArray()->get(0)->asArray();
+        auto fancyArray = fancyRoot->asArray()->get(0)->asArray();
+        for (uint32_t i = 0; i < array->count(); ++i)
+            CHECK(fancyArray->get(i)->hash() == array->get(i)->hash());
+        CHECK(fancyArray->hash() == array->hash());
+        auto dict = root->asArray()->get(1)->asDict();
+        auto fancyDict = fancyRoot->asArray()->get(1)->asDict();
+        CHECK(dict->count() == 100);
+        CHECK(fancyDict->hash() == dict->hash());
+        CHECK(fancyRoot->isEqual(root));
+
+        // Mutable copies have the same hashes too:
+        Retained<MutableDict> mdict = MutableDict::newDict(dict);
+        CHECK(mdict->hash() == dict->hash());
+        mdict->set("k7"_sl, 3.0);
+        CHECK(mdict->hash() != dict->hash());
+
+        // Different values have different hashes:
+        Encoder e;
+        e.setSharedKeys(sk);
+        e.embedHashes(true);
+        e.writeValue(mdict);
+        alloc_slice changed = e.finish();
+        auto changedDict = Value::fromTrustedData(changed)->asDict();
+        CHECK(changedDict->hash() == mdict->hash());
+        CHECK(!changedDict->isEqual(fancyDict));
+    }
+
+
+    TEST_CASE_METHOD(EncoderTests, "Canonical Encoding", "[Encoder]") {
+        // The same content, encoded in different ways:
+        Retained<SharedKeys> sk = new SharedKeys();
+        Encoder e1;
+        e1.setSharedKeys(sk);
+        e1.uniqueStrings(false);
+        e1.beginDictionary();
+        e1.writeKey("name");
+        e1.writeString("Fleece Fleece");
+        e1.writeKey("size");
+        e1.writeDouble(3.0);
+        e1.writeKey("tags");
+        e1.beginArray();
+        e1.writeString("Fleece Fleece");
+        e1.writeFloat(0.5f);
+        e1.writeUInt(UINT32_MAX);
+        e1.endArray();
+        e1.writeKey("zero");
+        e1.writeDouble(-0.0);
+        e1.endDictionary();
+        Retained<Doc> doc1 = e1.finishDoc();
+        Retained<Doc> doc2 = Doc::fromJSON("{\"zero\":0,\"tags\":[\"Fleece Fleece\",0.5,4294967295],"
+                                           "\"size\":3,\"name\":\"Fleece Fleece\"}"_sl);
+        CHECK(doc1->data() != doc2->data());
+
+        auto canonical = [&](const Value *v) {
+            Encoder e;
+            e.canonical(true);
+            e.setSharedKeys(sk);
+            e.writeValue(v);
+            return e.finish();
+        };
+        alloc_slice c = canonical(doc1->root());
+        CHECK(canonical(doc2->root()) == c);
+        Retained<MutableDict> mdict = MutableDict::newDict(doc1->root()->asDict());
+        mdict->set("size"_sl, 3);
+        CHECK(canonical(mdict) == c);
+
+        // Writing the same content directly, keys in order:
+        Encoder e3;
+        e3.canonical(true);
+        e3.setSharedKeys(sk);
+        e3.beginDictionary();
+        e3.writeKey("name");
+        e3.writeString("Fleece Fleece");
+        e3.writeKey("size");
+        e3.writeUInt(3);
+        e3.writeKey("tags");
+        e3.beginArray();
+        e3.writeString("Fleece Fleece");
+        e3.writeDouble(0.5);
+        e3.writeInt(UINT32_MAX);
+        e3.endArray();
+        e3.writeKey("zero");
+        e3.writeFloat(0.0f);
+        e3.endDictionary();
+        CHECK(e3.finish() == c);
+
+        // The canonical data has string keys, even though there were SharedKeys:
+        const Dict *root = Value::fromData(c)->asDict();
+        REQUIRE(root);
+        CHECK(root->toJSONString() == "{\"name\":\"Fleece Fleece\",\"size\":3,"
+                                      "\"tags\":[\"Fleece Fleece\",0.5,4294967295],\"zero\":0}");
+        for (Dict::iterator i(root); i; ++i)
+            CHECK(i.key()->type() == kString);
+
+        // Keys out of order:
+        Encoder e4;
+        e4.canonical(true);
+        e4.beginDictionary();
+        e4.writeKey("b");
+        e4.writeInt(1);
+        e4.writeKey("a");
+        e4.writeInt(2);
+        CHECK_THROWS_AS(e4.endDictionary(), FleeceException);
+
+        // Unsupported:
+        Encoder e5;
+        e5.canonical(true);
+        CHECK_THROWS_AS(e5.setBase(c), FleeceException);
+        e5.canonical(false);
+        e5.setBase(c);
+        CHECK_THROWS_AS(e5.canonical(true), FleeceException);
+    }
+
+
+    TEST_CASE("Amending repeatedly", "[Encoder]") {
+        alloc_slice data = JSONConverter::convertJSON(
+                                ConvertJSON5("{name: 'Brooklyn Bridge', city: 'New York City'}"));
+        Encoder incremental, full;
+        incremental.setBase(data);
+        incremental.reuseBaseStrings();
+        for (int round = 0; round < 5; ++round) {
+            // Each amendment adds a new string, and repeats earlier ones:
+            Retained<Doc> doc = new Doc(data, Doc::kTrusted);
+            Retained<MutableDict> update = MutableDict::newDict(doc->asDict());
+            std::string key = "k" + std::to_string(round);
+            update->set(slice(key), "Round number " + std::to_string(round));
+            update->set("again"_sl, "Brooklyn Bridge"_sl);
+            if (round > 0)
+                update->set("previous"_sl, "Round number " + std::to_string(round - 1));
+
+            incremental.writeValue(update);
+            alloc_slice delta = incremental.finish();
+
+            // It should come out the same as when the whole base is scanned:
+            full.reset();
+            full.setBase(data);
+            full.reuseBaseStrings();
+            full.writeValue(update);
+            CHECK(full.finish() == delta);
+
+            alloc_slice combined(data);
+            combined.append(delta);
+            data = combined;
+            incremental.resetForAmend(data);
+        }
+        auto root = Value::fromData(data)->asDict();
+        CHECK(root->get("previous"_sl)->asString() == "Round number 3"_sl);
+        CHECK(root->get("again"_sl)->asString() == "Brooklyn Bridge"_sl);
+        CHECK(root->count() == 9);
+
+        // A base that isn't the last one plus its output just gets scanned:
+        alloc_slice other = JSONConverter::convertJSON("{\"x\":\"Brooklyn Bridge\"}"_sl);
+        incremental.resetForAmend(other);
+        Retained<Doc> otherDoc = new Doc(other, Doc::kTrusted);
+        Retained<MutableDict> update = MutableDict::newDict(otherDoc->asDict());
+        update->set("y"_sl, "Brooklyn Bridge"_sl);
+        incremental.writeValue(update);
+        full.reset();
+        full.setBase(other);
+        full.reuseBaseStrings();
+        full.writeValue(update);
+        CHECK(incremental.finish() == full.finish());
+    }
+
+
+    TEST_CASE("Max Dict parent depth", "[Encoder]") {
+        // True if the last Dict in the data (the root) inherits from a parent:
+        auto rootHasParent = [](slice data) {
+            std::string dump = Value::dump(data);
+            return dump.find("<parent>", dump.rfind("Dict {")) != std::string::npos;
+        };
+
+        alloc_slice data = JSONConverter::convertJSON("{\"a\":1,\"b\":2,\"c\":3}"_sl);
+        for (int round = 0; round < 8; ++round) {
+            Encoder enc;
+            enc.setBase(data);
+            enc.maxDictParentDepth(3);
+            enc.beginDictionary(Value::fromData(data)->asDict());
+            std::string key = "k" + std::to_string(round);
+            enc.writeKey(slice(key));
+            enc.writeInt(round);
+            if (round == 2) {
+                enc.writeKey("a"_sl);
+                enc.writeUndefined();
+            }
+            enc.endDictionary();
+            alloc_slice combined(data);
+            combined.append(enc.finish());
+            data = combined;
+
+            // Every fourth revision is written without a parent, so chains stay short:
+            CHECK(rootHasParent(data) == (round % 4 != 3));
+            auto root = Value::fromData(data)->asDict();
+            CHECK(root->count() == 2 + unsigned(round + 1) + (round < 2));
+            CHECK((root->get("a"_sl) != nullptr) == (round < 2));
+            CHECK(root->get("c"_sl)->asInt() == 3);
+            CHECK(root->get("k0"_sl)->asInt() == 0);
+            CHECK(root->get(slice(key))->asInt() == round);
+        }
+        CHECK(Value::fromData(data)->toJSONString() ==
+              "{\"b\":2,\"c\":3,\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,"
+              "\"k5\":5,\"k6\":6,\"k7\":7}");
+    }
+
+
+#ifndef NDEBUG
+    TEST_CASE("Far pointers", "[Encoder]") {
+        auto encode = [] {
+            Encoder enc;
+            enc.beginDictionary();
+            enc.writeKey("greeting");
+            enc.writeString("hello there, world");
+            enc.writeKey("list");
+            enc.beginArray();
+            for (int i = 0; i < 20; ++i) {
+                enc.writeString("string number " + std::string(1, char('a' + i % 5)));
+                enc.writeInt(i * 1000);
+            }
+            enc.endArray();
+            enc.writeKey("nested");
+            enc.beginDictionary();
+            enc.writeKey("greeting");
+            enc.writeString("hello there, world");
+            enc.endDictionary();
+            enc.endDictionary();
+            return enc.finish();
+        };
+        alloc_slice normal = encode();
+
+        // Lower the limit, so this small document needs far pointers:
+        gMaxWideOffset = 64;
+        alloc_slice far;
+        try {
+            far = encode();
+        } catch (...) {
+            gMaxWideOffset = Pointer::kMaxWideOffset;
+            throw;
+        }
+        gMaxWideOffset = Pointer::kMaxWideOffset;
+
+        CHECK(far.size > normal.size);
+        const Value *root = Value::fromData(far);
+        REQUIRE(root);
+        CHECK(root->toJSON() == Value::fromData(normal)->toJSON());
+        CHECK(root->asDict()->get("list"_sl)->asArray()->get(39)->asInt() == 19000);
+
+        // Find the far pointers, and check that validation catches a bad offset in any of them:
+        int nFar = 0;
+        for (size_t pos = 0; pos + Pointer::kFarPointerSize <= far.size; pos += 2) {
+            auto v = (const Value*)&far[pos];
+            uint64_t offset = Pointer::farOffset(v);
+            if (Pointer::isFarPointer(v) && far[pos + 1] == 0 && offset > 0 && offset <= pos
+                    && offset % 2 == 0) {
+                ++nFar;
+                alloc_slice corrupt {slice(far)};             // (a copy)
+                Pointer::writeFarPointer((void*)&corrupt[pos], pos + 2);
+                CHECK(Value::fromData(corrupt) == nullptr);
+            }
+        }
+        CHECK(nFar > 0);
+    }
+#endif
+
+
+    TEST_CASE("Doc templates", "[Encoder]") {
+        Encoder enc;
+        enc.beginDictionary();
+        enc.writeKey("id");
+        CHECK(enc.writePlaceholder(DocTemplate::kIntPlaceholder) == 0);
+        enc.writeKey("kind");
+        enc.writeString("response");
+        enc.writeKey("name");
+        CHECK(enc.writePlaceholder(DocTemplate::kStringPlaceholder) == 1);
+        enc.writeKey("score");
+        CHECK(enc.writePlaceholder(DocTemplate::kDoublePlaceholder) == 2);
+        enc.writeKey("tags");
+        enc.beginArray();
+        enc.writeString("fixed");
+        CHECK(enc.writePlaceholder(DocTemplate::kStringPlaceholder) == 3);
+        enc.endArray();
+        enc.endDictionary();
+        DocTemplate tmpl = enc.finishTemplate();
+        REQUIRE(tmpl.count() == 4);
+        CHECK(tmpl.placeholder(2).type == DocTemplate::kDoublePlaceholder);
+
+        auto check = [&](int64_t id, slice name, double score, slice tag) {
+            DocTemplate::Arg args[4] = {{id, 0, {}}, {0, 0, name}, {0, score, {}}, {0, 0, tag}};
+            alloc_slice data = tmpl.instantiate(args, 4);
+            const Dict *root = Value::fromData(data)->asDict();      // (validates the data)
+            REQUIRE(root);
+            CHECK(root->count() == 5);
+            CHECK(root->get("id"_sl)->asInt() == id);
+            CHECK(root->get("kind"_sl)->asString() == "response"_sl);
+            CHECK(root->get("name"_sl)->asString() == name);
+            CHECK(root->get("score"_sl)->asDouble() == score);
+            const Array *tags = root->get("tags"_sl)->asArray();
+            CHECK(tags->get(0)->asString() == "fixed"_sl);
+            CHECK(tags->get(1)->asString() == tag);
+        };
+        check(17, "Alice"_sl, 2.5, "x"_sl);
+        check(-1234567890123, ""_sl, -0.001, "a tag that's longer than fifteen bytes"_sl);
+        check(INT64_MAX, std::string(100000, 'z'), 1e300, "odd"_sl);   // far from its pointer
+
+        DocTemplate::Arg tooFew[1] = {{1, 0, {}}};
+        CHECK_THROWS_AS(tmpl.instantiate(tooFew, 1), FleeceException);
+
+        enc.reset();
+        enc.beginDictionary();
+        CHECK_THROWS_AS(enc.writePlaceholder(DocTemplate::kIntPlaceholder), FleeceException);
+    }
+
+
+    TEST_CASE("Encode mutable tree in parallel", "[Encoder]") {
+        // A Dict of Arrays of small Dicts, with some shared strings and one big nested subtree:
+        Retained<MutableDict> root = MutableDict::newDict();
+        for (int k = 0; k < 8; ++k) {
+            Retained<MutableArray> array = MutableArray::newArray();
+            for (int i = 0; i < 150; ++i) {
+                Retained<MutableDict> item = MutableDict::newDict();
+                item->set("name"_sl, slice("item #" + std::to_string(i % 40)));
+                item->set("kind"_sl, "widget"_sl);
+                Retained<MutableArray> nums = MutableArray::newArray();
+                for (int j = 0; j < 30; ++j)
+                    nums->append(k * 100000 + i * 100 + j);
+                item->set("nums"_sl, nums);
+                array->append(item);
+            }
+            root->set(slice("list" + std::to_string(k)), array);
+        }
+        root->set("scalar"_sl, 17);
+
+        Encoder serialEnc;
+        serialEnc.writeValue(root);
+        alloc_slice serial = serialEnc.finish();
+
+        alloc_slice parallel;
+        for (unsigned nThreads : {1u, 2u, 3u, 8u, 0u}) {
+            Encoder enc;
+            enc.beginArray();
+            enc.writeString("widget");
+            enc.writeValueParallel(root, nThreads);
+            enc.writeString("item #7");          // can point to the copy in a subtree
+            enc.endArray();
+            alloc_slice data = enc.finish();
+            if (parallel)
+                CHECK(data == parallel);          // output doesn't depend on the thread count
+            else
+                parallel = data;
+
+            Retained<Doc> doc = new Doc(data, Doc::kUntrusted);
+            REQUIRE(doc->asArray());
+            CHECK(doc->asArray()->get(1)->isEqual(root));
+            CHECK(doc->asArray()->get(2)->asString() == "item #7"_sl);
+        }
+        CHECK(Value::fromData(serial)->isEqual(root));
+        CHECK(parallel.size < serial.size + serial.size / 10);
+
+        // A small tree is just written with writeValue:
+        Retained<MutableDict> small = MutableDict::newDict();
+        small->set("x"_sl, 1);
+        Encoder enc2, enc3;
+        enc2.writeValueParallel(small, 4);
+        enc3.writeValue(small);
+        CHECK(enc2.finish() == enc3.finish());
+    }
+
+
+    TEST_CASE_METHOD(EncoderTests, "Shared String Pool", "[Encoder]") {
+        Retained<SharedStrings> pool = new SharedStrings({"active", "x", "United Kingdom", "active"});
+        CHECK(pool->count() == 2);
+        CHECK(pool->find("x") == nullptr);
+
+        // Reload it from its data, as though it had been persisted:
+        pool = new SharedStrings(alloc_slice(pool->data()));
+        CHECK(pool->count() == 2);
+        const Value *active = pool->find("active");
+        REQUIRE(active);
+        CHECK(active->asString() == "active"_sl);
+        CHECK(pool->contains(active));
+
+        auto encode = [&](bool useUniqueStrings, SharedStrings *withPool) {
+            Encoder e;
+            e.setSharedStrings(withPool);
+            e.uniqueStrings(useUniqueStrings);
+            for (int pass = 0; pass < 2; ++pass) {  // second pass checks the pool survives reset()
+                e.reset();
+                e.beginArray();
+                e.writeString("active");
+                e.writeString("United Kingdom");
+                e.beginDictionary();
+                e.writeKey("status");
+                e.writeString("active");
+                e.endDictionary();
+                e.writeString("unknown");
+                e.endArray();
+                result = e.finish();
+            }
+        };
+
+        encode(true, nullptr);
+        size_t sizeWithoutPool = result.size;
+
+        for (bool unique : {true, false}) {
+            encode(unique, pool);
+            Retained<Doc> doc = new Doc(result, Doc::kUntrusted, nullptr, pool->data());
+            auto root = doc->root()->asArray();
+            REQUIRE(root);
+            CHECK(root->toJSONString() ==
+                  R"(["active","United Kingdom",{"status":"active"},"unknown"])");
+            // Pooled strings are pointers into the pool:
+            CHECK(root->get(0) == active);
+            CHECK(root->get(2)->asDict()->get("status") == active);
+            CHECK(pool->contains(root->get(1)));
+            CHECK(!pool->contains(root->get(3)));
+            CHECK(result.size + 20 < sizeWithoutPool);
+        }
+
+        // Invalid pool data:
+        CHECK_THROWS_AS(new SharedStrings(alloc_slice("not fleece")), FleeceException);
+        Encoder e;
+        e.beginArray();
+        e.writeInt(17);
+        e.endArray();
+        CHECK_THROWS_AS(new SharedStrings(e.finish()), FleeceException);
+
+        // The pool is the encoder's base, so it can't have another one:
+        e.reset();
+        e.setSharedStrings(pool);
+        CHECK_THROWS_AS(e.setBase(pool->data()), FleeceException);
+    }
+
+
+#if FL_HAVE_FILESYSTEM
+    TEST_CASE("CollectionFile", "[Encoder]") {
+        const char *path = kTempDir "fleece_collection";
+        // Store each person in the big test file as a separate document:
+        Retained<Doc> people = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+        const Array *array = people->asArray();
+        REQUIRE(array);
+        Retained<SharedStrings> pool = new SharedStrings({"female", "male", "brown", "blue",
+                                                          "green", "apple", "banana",
+                                                          "strawberry"});
+        size_t separateSize = 0;
+        {
+            CollectionFileWriter writer(path, nullptr, pool);
+            for (Array::iterator i(array); i; ++i) {
+                size_t n = writer.count();
+                CHECK(writer.add(i.value()) == n);
+                Encoder enc;
+                enc.writeValue(i.value());
+                separateSize += enc.finish().size;
+            }
+            CHECK(writer.addJSON("{\"gender\":\"male\",\"name\":\"Extra\"}"_sl) == array->count());
+            CHECK_THROWS_AS(writer.addJSON("{\"gender\":"_sl), FleeceException);
+            writer.finish();
+            CHECK_THROWS_AS(writer.addJSON("[]"_sl), FleeceException);
+        }
+        alloc_slice data = readFile(path);
+        std::cerr << "Collection file is " << data.size << " bytes; separate documents are "
+                  << separateSize << "\n";
+        CHECK(data.size < separateSize * 9 / 10);
+
+        for (int mapped = 0; mapped <= 1; ++mapped) {
+            Retained<CollectionFile> file = mapped ? CollectionFile::open(path)
+                                                   : make_retained<CollectionFile>(data);
+            REQUIRE(file->count() == array->count() + 1);
+            CHECK(file->stringPool() == pool->data());
+            CHECK(file->sharedKeys()->count() > 0);
+            for (size_t i : {size_t(0), size_t(17), file->count() - 2}) {
+                Retained<Doc> doc = file->document(i);
+                REQUIRE(doc);
+                CHECK(doc->root()->isEqual(array->get(uint32_t(i))));
+                const Dict *person = doc->asDict();
+                CHECK(person->get("gender")->asString() == array->get(uint32_t(i))->asDict()
+                                                               ->get("gender")->asString());
+                CHECK(file->stringPool().containsAddress(person->get("gender")));
+            }
+            Retained<Doc> extra = file->document(file->count() - 1);
+            REQUIRE(extra);
+            CHECK(extra->root()->toJSONString() == "{\"name\":\"Extra\",\"gender\":\"male\"}");
+            CHECK_THROWS_AS(file->document(file->count()), FleeceException);
+            file = nullptr;
+            // The Doc retains the file:
+            CHECK(extra->asDict()->get("name")->asString() == "Extra"_sl);
+        }
+
+        // Invalid files:
+        CHECK_THROWS_AS(new CollectionFile(alloc_slice("not a collection file")), FleeceException);
+        alloc_slice truncated(data.upTo(data.size - 8));
+        CHECK_THROWS_AS(new CollectionFile(truncated), FleeceException);
+    }
+#endif
+
+
+    TEST_CASE("CompressedDoc", "[Encoder]") {
+        Retained<Doc> original = Doc::fromJSON(readTestFile(kBigJSONTestFileName));
+        alloc_slice compressed = CompressedDoc::compress(original->data(), 16 * 1024);
+        std::cerr << "Compressed " << original->data().size << " bytes to " << compressed.size
+                  << "\n";
+        CHECK(compressed.size < original->data().size * 3 / 4);
+
+        Retained<CompressedDoc> doc = new CompressedDoc(compressed);
+        CHECK(doc->blockCount() == (original->data().size + 16 * 1024 - 1) / (16 * 1024));
+        const Array *people = doc->root()->asArray();
+        REQUIRE(people);
+        CHECK(people->count() == original->asArray()->count());
+        CHECK(doc->loadedBlockCount() < doc->blockCount());
+        CHECK(Doc::containing(people).get() == doc->doc());
+
+        // Load one item, and look up its properties:
+        size_t before = doc->loadedBlockCount();
+        uint32_t index = people->count() / 2;
+        const Dict *person = doc->load(people->get(index))->asDict();
+        REQUIRE(person);
+        const Dict *originalPerson = original->asArray()->get(index)->asDict();
+        CHECK(person->get("name")->asString() == originalPerson->get("name")->asString());
+        CHECK(person->get("age")->asInt() == originalPerson->get("age")->asInt());
+        CHECK(doc->load(person, true)->isEqual(originalPerson));
+        CHECK(doc->loadedBlockCount() <= before + 3);
+
+        // Load everything:
+        doc->load(doc->root(), true);
+        CHECK(doc->loadedBlockCount() == doc->blockCount());
+        CHECK(doc->root()->isEqual(original->root()));
+        CHECK(doc->load(original->root()) == original->root());
+
+        // Small data and block sizes:
+        alloc_slice small = Doc::fromJSON("[1, \"two\", {\"three\": 3}]"_sl)->allocedData();
+        Retained<CompressedDoc> smallDoc = new CompressedDoc(CompressedDoc::compress(small, 1024));
+        CHECK(smallDoc->blockCount() == 1);
+        CHECK(smallDoc->load(smallDoc->root(), true)->toJSONString() == "[1,\"two\",{\"three\":3}]");
+
+        // Invalid data:
+        CHECK_THROWS_AS(CompressedDoc::compress(original->data(), 100), FleeceException);
+        CHECK_THROWS_AS(new CompressedDoc(original->allocedData()), FleeceException);
+        alloc_slice truncated(compressed.upTo(100));
+        CHECK_THROWS_AS(new CompressedDoc(truncated), FleeceException);
+    }
+
+
 #pragma mark - KEY TREE:
 
     TEST_CASE_METHOD(EncoderTests, "KeyTree", "[Encoder]") {
@@ -1013,8 +3877,151 @@ public:
         REQUIRE(keys[(unsigned)n+2].buf == nullptr);
         REQUIRE(keys[(unsigned)n+28].buf == nullptr);
         REQUIRE(keys[(unsigned)9999].buf == nullptr);
+
+        // Small trees, whose bottom nodes aren't all at the same depth:
+        for (size_t count = 0; count <= 9; ++count) {
+            std::vector<slice> few(strings.begin(), strings.begin() + count);
+            std::sort(few.begin(), few.end());
+            KeyTree small = KeyTree::fromSortedStrings(few);
+            CHECK(small.count() == count);
+            for (size_t i = 0; i < count; ++i) {
+                CHECK(small[few[i]] == i + 1);
+                CHECK(small[unsigned(i + 1)] == few[i]);
+            }
+            CHECK(small["~"_sl] == 0);
+            CHECK(small[""_sl] == 0);
+            CHECK(small[unsigned(count + 1)].buf == nullptr);
+        }
+    }
+
+    // Converts Fleece to CBOR or MessagePack and back, checking that nothing changed.
+    template <class TO, class FROM>
+    static std::string roundTrip(const char *json5, TO toFormat, FROM fromFormat) {
+        alloc_slice fleece = JSONConverter::convertJSON(ConvertJSON5(json5));
+        const Value *original = Value::fromData(fleece);
+        alloc_slice converted = toFormat(original, nullptr);
+        alloc_slice back = fromFormat(converted, nullptr);
+        CHECK(Value::fromData(back)->isEqual(original));
+        return converted.hexString();
+    }
+
+    static std::string cborToJSON(slice cbor, ErrorCode *outError =nullptr) {
+        Encoder enc;
+        ErrorCode error;
+        if (!CBORConverter::encodeCBOR(cbor, enc, error)) {
+            if (outError)
+                *outError = error;
+            return "error";
+        }
+        return Value::fromData(enc.finish())->toJSONString();
+    }
+
+    static std::string msgPackToJSON(slice msgpack, ErrorCode *outError =nullptr) {
+        Encoder enc;
+        ErrorCode error;
+        if (!MsgPackConverter::encodeMsgPack(msgpack, enc, error)) {
+            if (outError)
+                *outError = error;
+            return "error";
+        }
+        return Value::fromData(enc.finish())->toJSONString();
+    }
+
+
+    TEST_CASE("CBOR conversion", "[Encoder]") {
+        // Examples from RFC 8949, Appendix A (in arrays, since the JSON parser wants one):
+        auto cbor = [](const char *json5) {
+            return roundTrip(json5, CBORConverter::toCBOR, [](slice s, SharedKeys *sk) {
+                return CBORConverter::convertCBOR(s, sk);
+            });
+        };
+        CHECK(cbor("[0]") == "8100");
+        CHECK(cbor("[23]") == "8117");
+        CHECK(cbor("[24]") == "811818");
+        CHECK(cbor("[1000]") == "811903e8");
+        CHECK(cbor("[1000000]") == "811a000f4240");
+        CHECK(cbor("[18446744073709551615]") == "811bffffffffffffffff");
+        CHECK(cbor("[-1]") == "8120");
+        CHECK(cbor("[-1000]") == "813903e7");
+        CHECK(cbor("[-9223372036854775808]") == "813b7fffffffffffffff");
+        CHECK(cbor("[1.5]") == "81fa3fc00000");
+        CHECK(cbor("[1.1]") == "81fb3ff199999999999a");
+        CHECK(cbor("[false, true, null]") == "83f4f5f6");
+        CHECK(cbor("'IETF'") == "6449455446");
+        CHECK(cbor("[1, [2, 3], [4, 5]]") == "8301820203820405");
+        CHECK(cbor("{a: 1, b: [2, 3]}") == "a26161016162820203");
+        cbor("{name: 'Alice', tags: ['x', 'y'], n: {deep: [{deeper: 3.25}]}}");
+
+        CHECK(cborToJSON("\xf9\x3e\x00"_sl) == "1.5");                       // half float
+        CHECK(cborToJSON("\xf9\xc4\x00"_sl) == "-4.0");
+        CHECK(cborToJSON("\x9f\xff"_sl) == "[]");                            // indefinite
+        CHECK(cborToJSON("\x7f\x65strea\x64ming\xff"_sl) == "\"streaming\"");
+        CHECK(cborToJSON("\xbf\x61\x61\x01\x61\x62\x9f\x02\x03\xff\xff"_sl)
+              == "{\"a\":1,\"b\":[2,3]}");
+        CHECK(cborToJSON("\xc1\x1a\x51\x4b\x67\xb0"_sl) == "1363896240");    // tagged
+        CHECK(cborToJSON("\xf7"_sl) == "undefined");
+
+        ErrorCode error = NoError;
+        CHECK(cborToJSON("\xa1\x01\x02"_sl, &error) == "error");            // int key
+        CHECK(error == EncodeError);
+        CHECK(cborToJSON("\xf8\xff"_sl, &error) == "error");                // simple(255)
+        CHECK(error == EncodeError);
+        for (slice bad : {"\x19\x03"_sl, "\x00\x00"_sl, "\x3b\xff\xff\xff\xff\xff\xff\xff\xff"_sl,
+                          "\x1c"_sl, "\xff"_sl, "\x9f\x01"_sl, "\x85\x01"_sl, "\x62\xc3\x28"_sl,
+                          "\xfa\x7f\xc0\x00\x00"_sl, ""_sl}) {
+            error = NoError;
+            CHECK(cborToJSON(bad, &error) == "error");
+            CHECK(error == InvalidData);
+        }
+        std::string deep(CBORConverter::kMaxNestingLevels + 1, '\x81');
+        deep += '\x00';
+        CHECK(cborToJSON(slice(deep), &error) == "error");
+        CHECK_THROWS_AS(CBORConverter::convertCBOR("\x18"_sl), FleeceException);
+    }
+
+
+    TEST_CASE("MessagePack conversion", "[Encoder]") {
+        auto msgPack = [](const char *json5) {
+            return roundTrip(json5, MsgPackConverter::toMsgPack, [](slice s, SharedKeys *sk) {
+                return MsgPackConverter::convertMsgPack(s, sk);
+            });
+        };
+        CHECK(msgPack("[0]") == "9100");
+        CHECK(msgPack("[127]") == "917f");
+        CHECK(msgPack("[200]") == "91ccc8");
+        CHECK(msgPack("[65536]") == "91ce00010000");
+        CHECK(msgPack("[18446744073709551615]") == "91cfffffffffffffffff");
+        CHECK(msgPack("[-1]") == "91ff");
+        CHECK(msgPack("[-33]") == "91d0df");
+        CHECK(msgPack("[-1000]") == "91d1fc18");
+        CHECK(msgPack("[-9223372036854775808]") == "91d38000000000000000");
+        CHECK(msgPack("[1.5]") == "91ca3fc00000");
+        CHECK(msgPack("[1.1]") == "91cb3ff199999999999a");
+        CHECK(msgPack("[false, true, null]") == "93c2c3c0");
+        CHECK(msgPack("{a: 1}") == "81a16101");
+        CHECK(msgPack("'0123456789012345678901234567890123456789'").substr(0, 4) == "d928");
+        CHECK(msgPack("[0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5]").substr(0, 6) == "dc0010");
+        msgPack("{name: 'Alice', tags: ['x', 'y'], n: {deep: [{deeper: 3.25}]}}");
+
+        CHECK(msgPackToJSON("\xd0\x80"_sl) == "-128");
+        CHECK(msgPackToJSON("\xc4\x02\x01\x02"_sl) == "\"AQI=\"");          // binary
+        CHECK(msgPackToJSON("\xde\x00\x01\xa1z\x90"_sl) == "{\"z\":[]}");
+
+        ErrorCode error = NoError;
+        CHECK(msgPackToJSON("\x81\x01\x02"_sl, &error) == "error");         // int key
+        CHECK(error == EncodeError);
+        CHECK(msgPackToJSON("\xd4\x01\x00"_sl, &error) == "error");         // extension
+        CHECK(error == EncodeError);
+        for (slice bad : {"\xc1"_sl, "\xcd\x01"_sl, "\x00\x00"_sl, "\x92\x01"_sl,
+                          "\xa2\xc3\x28"_sl, "\xdd\xff\xff\xff\xff"_sl, ""_sl}) {
+            error = NoError;
+            CHECK(msgPackToJSON(bad, &error) == "error");
+            CHECK(error == InvalidData);
+        }
+        CHECK_THROWS_AS(MsgPackConverter::convertMsgPack("\xc1"_sl), FleeceException);
     }
 
+
     TEST_CASE("Locale-free encoding") {
         // Note this will fail if Linux is missing the French locale,
         // so make sure it is installed on the machine doing testing
@@ -1123,6 +4130,66 @@ public:
         }
     }
 
+    TEST_CASE("WriteInteger") {
+        char str[kMaxIntegerLength + 1];
+        auto check = [&](auto n, const char *expected) {
+            INFO("Checking " << expected);
+            size_t len = WriteInteger(n, str);
+            CHECK(std::string(str, len) == expected);
+        };
+        check(int64_t(0), "0");
+        check(int64_t(7), "7");
+        check(int64_t(10), "10");
+        check(int64_t(-99), "-99");
+        check(int64_t(100), "100");
+        check(int64_t(-123456789), "-123456789");
+        check(INT64_MAX, "9223372036854775807");
+        check(INT64_MIN, "-9223372036854775808");
+        check(uint64_t(0), "0");
+        check(UINT64_MAX, "18446744073709551615");
+
+        // Compare with printf, at every number of digits:
+        for (uint64_t n = 1; n < UINT64_MAX / 10; n = n * 10 + (n % 7)) {
+            for (uint64_t i : {n - 1, n, n + 1}) {
+                char expected[32];
+                sprintf(expected, "%llu", (unsigned long long)i);
+                check(i, expected);
+                sprintf(expected, "%lld", -(long long)i);
+                check(-int64_t(i), expected);
+            }
+        }
+    }
+
+    TEST_CASE("JSON string escaping") {
+        // Put each special character at every position in strings of varying lengths, so it's
+        // found both by the vectorized scan and by the byte-at-a-time loop:
+        for (char special : {'"', '\\', '\n', '\x01', '\x1f', '\x7f'}) {
+            for (size_t len = 1; len <= 40; ++len) {
+                for (size_t pos = 0; pos < len; ++pos) {
+                    std::string str(len, 'x');
+                    str[len - 1 - pos] = '\xC3';        // Non-ASCII must not be escaped
+                    str[pos] = special;
+                    std::string expected;
+                    for (char c : str) {
+                        switch (c) {
+                            case '"':   expected += "\\\""; break;
+                            case '\\':  expected += "\\\\"; break;
+                            case '\n':  expected += "\\n"; break;
+                            case '\x01': expected += "\\u0001"; break;
+                            case '\x1f': expected += "\\u001f"; break;
+                            case '\x7f': expected += "\\u007f"; break;
+                            default:    expected += c; break;
+                        }
+                    }
+                    JSONEncoder enc;
+                    enc.writeString(str);
+                    INFO("len=" << len << ", pos=" << pos);
+                    CHECK(enc.finish() == slice("\"" + expected + "\""));
+                }
+            }
+        }
+    }
+
     TEST_CASE("Truncated JSON") {
         // https://issues.couchbase.com/browse/CBL-1763
         fleece::Encoder enc;
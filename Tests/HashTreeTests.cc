@@ -6,12 +6,16 @@
 //
 
 #include "FleeceTests.hh"
+#include "IntHashTree.hh"
 #include "MutableHashTree.hh"
+#include "PathIndex.hh"
 #include "HashTree+Internal.hh"     // for ComputeHash
 #include "Doc.hh"
 #include "PlatformCompat.hh"
 #include <iostream>
+#include <algorithm>
 #include <set>
+#include <thread>
 
 using namespace std;
 using namespace fleece;
@@ -220,6 +224,121 @@ TEST_CASE_METHOD(HashTreeTests, "Bigger MutableHashTree Write", "[HashTree]") {
 }
 
 
+TEST_CASE_METHOD(HashTreeTests, "MutableHashTree Bulk Set And Parallel Write", "[HashTree]") {
+    static constexpr int N = 20000;
+    createItems(N);
+    vector<MutableHashTree::KeyValue> items;
+    for (int i = 0; i < N; i++)
+        items.emplace_back(keys[i], values.get(uint32_t(i)));
+    items.emplace_back(keys[17], values.get(18));       // duplicate key; last value wins
+    tree.setMany(items, 4);
+    CHECK(tree.get(keys[17]).asInt() == 18);
+    tree.set(keys[17], values.get(17));
+    checkTree(N);
+    checkIterator(N);
+
+    Encoder enc;
+    enc.suppressTrailer();
+    tree.writeTo(enc, 4);
+    alloc_slice data = enc.finish();
+    REQUIRE(data);
+
+    // Now read it as an immutable HashTree:
+    const HashTree *itree = HashTree::fromData(data);
+    CHECK(itree->count() == N);
+    for (int i = 0; i < N; i++) {
+        auto value = itree->get(keys[i]);
+        REQUIRE(value);
+        CHECK(value.asInt() == i);
+    }
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "MutableHashTree Snapshots", "[HashTree]") {
+    static constexpr unsigned N = 1000;
+    createItems(N + 100);
+    insertItems(N);
+    tree.enableSnapshots();
+
+    {
+        // A Snapshot keeps seeing the tree as it was:
+        MutableHashTree::Snapshot before(tree);
+        tree.set(keys[3], values.get(N));
+        tree.set(keys[N], values.get(N));
+        CHECK(tree.remove(keys[4]));
+        CHECK(!tree.remove(keys[N + 1]));
+        CHECK(before.count() == N);
+        CHECK(before.get(keys[3]).asInt() == 3);
+        CHECK(before.get(keys[4]).asInt() == 4);
+        CHECK(!before.get(keys[N]));
+
+        MutableHashTree::Snapshot after(tree);
+        CHECK(after.count() == N);
+        CHECK(after.get(keys[3]).asInt() == N);
+        CHECK(!after.get(keys[4]));
+        CHECK(after.get(keys[N]).asInt() == N);
+        CHECK(tree.get(keys[3]).asInt() == N);
+    }
+
+    // Readers on other threads, while this thread keeps changing the tree. Each value is the
+    // index of its key, or N plus that, and the count only grows:
+    tree.set(keys[3], values.get(3));
+    tree.set(keys[4], values.get(4));
+    std::atomic<bool> done {false};
+    std::atomic<int> errors {0};
+    vector<thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&, t] {
+            unsigned lastCount = 0;
+            for (unsigned round = 0; !done || round < 10; ++round) {
+                MutableHashTree::Snapshot snap(tree);
+                unsigned count = snap.count();
+                if (count < lastCount || count < N + 1 || count > N + 100)
+                    ++errors;
+                lastCount = count;
+                for (unsigned i = t; i < N; i += 7) {
+                    Value value = snap.get(keys[i]);
+                    if (!value || (value.asInt() != i && value.asInt() != 100 + i))
+                        ++errors;
+                }
+            }
+        });
+    }
+    for (unsigned round = 0; round < 20; ++round) {
+        for (unsigned i = round % 2; i < N; i += 2)
+            tree.set(keys[i], values.get((round % 2) ? i : 100 + i));
+        tree.set(keys[N + round], values.get(N + round));
+    }
+    done = true;
+    for (auto &reader : readers)
+        reader.join();
+    CHECK(errors == 0);
+    CHECK(tree.count() == N + 20);
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree GetMany", "[HashTree]") {
+    static constexpr int N = 1000;
+    createItems(N);
+    insertItems(N / 2);
+    alloc_slice data = encodeTree();
+    const HashTree *itree = HashTree::fromData(data);
+
+    // Look up all the keys, half of which aren't in the tree:
+    vector<slice> lookup(keys.begin(), keys.end());
+    lookup.push_back(""_sl);
+    vector<Value> results(lookup.size());
+    itree->getMany(lookup.data(), results.data(), lookup.size());
+    for (size_t i = 0; i < lookup.size(); i++) {
+        CHECK(results[i] == itree->get(lookup[i]));
+        if (i < N / 2)
+            CHECK(results[i].asInt() == int64_t(i));
+        else
+            CHECK(!results[i]);
+    }
+}
+
+
 TEST_CASE_METHOD(HashTreeTests, "Tiny HashTree Mutate", "[HashTree]") {
     createItems(10);
     tree.set(keys[9], values.get(9));
@@ -330,7 +449,7 @@ TEST_CASE_METHOD(HashTreeTests, "HashTree Re-Encode Delta", "[HashTree]") {
     alloc_slice delta = enc.finish();
 
     cerr << "Original is " << data.size << " bytes encoded:\t" << data.hexString() << "\n";
-    cerr << "Delta is " << delta.size << " bytes encoded:\t" << data.hexString() << "\n";
+    cerr << "Delta is " << delta.size << " bytes encoded:\t" << delta.hexString() << "\n";
 
     alloc_slice full = encodeTree();
     cerr << "Full rewrite would be " << full.size << " bytes encoded.\n";
@@ -345,6 +464,442 @@ TEST_CASE_METHOD(HashTreeTests, "HashTree Re-Encode Delta", "[HashTree]") {
 }
 
 
+TEST_CASE_METHOD(HashTreeTests, "HashTree Delta Size", "[HashTree]") {
+    // A delta only holds the nodes on the paths to the changed leaves:
+    static const unsigned N = 20000;
+    createItems(N + 5);
+    vector<MutableHashTree::KeyValue> items;
+    for (unsigned i = 0; i < N; i++)
+        items.emplace_back(keys[i], values.get(i));
+    tree.setMany(items);
+    alloc_slice data = encodeTree();
+    tree = HashTree::fromData(data);
+
+    for (unsigned i = 0; i < 5; i++)
+        tree.set(keys[i * 1000], values.get(N + i));    // replace
+    for (unsigned i = N; i < N + 5; i++)
+        tree.set(keys[i], values.get(i));               // insert
+    CHECK(tree.remove(keys[7]));
+
+    Encoder enc;
+    enc.amend(data, false);
+    enc.suppressTrailer();
+    tree.writeTo(enc);
+    alloc_slice delta = enc.finish();
+    cerr << "Delta of 11 changes to " << N << " keys is " << delta.size << " of "
+         << data.size << " bytes\n";
+    CHECK(delta.size < 8000);
+
+    alloc_slice total(data.size + delta.size);
+    memcpy((void*)&total[0],         data.buf, data.size);
+    memcpy((void*)&total[data.size], delta.buf, delta.size);
+    const HashTree *itree = HashTree::fromData(total);
+    CHECK(itree->count() == N + 4);
+    for (unsigned i = 0; i < N + 5; i++) {
+        Value value = itree->get(keys[i]);
+        if (i == 7) {
+            CHECK(!value);
+        } else {
+            REQUIRE(value);
+            CHECK(value.asInt() == ((i % 1000 == 0 && i < 5000) ? N + i / 1000 : i));
+        }
+    }
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree Merge", "[HashTree]") {
+    // Tree A has keys [0, 1200); tree B has [800, 2000), with the value 0 for the keys in both.
+    static const unsigned N = 2000, kEndA = 1200, kStartB = 800;
+    createItems(N);
+    auto encodeRange = [&](unsigned start, unsigned end, bool zeroOverlap) {
+        MutableHashTree t;
+        for (unsigned i = start; i < end; i++)
+            t.set(keys[i], values.get((zeroOverlap && i < kEndA) ? 0 : i));
+        Encoder enc;
+        enc.suppressTrailer();
+        t.writeTo(enc);
+        return enc.finish();
+    };
+    alloc_slice dataA = encodeRange(0, kEndA, false), dataB = encodeRange(kStartB, N, true);
+    const HashTree *treeB = HashTree::fromData(dataB);
+
+    SECTION("Their values win") {
+        tree = HashTree::fromData(dataA);
+        tree.merge(treeB);
+        CHECK(tree.count() == N);
+        for (unsigned i = 0; i < N; i++)
+            CHECK(tree.get(keys[i]).asInt() == ((i >= kStartB && i < kEndA) ? 0 : i));
+    }
+    SECTION("Conflict callback") {
+        tree = HashTree::fromData(dataA);
+        tree.set(keys[kStartB], values.get(3));          // mutable leaf in both trees
+        tree.set(keys[kStartB], values.get(kStartB));
+        unsigned conflicts = 0;
+        tree.merge(treeB, [&](slice key, Value mine, Value theirs) {
+            ++conflicts;
+            CHECK(theirs.asInt() == 0);
+            return mine;
+        });
+        CHECK(conflicts == kEndA - kStartB);
+        checkTree(N);
+        checkIterator(N);
+
+        // The merged tree shares B's subtrees; it can be written and read back:
+        alloc_slice merged = encodeTree();
+        const HashTree *itree = HashTree::fromData(merged);
+        CHECK(itree->count() == N);
+        for (unsigned i = 0; i < N; i++)
+            CHECK(itree->get(keys[i]).asInt() == i);
+    }
+    SECTION("Into an empty tree") {
+        tree.merge(treeB);
+        CHECK(tree.count() == N - kStartB);
+        tree.merge(HashTree::fromData(dataA), [](slice, Value mine, Value theirs) {
+            return theirs;
+        });
+        checkTree(N);
+    }
+    SECTION("With snapshots") {
+        insertItems(kEndA);
+        tree.enableSnapshots();
+        MutableHashTree::Snapshot before(tree);
+        tree.merge(treeB, [](slice, Value mine, Value) {return mine;});
+        checkTree(N);
+        CHECK(before.count() == kEndA);
+        CHECK(!before.get(keys[N - 1]));
+    }
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree Sorted Index", "[HashTree]") {
+    static const unsigned N = 1000;
+    createItems(N + 10);
+    insertItems(N);
+    vector<slice> sortedKeys(keys.begin(), keys.begin() + N);
+    sort(sortedKeys.begin(), sortedKeys.end());
+
+    auto checkSorted = [&](const HashTree *itree, size_t n) {
+        size_t i = 0;
+        for (auto iter = itree->lowerBound(nullslice); iter; ++iter, ++i) {
+            REQUIRE(i < n);
+            CHECK(iter.key() == sortedKeys[i]);
+            CHECK(iter.value() == itree->get(iter.key()));
+        }
+        CHECK(i == n);
+
+        vector<slice> found;
+        for (auto iter = itree->withPrefix("12 "_sl); iter; ++iter)
+            found.push_back(iter.key());
+        CHECK(found == (vector<slice>{"12 eight"_sl, "12 five"_sl, "12 four"_sl, "12 nine"_sl,
+                                      "12 one"_sl, "12 seven"_sl, "12 six"_sl, "12 three"_sl,
+                                      "12 two"_sl, "12 zero"_sl}));
+        auto iter = itree->lowerBound("99 zz"_sl);
+        REQUIRE(iter);
+        CHECK(iter.key() == "eight eight"_sl);
+        CHECK(!itree->lowerBound("\xff"_sl));
+        CHECK(!itree->withPrefix("nope"_sl));
+    };
+
+    // Without an index, the iterator has to sort all the keys first:
+    alloc_slice data = encodeTree();
+    const HashTree *itree = HashTree::fromData(data);
+    CHECK(!itree->hasSortedIndex());
+    checkSorted(itree, N);
+
+    Encoder enc;
+    enc.suppressTrailer();
+    tree.writeTo(enc, 4, true);
+    alloc_slice indexedData = enc.finish();
+    CHECK(indexedData.size == data.size + 4 * N);
+    itree = HashTree::fromData(indexedData);
+    CHECK(itree->hasSortedIndex());
+    CHECK(itree->count() == N);
+    checkSorted(itree, N);
+
+    // An index written with a delta refers to leaves in the base, too:
+    tree = itree;
+    for (unsigned i = N; i < N + 10; i++)
+        tree.set(keys[i], values.get(uint32_t(i)));
+    enc.reset();
+    enc.amend(indexedData, false);
+    enc.suppressTrailer();
+    tree.writeTo(enc, 1, true);
+    alloc_slice delta = enc.finish();
+    CHECK(delta.size < indexedData.size / 2);
+    alloc_slice total(indexedData.size + delta.size);
+    memcpy((void*)&total[0],                indexedData.buf, indexedData.size);
+    memcpy((void*)&total[indexedData.size], delta.buf, delta.size);
+    itree = HashTree::fromData(total);
+    CHECK(itree->hasSortedIndex());
+    sortedKeys.assign(keys.begin(), keys.end());
+    sort(sortedKeys.begin(), sortedKeys.end());
+    checkSorted(itree, N + 10);
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "HashTree Bloom Filter", "[HashTree]") {
+    static const unsigned N = 1000;
+    createItems(N + 10);
+    insertItems(N);
+
+    auto checkTree = [&](const HashTree *itree, size_t n) {
+        CHECK(itree->hasBloomFilter());
+        CHECK(itree->count() == n);
+        for (size_t i = 0; i < n; i++)
+            CHECK(itree->get(keys[i]).asInt() == int64_t(i));
+        for (size_t i = n; i < N + 10; i++)
+            CHECK(!itree->get(keys[i]));
+        vector<slice> lookup(keys.begin(), keys.end());
+        vector<Value> results(lookup.size());
+        itree->getMany(lookup.data(), results.data(), lookup.size());
+        for (size_t i = 0; i < lookup.size(); i++) {
+            CHECK(!!results[i] == (i < n));
+            CHECK(results[i].asInt() == int64_t(i < n ? i : 0));
+        }
+    };
+
+    alloc_slice data = encodeTree();
+    CHECK(!HashTree::fromData(data)->hasBloomFilter());
+
+    Encoder enc;
+    enc.suppressTrailer();
+    tree.writeTo(enc, 1, false, true);
+    alloc_slice filteredData = enc.finish();
+    CHECK(filteredData.size > data.size + N);
+    const HashTree *itree = HashTree::fromData(filteredData);
+    CHECK(!itree->hasSortedIndex());
+    checkTree(itree, N);
+
+    for (unsigned i = 0; i < 10000; i++) {
+        char key[30];
+        sprintf(key, "missing %u", i);
+        CHECK(!itree->get(slice(key)));
+    }
+
+    // With a sorted index too, and then in a delta:
+    enc.reset();
+    enc.suppressTrailer();
+    tree.writeTo(enc, 1, true, true);
+    alloc_slice bothData = enc.finish();
+    CHECK(bothData.size == filteredData.size + 4 * N);
+    itree = HashTree::fromData(bothData);
+    CHECK(itree->hasSortedIndex());
+    checkTree(itree, N);
+    CHECK(itree->lowerBound("12 "_sl).key() == "12 eight"_sl);
+
+    tree = itree;
+    for (unsigned i = N; i < N + 5; i++)
+        tree.set(keys[i], values.get(uint32_t(i)));
+    enc.reset();
+    enc.amend(bothData, false);
+    enc.suppressTrailer();
+    tree.writeTo(enc, 1, true, true);
+    alloc_slice delta = enc.finish();
+    alloc_slice total(bothData.size + delta.size);
+    memcpy((void*)&total[0],             bothData.buf, bothData.size);
+    memcpy((void*)&total[bothData.size], delta.buf, delta.size);
+    itree = HashTree::fromData(total);
+    CHECK(itree->hasSortedIndex());
+    checkTree(itree, N + 5);
+}
+
+
+TEST_CASE("IntHashTree", "[HashTree]") {
+    static constexpr unsigned N = 5000;
+    Encoder valueEnc;
+    valueEnc.beginArray(N);
+    for (unsigned i = 0; i < N; i++)
+        valueEnc.writeInt(i);
+    valueEnc.endArray();
+    Doc doc = valueEnc.finishDoc();
+    Array values = doc.asArray();
+
+    // Large increasing IDs (like "snowflake" IDs), plus a few at the extremes of the range:
+    vector<uint64_t> keys;
+    for (unsigned i = 0; i < N - 3; i++)
+        keys.push_back(1'234'567'890'123'456'789 + 7919 * i);
+    keys.push_back(0);
+    keys.push_back(UINT64_MAX);
+    keys.push_back(uint64_t(1) << 63);
+
+    MutableIntHashTree tree;
+    for (unsigned i = 0; i < N; i++)
+        tree.set(keys[i], values.get(i));
+    CHECK(tree.count() == N);
+    CHECK(!tree.get(1));
+    for (unsigned i = 0; i < N; i++)
+        REQUIRE(tree.get(keys[i]).asInt() == i);
+
+    set<uint64_t> seen;
+    for (MutableIntHashTree::iterator i(tree); i; ++i)
+        CHECK(seen.insert(i.key()).second);
+    CHECK(seen.size() == N);
+
+    for (unsigned i = 0; i < N; i += 3)
+        CHECK(tree.remove(keys[i]));
+    CHECK(!tree.remove(keys[0]));
+    const unsigned remaining = N - (N + 2) / 3;
+    CHECK(tree.count() == remaining);
+
+    Encoder enc;
+    enc.suppressTrailer();
+    tree.writeTo(enc);
+    alloc_slice data = enc.finish();
+    REQUIRE(data);
+
+    // Read it as an immutable IntHashTree:
+    const IntHashTree *itree = IntHashTree::fromData(data);
+    CHECK(itree->count() == remaining);
+    for (unsigned i = 0; i < N; i++) {
+        Value value = itree->get(keys[i]);
+        if (i % 3 == 0) {
+            CHECK(!value);
+        } else {
+            REQUIRE(value);
+            CHECK(value.asInt() == i);
+        }
+    }
+    unsigned n = 0;
+    for (IntHashTree::iterator i(itree); i; ++i, ++n)
+        CHECK(i.value().asInt() == find(keys.begin(), keys.end(), i.key()) - keys.begin());
+    CHECK(n == remaining);
+
+    // It's smaller than a HashTree with the same keys as strings:
+    MutableHashTree stringTree;
+    for (unsigned i = 1; i < N; i++) {
+        if (i % 3 != 0)
+            stringTree.set(slice(to_string(keys[i])), values.get(i));
+    }
+    Encoder stringEnc;
+    stringEnc.suppressTrailer();
+    stringTree.writeTo(stringEnc);
+    alloc_slice stringData = stringEnc.finish();
+    cerr << "IntHashTree of " << remaining << " keys is " << data.size
+         << " bytes; with string keys it's " << stringData.size << "\n";
+    CHECK(data.size < stringData.size);
+
+    // Write a delta:
+    MutableIntHashTree tree2(itree);
+    tree2.set(keys[0], values.get(0));
+    CHECK(tree2.remove(keys[1]));
+    CHECK(tree2.count() == remaining);
+    Encoder deltaEnc;
+    deltaEnc.amend(data, false);
+    deltaEnc.suppressTrailer();
+    tree2.writeTo(deltaEnc);
+    alloc_slice delta = deltaEnc.finish();
+    CHECK(delta.size < data.size / 20);
+
+    alloc_slice total(data.size + delta.size);
+    memcpy((void*)&total[0],         data.buf, data.size);
+    memcpy((void*)&total[data.size], delta.buf, delta.size);
+    itree = IntHashTree::fromData(total);
+    CHECK(itree->count() == remaining);
+    CHECK(itree->get(keys[0]).asInt() == 0);
+    CHECK(!itree->get(keys[1]));
+    CHECK(itree->get(keys[2]).asInt() == 2);
+    CHECK(itree->get(uint64_t(1) << 63).asInt() == N - 1);
+}
+
+
+TEST_CASE("PathIndexBuilder", "[HashTree]") {
+    static const char* kColors[3] = {"red", "green", "blue"};
+    static constexpr unsigned N = 300;
+    auto encodeDoc = [](const char *color, unsigned i) {
+        Encoder enc;
+        enc.beginDict();
+        enc.writeKey("color"); enc.writeString(color);
+        enc.writeKey("tags");
+        enc.beginArray();
+        enc.writeInt(i % 2);
+        enc.writeString(i % 5 == 0 ? "five" : "other");
+        enc.endArray();
+        enc.endDict();
+        return enc.finish();
+    };
+    vector<alloc_slice> ids, datas;
+    vector<PathIndexBuilder::Document> docs;
+    for (unsigned i = 0; i < N; ++i) {
+        char id[20];
+        sprintf(id, "doc-%03u", i);
+        ids.emplace_back(id);
+        datas.push_back(encodeDoc(kColors[i % 3], i));
+        docs.push_back({ids.back(), datas.back()});
+    }
+    auto checkIDs = [](Value ids, vector<unsigned> expected) {
+        Array array = ids.asArray();
+        REQUIRE(array);
+        REQUIRE(array.count() == expected.size());
+        for (uint32_t i = 0; i < expected.size(); ++i) {
+            char id[20];
+            sprintf(id, "doc-%03u", expected[i]);
+            CHECK(array.get(i).asString() == slice(id));
+        }
+    };
+    auto docsWhere = [](function<bool(unsigned)> pred) {
+        vector<unsigned> result;
+        for (unsigned i = 0; i < N; ++i) {
+            if (pred(i))
+                result.push_back(i);
+        }
+        return result;
+    };
+
+    MutableHashTree colorIndex;
+    PathIndexBuilder colors(colorIndex, KeyPath("color"_sl, nullptr));
+    CHECK(colors.addMany(docs, 4) == 0);
+    CHECK(colors.pendingCount() == N);
+    colors.commit(4);
+    CHECK(colors.pendingCount() == 0);
+    CHECK(colorIndex.count() == 3);
+    checkIDs(colorIndex.get("\"green\""_sl), docsWhere([](unsigned i) {return i % 3 == 1;}));
+
+    // Array values index each item; scalars of different types get different keys:
+    MutableHashTree tagIndex;
+    PathIndexBuilder tags(tagIndex, KeyPath("tags"_sl, nullptr));
+    for (auto &doc : docs)
+        CHECK(tags.add(doc.docID, doc.data));
+    tags.commit(1);
+    CHECK(tagIndex.count() == 4);
+    checkIDs(tagIndex.get("1"_sl), docsWhere([](unsigned i) {return i % 2 == 1;}));
+    checkIDs(tagIndex.get("\"five\""_sl), docsWhere([](unsigned i) {return i % 5 == 0;}));
+    CHECK(PathIndexBuilder::keyFor(tagIndex.get("1"_sl).asArray().get(0)) == "\"doc-001\""_sl);
+
+    // Write the index, read it back, and update it incrementally:
+    Encoder enc;
+    enc.suppressTrailer();
+    colorIndex.writeTo(enc);
+    alloc_slice indexData = enc.finish();
+    const HashTree *itree = HashTree::fromData(indexData);
+    REQUIRE(itree->count() == 3);
+    checkIDs(itree->get("\"red\""_sl), docsWhere([](unsigned i) {return i % 3 == 0;}));
+
+    MutableHashTree updated(itree);
+    PathIndexBuilder updater(updated, KeyPath("color"_sl, nullptr));
+    alloc_slice purple = encodeDoc("purple", 0), red = encodeDoc("red", 0);
+    CHECK(updater.update(ids[0], datas[0], purple));          // red -> purple
+    CHECK(updater.update(ids[3], datas[3], datas[3]));         // unchanged
+    CHECK(updater.update(ids[4], datas[4], red));              // green -> red
+    CHECK(updater.remove(ids[1], datas[1]));                   // green
+    CHECK(!updater.add("bad"_sl, alloc_slice("not fleece")));
+    updater.commit();
+    CHECK(updated.count() == 4);
+    checkIDs(updated.get("\"purple\""_sl), {0});
+    checkIDs(updated.get("\"red\""_sl), docsWhere([](unsigned i) {return i == 4 || (i % 3 == 0 && i != 0);}));
+    checkIDs(updated.get("\"green\""_sl), docsWhere([](unsigned i) {return i % 3 == 1 && i != 1 && i != 4;}));
+
+    // A key left with no documents is removed:
+    MutableHashTree small;
+    PathIndexBuilder smallBuilder(small, KeyPath("color"_sl, nullptr));
+    smallBuilder.add(ids[0], purple);
+    smallBuilder.commit();
+    CHECK(small.count() == 1);
+    smallBuilder.remove(ids[0], purple);
+    smallBuilder.commit();
+    CHECK(small.count() == 0);
+}
+
+
 #if 0 // currently throws an exception; debug this later --jens Feb 2020
 TEST_CASE("Perf TreeSearch", "[.Perf]") {
     static const int kSamples = 500000;
@@ -396,3 +951,123 @@ TEST_CASE("Perf TreeSearch", "[.Perf]") {
     bench.printReport();
 }
 #endif
+
+
+TEST_CASE_METHOD(HashTreeTests, "Perf HashTree Bulk Build", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int N = 100000;
+    createItems(N);
+    vector<MutableHashTree::KeyValue> items;
+    for (int i = 0; i < N; i++)
+        items.emplace_back(keys[i], values.get(uint32_t(i)));
+
+    for (unsigned nThreads : {1, 0}) {
+        fprintf(stderr, "Building and writing a %d-key tree with nThreads=%u...\n", N, nThreads);
+        Benchmark bench;
+        for (int i = 0; i < 5; i++) {
+            bench.start();
+            MutableHashTree bulk;
+            bulk.setMany(items, nThreads);
+            Encoder enc;
+            enc.suppressTrailer();
+            bulk.writeTo(enc, nThreads);
+            alloc_slice data = enc.finish();
+            bench.stop();
+            CHECK(HashTree::fromData(data)->count() == N);
+        }
+        bench.printReport();
+    }
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "Perf HashTree Insert", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int N = 100000;
+    createItems(N);
+
+    // Times building a tree one key at a time, then destroying it, which is where node
+    // allocation costs the most:
+    fprintf(stderr, "Inserting %d keys into a MutableHashTree, then destroying it...\n", N);
+    Benchmark bench;
+    for (int i = 0; i < 20; i++) {
+        bench.start();
+        {
+            MutableHashTree t;
+            for (int k = 0; k < N; k++)
+                t.set(keys[k], values.get(uint32_t(k)));
+            CHECK(t.count() == N);
+        }
+        bench.stop();
+    }
+    bench.printReport(1.0 / N, "insert");
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "Perf HashTree GetMany", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int N = 100000;
+    createItems(N);
+    vector<MutableHashTree::KeyValue> items;
+    for (int i = 0; i < N; i++)
+        items.emplace_back(keys[i], values.get(uint32_t(i)));
+    tree.setMany(items);
+    alloc_slice data = encodeTree();
+    const HashTree *itree = HashTree::fromData(data);
+
+    vector<slice> lookup;
+    for (int i = 0; i < N; i++)
+        lookup.push_back(keys[random() % N]);
+    vector<Value> results(N);
+
+    for (bool batched : {false, true}) {
+        fprintf(stderr, "Looking up %d keys %s...\n", N, (batched ? "with getMany" : "with get"));
+        Benchmark bench;
+        for (int i = 0; i < 20; i++) {
+            bench.start();
+            if (batched) {
+                itree->getMany(lookup.data(), results.data(), N);
+            } else {
+                for (int k = 0; k < N; k++)
+                    results[k] = itree->get(lookup[k]);
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0 / N, "lookup");
+    }
+}
+
+
+TEST_CASE_METHOD(HashTreeTests, "Perf HashTree Misses", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int N = 100000;
+    createItems(N);
+    vector<MutableHashTree::KeyValue> items;
+    for (int i = 0; i < N; i++)
+        items.emplace_back(keys[i], values.get(uint32_t(i)));
+    tree.setMany(items);
+
+    vector<string> missing;
+    for (int i = 0; i < N; i++)
+        missing.push_back("missing " + to_string(random()));
+
+    for (bool bloomFilter : {false, true}) {
+        Encoder enc;
+        enc.suppressTrailer();
+        tree.writeTo(enc, 1, false, bloomFilter);
+        alloc_slice data = enc.finish();
+        const HashTree *itree = HashTree::fromData(data);
+
+        fprintf(stderr, "Looking up %d missing keys %s...\n", N,
+                (bloomFilter ? "with a Bloom filter" : "without a Bloom filter"));
+        Benchmark bench;
+        for (int i = 0; i < 20; i++) {
+            bench.start();
+            for (int k = 0; k < N; k++) {
+                if (itree->get(slice(missing[k])))
+                    abort();
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0 / N, "lookup");
+    }
+}
@@ -17,9 +17,12 @@
 //
 
 #include "JSON5.hh"
+#include "JSONConverter.hh"
+#include "FleeceImpl.hh"
 #include "catch.hpp"
 
 using namespace fleece;
+using namespace fleece::impl;
 
 
 TEST_CASE("JSON5 Constants") {
@@ -76,3 +79,30 @@ TEST_CASE("JSON5 Objects") {
     CHECK(ConvertJSON5("{key:false,$other:'hey',}") == "{\"key\":false,\"$other\":\"hey\"}");
     CHECK(ConvertJSON5("{_key : false, _Oth3r:null,}") == "{\"_key\":false,\"_Oth3r\":null}");
 }
+
+static std::string ParseJSON5(slice json5) {
+    alloc_slice data = JSONConverter::convertJSON5(json5);
+    return Value::fromData(data)->toJSONString();
+}
+
+TEST_CASE("JSON5 Direct To Fleece") {
+    CHECK(ParseJSON5("/* comment */true // comment") == "true");
+    CHECK(ParseJSON5("\v\f  null") == "null");
+    CHECK(ParseJSON5("+12340") == "12340");
+    CHECK(ParseJSON5("-0x1F") == "-31");
+    CHECK(ParseJSON5("0xFFFFFFFFFFFFFFFF") == "18446744073709551615");
+    CHECK(ParseJSON5(".5") == "0.5");
+    CHECK(ParseJSON5("5.") == "5.0");
+    CHECK(ParseJSON5("'hi \\\nthere'") == "\"hi there\"");
+    CHECK(ParseJSON5("'can\\'t \"x\"'") == "\"can't \\\"x\\\"\"");
+    CHECK(ParseJSON5("'\\x41\\u00e9\\uD83D\\uDE00\\0'") == "\"A\u00e9\U0001F600\\u0000\"");
+    CHECK(ParseJSON5("[1,[2,3],'hi',]") == "[1,[2,3],\"hi\"]");
+    CHECK(ParseJSON5("{key:false, /* c */ $other:'hey', _Oth3r : null,}")
+          == "{\"$other\":\"hey\",\"_Oth3r\":null,\"key\":false}");
+
+    for (const char *bad : {"[1,,2]", "[,]", "{,}", "{1:2}", "/* open", "'unterminated",
+                            "'\\x4'", "'\\uD800'", "0x", "Infinity", "NaN", "true false"}) {
+        INFO("Input: " << bad);
+        CHECK_THROWS_AS(ParseJSON5(slice(bad)), FleeceException);
+    }
+}
@@ -21,7 +21,11 @@
 #include "MutableArray.hh"
 #include "MutableDict.hh"
 #include "Doc.hh"
+#include "InternedStrings.hh"
+#include <atomic>
 #include <iostream>
+#include <random>
+#include <thread>
 
 namespace fleece {
     using namespace fleece::impl;
@@ -284,6 +288,120 @@ namespace fleece {
     }
 
 
+    TEST_CASE("MutableArray insert and remove near front", "[Mutable]") {
+        // Big enough that inserting and removing near the front moves the front items instead:
+        Encoder enc;
+        enc.beginArray();
+        for (int i = 0; i < 1000; ++i)
+            enc.writeInt(i);
+        enc.endArray();
+        Retained<Doc> doc = enc.finishDoc();
+        const Array *source = doc->root()->asArray();
+
+        Retained<MutableArray> ma = MutableArray::newArray(source);
+        std::vector<int64_t> expected(1000);
+        for (int i = 0; i < 1000; ++i)
+            expected[i] = i;
+        auto check = [&] {
+            REQUIRE(ma->count() == expected.size());
+            for (uint32_t i = 0; i < expected.size(); ++i)
+                REQUIRE(ma->get(i)->asInt() == expected[i]);
+            uint32_t i = 0;
+            for (MutableArray::iterator iter(ma); iter; ++iter, ++i)
+                REQUIRE(iter.value()->asInt() == expected[i]);
+            CHECK(i == expected.size());
+        };
+
+        std::mt19937 rng(1234);
+        for (int round = 0; round < 300; ++round) {
+            auto count = uint32_t(expected.size());
+            auto where = uint32_t(rng() % (count / 2));
+            if (round % 3 != 2) {
+                auto n = uint32_t(1 + rng() % 4);
+                ma->insert(where, n);
+                for (uint32_t i = 0; i < n; ++i)
+                    ma->set(where + i, int64_t(-round));
+                expected.insert(expected.begin() + where, n, -round);
+            } else {
+                auto n = std::min(uint32_t(1 + rng() % 4), count - where);
+                ma->remove(where, n);
+                expected.erase(expected.begin() + where, expected.begin() + where + n);
+            }
+            if (round % 50 == 0)
+                check();
+        }
+        check();
+
+        // Copies, and encoding, see the same items:
+        Retained<MutableArray> copy = ma->copy();
+        CHECK(copy->isEqual(ma));
+        enc.reset();
+        enc.writeValue(ma);
+        Retained<Doc> doc2 = enc.finishDoc();
+        CHECK(doc2->root()->isEqual(ma));
+        copy = MutableArray::newArray(ma, kCopyImmutables);
+        CHECK(copy->source() == nullptr);
+        CHECK(copy->isEqual(ma));
+    }
+
+
+    TEST_CASE("MutableArray sparse copy", "[Mutable]") {
+        // A copy of a big Array remembers only the items that change:
+        Encoder enc;
+        enc.beginArray();
+        for (int i = 0; i < 1000; ++i)
+            enc.writeInt(i);
+        enc.endArray();
+        Retained<Doc> doc = enc.finishDoc();
+        const Array *source = doc->root()->asArray();
+
+        Retained<MutableArray> ma = MutableArray::newArray(source);
+        CHECK(ma->memoryUsage() < 1000);
+        ma->set(500, int64_t(-500));
+        ma->append(1000);
+        CHECK(ma->memoryUsage() < 1000);
+        CHECK(ma->count() == 1001);
+        CHECK(ma->get(499)->asInt() == 499);
+        CHECK(ma->get(500)->asInt() == -500);
+        CHECK(ma->get(1000)->asInt() == 1000);
+
+        // Encoding it doesn't materialize it:
+        enc.reset();
+        enc.writeValue(ma);
+        Retained<Doc> doc2 = enc.finishDoc();
+        CHECK(ma->memoryUsage() < 1000);
+        CHECK(doc2->root()->isEqual(ma));
+
+        ma->remove(999, 2);
+        CHECK(ma->count() == 999);
+        ma->resize(1000);
+        CHECK(ma->count() == 1000);
+        CHECK(ma->get(999)->type() == kNull);
+
+        // Changing more items materializes it, without changing its contents:
+        for (uint32_t i = 0; i < 200; i += 2)
+            ma->set(i, int64_t(-1));
+        CHECK(ma->memoryUsage() > 1000);
+        for (uint32_t i = 0; i < 999; ++i) {
+            int64_t expected = i;
+            if (i == 500)
+                expected = -500;
+            else if (i < 200 && i % 2 == 0)
+                expected = -1;
+            CHECK(ma->get(i)->asInt() == expected);
+        }
+
+        // Copying a sparse MutableArray:
+        Retained<MutableArray> ma2 = MutableArray::newArray(source);
+        ma2->set(3, int64_t(-3));
+        Retained<MutableArray> copy = ma2->copy();
+        CHECK(copy->isEqual(ma2));
+        copy->set(3, 3);
+        CHECK(copy->isEqual(source));
+        CHECK(!ma2->isEqual(source));
+    }
+
+
 #pragma mark - MUTABLE DICT:
 
 
@@ -486,6 +604,117 @@ namespace fleece {
     }
 
 
+    TEST_CASE("MutableDict interned keys", "[Mutable]") {
+        // Interning is opt-in:
+        {
+            Retained<MutableDict> md = MutableDict::newDict();
+            md->set("not-interned-key"_sl, 1);
+            CHECK(InternedStrings::shared() == nullptr);
+        }
+        InternedStrings::setSharedEnabled(true);
+        Retained<MutableDict> ma = MutableDict::newDict(), mb = MutableDict::newDict();
+        std::string key = "interned-key", longKey(100, 'x');
+        ma->set(slice(key), 1);
+        ma->set(slice(longKey), 2);
+        mb->set(slice(key), 3);
+        mb->set(slice(longKey), 4);
+
+        auto keyIn = [](MutableDict *md, slice key) -> slice {
+            for (MutableDict::iterator i(md); i; ++i)
+                if (i.keyString() == key)
+                    return i.keyString();
+            return nullslice;
+        };
+        // Short keys share one copy; long ones are copied into each Dict:
+        CHECK(keyIn(ma, slice(key)).buf == keyIn(mb, slice(key)).buf);
+        CHECK(keyIn(ma, slice(key)).buf == InternedStrings::shared()->find(slice(key)).buf);
+        CHECK(!InternedStrings::shared()->find("not-interned-key"_sl));
+        CHECK(keyIn(ma, slice(longKey)).buf != keyIn(mb, slice(longKey)).buf);
+        CHECK(mb->get(slice(key))->asInt() == 3);
+        CHECK(mb->get(slice(longKey))->asInt() == 4);
+        InternedStrings::setSharedEnabled(false);
+    }
+
+
+    TEST_CASE("MutableDict values stay put", "[Mutable]") {
+        // Values returned by get(), including inline ones stored in the dict itself, stay valid
+        // while other keys are added and removed:
+        Retained<MutableDict> md = MutableDict::newDict();
+        md->set("m"_sl, 17);
+        md->set("n"_sl, true);
+        const Value *m = md->get("m"_sl), *n = md->get("n"_sl);
+        for (int i = 0; i < 500; ++i)
+            md->set(slice("k" + std::to_string(i)), i);
+        for (int i = 0; i < 500; i += 2)
+            md->remove(slice("k" + std::to_string(i)));
+        CHECK(m == md->get("m"_sl));
+        CHECK(m->asInt() == 17);
+        CHECK(n == md->get("n"_sl));
+        CHECK(n->asBool() == true);
+
+        // ...and so do the slots returned by setting():
+        ValueSlot &slot = md->setting("a"_sl);
+        for (int i = 500; i < 1000; ++i)
+            md->set(slice("k" + std::to_string(i)), i);
+        slot.set(42);
+        CHECK(md->get("a"_sl)->asInt() == 42);
+        CHECK(md->count() == 753);
+
+        // Removed keys' slots are reused:
+        md->remove("m"_sl);
+        md->set("zz"_sl, 99);
+        CHECK(md->get("zz"_sl)->asInt() == 99);
+        CHECK(!md->get("m"_sl));
+        CHECK(n->asBool() == true);
+    }
+
+
+    TEST_CASE("MutableDict many keys", "[Mutable]") {
+        // Enough keys, some long, to need several chunks of key storage; inserted out of order.
+        std::vector<std::string> keys;
+        for (int i = 0; i < 200; ++i) {
+            std::string key = "key" + std::to_string((i * 37) % 200);
+            if (i % 10 == 0)
+                key += std::string(100, 'x');
+            keys.push_back(key);
+        }
+        Retained<MutableDict> md = MutableDict::newDict();
+        for (size_t i = 0; i < keys.size(); ++i)
+            md->set(slice(keys[i]), int(i));
+        CHECK(md->count() == keys.size());
+
+        // A copy shares the existing key storage, but both can then add keys independently:
+        Retained<MutableDict> copy = md->copy();
+        md->set("zzz-original"_sl, true);
+        copy->set("zzz-copy"_sl, false);
+        md->remove(slice(keys[5]));
+        for (size_t i = 0; i < keys.size(); ++i) {
+            auto value = md->get(slice(keys[i]));
+            if (i == 5) {
+                CHECK(!value);
+            } else {
+                REQUIRE(value);
+                CHECK(value->asInt() == int64_t(i));
+            }
+            CHECK(copy->get(slice(keys[i]))->asInt() == int64_t(i));
+        }
+        CHECK(md->get("zzz-original"_sl)->asBool() == true);
+        CHECK(md->get("zzz-copy"_sl) == nullptr);
+        CHECK(copy->get("zzz-copy"_sl)->asBool() == false);
+        CHECK(copy->get("zzz-original"_sl) == nullptr);
+
+        // Iteration is in sorted key order:
+        std::string prevKey;
+        unsigned n = 0;
+        for (MutableDict::iterator i(md); i; ++i, ++n) {
+            std::string key(i.keyString());
+            CHECK(prevKey < key);
+            prevKey = key;
+        }
+        CHECK(n == md->count());
+    }
+
+
     TEST_CASE("MutableDict copy immutable", "[Mutable]") {
         Retained<Doc> doc = Doc::fromJSON("{\"a\":123,\"b\":\"howdy\"}"_sl);
         const Dict *a = doc->root()->asDict();
@@ -775,6 +1004,260 @@ namespace fleece {
     }
 
 
+    TEST_CASE("MutableDict lazy deep copy", "[Mutable]") {
+        Retained<MutableDict> inner = MutableDict::newDict();
+        inner->set("x"_sl, 1);
+        Retained<MutableArray> middle = MutableArray::newArray();
+        middle->append(inner);
+        Retained<MutableDict> original = MutableDict::newDict();
+        original->set("middle"_sl, middle);
+        original->set("n"_sl, 17);
+        middle = nullptr;
+        inner = nullptr;
+
+        Retained<MutableDict> copy = original->copy(CopyFlags(kDeepCopy | kCopyLazily));
+        CHECK(copy->isEqual(original));
+        // Nothing nested has been copied yet:
+        CHECK(copy->get("middle"_sl) == original->get("middle"_sl));
+        // ...so the shared collections can't be modified directly, only via getMutable*:
+        CHECK(copy->get("middle"_sl)->asArray()->asMutable() == nullptr);
+        CHECK(original->get("middle"_sl)->asArray()->asMutable() == nullptr);
+
+        // Modifying through the copy copies just the path to the change:
+        MutableArray *copyMiddle = copy->getMutableArray("middle"_sl);
+        REQUIRE(copyMiddle);
+        CHECK(copyMiddle != original->get("middle"_sl));
+        CHECK(copyMiddle->get(0) == original->get("middle"_sl)->asArray()->get(0));
+        copyMiddle->getMutableDict(0)->set("x"_sl, 2);
+        CHECK(copyMiddle->get(0) != original->get("middle"_sl)->asArray()->get(0));
+        CHECK(copy->get("middle"_sl)->asArray()->get(0)->asDict()->get("x"_sl)->asInt() == 2);
+        CHECK(original->get("middle"_sl)->asArray()->get(0)->asDict()->get("x"_sl)->asInt() == 1);
+
+        // Modifying the original doesn't affect another lazy copy:
+        Retained<MutableDict> copy2 = original->copy(CopyFlags(kDeepCopy | kCopyLazily));
+        original->getMutableArray("middle"_sl)->getMutableDict(0)->set("x"_sl, 3);
+        CHECK(copy2->get("middle"_sl)->asArray()->get(0)->asDict()->get("x"_sl)->asInt() == 1);
+        CHECK(original->get("middle"_sl)->asArray()->get(0)->asDict()->get("x"_sl)->asInt() == 3);
+        CHECK(copy->get("middle"_sl)->asArray()->get(0)->asDict()->get("x"_sl)->asInt() == 2);
+
+        // Once it's no longer shared, a collection is modified in place:
+        copy2 = nullptr;
+        const Value *originalMiddle = original->get("middle"_sl);
+        CHECK(original->getMutableArray("middle"_sl) == originalMiddle);
+        CHECK(originalMiddle->asArray()->asMutable() == originalMiddle);
+    }
+
+
+    TEST_CASE("Frozen mutable collections", "[Mutable]") {
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        Retained<MutableDict> config = MutableDict::newDict(doc->asDict());
+        Retained<MutableArray> friends = config->getMutableArray("friends"_sl);
+        REQUIRE(friends);
+        friends->getMutableDict(0)->set("name"_sl, "Frozen Fred"_sl);
+        std::string numbers = "[0";
+        for (int i = 1; i < 200; ++i)
+            numbers += "," + std::to_string(i);
+        Retained<Doc> numbersDoc = Doc::fromJSON(numbers + "]");
+        Retained<MutableArray> big = MutableArray::newArray(numbersDoc->asArray()); // (sparse)
+        config->set("big"_sl, big);
+
+        config->freeze();
+        CHECK(config->isFrozen());
+        CHECK(friends->isFrozen());
+        CHECK(((const MutableDict*)friends->get(0))->isFrozen());
+        CHECK(big->isFrozen());
+
+        // Any attempt to modify it, or anything in it, throws:
+        CHECK_THROWS_AS(config->set("age"_sl, 31), FleeceException);
+        CHECK_THROWS_AS(config->remove("age"_sl), FleeceException);
+        CHECK_THROWS_AS(config->getMutableArray("tags"_sl), FleeceException);
+        CHECK_THROWS_AS(friends->append(1), FleeceException);
+        CHECK_THROWS_AS(friends->getMutableDict(0)->set("x"_sl, 1), FleeceException);
+        CHECK_THROWS_AS(big->resize(1), FleeceException);
+        CHECK(config->get("age"_sl)->asInt() == doc->asDict()->get("age"_sl)->asInt());
+
+        // Reading it from many threads at once, including with iterators, which would otherwise
+        // lazily build state on first use:
+        auto read = [&] {
+            std::string json = config->toJSONString();
+            for (Array::iterator iter(config->get("big"_sl)->asArray()); iter; ++iter)
+                json += iter.value()->toString().asString();
+            for (Array::iterator iter((const Array*)config.get()); iter; ++iter)
+                json += iter.value()->toString().asString();
+            return json;
+        };
+        std::string json = config->toJSONString(), expected = read();
+        std::vector<std::thread> threads;
+        std::atomic<int> mismatches {0};
+        for (int t = 0; t < 8; ++t) {
+            threads.emplace_back([&] {
+                for (int i = 0; i < 100; ++i) {
+                    if (read() != expected)
+                        ++mismatches;
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        CHECK(mismatches == 0);
+
+        // A copy is mutable, and copies frozen collections it contains before changing them:
+        Retained<MutableDict> copy = config->copy();
+        CHECK(!copy->isFrozen());
+        copy->set("age"_sl, 31);
+        MutableArray *copyFriends = copy->getMutableArray("friends"_sl);
+        REQUIRE(copyFriends);
+        CHECK(copyFriends != friends);
+        CHECK(!copyFriends->isFrozen());
+        copyFriends->getMutableDict(0)->set("name"_sl, "Thawed Fred"_sl);
+        CHECK(friends->get(0)->asDict()->get("name"_sl)->asString() == "Frozen Fred"_sl);
+        CHECK(config->toJSONString() == json);
+    }
+
+
+    TEST_CASE("Mutable snapshots", "[Mutable]") {
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        Retained<MutableDict> person = MutableDict::newDict(doc->asDict());
+        person->getMutableArray("friends"_sl)->getMutableDict(0)->set("name"_sl, "Fred"_sl);
+        person->getMutableArray("tags"_sl)->append("fresh"_sl);
+        std::string before = person->toJSONString();
+
+        Retained<MutableDict> snap = person->snapshot();
+        CHECK(snap != person);
+        CHECK(snap->isFrozen());
+        CHECK(!person->isFrozen());
+        CHECK(snap->toJSONString() == before);
+        CHECK(snap->snapshot().get() == snap);
+        // The nested collections are shared:
+        CHECK(snap->get("friends"_sl) == person->get("friends"_sl));
+        CHECK(snap->get("tags"_sl) == person->get("tags"_sl));
+
+        // A change copies just the collections on its path:
+        person->getMutableArray("friends"_sl)->getMutableDict(0)->set("name"_sl, "Ted"_sl);
+        person->set("age"_sl, 99);
+        CHECK(snap->toJSONString() == before);
+        CHECK(snap->get("age"_sl)->asInt() == doc->asDict()->get("age"_sl)->asInt());
+        CHECK(person->get("age"_sl)->asInt() == 99);
+        auto snapFriends = snap->get("friends"_sl)->asArray();
+        auto friends = person->get("friends"_sl)->asArray();
+        CHECK(friends != snapFriends);
+        CHECK(friends->get(0) != snapFriends->get(0));
+        CHECK(friends->get(0)->asDict()->get("name"_sl)->asString() == "Ted"_sl);
+        CHECK(snapFriends->get(0)->asDict()->get("name"_sl)->asString() == "Fred"_sl);
+        CHECK(friends->get(1) == snapFriends->get(1));
+        CHECK(person->get("tags"_sl) == snap->get("tags"_sl));
+
+        // A later snapshot shares what's unchanged with the earlier one:
+        Retained<MutableDict> snap2 = person->snapshot();
+        CHECK(snap2->get("tags"_sl) == snap->get("tags"_sl));
+        CHECK(snap2->get("friends"_sl) == person->get("friends"_sl));
+        CHECK(snap2->get("friends"_sl) != snap->get("friends"_sl));
+        CHECK(snap2->isEqual(person));
+        CHECK(!snap2->isEqual(snap));
+
+        Retained<MutableArray> array = MutableArray::newArray();
+        array->append(person);
+        Retained<MutableArray> arraySnap = array->snapshot();
+        array->getMutableDict(0)->set("age"_sl, 100);
+        CHECK(arraySnap->get(0) == person);
+        CHECK(array->get(0) != person);
+        CHECK(arraySnap->get(0)->asDict()->get("age"_sl)->asInt() == 99);
+    }
+
+
+    TEST_CASE("Deep copy to arena", "[Mutable]") {
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        auto person = doc->asDict();
+
+        Retained<MutableDict> copy = MutableDict::newDict(person,
+                                    CopyFlags(kDeepCopy | kCopyImmutables | kCopyToArena));
+        CHECK(copy->isEqual(person));
+        CHECK(copy->source() == nullptr);
+
+        // The copy is an ordinary mutable tree, whose values can be changed and replaced:
+        Retained<MutableArray> friends = copy->getMutableArray("friends"_sl);
+        REQUIRE(friends);
+        MutableDict *frend = friends->getMutableDict(1);
+        REQUIRE(frend);
+        frend->set("name"_sl, "Reddy Kill-a-Watt"_sl);
+        copy->set("age"_sl, 31);
+        copy->set("about"_sl, std::string(5000, '!'));     // too big for the arena
+        CHECK(copy->get("age"_sl)->asInt() == 31);
+        CHECK(friends->get(1)->asDict()->get("name"_sl)->asString() == "Reddy Kill-a-Watt"_sl);
+
+        // A value from the arena outlives the root that it was copied with:
+        Retained<MutableDict> copy2 = copy->copy(CopyFlags(kDeepCopy | kCopyToArena));
+        CHECK(copy2->isEqual(copy));
+        copy = nullptr;
+        CHECK(friends->count() == 3);
+        CHECK(friends->get(1)->asDict()->get("name"_sl)->asString() == "Reddy Kill-a-Watt"_sl);
+        friends = nullptr;
+        CHECK(copy2->get("about"_sl)->asString().size == 5000);
+    }
+
+
+    TEST_CASE("Deep copy single-threaded", "[Mutable]") {
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        auto person = doc->asDict();
+        auto refCount = [](const Value *v) {return internal::HeapValue::asHeapValue(v)->refCount();};
+
+        Retained<MutableDict> copy = MutableDict::newDict(person,
+                                    CopyFlags(kDeepCopy | kCopyImmutables | kCopySingleThreaded));
+        CHECK(copy->isEqual(person));
+        Retained<MutableArray> friends = copy->getMutableArray("friends"_sl);
+        REQUIRE(friends);
+        CHECK(refCount(friends) == 2);
+        {
+            RetainedConst<Value> f = friends->get(0);
+            CHECK(refCount(f) == 2);
+        }
+        CHECK(refCount(friends->get(0)) == 1);
+        friends->getMutableDict(1)->set("name"_sl, "Reddy Kill-a-Watt"_sl);
+        copy = nullptr;
+        CHECK(refCount(friends) == 1);
+        CHECK(friends->get(1)->asDict()->get("name"_sl)->asString() == "Reddy Kill-a-Watt"_sl);
+    }
+
+
+    TEST_CASE("String arena", "[Mutable]") {
+        using namespace internal;
+        auto arenaOf = [](const Value *v) {return HeapArena::arenaOf(HeapValue::asHeapValue(v));};
+
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        Retained<MutableDict> root = MutableDict::newDict(doc->asDict(), kCopyStringArena);
+        HeapArena *arena = ((HeapDict*)HeapValue::asHeapValue(root))->stringArena();
+        REQUIRE(arena);
+
+        // Strings that don't fit inline go in the arena, whether set directly or via a slot:
+        root->set("name"_sl, "Reddy Kill-a-Watt"_sl);
+        root->setting("tag"_sl).set("a mid-length string"_sl);
+        CHECK(arenaOf(root->get("name"_sl)) == arena);
+        CHECK(arenaOf(root->get("tag"_sl)) == arena);
+        CHECK(root->get("tag"_sl)->asString() == "a mid-length string"_sl);
+
+        // ...including in nested mutable collections:
+        Retained<MutableArray> friends = root->getMutableArray("friends"_sl);
+        REQUIRE(friends);
+        friends->append("Someone Entirely New"_sl);
+        friends->getMutableDict(0)->set("name"_sl, "Rusty Hinges the Third"_sl);
+        CHECK(arenaOf(friends->get(3)) == arena);
+        CHECK(arenaOf(friends->get(0)->asDict()->get("name"_sl)) == arena);
+
+        // A collection from elsewhere doesn't use it, and big strings come from the heap:
+        Retained<MutableArray> other = MutableArray::newArray();
+        other->append("not in the arena"_sl);
+        CHECK(((const uint8_t*)other->get(0))[-1] == offsetValue::kPad);     // not in an arena
+        root->set("about"_sl, std::string(5000, '!'));
+        CHECK(root->get("about"_sl)->asString().size == 5000);
+
+        // Values outlive the root:
+        RetainedConst<Value> name = root->get("name"_sl);
+        root = nullptr;
+        friends = nullptr;
+        CHECK(name->asString() == "Reddy Kill-a-Watt"_sl);
+    }
+
+
     TEST_CASE("Extern Destination", "[Mutable]") {
         Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
         auto person = doc->asDict();
@@ -796,6 +1279,161 @@ namespace fleece {
     }
 
 
+    TEST_CASE("Multiple Extern Segments", "[Mutable]") {
+        Retained<Doc> doc1 = new Doc(readTestFile("1person.fleece"));
+        const Array *friends = doc1->asDict()->get("friends"_sl)->asArray();
+        REQUIRE(friends);
+
+        Retained<MutableDict> mp = MutableDict::newDict(doc1->asDict());
+        mp->set("age"_sl, 666);
+        Encoder enc;
+        enc.setBase(doc1->data(), true);
+        enc.writeValue(mp);
+        Retained<Doc> doc2 = new Doc(enc.finish(), Doc::kTrusted, nullptr, doc1->data());
+        CHECK(doc2->olderExternSegments().empty());
+        CHECK(doc2->asDict()->get("friends"_sl) == friends);
+
+        // By default a Value from doc1, reached through doc2, isn't in the base, so it's copied:
+        enc.reset();
+        enc.setBase(doc2->data(), true);
+        CHECK(!enc.valueIsInBase(friends));
+        enc.writeValue(doc2->asDict()->get("friends"_sl));
+        Retained<Doc> copied = enc.finishDoc();
+        CHECK(copied->data().size > 16);
+
+        // Write it again with doc1's segment in use. It's written as a pointer into doc1, the
+        // older segment, instead of being copied:
+        enc.reset();
+        enc.setBase(doc2->data(), true);
+        enc.useOlderExternSegments();
+        CHECK(enc.valueIsInBase(friends));
+        enc.beginArray();
+        enc.writeValue(doc2->asDict()->get("friends"_sl));
+        enc.writeValue(doc2->asDict());
+        enc.endArray();
+        Retained<Doc> doc3 = enc.finishDoc();
+        CHECK(doc3->data().size <= 16);
+        CHECK(doc3->externDestination() == doc2->data());
+        CHECK(doc3->olderExternSegments() == std::vector<slice>{doc1->data()});
+        CHECK(doc3->externDepth() == 2);
+
+        const Array *root = doc3->asArray();
+        REQUIRE(root);
+        CHECK(root->get(0) == friends);
+        CHECK(root->get(1) == doc2->asDict());
+        CHECK(root->get(1)->asDict()->get("age"_sl)->asInt() == 666);
+
+        // Untrusted data is validated, including the pointer into the older segment:
+        Retained<Doc> doc3u = new Doc(doc3->allocedData(), Doc::kUntrusted,
+                                      nullptr, doc2->data());
+        REQUIRE(doc3u->asArray());
+        CHECK(doc3u->asArray()->get(0) == friends);
+    }
+
+
+    TEST_CASE("Flatten Extern Destinations", "[Mutable]") {
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        CHECK(doc->externDepth() == 0);
+        CHECK(doc->flattened().get() == doc);
+
+        // Amend it twice, each time as a separate segment with extern pointers to the last:
+        std::vector<Retained<Doc>> segments {doc};
+        for (int age = 666; age <= 667; ++age) {
+            Doc *last = segments.back();
+            Retained<MutableDict> mp = MutableDict::newDict(last->asDict());
+            mp->set("age"_sl, age);
+            Encoder enc;
+            enc.setBase(last->data(), true);
+            enc.reuseBaseStrings();
+            enc.writeValue(mp);
+            segments.push_back(new Doc(enc.finish(), Doc::kTrusted, nullptr, last->data()));
+        }
+        Retained<Doc> last = segments.back();
+        CHECK(last->externDepth() == 2);
+        CHECK(last->flattened(2).get() == last);
+
+        RetainedConst<Doc> flat = last->flattened(1);
+        REQUIRE(flat != last);
+        CHECK(flat->externDepth() == 0);
+        CHECK(flat->externDestination() == nullslice);
+        CHECK(flat->asDict()->get("age"_sl)->asInt() == 667);
+        CHECK(flat->asDict()->isEqual(last->asDict()));
+        CHECK(flat->asDict()->toJSON() == last->asDict()->toJSON());
+
+        // The flattened Doc doesn't depend on the old segments:
+        alloc_slice json = last->asDict()->toJSON();
+        last = nullptr;
+        doc = nullptr;
+        segments.clear();
+        CHECK(flat->asDict()->toJSON() == json);
+    }
+
+
+    TEST_CASE("MutableDict amend", "[Mutable]") {
+        Retained<Doc> doc = new Doc(readTestFile("1person.fleece"));
+        auto person = doc->asDict();
+
+        Retained<MutableDict> mp = MutableDict::newDict(person);
+        CHECK_THROWS_AS(MutableDict::newDict()->amend(), FleeceException);
+
+        // An unchanged Dict is written as a pointer to the original:
+        alloc_slice delta = mp->amend();
+        CHECK(delta.size <= 8);
+
+        // So is an unchanged nested Array:
+        REQUIRE(mp->getMutableArray("friends"_sl));
+        delta = mp->amend();
+        CHECK(delta.size <= 24);
+
+        mp->getMutableArray("friends"_sl)->getMutableDict(1)->set("name"_sl, "Reddy Kill-a-Watt"_sl);
+        mp->set("age"_sl, 666);
+        delta = mp->amend(true);
+        CHECK(delta.size < doc->data().size / 4);
+
+        alloc_slice combined(doc->data().size + delta.size);
+        memcpy((void*)combined.buf, doc->data().buf, doc->data().size);
+        memcpy((void*)&combined[doc->data().size], delta.buf, delta.size);
+        const Dict *newDict = Value::fromData(combined)->asDict();
+        REQUIRE(newDict);
+        CHECK(newDict->isEqual(mp));
+        CHECK(newDict->get("age"_sl)->asInt() == 666);
+        CHECK(newDict->get("friends"_sl)->asArray()->get(1)->asDict()->get("name"_sl)->asString()
+              == "Reddy Kill-a-Watt"_sl);
+    }
+
+
+    TEST_CASE("Doc compact", "[Mutable]") {
+        Retained<MutableDict> md = MutableDict::newDict();
+        md->set("original"_sl, "This data is unchanged"_sl);
+        alloc_slice data;
+        for (int i = 0; i < 20; ++i) {
+            // Append a delta replacing a string, leaving the old value unreachable:
+            std::string str = "Revision number " + std::to_string(i);
+            md->set("changing"_sl, slice(str));
+            Encoder enc;
+            if (data)
+                enc.setBase(data);
+            enc.writeValue(md);
+            alloc_slice delta = enc.finish();
+            if (data)
+                data.append(delta);
+            else
+                data = delta;
+            md = MutableDict::newDict(Doc::fromFleece(data)->asDict());
+        }
+
+        Retained<Doc> doc = Doc::fromFleece(data);
+        size_t live = doc->liveDataSize();
+        CHECK(live > 0);
+        CHECK(live < data.size / 4);
+
+        Retained<Doc> compacted = doc->compact();
+        CHECK(compacted->data().size <= live);
+        CHECK(compacted->liveDataSize() == compacted->data().size);
+        CHECK(compacted->root()->isEqual(doc->root()));
+    }
+
+
     TEST_CASE("Compaction", "[Mutable]") {
         static constexpr size_t kMaxDataSize = 1000;
         alloc_slice data;
@@ -110,6 +110,19 @@ TEST_CASE("Obj-C Dictionaries", "[Encoder]") {
             "{\"a\":\"flumpety\",\"b\":\"flumpety\",\"c\":\"flumpety\"}");
 }
 
+TEST_CASE("Obj-C Uncopied Strings", "[Encoder]") {
+    @autoreleasepool {
+        NSString *str;
+        {
+            Retained<Doc> doc = Doc::fromJSON("[\"This string is too long to be shared\"]"_sl);
+            str = doc->root()->asArray()->get(0)->toNSObject();
+            // `doc` is released, but `str` keeps it alive, since it points into its data...
+        }
+        CHECK([str isEqualToString: @"This string is too long to be shared"]);
+        str = nil;
+    }
+}
+
 TEST_CASE("Obj-C PerfParse1000PeopleNS", "[.Perf]") {
     @autoreleasepool {
         const int kSamples = 50;
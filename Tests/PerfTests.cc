@@ -19,9 +19,19 @@
 #include "FleeceTests.hh"
 #include "FleeceImpl.hh"
 #include "JSONConverter.hh"
+#include "JSONEncoder.hh"
 #include "Doc.hh"
 #include "varint.hh"
+#include "Aggregates.hh"
+#include "Columns.hh"
+#include "DeepIterator.hh"
+#include "StringTable.hh"
+#include "TableHash.hh"
+#include "MutableArray.hh"
+#include "MutableDict.hh"
+#include "Path.hh"
 #include <chrono>
+#include <random>
 #include <stdlib.h>
 #include <thread>
 #ifndef _MSC_VER
@@ -77,8 +87,44 @@ TEST_CASE("GetUVarint performance", "[.Perf]") {
     bench.printReport(1.0/kNRounds);
 }
 
-TEST_CASE("Perf Convert1000People", "[.Perf]") {
+TEST_CASE("GetUVarint multi-byte performance", "[.Perf]") {
     assert(false); // This test should not be run with a debug build!
+    static constexpr size_t kCount = 100000;
+    static constexpr int kNRounds = 100;
+    std::mt19937_64 rng(1234);
+    // Each distribution has lengths evenly spread from 1 to `maxLen` bytes:
+    for (unsigned maxLen : {1, 2, 3, 5, 10}) {
+        std::vector<uint8_t> buf(kCount * kMaxVarintLen64);
+        size_t size = 0;
+        for (size_t i = 0; i < kCount; ++i) {
+            unsigned len = 1 + rng() % maxLen;
+            uint64_t n = rng();
+            if (len < 10)
+                n &= (1ull << (7 * len)) - 1;
+            size += PutUVarInt(&buf[size], n);
+        }
+        slice data(buf.data(), size);
+        std::vector<uint64_t> numbers(kCount);
+
+        Benchmark one, bulk;
+        for (int round = 0; round < kNRounds; ++round) {
+            one.start();
+            slice in = data;
+            for (size_t i = 0; i < kCount; ++i)
+                in.moveStart(GetUVarInt(in, &numbers[i]));
+            one.stop();
+            CHECK(in.size == 0);
+
+            bulk.start();
+            CHECK(GetUVarInts(data, numbers.data(), kCount) == size);
+            bulk.stop();
+        }
+        fprintf(stderr, "Lengths 1-%2u bytes: GetUVarInt %.3f ns, GetUVarInts %.3f ns\n",
+                maxLen, one.median() / kCount * 1.0e9, bulk.median() / kCount * 1.0e9);
+    }
+}
+
+static alloc_slice convert1000People(JSONConverter::Parser parser) {
     static const int kSamples = 500;
 
     std::vector<double> elapsedTimes;
@@ -87,13 +133,12 @@ TEST_CASE("Perf Convert1000People", "[.Perf]") {
     Benchmark bench;
 
     alloc_slice lastResult;
-    fprintf(stderr, "Converting JSON to Fleece...\n");
     for (int i = 0; i < kSamples; i++) {
         bench.start();
         {
             Encoder e(input.size);
             e.uniqueStrings(true);
-            JSONConverter jr(e);
+            JSONConverter jr(e, parser);
 
             jr.encodeJSON(input);
             e.end();
@@ -109,9 +154,25 @@ TEST_CASE("Perf Convert1000People", "[.Perf]") {
 
     fprintf(stderr, "\nJSON size: %zu bytes; Fleece size: %zu bytes (%.2f%%)\n",
             input.size, lastResult.size, (lastResult.size*100.0/input.size));
+    return lastResult;
+}
+
+TEST_CASE("Perf Convert1000People", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    fprintf(stderr, "Converting JSON to Fleece...\n");
+    alloc_slice lastResult = convert1000People(JSONConverter::kJsonslParser);
     writeToFile(lastResult, kTestFilesDir "1000people.fleece");
 }
 
+TEST_CASE("Perf Convert1000People fast parser", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    fprintf(stderr, "Converting JSON to Fleece with jsonsl...\n");
+    alloc_slice jsonslResult = convert1000People(JSONConverter::kJsonslParser);
+    fprintf(stderr, "Converting JSON to Fleece with fast parser...\n");
+    alloc_slice fastResult = convert1000People(JSONConverter::kFastParser);
+    CHECK(fastResult == jsonslResult);
+}
+
 TEST_CASE("Perf LoadFleece", "[.Perf]") {
     assert(false); // This test should not be run with a debug build!
     static const int kIterations = 1000;
@@ -182,6 +243,240 @@ static void testFindPersonByIndex(int sort) {
 TEST_CASE("Perf FindPersonByIndexSorted", "[.Perf]")      {testFindPersonByIndex(1);}
 TEST_CASE("Perf FindPersonByIndexKeyed", "[.Perf]")       {testFindPersonByIndex(2);}
 
+TEST_CASE("Perf Path eval", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 50;
+    auto sk = retained(new SharedKeys);
+    Retained<Doc> doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName), sk);
+    auto people = doc->asArray();
+    static constexpr slice kSpecifier = "friends[-1].name";
+    Path path(kSpecifier);
+    CompiledPath compiled(path, sk);
+    auto run = [&](const char *what, auto fn) {
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            for (Array::iterator iter(people); iter; ++iter)
+                CHECK(fn(iter.value()));
+            bench.stop();
+        }
+        bench.printReport(1.0 / people->count(), what);
+    };
+    run("eval (Path)",                [&](const Value *v) {return path.eval(v);});
+    run("eval (CompiledPath)",        [&](const Value *v) {return compiled.eval(v);});
+    run("eval (Path, one-shot)",      [&](const Value *v) {return Path::eval(kSpecifier, v);});
+    run("eval (CompiledPath cached)", [&](const Value *v) {return CompiledPath::evalCached(kSpecifier, v);});
+}
+
+TEST_CASE("Perf ExtractColumns", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 50;
+    auto sk = retained(new SharedKeys);
+    Retained<Doc> doc = Doc::fromJSON(readTestFile(kBigJSONTestFileName), sk);
+    auto people = doc->asArray();
+    uint32_t n = people->count();
+    std::vector<int64_t> ages(n), indexes(n);
+    std::vector<double> latitudes(n);
+    std::vector<slice> names(n);
+    std::vector<uint8_t> nulls((n + 7) / 8);
+    {
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            uint32_t row = 0;
+            for (Array::iterator iter(people); iter; ++iter, ++row) {
+                auto person = iter.value()->asDict();
+                ages[row] = person->get("age"_sl)->asInt();
+                indexes[row] = person->get("index"_sl)->asInt();
+                latitudes[row] = person->get("latitude"_sl)->asDouble();
+                names[row] = person->get("name"_sl)->asString();
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0 / n, "row (Dict::get)");
+    }
+    {
+        Column columns[] = {
+            {"age"_sl,      ColumnType::kInt,    ages.data(),      nulls.data()},
+            {"index"_sl,    ColumnType::kInt,    indexes.data(),   nullptr},
+            {"latitude"_sl, ColumnType::kDouble, latitudes.data(), nullptr},
+            {"name"_sl,     ColumnType::kString, names.data(),     nullptr},
+        };
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            extractColumns(people, columns, 4);
+            bench.stop();
+        }
+        bench.printReport(1.0 / n, "row (extractColumns)");
+    }
+}
+
+
+TEST_CASE("Perf ArrayIteratorRead", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 200;
+    static const uint32_t kCount = 1000000;
+    Encoder enc;
+    enc.beginArray();
+    for (uint32_t i = 0; i < kCount; ++i) {
+        if (i % 4 == 0)
+            enc.writeInt(i);
+        else
+            enc.writeString(std::to_string(i % 5000));
+    }
+    enc.endArray();
+    alloc_slice data = enc.finish();
+    auto array = Value::fromTrustedData(data)->asArray();
+
+    for (bool bulk : {false, true}) {
+        Benchmark bench;
+        size_t total = 0;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            Array::iterator iter(array);
+            if (bulk) {
+                const Value* values[256];
+                while (size_t n = iter.read(values, 256)) {
+                    for (size_t j = 0; j < n; ++j)
+                        total += size_t(values[j]);
+                }
+            } else {
+                for (; iter; ++iter)
+                    total += size_t(iter.value());
+            }
+            bench.stop();
+        }
+        fprintf(stderr, "%s: ", (bulk ? "read(values, 256)" : "operator++"));
+        bench.printReport(1.0 / kCount, "item");
+        CHECK(total > 0);
+    }
+}
+
+
+TEST_CASE("Perf ExternPointers", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 200;
+    static const uint32_t kCount = 100000;
+    Encoder enc;
+    enc.beginArray();
+    for (uint32_t i = 0; i < kCount; ++i)
+        enc.writeString("string #" + std::to_string(i));
+    enc.endArray();
+    Retained<Doc> base = enc.finishDoc();
+
+    // An Array in a separate segment whose items are all extern pointers to the base's strings:
+    enc.reset();
+    enc.setBase(base->data(), true);
+    enc.beginArray();
+    for (Array::iterator iter(base->asArray()); iter; ++iter)
+        enc.writeValue(iter.value());
+    enc.endArray();
+    Retained<Doc> doc = enc.finishDoc();
+    CHECK(doc->data().size < base->data().size / 2);
+    auto array = doc->asArray();
+
+    Benchmark bench;
+    size_t total = 0;
+    for (int i = 0; i < kSamples; i++) {
+        bench.start();
+        for (Array::iterator iter(array); iter; ++iter)
+            total += size_t(iter.value());
+        bench.stop();
+    }
+    bench.printReport(1.0 / kCount, "item");
+    CHECK(total > 0);
+}
+
+
+TEST_CASE("Perf PackedArrays", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 200;
+    static const uint32_t kCount = 100000;
+    for (bool packed : {false, true}) {
+        Encoder enc;
+        enc.packNumericArrays(packed);
+        enc.beginArray();
+        for (uint32_t i = 0; i < kCount; ++i)
+            enc.writeDouble(i * 1.1);
+        enc.endArray();
+        alloc_slice data = enc.finish();
+        auto array = Value::fromTrustedData(data)->asArray();
+        fprintf(stderr, "%s: %zu bytes\n", (packed ? "Packed" : "Unpacked"), data.size);
+
+        for (bool bulk : {false, true}) {
+            std::vector<double> numbers(kCount);
+            Benchmark bench;
+            double total = 0;
+            for (int i = 0; i < kSamples; i++) {
+                bench.start();
+                if (bulk) {
+                    array->getDoubles(0, kCount, numbers.data());
+                    for (double n : numbers)
+                        total += n;
+                } else {
+                    for (Array::iterator iter(array); iter; ++iter)
+                        total += iter.value()->asDouble();
+                }
+                bench.stop();
+            }
+            fprintf(stderr, "    %s: ", (bulk ? "getDoubles" : "iterator"));
+            bench.printReport(1.0 / kCount, "item");
+            CHECK(total > 0);
+        }
+    }
+}
+
+
+TEST_CASE("Perf ArrayStats", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 200;
+    static const uint32_t kCount = 100000;
+    for (bool packed : {false, true}) {
+        Encoder enc;
+        enc.packNumericArrays(packed);
+        enc.beginArray();
+        for (uint32_t i = 0; i < kCount; ++i)
+            enc.writeDouble(i * 1.1);
+        enc.endArray();
+        alloc_slice data = enc.finish();
+        auto array = Value::fromTrustedData(data)->asArray();
+        fprintf(stderr, "%s:\n", (packed ? "Packed" : "Unpacked"));
+
+        std::vector<uint8_t> bitmap((kCount + 7) / 8);
+        for (int mode = 0; mode < 3; ++mode) {
+            Benchmark bench;
+            double total = 0;
+            for (int i = 0; i < kSamples; i++) {
+                bench.start();
+                if (mode == 0) {
+                    double sum = 0, min = INFINITY, max = -INFINITY;
+                    for (Array::iterator iter(array); iter; ++iter) {
+                        if (iter.value()->type() == kNumber) {
+                            double n = iter.value()->asDouble();
+                            sum += n;
+                            min = std::min(min, n);
+                            max = std::max(max, n);
+                        }
+                    }
+                    total += sum + min + max;
+                } else if (mode == 1) {
+                    ArrayStats stats = getArrayStats(array);
+                    total += stats.sum + stats.min + stats.max;
+                } else {
+                    total += filterNumbers(array, 1000.0, 50000.0, bitmap.data());
+                }
+                bench.stop();
+            }
+            static const char* const kModes[3] = {"iterator", "getArrayStats", "filterNumbers"};
+            fprintf(stderr, "    %s: ", kModes[mode]);
+            bench.printReport(1.0 / kCount, "item");
+            CHECK(total > 0);
+        }
+    }
+}
+
+
 TEST_CASE("Perf LoadPeople", "[.Perf]") {
     assert(false); // This test should not be run with a debug build!
     for (int shareKeys = 0; shareKeys <= 1; ++shareKeys) {
@@ -237,7 +532,7 @@ TEST_CASE("Perf LoadPeople", "[.Perf]") {
 }
 
 
-TEST_CASE("Perf DictSearch", "[.Perf]") {
+static void testDictSearch(bool indexed, bool prefixed =false) {
     assert(false); // This test should not be run with a debug build!
     static const int kSamples = 500000;
 
@@ -248,6 +543,8 @@ TEST_CASE("Perf DictSearch", "[.Perf]") {
     std::vector<alloc_slice> names;
     unsigned nPeople = 0;
     Encoder enc;
+    enc.indexLargeDicts(indexed);
+    enc.prefixDictKeys(prefixed);
     enc.beginDictionary();
     for (Array::iterator i(Value::fromTrustedData(input)->asArray()); i; ++i) {
         auto person = i.value()->asDict();
@@ -283,4 +580,363 @@ TEST_CASE("Perf DictSearch", "[.Perf]") {
     bench.printReport();
 }
 
+TEST_CASE("Perf DictSearch", "[.Perf]")           {testDictSearch(false);}
+TEST_CASE("Perf DictSearch indexed", "[.Perf]")   {testDictSearch(true);}
+TEST_CASE("Perf DictSearch prefixed", "[.Perf]")  {testDictSearch(false, true);}
+
+TEST_CASE("Perf DictSearch large", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    // A Dict too big for the CPU caches, so most probes of a binary search miss:
+    static const int kSamples = 20000;
+    static const unsigned kCount = 2000000;
+    std::vector<std::string> names;
+    Encoder enc;
+    enc.beginDictionary();
+    for (unsigned i = 0; i < kCount; ++i) {
+        char key[40];
+        snprintf(key, sizeof(key), "%08x-key-%u", i * 2654435761u, i);
+        names.emplace_back(key);
+    }
+    std::sort(names.begin(), names.end());
+    for (auto &name : names) {
+        enc.writeKey(name);
+        enc.writeInt(17);
+    }
+    enc.endDictionary();
+    alloc_slice dictData = enc.finish();
+    auto dict = Value::fromTrustedData(dictData)->asDict();
+    fprintf(stderr, "Dict of %u keys is %zu bytes\n", dict->count(), dictData.size);
+
+    Benchmark bench;
+    for (int i = 0; i < kSamples; i++) {
+        slice keys[100];
+        for (int k = 0; k < 100; k++)
+            keys[k] = names[ random() % names.size() ];
+        bench.start();
+        for (int k = 0; k < 100; k++) {
+            if (!dict->get(keys[k]))
+                abort();
+        }
+        bench.stop();
+    }
+    bench.printReport(0.01, "lookup");
+}
+
+TEST_CASE("Perf Encode uniqueStrings", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 500;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    const Value *root = Value::fromTrustedData(input);
+
+    for (int unique = 1; unique >= 0; --unique) {
+        fprintf(stderr, "Encoding 1000 people %s uniqueStrings...\n", (unique ? "with" : "without"));
+        Benchmark bench;
+        size_t outputSize = 0;
+        Encoder enc(input.size);
+        enc.uniqueStrings(unique);
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            enc.writeValue(root);
+            outputSize = enc.finish().size;
+            bench.stop();
+        }
+        bench.printReport();
+        fprintf(stderr, "Output size %zu bytes; throughput %.0f MB/sec\n\n",
+                outputSize, input.size / bench.median() / 1.0e6);
+    }
+}
+
+TEST_CASE("Perf StringTable", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 200;
+    // Collect all the strings in the people data, with their duplicates:
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    std::vector<slice> strings;
+    for (DeepIterator i(Value::fromTrustedData(input)); i; ++i) {
+        if (auto key = i.keyString(); key)
+            strings.push_back(key);
+        if (auto str = i.value()->asString(); str.size >= 2)
+            strings.push_back(str);
+    }
+    fprintf(stderr, "Inserting %zu strings into a StringTable...\n", strings.size());
+
+    Benchmark bench;
+    StringTable table;
+    for (int i = 0; i < kSamples; i++) {
+        table.clear();
+        bench.start();
+        for (slice str : strings)
+            table.insert(str, 1);
+        bench.stop();
+    }
+    bench.printReport(1.0 / strings.size(), "insert");
+    fprintf(stderr, "(%zu unique strings)\n", table.count());
+}
+
+TEST_CASE("Perf hashing", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static constexpr int kNKeys = 1000, kRounds = 10000;
+    for (size_t len : {1, 4, 8, 12, 16, 24, 32, 64, 256}) {
+        // Keys at varying alignments, as they are in encoded data:
+        std::string text;
+        for (int i = 0; i < kNKeys + int(len); ++i)
+            text += char('a' + i % 26);
+        fprintf(stderr, "%3zu-byte keys:\n", len);
+        for (int fn = 0; fn < 2; ++fn) {
+            Benchmark bench;
+            uint32_t total = 0;
+            for (int round = 0; round < 10; ++round) {
+                bench.start();
+                for (int r = 0; r < kRounds / 10; ++r) {
+                    for (int i = 0; i < kNKeys; ++i) {
+                        slice key(&text[i], len);
+                        total += fn ? tableHash(key) : key.hash();
+                    }
+                }
+                bench.stop();
+            }
+            CHECK(total != 1); // bogus
+            bench.printReport(1.0 / (kRounds / 10 * kNKeys), fn ? "tableHash" : "slice::hash");
+        }
+    }
+}
+
+
+TEST_CASE("Perf DeepIterator", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 100;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    auto root = Value::fromTrustedData(input);
+
+    size_t count = 0;
+    Benchmark bench;
+    for (int i = 0; i < kSamples; i++) {
+        count = 0;
+        bench.start();
+        for (DeepIterator iter(root); iter; ++iter)
+            ++count;
+        bench.stop();
+    }
+    bench.printReport(1.0 / count, "value (DeepIterator)");
+
+    Benchmark visitBench;
+    for (int i = 0; i < kSamples; i++) {
+        size_t visited = 0;
+        visitBench.start();
+        root->visit([&](const Value*, slice, uint32_t) {++visited; return true;});
+        visitBench.stop();
+        CHECK(visited == count);
+    }
+    visitBench.printReport(1.0 / count, "value (Value::visit)");
+
+    struct Counter : public ParallelVisitor {
+        size_t count = 0;
+        bool visit(const Value*, const DeepIterator::Path&) override {++count; return true;}
+    };
+    Benchmark parallelBench;
+    for (int i = 0; i < kSamples; i++) {
+        parallelBench.start();
+        auto visitors = visitParallel(root, [] {return std::make_unique<Counter>();});
+        parallelBench.stop();
+        size_t visited = 0;
+        for (auto &v : visitors)
+            visited += ((Counter*)v.get())->count;
+        CHECK(visited == count);
+    }
+    parallelBench.printReport(1.0 / count, "value (visitParallel)");
+}
+
+TEST_CASE("Perf ToJSON parallel", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 100;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    const Value *root = Value::fromTrustedData(input);
+
+    for (unsigned nThreads : {1, 2, 4, 0}) {
+        fprintf(stderr, "Converting 1000 people to JSON on %u threads...\n", nThreads);
+        Benchmark bench;
+        size_t outputSize = 0;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            outputSize = JSONEncoder::toJSONParallel(root, false, false, nThreads).size;
+            bench.stop();
+        }
+        bench.printReport();
+        fprintf(stderr, "Output size %zu bytes; throughput %.0f MB/sec\n\n",
+                outputSize, outputSize / bench.median() / 1.0e6);
+    }
+}
+
+TEST_CASE("Perf MutableDict update", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 50;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    Retained<Doc> doc = new Doc(input, Doc::kTrusted);
+    const Array *people = doc->asArray();
+
+    // Each update overwrites every existing key of a person, and adds 10 new ones:
+    std::vector<std::string> keys;
+    for (Dict::iterator i(people->get(0)->asDict()); i; ++i)
+        keys.push_back(std::string(i.keyString()));
+    for (int n = 0; n < 10; ++n)
+        keys.push_back("extra" + std::to_string(n));
+    fprintf(stderr, "Updating %u people, %zu keys each...\n", people->count(), keys.size());
+
+    Benchmark bench;
+    for (int i = 0; i < kSamples; i++) {
+        bench.start();
+        for (Array::iterator iter(people); iter; ++iter) {
+            Retained<MutableDict> md = MutableDict::newDict(iter.value()->asDict());
+            for (auto &key : keys)
+                md->set(slice(key), 17);
+            for (auto &key : keys)
+                CHECK(md->get(slice(key)) != nullptr);
+        }
+        bench.stop();
+    }
+    bench.printReport(1.0 / people->count(), "doc");
+}
+
+TEST_CASE("Perf MutableDict deep copy", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 50;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    Retained<Doc> doc = new Doc(input, Doc::kTrusted);
+    const Array *people = doc->asArray();
+
+    for (auto flags : {kDeepCopy | kCopyImmutables, kDeepCopy | kCopyImmutables | kCopyToArena}) {
+        fprintf(stderr, "Deep-copying 1000 people %s...\n",
+                (flags & kCopyToArena) ? "into an arena" : "onto the heap");
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            Retained<MutableArray> copy = MutableArray::newArray(people, CopyFlags(flags));
+            copy = nullptr;
+            bench.stop();
+        }
+        bench.printReport();
+    }
+}
+
+TEST_CASE("Perf short-lived Docs", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 50;
+    static const int kCount = 10000;
+    alloc_slice data = JSONConverter::convertJSON("{\"id\":1234,\"name\":\"Zaphod\"}"_sl);
+    // Each iteration uses its own copy of the data, as a request would:
+    std::vector<alloc_slice> inputs;
+    for (int i = 0; i < kCount; ++i)
+        inputs.emplace_back(slice(data));
+
+    Retained<Doc> reused = new Doc(inputs[0]);
+    for (int mode = 0; mode < 3; ++mode) {
+        fprintf(stderr, "%s:\n", (const char*[]){"new Doc", "Doc::reinit", "TransientDoc"}[mode]);
+        Benchmark bench;
+        int64_t total = 0;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            for (auto &input : inputs) {
+                if (mode == 0) {
+                    Retained<Doc> doc = new Doc(input);
+                    total += doc->asDict()->get("id"_sl)->asInt();
+                } else if (mode == 1) {
+                    reused->reinit(input);
+                    total += reused->asDict()->get("id"_sl)->asInt();
+                } else {
+                    TransientDoc doc(input);
+                    total += doc.asDict()->get("id"_sl)->asInt();
+                }
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0 / kCount, "doc");
+        CHECK(total == int64_t(1234) * kCount * kSamples);
+    }
+}
+
+
+TEST_CASE("Perf retain mutable values", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    static const int kSamples = 50;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    Retained<Doc> doc = new Doc(input, Doc::kTrusted);
+
+    for (auto flags : {kDeepCopy | kCopyImmutables, kDeepCopy | kCopyImmutables | kCopySingleThreaded}) {
+        Retained<MutableArray> copy = MutableArray::newArray(doc->asArray(), CopyFlags(flags));
+        std::vector<const Value*> values;
+        for (DeepIterator i(copy); i; ++i) {
+            if (internal::HeapValue::isHeapValue(i.value()))
+                values.push_back(i.value());
+        }
+        fprintf(stderr, "Retaining and releasing %zu %s values...\n", values.size(),
+                (flags & kCopySingleThreaded) ? "single-threaded" : "regular");
+        Benchmark bench;
+        for (int i = 0; i < kSamples; i++) {
+            bench.start();
+            for (int n = 0; n < 10; n++) {
+                for (const Value *value : values)
+                    RetainedConst<Value> r(value);
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0 / (10 * values.size()), "value");
+    }
+}
+
+TEST_CASE("Perf huge pages", "[.Perf]") {
+    assert(false); // This test should not be run with a debug build!
+    // 1000people scaled up 250 times, so the data is far bigger than the TLB's reach:
+    static const int kCopies = 250, kSamples = 50, kLookups = 100000;
+    alloc_slice input = readTestFile("1000people.fleece");
+    if (!input)
+        abort();
+    const Array *people = Value::fromTrustedData(input)->asArray();
+    Encoder enc;
+    enc.beginArray(kCopies * people->count());
+    for (int c = 0; c < kCopies; ++c)
+        for (Array::iterator i(people); i; ++i)
+            enc.writeValue(i.value());
+    enc.endArray();
+    alloc_slice scaled = enc.finish();
+    fprintf(stderr, "Data is %zu MB\n", scaled.size >> 20);
+
+    std::mt19937 rng(1234);
+    for (size_t threshold : {size_t(0), size_t(4 << 20)}) {
+        FLSetHugePageThreshold(threshold);
+        alloc_slice data(scaled.size);      // a new copy, allocated with or without huge pages
+        memcpy((void*)data.buf, scaled.buf, scaled.size);
+        const Array *root = Value::fromTrustedData(data)->asArray();
+        const uint32_t count = root->count();
+        fprintf(stderr, "%s:\n", threshold ? "Huge pages" : "Regular pages");
+        Benchmark bench;
+        size_t found = 0;
+        for (int s = 0; s < kSamples; ++s) {
+            bench.start();
+            for (int i = 0; i < kLookups; ++i) {
+                auto person = root->get(rng() % count)->asDict();
+                if (person->get("name"_sl))
+                    ++found;
+            }
+            bench.stop();
+        }
+        bench.printReport(1.0 / kLookups, "lookup");
+        CHECK(found == size_t(kSamples) * kLookups);
+    }
+    FLSetHugePageThreshold(0);
+}
+
 #endif // !FL_EMBEDDED
@@ -20,7 +20,11 @@
 #include "FleeceImpl.hh"
 #include "Path.hh"
 #include "Doc.hh"
+#include "KeyTranscoder.hh"
+#include "MutableDict.hh"
+#include "JSONEncoder.hh"
 #include <iostream>
+#include <future>
 #include <limits.h>
 
 using namespace std;
@@ -157,6 +161,244 @@ TEST_CASE("many keys", "[SharedKeys]") {
 }
 
 
+TEST_CASE("concurrent encode and decode", "[SharedKeys]") {
+    // One thread adds keys while others encode and decode them without locking.
+    // (Can't use CHECK in the lambdas because Catch isn't thread-safe; using assert instead.)
+    Retained<SharedKeys> sk = new SharedKeys();
+    auto keyName = [](int i, char *str) {
+        sprintf(str, "K%d", i);
+        return slice(str);
+    };
+    auto writer = [&] {
+        for (int i = 0; i < SharedKeys::kMaxCount; ++i) {
+            char str[10];
+            int key;
+            sk->encodeAndAdd(keyName(i, str), key);
+            assert(key == i);
+        }
+    };
+    auto reader = [&] {
+        while (sk->count() < SharedKeys::kMaxCount) {
+            auto keys = sk->byKey();
+            for (int i = 0; i < int(keys.size()); ++i) {
+                char str[10];
+                int key;
+                assert(keys[i] == keyName(i, str));
+                assert(sk->decode(i) == keys[i]);
+                assert(sk->encode(keys[i], key) && key == i);
+                assert(sk->platformStringForKey(i) == nullptr);
+            }
+        }
+    };
+
+    auto f1 = async(launch::async, writer);
+    auto f2 = async(launch::async, reader);
+    auto f3 = async(launch::async, reader);
+    f1.wait();
+    f2.wait();
+    f3.wait();
+    CHECK(sk->count() == size_t(SharedKeys::kMaxCount));
+}
+
+
+TEST_CASE("increased capacity", "[SharedKeys]") {
+    static constexpr int kNumKeys = 5000;
+    Retained<SharedKeys> sk = new SharedKeys();
+    CHECK(sk->capacity() == size_t(SharedKeys::kMaxCount));
+    sk->setCapacity(6000);
+    CHECK(sk->capacity() == 6000);
+
+    Encoder enc;
+    enc.setSharedKeys(sk);
+    enc.beginDictionary();
+    for (int i = 0; i < kNumKeys; i++) {
+        char str[10];
+        sprintf(str, "K%d", i);
+        enc.writeKey(slice(str));
+        enc.writeInt(i);
+    }
+    enc.endDictionary();
+    Retained<Doc> doc = enc.finishDoc();
+    REQUIRE(sk->count() == kNumKeys);
+
+    const Dict *root = doc->asDict();
+    REQUIRE(root);
+    CHECK(root->count() == kNumKeys);
+    for (int i = 0; i < kNumKeys; i++) {
+        char str[10];
+        sprintf(str, "K%d", i);
+        CHECK(sk->decode(i) == slice(str));
+        const Value *v = root->get(slice(str));
+        REQUIRE(v);
+        CHECK(v->asInt() == i);
+        Dict::key dictKey{slice(str)};
+        CHECK(root->get(dictKey) == v);
+    }
+
+    int n = 0;
+    for (Dict::iterator i(root); i; ++i, ++n) {
+        CHECK(i.key()->asInt() == n);
+        CHECK(i.keyString() == sk->decode(n));
+        CHECK(i.value()->asInt() == n);
+    }
+    CHECK(n == kNumKeys);
+
+    // Capacity can't be changed once keys have been added:
+    CHECK_THROWS_AS(sk->setCapacity(8000), FleeceException);
+}
+
+
+TEST_CASE("image", "[SharedKeys]") {
+    static constexpr int kNumKeys = 3000;
+    Retained<SharedKeys> sk = new SharedKeys();
+    sk->setCapacity(4000);
+    Encoder enc;
+    enc.setSharedKeys(sk);
+    enc.beginDictionary();
+    for (int i = 0; i < kNumKeys; i++) {
+        char str[10];
+        sprintf(str, "K%d", (i * 7919) % kNumKeys);      // (so keys aren't in sorted order)
+        enc.writeKey(slice(str));
+        enc.writeInt(i);
+    }
+    enc.endDictionary();
+    alloc_slice data = enc.finish();
+    alloc_slice image = sk->imageData();
+    REQUIRE(image);
+
+    Retained<SharedKeys> sk2 = new SharedKeys();
+    CHECK(!sk2->useImage(sk->stateData()));
+    CHECK(!sk2->useImage(image.upTo(image.size / 2)));
+    sk2->setCapacity(4000);
+    REQUIRE(sk2->useImage(image));
+    CHECK(sk2->count() == kNumKeys);
+    CHECK(sk2->stateData() == sk->stateData());
+    for (int i = 0; i < kNumKeys; i++) {
+        CHECK(sk2->decode(i) == sk->decode(i));
+        int key;
+        REQUIRE(sk2->encode(sk->decode(i), key));
+        CHECK(key == i);
+        REQUIRE(sk2->encode(sk->decode(i), key));      // now from the hash table
+        CHECK(key == i);
+    }
+    int key;
+    CHECK(!sk2->encode("K3000"_sl, key));
+    CHECK(!sk2->encode("K"_sl, key));
+    CHECK_THROWS_AS(sk2->useImage(image), FleeceException);
+
+    // Read the data using the image:
+    Retained<Doc> doc = new Doc(data, Doc::kTrusted, sk2);
+    const Dict *root = doc->asDict();
+    REQUIRE(root);
+    CHECK(root->count() == kNumKeys);
+    CHECK(root->get("K1919"_sl)->asInt() == 1);
+
+    // Keys are added after the image's:
+    CHECK(sk2->encodeAndAdd("foo"_sl, key));
+    CHECK(key == kNumKeys);
+    CHECK(sk2->decode(key) == "foo"_sl);
+
+    // Reverting forgets image keys, too:
+    slice reverted = sk->decode(kNumKeys - 1);
+    sk2->revertToCount(kNumKeys - 1);
+    CHECK(!sk2->encode(reverted, key));
+    CHECK(sk2->encodeAndAdd("bar"_sl, key));
+    CHECK(key == kNumKeys - 1);
+    CHECK(sk2->decode(key) == "bar"_sl);
+    CHECK(sk2->decode(kNumKeys - 2) == sk->decode(kNumKeys - 2));
+}
+
+
+TEST_CASE("shared image", "[SharedKeys]") {
+    // An instance doesn't preallocate tables for its full capacity:
+    CHECK(sizeof(SharedKeys) < 2048);
+
+    alloc_slice image;
+    {
+        Retained<SharedKeys> sk = new SharedKeys();
+        int key;
+        for (int i = 0; i < 100; i++)
+            REQUIRE(sk->encodeAndAdd(slice("K" + std::to_string(i)), key));
+        image = sk->imageData();
+    }
+
+    // Many instances can use the same image, which they keep alive:
+    std::vector<Retained<SharedKeys>> sks;
+    for (int n = 0; n < 3; n++) {
+        sks.push_back(new SharedKeys());
+        REQUIRE(sks.back()->useImage(image));
+    }
+    const void *imageStart = image.buf;
+    image = nullslice;
+    for (auto &sk : sks) {
+        CHECK(sk->count() == 100);
+        CHECK(sk->decode(42) == "K42"_sl);
+        CHECK(sk->decode(42).buf == sks[0]->decode(42).buf);
+        CHECK(sk->decode(42).buf > imageStart);
+    }
+
+    // Keys added to one are its own:
+    int key;
+    REQUIRE(sks[1]->encodeAndAdd("extra"_sl, key));
+    CHECK(key == 100);
+    CHECK(sks[1]->decode(100) == "extra"_sl);
+    CHECK(sks[0]->decode(100) == nullslice);
+    CHECK(!sks[2]->encode("extra"_sl, key));
+}
+
+
+TEST_CASE("training", "[SharedKeys]") {
+    Retained<SharedKeys> sk = new SharedKeys();
+    sk->setCapacity(3);
+    int key;
+    CHECK(sk->encodeAndAdd("name"_sl, key));
+    CHECK(key == 0);
+
+    // Early documents have rare keys; later ones have the hot keys:
+    sk->beginTraining();
+    CHECK(sk->isTraining());
+    auto writeDoc = [&](int i) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        enc.beginDictionary();
+        enc.writeKey("name"_sl);
+        enc.writeInt(i);
+        if (i < 10) {
+            char str[10];
+            sprintf(str, "rare%d", i);
+            enc.writeKey(slice(str));
+        } else {
+            enc.writeKey("x"_sl);
+            enc.writeInt(i);
+            enc.writeKey("description"_sl);
+        }
+        enc.writeInt(i);
+        enc.endDictionary();
+        return enc.finishDoc();
+    };
+    for (int i = 0; i < 20; i++)
+        writeDoc(i);
+    CHECK(sk->count() == 1);        // nothing new gets added while training
+    CHECK(!sk->encode("rare0"_sl, key));
+
+    // Sampling a value directly:
+    auto sample = writeDoc(100);
+    sk->train(sample->root());
+
+    CHECK(sk->finishTraining() == 2);
+    CHECK(!sk->isTraining());
+    CHECK(sk->byKey() == (vector<slice>{"name", "description", "x"}));
+    CHECK_THROWS_AS(sk->finishTraining(), FleeceException);
+
+    sk->resetStats();
+    writeDoc(1);
+    writeDoc(20);
+    auto stats = sk->stats();
+    CHECK(stats.hits == 4);
+    CHECK(stats.misses == 1);
+}
+
+
 #pragma mark - PERSISTENCE:
 
 
@@ -382,6 +624,88 @@ TEST_CASE("preserve existing keys on abort", "[SharedKeys]") {
 }
 
 
+// PersistentSharedKeys implementation that keeps a full state plus appended deltas
+class AppendingSharedKeys : public PersistentSharedKeys {
+public:
+    AppendingSharedKeys(std::vector<alloc_slice> &storage)
+    :_storage(storage)
+    { }
+
+    unsigned writes {0}, appends {0};
+
+protected:
+    virtual bool read() override {
+        bool loaded = false;
+        for (auto &data : _storage)
+            loaded = loadFrom(data) || loaded;
+        return loaded;
+    }
+
+    virtual void write(slice encodedData) override {
+        _storage = {alloc_slice(encodedData)};
+        ++writes;
+    }
+
+    virtual bool append(slice encodedDelta) override {
+        _storage.emplace_back(encodedDelta);
+        ++appends;
+        return true;
+    }
+
+private:
+    std::vector<alloc_slice> &_storage;
+};
+
+
+TEST_CASE("incremental persistence", "[SharedKeys]") {
+    std::vector<alloc_slice> storage;
+    AppendingSharedKeys sk1(storage);
+    sk1.setSnapshotInterval(2);
+    int key;
+    for (int i = 0; i < 6; ++i) {
+        sk1.transactionBegan();
+        REQUIRE(sk1.encodeAndAdd(slice("key" + std::to_string(i)), key));
+        CHECK(key == i);
+        sk1.save();
+        sk1.transactionEnded();
+    }
+    // Full write, 2 appends, full write, 2 appends:
+    CHECK(sk1.writes == 2);
+    CHECK(sk1.appends == 4);
+    REQUIRE(storage.size() == 3);
+    CHECK(storage.back().size < storage.front().size);
+
+    AppendingSharedKeys sk2(storage);
+    sk2.setSnapshotInterval(2);
+    REQUIRE(sk2.refresh());
+    CHECK(sk2.count() == 6);
+    for (int i = 0; i < 6; ++i)
+        CHECK(sk2.decode(i) == slice("key" + std::to_string(i)));
+
+    // sk2 knows the storage already has 2 appends, so it writes the full state:
+    sk2.transactionBegan();
+    REQUIRE(sk2.encodeAndAdd("other"_sl, key));
+    CHECK(key == 6);
+    sk2.save();
+    sk2.transactionEnded();
+    CHECK(sk2.writes == 1);
+    CHECK(sk2.appends == 0);
+    CHECK(storage.size() == 1);
+
+    // sk1 catches up, then appends:
+    sk1.transactionBegan();
+    CHECK(sk1.decode(6) == "other"_sl);
+    REQUIRE(sk1.encodeAndAdd("another"_sl, key));
+    CHECK(key == 7);
+    sk1.save();
+    sk1.transactionEnded();
+    CHECK(sk1.appends == 5);
+    CHECK(storage.size() == 2);
+    REQUIRE(sk2.refresh());
+    CHECK(sk2.decode(7) == "another"_sl);
+}
+
+
 #pragma mark - TESTING WITH ENCODERS:
 
 
@@ -447,6 +771,63 @@ TEST_CASE("encoding", "[SharedKeys]") {
         Dict::key thumbKey("thumbnail.jpg"_sl);
         REQUIRE(atts->get(thumbKey) != nullptr);
     }
+    SECTION("Dict::resolvedKey lookup") {
+        Dict::resolvedKey typeKey("type"_sl, sk), attsKey("_attachments"_sl, sk);
+        CHECK(typeKey.isShared());
+        CHECK(typeKey.string() == "type"_sl);
+
+        const Value *v = root->get(typeKey);
+        REQUIRE(v);
+        REQUIRE(v->asString() == "animal"_sl);
+        const Dict *atts = root->get(attsKey)->asDict();
+        REQUIRE(atts);
+        REQUIRE(atts->get(typeKey) != nullptr);
+        REQUIRE(atts->get(attsKey) == nullptr);
+
+        // A key that can't be mapped to an integer:
+        Dict::resolvedKey thumbKey("thumbnail.jpg"_sl, sk);
+        CHECK(!thumbKey.isShared());
+        REQUIRE(atts->get(thumbKey) != nullptr);
+        REQUIRE(root->get(thumbKey) == nullptr);
+
+        // A key without SharedKeys still works, by string:
+        Dict::resolvedKey massKey("mass"_sl);
+        CHECK(!massKey.isShared());
+        REQUIRE(root->get(massKey));
+        CHECK(root->get(massKey)->asDouble() == 123.456);
+
+        // A key added to the SharedKeys after it was resolved:
+        Dict::resolvedKey newKey("new"_sl, sk);
+        CHECK(!newKey.isShared());
+        enc.setSharedKeys(sk);
+        enc.beginDictionary();
+        enc.writeKey("new");
+        enc.writeInt(17);
+        enc.endDictionary();
+        Retained<Doc> doc2 = enc.finishDoc();
+        REQUIRE(doc2->asDict()->get(newKey));
+        CHECK(doc2->asDict()->get(newKey)->asInt() == 17);
+    }
+    SECTION("getMany lookup") {
+        int typeKey, massKey;
+        REQUIRE(sk->encode("type"_sl, typeKey));
+        REQUIRE(sk->encode("mass"_sl, massKey));
+        impl::key_t keys[3] = {typeKey, massKey, "zzz"_sl};
+        std::sort(&keys[0], &keys[3]);
+        const Value* values[3];
+        root->getMany(keys, 3, values);
+        for (int i = 0; i < 3; i++)
+            CHECK(values[i] == root->get(keys[i]));
+
+        // String keys get mapped to shared keys:
+        slice strKeys[4] = {"type"_sl, "zzz"_sl, "_attachments"_sl, "mass"_sl};
+        const Value* strValues[4];
+        root->getMany(strKeys, 4, strValues);
+        CHECK(strValues[0]->asString() == "animal"_sl);
+        CHECK(strValues[1] == nullptr);
+        CHECK(strValues[2]->type() == kDict);
+        CHECK(strValues[3]->asDouble() == 123.456);
+    }
     SECTION("Path lookup") {
         Path attsTypePath("_attachments.type");
         const Value *t = attsTypePath.eval(root);
@@ -462,6 +843,96 @@ TEST_CASE("encoding", "[SharedKeys]") {
 }
 
 
+TEST_CASE("prepared keys", "[SharedKeys]") {
+    Encoder::PreparedKey typeKey("type"_sl), massKey("mass"_sl), badKey("not a shareable key"_sl);
+    auto encode = [&](SharedKeys *sk) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        enc.beginDictionary();
+        enc.writeKey(typeKey);
+        enc.writeString("animal");
+        enc.writeKey(badKey);
+        enc.writeBool(true);
+        enc.writeKey(massKey);
+        enc.writeDouble(123.456);
+        enc.endDictionary();
+        Retained<Doc> doc = enc.finishDoc();
+        const Dict *root = doc->asDict();
+        CHECK(root->count() == 3);
+        CHECK(root->get("type"_sl)->asString() == "animal"_sl);
+        CHECK(root->get("mass"_sl)->asDouble() == 123.456);
+        CHECK(root->get("not a shareable key"_sl)->asBool());
+        return doc;
+    };
+
+    Retained<SharedKeys> sk = new SharedKeys();
+    encode(sk);
+    CHECK(sk->byKey() == (vector<slice>{"type", "mass"}));
+    sk->resetStats();
+    encode(sk);
+    CHECK(sk->stats().hits == 0);           // The shared keys came from the PreparedKeys
+
+    // The keys re-resolve themselves when used with different SharedKeys:
+    Retained<SharedKeys> sk2 = new SharedKeys();
+    int key;
+    REQUIRE(sk2->encodeAndAdd("mass"_sl, key));
+    Retained<Doc> doc = encode(sk2);
+    CHECK(sk2->byKey() == (vector<slice>{"mass", "type"}));
+    CHECK(doc->asDict()->get(1)->asString() == "animal"_sl);
+
+    // ...or after the SharedKeys is reverted:
+    sk2->revertToCount(0);
+    REQUIRE(sk2->encodeAndAdd("other"_sl, key));
+    doc = encode(sk2);
+    CHECK(sk2->byKey() == (vector<slice>{"other", "type", "mass"}));
+
+    // Without SharedKeys the keys are strings:
+    doc = encode(nullptr);
+    CHECK(!doc->asDict()->get(0));
+}
+
+
+TEST_CASE("concurrent resolvedKey lookup", "[SharedKeys]") {
+    // Several threads share the same resolved keys. (Can't use CHECK in the lambdas because
+    // Catch isn't thread-safe; using assert instead.)
+    Retained<SharedKeys> sk = new SharedKeys();
+    Encoder enc;
+    enc.setSharedKeys(sk);
+    enc.beginArray();
+    for (int i = 0; i < 1000; ++i) {
+        enc.beginDictionary();
+        enc.writeKey("id");
+        enc.writeInt(i);
+        enc.writeKey("name");
+        enc.writeString("x");
+        enc.endDictionary();
+    }
+    enc.endArray();
+    Retained<Doc> doc = enc.finishDoc();
+    const Array *records = doc->asArray();
+
+    Dict::resolvedKey idKey("id"_sl, sk), missingKey("missing"_sl, sk);
+    auto reader = [&] {
+        for (int pass = 0; pass < 100; ++pass) {
+            int i = 0;
+            for (Array::iterator iter(records); iter; ++iter, ++i) {
+                const Dict *d = iter.value()->asDict();
+                const Value *id = d->get(idKey);
+                assert(id && id->asInt() == i);
+                assert(d->get(missingKey) == nullptr);
+            }
+        }
+    };
+    auto f1 = async(launch::async, reader);
+    auto f2 = async(launch::async, reader);
+    auto f3 = async(launch::async, reader);
+    f1.wait();
+    f2.wait();
+    f3.wait();
+    CHECK(records->get(999)->asDict()->get(idKey)->asInt() == 999);
+}
+
+
 TEST_CASE("big JSON encoding", "[SharedKeys]") {
     Retained<SharedKeys> sk = new SharedKeys();
     Encoder enc;
@@ -483,3 +954,223 @@ TEST_CASE("big JSON encoding", "[SharedKeys]") {
     std::string nameStr = (std::string)name->asString();
     REQUIRE(nameStr == std::string("Janet Ayala"));
 }
+
+
+TEST_CASE("canonical JSON with shared keys", "[SharedKeys]") {
+    Retained<SharedKeys> sk = new SharedKeys();
+    int key;
+    for (auto name : {"zebra", "apple", "mango", "kiwi"})
+        REQUIRE(sk->encodeAndAdd(slice(name), key));
+    auto ranks = sk->keyRanks();
+    CHECK(*ranks == (std::vector<uint16_t>{3, 0, 2, 1}));
+    CHECK(sk->keyRanks() == ranks);             // cached
+
+    // Shared keys sort before string keys in the data, and in key order, not string order:
+    Encoder enc;
+    enc.setSharedKeys(sk);
+    enc.beginDictionary();
+    for (auto name : {"zebra", "not shared", "apple", "mango", "Also not shared", "kiwi"}) {
+        enc.writeKey(slice(name));
+        enc.writeString(slice(name));
+    }
+    enc.endDictionary();
+    Retained<Doc> doc = new Doc(enc.finish(), Doc::kTrusted, sk);
+    CHECK(doc->root()->toJSON(true) == "{\"Also not shared\":\"Also not shared\","
+                                         "\"apple\":\"apple\",\"kiwi\":\"kiwi\","
+                                         "\"mango\":\"mango\",\"not shared\":\"not shared\","
+                                         "\"zebra\":\"zebra\"}"_sl);
+
+    // Adding or reverting keys invalidates the ranks:
+    REQUIRE(sk->encodeAndAdd("banana"_sl, key));
+    CHECK(*sk->keyRanks() == (std::vector<uint16_t>{4, 0, 3, 2, 1}));
+    sk->revertToCount(4);
+    REQUIRE(sk->encodeAndAdd("aardvark"_sl, key));
+    CHECK(*sk->keyRanks() == (std::vector<uint16_t>{4, 1, 3, 2, 0}));
+
+    // The parallel converter sorts big Dicts the same way:
+    enc.reset();
+    enc.setSharedKeys(sk);
+    enc.beginDictionary();
+    for (int i = 999; i >= 0; i -= 3) {
+        std::string name = (i % 2 ? "key " : "key") + std::to_string(i);
+        enc.writeKey(name);
+        enc.writeInt(i);
+    }
+    enc.endDictionary();
+    Retained<Doc> bigDoc = new Doc(enc.finish(), Doc::kTrusted, sk);
+    alloc_slice json = bigDoc->root()->toJSON(true);
+    CHECK(JSONEncoder::toJSONParallel(bigDoc->root(), false, true, 4) == json);
+    CHECK(json.hasPrefix("{\"key 105\":105,\"key 111\":111,"_sl));
+    CHECK(json.hasSuffix(",\"key990\":990,\"key996\":996}"_sl));
+}
+
+
+TEST_CASE("explicit SharedKeys without a Doc", "[SharedKeys]") {
+    Retained<SharedKeys> sk = new SharedKeys();
+    Encoder enc;
+    enc.setSharedKeys(sk);
+    enc.beginDictionary();
+    enc.writeKey("name");
+    enc.writeString("Gaga");
+    enc.writeKey("address");
+    enc.beginDictionary();
+    enc.writeKey("city");
+    enc.writeString("Brooklyn");
+    enc.endDictionary();
+    enc.endDictionary();
+    alloc_slice encoded = enc.finish();
+    REQUIRE(sk->count() == 3);
+
+    // The data isn't in any Doc, so its SharedKeys can only be found if they're given:
+    auto root = Value::fromTrustedData(encoded)->asDict();
+    REQUIRE(Doc::sharedKeys(root) == nullptr);
+
+    CHECK(root->get("name"_sl, sk)->asString() == "Gaga"_sl);
+    CHECK(root->get("nope"_sl, sk) == nullptr);
+
+    int n = 0;
+    for (Dict::iterator i(root, sk); i; ++i, ++n) {
+        CHECK(i.key()->isInteger());
+        CHECK(i.keyString() == (n == 0 ? "name"_sl : "address"_sl));
+    }
+    CHECK(n == 2);
+
+    CHECK(root->toJSON(true, sk) == "{\"address\":{\"city\":\"Brooklyn\"},\"name\":\"Gaga\"}"_sl);
+
+    Path path("address.city");
+    CHECK(path.eval(root, sk)->asString() == "Brooklyn"_sl);
+    CHECK(Path::eval("address.city"_sl, root, sk)->asString() == "Brooklyn"_sl);
+}
+
+
+TEST_CASE("KeyTranscoder", "[SharedKeys]") {
+    Retained<SharedKeys> source = new SharedKeys();
+    Encoder enc;
+    enc.setSharedKeys(source);
+    enc.beginDictionary();
+    enc.writeKey("name");
+    enc.writeString("Gaga");
+    enc.writeKey("address");
+    enc.beginDictionary();
+    enc.writeKey("city");
+    enc.writeString("Brooklyn");
+    enc.writeKey("a long key that won't be shared!");
+    enc.writeInt(17);
+    enc.endDictionary();
+    enc.writeKey("tags");
+    enc.beginArray();
+    enc.beginDictionary();
+    enc.writeKey("name");
+    enc.writeBool(true);
+    enc.endDictionary();
+    enc.endArray();
+    enc.endDictionary();
+    alloc_slice encoded = enc.finish();
+    REQUIRE(source->count() == 4);
+    alloc_slice json = Value::fromData(encoded)->toJSON(true, source);
+
+    SECTION("Identical SharedKeys") {
+        Retained<SharedKeys> target = new SharedKeys();
+        int key;
+        for (auto str : {"name", "address", "city", "tags"})
+            REQUIRE(target->encodeAndAdd(slice(str), key));
+        KeyTranscoder transcoder(source, target);
+        alloc_slice result = transcoder.transcode(encoded);
+        CHECK(result == encoded);
+        CHECK(target->count() == 4);
+    }
+
+    SECTION("Different SharedKeys") {
+        Retained<SharedKeys> target = new SharedKeys();
+        int key;
+        REQUIRE(target->encodeAndAdd("tags"_sl, key));
+        REQUIRE(target->encodeAndAdd("other"_sl, key));
+        KeyTranscoder transcoder(source, target);
+        alloc_slice result = transcoder.transcode(encoded);
+        CHECK(result != encoded);
+        CHECK(target->count() == 5);
+        CHECK(transcoder.mapKey(0) == 2);       // "name"
+        CHECK(transcoder.mapKey(3) == 0);       // "tags"
+
+        auto root = Value::fromData(result)->asDict();
+        REQUIRE(root);
+        CHECK(root->toJSON(true, target) == json);
+        CHECK(root->get("address"_sl, target)->asDict()->get("city"_sl, target)->asString()
+              == "Brooklyn"_sl);
+        CHECK(root->get("tags"_sl, target)->asArray()->get(0)->asDict()
+                  ->get("name"_sl, target)->asBool());
+    }
+
+    SECTION("Full target") {
+        Retained<SharedKeys> target = new SharedKeys();
+        target->setMaxKeyLength(2);
+        KeyTranscoder transcoder(source, target);
+        alloc_slice result = transcoder.transcode(encoded);
+        CHECK(transcoder.mapKey(0) == -1);
+        auto root = Value::fromData(result)->asDict();
+        REQUIRE(root);
+        CHECK(root->toJSON(true, target) == json);
+        CHECK(root->get("name"_sl)->asString() == "Gaga"_sl);
+    }
+}
+
+
+TEST_CASE("DictMergeIterator", "[SharedKeys]") {
+    auto encode = [](SharedKeys *sk, std::vector<std::pair<const char*,int>> items) {
+        Encoder enc;
+        enc.setSharedKeys(sk);
+        enc.beginDictionary();
+        for (auto &[key, value] : items) {
+            enc.writeKey(slice(key));
+            enc.writeInt(value);
+        }
+        enc.endDictionary();
+        return Retained<Doc>(new Doc(enc.finish(), Doc::kTrusted, sk));
+    };
+    auto merge = [](const Dict *d1, const Dict *d2) {
+        std::string result;
+        for (DictMergeIterator i(d1, d2); i; ++i) {
+            result += std::string(i.keyString()) + "=";
+            result += i.value1() ? std::to_string(i.value1()->asInt()) : "-";
+            result += i.value2() ? std::to_string(i.value2()->asInt()) : "-";
+            result += " ";
+        }
+        return result;
+    };
+
+    Retained<SharedKeys> sk1 = new SharedKeys(), sk2 = new SharedKeys();
+    int key;
+    for (auto str : {"zebra", "mango", "apple"})     // so sk2's integers are in reverse order
+        REQUIRE(sk2->encodeAndAdd(slice(str), key));
+    auto doc1 = encode(sk1, {{"apple", 1}, {"mango", 2}, {"a long key that won't be shared!", 3}});
+    auto doc2 = encode(sk2, {{"zebra", 4}, {"mango", 5}, {"a long key that won't be shared!", 6}});
+    auto d1 = doc1->asDict(), d2 = doc2->asDict();
+    const char *expected = "a long key that won't be shared!=36 apple=1- mango=25 zebra=-4 ";
+
+    SECTION("Same SharedKeys") {
+        auto doc3 = encode(sk1, {{"zebra", 4}, {"mango", 5}, {"a long key that won't be shared!", 6}});
+        // With the same SharedKeys, integer keys come first, in the order they were added:
+        CHECK(merge(d1, doc3->asDict())
+              == "apple=1- mango=25 zebra=-4 a long key that won't be shared!=36 ");
+        CHECK(!d1->isEqualToDict(doc3->asDict()));
+        CHECK(d1->isEqualToDict(encode(sk1, {{"mango", 2}, {"apple", 1},
+                                             {"a long key that won't be shared!", 3}})->asDict()));
+    }
+    SECTION("Different SharedKeys") {
+        CHECK(merge(d1, d2) == expected);
+        CHECK(!d1->isEqualToDict(d2));
+        CHECK(d1->isEqualToDict(encode(sk2, {{"mango", 2}, {"apple", 1},
+                                             {"a long key that won't be shared!", 3}})->asDict()));
+    }
+    SECTION("Mutable") {
+        Retained<MutableDict> m = MutableDict::newDict(d1);
+        m->remove("apple"_sl);
+        m->set("zebra"_sl, 7);
+        CHECK(merge(m, d2) == "a long key that won't be shared!=36 mango=25 zebra=74 ");
+        CHECK(merge(d1, m) == "a long key that won't be shared!=33 apple=1- mango=22 zebra=-7 ");
+    }
+    SECTION("Empty") {
+        CHECK(merge(d1, nullptr) == "apple=1- mango=2- a long key that won't be shared!=3- ");
+        CHECK(merge(nullptr, Dict::kEmpty) == "");
+    }
+}
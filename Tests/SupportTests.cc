@@ -19,11 +19,35 @@
 #include "FleeceTests.hh"
 #include "FleeceImpl.hh"
 #include "ConcurrentMap.hh"
+#include "InternedStrings.hh"
+#include "MutableDict.hh"
+#include "Base64.hh"
 #include "Bitmap.hh"
+#include "LZ4.hh"
+#include "NumConversion.hh"
+#include "ParseDate.hh"
+#include "CRC32C.hh"
+#include "CPUFeatures.hh"
+#include "Writer.hh"
+#include "Allocator.hh"
+#include "Executor.hh"
+#include "JSONDelta.hh"
+#include "fleece/Fleece.h"
+#include "Backtrace.hh"
+#include "InstanceCounted.hh"
 #include "TempArray.hh"
+#include "UTF8.hh"
 #include "sliceIO.hh"
+#include "AsyncFileIO.hh"
+#include "TableHash.hh"
+#include "function_ref.hh"
+#include <cfloat>
+#include <cmath>
 #include <iostream>
 #include <future>
+#include <thread>
+#include <random>
+#include <set>
 
 using namespace std;
 
@@ -95,6 +119,250 @@ TEST_CASE("Slice I/O") {
     fclose(f);
 #endif
 }
+
+
+TEST_CASE("AsyncFileIO") {
+    bool useIOUring = GENERATE(false, true);
+    AsyncFileIO io(8, useIOUring);
+    INFO("useIOUring=" << useIOUring << ", using it=" << io.usesIOUring());
+    if (!useIOUring)
+        CHECK(!io.usesIOUring());
+
+    // More files than the queue depth, so some have to wait their turn:
+    constexpr int kNumFiles = 40;
+    std::vector<std::string> paths;
+    std::vector<alloc_slice> contents;
+    std::vector<std::future<void>> writes;
+    for (int i = 0; i < kNumFiles; ++i) {
+        paths.push_back(kTempDir "asyncfile" + std::to_string(i));
+        alloc_slice data(1000 * (i + 1));
+        for (size_t j = 0; j < data.size; ++j)
+            ((uint8_t*)data.buf)[j] = uint8_t(i + j);
+        contents.push_back(data);
+        writes.push_back(io.writeFile(data, paths[i].c_str()));
+    }
+    for (auto &write : writes)
+        write.get();
+
+    std::vector<std::future<alloc_slice>> reads;
+    for (int i = 0; i < kNumFiles; ++i)
+        reads.push_back(io.readFile(paths[i].c_str()));
+    for (int i = 0; i < kNumFiles; ++i)
+        CHECK(reads[i].get() == contents[i]);
+
+    // Callbacks, and errors:
+    std::atomic<int> nErrors {0};
+    io.readFile(kTempDir "no-such-asyncfile", [&](alloc_slice data, std::exception_ptr error) {
+        if (error && !data)
+            ++nErrors;
+    });
+    io.writeFile(contents[0], kTempDir "no-such-dir/asyncfile", [&](std::exception_ptr error) {
+        if (error)
+            ++nErrors;
+    });
+    io.waitIdle();
+    CHECK(nErrors == 2);
+    CHECK_THROWS_AS(io.readFile(kTempDir "no-such-asyncfile").get(), FleeceException);
+
+    writeToFile(nullslice, paths[0].c_str());
+    CHECK(io.readFile(paths[0].c_str()).get().size == 0);
+    for (auto &path : paths)
+        remove(path.c_str());
+}
+
+
+TEST_CASE("Async Doc load and save") {
+    using namespace fleece::impl;
+    const char *path = kTempDir "asyncdoc.fleece";
+    Encoder enc;
+    enc.beginDictionary();
+    enc.writeKey("greeting");
+    enc.writeString("hello");
+    enc.endDictionary();
+    enc.finishToFileAsync(path).get();
+
+    Retained<Doc> doc = Doc::loadFileAsync(path).get();
+    REQUIRE(doc->root());
+    CHECK(doc->asDict()->get("greeting"_sl)->asString() == "hello"_sl);
+
+    writeToFile("not fleece"_sl, path);
+    doc = Doc::loadFileAsync(path).get();
+    CHECK(!doc->root());
+    remove(path);
+    CHECK_THROWS_AS(Doc::loadFileAsync(path).get(), FleeceException);
+}
+#endif
+
+
+#if !FL_EMBEDDED
+static atomic<int> sTestAllocs;
+
+TEST_CASE("Slice search") {
+    CHECK("hello world"_sl.find("o w"_sl) == slice("hello world").from(4).upTo(3));
+    CHECK(!"hello world"_sl.find("low"_sl));
+    CHECK(!"hi"_sl.find("hi!"_sl));
+    CHECK("x"_sl.find(""_sl).buf != nullptr);
+    CHECK(!nullslice.find("x"_sl));
+    CHECK(!"hello"_sl.findAnyByteOf(""_sl));
+    CHECK(!nullslice.findByteNotIn("x"_sl));
+    CHECK("Hello"_sl.caseEquivalent("hELLO"_sl));
+    CHECK(!"Hello"_sl.caseEquivalent("Hellp"_sl));
+    CHECK("abc"_sl.caseEquivalentCompare("ABCD"_sl) < 0);
+    CHECK("["_sl.caseEquivalentCompare("A"_sl) < 0);        // compares '[' with 'a', not 'A'
+
+    // Compare against simple implementations, with slices long enough for the vector code and
+    // byte sets that include non-ASCII bytes and the bytes sharing each one's low nybble:
+    mt19937 rng(1234);
+    for (int round = 0; round < 500; ++round) {
+        string text(rng() % 100, '\0'), set(1 + rng() % 10, '\0');
+        for (auto &c : set)
+            c = char(rng());
+        for (auto &c : text) {
+            c = char(rng() % 4 == 0 ? set[rng() % set.size()] : set[0] ^ (rng() % 4 << 4));
+            if (rng() % 8 == 0) c = char(rng());
+        }
+        slice s(text), bytes(set);
+        INFO("text " << s.hexString() << ", set " << bytes.hexString());
+
+        const uint8_t *anyOf = nullptr, *notIn = nullptr;
+        for (auto p = (const uint8_t*)s.buf; p < s.end(); ++p) {
+            bool inSet = set.find(char(*p)) != string::npos;
+            if (inSet && !anyOf)    anyOf = p;
+            if (!inSet && !notIn)   notIn = p;
+        }
+        CHECK(s.findAnyByteOf(bytes) == anyOf);
+        CHECK(s.findByteNotIn(bytes) == notIn);
+
+        string target = set.substr(0, 2);
+        size_t pos = text.find(target);
+        CHECK(s.find(slice(target)).buf == (pos == string::npos ? nullptr : &text[pos]));
+        if (text.size() > 2) {
+            // Longer targets, often occurring in the text, with the vector code's candidates:
+            size_t start = rng() % (text.size() - 2);
+            target = text.substr(start, 2 + rng() % 12);
+            if (rng() % 2)
+                target.back() ^= 1;
+            pos = text.find(target);
+            CHECK(s.find(slice(target)).buf == (pos == string::npos ? nullptr : &text[pos]));
+        }
+
+        string other = text;
+        for (auto &c : other)
+            c = char(c ^ (rng() % 3 == 0 && isalpha(uint8_t(c)) ? 0x20 : 0));
+        if (!other.empty() && rng() % 2)
+            other[rng() % other.size()] = char(rng());
+        auto lower = [](string str) {
+            for (auto &c : str)
+                c = char(tolower(uint8_t(c)));
+            return str;
+        };
+        int expected = slice(lower(text)).compare(slice(lower(other)));
+        int cmp = s.caseEquivalentCompare(slice(other));
+        CHECK((cmp < 0) == (expected < 0));
+        CHECK((cmp > 0) == (expected > 0));
+    }
+}
+
+
+TEST_CASE("alloc_slice pool") {
+    FLSlice_SetPooling(true);
+
+    SECTION("Reuse") {
+        const void *buf;
+        {
+            alloc_slice a(100);
+            buf = a.buf;
+        }
+        auto before = FLSlice_GetAllocStats();
+        alloc_slice b(90);                      // same size class
+        auto after = FLSlice_GetAllocStats();
+        CHECK(b.buf == buf);
+        CHECK(after.poolHits == before.poolHits + 1);
+
+        alloc_slice big(100000);
+        CHECK(FLSlice_GetAllocStats().unpooled == after.unpooled + 1);
+    }
+
+    SECTION("Cross-thread") {
+        // Slices allocated on one thread and freed on another go through the shared lists:
+        static constexpr size_t kCount = 5000;
+        vector<alloc_slice> slices(kCount);
+        for (int round = 0; round < 3; ++round) {
+            auto producer = async(launch::async, [&] {
+                for (size_t i = 0; i < kCount; ++i) {
+                    size_t size = 1 + (i * 37) % 900;
+                    slices[i] = alloc_slice(size);
+                    memset((void*)slices[i].buf, int(i & 0xFF), size);
+                }
+            });
+            producer.wait();
+            for (size_t i = 0; i < kCount; ++i) {
+                auto bytes = (const uint8_t*)slices[i].buf;
+                REQUIRE(bytes[0] == (i & 0xFF));
+                REQUIRE(bytes[slices[i].size - 1] == (i & 0xFF));
+            }
+            slices.assign(kCount, nullslice);
+        }
+        auto stats = FLSlice_GetAllocStats();
+        CHECK(stats.poolHits > 0);
+        CHECK(stats.poolMisses > 0);
+    }
+
+    FLSlice_SetPooling(true);
+}
+
+
+TEST_CASE("FLSetAllocator") {
+    using namespace fleece::impl;
+    // A counting allocator that's compatible with the default one, so blocks allocated before or
+    // after it's installed can be freed by either:
+    FLAllocator counting {
+        [](void *ctx, size_t size, size_t alignment) -> void* {
+            ++*(atomic<int>*)ctx;
+            if (alignment > alignof(max_align_t))
+                return ::operator new(size, align_val_t(alignment), nothrow);
+            return ::malloc(size);
+        },
+        [](void *ctx, void *block, size_t size) {
+            if (!block)
+                ++*(atomic<int>*)ctx;
+            return ::realloc(block, size);
+        },
+        [](void*, void *block, size_t alignment) {
+            if (alignment > alignof(max_align_t))
+                ::operator delete(block, align_val_t(alignment));
+            else
+                ::free(block);
+        },
+        &sTestAllocs
+    };
+    FLSetAllocator(&counting);
+    FLSlice_SetPooling(false);
+    sTestAllocs = 0;
+    {
+        {
+            alloc_slice a(10), b("hello"_sl);       // slice buffers use it too
+            CHECK(sTestAllocs == 2);
+        }
+        alloc_slice data;
+        {
+            Retained<MutableDict> dict = MutableDict::newDict();
+            for (int i = 0; i < 100; ++i)
+                dict->set(slice("key" + to_string(i)), i);
+            CHECK(sTestAllocs > 0);                 // HeapDict storage
+
+            Encoder enc;
+            enc.writeValue(dict);
+            data = enc.finish();
+        }
+        int before = sTestAllocs;
+        Retained<Doc> doc = new Doc(data, Doc::kTrusted);
+        CHECK(sTestAllocs > before);                // the Doc itself
+        CHECK(doc->root()->asDict()->get("key42"_sl)->asInt() == 42);
+    }
+    FLSlice_SetPooling(true);
+    FLSetAllocator(nullptr);
+}
 #endif
 
 
@@ -114,13 +382,13 @@ TEST_CASE("Bitmap") {
 }
 
 
-TEST_CASE("Hash distribution") {
+static void checkHashDistribution(const char *format, function_ref<uint32_t(slice)> hashFn) {
     static constexpr int kSize = 4096, kNKeys = 2048;
     int bucket[kSize] = {0};
     for (int i = 0; i < kNKeys; ++i) {
-        char keybuf[10];
-        sprintf(keybuf, "k-%04d", i);
-        int hash = slice(keybuf).hash();
+        char keybuf[40];
+        snprintf(keybuf, sizeof(keybuf), format, i);
+        int hash = hashFn(slice(keybuf));
         int index = hash & (kSize-1);
         ++bucket[index];
     }
@@ -141,9 +409,542 @@ TEST_CASE("Hash distribution") {
 }
 
 
+TEST_CASE("Hash distribution") {
+    // Short keys, and ones that take tableHash's loop:
+    for (const char *format : {"k-%04d", "%d", "a-key-of-twenty-bytes-%04d"}) {
+        INFO("Keys like " << format);
+        checkHashDistribution(format, [](slice s) {return s.hash();});
+        checkHashDistribution(format, [](slice s) {return tableHash(s);});
+    }
+    CHECK(tableHash("hello"_sl) == tableHash(slice(string("hello"))));
+    CHECK(tableHash("hello"_sl) != tableHash("hellO"_sl));
+    CHECK(tableHash(""_sl) != tableHash(slice("\0", 1)));
+}
+
+
+TEST_CASE("LZ4") {
+    alloc_slice json = readTestFile(kBigJSONTestFileName);
+    string zeros(1000, '\0');
+    string random(1000, ' ');
+    for (auto &c : random)
+        c = char(::random());
+    for (slice input : {slice(json), slice(zeros), slice(random), slice("hello"), slice("abcdabcdabcdabcdabcd"),
+                        slice()}) {
+        alloc_slice compressed(input.size + 100);
+        size_t size = compressLZ4(input, (void*)compressed.buf, compressed.size);
+        REQUIRE(size > 0);
+        compressed.shorten(size);
+        alloc_slice output(input.size);
+        CHECK(decompressLZ4(compressed, (void*)output.buf, output.size));
+        CHECK(output == input);
+
+        if (input.size > 0) {
+            // Wrong output size, or truncated input:
+            CHECK(!decompressLZ4(compressed, (void*)output.buf, output.size - 1));
+            CHECK(!decompressLZ4(compressed.upTo(compressed.size - 1), (void*)output.buf, output.size));
+        }
+    }
+
+    // Compressible data shrinks; and the output capacity is respected:
+    char buf[1000];
+    CHECK(compressLZ4(json, buf, sizeof(buf)) == 0);
+    CHECK(compressLZ4(slice(zeros), buf, sizeof(buf)) < 20);
+    CHECK(compressLZ4(slice(random), buf, sizeof(buf)) == 0);
+
+    // Garbage input doesn't crash:
+    for (int i = 0; i < 100; ++i) {
+        for (auto &c : random)
+            c = char(::random());
+        decompressLZ4(slice(random).upTo(i * 10), buf, sizeof(buf));
+    }
+}
+
+
+TEST_CASE("CRC32C") {
+    CHECK(crc32c(nullslice) == 0);
+    CHECK(crc32c("123456789"_sl) == 0xE3069283);
+    CHECK(crc32c(slice(string(32, '\0'))) == 0x8A9136AA);
+
+    // Checksumming in pieces, of any alignment, gives the same result:
+    alloc_slice json = readTestFile(kBigJSONTestFileName);
+    uint32_t crc = crc32c(json);
+    for (size_t split : {size_t(1), size_t(7), json.size / 2, json.size - 3}) {
+        CHECK(crc32c(slice(offsetby(json.buf, split), json.end()),
+                     crc32c(json.upTo(split))) == crc);
+    }
+}
+
+
 #pragma mark - CONCURRENT MAP:
 
 
+TEST_CASE("ISO-8601 dates") {
+    CHECK(ParseISO8601Date("1970-01-01T00:00:00Z"_sl) == 0);
+    CHECK(ParseISO8601Date("1969-12-31T23:59:59.999Z") == -1);
+    CHECK(ParseISO8601Date("2024-02-29T12:00:00Z"_sl) == 1709208000000);
+    CHECK(ParseISO8601Date("2026-10-14T24:00:00Z"_sl) == ParseISO8601Date("2026-10-15T00:00:00Z"_sl));
+    for (const char *bad : {"2026-02-29T00:00:00Z", "1900-02-29T00:00:00Z", "2026-04-31T00:00:00Z",
+                            "2020-01-32T00:00:00Z", "2020-01-45T00:00:00Z", "2020-12-99T00:00:00Z",
+                            "2026-13-01T00:00:00Z", "2026-00-01T00:00:00Z", "2026-10-00T00:00:00Z",
+                            "2026-10-14T12:60:00Z", "2026-10-14T12:00:60Z", "2026-10-14T12:00:00.00xZ",
+                            "2026-10-14T12:00:00Y", "2026/10/14T12:00:00Z"}) {
+        INFO("Date " << bad);
+        CHECK(ParseISO8601Date(slice(bad)) == kInvalidDate);
+    }
+
+    // Dates in the common form, which are parsed and formatted by the fast paths, agree with
+    // the general parser's reading of the same dates in another form:
+    static constexpr int64_t kYear0 = -62167219200000, kYear10000 = 253402300800000;
+    std::mt19937_64 random(1234);
+    char buf[kFormattedISO8601DateMaxSize];
+    for (int i = 0; i < 10000; ++i) {
+        int64_t t = kYear0 + int64_t(random() % uint64_t(kYear10000 - kYear0));
+        if (i % 2)
+            t -= t % 1000;
+        string str(FormatISO8601Date(buf, t, true));
+        INFO("Date " << str);
+        REQUIRE(str.size() == (t % 1000 ? 24 : 20));
+        REQUIRE(ParseISO8601Date(slice(str)) == t);
+        str[10] = ' ';
+        REQUIRE(ParseISO8601Date(slice(str)) == t);
+    }
+
+    slice strs[3] = {"2026-10-14T12:34:56Z"_sl, "yesterday"_sl, "2026-10-14T12:34:56.789Z"_sl};
+    int64_t timestamps[3];
+    CHECK(ParseISO8601Dates(strs, 3, timestamps) == 2);
+    CHECK(timestamps[1] == kInvalidDate);
+    CHECK(timestamps[2] - timestamps[0] == 789);
+    char bufs[3 * kFormattedISO8601DateMaxSize];
+    slice formatted[3];
+    FormatISO8601Dates(timestamps, 3, true, bufs, formatted);
+    CHECK(formatted[0] == strs[0]);
+    CHECK(formatted[1] == nullslice);
+    CHECK(formatted[2] == strs[2]);
+}
+
+
+TEST_CASE("UTF-8 validation") {
+    CHECK(isValidUTF8(nullslice));
+    CHECK(isValidUTF8("plain ASCII"_sl));
+    for (const char *bad : {"\x80", "\xBF", "\xC0\x80", "\xC1\xBF", "\xC2", "\xE0\x9F\xBF",
+                            "\xE2\x82", "\xED\xA0\x80", "\xED\xBF\xBF", "\xF0\x8F\xBF\xBF",
+                            "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", "\xC2\xC2\xA2"}) {
+        INFO("Sequence " << slice(bad).hexString());
+        CHECK(!isValidUTF8(slice(bad)));
+    }
+
+    // Mixed text of every sequence length. Cutting it off in the middle of a character, or
+    // corrupting a byte anywhere, makes it invalid; those are checked at every position so the
+    // vector code's block boundaries are covered:
+    string text;
+    for (int i = 0; i < 20; ++i)
+        text += "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x9C\xEF\xBF\xBD\xF4\x8F\xBF\xBF" + to_string(i);
+    REQUIRE(isValidUTF8(slice(text)));
+    for (size_t len = 0; len <= text.size(); ++len) {
+        bool atBoundary = (len == text.size()) || (uint8_t(text[len]) & 0xC0) != 0x80;
+        REQUIRE(isValidUTF8(slice(text).upTo(len)) == atBoundary);
+    }
+    for (size_t i = 0; i < text.size(); ++i) {
+        string corrupt = text;
+        uint8_t c = uint8_t(corrupt[i]);
+        // turn ASCII into a continuation, a continuation into ASCII, a lead byte into an
+        // invalid one:
+        corrupt[i] = char(c < 0x80 ? 0x80 : (c < 0xC0 ? 'x' : 0xFF));
+        REQUIRE(!isValidUTF8(slice(corrupt)));
+    }
+}
+
+
+TEST_CASE("Base64") {
+    CHECK(base64::encode(""_sl) == "");
+    CHECK(base64::encode("f"_sl) == "Zg==");
+    CHECK(base64::encode("fo"_sl) == "Zm8=");
+    CHECK(base64::encode("foo"_sl) == "Zm9v");
+    CHECK(base64::encode("foobar"_sl) == "Zm9vYmFy");
+    CHECK(base64::decode("Zm9vYmE="_sl) == "fooba"_sl);
+
+    string random(1000, ' ');
+    for (auto &c : random)
+        c = char(::random());
+    for (size_t size = 0; size <= random.size(); size += (size < 100 ? 1 : 99)) {
+        slice data = slice(random).upTo(size);
+        string encoded = base64::encode(data);
+        REQUIRE(encoded.size() == base64::encodedSize(size));
+        // Long data is encoded the same as it is 3 bytes at a time:
+        if (size % 3 == 0) {
+            string pieces;
+            for (size_t i = 0; i < size; i += 3)
+                pieces += base64::encode(data.from(i).upTo(3));
+            REQUIRE(encoded == pieces);
+        }
+        REQUIRE(base64::decode(slice(encoded)) == data);
+
+        // Line breaks and other non-base64 characters are skipped:
+        string wrapped;
+        for (size_t i = 0; i < encoded.size(); i += 76)
+            wrapped += encoded.substr(i, 76) + "\r\n";
+        if (size > 0)
+            REQUIRE(base64::decode(slice(wrapped)) == data);
+    }
+}
+
+
+TEST_CASE("CPU feature dispatch") {
+    cpu::Features features = cpu::detected();
+    cerr << "CPU features: " << cpu::describe(features) << "\n";
+    CHECK(cpu::enabled() == features);
+    CHECK(cpu::describe(cpu::kSSE42 | cpu::kAVX2) == "sse4.2 avx2");
+
+    // The specialized code must get the same results as the generic code it replaces:
+    string text;
+    for (int i = 0; i < 200; ++i)
+        text += "caf\xC3\xA9 \xE2\x82\xAC" + to_string(i * i);
+    slice s(text);
+    auto run = [&] {
+        string b64 = base64::encode(s);
+        return make_tuple(b64, base64::decode(slice(b64)), isValidUTF8(s),
+                          isValidUTF8(s.upTo(text.size() - 30)), crc32c(s),
+                          s.findAnyByteOf("\xE2$"_sl), s.findByteNotIn("acf\xC3\xA9"_sl));
+    };
+    auto withFeatures = run();
+    cpu::setDisabled(features);
+    CHECK(cpu::enabled() == 0);
+    CHECK(!cpu::has(cpu::kAVX2));
+    auto generic = run();
+    cpu::setDisabled(0);
+    CHECK(cpu::enabled() == features);
+    CHECK(withFeatures == generic);
+}
+
+
+TEST_CASE("ParseDouble","[Numeric]") {
+    auto parse = [](const char *str) {
+        double d = -1;
+        CHECK(ParseDouble(slice(str), d) == strlen(str));
+        double d2 = ParseDouble(str);
+        CHECK(memcmp(&d, &d2, sizeof(d)) == 0);
+        return d;
+    };
+    CHECK(parse("0") == 0.0);
+    CHECK(signbit(parse("-0.0")));
+    CHECK(parse("1.5") == 1.5);
+    CHECK(parse("+1.") == 1.0);
+    CHECK(parse(".25") == 0.25);
+    CHECK(parse("-12345.6789e-3") == -12.3456789);
+    CHECK(parse("0.1") == 0.1);
+    CHECK(parse("1e23") == 1e23);
+    CHECK(parse("9007199254740993") == 9007199254740992.0);         // halfway, rounds to even
+    CHECK(parse("1.7976931348623157e308") == DBL_MAX);
+    CHECK(parse("1.7976931348623159e308") == INFINITY);
+    CHECK(parse("2.2250738585072011e-308") == 2.2250738585072011e-308);
+    CHECK(parse("4.9e-324") == 4.9e-324);
+    CHECK(parse("2.4703282292062328e-324") == 4.9e-324);
+    CHECK(parse("2.4703282292062327e-324") == 0.0);
+    CHECK(parse("1e-400") == 0.0);
+    CHECK(parse("1e400") == INFINITY);
+    CHECK(parse("0.000000000000000000000000000001e30") == 1.0);
+    CHECK(parse("3.14159265358979323846264338327950288") == 3.141592653589793);
+
+    double d;
+    CHECK(ParseDouble("12.5e+"_sl, d) == 4);                       // 'e' isn't part of it
+    CHECK(d == 12.5);
+    CHECK(ParseDouble("7,"_sl, d) == 1);
+    CHECK(ParseDouble("-"_sl, d) == 0);
+    CHECK(ParseDouble("."_sl, d) == 0);
+    CHECK(ParseDouble("x"_sl, d) == 0);
+
+    CHECK(IsEightDigits("01234567"));
+    CHECK(ParseEightDigits("01234567") == 1234567);
+    CHECK(ParseEightDigits("99999999") == 99999999);
+    CHECK(!IsEightDigits("0123456/"));
+    CHECK(!IsEightDigits("0123:567"));
+
+    // Compare with strtod on random numbers, of random precision and magnitude:
+    std::mt19937_64 rng(42);
+    char str[64];
+    for (int i = 0; i < 200000; ++i) {
+        double n;
+        if (i % 2) {
+            uint64_t bits = rng();
+            memcpy(&n, &bits, sizeof(n));
+            if (!isfinite(n))
+                continue;
+            WriteFloat(n, str, sizeof(str));
+        } else {
+            snprintf(str, sizeof(str), "%llu.%llue%d", (unsigned long long)(rng() >> (rng() % 64)),
+                     (unsigned long long)(rng() % 1000000), int(rng() % 700) - 350);
+            n = strtod(str, nullptr);
+        }
+        double result;
+        if (ParseDouble(slice(str), result) != strlen(str) || memcmp(&result, &n, sizeof(n)) != 0)
+            FAIL("ParseDouble(\"" << str << "\") returned " << result);
+    }
+}
+
+
+TEST_CASE("Writer chunks") {
+    static constexpr size_t kPieceSize = 1000, kPieceCount = 3000;
+    char piece[kPieceSize];
+    auto writeAll = [&](Writer &w) {
+        for (size_t i = 0; i < kPieceCount; ++i) {
+            memset(piece, 'a' + i % 26, kPieceSize);
+            w.write(piece, kPieceSize);
+        }
+        return w.output();
+    };
+
+    set<const void*> freedChunks;
+    {
+        Writer w;
+        auto chunks = writeAll(w);
+        CHECK(w.length() == kPieceSize * kPieceCount);
+        // Chunks grow geometrically to kMaxChunkSize, so there aren't many of them:
+        CHECK(chunks.size() < 16);
+        for (auto &chunk : chunks) {
+            CHECK(chunk.size <= Writer::kMaxChunkSize);
+            freedChunks.insert(chunk.buf);
+        }
+        alloc_slice output = w.finish();
+        for (size_t i = 0; i < kPieceCount; ++i)
+            REQUIRE(output[i * kPieceSize] == 'a' + i % 26);
+    }
+    {
+        // Another Writer on this thread reuses the chunks the first one freed:
+        Writer w;
+        auto chunks = writeAll(w);
+        size_t reused = count_if(chunks.begin(), chunks.end(),
+                                 [&](slice chunk) {return freedChunks.count(chunk.buf) > 0;});
+        CHECK(reused > 0);
+        CHECK(w.copyOutput().size == kPieceSize * kPieceCount);
+    }
+}
+
+
+TEST_CASE("Huge pages") {
+    CHECK(heap::hugePageThreshold() == 0);
+    alloc_slice big(16 << 20);
+    CHECK(!heap::adviseHugePages(big.buf, big.size));       // disabled by default
+
+    FLSetHugePageThreshold(4 << 20);
+    CHECK(heap::hugePageThreshold() == 4 << 20);
+    CHECK(!heap::adviseHugePages(big.buf, 1 << 20));        // too small
+#if !defined(__linux__)
+    CHECK(!heap::adviseHugePages(big.buf, big.size));
+#endif
+
+    // Writer chunks grow bigger, so they can contain huge pages:
+    {
+        Writer w;
+        std::string piece(100000, 'h');
+        for (int i = 0; i < 300; ++i)
+            w.write(piece.data(), piece.size());
+        size_t biggest = 0;
+        for (slice chunk : w.output())
+            biggest = max(biggest, chunk.size);
+        CHECK(biggest > Writer::kMaxChunkSize);
+        CHECK(biggest <= Writer::kMaxHugeChunkSize);
+        alloc_slice output = w.finish();
+        CHECK(output.size == 300 * piece.size());
+        CHECK(output[output.size - 1] == 'h');
+    }
+    FLSetHugePageThreshold(0);
+}
+
+
+TEST_CASE("Executor") {
+    SECTION("parallelFor") {
+        constexpr size_t kCount = 10000;
+        std::vector<std::atomic<int>> calls(kCount);
+        Executor::parallelFor(kCount, 0, [&](size_t i) {++calls[i];});
+        for (size_t i = 0; i < kCount; ++i)
+            CHECK(calls[i] == 1);
+        Executor::parallelFor(0, 4, [&](size_t) {FAIL("Called with empty range");});
+    }
+    SECTION("Exceptions") {
+        std::atomic<size_t> nCalls {0};
+        CHECK_THROWS_AS(Executor::parallelFor(1000, 4, [&](size_t i) {
+            ++nCalls;
+            if (i == 10)
+                throw std::runtime_error("oops");
+        }), std::runtime_error);
+        CHECK(nCalls < 1000);
+    }
+    SECTION("Nested") {
+        // More outer tasks than threads, each waiting on inner tasks, mustn't deadlock:
+        std::atomic<size_t> total {0};
+        unsigned n = 4 * Executor::current().concurrency();
+        Executor::parallelFor(n, n, [&](size_t) {
+            Executor::parallelFor(100, n, [&](size_t) {++total;});
+        });
+        CHECK(total == n * 100);
+    }
+    SECTION("Custom Executor") {
+        // A C executor that runs each task on a new thread:
+        std::atomic<int> nSubmits {0};
+        FLExecutor executor = {};
+        executor.submit = [](void *context, void (*task)(void*), void *taskContext) {
+            ++*(std::atomic<int>*)context;
+            std::thread([=] {task(taskContext);}).detach();
+        };
+        executor.concurrency = 3;
+        executor.context = &nSubmits;
+        FLSetExecutor(&executor);
+        CHECK(Executor::current().concurrency() == 3);
+        CHECK(Executor::resolveThreads(0) == 3);
+
+        std::atomic<size_t> total {0};
+        FLExecutor_ParallelFor(100, 0, [](void *context, size_t i) {
+            *(std::atomic<size_t>*)context += i;
+        }, &total);
+        CHECK(total == 4950);
+        CHECK(nSubmits == 2);
+
+        // Fleece's parallel operations go through it too:
+        using namespace fleece::impl;
+        Retained<Doc> doc = Doc::fromJSON("{\"n\":1}"_sl);
+        std::vector<const Value*> olds(100, doc->root());
+        std::vector<slice> deltas(100, "{\"n\":2}"_sl);
+        std::vector<alloc_slice> results(olds.size());
+        CHECK(JSONDelta::applyMany(olds.size(), olds.data(), deltas.data(), false,
+                                   results.data(), nullptr, 0) == 0);
+        CHECK(nSubmits == 4);
+        CHECK(Value::fromData(results[99])->toJSONString() == "{\"n\":2}");
+
+        FLSetExecutor(nullptr);
+        CHECK(&Executor::current() != nullptr);
+        CHECK(Executor::current().concurrency() == max(thread::hardware_concurrency(), 1u));
+    }
+}
+
+
+TEST_CASE("Backtrace") {
+    void* pcs[20];
+    unsigned n = Backtrace::captureRaw(pcs, 20);
+    REQUIRE(n > 0);
+    CHECK(n <= 20);
+    // Skipping frames drops them from the top:
+    void* skipped[20];
+    unsigned nSkipped = Backtrace::captureRaw(skipped, 20, 1);
+    REQUIRE(nSkipped > 0);
+    if (n > 1)
+        CHECK(skipped[0] == pcs[1]);
+    CHECK(Backtrace::captureRaw(pcs, 0) == 0);
+
+    Backtrace bt(pcs, n);
+    CHECK(bt.size() == n);
+    string str = bt.toString();
+    CHECK(!str.empty());
+    CHECK(bt.toString() == str);            // second time comes from the symbol cache
+    auto frame = bt.getFrame(0);
+    if (frame.pc)
+        CHECK(frame.pc == pcs[0]);
+
+    auto captured = Backtrace::capture(0, 5);
+    CHECK(captured->size() > 0);
+    CHECK(captured->size() <= 5);
+}
+
+
+TEST_CASE("InstanceCounted") {
+    struct Counted : InstanceCounted { int n = 0; };
+    int baseCount = InstanceCounted::liveInstanceCount();
+    {
+        vector<Counted> objects(10);
+        CHECK(InstanceCounted::liveInstanceCount() == baseCount + 10);
+        // Moving and copying count like constructing; objects destructed on other threads
+        // are subtracted from the total, whichever shard they were added to:
+        Counted moved(std::move(objects[0]));
+        auto copies = new vector<Counted>(objects);
+        CHECK(InstanceCounted::liveInstanceCount() == baseCount + 21);
+        thread([&] {delete copies;}).join();
+        CHECK(InstanceCounted::liveInstanceCount() == baseCount + 11);
+    }
+    CHECK(InstanceCounted::liveInstanceCount() == baseCount);
+
+    size_t baseSampled = InstanceCounted::sampledInstanceCount();
+    InstanceCounted::setSampling(4);
+    auto objects = make_unique<vector<Counted>>(40);
+    InstanceCounted::setSampling(0);
+    CHECK(InstanceCounted::sampledInstanceCount() == baseSampled + 10);
+    {
+        Counted unsampled;
+        CHECK(InstanceCounted::sampledInstanceCount() == baseSampled + 10);
+    }
+    size_t found = 0;
+    InstanceCounted::eachSampledInstance([&](const void *address, const Backtrace &bt) {
+        if (address >= objects->data() && address < objects->data() + objects->size()) {
+            ++found;
+            CHECK(bt.size() > 0);
+        }
+    });
+    CHECK(found == 10);
+    objects.reset();
+    CHECK(InstanceCounted::sampledInstanceCount() == baseSampled);
+}
+
+
+TEST_CASE("ConcurrentArena", "[ConcurrentMap]") {
+    SECTION("Fixed") {
+        ConcurrentArena arena(100);
+        CHECK(arena.capacity() == 100);
+        void *a = arena.alloc(60);
+        CHECK(a);
+        CHECK(!arena.alloc(60));
+        void *b = arena.alloc(40);
+        CHECK(b == offsetby(a, 60));
+        CHECK(!arena.free(a, 60));              // not the last block
+        CHECK(arena.free(b, 40));
+        CHECK(arena.allocated() == 60);
+        CHECK(arena.toPointer(arena.toOffset(b)) == b);
+    }
+    SECTION("Growable") {
+        ConcurrentArena arena(100, true);
+        vector<void*> blocks;
+        for (int i = 0; i < 1000; ++i) {
+            auto block = arena.alloc(60);
+            REQUIRE(block);
+            memset(block, i & 0xFF, 60);
+            blocks.push_back(block);
+        }
+        CHECK(arena.capacity() >= 60000);
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(arena.toPointer(arena.toOffset(blocks[i])) == blocks[i]);
+            REQUIRE(((uint8_t*)blocks[i])[59] == (i & 0xFF));
+        }
+        CHECK(!arena.alloc(ConcurrentArena::kMaxSegmentSize + 1));
+    }
+    SECTION("Thread buffers") {
+        static constexpr int kThreads = 4, kBlocks = 20000;
+        ConcurrentArena arena(4096, true, 1024);
+        auto fill = [&](uint8_t tag) {
+            vector<uint8_t*> blocks;
+            for (int i = 0; i < kBlocks; ++i) {
+                size_t size = 1 + i % 32;
+                auto block = (uint8_t*)arena.alloc(size);
+                if (!block)
+                    throw runtime_error("ConcurrentArena overflow");
+                memset(block, tag, size);
+                blocks.push_back(block);
+                if (i % 10 == 0 && !arena.free(block, size))   // last block is freeable
+                    throw runtime_error("ConcurrentArena couldn't free last block");
+                else if (i % 10 == 0)
+                    blocks.pop_back();
+            }
+            // If any other thread was given the same space, it would have overwritten my tag:
+            for (int i = 0; i < int(blocks.size()); ++i)
+                if (blocks[i][0] != tag)
+                    throw runtime_error("ConcurrentArena gave out the same block twice");
+        };
+        vector<future<void>> futures;
+        for (int t = 0; t < kThreads; ++t)
+            futures.push_back(async(launch::async, fill, uint8_t('A' + t)));
+        for (auto &f : futures)
+            f.get();
+        CHECK(arena.allocated() >= kThreads * kBlocks * 8);
+    }
+}
+
+
 TEST_CASE("ConcurrentMap basic", "[ConcurrentMap]") {
     ConcurrentMap map(2048);
     cout << "table size = " << map.tableSize() << ", capacity = " << map.capacity()
@@ -268,6 +1069,111 @@ TEST_CASE("ConcurrentMap concurrency", "[ConcurrentMap]") {
 }
 
 
+TEST_CASE("ConcurrentMap growth", "[ConcurrentMap]") {
+    static constexpr int kSize = 100000;
+    ConcurrentMap map(16, 64);
+    int initialTableSize = map.tableSize(), initialStrings = map.stringBytesCapacity();
+
+    vector<string> keys;
+    for (int i = 0; i < kSize; i++)
+        keys.push_back("key-" + to_string(i * 7919));
+
+    SECTION("Single-threaded") {
+        for (int i = 0; i < kSize; i++) {
+            auto e = map.insert(keys[i], i);
+            REQUIRE(e.key == slice(keys[i]));
+            REQUIRE(e.value == i);
+        }
+        CHECK(map.count() == kSize);
+        CHECK(map.capacity() >= kSize);
+        CHECK(map.tableSize() > initialTableSize);
+        CHECK(map.stringBytesCapacity() > initialStrings);
+
+        for (int i = 0; i < kSize; i += 2)
+            CHECK(map.remove(keys[i]));
+        for (int i = 0; i < kSize; i++) {
+            auto e = map.find(keys[i]);
+            if (i % 2) {
+                REQUIRE(e.key == slice(keys[i]));
+                REQUIRE(e.value == i);
+            } else {
+                REQUIRE(!e.key);
+            }
+        }
+        CHECK(map.count() == kSize / 2);
+    }
+
+    SECTION("Concurrent") {
+        // Four writers insert interleaved keys while a reader checks that keys don't vanish
+        // while the table is migrated:
+        static constexpr int kWriters = 4;
+        atomic<int> inserted[kWriters];     // the last key each writer inserted
+        for (auto &n : inserted)
+            n = -1;
+        auto writer = [&](int w) {
+            for (int i = w; i < kSize; i += kWriters) {
+                auto e = map.insert(keys[i], i);
+                if (e.key != slice(keys[i]) || e.value != i)
+                    throw runtime_error("ConcurrentMap insert failed");
+                inserted[w] = i;
+            }
+        };
+        auto reader = [&]() {
+            for (int pass = 0; pass < 20; ++pass) {
+                for (int w = 0; w < kWriters; ++w) {
+                    for (int i = w; i <= inserted[w]; i += kWriters) {
+                        auto e = map.find(keys[i]);
+                        if (e.key != slice(keys[i]) || e.value != i)
+                            throw runtime_error("ConcurrentMap lost a key");
+                    }
+                }
+            }
+        };
+
+        vector<future<void>> futures;
+        futures.push_back(async(launch::async, reader));
+        for (int w = 0; w < kWriters; ++w)
+            futures.push_back(async(launch::async, writer, w));
+        for (auto &f : futures)
+            f.get();
+
+        CHECK(map.count() == kSize);
+        for (int i = 0; i < kSize; i++) {
+            auto e = map.find(keys[i]);
+            REQUIRE(e.key == slice(keys[i]));
+            REQUIRE(e.value == i);
+        }
+    }
+}
+
+
+TEST_CASE("InternedStrings", "[ConcurrentMap]") {
+    InternedStrings strings(100, 8);
+    CHECK(strings.count() == 0);
+    CHECK(!strings.find("apple"));
+
+    string apple1 = "apple", apple2 = "apple";
+    slice interned = strings.intern(slice(apple1));
+    CHECK(interned == "apple"_sl);
+    CHECK(interned.buf != apple1.data());
+    CHECK(strings.intern(slice(apple2)).buf == interned.buf);
+    CHECK(strings.find("apple").buf == interned.buf);
+    CHECK(strings.count() == 1);
+
+    CHECK(strings.intern(""_sl) == ""_sl);
+    CHECK(!strings.intern(nullslice));
+    CHECK(!strings.intern("too long to intern"_sl));
+    CHECK(!strings.intern("a\0b"_sl));
+    CHECK(strings.count() == 2);
+
+    // When it's full, new strings aren't interned but existing ones are still found:
+    for (int i = 0; strings.count() < strings.maxCount(); ++i)
+        REQUIRE(strings.intern(slice(to_string(i))));
+    CHECK(!strings.intern("new"_sl));
+    CHECK(strings.intern("apple"_sl).buf == interned.buf);
+}
+
+
 #pragma mark - SMALLVECTOR:
 
 
@@ -316,3 +1222,38 @@ TEST_CASE("SmallVector, big", "[SmallVector]") {
     CHECK(movedStrings[1] == "string 2"_sl);
     CHECK(movedStrings[2] == "string 3"_sl);
 }
+
+
+TEST_CASE("Benchmark statistics", "[Support]") {
+    Benchmark bench;
+    bench.setWarmup(2);
+    for (int i = 0; i < 102; ++i) {
+        bench.start();
+        bench.stop();
+    }
+    CHECK(!bench.empty());
+    CHECK(bench.range().second >= bench.percentile(99));
+    CHECK(bench.percentile(99) >= bench.percentile(90));
+    CHECK(bench.percentile(90) >= bench.percentile(50));
+    CHECK(bench.percentile(50) == bench.median());
+
+    std::string json = bench.json("empty", 1.0);
+    CHECK(json.find("\"name\":\"empty\"") != std::string::npos);
+    CHECK(json.find("\"runs\":100,") != std::string::npos);     // (warmup runs not counted)
+    CHECK(json.find("\"p99\":") != std::string::npos);
+    CHECK(json.back() == '}');
+
+    // Hardware counters may not be allowed; if they are, they should count something:
+    if (bench.enableCounters()) {
+        bench.reset();
+        for (int i = 0; i < 10; ++i) {
+            bench.start();
+            volatile int sum = 0;
+            for (int j = 0; j < 1000; ++j)
+                sum = sum + j;
+            bench.stop();
+        }
+        CHECK(bench.counterMedian(Benchmark::kInstructions) > 0);
+        CHECK(bench.json("loop").find("\"instructions\":") != std::string::npos);
+    }
+}
@@ -27,8 +27,15 @@
 #include "DeepIterator.hh"
 #include "SharedKeys.hh"
 #include "Doc.hh"
+#include "DocCache.hh"
+#include "ReplicatedDoc.hh"
+#include "Encoder.hh"
+#include "Path.hh"
+#include <future>
 #include <iostream>
+#include <set>
 #include <sstream>
+#include <thread>
 
 #undef NOMINMAX
 
@@ -98,6 +105,32 @@ namespace fleece {
         std::cerr << "\n";
     }
 
+    TEST_CASE("VarInt bulk read") {
+        std::vector<uint64_t> numbers;
+        for (double d = 0.0; d <= UINT64_MAX; d = std::max(d, 1.0) * 1.5)
+            numbers.push_back((uint64_t)d);
+        numbers.push_back(UINT64_MAX);
+        std::vector<uint8_t> buf(numbers.size() * kMaxVarintLen64);
+        size_t size = 0;
+        for (auto n : numbers)
+            size += PutUVarInt(&buf[size], n);
+
+        std::vector<uint64_t> result(numbers.size());
+        CHECK(GetUVarInts(slice(buf.data(), size), result.data(), numbers.size()) == size);
+        CHECK(result == numbers);
+        CHECK(GetUVarInts(slice(buf.data(), size - 1), result.data(), numbers.size()) == 0);
+
+        // Numbers that don't fit in 32 bits make GetUVarInts32 fail:
+        std::vector<uint32_t> result32(numbers.size());
+        CHECK(GetUVarInts32(slice(buf.data(), size), result32.data(), numbers.size()) == 0);
+        size_t n32 = 0, size32 = 0;
+        while (numbers[n32] <= UINT32_MAX)
+            size32 += SizeOfVarInt(numbers[n32++]);
+        CHECK(GetUVarInts32(slice(buf.data(), size32), result32.data(), n32) == size32);
+        for (size_t i = 0; i < n32; ++i)
+            CHECK(result32[i] == numbers[i]);
+    }
+
     TEST_CASE("Constants") {
         CHECK(Value::kNullValue->type() == kNull);
         CHECK(!Value::kNullValue->isUndefined());
@@ -177,6 +210,217 @@ namespace fleece {
     }
 
 
+    TEST_CASE("Value visit") {
+        auto input = readTestFile("1person.fleece");
+        auto person = Value::fromData(input);
+
+        // Visits the same values, with the same keys, as a DeepIterator:
+        std::set<std::pair<std::string,const Value*>> visited, iterated;
+        size_t nVisited = 0, nIterated = 0;
+        person->visit([&](const Value *value, slice key, uint32_t index) {
+            visited.insert({key ? std::string(key) : std::to_string(index), value});
+            ++nVisited;
+            return true;
+        });
+        for (DeepIterator i(person); i; ++i) {
+            slice key = i.keyString();
+            iterated.insert({key ? std::string(key) : std::to_string(i.index()), i.value()});
+            ++nIterated;
+        }
+        CHECK(nVisited == nIterated);
+        CHECK(visited == iterated);
+
+        // Skipping children:
+        std::vector<std::string> keys;
+        person->visit([&](const Value *value, slice key, uint32_t index) {
+            if (value != person)
+                keys.push_back(std::string(key));
+            return value == person;
+        });
+        CHECK(keys.size() == person->asDict()->count());
+        CHECK(keys.front() == "_id");
+        CHECK(keys.back() == "type");
+    }
+
+
+    TEST_CASE("Value containsString") {
+        Encoder enc;
+        enc.beginDictionary();
+        enc.writeKey("name");
+        enc.writeString("Amelia Bedelia");
+        enc.writeKey("notes");
+        enc.beginArray();
+        enc.writeString("Thinks literally");
+        enc.writeData("binary Bedelia"_sl);
+        enc.writeString("Works for the Rogers family");
+        enc.endArray();
+        enc.writeKey("keyword");
+        enc.writeInt(17);
+        enc.endDictionary();
+        Retained<Doc> doc = enc.finishDoc();
+        const Value *root = doc->root();
+
+        CHECK(root->containsString("Bedelia"_sl));
+        CHECK(root->containsString("Rogers"_sl));
+        CHECK(!root->containsString("Amelia Bedelia!"_sl));
+        CHECK(!root->containsString("Zebra"_sl));
+        CHECK(!root->containsString("keyword"_sl));
+        CHECK(root->containsString("keyword"_sl, Value::kSearchKeys));
+        CHECK(!root->containsString("binary"_sl));
+        CHECK(root->containsString("binary"_sl, Value::kSearchData));
+        CHECK(root->asDict()->get("notes"_sl)->containsString("Rogers"_sl));
+        CHECK(!root->asDict()->get("notes"_sl)->containsString("Amelia"_sl));
+
+        std::vector<std::string> paths;
+        CHECK(root->containsString("e"_sl, Value::kSearchStrings | Value::kSearchKeys, &paths));
+        CHECK(paths == (std::vector<std::string>{".keyword", ".name", ".notes",
+                                                 ".notes[0]", ".notes[2]"}));
+        paths.clear();
+        CHECK(!root->containsString("Zebra"_sl, Value::kSearchStrings, &paths));
+        CHECK(paths.empty());
+    }
+
+
+    TEST_CASE("Value patchInPlace") {
+        auto encode = [](bool checksum) {
+            Encoder enc;
+            enc.checksum(checksum);
+            enc.beginDictionary();
+            enc.writeKey("count");  enc.writeInt(5);
+            enc.writeKey("flag");   enc.writeBool(false);
+            enc.writeKey("big");    enc.writeInt(100000);
+            enc.writeKey("ratio");  enc.writeDouble(2.5);
+            enc.writeKey("pi");     enc.writeDouble(3.14159265358979);
+            enc.writeKey("name");   enc.writeString("Zegpold");
+            enc.writeKey("list");
+            enc.beginArray(); enc.writeInt(1); enc.writeInt(2); enc.endArray();
+            enc.endDictionary();
+            return enc.finish();
+        };
+        // Scalars to patch in:
+        std::vector<alloc_slice> scalars;
+        auto scalar = [&](auto n) {
+            Encoder enc;
+            enc << n;
+            scalars.push_back(enc.finish());
+            return Value::fromData(scalars.back());
+        };
+
+        Retained<Doc> doc = new Doc(encode(false), Doc::kTrusted);
+        const Value *root = doc->root();
+        const Dict *dict = root->asDict();
+        auto patch = [&](const char *path, const Value *newValue) {
+            return root->patchInPlace(Path(path), newValue);
+        };
+
+        CHECK(patch("count", scalar(6)));
+        CHECK(dict->get("count"_sl)->asInt() == 6);
+        CHECK(!patch("count", scalar(100000)));             // too big for a small int
+        CHECK(dict->get("count"_sl)->asInt() == 6);
+        CHECK(patch("flag", Value::kTrueValue));
+        CHECK(dict->get("flag"_sl)->asBool());
+
+        CHECK(patch("big", scalar(-200000)));               // same 3 bytes
+        CHECK(dict->get("big"_sl)->asInt() == -200000);
+        CHECK(!patch("big", scalar(10000000000)));          // needs 5 bytes
+        CHECK(patch("big", scalar(7)));
+        CHECK(dict->get("big"_sl)->asInt() == 7);
+
+        CHECK(patch("ratio", scalar(0.75)));                // float
+        CHECK(dict->get("ratio"_sl)->asDouble() == 0.75);
+        CHECK(!patch("ratio", scalar(0.1)));                // not representable as a float
+        CHECK(patch("pi", scalar(1e300)));                  // double
+        CHECK(dict->get("pi"_sl)->asDouble() == 1e300);
+        CHECK(!patch("pi", scalar(7)));                     // an int doesn't replace a double
+
+        CHECK(patch("list[-1]", scalar(-2048)));
+        CHECK(dict->get("list"_sl)->asArray()->get(1)->asInt() == -2048);
+
+        CHECK(!patch("name", scalar(1)));                   // not a number
+        CHECK(!patch("missing", scalar(1)));
+        CHECK(!patch("list[*]", scalar(1)));                // not single-valued
+        CHECK(Value::fromData(doc->data()) != nullptr);     // still valid
+
+        // Patching would invalidate a checksum:
+        Retained<Doc> checksummed = new Doc(encode(true), Doc::kTrusted);
+        CHECK(!checksummed->root()->patchInPlace(Path("count"), scalar(6)));
+    }
+
+    TEST_CASE("visitParallel") {
+        // A dict with a large array of dicts, a large dict, and a small array:
+        Encoder enc;
+        enc.beginDictionary();
+        enc.writeKey("rows");
+        enc.beginArray();
+        for (int i = 0; i < 5000; ++i) {
+            enc.beginDictionary();
+            enc.writeKey("n");  enc.writeInt(i);
+            enc.writeKey("tags");
+            enc.beginArray(); enc.writeInt(i); enc.writeInt(i); enc.endArray();
+            enc.endDictionary();
+        }
+        enc.endArray();
+        enc.writeKey("index");
+        enc.beginDictionary();
+        for (int i = 0; i < 2000; ++i) {
+            enc.writeKey(std::to_string(i));
+            enc.writeInt(i);
+        }
+        enc.endDictionary();
+        enc.writeKey("small");
+        enc.beginArray(); enc.writeInt(1); enc.endArray();
+        enc.endDictionary();
+        alloc_slice data = enc.finish();
+        const Value *root = Value::fromData(data);
+
+        // Each visitor counts values, and checks that each integer is consistent with its path:
+        struct Counter : public ParallelVisitor {
+            size_t count = 0, bad = 0;
+            int64_t sum = 0;
+            bool visit(const Value *value, const DeepIterator::Path &path) override {
+                ++count;
+                if (value->type() == kNumber) {
+                    sum += value->asInt();
+                    if (path[0].key == "rows"_sl) {
+                        if (path.size() < 3 || value->asInt() != path[1].index)
+                            ++bad;
+                    } else if (path[0].key == "index"_sl) {
+                        if (path.size() != 2 || std::to_string(value->asInt()) != std::string(path[1].key))
+                            ++bad;
+                    }
+                }
+                return path.empty() || path[0].key != "small"_sl;   // (skips small's items)
+            }
+        };
+
+        for (unsigned nThreads : {1u, 4u, 0u}) {
+            INFO("nThreads = " << nThreads);
+            auto visitors = visitParallel(root, [] {return std::make_unique<Counter>();},
+                                          nThreads);
+            CHECK(visitors.size() == (nThreads == 1 ? 1 : (nThreads ? nThreads : std::max(std::thread::hardware_concurrency(), 1u))));
+            size_t count = 0, bad = 0;
+            int64_t sum = 0;
+            for (auto &v : visitors) {
+                auto counter = (Counter*)v.get();
+                count += counter->count;
+                bad += counter->bad;
+                sum += counter->sum;
+            }
+            CHECK(count == 1 + (1 + 5000 * 5) + (1 + 2000) + 1);
+            CHECK(bad == 0);
+            CHECK(sum == 3 * (4999 * 5000 / 2) + (1999 * 2000 / 2));
+        }
+
+        // Small and scalar roots are visited serially:
+        auto visitors = visitParallel(root->asDict()->get("small"_sl),
+                                      [] {return std::make_unique<Counter>();}, 4);
+        REQUIRE(visitors.size() == 1);
+        CHECK(((Counter*)visitors[0].get())->count == 2);
+        visitors = visitParallel(nullptr, [] {return std::make_unique<Counter>();}, 4);
+        CHECK(((Counter*)visitors[0].get())->count == 0);
+    }
+
+
     TEST_CASE("Doc", "[SharedKeys]") {
         const Dict *root;
         {
@@ -217,4 +461,247 @@ namespace fleece {
         CHECK(Doc::sharedKeys(root) == nullptr);
     }
 
+
+    TEST_CASE("Doc reinit", "[SharedKeys]") {
+        alloc_slice data1 = Doc::fromJSON("{\"n\":1}"_sl)->allocedData();
+        alloc_slice data2 = Doc::fromJSON("[2,\"two\"]"_sl)->allocedData();
+        Retained<SharedKeys> sk = new SharedKeys();
+        Retained<Doc> doc = new Doc(data1);
+        CHECK(Doc::containing(doc->root()).get() == doc);
+
+        doc->reinit(data2, Doc::kUntrusted, sk);
+        REQUIRE(doc->asArray());
+        CHECK(doc->data() == data2);
+        CHECK(doc->sharedKeys() == sk);
+        CHECK(Doc::containing(doc->root()).get() == doc);
+        CHECK(Doc::containing(Value::fromData(data1)).get() == nullptr);  // old data is unregistered
+        CHECK(doc->asArray()->get(1)->asString() == "two"_sl);
+
+        // Invalid data leaves it without a root or a registered range; then it can be reused:
+        doc->reinit(alloc_slice("nope"));
+        CHECK(doc->root() == nullptr);
+        doc->reinit(data1, Doc::kTrusted);
+        REQUIRE(doc->asDict());
+        CHECK(doc->asDict()->get("n"_sl)->asInt() == 1);
+        CHECK(Doc::containing(doc->root()).get() == doc);
+    }
+
+
+    TEST_CASE("ReplicatedDoc", "[SharedKeys]") {
+        Retained<SharedKeys> sk = new SharedKeys();
+        Retained<Doc> doc = Doc::fromJSON("{\"name\":\"Replicant\",\"n\":[1,2,3]}"_sl, sk);
+        CHECK(ReplicatedDoc::numaNodeCount() >= 1);
+        CHECK(ReplicatedDoc::currentNumaNode() < ReplicatedDoc::numaNodeCount());
+
+        Retained<ReplicatedDoc> replicated = new ReplicatedDoc(doc, 3);
+        REQUIRE(replicated->replicaCount() == 3);
+        CHECK(replicated->replica(0) == doc);
+        for (unsigned node = 1; node < 3; ++node) {
+            const Doc *replica = replicated->replica(node);
+            CHECK(replica->data() == doc->data());
+            CHECK(replica->data().buf != doc->data().buf);
+            CHECK(replica->sharedKeys() == sk);
+            CHECK(replica->root()->isEqual(doc->root()));
+            // Values in the replica resolve to it:
+            CHECK(Doc::containing(replica->asDict()->get("n"_sl)).get() == replica);
+        }
+        const Doc *local = replicated->local();
+        CHECK(local == replicated->replica(ReplicatedDoc::currentNumaNode() % 3));
+        CHECK(replicated->root()->asDict()->get("name"_sl)->asString() == "Replicant"_sl);
+
+        // By default there's one replica per node, and with one node that's the original:
+        Retained<ReplicatedDoc> perNode = new ReplicatedDoc(doc);
+        CHECK(perNode->replicaCount() == ReplicatedDoc::numaNodeCount());
+        if (perNode->replicaCount() == 1)
+            CHECK(perNode->local() == doc);
+    }
+
+
+    TEST_CASE("DocCache", "[SharedKeys]") {
+        auto makeData = [](int n) {
+            Encoder enc;
+            enc.beginArray();
+            for (int i = 0; i < 100; ++i)
+                enc.writeInt(n * 1000 + i);
+            enc.endArray();
+            return enc.finish();
+        };
+        alloc_slice data1 = makeData(1);
+        size_t docSize = Retained<Doc>(new Doc(data1))->memoryUsage();
+
+        DocCache cache(20 * (docSize + 200), 1);
+        CHECK(cache.get("one"_sl).get() == nullptr);
+        Retained<Doc> doc1 = new Doc(data1);
+        CHECK(cache.put("one"_sl, doc1).get() == doc1);
+        CHECK(cache.get("one"_sl).get() == doc1);
+        CHECK(cache.count() == 1);
+        CHECK(cache.bytesUsed() >= docSize);
+
+        // getOrCreate only creates on a miss:
+        int created = 0;
+        auto create = [&] {++created; return retained(new Doc(makeData(2)));};
+        Retained<Doc> doc2 = cache.getOrCreate("two"_sl, create);
+        CHECK(cache.getOrCreate("two"_sl, create).get() == doc2);
+        CHECK(created == 1);
+        CHECK(doc2->asArray()->get(0)->asInt() == 2000);
+
+        // Keyed by content; the same data in another buffer finds the same Doc:
+        Retained<Doc> byContent = cache.getOrCreateFromData(makeData(3));
+        REQUIRE(byContent);
+        CHECK(cache.getOrCreateFromData(makeData(3)).get() == byContent);
+        CHECK(cache.getOrCreateFromData(makeData(4)).get() != byContent);
+        CHECK(cache.getOrCreateFromData(alloc_slice("nope")).get() == nullptr);
+        CHECK(cache.get("three"_sl).get() == nullptr);         // IDs and content keys are separate
+
+        // Native objects:
+        auto native = std::make_shared<std::string>("native tree");
+        CHECK(cache.setNative("one"_sl, doc1, native, 100));
+        CHECK(!cache.setNative("one"_sl, doc2, native, 100));
+        CHECK(!cache.setNative("nope"_sl, doc1, native, 100));
+        DocCache::Entry entry = cache.getEntry("one"_sl);
+        CHECK(entry.doc == doc1);
+        CHECK(entry.native == native);
+
+        CHECK(cache.remove("one"_sl));
+        CHECK(!cache.remove("one"_sl));
+        CHECK(cache.get("one"_sl).get() == nullptr);
+        CHECK(doc1->asArray()->count() == 100);         // still retained by the test
+        CHECK(cache.hits() > 0);
+        CHECK(cache.misses() > 0);
+
+        // Going over budget evicts the least recently used:
+        for (int i = 0; i < 50; ++i) {
+            cache.put(slice(std::to_string(i)), new Doc(makeData(i)));
+            CHECK(cache.get("two"_sl).get() == doc2);         // keep it recently used
+        }
+        CHECK(cache.count() <= 20);
+        CHECK(cache.bytesUsed() <= cache.byteBudget());
+        CHECK(cache.get("two"_sl).get() == doc2);
+        CHECK(cache.get("49"_sl).get() != nullptr);
+        CHECK(cache.get("0"_sl).get() == nullptr);
+
+        cache.clear();
+        CHECK(cache.count() == 0);
+        CHECK(cache.bytesUsed() == 0);
+    }
+
+
+    TEST_CASE("DocCache concurrency", "[SharedKeys]") {
+        DocCache cache(64 * 1024);
+        std::atomic<int> created {0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t] {
+                for (int i = 0; i < 2000; ++i) {
+                    int n = (i * 7 + t) % 40;
+                    std::string id = std::to_string(n);
+                    Retained<Doc> doc = cache.getOrCreate(slice(id), [&] {
+                        ++created;
+                        Encoder enc;
+                        enc.writeInt(n);
+                        return retained(new Doc(enc.finish()));
+                    });
+                    REQUIRE(doc->root()->asInt() == n);
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        CHECK(created >= 40);
+        CHECK(cache.count() == 40);
+        CHECK(cache.hits() + cache.misses() == 8000);
+    }
+
+
+    TEST_CASE("TransientDoc", "[SharedKeys]") {
+        alloc_slice data = readTestFile("1000people.fleece");
+        TransientDoc doc(data);
+        REQUIRE(doc.asArray());
+        CHECK(doc.asArray()->count() == 1000);
+        CHECK(doc.asArray()->get(7)->asDict()->get("name"_sl)->asString().size > 0);
+        CHECK(Doc::containing(doc.root()).get() == nullptr);     // it's not registered
+
+        TransientDoc bad(alloc_slice("nope"));
+        CHECK(bad.root() == nullptr);
+    }
+
+
+    TEST_CASE("Concurrent Docs", "[SharedKeys]") {
+        // Creates and destroys Docs on several threads while others look up Values in them.
+        // (Can't use CHECK in the lambdas because Catch isn't thread-safe; using assert instead.)
+        alloc_slice data( readTestFile("1person.fleece") );
+        Retained<SharedKeys> sk = new SharedKeys();
+        Retained<Doc> doc = new Doc(data, Doc::kUntrusted, sk);
+        const Dict *root = (const Dict*)doc->root();
+        REQUIRE(root);
+
+        auto churner = [&] {
+            for (int i = 0; i < 1000; ++i) {
+                Retained<Doc> tmp = new Doc(alloc_slice(slice(data)), Doc::kUntrusted, sk);
+                assert(Doc::containing(tmp->root()).get() == tmp);
+                assert(Doc::sharedKeys(tmp->root()) == sk);
+            }
+        };
+        auto reader = [&] {
+            for (int i = 0; i < 10000; ++i) {
+                assert(Doc::containing(root).get() == doc);
+                assert(Doc::sharedKeys(root->get("_id"_sl)) == sk);
+            }
+        };
+
+        auto f1 = async(launch::async, churner);
+        auto f2 = async(launch::async, churner);
+        auto f3 = async(launch::async, reader);
+        auto f4 = async(launch::async, reader);
+        f1.wait();
+        f2.wait();
+        f3.wait();
+        f4.wait();
+        CHECK(Doc::containing(root).get() == doc);
+    }
+
+
+    TEST_CASE("Doc destroyed while another thread has it cached", "[SharedKeys]") {
+        // The Docs share the data, so it stays valid when they're gone; doc3 will be registered
+        // for the same memory as doc1 was:
+        alloc_slice data( readTestFile("1person.fleece") );
+        alloc_slice data2(slice(data).copy());
+        Retained<Doc> doc1 = new Doc(data, Doc::kUntrusted);
+        Retained<Doc> doc2 = new Doc(data2, Doc::kUntrusted);
+        const Value *root1 = doc1->root(), *root2 = doc2->root();
+        REQUIRE(root1);
+        REQUIRE(root2);
+
+        // The other thread looks up Values of both Docs, caching their Scopes, then does it again
+        // at each step; it records what it found, since Catch isn't thread-safe:
+        constexpr int kSteps = 3;
+        promise<void> advance[kSteps], done[kSteps];
+        const Doc* found1[kSteps], *found2[kSteps];
+        thread reader([&] {
+            for (int step = 0; step < kSteps; ++step) {
+                if (step > 0)
+                    advance[step].get_future().wait();
+                found1[step] = Doc::containing(root1).get();
+                found2[step] = Doc::containing(root2).get();
+                done[step].set_value();
+            }
+        });
+
+        done[0].get_future().wait();
+        const Doc *doc1Ptr = doc1;
+        doc1 = nullptr;
+        advance[1].set_value();
+        done[1].get_future().wait();
+        Retained<Doc> doc3 = new Doc(data, Doc::kUntrusted);
+        advance[2].set_value();
+        done[2].get_future().wait();
+        reader.join();
+
+        CHECK(found1[0] == doc1Ptr);
+        CHECK(found1[1] == nullptr);
+        CHECK(found1[2] == doc3);
+        for (int step = 0; step < kSteps; ++step)
+            CHECK(found2[step] == doc2);
+    }
+
 }
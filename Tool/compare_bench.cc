@@ -0,0 +1,675 @@
+//
+// compare_bench.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "fleece/Fleece.hh"
+#include "fleece/Mutable.hh"
+#include "Benchmark.hh"
+#include "simdjson.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "flatbuffers/flexbuffers.h"
+#include "nlohmann/json.hpp"
+#include <errno.h>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace fleece;
+using namespace std;
+using json = nlohmann::json;
+
+
+// Compares Fleece with other serialization libraries, doing the same operations on the same
+// data with each: JSON (simdjson and RapidJSON), FlexBuffers (the schemaless form of
+// FlatBuffers), CBOR and MessagePack (both with nlohmann/json). Built by the `compare_bench`
+// target when CMake's FLEECE_COMPARE_BENCH option is on; see Performance.md.
+
+
+static void usage(void) {
+    fprintf(stderr, "usage: compare_bench [options] [format ...]\n");
+    fprintf(stderr, "  --data FILE      JSON array of records to use (default Tests/1000people.json)\n");
+    fprintf(stderr, "  --size MB        Repeats the records to make this much JSON (default 100)\n");
+    fprintf(stderr, "  --iterations N   Timed runs of each operation (default 5)\n");
+    fprintf(stderr, "  --out FILE       Writes the JSON results to FILE instead of stdout\n");
+    fprintf(stderr, "  Formats: fleece, simdjson, rapidjson, flexbuffers, cbor, msgpack (default all)\n");
+}
+
+
+// A small, fast PRNG (splitmix64), so every format looks up the same records.
+static uint64_t nextRandom(uint64_t &state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+
+#pragma mark - ENCODING:
+
+
+// Writes a parsed JSON value to a Sink, which adapts one library's builder. Every encoder is
+// fed the same way from the same in-memory data, so only the builders' costs differ.
+template <class Sink>
+static void emit(const json &j, Sink &out) {
+    switch (j.type()) {
+        case json::value_t::array:
+            out.beginArray(j.size());
+            for (auto &item : j)
+                emit(item, out);
+            out.endArray();
+            break;
+        case json::value_t::object:
+            out.beginMap(j.size());
+            for (auto i = j.begin(); i != j.end(); ++i) {
+                out.key(i.key());
+                emit(i.value(), out);
+            }
+            out.endMap();
+            break;
+        case json::value_t::string:     out.text(j.get_ref<const string&>()); break;
+        case json::value_t::boolean:    out.boolean(j.get<bool>()); break;
+        case json::value_t::number_integer:  out.integer(j.get<int64_t>()); break;
+        case json::value_t::number_unsigned: out.uinteger(j.get<uint64_t>()); break;
+        case json::value_t::number_float:    out.real(j.get<double>()); break;
+        default:                        out.null(); break;
+    }
+}
+
+
+struct FleeceSink {
+    Encoder &enc;
+    void beginArray(size_t n)       {enc.beginArray(n);}
+    void endArray()                 {enc.endArray();}
+    void beginMap(size_t n)         {enc.beginDict(n);}
+    void endMap()                   {enc.endDict();}
+    void key(const string &k)       {enc.writeKey(fleece::slice(k));}
+    void null()                     {enc.writeNull();}
+    void boolean(bool b)            {enc.writeBool(b);}
+    void integer(int64_t i)         {enc.writeInt(i);}
+    void uinteger(uint64_t i)       {enc.writeUInt(i);}
+    void real(double d)             {enc.writeDouble(d);}
+    void text(const string &s)      {enc.writeString(fleece::slice(s));}
+};
+
+
+struct RapidJSONSink {
+    rapidjson::Writer<rapidjson::StringBuffer> &w;
+    void beginArray(size_t)         {w.StartArray();}
+    void endArray()                 {w.EndArray();}
+    void beginMap(size_t)           {w.StartObject();}
+    void endMap()                   {w.EndObject();}
+    void key(const string &k)       {w.Key(k.data(), rapidjson::SizeType(k.size()));}
+    void null()                     {w.Null();}
+    void boolean(bool b)            {w.Bool(b);}
+    void integer(int64_t i)         {w.Int64(i);}
+    void uinteger(uint64_t i)       {w.Uint64(i);}
+    void real(double d)             {w.Double(d);}
+    void text(const string &s)      {w.String(s.data(), rapidjson::SizeType(s.size()));}
+};
+
+
+struct FlexBuffersSink {
+    flexbuffers::Builder &b;
+    vector<size_t> starts {};
+    void beginArray(size_t)         {starts.push_back(b.StartVector());}
+    void endArray()                 {b.EndVector(starts.back(), false, false); starts.pop_back();}
+    void beginMap(size_t)           {starts.push_back(b.StartMap());}
+    void endMap()                   {b.EndMap(starts.back()); starts.pop_back();}
+    void key(const string &k)       {b.Key(k.c_str(), k.size());}
+    void null()                     {b.Null();}
+    void boolean(bool v)            {b.Bool(v);}
+    void integer(int64_t i)         {b.Int(i);}
+    void uinteger(uint64_t i)       {b.UInt(i);}
+    void real(double d)             {b.Double(d);}
+    void text(const string &s)      {b.String(s.c_str(), s.size());}
+};
+
+
+#pragma mark - CONTEXT:
+
+
+// The data in every format, and each format's opened form, set up before anything is timed.
+struct Context {
+    static constexpr size_t kLookups = 10000;
+
+    json                        source;         // The dataset; what the encoders write from
+    size_t                      records {0};
+    string                      jsonText;
+    simdjson::padded_string     paddedJSON;
+    vector<size_t>              picks;          // Records to look up, chosen at random
+
+    alloc_slice                 fleeceData;
+    Doc                         fleeceDoc;
+    simdjson::dom::parser       simdParser;
+    vector<simdjson::dom::element> simdRecords; // (simdjson arrays can't be indexed in O(1))
+    rapidjson::Document         rapidDoc;
+    vector<uint8_t>             flexData, cborData, msgpackData;
+    json                        cborDOM, msgpackDOM;
+
+    Context(const char *path, size_t targetSize) {
+        FILE *file = fopen(path, "rb");
+        if (!file)
+            throw runtime_error(string("can't open ") + path + ": " + strerror(errno));
+        json people = json::parse(file);
+        fclose(file);
+        if (!people.is_array() || people.empty())
+            throw runtime_error("the data must be a JSON array");
+
+        // Repeat the records until the JSON is as big as requested:
+        size_t size = people.dump().size();
+        size_t copies = max((targetSize + size - 1) / size, size_t(1));
+        source = json::array();
+        for (size_t c = 0; c < copies; ++c)
+            for (auto &person : people)
+                source.push_back(person);
+        records = source.size();
+        jsonText = source.dump();
+        paddedJSON = simdjson::padded_string(jsonText);
+
+        uint64_t state = 1;
+        for (size_t i = 0; i < kLookups; ++i)
+            picks.push_back(size_t(nextRandom(state) % records));
+
+        Encoder enc;
+        FleeceSink fleeceSink {enc};
+        emit(source, fleeceSink);
+        fleeceData = enc.finish();
+        fleeceDoc = Doc(fleeceData, kFLTrusted);
+
+        simdjson::dom::element root;
+        simdjson::dom::array array;
+        if (simdParser.parse(paddedJSON).get(root) || root.get(array))
+            throw runtime_error("simdjson couldn't parse the data");
+        for (simdjson::dom::element record : array)
+            simdRecords.push_back(record);
+
+        rapidDoc.Parse(jsonText.data(), jsonText.size());
+        if (rapidDoc.HasParseError())
+            throw runtime_error("RapidJSON couldn't parse the data");
+
+        flexbuffers::Builder builder;
+        FlexBuffersSink flexSink {builder};
+        emit(source, flexSink);
+        builder.Finish();
+        flexData = builder.GetBuffer();
+
+        cborData = json::to_cbor(source);
+        cborDOM = json::from_cbor(cborData);
+        msgpackData = json::to_msgpack(source);
+        msgpackDOM = json::from_msgpack(msgpackData);
+    }
+};
+
+
+// Keeps the compiler from optimizing away a result that's otherwise unused.
+static volatile uintptr_t sSink;
+template <class T> static void consume(T value)     {sSink = sSink + uintptr_t(value);}
+
+
+#pragma mark - TRAVERSAL:
+
+
+// Each of these visits every value, and returns the number visited.
+
+static size_t traverse(Value v) {
+    size_t n = 1;
+    switch (v.type()) {
+        case kFLArray:
+            for (Array::iterator i(v.asArray()); i; ++i)
+                n += traverse(i.value());
+            break;
+        case kFLDict:
+            for (Dict::iterator i(v.asDict()); i; ++i) {
+                consume(i.keyString().size);
+                n += traverse(i.value());
+            }
+            break;
+        case kFLString:
+            consume(v.asString().size);
+            break;
+        default:
+            consume(v.asInt());
+            break;
+    }
+    return n;
+}
+
+static size_t traverse(simdjson::dom::element e) {
+    size_t n = 1;
+    switch (e.type()) {
+        case simdjson::dom::element_type::ARRAY:
+            for (simdjson::dom::element item : simdjson::dom::array(e))
+                n += traverse(item);
+            break;
+        case simdjson::dom::element_type::OBJECT:
+            for (simdjson::dom::key_value_pair field : simdjson::dom::object(e)) {
+                consume(field.key.size());
+                n += traverse(field.value);
+            }
+            break;
+        case simdjson::dom::element_type::STRING:
+            consume(string_view(e).size());
+            break;
+        default:
+            consume(e.is_int64() ? int64_t(e) : 0);
+            break;
+    }
+    return n;
+}
+
+static size_t traverse(const rapidjson::Value &v) {
+    size_t n = 1;
+    if (v.IsArray()) {
+        for (auto &item : v.GetArray())
+            n += traverse(item);
+    } else if (v.IsObject()) {
+        for (auto &member : v.GetObject()) {
+            consume(member.name.GetStringLength());
+            n += traverse(member.value);
+        }
+    } else if (v.IsString()) {
+        consume(v.GetStringLength());
+    } else {
+        consume(v.IsInt64() ? v.GetInt64() : 0);
+    }
+    return n;
+}
+
+static size_t traverse(flexbuffers::Reference r) {
+    size_t n = 1;
+    if (r.IsMap()) {
+        auto map = r.AsMap();
+        auto keys = map.Keys();
+        auto values = map.Values();
+        for (size_t i = 0; i < values.size(); ++i) {
+            consume(strlen(keys[i].AsKey()));
+            n += traverse(values[i]);
+        }
+    } else if (r.IsVector()) {
+        auto vec = r.AsVector();
+        for (size_t i = 0; i < vec.size(); ++i)
+            n += traverse(vec[i]);
+    } else if (r.IsString()) {
+        consume(r.AsString().size());
+    } else {
+        consume(r.AsInt64());
+    }
+    return n;
+}
+
+static size_t traverse(const json &j) {
+    size_t n = 1;
+    if (j.is_array()) {
+        for (auto &item : j)
+            n += traverse(item);
+    } else if (j.is_object()) {
+        for (auto i = j.begin(); i != j.end(); ++i) {
+            consume(i.key().size());
+            n += traverse(i.value());
+        }
+    } else if (j.is_string()) {
+        consume(j.get_ref<const string&>().size());
+    } else {
+        consume(j.is_number_integer() ? j.get<int64_t>() : 0);
+    }
+    return n;
+}
+
+
+#pragma mark - FORMATS:
+
+
+// An operation runs once per timed iteration and returns the number of items it processed.
+using Operation = function<size_t(Context&)>;
+
+// The operations on one format. Those a library doesn't support are null.
+struct Format {
+    const char *name;
+    function<size_t(Context&)> dataSize;
+    Operation encode;       // Write the dataset from memory
+    Operation open;         // Parse, or validate, the encoded data so it can be read
+    Operation access;       // Look up one property of random records
+    Operation traverse;     // Visit every value
+    Operation update;       // Change one property of a record, and produce the new encoding
+};
+
+
+static const char* const kOperationNames[] = {"encode", "open", "access", "traverse", "update"};
+
+
+static const vector<Format> kFormats = {
+    {"fleece",
+        [](Context &ctx) {return ctx.fleeceData.size;},
+        [](Context &ctx) {
+            Encoder enc;
+            FleeceSink sink {enc};
+            emit(ctx.source, sink);
+            consume(enc.finish().size);
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            Doc doc(ctx.fleeceData, kFLUntrusted);
+            if (!doc.root())
+                throw runtime_error("invalid Fleece data");
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            Array root = ctx.fleeceDoc.root().asArray();
+            for (size_t i : ctx.picks)
+                consume(root.get(uint32_t(i)).asDict().get("name").asString().size);
+            return ctx.picks.size();
+        },
+        [](Context &ctx) {
+            consume(traverse(ctx.fleeceDoc.root()));
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            // Fleece can append just the changes to the existing data:
+            MutableArray root = ctx.fleeceDoc.root().asArray().mutableCopy();
+            root.getMutableDict(uint32_t(ctx.picks[0]))["age"] = 99;
+            Encoder enc;
+            enc.amend(ctx.fleeceData, true);
+            enc.writeValue(root);
+            consume(enc.finish().size);
+            return size_t(1);
+        },
+    },
+    {"simdjson",
+        [](Context &ctx) {return ctx.jsonText.size();},
+        nullptr,                                    // (simdjson only parses)
+        [](Context &ctx) {
+            simdjson::dom::parser parser;
+            simdjson::dom::element root;
+            if (parser.parse(ctx.paddedJSON).get(root))
+                throw runtime_error("simdjson parse failed");
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            for (size_t i : ctx.picks) {
+                string_view name;
+                if (!ctx.simdRecords[i]["name"].get(name))
+                    consume(name.size());
+            }
+            return ctx.picks.size();
+        },
+        [](Context &ctx) {
+            for (auto &record : ctx.simdRecords)
+                consume(traverse(record));
+            return ctx.records;
+        },
+        nullptr,                                    // (its DOM is immutable)
+    },
+    {"rapidjson",
+        [](Context &ctx) {return ctx.jsonText.size();},
+        [](Context &ctx) {
+            rapidjson::StringBuffer buffer;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+            RapidJSONSink sink {writer};
+            emit(ctx.source, sink);
+            consume(buffer.GetSize());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            rapidjson::Document doc;
+            doc.Parse(ctx.jsonText.data(), ctx.jsonText.size());
+            if (doc.HasParseError())
+                throw runtime_error("RapidJSON parse failed");
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            for (size_t i : ctx.picks) {
+                auto &record = ctx.rapidDoc[rapidjson::SizeType(i)];
+                auto name = record.FindMember("name");
+                if (name != record.MemberEnd())
+                    consume(name->value.GetStringLength());
+            }
+            return ctx.picks.size();
+        },
+        [](Context &ctx) {
+            consume(traverse(ctx.rapidDoc));
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            ctx.rapidDoc[rapidjson::SizeType(ctx.picks[0])]["age"].SetInt(99);
+            rapidjson::StringBuffer buffer;
+            rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+            ctx.rapidDoc.Accept(writer);
+            consume(buffer.GetSize());
+            return size_t(1);
+        },
+    },
+    {"flexbuffers",
+        [](Context &ctx) {return ctx.flexData.size();},
+        [](Context &ctx) {
+            flexbuffers::Builder builder;
+            FlexBuffersSink sink {builder};
+            emit(ctx.source, sink);
+            builder.Finish();
+            consume(builder.GetSize());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            if (!flexbuffers::VerifyBuffer(ctx.flexData.data(), ctx.flexData.size()))
+                throw runtime_error("invalid FlexBuffers data");
+            consume(flexbuffers::GetRoot(ctx.flexData).AsVector().size());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            auto root = flexbuffers::GetRoot(ctx.flexData).AsVector();
+            for (size_t i : ctx.picks)
+                consume(root[i].AsMap()["name"].AsString().size());
+            return ctx.picks.size();
+        },
+        [](Context &ctx) {
+            consume(traverse(flexbuffers::GetRoot(ctx.flexData)));
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            // FlexBuffers can only change a scalar in place, in a copy of the data:
+            vector<uint8_t> copy = ctx.flexData;
+            auto root = flexbuffers::GetRoot(copy).AsVector();
+            if (!root[ctx.picks[0]].AsMap()["age"].MutateInt(99))
+                throw runtime_error("FlexBuffers couldn't update the value");
+            consume(copy.size());
+            return size_t(1);
+        },
+    },
+    {"cbor",
+        [](Context &ctx) {return ctx.cborData.size();},
+        [](Context &ctx) {
+            consume(json::to_cbor(ctx.source).size());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            consume(json::from_cbor(ctx.cborData).size());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            for (size_t i : ctx.picks)
+                consume(ctx.cborDOM[i]["name"].get_ref<const string&>().size());
+            return ctx.picks.size();
+        },
+        [](Context &ctx) {
+            consume(traverse(ctx.cborDOM));
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            ctx.cborDOM[ctx.picks[0]]["age"] = 99;
+            consume(json::to_cbor(ctx.cborDOM).size());
+            return size_t(1);
+        },
+    },
+    {"msgpack",
+        [](Context &ctx) {return ctx.msgpackData.size();},
+        [](Context &ctx) {
+            consume(json::to_msgpack(ctx.source).size());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            consume(json::from_msgpack(ctx.msgpackData).size());
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            for (size_t i : ctx.picks)
+                consume(ctx.msgpackDOM[i]["name"].get_ref<const string&>().size());
+            return ctx.picks.size();
+        },
+        [](Context &ctx) {
+            consume(traverse(ctx.msgpackDOM));
+            return ctx.records;
+        },
+        [](Context &ctx) {
+            ctx.msgpackDOM[ctx.picks[0]]["age"] = 99;
+            consume(json::to_msgpack(ctx.msgpackDOM).size());
+            return size_t(1);
+        },
+    },
+};
+
+
+#pragma mark - MAIN:
+
+
+static bool parseNumber(const char *str, uint64_t &n) {
+    char *end;
+    n = strtoull(str, &end, 10);
+    return *str && *end == '\0';
+}
+
+
+int main(int argc, const char * argv[]) {
+    const char *dataPath = "Tests/1000people.json", *outPath = nullptr;
+    uint64_t sizeMB = 100;
+    unsigned iterations = 5;
+    vector<const Format*> selected;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            uint64_t n;
+            if (arg.size() > 2 && arg.compare(0, 2, "--") == 0 && i + 1 < argc) {
+                const char *value = argv[++i];
+                if (arg == "--data")
+                    dataPath = value;
+                else if (arg == "--size" && parseNumber(value, n) && n > 0 && n <= 100000)
+                    sizeMB = n;
+                else if (arg == "--iterations" && parseNumber(value, n) && n > 0 && n <= 100000)
+                    iterations = unsigned(n);
+                else if (arg == "--out")
+                    outPath = value;
+                else {
+                    usage();
+                    return 1;
+                }
+            } else {
+                auto f = find_if(kFormats.begin(), kFormats.end(),
+                                 [&](const Format &f) {return arg == f.name;});
+                if (f == kFormats.end()) {
+                    usage();
+                    return 1;
+                }
+                selected.push_back(&*f);
+            }
+        }
+        if (selected.empty()) {
+            for (auto &f : kFormats)
+                selected.push_back(&f);
+        }
+
+        fprintf(stderr, "Setting up %llu MB of data from %s...\n",
+                (unsigned long long)sizeMB, dataPath);
+        Context ctx(dataPath, size_t(sizeMB) << 20);
+
+        JSONEncoder out;
+        out.beginDict();
+        out["benchmark"_sl] = "compare_bench";
+#ifdef NDEBUG
+        out["optimized"_sl] = true;
+#else
+        out["optimized"_sl] = false;
+#endif
+        out.writeKey("dataset"_sl);
+        out.beginDict();
+        out["file"_sl] = dataPath;
+        out["records"_sl] = (unsigned long long)ctx.records;
+        out["json_size"_sl] = (unsigned long long)ctx.jsonText.size();
+        out.endDict();
+        out["iterations"_sl] = iterations;
+        out.writeKey("results"_sl);
+        out.beginArray();
+        for (auto format : selected) {
+            out.beginDict();
+            out["format"_sl] = format->name;
+            out["size"_sl] = (unsigned long long)format->dataSize(ctx);
+            const Operation* operations[] = {&format->encode, &format->open, &format->access,
+                                             &format->traverse, &format->update};
+            for (size_t op = 0; op < 5; ++op) {
+                auto &run = *operations[op];
+                if (!run)
+                    continue;
+                Benchmark bench;
+                bench.setWarmup(1);
+                size_t items = 0;
+                for (unsigned i = 0; i <= iterations; ++i) {
+                    bench.start();
+                    items = run(ctx);
+                    bench.stop();
+                }
+                double median = bench.median();
+                auto range = bench.range();
+                fprintf(stderr, "%-12s %-9s ", format->name, kOperationNames[op]);
+                bench.printReport();
+
+                out.writeKey(fleece::slice(kOperationNames[op]));
+                out.beginDict();
+                out["items"_sl] = (unsigned long long)items;
+                out["median_ns"_sl] = median * 1e9;
+                out["mean_ns"_sl] = bench.average() * 1e9;
+                out["stddev_ns"_sl] = bench.stddev() * 1e9;
+                out["min_ns"_sl] = range.first * 1e9;
+                out["max_ns"_sl] = range.second * 1e9;
+                out["ns_per_item"_sl] = median * 1e9 / double(max(items, size_t(1)));
+                out.endDict();
+            }
+            out.endDict();
+        }
+        out.endArray();
+        out.endDict();
+        alloc_slice result = out.finish();
+
+        FILE *file = outPath ? fopen(outPath, "w") : stdout;
+        if (!file) {
+            fprintf(stderr, "Can't open %s: %s\n", outPath, strerror(errno));
+            return 1;
+        }
+        fwrite(result.buf, 1, result.size, file);
+        fputc('\n', file);
+        if (outPath)
+            fclose(file);
+        return 0;
+    } catch (const exception &x) {
+        fprintf(stderr, "Error: %s\n", x.what());
+        return 1;
+    }
+}
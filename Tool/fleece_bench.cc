@@ -0,0 +1,714 @@
+//
+// fleece_bench.cc
+//
+// Copyright (c) 2026 Couchbase, Inc All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "fleece/Fleece.hh"
+#include "fleece/Mutable.hh"
+#include "HashTree.hh"
+#include "MutableHashTree.hh"
+#include "ConcurrentMap.hh"
+#include "Benchmark.hh"
+#include <atomic>
+#include <errno.h>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace fleece;
+using namespace std;
+
+
+// Runs reproducible workloads over a synthetic dataset and writes the timings as JSON, so that
+// results from different builds or releases can be compared by a script.
+
+
+static void usage(void) {
+    fprintf(stderr, "usage: fleece_bench [options] [workload ...]\n");
+    fprintf(stderr, "  --shape S        Dataset shape: people (default), wide or deep\n");
+    fprintf(stderr, "  --records N      Number of records in the dataset (default 1000)\n");
+    fprintf(stderr, "  --seed N         Random seed for the dataset (default 1)\n");
+    fprintf(stderr, "  --iterations N   Timed runs of each workload (default 20)\n");
+    fprintf(stderr, "  --threads N      Most threads to run the mt_ workloads on (default: # of cores)\n");
+    fprintf(stderr, "  --out FILE       Writes the JSON results to FILE instead of stdout\n");
+    fprintf(stderr, "  --list           Lists the workloads\n");
+    fprintf(stderr, "  Runs all workloads unless some are named. A summary goes to stderr.\n");
+}
+
+
+#pragma mark - DATASET:
+
+
+// A small, fast PRNG (splitmix64), so the dataset is the same on every platform.
+class Random {
+public:
+    explicit Random(uint64_t seed)          :_state(seed) { }
+
+    uint64_t next() {
+        uint64_t z = (_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    uint64_t below(uint64_t n)              {return next() % n;}
+    double fraction()                       {return (next() >> 11) * 0x1.0p-53;}
+
+    string word() {
+        static const char* const kSyllables[] = {"ka", "lo", "mi", "ne", "ru", "sa", "ti",
+                                                 "vo", "an", "el", "or", "ush", "qua", "ber"};
+        string w;
+        for (auto n = 2 + below(3); n > 0; --n)
+            w += kSyllables[below(sizeof(kSyllables) / sizeof(kSyllables[0]))];
+        return w;
+    }
+
+    string hex(size_t digits) {
+        string s;
+        while (s.size() < digits)
+            s += "0123456789abcdef"[below(16)];
+        return s;
+    }
+
+private:
+    uint64_t _state;
+};
+
+
+enum class Shape {people, wide, deep};
+
+
+struct Dataset {
+    Shape    shape {Shape::people};
+    unsigned records {1000};
+    uint64_t seed {1};
+
+    // Writes the dataset to an encoder, which may be a JSONEncoder. Always writes the same data.
+    void write(Encoder &enc) const {
+        Random rnd(seed);
+        switch (shape) {
+            case Shape::people:
+                // An array of records with the same schema, like a query result:
+                enc.beginArray(records);
+                for (unsigned i = 0; i < records; ++i)
+                    writePerson(enc, i, rnd);
+                enc.endArray();
+                break;
+            case Shape::wide:
+                // One big dict of unrelated properties:
+                enc.beginDict(records);
+                for (unsigned i = 0; i < records; ++i) {
+                    enc.writeKey("prop" + to_string(i));
+                    switch (rnd.below(3)) {
+                        case 0:  enc.writeInt(int64_t(rnd.below(1000000))); break;
+                        case 1:  enc.writeDouble(rnd.fraction() * 1000); break;
+                        default: enc.writeString(rnd.word() + " " + rnd.word()); break;
+                    }
+                }
+                enc.endDict();
+                break;
+            case Shape::deep:
+                // An array of records, each a chain of nested dicts and arrays:
+                enc.beginArray(records);
+                for (unsigned i = 0; i < records; ++i)
+                    writeNested(enc, 8, rnd);
+                enc.endArray();
+                break;
+        }
+    }
+
+    alloc_slice fleece() const {
+        Encoder enc;
+        write(enc);
+        return enc.finish();
+    }
+
+    alloc_slice json() const {
+        JSONEncoder enc;
+        write(enc);
+        return enc.finish();
+    }
+
+    const char* shapeName() const {
+        switch (shape) {
+            case Shape::people: return "people";
+            case Shape::wide:   return "wide";
+            default:            return "deep";
+        }
+    }
+
+private:
+    static void writePerson(Encoder &enc, unsigned i, Random &rnd) {
+        enc.beginDict(10);
+        enc["id"_sl] = i;
+        enc["guid"_sl] = rnd.hex(32);
+        enc["name"_sl] = rnd.word() + " " + rnd.word();
+        enc["age"_sl] = int(18 + rnd.below(70));
+        enc["balance"_sl] = rnd.fraction() * 10000;
+        enc.writeKey("isActive"_sl);
+        enc.writeBool(rnd.below(2));
+        enc.writeKey("tags"_sl);
+        enc.beginArray();
+        for (auto n = 2 + rnd.below(6); n > 0; --n)
+            enc.writeString(rnd.word());
+        enc.endArray();
+        enc.writeKey("address"_sl);
+        enc.beginDict(3);
+        enc["street"_sl] = to_string(1 + rnd.below(999)) + " " + rnd.word() + " Street";
+        enc["city"_sl] = rnd.word();
+        enc["zip"_sl] = int(10000 + rnd.below(90000));
+        enc.endDict();
+        enc.writeKey("friends"_sl);
+        enc.beginArray(3);
+        for (int f = 0; f < 3; ++f) {
+            enc.beginDict(2);
+            enc["id"_sl] = int(rnd.below(1000));
+            enc["name"_sl] = rnd.word() + " " + rnd.word();
+            enc.endDict();
+        }
+        enc.endArray();
+        enc["registered"_sl] = "20" + to_string(10 + rnd.below(16)) + "-0"
+                                    + to_string(1 + rnd.below(9)) + "-1" + to_string(rnd.below(10));
+        enc.endDict();
+    }
+
+    static void writeNested(Encoder &enc, int depth, Random &rnd) {
+        enc.beginDict(4);
+        enc["level"_sl] = depth;
+        enc["name"_sl] = rnd.word();
+        enc.writeKey("values"_sl);
+        enc.beginArray(3);
+        for (int v = 0; v < 3; ++v)
+            enc.writeInt(int64_t(rnd.below(1000)));
+        enc.endArray();
+        if (depth > 0) {
+            enc.writeKey("child"_sl);
+            writeNested(enc, depth - 1, rnd);
+        }
+        enc.endDict();
+    }
+};
+
+
+#pragma mark - WORKLOADS:
+
+
+// The state shared by the workloads, set up before any of them is timed.
+struct Context {
+    Dataset     dataset;
+    alloc_slice fleeceData, jsonData;
+    Doc         doc;
+    Value       root;
+    vector<Value> items;                        // Root Array's items or root Dict's values
+    vector<pair<Dict, alloc_slice>> lookups;    // Dict + key, for every dict entry (sampled)
+    vector<KeyPath> paths;                      // Paths of sampled leaf values
+    Doc         editedDoc;                      // Copy of the data with every 10th item changed
+    alloc_slice delta;                          // JSON delta from doc to editedDoc
+    vector<alloc_slice> treeKeys;               // Keys of `items` in a HashTree
+    alloc_slice treeData;                       // Encoded HashTree of `items`
+    SharedKeys  sharedKeys;                     // Shared by all the mt_ workloads' threads
+    alloc_slice sharedKeysData;                 // The data encoded with `sharedKeys`
+    Doc         sharedKeysDoc;
+    vector<pair<Dict, alloc_slice>> sharedKeysLookups;  // Like `lookups`, in sharedKeysDoc
+    ConcurrentMap map;                          // Contains the lookups' keys
+    ConcurrentArena arena;                      // Allocated from by mt_arena_alloc
+    ConcurrentArena bufferedArena;              // Same, but with thread buffers
+
+    static constexpr size_t kMaxLookups = 10000;
+
+    explicit Context(const Dataset &ds)
+    :dataset(ds)
+    ,fleeceData(ds.fleece())
+    ,jsonData(ds.json())
+    ,doc(fleeceData, kFLTrusted)
+    ,root(doc.root())
+    ,sharedKeys(SharedKeys::create())
+    ,map(int(kMaxLookups))
+    ,arena(64 * 1024, true)
+    ,bufferedArena(64 * 1024, true, 4096)
+    {
+        if (Array a = root.asArray(); a) {
+            for (Array::iterator i(a); i; ++i)
+                items.push_back(i.value());
+        } else {
+            for (Dict::iterator i(root.asDict()); i; ++i)
+                items.push_back(i.value());
+        }
+
+        // Sample the entries and leaves to look up, at most about 10,000 of each:
+        lookups = sampleLookups(root);
+        size_t leaves = 0;
+        for (DeepIterator i(root); i; ++i) {
+            if (i.value().type() < kFLArray)
+                ++leaves;
+        }
+        size_t leafStep = max(leaves / kMaxLookups, size_t(1));
+        leaves = 0;
+        for (DeepIterator i(root); i; ++i) {
+            if (i.value().type() < kFLArray && leaves++ % leafStep == 0) {
+                FLError error;
+                KeyPath path(i.pathString(), &error);
+                if (!path)
+                    throw runtime_error("can't compile path " + string(i.pathString()));
+                paths.push_back(move(path));
+            }
+        }
+
+        editedDoc = edit();
+        delta = JSONDelta::create(root, editedDoc.root());
+
+        for (size_t i = 0; i < items.size(); ++i)
+            treeKeys.emplace_back("record-" + to_string(i));
+        MutableHashTree tree;
+        insertTree(tree);
+        treeData = encodeTree(tree);
+
+        Encoder enc(sharedKeys);
+        dataset.write(enc);
+        sharedKeysData = enc.finish();
+        sharedKeysDoc = Doc(sharedKeysData, kFLTrusted, sharedKeys);
+        sharedKeysLookups = sampleLookups(sharedKeysDoc.root());
+
+        for (auto &lookup : lookups)
+            map.insert(lookup.second, ConcurrentMap::value_t(map.count()));
+    }
+
+    // Returns the Dicts and keys of up to about kMaxLookups entries in the data.
+    static vector<pair<Dict, alloc_slice>> sampleLookups(Value root) {
+        size_t entries = 0;
+        for (DeepIterator i(root); i; ++i) {
+            if (i.key())
+                ++entries;
+        }
+        size_t step = max(entries / kMaxLookups, size_t(1));
+        vector<pair<Dict, alloc_slice>> result;
+        entries = 0;
+        for (DeepIterator i(root); i; ++i) {
+            if (i.key() && entries++ % step == 0)
+                result.emplace_back(i.parent().asDict(), alloc_slice(i.key()));
+        }
+        return result;
+    }
+
+    // Copies the data, changing every 10th item, and returns the copy re-encoded.
+    Doc edit() const {
+        if (Array a = root.asArray(); a) {
+            MutableArray ma = a.mutableCopy();
+            for (uint32_t i = 0; i < ma.count(); i += 10) {
+                if (MutableDict d = ma.getMutableDict(i); d)
+                    d["edited"_sl] = int(i);
+                else
+                    ma[i] = int(i);
+            }
+            Encoder enc;
+            enc.writeValue(ma);
+            return enc.finishDoc();
+        } else {
+            MutableDict md = root.asDict().mutableCopy();
+            uint32_t n = 0;
+            for (Dict::iterator i(root.asDict()); i; ++i, ++n) {
+                if (n % 10 == 0)
+                    md[i.keyString()] = int(n);
+            }
+            Encoder enc;
+            enc.writeValue(md);
+            return enc.finishDoc();
+        }
+    }
+
+    void insertTree(MutableHashTree &tree) const {
+        for (size_t i = 0; i < items.size(); ++i)
+            tree.set(treeKeys[i], items[i]);
+    }
+
+    static alloc_slice encodeTree(MutableHashTree &tree) {
+        Encoder enc;
+        enc.suppressTrailer();
+        tree.writeTo(enc);
+        return enc.finish();
+    }
+};
+
+
+// A workload runs once per timed iteration and returns the number of operations it did.
+struct Workload {
+    const char *name;
+    const char *description;
+    function<size_t(Context&)> run;
+};
+
+
+// Keeps the compiler from optimizing away a result that's otherwise unused.
+static volatile uintptr_t sSink;
+template <class T> static void consume(T value)     {sSink = sSink + uintptr_t(value);}
+
+
+static const vector<Workload> kWorkloads = {
+    {"encode", "Encode the dataset to Fleece", [](Context &ctx) {
+        Encoder enc;
+        ctx.dataset.write(enc);
+        consume(enc.finish().size);
+        return size_t(ctx.dataset.records);
+    }},
+    {"json_to_fleece", "Convert the dataset's JSON to Fleece", [](Context &ctx) {
+        Encoder enc;
+        enc.convertJSON(ctx.jsonData);
+        consume(enc.finish().size);
+        return size_t(ctx.dataset.records);
+    }},
+    {"fleece_to_json", "Convert the Fleece data to JSON", [](Context &ctx) {
+        consume(ctx.root.toJSON().size);
+        return size_t(ctx.dataset.records);
+    }},
+    {"validate", "Validate the untrusted Fleece data", [](Context &ctx) {
+        if (!Value::fromData(ctx.fleeceData, kFLUntrusted))
+            throw runtime_error("data is invalid");
+        return size_t(ctx.dataset.records);
+    }},
+    {"dict_lookup", "Look up keys in Dicts", [](Context &ctx) {
+        for (auto &lookup : ctx.lookups)
+            consume(FLValue(lookup.first.get(lookup.second)));
+        return ctx.lookups.size();
+    }},
+    {"path_eval", "Evaluate KeyPaths from the root", [](Context &ctx) {
+        for (auto &path : ctx.paths)
+            consume(FLValue(path.eval(ctx.root)));
+        return ctx.paths.size();
+    }},
+    {"deep_iterate", "Iterate every Value with a DeepIterator", [](Context &ctx) {
+        size_t n = 0;
+        for (DeepIterator i(ctx.root); i; ++i)
+            ++n;
+        return n;
+    }},
+    {"mutable_edit", "Copy, edit and re-encode the data", [](Context &ctx) {
+        consume(ctx.edit().data().size);
+        return ctx.items.size();
+    }},
+    {"delta_create", "Create a JSON delta of the edits", [](Context &ctx) {
+        consume(JSONDelta::create(ctx.root, ctx.editedDoc.root()).size);
+        return ctx.items.size();
+    }},
+    {"delta_apply", "Apply the JSON delta of the edits", [](Context &ctx) {
+        alloc_slice result = JSONDelta::apply(ctx.root, ctx.delta, nullptr);
+        if (!result)
+            throw runtime_error("couldn't apply delta");
+        return ctx.items.size();
+    }},
+    {"hashtree_insert", "Insert the records into a MutableHashTree", [](Context &ctx) {
+        MutableHashTree tree;
+        ctx.insertTree(tree);
+        consume(tree.count());
+        return ctx.items.size();
+    }},
+    {"hashtree_encode", "Insert the records into a MutableHashTree and encode it", [](Context &ctx) {
+        MutableHashTree tree;
+        ctx.insertTree(tree);
+        consume(Context::encodeTree(tree).size);
+        return ctx.items.size();
+    }},
+    {"hashtree_lookup", "Look up every record in an encoded HashTree", [](Context &ctx) {
+        const HashTree *tree = HashTree::fromData(ctx.treeData);
+        for (auto &key : ctx.treeKeys)
+            consume(FLValue(tree->get(key)));
+        return ctx.treeKeys.size();
+    }},
+};
+
+
+// A workload that's run on multiple threads at once, to measure how it scales. Each thread
+// calls `run` with its index, which returns the number of operations it did.
+struct ThreadedWorkload {
+    const char *name;
+    const char *description;
+    function<size_t(Context&, unsigned thread)> run;
+};
+
+
+// Allocates small blocks from an arena, as a HeapDict or ConcurrentMap would for keys.
+static size_t allocateBlocks(ConcurrentArena &arena) {
+    static constexpr size_t kCount = 10000;
+    for (size_t i = 0; i < kCount; ++i) {
+        auto block = (char*)arena.alloc(8 + i % 16);
+        if (!block)
+            throw runtime_error("arena is full");
+        block[0] = char(i);
+    }
+    return kCount;
+}
+
+
+static const vector<ThreadedWorkload> kThreadedWorkloads = {
+    {"mt_encode_shared_keys", "Encode the dataset with one SharedKeys", [](Context &ctx, unsigned) {
+        Encoder enc(ctx.sharedKeys);
+        ctx.dataset.write(enc);
+        consume(enc.finish().size);
+        return size_t(ctx.dataset.records);
+    }},
+    {"mt_doc_open", "Open and close Docs on the same data", [](Context &ctx, unsigned) {
+        static constexpr size_t kCount = 1000;
+        for (size_t i = 0; i < kCount; ++i) {
+            Doc doc(ctx.sharedKeysData, kFLTrusted, ctx.sharedKeys);
+            consume(FLValue(doc.root()));
+        }
+        return kCount;
+    }},
+    {"mt_dict_get_shared", "Look up string keys in Dicts with SharedKeys", [](Context &ctx, unsigned) {
+        for (auto &lookup : ctx.sharedKeysLookups)
+            consume(FLValue(lookup.first.get(lookup.second)));
+        return ctx.sharedKeysLookups.size();
+    }},
+    {"mt_retain_release", "Retain and release the same Doc", [](Context &ctx, unsigned) {
+        static constexpr size_t kCount = 100000;
+        for (size_t i = 0; i < kCount; ++i)
+            FLDoc_Release(FLDoc_Retain(ctx.sharedKeysDoc));
+        return kCount;
+    }},
+    {"mt_concurrent_map", "Find keys in a ConcurrentMap", [](Context &ctx, unsigned) {
+        for (auto &lookup : ctx.lookups)
+            consume(ctx.map.find(lookup.second).value);
+        return ctx.lookups.size();
+    }},
+    {"mt_arena_alloc", "Allocate small blocks from one ConcurrentArena", [](Context &ctx, unsigned) {
+        return allocateBlocks(ctx.arena);
+    }},
+    {"mt_arena_buffered", "Same, with thread buffers", [](Context &ctx, unsigned) {
+        return allocateBlocks(ctx.bufferedArena);
+    }},
+};
+
+
+// Starts `nThreads` threads running a workload, and times them from when they're all released at
+// once until the last has finished. Returns the total number of operations.
+static size_t runThreads(const ThreadedWorkload &w, Context &ctx, unsigned nThreads,
+                         Benchmark &bench)
+{
+    atomic<unsigned> ready {0};
+    atomic<bool> go {false};
+    atomic<size_t> ops {0};
+    exception_ptr error;
+    mutex errorMutex;
+    vector<thread> threads;
+    for (unsigned t = 0; t < nThreads; ++t) {
+        threads.emplace_back([&, t] {
+            ++ready;
+            while (!go.load(memory_order_acquire))
+                this_thread::yield();
+            try {
+                ops += w.run(ctx, t);
+            } catch (...) {
+                lock_guard<mutex> lock(errorMutex);
+                error = current_exception();
+            }
+        });
+    }
+    while (ready < nThreads)
+        this_thread::yield();
+    bench.start();
+    go.store(true, memory_order_release);
+    for (auto &thread : threads)
+        thread.join();
+    bench.stop();
+    if (error)
+        rethrow_exception(error);
+    return ops;
+}
+
+
+#pragma mark - MAIN:
+
+
+static bool parseNumber(const char *str, uint64_t &n) {
+    char *end;
+    n = strtoull(str, &end, 10);
+    return *str && *end == '\0';
+}
+
+
+int main(int argc, const char * argv[]) {
+    Dataset dataset;
+    unsigned iterations = 20;
+    unsigned maxThreads = max(thread::hardware_concurrency(), 1u);
+    const char *outPath = nullptr;
+    vector<const Workload*> selected;
+    vector<const ThreadedWorkload*> selectedThreaded;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            uint64_t n;
+            if (arg == "--list") {
+                for (auto &w : kWorkloads)
+                    fprintf(stdout, "%-22s %s\n", w.name, w.description);
+                for (auto &w : kThreadedWorkloads)
+                    fprintf(stdout, "%-22s %s, on 1..N threads\n", w.name, w.description);
+                return 0;
+            } else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0 && i + 1 < argc) {
+                const char *value = argv[++i];
+                if (arg == "--shape" && strcmp(value, "people") == 0)
+                    dataset.shape = Shape::people;
+                else if (arg == "--shape" && strcmp(value, "wide") == 0)
+                    dataset.shape = Shape::wide;
+                else if (arg == "--shape" && strcmp(value, "deep") == 0)
+                    dataset.shape = Shape::deep;
+                else if (arg == "--records" && parseNumber(value, n) && n > 0 && n <= UINT32_MAX)
+                    dataset.records = unsigned(n);
+                else if (arg == "--seed" && parseNumber(value, n))
+                    dataset.seed = n;
+                else if (arg == "--iterations" && parseNumber(value, n) && n > 0 && n <= 100000)
+                    iterations = unsigned(n);
+                else if (arg == "--threads" && parseNumber(value, n) && n > 0 && n <= 256)
+                    maxThreads = unsigned(n);
+                else if (arg == "--out")
+                    outPath = value;
+                else {
+                    usage();
+                    return 1;
+                }
+            } else {
+                auto w = find_if(kWorkloads.begin(), kWorkloads.end(),
+                                 [&](const Workload &w) {return arg == w.name;});
+                auto tw = find_if(kThreadedWorkloads.begin(), kThreadedWorkloads.end(),
+                                  [&](const ThreadedWorkload &w) {return arg == w.name;});
+                if (w != kWorkloads.end()) {
+                    selected.push_back(&*w);
+                } else if (tw != kThreadedWorkloads.end()) {
+                    selectedThreaded.push_back(&*tw);
+                } else {
+                    usage();
+                    return 1;
+                }
+            }
+        }
+        if (selected.empty() && selectedThreaded.empty()) {
+            for (auto &w : kWorkloads)
+                selected.push_back(&w);
+            for (auto &w : kThreadedWorkloads)
+                selectedThreaded.push_back(&w);
+        }
+
+        fprintf(stderr, "Setting up %u '%s' records...\n", dataset.records, dataset.shapeName());
+        Context ctx(dataset);
+
+        JSONEncoder out;
+        out.beginDict();
+        out["benchmark"_sl] = "fleece_bench";
+#ifdef NDEBUG
+        out["optimized"_sl] = true;
+#else
+        out["optimized"_sl] = false;
+#endif
+        out.writeKey("dataset"_sl);
+        out.beginDict();
+        out["shape"_sl] = dataset.shapeName();
+        out["records"_sl] = dataset.records;
+        out["seed"_sl] = (unsigned long long)dataset.seed;
+        out["fleece_size"_sl] = (unsigned long long)ctx.fleeceData.size;
+        out["json_size"_sl] = (unsigned long long)ctx.jsonData.size;
+        out.endDict();
+        out["iterations"_sl] = iterations;
+        out.writeKey("results"_sl);
+        out.beginArray();
+        for (auto w : selected) {
+            Benchmark bench;
+            size_t ops = w->run(ctx);                   // warm-up
+            for (unsigned i = 0; i < iterations; ++i) {
+                bench.start();
+                w->run(ctx);
+                bench.stop();
+            }
+            double median = bench.median();
+            auto range = bench.range();
+            fprintf(stderr, "%-22s ", w->name);
+            bench.printReport();
+
+            out.beginDict();
+            out["name"_sl] = w->name;
+            out["ops"_sl] = (unsigned long long)ops;
+            out["median_ns"_sl] = median * 1e9;
+            out["mean_ns"_sl] = bench.average() * 1e9;
+            out["stddev_ns"_sl] = bench.stddev() * 1e9;
+            out["min_ns"_sl] = range.first * 1e9;
+            out["max_ns"_sl] = range.second * 1e9;
+            out["ns_per_op"_sl] = median * 1e9 / double(max(ops, size_t(1)));
+            out.endDict();
+        }
+        out.endArray();
+
+        // Threaded workloads are run on 1, 2, 4... threads, up to maxThreads, and report their
+        // throughput and its speedup over one thread:
+        vector<unsigned> threadCounts;
+        for (unsigned n = 1; n < maxThreads; n *= 2)
+            threadCounts.push_back(n);
+        threadCounts.push_back(maxThreads);
+        out["max_threads"_sl] = maxThreads;
+        out.writeKey("scaling"_sl);
+        out.beginArray();
+        for (auto w : selectedThreaded) {
+            out.beginDict();
+            out["name"_sl] = w->name;
+            out.writeKey("runs"_sl);
+            out.beginArray();
+            double baseThroughput = 0;
+            for (unsigned nThreads : threadCounts) {
+                Benchmark warmup, bench;
+                size_t ops = runThreads(*w, ctx, nThreads, warmup);
+                for (unsigned i = 0; i < iterations; ++i)
+                    runThreads(*w, ctx, nThreads, bench);
+                double median = bench.median();
+                double throughput = double(ops) / median;
+                if (nThreads == 1)
+                    baseThroughput = throughput;
+                fprintf(stderr, "%-22s %3u threads: %12.0f ops/sec, speedup %5.2f\n",
+                        w->name, nThreads, throughput, throughput / baseThroughput);
+
+                out.beginDict();
+                out["threads"_sl] = nThreads;
+                out["ops"_sl] = (unsigned long long)ops;
+                out["median_ns"_sl] = median * 1e9;
+                out["stddev_ns"_sl] = bench.stddev() * 1e9;
+                out["ops_per_sec"_sl] = throughput;
+                out["speedup"_sl] = throughput / baseThroughput;
+                out.endDict();
+            }
+            out.endArray();
+            out.endDict();
+        }
+        out.endArray();
+        out.endDict();
+        alloc_slice json = out.finish();
+
+        FILE *file = outPath ? fopen(outPath, "w") : stdout;
+        if (!file) {
+            fprintf(stderr, "Can't open %s: %s\n", outPath, strerror(errno));
+            return 1;
+        }
+        fwrite(json.buf, 1, json.size, file);
+        fputc('\n', file);
+        if (outPath)
+            fclose(file);
+        return 0;
+    } catch (const exception &x) {
+        fprintf(stderr, "Error: %s\n", x.what());
+        return 1;
+    }
+}
@@ -18,8 +18,17 @@
 
 #include "fleece/Fleece.hh"
 #include <stdio.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
 #ifndef _MSC_VER
 #include <unistd.h>
 #define _isatty isatty
@@ -38,7 +47,19 @@ static void usage(void) {
     fprintf(stderr, "usage: fleece [--hex] encode [JSON file]\n");
     fprintf(stderr, "       fleece [--hex] decode [Fleece file]\n");
     fprintf(stderr, "       fleece dump [Fleece file]\n");
+    fprintf(stderr, "       fleece [--hex] compact [Fleece file]\n");
+    fprintf(stderr, "       fleece [--hex] [--ndjson] [--sharedkeys FILE] stats [Fleece file|dir...]\n");
     fprintf(stderr, "  Reads stdin unless a file is given; always writes to stdout.\n");
+    fprintf(stderr, "  'compact' writes the live (reachable) data, and reports the dead bytes to stderr.\n");
+    fprintf(stderr, "  'stats' reports where the bytes of the documents go, over all the inputs.\n");
+    fprintf(stderr, "Batch mode: fleece [--hex] [--ndjson] [--jobs N] [--sharedkeys FILE] encode|decode FILE|DIR...\n");
+    fprintf(stderr, "  Converts many documents, in parallel, writing the results in input order.\n");
+    fprintf(stderr, "  Each file (or each file in a directory) is a document, or with --ndjson a stream\n");
+    fprintf(stderr, "  of them: a JSON object per line, or Fleece records. A Fleece record is its size\n");
+    fprintf(stderr, "  as a 32-bit big-endian integer followed by the data, or with --hex a line of hex.\n");
+    fprintf(stderr, "  --jobs sets the number of threads (default: one per CPU core.)\n");
+    fprintf(stderr, "  --sharedkeys uses a SharedKeys state file for all the documents. 'encode' loads\n");
+    fprintf(stderr, "  it if it exists and saves the updated state to it afterwards.\n");
 }
 
 
@@ -118,9 +139,377 @@ static void writeOutput(slice output, bool asHex =false) {
 }
 
 
+#pragma mark - BATCH MODE:
+
+
+static constexpr size_t kChunkRecords = 256;            // Max records converted as one task
+static constexpr size_t kChunkBytes = 1 << 20;          // Max input bytes in one task
+static constexpr size_t kMaxRecordSize = 1u << 30;      // Sanity limit on a Fleece record's size
+
+
+// A run of consecutive records, converted together by one worker thread.
+struct Chunk {
+    size_t                  firstRecord;
+    vector<alloc_slice>     records;
+    vector<alloc_slice>     results;
+    string                  error;          // Error converting a record, if any
+    size_t                  errorRecord {0};
+    bool                    done {false};
+};
+
+
+// Reads records from a series of input files (or stdin.)
+class RecordReader {
+public:
+    RecordReader(vector<string> paths, bool streams, bool hex, bool fleeceRecords)
+    :_paths(move(paths)), _streams(streams), _hex(hex), _fleeceRecords(fleeceRecords)
+    {
+        if (_paths.empty())
+            _in = stdin;
+    }
+
+    RecordReader(const RecordReader&) =delete;
+
+    ~RecordReader() {
+        if (_in && _in != stdin)
+            fclose(_in);
+    }
+
+    // Reads the next record, returning a null slice at the end of the input.
+    alloc_slice next() {
+        while (true) {
+            if (!_in) {
+                if (_nextPath >= _paths.size())
+                    return nullslice;
+                const string &path = _paths[_nextPath++];
+                _in = fopen(path.c_str(), "rb");
+                if (!_in)
+                    throw runtime_error("Couldn't open file " + path);
+                _recordInFile = 0;
+            }
+            ++_recordInFile;
+            alloc_slice record;
+            if (!_streams) {
+                record = readInput(_in, _hex && _fleeceRecords);
+                closeInput();
+                return record;
+            } else if (_fleeceRecords && !_hex) {
+                record = readFramed();
+            } else {
+                record = readLine();
+                if (record && _hex && _fleeceRecords) {
+                    size_t n = decodeHex((uint8_t*)record.buf, record.size);
+                    if (n == 0)
+                        throw "Invalid hex input";
+                    record.shorten(n);
+                }
+            }
+            if (record)
+                return record;
+            closeInput();
+        }
+    }
+
+    // A name for the last record read: its file's path, plus its index if it's in a stream.
+    string label() const {
+        string label = _in == stdin || _nextPath == 0 ? "stdin" : _paths[_nextPath - 1];
+        if (_streams)
+            label += "#" + to_string(_recordInFile);
+        return label;
+    }
+
+private:
+    void closeInput() {
+        if (_in != stdin)
+            fclose(_in);
+        _in = nullptr;
+    }
+
+    // Reads a line, skipping blank ones; returns null at EOF.
+    alloc_slice readLine() {
+        _line.clear();
+        char buf[4096];
+        while (fgets(buf, sizeof(buf), _in)) {
+            _line += buf;
+            if (_line.back() == '\n') {
+                while (!_line.empty() && isspace((unsigned char)_line.back()))
+                    _line.pop_back();
+                if (!_line.empty())
+                    return alloc_slice(_line);
+            }
+        }
+        if (ferror(_in))
+            throw "Error reading input";
+        while (!_line.empty() && isspace((unsigned char)_line.back()))
+            _line.pop_back();
+        return _line.empty() ? alloc_slice() : alloc_slice(_line);
+    }
+
+    // Reads a size-prefixed binary Fleece record; returns null at EOF.
+    alloc_slice readFramed() {
+        uint8_t header[4];
+        size_t n = fread(header, 1, 4, _in);
+        if (n == 0 && !ferror(_in))
+            return nullslice;
+        if (n != 4)
+            throw "Truncated Fleece record";
+        size_t size = (size_t(header[0]) << 24) | (size_t(header[1]) << 16)
+                    | (size_t(header[2]) << 8)  |  size_t(header[3]);
+        if (size == 0 || size > kMaxRecordSize)
+            throw "Invalid Fleece record size";
+        alloc_slice record(size);
+        if (fread((void*)record.buf, 1, size, _in) != size)
+            throw "Truncated Fleece record";
+        return record;
+    }
+
+    vector<string> const _paths;
+    size_t _nextPath {0};
+    bool const _streams, _hex, _fleeceRecords;
+    FILE* _in {nullptr};
+    size_t _recordInFile {0};
+    string _line;
+};
+
+
+// Converts chunks of records on a pool of threads, each with its own Encoder.
+class BatchConverter {
+public:
+    BatchConverter(bool encode, SharedKeys sk, unsigned jobs)
+    :_encode(encode), _sharedKeys(sk)
+    {
+        for (unsigned i = 0; i < jobs; ++i)
+            _threads.emplace_back([this] {run();});
+    }
+
+    ~BatchConverter() {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _stopping = true;
+            _queue.clear();
+        }
+        _cond.notify_all();
+        for (auto &t : _threads)
+            t.join();
+    }
+
+    void submit(Chunk *chunk) {
+        {
+            lock_guard<mutex> lock(_mutex);
+            _queue.push_back(chunk);
+        }
+        _cond.notify_all();
+    }
+
+    void wait(Chunk *chunk) {
+        unique_lock<mutex> lock(_mutex);
+        _doneCond.wait(lock, [&] {return chunk->done;});
+    }
+
+private:
+    void run() {
+        Encoder enc;
+        if (_encode && _sharedKeys)
+            enc.setSharedKeys(_sharedKeys);
+        while (true) {
+            Chunk *chunk;
+            {
+                unique_lock<mutex> lock(_mutex);
+                _cond.wait(lock, [&] {return _stopping || !_queue.empty();});
+                if (_stopping)
+                    return;
+                chunk = _queue.front();
+                _queue.pop_front();
+            }
+            convert(*chunk, enc);
+            {
+                lock_guard<mutex> lock(_mutex);
+                chunk->done = true;
+            }
+            _doneCond.notify_all();
+        }
+    }
+
+    void convert(Chunk &chunk, Encoder &enc) {
+        chunk.results.reserve(chunk.records.size());
+        for (size_t i = 0; i < chunk.records.size(); ++i) {
+            alloc_slice result;
+            if (_encode) {
+                enc.reset();
+                if (enc.convertJSON(chunk.records[i]))
+                    result = enc.finish();
+                if (!result)
+                    chunk.error = string("Invalid JSON input: ") + enc.errorMessage();
+            } else {
+                Doc doc(chunk.records[i], kFLUntrusted, _sharedKeys);
+                if (doc)
+                    result = doc.root().toJSON();
+                else
+                    chunk.error = "Couldn't parse input as Fleece";
+            }
+            if (!result) {
+                chunk.errorRecord = chunk.firstRecord + i;
+                return;
+            }
+            chunk.results.push_back(move(result));
+        }
+    }
+
+    bool const _encode;
+    SharedKeys const _sharedKeys;
+    vector<thread> _threads;
+    mutex _mutex;
+    condition_variable _cond, _doneCond;
+    deque<Chunk*> _queue;
+    bool _stopping {false};
+};
+
+
+static void writeRecord(slice output, bool encode, bool hex) {
+    if (encode && !hex) {
+        uint8_t header[4] = {uint8_t(output.size >> 24), uint8_t(output.size >> 16),
+                             uint8_t(output.size >> 8),  uint8_t(output.size)};
+        fwrite(header, 1, 4, stdout);
+    }
+    writeOutput(output, encode && hex);
+    if (!encode || hex)
+        fputc('\n', stdout);
+}
+
+
+// Lists the input files: the files given, plus the regular files in directories given.
+static vector<string> expandInputs(const vector<string> &args) {
+    namespace fs = std::filesystem;
+    vector<string> paths;
+    for (auto &arg : args) {
+        if (fs::is_directory(arg)) {
+            vector<string> files;
+            for (auto &entry : fs::directory_iterator(arg)) {
+                if (entry.is_regular_file() && entry.path().filename().string()[0] != '.')
+                    files.push_back(entry.path().string());
+            }
+            sort(files.begin(), files.end());
+            paths.insert(paths.end(), files.begin(), files.end());
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    return paths;
+}
+
+
+// Loads a SharedKeys state file, if a path is given.
+static SharedKeys loadSharedKeys(const char *path, bool mustExist) {
+    SharedKeys sk;
+    if (path) {
+        sk = SharedKeys::create();
+        if (FILE *f = fopen(path, "rb")) {
+            alloc_slice state = readInput(f, false);
+            fclose(f);
+            if (!sk.loadState(state))
+                throw "Invalid SharedKeys state file";
+        } else if (mustExist) {
+            throw runtime_error(string("Couldn't open file ") + path);
+        }
+    }
+    return sk;
+}
+
+
+static int runBatch(bool encode, bool ndjson, bool hex, unsigned jobs,
+                    const char *sharedKeysPath, const vector<string> &args)
+{
+    if (args.empty() && !ndjson)
+        throw "Batch input from stdin requires --ndjson";
+    if (jobs == 0)
+        jobs = max(1u, thread::hardware_concurrency());
+
+    SharedKeys sk = loadSharedKeys(sharedKeysPath, !encode);
+
+    RecordReader reader(expandInputs(args), ndjson, hex, !encode);
+    deque<unique_ptr<Chunk>> pending;
+    size_t nRecords = 0;
+    {
+        BatchConverter converter(encode, sk, jobs);
+
+        // Writes the oldest chunk's results, once it's converted:
+        auto writeFirst = [&] {
+            Chunk *chunk = pending.front().get();
+            converter.wait(chunk);
+            for (auto &result : chunk->results)
+                writeRecord(result, encode, hex);
+            if (!chunk->error.empty())
+                throw runtime_error("Record " + to_string(chunk->errorRecord + 1) + ": "
+                                    + chunk->error);
+            pending.pop_front();
+        };
+
+        bool eof = false;
+        while (!eof) {
+            auto chunk = make_unique<Chunk>();
+            chunk->firstRecord = nRecords;
+            size_t bytes = 0;
+            while (chunk->records.size() < kChunkRecords && bytes < kChunkBytes) {
+                alloc_slice record = reader.next();
+                if (!record) {
+                    eof = true;
+                    break;
+                }
+                bytes += record.size;
+                chunk->records.push_back(move(record));
+            }
+            if (chunk->records.empty())
+                break;
+            nRecords += chunk->records.size();
+            converter.submit(chunk.get());
+            pending.push_back(move(chunk));
+            while (pending.size() > 2 * jobs)
+                writeFirst();
+        }
+        while (!pending.empty())
+            writeFirst();
+    }
+
+    if (sharedKeysPath && encode) {
+        FILE *f = fopen(sharedKeysPath, "wb");
+        if (!f)
+            throw runtime_error(string("Couldn't write file ") + sharedKeysPath);
+        alloc_slice state = sk.stateData();
+        bool ok = fwrite(state.buf, 1, state.size, f) == state.size;
+        if (fclose(f) != 0 || !ok)
+            throw runtime_error(string("Couldn't write file ") + sharedKeysPath);
+    }
+    fprintf(stderr, "Converted %zu records\n", nRecords);
+    return 0;
+}
+
+
+// Reports statistics about all the documents in the inputs.
+static int runStats(bool ndjson, bool hex, const char *sharedKeysPath, const vector<string> &args) {
+    SharedKeys sk = loadSharedKeys(sharedKeysPath, true);
+    unique_ptr<_FLDataStats, void(*)(FLDataStats)> stats(FLDataStats_New(20), FLDataStats_Free);
+    RecordReader reader(expandInputs(args), ndjson, hex, true);
+    size_t invalid = 0;
+    while (alloc_slice record = reader.next()) {
+        string label = reader.label();
+        if (!FLDataStats_Add(stats.get(), record, sk, slice(label))) {
+            fprintf(stderr, "%s: Couldn't parse input as Fleece\n", label.c_str());
+            ++invalid;
+        }
+    }
+    alloc_slice report(FLDataStats_Report(stats.get()));
+    writeOutput(report);
+    return invalid ? 1 : 0;
+}
+
+
 int main(int argc, const char * argv[]) {
     try {
-        bool encode = false, decode = false, dump = false, hex = false;
+        bool encode = false, decode = false, dump = false, compact = false, stats = false;
+        bool hex = false;
+        bool ndjson = false;
+        unsigned jobs = 0;
+        const char *sharedKeysPath = nullptr;
 
         int i;
         for (i = 1; i < argc; ++i) {
@@ -135,8 +524,18 @@ int main(int argc, const char * argv[]) {
                     decode = true;
                 } else if (strcmp(arg, "--dump") == 0) {
                     dump = true;
+                } else if (strcmp(arg, "--compact") == 0) {
+                    compact = true;
+                } else if (strcmp(arg, "--stats") == 0) {
+                    stats = true;
                 } else if (strcmp(arg, "--hex") == 0) {
                     hex = true;
+                } else if (strcmp(arg, "--ndjson") == 0) {
+                    ndjson = true;
+                } else if (strcmp(arg, "--jobs") == 0 && i + 1 < argc) {
+                    jobs = unsigned(strtoul(argv[++i], nullptr, 10));
+                } else if (strcmp(arg, "--sharedkeys") == 0 && i + 1 < argc) {
+                    sharedKeysPath = argv[++i];
                 } else if (strcmp(arg, "--help") == 0) {
                     usage();
                     return 0;
@@ -145,7 +544,7 @@ int main(int argc, const char * argv[]) {
                     usage();
                     return 1;
                 }
-            } else if (encode+decode+dump == 0) {
+            } else if (encode+decode+dump+compact+stats == 0) {
                 // Also allow mode without '--' prefix, if none was chosen yet:
                 if (strcmp(arg, "encode") == 0) {
                     encode = true;
@@ -153,6 +552,10 @@ int main(int argc, const char * argv[]) {
                     decode = true;
                 } else if (strcmp(arg, "dump") == 0) {
                     dump = true;
+                } else if (strcmp(arg, "compact") == 0) {
+                    compact = true;
+                } else if (strcmp(arg, "stats") == 0) {
+                    stats = true;
                 } else {
                     break;
                 }
@@ -161,15 +564,31 @@ int main(int argc, const char * argv[]) {
             }
         }
 
-        if (encode + decode + dump != 1) {
-            fprintf(stderr, "Choose one of --encode, --decode, or --dump\n");
+        if (encode + decode + dump + compact + stats != 1) {
+            fprintf(stderr, "Choose one of --encode, --decode, --dump, --compact, or --stats\n");
             usage();
             return 1;
         }
 
+        if (stats)
+            return runStats(ndjson, hex, sharedKeysPath, vector<string>(&argv[i], &argv[argc]));
+
+        bool batch = ndjson || sharedKeysPath || argc - i > 1
+                        || (i < argc && std::filesystem::is_directory(argv[i]));
+        if (batch) {
+            if (!encode && !decode)
+                throw "Batch mode only supports encode and decode";
+            if (encode && !hex && _isatty(STDOUT_FILENO))
+                throw "Let's not spew binary Fleece data to a terminal! Please redirect stdout.";
+            return runBatch(encode, ndjson, hex, jobs, sharedKeysPath,
+                            vector<string>(&argv[i], &argv[argc]));
+        }
+
         FILE *in = stdin;
+        const char *path = nullptr;
         if (i < argc) {
-            in = fopen(argv[i], "r");
+            path = argv[i];
+            in = fopen(path, "r");
             if (!in) {
                 fprintf(stderr, "Couldn't open file %s\n", argv[i]);
                 return 1;
@@ -183,9 +602,21 @@ int main(int argc, const char * argv[]) {
             return 1;
         }
 
-        if (encode && !hex && _isatty(STDOUT_FILENO))
+        if ((encode || compact) && !hex && _isatty(STDOUT_FILENO))
             throw "Let's not spew binary Fleece data to a terminal! Please redirect stdout.";
 
+        if (decode && !hex && path) {
+            // Decoding a file: map it instead of reading it all into memory.
+            fclose(in);
+            Doc doc = Doc::fromMappedFile(path);
+            if (!doc)
+                throw "Couldn't parse input as Fleece";
+            auto json = doc.root().toJSON();
+            writeOutput(json);
+            fprintf(stdout, "\n");
+            return 0;
+        }
+
         auto input = readInput(in, (decode && hex));
 
         if (encode) {
@@ -206,6 +637,16 @@ int main(int argc, const char * argv[]) {
             if (!output)
                 throw "Couldn't parse input as Fleece";
             writeOutput(output);
+        } else if (compact) {
+            size_t liveBytes;
+            FLError error;
+            alloc_slice output(FLData_Compact(input, nullptr, &liveBytes, &error));
+            if (!output)
+                throw (error == kFLInvalidData) ? "Couldn't parse input as Fleece"
+                                                : "Couldn't compact input (does it use shared keys?)";
+            fprintf(stderr, "%zu bytes: %zu live, %zu dead; compacted to %zu bytes\n",
+                    input.size, liveBytes, input.size - liveBytes, output.size);
+            writeOutput(output, hex);
         }
 
         return 0;
@@ -215,6 +656,7 @@ int main(int argc, const char * argv[]) {
         return 1;
     } catch (const std::exception &x) {
         fprintf(stderr, "%s\n", x.what());
+        return 1;
     } catch (...) {
         fprintf(stderr, "Uncaught exception!\n");
         return 1;
@@ -9,46 +9,78 @@ function(set_source_files_base)
         ${BASE_SSS_RESULT}
         Fleece/API_Impl/Fleece.cc
         Fleece/API_Impl/FLSlice.cc
+        Experimental/KeyTree.cc
+        Fleece/Core/AccessProfile.cc
+        Fleece/Core/Aggregates.cc
         Fleece/Core/Array.cc
+        Fleece/Core/ArraySort.cc
+        Fleece/Core/CBORConverter.cc
+        Fleece/Core/CollectionFile.cc
+        Fleece/Core/Columns.cc
+        Fleece/Core/CompressedDoc.cc
+        Fleece/Core/DataStats.cc
         Fleece/Core/DeepIterator.cc
         Fleece/Core/Dict.cc
         Fleece/Core/Doc.cc
+        Fleece/Core/DocCache.cc
+        Fleece/Core/DocTemplate.cc
         Fleece/Core/Encoder.cc
         Fleece/Core/JSONConverter.cc
         Fleece/Core/JSONDelta.cc
+        Fleece/Core/KeyTranscoder.cc
+        Fleece/Core/MsgPackConverter.cc
         Fleece/Core/Path.cc
         Fleece/Core/Pointer.cc
+        Fleece/Core/PostingList.cc
+        Fleece/Core/Predicate.cc
+        Fleece/Core/ProgressiveDoc.cc
+        Fleece/Core/ReplicatedDoc.cc
         Fleece/Core/SharedKeys.cc
+        Fleece/Core/SharedStrings.cc
         Fleece/Core/Value+Dump.cc
         Fleece/Core/Value.cc
         Fleece/Integration/MContext.cc
+        Fleece/Mutable/HeapArena.cc
         Fleece/Mutable/HeapArray.cc
         Fleece/Mutable/HeapDict.cc
         Fleece/Mutable/HeapValue.cc
         Fleece/Mutable/ValueSlot.cc
+        Fleece/Support/Allocator.cc
         Fleece/Support/Backtrace.cc
+        Fleece/Support/AsyncFileIO.cc
         Fleece/Support/Base64.cc
         Fleece/Support/betterassert.cc
         Fleece/Support/Bitmap.cc
+        Fleece/Support/ByteDiff.cc
         Fleece/Support/ConcurrentArena.cc
         Fleece/Support/ConcurrentMap.cc
+        Fleece/Support/Counters.cc
+        Fleece/Support/CPUFeatures.cc
+        Fleece/Support/CRC32C.cc
+        Fleece/Support/Executor.cc
         Fleece/Support/FileUtils.cc
         Fleece/Support/FleeceException.cc
         Fleece/Support/InstanceCounted.cc
+        Fleece/Support/InternedStrings.cc
         Fleece/Support/NumConversion.cc
         Fleece/Support/JSON5.cc
         Fleece/Support/JSONEncoder.cc
+        Fleece/Support/LZ4.cc
         Fleece/Support/LibC++Debug.cc
         Fleece/Support/ParseDate.cc
         Fleece/Support/RefCounted.cc
         Fleece/Support/slice_stream.cc
         Fleece/Support/sliceIO.cc
         Fleece/Support/StringTable.cc
+        Fleece/Support/Tracing.cc
+        Fleece/Support/UTF8.cc
         Fleece/Support/varint.cc
         Fleece/Support/Writer.cc
         Fleece/Tree/HashTree.cc
+        Fleece/Tree/IntHashTree.cc
         Fleece/Tree/MutableHashTree.cc
         Fleece/Tree/NodeRef.cc
+        Fleece/Tree/PathIndex.cc
         vendor/jsonsl/jsonsl.c
         vendor/libb64/cdecode.c
         vendor/libb64/cencode.c
@@ -78,7 +110,6 @@ function(set_test_source_files_base)
         Tests/SharedKeysTests.cc
         Tests/SupportTests.cc
         Tests/ValueTests.cc
-        Experimental/KeyTree.cc
         PARENT_SCOPE
     )
 endfunction()
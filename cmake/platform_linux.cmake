@@ -30,11 +30,13 @@ function(setup_build)
     target_link_libraries(
         FleeceBase INTERFACE
         dl
+        rt  # for shm_open, with glibc before 2.34
     )
 
     target_link_libraries(
         FleeceStatic INTERFACE
         dl
+        rt  # for shm_open, with glibc before 2.34
     )
 
     target_compile_definitions(